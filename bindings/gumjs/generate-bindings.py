@@ -12,7 +12,8 @@ def generate_and_write_bindings(source_dir, output_dir):
                                 'set_target_cpu', 'set_target_abi', 'set_target_os',
                                 'cur', 'offset', 'flush', 'get_cpu_register_for_nth_argument'] }),
         ("relocator", { 'ignore': ['new', 'ref', 'unref', 'init', 'clear', 'reset',
-                                   'read_one', 'eob', 'eoi', 'can_relocate'] }),
+                                   'read_one', 'eob', 'eoi', 'can_relocate',
+                                   'set_detail_needed'] }),
     ]
 
     flavor_combos = [
@@ -1173,100 +1174,67 @@ def generate_v8_wrapper_code(component, api):
 
     lines.extend(generate_v8_base_methods(component))
 
+    batchable_methods = []
+
     for method in api.instance_methods:
         args = method.args
 
-        is_put_array = method.is_put_array
-        if method.is_put_call:
-            array_item_type = "GumArgument"
-            array_item_parse_logic = generate_v8_parse_call_arg_array_element(component, api)
-        elif method.is_put_regs:
-            array_item_type = api.native_register_type
-            array_item_parse_logic = generate_v8_parse_register_array_element(component, api)
-
-        lines.extend([
-            "GUMJS_DEFINE_CLASS_METHOD ({0}_{1}, {2})".format(component.gumjs_function_prefix, method.name, component.wrapper_struct_name),
-            "{",
-            "  if (!{0}_check (self, isolate))".format(component.wrapper_function_prefix),
-            "    return;",
-        ])
-
-        if len(args) > 0:
-            lines.append("")
+        if is_batchable_method(component, method):
+            batchable_methods.append(method)
 
-            for arg in args:
-                type_raw = arg.type_raw_for_cpp()
-                if type_raw == "$array":
-                    type_raw = "Local<Array>"
-                lines.append("  {0} {1};".format(type_raw, arg.name_raw_for_cpp()))
+            op_lines = generate_v8_method_call(component, api, method, "return FALSE;")
+            if method.return_type == "gboolean":
+                op_lines.extend([
+                    "  if (!result)",
+                    "  {",
+                    "    _gum_v8_throw_ascii_literal (isolate, \"invalid argument\");",
+                    "    return FALSE;",
+                    "  }",
+                ])
+            op_lines.extend(generate_v8_method_cleanup(method))
 
-            arglist_signature = "".join([arg.type_format_for_cpp() for arg in args])
-            arglist_pointers = ", ".join(["&" + arg.name_raw_for_cpp() for arg in args])
+            op_locals = []
+            op_code = "\n".join(op_lines)
+            if re.search(r"\bcore\b", op_code) is not None:
+                op_locals.append("  auto core = args->core;")
+            if re.search(r"\bisolate\b", op_code) is not None:
+                op_locals.append("  auto isolate = args->core->isolate;")
+            if len(op_locals) == 0:
+                op_lines = op_lines[1:]
 
             lines.extend([
-                "  if (!_gum_v8_args_parse (args, \"{0}\", {1}))".format(arglist_signature, arglist_pointers),
+                "static gboolean",
+                "{0}_{1} ({2} * self, const GumV8Args * args)".format(component.wrapper_function_prefix, method.name, component.wrapper_struct_name),
+                "{",
+            ])
+            lines.extend(op_locals)
+            lines.extend(op_lines)
+            lines.extend([
+                "",
+                "  return TRUE;",
+                "}",
+                "",
+                "GUMJS_DEFINE_CLASS_METHOD ({0}_{1}, {2})".format(component.gumjs_function_prefix, method.name, component.wrapper_struct_name),
+                "{",
+                "  if (!{0}_check (self, isolate))".format(component.wrapper_function_prefix),
                 "    return;",
+                "",
+                "  {0}_{1} (self, args);".format(component.wrapper_function_prefix, method.name),
+                "}",
+                ""
             ])
 
-        args_needing_conversion = [arg for arg in args if arg.type_converter_for_cpp() is not None]
-        if len(args_needing_conversion) > 0:
-            lines.append("")
-            for arg in args_needing_conversion:
-                converter = arg.type_converter_for_cpp()
-                if converter == "label":
-                    lines.append("  auto {value} = {wrapper_function_prefix}_resolve_label (self, {value_raw});".format(
-                        value=arg.name,
-                        value_raw=arg.name_raw_for_cpp(),
-                        wrapper_function_prefix=component.wrapper_function_prefix))
-                elif converter == "address":
-                    lines.append("  auto {value} = GUM_ADDRESS ({value_raw});".format(
-                        value=arg.name,
-                        value_raw=arg.name_raw_for_cpp()))
-                elif converter == "bytes":
-                    lines.extend([
-                        "  gsize {0}_size;".format(arg.name),
-                        "  auto {value} = (const guint8 *) g_bytes_get_data ({value_raw}, &{value}_size);".format(
-                            value=arg.name,
-                            value_raw=arg.name_raw_for_cpp()),
-                    ])
-                else:
-                    lines.extend([
-                        "  {0} {1};".format(arg.type, arg.name),
-                        "  if (!gum_parse_{arch}_{type} (isolate, {value_raw}, &{value}))".format(
-                            value=arg.name,
-                            value_raw=arg.name_raw_for_cpp(),
-                            arch=component.arch,
-                            type=arg.type_converter_for_cpp()),
-                        "    return;",
-                    ])
-
-        if is_put_array:
-            lines.extend(generate_v8_parse_array_elements(array_item_type, array_item_parse_logic).split("\n"))
-
-        impl_function_name = "{0}_{1}".format(component.impl_function_prefix, method.name)
-
-        arglist = ["self->impl"]
-        if method.needs_calling_convention_arg:
-            arglist.append("GUM_CALL_CAPI")
-        for arg in args:
-            if arg.type_converter_for_cpp() == "bytes":
-                arglist.extend([arg.name, arg.name + "_size"])
-            else:
-                arglist.append(arg.name)
-        if is_put_array:
-            impl_function_name += "_array"
-            arglist.insert(len(arglist) - 1, "items_length")
-
-        if method.return_type == "void":
-            return_capture = ""
-        else:
-            return_capture = "auto result = "
+            continue
 
         lines.extend([
-            "",
-            "  {0}{1} ({2});".format(return_capture, impl_function_name, ", ".join(arglist))
+            "GUMJS_DEFINE_CLASS_METHOD ({0}_{1}, {2})".format(component.gumjs_function_prefix, method.name, component.wrapper_struct_name),
+            "{",
+            "  if (!{0}_check (self, isolate))".format(component.wrapper_function_prefix),
+            "    return;",
         ])
 
+        lines.extend(generate_v8_method_call(component, api, method, "return;"))
+
         if method.return_type == "gboolean" and method.name.startswith("put_"):
             lines.extend([
                 "  if (!result)",
@@ -1301,17 +1269,16 @@ def generate_v8_wrapper_code(component, api):
             else:
                 raise ValueError("Unsupported return type: {0}".format(method.return_type))
 
-        args_needing_cleanup = [arg for arg in args if arg.type_converter_for_cpp() == "bytes"]
-        if len(args_needing_cleanup) > 0:
-            lines.append("")
-            for arg in args_needing_cleanup:
-                lines.append("  g_bytes_unref ({0});".format(arg.name_raw_for_cpp()))
+        lines.extend(generate_v8_method_cleanup(method))
 
         lines.extend([
             "}",
             ""
         ])
 
+    if component.name == "writer":
+        lines.extend(generate_v8_writer_put_ops(component, batchable_methods))
+
     lines.extend([
         "static const GumV8Function {0}_functions[] =".format(component.gumjs_function_prefix),
         "{",
@@ -1320,6 +1287,7 @@ def generate_v8_wrapper_code(component, api):
     ])
     if component.name == "writer":
         lines.append("  {{ \"flush\", {0}_flush }},".format(component.gumjs_function_prefix))
+        lines.append("  {{ \"putOps\", {0}_put_ops }},".format(component.gumjs_function_prefix))
     elif component.name == "relocator":
         lines.append("  {{ \"readOne\", {0}_read_one }},".format(component.gumjs_function_prefix))
 
@@ -1341,6 +1309,200 @@ def generate_v8_wrapper_code(component, api):
 
     return "\n".join(lines)
 
+def is_batchable_method(component, method):
+    return component.name == "writer" and method.name.startswith("put_") and \
+            method.return_type in ("void", "gboolean")
+
+def generate_v8_method_call(component, api, method, failure):
+    lines = []
+
+    args = method.args
+
+    is_put_array = method.is_put_array
+    if method.is_put_call:
+        array_item_type = "GumArgument"
+        array_item_parse_logic = generate_v8_parse_call_arg_array_element(component, api, failure)
+    elif method.is_put_regs:
+        array_item_type = api.native_register_type
+        array_item_parse_logic = generate_v8_parse_register_array_element(component, api, failure)
+
+    if len(args) > 0:
+        lines.append("")
+
+        for arg in args:
+            type_raw = arg.type_raw_for_cpp()
+            if type_raw == "$array":
+                type_raw = "Local<Array>"
+            lines.append("  {0} {1};".format(type_raw, arg.name_raw_for_cpp()))
+
+        arglist_signature = "".join([arg.type_format_for_cpp() for arg in args])
+        arglist_pointers = ", ".join(["&" + arg.name_raw_for_cpp() for arg in args])
+
+        lines.extend([
+            "  if (!_gum_v8_args_parse (args, \"{0}\", {1}))".format(arglist_signature, arglist_pointers),
+            "    " + failure,
+        ])
+
+    args_needing_conversion = [arg for arg in args if arg.type_converter_for_cpp() is not None]
+    if len(args_needing_conversion) > 0:
+        lines.append("")
+        for arg in args_needing_conversion:
+            converter = arg.type_converter_for_cpp()
+            if converter == "label":
+                lines.append("  auto {value} = {wrapper_function_prefix}_resolve_label (self, {value_raw});".format(
+                    value=arg.name,
+                    value_raw=arg.name_raw_for_cpp(),
+                    wrapper_function_prefix=component.wrapper_function_prefix))
+            elif converter == "address":
+                lines.append("  auto {value} = GUM_ADDRESS ({value_raw});".format(
+                    value=arg.name,
+                    value_raw=arg.name_raw_for_cpp()))
+            elif converter == "bytes":
+                lines.extend([
+                    "  gsize {0}_size;".format(arg.name),
+                    "  auto {value} = (const guint8 *) g_bytes_get_data ({value_raw}, &{value}_size);".format(
+                        value=arg.name,
+                        value_raw=arg.name_raw_for_cpp()),
+                ])
+            else:
+                lines.extend([
+                    "  {0} {1};".format(arg.type, arg.name),
+                    "  if (!gum_parse_{arch}_{type} (isolate, {value_raw}, &{value}))".format(
+                        value=arg.name,
+                        value_raw=arg.name_raw_for_cpp(),
+                        arch=component.arch,
+                        type=arg.type_converter_for_cpp()),
+                    "    " + failure,
+                ])
+
+    if is_put_array:
+        lines.extend(generate_v8_parse_array_elements(array_item_type, array_item_parse_logic).split("\n"))
+
+    impl_function_name = "{0}_{1}".format(component.impl_function_prefix, method.name)
+
+    arglist = ["self->impl"]
+    if method.needs_calling_convention_arg:
+        arglist.append("GUM_CALL_CAPI")
+    for arg in args:
+        if arg.type_converter_for_cpp() == "bytes":
+            arglist.extend([arg.name, arg.name + "_size"])
+        else:
+            arglist.append(arg.name)
+    if is_put_array:
+        impl_function_name += "_array"
+        arglist.insert(len(arglist) - 1, "items_length")
+
+    if method.return_type == "void":
+        return_capture = ""
+    else:
+        return_capture = "auto result = "
+
+    lines.extend([
+        "",
+        "  {0}{1} ({2});".format(return_capture, impl_function_name, ", ".join(arglist))
+    ])
+
+    return lines
+
+def generate_v8_method_cleanup(method):
+    lines = []
+
+    args_needing_cleanup = [arg for arg in method.args if arg.type_converter_for_cpp() == "bytes"]
+    if len(args_needing_cleanup) > 0:
+        lines.append("")
+        for arg in args_needing_cleanup:
+            lines.append("  g_bytes_unref ({0});".format(arg.name_raw_for_cpp()))
+
+    return lines
+
+def generate_v8_writer_put_ops(component, methods):
+    params = dict(component.__dict__)
+
+    params["op_entries"] = "\n".join(["  {{ \"{0}\", {1}_{2} }},".format(method.name_js, component.wrapper_function_prefix, method.name)
+        for method in sorted(methods, key=lambda m: m.name_js)])
+
+    template = """\
+/*
+ * Lets a whole sequence of put operations be submitted in one call, each as
+ * an array holding the name of the method followed by its arguments, e.g.
+ * [['putNop'], ['putRet']]. Kept sorted by name for lookup.
+ */
+typedef gboolean (* {wrapper_struct_name}OpFunc) ({wrapper_struct_name} * self,
+    const GumV8Args * args);
+
+struct {wrapper_struct_name}Op
+{{
+  const gchar * name;
+  {wrapper_struct_name}OpFunc func;
+}};
+
+static const {wrapper_struct_name}Op {wrapper_function_prefix}_ops[] =
+{{
+{op_entries}
+}};
+
+static int
+{wrapper_function_prefix}_op_compare (
+    const void * name,
+    const void * op)
+{{
+  return strcmp ((const gchar *) name,
+      ((const {wrapper_struct_name}Op *) op)->name);
+}}
+
+GUMJS_DEFINE_CLASS_METHOD ({gumjs_function_prefix}_put_ops, {wrapper_struct_name})
+{{
+  if (!{wrapper_function_prefix}_check (self, isolate))
+    return;
+
+  Local<Array> ops;
+  if (!_gum_v8_args_parse (args, "A", &ops))
+    return;
+
+  auto context = isolate->GetCurrentContext ();
+
+  uint32_t ops_length = ops->Length ();
+  for (uint32_t ops_index = 0; ops_index != ops_length; ops_index++)
+  {{
+    auto op_value = ops->Get (context, ops_index).ToLocalChecked ();
+    if (!op_value->IsArray ())
+    {{
+      _gum_v8_throw_ascii_literal (isolate, "expected an array of operations");
+      return;
+    }}
+    auto op = op_value.As<Array> ();
+
+    auto name_value = op->Get (context, 0).ToLocalChecked ();
+    if (!name_value->IsString ())
+    {{
+      _gum_v8_throw_ascii_literal (isolate, "expected an operation name");
+      return;
+    }}
+    String::Utf8Value name (name_value.As<String> ());
+
+    auto entry = (const {wrapper_struct_name}Op *) bsearch (*name,
+        {wrapper_function_prefix}_ops, G_N_ELEMENTS ({wrapper_function_prefix}_ops),
+        sizeof ({wrapper_struct_name}Op), {wrapper_function_prefix}_op_compare);
+    if (entry == NULL)
+    {{
+      _gum_v8_throw_ascii (isolate, "unknown operation '%s'", *name);
+      return;
+    }}
+
+    GumV8Args op_args;
+    op_args.info = nullptr;
+    op_args.values = op;
+    op_args.values_offset = 1;
+    op_args.core = core;
+
+    if (!entry->func (self, &op_args))
+      return;
+  }}
+}}
+"""
+
+    return template.format(**params).split("\n")
+
 def generate_v8_parse_array_elements(item_type, parse_item):
     return """
   auto context = isolate->GetCurrentContext ();
@@ -1354,7 +1516,7 @@ def generate_v8_parse_array_elements(item_type, parse_item):
 {parse_item}
   }}""".format(item_type=item_type, parse_item=parse_item)
 
-def generate_v8_parse_call_arg_array_element(component, api):
+def generate_v8_parse_call_arg_array_element(component, api, failure):
     return """
     auto value = items_value->Get (context, items_index).ToLocalChecked ();
     if (value->IsString ())
@@ -1364,7 +1526,7 @@ def generate_v8_parse_call_arg_array_element(component, api):
       String::Utf8Value value_as_utf8 (value.As<String> ());
       {native_register_type} value_as_reg;
       if (!gum_parse_{arch}_register (isolate, *value_as_utf8, &value_as_reg))
-        return;
+        {failure}
       item->value.reg = value_as_reg;
     }}
     else
@@ -1373,25 +1535,25 @@ def generate_v8_parse_call_arg_array_element(component, api):
 
       gpointer ptr;
       if (!_gum_v8_native_pointer_parse (value, &ptr, core))
-        return;
+        {failure}
       item->value.address = GUM_ADDRESS (ptr);
-    }}""".format(arch=component.arch, native_register_type=api.native_register_type)
+    }}""".format(arch=component.arch, native_register_type=api.native_register_type, failure=failure)
 
-def generate_v8_parse_register_array_element(component, api):
+def generate_v8_parse_register_array_element(component, api, failure):
     return """
     auto value = items_value->Get (context, items_index).ToLocalChecked ();
     if (!value->IsString ())
     {{
       _gum_v8_throw_ascii_literal (isolate, "expected an array with register names");
-      return;
+      {failure}
     }}
 
     String::Utf8Value value_as_utf8 (value.As<String> ());
     {native_register_type} value_as_reg;
     if (!gum_parse_{arch}_register (isolate, *value_as_utf8, &value_as_reg))
-      return;
+      {failure}
 
-    *item = value_as_reg;""".format(arch=component.arch, native_register_type=api.native_register_type)
+    *item = value_as_reg;""".format(arch=component.arch, native_register_type=api.native_register_type, failure=failure)
 
 def generate_v8_fields(component):
     return """\
@@ -2308,6 +2470,12 @@ def generate_class_api_reference(name, arch, flavor, api):
     also desirable to do this between pieces of unrelated code, e.g. when
     generating multiple functions in one go.
 
+-   `putOps(ops)`: put a whole sequence of instructions in one call, where
+    `ops` is an array of operations, each an array holding the name of a
+    `put` method followed by its arguments, e.g.
+    `[['putNop'], ['putRet']]`. This is a lot faster than calling the methods
+    one by one when generating large amounts of code.
+
 -   `base`: memory location of the first byte of output, as a NativePointer
 
 -   `code`: memory location of the next byte of output, as a NativePointer
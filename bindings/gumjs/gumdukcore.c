@@ -12,9 +12,11 @@
 #include "gumdukscript-objc.h"
 #include "gumdukscript-promise.h"
 #include "gumdukstalker.h"
+#include "gumhexdump.h"
 #include "gumsourcemap.h"
 
 #include <ffi.h>
+#include <string.h>
 
 #define GUM_DUK_NATIVE_POINTER_CACHE_SIZE 8
 
@@ -48,7 +50,8 @@ struct _GumDukScheduledCallback
   gint id;
   gboolean repeat;
   GumDukHeapPtr func;
-  GSource * source;
+  GumTimer * timer;
+  GumDukCallbackStats stats;
 
   GumDukCore * core;
 };
@@ -121,6 +124,7 @@ struct _GumDukNativeCallback
   ffi_cif cif;
   ffi_type ** atypes;
   GSList * data;
+  GumDukCallbackStats stats;
 
   GumDukCore * core;
 };
@@ -166,9 +170,11 @@ GUMJS_DECLARE_FUNCTION (gumjs_set_interval)
 GUMJS_DECLARE_FUNCTION (gumjs_clear_timer)
 GUMJS_DECLARE_FUNCTION (gumjs_gc)
 GUMJS_DECLARE_FUNCTION (gumjs_send)
+GUMJS_DECLARE_FUNCTION (gumjs_write_log)
 GUMJS_DECLARE_FUNCTION (gumjs_set_unhandled_exception_callback)
 GUMJS_DECLARE_FUNCTION (gumjs_set_incoming_message_callback)
 GUMJS_DECLARE_FUNCTION (gumjs_wait_for_event)
+GUMJS_DECLARE_FUNCTION (gumjs_hexdump)
 
 GUMJS_DECLARE_GETTER (gumjs_get_promise)
 
@@ -187,6 +193,9 @@ GUMJS_DECLARE_FUNCTION (gumjs_script_next_tick)
 GUMJS_DECLARE_FUNCTION (gumjs_script_pin)
 GUMJS_DECLARE_FUNCTION (gumjs_script_unpin)
 GUMJS_DECLARE_FUNCTION (gumjs_script_set_global_access_handler)
+GUMJS_DECLARE_FUNCTION (gumjs_script_get_statistics)
+GUMJS_DECLARE_FUNCTION (gumjs_script_start_profiling)
+GUMJS_DECLARE_FUNCTION (gumjs_script_stop_profiling)
 static int gum_duk_core_on_global_enumerate (duk_context * ctx, void * udata);
 static int gum_duk_core_on_global_get (duk_context * ctx, const char * name,
     void * udata);
@@ -304,9 +313,10 @@ static GumDukScheduledCallback * gum_duk_core_try_steal_scheduled_callback (
     GumDukCore * self, gint id);
 
 static GumDukScheduledCallback * gum_scheduled_callback_new (guint id,
-    GumDukHeapPtr func, gboolean repeat, GSource * source, GumDukCore * core);
+    GumDukHeapPtr func, gboolean repeat, GumDukCore * core);
 static void gum_scheduled_callback_free (GumDukScheduledCallback * callback);
-static gboolean gum_scheduled_callback_invoke (GumDukScheduledCallback * self);
+static void gum_duk_core_on_timers_due (GumTimerWheel * timers,
+    GumDukCore * self);
 
 static GumDukExceptionSink * gum_duk_exception_sink_new (GumDukHeapPtr callback,
     GumDukCore * core);
@@ -361,6 +371,9 @@ static const duk_function_list_entry gumjs_script_functions[] =
   { "pin", gumjs_script_pin, 0 },
   { "unpin", gumjs_script_unpin, 0 },
   { "setGlobalAccessHandler", gumjs_script_set_global_access_handler, 1 },
+  { "getStatistics", gumjs_script_get_statistics, 0 },
+  { "startProfiling", gumjs_script_start_profiling, 1 },
+  { "stopProfiling", gumjs_script_stop_profiling, 0 },
 
   { NULL, NULL, 0 }
 };
@@ -790,8 +803,13 @@ _gum_duk_core_init (GumDukCore * self,
       (GDestroyNotify) gum_duk_weak_ref_clear);
 
   self->scheduled_callbacks = g_hash_table_new (NULL, NULL);
+  self->timers = gum_timer_wheel_new (
+      gum_script_scheduler_get_js_context (scheduler),
+      (GumTimerWheelDispatchFunc) gum_duk_core_on_timers_due, self);
   self->next_callback_id = 1;
 
+  self->native_callbacks = g_hash_table_new (NULL, NULL);
+
   _gum_duk_store_module_data (ctx, "core", self);
 
   /* set `global` to the global object */
@@ -840,11 +858,13 @@ _gum_duk_core_init (GumDukCore * self,
   GUMJS_ADD_GLOBAL_FUNCTION ("clearInterval", gumjs_clear_timer, 1);
   GUMJS_ADD_GLOBAL_FUNCTION ("gc", gumjs_gc, 0);
   GUMJS_ADD_GLOBAL_FUNCTION ("_send", gumjs_send, 2);
+  GUMJS_ADD_GLOBAL_FUNCTION ("_writeLog", gumjs_write_log, 1);
   GUMJS_ADD_GLOBAL_FUNCTION ("_setUnhandledExceptionCallback",
       gumjs_set_unhandled_exception_callback, 1);
   GUMJS_ADD_GLOBAL_FUNCTION ("_setIncomingMessageCallback",
       gumjs_set_incoming_message_callback, 1);
   GUMJS_ADD_GLOBAL_FUNCTION ("_waitForEvent", gumjs_wait_for_event, 0);
+  GUMJS_ADD_GLOBAL_FUNCTION ("_hexdump", gumjs_hexdump, 5);
 
   duk_push_c_function (ctx, gumjs_int64_construct, 1);
   duk_push_object (ctx);
@@ -962,10 +982,7 @@ _gum_duk_core_flush (GumDukCore * self,
 
   g_hash_table_iter_init (&iter, self->scheduled_callbacks);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &callback))
-  {
-    _gum_duk_core_pin (self);
-    g_source_destroy (callback->source);
-  }
+    gum_scheduled_callback_free (callback);
   g_hash_table_remove_all (self->scheduled_callbacks);
 
   if (self->usage_count > 1)
@@ -1054,9 +1071,15 @@ _gum_duk_core_dispose (GumDukCore * self)
 void
 _gum_duk_core_finalize (GumDukCore * self)
 {
+  gum_timer_wheel_free (self->timers);
+  self->timers = NULL;
+
   g_hash_table_unref (self->scheduled_callbacks);
   self->scheduled_callbacks = NULL;
 
+  g_hash_table_unref (self->native_callbacks);
+  self->native_callbacks = NULL;
+
   g_hash_table_unref (self->weak_refs);
   self->weak_refs = NULL;
 
@@ -1176,12 +1199,14 @@ _gum_duk_scope_enter (GumDukScope * self,
   self->exception = NULL;
 
   g_queue_init (&self->tick_callbacks);
-  g_queue_init (&self->scheduled_sources);
 
   self->pending_stalker_level = 0;
   self->pending_stalker_transformer = NULL;
   self->pending_stalker_sink = NULL;
 
+  self->stats = NULL;
+  self->start_time = 0;
+
   return self->ctx;
 }
 
@@ -1291,7 +1316,6 @@ _gum_duk_scope_perform_pending_io (GumDukScope * self)
 {
   duk_context * ctx = self->ctx;
   GumDukHeapPtr tick_callback;
-  GSource * source;
 
   while ((tick_callback = g_queue_pop_head (&self->tick_callbacks)) != NULL)
   {
@@ -1301,17 +1325,6 @@ _gum_duk_scope_perform_pending_io (GumDukScope * self)
 
     _gum_duk_unprotect (ctx, tick_callback);
   }
-
-  while ((source = g_queue_pop_head (&self->scheduled_sources)) != NULL)
-  {
-    if (!g_source_is_destroyed (source))
-    {
-      g_source_attach (source,
-          gum_script_scheduler_get_js_context (self->core->scheduler));
-    }
-
-    g_source_unref (source);
-  }
 }
 
 void
@@ -1326,6 +1339,12 @@ _gum_duk_scope_leave (GumDukScope * self)
 
   _gum_duk_scope_perform_pending_io (self);
 
+  if (self->stats != NULL)
+  {
+    _gum_duk_callback_stats_add (self->stats,
+        g_get_monotonic_time () - self->start_time);
+  }
+
   if (core->mutex_depth == 1)
   {
     core->current_scope = NULL;
@@ -1365,6 +1384,44 @@ _gum_duk_scope_leave (GumDukScope * self)
   _gum_duk_stalker_process_pending (core->stalker, self);
 }
 
+/*
+ * Charges the time from now until _gum_duk_scope_leave() to `stats`. Call it
+ * right after entering so that waiting for the lock is left out.
+ */
+void
+_gum_duk_scope_track (GumDukScope * self,
+                      GumDukCallbackStats * stats)
+{
+  self->stats = stats;
+  self->start_time = g_get_monotonic_time ();
+}
+
+void
+_gum_duk_callback_stats_add (GumDukCallbackStats * self,
+                             guint64 elapsed)
+{
+  self->calls++;
+  self->total_time += elapsed;
+  if (elapsed > self->max_time)
+    self->max_time = elapsed;
+}
+
+void
+_gum_duk_put_callback_stats (duk_context * ctx,
+                             duk_idx_t index,
+                             const GumDukCallbackStats * stats,
+                             GumDukCore * core)
+{
+  index = duk_require_normalize_index (ctx, index);
+
+  _gum_duk_push_uint64 (ctx, stats->calls, core);
+  duk_put_prop_string (ctx, index, "calls");
+  _gum_duk_push_uint64 (ctx, stats->total_time, core);
+  duk_put_prop_string (ctx, index, "totalTime");
+  _gum_duk_push_uint64 (ctx, stats->max_time, core);
+  duk_put_prop_string (ctx, index, "maxTime");
+}
+
 GUMJS_DEFINE_GETTER (gumjs_get_promise)
 {
   duk_push_global_object (ctx);
@@ -1605,6 +1662,64 @@ GUMJS_DEFINE_FUNCTION (gumjs_script_set_global_access_handler)
   return 0;
 }
 
+/*
+ * Only covers callbacks that are still around, so one-shot timers drop out
+ * once they have fired.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_script_get_statistics)
+{
+  GumDukCore * self = args->core;
+  GHashTableIter iter;
+  GumDukNativeCallback * native_callback;
+  GumDukScheduledCallback * scheduled_callback;
+  duk_uarridx_t i;
+
+  duk_push_object (ctx);
+
+  _gum_duk_interceptor_push_listener_statistics (self->interceptor, ctx);
+  duk_put_prop_string (ctx, -2, "listeners");
+
+  duk_push_array (ctx);
+  g_hash_table_iter_init (&iter, self->native_callbacks);
+  i = 0;
+  while (g_hash_table_iter_next (&iter, (gpointer *) &native_callback, NULL))
+  {
+    duk_push_object (ctx);
+    _gum_duk_push_native_pointer (ctx, native_callback->parent.value, self);
+    duk_put_prop_string (ctx, -2, "address");
+    _gum_duk_put_callback_stats (ctx, -1, &native_callback->stats, self);
+    duk_put_prop_index (ctx, -2, i++);
+  }
+  duk_put_prop_string (ctx, -2, "nativeCallbacks");
+
+  duk_push_array (ctx);
+  g_hash_table_iter_init (&iter, self->scheduled_callbacks);
+  i = 0;
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &scheduled_callback))
+  {
+    duk_push_object (ctx);
+    duk_push_int (ctx, scheduled_callback->id);
+    duk_put_prop_string (ctx, -2, "id");
+    _gum_duk_put_callback_stats (ctx, -1, &scheduled_callback->stats, self);
+    duk_put_prop_index (ctx, -2, i++);
+  }
+  duk_put_prop_string (ctx, -2, "timers");
+
+  return 1;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_script_start_profiling)
+{
+  _gum_duk_throw (ctx, "CPU profiling is only supported by the V8 runtime");
+  return 0;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_script_stop_profiling)
+{
+  _gum_duk_throw (ctx, "CPU profiling is only supported by the V8 runtime");
+  return 0;
+}
+
 static int
 gum_duk_core_on_global_enumerate (duk_context * ctx,
                                   void * udata)
@@ -1759,10 +1874,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_clear_timer)
 
   callback = gum_duk_core_try_steal_scheduled_callback (self, id);
   if (callback != NULL)
-  {
-    _gum_duk_core_pin (self);
-    g_source_destroy (callback->source);
-  }
+    gum_scheduled_callback_free (callback);
 
   duk_push_boolean (ctx, callback != NULL);
   return 1;
@@ -1787,8 +1899,13 @@ GUMJS_DEFINE_FUNCTION (gumjs_send)
   GumInterceptor * interceptor = self->interceptor->interceptor;
   const gchar * message;
   GBytes * data;
+  gboolean transfer = FALSE;
 
-  _gum_duk_args_parse (args, "sB?", &message, &data);
+  /*
+   * Duktape's fixed buffers cannot be detached from their ArrayBuffer, so a
+   * transfer is honoured by copying.
+   */
+  _gum_duk_args_parse (args, "sB?|t", &message, &data, &transfer);
 
   /*
    * Synchronize Interceptor state before sending the message. The application
@@ -1806,6 +1923,17 @@ GUMJS_DEFINE_FUNCTION (gumjs_send)
   return 0;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_write_log)
+{
+  const gchar * text;
+
+  _gum_duk_args_parse (args, "s", &text);
+
+  gum_log_write (text, strlen (text));
+
+  return 0;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_set_unhandled_exception_callback)
 {
   GumDukCore * self = args->core;
@@ -1893,6 +2021,57 @@ GUMJS_DEFINE_FUNCTION (gumjs_wait_for_event)
   return 0;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_hexdump)
+{
+  GumDukHeapPtr target;
+  gsize offset, length;
+  gboolean header, ansi;
+  const guint8 * data;
+  gsize max_size, size;
+  gchar * output;
+  GumExceptor * exceptor = args->core->exceptor;
+  GumExceptorScope scope;
+
+  _gum_duk_args_parse (args, "VZZtt", &target, &offset, &length, &header,
+      &ansi);
+
+  if (duk_is_buffer_data (ctx, 0))
+  {
+    duk_size_t buffer_size;
+
+    data = duk_get_buffer_data (ctx, 0, &buffer_size);
+    length = MIN (length, buffer_size);
+  }
+  else
+  {
+    data = _gum_duk_require_pointer (ctx, 0, args->core);
+  }
+
+  max_size = gum_hexdump_compute_max_size (offset, length, header, ansi);
+  if (max_size > 0x7fffffff)
+    _gum_duk_throw (ctx, "invalid length");
+
+  output = g_malloc (max_size);
+  size = 0;
+
+  if (gum_exceptor_try (exceptor, &scope))
+  {
+    size = gum_hexdump_format (data, offset, length, header, ansi, output);
+  }
+
+  if (gum_exceptor_catch (exceptor, &scope))
+  {
+    g_free (output);
+    _gum_duk_throw_native (ctx, &scope.exception, args->core);
+  }
+
+  duk_push_lstring (ctx, output, size);
+
+  g_free (output);
+
+  return 1;
+}
+
 static gint64
 gumjs_int64_from_args (const GumDukArgs * args)
 {
@@ -3128,6 +3307,8 @@ GUMJS_DEFINE_CONSTRUCTOR (gumjs_native_callback_construct)
 
   duk_pop (ctx);
 
+  g_hash_table_add (core->native_callbacks, callback);
+
   return 0;
 
 invalid_return_type:
@@ -3184,6 +3365,8 @@ static void
 gum_duk_native_callback_finalize (GumDukNativeCallback * callback,
                                   gboolean heap_destruct)
 {
+  g_hash_table_remove (callback->core->native_callbacks, callback);
+
   ffi_closure_free (callback->closure);
 
   while (callback->data != NULL)
@@ -3215,6 +3398,7 @@ gum_duk_native_callback_invoke (ffi_cif * cif,
   gboolean success;
 
   ctx = _gum_duk_scope_enter (&scope, core);
+  _gum_duk_scope_track (&scope, &self->stats);
 
   if (rtype != &ffi_type_void)
   {
@@ -3439,7 +3623,6 @@ gum_duk_core_schedule_callback (GumDukCore * self,
   GumDukHeapPtr func;
   gsize delay;
   guint id;
-  GSource * source;
   GumDukScheduledCallback * callback;
 
   if (repeat)
@@ -3453,18 +3636,13 @@ gum_duk_core_schedule_callback (GumDukCore * self,
   }
 
   id = self->next_callback_id++;
-  if (delay == 0)
-    source = g_idle_source_new ();
-  else
-    source = g_timeout_source_new ((guint) delay);
 
-  callback = gum_scheduled_callback_new (id, func, repeat, source, self);
-  g_source_set_callback (source, (GSourceFunc) gum_scheduled_callback_invoke,
-      callback, (GDestroyNotify) gum_scheduled_callback_free);
+  callback = gum_scheduled_callback_new (id, func, repeat, self);
+  callback->timer = gum_timer_wheel_add (self->timers, (guint) delay,
+      repeat ? MAX ((guint) delay, 1) : 0, callback);
 
   g_hash_table_insert (self->scheduled_callbacks, GINT_TO_POINTER (id),
       callback);
-  g_queue_push_tail (&self->current_scope->scheduled_sources, source);
 
   duk_push_number (args->ctx, id);
   return 1;
@@ -3492,7 +3670,6 @@ static GumDukScheduledCallback *
 gum_scheduled_callback_new (guint id,
                             GumDukHeapPtr func,
                             gboolean repeat,
-                            GSource * source,
                             GumDukCore * core)
 {
   GumDukScheduledCallback * callback;
@@ -3502,7 +3679,8 @@ gum_scheduled_callback_new (guint id,
   _gum_duk_protect (core->current_scope->ctx, func);
   callback->func = func;
   callback->repeat = repeat;
-  callback->source = source;
+  callback->timer = NULL;
+  memset (&callback->stats, 0, sizeof (callback->stats));
   callback->core = core;
 
   return callback;
@@ -3515,36 +3693,58 @@ gum_scheduled_callback_free (GumDukScheduledCallback * callback)
   GumDukScope scope;
   duk_context * ctx;
 
+  gum_timer_wheel_remove (core->timers, callback->timer);
+
   ctx = _gum_duk_scope_enter (&scope, core);
-  _gum_duk_core_unpin (core);
   _gum_duk_unprotect (ctx, callback->func);
   _gum_duk_scope_leave (&scope);
 
   g_slice_free (GumDukScheduledCallback, callback);
 }
 
-static gboolean
-gum_scheduled_callback_invoke (GumDukScheduledCallback * self)
+static void
+gum_duk_core_on_timers_due (GumTimerWheel * timers,
+                            GumDukCore * self)
 {
-  GumDukCore * core = self->core;
   duk_context * ctx;
   GumDukScope scope;
+  GumTimer * timer;
 
-  ctx = _gum_duk_scope_enter (&scope, self->core);
+  ctx = _gum_duk_scope_enter (&scope, self);
 
-  duk_push_heapptr (ctx, self->func);
-  _gum_duk_scope_call (&scope, 0);
-  duk_pop (ctx);
-
-  if (!self->repeat)
+  while ((timer = gum_timer_wheel_pop_due (timers)) != NULL)
   {
-    if (gum_duk_core_try_steal_scheduled_callback (core, self->id) != NULL)
-      _gum_duk_core_pin (core);
+    GumDukScheduledCallback * callback = timer->data;
+    gint id = callback->id;
+    gboolean repeat = callback->repeat;
+    gint64 start_time;
+
+    /*
+     * The callback may clear its own timer, so don't touch it afterwards.
+     * All due timers share one scope, so each call is timed here instead.
+     */
+    start_time = g_get_monotonic_time ();
+    duk_push_heapptr (ctx, callback->func);
+    _gum_duk_scope_call (&scope, 0);
+    duk_pop (ctx);
+
+    callback = g_hash_table_lookup (self->scheduled_callbacks,
+        GINT_TO_POINTER (id));
+    if (callback != NULL)
+    {
+      _gum_duk_callback_stats_add (&callback->stats,
+          g_get_monotonic_time () - start_time);
+    }
+
+    if (!repeat)
+    {
+      callback = gum_duk_core_try_steal_scheduled_callback (self, id);
+      if (callback != NULL)
+        gum_scheduled_callback_free (callback);
+    }
   }
 
   _gum_duk_scope_leave (&scope);
-
-  return self->repeat;
 }
 
 static GumDukExceptionSink *
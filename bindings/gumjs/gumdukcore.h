@@ -11,6 +11,7 @@
 #include "gumdukscript.h"
 #include "gumdukscriptbackend.h"
 #include "gumscriptscheduler.h"
+#include "gumtimerwheel.h"
 
 #include <gum/gumexceptor.h>
 
@@ -28,6 +29,7 @@ typedef struct _GumDukCore GumDukCore;
 typedef struct _GumDukInterceptor GumDukInterceptor;
 typedef struct _GumDukStalker GumDukStalker;
 typedef struct _GumDukScope GumDukScope;
+typedef struct _GumDukCallbackStats GumDukCallbackStats;
 typedef gpointer GumDukHeapPtr;
 typedef struct _GumDukWeakRef GumDukWeakRef;
 
@@ -84,8 +86,11 @@ struct _GumDukCore
   guint last_weak_ref_id;
 
   GHashTable * scheduled_callbacks;
+  GumTimerWheel * timers;
   guint next_callback_id;
 
+  GHashTable * native_callbacks;
+
   GumDukHeapPtr weak_ref;
   GumDukHeapPtr int64;
   GumDukHeapPtr uint64;
@@ -112,11 +117,24 @@ struct _GumDukScope
   duk_thread_state thread_state;
 
   GQueue tick_callbacks;
-  GQueue scheduled_sources;
 
   gint pending_stalker_level;
   GumStalkerTransformer * pending_stalker_transformer;
   GumEventSink * pending_stalker_sink;
+
+  GumDukCallbackStats * stats;
+  gint64 start_time;
+};
+
+/*
+ * Accounting for one JS callback, updated while holding the script lock.
+ * Times are in microseconds and include any ticks queued by the callback.
+ */
+struct _GumDukCallbackStats
+{
+  guint64 calls;
+  guint64 total_time;
+  guint64 max_time;
 };
 
 struct _GumDukInt64
@@ -198,6 +216,13 @@ G_GNUC_INTERNAL gboolean _gum_duk_scope_call_sync (GumDukScope * self,
 G_GNUC_INTERNAL void _gum_duk_scope_flush (GumDukScope * self);
 G_GNUC_INTERNAL void _gum_duk_scope_perform_pending_io (GumDukScope * self);
 G_GNUC_INTERNAL void _gum_duk_scope_leave (GumDukScope * self);
+G_GNUC_INTERNAL void _gum_duk_scope_track (GumDukScope * self,
+    GumDukCallbackStats * stats);
+
+G_GNUC_INTERNAL void _gum_duk_callback_stats_add (GumDukCallbackStats * self,
+    guint64 elapsed);
+G_GNUC_INTERNAL void _gum_duk_put_callback_stats (duk_context * ctx,
+    duk_idx_t index, const GumDukCallbackStats * stats, GumDukCore * core);
 
 G_END_DECLS
 
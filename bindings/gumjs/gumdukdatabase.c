@@ -9,6 +9,8 @@
 #include "gumdukmacros.h"
 #include "sqlite3.h"
 
+#include <string.h>
+
 typedef struct _GumDatabase GumDatabase;
 
 struct _GumDatabase
@@ -42,6 +44,11 @@ GUMJS_DECLARE_FUNCTION (gumjs_statement_bind_blob)
 GUMJS_DECLARE_FUNCTION (gumjs_statement_bind_null)
 GUMJS_DECLARE_FUNCTION (gumjs_statement_step)
 GUMJS_DECLARE_FUNCTION (gumjs_statement_reset)
+GUMJS_DECLARE_FUNCTION (gumjs_statement_run_many)
+GUMJS_DECLARE_FUNCTION (gumjs_statement_step_many)
+
+static void gum_statement_bind_value (duk_context * ctx,
+    sqlite3_stmt * statement, gint index, duk_idx_t value_index);
 
 static void gum_push_row (duk_context * ctx, sqlite3_stmt * statement);
 static void gum_push_column (duk_context * ctx, sqlite3_stmt * statement,
@@ -50,7 +57,7 @@ static void gum_push_column (duk_context * ctx, sqlite3_stmt * statement,
 static const duk_function_list_entry gumjs_database_module_functions[] =
 {
   { "_open", gumjs_database_open, 2 },
-  { "openInline", gumjs_database_open_inline, 1 },
+  { "_openInline", gumjs_database_open_inline, 2 },
 
   { NULL, NULL, 0 }
 };
@@ -60,7 +67,7 @@ static const duk_function_list_entry gumjs_database_functions[] =
   { "close", gumjs_database_close, 0 },
   { "exec", gumjs_database_exec, 1 },
   { "prepare", gumjs_database_prepare, 1 },
-  { "dump", gumjs_database_dump, 0 },
+  { "dump", gumjs_database_dump, 1 },
 
   { NULL, NULL, 0 }
 };
@@ -74,6 +81,8 @@ static const duk_function_list_entry gumjs_statement_functions[] =
   { "bindNull", gumjs_statement_bind_null, 1 },
   { "step", gumjs_statement_step, 0 },
   { "reset", gumjs_statement_reset, 0 },
+  { "runMany", gumjs_statement_run_many, 1 },
+  { "stepMany", gumjs_statement_step_many, 1 },
 
   { NULL, NULL, 0 }
 };
@@ -169,24 +178,40 @@ invalid_database:
 GUMJS_DEFINE_FUNCTION (gumjs_database_open_inline)
 {
   GumDukDatabase * self;
-  const gchar * encoded_contents;
+  gsize memory_limit;
   gpointer contents;
   gsize size;
-  gboolean valid;
   const gchar * path;
   sqlite3 * handle;
   gint status;
 
   self = gumjs_module_from_args (args);
 
-  _gum_duk_args_parse (args, "s", &encoded_contents);
+  memory_limit = (gsize) duk_require_number (ctx, 1);
+
+  if (duk_is_string (ctx, 0))
+  {
+    if (!gum_memory_vfs_contents_from_string (duk_get_string (ctx, 0),
+        &contents, &size))
+      goto invalid_data;
+  }
+  else
+  {
+    gconstpointer data;
+    duk_size_t data_size;
+
+    data = duk_get_buffer_data (ctx, 0, &data_size);
+    if (data == NULL)
+      goto invalid_data;
 
-  valid =
-      gum_memory_vfs_contents_from_string (encoded_contents, &contents, &size);
-  if (!valid)
-    goto invalid_data;
+    contents = g_memdup (data, data_size);
+    size = data_size;
+  }
 
-  path = gum_memory_vfs_add_file (self->memory_vfs, contents, size);
+  path = gum_memory_vfs_add_file (self->memory_vfs, contents, size,
+      memory_limit);
+  if (path == NULL)
+    goto io_error;
 
   handle = NULL;
   status = sqlite3_open_v2 (path, &handle, SQLITE_OPEN_READWRITE,
@@ -206,6 +231,11 @@ invalid_data:
     _gum_duk_throw (ctx, "invalid data");
     return 0;
   }
+io_error:
+  {
+    _gum_duk_throw (ctx, "unable to store database");
+    return 0;
+  }
 invalid_database:
   {
     sqlite3_close_v2 (handle);
@@ -341,27 +371,54 @@ invalid_sql:
 GUMJS_DEFINE_FUNCTION (gumjs_database_dump)
 {
   GumDatabase * self;
-  gpointer data, malloc_data;
+  const gchar * format = NULL;
+  gboolean binary = FALSE;
+  gpointer data;
   gsize size;
   GError * error;
   gchar * data_str;
 
   self = gumjs_database_from_args (args);
 
+  _gum_duk_args_parse (args, "|s", &format);
+
+  if (format == NULL || strcmp (format, "base64") == 0)
+    binary = FALSE;
+  else if (strcmp (format, "binary") == 0)
+    binary = TRUE;
+  else
+    _gum_duk_throw (ctx, "format must be either 'base64' or 'binary'");
+
   if (self->is_virtual)
   {
-    gum_memory_vfs_get_file_contents (self->module->memory_vfs, self->path,
-        &data, &size);
+    /* A WAL database only has every page in the main file once checkpointed. */
+    sqlite3_wal_checkpoint_v2 (self->handle, NULL, SQLITE_CHECKPOINT_FULL,
+        NULL, NULL);
 
-    malloc_data = NULL;
+    if (!gum_memory_vfs_get_file_contents (self->module->memory_vfs,
+        self->path, &data, &size))
+      _gum_duk_throw (ctx, "unable to read database");
   }
   else
   {
     error = NULL;
     if (!g_file_get_contents (self->path, (gchar **) &data, &size, &error))
       goto io_error;
+  }
 
-    malloc_data = data;
+  if (binary)
+  {
+    gpointer buffer_data;
+
+    buffer_data = duk_push_fixed_buffer (ctx, size);
+    memcpy (buffer_data, data, size);
+    duk_push_buffer_object (ctx, -1, 0, size, DUK_BUFOBJ_ARRAYBUFFER);
+    duk_swap (ctx, -2, -1);
+    duk_pop (ctx);
+
+    g_free (data);
+
+    return 1;
   }
 
   data_str = gum_memory_vfs_contents_to_string (data, size);
@@ -369,7 +426,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_database_dump)
   duk_push_string (ctx, data_str);
 
   g_free (data_str);
-  g_free (malloc_data);
+  g_free (data);
 
   return 1;
 
@@ -564,6 +621,144 @@ GUMJS_DEFINE_FUNCTION (gumjs_statement_reset)
   return 0;
 }
 
+/*
+ * Binds each row of `rows` in turn and runs the statement to completion, so
+ * bulk inserts cost one crossing rather than one per value and step.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_statement_run_many)
+{
+  sqlite3_stmt * statement;
+  duk_size_t num_rows, row_index;
+
+  statement = gumjs_statement_from_args (args);
+
+  if (!duk_is_array (ctx, 0))
+    _gum_duk_throw (ctx, "expected an array of rows");
+
+  num_rows = duk_get_length (ctx, 0);
+  for (row_index = 0; row_index != num_rows; row_index++)
+  {
+    duk_size_t num_values, i;
+    gint status;
+
+    duk_get_prop_index (ctx, 0, row_index);
+    if (!duk_is_array (ctx, -1))
+      _gum_duk_throw (ctx, "expected an array of rows");
+
+    sqlite3_reset (statement);
+    sqlite3_clear_bindings (statement);
+
+    num_values = duk_get_length (ctx, -1);
+    for (i = 0; i != num_values; i++)
+    {
+      duk_get_prop_index (ctx, -1, i);
+      gum_statement_bind_value (ctx, statement, i + 1, -1);
+      duk_pop (ctx);
+    }
+
+    duk_pop (ctx);
+
+    while ((status = sqlite3_step (statement)) == SQLITE_ROW)
+      ;
+    if (status != SQLITE_DONE)
+    {
+      sqlite3_reset (statement);
+      _gum_duk_throw (ctx, "%s", sqlite3_errstr (status));
+    }
+  }
+
+  sqlite3_reset (statement);
+
+  duk_push_uint (ctx, num_rows);
+  return 1;
+}
+
+/*
+ * Steps up to `n` times and returns the rows produced, which is fewer than
+ * `n` once the statement is done.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_statement_step_many)
+{
+  sqlite3_stmt * statement;
+  guint n, i;
+
+  statement = gumjs_statement_from_args (args);
+
+  _gum_duk_args_parse (args, "u", &n);
+
+  duk_push_array (ctx);
+
+  for (i = 0; i != n; i++)
+  {
+    gint status;
+
+    status = sqlite3_step (statement);
+    if (status == SQLITE_DONE)
+      break;
+    if (status != SQLITE_ROW)
+      _gum_duk_throw (ctx, "%s", sqlite3_errstr (status));
+
+    gum_push_row (ctx, statement);
+    duk_put_prop_index (ctx, -2, i);
+  }
+
+  return 1;
+}
+
+static void
+gum_statement_bind_value (duk_context * ctx,
+                          sqlite3_stmt * statement,
+                          gint index,
+                          duk_idx_t value_index)
+{
+  gint status;
+
+  if (duk_is_number (ctx, value_index))
+  {
+    gdouble number;
+
+    number = duk_get_number (ctx, value_index);
+    if (number >= -9223372036854775808.0 && number < 9223372036854775808.0 &&
+        number == (gdouble) (gint64) number)
+      status = sqlite3_bind_int64 (statement, index, (gint64) number);
+    else
+      status = sqlite3_bind_double (statement, index, number);
+  }
+  else if (duk_is_boolean (ctx, value_index))
+  {
+    status = sqlite3_bind_int (statement, index,
+        duk_get_boolean (ctx, value_index) ? 1 : 0);
+  }
+  else if (duk_is_string (ctx, value_index))
+  {
+    duk_size_t length;
+    const gchar * str;
+
+    str = duk_get_lstring (ctx, value_index, &length);
+    status = sqlite3_bind_text (statement, index, str, length,
+        SQLITE_TRANSIENT);
+  }
+  else if (duk_is_null_or_undefined (ctx, value_index))
+  {
+    status = sqlite3_bind_null (statement, index);
+  }
+  else
+  {
+    gconstpointer data;
+    duk_size_t size;
+
+    data = duk_get_buffer_data (ctx, value_index, &size);
+    if (data == NULL)
+      _gum_duk_throw (ctx, "unsupported value type");
+
+    status = sqlite3_bind_blob64 (statement, index, data, size,
+        SQLITE_TRANSIENT);
+  }
+
+  if (status != SQLITE_OK)
+    _gum_duk_throw (ctx, "%s", sqlite3_errstr (status));
+}
+
 static void
 gum_push_row (duk_context * ctx,
               sqlite3_stmt * statement)
@@ -588,7 +783,7 @@ gum_push_column (duk_context * ctx,
   switch (sqlite3_column_type (statement, index))
   {
     case SQLITE_INTEGER:
-      duk_push_int (ctx, sqlite3_column_int64 (statement, index));
+      duk_push_number (ctx, sqlite3_column_int64 (statement, index));
       break;
     case SQLITE_FLOAT:
       duk_push_number (ctx, sqlite3_column_double (statement, index));
@@ -8,9 +8,26 @@
 
 #include "gumdukvalue.h"
 
+#include <gio/gio.h>
 #include <gum/gumspinlock.h>
 #include <string.h>
 
+/*
+ * Events are queued in a ring that has exactly one producer, the thread being
+ * followed, and one consumer, the JS thread, so queueing an event is a couple
+ * of loads and a store. Capacity is rounded up to a power of two so the
+ * free-running head and tail stay consistent across wrap-around.
+ *
+ * Call summaries are counted as the events are produced, into a table that
+ * the JS thread takes over wholesale on each drain. Its lock is only ever
+ * contended for the instant of that hand-over.
+ *
+ * When compression is requested, each drained batch is run through a single
+ * raw deflate stream and flushed, so the consumer only sees whole batches
+ * while keeping the history window of the earlier ones. The chunks must be
+ * inflated in order by one decompressor, e.g. zlib.decompressobj(-15).
+ */
+
 static void gum_duk_event_sink_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_duk_event_sink_dispose (GObject * obj);
@@ -23,15 +40,36 @@ static void gum_duk_event_sink_flush (GumEventSink * sink);
 static void gum_duk_event_sink_stop (GumEventSink * sink);
 static gboolean gum_duk_event_sink_stop_when_idle (GumDukEventSink * self);
 static gboolean gum_duk_event_sink_drain (GumDukEventSink * self);
+static gboolean gum_duk_event_sink_drain_now (GumDukEventSink * self);
+static guint8 * gum_duk_event_sink_compress (GumDukEventSink * self,
+    const guint8 * data, gsize size, gsize * compressed_size);
+static void gum_duk_event_sink_count_call (GumDukEventSink * self,
+    gpointer target);
+static void gum_duk_event_sink_push_call_summary (GHashTable * frequencies,
+    duk_context * ctx);
+static void gum_duk_event_sink_push_packed_call_summary (
+    GHashTable * frequencies, duk_context * ctx);
 
 struct _GumDukEventSink
 {
   GObject parent;
 
-  GumSpinlock lock;
-  GArray * queue;
+  GumEvent * queue;
   guint queue_capacity;
   guint queue_drain_interval;
+  volatile guint queue_head;
+  volatile guint queue_tail;
+  gboolean block_when_full;
+  volatile gint drain_requested;
+  volatile gint dropped_count;
+  guint dropped_reported;
+
+  gboolean queue_events;
+  gboolean summarize_calls;
+  gboolean pack_call_summary;
+  GumSpinlock call_summary_lock;
+  GHashTable * call_summary;
+  GConverter * compressor;
 
   GumDukCore * core;
   GMainContext * main_context;
@@ -73,7 +111,7 @@ gum_duk_event_sink_iface_init (gpointer g_iface,
 static void
 gum_duk_event_sink_init (GumDukEventSink * self)
 {
-  gum_spinlock_init (&self->lock);
+  gum_spinlock_init (&self->call_summary_lock);
 }
 
 static void
@@ -115,8 +153,13 @@ gum_duk_event_sink_finalize (GObject * obj)
 
   g_assert (self->source == NULL);
 
-  gum_spinlock_free (&self->lock);
-  g_array_free (self->queue, TRUE);
+  g_free (self->queue);
+
+  if (self->call_summary != NULL)
+    g_hash_table_unref (self->call_summary);
+  gum_spinlock_free (&self->call_summary_lock);
+
+  g_clear_object (&self->compressor);
 
   G_OBJECT_CLASS (gum_duk_event_sink_parent_class)->finalize (obj);
 }
@@ -128,10 +171,19 @@ gum_duk_event_sink_new (duk_context * ctx,
   GumDukEventSink * sink;
 
   sink = g_object_new (GUM_DUK_TYPE_EVENT_SINK, NULL);
-  sink->queue = g_array_sized_new (FALSE, FALSE, sizeof (GumEvent),
-      options->queue_capacity);
-  sink->queue_capacity = options->queue_capacity;
+  sink->queue_capacity =
+      1U << g_bit_storage (MAX (options->queue_capacity, 2) - 1);
+  sink->queue = g_new (GumEvent, sink->queue_capacity);
   sink->queue_drain_interval = options->queue_drain_interval;
+  sink->block_when_full = options->block_when_full;
+  sink->queue_events = options->on_receive != NULL;
+  sink->summarize_calls = options->on_call_summary != NULL;
+  sink->pack_call_summary = options->pack_call_summary;
+  if (options->compress_events)
+  {
+    sink->compressor = G_CONVERTER (
+        g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+  }
 
   g_object_ref (options->core->script);
   sink->core = options->core;
@@ -168,11 +220,47 @@ gum_duk_event_sink_process (GumEventSink * sink,
                            const GumEvent * ev)
 {
   GumDukEventSink * self = GUM_DUK_EVENT_SINK_CAST (sink);
+  guint head;
+
+  if (self->summarize_calls && ev->type == GUM_CALL)
+    gum_duk_event_sink_count_call (self, ev->call.target);
+
+  if (!self->queue_events)
+    return;
+
+  head = self->queue_head;
 
-  gum_spinlock_acquire (&self->lock);
-  if (self->queue->len != self->queue_capacity)
-    g_array_append_val (self->queue, *ev);
-  gum_spinlock_release (&self->lock);
+  while (head - g_atomic_int_get (&self->queue_tail) == self->queue_capacity)
+  {
+    /*
+     * Blocking is only safe when the JS thread is free to drain the queue, so
+     * events produced on the JS thread itself are always dropped.
+     */
+    if (!self->block_when_full || self->core == NULL ||
+        g_main_context_is_owner (self->main_context))
+    {
+      g_atomic_int_inc (&self->dropped_count);
+      return;
+    }
+
+    if (g_atomic_int_compare_and_exchange (&self->drain_requested, FALSE, TRUE))
+    {
+      GSource * source;
+
+      source = g_idle_source_new ();
+      g_source_set_callback (source,
+          (GSourceFunc) gum_duk_event_sink_drain_now, g_object_ref (self),
+          g_object_unref);
+      g_source_attach (source, self->main_context);
+      g_source_unref (source);
+    }
+
+    g_thread_yield ();
+  }
+
+  self->queue[head & (self->queue_capacity - 1)] = *ev;
+
+  g_atomic_int_set (&self->queue_head, head + 1);
 }
 
 static void
@@ -220,75 +308,101 @@ gum_duk_event_sink_stop_when_idle (GumDukEventSink * self)
   return FALSE;
 }
 
+static gboolean
+gum_duk_event_sink_drain_now (GumDukEventSink * self)
+{
+  g_atomic_int_set (&self->drain_requested, FALSE);
+
+  gum_duk_event_sink_drain (self);
+
+  return FALSE;
+}
+
 static gboolean
 gum_duk_event_sink_drain (GumDukEventSink * self)
 {
   GumDukCore * core = self->core;
-  gpointer buffer_data;
-  guint len, size;
+  GHashTable * frequencies;
+  GumEvent * buffer_data;
+  guint tail, len, size, offset, n, dropped_count, dropped;
   GumDukScope scope;
   duk_context * ctx;
 
   if (core == NULL)
     return FALSE;
 
-  len = self->queue->len;
-  if (len == 0)
+  frequencies = NULL;
+  if (self->summarize_calls)
+  {
+    gum_spinlock_acquire (&self->call_summary_lock);
+    frequencies = g_steal_pointer (&self->call_summary);
+    gum_spinlock_release (&self->call_summary_lock);
+  }
+
+  if (frequencies == NULL &&
+      g_atomic_int_get (&self->queue_head) == self->queue_tail)
+  {
     return TRUE;
-  size = len * sizeof (GumEvent);
+  }
 
+  /*
+   * The scope serializes us with flushes coming from the followed thread,
+   * which keeps this side of the queue single-consumer.
+   */
   ctx = _gum_duk_scope_enter (&scope, core);
 
-  buffer_data = duk_push_fixed_buffer (ctx, size);
-  memcpy (buffer_data, self->queue->data, size);
-
-  gum_spinlock_acquire (&self->lock);
-  g_array_remove_range (self->queue, 0, len);
-  gum_spinlock_release (&self->lock);
-
-  if (self->on_call_summary != NULL)
+  if (frequencies != NULL)
   {
-    GHashTable * frequencies;
-    GumCallEvent * ev;
-    guint i;
-    GHashTableIter iter;
-    gpointer target, count;
-    gchar target_str[32];
-
-    frequencies = g_hash_table_new (NULL, NULL);
-
-    ev = buffer_data;
-    for (i = 0; i != len; i++)
+    if (self->on_call_summary != NULL)
     {
-      if (ev->type == GUM_CALL)
-      {
-        gsize n;
+      duk_push_heapptr (ctx, self->on_call_summary);
 
-        n = GPOINTER_TO_SIZE (g_hash_table_lookup (frequencies, ev->target));
-        n++;
-        g_hash_table_insert (frequencies, ev->target, GSIZE_TO_POINTER (n));
-      }
+      if (self->pack_call_summary)
+        gum_duk_event_sink_push_packed_call_summary (frequencies, ctx);
+      else
+        gum_duk_event_sink_push_call_summary (frequencies, ctx);
 
-      ev++;
+      _gum_duk_scope_call (&scope, 1);
+      duk_pop (ctx);
     }
 
-    duk_push_heapptr (ctx, self->on_call_summary);
+    g_hash_table_unref (frequencies);
+  }
 
-    duk_push_object (ctx);
+  tail = self->queue_tail;
+  len = g_atomic_int_get (&self->queue_head) - tail;
+  if (len == 0)
+  {
+    _gum_duk_scope_leave (&scope);
+    return TRUE;
+  }
+  size = len * sizeof (GumEvent);
 
-    g_hash_table_iter_init (&iter, frequencies);
-    while (g_hash_table_iter_next (&iter, &target, &count))
-    {
-      sprintf (target_str, "0x%" G_GSIZE_MODIFIER "x",
-          GPOINTER_TO_SIZE (target));
-      duk_push_uint (ctx, GPOINTER_TO_SIZE (count));
-      duk_put_prop_string (ctx, -2, target_str);
-    }
+  dropped_count = (guint) g_atomic_int_get (&self->dropped_count);
+  dropped = dropped_count - self->dropped_reported;
+  self->dropped_reported = dropped_count;
 
-    g_hash_table_unref (frequencies);
+  buffer_data = duk_push_fixed_buffer (ctx, size);
+
+  offset = tail & (self->queue_capacity - 1);
+  n = MIN (len, self->queue_capacity - offset);
+  memcpy (buffer_data, self->queue + offset, n * sizeof (GumEvent));
+  memcpy (buffer_data + n, self->queue, (len - n) * sizeof (GumEvent));
+
+  g_atomic_int_set (&self->queue_tail, tail + len);
 
-    _gum_duk_scope_call (&scope, 1);
+  if (self->compressor != NULL)
+  {
+    guint8 * compressed;
+    gsize compressed_size;
+
+    compressed = gum_duk_event_sink_compress (self, (guint8 *) buffer_data,
+        size, &compressed_size);
     duk_pop (ctx);
+
+    size = compressed_size;
+    memcpy (duk_push_fixed_buffer (ctx, size), compressed, size);
+    g_free (compressed);
   }
 
   if (self->on_receive != NULL)
@@ -296,8 +410,9 @@ gum_duk_event_sink_drain (GumDukEventSink * self)
     duk_push_heapptr (ctx, self->on_receive);
 
     duk_push_buffer_object (ctx, -2, 0, size, DUK_BUFOBJ_ARRAYBUFFER);
+    duk_push_uint (ctx, dropped);
 
-    _gum_duk_scope_call (&scope, 1);
+    _gum_duk_scope_call (&scope, 2);
     duk_pop_2 (ctx);
   }
   else
@@ -309,3 +424,107 @@ gum_duk_event_sink_drain (GumDukEventSink * self)
 
   return TRUE;
 }
+
+static guint8 *
+gum_duk_event_sink_compress (GumDukEventSink * self,
+                             const guint8 * data,
+                             gsize size,
+                             gsize * compressed_size)
+{
+  GByteArray * output;
+  gsize offset;
+  GConverterResult result;
+
+  output = g_byte_array_new ();
+  offset = 0;
+
+  do
+  {
+    gsize bytes_read, bytes_written;
+    GError * error = NULL;
+
+    g_byte_array_set_size (output, offset + MAX (size / 2, 4096));
+
+    result = g_converter_convert (self->compressor, data, size,
+        output->data + offset, output->len - offset, G_CONVERTER_FLUSH,
+        &bytes_read, &bytes_written, &error);
+    if (result == G_CONVERTER_ERROR)
+    {
+      /* The previous round filled the output exactly and flushed it all. */
+      g_assert (size == 0);
+      g_error_free (error);
+      break;
+    }
+
+    data += bytes_read;
+    size -= bytes_read;
+    offset += bytes_written;
+  }
+  while (result != G_CONVERTER_FLUSHED);
+
+  *compressed_size = offset;
+
+  return g_byte_array_free (output, FALSE);
+}
+
+static void
+gum_duk_event_sink_count_call (GumDukEventSink * self,
+                               gpointer target)
+{
+  gsize count;
+
+  gum_spinlock_acquire (&self->call_summary_lock);
+
+  if (self->call_summary == NULL)
+    self->call_summary = g_hash_table_new (NULL, NULL);
+
+  count = GPOINTER_TO_SIZE (g_hash_table_lookup (self->call_summary, target));
+  g_hash_table_insert (self->call_summary, target,
+      GSIZE_TO_POINTER (count + 1));
+
+  gum_spinlock_release (&self->call_summary_lock);
+}
+
+static void
+gum_duk_event_sink_push_call_summary (GHashTable * frequencies,
+                                      duk_context * ctx)
+{
+  GHashTableIter iter;
+  gpointer target, count;
+  gchar target_str[32];
+
+  duk_push_object (ctx);
+
+  g_hash_table_iter_init (&iter, frequencies);
+  while (g_hash_table_iter_next (&iter, &target, &count))
+  {
+    sprintf (target_str, "0x%" G_GSIZE_MODIFIER "x",
+        GPOINTER_TO_SIZE (target));
+    duk_push_uint (ctx, GPOINTER_TO_SIZE (count));
+    duk_put_prop_string (ctx, -2, target_str);
+  }
+}
+
+static void
+gum_duk_event_sink_push_packed_call_summary (GHashTable * frequencies,
+                                             duk_context * ctx)
+{
+  guint n;
+  gdouble * pairs;
+  GHashTableIter iter;
+  gpointer target, count;
+
+  n = g_hash_table_size (frequencies);
+
+  pairs = duk_push_fixed_buffer (ctx, n * 2 * sizeof (gdouble));
+  duk_push_buffer_object (ctx, -1, 0, n * 2 * sizeof (gdouble),
+      DUK_BUFOBJ_FLOAT64ARRAY);
+  duk_remove (ctx, -2);
+
+  g_hash_table_iter_init (&iter, frequencies);
+  while (g_hash_table_iter_next (&iter, &target, &count))
+  {
+    *pairs++ = (gdouble) GPOINTER_TO_SIZE (target);
+    *pairs++ = (gdouble) GPOINTER_TO_SIZE (count);
+  }
+}
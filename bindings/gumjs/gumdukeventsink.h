@@ -27,6 +27,9 @@ struct _GumDukEventSinkOptions
   GumEventType event_mask;
   guint queue_capacity;
   guint queue_drain_interval;
+  gboolean block_when_full;
+  gboolean pack_call_summary;
+  gboolean compress_events;
 
   GumDukHeapPtr on_receive;
   GumDukHeapPtr on_call_summary;
@@ -32,7 +32,12 @@
 # error Unsupported architecture
 #endif
 
+#define GUM_MAX_INSTRUCTION_SIZE 16
+
 GUMJS_DECLARE_FUNCTION (gumjs_instruction_parse)
+GUMJS_DECLARE_FUNCTION (gumjs_instruction_parse_range)
+static void gum_duk_instruction_decode_range (GumDukInstruction * self,
+    gconstpointer target, guint count, GPtrArray * insns);
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_instruction_construct)
 GUMJS_DECLARE_FINALIZER (gumjs_instruction_finalize)
@@ -83,6 +88,7 @@ static void gum_push_groups (duk_context * ctx, const uint8_t * groups,
 static const duk_function_list_entry gumjs_instruction_module_functions[] =
 {
   { "_parse", gumjs_instruction_parse, 1 },
+  { "_parseRange", gumjs_instruction_parse_range, 2 },
 
   { NULL, NULL, 0 }
 };
@@ -244,6 +250,111 @@ GUMJS_DEFINE_FUNCTION (gumjs_instruction_parse)
   return 1;
 }
 
+/*
+ * Decodes up to `count` instructions back to back in one go, stopping early
+ * at the first one that is invalid or not readable.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_instruction_parse_range)
+{
+  GumDukInstruction * module;
+  GumExceptor * exceptor = args->core->exceptor;
+  gpointer target;
+  guint count, i;
+  GPtrArray * insns;
+  uint64_t first_address;
+  GumExceptorScope scope;
+
+  module = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "pu", &target, &count);
+
+  insns = g_ptr_array_new ();
+
+  if (gum_exceptor_try (exceptor, &scope))
+  {
+    gum_duk_instruction_decode_range (module, target, count, insns);
+  }
+
+  if (gum_exceptor_catch (exceptor, &scope))
+  {
+    /* The one being decoded when we faulted is only partially there. */
+    cs_free (g_ptr_array_index (insns, insns->len - 1), 1);
+    g_ptr_array_set_size (insns, insns->len - 1);
+
+    if (insns->len == 0)
+    {
+      g_ptr_array_unref (insns);
+      _gum_duk_throw_native (ctx, &scope.exception, args->core);
+    }
+  }
+
+  if (insns->len == 0)
+  {
+    g_ptr_array_unref (insns);
+    _gum_duk_throw (ctx, "invalid instruction");
+  }
+
+  first_address = ((cs_insn *) g_ptr_array_index (insns, 0))->address;
+
+  duk_push_array (ctx);
+
+  for (i = 0; i != insns->len; i++)
+  {
+    const cs_insn * insn = g_ptr_array_index (insns, i);
+
+    _gum_duk_push_instruction (ctx, module->capstone, insn, TRUE,
+        GSIZE_TO_POINTER (GPOINTER_TO_SIZE (target) +
+            (insn->address - first_address)),
+        module);
+    duk_put_prop_index (ctx, -2, i);
+  }
+
+  g_ptr_array_unref (insns);
+
+  return 1;
+}
+
+/*
+ * Runs inside an exceptor scope. Each instruction is added to `insns` before
+ * it is decoded, so the caller can tell which one was cut short by a fault.
+ */
+static void
+gum_duk_instruction_decode_range (GumDukInstruction * self,
+                                  gconstpointer target,
+                                  guint count,
+                                  GPtrArray * insns)
+{
+  uint64_t address;
+  const uint8_t * code;
+
+#ifdef HAVE_ARM
+  address = GPOINTER_TO_SIZE (target) & ~1;
+  cs_option (self->capstone, CS_OPT_MODE,
+      (GPOINTER_TO_SIZE (target) & 1) == 1 ? CS_MODE_THUMB : CS_MODE_ARM);
+#else
+  address = GPOINTER_TO_SIZE (target);
+#endif
+
+  code = GSIZE_TO_POINTER (address);
+
+  while (insns->len != count)
+  {
+    cs_insn * insn;
+    size_t size;
+
+    insn = cs_malloc (self->capstone);
+    g_ptr_array_add (insns, insn);
+
+    size = GUM_MAX_INSTRUCTION_SIZE;
+    if (!cs_disasm_iter (self->capstone, &code, &size, &address, insn))
+    {
+      g_ptr_array_set_size (insns, insns->len - 1);
+      cs_free (insn, 1);
+      break;
+    }
+  }
+}
+
 static GumDukInstructionValue *
 gumjs_instruction_from_args (const GumDukArgs * args)
 {
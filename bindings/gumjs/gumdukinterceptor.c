@@ -9,18 +9,24 @@
 #include "gumdukmacros.h"
 #include "gumdukscript-priv.h"
 
+#include <gum/gumdeferredlistener.h>
+
 #define GUM_DUK_INVOCATION_LISTENER_CAST(obj) \
     ((GumDukInvocationListener *) (obj))
 #define GUM_DUK_TYPE_CALL_LISTENER (gum_duk_call_listener_get_type ())
 #define GUM_DUK_TYPE_PROBE_LISTENER (gum_duk_probe_listener_get_type ())
+#define GUM_DUK_CAPTURE_DRAIN_BATCH_SIZE 256
 
 typedef struct _GumDukInvocationListener GumDukInvocationListener;
+typedef void (* GumDukNativeInvocationCallback) (GumInvocationContext * ic);
 typedef struct _GumDukCallListener GumDukCallListener;
 typedef struct _GumDukCallListenerClass GumDukCallListenerClass;
 typedef struct _GumDukProbeListener GumDukProbeListener;
 typedef struct _GumDukProbeListenerClass GumDukProbeListenerClass;
 typedef struct _GumDukInvocationState GumDukInvocationState;
 typedef struct _GumDukReplaceEntry GumDukReplaceEntry;
+typedef struct _GumDukCaptureEntry GumDukCaptureEntry;
+typedef struct _GumDukDeferredSink GumDukDeferredSink;
 
 struct _GumDukInvocationListener
 {
@@ -30,6 +36,15 @@ struct _GumDukInvocationListener
   GumDukHeapPtr on_enter;
   GumDukHeapPtr on_leave;
 
+  gboolean is_native;
+  GumDukNativeInvocationCallback native_on_enter;
+  GumDukNativeInvocationCallback native_on_leave;
+
+  GumDeferredListener * deferred;
+
+  gpointer target;
+  GumDukCallbackStats stats;
+
   GumDukInterceptor * module;
 };
 
@@ -84,13 +99,51 @@ struct _GumDukReplaceEntry
   GumDukCore * core;
 };
 
+struct _GumDukCaptureEntry
+{
+  GumInterceptor * interceptor;
+  gpointer target;
+};
+
+struct _GumDukDeferredSink
+{
+  volatile gint ref_count;
+
+  GumDukHeapPtr on_calls;
+  guint n_args;
+
+  GMutex mutex;
+  GArray * invocations;
+  gboolean drain_scheduled;
+
+  GumDukCore * core;
+};
+
 static gboolean gum_duk_interceptor_on_flush_timer_tick (
     GumDukInterceptor * self);
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_interceptor_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_attach)
+static void gum_duk_interceptor_attach_listener (GumDukInterceptor * self,
+    duk_context * ctx, gpointer target, GumDukInvocationListener * listener,
+    gpointer listener_function_data);
+static gboolean gum_duk_interceptor_get_native_callbacks (duk_context * ctx,
+    duk_idx_t index, GumDukCore * core, gpointer * on_enter,
+    gpointer * on_leave);
+static gboolean gum_duk_is_native_pointer (duk_context * ctx, duk_idx_t index,
+    GumDukCore * core);
 static void gum_duk_invocation_listener_destroy (
     GumDukInvocationListener * listener);
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_attach_deferred)
+static GumDukDeferredSink * gum_duk_deferred_sink_new (duk_context * ctx,
+    GumDukHeapPtr on_calls, guint n_args, GumDukCore * core);
+static GumDukDeferredSink * gum_duk_deferred_sink_ref (
+    GumDukDeferredSink * sink);
+static void gum_duk_deferred_sink_unref (GumDukDeferredSink * sink);
+static void gum_duk_deferred_sink_push (
+    const GumDeferredInvocation * invocations, guint n_invocations,
+    GumDukDeferredSink * self);
+static void gum_duk_deferred_sink_drain (GumDukDeferredSink * self);
 static void gum_duk_interceptor_detach (GumDukInterceptor * self,
     GumDukInvocationListener * listener);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_detach_all)
@@ -98,6 +151,12 @@ GUMJS_DECLARE_FUNCTION (gumjs_interceptor_replace)
 static void gum_duk_replace_entry_free (GumDukReplaceEntry * entry);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_revert)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_flush)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_set_statistics_enabled)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_get_statistics)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_capture)
+static void gum_duk_capture_entry_free (GumDukCaptureEntry * entry);
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_detach_capture)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_drain_captures)
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_invocation_listener_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_invocation_listener_detach)
@@ -166,11 +225,17 @@ static void gum_duk_interceptor_release_invocation_return_value (
 
 static const duk_function_list_entry gumjs_interceptor_functions[] =
 {
-  { "_attach", gumjs_interceptor_attach, 2 },
+  { "_attach", gumjs_interceptor_attach, DUK_VARARGS },
+  { "_attachDeferred", gumjs_interceptor_attach_deferred, 3 },
   { "detachAll", gumjs_interceptor_detach_all, 0 },
   { "_replace", gumjs_interceptor_replace, 2 },
   { "revert", gumjs_interceptor_revert, 1 },
   { "flush", gumjs_interceptor_flush, 0 },
+  { "setStatisticsEnabled", gumjs_interceptor_set_statistics_enabled, 1 },
+  { "getStatistics", gumjs_interceptor_get_statistics, 0 },
+  { "_capture", gumjs_interceptor_capture, 3 },
+  { "detachCapture", gumjs_interceptor_detach_capture, 1 },
+  { "drainCaptures", gumjs_interceptor_drain_captures, 0 },
 
   { NULL, NULL, 0 }
 };
@@ -235,6 +300,8 @@ _gum_duk_interceptor_init (GumDukInterceptor * self,
       (GDestroyNotify) gum_duk_invocation_listener_destroy);
   self->replacement_by_address = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_duk_replace_entry_free);
+  self->capture_by_address = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_duk_capture_entry_free);
   self->flush_timer = NULL;
 
   _gum_duk_store_module_data (ctx, "interceptor", self);
@@ -302,6 +369,7 @@ _gum_duk_interceptor_flush (GumDukInterceptor * self)
 
   g_hash_table_remove_all (self->invocation_listeners);
   g_hash_table_remove_all (self->replacement_by_address);
+  g_hash_table_remove_all (self->capture_by_address);
 
   _gum_duk_scope_suspend (&scope);
 
@@ -375,10 +443,37 @@ _gum_duk_interceptor_finalize (GumDukInterceptor * self)
 {
   g_clear_pointer (&self->invocation_listeners, g_hash_table_unref);
   g_clear_pointer (&self->replacement_by_address, g_hash_table_unref);
+  g_clear_pointer (&self->capture_by_address, g_hash_table_unref);
 
   g_clear_pointer (&self->interceptor, g_object_unref);
 }
 
+/* Native and deferred listeners run no JS of their own and are left out. */
+void
+_gum_duk_interceptor_push_listener_statistics (GumDukInterceptor * self,
+                                               duk_context * ctx)
+{
+  GHashTableIter iter;
+  GumDukInvocationListener * listener;
+  duk_uarridx_t i;
+
+  duk_push_array (ctx);
+
+  g_hash_table_iter_init (&iter, self->invocation_listeners);
+  i = 0;
+  while (g_hash_table_iter_next (&iter, (gpointer *) &listener, NULL))
+  {
+    if (listener->on_enter == NULL && listener->on_leave == NULL)
+      continue;
+
+    duk_push_object (ctx);
+    _gum_duk_push_native_pointer (ctx, listener->target, self->core);
+    duk_put_prop_string (ctx, -2, "target");
+    _gum_duk_put_callback_stats (ctx, -1, &listener->stats, self->core);
+    duk_put_prop_index (ctx, -2, i++);
+  }
+}
+
 static GumDukInterceptor *
 gumjs_module_from_args (const GumDukArgs * args)
 {
@@ -395,12 +490,36 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
   GumDukInterceptor * self;
   gpointer target;
   GumDukHeapPtr on_enter, on_leave;
+  gpointer native_on_enter, native_on_leave;
+  gpointer listener_function_data = NULL;
+  gboolean has_data = FALSE;
   GumDukInvocationListener * listener;
-  GumAttachReturn attach_ret;
 
   self = gumjs_module_from_args (args);
 
-  if (duk_is_function (ctx, 1))
+  if (gum_duk_interceptor_get_native_callbacks (ctx, 1, args->core,
+      &native_on_enter, &native_on_leave))
+  {
+    GumDukHeapPtr callbacks;
+
+    _gum_duk_args_parse (args, "pV|p", &target, &callbacks,
+        &listener_function_data);
+    has_data = duk_get_top (ctx) > 2;
+    on_enter = NULL;
+    on_leave = NULL;
+
+    listener = g_object_new ((native_on_leave != NULL)
+        ? GUM_DUK_TYPE_CALL_LISTENER
+        : GUM_DUK_TYPE_PROBE_LISTENER,
+        NULL);
+
+    listener->is_native = TRUE;
+    listener->native_on_enter = GUM_POINTER_TO_FUNCPTR (
+        GumDukNativeInvocationCallback, native_on_enter);
+    listener->native_on_leave = GUM_POINTER_TO_FUNCPTR (
+        GumDukNativeInvocationCallback, native_on_leave);
+  }
+  else if (duk_is_function (ctx, 1))
   {
     _gum_duk_args_parse (args, "pF", &target, &on_enter);
     on_leave = NULL;
@@ -419,18 +538,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
   listener->on_leave = on_leave;
   listener->module = self;
 
-  attach_ret = gum_interceptor_attach_listener (self->interceptor, target,
-      GUM_INVOCATION_LISTENER (listener), NULL);
-
-  if (attach_ret != GUM_ATTACH_OK)
-    goto unable_to_attach;
-
-  duk_push_heapptr (ctx, self->invocation_listener);
-  duk_new (ctx, 0);
-
-  listener->object = _gum_duk_require_heapptr (ctx, -1);
-
-  _gum_duk_put_data (ctx, -1, listener);
+  gum_duk_interceptor_attach_listener (self, ctx, target, listener,
+      listener_function_data);
 
   if (on_enter != NULL)
   {
@@ -444,9 +553,52 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
     duk_put_prop_string (ctx, -2, DUK_HIDDEN_SYMBOL ("on-leave"));
   }
 
-  g_hash_table_add (self->invocation_listeners, listener);
+  if (listener->is_native)
+  {
+    /* Keep whatever backs the callbacks and their data alive */
+    duk_dup (ctx, 1);
+    duk_put_prop_string (ctx, -2, DUK_HIDDEN_SYMBOL ("callbacks"));
+
+    if (has_data)
+    {
+      duk_dup (ctx, 2);
+      duk_put_prop_string (ctx, -2, DUK_HIDDEN_SYMBOL ("data"));
+    }
+  }
 
   return 1;
+}
+
+/*
+ * Attaches `listener` and pushes the InvocationListener object that
+ * represents it, throwing if the interceptor refused.
+ */
+static void
+gum_duk_interceptor_attach_listener (GumDukInterceptor * self,
+                                     duk_context * ctx,
+                                     gpointer target,
+                                     GumDukInvocationListener * listener,
+                                     gpointer listener_function_data)
+{
+  GumAttachReturn attach_ret;
+
+  attach_ret = gum_interceptor_attach_listener (self->interceptor, target,
+      GUM_INVOCATION_LISTENER (listener), listener_function_data);
+
+  if (attach_ret != GUM_ATTACH_OK)
+    goto unable_to_attach;
+
+  duk_push_heapptr (ctx, self->invocation_listener);
+  duk_new (ctx, 0);
+
+  listener->object = _gum_duk_require_heapptr (ctx, -1);
+
+  _gum_duk_put_data (ctx, -1, listener);
+
+  listener->target = target;
+  g_hash_table_add (self->invocation_listeners, listener);
+
+  return;
 
 unable_to_attach:
   {
@@ -464,9 +616,71 @@ unable_to_attach:
       default:
         g_assert_not_reached ();
     }
+  }
+}
 
-    return 0;
+/*
+ * Native callbacks are passed either as a NativePointer in place of the
+ * probe function, or as NativePointer values of onEnter and onLeave. They
+ * are called with the GumInvocationContext and run without entering the
+ * script, so the data given to attach() is their only link to it.
+ */
+static gboolean
+gum_duk_interceptor_get_native_callbacks (duk_context * ctx,
+                                          duk_idx_t index,
+                                          GumDukCore * core,
+                                          gpointer * on_enter,
+                                          gpointer * on_leave)
+{
+  gboolean is_native = FALSE;
+
+  *on_enter = NULL;
+  *on_leave = NULL;
+
+  if (gum_duk_is_native_pointer (ctx, index, core))
+  {
+    *on_enter = _gum_duk_require_pointer (ctx, index, core);
+    return TRUE;
   }
+
+  if (!duk_is_object (ctx, index) || duk_is_function (ctx, index))
+    return FALSE;
+
+  duk_get_prop_string (ctx, index, "onEnter");
+  if (gum_duk_is_native_pointer (ctx, -1, core))
+  {
+    *on_enter = _gum_duk_require_pointer (ctx, -1, core);
+    is_native = TRUE;
+  }
+  duk_pop (ctx);
+
+  duk_get_prop_string (ctx, index, "onLeave");
+  if (gum_duk_is_native_pointer (ctx, -1, core))
+  {
+    *on_leave = _gum_duk_require_pointer (ctx, -1, core);
+    is_native = TRUE;
+  }
+  duk_pop (ctx);
+
+  return is_native;
+}
+
+static gboolean
+gum_duk_is_native_pointer (duk_context * ctx,
+                           duk_idx_t index,
+                           GumDukCore * core)
+{
+  gboolean result;
+
+  index = duk_normalize_index (ctx, index);
+  if (index == DUK_INVALID_INDEX || !duk_is_object (ctx, index))
+    return FALSE;
+
+  duk_push_heapptr (ctx, core->native_pointer);
+  result = duk_instanceof (ctx, index, -1);
+  duk_pop (ctx);
+
+  return result;
 }
 
 static void
@@ -477,6 +691,195 @@ gum_duk_invocation_listener_destroy (GumDukInvocationListener * listener)
   g_object_unref (listener);
 }
 
+/*
+ * Deferred listeners record calls without entering the script, so hooked
+ * threads never wait for the JS lock. The records are handed to `onCalls`
+ * on the JS thread, in batches, some time after the calls returned.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach_deferred)
+{
+  GumDukInterceptor * self;
+  gpointer target;
+  GumDukHeapPtr on_calls;
+  guint n_args;
+  GumDukInvocationListener * listener;
+  GumDukDeferredSink * sink;
+
+  self = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "pFu", &target, &on_calls, &n_args);
+
+  if (n_args > GUM_DEFERRED_MAX_ARGS)
+  {
+    _gum_duk_throw (ctx, "at most %u arguments can be recorded",
+        GUM_DEFERRED_MAX_ARGS);
+  }
+
+  listener = g_object_new (GUM_DUK_TYPE_CALL_LISTENER, NULL);
+
+  sink = gum_duk_deferred_sink_new (ctx, on_calls, n_args, args->core);
+  listener->deferred = gum_deferred_listener_new (n_args,
+      (GumDeferredInvocationFunc) gum_duk_deferred_sink_push, sink,
+      (GDestroyNotify) gum_duk_deferred_sink_unref);
+
+  listener->module = self;
+
+  gum_duk_interceptor_attach_listener (self, ctx, target, listener, NULL);
+
+  return 1;
+}
+
+static GumDukDeferredSink *
+gum_duk_deferred_sink_new (duk_context * ctx,
+                           GumDukHeapPtr on_calls,
+                           guint n_args,
+                           GumDukCore * core)
+{
+  GumDukDeferredSink * sink;
+
+  sink = g_slice_new (GumDukDeferredSink);
+  sink->ref_count = 1;
+
+  _gum_duk_protect (ctx, on_calls);
+  sink->on_calls = on_calls;
+  sink->n_args = n_args;
+
+  g_mutex_init (&sink->mutex);
+  sink->invocations = g_array_new (FALSE, FALSE,
+      sizeof (GumDeferredInvocation));
+  sink->drain_scheduled = FALSE;
+
+  sink->core = core;
+  _gum_duk_core_pin (core);
+
+  return sink;
+}
+
+static GumDukDeferredSink *
+gum_duk_deferred_sink_ref (GumDukDeferredSink * sink)
+{
+  g_atomic_int_inc (&sink->ref_count);
+
+  return sink;
+}
+
+static void
+gum_duk_deferred_sink_unref (GumDukDeferredSink * sink)
+{
+  GumDukCore * core = sink->core;
+  GumDukScope scope;
+  duk_context * ctx;
+
+  if (!g_atomic_int_dec_and_test (&sink->ref_count))
+    return;
+
+  ctx = _gum_duk_scope_enter (&scope, core);
+
+  _gum_duk_unprotect (ctx, sink->on_calls);
+
+  _gum_duk_core_unpin (core);
+
+  _gum_duk_scope_leave (&scope);
+
+  g_array_free (sink->invocations, TRUE);
+  g_mutex_clear (&sink->mutex);
+
+  g_slice_free (GumDukDeferredSink, sink);
+}
+
+static void
+gum_duk_deferred_sink_push (const GumDeferredInvocation * invocations,
+                            guint n_invocations,
+                            GumDukDeferredSink * self)
+{
+  gboolean schedule_drain;
+
+  g_mutex_lock (&self->mutex);
+  g_array_append_vals (self->invocations, invocations, n_invocations);
+  schedule_drain = !self->drain_scheduled;
+  self->drain_scheduled = TRUE;
+  g_mutex_unlock (&self->mutex);
+
+  if (schedule_drain)
+  {
+    gum_script_scheduler_push_job_on_js_thread (self->core->scheduler,
+        G_PRIORITY_DEFAULT, (GumScriptJobFunc) gum_duk_deferred_sink_drain,
+        gum_duk_deferred_sink_ref (self),
+        (GDestroyNotify) gum_duk_deferred_sink_unref);
+  }
+}
+
+static void
+gum_duk_deferred_sink_drain (GumDukDeferredSink * self)
+{
+  GumDukCore * core = self->core;
+  GArray * invocations;
+
+  g_mutex_lock (&self->mutex);
+  invocations = self->invocations;
+  self->invocations = g_array_new (FALSE, FALSE,
+      sizeof (GumDeferredInvocation));
+  self->drain_scheduled = FALSE;
+  g_mutex_unlock (&self->mutex);
+
+  if (invocations->len != 0)
+  {
+    GumDukScope scope;
+    duk_context * ctx;
+    guint i;
+
+    ctx = _gum_duk_scope_enter (&scope, core);
+
+    duk_push_heapptr (ctx, self->on_calls);
+
+    duk_push_array (ctx);
+    for (i = 0; i != invocations->len; i++)
+    {
+      const GumDeferredInvocation * invocation;
+      guint j;
+
+      invocation = &g_array_index (invocations, GumDeferredInvocation, i);
+
+      duk_push_object (ctx);
+
+      _gum_duk_push_native_pointer (ctx, invocation->function, core);
+      duk_put_prop_string (ctx, -2, "function");
+
+      duk_push_uint (ctx, invocation->thread_id);
+      duk_put_prop_string (ctx, -2, "threadId");
+
+      duk_push_uint (ctx, invocation->depth);
+      duk_put_prop_string (ctx, -2, "depth");
+
+      duk_push_number (ctx, (double) invocation->timestamp);
+      duk_put_prop_string (ctx, -2, "timestamp");
+
+      duk_push_number (ctx, (double) invocation->duration);
+      duk_put_prop_string (ctx, -2, "duration");
+
+      duk_push_array (ctx);
+      for (j = 0; j != self->n_args; j++)
+      {
+        _gum_duk_push_native_pointer (ctx, invocation->args[j], core);
+        duk_put_prop_index (ctx, -2, j);
+      }
+      duk_put_prop_string (ctx, -2, "args");
+
+      _gum_duk_push_native_pointer (ctx, invocation->return_value, core);
+      duk_put_prop_string (ctx, -2, "retval");
+
+      duk_put_prop_index (ctx, -2, i);
+    }
+
+    _gum_duk_scope_call (&scope, 1);
+    duk_pop (ctx);
+
+    _gum_duk_scope_leave (&scope);
+  }
+
+  g_array_free (invocations, TRUE);
+}
+
 static void
 gum_duk_interceptor_detach (GumDukInterceptor * self,
                             GumDukInvocationListener * listener)
@@ -587,6 +990,183 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_flush)
   return 0;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_set_statistics_enabled)
+{
+  GumDukInterceptor * self;
+  gboolean enabled;
+
+  self = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "t", &enabled);
+
+  gum_interceptor_set_statistics_enabled (self->interceptor, enabled);
+
+  return 0;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_get_statistics)
+{
+  GumDukInterceptor * self;
+  GArray * statistics;
+  guint i;
+
+  self = gumjs_module_from_args (args);
+
+  statistics = gum_interceptor_get_statistics (self->interceptor);
+
+  duk_push_array (ctx);
+  for (i = 0; i != statistics->len; i++)
+  {
+    GumFunctionStatistics * stats;
+
+    stats = &g_array_index (statistics, GumFunctionStatistics, i);
+
+    duk_push_object (ctx);
+    _gum_duk_push_native_pointer (ctx, stats->function_address, args->core);
+    duk_put_prop_string (ctx, -2, "address");
+    _gum_duk_push_uint64 (ctx, stats->calls, args->core);
+    duk_put_prop_string (ctx, -2, "calls");
+    _gum_duk_push_uint64 (ctx, stats->bypassed_calls, args->core);
+    duk_put_prop_string (ctx, -2, "bypassedCalls");
+    _gum_duk_push_uint64 (ctx, stats->listener_time, args->core);
+    duk_put_prop_string (ctx, -2, "listenerTime");
+    duk_put_prop_index (ctx, -2, i);
+  }
+
+  g_array_free (statistics, TRUE);
+
+  return 1;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_capture)
+{
+  GumDukInterceptor * self;
+  gpointer target;
+  guint n_args;
+  gboolean capture_return;
+  GumAttachReturn attach_ret;
+  GumDukCaptureEntry * entry;
+
+  self = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "put", &target, &n_args, &capture_return);
+
+  if (n_args > GUM_CAPTURE_MAX_ARGS)
+  {
+    _gum_duk_throw (ctx, "at most %u arguments can be captured",
+        GUM_CAPTURE_MAX_ARGS);
+  }
+
+  attach_ret = gum_interceptor_attach_capture (self->interceptor, target,
+      n_args, capture_return);
+  switch (attach_ret)
+  {
+    case GUM_ATTACH_OK:
+      break;
+    case GUM_ATTACH_WRONG_SIGNATURE:
+      _gum_duk_throw (ctx, "unable to intercept function at %p; "
+          "please file a bug", target);
+    case GUM_ATTACH_ALREADY_ATTACHED:
+      _gum_duk_throw (ctx, "already capturing this function");
+    case GUM_ATTACH_POLICY_VIOLATION:
+      _gum_duk_throw (ctx, "not permitted by code-signing policy");
+    default:
+      g_assert_not_reached ();
+  }
+
+  entry = g_slice_new (GumDukCaptureEntry);
+  entry->interceptor = self->interceptor;
+  entry->target = target;
+
+  g_hash_table_insert (self->capture_by_address, target, entry);
+
+  return 0;
+}
+
+static void
+gum_duk_capture_entry_free (GumDukCaptureEntry * entry)
+{
+  gum_interceptor_detach_capture (entry->interceptor, entry->target);
+
+  g_slice_free (GumDukCaptureEntry, entry);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_detach_capture)
+{
+  GumDukInterceptor * self;
+  gpointer target;
+
+  self = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "p", &target);
+
+  g_hash_table_remove (self->capture_by_address, target);
+
+  return 0;
+}
+
+/*
+ * Captures are process wide, so this also returns calls captured by other
+ * users of the interceptor, if any.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_drain_captures)
+{
+  GumDukInterceptor * self;
+  GumDukCore * core = args->core;
+  GumCapturedCall * calls;
+  guint n, i, j;
+  duk_uarridx_t index = 0;
+
+  self = gumjs_module_from_args (args);
+
+  calls = g_new (GumCapturedCall, GUM_DUK_CAPTURE_DRAIN_BATCH_SIZE);
+
+  duk_push_array (ctx);
+
+  do
+  {
+    n = gum_interceptor_drain_captures (self->interceptor, calls,
+        GUM_DUK_CAPTURE_DRAIN_BATCH_SIZE);
+
+    for (i = 0; i != n; i++)
+    {
+      const GumCapturedCall * call = &calls[i];
+
+      duk_push_object (ctx);
+
+      _gum_duk_push_native_pointer (ctx, call->function, core);
+      duk_put_prop_string (ctx, -2, "function");
+
+      duk_push_uint (ctx, call->thread_id);
+      duk_put_prop_string (ctx, -2, "threadId");
+
+      duk_push_number (ctx, (double) call->timestamp);
+      duk_put_prop_string (ctx, -2, "timestamp");
+
+      duk_push_array (ctx);
+      for (j = 0; j != call->n_args; j++)
+      {
+        _gum_duk_push_native_pointer (ctx, call->args[j], core);
+        duk_put_prop_index (ctx, -2, j);
+      }
+      duk_put_prop_string (ctx, -2, "args");
+
+      if (call->has_return_value)
+      {
+        _gum_duk_push_native_pointer (ctx, call->return_value, core);
+        duk_put_prop_string (ctx, -2, "retval");
+      }
+
+      duk_put_prop_index (ctx, -2, index++);
+    }
+  }
+  while (n == GUM_DUK_CAPTURE_DRAIN_BATCH_SIZE);
+
+  g_free (calls);
+
+  return 1;
+}
+
 GUMJS_DEFINE_CONSTRUCTOR (gumjs_invocation_listener_construct)
 {
   return 0;
@@ -617,6 +1197,7 @@ gum_duk_invocation_listener_dispose (GumDukInvocationListener * self)
 
   ctx = _gum_duk_scope_enter (&scope, core);
   _gum_duk_release_heapptr (ctx, self->object);
+  g_clear_object (&self->deferred);
   _gum_duk_scope_leave (&scope);
 }
 
@@ -628,6 +1209,21 @@ gum_duk_invocation_listener_on_enter (GumInvocationListener * listener,
   GumDukInvocationState * state;
 
   self = GUM_DUK_INVOCATION_LISTENER_CAST (listener);
+
+  if (self->deferred != NULL)
+  {
+    gum_invocation_listener_on_enter (
+        GUM_INVOCATION_LISTENER (self->deferred), ic);
+    return;
+  }
+
+  if (self->is_native)
+  {
+    if (self->native_on_enter != NULL)
+      self->native_on_enter (ic);
+    return;
+  }
+
   state = GUM_LINCTX_GET_FUNC_INVDATA (ic, GumDukInvocationState);
 
   if (self->on_enter != NULL)
@@ -640,6 +1236,7 @@ gum_duk_invocation_listener_on_enter (GumInvocationListener * listener,
     GumDukInvocationArgs * args;
 
     ctx = _gum_duk_scope_enter (&scope, core);
+    _gum_duk_scope_track (&scope, &self->stats);
 
     jic = _gum_duk_interceptor_obtain_invocation_context (module);
     _gum_duk_invocation_context_reset (jic, ic);
@@ -683,6 +1280,20 @@ gum_duk_invocation_listener_on_leave (GumInvocationListener * listener,
   GumDukInvocationState * state;
 
   self = GUM_DUK_INVOCATION_LISTENER_CAST (listener);
+
+  if (self->deferred != NULL)
+  {
+    gum_invocation_listener_on_leave (
+        GUM_INVOCATION_LISTENER (self->deferred), ic);
+    return;
+  }
+
+  if (self->is_native)
+  {
+    self->native_on_leave (ic);
+    return;
+  }
+
   state = GUM_LINCTX_GET_FUNC_INVDATA (ic, GumDukInvocationState);
 
   if (self->on_leave != NULL)
@@ -695,6 +1306,7 @@ gum_duk_invocation_listener_on_leave (GumInvocationListener * listener,
     GumDukInvocationReturnValue * retval;
 
     ctx = _gum_duk_scope_enter (&scope, core);
+    _gum_duk_scope_track (&scope, &self->stats);
 
     jic = (self->on_enter != NULL) ? state->jic : NULL;
     if (jic == NULL)
@@ -851,7 +1463,7 @@ _gum_duk_invocation_context_reset (GumDukInvocationContext * self,
 
     duk_push_heapptr (ctx, self->object);
     duk_push_null (ctx);
-    duk_put_prop_string (ctx, -2, DUK_HIDDEN_SYMBOL ("cc"));
+    duk_put_prop_literal (ctx, -2, DUK_HIDDEN_SYMBOL ("cc"));
     duk_pop (ctx);
   }
 }
@@ -908,7 +1520,7 @@ GUMJS_DEFINE_GETTER (gumjs_invocation_context_get_cpu_context)
     duk_push_this (ctx);
     self->cpu_context = _gum_duk_push_cpu_context (ctx,
         self->handle->cpu_context, GUM_CPU_CONTEXT_READWRITE, args->core);
-    duk_put_prop_string (ctx, -2, DUK_HIDDEN_SYMBOL ("cc"));
+    duk_put_prop_literal (ctx, -2, DUK_HIDDEN_SYMBOL ("cc"));
     duk_pop (ctx);
   }
 
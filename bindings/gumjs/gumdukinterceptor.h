@@ -25,6 +25,7 @@ struct _GumDukInterceptor
 
   GHashTable * invocation_listeners;
   GHashTable * replacement_by_address;
+  GHashTable * capture_by_address;
   GSource * flush_timer;
 
   GumDukHeapPtr invocation_listener;
@@ -58,6 +59,9 @@ G_GNUC_INTERNAL void _gum_duk_interceptor_flush (GumDukInterceptor * self);
 G_GNUC_INTERNAL void _gum_duk_interceptor_dispose (GumDukInterceptor * self);
 G_GNUC_INTERNAL void _gum_duk_interceptor_finalize (GumDukInterceptor * self);
 
+G_GNUC_INTERNAL void _gum_duk_interceptor_push_listener_statistics (
+    GumDukInterceptor * self, duk_context * ctx);
+
 G_GNUC_INTERNAL GumDukInvocationContext *
 _gum_duk_interceptor_obtain_invocation_context (GumDukInterceptor * self);
 G_GNUC_INTERNAL void _gum_duk_interceptor_release_invocation_context (
@@ -19,6 +19,7 @@
 typedef guint GumMemoryValueType;
 typedef struct _GumMemoryPatchContext GumMemoryPatchContext;
 typedef struct _GumMemoryScanContext GumMemoryScanContext;
+typedef struct _GumMemoryScanSyncContext GumMemoryScanSyncContext;
 
 enum _GumMemoryValueType
 {
@@ -52,7 +53,7 @@ struct _GumMemoryPatchContext
 struct _GumMemoryScanContext
 {
   GumMemoryRange range;
-  GumMatchPattern * pattern;
+  GPtrArray * patterns;
   GumDukHeapPtr on_match;
   GumDukHeapPtr on_error;
   GumDukHeapPtr on_complete;
@@ -60,9 +61,18 @@ struct _GumMemoryScanContext
   GumDukCore * core;
 };
 
+struct _GumMemoryScanSyncContext
+{
+  gboolean report_pattern_index;
+
+  GumDukCore * core;
+};
+
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_memory_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_arena)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_copy)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_view)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_protect)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_patch_code)
 static void gum_memory_patch_context_apply (gpointer mem,
@@ -70,6 +80,9 @@ static void gum_memory_patch_context_apply (gpointer mem,
 
 static int gum_duk_memory_read (GumMemoryValueType type,
     const GumDukArgs * args);
+static gsize gum_duk_memory_get_scalar_size (GumMemoryValueType type);
+static void gum_duk_memory_push_scalar (duk_context * ctx,
+    GumMemoryValueType type, gconstpointer data, GumDukCore * core);
 static int gum_duk_memory_write (GumMemoryValueType type,
     const GumDukArgs * args);
 
@@ -127,10 +140,12 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_scan)
 static void gum_memory_scan_context_free (GumMemoryScanContext * ctx);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
-    gsize size, GumMemoryScanContext * self);
+    gsize size, guint pattern_index, GumMemoryScanContext * self);
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean gum_append_match (GumAddress address, gsize size,
-    GumDukCore * core);
+    guint pattern_index, GumMemoryScanSyncContext * sc);
+static GPtrArray * gum_parse_match_patterns (duk_context * ctx,
+    duk_idx_t index, gboolean * is_multi);
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_memory_access_monitor_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_enable)
@@ -139,7 +154,9 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_disable)
 static const duk_function_list_entry gumjs_memory_functions[] =
 {
   { "alloc", gumjs_memory_alloc, 1 },
+  { "arena", gumjs_memory_arena, 1 },
   { "copy", gumjs_memory_copy, 3 },
+  { "view", gumjs_memory_view, 2 },
   { "protect", gumjs_memory_protect, 3 },
   { "_patchCode", gumjs_memory_patch_code, 3 },
 
@@ -193,6 +210,12 @@ _gum_duk_memory_init (GumDukMemory * self,
 
   self->core = core;
 
+  self->pool = gum_memory_pool_new ();
+  self->arena = gum_memory_arena_new ();
+  self->arena_depth = 0;
+
+  _gum_duk_store_module_data (ctx, "memory", self);
+
   duk_push_c_function (ctx, gumjs_memory_construct, 0);
   duk_push_object (ctx);
   duk_put_function_list (ctx, -1, gumjs_memory_functions);
@@ -218,6 +241,14 @@ _gum_duk_memory_dispose (GumDukMemory * self)
 void
 _gum_duk_memory_finalize (GumDukMemory * self)
 {
+  gum_memory_arena_free (self->arena);
+  gum_memory_pool_free (self->pool);
+}
+
+static GumDukMemory *
+gumjs_module_from_args (const GumDukArgs * args)
+{
+  return _gum_duk_load_module_data (args->ctx, "memory");
 }
 
 GUMJS_DEFINE_CONSTRUCTOR (gumjs_memory_construct)
@@ -227,6 +258,7 @@ GUMJS_DEFINE_CONSTRUCTOR (gumjs_memory_construct)
 
 GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc)
 {
+  GumDukMemory * self = gumjs_module_from_args (args);
   GumDukCore * core = args->core;
   gsize size, page_size;
 
@@ -237,7 +269,17 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc)
 
   page_size = gum_query_page_size ();
 
-  if (size < page_size)
+  if (self->arena_depth != 0 && size < page_size)
+  {
+    _gum_duk_push_native_pointer (ctx,
+        gum_memory_arena_alloc (self->arena, size), core);
+  }
+  else if (size <= GUM_MEMORY_POOL_MAX_SIZE)
+  {
+    _gum_duk_push_native_resource (ctx, gum_memory_pool_alloc (self->pool,
+        size), gum_memory_pool_release, core);
+  }
+  else if (size < page_size)
   {
     _gum_duk_push_native_resource (ctx, g_malloc0 (size), g_free, core);
   }
@@ -250,6 +292,33 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc)
   return 1;
 }
 
+/*
+ * Small allocations made while the callback runs come from the arena rather
+ * than being tracked by the garbage collector, and all of them are released
+ * together when the outermost arena() returns, even if it throws.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_memory_arena)
+{
+  GumDukMemory * self = gumjs_module_from_args (args);
+  GumDukHeapPtr callback;
+  duk_int_t result;
+
+  _gum_duk_args_parse (args, "F", &callback);
+
+  self->arena_depth++;
+
+  duk_push_heapptr (ctx, callback);
+  result = duk_pcall (ctx, 0);
+
+  if (--self->arena_depth == 0)
+    gum_memory_arena_reset (self->arena);
+
+  if (result != DUK_EXEC_SUCCESS)
+    duk_throw (ctx);
+
+  return 1;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_memory_copy)
 {
   GumDukCore * core = args->core;
@@ -278,6 +347,39 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_copy)
   return 0;
 }
 
+/*
+ * Wraps target memory in an ArrayBuffer without copying, so typed arrays and
+ * DataViews over it read and write the memory directly. The range is only
+ * checked when the view is created; accesses through the view are not
+ * guarded, so it must not outlive the mapping.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_memory_view)
+{
+  gpointer address;
+  gsize size;
+
+  _gum_duk_args_parse (args, "pZ", &address, &size);
+
+  if (size > 0x7fffffff)
+    _gum_duk_throw (ctx, "invalid size");
+
+  if (size != 0 && !gum_memory_is_readable (GUM_ADDRESS (address), size))
+  {
+    _gum_duk_throw (ctx, "access violation accessing 0x%" G_GSIZE_MODIFIER "x",
+        GPOINTER_TO_SIZE (address));
+  }
+
+  duk_push_external_buffer (ctx);
+  duk_config_buffer (ctx, -1, address, size);
+
+  duk_push_buffer_object (ctx, -1, 0, size, DUK_BUFOBJ_ARRAYBUFFER);
+
+  duk_swap (ctx, -2, -1);
+  duk_pop (ctx);
+
+  return 1;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_memory_protect)
 {
   gpointer address;
@@ -340,6 +442,8 @@ gum_duk_memory_read (GumMemoryValueType type,
   GumExceptor * exceptor = core->exceptor;
   gpointer address;
   gssize length = -1;
+  gsize scalar_size;
+  guint64 scalar;
   GumExceptorScope scope;
 
   switch (type)
@@ -358,48 +462,33 @@ gum_duk_memory_read (GumMemoryValueType type,
       break;
   }
 
+  /* A faulting scalar read is retried below, to get at the fault details. */
+  scalar_size = gum_duk_memory_get_scalar_size (type);
+  if (scalar_size != 0 &&
+      gum_exceptor_try_read (exceptor, address, scalar_size, &scalar))
+  {
+    gum_duk_memory_push_scalar (ctx, type, &scalar, core);
+    return 1;
+  }
+
   if (gum_exceptor_try (exceptor, &scope))
   {
     switch (type)
     {
       case GUM_MEMORY_VALUE_POINTER:
-        _gum_duk_push_native_pointer (ctx, *((gpointer *) address), core);
-        break;
       case GUM_MEMORY_VALUE_S8:
-        duk_push_number (ctx, *((gint8 *) address));
-        break;
       case GUM_MEMORY_VALUE_U8:
-        duk_push_number (ctx, *((guint8 *) address));
-        break;
       case GUM_MEMORY_VALUE_S16:
-        duk_push_number (ctx, *((gint16 *) address));
-        break;
       case GUM_MEMORY_VALUE_U16:
-        duk_push_number (ctx, *((guint16 *) address));
-        break;
       case GUM_MEMORY_VALUE_S32:
-        duk_push_number (ctx, *((gint32 *) address));
-        break;
       case GUM_MEMORY_VALUE_U32:
-        duk_push_number (ctx, *((guint32 *) address));
-        break;
       case GUM_MEMORY_VALUE_S64:
-        _gum_duk_push_int64 (ctx, *((gint64 *) address), core);
-        break;
       case GUM_MEMORY_VALUE_U64:
-        _gum_duk_push_uint64 (ctx, *((guint64 *) address), core);
-        break;
       case GUM_MEMORY_VALUE_LONG:
-        _gum_duk_push_int64 (ctx, *((glong *) address), core);
-        break;
       case GUM_MEMORY_VALUE_ULONG:
-        _gum_duk_push_uint64 (ctx, *((gulong *) address), core);
-        break;
       case GUM_MEMORY_VALUE_FLOAT:
-        duk_push_number (ctx, *((gfloat *) address));
-        break;
       case GUM_MEMORY_VALUE_DOUBLE:
-        duk_push_number (ctx, *((gdouble *) address));
+        gum_duk_memory_push_scalar (ctx, type, address, core);
         break;
       case GUM_MEMORY_VALUE_BYTE_ARRAY:
       {
@@ -562,6 +651,87 @@ gum_duk_memory_read (GumMemoryValueType type,
   return 1;
 }
 
+static gsize
+gum_duk_memory_get_scalar_size (GumMemoryValueType type)
+{
+  switch (type)
+  {
+    case GUM_MEMORY_VALUE_POINTER:
+      return sizeof (gpointer);
+    case GUM_MEMORY_VALUE_S8:
+    case GUM_MEMORY_VALUE_U8:
+      return 1;
+    case GUM_MEMORY_VALUE_S16:
+    case GUM_MEMORY_VALUE_U16:
+      return 2;
+    case GUM_MEMORY_VALUE_S32:
+    case GUM_MEMORY_VALUE_U32:
+    case GUM_MEMORY_VALUE_FLOAT:
+      return 4;
+    case GUM_MEMORY_VALUE_S64:
+    case GUM_MEMORY_VALUE_U64:
+    case GUM_MEMORY_VALUE_DOUBLE:
+      return 8;
+    case GUM_MEMORY_VALUE_LONG:
+    case GUM_MEMORY_VALUE_ULONG:
+      return sizeof (glong);
+    default:
+      return 0;
+  }
+}
+
+static void
+gum_duk_memory_push_scalar (duk_context * ctx,
+                            GumMemoryValueType type,
+                            gconstpointer data,
+                            GumDukCore * core)
+{
+  switch (type)
+  {
+    case GUM_MEMORY_VALUE_POINTER:
+      _gum_duk_push_native_pointer (ctx, *((const gpointer *) data), core);
+      break;
+    case GUM_MEMORY_VALUE_S8:
+      duk_push_number (ctx, *((const gint8 *) data));
+      break;
+    case GUM_MEMORY_VALUE_U8:
+      duk_push_number (ctx, *((const guint8 *) data));
+      break;
+    case GUM_MEMORY_VALUE_S16:
+      duk_push_number (ctx, *((const gint16 *) data));
+      break;
+    case GUM_MEMORY_VALUE_U16:
+      duk_push_number (ctx, *((const guint16 *) data));
+      break;
+    case GUM_MEMORY_VALUE_S32:
+      duk_push_number (ctx, *((const gint32 *) data));
+      break;
+    case GUM_MEMORY_VALUE_U32:
+      duk_push_number (ctx, *((const guint32 *) data));
+      break;
+    case GUM_MEMORY_VALUE_S64:
+      _gum_duk_push_int64 (ctx, *((const gint64 *) data), core);
+      break;
+    case GUM_MEMORY_VALUE_U64:
+      _gum_duk_push_uint64 (ctx, *((const guint64 *) data), core);
+      break;
+    case GUM_MEMORY_VALUE_LONG:
+      _gum_duk_push_int64 (ctx, *((const glong *) data), core);
+      break;
+    case GUM_MEMORY_VALUE_ULONG:
+      _gum_duk_push_uint64 (ctx, *((const gulong *) data), core);
+      break;
+    case GUM_MEMORY_VALUE_FLOAT:
+      duk_push_number (ctx, *((const gfloat *) data));
+      break;
+    case GUM_MEMORY_VALUE_DOUBLE:
+      duk_push_number (ctx, *((const gdouble *) data));
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
+
 static int
 gum_duk_memory_write (GumMemoryValueType type,
                       const GumDukArgs * args)
@@ -820,19 +990,18 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
   GumMemoryScanContext sc;
   gpointer address;
   gsize size;
-  const gchar * match_str;
+  GumDukHeapPtr match_value;
+  gboolean is_multi;
 
-  _gum_duk_args_parse (args, "pZsF{onMatch,onError?,onComplete}",
-      &address, &size, &match_str, &sc.on_match, &sc.on_error, &sc.on_complete);
+  _gum_duk_args_parse (args, "pZVF{onMatch,onError?,onComplete}",
+      &address, &size, &match_value, &sc.on_match, &sc.on_error,
+      &sc.on_complete);
 
   sc.range.base_address = GUM_ADDRESS (address);
   sc.range.size = size;
-  sc.pattern = gum_match_pattern_new_from_string (match_str);
+  sc.patterns = gum_parse_match_patterns (ctx, 2, &is_multi);
   sc.core = core;
 
-  if (sc.pattern == NULL)
-    _gum_duk_throw (ctx, "invalid match pattern");
-
   _gum_duk_protect (ctx, sc.on_match);
   if (sc.on_error != NULL)
     _gum_duk_protect (ctx, sc.on_error);
@@ -864,7 +1033,7 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
   _gum_duk_core_unpin (core);
   _gum_duk_scope_leave (&scope);
 
-  gum_match_pattern_free (self->pattern);
+  g_ptr_array_unref (self->patterns);
 
   g_slice_free (GumMemoryScanContext, self);
 }
@@ -873,20 +1042,20 @@ static void
 gum_memory_scan_context_run (GumMemoryScanContext * self)
 {
   GumDukCore * core = self->core;
-  GumExceptor * exceptor = core->exceptor;
-  GumExceptorScope exceptor_scope;
+  GumExceptionDetails fault;
+  gboolean success;
   GumDukScope script_scope;
   duk_context * ctx;
 
-  if (gum_exceptor_try (exceptor, &exceptor_scope))
-  {
-    gum_memory_scan (&self->range, self->pattern,
-        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self);
-  }
+  success = gum_memory_scan_ranges (&self->range, 1,
+      (const GumMatchPattern * const *) self->patterns->pdata,
+      self->patterns->len, 0, GUM_MEMORY_SCAN_ORDERED,
+      (GumMemoryScanMultiMatchFunc) gum_memory_scan_context_emit_match,
+      self, &fault);
 
   ctx = _gum_duk_scope_enter (&script_scope, core);
 
-  if (gum_exceptor_catch (exceptor, &exceptor_scope))
+  if (!success)
   {
     if (self->on_error != NULL)
     {
@@ -894,7 +1063,7 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
 
       duk_push_heapptr (ctx, self->on_error);
 
-      message = gum_exception_details_to_string (&exceptor_scope.exception);
+      message = gum_exception_details_to_string (&fault);
       duk_push_string (ctx, message);
       g_free (message);
 
@@ -913,6 +1082,7 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
 static gboolean
 gum_memory_scan_context_emit_match (GumAddress address,
                                     gsize size,
+                                    guint pattern_index,
                                     GumMemoryScanContext * self)
 {
   GumDukCore * core = self->core;
@@ -926,10 +1096,11 @@ gum_memory_scan_context_emit_match (GumAddress address,
 
   _gum_duk_push_native_pointer (ctx, GSIZE_TO_POINTER (address), core);
   duk_push_number (ctx, size);
+  duk_push_uint (ctx, pattern_index);
 
   proceed = TRUE;
 
-  if (_gum_duk_scope_call (&scope, 2))
+  if (_gum_duk_scope_call (&scope, 3))
   {
     if (duk_is_string (ctx, -1))
       proceed = strcmp (duk_require_string (ctx, -1), "stop") != 0;
@@ -946,29 +1117,30 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
   GumDukCore * core = args->core;
   gpointer address;
   gsize size;
-  const gchar * match_str;
+  GumDukHeapPtr match_value;
   GumMemoryRange range;
-  GumMatchPattern * pattern;
+  GPtrArray * patterns;
+  GumMemoryScanSyncContext sc;
   GumExceptorScope scope;
 
-  _gum_duk_args_parse (args, "pZs", &address, &size, &match_str);
+  _gum_duk_args_parse (args, "pZV", &address, &size, &match_value);
 
   range.base_address = GUM_ADDRESS (address);
   range.size = size;
 
-  pattern = gum_match_pattern_new_from_string (match_str);
-  if (pattern == NULL)
-    _gum_duk_throw (ctx, "invalid match pattern");
+  patterns = gum_parse_match_patterns (ctx, 2, &sc.report_pattern_index);
+  sc.core = core;
 
   duk_push_array (ctx);
 
   if (gum_exceptor_try (core->exceptor, &scope))
   {
-    gum_memory_scan (&range, pattern, (GumMemoryScanMatchFunc) gum_append_match,
-        core);
+    gum_memory_scan_multi (&range,
+        (const GumMatchPattern * const *) patterns->pdata, patterns->len,
+        (GumMemoryScanMultiMatchFunc) gum_append_match, &sc);
   }
 
-  gum_match_pattern_free (pattern);
+  g_ptr_array_unref (patterns);
 
   if (gum_exceptor_catch (core->exceptor, &scope))
   {
@@ -981,8 +1153,10 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean
 gum_append_match (GumAddress address,
                   gsize size,
-                  GumDukCore * core)
+                  guint pattern_index,
+                  GumMemoryScanSyncContext * sc)
 {
+  GumDukCore * core = sc->core;
   GumDukScope scope = GUM_DUK_SCOPE_INIT (core);
   duk_context * ctx = scope.ctx;
 
@@ -994,11 +1168,74 @@ gum_append_match (GumAddress address,
   duk_push_uint (ctx, size);
   duk_put_prop_string (ctx, -2, "size");
 
+  if (sc->report_pattern_index)
+  {
+    duk_push_uint (ctx, pattern_index);
+    duk_put_prop_string (ctx, -2, "pattern");
+  }
+
   duk_put_prop_index (ctx, -2, (duk_uarridx_t) duk_get_length (ctx, -2));
 
   return TRUE;
 }
 
+/*
+ * Accepts either a single pattern string, or an array of them to be scanned
+ * for in one pass. Throws if any of them is invalid.
+ */
+static GPtrArray *
+gum_parse_match_patterns (duk_context * ctx,
+                          duk_idx_t index,
+                          gboolean * is_multi)
+{
+  GPtrArray * patterns;
+  duk_size_t n, i;
+
+  if (duk_is_string (ctx, index))
+  {
+    *is_multi = FALSE;
+    n = 1;
+  }
+  else if (duk_is_array (ctx, index))
+  {
+    *is_multi = TRUE;
+    n = duk_get_length (ctx, index);
+  }
+  else
+  {
+    _gum_duk_throw (ctx, "expected a string or an array of strings");
+    return NULL;
+  }
+
+  patterns = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_match_pattern_free);
+
+  for (i = 0; i != n; i++)
+  {
+    GumMatchPattern * pattern = NULL;
+
+    if (*is_multi)
+      duk_get_prop_index (ctx, index, (duk_uarridx_t) i);
+    else
+      duk_dup (ctx, index);
+
+    if (duk_is_string (ctx, -1))
+      pattern = gum_match_pattern_new_from_string (duk_get_string (ctx, -1));
+    duk_pop (ctx);
+
+    if (pattern == NULL)
+    {
+      g_ptr_array_unref (patterns);
+      _gum_duk_throw (ctx, "invalid match pattern");
+      return NULL;
+    }
+
+    g_ptr_array_add (patterns, pattern);
+  }
+
+  return patterns;
+}
+
 GUMJS_DEFINE_CONSTRUCTOR (gumjs_memory_access_monitor_construct)
 {
   return 0;
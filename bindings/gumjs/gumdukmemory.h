@@ -8,6 +8,7 @@
 #define __GUM_DUK_MEMORY_H__
 
 #include "gumdukcore.h"
+#include "gummemorypool.h"
 
 G_BEGIN_DECLS
 
@@ -16,6 +17,10 @@ typedef struct _GumDukMemory GumDukMemory;
 struct _GumDukMemory
 {
   GumDukCore * core;
+
+  GumMemoryPool * pool;
+  GumMemoryArena * arena;
+  guint arena_depth;
 };
 
 G_GNUC_INTERNAL void _gum_duk_memory_init (GumDukMemory * self,
@@ -8,7 +8,12 @@
 
 #include "gumdukmacros.h"
 
+#include <gum/gummodulesnapshot.h>
+
+#define GUM_MATCH_BATCH_SIZE 256
+
 typedef struct _GumDukMatchContext GumDukMatchContext;
+typedef struct _GumDukEnumerateExportsJob GumDukEnumerateExportsJob;
 typedef struct _GumDukModuleFilter GumDukModuleFilter;
 
 struct _GumDukMatchContext
@@ -19,6 +24,15 @@ struct _GumDukMatchContext
   GumDukScope * scope;
 };
 
+struct _GumDukEnumerateExportsJob
+{
+  gchar * module_name;
+  GumDukHeapPtr on_match;
+  GumDukHeapPtr on_complete;
+
+  GumDukCore * core;
+};
+
 struct _GumDukModuleFilter
 {
   GumDukHeapPtr callback;
@@ -34,6 +48,16 @@ static gboolean gum_emit_import (const GumImportDetails * details,
 GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_exports)
 static gboolean gum_emit_export (const GumExportDetails * details,
     GumDukMatchContext * mc);
+static void gum_push_export (duk_context * ctx,
+    const GumExportDetails * details, GumDukCore * core);
+GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_exports_async)
+static void gum_duk_enumerate_exports_job_free (
+    GumDukEnumerateExportsJob * self);
+static void gum_duk_enumerate_exports_job_run (
+    GumDukEnumerateExportsJob * self);
+static gboolean gum_copy_export (const GumExportDetails * details,
+    GArray * exports);
+static void gum_export_details_clear (GumExportDetails * details);
 GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_symbols)
 static gboolean gum_emit_symbol (const GumSymbolDetails * details,
     GumDukMatchContext * mc);
@@ -49,6 +73,7 @@ GUMJS_DECLARE_FUNCTION (gumjs_module_map_has)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_find)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_find_name)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_find_path)
+GUMJS_DECLARE_FUNCTION (gumjs_module_map_annotate)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_update)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_copy_values)
 
@@ -60,7 +85,8 @@ static const duk_function_list_entry gumjs_module_functions[] =
 {
   { "ensureInitialized", gumjs_module_ensure_initialized, 1 },
   { "enumerateImports", gumjs_module_enumerate_imports, 2 },
-  { "enumerateExports", gumjs_module_enumerate_exports, 2 },
+  { "enumerateExports", gumjs_module_enumerate_exports_async, 2 },
+  { "_enumerateExports", gumjs_module_enumerate_exports, 2 },
   { "enumerateSymbols", gumjs_module_enumerate_symbols, 2 },
   { "enumerateRanges", gumjs_module_enumerate_ranges, 3 },
   { "findBaseAddress", gumjs_module_find_base_address, 1 },
@@ -75,6 +101,7 @@ static const duk_function_list_entry gumjs_module_map_functions[] =
   { "find", gumjs_module_map_find, 1 },
   { "findName", gumjs_module_map_find_name, 1 },
   { "findPath", gumjs_module_map_find_path, 1 },
+  { "annotate", gumjs_module_map_annotate, 1 },
   { "update", gumjs_module_map_update, 0 },
   { "values", gumjs_module_map_copy_values, 0 },
 
@@ -245,7 +272,27 @@ gum_emit_export (const GumExportDetails * details,
   gboolean proceed = TRUE;
 
   duk_push_heapptr (ctx, mc->on_match);
+  gum_push_export (ctx, details, scope->core);
+
+  if (_gum_duk_scope_call_sync (scope, 1))
+  {
+    if (duk_is_string (ctx, -1))
+      proceed = strcmp (duk_require_string (ctx, -1), "stop") != 0;
+  }
+  else
+  {
+    proceed = FALSE;
+  }
+  duk_pop (ctx);
+
+  return proceed;
+}
 
+static void
+gum_push_export (duk_context * ctx,
+                 const GumExportDetails * details,
+                 GumDukCore * core)
+{
   duk_push_object (ctx);
 
   duk_push_string (ctx,
@@ -256,21 +303,138 @@ gum_emit_export (const GumExportDetails * details,
   duk_put_prop_string (ctx, -2, "name");
 
   _gum_duk_push_native_pointer (ctx, GSIZE_TO_POINTER (details->address),
-      scope->core);
+      core);
   duk_put_prop_string (ctx, -2, "address");
+}
 
-  if (_gum_duk_scope_call_sync (scope, 1))
-  {
-    if (duk_is_string (ctx, -1))
-      proceed = strcmp (duk_require_string (ctx, -1), "stop") != 0;
-  }
-  else
+/*
+ * Collects the exports on the thread pool, and only enters the heap to hand
+ * over one batch of them at a time, so the JS thread gets to run other
+ * callbacks in between.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_exports_async)
+{
+  GumDukCore * core = args->core;
+  const gchar * name;
+  GumDukHeapPtr on_match, on_complete;
+  GumDukEnumerateExportsJob * job;
+
+  _gum_duk_args_parse (args, "sF{onMatch,onComplete}", &name, &on_match,
+      &on_complete);
+
+  job = g_slice_new (GumDukEnumerateExportsJob);
+  job->module_name = g_strdup (name);
+  job->on_match = on_match;
+  job->on_complete = on_complete;
+  job->core = core;
+
+  _gum_duk_protect (ctx, job->on_match);
+  _gum_duk_protect (ctx, job->on_complete);
+
+  _gum_duk_core_pin (core);
+  _gum_duk_core_push_job (core,
+      (GumScriptJobFunc) gum_duk_enumerate_exports_job_run, job,
+      (GDestroyNotify) gum_duk_enumerate_exports_job_free);
+
+  return 0;
+}
+
+static void
+gum_duk_enumerate_exports_job_free (GumDukEnumerateExportsJob * self)
+{
+  GumDukCore * core = self->core;
+  GumDukScope scope;
+  duk_context * ctx;
+
+  ctx = _gum_duk_scope_enter (&scope, core);
+
+  _gum_duk_unprotect (ctx, self->on_match);
+  _gum_duk_unprotect (ctx, self->on_complete);
+
+  _gum_duk_core_unpin (core);
+  _gum_duk_scope_leave (&scope);
+
+  g_free (self->module_name);
+
+  g_slice_free (GumDukEnumerateExportsJob, self);
+}
+
+static void
+gum_duk_enumerate_exports_job_run (GumDukEnumerateExportsJob * self)
+{
+  GumDukCore * core = self->core;
+  GArray * exports;
+  guint i = 0;
+  gboolean finished = FALSE;
+
+  exports = g_array_new (FALSE, FALSE, sizeof (GumExportDetails));
+  g_array_set_clear_func (exports, (GDestroyNotify) gum_export_details_clear);
+  gum_module_enumerate_exports (self->module_name,
+      (GumFoundExportFunc) gum_copy_export, exports);
+
+  while (!finished)
   {
-    proceed = FALSE;
+    GumDukScope scope;
+    duk_context * ctx;
+    guint end;
+    gboolean proceed = TRUE, failed = FALSE;
+
+    ctx = _gum_duk_scope_enter (&scope, core);
+
+    end = MIN (i + GUM_MATCH_BATCH_SIZE, exports->len);
+    while (proceed && i != end)
+    {
+      duk_push_heapptr (ctx, self->on_match);
+      gum_push_export (ctx, &g_array_index (exports, GumExportDetails, i++),
+          core);
+
+      if (_gum_duk_scope_call (&scope, 1))
+      {
+        if (duk_is_string (ctx, -1))
+          proceed = strcmp (duk_require_string (ctx, -1), "stop") != 0;
+      }
+      else
+      {
+        proceed = FALSE;
+        failed = TRUE;
+      }
+      duk_pop (ctx);
+    }
+
+    finished = !proceed || i == exports->len;
+
+    if (finished && !failed)
+    {
+      duk_push_heapptr (ctx, self->on_complete);
+      _gum_duk_scope_call (&scope, 0);
+      duk_pop (ctx);
+    }
+
+    _gum_duk_scope_leave (&scope);
   }
-  duk_pop (ctx);
 
-  return proceed;
+  g_array_free (exports, TRUE);
+}
+
+static gboolean
+gum_copy_export (const GumExportDetails * details,
+                 GArray * exports)
+{
+  GumExportDetails copy;
+
+  copy.type = details->type;
+  copy.name = g_strdup (details->name);
+  copy.address = details->address;
+
+  g_array_append_val (exports, copy);
+
+  return TRUE;
+}
+
+static void
+gum_export_details_clear (GumExportDetails * details)
+{
+  g_free ((gchar *) details->name);
 }
 
 GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_symbols)
@@ -419,7 +583,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_module_find_export_by_name)
   _gum_duk_args_parse (args, "s?s", &module_name, &symbol_name);
 
   _gum_duk_scope_suspend (&scope);
-  address = gum_module_find_export_by_name (module_name, symbol_name);
+  address = gum_module_snapshot_lookup_export (module_name, symbol_name);
   _gum_duk_scope_resume (&scope);
 
   if (address != 0)
@@ -572,6 +736,35 @@ GUMJS_DEFINE_FUNCTION (gumjs_module_map_find_path)
   return 1;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_module_map_annotate)
+{
+  GumModuleMap * self;
+  const gpointer * addresses;
+  duk_size_t size;
+  guint n;
+  GumModuleLocation * locations;
+
+  self = gumjs_module_map_from_args (args);
+
+  addresses = duk_get_buffer_data (ctx, 0, &size);
+  if (addresses == NULL)
+    _gum_duk_throw (ctx, "expected an ArrayBuffer");
+
+  if (size % sizeof (gpointer) != 0)
+    _gum_duk_throw (ctx, "invalid buffer shape");
+
+  n = size / sizeof (gpointer);
+
+  locations = duk_push_fixed_buffer (ctx, n * sizeof (GumModuleLocation));
+  duk_push_buffer_object (ctx, -1, 0, n * sizeof (GumModuleLocation),
+      DUK_BUFOBJ_ARRAYBUFFER);
+  duk_remove (ctx, -2);
+
+  gum_module_map_resolve_many (self, addresses, n, locations);
+
+  return 1;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_module_map_update)
 {
   gum_module_map_update (gumjs_module_map_from_args (args));
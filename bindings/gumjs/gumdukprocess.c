@@ -8,6 +8,10 @@
 
 #include "gumdukmacros.h"
 
+#include <gum/gummodulesnapshot.h>
+
+#define GUM_MATCH_BATCH_SIZE 256
+
 #if defined (HAVE_I386)
 # if GLIB_SIZEOF_VOID_P == 4
 #  define GUM_SCRIPT_ARCH "ia32"
@@ -33,8 +37,12 @@
 #endif
 
 typedef struct _GumDukMatchContext GumDukMatchContext;
+typedef struct _GumDukEnumerateJob GumDukEnumerateJob;
 typedef struct _GumDukFindRangeByAddressContext GumDukFindRangeByAddressContext;
 
+typedef void (* GumDukPushItemFunc) (duk_context * ctx, gpointer items,
+    guint index, GumDukCore * core);
+
 struct _GumDukExceptionHandler
 {
   GumDukHeapPtr callback;
@@ -49,6 +57,15 @@ struct _GumDukMatchContext
   GumDukScope * scope;
 };
 
+struct _GumDukEnumerateJob
+{
+  GumPageProtection prot;
+  GumDukHeapPtr on_match;
+  GumDukHeapPtr on_complete;
+
+  GumDukCore * core;
+};
+
 struct _GumDukFindRangeByAddressContext
 {
   GumAddress address;
@@ -65,15 +82,33 @@ static gboolean gum_emit_thread (const GumThreadDetails * details,
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_modules)
 static gboolean gum_emit_module (const GumModuleDetails * details,
     GumDukMatchContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_modules_async)
+static void gum_duk_enumerate_job_run_modules (GumDukEnumerateJob * self);
+static gboolean gum_collect_module (const GumModuleDetails * details,
+    GPtrArray * modules);
+static void gum_push_collected_module (duk_context * ctx, GPtrArray * modules,
+    guint index, GumDukCore * core);
 GUMJS_DECLARE_FUNCTION (gumjs_process_find_range_by_address)
 static gboolean gum_push_range_if_containing_address (
     const GumRangeDetails * details, GumDukFindRangeByAddressContext * fc);
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_ranges)
 static gboolean gum_emit_range (const GumRangeDetails * details,
     GumDukMatchContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_ranges_async)
+static void gum_duk_enumerate_job_run_ranges (GumDukEnumerateJob * self);
+static void gum_push_collected_range (duk_context * ctx, GArray * entries,
+    guint index, GumDukCore * core);
+GUMJS_DECLARE_FUNCTION (gumjs_process_collect_ranges)
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_malloc_ranges)
 GUMJS_DECLARE_FUNCTION (gumjs_process_set_exception_handler)
 
+static GumDukEnumerateJob * gum_duk_enumerate_job_new (duk_context * ctx,
+    GumPageProtection prot, GumDukHeapPtr on_match, GumDukHeapPtr on_complete,
+    GumDukCore * core);
+static void gum_duk_enumerate_job_free (GumDukEnumerateJob * self);
+static void gum_duk_enumerate_job_emit (GumDukEnumerateJob * self,
+    gpointer items, guint n_items, GumDukPushItemFunc push);
+
 static GumDukExceptionHandler * gum_duk_exception_handler_new (
     GumDukHeapPtr callback, GumDukCore * core);
 static void gum_duk_exception_handler_free (
@@ -86,9 +121,12 @@ static const duk_function_list_entry gumjs_process_functions[] =
   { "isDebuggerAttached", gumjs_process_is_debugger_attached, 0 },
   { "getCurrentThreadId", gumjs_process_get_current_thread_id, 0 },
   { "enumerateThreads", gumjs_process_enumerate_threads, 1 },
-  { "enumerateModules", gumjs_process_enumerate_modules, 1 },
+  { "enumerateModules", gumjs_process_enumerate_modules_async, 1 },
+  { "_enumerateModules", gumjs_process_enumerate_modules, 1 },
   { "findRangeByAddress", gumjs_process_find_range_by_address, 1 },
   { "_enumerateRanges", gumjs_process_enumerate_ranges, 2 },
+  { "_enumerateRangesAsync", gumjs_process_enumerate_ranges_async, 2 },
+  { "_collectRanges", gumjs_process_collect_ranges, 1 },
   { "enumerateMallocRanges", gumjs_process_enumerate_malloc_ranges, 1 },
   { "setExceptionHandler", gumjs_process_set_exception_handler, 1 },
 
@@ -217,12 +255,16 @@ GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_modules)
 {
   GumDukMatchContext mc;
   GumDukScope scope = GUM_DUK_SCOPE_INIT (args->core);
+  GumModuleSnapshot * snapshot;
 
   _gum_duk_args_parse (args, "F{onMatch,onComplete}", &mc.on_match,
       &mc.on_complete);
   mc.scope = &scope;
 
-  gum_process_enumerate_modules ((GumFoundModuleFunc) gum_emit_module, &mc);
+  snapshot = gum_module_snapshot_obtain ();
+  gum_module_snapshot_enumerate_modules (snapshot,
+      (GumFoundModuleFunc) gum_emit_module, &mc);
+  gum_module_snapshot_unref (snapshot);
   _gum_duk_scope_flush (&scope);
 
   duk_push_heapptr (ctx, mc.on_complete);
@@ -257,6 +299,65 @@ gum_emit_module (const GumModuleDetails * details,
   return proceed;
 }
 
+/*
+ * The asynchronous enumerations run on the thread pool, and only enter the
+ * heap to hand over one batch of results at a time, so the JS thread gets to
+ * run other callbacks in between.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_modules_async)
+{
+  GumDukHeapPtr on_match, on_complete;
+  GumDukEnumerateJob * job;
+
+  _gum_duk_args_parse (args, "F{onMatch,onComplete}", &on_match,
+      &on_complete);
+
+  job = gum_duk_enumerate_job_new (ctx, GUM_PAGE_NO_ACCESS, on_match,
+      on_complete, args->core);
+  _gum_duk_core_push_job (args->core,
+      (GumScriptJobFunc) gum_duk_enumerate_job_run_modules, job,
+      (GDestroyNotify) gum_duk_enumerate_job_free);
+
+  return 0;
+}
+
+static void
+gum_duk_enumerate_job_run_modules (GumDukEnumerateJob * self)
+{
+  GumModuleSnapshot * snapshot;
+  GPtrArray * modules;
+
+  snapshot = gum_module_snapshot_obtain ();
+
+  modules = g_ptr_array_new ();
+  gum_module_snapshot_enumerate_modules (snapshot,
+      (GumFoundModuleFunc) gum_collect_module, modules);
+
+  gum_duk_enumerate_job_emit (self, modules, modules->len,
+      (GumDukPushItemFunc) gum_push_collected_module);
+
+  g_ptr_array_unref (modules);
+  gum_module_snapshot_unref (snapshot);
+}
+
+static gboolean
+gum_collect_module (const GumModuleDetails * details,
+                    GPtrArray * modules)
+{
+  g_ptr_array_add (modules, (gpointer) details);
+
+  return TRUE;
+}
+
+static void
+gum_push_collected_module (duk_context * ctx,
+                           GPtrArray * modules,
+                           guint index,
+                           GumDukCore * core)
+{
+  _gum_duk_push_module (ctx, g_ptr_array_index (modules, index), core);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_process_find_range_by_address)
 {
   GumDukFindRangeByAddressContext fc;
@@ -340,6 +441,83 @@ gum_emit_range (const GumRangeDetails * details,
   return proceed;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_ranges_async)
+{
+  GumPageProtection prot;
+  GumDukHeapPtr on_match, on_complete;
+  GumDukEnumerateJob * job;
+
+  _gum_duk_args_parse (args, "mF{onMatch,onComplete}", &prot, &on_match,
+      &on_complete);
+
+  job = gum_duk_enumerate_job_new (ctx, prot, on_match, on_complete,
+      args->core);
+  _gum_duk_core_push_job (args->core,
+      (GumScriptJobFunc) gum_duk_enumerate_job_run_ranges, job,
+      (GDestroyNotify) gum_duk_enumerate_job_free);
+
+  return 0;
+}
+
+static void
+gum_duk_enumerate_job_run_ranges (GumDukEnumerateJob * self)
+{
+  GArray * entries;
+
+  entries = gum_process_collect_ranges (self->prot);
+
+  gum_duk_enumerate_job_emit (self, entries, entries->len,
+      (GumDukPushItemFunc) gum_push_collected_range);
+
+  g_array_unref (entries);
+}
+
+static void
+gum_push_collected_range (duk_context * ctx,
+                          GArray * entries,
+                          guint index,
+                          GumDukCore * core)
+{
+  const GumRangeEntry * e = &g_array_index (entries, GumRangeEntry, index);
+  GumRangeDetails details;
+
+  details.range = &e->range;
+  details.prot = e->prot;
+  details.file = (e->file.path != NULL) ? &e->file : NULL;
+
+  _gum_duk_push_range (ctx, &details, core);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_process_collect_ranges)
+{
+  GumPageProtection prot;
+  GArray * entries;
+  guint i;
+
+  _gum_duk_args_parse (args, "m", &prot);
+
+  entries = gum_process_collect_ranges (prot);
+
+  duk_push_array (ctx);
+
+  for (i = 0; i != entries->len; i++)
+  {
+    const GumRangeEntry * e = &g_array_index (entries, GumRangeEntry, i);
+    GumRangeDetails details;
+
+    details.range = &e->range;
+    details.prot = e->prot;
+    details.file = (e->file.path != NULL) ? &e->file : NULL;
+
+    _gum_duk_push_range (ctx, &details, args->core);
+    duk_put_prop_index (ctx, -2, i);
+  }
+
+  g_array_unref (entries);
+
+  return 1;
+}
+
 #if defined (G_OS_WIN32) || defined (HAVE_DARWIN)
 
 static gboolean gum_emit_malloc_range (const GumMallocRangeDetails * details,
@@ -433,6 +611,102 @@ GUMJS_DEFINE_FUNCTION (gumjs_process_set_exception_handler)
   return 0;
 }
 
+static GumDukEnumerateJob *
+gum_duk_enumerate_job_new (duk_context * ctx,
+                           GumPageProtection prot,
+                           GumDukHeapPtr on_match,
+                           GumDukHeapPtr on_complete,
+                           GumDukCore * core)
+{
+  GumDukEnumerateJob * job;
+
+  job = g_slice_new (GumDukEnumerateJob);
+  job->prot = prot;
+  job->on_match = on_match;
+  job->on_complete = on_complete;
+  job->core = core;
+
+  _gum_duk_protect (ctx, on_match);
+  _gum_duk_protect (ctx, on_complete);
+
+  _gum_duk_core_pin (core);
+
+  return job;
+}
+
+static void
+gum_duk_enumerate_job_free (GumDukEnumerateJob * self)
+{
+  GumDukCore * core = self->core;
+  GumDukScope scope;
+  duk_context * ctx;
+
+  ctx = _gum_duk_scope_enter (&scope, core);
+
+  _gum_duk_unprotect (ctx, self->on_match);
+  _gum_duk_unprotect (ctx, self->on_complete);
+
+  _gum_duk_core_unpin (core);
+  _gum_duk_scope_leave (&scope);
+
+  g_slice_free (GumDukEnumerateJob, self);
+}
+
+/*
+ * Calls onMatch for up to GUM_MATCH_BATCH_SIZE items per entry into the
+ * heap, and onComplete once done, unless onMatch threw.
+ */
+static void
+gum_duk_enumerate_job_emit (GumDukEnumerateJob * self,
+                            gpointer items,
+                            guint n_items,
+                            GumDukPushItemFunc push)
+{
+  GumDukCore * core = self->core;
+  guint i = 0;
+  gboolean finished = FALSE;
+
+  while (!finished)
+  {
+    GumDukScope scope;
+    duk_context * ctx;
+    guint end;
+    gboolean proceed = TRUE, failed = FALSE;
+
+    ctx = _gum_duk_scope_enter (&scope, core);
+
+    end = MIN (i + GUM_MATCH_BATCH_SIZE, n_items);
+    while (proceed && i != end)
+    {
+      duk_push_heapptr (ctx, self->on_match);
+      push (ctx, items, i++, core);
+
+      if (_gum_duk_scope_call (&scope, 1))
+      {
+        if (duk_is_string (ctx, -1))
+          proceed = strcmp (duk_require_string (ctx, -1), "stop") != 0;
+      }
+      else
+      {
+        proceed = FALSE;
+        failed = TRUE;
+      }
+      duk_pop (ctx);
+    }
+
+    finished = !proceed || i == n_items;
+
+    if (finished && !failed)
+    {
+      duk_push_heapptr (ctx, self->on_complete);
+      _gum_duk_scope_call (&scope, 0);
+      duk_pop (ctx);
+    }
+
+    _gum_duk_scope_leave (&scope);
+  }
+}
+
 static GumDukExceptionHandler *
 gum_duk_exception_handler_new (GumDukHeapPtr callback,
                                GumDukCore * core)
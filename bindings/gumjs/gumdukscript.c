@@ -25,6 +25,7 @@
 #include "gumduksymbol.h"
 #include "gumdukthread.h"
 #include "gumdukvalue.h"
+#include "gumscriptoutbox.h"
 #include "gumscripttask.h"
 
 #include <gum/guminvocationlistener.h>
@@ -40,7 +41,6 @@ typedef guint GumScriptState;
 typedef struct _GumDukScriptDebugger GumDukScriptDebugger;
 typedef struct _GumUnloadNotifyCallback GumUnloadNotifyCallback;
 typedef void (* GumUnloadNotifyFunc) (GumDukScript * self, gpointer user_data);
-typedef struct _GumEmitData GumEmitData;
 typedef struct _GumPostData GumPostData;
 
 struct _GumDukScriptDebugger
@@ -67,6 +67,7 @@ struct _GumDukScript
   GBytes * bytecode;
   GMainContext * main_context;
   GumDukScriptBackend * backend;
+  GumScriptScheduler * scheduler;
 
   GumScriptState state;
   GSList * on_unload;
@@ -90,9 +91,7 @@ struct _GumDukScript
   GumDukCodeRelocator code_relocator;
   GumDukStalker stalker;
 
-  GumScriptMessageHandler message_handler;
-  gpointer message_handler_data;
-  GDestroyNotify message_handler_data_destroy;
+  GumScriptOutbox outbox;
 
   GumDukScriptDebugger debugger;
 };
@@ -128,13 +127,6 @@ struct _GumUnloadNotifyCallback
   GDestroyNotify data_destroy;
 };
 
-struct _GumEmitData
-{
-  GumDukScript * script;
-  gchar * message;
-  GBytes * data;
-};
-
 struct _GumPostData
 {
   GumDukScript * script;
@@ -146,6 +138,7 @@ static void gum_duk_script_iface_init (gpointer g_iface, gpointer iface_data);
 
 static void gum_duk_script_dispose (GObject * object);
 static void gum_duk_script_finalize (GObject * object);
+static GumScriptScheduler * gum_duk_script_get_scheduler (GumDukScript * self);
 static void gum_duk_script_get_property (GObject * object, guint property_id,
     GValue * value, GParamSpec * pspec);
 static void gum_duk_script_set_property (GObject * object, guint property_id,
@@ -180,6 +173,9 @@ static void gum_duk_script_once_unloaded (GumDukScript * self,
 static void gum_duk_script_set_message_handler (GumScript * script,
     GumScriptMessageHandler handler, gpointer data,
     GDestroyNotify data_destroy);
+static void gum_duk_script_set_message_batch_handler (GumScript * script,
+    GumScriptMessageBatchHandler handler, gpointer data,
+    GDestroyNotify data_destroy);
 static void gum_duk_script_post (GumScript * script, const gchar * message,
     GBytes * data);
 static void gum_duk_script_do_post (GumPostData * d);
@@ -189,8 +185,6 @@ static GumStalker * gum_duk_script_get_stalker (GumScript * script);
 
 static void gum_duk_script_emit (GumDukScript * self,
     const gchar * message, GBytes * data);
-static gboolean gum_duk_script_do_emit (GumEmitData * d);
-static void gum_duk_emit_data_free (GumEmitData * d);
 
 static void gum_duk_script_do_attach_debugger (GumDukScript * self);
 static void gum_duk_script_do_detach_debugger (GumDukScript * self);
@@ -280,6 +274,7 @@ gum_duk_script_iface_init (gpointer g_iface,
   iface->unload_sync = gum_duk_script_unload_sync;
 
   iface->set_message_handler = gum_duk_script_set_message_handler;
+  iface->set_message_batch_handler = gum_duk_script_set_message_batch_handler;
   iface->post = gum_duk_script_post;
 
   iface->get_stalker = gum_duk_script_get_stalker;
@@ -293,6 +288,8 @@ gum_duk_script_init (GumDukScript * self)
   self->state = GUM_SCRIPT_STATE_UNLOADED;
   self->on_unload = NULL;
 
+  gum_script_outbox_init (&self->outbox, GUM_SCRIPT (self));
+
   gum_duk_script_debugger_init (&self->debugger, self);
 }
 
@@ -303,6 +300,7 @@ gum_duk_script_dispose (GObject * object)
   GumScript * script = GUM_SCRIPT (self);
 
   gum_duk_script_set_message_handler (script, NULL, NULL, NULL);
+  gum_duk_script_set_message_batch_handler (script, NULL, NULL, NULL);
 
   if (self->state == GUM_SCRIPT_STATE_LOADED)
   {
@@ -312,6 +310,7 @@ gum_duk_script_dispose (GObject * object)
   else
   {
     g_clear_pointer (&self->main_context, g_main_context_unref);
+    g_clear_object (&self->scheduler);
     g_clear_pointer (&self->backend, g_object_unref);
   }
 
@@ -325,6 +324,8 @@ gum_duk_script_finalize (GObject * object)
 
   gum_duk_script_debugger_finalize (&self->debugger);
 
+  gum_script_outbox_finalize (&self->outbox);
+
   g_free (self->name);
   g_free (self->source);
   g_bytes_unref (self->bytecode);
@@ -332,6 +333,27 @@ gum_duk_script_finalize (GObject * object)
   G_OBJECT_CLASS (gum_duk_script_parent_class)->finalize (object);
 }
 
+/*
+ * Each script has its own heap, so scripts can be spread across however many
+ * JS threads the scheduler has been given. Running JS still requires the
+ * backend's scope lock, which keeps scripts that hook each other's code from
+ * deadlocking, but each script gets a loop of its own to be dispatched from.
+ */
+static GumScriptScheduler *
+gum_duk_script_get_scheduler (GumDukScript * self)
+{
+  static volatile gint next_affinity = 0;
+
+  if (self->scheduler == NULL)
+  {
+    self->scheduler = gum_script_scheduler_acquire_js_lane (
+        gum_duk_script_backend_get_scheduler (self->backend),
+        g_atomic_int_add (&next_affinity, 1));
+  }
+
+  return self->scheduler;
+}
+
 static void
 gum_duk_script_get_property (GObject * object,
                              guint property_id,
@@ -451,8 +473,7 @@ gum_duk_script_create_context (GumDukScript * self,
   _gum_duk_core_init (core, self,
       gum_duk_script_backend_get_scope_mutex (self->backend),
       gumjs_frida_source_map, &self->interceptor, &self->stalker,
-      gum_duk_script_emit, gum_duk_script_backend_get_scheduler (self->backend),
-      self->ctx);
+      gum_duk_script_emit, gum_duk_script_get_scheduler (self), self->ctx);
 
   scope.ctx = self->ctx;
   core->current_scope = &scope;
@@ -560,7 +581,7 @@ gum_duk_script_load (GumScript * script,
   task = gum_script_task_new ((GumScriptTaskFunc) gum_duk_script_do_load, self,
       cancellable, callback, user_data);
   gum_script_task_run_in_js_thread (task,
-      gum_duk_script_backend_get_scheduler (self->backend));
+      gum_duk_script_get_scheduler (self));
   g_object_unref (task);
 }
 
@@ -581,7 +602,7 @@ gum_duk_script_load_sync (GumScript * script,
   task = gum_script_task_new ((GumScriptTaskFunc) gum_duk_script_do_load, self,
       cancellable, NULL, NULL);
   gum_script_task_run_in_js_thread_sync (task,
-      gum_duk_script_backend_get_scheduler (self->backend));
+      gum_duk_script_get_scheduler (self));
   gum_script_task_propagate_pointer (task, NULL);
   g_object_unref (task);
 }
@@ -650,7 +671,7 @@ gum_duk_script_unload (GumScript * script,
   task = gum_script_task_new ((GumScriptTaskFunc) gum_duk_script_do_unload,
       self, cancellable, callback, user_data);
   gum_script_task_run_in_js_thread (task,
-      gum_duk_script_backend_get_scheduler (self->backend));
+      gum_duk_script_get_scheduler (self));
   g_object_unref (task);
 }
 
@@ -671,7 +692,7 @@ gum_duk_script_unload_sync (GumScript * script,
   task = gum_script_task_new ((GumScriptTaskFunc) gum_duk_script_do_unload,
       self, cancellable, NULL, NULL);
   gum_script_task_run_in_js_thread_sync (task,
-      gum_duk_script_backend_get_scheduler (self->backend));
+      gum_duk_script_get_scheduler (self));
   gum_script_task_propagate_pointer (task, NULL);
   g_object_unref (task);
 }
@@ -775,11 +796,21 @@ gum_duk_script_set_message_handler (GumScript * script,
 {
   GumDukScript * self = GUM_DUK_SCRIPT (script);
 
-  if (self->message_handler_data_destroy != NULL)
-    self->message_handler_data_destroy (self->message_handler_data);
-  self->message_handler = handler;
-  self->message_handler_data = data;
-  self->message_handler_data_destroy = data_destroy;
+  gum_script_outbox_set_message_handler (&self->outbox, handler, data,
+      data_destroy);
+}
+
+static void
+gum_duk_script_set_message_batch_handler (
+    GumScript * script,
+    GumScriptMessageBatchHandler handler,
+    gpointer data,
+    GDestroyNotify data_destroy)
+{
+  GumDukScript * self = GUM_DUK_SCRIPT (script);
+
+  gum_script_outbox_set_batch_handler (&self->outbox, handler, data,
+      data_destroy);
 }
 
 static void
@@ -797,7 +828,7 @@ gum_duk_script_post (GumScript * script,
   d->data = (data != NULL) ? g_bytes_ref (data) : NULL;
 
   gum_script_scheduler_push_job_on_js_thread (
-      gum_duk_script_backend_get_scheduler (self->backend),
+      gum_duk_script_get_scheduler (self),
       G_PRIORITY_DEFAULT, (GumScriptJobFunc) gum_duk_script_do_post, d,
       (GDestroyNotify) gum_duk_post_data_free);
 }
@@ -835,53 +866,14 @@ gum_duk_script_emit (GumDukScript * self,
                      const gchar * message,
                      GBytes * data)
 {
-  GumEmitData * d;
-  GSource * source;
-
-  d = g_slice_new (GumEmitData);
-  d->script = self;
-  g_object_ref (self);
-  d->message = g_strdup (message);
-  d->data = (data != NULL) ? g_bytes_ref (data) : NULL;
-
-  source = g_idle_source_new ();
-  g_source_set_callback (source,
-      (GSourceFunc) gum_duk_script_do_emit,
-      d,
-      (GDestroyNotify) gum_duk_emit_data_free);
-  g_source_attach (source, self->main_context);
-  g_source_unref (source);
-}
-
-static gboolean
-gum_duk_script_do_emit (GumEmitData * d)
-{
-  GumDukScript * self = d->script;
-
-  if (self->message_handler != NULL)
-  {
-    self->message_handler (GUM_SCRIPT (self), d->message, d->data,
-        self->message_handler_data);
-  }
-
-  return FALSE;
-}
-
-static void
-gum_duk_emit_data_free (GumEmitData * d)
-{
-  g_bytes_unref (d->data);
-  g_free (d->message);
-  g_object_unref (d->script);
-
-  g_slice_free (GumEmitData, d);
+  gum_script_outbox_push (&self->outbox, message, data, self->main_context);
 }
 
 void
 gum_duk_script_attach_debugger (GumDukScript * self)
 {
   gum_script_scheduler_push_job_on_js_thread (
-      gum_duk_script_backend_get_scheduler (self->backend),
+      gum_duk_script_get_scheduler (self),
       G_PRIORITY_DEFAULT, (GumScriptJobFunc) gum_duk_script_do_attach_debugger,
       g_object_ref (self), g_object_unref);
 }
@@ -907,7 +899,7 @@ gum_duk_script_detach_debugger (GumDukScript * self)
   gum_duk_script_debugger_cancel (&self->debugger);
 
   gum_script_scheduler_push_job_on_js_thread (
-      gum_duk_script_backend_get_scheduler (self->backend),
+      gum_duk_script_get_scheduler (self),
       G_PRIORITY_DEFAULT, (GumScriptJobFunc) gum_duk_script_do_detach_debugger,
       g_object_ref (self), g_object_unref);
 }
@@ -938,7 +930,7 @@ gum_duk_script_post_to_debugger (GumDukScript * self,
     return;
 
   gum_script_scheduler_push_job_on_js_thread (
-      gum_duk_script_backend_get_scheduler (self->backend),
+      gum_duk_script_get_scheduler (self),
       G_PRIORITY_DEFAULT, (GumScriptJobFunc) gum_duk_script_awaken_debugger,
       g_object_ref (self), g_object_unref);
 }
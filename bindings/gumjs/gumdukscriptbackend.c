@@ -11,10 +11,13 @@
 #include "gumscripttask.h"
 
 #include <gum/guminterceptor.h>
+#include <string.h>
 
 #define GUM_DUK_SCRIPT_BACKEND_LOCK()   (g_mutex_lock (&self->mutex))
 #define GUM_DUK_SCRIPT_BACKEND_UNLOCK() (g_mutex_unlock (&self->mutex))
 
+#define GUM_DUK_MAX_CACHED_PROGRAMS 16
+
 typedef guint GumDukScriptId;
 typedef struct _GumDukScriptWeakRef GumDukScriptWeakRef;
 typedef struct _GumCreateScriptData GumCreateScriptData;
@@ -34,6 +37,9 @@ struct _GumDukScriptBackend
   GHashTable * scripts;
   GumDukScriptId next_script_id;
 
+  GHashTable * programs;
+  GQueue program_keys;
+
   GumScriptScheduler * scheduler;
 
   GumScriptBackendDebugMessageHandler debug_handler;
@@ -101,6 +107,13 @@ static void gum_duk_script_backend_finalize (GObject * object);
 static void gum_duk_script_weak_ref_on_notify (GumDukScriptWeakRef * ref,
     GObject * where_the_object_was);
 
+static gchar * gum_duk_script_backend_compute_program_key (const gchar * name,
+    const gchar * source);
+static GBytes * gum_duk_script_backend_lookup_program (
+    GumDukScriptBackend * self, const gchar * key);
+static void gum_duk_script_backend_cache_program (GumDukScriptBackend * self,
+    gchar * key, GBytes * program);
+
 static void gum_duk_script_backend_create (GumScriptBackend * backend,
     const gchar * name, const gchar * source, GCancellable * cancellable,
     GAsyncReadyCallback callback, gpointer user_data);
@@ -253,6 +266,10 @@ gum_duk_script_backend_init (GumDukScriptBackend * self)
   self->scripts = g_hash_table_new (NULL, NULL);
   self->next_script_id = 1;
 
+  self->programs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_bytes_unref);
+  g_queue_init (&self->program_keys);
+
   self->scheduler = NULL;
 
   self->debug_handler_announced_scripts = g_hash_table_new (NULL, NULL);
@@ -275,6 +292,9 @@ gum_duk_script_backend_dispose (GObject * object)
 
   g_clear_pointer (&self->scripts, g_hash_table_unref);
 
+  g_queue_clear (&self->program_keys);
+  g_clear_pointer (&self->programs, g_hash_table_unref);
+
   G_OBJECT_CLASS (gum_duk_script_backend_parent_class)->dispose (object);
 }
 
@@ -350,9 +370,27 @@ gum_duk_script_backend_push_program (GumDukScriptBackend * self,
                                      const gchar * source,
                                      GError ** error)
 {
-  gchar * filename;
+  gchar * key, * filename;
+  GBytes * program;
+  gconstpointer code;
+  duk_size_t size;
   gboolean valid;
 
+  key = gum_duk_script_backend_compute_program_key (name, source);
+
+  program = gum_duk_script_backend_lookup_program (self, key);
+  if (program != NULL)
+  {
+    code = g_bytes_get_data (program, &size);
+    memcpy (duk_push_fixed_buffer (ctx, size), code, size);
+    duk_load_function (ctx);
+
+    g_bytes_unref (program);
+    g_free (key);
+
+    return TRUE;
+  }
+
   filename = g_strconcat ("/", name, ".js", NULL);
 
   duk_push_string (ctx, source);
@@ -361,7 +399,17 @@ gum_duk_script_backend_push_program (GumDukScriptBackend * self,
 
   g_free (filename);
 
-  if (!valid)
+  if (valid)
+  {
+    duk_dup (ctx, -1);
+    duk_dump_function (ctx);
+    code = duk_require_buffer_data (ctx, -1, &size);
+    program = g_bytes_new (code, size);
+    duk_pop (ctx);
+
+    gum_duk_script_backend_cache_program (self, key, program);
+  }
+  else
   {
     gchar message[1024];
     gint line;
@@ -380,11 +428,78 @@ gum_duk_script_backend_push_program (GumDukScriptBackend * self,
         "Script(line %u): %s",
         line,
         message);
+
+    g_free (key);
   }
 
   return valid;
 }
 
+static gchar *
+gum_duk_script_backend_compute_program_key (const gchar * name,
+                                            const gchar * source)
+{
+  GChecksum * checksum;
+  gchar * key;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (checksum, (const guchar *) name, strlen (name) + 1);
+  g_checksum_update (checksum, (const guchar *) source, -1);
+  key = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return key;
+}
+
+static GBytes *
+gum_duk_script_backend_lookup_program (GumDukScriptBackend * self,
+                                       const gchar * key)
+{
+  GBytes * program;
+
+  GUM_DUK_SCRIPT_BACKEND_LOCK ();
+  program = g_hash_table_lookup (self->programs, key);
+  if (program != NULL)
+    g_bytes_ref (program);
+  GUM_DUK_SCRIPT_BACKEND_UNLOCK ();
+
+  return program;
+}
+
+/*
+ * Keeps the bytecode of recently compiled programs around, so that loading
+ * the same agent again, which is common when re-attaching, skips the
+ * compiler. Takes ownership of both key and program.
+ */
+static void
+gum_duk_script_backend_cache_program (GumDukScriptBackend * self,
+                                      gchar * key,
+                                      GBytes * program)
+{
+  GUM_DUK_SCRIPT_BACKEND_LOCK ();
+
+  if (!g_hash_table_contains (self->programs, key))
+  {
+    if (self->program_keys.length == GUM_DUK_MAX_CACHED_PROGRAMS)
+    {
+      g_hash_table_remove (self->programs,
+          g_queue_pop_head (&self->program_keys));
+    }
+
+    g_hash_table_insert (self->programs, key, program);
+    g_queue_push_tail (&self->program_keys, key);
+
+    key = NULL;
+    program = NULL;
+  }
+
+  GUM_DUK_SCRIPT_BACKEND_UNLOCK ();
+
+  g_free (key);
+  if (program != NULL)
+    g_bytes_unref (program);
+}
+
 GRecMutex *
 gum_duk_script_backend_get_scope_mutex (GumDukScriptBackend * self)
 {
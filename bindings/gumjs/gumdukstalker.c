@@ -9,6 +9,8 @@
 #include "gumdukeventsink.h"
 #include "gumdukmacros.h"
 
+#define GUM_DUK_MAX_BLOCK_INSTRUCTIONS 256
+
 #define GUM_DUK_TYPE_CALLBACK_TRANSFORMER \
     (gum_duk_callback_transformer_get_type ())
 #define GUM_DUK_CALLBACK_TRANSFORMER_CAST(obj) \
@@ -18,12 +20,15 @@ typedef struct _GumDukCallbackTransformer GumDukCallbackTransformer;
 typedef struct _GumDukCallbackTransformerClass GumDukCallbackTransformerClass;
 typedef struct _GumDukCallout GumDukCallout;
 typedef struct _GumDukCallProbe GumDukCallProbe;
+typedef struct _GumDukBlockInstruction GumDukBlockInstruction;
+typedef struct _GumDukBlockCallout GumDukBlockCallout;
 
 struct _GumDukCallbackTransformer
 {
   GObject parent;
 
   GumDukHeapPtr callback;
+  gboolean batched;
 
   GumDukStalker * module;
 };
@@ -47,6 +52,19 @@ struct _GumDukCallProbe
   GumDukStalker * module;
 };
 
+struct _GumDukBlockInstruction
+{
+  guint64 address;
+  guint16 size;
+  guint id;
+};
+
+struct _GumDukBlockCallout
+{
+  guint index;
+  GumDukHeapPtr callback;
+};
+
 struct _GumDukStalkerIterator
 {
   GumDukNativeWriter parent;
@@ -77,6 +95,11 @@ GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_capacity)
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_queue_drain_interval)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_drain_interval)
 
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_timestamps)
+GUMJS_DECLARE_SETTER (gumjs_stalker_set_timestamps)
+
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_stats)
+
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_flush)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_garbage_collect)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_follow)
@@ -84,10 +107,15 @@ GUMJS_DECLARE_FUNCTION (gumjs_stalker_unfollow)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_add_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_remove_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_parse)
+GUMJS_DECLARE_FUNCTION (gumjs_stalker_parse_each)
 
 static void gum_duk_callback_transformer_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_duk_callback_transformer_dispose (GObject * object);
+static void gum_duk_callback_transformer_transform_batch (
+    GumDukCallbackTransformer * self, GumStalkerIterator * iterator);
+static GArray * gum_duk_stalker_decode_block (csh capstone,
+    const cs_insn * first);
 G_DEFINE_TYPE_EXTENDED (GumDukCallbackTransformer,
                         gum_duk_callback_transformer,
                         G_TYPE_OBJECT,
@@ -142,6 +170,8 @@ static void gum_duk_stalker_release_probe_args (GumDukStalker * self,
 
 static void gum_push_pointer (duk_context * ctx, gpointer value,
     gboolean stringify, GumDukCore * core);
+static void gum_push_address (duk_context * ctx, gpointer value,
+    gboolean numeric, gboolean stringify, GumDukCore * core);
 
 static const GumDukPropertyEntry gumjs_stalker_values[] =
 {
@@ -160,6 +190,12 @@ static const GumDukPropertyEntry gumjs_stalker_values[] =
     gumjs_stalker_get_queue_drain_interval,
     gumjs_stalker_set_queue_drain_interval
   },
+  {
+    "timestamps",
+    gumjs_stalker_get_timestamps,
+    gumjs_stalker_set_timestamps
+  },
+  { "stats", gumjs_stalker_get_stats, NULL },
 
   { NULL, NULL, NULL }
 };
@@ -168,11 +204,12 @@ static const duk_function_list_entry gumjs_stalker_functions[] =
 {
   { "flush", gumjs_stalker_flush, 0 },
   { "garbageCollect", gumjs_stalker_garbage_collect, 0 },
-  { "_follow", gumjs_stalker_follow, 5 },
+  { "_follow", gumjs_stalker_follow, 10 },
   { "unfollow", gumjs_stalker_unfollow, 1 },
   { "addCallProbe", gumjs_stalker_add_call_probe, 2 },
   { "removeCallProbe", gumjs_stalker_remove_call_probe, 1 },
   { "_parse", gumjs_stalker_parse, 3 },
+  { "_parseEach", gumjs_stalker_parse_each, 4 },
 
   { NULL, NULL, 0 }
 };
@@ -202,6 +239,7 @@ _gum_duk_stalker_init (GumDukStalker * self,
   self->stalker = NULL;
   self->queue_capacity = 16384;
   self->queue_drain_interval = 250;
+  self->shared_sink = NULL;
 
   self->flush_timer = NULL;
 
@@ -325,6 +363,8 @@ _gum_duk_stalker_dispose (GumDukStalker * self)
   _gum_duk_instruction_release (self->cached_instruction);
   gum_duk_stalker_iterator_release (self->cached_iterator);
 
+  g_clear_object (&self->shared_sink);
+
   _gum_duk_release_heapptr (ctx, self->probe_args);
   _gum_duk_release_heapptr (ctx, self->iterator);
 }
@@ -426,6 +466,76 @@ GUMJS_DEFINE_SETTER (gumjs_stalker_set_queue_drain_interval)
   return 0;
 }
 
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_timestamps)
+{
+  GumStalker * stalker = _gum_duk_stalker_get (gumjs_module_from_args (args));
+
+  duk_push_boolean (ctx, gum_stalker_get_timestamps_enabled (stalker));
+  return 1;
+}
+
+GUMJS_DEFINE_SETTER (gumjs_stalker_set_timestamps)
+{
+  GumStalker * stalker;
+  gboolean enabled;
+
+  stalker = _gum_duk_stalker_get (gumjs_module_from_args (args));
+
+  _gum_duk_args_parse (args, "t", &enabled);
+
+  gum_stalker_set_timestamps_enabled (stalker, enabled);
+  return 0;
+}
+
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_stats)
+{
+  GumStalker * stalker;
+  GumStalkerStats stats;
+
+  stalker = _gum_duk_stalker_get (gumjs_module_from_args (args));
+
+  gum_stalker_get_stats (stalker, &stats);
+
+  duk_push_object (ctx);
+  _gum_duk_push_uint64 (ctx, stats.blocks_compiled, args->core);
+  duk_put_prop_string (ctx, -2, "blocksCompiled");
+  _gum_duk_push_uint64 (ctx, stats.bytes_emitted, args->core);
+  duk_put_prop_string (ctx, -2, "bytesEmitted");
+  _gum_duk_push_uint64 (ctx, stats.compile_time, args->core);
+  duk_put_prop_string (ctx, -2, "compileTime");
+  _gum_duk_push_uint64 (ctx, stats.trust_failures, args->core);
+  duk_put_prop_string (ctx, -2, "trustFailures");
+  _gum_duk_push_uint64 (ctx, stats.code_cache_flushes, args->core);
+  duk_put_prop_string (ctx, -2, "codeCacheFlushes");
+  _gum_duk_push_uint64 (ctx, stats.ic_hits, args->core);
+  duk_put_prop_string (ctx, -2, "icHits");
+  _gum_duk_push_uint64 (ctx, stats.ic_misses, args->core);
+  duk_put_prop_string (ctx, -2, "icMisses");
+
+  duk_push_object (ctx);
+  _gum_duk_push_uint64 (ctx, stats.call_imm_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "callImm");
+  _gum_duk_push_uint64 (ctx, stats.call_indirect_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "callIndirect");
+  _gum_duk_push_uint64 (ctx, stats.post_call_invoke_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "postCallInvoke");
+  _gum_duk_push_uint64 (ctx, stats.ret_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "ret");
+  _gum_duk_push_uint64 (ctx, stats.jmp_imm_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "jmpImm");
+  _gum_duk_push_uint64 (ctx, stats.jmp_indirect_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "jmpIndirect");
+  _gum_duk_push_uint64 (ctx, stats.jmp_cond_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "jmpCond");
+  _gum_duk_push_uint64 (ctx, stats.jmp_continuation_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "jmpContinuation");
+  _gum_duk_push_uint64 (ctx, stats.sysenter_entrygates, args->core);
+  duk_put_prop_string (ctx, -2, "sysenter");
+  duk_put_prop_string (ctx, -2, "entrygates");
+
+  return 1;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_flush)
 {
   GumStalker * stalker;
@@ -455,9 +565,11 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   GumDukCore * core;
   GumThreadId thread_id;
   GumDukHeapPtr transformer_callback;
+  gboolean batched, shared;
   GumDukEventSinkOptions so;
   GumStalkerTransformer * transformer;
   GumEventSink * sink;
+  gboolean sink_created = FALSE;
 
   module = gumjs_module_from_args (args);
   stalker = _gum_duk_stalker_get (module);
@@ -468,8 +580,36 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   so.queue_capacity = module->queue_capacity;
   so.queue_drain_interval = module->queue_drain_interval;
 
-  _gum_duk_args_parse (args, "ZF?uF?F?", &thread_id, &transformer_callback,
-      &so.event_mask, &so.on_receive, &so.on_call_summary);
+  _gum_duk_args_parse (args, "ZF?tuF?F?tttt", &thread_id,
+      &transformer_callback, &batched, &so.event_mask, &so.on_receive,
+      &so.on_call_summary, &so.pack_call_summary, &so.block_when_full,
+      &so.compress_events, &shared);
+
+  if (shared)
+  {
+    if (module->shared_sink == NULL)
+    {
+      GError * error = NULL;
+
+      module->shared_sink = gum_shared_event_sink_new (so.event_mask,
+          module->queue_capacity, &error);
+      if (module->shared_sink == NULL)
+      {
+        duk_push_error_object (ctx, DUK_ERR_ERROR, "%s", error->message);
+        g_error_free (error);
+        (void) duk_throw (ctx);
+        return 0;
+      }
+
+      sink_created = TRUE;
+    }
+    else if (gum_event_sink_query_mask (
+        GUM_EVENT_SINK (module->shared_sink)) != so.event_mask)
+    {
+      _gum_duk_throw (ctx, "the shared transport is already in use with "
+          "different events");
+    }
+  }
 
   if (transformer_callback != NULL)
   {
@@ -478,6 +618,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
     cbt = g_object_new (GUM_DUK_TYPE_CALLBACK_TRANSFORMER, NULL);
     _gum_duk_protect (ctx, transformer_callback);
     cbt->callback = transformer_callback;
+    cbt->batched = batched;
     cbt->module = module;
 
     transformer = GUM_STALKER_TRANSFORMER (cbt);
@@ -487,7 +628,10 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
     transformer = NULL;
   }
 
-  sink = gum_duk_event_sink_new (ctx, &so);
+  if (shared)
+    sink = g_object_ref (GUM_EVENT_SINK (module->shared_sink));
+  else
+    sink = gum_duk_event_sink_new (ctx, &so);
 
   if (thread_id == gum_process_get_current_thread_id ())
   {
@@ -507,6 +651,18 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
     g_clear_object (&transformer);
   }
 
+  if (sink_created)
+  {
+    duk_push_object (ctx);
+    duk_push_string (ctx,
+        gum_shared_event_sink_get_path (module->shared_sink));
+    duk_put_prop_string (ctx, -2, "path");
+    duk_push_number (ctx,
+        gum_shared_event_sink_get_size (module->shared_sink));
+    duk_put_prop_string (ctx, -2, "size");
+    return 1;
+  }
+
   return 0;
 }
 
@@ -581,6 +737,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
   duk_size_t size, count;
   duk_uarridx_t row_index;
   const GumEvent * ev;
+  guint64 timestamp;
 
   module = gumjs_module_from_args (args);
   core = module->core;
@@ -610,6 +767,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
       {
         const GumCallEvent * call = &ev->call;
 
+        timestamp = call->timestamp;
+
         if (annotate)
         {
           duk_push_string (ctx, "call");
@@ -631,6 +790,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
       {
         const GumRetEvent * ret = &ev->ret;
 
+        timestamp = ret->timestamp;
+
         if (annotate)
         {
           duk_push_string (ctx, "ret");
@@ -652,6 +813,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
       {
         const GumExecEvent * exec = &ev->exec;
 
+        timestamp = exec->timestamp;
+
         if (annotate)
         {
           duk_push_string (ctx, "exec");
@@ -667,6 +830,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
       {
         const GumBlockEvent * block = &ev->block;
 
+        timestamp = block->timestamp;
+
         if (annotate)
         {
           duk_push_string (ctx, "block");
@@ -685,6 +850,8 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
       {
         const GumCompileEvent * compile = &ev->compile;
 
+        timestamp = compile->timestamp;
+
         if (annotate)
         {
           duk_push_string (ctx, "compile");
@@ -704,12 +871,149 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
         return 0;
     }
 
+    if (timestamp != 0)
+    {
+      duk_push_number (ctx, (double) gum_timestamp_to_nanoseconds (timestamp));
+      duk_put_prop_index (ctx, -2, column_index++);
+    }
+
     duk_put_prop_index (ctx, -2, row_index);
   }
 
   return 1;
 }
 
+/*
+ * Streams events one at a time into `callback`, without building any
+ * arrays. In numeric mode the event type is passed as its GumEventType
+ * value and addresses as plain numbers, so no objects are created at all.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse_each)
+{
+  GumDukStalker * module;
+  GumDukCore * core;
+  GumDukHeapPtr events_value, callback;
+  gboolean numeric, stringify;
+  const GumEvent * events;
+  duk_size_t size, count, i;
+  const GumEvent * ev;
+  guint64 timestamp;
+
+  module = gumjs_module_from_args (args);
+  core = module->core;
+
+  _gum_duk_args_parse (args, "VFtt", &events_value, &callback, &numeric,
+      &stringify);
+
+  events = duk_get_buffer_data (ctx, 0, &size);
+  if (events == NULL)
+    _gum_duk_throw (ctx, "expected an ArrayBuffer");
+
+  if (size % sizeof (GumEvent) != 0)
+    _gum_duk_throw (ctx, "invalid buffer shape");
+
+  count = size / sizeof (GumEvent);
+
+  for (ev = events, i = 0; i != count; ev++, i++)
+  {
+    duk_idx_t argc;
+
+    duk_push_heapptr (ctx, callback);
+
+    if (numeric)
+      duk_push_uint (ctx, ev->type);
+
+    switch (ev->type)
+    {
+      case GUM_CALL:
+      {
+        const GumCallEvent * call = &ev->call;
+
+        timestamp = call->timestamp;
+
+        if (!numeric)
+          duk_push_string (ctx, "call");
+        gum_push_address (ctx, call->location, numeric, stringify, core);
+        gum_push_address (ctx, call->target, numeric, stringify, core);
+        duk_push_int (ctx, call->depth);
+        argc = 4;
+
+        break;
+      }
+      case GUM_RET:
+      {
+        const GumRetEvent * ret = &ev->ret;
+
+        timestamp = ret->timestamp;
+
+        if (!numeric)
+          duk_push_string (ctx, "ret");
+        gum_push_address (ctx, ret->location, numeric, stringify, core);
+        gum_push_address (ctx, ret->target, numeric, stringify, core);
+        duk_push_int (ctx, ret->depth);
+        argc = 4;
+
+        break;
+      }
+      case GUM_EXEC:
+      {
+        const GumExecEvent * exec = &ev->exec;
+
+        timestamp = exec->timestamp;
+
+        if (!numeric)
+          duk_push_string (ctx, "exec");
+        gum_push_address (ctx, exec->location, numeric, stringify, core);
+        argc = 2;
+
+        break;
+      }
+      case GUM_BLOCK:
+      {
+        const GumBlockEvent * block = &ev->block;
+
+        timestamp = block->timestamp;
+
+        if (!numeric)
+          duk_push_string (ctx, "block");
+        gum_push_address (ctx, block->begin, numeric, stringify, core);
+        gum_push_address (ctx, block->end, numeric, stringify, core);
+        argc = 3;
+
+        break;
+      }
+      case GUM_COMPILE:
+      {
+        const GumCompileEvent * compile = &ev->compile;
+
+        timestamp = compile->timestamp;
+
+        if (!numeric)
+          duk_push_string (ctx, "compile");
+        gum_push_address (ctx, compile->begin, numeric, stringify, core);
+        gum_push_address (ctx, compile->end, numeric, stringify, core);
+        argc = 3;
+
+        break;
+      }
+      default:
+        _gum_duk_throw (ctx, "invalid event type");
+        return 0;
+    }
+
+    if (timestamp != 0)
+    {
+      duk_push_number (ctx, (double) gum_timestamp_to_nanoseconds (timestamp));
+      argc++;
+    }
+
+    duk_call (ctx, argc);
+    duk_pop (ctx);
+  }
+
+  return 0;
+}
+
 static void
 gum_duk_callback_transformer_transform_block (
     GumStalkerTransformer * transformer,
@@ -724,6 +1028,12 @@ gum_duk_callback_transformer_transform_block (
   GumDukStalkerIterator * iterator_value;
   GumDukNativeWriter * output_value;
 
+  if (self->batched)
+  {
+    gum_duk_callback_transformer_transform_batch (self, iterator);
+    return;
+  }
+
   ctx = _gum_duk_scope_enter (&scope, module->core);
 
   iterator_value = gum_duk_stalker_obtain_iterator (module);
@@ -744,6 +1054,197 @@ gum_duk_callback_transformer_transform_block (
   _gum_duk_scope_leave (&scope);
 }
 
+/*
+ * Hands JS the whole block up front, as (address, size, id) triples in one
+ * Float64Array, and lets it answer with a bitset of instructions to keep and
+ * (index, callback) pairs of callouts to put before them. The list is
+ * decoded ahead of the iterator, so Stalker may end the block earlier or
+ * later than JS saw it; instructions JS did not see are kept.
+ */
+static void
+gum_duk_callback_transformer_transform_batch (GumDukCallbackTransformer * self,
+                                              GumStalkerIterator * iterator)
+{
+  GumDukStalker * module = self->module;
+  const cs_insn * insn;
+  duk_context * ctx;
+  GumDukScope scope;
+  GArray * block, * callouts;
+  guint n, i, index;
+  gdouble * triples;
+  const guint8 * keep;
+  duk_size_t keep_size;
+
+  if (!gum_stalker_iterator_next (iterator, &insn))
+    return;
+
+  ctx = _gum_duk_scope_enter (&scope, module->core);
+
+  block = gum_duk_stalker_decode_block (module->instruction->capstone, insn);
+  n = block->len;
+
+  duk_push_heapptr (ctx, self->callback);
+
+  triples = duk_push_fixed_buffer (ctx, n * 3 * sizeof (gdouble));
+  duk_push_buffer_object (ctx, -1, 0, n * 3 * sizeof (gdouble),
+      DUK_BUFOBJ_FLOAT64ARRAY);
+  duk_remove (ctx, -2);
+  for (i = 0; i != n; i++)
+  {
+    GumDukBlockInstruction * bi;
+
+    bi = &g_array_index (block, GumDukBlockInstruction, i);
+
+    *triples++ = (gdouble) bi->address;
+    *triples++ = bi->size;
+    *triples++ = bi->id;
+  }
+
+  if (!_gum_duk_scope_call (&scope, 1))
+  {
+    duk_pop (ctx);
+    duk_push_undefined (ctx);
+  }
+
+  keep = NULL;
+  keep_size = 0;
+  callouts = g_array_new (FALSE, FALSE, sizeof (GumDukBlockCallout));
+
+  if (duk_is_object (ctx, -1))
+  {
+    duk_get_prop_string (ctx, -1, "keep");
+    if (duk_is_buffer_data (ctx, -1))
+      keep = duk_get_buffer_data (ctx, -1, &keep_size);
+    duk_pop (ctx);
+
+    duk_get_prop_string (ctx, -1, "callouts");
+    if (duk_is_array (ctx, -1))
+    {
+      duk_size_t num_entries, entry_index;
+
+      num_entries = duk_get_length (ctx, -1);
+      for (entry_index = 0; entry_index != num_entries; entry_index++)
+      {
+        duk_get_prop_index (ctx, -1, entry_index);
+
+        if (duk_is_array (ctx, -1))
+        {
+          duk_get_prop_index (ctx, -1, 0);
+          duk_get_prop_index (ctx, -2, 1);
+
+          if (duk_is_number (ctx, -2) && duk_is_function (ctx, -1))
+          {
+            GumDukBlockCallout callout;
+
+            callout.index = duk_get_uint (ctx, -2);
+            callout.callback = duk_get_heapptr (ctx, -1);
+            g_array_append_val (callouts, callout);
+          }
+
+          duk_pop_2 (ctx);
+        }
+
+        duk_pop (ctx);
+      }
+    }
+    duk_pop (ctx);
+  }
+
+  index = 0;
+  do
+  {
+    gboolean seen, should_keep;
+
+    while (index != n &&
+        g_array_index (block, GumDukBlockInstruction, index).address <
+        insn->address)
+    {
+      index++;
+    }
+
+    seen = index != n &&
+        g_array_index (block, GumDukBlockInstruction, index).address ==
+        insn->address;
+
+    should_keep = TRUE;
+    if (seen)
+    {
+      for (i = 0; i != callouts->len; i++)
+      {
+        GumDukBlockCallout * c;
+        GumDukCallout * callout;
+
+        c = &g_array_index (callouts, GumDukBlockCallout, i);
+        if (c->index != index)
+          continue;
+
+        callout = g_slice_new (GumDukCallout);
+        _gum_duk_protect (ctx, c->callback);
+        callout->callback = c->callback;
+        callout->module = module;
+
+        gum_stalker_iterator_put_callout (iterator,
+            (GumStalkerCallout) gum_duk_callout_on_invoke, callout,
+            (GDestroyNotify) gum_duk_callout_free);
+      }
+
+      if (keep != NULL && index / 8 < keep_size)
+        should_keep = (keep[index / 8] & (1 << (index % 8))) != 0;
+    }
+
+    if (should_keep)
+      gum_stalker_iterator_keep (iterator);
+  }
+  while (gum_stalker_iterator_next (iterator, &insn));
+
+  g_array_free (callouts, TRUE);
+  g_array_free (block, TRUE);
+
+  duk_pop (ctx);
+
+  _gum_duk_scope_leave (&scope);
+}
+
+static GArray *
+gum_duk_stalker_decode_block (csh capstone,
+                              const cs_insn * first)
+{
+  GArray * block;
+  cs_insn * insn;
+  const uint8_t * code;
+  size_t size;
+  uint64_t address;
+
+  block = g_array_sized_new (FALSE, FALSE, sizeof (GumDukBlockInstruction),
+      16);
+
+  insn = cs_malloc (capstone);
+  code = GSIZE_TO_POINTER (first->address);
+  size = GUM_DUK_MAX_BLOCK_INSTRUCTIONS * 16;
+  address = first->address;
+
+  while (block->len != GUM_DUK_MAX_BLOCK_INSTRUCTIONS &&
+      cs_disasm_iter (capstone, &code, &size, &address, insn))
+  {
+    GumDukBlockInstruction bi;
+
+    bi.address = insn->address;
+    bi.size = insn->size;
+    bi.id = insn->id;
+    g_array_append_val (block, bi);
+
+    if (cs_insn_group (capstone, insn, CS_GRP_JUMP) ||
+        cs_insn_group (capstone, insn, CS_GRP_CALL) ||
+        cs_insn_group (capstone, insn, CS_GRP_RET) ||
+        cs_insn_group (capstone, insn, CS_GRP_IRET))
+      break;
+  }
+
+  cs_free (insn, 1);
+
+  return block;
+}
+
 static void
 gum_duk_callback_transformer_class_init (GumDukCallbackTransformerClass * klass)
 {
@@ -1257,3 +1758,16 @@ gum_push_pointer (duk_context * ctx,
     _gum_duk_push_native_pointer (ctx, value, core);
   }
 }
+
+static void
+gum_push_address (duk_context * ctx,
+                  gpointer value,
+                  gboolean numeric,
+                  gboolean stringify,
+                  GumDukCore * core)
+{
+  if (numeric)
+    duk_push_number (ctx, (gdouble) GPOINTER_TO_SIZE (value));
+  else
+    gum_push_pointer (ctx, value, stringify, core);
+}
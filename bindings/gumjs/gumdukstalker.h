@@ -25,6 +25,7 @@ struct _GumDukStalker
   GumStalker * stalker;
   guint queue_capacity;
   guint queue_drain_interval;
+  GumSharedEventSink * shared_sink;
 
   GSource * flush_timer;
 
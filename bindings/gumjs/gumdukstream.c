@@ -70,12 +70,18 @@ struct _GumDukWriteOperation
   GumDukObjectOperation parent;
   GumDukWriteStrategy strategy;
   GBytes * bytes;
+
+  GPtrArray * vectors;
+  guint vector_index;
+  gsize vectors_size;
+  gsize vectors_written;
 };
 
 enum _GumDukWriteStrategy
 {
   GUM_DUK_WRITE_SOME,
-  GUM_DUK_WRITE_ALL
+  GUM_DUK_WRITE_ALL,
+  GUM_DUK_WRITE_VECTORS
 };
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_io_stream_construct)
@@ -113,12 +119,19 @@ static void gum_duk_close_output_operation_finish (GOutputStream * stream,
 GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write)
 GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write_all)
 GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write_memory_region)
+GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write_vectors)
 static gint gumjs_output_stream_write_with_strategy (duk_context * ctx,
     const GumDukArgs * args, GumDukWriteStrategy strategy);
 static void gum_duk_write_operation_dispose (GumDukWriteOperation * self);
 static void gum_duk_write_operation_start (GumDukWriteOperation * self);
 static void gum_duk_write_operation_finish (GOutputStream * stream,
     GAsyncResult * result, GumDukWriteOperation * self);
+static void gum_duk_write_operation_write_next_vector (
+    GumDukWriteOperation * self);
+static void gum_duk_write_operation_vector_written (GOutputStream * stream,
+    GAsyncResult * result, GumDukWriteOperation * self);
+static void gum_duk_write_operation_complete (GumDukWriteOperation * self,
+    gsize bytes_written, gsize expected_size, GError * error);
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_native_input_stream_construct)
 
@@ -149,6 +162,7 @@ static const duk_function_list_entry gumjs_output_stream_functions[] =
   { "_write", gumjs_output_stream_write, 2 },
   { "_writeAll", gumjs_output_stream_write_all, 2 },
   { "_writeMemoryRegion", gumjs_output_stream_write_memory_region, 3 },
+  { "_writeVectors", gumjs_output_stream_write_vectors, 2 },
 
   { NULL, NULL, 0 }
 };
@@ -675,11 +689,128 @@ GUMJS_DEFINE_FUNCTION (gumjs_output_stream_write_memory_region)
       gum_duk_write_operation_start, gum_duk_write_operation_dispose);
   op->strategy = GUM_DUK_WRITE_ALL;
   op->bytes = g_bytes_new_static (address, length);
+  op->vectors = NULL;
   _gum_duk_object_operation_schedule (op);
 
   return 0;
 }
 
+/*
+ * Takes a flat array where each element is either bytes to copy, or a
+ * NativePointer followed by the length of the memory to write in place.
+ * Copied bytes that are next to each other are gathered into one buffer, so
+ * a batch of small writes ends up as a handful of large ones.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_output_stream_write_vectors)
+{
+  GumDukObject * self;
+  GumDukHeapPtr items, callback;
+  GPtrArray * vectors;
+  GByteArray * gathered;
+  gsize total_size;
+  duk_size_t n, i;
+  GumDukWriteOperation * op;
+
+  self = _gum_duk_object_get (args);
+
+  _gum_duk_args_parse (args, "AF", &items, &callback);
+
+  vectors = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+  gathered = NULL;
+  total_size = 0;
+
+  duk_push_heapptr (ctx, items);
+  n = duk_get_length (ctx, -1);
+
+  for (i = 0; i != n; i++)
+  {
+    gpointer address;
+    gconstpointer data;
+    duk_size_t size;
+
+    duk_get_prop_index (ctx, -1, (duk_uarridx_t) i);
+
+    if (_gum_duk_get_pointer (ctx, -1, args->core, &address))
+    {
+      gsize length;
+
+      duk_pop (ctx);
+
+      if (i + 1 == n)
+        goto invalid_vector;
+      duk_get_prop_index (ctx, -1, (duk_uarridx_t) ++i);
+      if (!_gum_duk_get_size (ctx, -1, args->core, &length))
+        goto invalid_vector;
+      duk_pop (ctx);
+
+      if (gathered != NULL)
+      {
+        g_ptr_array_add (vectors,
+            g_byte_array_free_to_bytes (g_steal_pointer (&gathered)));
+      }
+
+      g_ptr_array_add (vectors, g_bytes_new_static (address, length));
+      total_size += length;
+
+      continue;
+    }
+
+    if (gathered == NULL)
+      gathered = g_byte_array_new ();
+
+    data = duk_get_buffer_data (ctx, -1, &size);
+    if (data != NULL)
+    {
+      g_byte_array_append (gathered, data, size);
+    }
+    else
+    {
+      GBytes * bytes;
+      gsize bytes_size;
+
+      if (!_gum_duk_get_bytes (ctx, -1, &bytes))
+        goto invalid_vector;
+
+      data = g_bytes_get_data (bytes, &bytes_size);
+      g_byte_array_append (gathered, data, bytes_size);
+      size = bytes_size;
+
+      g_bytes_unref (bytes);
+    }
+    total_size += size;
+
+    duk_pop (ctx);
+  }
+
+  duk_pop (ctx);
+
+  if (gathered != NULL)
+    g_ptr_array_add (vectors, g_byte_array_free_to_bytes (gathered));
+
+  op = _gum_duk_object_operation_new (GumDukWriteOperation, self, callback,
+      gum_duk_write_operation_start, gum_duk_write_operation_dispose);
+  op->strategy = GUM_DUK_WRITE_VECTORS;
+  op->bytes = NULL;
+  op->vectors = vectors;
+  op->vector_index = 0;
+  op->vectors_size = total_size;
+  op->vectors_written = 0;
+  _gum_duk_object_operation_schedule (op);
+
+  return 0;
+
+invalid_vector:
+  {
+    if (gathered != NULL)
+      g_byte_array_unref (gathered);
+    g_ptr_array_unref (vectors);
+
+    _gum_duk_throw (ctx, "expected bytes, or a NativePointer followed by "
+        "a length");
+    return 0;
+  }
+}
+
 static gint
 gumjs_output_stream_write_with_strategy (duk_context * ctx,
                                          const GumDukArgs * args,
@@ -698,6 +829,7 @@ gumjs_output_stream_write_with_strategy (duk_context * ctx,
       gum_duk_write_operation_start, gum_duk_write_operation_dispose);
   op->strategy = strategy;
   op->bytes = bytes;
+  op->vectors = NULL;
   _gum_duk_object_operation_schedule (op);
 
   return 0;
@@ -706,7 +838,10 @@ gumjs_output_stream_write_with_strategy (duk_context * ctx,
 static void
 gum_duk_write_operation_dispose (GumDukWriteOperation * self)
 {
-  g_bytes_unref (self->bytes);
+  if (self->bytes != NULL)
+    g_bytes_unref (self->bytes);
+  if (self->vectors != NULL)
+    g_ptr_array_unref (self->vectors);
 }
 
 static void
@@ -715,7 +850,11 @@ gum_duk_write_operation_start (GumDukWriteOperation * self)
   GumDukObjectOperation * op = GUM_DUK_OBJECT_OPERATION (self);
   GumDukObject * stream = op->object;
 
-  if (self->strategy == GUM_DUK_WRITE_SOME)
+  if (self->strategy == GUM_DUK_WRITE_VECTORS)
+  {
+    gum_duk_write_operation_write_next_vector (self);
+  }
+  else if (self->strategy == GUM_DUK_WRITE_SOME)
   {
     g_output_stream_write_bytes_async (stream->handle, self->bytes,
         G_PRIORITY_DEFAULT, stream->cancellable,
@@ -741,11 +880,8 @@ gum_duk_write_operation_finish (GOutputStream * stream,
                                 GAsyncResult * result,
                                 GumDukWriteOperation * self)
 {
-  GumDukObjectOperation * op = GUM_DUK_OBJECT_OPERATION (self);
   gsize bytes_written = 0;
   GError * error = NULL;
-  GumDukScope scope;
-  duk_context * ctx;
 
   if (self->strategy == GUM_DUK_WRITE_SOME)
   {
@@ -762,12 +898,64 @@ gum_duk_write_operation_finish (GOutputStream * stream,
     g_output_stream_write_all_finish (stream, result, &bytes_written, &error);
   }
 
+  gum_duk_write_operation_complete (self, bytes_written,
+      g_bytes_get_size (self->bytes), error);
+}
+
+static void
+gum_duk_write_operation_write_next_vector (GumDukWriteOperation * self)
+{
+  GumDukObject * stream = GUM_DUK_OBJECT_OPERATION (self)->object;
+  gconstpointer data = NULL;
+  gsize size = 0;
+
+  if (self->vector_index != self->vectors->len)
+  {
+    data = g_bytes_get_data (
+        g_ptr_array_index (self->vectors, self->vector_index), &size);
+  }
+
+  g_output_stream_write_all_async (stream->handle, data, size,
+      G_PRIORITY_DEFAULT, stream->cancellable,
+      (GAsyncReadyCallback) gum_duk_write_operation_vector_written, self);
+}
+
+static void
+gum_duk_write_operation_vector_written (GOutputStream * stream,
+                                        GAsyncResult * result,
+                                        GumDukWriteOperation * self)
+{
+  gsize bytes_written = 0;
+  GError * error = NULL;
+
+  g_output_stream_write_all_finish (stream, result, &bytes_written, &error);
+  self->vectors_written += bytes_written;
+
+  if (error == NULL && ++self->vector_index < self->vectors->len)
+  {
+    gum_duk_write_operation_write_next_vector (self);
+    return;
+  }
+
+  gum_duk_write_operation_complete (self, self->vectors_written,
+      self->vectors_size, error);
+}
+
+static void
+gum_duk_write_operation_complete (GumDukWriteOperation * self,
+                                  gsize bytes_written,
+                                  gsize expected_size,
+                                  GError * error)
+{
+  GumDukObjectOperation * op = GUM_DUK_OBJECT_OPERATION (self);
+  GumDukScope scope;
+  duk_context * ctx;
+
   ctx = _gum_duk_scope_enter (&scope, op->core);
 
   duk_push_heapptr (ctx, op->callback);
 
-  if (self->strategy == GUM_DUK_WRITE_ALL &&
-      bytes_written != g_bytes_get_size (self->bytes))
+  if (self->strategy != GUM_DUK_WRITE_SOME && bytes_written != expected_size)
   {
     duk_push_error_object (ctx, DUK_ERR_ERROR, "%s",
         (error != NULL) ? error->message : "Short write");
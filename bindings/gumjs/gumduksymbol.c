@@ -12,6 +12,7 @@
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_symbol_module_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_from_address)
+GUMJS_DECLARE_FUNCTION (gumjs_symbol_from_addresses)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_from_name)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_get_function_by_name)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_find_functions_named)
@@ -26,6 +27,7 @@ static void gumjs_pointer_array_push (duk_context * ctx, GArray * pointers,
 static const duk_function_list_entry gumjs_symbol_module_functions[] =
 {
   { "fromAddress", gumjs_symbol_from_address, 1 },
+  { "fromAddresses", gumjs_symbol_from_addresses, 1 },
   { "fromName", gumjs_symbol_from_name, 1 },
   { "getFunctionByName", gumjs_symbol_get_function_by_name, 1 },
   { "findFunctionsNamed", gumjs_symbol_find_functions_named, 1 },
@@ -115,6 +117,60 @@ GUMJS_DEFINE_FUNCTION (gumjs_symbol_from_address)
   return 1;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_symbol_from_addresses)
+{
+  GumDukScope scope = GUM_DUK_SCOPE_INIT (args->core);
+  GumDukSymbol * self;
+  GumDukHeapPtr addresses_value;
+  duk_size_t n, i;
+  gpointer * addresses;
+  GumDebugSymbolDetails * details;
+  gboolean * resolved;
+
+  self = gumjs_module_from_args (args);
+
+  _gum_duk_args_parse (args, "A", &addresses_value);
+
+  duk_push_heapptr (ctx, addresses_value);
+  n = duk_get_length (ctx, -1);
+
+  addresses = g_new (gpointer, n);
+  for (i = 0; i != n; i++)
+  {
+    duk_get_prop_index (ctx, -1, (duk_uarridx_t) i);
+    if (!_gum_duk_get_pointer (ctx, -1, args->core, &addresses[i]))
+    {
+      g_free (addresses);
+      _gum_duk_throw (ctx, "expected an array of pointers");
+    }
+    duk_pop (ctx);
+  }
+  duk_pop (ctx);
+
+  details = g_new (GumDebugSymbolDetails, n);
+  resolved = g_new (gboolean, n);
+
+  _gum_duk_scope_suspend (&scope);
+  gum_symbol_details_from_addresses (addresses, n, details, resolved);
+  _gum_duk_scope_resume (&scope);
+
+  duk_push_array (ctx);
+  for (i = 0; i != n; i++)
+  {
+    duk_push_heapptr (ctx, self->symbol);
+    duk_push_pointer (ctx, addresses[i]);
+    duk_push_pointer (ctx, resolved[i] ? &details[i] : NULL);
+    duk_new (ctx, 2);
+    duk_put_prop_index (ctx, -2, (duk_uarridx_t) i);
+  }
+
+  g_free (resolved);
+  g_free (details);
+  g_free (addresses);
+
+  return 1;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_symbol_from_name)
 {
   GumDukScope scope = GUM_DUK_SCOPE_INIT (args->core);
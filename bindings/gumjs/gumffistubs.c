@@ -0,0 +1,248 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumffistubs.h"
+
+#include <string.h>
+
+/*
+ * Calls through libffi pay for a generic argument marshalling loop on every
+ * invocation. For signatures made up only of integers and pointers that all
+ * fit in argument registers we instead call through a tiny generated stub,
+ * one per argument count, which loads the arguments from a packed array of
+ * machine words and calls the target directly. The result comes back as a
+ * machine word, with the low bytes holding narrower values.
+ */
+
+#if G_BYTE_ORDER == G_LITTLE_ENDIAN && \
+    ((defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 8) || defined (HAVE_ARM64))
+# define GUM_FFI_STUBS_SUPPORTED 1
+#endif
+
+#if defined (HAVE_I386) && defined (G_OS_WIN32)
+# define GUM_FFI_STUBS_MAX_REGISTER_ARGS 4
+#elif defined (HAVE_I386)
+# define GUM_FFI_STUBS_MAX_REGISTER_ARGS 6
+#else
+# define GUM_FFI_STUBS_MAX_REGISTER_ARGS 8
+#endif
+
+#ifdef GUM_FFI_STUBS_SUPPORTED
+static void gum_ffi_stubs_generate (GumFFIStubs * self);
+static gboolean gum_ffi_type_is_word_sized (const ffi_type * type);
+#endif
+
+void
+gum_ffi_stubs_init (GumFFIStubs * self)
+{
+  self->code = NULL;
+  self->generated = FALSE;
+  memset (self->stubs, 0, sizeof (self->stubs));
+}
+
+void
+gum_ffi_stubs_finalize (GumFFIStubs * self)
+{
+  if (self->code != NULL)
+  {
+    gum_free_pages (self->code);
+    self->code = NULL;
+  }
+}
+
+/*
+ * Returns the stub to use for calls described by `cif`, or NULL if they need
+ * to go through ffi_call(). Variadic signatures must not be looked up, as
+ * their arguments are not always passed in registers.
+ */
+GumFFIStubFunc
+gum_ffi_stubs_lookup (GumFFIStubs * self,
+                      const ffi_cif * cif)
+{
+#ifdef GUM_FFI_STUBS_SUPPORTED
+  guint i;
+
+  if (cif->abi != FFI_DEFAULT_ABI ||
+      cif->nargs > GUM_FFI_STUBS_MAX_REGISTER_ARGS)
+    return NULL;
+
+  if (cif->rtype->type != FFI_TYPE_VOID &&
+      !gum_ffi_type_is_word_sized (cif->rtype))
+    return NULL;
+
+  for (i = 0; i != cif->nargs; i++)
+  {
+    if (!gum_ffi_type_is_word_sized (cif->arg_types[i]))
+      return NULL;
+  }
+
+  if (!self->generated)
+  {
+    self->generated = TRUE;
+
+    if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_OPTIONAL)
+      gum_ffi_stubs_generate (self);
+  }
+
+  return self->stubs[cif->nargs];
+#else
+  return NULL;
+#endif
+}
+
+/*
+ * Converts an argument of `type` stored at `value` to a machine word,
+ * sign- or zero-extending it as the callee expects.
+ */
+gsize
+gum_ffi_arg_widen (gconstpointer value,
+                   const ffi_type * type)
+{
+  switch (type->type)
+  {
+    case FFI_TYPE_SINT8:
+      return (gsize) (gssize) *((const gint8 *) value);
+    case FFI_TYPE_UINT8:
+      return *((const guint8 *) value);
+    case FFI_TYPE_SINT16:
+      return (gsize) (gssize) *((const gint16 *) value);
+    case FFI_TYPE_UINT16:
+      return *((const guint16 *) value);
+    case FFI_TYPE_SINT32:
+      return (gsize) (gssize) *((const gint32 *) value);
+    case FFI_TYPE_UINT32:
+      return *((const guint32 *) value);
+    case FFI_TYPE_SINT64:
+    case FFI_TYPE_UINT64:
+      return (gsize) *((const guint64 *) value);
+    case FFI_TYPE_POINTER:
+      return GPOINTER_TO_SIZE (*((const gpointer *) value));
+    default:
+      g_assert_not_reached ();
+      return 0;
+  }
+}
+
+#ifdef GUM_FFI_STUBS_SUPPORTED
+
+#if defined (HAVE_I386)
+
+static void
+gum_ffi_stubs_generate (GumFFIStubs * self)
+{
+  static const GumCpuReg arg_regs[] = {
+# ifdef G_OS_WIN32
+    GUM_REG_RCX, GUM_REG_RDX, GUM_REG_R8, GUM_REG_R9
+# else
+    GUM_REG_RDI, GUM_REG_RSI, GUM_REG_RDX, GUM_REG_RCX, GUM_REG_R8, GUM_REG_R9
+# endif
+  };
+# ifdef G_OS_WIN32
+  /* Shadow space for the callee, plus keeping the stack 16-byte aligned */
+  const gssize frame_size = 32 + 8;
+# else
+  const gssize frame_size = 8;
+# endif
+  guint page_size, n;
+  GumX86Writer cw;
+
+  page_size = gum_query_page_size ();
+  self->code = gum_alloc_n_pages (1, GUM_PAGE_RW);
+
+  gum_x86_writer_init (&cw, self->code);
+
+  for (n = 0; n <= GUM_FFI_STUBS_MAX_REGISTER_ARGS; n++)
+  {
+    guint i;
+
+    self->stubs[n] =
+        GUM_POINTER_TO_FUNCPTR (GumFFIStubFunc, gum_x86_writer_cur (&cw));
+
+    gum_x86_writer_put_sub_reg_imm (&cw, GUM_REG_RSP, frame_size);
+    gum_x86_writer_put_mov_reg_reg (&cw, GUM_REG_RAX, arg_regs[0]);
+    gum_x86_writer_put_mov_reg_reg (&cw, GUM_REG_R10, arg_regs[1]);
+    for (i = 0; i != n; i++)
+    {
+      gum_x86_writer_put_mov_reg_reg_offset_ptr (&cw, arg_regs[i], GUM_REG_R10,
+          i * sizeof (gsize));
+    }
+    gum_x86_writer_put_call_reg (&cw, GUM_REG_RAX);
+    gum_x86_writer_put_add_reg_imm (&cw, GUM_REG_RSP, frame_size);
+    gum_x86_writer_put_ret (&cw);
+  }
+
+  gum_x86_writer_flush (&cw);
+  g_assert_cmpuint (gum_x86_writer_offset (&cw), <=, page_size);
+  gum_x86_writer_clear (&cw);
+
+  gum_mprotect (self->code, page_size, GUM_PAGE_RX);
+  gum_clear_cache (self->code, page_size);
+}
+
+#elif defined (HAVE_ARM64)
+
+static void
+gum_ffi_stubs_generate (GumFFIStubs * self)
+{
+  guint page_size, n;
+  GumArm64Writer cw;
+
+  page_size = gum_query_page_size ();
+  self->code = gum_alloc_n_pages (1, GUM_PAGE_RW);
+
+  gum_arm64_writer_init (&cw, self->code);
+
+  for (n = 0; n <= GUM_FFI_STUBS_MAX_REGISTER_ARGS; n++)
+  {
+    guint i;
+
+    self->stubs[n] =
+        GUM_POINTER_TO_FUNCPTR (GumFFIStubFunc, gum_arm64_writer_cur (&cw));
+
+    gum_arm64_writer_put_push_reg_reg (&cw, ARM64_REG_X29, ARM64_REG_LR);
+    gum_arm64_writer_put_mov_reg_reg (&cw, ARM64_REG_X16, ARM64_REG_X0);
+    gum_arm64_writer_put_mov_reg_reg (&cw, ARM64_REG_X17, ARM64_REG_X1);
+    for (i = 0; i != n; i++)
+    {
+      gum_arm64_writer_put_ldr_reg_reg_offset (&cw, ARM64_REG_X0 + i,
+          ARM64_REG_X17, i * sizeof (gsize));
+    }
+    gum_arm64_writer_put_blr_reg (&cw, ARM64_REG_X16);
+    gum_arm64_writer_put_pop_reg_reg (&cw, ARM64_REG_X29, ARM64_REG_LR);
+    gum_arm64_writer_put_ret (&cw);
+  }
+
+  gum_arm64_writer_flush (&cw);
+  g_assert_cmpuint (gum_arm64_writer_offset (&cw), <=, page_size);
+  gum_arm64_writer_clear (&cw);
+
+  gum_mprotect (self->code, page_size, GUM_PAGE_RX);
+  gum_clear_cache (self->code, page_size);
+}
+
+#endif
+
+static gboolean
+gum_ffi_type_is_word_sized (const ffi_type * type)
+{
+  switch (type->type)
+  {
+    case FFI_TYPE_SINT8:
+    case FFI_TYPE_UINT8:
+    case FFI_TYPE_SINT16:
+    case FFI_TYPE_UINT16:
+    case FFI_TYPE_SINT32:
+    case FFI_TYPE_UINT32:
+    case FFI_TYPE_SINT64:
+    case FFI_TYPE_UINT64:
+    case FFI_TYPE_POINTER:
+      return TRUE;
+    default:
+      return FALSE;
+  }
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_FFI_STUBS_H__
+#define __GUM_FFI_STUBS_H__
+
+#include <ffi.h>
+#include <gum/gum.h>
+
+#define GUM_FFI_STUBS_MAX_ARGS 8
+
+G_BEGIN_DECLS
+
+typedef struct _GumFFIStubs GumFFIStubs;
+
+typedef gsize (* GumFFIStubFunc) (GCallback implementation, const gsize * args);
+
+struct _GumFFIStubs
+{
+  gpointer code;
+  gboolean generated;
+  GumFFIStubFunc stubs[GUM_FFI_STUBS_MAX_ARGS + 1];
+};
+
+G_GNUC_INTERNAL void gum_ffi_stubs_init (GumFFIStubs * self);
+G_GNUC_INTERNAL void gum_ffi_stubs_finalize (GumFFIStubs * self);
+
+G_GNUC_INTERNAL GumFFIStubFunc gum_ffi_stubs_lookup (GumFFIStubs * self,
+    const ffi_cif * cif);
+
+G_GNUC_INTERNAL gsize gum_ffi_arg_widen (gconstpointer value,
+    const ffi_type * type);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumhexdump.h"
+
+#include <string.h>
+
+/*
+ * Produces the same output as the JavaScript implementation that came before
+ * it: bytes from `offset` up to `length` are laid out sixteen to a line, with
+ * each line labeled by the offset of its first byte. The caller provides a
+ * buffer of at least gum_hexdump_compute_max_size() bytes, so nothing here
+ * allocates, and `data` may be read while the formatting is guarded against
+ * faults.
+ */
+
+#define GUM_HEXDUMP_BYTES_PER_LINE 16
+
+#define GUM_HEXDUMP_COLUMN_PADDING "  "
+#define GUM_HEXDUMP_HEADER \
+    "        " \
+    GUM_HEXDUMP_COLUMN_PADDING \
+    " 0  1  2  3  4  5  6  7  8  9  A  B  C  D  E  F" \
+    GUM_HEXDUMP_COLUMN_PADDING \
+    "0123456789ABCDEF" \
+    "\n"
+
+#define GUM_HEXDUMP_RESET_COLOR "\033[0m"
+#define GUM_HEXDUMP_OFFSET_COLOR "\033[0;32m"
+#define GUM_HEXDUMP_DATA_COLOR "\033[0;33m"
+#define GUM_HEXDUMP_MAX_COLOR_SIZE (sizeof (GUM_HEXDUMP_OFFSET_COLOR) - 1)
+
+#define GUM_HEXDUMP_MIN_OFFSET_DIGITS 8
+#define GUM_HEXDUMP_MAX_OFFSET_DIGITS (2 * sizeof (gsize))
+
+#define GUM_HEXDUMP_MAX_LINE_SIZE \
+    (GUM_HEXDUMP_MAX_COLOR_SIZE + GUM_HEXDUMP_MAX_OFFSET_DIGITS + \
+     GUM_HEXDUMP_MAX_COLOR_SIZE + \
+     (2 * (sizeof (GUM_HEXDUMP_COLUMN_PADDING) - 1)) + \
+     (GUM_HEXDUMP_BYTES_PER_LINE * (3 + (2 * GUM_HEXDUMP_MAX_COLOR_SIZE))) + \
+     (GUM_HEXDUMP_BYTES_PER_LINE * (1 + (2 * GUM_HEXDUMP_MAX_COLOR_SIZE))) + \
+     1)
+
+#define GUM_HEXDUMP_APPEND_LITERAL(cursor, str) \
+    G_STMT_START \
+    { \
+      memcpy (cursor, str, sizeof (str) - 1); \
+      cursor += sizeof (str) - 1; \
+    } \
+    G_STMT_END
+#define GUM_HEXDUMP_APPEND_COLOR(cursor, str) \
+    G_STMT_START \
+    { \
+      if (ansi) \
+        GUM_HEXDUMP_APPEND_LITERAL (cursor, str); \
+    } \
+    G_STMT_END
+
+static const gchar gum_hexdump_digits[] = "0123456789abcdef";
+
+static gchar * gum_hexdump_append_offset (gchar * cursor, gsize offset);
+
+gsize
+gum_hexdump_compute_max_size (gsize offset,
+                              gsize length,
+                              gboolean header,
+                              gboolean ansi)
+{
+  gsize n_lines;
+
+  n_lines = (length > offset)
+      ? (length - offset + GUM_HEXDUMP_BYTES_PER_LINE - 1) /
+          GUM_HEXDUMP_BYTES_PER_LINE
+      : 0;
+
+  return (header ? sizeof (GUM_HEXDUMP_HEADER) - 1 : 0) +
+      (n_lines * GUM_HEXDUMP_MAX_LINE_SIZE);
+}
+
+/* Returns the number of bytes written, excluding any NUL terminator. */
+gsize
+gum_hexdump_format (const guint8 * data,
+                    gsize offset,
+                    gsize length,
+                    gboolean header,
+                    gboolean ansi,
+                    gchar * output)
+{
+  gchar * cursor = output;
+  gsize line_offset;
+
+  if (header)
+    GUM_HEXDUMP_APPEND_LITERAL (cursor, GUM_HEXDUMP_HEADER);
+
+  for (line_offset = offset; line_offset < length;
+      line_offset += GUM_HEXDUMP_BYTES_PER_LINE)
+  {
+    gchar ascii[GUM_HEXDUMP_BYTES_PER_LINE * (1 +
+        (2 * GUM_HEXDUMP_MAX_COLOR_SIZE))];
+    gchar * ascii_cursor = ascii;
+    guint line_size, i;
+
+    if (line_offset != offset)
+      *cursor++ = '\n';
+
+    GUM_HEXDUMP_APPEND_COLOR (cursor, GUM_HEXDUMP_OFFSET_COLOR);
+    cursor = gum_hexdump_append_offset (cursor, line_offset);
+    GUM_HEXDUMP_APPEND_COLOR (cursor, GUM_HEXDUMP_RESET_COLOR);
+    GUM_HEXDUMP_APPEND_LITERAL (cursor, GUM_HEXDUMP_COLUMN_PADDING);
+
+    line_size = MIN (length - line_offset, GUM_HEXDUMP_BYTES_PER_LINE);
+
+    for (i = 0; i != line_size; i++)
+    {
+      guint8 value = data[line_offset + i];
+      gboolean is_newline = value == '\n';
+
+      if (i != 0)
+        *cursor++ = ' ';
+
+      if (is_newline)
+      {
+        GUM_HEXDUMP_APPEND_COLOR (cursor, GUM_HEXDUMP_RESET_COLOR);
+        GUM_HEXDUMP_APPEND_COLOR (ascii_cursor, GUM_HEXDUMP_RESET_COLOR);
+      }
+      else
+      {
+        GUM_HEXDUMP_APPEND_COLOR (cursor, GUM_HEXDUMP_DATA_COLOR);
+        GUM_HEXDUMP_APPEND_COLOR (ascii_cursor, GUM_HEXDUMP_DATA_COLOR);
+      }
+
+      *cursor++ = gum_hexdump_digits[value >> 4];
+      *cursor++ = gum_hexdump_digits[value & 0xf];
+      GUM_HEXDUMP_APPEND_COLOR (cursor, GUM_HEXDUMP_RESET_COLOR);
+
+      *ascii_cursor++ = (value >= 32 && value <= 126) ? (gchar) value : '.';
+      GUM_HEXDUMP_APPEND_COLOR (ascii_cursor, GUM_HEXDUMP_RESET_COLOR);
+    }
+
+    for (i = line_size; i != GUM_HEXDUMP_BYTES_PER_LINE; i++)
+      GUM_HEXDUMP_APPEND_LITERAL (cursor, "   ");
+
+    GUM_HEXDUMP_APPEND_LITERAL (cursor, GUM_HEXDUMP_COLUMN_PADDING);
+
+    /*
+     * The ASCII column is not padded, which is what trimming trailing spaces
+     * off the last line used to result in.
+     */
+    memcpy (cursor, ascii, ascii_cursor - ascii);
+    cursor += ascii_cursor - ascii;
+  }
+
+  return cursor - output;
+}
+
+static gchar *
+gum_hexdump_append_offset (gchar * cursor,
+                           gsize offset)
+{
+  guint n_digits, i;
+
+  n_digits = GUM_HEXDUMP_MIN_OFFSET_DIGITS;
+  while (n_digits != GUM_HEXDUMP_MAX_OFFSET_DIGITS &&
+      (offset >> (4 * n_digits)) != 0)
+  {
+    n_digits++;
+  }
+
+  for (i = 0; i != n_digits; i++)
+  {
+    guint shift = 4 * (n_digits - 1 - i);
+
+    cursor[i] = gum_hexdump_digits[(offset >> shift) & 0xf];
+  }
+
+  return cursor + n_digits;
+}
@@ -0,0 +1,21 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_HEXDUMP_H__
+#define __GUM_HEXDUMP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL gsize gum_hexdump_compute_max_size (gsize offset,
+    gsize length, gboolean header, gboolean ansi);
+G_GNUC_INTERNAL gsize gum_hexdump_format (const guint8 * data, gsize offset,
+    gsize length, gboolean header, gboolean ansi, gchar * output);
+
+G_END_DECLS
+
+#endif
@@ -23,5 +23,5 @@ gumjs_recover_from_fork_in_parent (void)
 void
 gumjs_recover_from_fork_in_child (void)
 {
-  _gum_script_scheduler_recover_from_fork ();
+  _gum_script_scheduler_recover_from_fork_in_child ();
 }
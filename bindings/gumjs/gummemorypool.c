@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummemorypool.h"
+
+#include <string.h>
+
+/*
+ * Small allocations are rounded up to a power of two from 16 bytes and
+ * carved out of slabs that belong to the pool, with a header just in front
+ * of each chunk pointing back to its size class. Released chunks go on that
+ * class' free list for the next allocation of the same class, and slabs are
+ * only returned when the pool is freed. There is no locking, as everything
+ * happens with the script's runtime lock held.
+ *
+ * An arena hands out memory by bumping a cursor through its blocks, and
+ * gives it all back at once when reset. It keeps one block around for the
+ * next round, so a scope that is entered over and over costs no allocations.
+ */
+
+#define GUM_MEMORY_POOL_MIN_SHIFT 4
+#define GUM_MEMORY_POOL_N_CLASSES 8
+#define GUM_MEMORY_POOL_SLAB_SIZE 16384
+
+#define GUM_MEMORY_ARENA_BLOCK_SIZE 16384
+
+#define GUM_MEMORY_ALIGNMENT (2 * sizeof (gpointer))
+#define GUM_MEMORY_ALIGN(n) \
+    (((n) + GUM_MEMORY_ALIGNMENT - 1) & ~(GUM_MEMORY_ALIGNMENT - 1))
+
+typedef struct _GumMemoryPoolClass GumMemoryPoolClass;
+typedef union _GumMemoryPoolChunk GumMemoryPoolChunk;
+typedef struct _GumMemoryArenaBlock GumMemoryArenaBlock;
+
+union _GumMemoryPoolChunk
+{
+  GumMemoryPoolClass * klass;
+  GumMemoryPoolChunk * next;
+  gpointer padding[2];
+};
+
+struct _GumMemoryPoolClass
+{
+  gsize size;
+  GumMemoryPoolChunk * free_chunks;
+};
+
+struct _GumMemoryPool
+{
+  GumMemoryPoolClass classes[GUM_MEMORY_POOL_N_CLASSES];
+  GSList * slabs;
+};
+
+struct _GumMemoryArenaBlock
+{
+  GumMemoryArenaBlock * next;
+  gsize size;
+};
+
+struct _GumMemoryArena
+{
+  GumMemoryArenaBlock * blocks;
+  guint8 * cursor;
+  guint8 * end;
+  GumMemoryArenaBlock * spare;
+};
+
+G_STATIC_ASSERT (sizeof (GumMemoryPoolChunk) == GUM_MEMORY_ALIGNMENT);
+G_STATIC_ASSERT (sizeof (GumMemoryArenaBlock) == GUM_MEMORY_ALIGNMENT);
+G_STATIC_ASSERT ((1 << (GUM_MEMORY_POOL_MIN_SHIFT +
+    GUM_MEMORY_POOL_N_CLASSES - 1)) == GUM_MEMORY_POOL_MAX_SIZE);
+
+static void gum_memory_pool_class_refill (GumMemoryPool * self,
+    GumMemoryPoolClass * klass);
+
+GumMemoryPool *
+gum_memory_pool_new (void)
+{
+  GumMemoryPool * pool;
+  guint i;
+
+  pool = g_slice_new0 (GumMemoryPool);
+
+  for (i = 0; i != GUM_MEMORY_POOL_N_CLASSES; i++)
+    pool->classes[i].size = 1 << (GUM_MEMORY_POOL_MIN_SHIFT + i);
+
+  return pool;
+}
+
+void
+gum_memory_pool_free (GumMemoryPool * self)
+{
+  g_slist_free_full (self->slabs, g_free);
+
+  g_slice_free (GumMemoryPool, self);
+}
+
+/*
+ * Returns zeroed memory, or NULL if `size` is above what the pool serves,
+ * which is GUM_MEMORY_POOL_MAX_SIZE.
+ */
+gpointer
+gum_memory_pool_alloc (GumMemoryPool * self,
+                       gsize size)
+{
+  guint index;
+  GumMemoryPoolClass * klass;
+  GumMemoryPoolChunk * chunk;
+
+  if (size > GUM_MEMORY_POOL_MAX_SIZE)
+    return NULL;
+
+  index = (size > (1 << GUM_MEMORY_POOL_MIN_SHIFT))
+      ? g_bit_storage (size - 1) - GUM_MEMORY_POOL_MIN_SHIFT
+      : 0;
+  klass = &self->classes[index];
+
+  if (klass->free_chunks == NULL)
+    gum_memory_pool_class_refill (self, klass);
+
+  chunk = klass->free_chunks;
+  klass->free_chunks = chunk->next;
+  chunk->klass = klass;
+
+  memset (chunk + 1, 0, klass->size);
+
+  return chunk + 1;
+}
+
+void
+gum_memory_pool_release (gpointer mem)
+{
+  GumMemoryPoolChunk * chunk = (GumMemoryPoolChunk *) mem - 1;
+  GumMemoryPoolClass * klass = chunk->klass;
+
+  chunk->next = klass->free_chunks;
+  klass->free_chunks = chunk;
+}
+
+static void
+gum_memory_pool_class_refill (GumMemoryPool * self,
+                              GumMemoryPoolClass * klass)
+{
+  guint8 * slab;
+  gsize stride;
+  guint n, i;
+
+  slab = g_malloc (GUM_MEMORY_POOL_SLAB_SIZE);
+  self->slabs = g_slist_prepend (self->slabs, slab);
+
+  stride = sizeof (GumMemoryPoolChunk) + klass->size;
+  n = GUM_MEMORY_POOL_SLAB_SIZE / stride;
+
+  for (i = 0; i != n; i++)
+  {
+    GumMemoryPoolChunk * chunk = (GumMemoryPoolChunk *) (slab + (i * stride));
+
+    chunk->next = klass->free_chunks;
+    klass->free_chunks = chunk;
+  }
+}
+
+GumMemoryArena *
+gum_memory_arena_new (void)
+{
+  return g_slice_new0 (GumMemoryArena);
+}
+
+void
+gum_memory_arena_free (GumMemoryArena * self)
+{
+  gum_memory_arena_reset (self);
+  g_free (self->spare);
+
+  g_slice_free (GumMemoryArena, self);
+}
+
+/* Returns zeroed memory that stays valid until the arena is reset. */
+gpointer
+gum_memory_arena_alloc (GumMemoryArena * self,
+                        gsize size)
+{
+  GumMemoryArenaBlock * block;
+  gpointer mem;
+
+  size = GUM_MEMORY_ALIGN (size);
+
+  if ((gsize) (self->end - self->cursor) < size)
+  {
+    if (size > GUM_MEMORY_ARENA_BLOCK_SIZE - sizeof (GumMemoryArenaBlock))
+    {
+      /* Too big to share a block, so give it one of its own. */
+      block = g_malloc0 (sizeof (GumMemoryArenaBlock) + size);
+      block->size = sizeof (GumMemoryArenaBlock) + size;
+
+      if (self->blocks != NULL)
+      {
+        block->next = self->blocks->next;
+        self->blocks->next = block;
+      }
+      else
+      {
+        block->next = NULL;
+        self->blocks = block;
+      }
+
+      return block + 1;
+    }
+
+    block = g_steal_pointer (&self->spare);
+    if (block == NULL)
+      block = g_malloc (GUM_MEMORY_ARENA_BLOCK_SIZE);
+    block->size = GUM_MEMORY_ARENA_BLOCK_SIZE;
+    block->next = self->blocks;
+    self->blocks = block;
+
+    self->cursor = (guint8 *) (block + 1);
+    self->end = (guint8 *) block + GUM_MEMORY_ARENA_BLOCK_SIZE;
+  }
+
+  mem = self->cursor;
+  self->cursor += size;
+
+  memset (mem, 0, size);
+
+  return mem;
+}
+
+void
+gum_memory_arena_reset (GumMemoryArena * self)
+{
+  GumMemoryArenaBlock * block, * next;
+
+  for (block = self->blocks; block != NULL; block = next)
+  {
+    next = block->next;
+
+    if (self->spare == NULL && block->size == GUM_MEMORY_ARENA_BLOCK_SIZE)
+      self->spare = block;
+    else
+      g_free (block);
+  }
+
+  self->blocks = NULL;
+  self->cursor = NULL;
+  self->end = NULL;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_MEMORY_POOL_H__
+#define __GUM_MEMORY_POOL_H__
+
+#include <glib.h>
+
+#define GUM_MEMORY_POOL_MAX_SIZE 2048
+
+G_BEGIN_DECLS
+
+typedef struct _GumMemoryPool GumMemoryPool;
+typedef struct _GumMemoryArena GumMemoryArena;
+
+G_GNUC_INTERNAL GumMemoryPool * gum_memory_pool_new (void);
+G_GNUC_INTERNAL void gum_memory_pool_free (GumMemoryPool * self);
+
+G_GNUC_INTERNAL gpointer gum_memory_pool_alloc (GumMemoryPool * self,
+    gsize size);
+G_GNUC_INTERNAL void gum_memory_pool_release (gpointer mem);
+
+G_GNUC_INTERNAL GumMemoryArena * gum_memory_arena_new (void);
+G_GNUC_INTERNAL void gum_memory_arena_free (GumMemoryArena * self);
+
+G_GNUC_INTERNAL gpointer gum_memory_arena_alloc (GumMemoryArena * self,
+    gsize size);
+G_GNUC_INTERNAL void gum_memory_arena_reset (GumMemoryArena * self);
+
+G_END_DECLS
+
+#endif
@@ -12,6 +12,15 @@
 #define GUM_MEMORY_VFS(vfs) ((GumMemoryVfs *) (vfs))
 #define GUM_MEMORY_FILE(f) ((GumMemoryFile *) (f))
 
+/*
+ * Files are stored as fixed-size chunks so that growing one only ever
+ * appends, and a chunk is as large as SQLite's biggest page size so that no
+ * page straddles two of them. Chunks beyond a file's memory limit live in a
+ * sparse temporary file instead, at the same offset they have in the file
+ * itself; such chunks are NULL in the chunk array.
+ */
+#define GUM_MEMORY_FILE_CHUNK_SIZE (64 * 1024)
+
 typedef struct _GumMemoryFile GumMemoryFile;
 typedef struct _GumMemoryFileEntry GumMemoryFileEntry;
 
@@ -26,13 +35,19 @@ struct _GumMemoryFile
 struct _GumMemoryFileEntry
 {
   guint ref_count;
-  guint8 * data;
+  GPtrArray * chunks;
   gsize size;
+  gsize memory_limit;
+  GFile * spill_file;
+  GFileIOStream * spill;
   gint lock_level;
+  GPtrArray * shm_regions;
 };
 
 static GumMemoryFileEntry * gum_memory_vfs_add_entry (GumMemoryVfs * self,
-    gchar * path, guint8 * data, gsize size);
+    gchar * path, gsize memory_limit);
+static gsize gum_memory_vfs_get_inherited_memory_limit (GumMemoryVfs * self,
+    const gchar * name);
 static int gum_memory_vfs_open (sqlite3_vfs * vfs, const char * name,
     sqlite3_file * file, int flags, int * out_flags);
 static int gum_memory_vfs_delete (sqlite3_vfs * vfs, const char * name,
@@ -57,6 +72,13 @@ static int gum_memory_vfs_current_time_int64 (sqlite3_vfs * vfs,
 static GumMemoryFileEntry * gum_memory_file_entry_ref (
     GumMemoryFileEntry * self);
 static void gum_memory_file_entry_unref (GumMemoryFileEntry * self);
+static void gum_memory_file_entry_resize (GumMemoryFileEntry * self,
+    gsize size);
+static gboolean gum_memory_file_entry_read (GumMemoryFileEntry * self,
+    guint8 * buffer, gsize amount, gsize offset);
+static gboolean gum_memory_file_entry_write (GumMemoryFileEntry * self,
+    const guint8 * buffer, gsize amount, gsize offset);
+static gboolean gum_memory_file_entry_ensure_spill (GumMemoryFileEntry * self);
 static int gum_memory_file_close (sqlite3_file * file);
 static int gum_memory_file_read (sqlite3_file * file, void * buffer, int amount,
     sqlite3_int64 offset);
@@ -161,13 +183,26 @@ gum_memory_vfs_free (GumMemoryVfs * self)
 const gchar *
 gum_memory_vfs_add_file (GumMemoryVfs * self,
                          gpointer contents,
-                         gsize size)
+                         gsize size,
+                         gsize memory_limit)
 {
   gchar * path;
+  GumMemoryFileEntry * entry;
+  gboolean stored;
 
   path = g_strdup_printf ("/f%d.db", self->next_entry_id++);
 
-  gum_memory_vfs_add_entry (self, path, contents, size);
+  entry = gum_memory_vfs_add_entry (self, path, memory_limit);
+  gum_memory_file_entry_resize (entry, size);
+  stored = gum_memory_file_entry_write (entry, contents, size, 0);
+
+  g_free (contents);
+
+  if (!stored)
+  {
+    g_hash_table_remove (self->entries, path);
+    return NULL;
+  }
 
   return path;
 }
@@ -186,12 +221,20 @@ gum_memory_vfs_get_file_contents (GumMemoryVfs * self,
                                   gsize * size)
 {
   GumMemoryFileEntry * entry;
+  guint8 * data;
 
   entry = g_hash_table_lookup (self->entries, path);
   if (entry == NULL)
     return FALSE;
 
-  *contents = entry->data;
+  data = g_malloc (MAX (entry->size, 1));
+  if (!gum_memory_file_entry_read (entry, data, entry->size, 0))
+  {
+    g_free (data);
+    return FALSE;
+  }
+
+  *contents = data;
   *size = entry->size;
 
   return TRUE;
@@ -200,21 +243,47 @@ gum_memory_vfs_get_file_contents (GumMemoryVfs * self,
 static GumMemoryFileEntry *
 gum_memory_vfs_add_entry (GumMemoryVfs * self,
                           gchar * path,
-                          guint8 * data,
-                          gsize size)
+                          gsize memory_limit)
 {
   GumMemoryFileEntry * entry;
 
   entry = g_slice_new (GumMemoryFileEntry);
   entry->ref_count = 1;
-  entry->data = data;
-  entry->size = size;
+  entry->chunks = g_ptr_array_new_with_free_func (g_free);
+  entry->size = 0;
+  entry->memory_limit = memory_limit;
+  entry->spill_file = NULL;
+  entry->spill = NULL;
   entry->lock_level = SQLITE_LOCK_NONE;
+  entry->shm_regions = NULL;
   g_hash_table_replace (self->entries, path, entry);
 
   return entry;
 }
 
+/*
+ * Journals and WAL files are named after the database they belong to, and
+ * should be kept within the same memory limit.
+ */
+static gsize
+gum_memory_vfs_get_inherited_memory_limit (GumMemoryVfs * self,
+                                           const gchar * name)
+{
+  const gchar * dash;
+  gchar * main_name;
+  GumMemoryFileEntry * main_entry;
+
+  dash = strrchr (name, '-');
+  if (dash == NULL)
+    return 0;
+
+  main_name = g_strndup (name, dash - name);
+  main_entry = g_hash_table_lookup (self->entries, main_name);
+  g_free (main_name);
+
+  return (main_entry != NULL) ? main_entry->memory_limit : 0;
+}
+
 static int
 gum_memory_vfs_open (sqlite3_vfs * vfs,
                      const char * name,
@@ -228,15 +297,17 @@ gum_memory_vfs_open (sqlite3_vfs * vfs,
 
   memset (f, 0, sizeof (GumMemoryFile));
 
-  if ((flags & SQLITE_OPEN_CREATE) != 0)
-  {
-    entry = gum_memory_vfs_add_entry (self, g_strdup (name), NULL, 0);
-  }
-  else
+  entry = g_hash_table_lookup (self->entries, name);
+  if (entry != NULL && (flags & SQLITE_OPEN_EXCLUSIVE) != 0)
+    return SQLITE_CANTOPEN;
+
+  if (entry == NULL)
   {
-    entry = g_hash_table_lookup (self->entries, name);
-    if (entry == NULL)
+    if ((flags & SQLITE_OPEN_CREATE) == 0)
       return SQLITE_CANTOPEN;
+
+    entry = gum_memory_vfs_add_entry (self, g_strdup (name),
+        gum_memory_vfs_get_inherited_memory_limit (self, name));
   }
 
   file->pMethods = &gum_memory_file_methods;
@@ -382,12 +453,160 @@ gum_memory_file_entry_unref (GumMemoryFileEntry * self)
 {
   if (--self->ref_count == 0)
   {
-    g_free (self->data);
+    if (self->shm_regions != NULL)
+      g_ptr_array_unref (self->shm_regions);
+
+    if (self->spill != NULL)
+    {
+      g_io_stream_close (G_IO_STREAM (self->spill), NULL, NULL);
+      g_object_unref (self->spill);
+
+      g_file_delete (self->spill_file, NULL, NULL);
+      g_object_unref (self->spill_file);
+    }
+
+    g_ptr_array_unref (self->chunks);
 
     g_slice_free (GumMemoryFileEntry, self);
   }
 }
 
+static void
+gum_memory_file_entry_resize (GumMemoryFileEntry * self,
+                              gsize size)
+{
+  guint n_chunks;
+
+  n_chunks = (size + GUM_MEMORY_FILE_CHUNK_SIZE - 1) /
+      GUM_MEMORY_FILE_CHUNK_SIZE;
+
+  if (n_chunks < self->chunks->len)
+  {
+    g_ptr_array_set_size (self->chunks, n_chunks);
+
+    if (self->spill != NULL)
+    {
+      g_seekable_truncate (G_SEEKABLE (self->spill),
+          (goffset) n_chunks * GUM_MEMORY_FILE_CHUNK_SIZE, NULL, NULL);
+    }
+  }
+
+  while (self->chunks->len < n_chunks)
+  {
+    gsize end = ((gsize) self->chunks->len + 1) * GUM_MEMORY_FILE_CHUNK_SIZE;
+    gboolean spilled;
+
+    spilled = self->memory_limit != 0 && end > self->memory_limit &&
+        gum_memory_file_entry_ensure_spill (self);
+
+    g_ptr_array_add (self->chunks,
+        spilled ? NULL : g_malloc0 (GUM_MEMORY_FILE_CHUNK_SIZE));
+  }
+
+  self->size = size;
+}
+
+static gboolean
+gum_memory_file_entry_read (GumMemoryFileEntry * self,
+                            guint8 * buffer,
+                            gsize amount,
+                            gsize offset)
+{
+  while (amount != 0)
+  {
+    gsize chunk_offset, n;
+    const guint8 * chunk;
+
+    chunk_offset = offset % GUM_MEMORY_FILE_CHUNK_SIZE;
+    n = MIN (amount, GUM_MEMORY_FILE_CHUNK_SIZE - chunk_offset);
+
+    chunk = g_ptr_array_index (self->chunks,
+        offset / GUM_MEMORY_FILE_CHUNK_SIZE);
+    if (chunk != NULL)
+    {
+      memcpy (buffer, chunk + chunk_offset, n);
+    }
+    else
+    {
+      gsize n_read = 0;
+
+      if (!g_seekable_seek (G_SEEKABLE (self->spill), offset, G_SEEK_SET,
+          NULL, NULL))
+        return FALSE;
+
+      if (!g_input_stream_read_all (
+          g_io_stream_get_input_stream (G_IO_STREAM (self->spill)),
+          buffer, n, &n_read, NULL, NULL))
+        return FALSE;
+
+      /* Parts of the spill file never written to are holes. */
+      memset (buffer + n_read, 0, n - n_read);
+    }
+
+    buffer += n;
+    offset += n;
+    amount -= n;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gum_memory_file_entry_write (GumMemoryFileEntry * self,
+                             const guint8 * buffer,
+                             gsize amount,
+                             gsize offset)
+{
+  while (amount != 0)
+  {
+    gsize chunk_offset, n;
+    guint8 * chunk;
+
+    chunk_offset = offset % GUM_MEMORY_FILE_CHUNK_SIZE;
+    n = MIN (amount, GUM_MEMORY_FILE_CHUNK_SIZE - chunk_offset);
+
+    chunk = g_ptr_array_index (self->chunks,
+        offset / GUM_MEMORY_FILE_CHUNK_SIZE);
+    if (chunk != NULL)
+    {
+      memcpy (chunk + chunk_offset, buffer, n);
+    }
+    else
+    {
+      if (!g_seekable_seek (G_SEEKABLE (self->spill), offset, G_SEEK_SET,
+          NULL, NULL))
+        return FALSE;
+
+      if (!g_output_stream_write_all (
+          g_io_stream_get_output_stream (G_IO_STREAM (self->spill)),
+          buffer, n, NULL, NULL, NULL))
+        return FALSE;
+    }
+
+    buffer += n;
+    offset += n;
+    amount -= n;
+  }
+
+  return TRUE;
+}
+
+/*
+ * If no temporary file can be created we keep going in memory rather than
+ * fail writes that would otherwise have succeeded.
+ */
+static gboolean
+gum_memory_file_entry_ensure_spill (GumMemoryFileEntry * self)
+{
+  if (self->spill != NULL)
+    return TRUE;
+
+  self->spill_file = g_file_new_tmp ("frida-sqlite-XXXXXX", &self->spill,
+      NULL);
+
+  return self->spill_file != NULL;
+}
+
 static int
 gum_memory_file_close (sqlite3_file * file)
 {
@@ -407,17 +626,18 @@ gum_memory_file_read (sqlite3_file * file,
 {
   GumMemoryFile * self = GUM_MEMORY_FILE (file);
   GumMemoryFileEntry * entry = self->entry;
-  gint available, n;
+  gsize available, n;
 
-  if (offset < 0 || (gsize) offset >= entry->size)
+  if (offset < 0)
     return SQLITE_IOERR_READ;
 
-  available = entry->size - offset;
-  n = MIN (amount, available);
+  available = ((gsize) offset < entry->size) ? entry->size - offset : 0;
+  n = MIN ((gsize) amount, available);
 
-  memcpy (buffer, entry->data + offset, n);
+  if (n > 0 && !gum_memory_file_entry_read (entry, buffer, n, offset))
+    return SQLITE_IOERR_READ;
 
-  if (n < amount)
+  if (n < (gsize) amount)
   {
     memset ((guint8 *) buffer + n, 0, amount - n);
     return SQLITE_IOERR_SHORT_READ;
@@ -441,12 +661,10 @@ gum_memory_file_write (sqlite3_file * file,
 
   required_size = offset + amount;
   if (required_size > entry->size)
-  {
-    entry->data = g_realloc (entry->data, required_size);
-    entry->size = required_size;
-  }
+    gum_memory_file_entry_resize (entry, required_size);
 
-  memcpy (entry->data + offset, buffer, amount);
+  if (!gum_memory_file_entry_write (entry, buffer, amount, offset))
+    return SQLITE_IOERR_WRITE;
 
   return SQLITE_OK;
 }
@@ -458,8 +676,11 @@ gum_memory_file_truncate (sqlite3_file * file,
   GumMemoryFile * self = GUM_MEMORY_FILE (file);
   GumMemoryFileEntry * entry = self->entry;
 
-  g_free (g_steal_pointer (&entry->data));
-  entry->size = 0;
+  if (size < 0)
+    return SQLITE_IOERR_TRUNCATE;
+
+  if ((gsize) size < entry->size)
+    gum_memory_file_entry_resize (entry, size);
 
   return SQLITE_OK;
 }
@@ -540,6 +761,11 @@ gum_memory_file_device_characteristics (sqlite3_file * file)
       SQLITE_IOCAP_POWERSAFE_OVERWRITE;
 }
 
+/*
+ * All connections to a file live in the same process and share its entry,
+ * so the wal-index can simply be heap memory hanging off that entry, and
+ * the locks between them can be no-ops like the file locks above.
+ */
 static int
 gum_memory_file_shm_map (sqlite3_file * file,
                          int region,
@@ -547,7 +773,27 @@ gum_memory_file_shm_map (sqlite3_file * file,
                          int extend,
                          void volatile ** memory)
 {
-  return SQLITE_IOERR_NOMEM;
+  GumMemoryFile * self = GUM_MEMORY_FILE (file);
+  GumMemoryFileEntry * entry = self->entry;
+
+  if (entry->shm_regions == NULL)
+    entry->shm_regions = g_ptr_array_new_with_free_func (g_free);
+
+  if ((guint) region >= entry->shm_regions->len)
+  {
+    if (!extend)
+    {
+      *memory = NULL;
+      return SQLITE_OK;
+    }
+
+    while (entry->shm_regions->len <= (guint) region)
+      g_ptr_array_add (entry->shm_regions, g_malloc0 (region_size));
+  }
+
+  *memory = g_ptr_array_index (entry->shm_regions, region);
+
+  return SQLITE_OK;
 }
 
 static int
@@ -568,6 +814,12 @@ static int
 gum_memory_file_shm_unmap (sqlite3_file * file,
                            int delete_flag)
 {
+  GumMemoryFile * self = GUM_MEMORY_FILE (file);
+  GumMemoryFileEntry * entry = self->entry;
+
+  if (delete_flag && entry->shm_regions != NULL)
+    g_clear_pointer (&entry->shm_regions, g_ptr_array_unref);
+
   return SQLITE_OK;
 }
 
@@ -29,7 +29,7 @@ G_GNUC_INTERNAL GumMemoryVfs * gum_memory_vfs_new (void);
 G_GNUC_INTERNAL void gum_memory_vfs_free (GumMemoryVfs * self);
 
 G_GNUC_INTERNAL const gchar * gum_memory_vfs_add_file (GumMemoryVfs * self,
-    gpointer contents, gsize size);
+    gpointer contents, gsize size, gsize memory_limit);
 G_GNUC_INTERNAL void gum_memory_vfs_remove_file (GumMemoryVfs * self,
     const gchar * path);
 G_GNUC_INTERNAL gboolean gum_memory_vfs_get_file_contents (GumMemoryVfs * self,
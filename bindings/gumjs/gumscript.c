@@ -69,6 +69,21 @@ gum_script_set_message_handler (GumScript * self,
       data_destroy);
 }
 
+/*
+ * Messages emitted in quick succession are delivered to `handler` in FIFO
+ * order with a single call per main context iteration. While a batch handler
+ * is set it takes precedence over the per-message handler.
+ */
+void
+gum_script_set_message_batch_handler (GumScript * self,
+                                      GumScriptMessageBatchHandler handler,
+                                      gpointer data,
+                                      GDestroyNotify data_destroy)
+{
+  GUM_SCRIPT_GET_IFACE (self)->set_message_batch_handler (self, handler, data,
+      data_destroy);
+}
+
 void
 gum_script_post (GumScript * self,
                  const gchar * message,
@@ -16,8 +16,18 @@ G_BEGIN_DECLS
 #define GUM_TYPE_SCRIPT (gum_script_get_type ())
 G_DECLARE_INTERFACE (GumScript, gum_script, GUM, SCRIPT, GObject)
 
+typedef struct _GumScriptMessage GumScriptMessage;
+
 typedef void (* GumScriptMessageHandler) (GumScript * script,
     const gchar * message, GBytes * data, gpointer user_data);
+typedef void (* GumScriptMessageBatchHandler) (GumScript * script,
+    const GumScriptMessage * messages, guint n_messages, gpointer user_data);
+
+struct _GumScriptMessage
+{
+  const gchar * message;
+  GBytes * data;
+};
 
 struct _GumScriptInterface
 {
@@ -35,6 +45,9 @@ struct _GumScriptInterface
   void (* set_message_handler) (GumScript * self,
       GumScriptMessageHandler handler, gpointer data,
       GDestroyNotify data_destroy);
+  void (* set_message_batch_handler) (GumScript * self,
+      GumScriptMessageBatchHandler handler, gpointer data,
+      GDestroyNotify data_destroy);
   void (* post) (GumScript * self, const gchar * message, GBytes * data);
 
   GumStalker * (* get_stalker) (GumScript * self);
@@ -54,6 +67,9 @@ GUM_API void gum_script_unload_sync (GumScript * self,
 GUM_API void gum_script_set_message_handler (GumScript * self,
     GumScriptMessageHandler handler, gpointer data,
     GDestroyNotify data_destroy);
+GUM_API void gum_script_set_message_batch_handler (GumScript * self,
+    GumScriptMessageBatchHandler handler, gpointer data,
+    GDestroyNotify data_destroy);
 GUM_API void gum_script_post (GumScript * self, const gchar * message,
     GBytes * data);
 
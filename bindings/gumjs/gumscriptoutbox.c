@@ -0,0 +1,211 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumscriptoutbox.h"
+
+/*
+ * Messages sent by a script are pushed onto a lock-free stack from whichever
+ * thread calls send(). Only the push that finds the stack empty schedules a
+ * drain on the main context, so a burst of messages costs one wakeup, and
+ * the drain hands them to the batch handler in a single call, falling back
+ * to calling the message handler once per message.
+ */
+
+struct _GumScriptOutboxItem
+{
+  GumScriptOutboxItem * next;
+  gchar * message;
+  GBytes * data;
+};
+
+static gboolean gum_script_outbox_drain (GumScriptOutbox * self);
+static void gum_script_outbox_release (GumScriptOutbox * self);
+static GumScriptOutboxItem * gum_script_outbox_steal_pending (
+    GumScriptOutbox * self);
+
+static void gum_script_outbox_item_free (GumScriptOutboxItem * item);
+
+void
+gum_script_outbox_init (GumScriptOutbox * self,
+                        GumScript * script)
+{
+  self->script = script;
+
+  self->pending = NULL;
+
+  self->message_handler = NULL;
+  self->message_handler_data = NULL;
+  self->message_handler_data_destroy = NULL;
+
+  self->batch_handler = NULL;
+  self->batch_handler_data = NULL;
+  self->batch_handler_data_destroy = NULL;
+}
+
+void
+gum_script_outbox_finalize (GumScriptOutbox * self)
+{
+  GumScriptOutboxItem * item, * next;
+
+  gum_script_outbox_set_message_handler (self, NULL, NULL, NULL);
+  gum_script_outbox_set_batch_handler (self, NULL, NULL, NULL);
+
+  for (item = gum_script_outbox_steal_pending (self); item != NULL;
+      item = next)
+  {
+    next = item->next;
+    gum_script_outbox_item_free (item);
+  }
+}
+
+void
+gum_script_outbox_set_message_handler (GumScriptOutbox * self,
+                                       GumScriptMessageHandler handler,
+                                       gpointer data,
+                                       GDestroyNotify data_destroy)
+{
+  if (self->message_handler_data_destroy != NULL)
+    self->message_handler_data_destroy (self->message_handler_data);
+  self->message_handler = handler;
+  self->message_handler_data = data;
+  self->message_handler_data_destroy = data_destroy;
+}
+
+void
+gum_script_outbox_set_batch_handler (GumScriptOutbox * self,
+                                     GumScriptMessageBatchHandler handler,
+                                     gpointer data,
+                                     GDestroyNotify data_destroy)
+{
+  if (self->batch_handler_data_destroy != NULL)
+    self->batch_handler_data_destroy (self->batch_handler_data);
+  self->batch_handler = handler;
+  self->batch_handler_data = data;
+  self->batch_handler_data_destroy = data_destroy;
+}
+
+void
+gum_script_outbox_push (GumScriptOutbox * self,
+                        const gchar * message,
+                        GBytes * data,
+                        GMainContext * main_context)
+{
+  GumScriptOutboxItem * item, * head;
+
+  item = g_slice_new (GumScriptOutboxItem);
+  item->message = g_strdup (message);
+  item->data = (data != NULL) ? g_bytes_ref (data) : NULL;
+
+  do
+  {
+    head = g_atomic_pointer_get (&self->pending);
+    item->next = head;
+  }
+  while (!g_atomic_pointer_compare_and_exchange (&self->pending, head, item));
+
+  if (head == NULL)
+  {
+    GSource * source;
+
+    g_object_ref (self->script);
+
+    source = g_idle_source_new ();
+    g_source_set_callback (source, (GSourceFunc) gum_script_outbox_drain,
+        self, (GDestroyNotify) gum_script_outbox_release);
+    g_source_attach (source, main_context);
+    g_source_unref (source);
+  }
+}
+
+static gboolean
+gum_script_outbox_drain (GumScriptOutbox * self)
+{
+  GumScriptOutboxItem * pending, * item, * next;
+  guint n, i;
+  GArray * messages;
+
+  /*
+   * A drain scheduled by a later push may find that an earlier drain
+   * already took its messages.
+   */
+  pending = gum_script_outbox_steal_pending (self);
+  if (pending == NULL)
+    return FALSE;
+
+  n = 0;
+  for (item = pending; item != NULL; item = item->next)
+    n++;
+
+  messages = g_array_sized_new (FALSE, FALSE, sizeof (GumScriptMessage), n);
+  g_array_set_size (messages, n);
+
+  /* The stack is newest-first, so fill the batch from the back */
+  i = n;
+  for (item = pending; item != NULL; item = item->next)
+  {
+    GumScriptMessage * m = &g_array_index (messages, GumScriptMessage, --i);
+
+    m->message = item->message;
+    m->data = item->data;
+  }
+
+  if (self->batch_handler != NULL)
+  {
+    self->batch_handler (self->script,
+        (const GumScriptMessage *) messages->data, messages->len,
+        self->batch_handler_data);
+  }
+  else if (self->message_handler != NULL)
+  {
+    for (i = 0; i != messages->len; i++)
+    {
+      const GumScriptMessage * m =
+          &g_array_index (messages, GumScriptMessage, i);
+
+      self->message_handler (self->script, m->message, m->data,
+          self->message_handler_data);
+    }
+  }
+
+  g_array_free (messages, TRUE);
+
+  for (item = pending; item != NULL; item = next)
+  {
+    next = item->next;
+    gum_script_outbox_item_free (item);
+  }
+
+  return FALSE;
+}
+
+static void
+gum_script_outbox_release (GumScriptOutbox * self)
+{
+  g_object_unref (self->script);
+}
+
+static GumScriptOutboxItem *
+gum_script_outbox_steal_pending (GumScriptOutbox * self)
+{
+  GumScriptOutboxItem * head;
+
+  do
+  {
+    head = g_atomic_pointer_get (&self->pending);
+  }
+  while (!g_atomic_pointer_compare_and_exchange (&self->pending, head, NULL));
+
+  return head;
+}
+
+static void
+gum_script_outbox_item_free (GumScriptOutboxItem * item)
+{
+  g_bytes_unref (item->data);
+  g_free (item->message);
+
+  g_slice_free (GumScriptOutboxItem, item);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_SCRIPT_OUTBOX_H__
+#define __GUM_SCRIPT_OUTBOX_H__
+
+#include "gumscript.h"
+
+G_BEGIN_DECLS
+
+typedef struct _GumScriptOutbox GumScriptOutbox;
+typedef struct _GumScriptOutboxItem GumScriptOutboxItem;
+
+struct _GumScriptOutbox
+{
+  GumScript * script;
+
+  GumScriptOutboxItem * volatile pending;
+
+  GumScriptMessageHandler message_handler;
+  gpointer message_handler_data;
+  GDestroyNotify message_handler_data_destroy;
+
+  GumScriptMessageBatchHandler batch_handler;
+  gpointer batch_handler_data;
+  GDestroyNotify batch_handler_data_destroy;
+};
+
+G_GNUC_INTERNAL void gum_script_outbox_init (GumScriptOutbox * self,
+    GumScript * script);
+G_GNUC_INTERNAL void gum_script_outbox_finalize (GumScriptOutbox * self);
+
+G_GNUC_INTERNAL void gum_script_outbox_set_message_handler (
+    GumScriptOutbox * self, GumScriptMessageHandler handler, gpointer data,
+    GDestroyNotify data_destroy);
+G_GNUC_INTERNAL void gum_script_outbox_set_batch_handler (
+    GumScriptOutbox * self, GumScriptMessageBatchHandler handler,
+    gpointer data, GDestroyNotify data_destroy);
+
+G_GNUC_INTERNAL void gum_script_outbox_push (GumScriptOutbox * self,
+    const gchar * message, GBytes * data, GMainContext * main_context);
+
+G_END_DECLS
+
+#endif
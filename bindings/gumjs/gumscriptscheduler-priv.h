@@ -13,6 +13,7 @@ G_BEGIN_DECLS
 
 G_GNUC_INTERNAL void _gum_script_scheduler_prepare_to_fork (void);
 G_GNUC_INTERNAL void _gum_script_scheduler_recover_from_fork (void);
+G_GNUC_INTERNAL void _gum_script_scheduler_recover_from_fork_in_child (void);
 
 G_END_DECLS
 
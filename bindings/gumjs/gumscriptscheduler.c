@@ -8,17 +8,35 @@
 
 #include "gumscriptscheduler-priv.h"
 
+#define GUM_SCRIPT_SCHEDULER_MIN_POOL_THREADS 4
+
+/*
+ * A scheduler runs one JS loop of its own, and may be asked to spread
+ * scripts across more of them. Each extra loop is a lane: a scheduler with
+ * its own thread and context that hands blocking work to the root's thread
+ * pool. Scripts acquire a lane by affinity and then use it exactly like they
+ * would use the root, so nothing else needs to know how many loops exist.
+ */
 struct _GumScriptScheduler
 {
   GObject parent;
 
   gboolean disposed;
 
+  GumScriptScheduler * root;
+  guint js_thread_count;
+  GPtrArray * lanes;
+  GMutex lanes_mutex;
+
   gboolean enable_background_thread;
   GThread * js_thread;
   GMainLoop * js_loop;
   GMainContext * js_context;
 
+  GMutex busy_mutex;
+  guint64 busy_time;
+  gint64 busy_since;
+
   GThreadPool * thread_pool;
 };
 
@@ -32,6 +50,7 @@ struct _GumScriptJob
 };
 
 static void gum_script_scheduler_dispose (GObject * obj);
+static void gum_script_scheduler_finalize (GObject * obj);
 
 static gboolean gum_script_scheduler_perform_js_job (
     GumScriptJob * job);
@@ -39,12 +58,18 @@ static void gum_script_scheduler_perform_pool_job (GumScriptJob * job,
     GumScriptScheduler * self);
 
 static gpointer gum_script_scheduler_run_js_loop (GumScriptScheduler * self);
+static gint gum_script_scheduler_poll (GPollFD * fds, guint nfds,
+    gint timeout);
+static void gum_script_scheduler_account_busy_time (GumScriptScheduler * self,
+    gint64 now);
 
 G_DEFINE_TYPE (GumScriptScheduler, gum_script_scheduler, G_TYPE_OBJECT)
 
 G_LOCK_DEFINE_STATIC (gum_script_schedulers);
 static GSList * gum_script_schedulers = NULL;
 
+static GPrivate gum_script_scheduler_current = G_PRIVATE_INIT (NULL);
+
 void
 _gum_script_scheduler_prepare_to_fork (void)
 {
@@ -75,25 +100,63 @@ _gum_script_scheduler_recover_from_fork (void)
   G_UNLOCK (gum_script_schedulers);
 }
 
+/*
+ * The pool's workers did not make it across the fork, and neither did any
+ * thread that might have held one of our locks, so we start over with fresh
+ * ones. The old pools are left behind, as tearing them down would wait on
+ * threads that no longer exist.
+ */
+void
+_gum_script_scheduler_recover_from_fork_in_child (void)
+{
+  GSList * cur;
+
+  for (cur = gum_script_schedulers; cur != NULL; cur = cur->next)
+  {
+    GumScriptScheduler * self = cur->data;
+
+    g_mutex_init (&self->lanes_mutex);
+    g_mutex_init (&self->busy_mutex);
+
+    self->thread_pool = g_thread_pool_new (
+        (GFunc) gum_script_scheduler_perform_pool_job,
+        self,
+        MAX (self->js_thread_count, GUM_SCRIPT_SCHEDULER_MIN_POOL_THREADS),
+        FALSE,
+        NULL);
+
+    gum_script_scheduler_start (self);
+  }
+}
+
 static void
 gum_script_scheduler_class_init (GumScriptSchedulerClass * klass)
 {
   GObjectClass * object_class = G_OBJECT_CLASS (klass);
 
   object_class->dispose = gum_script_scheduler_dispose;
+  object_class->finalize = gum_script_scheduler_finalize;
 }
 
 static void
 gum_script_scheduler_init (GumScriptScheduler * self)
 {
+  self->root = self;
+  self->js_thread_count = 1;
+  self->lanes = g_ptr_array_new_with_free_func (g_object_unref);
+  g_mutex_init (&self->lanes_mutex);
+
   self->enable_background_thread = TRUE;
 
   self->js_context = g_main_context_new ();
+  g_main_context_set_poll_func (self->js_context, gum_script_scheduler_poll);
+
+  g_mutex_init (&self->busy_mutex);
 
   self->thread_pool = g_thread_pool_new (
       (GFunc) gum_script_scheduler_perform_pool_job,
       self,
-      4,
+      GUM_SCRIPT_SCHEDULER_MIN_POOL_THREADS,
       FALSE,
       NULL);
 
@@ -115,6 +178,10 @@ gum_script_scheduler_dispose (GObject * obj)
     gum_script_schedulers = g_slist_remove (gum_script_schedulers, self);
     G_UNLOCK (gum_script_schedulers);
 
+    g_mutex_lock (&self->lanes_mutex);
+    g_ptr_array_set_size (self->lanes, 0);
+    g_mutex_unlock (&self->lanes_mutex);
+
     g_thread_pool_free (self->thread_pool, FALSE, TRUE);
     self->thread_pool = NULL;
 
@@ -127,6 +194,19 @@ gum_script_scheduler_dispose (GObject * obj)
   G_OBJECT_CLASS (gum_script_scheduler_parent_class)->dispose (obj);
 }
 
+static void
+gum_script_scheduler_finalize (GObject * obj)
+{
+  GumScriptScheduler * self = GUM_SCRIPT_SCHEDULER (obj);
+
+  g_mutex_clear (&self->busy_mutex);
+
+  g_ptr_array_unref (self->lanes);
+  g_mutex_clear (&self->lanes_mutex);
+
+  G_OBJECT_CLASS (gum_script_scheduler_parent_class)->finalize (obj);
+}
+
 GumScriptScheduler *
 gum_script_scheduler_new (void)
 {
@@ -179,6 +259,86 @@ gum_script_scheduler_stop (GumScriptScheduler * self)
   }
 }
 
+guint
+gum_script_scheduler_get_js_thread_count (GumScriptScheduler * self)
+{
+  return self->js_thread_count;
+}
+
+/*
+ * Only affects lanes acquired from now on; scripts keep the lane they were
+ * given for as long as they live.
+ */
+void
+gum_script_scheduler_set_js_thread_count (GumScriptScheduler * self,
+                                          guint count)
+{
+  g_return_if_fail (self->root == self);
+  g_return_if_fail (count >= 1);
+
+  self->js_thread_count = count;
+
+  g_thread_pool_set_max_threads (self->thread_pool,
+      MAX (count, GUM_SCRIPT_SCHEDULER_MIN_POOL_THREADS), NULL);
+}
+
+/*
+ * Returns a scheduler whose JS thread is picked by `affinity`, so that
+ * scripts given different affinities can run their loops side by side.
+ * With a single JS thread, or without a background thread to run lanes on,
+ * this is the scheduler itself.
+ */
+GumScriptScheduler *
+gum_script_scheduler_acquire_js_lane (GumScriptScheduler * self,
+                                      guint affinity)
+{
+  GumScriptScheduler * root = self->root;
+  guint index;
+  GumScriptScheduler * lane;
+
+  index = affinity % root->js_thread_count;
+  if (index == 0 || !root->enable_background_thread)
+    return g_object_ref (root);
+
+  g_mutex_lock (&root->lanes_mutex);
+
+  while (root->lanes->len < index)
+  {
+    lane = g_object_new (GUM_TYPE_SCRIPT_SCHEDULER, NULL);
+    lane->root = root;
+    g_ptr_array_add (root->lanes, lane);
+  }
+
+  lane = g_object_ref (g_ptr_array_index (root->lanes, index - 1));
+
+  g_mutex_unlock (&root->lanes_mutex);
+
+  gum_script_scheduler_start (lane);
+
+  return lane;
+}
+
+/*
+ * Microseconds that this scheduler's JS thread has spent doing work rather
+ * than waiting for it. A script that monopolizes its thread shows up here
+ * well before it shows up as latency in the scripts sharing it.
+ */
+guint64
+gum_script_scheduler_get_js_busy_time (GumScriptScheduler * self)
+{
+  guint64 busy_time;
+
+  g_mutex_lock (&self->busy_mutex);
+
+  busy_time = self->busy_time;
+  if (self->busy_since != 0)
+    busy_time += g_get_monotonic_time () - self->busy_since;
+
+  g_mutex_unlock (&self->busy_mutex);
+
+  return busy_time;
+}
+
 GMainContext *
 gum_script_scheduler_get_js_context (GumScriptScheduler * self)
 {
@@ -213,7 +373,7 @@ gum_script_scheduler_push_job_on_thread_pool (GumScriptScheduler * self,
                                               gpointer data,
                                               GDestroyNotify data_destroy)
 {
-  g_thread_pool_push (self->thread_pool,
+  g_thread_pool_push (self->root->thread_pool,
       gum_script_job_new (self, func, data, data_destroy),
       NULL);
 }
@@ -238,13 +398,65 @@ gum_script_scheduler_perform_pool_job (GumScriptJob * job,
 static gpointer
 gum_script_scheduler_run_js_loop (GumScriptScheduler * self)
 {
+  g_private_set (&gum_script_scheduler_current, self);
+
+  g_mutex_lock (&self->busy_mutex);
+  self->busy_since = g_get_monotonic_time ();
+  g_mutex_unlock (&self->busy_mutex);
+
   g_main_context_push_thread_default (self->js_context);
   g_main_loop_run (self->js_loop);
   g_main_context_pop_thread_default (self->js_context);
 
+  gum_script_scheduler_account_busy_time (self, g_get_monotonic_time ());
+
+  g_private_set (&gum_script_scheduler_current, NULL);
+
   return NULL;
 }
 
+/*
+ * Everything a JS thread does happens between polls, so timing the polls is
+ * enough to know how busy it is, whatever kind of source did the work.
+ */
+static gint
+gum_script_scheduler_poll (GPollFD * fds,
+                           guint nfds,
+                           gint timeout)
+{
+  GumScriptScheduler * self;
+  gint result;
+
+  self = g_private_get (&gum_script_scheduler_current);
+  if (self == NULL)
+    return g_poll (fds, nfds, timeout);
+
+  gum_script_scheduler_account_busy_time (self, g_get_monotonic_time ());
+
+  result = g_poll (fds, nfds, timeout);
+
+  g_mutex_lock (&self->busy_mutex);
+  self->busy_since = g_get_monotonic_time ();
+  g_mutex_unlock (&self->busy_mutex);
+
+  return result;
+}
+
+static void
+gum_script_scheduler_account_busy_time (GumScriptScheduler * self,
+                                        gint64 now)
+{
+  g_mutex_lock (&self->busy_mutex);
+
+  if (self->busy_since != 0)
+  {
+    self->busy_time += now - self->busy_since;
+    self->busy_since = 0;
+  }
+
+  g_mutex_unlock (&self->busy_mutex);
+}
+
 GumScriptJob *
 gum_script_job_new (GumScriptScheduler * scheduler,
                     GumScriptJobFunc func,
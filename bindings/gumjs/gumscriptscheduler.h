@@ -28,6 +28,15 @@ GUM_API void gum_script_scheduler_disable_background_thread (
 GUM_API void gum_script_scheduler_start (GumScriptScheduler * self);
 GUM_API void gum_script_scheduler_stop (GumScriptScheduler * self);
 
+GUM_API guint gum_script_scheduler_get_js_thread_count (
+    GumScriptScheduler * self);
+GUM_API void gum_script_scheduler_set_js_thread_count (
+    GumScriptScheduler * self, guint count);
+GUM_API GumScriptScheduler * gum_script_scheduler_acquire_js_lane (
+    GumScriptScheduler * self, guint affinity);
+GUM_API guint64 gum_script_scheduler_get_js_busy_time (
+    GumScriptScheduler * self);
+
 GUM_API GMainContext * gum_script_scheduler_get_js_context (
     GumScriptScheduler * self);
 
@@ -0,0 +1,466 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumtimerwheel.h"
+
+/*
+ * A hierarchical timing wheel with millisecond ticks, driven by a single
+ * GSource so that a script with thousands of timers costs the main loop no
+ * more than a script with one. The near wheel has a slot for each of the
+ * next 256 ticks, and each far wheel has 64 slots that are each as wide as
+ * the whole wheel below. Adding and removing a timer is a list operation,
+ * and a far slot is only spread out into the wheel below when time reaches
+ * it. Timers further out than the last wheel covers wait in its last slot
+ * and are put back when that slot comes around.
+ */
+
+#define GUM_NEAR_BITS 8
+#define GUM_NEAR_SLOTS (1 << GUM_NEAR_BITS)
+#define GUM_NEAR_MASK (GUM_NEAR_SLOTS - 1)
+#define GUM_FAR_BITS 6
+#define GUM_FAR_SLOTS (1 << GUM_FAR_BITS)
+#define GUM_FAR_MASK (GUM_FAR_SLOTS - 1)
+#define GUM_N_FAR_WHEELS 3
+#define GUM_WHEEL_SPAN \
+    (G_GUINT64_CONSTANT (1) << (GUM_NEAR_BITS + \
+        (GUM_N_FAR_WHEELS * GUM_FAR_BITS)))
+
+#define GUM_LEVEL_DUE -1
+#define GUM_LEVEL_DETACHED -2
+
+#define GUM_FAR_SHIFT(level) (GUM_NEAR_BITS + (((level) - 1) * GUM_FAR_BITS))
+
+struct _GumTimerWheel
+{
+  GSource source;
+
+  GMutex mutex;
+  guint64 current_tick;
+  guint near_count;
+  guint far_count;
+  GumTimerLink near[GUM_NEAR_SLOTS];
+  GumTimerLink far[GUM_N_FAR_WHEELS][GUM_FAR_SLOTS];
+  GumTimerLink due;
+  GumTimerLink firing;
+};
+
+static gboolean gum_timer_wheel_prepare (GSource * source, gint * timeout);
+static gboolean gum_timer_wheel_check (GSource * source);
+static gboolean gum_timer_wheel_dispatch (GSource * source,
+    GSourceFunc callback, gpointer user_data);
+static void gum_timer_wheel_finalize (GSource * source);
+
+static void gum_timer_wheel_advance (GumTimerWheel * self, guint64 now);
+static void gum_timer_wheel_cascade (GumTimerWheel * self, gint level);
+static void gum_timer_wheel_insert (GumTimerWheel * self, GumTimer * timer);
+static void gum_timer_wheel_unlink (GumTimerWheel * self, GumTimer * timer);
+static guint64 gum_timer_wheel_now (GumTimerWheel * self);
+
+static void gum_timer_list_init (GumTimerLink * list);
+static gboolean gum_timer_list_is_empty (GumTimerLink * list);
+static void gum_timer_list_append (GumTimerLink * list, GumTimerLink * link);
+static void gum_timer_list_steal (GumTimerLink * list, GumTimerLink * into);
+
+static GSourceFuncs gum_timer_wheel_source_funcs = {
+  gum_timer_wheel_prepare,
+  gum_timer_wheel_check,
+  gum_timer_wheel_dispatch,
+  gum_timer_wheel_finalize
+};
+
+GumTimerWheel *
+gum_timer_wheel_new (GMainContext * context,
+                     GumTimerWheelDispatchFunc func,
+                     gpointer data)
+{
+  GumTimerWheel * wheel;
+  GSource * source;
+  guint level, i;
+
+  source = g_source_new (&gum_timer_wheel_source_funcs,
+      sizeof (GumTimerWheel));
+  wheel = (GumTimerWheel *) source;
+
+  g_mutex_init (&wheel->mutex);
+  wheel->current_tick = g_get_monotonic_time () / 1000;
+  wheel->near_count = 0;
+  wheel->far_count = 0;
+  for (i = 0; i != GUM_NEAR_SLOTS; i++)
+    gum_timer_list_init (&wheel->near[i]);
+  for (level = 0; level != GUM_N_FAR_WHEELS; level++)
+  {
+    for (i = 0; i != GUM_FAR_SLOTS; i++)
+      gum_timer_list_init (&wheel->far[level][i]);
+  }
+  gum_timer_list_init (&wheel->due);
+  gum_timer_list_init (&wheel->firing);
+
+  g_source_set_callback (source, (GSourceFunc) func, data, NULL);
+  g_source_attach (source, context);
+
+  return wheel;
+}
+
+/*
+ * Timers still in the wheel are freed along with it, but their data is left
+ * alone, as it belongs to whoever added them.
+ */
+void
+gum_timer_wheel_free (GumTimerWheel * self)
+{
+  GSource * source = &self->source;
+
+  g_source_destroy (source);
+  g_source_unref (source);
+}
+
+GumTimer *
+gum_timer_wheel_add (GumTimerWheel * self,
+                     guint delay,
+                     guint interval,
+                     gpointer data)
+{
+  GumTimer * timer;
+  GMainContext * context;
+
+  timer = g_slice_new (GumTimer);
+  timer->interval = interval;
+  timer->data = data;
+
+  g_mutex_lock (&self->mutex);
+
+  timer->expires = MAX (gum_timer_wheel_now (self), self->current_tick) +
+      delay;
+  gum_timer_wheel_insert (self, timer);
+
+  g_mutex_unlock (&self->mutex);
+
+  context = g_source_get_context (&self->source);
+  if (context != NULL && !g_main_context_is_owner (context))
+    g_main_context_wakeup (context);
+
+  return timer;
+}
+
+void
+gum_timer_wheel_remove (GumTimerWheel * self,
+                        GumTimer * timer)
+{
+  g_mutex_lock (&self->mutex);
+  gum_timer_wheel_unlink (self, timer);
+  g_mutex_unlock (&self->mutex);
+
+  g_slice_free (GumTimer, timer);
+}
+
+/*
+ * Called from the dispatch function until it returns NULL. Only timers that
+ * were due when the batch started are returned, so a callback that keeps
+ * adding zero-delay timers cannot starve the rest of the main loop. Repeating
+ * timers are put back into the wheel before being returned, and one-shot
+ * timers stay valid until they are removed.
+ */
+GumTimer *
+gum_timer_wheel_pop_due (GumTimerWheel * self)
+{
+  GumTimer * timer = NULL;
+
+  g_mutex_lock (&self->mutex);
+
+  if (!gum_timer_list_is_empty (&self->firing))
+  {
+    timer = (GumTimer *) self->firing.next;
+    gum_timer_wheel_unlink (self, timer);
+
+    if (timer->interval != 0)
+    {
+      timer->expires = self->current_tick + timer->interval;
+      gum_timer_wheel_insert (self, timer);
+    }
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return timer;
+}
+
+static gboolean
+gum_timer_wheel_prepare (GSource * source,
+                         gint * timeout)
+{
+  GumTimerWheel * self = (GumTimerWheel *) source;
+  guint64 now, target;
+  guint index, i;
+
+  g_mutex_lock (&self->mutex);
+
+  now = gum_timer_wheel_now (self);
+  gum_timer_wheel_advance (self, now);
+
+  if (!gum_timer_list_is_empty (&self->due))
+  {
+    g_mutex_unlock (&self->mutex);
+
+    *timeout = 0;
+    return TRUE;
+  }
+
+  /*
+   * Wake up for the next occupied near slot, or otherwise when the near wheel
+   * wraps around, as that is when far slots come within reach.
+   */
+  if (self->near_count == 0 && self->far_count == 0)
+  {
+    *timeout = -1;
+  }
+  else
+  {
+    index = self->current_tick & GUM_NEAR_MASK;
+    target = self->current_tick + (GUM_NEAR_SLOTS - index);
+    for (i = index + 1; i != GUM_NEAR_SLOTS; i++)
+    {
+      if (!gum_timer_list_is_empty (&self->near[i]))
+      {
+        target = self->current_tick + (i - index);
+        break;
+      }
+    }
+
+    *timeout = (gint) MIN (target - now, G_MAXINT);
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return FALSE;
+}
+
+static gboolean
+gum_timer_wheel_check (GSource * source)
+{
+  GumTimerWheel * self = (GumTimerWheel *) source;
+  gboolean ready;
+
+  g_mutex_lock (&self->mutex);
+
+  gum_timer_wheel_advance (self, gum_timer_wheel_now (self));
+  ready = !gum_timer_list_is_empty (&self->due);
+
+  g_mutex_unlock (&self->mutex);
+
+  return ready;
+}
+
+static gboolean
+gum_timer_wheel_dispatch (GSource * source,
+                          GSourceFunc callback,
+                          gpointer user_data)
+{
+  GumTimerWheel * self = (GumTimerWheel *) source;
+  GumTimerWheelDispatchFunc func = (GumTimerWheelDispatchFunc) callback;
+
+  g_mutex_lock (&self->mutex);
+  gum_timer_list_steal (&self->due, &self->firing);
+  g_mutex_unlock (&self->mutex);
+
+  if (func != NULL)
+    func (self, user_data);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+gum_timer_wheel_finalize (GSource * source)
+{
+  GumTimerWheel * self = (GumTimerWheel *) source;
+  GumTimerLink remaining, * cur, * next;
+  guint level, i;
+
+  gum_timer_list_init (&remaining);
+  for (i = 0; i != GUM_NEAR_SLOTS; i++)
+    gum_timer_list_steal (&self->near[i], &remaining);
+  for (level = 0; level != GUM_N_FAR_WHEELS; level++)
+  {
+    for (i = 0; i != GUM_FAR_SLOTS; i++)
+      gum_timer_list_steal (&self->far[level][i], &remaining);
+  }
+  gum_timer_list_steal (&self->due, &remaining);
+  gum_timer_list_steal (&self->firing, &remaining);
+
+  for (cur = remaining.next; cur != &remaining; cur = next)
+  {
+    next = cur->next;
+    g_slice_free (GumTimer, (GumTimer *) cur);
+  }
+
+  g_mutex_clear (&self->mutex);
+}
+
+static void
+gum_timer_wheel_advance (GumTimerWheel * self,
+                         guint64 now)
+{
+  while (self->current_tick < now)
+  {
+    guint index;
+
+    if (self->near_count == 0 && self->far_count == 0)
+    {
+      self->current_tick = now;
+      break;
+    }
+
+    /* Nothing to collect on the way to the next wrap-around. */
+    if (self->near_count == 0)
+    {
+      self->current_tick = MIN (self->current_tick | GUM_NEAR_MASK, now);
+      if (self->current_tick == now)
+        break;
+    }
+
+    self->current_tick++;
+
+    index = self->current_tick & GUM_NEAR_MASK;
+    if (index == 0)
+      gum_timer_wheel_cascade (self, 1);
+
+    if (!gum_timer_list_is_empty (&self->near[index]))
+    {
+      GumTimerLink * cur;
+
+      for (cur = self->near[index].next; cur != &self->near[index];
+          cur = cur->next)
+      {
+        ((GumTimer *) cur)->level = GUM_LEVEL_DUE;
+        self->near_count--;
+      }
+
+      gum_timer_list_steal (&self->near[index], &self->due);
+    }
+  }
+}
+
+static void
+gum_timer_wheel_cascade (GumTimerWheel * self,
+                         gint level)
+{
+  guint index;
+  GumTimerLink pending, * cur, * next;
+
+  index = (self->current_tick >> GUM_FAR_SHIFT (level)) & GUM_FAR_MASK;
+
+  gum_timer_list_init (&pending);
+  gum_timer_list_steal (&self->far[level - 1][index], &pending);
+
+  for (cur = pending.next; cur != &pending; cur = next)
+  {
+    next = cur->next;
+    self->far_count--;
+    gum_timer_wheel_insert (self, (GumTimer *) cur);
+  }
+
+  if (index == 0 && level != GUM_N_FAR_WHEELS)
+    gum_timer_wheel_cascade (self, level + 1);
+}
+
+static void
+gum_timer_wheel_insert (GumTimerWheel * self,
+                        GumTimer * timer)
+{
+  guint64 delta;
+  gint level;
+
+  if (timer->expires <= self->current_tick)
+  {
+    timer->level = GUM_LEVEL_DUE;
+    gum_timer_list_append (&self->due, &timer->link);
+    return;
+  }
+
+  delta = timer->expires - self->current_tick;
+
+  if (delta < GUM_NEAR_SLOTS)
+  {
+    timer->level = 0;
+    gum_timer_list_append (&self->near[timer->expires & GUM_NEAR_MASK],
+        &timer->link);
+    self->near_count++;
+    return;
+  }
+
+  for (level = 1; level != GUM_N_FAR_WHEELS; level++)
+  {
+    if (delta < (G_GUINT64_CONSTANT (1) << GUM_FAR_SHIFT (level + 1)))
+      break;
+  }
+
+  timer->level = level;
+  self->far_count++;
+  gum_timer_list_append (&self->far[level - 1][
+      (MIN (timer->expires, self->current_tick + GUM_WHEEL_SPAN - 1) >>
+          GUM_FAR_SHIFT (level)) & GUM_FAR_MASK],
+      &timer->link);
+}
+
+static void
+gum_timer_wheel_unlink (GumTimerWheel * self,
+                        GumTimer * timer)
+{
+  if (timer->level == GUM_LEVEL_DETACHED)
+    return;
+
+  if (timer->level == 0)
+    self->near_count--;
+  else if (timer->level > 0)
+    self->far_count--;
+
+  timer->link.prev->next = timer->link.next;
+  timer->link.next->prev = timer->link.prev;
+  timer->level = GUM_LEVEL_DETACHED;
+}
+
+static guint64
+gum_timer_wheel_now (GumTimerWheel * self)
+{
+  return g_get_monotonic_time () / 1000;
+}
+
+static void
+gum_timer_list_init (GumTimerLink * list)
+{
+  list->prev = list;
+  list->next = list;
+}
+
+static gboolean
+gum_timer_list_is_empty (GumTimerLink * list)
+{
+  return list->next == list;
+}
+
+static void
+gum_timer_list_append (GumTimerLink * list,
+                       GumTimerLink * link)
+{
+  link->prev = list->prev;
+  link->next = list;
+  list->prev->next = link;
+  list->prev = link;
+}
+
+static void
+gum_timer_list_steal (GumTimerLink * list,
+                      GumTimerLink * into)
+{
+  if (gum_timer_list_is_empty (list))
+    return;
+
+  list->next->prev = into->prev;
+  list->prev->next = into;
+  into->prev->next = list->next;
+  into->prev = list->prev;
+
+  gum_timer_list_init (list);
+}
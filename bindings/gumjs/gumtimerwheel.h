@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_TIMER_WHEEL_H__
+#define __GUM_TIMER_WHEEL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GumTimerWheel GumTimerWheel;
+typedef struct _GumTimerLink GumTimerLink;
+typedef struct _GumTimer GumTimer;
+
+typedef void (* GumTimerWheelDispatchFunc) (GumTimerWheel * wheel,
+    gpointer user_data);
+
+struct _GumTimerLink
+{
+  GumTimerLink * prev;
+  GumTimerLink * next;
+};
+
+struct _GumTimer
+{
+  GumTimerLink link;
+  gint level;
+  guint64 expires;
+  guint interval;
+
+  gpointer data;
+};
+
+G_GNUC_INTERNAL GumTimerWheel * gum_timer_wheel_new (GMainContext * context,
+    GumTimerWheelDispatchFunc func, gpointer data);
+G_GNUC_INTERNAL void gum_timer_wheel_free (GumTimerWheel * self);
+
+G_GNUC_INTERNAL GumTimer * gum_timer_wheel_add (GumTimerWheel * self,
+    guint delay, guint interval, gpointer data);
+G_GNUC_INTERNAL void gum_timer_wheel_remove (GumTimerWheel * self,
+    GumTimer * timer);
+G_GNUC_INTERNAL GumTimer * gum_timer_wheel_pop_due (GumTimerWheel * self);
+
+G_END_DECLS
+
+#endif
@@ -8,6 +8,7 @@
 
 #include "gumv8core.h"
 
+#include "gumhexdump.h"
 #include "gumsourcemap.h"
 #include "gumv8macros.h"
 #include "gumv8scope.h"
@@ -19,6 +20,8 @@
 
 #define GUMJS_MODULE_NAME Core
 
+#define GUM_V8_PROFILE_TITLE "gum-script"
+
 using namespace v8;
 
 typedef guint8 GumV8SchedulingBehavior;
@@ -45,7 +48,8 @@ struct GumV8ScheduledCallback
   gint id;
   gboolean repeat;
   GumPersistent<Function>::type * func;
-  GSource * source;
+  GumTimer * timer;
+  GumV8CallbackStats stats;
 
   GumV8Core * core;
 };
@@ -102,6 +106,7 @@ struct GumV8NativeFunction
   ffi_cif cif;
   ffi_type ** atypes;
   gsize arglist_size;
+  GumFFIStubFunc stub;
   GSList * data;
 
   GumV8Core * core;
@@ -113,9 +118,11 @@ struct GumV8NativeCallback
 
   GumPersistent<Function>::type * func;
   ffi_closure * closure;
+  gpointer code;
   ffi_cif cif;
   ffi_type ** atypes;
   GSList * data;
+  GumV8CallbackStats stats;
 
   GumV8Core * core;
 };
@@ -173,14 +180,16 @@ static GumV8ScheduledCallback * gum_v8_core_try_steal_scheduled_callback (
     GumV8Core * self, gint id);
 GUMJS_DECLARE_FUNCTION (gumjs_clear_timer)
 static GumV8ScheduledCallback * gum_v8_scheduled_callback_new (guint id,
-    gboolean repeat, GSource * source, GumV8Core * core);
+    gboolean repeat, GumV8Core * core);
 static void gum_v8_scheduled_callback_free (GumV8ScheduledCallback * callback);
-static gboolean gum_v8_scheduled_callback_invoke (
-    GumV8ScheduledCallback * self);
+static void gum_v8_core_on_timers_due (GumTimerWheel * timers,
+    GumV8Core * self);
 GUMJS_DECLARE_FUNCTION (gumjs_send)
+GUMJS_DECLARE_FUNCTION (gumjs_write_log)
 GUMJS_DECLARE_FUNCTION (gumjs_set_unhandled_exception_callback)
 GUMJS_DECLARE_FUNCTION (gumjs_set_incoming_message_callback)
 GUMJS_DECLARE_FUNCTION (gumjs_wait_for_event)
+GUMJS_DECLARE_FUNCTION (gumjs_hexdump)
 
 static void gumjs_global_get (Local<Name> property,
     const PropertyCallbackInfo<Value> & info);
@@ -201,6 +210,13 @@ GUMJS_DECLARE_FUNCTION (gumjs_script_next_tick)
 GUMJS_DECLARE_FUNCTION (gumjs_script_pin)
 GUMJS_DECLARE_FUNCTION (gumjs_script_unpin)
 GUMJS_DECLARE_FUNCTION (gumjs_script_set_global_access_handler)
+GUMJS_DECLARE_FUNCTION (gumjs_script_get_statistics)
+GUMJS_DECLARE_FUNCTION (gumjs_script_start_profiling)
+GUMJS_DECLARE_FUNCTION (gumjs_script_stop_profiling)
+static Local<Object> gum_v8_cpu_profile_to_object (const CpuProfile * profile,
+    GumV8Core * core);
+static void gum_v8_cpu_profile_node_collect (const CpuProfileNode * node,
+    Handle<Array> nodes, GumV8Core * core);
 
 GUMJS_DECLARE_FUNCTION (gumjs_weak_ref_bind)
 GUMJS_DECLARE_FUNCTION (gumjs_weak_ref_unbind)
@@ -336,9 +352,11 @@ static const GumV8Function gumjs_global_functions[] =
   { "clearTimeout", gumjs_clear_timer },
   { "clearInterval", gumjs_clear_timer },
   { "_send", gumjs_send },
+  { "_writeLog", gumjs_write_log },
   { "_setUnhandledExceptionCallback", gumjs_set_unhandled_exception_callback },
   { "_setIncomingMessageCallback", gumjs_set_incoming_message_callback },
   { "_waitForEvent", gumjs_wait_for_event },
+  { "_hexdump", gumjs_hexdump },
 
   { NULL, NULL }
 };
@@ -375,6 +393,9 @@ static const GumV8Function gumjs_script_functions[] =
   { "pin", gumjs_script_pin },
   { "unpin", gumjs_script_unpin },
   { "setGlobalAccessHandler", gumjs_script_set_global_access_handler },
+  { "getStatistics", gumjs_script_get_statistics },
+  { "startProfiling", gumjs_script_start_profiling },
+  { "stopProfiling", gumjs_script_stop_profiling },
 
   { NULL, NULL }
 };
@@ -493,8 +514,14 @@ _gum_v8_core_init (GumV8Core * self,
       (GDestroyNotify) gum_v8_weak_ref_free);
 
   self->scheduled_callbacks = g_hash_table_new (NULL, NULL);
+  self->timers = gum_timer_wheel_new (
+      gum_script_scheduler_get_js_context (scheduler),
+      (GumTimerWheelDispatchFunc) gum_v8_core_on_timers_due, self);
   self->next_callback_id = 1;
 
+  self->cpu_profiler = nullptr;
+  self->profiling = FALSE;
+
   auto module = External::New (isolate, self);
 
   _gum_v8_module_add (module, scope, gumjs_global_functions, isolate);
@@ -700,6 +727,7 @@ _gum_v8_core_realize (GumV8Core * self)
 
   self->native_functions = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_v8_native_function_free);
+  gum_ffi_stubs_init (&self->ffi_stubs);
 
   self->native_callbacks = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_v8_native_callback_free);
@@ -782,10 +810,7 @@ _gum_v8_core_flush (GumV8Core * self,
 
   g_hash_table_iter_init (&iter, self->scheduled_callbacks);
   while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &callback))
-  {
-    _gum_v8_core_pin (self);
-    g_source_destroy (callback->source);
-  }
+    gum_v8_scheduled_callback_free (callback);
   g_hash_table_remove_all (self->scheduled_callbacks);
 
   if (self->usage_count > 1)
@@ -852,6 +877,21 @@ gum_v8_flush_callback_notify (GumV8FlushCallback * self)
 void
 _gum_v8_core_dispose (GumV8Core * self)
 {
+  if (self->cpu_profiler != nullptr)
+  {
+    if (self->profiling)
+    {
+      auto profile = self->cpu_profiler->StopProfiling (
+          _gum_v8_string_new_ascii (self->isolate, GUM_V8_PROFILE_TITLE));
+      if (profile != nullptr)
+        profile->Delete ();
+      self->profiling = FALSE;
+    }
+
+    self->cpu_profiler->Dispose ();
+    self->cpu_profiler = nullptr;
+  }
+
   g_hash_table_unref (self->source_maps);
   self->source_maps = NULL;
 
@@ -863,6 +903,7 @@ _gum_v8_core_dispose (GumV8Core * self)
 
   g_hash_table_unref (self->native_functions);
   self->native_functions = NULL;
+  gum_ffi_stubs_finalize (&self->ffi_stubs);
 
   g_clear_pointer (&self->unhandled_exception_sink, gum_v8_exception_sink_free);
 
@@ -907,6 +948,9 @@ _gum_v8_core_dispose (GumV8Core * self)
 void
 _gum_v8_core_finalize (GumV8Core * self)
 {
+  gum_timer_wheel_free (self->timers);
+  self->timers = NULL;
+
   g_hash_table_unref (self->scheduled_callbacks);
   self->scheduled_callbacks = NULL;
 
@@ -1027,19 +1071,13 @@ gum_v8_core_schedule_callback (GumV8Core * self,
   }
 
   auto id = self->next_callback_id++;
-  GSource * source;
-  if (delay == 0)
-    source = g_idle_source_new ();
-  else
-    source = g_timeout_source_new ((guint) delay);
-  auto callback = gum_v8_scheduled_callback_new (id, repeat, source, self);
+  auto callback = gum_v8_scheduled_callback_new (id, repeat, self);
   callback->func = new GumPersistent<Function>::type (self->isolate, func);
-  g_source_set_callback (source, (GSourceFunc) gum_v8_scheduled_callback_invoke,
-      callback, (GDestroyNotify) gum_v8_scheduled_callback_free);
+  callback->timer = gum_timer_wheel_add (self->timers, (guint) delay,
+      repeat ? MAX ((guint) delay, 1) : 0, callback);
 
   g_hash_table_insert (self->scheduled_callbacks, GINT_TO_POINTER (id),
       callback);
-  self->current_scope->AddScheduledSource (source);
 
   args->info->GetReturnValue ().Set (id);
 }
@@ -1074,10 +1112,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_clear_timer)
 
   auto callback = gum_v8_core_try_steal_scheduled_callback (core, id);
   if (callback != NULL)
-  {
-    _gum_v8_core_pin (core);
-    g_source_destroy (callback->source);
-  }
+    gum_v8_scheduled_callback_free (callback);
 
   info.GetReturnValue ().Set (callback != NULL);
 }
@@ -1085,14 +1120,15 @@ GUMJS_DEFINE_FUNCTION (gumjs_clear_timer)
 static GumV8ScheduledCallback *
 gum_v8_scheduled_callback_new (guint id,
                                gboolean repeat,
-                               GSource * source,
                                GumV8Core * core)
 {
   auto callback = g_slice_new (GumV8ScheduledCallback);
 
   callback->id = id;
   callback->repeat = repeat;
-  callback->source = source;
+  callback->func = nullptr;
+  callback->timer = NULL;
+  callback->stats = { 0, 0, 0 };
 
   callback->core = core;
 
@@ -1104,42 +1140,77 @@ gum_v8_scheduled_callback_free (GumV8ScheduledCallback * callback)
 {
   auto core = callback->core;
 
+  gum_timer_wheel_remove (core->timers, callback->timer);
+
   {
     ScriptScope scope (core->script);
 
     delete callback->func;
-
-    _gum_v8_core_unpin (core);
   }
 
   g_slice_free (GumV8ScheduledCallback, callback);
 }
 
-static gboolean
-gum_v8_scheduled_callback_invoke (GumV8ScheduledCallback * self)
+static void
+gum_v8_core_on_timers_due (GumTimerWheel * timers,
+                           GumV8Core * self)
 {
-  auto core = self->core;
-
-  ScriptScope scope (core->script);
-  auto func = Local<Function>::New (core->isolate, *self->func);
-  func->Call (Undefined (core->isolate), 0, nullptr);
+  ScriptScope scope (self->script);
+  auto isolate = self->isolate;
+  auto receiver = Undefined (isolate);
 
-  if (!self->repeat)
+  GumTimer * timer;
+  while ((timer = gum_timer_wheel_pop_due (timers)) != NULL)
   {
-    if (gum_v8_core_try_steal_scheduled_callback (core, self->id) != NULL)
-      _gum_v8_core_pin (core);
-  }
+    auto callback = (GumV8ScheduledCallback *) timer->data;
+    auto id = callback->id;
+    auto repeat = callback->repeat;
 
-  return self->repeat;
+    /*
+     * The callback may clear its own timer, so don't touch it afterwards.
+     * All due timers share one scope, so each call is timed here instead.
+     */
+    auto func = Local<Function>::New (isolate, *callback->func);
+    auto start_time = g_get_monotonic_time ();
+    func->Call (receiver, 0, nullptr);
+    scope.ProcessAnyPendingException ();
+    auto elapsed = g_get_monotonic_time () - start_time;
+
+    callback = (GumV8ScheduledCallback *) g_hash_table_lookup (
+        self->scheduled_callbacks, GINT_TO_POINTER (id));
+    if (callback != NULL)
+      _gum_v8_callback_stats_add (&callback->stats, elapsed);
+
+    if (!repeat)
+    {
+      callback = gum_v8_core_try_steal_scheduled_callback (self, id);
+      if (callback != NULL)
+        gum_v8_scheduled_callback_free (callback);
+    }
+  }
 }
 
 GUMJS_DEFINE_FUNCTION (gumjs_send)
 {
   gchar * message;
-  GBytes * data;
-  if (!_gum_v8_args_parse (args, "sB?", &message, &data))
+  Local<Value> data_value;
+  gboolean transfer = FALSE;
+  if (!_gum_v8_args_parse (args, "sV|t", &message, &data_value, &transfer))
     return;
 
+  GBytes * data = NULL;
+  if (!data_value->IsNull ())
+  {
+    data = transfer
+        ? _gum_v8_bytes_take (data_value, core)
+        : _gum_v8_bytes_get (data_value, core);
+    if (data == NULL)
+    {
+      g_free (message);
+      return;
+    }
+  }
+
   /*
    * Synchronize Interceptor state before sending the message. The application
    * might be waiting for an acknowledgement that APIs have been instrumented.
@@ -1156,6 +1227,17 @@ GUMJS_DEFINE_FUNCTION (gumjs_send)
   g_free (message);
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_write_log)
+{
+  gchar * text;
+  if (!_gum_v8_args_parse (args, "s", &text))
+    return;
+
+  gum_log_write (text, strlen (text));
+
+  g_free (text);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_set_unhandled_exception_callback)
 {
   Local<Function> callback;
@@ -1228,6 +1310,66 @@ GUMJS_DEFINE_FUNCTION (gumjs_wait_for_event)
     _gum_v8_throw_ascii_literal (isolate, "script is unloading");
 }
 
+/*
+ * Formats straight from the target into a single buffer, instead of copying
+ * it out first and building the dump byte by byte in JavaScript.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_hexdump)
+{
+  Local<Value> target;
+  gsize offset, length;
+  gboolean header, ansi;
+  if (!_gum_v8_args_parse (args, "VZZtt", &target, &offset, &length, &header,
+      &ansi))
+    return;
+
+  const guint8 * data;
+  if (target->IsArrayBuffer ())
+  {
+    auto contents = target.As<ArrayBuffer> ()->GetContents ();
+    data = (const guint8 *) contents.Data ();
+    length = MIN (length, contents.ByteLength ());
+  }
+  else
+  {
+    gpointer address;
+    if (!_gum_v8_native_pointer_get (target, &address, core))
+      return;
+    data = (const guint8 *) address;
+  }
+
+  auto max_size = gum_hexdump_compute_max_size (offset, length, header, ansi);
+  if (max_size > String::kMaxLength)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid length");
+    return;
+  }
+
+  auto output = (gchar *) g_malloc (max_size);
+  gsize size = 0;
+
+  auto exceptor = core->exceptor;
+  GumExceptorScope scope;
+
+  if (gum_exceptor_try (exceptor, &scope))
+  {
+    size = gum_hexdump_format (data, offset, length, header, ansi, output);
+  }
+
+  if (gum_exceptor_catch (exceptor, &scope))
+  {
+    _gum_v8_throw_native (&scope.exception, core);
+  }
+  else
+  {
+    info.GetReturnValue ().Set (String::NewFromOneByte (isolate,
+        (const uint8_t *) output, NewStringType::kNormal, size)
+        .ToLocalChecked ());
+  }
+
+  g_free (output);
+}
+
 static void
 gumjs_global_get (Local<Name> property,
                   const PropertyCallbackInfo<Value> & info)
@@ -1451,6 +1593,187 @@ GUMJS_DEFINE_FUNCTION (gumjs_script_set_global_access_handler)
   }
 }
 
+/*
+ * Only covers callbacks that are still around, so one-shot timers drop out
+ * once they have fired.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_script_get_statistics)
+{
+  auto result = Object::New (isolate);
+  GHashTableIter iter;
+  guint i;
+
+  _gum_v8_object_set (result, "listeners",
+      _gum_v8_interceptor_get_listener_statistics (&core->script->interceptor),
+      core);
+
+  auto native_callbacks =
+      Array::New (isolate, g_hash_table_size (core->native_callbacks));
+  GumV8NativeCallback * native_callback;
+  g_hash_table_iter_init (&iter, core->native_callbacks);
+  i = 0;
+  while (g_hash_table_iter_next (&iter, (gpointer *) &native_callback, NULL))
+  {
+    auto entry = Object::New (isolate);
+    _gum_v8_object_set_pointer (entry, "address", native_callback->code,
+        core);
+    _gum_v8_object_set_callback_stats (entry, &native_callback->stats, core);
+    native_callbacks->Set (i++, entry);
+  }
+  _gum_v8_object_set (result, "nativeCallbacks", native_callbacks, core);
+
+  auto timers =
+      Array::New (isolate, g_hash_table_size (core->scheduled_callbacks));
+  GumV8ScheduledCallback * scheduled_callback;
+  g_hash_table_iter_init (&iter, core->scheduled_callbacks);
+  i = 0;
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &scheduled_callback))
+  {
+    auto entry = Object::New (isolate);
+    _gum_v8_object_set_uint (entry, "id", scheduled_callback->id, core);
+    _gum_v8_object_set_callback_stats (entry, &scheduled_callback->stats,
+        core);
+    timers->Set (i++, entry);
+  }
+  _gum_v8_object_set (result, "timers", timers, core);
+
+  info.GetReturnValue ().Set (result);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_script_start_profiling)
+{
+  guint sampling_interval = 0;
+  if (!_gum_v8_args_parse (args, "|u", &sampling_interval))
+    return;
+
+  if (core->profiling)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "already profiling");
+    return;
+  }
+
+  if (core->cpu_profiler == nullptr)
+    core->cpu_profiler = CpuProfiler::New (isolate);
+
+  if (sampling_interval != 0)
+    core->cpu_profiler->SetSamplingInterval (sampling_interval);
+
+  core->cpu_profiler->StartProfiling (
+      _gum_v8_string_new_ascii (isolate, GUM_V8_PROFILE_TITLE), true);
+  core->profiling = TRUE;
+}
+
+/*
+ * Returns the profile as a string in the .cpuprofile format that DevTools
+ * and most other tools load.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_script_stop_profiling)
+{
+  if (!core->profiling)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "not profiling");
+    return;
+  }
+
+  auto profile = core->cpu_profiler->StopProfiling (
+      _gum_v8_string_new_ascii (isolate, GUM_V8_PROFILE_TITLE));
+  core->profiling = FALSE;
+  if (profile == nullptr)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "unable to collect profile");
+    return;
+  }
+
+  auto profile_object = gum_v8_cpu_profile_to_object (profile, core);
+  profile->Delete ();
+
+  Local<String> json;
+  if (JSON::Stringify (isolate->GetCurrentContext (), profile_object)
+      .ToLocal (&json))
+  {
+    info.GetReturnValue ().Set (json);
+  }
+}
+
+static Local<Object>
+gum_v8_cpu_profile_to_object (const CpuProfile * profile,
+                              GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  auto nodes = Array::New (isolate);
+  gum_v8_cpu_profile_node_collect (profile->GetTopDownRoot (), nodes, core);
+
+  auto start_time = profile->GetStartTime ();
+  auto num_samples = profile->GetSamplesCount ();
+  auto samples = Array::New (isolate, num_samples);
+  auto time_deltas = Array::New (isolate, num_samples);
+  auto previous_timestamp = start_time;
+  for (gint i = 0; i != num_samples; i++)
+  {
+    auto timestamp = profile->GetSampleTimestamp (i);
+
+    samples->Set (i, Integer::NewFromUnsigned (isolate,
+        profile->GetSample (i)->GetNodeId ()));
+    time_deltas->Set (i,
+        Number::New (isolate, (double) (timestamp - previous_timestamp)));
+
+    previous_timestamp = timestamp;
+  }
+
+  auto result = Object::New (isolate);
+  _gum_v8_object_set (result, "nodes", nodes, core);
+  _gum_v8_object_set (result, "startTime",
+      Number::New (isolate, (double) start_time), core);
+  _gum_v8_object_set (result, "endTime",
+      Number::New (isolate, (double) profile->GetEndTime ()), core);
+  _gum_v8_object_set (result, "samples", samples, core);
+  _gum_v8_object_set (result, "timeDeltas", time_deltas, core);
+
+  return result;
+}
+
+static void
+gum_v8_cpu_profile_node_collect (const CpuProfileNode * node,
+                                 Handle<Array> nodes,
+                                 GumV8Core * core)
+{
+  auto isolate = core->isolate;
+  gchar script_id[16];
+
+  g_snprintf (script_id, sizeof (script_id), "%d", node->GetScriptId ());
+
+  /* V8 numbers lines and columns from 1, the format from 0 */
+  auto call_frame = Object::New (isolate);
+  _gum_v8_object_set (call_frame, "functionName", node->GetFunctionName (),
+      core);
+  _gum_v8_object_set_ascii (call_frame, "scriptId", script_id, core);
+  _gum_v8_object_set (call_frame, "url", node->GetScriptResourceName (),
+      core);
+  _gum_v8_object_set_int (call_frame, "lineNumber",
+      node->GetLineNumber () - 1, core);
+  _gum_v8_object_set_int (call_frame, "columnNumber",
+      node->GetColumnNumber () - 1, core);
+
+  auto num_children = node->GetChildrenCount ();
+  auto children = Array::New (isolate, num_children);
+  for (gint i = 0; i != num_children; i++)
+  {
+    children->Set (i, Integer::NewFromUnsigned (isolate,
+        node->GetChild (i)->GetNodeId ()));
+  }
+
+  auto entry = Object::New (isolate);
+  _gum_v8_object_set_uint (entry, "id", node->GetNodeId (), core);
+  _gum_v8_object_set (entry, "callFrame", call_frame, core);
+  _gum_v8_object_set_uint (entry, "hitCount", node->GetHitCount (), core);
+  _gum_v8_object_set (entry, "children", children, core);
+  nodes->Set (nodes->Length (), entry);
+
+  for (gint i = 0; i != num_children; i++)
+    gum_v8_cpu_profile_node_collect (node->GetChild (i), nodes, core);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_weak_ref_bind)
 {
   Local<Value> target;
@@ -1586,6 +1909,26 @@ _gum_v8_core_push_job (GumV8Core * self,
       data, data_destroy);
 }
 
+void
+_gum_v8_callback_stats_add (GumV8CallbackStats * self,
+                            guint64 elapsed)
+{
+  self->calls++;
+  self->total_time += elapsed;
+  if (elapsed > self->max_time)
+    self->max_time = elapsed;
+}
+
+void
+_gum_v8_object_set_callback_stats (Handle<Object> object,
+                                   const GumV8CallbackStats * stats,
+                                   GumV8Core * core)
+{
+  _gum_v8_object_set_uint64 (object, "calls", stats->calls, core);
+  _gum_v8_object_set_uint64 (object, "totalTime", stats->total_time, core);
+  _gum_v8_object_set_uint64 (object, "maxTime", stats->max_time, core);
+}
+
 GUMJS_DEFINE_CONSTRUCTOR (gumjs_int64_construct)
 {
   if (!info.IsConstructCall ())
@@ -2217,6 +2560,8 @@ gumjs_native_function_init (Handle<Object> wrapper,
           "failed to compile function call interface");
       goto error;
     }
+
+    func->stub = gum_ffi_stubs_lookup (&core->ffi_stubs, &func->cif);
   }
 
   for (i = 0; i != nargs_total; i++)
@@ -2293,8 +2638,24 @@ gum_v8_native_function_invoke (GumV8NativeFunction * self,
 
   void ** avalue;
   guint8 * avalues;
+  gsize stub_args[GUM_FFI_STUBS_MAX_ARGS];
 
-  if (num_args_required > 0)
+  if (self->stub != NULL)
+  {
+    for (gsize i = 0; i != num_args_required; i++)
+    {
+      auto t = self->cif.arg_types[i];
+      GumFFIValue v;
+
+      if (!gum_v8_value_to_ffi_type (core,
+          (argv != nullptr) ? argv[i] : info[i], &v, t))
+        return;
+      stub_args[i] = gum_ffi_arg_widen (&v, t);
+    }
+
+    avalue = NULL;
+  }
+  else if (num_args_required > 0)
   {
     avalue = (void **) g_alloca (num_args_required * sizeof (void *));
 
@@ -2327,6 +2688,7 @@ gum_v8_native_function_invoke (GumV8NativeFunction * self,
     avalue = NULL;
   }
 
+  auto stub = self->stub;
   auto scheduling = self->scheduling;
   auto exceptions = self->exceptions;
   auto return_shape = self->return_shape;
@@ -2347,7 +2709,10 @@ gum_v8_native_function_invoke (GumV8NativeFunction * self,
         gum_interceptor_unignore_current_thread (interceptor);
       }
 
-      ffi_call (&self->cif, FFI_FN (implementation), rvalue, avalue);
+      if (stub != NULL)
+        rvalue->v_pointer = GSIZE_TO_POINTER (stub (implementation, stub_args));
+      else
+        ffi_call (&self->cif, FFI_FN (implementation), rvalue, avalue);
 
       if (return_shape == GUM_V8_RETURN_DETAILED)
         system_error = gum_thread_get_system_error ();
@@ -2609,6 +2974,7 @@ GUMJS_DEFINE_CONSTRUCTOR (gumjs_native_callback_construct)
 
   wrapper->SetInternalField (0, External::New (isolate, func));
 
+  callback->code = func;
   callback->wrapper = new GumPersistent<Object>::type (isolate, wrapper);
   callback->wrapper->SetWeak (callback,
       gum_v8_native_callback_on_weak_notify, WeakCallbackType::kParameter);
@@ -2657,7 +3023,7 @@ gum_v8_native_callback_invoke (ffi_cif * cif,
                                void * user_data)
 {
   auto self = (GumV8NativeCallback *) user_data;
-  ScriptScope scope (self->core->script);
+  ScriptScope scope (self->core->script, &self->stats);
   auto isolate = self->core->isolate;
 
   auto rtype = cif->rtype;
@@ -7,7 +7,9 @@
 #ifndef __GUM_V8_CORE_H__
 #define __GUM_V8_CORE_H__
 
+#include "gumffistubs.h"
 #include "gumscriptscheduler.h"
+#include "gumtimerwheel.h"
 #include "gumv8scope.h"
 #include "gumv8script.h"
 #include "gumv8scriptbackend.h"
@@ -15,6 +17,7 @@
 #include <gum/gumexceptor.h>
 #include <gum/gumprocess.h>
 #include <v8/v8.h>
+#include <v8/v8-profiler.h>
 
 #define GUMJS_NATIVE_POINTER_VALUE(o) \
     (o)->GetInternalField (0).As<External> ()->Value ()
@@ -74,9 +77,11 @@ struct GumV8Core
   GSource * pending_weak_source;
 
   GHashTable * scheduled_callbacks;
+  GumTimerWheel * timers;
   guint next_callback_id;
 
   GHashTable * native_functions;
+  GumFFIStubs ffi_stubs;
 
   GHashTable * native_callbacks;
 
@@ -84,6 +89,9 @@ struct GumV8Core
 
   GHashTable * source_maps;
 
+  v8::CpuProfiler * cpu_profiler;
+  gboolean profiling;
+
   GumPersistent<v8::FunctionTemplate>::type * int64;
   GumPersistent<v8::Object>::type * int64_value;
 
@@ -125,6 +133,17 @@ struct GumV8ByteArray
   GumV8Core * core;
 };
 
+/*
+ * Accounting for one JS callback, updated while holding the isolate lock.
+ * Times are in microseconds and include any ticks queued by the callback.
+ */
+struct GumV8CallbackStats
+{
+  guint64 calls;
+  guint64 total_time;
+  guint64 max_time;
+};
+
 G_GNUC_INTERNAL void _gum_v8_core_init (GumV8Core * self,
     GumV8Script * script, const gchar * runtime_source_map,
     GumV8MessageEmitter message_emitter, GumScriptScheduler * scheduler,
@@ -149,4 +168,10 @@ G_GNUC_INTERNAL void _gum_v8_core_post (GumV8Core * self, const gchar * message,
 G_GNUC_INTERNAL void _gum_v8_core_push_job (GumV8Core * self,
     GumScriptJobFunc job_func, gpointer data, GDestroyNotify data_destroy);
 
+G_GNUC_INTERNAL void _gum_v8_callback_stats_add (GumV8CallbackStats * self,
+    guint64 elapsed);
+G_GNUC_INTERNAL void _gum_v8_object_set_callback_stats (
+    v8::Handle<v8::Object> object, const GumV8CallbackStats * stats,
+    GumV8Core * core);
+
 #endif
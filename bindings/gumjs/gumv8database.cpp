@@ -8,6 +8,8 @@
 
 #include "gumv8macros.h"
 
+#include <string.h>
+
 #define GUMJS_MODULE_NAME Database
 
 using namespace v8;
@@ -51,6 +53,8 @@ GUMJS_DECLARE_FUNCTION (gumjs_statement_bind_blob)
 GUMJS_DECLARE_FUNCTION (gumjs_statement_bind_null)
 GUMJS_DECLARE_FUNCTION (gumjs_statement_step)
 GUMJS_DECLARE_FUNCTION (gumjs_statement_reset)
+GUMJS_DECLARE_FUNCTION (gumjs_statement_run_many)
+GUMJS_DECLARE_FUNCTION (gumjs_statement_step_many)
 
 static Local<Object> gum_statement_new (sqlite3_stmt * handle,
     GumV8Database * module);
@@ -58,6 +62,9 @@ static void gum_statement_free (GumStatement * self);
 static void gum_statement_on_weak_notify (
     const WeakCallbackInfo<GumStatement> & info);
 
+static gboolean gum_statement_bind_value (sqlite3_stmt * statement, gint index,
+    Local<Value> value, Isolate * isolate);
+
 static Local<Array> gum_parse_row (Isolate * isolate, sqlite3_stmt * statement);
 static Local<Value> gum_parse_column (Isolate * isolate,
     sqlite3_stmt * statement, guint index);
@@ -65,7 +72,7 @@ static Local<Value> gum_parse_column (Isolate * isolate,
 static const GumV8Function gumjs_database_module_functions[] =
 {
   { "_open", gumjs_database_open },
-  { "openInline", gumjs_database_open_inline },
+  { "_openInline", gumjs_database_open_inline },
 
   { NULL, NULL }
 };
@@ -89,6 +96,8 @@ static const GumV8Function gumjs_statement_functions[] =
   { "bindNull", gumjs_statement_bind_null },
   { "step", gumjs_statement_step },
   { "reset", gumjs_statement_reset },
+  { "runMany", gumjs_statement_run_many },
+  { "stepMany", gumjs_statement_step_many },
 
   { NULL, NULL }
 };
@@ -189,25 +198,42 @@ invalid_database:
 
 GUMJS_DEFINE_FUNCTION (gumjs_database_open_inline)
 {
-  gchar * encoded_contents;
+  Local<Value> contents_value;
+  gsize memory_limit;
   gpointer contents;
   gsize size;
-  gboolean valid;
   const gchar * path;
   sqlite3 * handle;
   gint status;
   Local<Object> object;
 
-  if (!_gum_v8_args_parse (args, "s", &encoded_contents))
+  if (!_gum_v8_args_parse (args, "VZ", &contents_value, &memory_limit))
     return;
 
-  valid =
-      gum_memory_vfs_contents_from_string (encoded_contents, &contents, &size);
-  g_free (encoded_contents);
-  if (!valid)
+  if (contents_value->IsArrayBuffer ())
+  {
+    auto buffer_contents = contents_value.As<ArrayBuffer> ()->GetContents ();
+
+    size = buffer_contents.ByteLength ();
+    contents = g_memdup (buffer_contents.Data (), size);
+  }
+  else if (contents_value->IsString ())
+  {
+    String::Utf8Value encoded_contents (isolate, contents_value);
+
+    if (!gum_memory_vfs_contents_from_string (*encoded_contents, &contents,
+        &size))
+      goto invalid_data;
+  }
+  else
+  {
     goto invalid_data;
+  }
 
-  path = gum_memory_vfs_add_file (module->memory_vfs, contents, size);
+  path = gum_memory_vfs_add_file (module->memory_vfs, contents, size,
+      memory_limit);
+  if (path == NULL)
+    goto io_error;
 
   handle = NULL;
   status = sqlite3_open_v2 (path, &handle, SQLITE_OPEN_READWRITE,
@@ -226,6 +252,11 @@ invalid_data:
     _gum_v8_throw (isolate, "invalid data");
     return;
   }
+io_error:
+  {
+    _gum_v8_throw_ascii_literal (isolate, "unable to store database");
+    return;
+  }
 invalid_database:
   {
     sqlite3_close_v2 (handle);
@@ -303,7 +334,9 @@ invalid_sql:
 
 GUMJS_DEFINE_CLASS_METHOD (gumjs_database_dump, GumDatabase)
 {
-  gpointer data, malloc_data;
+  gchar * format = NULL;
+  gboolean binary;
+  gpointer data;
   gsize size;
   GError * error;
   gchar * data_str;
@@ -311,23 +344,44 @@ GUMJS_DEFINE_CLASS_METHOD (gumjs_database_dump, GumDatabase)
   if (!gum_database_check_open (self, isolate))
     return;
 
+  if (!_gum_v8_args_parse (args, "|s", &format))
+    return;
+
+  if (format == NULL || strcmp (format, "base64") == 0)
+    binary = FALSE;
+  else if (strcmp (format, "binary") == 0)
+    binary = TRUE;
+  else
+    goto invalid_format;
+
+  g_free (format);
+
   if (self->is_virtual)
   {
     gboolean found;
 
+    /* A WAL database only has every page in the main file once checkpointed. */
+    sqlite3_wal_checkpoint_v2 (self->handle, NULL, SQLITE_CHECKPOINT_FULL,
+        NULL, NULL);
+
     found = gum_memory_vfs_get_file_contents (module->memory_vfs, self->path,
         &data, &size);
-    g_assert (found);
-
-    malloc_data = NULL;
+    if (!found)
+      goto io_error_virtual;
   }
   else
   {
     error = NULL;
     if (!g_file_get_contents (self->path, (gchar **) &data, &size, &error))
       goto io_error;
+  }
+
+  if (binary)
+  {
+    info.GetReturnValue ().Set (ArrayBuffer::New (isolate, data, size,
+        ArrayBufferCreationMode::kInternalized));
 
-    malloc_data = data;
+    return;
   }
 
   data_str = gum_memory_vfs_contents_to_string (data, size);
@@ -335,16 +389,28 @@ GUMJS_DEFINE_CLASS_METHOD (gumjs_database_dump, GumDatabase)
   info.GetReturnValue ().Set (_gum_v8_string_new_ascii (isolate, data_str));
 
   g_free (data_str);
-  g_free (malloc_data);
+  g_free (data);
 
   return;
 
+invalid_format:
+  {
+    g_free (format);
+    _gum_v8_throw_ascii_literal (isolate,
+        "format must be either 'base64' or 'binary'");
+    return;
+  }
 io_error:
   {
     _gum_v8_throw (isolate, "%s", error->message);
     g_error_free (error);
     return;
   }
+io_error_virtual:
+  {
+    _gum_v8_throw_ascii_literal (isolate, "unable to read database");
+    return;
+  }
 }
 
 static Local<Object>
@@ -510,6 +576,156 @@ GUMJS_DEFINE_CLASS_METHOD (gumjs_statement_reset, GumStatement)
     _gum_v8_throw (isolate, "%s", sqlite3_errstr (status));
 }
 
+/*
+ * Binds each row of `rows` in turn and runs the statement to completion, so
+ * bulk inserts cost one crossing rather than one per value and step.
+ */
+GUMJS_DEFINE_CLASS_METHOD (gumjs_statement_run_many, GumStatement)
+{
+  Local<Value> rows_value;
+  if (!_gum_v8_args_parse (args, "V", &rows_value))
+    return;
+
+  if (!rows_value->IsArray ())
+  {
+    _gum_v8_throw_ascii_literal (isolate, "expected an array of rows");
+    return;
+  }
+
+  auto context = isolate->GetCurrentContext ();
+  auto rows = rows_value.As<Array> ();
+  auto num_rows = rows->Length ();
+  auto handle = self->handle;
+
+  for (uint32_t row_index = 0; row_index != num_rows; row_index++)
+  {
+    Local<Value> row_value;
+    if (!rows->Get (context, row_index).ToLocal (&row_value))
+      return;
+    if (!row_value->IsArray ())
+    {
+      _gum_v8_throw_ascii_literal (isolate, "expected an array of rows");
+      return;
+    }
+    auto row = row_value.As<Array> ();
+
+    sqlite3_reset (handle);
+    sqlite3_clear_bindings (handle);
+
+    auto num_values = row->Length ();
+    for (uint32_t i = 0; i != num_values; i++)
+    {
+      Local<Value> value;
+      if (!row->Get (context, i).ToLocal (&value))
+        return;
+      if (!gum_statement_bind_value (handle, i + 1, value, isolate))
+        return;
+    }
+
+    gint status;
+    while ((status = sqlite3_step (handle)) == SQLITE_ROW)
+      ;
+    if (status != SQLITE_DONE)
+    {
+      _gum_v8_throw (isolate, "%s",
+          sqlite3_errmsg (sqlite3_db_handle (handle)));
+      sqlite3_reset (handle);
+      return;
+    }
+  }
+
+  sqlite3_reset (handle);
+
+  info.GetReturnValue ().Set (num_rows);
+}
+
+/*
+ * Steps up to `n` times and returns the rows produced, which is fewer than
+ * `n` once the statement is done.
+ */
+GUMJS_DEFINE_CLASS_METHOD (gumjs_statement_step_many, GumStatement)
+{
+  guint n;
+  if (!_gum_v8_args_parse (args, "u", &n))
+    return;
+
+  auto rows = Array::New (isolate);
+
+  for (guint i = 0; i != n; i++)
+  {
+    auto status = sqlite3_step (self->handle);
+    if (status == SQLITE_DONE)
+      break;
+    if (status != SQLITE_ROW)
+    {
+      _gum_v8_throw (isolate, "%s", sqlite3_errstr (status));
+      return;
+    }
+
+    rows->Set (i, gum_parse_row (isolate, self->handle));
+  }
+
+  info.GetReturnValue ().Set (rows);
+}
+
+static gboolean
+gum_statement_bind_value (sqlite3_stmt * statement,
+                          gint index,
+                          Local<Value> value,
+                          Isolate * isolate)
+{
+  gint status;
+
+  if (value->IsInt32 ())
+  {
+    status = sqlite3_bind_int64 (statement, index,
+        value.As<Int32> ()->Value ());
+  }
+  else if (value->IsNumber ())
+  {
+    auto number = value.As<Number> ()->Value ();
+    if (number >= -9223372036854775808.0 && number < 9223372036854775808.0 &&
+        number == (gdouble) (gint64) number)
+      status = sqlite3_bind_int64 (statement, index, (gint64) number);
+    else
+      status = sqlite3_bind_double (statement, index, number);
+  }
+  else if (value->IsBoolean ())
+  {
+    status = sqlite3_bind_int (statement, index,
+        value.As<Boolean> ()->Value () ? 1 : 0);
+  }
+  else if (value->IsString ())
+  {
+    String::Utf8Value str (isolate, value);
+    status = sqlite3_bind_text (statement, index, *str, str.length (),
+        SQLITE_TRANSIENT);
+  }
+  else if (value->IsArrayBuffer ())
+  {
+    auto contents = value.As<ArrayBuffer> ()->GetContents ();
+    status = sqlite3_bind_blob64 (statement, index, contents.Data (),
+        contents.ByteLength (), SQLITE_TRANSIENT);
+  }
+  else if (value->IsNull () || value->IsUndefined ())
+  {
+    status = sqlite3_bind_null (statement, index);
+  }
+  else
+  {
+    _gum_v8_throw_ascii_literal (isolate, "unsupported value type");
+    return FALSE;
+  }
+
+  if (status != SQLITE_OK)
+  {
+    _gum_v8_throw (isolate, "%s", sqlite3_errstr (status));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
 static Local<Object>
 gum_statement_new (sqlite3_stmt * handle,
                    GumV8Database * module)
@@ -581,7 +797,7 @@ gum_parse_column (Isolate * isolate,
     case SQLITE_INTEGER:
       return Number::New (isolate, sqlite3_column_int64 (statement, index));
     case SQLITE_FLOAT:
-      return Number::New (isolate, sqlite3_column_int64 (statement, index));
+      return Number::New (isolate, sqlite3_column_double (statement, index));
     case SQLITE_TEXT:
       return String::NewFromUtf8 (isolate,
           (const char *) sqlite3_column_text (statement, index),
@@ -9,19 +9,48 @@
 #include "gumv8scope.h"
 #include "gumv8value.h"
 
+#include <gio/gio.h>
 #include <gum/gumspinlock.h>
 #include <string.h>
 
+/*
+ * Events are queued in a ring that has exactly one producer, the thread being
+ * followed, and one consumer, the JS thread, so queueing an event is a couple
+ * of loads and a store. Capacity is rounded up to a power of two so the
+ * free-running head and tail stay consistent across wrap-around.
+ *
+ * Call summaries are counted as the events are produced, into a table that
+ * the JS thread takes over wholesale on each drain. Its lock is only ever
+ * contended for the instant of that hand-over.
+ *
+ * When compression is requested, each drained batch is run through a single
+ * raw deflate stream and flushed, so the consumer only sees whole batches
+ * while keeping the history window of the earlier ones. The chunks must be
+ * inflated in order by one decompressor, e.g. zlib.decompressobj(-15).
+ */
+
 using namespace v8;
 
 struct _GumV8EventSink
 {
   GObject parent;
 
-  GumSpinlock lock;
-  GArray * queue;
+  GumEvent * queue;
   guint queue_capacity;
   guint queue_drain_interval;
+  volatile guint queue_head;
+  volatile guint queue_tail;
+  gboolean block_when_full;
+  volatile gint drain_requested;
+  volatile gint dropped_count;
+  guint dropped_reported;
+
+  gboolean queue_events;
+  gboolean summarize_calls;
+  gboolean pack_call_summary;
+  GumSpinlock call_summary_lock;
+  GHashTable * call_summary;
+  GConverter * compressor;
 
   GumV8Core * core;
   GMainContext * main_context;
@@ -43,6 +72,15 @@ static void gum_v8_event_sink_flush (GumEventSink * sink);
 static void gum_v8_event_sink_stop (GumEventSink * sink);
 static gboolean gum_v8_event_sink_stop_when_idle (GumV8EventSink * self);
 static gboolean gum_v8_event_sink_drain (GumV8EventSink * self);
+static gboolean gum_v8_event_sink_drain_now (GumV8EventSink * self);
+static guint8 * gum_v8_event_sink_compress (GumV8EventSink * self,
+    const guint8 * data, gsize size, gsize * compressed_size);
+static void gum_v8_event_sink_count_call (GumV8EventSink * self,
+    gpointer target);
+static Local<Value> gum_v8_event_sink_build_call_summary (
+    GHashTable * frequencies, GumV8Core * core);
+static Local<Value> gum_v8_event_sink_pack_call_summary (
+    GHashTable * frequencies, Isolate * isolate);
 
 G_DEFINE_TYPE_EXTENDED (GumV8EventSink,
                         gum_v8_event_sink,
@@ -76,7 +114,7 @@ gum_v8_event_sink_iface_init (gpointer g_iface,
 static void
 gum_v8_event_sink_init (GumV8EventSink * self)
 {
-  gum_spinlock_init (&self->lock);
+  gum_spinlock_init (&self->call_summary_lock);
 }
 
 static void
@@ -116,8 +154,13 @@ gum_v8_event_sink_finalize (GObject * obj)
 
   g_assert (self->source == NULL);
 
-  gum_spinlock_free (&self->lock);
-  g_array_free (self->queue, TRUE);
+  g_free (self->queue);
+
+  if (self->call_summary != NULL)
+    g_hash_table_unref (self->call_summary);
+  gum_spinlock_free (&self->call_summary_lock);
+
+  g_clear_object (&self->compressor);
 
   G_OBJECT_CLASS (gum_v8_event_sink_parent_class)->finalize (obj);
 }
@@ -129,10 +172,19 @@ gum_v8_event_sink_new (const GumV8EventSinkOptions * options)
 
   auto sink = GUM_V8_EVENT_SINK (
       g_object_new (GUM_V8_TYPE_EVENT_SINK, NULL));
-  sink->queue = g_array_sized_new (FALSE, FALSE, sizeof (GumEvent),
-      options->queue_capacity);
-  sink->queue_capacity = options->queue_capacity;
+  sink->queue_capacity =
+      1U << g_bit_storage (MAX (options->queue_capacity, 2) - 1);
+  sink->queue = g_new (GumEvent, sink->queue_capacity);
   sink->queue_drain_interval = options->queue_drain_interval;
+  sink->block_when_full = options->block_when_full;
+  sink->queue_events = !options->on_receive.IsEmpty ();
+  sink->summarize_calls = !options->on_call_summary.IsEmpty ();
+  sink->pack_call_summary = options->pack_call_summary;
+  if (options->compress_events)
+  {
+    sink->compressor = G_CONVERTER (
+        g_zlib_compressor_new (G_ZLIB_COMPRESSOR_FORMAT_RAW, 1));
+  }
 
   g_object_ref (options->core->script);
   sink->core = options->core;
@@ -175,10 +227,43 @@ gum_v8_event_sink_process (GumEventSink * sink,
 {
   auto self = GUM_V8_EVENT_SINK_CAST (sink);
 
-  gum_spinlock_acquire (&self->lock);
-  if (self->queue->len != self->queue_capacity)
-    g_array_append_val (self->queue, *ev);
-  gum_spinlock_release (&self->lock);
+  if (self->summarize_calls && ev->type == GUM_CALL)
+    gum_v8_event_sink_count_call (self, ev->call.target);
+
+  if (!self->queue_events)
+    return;
+
+  auto head = self->queue_head;
+
+  while (head - g_atomic_int_get (&self->queue_tail) == self->queue_capacity)
+  {
+    /*
+     * Blocking is only safe when the JS thread is free to drain the queue, so
+     * events produced on the JS thread itself are always dropped.
+     */
+    if (!self->block_when_full || self->core == NULL ||
+        g_main_context_is_owner (self->main_context))
+    {
+      g_atomic_int_inc (&self->dropped_count);
+      return;
+    }
+
+    if (g_atomic_int_compare_and_exchange (&self->drain_requested, FALSE, TRUE))
+    {
+      auto source = g_idle_source_new ();
+      g_source_set_callback (source,
+          (GSourceFunc) gum_v8_event_sink_drain_now, g_object_ref (self),
+          g_object_unref);
+      g_source_attach (source, self->main_context);
+      g_source_unref (source);
+    }
+
+    g_thread_yield ();
+  }
+
+  self->queue[head & (self->queue_capacity - 1)] = *ev;
+
+  g_atomic_int_set (&self->queue_head, head + 1);
 }
 
 static void
@@ -225,69 +310,52 @@ gum_v8_event_sink_stop_when_idle (GumV8EventSink * self)
 }
 
 static gboolean
-gum_v8_event_sink_drain (GumV8EventSink * self)
+gum_v8_event_sink_drain_now (GumV8EventSink * self)
 {
-  gpointer buffer = NULL;
-  guint len, size;
+  g_atomic_int_set (&self->drain_requested, FALSE);
 
+  gum_v8_event_sink_drain (self);
+
+  return FALSE;
+}
+
+static gboolean
+gum_v8_event_sink_drain (GumV8EventSink * self)
+{
   if (self->core == NULL)
     return FALSE;
 
-  len = self->queue->len;
-  size = len * sizeof (GumEvent);
-  if (len != 0)
+  GHashTable * frequencies = NULL;
+  if (self->summarize_calls)
   {
-    buffer = g_memdup (self->queue->data, size);
-
-    gum_spinlock_acquire (&self->lock);
-    g_array_remove_range (self->queue, 0, len);
-    gum_spinlock_release (&self->lock);
+    gum_spinlock_acquire (&self->call_summary_lock);
+    frequencies = (GHashTable *) g_steal_pointer (&self->call_summary);
+    gum_spinlock_release (&self->call_summary_lock);
   }
 
-  if (buffer != NULL)
+  if (frequencies == NULL &&
+      g_atomic_int_get (&self->queue_head) == self->queue_tail)
   {
-    GHashTable * frequencies = NULL;
-
-    if (self->on_call_summary != nullptr)
-    {
-      frequencies = g_hash_table_new (NULL, NULL);
-
-      auto ev = (GumCallEvent *) buffer;
-      for (guint i = 0; i != len; i++)
-      {
-        if (ev->type == GUM_CALL)
-        {
-          auto count = GPOINTER_TO_SIZE (
-              g_hash_table_lookup (frequencies, ev->target));
-          count++;
-          g_hash_table_insert (frequencies, ev->target,
-              GSIZE_TO_POINTER (count));
-        }
-
-        ev++;
-      }
-    }
+    return TRUE;
+  }
 
-    ScriptScope scope (self->core->script);
-    auto isolate = self->core->isolate;
+  /*
+   * The scope serializes us with flushes coming from the followed thread,
+   * which keeps this side of the queue single-consumer.
+   */
+  ScriptScope scope (self->core->script);
+  auto isolate = self->core->isolate;
 
-    if (frequencies != NULL)
+  if (frequencies != NULL)
+  {
+    if (self->on_call_summary != nullptr)
     {
-      auto summary = Object::New (isolate);
-
-      GHashTableIter iter;
-      g_hash_table_iter_init (&iter, frequencies);
-      gpointer target, count;
-      gchar target_str[32];
-      while (g_hash_table_iter_next (&iter, &target, &count))
-      {
-        sprintf (target_str, "0x%" G_GSIZE_MODIFIER "x",
-            GPOINTER_TO_SIZE (target));
-        _gum_v8_object_set (summary, target_str,
-            Number::New (isolate, GPOINTER_TO_SIZE (count)), self->core);
-      }
-
-      g_hash_table_unref (frequencies);
+      Local<Value> summary;
+      if (self->pack_call_summary)
+        summary = gum_v8_event_sink_pack_call_summary (frequencies, isolate);
+      else
+        summary = gum_v8_event_sink_build_call_summary (frequencies,
+            self->core);
 
       Local<Value> argv[] = { summary };
       auto on_call_summary =
@@ -296,12 +364,43 @@ gum_v8_event_sink_drain (GumV8EventSink * self)
       scope.ProcessAnyPendingException ();
     }
 
+    g_hash_table_unref (frequencies);
+  }
+
+  guint tail = self->queue_tail;
+  guint len = g_atomic_int_get (&self->queue_head) - tail;
+  gsize size = len * sizeof (GumEvent);
+
+  auto dropped_count = (guint) g_atomic_int_get (&self->dropped_count);
+  auto dropped = dropped_count - self->dropped_reported;
+  self->dropped_reported = dropped_count;
+
+  if (len != 0)
+  {
+    auto buffer = (GumEvent *) g_malloc (size);
+
+    auto offset = tail & (self->queue_capacity - 1);
+    auto n = MIN (len, self->queue_capacity - offset);
+    memcpy (buffer, self->queue + offset, n * sizeof (GumEvent));
+    memcpy (buffer + n, self->queue, (len - n) * sizeof (GumEvent));
+
+    g_atomic_int_set (&self->queue_tail, tail + len);
+
+    if (self->compressor != NULL)
+    {
+      auto compressed = gum_v8_event_sink_compress (self, (guint8 *) buffer,
+          size, &size);
+      g_free (buffer);
+      buffer = (GumEvent *) compressed;
+    }
+
     if (self->on_receive != nullptr)
     {
       auto on_receive = Local<Function>::New (isolate, *self->on_receive);
       Local<Value> argv[] = {
         ArrayBuffer::New (isolate, buffer, size,
-            ArrayBufferCreationMode::kInternalized)
+            ArrayBufferCreationMode::kInternalized),
+        Number::New (isolate, dropped)
       };
       on_receive->Call (Undefined (isolate), G_N_ELEMENTS (argv), argv);
       scope.ProcessAnyPendingException ();
@@ -314,3 +413,100 @@ gum_v8_event_sink_drain (GumV8EventSink * self)
 
   return TRUE;
 }
+
+static guint8 *
+gum_v8_event_sink_compress (GumV8EventSink * self,
+                            const guint8 * data,
+                            gsize size,
+                            gsize * compressed_size)
+{
+  auto output = g_byte_array_new ();
+  gsize offset = 0;
+
+  GConverterResult result;
+  do
+  {
+    g_byte_array_set_size (output, offset + MAX (size / 2, 4096));
+
+    gsize bytes_read, bytes_written;
+    GError * error = NULL;
+    result = g_converter_convert (self->compressor, data, size,
+        output->data + offset, output->len - offset, G_CONVERTER_FLUSH,
+        &bytes_read, &bytes_written, &error);
+    if (result == G_CONVERTER_ERROR)
+    {
+      /* The previous round filled the output exactly and flushed it all. */
+      g_assert (size == 0);
+      g_error_free (error);
+      break;
+    }
+
+    data += bytes_read;
+    size -= bytes_read;
+    offset += bytes_written;
+  }
+  while (result != G_CONVERTER_FLUSHED);
+
+  *compressed_size = offset;
+
+  return g_byte_array_free (output, FALSE);
+}
+
+static void
+gum_v8_event_sink_count_call (GumV8EventSink * self,
+                              gpointer target)
+{
+  gum_spinlock_acquire (&self->call_summary_lock);
+
+  if (self->call_summary == NULL)
+    self->call_summary = g_hash_table_new (NULL, NULL);
+
+  auto count = GPOINTER_TO_SIZE (
+      g_hash_table_lookup (self->call_summary, target));
+  g_hash_table_insert (self->call_summary, target,
+      GSIZE_TO_POINTER (count + 1));
+
+  gum_spinlock_release (&self->call_summary_lock);
+}
+
+static Local<Value>
+gum_v8_event_sink_build_call_summary (GHashTable * frequencies,
+                                      GumV8Core * core)
+{
+  auto isolate = core->isolate;
+  auto summary = Object::New (isolate);
+
+  GHashTableIter iter;
+  g_hash_table_iter_init (&iter, frequencies);
+  gpointer target, count;
+  gchar target_str[32];
+  while (g_hash_table_iter_next (&iter, &target, &count))
+  {
+    sprintf (target_str, "0x%" G_GSIZE_MODIFIER "x",
+        GPOINTER_TO_SIZE (target));
+    _gum_v8_object_set (summary, target_str,
+        Number::New (isolate, GPOINTER_TO_SIZE (count)), core);
+  }
+
+  return summary;
+}
+
+static Local<Value>
+gum_v8_event_sink_pack_call_summary (GHashTable * frequencies,
+                                     Isolate * isolate)
+{
+  auto n = g_hash_table_size (frequencies);
+  auto buffer = ArrayBuffer::New (isolate, n * 2 * sizeof (gdouble));
+  auto pairs = (gdouble *) buffer->GetContents ().Data ();
+
+  GHashTableIter iter;
+  g_hash_table_iter_init (&iter, frequencies);
+  gpointer target, count;
+  while (g_hash_table_iter_next (&iter, &target, &count))
+  {
+    *pairs++ = (gdouble) GPOINTER_TO_SIZE (target);
+    *pairs++ = (gdouble) GPOINTER_TO_SIZE (count);
+  }
+
+  return Float64Array::New (buffer, 0, n * 2);
+}
@@ -23,6 +23,9 @@ struct GumV8EventSinkOptions
   GumEventType event_mask;
   guint queue_capacity;
   guint queue_drain_interval;
+  gboolean block_when_full;
+  gboolean pack_call_summary;
+  gboolean compress_events;
   v8::Handle<v8::Function> on_receive;
   v8::Handle<v8::Function> on_call_summary;
 };
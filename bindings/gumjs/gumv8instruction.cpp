@@ -39,15 +39,39 @@
 #endif
 
 #define GUM_INSTRUCTION_FOOTPRINT_ESTIMATE 256
+#define GUM_MAX_DECODED_INSTRUCTIONS 256
+#define GUM_MAX_INSTRUCTION_SIZE 16
 
 using namespace v8;
 
+/*
+ * Recently parsed instructions are kept around by target, so that walking
+ * the same code again does not decode it again. An entry is only trusted if
+ * the bytes it was decoded from are still there, which keeps the cache
+ * honest about code that gets patched.
+ */
+struct GumV8DecodedInstruction
+{
+  gconstpointer target;
+  cs_insn * insn;
+  GList link;
+};
+
 GUMJS_DECLARE_FUNCTION (gumjs_instruction_parse)
+GUMJS_DECLARE_FUNCTION (gumjs_instruction_parse_range)
+static const cs_insn * gum_v8_instruction_decode (GumV8Instruction * self,
+    gconstpointer target);
+static void gum_v8_instruction_decode_range (GumV8Instruction * self,
+    gconstpointer target, guint count, GPtrArray * insns);
+static void gum_v8_decoded_instruction_free (
+    GumV8DecodedInstruction * decoded);
 
 static GumV8InstructionValue * gum_v8_instruction_alloc (
     GumV8Instruction * module);
 static void gum_v8_instruction_dispose (GumV8InstructionValue * self);
 static void gum_v8_instruction_free (GumV8InstructionValue * self);
+static Local<Array> gum_v8_instruction_memoize (GumV8InstructionValue * self,
+    GumPersistent<Array>::type ** memo, Local<Array> value);
 GUMJS_DECLARE_GETTER (gumjs_instruction_get_address)
 GUMJS_DECLARE_GETTER (gumjs_instruction_get_next)
 GUMJS_DECLARE_GETTER (gumjs_instruction_get_size)
@@ -96,6 +120,7 @@ static Local<Array> gum_parse_groups (const uint8_t * groups, uint8_t count,
 static const GumV8Function gumjs_instruction_module_functions[] =
 {
   { "_parse", gumjs_instruction_parse },
+  { "_parseRange", gumjs_instruction_parse_range },
 
   { NULL, NULL }
 };
@@ -159,6 +184,9 @@ _gum_v8_instruction_realize (GumV8Instruction * self)
 
   self->instructions = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_v8_instruction_free);
+  self->decoded = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_v8_decoded_instruction_free);
+  g_queue_init (&self->decoded_lru);
 
   auto constructor = Local<FunctionTemplate>::New (isolate, *self->constructor);
   auto object = constructor->GetFunction ()->NewInstance (context, 0, nullptr)
@@ -172,6 +200,10 @@ _gum_v8_instruction_dispose (GumV8Instruction * self)
   g_hash_table_unref (self->instructions);
   self->instructions = NULL;
 
+  g_hash_table_unref (self->decoded);
+  self->decoded = NULL;
+  g_queue_init (&self->decoded_lru);
+
   delete self->template_object;
   self->template_object = nullptr;
 
@@ -201,12 +233,16 @@ _gum_v8_instruction_new (csh capstone,
   else
   {
     g_assert (capstone != 0);
-    value->insn = cs_malloc (capstone);
-    memcpy ((void *) value->insn, insn, sizeof (cs_insn));
+    auto insn_copy = cs_malloc (capstone);
+    auto detail_copy = insn_copy->detail;
+    memcpy (insn_copy, insn, sizeof (cs_insn));
+    insn_copy->detail = detail_copy;
     if (insn->detail != NULL)
-      memcpy (value->insn->detail, insn->detail, sizeof (cs_detail));
+      memcpy (detail_copy, insn->detail, sizeof (cs_detail));
+    value->insn = insn_copy;
   }
   value->target = target;
+  value->is_immutable = TRUE;
 
   value->object->MarkIndependent ();
   value->object->SetWeak (value, gum_v8_instruction_on_weak_notify,
@@ -251,6 +287,11 @@ gum_v8_instruction_alloc (GumV8Instruction * module)
   value->object = nullptr;
   value->insn = NULL;
   value->target = NULL;
+  value->is_immutable = FALSE;
+  value->operands = nullptr;
+  value->regs_read = nullptr;
+  value->regs_written = nullptr;
+  value->groups = nullptr;
   value->module = module;
 
   module->core->isolate->AdjustAmountOfExternalAllocatedMemory (
@@ -267,6 +308,39 @@ gum_v8_instruction_dispose (GumV8InstructionValue * self)
     cs_free ((cs_insn *) self->insn, 1);
     self->insn = NULL;
   }
+
+  self->is_immutable = FALSE;
+
+  delete self->operands;
+  self->operands = nullptr;
+
+  delete self->regs_read;
+  self->regs_read = nullptr;
+
+  delete self->regs_written;
+  self->regs_written = nullptr;
+
+  delete self->groups;
+  self->groups = nullptr;
+}
+
+/*
+ * Parsed instructions never change, so the arrays describing them are built
+ * on first access and handed out from then on. Those of the Stalker's
+ * iterator are reused for each instruction, and are rebuilt every time.
+ */
+static Local<Array>
+gum_v8_instruction_memoize (GumV8InstructionValue * self,
+                            GumPersistent<Array>::type ** memo,
+                            Local<Array> value)
+{
+  if (self->is_immutable)
+  {
+    *memo = new GumPersistent<Array>::type (self->module->core->isolate,
+        value);
+  }
+
+  return value;
 }
 
 static void
@@ -301,25 +375,176 @@ GUMJS_DEFINE_FUNCTION (gumjs_instruction_parse)
   if (!_gum_v8_args_parse (args, "p", &target))
     return;
 
+  auto insn = gum_v8_instruction_decode (module, target);
+  if (insn == NULL)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid instruction");
+    return;
+  }
+
+  info.GetReturnValue ().Set (
+      _gum_v8_instruction_new (module->capstone, insn, FALSE, target, module));
+}
+
+/*
+ * Decodes up to `count` instructions back to back in one go, stopping early
+ * at the first one that is invalid or not readable.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_instruction_parse_range)
+{
+  gpointer target;
+  guint count;
+  if (!_gum_v8_args_parse (args, "pu", &target, &count))
+    return;
+
+  auto insns = g_ptr_array_new ();
+
+  auto exceptor = core->exceptor;
+  GumExceptorScope scope;
+
+  if (gum_exceptor_try (exceptor, &scope))
+  {
+    gum_v8_instruction_decode_range (module, target, count, insns);
+  }
+
+  if (gum_exceptor_catch (exceptor, &scope))
+  {
+    /* The one being decoded when we faulted is only partially there. */
+    cs_free ((cs_insn *) g_ptr_array_index (insns, insns->len - 1), 1);
+    g_ptr_array_set_size (insns, insns->len - 1);
+
+    if (insns->len == 0)
+    {
+      g_ptr_array_unref (insns);
+      _gum_v8_throw_native (&scope.exception, core);
+      return;
+    }
+  }
+
+  if (insns->len == 0)
+  {
+    g_ptr_array_unref (insns);
+    _gum_v8_throw_ascii_literal (isolate, "invalid instruction");
+    return;
+  }
+
+  auto first_address = ((cs_insn *) g_ptr_array_index (insns, 0))->address;
+
+  auto elements = Array::New (isolate, insns->len);
+
+  for (guint i = 0; i != insns->len; i++)
+  {
+    auto insn = (const cs_insn *) g_ptr_array_index (insns, i);
+    auto insn_target = GSIZE_TO_POINTER (GPOINTER_TO_SIZE (target) +
+        (insn->address - first_address));
+
+    elements->Set (i, _gum_v8_instruction_new (module->capstone, insn, TRUE,
+        insn_target, module));
+  }
+
+  g_ptr_array_unref (insns);
+
+  info.GetReturnValue ().Set (elements);
+}
+
+static const cs_insn *
+gum_v8_instruction_decode (GumV8Instruction * self,
+                           gconstpointer target)
+{
+  auto decoded = (GumV8DecodedInstruction *) g_hash_table_lookup (
+      self->decoded, target);
+  if (decoded != NULL)
+  {
+    auto insn = decoded->insn;
+
+    g_queue_unlink (&self->decoded_lru, &decoded->link);
+
+    if (memcmp (GSIZE_TO_POINTER (insn->address), insn->bytes,
+        insn->size) == 0)
+    {
+      g_queue_push_head_link (&self->decoded_lru, &decoded->link);
+      return insn;
+    }
+
+    g_hash_table_remove (self->decoded, target);
+  }
+
   uint64_t address;
 #ifdef HAVE_ARM
   address = GPOINTER_TO_SIZE (target) & ~1;
-  cs_option (module->capstone, CS_OPT_MODE,
+  cs_option (self->capstone, CS_OPT_MODE,
       (GPOINTER_TO_SIZE (target) & 1) == 1 ? CS_MODE_THUMB : CS_MODE_ARM);
 #else
   address = GPOINTER_TO_SIZE (target);
 #endif
 
   cs_insn * insn;
-  if (cs_disasm (module->capstone, (uint8_t *) GSIZE_TO_POINTER (address), 16,
-      address, 1, &insn) == 0)
+  if (cs_disasm (self->capstone, (uint8_t *) GSIZE_TO_POINTER (address),
+      GUM_MAX_INSTRUCTION_SIZE, address, 1, &insn) == 0)
+    return NULL;
+
+  if (self->decoded_lru.length == GUM_MAX_DECODED_INSTRUCTIONS)
   {
-    _gum_v8_throw_ascii_literal (isolate, "invalid instruction");
-    return;
+    auto oldest = (GumV8DecodedInstruction *)
+        g_queue_pop_tail_link (&self->decoded_lru)->data;
+    g_hash_table_remove (self->decoded, oldest->target);
   }
 
-  info.GetReturnValue ().Set (
-      _gum_v8_instruction_new (module->capstone, insn, TRUE, target, module));
+  decoded = g_slice_new (GumV8DecodedInstruction);
+  decoded->target = target;
+  decoded->insn = insn;
+  decoded->link.data = decoded;
+  decoded->link.prev = NULL;
+  decoded->link.next = NULL;
+
+  g_queue_push_head_link (&self->decoded_lru, &decoded->link);
+  g_hash_table_insert (self->decoded, (gpointer) target, decoded);
+
+  return insn;
+}
+
+/*
+ * Runs inside an exceptor scope. Each instruction is added to `insns` before
+ * it is decoded, so the caller can tell which one was cut short by a fault.
+ */
+static void
+gum_v8_instruction_decode_range (GumV8Instruction * self,
+                                 gconstpointer target,
+                                 guint count,
+                                 GPtrArray * insns)
+{
+  uint64_t address;
+#ifdef HAVE_ARM
+  address = GPOINTER_TO_SIZE (target) & ~1;
+  cs_option (self->capstone, CS_OPT_MODE,
+      (GPOINTER_TO_SIZE (target) & 1) == 1 ? CS_MODE_THUMB : CS_MODE_ARM);
+#else
+  address = GPOINTER_TO_SIZE (target);
+#endif
+
+  auto code = (const uint8_t *) GSIZE_TO_POINTER (address);
+
+  while (insns->len != count)
+  {
+    auto insn = cs_malloc (self->capstone);
+    g_ptr_array_add (insns, insn);
+
+    size_t size = GUM_MAX_INSTRUCTION_SIZE;
+    if (!cs_disasm_iter (self->capstone, &code, &size, &address, insn))
+    {
+      g_ptr_array_set_size (insns, insns->len - 1);
+      cs_free (insn, 1);
+      break;
+    }
+  }
+}
+
+static void
+gum_v8_decoded_instruction_free (GumV8DecodedInstruction * decoded)
+{
+  cs_free (decoded->insn, 1);
+
+  g_slice_free (GumV8DecodedInstruction, decoded);
 }
 
 GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_address, GumV8InstructionValue)
@@ -375,7 +600,14 @@ GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_operands,
   if (!gum_v8_instruction_check_valid (self, isolate))
     return;
 
-  info.GetReturnValue ().Set (gum_parse_operands (self->insn, module));
+  if (self->operands != nullptr)
+  {
+    info.GetReturnValue ().Set (Local<Array>::New (isolate, *self->operands));
+    return;
+  }
+
+  info.GetReturnValue ().Set (gum_v8_instruction_memoize (self,
+      &self->operands, gum_parse_operands (self->insn, module)));
 }
 
 GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_regs_read,
@@ -384,10 +616,17 @@ GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_regs_read,
   if (!gum_v8_instruction_check_valid (self, isolate))
     return;
 
+  if (self->regs_read != nullptr)
+  {
+    info.GetReturnValue ().Set (Local<Array>::New (isolate, *self->regs_read));
+    return;
+  }
+
   auto detail = self->insn->detail;
 
-  info.GetReturnValue ().Set (gum_parse_regs (detail->regs_read,
-      detail->regs_read_count, module));
+  info.GetReturnValue ().Set (gum_v8_instruction_memoize (self,
+      &self->regs_read, gum_parse_regs (detail->regs_read,
+      detail->regs_read_count, module)));
 }
 
 GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_regs_written,
@@ -396,10 +635,18 @@ GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_regs_written,
   if (!gum_v8_instruction_check_valid (self, isolate))
     return;
 
+  if (self->regs_written != nullptr)
+  {
+    info.GetReturnValue ().Set (
+        Local<Array>::New (isolate, *self->regs_written));
+    return;
+  }
+
   auto detail = self->insn->detail;
 
-  info.GetReturnValue ().Set (gum_parse_regs (detail->regs_write,
-      detail->regs_write_count, module));
+  info.GetReturnValue ().Set (gum_v8_instruction_memoize (self,
+      &self->regs_written, gum_parse_regs (detail->regs_write,
+      detail->regs_write_count, module)));
 }
 
 GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_groups,
@@ -408,10 +655,17 @@ GUMJS_DEFINE_CLASS_GETTER (gumjs_instruction_get_groups,
   if (!gum_v8_instruction_check_valid (self, isolate))
     return;
 
+  if (self->groups != nullptr)
+  {
+    info.GetReturnValue ().Set (Local<Array>::New (isolate, *self->groups));
+    return;
+  }
+
   auto detail = self->insn->detail;
 
-  info.GetReturnValue ().Set (gum_parse_groups (detail->groups,
-      detail->groups_count, module));
+  info.GetReturnValue ().Set (gum_v8_instruction_memoize (self,
+      &self->groups, gum_parse_groups (detail->groups,
+      detail->groups_count, module)));
 }
 
 GUMJS_DEFINE_CLASS_METHOD (gumjs_instruction_to_string, GumV8InstructionValue)
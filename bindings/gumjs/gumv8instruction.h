@@ -17,6 +17,8 @@ struct GumV8Instruction
 
   csh capstone;
   GHashTable * instructions;
+  GHashTable * decoded;
+  GQueue decoded_lru;
 
   GumPersistent<v8::FunctionTemplate>::type * constructor;
   GumPersistent<v8::Object>::type * template_object;
@@ -28,6 +30,12 @@ struct GumV8InstructionValue
   const cs_insn * insn;
   gconstpointer target;
 
+  gboolean is_immutable;
+  GumPersistent<v8::Array>::type * operands;
+  GumPersistent<v8::Array>::type * regs_read;
+  GumPersistent<v8::Array>::type * regs_written;
+  GumPersistent<v8::Array>::type * groups;
+
   GumV8Instruction * module;
 };
 
@@ -10,6 +10,7 @@
 #include "gumv8scope.h"
 
 #include <errno.h>
+#include <gum/gumdeferredlistener.h>
 
 #define GUMJS_MODULE_NAME Interceptor
 
@@ -18,8 +19,13 @@
 #define GUM_V8_TYPE_CALL_LISTENER (gum_v8_call_listener_get_type ())
 #define GUM_V8_TYPE_PROBE_LISTENER (gum_v8_probe_listener_get_type ())
 
+#define GUM_V8_MAX_CACHED_ARGS 8
+#define GUM_V8_CAPTURE_DRAIN_BATCH_SIZE 256
+
 using namespace v8;
 
+typedef void (* GumV8NativeInvocationCallback) (GumInvocationContext * ic);
+
 struct GumV8InvocationListener
 {
   GObject parent;
@@ -27,6 +33,16 @@ struct GumV8InvocationListener
   GumPersistent<Function>::type * on_enter;
   GumPersistent<Function>::type * on_leave;
 
+  gboolean is_native;
+  GumV8NativeInvocationCallback native_on_enter;
+  GumV8NativeInvocationCallback native_on_leave;
+  GumPersistent<Value>::type * native_resources;
+
+  GumDeferredListener * deferred;
+
+  gpointer target;
+  GumV8CallbackStats stats;
+
   GumV8Interceptor * module;
 };
 
@@ -60,6 +76,10 @@ struct GumV8InvocationArgs
   GumPersistent<Object>::type * object;
   GumInvocationContext * ic;
 
+  GumPersistent<Array>::type * arg_wrappers;
+  gpointer arg_values[GUM_V8_MAX_CACHED_ARGS];
+  guint arg_wrappers_mask;
+
   GumV8Interceptor * module;
 };
 
@@ -78,17 +98,58 @@ struct GumV8ReplaceEntry
   GumPersistent<Value>::type * replacement;
 };
 
+struct GumV8CaptureEntry
+{
+  GumInterceptor * interceptor;
+  gpointer target;
+};
+
+struct GumV8DeferredSink
+{
+  volatile gint ref_count;
+
+  GumPersistent<Function>::type * on_calls;
+  guint n_args;
+
+  GMutex mutex;
+  GArray * invocations;
+  gboolean drain_scheduled;
+
+  GumV8Core * core;
+};
+
 static gboolean gum_v8_interceptor_on_flush_timer_tick (
     GumV8Interceptor * self);
 
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_attach)
+static void gum_v8_interceptor_attach_listener (GumV8Interceptor * self,
+    gpointer target, GumV8InvocationListener * listener,
+    gpointer listener_function_data,
+    const FunctionCallbackInfo<Value> & info);
+static gboolean gum_v8_interceptor_get_native_callbacks (Handle<Value> value,
+    gpointer * on_enter, gpointer * on_leave, GumV8Core * core);
 static void gum_v8_invocation_listener_destroy (
     GumV8InvocationListener * listener);
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_attach_deferred)
+static GumV8DeferredSink * gum_v8_deferred_sink_new (
+    Handle<Function> on_calls, guint n_args, GumV8Core * core);
+static GumV8DeferredSink * gum_v8_deferred_sink_ref (GumV8DeferredSink * sink);
+static void gum_v8_deferred_sink_unref (GumV8DeferredSink * sink);
+static void gum_v8_deferred_sink_push (
+    const GumDeferredInvocation * invocations, guint n_invocations,
+    GumV8DeferredSink * self);
+static void gum_v8_deferred_sink_drain (GumV8DeferredSink * self);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_detach_all)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_replace)
 static void gum_v8_replace_entry_free (GumV8ReplaceEntry * entry);
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_revert)
 GUMJS_DECLARE_FUNCTION (gumjs_interceptor_flush)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_set_statistics_enabled)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_get_statistics)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_capture)
+static void gum_v8_capture_entry_free (GumV8CaptureEntry * entry);
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_detach_capture)
+GUMJS_DECLARE_FUNCTION (gumjs_interceptor_drain_captures)
 
 GUMJS_DECLARE_FUNCTION (gumjs_invocation_listener_detach)
 
@@ -166,10 +227,16 @@ static void gum_v8_interceptor_release_invocation_return_value (
 static const GumV8Function gumjs_interceptor_functions[] =
 {
   { "_attach", gumjs_interceptor_attach },
+  { "_attachDeferred", gumjs_interceptor_attach_deferred },
   { "detachAll", gumjs_interceptor_detach_all },
   { "_replace", gumjs_interceptor_replace },
   { "revert", gumjs_interceptor_revert },
   { "flush", gumjs_interceptor_flush },
+  { "setStatisticsEnabled", gumjs_interceptor_set_statistics_enabled },
+  { "getStatistics", gumjs_interceptor_get_statistics },
+  { "_capture", gumjs_interceptor_capture },
+  { "detachCapture", gumjs_interceptor_detach_capture },
+  { "drainCaptures", gumjs_interceptor_drain_captures },
 
   { NULL, NULL }
 };
@@ -240,6 +307,8 @@ _gum_v8_interceptor_init (GumV8Interceptor * self,
       (GDestroyNotify) gum_v8_invocation_return_value_free);
   self->replacement_by_address = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_v8_replace_entry_free);
+  self->capture_by_address = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_v8_capture_entry_free);
   self->flush_timer = NULL;
 
   auto module = External::New (isolate, self);
@@ -317,17 +386,16 @@ _gum_v8_interceptor_realize (GumV8Interceptor * self)
   self->invocation_return_value = new GumPersistent<Object>::type (isolate,
       ir_value);
 
-  self->cached_invocation_context =
+  self->invocation_context_pool[0] =
       gum_v8_invocation_context_new_persistent (self);
-  self->cached_invocation_context_in_use = FALSE;
+  self->invocation_context_pool_size = 1;
 
-  self->cached_invocation_args =
-      gum_v8_invocation_args_new_persistent (self);
-  self->cached_invocation_args_in_use = FALSE;
+  self->invocation_args_pool[0] = gum_v8_invocation_args_new_persistent (self);
+  self->invocation_args_pool_size = 1;
 
-  self->cached_invocation_return_value =
+  self->invocation_return_value_pool[0] =
       gum_v8_invocation_return_value_new_persistent (self);
-  self->cached_invocation_return_value_in_use = FALSE;
+  self->invocation_return_value_pool_size = 1;
 }
 
 void
@@ -338,6 +406,7 @@ _gum_v8_interceptor_flush (GumV8Interceptor * self)
 
   g_hash_table_remove_all (self->invocation_listeners);
   g_hash_table_remove_all (self->replacement_by_address);
+  g_hash_table_remove_all (self->capture_by_address);
 
   {
     ScriptUnlocker unlocker (core);
@@ -387,15 +456,24 @@ _gum_v8_interceptor_dispose (GumV8Interceptor * self)
 {
   g_assert (self->flush_timer == NULL);
 
-  gum_v8_invocation_context_release_persistent (
-      self->cached_invocation_context);
-  gum_v8_invocation_args_release_persistent (
-      self->cached_invocation_args);
-  gum_v8_invocation_return_value_release_persistent (
-      self->cached_invocation_return_value);
-  self->cached_invocation_context = NULL;
-  self->cached_invocation_args = NULL;
-  self->cached_invocation_return_value = NULL;
+  while (self->invocation_context_pool_size != 0)
+  {
+    gum_v8_invocation_context_release_persistent (self->invocation_context_pool[
+        --self->invocation_context_pool_size]);
+  }
+
+  while (self->invocation_args_pool_size != 0)
+  {
+    gum_v8_invocation_args_release_persistent (self->invocation_args_pool[
+        --self->invocation_args_pool_size]);
+  }
+
+  while (self->invocation_return_value_pool_size != 0)
+  {
+    gum_v8_invocation_return_value_release_persistent (
+        self->invocation_return_value_pool[
+            --self->invocation_return_value_pool_size]);
+  }
 
   delete self->invocation_return_value;
   self->invocation_return_value = nullptr;
@@ -436,18 +514,76 @@ _gum_v8_interceptor_finalize (GumV8Interceptor * self)
 {
   g_hash_table_unref (self->invocation_listeners);
   g_hash_table_unref (self->replacement_by_address);
+  g_hash_table_unref (self->capture_by_address);
 
   g_object_unref (self->interceptor);
   self->interceptor = NULL;
 }
 
+/* Native and deferred listeners run no JS of their own and are left out. */
+Local<Array>
+_gum_v8_interceptor_get_listener_statistics (GumV8Interceptor * self)
+{
+  auto core = self->core;
+  auto isolate = core->isolate;
+
+  auto result = Array::New (isolate);
+  guint i = 0;
+
+  GHashTableIter iter;
+  GumV8InvocationListener * listener;
+  g_hash_table_iter_init (&iter, self->invocation_listeners);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &listener, NULL))
+  {
+    if (listener->on_enter == nullptr && listener->on_leave == nullptr)
+      continue;
+
+    auto entry = Object::New (isolate);
+    _gum_v8_object_set_pointer (entry, "target", listener->target, core);
+    _gum_v8_object_set_callback_stats (entry, &listener->stats, core);
+    result->Set (i++, entry);
+  }
+
+  return result;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
 {
   gpointer target;
   Local<Function> on_enter, on_leave;
+  gpointer native_on_enter, native_on_leave;
+  gpointer listener_function_data = NULL;
   GumV8InvocationListener * listener;
 
-  if (info.Length () >= 2 && info[1]->IsFunction ())
+  if (info.Length () >= 2 && gum_v8_interceptor_get_native_callbacks (info[1],
+      &native_on_enter, &native_on_leave, core))
+  {
+    Local<Value> callbacks;
+    if (!_gum_v8_args_parse (args, "pV|p", &target, &callbacks,
+        &listener_function_data))
+      return;
+
+    listener = GUM_V8_INVOCATION_LISTENER_CAST (g_object_new (
+        (native_on_leave != NULL)
+            ? GUM_V8_TYPE_CALL_LISTENER
+            : GUM_V8_TYPE_PROBE_LISTENER,
+        NULL));
+
+    listener->is_native = TRUE;
+    listener->native_on_enter = GUM_POINTER_TO_FUNCPTR (
+        GumV8NativeInvocationCallback, native_on_enter);
+    listener->native_on_leave = GUM_POINTER_TO_FUNCPTR (
+        GumV8NativeInvocationCallback, native_on_leave);
+
+    /* Keep whatever backs the callbacks and their data alive */
+    auto context = isolate->GetCurrentContext ();
+    auto resources = Array::New (isolate, 2);
+    resources->Set (context, 0, callbacks).FromJust ();
+    resources->Set (context, 1, info[2]).FromJust ();
+    listener->native_resources =
+        new GumPersistent<Value>::type (isolate, resources);
+  }
+  else if (info.Length () >= 2 && info[1]->IsFunction ())
   {
     if (!_gum_v8_args_parse (args, "pF", &target, &on_enter))
       return;
@@ -481,17 +617,31 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
 
   listener->module = module;
 
-  auto attach_ret = gum_interceptor_attach_listener (module->interceptor,
-      target, GUM_INVOCATION_LISTENER (listener), NULL);
+  gum_v8_interceptor_attach_listener (module, target, listener,
+      listener_function_data, info);
+}
+
+static void
+gum_v8_interceptor_attach_listener (GumV8Interceptor * self,
+                                    gpointer target,
+                                    GumV8InvocationListener * listener,
+                                    gpointer listener_function_data,
+                                    const FunctionCallbackInfo<Value> & info)
+{
+  auto isolate = self->core->isolate;
+
+  auto attach_ret = gum_interceptor_attach_listener (self->interceptor,
+      target, GUM_INVOCATION_LISTENER (listener), listener_function_data);
 
   if (attach_ret == GUM_ATTACH_OK)
   {
     auto listener_template_value (Local<Object>::New (isolate,
-        *module->invocation_listener_value));
+        *self->invocation_listener_value));
     auto listener_value (listener_template_value->Clone ());
     listener_value->SetAlignedPointerInInternalField (0, listener);
 
-    g_hash_table_add (module->invocation_listeners, listener);
+    listener->target = target;
+    g_hash_table_add (self->invocation_listeners, listener);
 
     info.GetReturnValue ().Set (listener_value);
   }
@@ -523,6 +673,57 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach)
   }
 }
 
+/*
+ * Native callbacks are passed either as a NativePointer in place of the
+ * probe function, or as NativePointer values of onEnter and onLeave. They
+ * are called with the GumInvocationContext and run without entering the
+ * script, so the data given to attach() is their only link to it.
+ */
+static gboolean
+gum_v8_interceptor_get_native_callbacks (Handle<Value> value,
+                                         gpointer * on_enter,
+                                         gpointer * on_leave,
+                                         GumV8Core * core)
+{
+  auto isolate = core->isolate;
+  auto context = isolate->GetCurrentContext ();
+  auto native_pointer = Local<FunctionTemplate>::New (isolate,
+      *core->native_pointer);
+
+  *on_enter = NULL;
+  *on_leave = NULL;
+
+  if (native_pointer->HasInstance (value))
+  {
+    *on_enter = GUMJS_NATIVE_POINTER_VALUE (value.As<Object> ());
+    return TRUE;
+  }
+
+  if (!value->IsObject () || value->IsFunction ())
+    return FALSE;
+  auto callbacks = value.As<Object> ();
+
+  gboolean is_native = FALSE;
+
+  Local<Value> on_enter_value;
+  if (callbacks->Get (context, _gum_v8_string_new_ascii (isolate, "onEnter"))
+      .ToLocal (&on_enter_value) && native_pointer->HasInstance (on_enter_value))
+  {
+    *on_enter = GUMJS_NATIVE_POINTER_VALUE (on_enter_value.As<Object> ());
+    is_native = TRUE;
+  }
+
+  Local<Value> on_leave_value;
+  if (callbacks->Get (context, _gum_v8_string_new_ascii (isolate, "onLeave"))
+      .ToLocal (&on_leave_value) && native_pointer->HasInstance (on_leave_value))
+  {
+    *on_leave = GUMJS_NATIVE_POINTER_VALUE (on_leave_value.As<Object> ());
+    is_native = TRUE;
+  }
+
+  return is_native;
+}
+
 static void
 gum_v8_invocation_listener_destroy (GumV8InvocationListener * listener)
 {
@@ -531,6 +732,169 @@ gum_v8_invocation_listener_destroy (GumV8InvocationListener * listener)
   g_object_unref (listener);
 }
 
+/*
+ * Deferred listeners record calls without entering the script, so hooked
+ * threads never wait for the JS lock. The records are handed to `onCalls`
+ * on the JS thread, in batches, some time after the calls returned.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_attach_deferred)
+{
+  gpointer target;
+  Local<Function> on_calls;
+  guint n_args;
+  if (!_gum_v8_args_parse (args, "pFu", &target, &on_calls, &n_args))
+    return;
+
+  if (n_args > GUM_DEFERRED_MAX_ARGS)
+  {
+    _gum_v8_throw_ascii (isolate, "at most %u arguments can be recorded",
+        GUM_DEFERRED_MAX_ARGS);
+    return;
+  }
+
+  auto listener = GUM_V8_INVOCATION_LISTENER_CAST (
+      g_object_new (GUM_V8_TYPE_CALL_LISTENER, NULL));
+
+  auto sink = gum_v8_deferred_sink_new (on_calls, n_args, core);
+  listener->deferred = gum_deferred_listener_new (n_args,
+      (GumDeferredInvocationFunc) gum_v8_deferred_sink_push, sink,
+      (GDestroyNotify) gum_v8_deferred_sink_unref);
+
+  listener->module = module;
+
+  gum_v8_interceptor_attach_listener (module, target, listener, NULL, info);
+}
+
+static GumV8DeferredSink *
+gum_v8_deferred_sink_new (Handle<Function> on_calls,
+                          guint n_args,
+                          GumV8Core * core)
+{
+  auto sink = g_slice_new (GumV8DeferredSink);
+  sink->ref_count = 1;
+
+  sink->on_calls = new GumPersistent<Function>::type (core->isolate, on_calls);
+  sink->n_args = n_args;
+
+  g_mutex_init (&sink->mutex);
+  sink->invocations = g_array_new (FALSE, FALSE,
+      sizeof (GumDeferredInvocation));
+  sink->drain_scheduled = FALSE;
+
+  sink->core = core;
+  _gum_v8_core_pin (core);
+
+  return sink;
+}
+
+static GumV8DeferredSink *
+gum_v8_deferred_sink_ref (GumV8DeferredSink * sink)
+{
+  g_atomic_int_inc (&sink->ref_count);
+
+  return sink;
+}
+
+static void
+gum_v8_deferred_sink_unref (GumV8DeferredSink * sink)
+{
+  if (!g_atomic_int_dec_and_test (&sink->ref_count))
+    return;
+
+  auto core = sink->core;
+
+  {
+    ScriptScope scope (core->script);
+
+    delete sink->on_calls;
+
+    _gum_v8_core_unpin (core);
+  }
+
+  g_array_free (sink->invocations, TRUE);
+  g_mutex_clear (&sink->mutex);
+
+  g_slice_free (GumV8DeferredSink, sink);
+}
+
+static void
+gum_v8_deferred_sink_push (const GumDeferredInvocation * invocations,
+                           guint n_invocations,
+                           GumV8DeferredSink * self)
+{
+  gboolean schedule_drain;
+
+  g_mutex_lock (&self->mutex);
+  g_array_append_vals (self->invocations, invocations, n_invocations);
+  schedule_drain = !self->drain_scheduled;
+  self->drain_scheduled = TRUE;
+  g_mutex_unlock (&self->mutex);
+
+  if (schedule_drain)
+  {
+    gum_script_scheduler_push_job_on_js_thread (self->core->scheduler,
+        G_PRIORITY_DEFAULT, (GumScriptJobFunc) gum_v8_deferred_sink_drain,
+        gum_v8_deferred_sink_ref (self),
+        (GDestroyNotify) gum_v8_deferred_sink_unref);
+  }
+}
+
+static void
+gum_v8_deferred_sink_drain (GumV8DeferredSink * self)
+{
+  auto core = self->core;
+
+  g_mutex_lock (&self->mutex);
+  auto invocations = self->invocations;
+  self->invocations = g_array_new (FALSE, FALSE,
+      sizeof (GumDeferredInvocation));
+  self->drain_scheduled = FALSE;
+  g_mutex_unlock (&self->mutex);
+
+  if (invocations->len != 0)
+  {
+    ScriptScope scope (core->script);
+    auto isolate = core->isolate;
+    auto context = isolate->GetCurrentContext ();
+
+    auto calls = Array::New (isolate, invocations->len);
+    for (guint i = 0; i != invocations->len; i++)
+    {
+      auto invocation =
+          &g_array_index (invocations, GumDeferredInvocation, i);
+
+      auto call = Object::New (isolate);
+      _gum_v8_object_set_pointer (call, "function", invocation->function,
+          core);
+      _gum_v8_object_set_uint (call, "threadId", invocation->thread_id, core);
+      _gum_v8_object_set_uint (call, "depth", invocation->depth, core);
+      _gum_v8_object_set (call, "timestamp",
+          Number::New (isolate, (double) invocation->timestamp), core);
+      _gum_v8_object_set (call, "duration",
+          Number::New (isolate, (double) invocation->duration), core);
+
+      auto call_args = Array::New (isolate, self->n_args);
+      for (guint j = 0; j != self->n_args; j++)
+      {
+        call_args->Set (context, j,
+            _gum_v8_native_pointer_new (invocation->args[j], core)).FromJust ();
+      }
+      _gum_v8_object_set (call, "args", call_args, core);
+
+      _gum_v8_object_set_pointer (call, "retval", invocation->return_value,
+          core);
+
+      calls->Set (context, i, call).FromJust ();
+    }
+
+    auto on_calls = Local<Function>::New (isolate, *self->on_calls);
+    Handle<Value> argv[] = { calls };
+    on_calls->Call (Undefined (isolate), G_N_ELEMENTS (argv), argv);
+  }
+
+  g_array_free (invocations, TRUE);
+}
+
 static void
 gum_v8_interceptor_detach (GumV8Interceptor * self,
                            GumV8InvocationListener * listener)
@@ -618,6 +982,156 @@ GUMJS_DEFINE_FUNCTION (gumjs_interceptor_flush)
   gum_interceptor_begin_transaction (interceptor);
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_set_statistics_enabled)
+{
+  gboolean enabled;
+  if (!_gum_v8_args_parse (args, "t", &enabled))
+    return;
+
+  gum_interceptor_set_statistics_enabled (module->interceptor, enabled);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_get_statistics)
+{
+  auto statistics = gum_interceptor_get_statistics (module->interceptor);
+
+  auto result = Array::New (isolate, statistics->len);
+  for (guint i = 0; i != statistics->len; i++)
+  {
+    auto stats = &g_array_index (statistics, GumFunctionStatistics, i);
+
+    auto entry = Object::New (isolate);
+    _gum_v8_object_set_pointer (entry, "address", stats->function_address,
+        core);
+    _gum_v8_object_set_uint64 (entry, "calls", stats->calls, core);
+    _gum_v8_object_set_uint64 (entry, "bypassedCalls", stats->bypassed_calls,
+        core);
+    _gum_v8_object_set_uint64 (entry, "listenerTime", stats->listener_time,
+        core);
+    result->Set (i, entry);
+  }
+
+  g_array_free (statistics, TRUE);
+
+  info.GetReturnValue ().Set (result);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_capture)
+{
+  gpointer target;
+  guint n_args;
+  gboolean capture_return;
+  if (!_gum_v8_args_parse (args, "put", &target, &n_args, &capture_return))
+    return;
+
+  if (n_args > GUM_CAPTURE_MAX_ARGS)
+  {
+    _gum_v8_throw_ascii (isolate, "at most %u arguments can be captured",
+        GUM_CAPTURE_MAX_ARGS);
+    return;
+  }
+
+  auto attach_ret = gum_interceptor_attach_capture (module->interceptor,
+      target, n_args, capture_return);
+
+  switch (attach_ret)
+  {
+    case GUM_ATTACH_OK:
+    {
+      auto entry = g_slice_new (GumV8CaptureEntry);
+      entry->interceptor = module->interceptor;
+      entry->target = target;
+
+      g_hash_table_insert (module->capture_by_address, target, entry);
+      break;
+    }
+    case GUM_ATTACH_WRONG_SIGNATURE:
+    {
+      _gum_v8_throw_ascii (isolate, "unable to intercept function at %p; "
+          "please file a bug", target);
+      break;
+    }
+    case GUM_ATTACH_ALREADY_ATTACHED:
+      _gum_v8_throw_ascii_literal (isolate, "already capturing this function");
+      break;
+    case GUM_ATTACH_POLICY_VIOLATION:
+      _gum_v8_throw_ascii_literal (isolate,
+          "not permitted by code-signing policy");
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+static void
+gum_v8_capture_entry_free (GumV8CaptureEntry * entry)
+{
+  gum_interceptor_detach_capture (entry->interceptor, entry->target);
+
+  g_slice_free (GumV8CaptureEntry, entry);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_detach_capture)
+{
+  gpointer target;
+  if (!_gum_v8_args_parse (args, "p", &target))
+    return;
+
+  g_hash_table_remove (module->capture_by_address, target);
+}
+
+/*
+ * Captures are process wide, so this also returns calls captured by other
+ * users of the interceptor, if any.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_interceptor_drain_captures)
+{
+  auto context = isolate->GetCurrentContext ();
+  auto calls = g_new (GumCapturedCall, GUM_V8_CAPTURE_DRAIN_BATCH_SIZE);
+  auto result = Array::New (isolate);
+  guint index = 0;
+  guint n;
+
+  do
+  {
+    n = gum_interceptor_drain_captures (module->interceptor, calls,
+        GUM_V8_CAPTURE_DRAIN_BATCH_SIZE);
+
+    for (guint i = 0; i != n; i++)
+    {
+      auto captured = &calls[i];
+
+      auto call = Object::New (isolate);
+      _gum_v8_object_set_pointer (call, "function", captured->function,
+          core);
+      _gum_v8_object_set_uint (call, "threadId", captured->thread_id, core);
+      _gum_v8_object_set (call, "timestamp",
+          Number::New (isolate, (double) captured->timestamp), core);
+
+      auto call_args = Array::New (isolate, captured->n_args);
+      for (guint j = 0; j != captured->n_args; j++)
+      {
+        call_args->Set (context, j,
+            _gum_v8_native_pointer_new (captured->args[j], core)).FromJust ();
+      }
+      _gum_v8_object_set (call, "args", call_args, core);
+
+      if (captured->has_return_value)
+      {
+        _gum_v8_object_set_pointer (call, "retval", captured->return_value,
+            core);
+      }
+
+      result->Set (context, index++, call).FromJust ();
+    }
+  }
+  while (n == GUM_V8_CAPTURE_DRAIN_BATCH_SIZE);
+
+  g_free (calls);
+
+  info.GetReturnValue ().Set (result);
+}
+
 GUMJS_DEFINE_CLASS_METHOD (gumjs_invocation_listener_detach,
                            GumV8InvocationListener)
 {
@@ -639,6 +1153,11 @@ gum_v8_invocation_listener_dispose (GumV8InvocationListener * self)
 
   delete self->on_leave;
   self->on_leave = nullptr;
+
+  delete self->native_resources;
+  self->native_resources = nullptr;
+
+  g_clear_object (&self->deferred);
 }
 
 static void
@@ -646,13 +1165,28 @@ gum_v8_invocation_listener_on_enter (GumInvocationListener * listener,
                                      GumInvocationContext * ic)
 {
   auto self = GUM_V8_INVOCATION_LISTENER_CAST (listener);
+
+  if (self->deferred != NULL)
+  {
+    gum_invocation_listener_on_enter (
+        GUM_INVOCATION_LISTENER (self->deferred), ic);
+    return;
+  }
+
+  if (self->is_native)
+  {
+    if (self->native_on_enter != NULL)
+      self->native_on_enter (ic);
+    return;
+  }
+
   auto state = GUM_LINCTX_GET_FUNC_INVDATA (ic, GumV8InvocationState);
 
   if (self->on_enter != nullptr)
   {
     auto module = self->module;
     auto core = module->core;
-    ScriptScope scope (core->script);
+    ScriptScope scope (core->script, &self->stats);
     auto isolate = core->isolate;
 
     auto on_enter = Local<Function>::New (isolate, *self->on_enter);
@@ -693,13 +1227,27 @@ gum_v8_invocation_listener_on_leave (GumInvocationListener * listener,
                                      GumInvocationContext * ic)
 {
   auto self = GUM_V8_INVOCATION_LISTENER_CAST (listener);
+
+  if (self->deferred != NULL)
+  {
+    gum_invocation_listener_on_leave (
+        GUM_INVOCATION_LISTENER (self->deferred), ic);
+    return;
+  }
+
+  if (self->is_native)
+  {
+    self->native_on_leave (ic);
+    return;
+  }
+
   auto state = GUM_LINCTX_GET_FUNC_INVDATA (ic, GumV8InvocationState);
 
   if (self->on_leave != nullptr)
   {
     auto module = self->module;
     auto core = module->core;
-    ScriptScope scope (core->script);
+    ScriptScope scope (core->script, &self->stats);
     auto isolate = core->isolate;
 
     auto on_leave = Local<Function>::New (isolate, *self->on_leave);
@@ -956,16 +1504,8 @@ gumjs_invocation_context_set_property (Local<Name> property,
   auto holder = info.Holder ();
   auto self =
       (GumV8InvocationContext *) holder->GetAlignedPointerFromInternalField (0);
-  auto module =
-      (GumV8Interceptor *) info.Data ().As<External> ()->Value ();
-
-  if (holder == *module->cached_invocation_context->object)
-  {
-    module->cached_invocation_context =
-        gum_v8_invocation_context_new_persistent (module);
-    module->cached_invocation_context_in_use = FALSE;
-  }
 
+  /* Properties set by the script must not leak into other invocations */
   self->dirty = TRUE;
 }
 
@@ -983,6 +1523,10 @@ gum_v8_invocation_args_new_persistent (GumV8Interceptor * parent)
   args->object = new GumPersistent<Object>::type (isolate, object);
   args->ic = NULL;
 
+  args->arg_wrappers = new GumPersistent<Array>::type (isolate,
+      Array::New (isolate, GUM_V8_MAX_CACHED_ARGS));
+  args->arg_wrappers_mask = 0;
+
   args->module = parent;
 
   return args;
@@ -1011,6 +1555,7 @@ gum_v8_invocation_args_on_weak_notify (
 static void
 gum_v8_invocation_args_free (GumV8InvocationArgs * self)
 {
+  delete self->arg_wrappers;
   delete self->object;
 
   g_slice_free (GumV8InvocationArgs, self);
@@ -1044,8 +1589,37 @@ gumjs_invocation_args_get_nth (uint32_t index,
     return;
   }
 
-  info.GetReturnValue ().Set (_gum_v8_native_pointer_new (
-      gum_invocation_context_get_nth_argument (self->ic, index), core));
+  auto value = gum_invocation_context_get_nth_argument (self->ic, index);
+
+  if (index >= GUM_V8_MAX_CACHED_ARGS)
+  {
+    info.GetReturnValue ().Set (_gum_v8_native_pointer_new (value, core));
+    return;
+  }
+
+  /*
+   * NativePointer objects are immutable, so the wrapper handed out for an
+   * argument can be handed out again whenever a later call of a function
+   * sharing this object passes the same value in that position.
+   */
+  auto isolate = core->isolate;
+  auto context = isolate->GetCurrentContext ();
+  auto wrappers = Local<Array>::New (isolate, *self->arg_wrappers);
+  guint bit = 1 << index;
+
+  if ((self->arg_wrappers_mask & bit) != 0 && self->arg_values[index] == value)
+  {
+    info.GetReturnValue ().Set (
+        wrappers->Get (context, index).ToLocalChecked ());
+    return;
+  }
+
+  auto wrapper = _gum_v8_native_pointer_new (value, core);
+  wrappers->Set (context, index, wrapper).FromJust ();
+  self->arg_values[index] = value;
+  self->arg_wrappers_mask |= bit;
+
+  info.GetReturnValue ().Set (wrapper);
 }
 
 static void
@@ -1150,55 +1724,47 @@ GUMJS_DEFINE_FUNCTION (gumjs_invocation_return_value_replace)
 GumV8InvocationContext *
 _gum_v8_interceptor_obtain_invocation_context (GumV8Interceptor * self)
 {
-  GumV8InvocationContext * jic;
+  if (self->invocation_context_pool_size != 0)
+    return self->invocation_context_pool[--self->invocation_context_pool_size];
 
-  if (!self->cached_invocation_context_in_use)
-  {
-    jic = self->cached_invocation_context;
-    self->cached_invocation_context_in_use = TRUE;
-  }
-  else
-  {
-    jic = gum_v8_invocation_context_new_persistent (self);
-  }
-
-  return jic;
+  return gum_v8_invocation_context_new_persistent (self);
 }
 
+/*
+ * Released objects are kept for reuse, up to a fixed number of each kind, so
+ * that nested and overlapping invocations, e.g. of a recursive function or
+ * from several threads, stop allocating once the pool has warmed up.
+ */
 void
 _gum_v8_interceptor_release_invocation_context (GumV8Interceptor * self,
                                                 GumV8InvocationContext * jic)
 {
-  if (jic == self->cached_invocation_context)
-    self->cached_invocation_context_in_use = FALSE;
+  if (!jic->dirty &&
+      self->invocation_context_pool_size != GUM_V8_INVOCATION_POOL_CAPACITY)
+  {
+    self->invocation_context_pool[self->invocation_context_pool_size++] = jic;
+  }
   else
+  {
     gum_v8_invocation_context_release_persistent (jic);
+  }
 }
 
 static GumV8InvocationArgs *
 gum_v8_interceptor_obtain_invocation_args (GumV8Interceptor * self)
 {
-  GumV8InvocationArgs * args;
+  if (self->invocation_args_pool_size != 0)
+    return self->invocation_args_pool[--self->invocation_args_pool_size];
 
-  if (!self->cached_invocation_args_in_use)
-  {
-    args = self->cached_invocation_args;
-    self->cached_invocation_args_in_use = TRUE;
-  }
-  else
-  {
-    args = gum_v8_invocation_args_new_persistent (self);
-  }
-
-  return args;
+  return gum_v8_invocation_args_new_persistent (self);
 }
 
 static void
 gum_v8_interceptor_release_invocation_args (GumV8Interceptor * self,
                                             GumV8InvocationArgs * args)
 {
-  if (args == self->cached_invocation_args)
-    self->cached_invocation_args_in_use = FALSE;
+  if (self->invocation_args_pool_size != GUM_V8_INVOCATION_POOL_CAPACITY)
+    self->invocation_args_pool[self->invocation_args_pool_size++] = args;
   else
     gum_v8_invocation_args_release_persistent (args);
 }
@@ -1206,19 +1772,13 @@ gum_v8_interceptor_release_invocation_args (GumV8Interceptor * self,
 static GumV8InvocationReturnValue *
 gum_v8_interceptor_obtain_invocation_return_value (GumV8Interceptor * self)
 {
-  GumV8InvocationReturnValue * retval;
-
-  if (!self->cached_invocation_return_value_in_use)
+  if (self->invocation_return_value_pool_size != 0)
   {
-    retval = self->cached_invocation_return_value;
-    self->cached_invocation_return_value_in_use = TRUE;
-  }
-  else
-  {
-    retval = gum_v8_invocation_return_value_new_persistent (self);
+    return self->invocation_return_value_pool[
+        --self->invocation_return_value_pool_size];
   }
 
-  return retval;
+  return gum_v8_invocation_return_value_new_persistent (self);
 }
 
 static void
@@ -1226,8 +1786,14 @@ gum_v8_interceptor_release_invocation_return_value (
     GumV8Interceptor * self,
     GumV8InvocationReturnValue * retval)
 {
-  if (retval == self->cached_invocation_return_value)
-    self->cached_invocation_return_value_in_use = FALSE;
+  if (self->invocation_return_value_pool_size !=
+      GUM_V8_INVOCATION_POOL_CAPACITY)
+  {
+    self->invocation_return_value_pool[
+        self->invocation_return_value_pool_size++] = retval;
+  }
   else
+  {
     gum_v8_invocation_return_value_release_persistent (retval);
+  }
 }
@@ -11,6 +11,8 @@
 
 #include <gum/guminterceptor.h>
 
+#define GUM_V8_INVOCATION_POOL_CAPACITY 16
+
 struct GumV8InvocationContext;
 struct GumV8InvocationArgs;
 struct GumV8InvocationReturnValue;
@@ -26,6 +28,7 @@ struct GumV8Interceptor
   GHashTable * invocation_args_values;
   GHashTable * invocation_return_values;
   GHashTable * replacement_by_address;
+  GHashTable * capture_by_address;
   GSource * flush_timer;
 
   GumPersistent<v8::FunctionTemplate>::type * invocation_listener;
@@ -38,14 +41,16 @@ struct GumV8Interceptor
   GumPersistent<v8::Object>::type * invocation_args_value;
   GumPersistent<v8::Object>::type * invocation_return_value;
 
-  GumV8InvocationContext * cached_invocation_context;
-  gboolean cached_invocation_context_in_use;
+  GumV8InvocationContext *
+      invocation_context_pool[GUM_V8_INVOCATION_POOL_CAPACITY];
+  guint invocation_context_pool_size;
 
-  GumV8InvocationArgs * cached_invocation_args;
-  gboolean cached_invocation_args_in_use;
+  GumV8InvocationArgs * invocation_args_pool[GUM_V8_INVOCATION_POOL_CAPACITY];
+  guint invocation_args_pool_size;
 
-  GumV8InvocationReturnValue * cached_invocation_return_value;
-  gboolean cached_invocation_return_value_in_use;
+  GumV8InvocationReturnValue *
+      invocation_return_value_pool[GUM_V8_INVOCATION_POOL_CAPACITY];
+  guint invocation_return_value_pool_size;
 };
 
 struct GumV8InvocationContext
@@ -65,6 +70,9 @@ G_GNUC_INTERNAL void _gum_v8_interceptor_flush (GumV8Interceptor * self);
 G_GNUC_INTERNAL void _gum_v8_interceptor_dispose (GumV8Interceptor * self);
 G_GNUC_INTERNAL void _gum_v8_interceptor_finalize (GumV8Interceptor * self);
 
+G_GNUC_INTERNAL v8::Local<v8::Array>
+    _gum_v8_interceptor_get_listener_statistics (GumV8Interceptor * self);
+
 G_GNUC_INTERNAL GumV8InvocationContext *
     _gum_v8_interceptor_obtain_invocation_context (GumV8Interceptor * self);
 G_GNUC_INTERNAL void _gum_v8_interceptor_release_invocation_context (
@@ -55,7 +55,7 @@ struct GumMemoryPatchContext
 struct GumMemoryScanContext
 {
   GumMemoryRange range;
-  GumMatchPattern * pattern;
+  GPtrArray * patterns;
   GumPersistent<Function>::type * on_match;
   GumPersistent<Function>::type * on_error;
   GumPersistent<Function>::type * on_complete;
@@ -63,15 +63,49 @@ struct GumMemoryScanContext
   GumV8Core * core;
 };
 
+struct GumMemoryScanMatch
+{
+  GumAddress address;
+  gsize size;
+  guint pattern_index;
+};
+
+struct GumMemoryScanner
+{
+  gint ref_count;
+  GumPersistent<Object>::type * wrapper;
+
+  GumMemoryRange range;
+  GPtrArray * patterns;
+  gboolean report_pattern_index;
+  guint chunk_size;
+
+  GMutex mutex;
+  GCond cond;
+  GumMemoryScanMatch * queue;
+  guint queue_capacity;
+  guint queue_head;
+  guint queue_length;
+  gboolean finished;
+  gboolean cancelled;
+  gchar * error;
+  GumPersistent<Function>::type * on_read;
+
+  GumV8Memory * module;
+};
+
 struct GumMemoryScanSyncContext
 {
   Local<Array> matches;
+  gboolean report_pattern_index;
 
   GumV8Core * core;
 };
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_alloc)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_arena)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_copy)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_view)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_protect)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_patch_code)
 static void gum_memory_patch_context_apply (gpointer mem,
@@ -79,6 +113,9 @@ static void gum_memory_patch_context_apply (gpointer mem,
 
 static void gum_v8_memory_read (GumMemoryValueType type,
     const GumV8Args * args, ReturnValue<Value> return_value);
+static gsize gum_v8_memory_get_scalar_size (GumMemoryValueType type);
+static Local<Value> gum_v8_memory_scalar_new (GumMemoryValueType type,
+    gconstpointer data, GumV8Core * core);
 static void gum_v8_memory_write (GumMemoryValueType type,
     const GumV8Args * args);
 
@@ -136,10 +173,30 @@ GUMJS_DECLARE_FUNCTION (gumjs_memory_scan)
 static void gum_memory_scan_context_free (GumMemoryScanContext * self);
 static void gum_memory_scan_context_run (GumMemoryScanContext * self);
 static gboolean gum_memory_scan_context_emit_match (GumAddress address,
-    gsize size, GumMemoryScanContext * self);
+    gsize size, guint pattern_index, GumMemoryScanContext * self);
+GUMJS_DECLARE_FUNCTION (gumjs_memory_open_scan)
+static GumMemoryScanner * gum_memory_scanner_ref (GumMemoryScanner * self);
+static void gum_memory_scanner_unref (GumMemoryScanner * self);
+static void gum_memory_scanner_release (GumMemoryScanner * self);
+static void gum_memory_scanner_on_weak_notify (
+    const WeakCallbackInfo<GumMemoryScanner> & info);
+static void gum_memory_scanner_run (GumMemoryScanner * self);
+static gboolean gum_memory_scanner_push_match (GumAddress address, gsize size,
+    guint pattern_index, GumMemoryScanner * self);
+static GArray * gum_memory_scanner_pop_chunk (GumMemoryScanner * self);
+static void gum_memory_scanner_deliver (GumMemoryScanner * self,
+    GumPersistent<Function>::type * on_read, GArray * matches, gboolean done,
+    const gchar * error);
+static void gum_memory_scanner_call (GumMemoryScanner * self,
+    Local<Function> callback, GArray * matches, gboolean done,
+    const gchar * error);
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scanner_read)
+GUMJS_DECLARE_FUNCTION (gumjs_memory_scanner_cancel)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean gum_append_match (GumAddress address, gsize size,
-    GumMemoryScanSyncContext * ctx);
+    guint pattern_index, GumMemoryScanSyncContext * ctx);
+static GPtrArray * gum_parse_match_patterns (Handle<Value> value,
+    gboolean * is_multi, GumV8Core * core);
 
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_enable)
 GUMJS_DECLARE_FUNCTION (gumjs_memory_access_monitor_disable)
@@ -152,7 +209,9 @@ static void gum_v8_memory_on_access (GumMemoryAccessMonitor * monitor,
 static const GumV8Function gumjs_memory_functions[] =
 {
   { "alloc", gumjs_memory_alloc },
+  { "arena", gumjs_memory_arena },
   { "copy", gumjs_memory_copy },
+  { "view", gumjs_memory_view },
   { "protect", gumjs_memory_protect },
   { "_patchCode", gumjs_memory_patch_code },
 
@@ -184,11 +243,20 @@ static const GumV8Function gumjs_memory_functions[] =
   { "allocUtf16String", gumjs_memory_alloc_utf16_string },
 
   { "scan", gumjs_memory_scan },
+  { "_openScan", gumjs_memory_open_scan },
   { "scanSync", gumjs_memory_scan_sync },
 
   { NULL, NULL }
 };
 
+static const GumV8Function gumjs_memory_scanner_functions[] =
+{
+  { "read", gumjs_memory_scanner_read },
+  { "cancel", gumjs_memory_scanner_cancel },
+
+  { NULL, NULL }
+};
+
 static const GumV8Function gumjs_memory_access_monitor_functions[] =
 {
   { "enable", gumjs_memory_access_monitor_enable },
@@ -206,11 +274,20 @@ _gum_v8_memory_init (GumV8Memory * self,
 
   self->core = core;
 
+  self->pool = gum_memory_pool_new ();
+  self->arena = gum_memory_arena_new ();
+  self->arena_depth = 0;
+
   auto module = External::New (isolate, self);
 
   auto memory = _gum_v8_create_module ("Memory", scope, isolate);
   _gum_v8_module_add (module, memory, gumjs_memory_functions, isolate);
 
+  auto scanner = _gum_v8_create_class ("MemoryScanner", nullptr, scope,
+      module, isolate);
+  _gum_v8_class_add (scanner, gumjs_memory_scanner_functions, module, isolate);
+  self->scanner = new GumPersistent<FunctionTemplate>::type (isolate, scanner);
+
   auto monitor = _gum_v8_create_module ("MemoryAccessMonitor", scope, isolate);
   _gum_v8_module_add (module, monitor, gumjs_memory_access_monitor_functions,
       isolate);
@@ -219,18 +296,29 @@ _gum_v8_memory_init (GumV8Memory * self,
 void
 _gum_v8_memory_realize (GumV8Memory * self)
 {
+  self->scanners = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_memory_scanner_release);
 }
 
 void
 _gum_v8_memory_dispose (GumV8Memory * self)
 {
   gum_v8_memory_clear_monitor (self);
+
+  g_hash_table_unref (self->scanners);
+  self->scanners = NULL;
+
+  delete self->scanner;
+  self->scanner = nullptr;
 }
 
 void
 _gum_v8_memory_finalize (GumV8Memory * self)
 {
   g_clear_object (&self->monitor);
+
+  gum_memory_arena_free (self->arena);
+  gum_memory_pool_free (self->pool);
 }
 
 GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc)
@@ -245,10 +333,23 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc)
     return;
   }
 
+  gsize page_size = gum_query_page_size ();
+
+  if (module->arena_depth != 0 && size < page_size)
+  {
+    info.GetReturnValue ().Set (_gum_v8_native_pointer_new (
+        gum_memory_arena_alloc (module->arena, size), core));
+    return;
+  }
+
   GumV8NativeResource * res;
 
-  gsize page_size = gum_query_page_size ();
-  if (size < page_size)
+  if (size <= GUM_MEMORY_POOL_MAX_SIZE)
+  {
+    res = _gum_v8_native_resource_new (gum_memory_pool_alloc (module->pool,
+        size), size, gum_memory_pool_release, core);
+  }
+  else if (size < page_size)
   {
     res = _gum_v8_native_resource_new (g_malloc0 (size), size, g_free, core);
   }
@@ -262,6 +363,28 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_alloc)
   info.GetReturnValue ().Set (Local<Object>::New (isolate, *res->instance));
 }
 
+/*
+ * Small allocations made while the callback runs come from the arena rather
+ * than being tracked by the garbage collector, and all of them are released
+ * together when the outermost arena() returns, even if it throws.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_memory_arena)
+{
+  Local<Function> callback;
+  if (!_gum_v8_args_parse (args, "F", &callback))
+    return;
+
+  module->arena_depth++;
+
+  auto result = callback->Call (Undefined (isolate), 0, nullptr);
+
+  if (--module->arena_depth == 0)
+    gum_memory_arena_reset (module->arena);
+
+  if (!result.IsEmpty ())
+    info.GetReturnValue ().Set (result);
+}
+
 #ifdef _MSC_VER
 # pragma warning (push)
 # pragma warning (disable: 4611)
@@ -298,6 +421,37 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_copy)
   }
 }
 
+/*
+ * Wraps target memory in an ArrayBuffer without copying, so typed arrays and
+ * DataViews over it read and write the memory directly. The range is only
+ * checked when the view is created; accesses through the view are not
+ * guarded, so it must not outlive the mapping.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_memory_view)
+{
+  gpointer address;
+  gsize size;
+  if (!_gum_v8_args_parse (args, "pZ", &address, &size))
+    return;
+
+  if (size > 0x7fffffff)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid size");
+    return;
+  }
+
+  if (size != 0 && !gum_memory_is_readable (GUM_ADDRESS (address), size))
+  {
+    _gum_v8_throw_ascii (isolate,
+        "access violation accessing 0x%" G_GSIZE_MODIFIER "x",
+        GPOINTER_TO_SIZE (address));
+    return;
+  }
+
+  info.GetReturnValue ().Set (ArrayBuffer::New (isolate, address, size,
+      ArrayBufferCreationMode::kExternalized));
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_memory_protect)
 {
   gpointer address;
@@ -383,48 +537,40 @@ gum_v8_memory_read (GumMemoryValueType type,
       break;
   }
 
+  /*
+   * Scalars are read through a guarded load, which is a lot cheaper than a
+   * try-scope. Should it fault, the read is repeated in the try-scope below,
+   * which captures the details of the fault for the error thrown.
+   */
+  auto scalar_size = gum_v8_memory_get_scalar_size (type);
+  if (scalar_size != 0)
+  {
+    guint64 scalar;
+    if (gum_exceptor_try_read (exceptor, address, scalar_size, &scalar))
+    {
+      return_value.Set (gum_v8_memory_scalar_new (type, &scalar, core));
+      return;
+    }
+  }
+
   if (gum_exceptor_try (exceptor, &scope))
   {
     switch (type)
     {
       case GUM_MEMORY_VALUE_POINTER:
-        result = _gum_v8_native_pointer_new (*((gpointer *) address), core);
-        break;
       case GUM_MEMORY_VALUE_S8:
-        result = Integer::New (isolate, *((gint8 *) address));
-        break;
       case GUM_MEMORY_VALUE_U8:
-        result = Integer::NewFromUnsigned (isolate, *((guint8 *) address));
-        break;
       case GUM_MEMORY_VALUE_S16:
-        result = Integer::New (isolate, *((gint16 *) address));
-        break;
       case GUM_MEMORY_VALUE_U16:
-        result = Integer::NewFromUnsigned (isolate, *((guint16 *) address));
-        break;
       case GUM_MEMORY_VALUE_S32:
-        result = Integer::New (isolate, *((gint32 *) address));
-        break;
       case GUM_MEMORY_VALUE_U32:
-        result = Integer::NewFromUnsigned (isolate, *((guint32 *) address));
-        break;
       case GUM_MEMORY_VALUE_S64:
-        result = _gum_v8_int64_new (*((gint64 *) address), core);
-        break;
       case GUM_MEMORY_VALUE_U64:
-        result = _gum_v8_uint64_new (*((guint64 *) address), core);
-        break;
       case GUM_MEMORY_VALUE_LONG:
-        result = _gum_v8_int64_new (*((glong *) address), core);
-        break;
       case GUM_MEMORY_VALUE_ULONG:
-        result = _gum_v8_uint64_new (*((gulong *) address), core);
-        break;
       case GUM_MEMORY_VALUE_FLOAT:
-        result = Number::New (isolate, *((gfloat *) address));
-        break;
       case GUM_MEMORY_VALUE_DOUBLE:
-        result = Number::New (isolate, *((gdouble *) address));
+        result = gum_v8_memory_scalar_new (type, address, core);
         break;
       case GUM_MEMORY_VALUE_BYTE_ARRAY:
       {
@@ -594,6 +740,77 @@ gum_v8_memory_read (GumMemoryValueType type,
   }
 }
 
+static gsize
+gum_v8_memory_get_scalar_size (GumMemoryValueType type)
+{
+  switch (type)
+  {
+    case GUM_MEMORY_VALUE_POINTER:
+      return sizeof (gpointer);
+    case GUM_MEMORY_VALUE_S8:
+    case GUM_MEMORY_VALUE_U8:
+      return 1;
+    case GUM_MEMORY_VALUE_S16:
+    case GUM_MEMORY_VALUE_U16:
+      return 2;
+    case GUM_MEMORY_VALUE_S32:
+    case GUM_MEMORY_VALUE_U32:
+    case GUM_MEMORY_VALUE_FLOAT:
+      return 4;
+    case GUM_MEMORY_VALUE_S64:
+    case GUM_MEMORY_VALUE_U64:
+    case GUM_MEMORY_VALUE_DOUBLE:
+      return 8;
+    case GUM_MEMORY_VALUE_LONG:
+    case GUM_MEMORY_VALUE_ULONG:
+      return sizeof (glong);
+    default:
+      return 0;
+  }
+}
+
+static Local<Value>
+gum_v8_memory_scalar_new (GumMemoryValueType type,
+                          gconstpointer data,
+                          GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  switch (type)
+  {
+    case GUM_MEMORY_VALUE_POINTER:
+      return _gum_v8_native_pointer_new (*((const gpointer *) data), core);
+    case GUM_MEMORY_VALUE_S8:
+      return Integer::New (isolate, *((const gint8 *) data));
+    case GUM_MEMORY_VALUE_U8:
+      return Integer::NewFromUnsigned (isolate, *((const guint8 *) data));
+    case GUM_MEMORY_VALUE_S16:
+      return Integer::New (isolate, *((const gint16 *) data));
+    case GUM_MEMORY_VALUE_U16:
+      return Integer::NewFromUnsigned (isolate, *((const guint16 *) data));
+    case GUM_MEMORY_VALUE_S32:
+      return Integer::New (isolate, *((const gint32 *) data));
+    case GUM_MEMORY_VALUE_U32:
+      return Integer::NewFromUnsigned (isolate, *((const guint32 *) data));
+    case GUM_MEMORY_VALUE_S64:
+      return _gum_v8_int64_new (*((const gint64 *) data), core);
+    case GUM_MEMORY_VALUE_U64:
+      return _gum_v8_uint64_new (*((const guint64 *) data), core);
+    case GUM_MEMORY_VALUE_LONG:
+      return _gum_v8_int64_new (*((const glong *) data), core);
+    case GUM_MEMORY_VALUE_ULONG:
+      return _gum_v8_uint64_new (*((const gulong *) data), core);
+    case GUM_MEMORY_VALUE_FLOAT:
+      return Number::New (isolate, *((const gfloat *) data));
+    case GUM_MEMORY_VALUE_DOUBLE:
+      return Number::New (isolate, *((const gdouble *) data));
+    default:
+      g_assert_not_reached ();
+  }
+
+  return Local<Value> ();
+}
+
 static void
 gum_v8_memory_write (GumMemoryValueType type,
                      const GumV8Args * args)
@@ -847,39 +1064,33 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan)
 {
   gpointer address;
   gsize size;
-  gchar * match_str;
+  Local<Value> match_value;
   Local<Function> on_match, on_error, on_complete;
-  if (!_gum_v8_args_parse (args, "pZsF{onMatch,onError?,onComplete}",
-      &address, &size, &match_str, &on_match, &on_error, &on_complete))
+  if (!_gum_v8_args_parse (args, "pZVF{onMatch,onError?,onComplete}",
+      &address, &size, &match_value, &on_match, &on_error, &on_complete))
     return;
 
   GumMemoryRange range;
   range.base_address = GUM_ADDRESS (address);
   range.size = size;
 
-  auto pattern = gum_match_pattern_new_from_string (match_str);
-
-  g_free (match_str);
-
-  if (pattern != NULL)
-  {
-    auto ctx = g_slice_new0 (GumMemoryScanContext);
-    ctx->range = range;
-    ctx->pattern = pattern;
-    ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
-    if (!on_error.IsEmpty ())
-      ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
-    ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
-    ctx->core = core;
+  gboolean is_multi;
+  auto patterns = gum_parse_match_patterns (match_value, &is_multi, core);
+  if (patterns == NULL)
+    return;
 
-    _gum_v8_core_pin (core);
-    _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
-        ctx, (GDestroyNotify) gum_memory_scan_context_free);
-  }
-  else
-  {
-    _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
-  }
+  auto ctx = g_slice_new0 (GumMemoryScanContext);
+  ctx->range = range;
+  ctx->patterns = patterns;
+  ctx->on_match = new GumPersistent<Function>::type (isolate, on_match);
+  if (!on_error.IsEmpty ())
+    ctx->on_error = new GumPersistent<Function>::type (isolate, on_error);
+  ctx->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+  ctx->core = core;
+
+  _gum_v8_core_pin (core);
+  _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scan_context_run,
+      ctx, (GDestroyNotify) gum_memory_scan_context_free);
 }
 
 static void
@@ -887,7 +1098,7 @@ gum_memory_scan_context_free (GumMemoryScanContext * self)
 {
   auto core = self->core;
 
-  gum_match_pattern_free (self->pattern);
+  g_ptr_array_unref (self->patterns);
 
   {
     ScriptScope script_scope (core->script);
@@ -911,21 +1122,20 @@ static void
 gum_memory_scan_context_run (GumMemoryScanContext * self)
 {
   auto core = self->core;
-  auto exceptor = core->exceptor;
   auto isolate = core->isolate;
-  GumExceptorScope scope;
+  GumExceptionDetails fault;
 
-  if (gum_exceptor_try (exceptor, &scope))
-  {
-    gum_memory_scan (&self->range, self->pattern,
-        (GumMemoryScanMatchFunc) gum_memory_scan_context_emit_match, self);
-  }
+  gboolean success = gum_memory_scan_ranges (&self->range, 1,
+      (const GumMatchPattern * const *) self->patterns->pdata,
+      self->patterns->len, 0, GUM_MEMORY_SCAN_ORDERED,
+      (GumMemoryScanMultiMatchFunc) gum_memory_scan_context_emit_match,
+      self, &fault);
 
-  if (gum_exceptor_catch (exceptor, &scope) && self->on_error != nullptr)
+  if (!success && self->on_error != nullptr)
   {
     ScriptScope script_scope (core->script);
 
-    auto message = gum_exception_details_to_string (&scope.exception);
+    auto message = gum_exception_details_to_string (&fault);
 
     auto on_error = Local<Function>::New (isolate, *self->on_error);
     Handle<Value> argv[] = { String::NewFromUtf8 (isolate, message) };
@@ -945,6 +1155,7 @@ gum_memory_scan_context_run (GumMemoryScanContext * self)
 static gboolean
 gum_memory_scan_context_emit_match (GumAddress address,
                                     gsize size,
+                                    guint pattern_index,
                                     GumMemoryScanContext * self)
 {
   ScriptScope scope (self->core->script);
@@ -953,7 +1164,8 @@ gum_memory_scan_context_emit_match (GumAddress address,
   auto on_match = Local<Function>::New (isolate, *self->on_match);
   Handle<Value> argv[] = {
     _gum_v8_native_pointer_new (GSIZE_TO_POINTER (address), self->core),
-    Integer::NewFromUnsigned (isolate, size)
+    Integer::NewFromUnsigned (isolate, size),
+    Integer::NewFromUnsigned (isolate, pattern_index)
   };
   auto result = on_match->Call (Undefined (isolate), G_N_ELEMENTS (argv), argv);
 
@@ -967,41 +1179,391 @@ gum_memory_scan_context_emit_match (GumAddress address,
   return proceed;
 }
 
-GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
+/*
+ * Scans on the thread pool like scan(), but rather than calling into JS for
+ * every match, the matches are queued up and handed out in chunks as the
+ * script asks for them through read(). Once the queue is full the scan waits
+ * for the script to catch up, and cancel() makes it stop at the next match.
+ *
+ * The wrapper and the scan job each hold a reference. A read() that has to
+ * wait pins the script until it gets its answer, so the job only ever calls
+ * into JS while the script is guaranteed to be around.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_memory_open_scan)
 {
   gpointer address;
   gsize size;
-  gchar * match_str;
-  if (!_gum_v8_args_parse (args, "pZs", &address, &size, &match_str))
+  Local<Value> match_value;
+  guint chunk_size;
+  if (!_gum_v8_args_parse (args, "pZVu", &address, &size, &match_value,
+      &chunk_size))
     return;
 
-  GumMemoryRange range;
-  range.base_address = GUM_ADDRESS (address);
-  range.size = size;
+  if (chunk_size == 0 || chunk_size > G_MAXUINT / 4)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid chunk size");
+    return;
+  }
+
+  gboolean is_multi;
+  auto patterns = gum_parse_match_patterns (match_value, &is_multi, core);
+  if (patterns == NULL)
+    return;
+
+  auto constructor = Local<FunctionTemplate>::New (isolate, *module->scanner);
+  auto object = constructor->GetFunction ()->NewInstance (
+      isolate->GetCurrentContext (), 0, nullptr).ToLocalChecked ();
+
+  auto scanner = g_slice_new0 (GumMemoryScanner);
+  scanner->ref_count = 1;
+  scanner->wrapper = new GumPersistent<Object>::type (isolate, object);
+  scanner->wrapper->MarkIndependent ();
+  scanner->wrapper->SetWeak (scanner, gum_memory_scanner_on_weak_notify,
+      WeakCallbackType::kParameter);
+
+  scanner->range.base_address = GUM_ADDRESS (address);
+  scanner->range.size = size;
+  scanner->patterns = patterns;
+  scanner->report_pattern_index = is_multi;
+  scanner->chunk_size = chunk_size;
+
+  g_mutex_init (&scanner->mutex);
+  g_cond_init (&scanner->cond);
+  scanner->queue_capacity = 4 * chunk_size;
+  scanner->queue = g_new (GumMemoryScanMatch, scanner->queue_capacity);
+
+  scanner->module = module;
 
-  auto pattern = gum_match_pattern_new_from_string (match_str);
+  object->SetAlignedPointerInInternalField (0, scanner);
 
-  g_free (match_str);
+  g_hash_table_add (module->scanners, scanner);
 
-  if (pattern == NULL)
+  _gum_v8_core_push_job (core, (GumScriptJobFunc) gum_memory_scanner_run,
+      gum_memory_scanner_ref (scanner),
+      (GDestroyNotify) gum_memory_scanner_unref);
+
+  info.GetReturnValue ().Set (object);
+}
+
+static GumMemoryScanner *
+gum_memory_scanner_ref (GumMemoryScanner * self)
+{
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+static void
+gum_memory_scanner_unref (GumMemoryScanner * self)
+{
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_free (self->error);
+  g_free (self->queue);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->mutex);
+  g_ptr_array_unref (self->patterns);
+
+  g_slice_free (GumMemoryScanner, self);
+}
+
+/*
+ * Called with the isolate locked when the wrapper goes away, which also
+ * means nobody is waiting in read(): a pending read() keeps the wrapper
+ * reachable, and pins the script so it cannot be disposed.
+ */
+static void
+gum_memory_scanner_release (GumMemoryScanner * self)
+{
+  GumPersistent<Function>::type * on_read;
+
+  g_mutex_lock (&self->mutex);
+  self->cancelled = TRUE;
+  on_read = self->on_read;
+  self->on_read = nullptr;
+  self->queue_length = 0;
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->mutex);
+
+  if (on_read != nullptr)
+  {
+    delete on_read;
+    _gum_v8_core_unpin (self->module->core);
+  }
+
+  delete self->wrapper;
+  self->wrapper = nullptr;
+
+  gum_memory_scanner_unref (self);
+}
+
+static void
+gum_memory_scanner_on_weak_notify (
+    const WeakCallbackInfo<GumMemoryScanner> & info)
+{
+  HandleScope handle_scope (info.GetIsolate ());
+  auto self = info.GetParameter ();
+  g_hash_table_remove (self->module->scanners, self);
+}
+
+static void
+gum_memory_scanner_run (GumMemoryScanner * self)
+{
+  GumExceptionDetails fault;
+
+  gboolean success = gum_memory_scan_ranges (&self->range, 1,
+      (const GumMatchPattern * const *) self->patterns->pdata,
+      self->patterns->len, 0, GUM_MEMORY_SCAN_ORDERED,
+      (GumMemoryScanMultiMatchFunc) gum_memory_scanner_push_match, self,
+      &fault);
+
+  g_mutex_lock (&self->mutex);
+
+  self->finished = TRUE;
+  if (!success && !self->cancelled)
+    self->error = gum_exception_details_to_string (&fault);
+
+  auto on_read = self->on_read;
+  self->on_read = nullptr;
+
+  GArray * matches = nullptr;
+  gboolean done = FALSE;
+  gchar * error = nullptr;
+  if (on_read != nullptr)
+  {
+    matches = gum_memory_scanner_pop_chunk (self);
+    done = self->queue_length == 0;
+    if (done)
+      error = g_strdup (self->error);
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (on_read != nullptr)
+  {
+    gum_memory_scanner_deliver (self, on_read, matches, done, error);
+    g_free (error);
+  }
+}
+
+static gboolean
+gum_memory_scanner_push_match (GumAddress address,
+                               gsize size,
+                               guint pattern_index,
+                               GumMemoryScanner * self)
+{
+  g_mutex_lock (&self->mutex);
+
+  while (self->queue_length == self->queue_capacity && !self->cancelled)
+    g_cond_wait (&self->cond, &self->mutex);
+
+  if (self->cancelled)
   {
-    _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+    g_mutex_unlock (&self->mutex);
+    return FALSE;
+  }
+
+  auto match = &self->queue[
+      (self->queue_head + self->queue_length) % self->queue_capacity];
+  match->address = address;
+  match->size = size;
+  match->pattern_index = pattern_index;
+  self->queue_length++;
+
+  GumPersistent<Function>::type * on_read = nullptr;
+  GArray * matches = nullptr;
+  if (self->on_read != nullptr && self->queue_length >= self->chunk_size)
+  {
+    on_read = self->on_read;
+    self->on_read = nullptr;
+    matches = gum_memory_scanner_pop_chunk (self);
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  if (on_read != nullptr)
+    gum_memory_scanner_deliver (self, on_read, matches, FALSE, NULL);
+
+  return TRUE;
+}
+
+/* Must be called with the mutex held. */
+static GArray *
+gum_memory_scanner_pop_chunk (GumMemoryScanner * self)
+{
+  auto n = MIN (self->queue_length, self->chunk_size);
+
+  auto matches = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryScanMatch),
+      n);
+
+  for (guint i = 0; i != n; i++)
+  {
+    g_array_append_val (matches, self->queue[self->queue_head]);
+    self->queue_head = (self->queue_head + 1) % self->queue_capacity;
+  }
+  self->queue_length -= n;
+
+  g_cond_broadcast (&self->cond);
+
+  return matches;
+}
+
+/*
+ * Answers a read() that had to wait, from the scan job's thread. Takes
+ * ownership of `on_read` and `matches`.
+ */
+static void
+gum_memory_scanner_deliver (GumMemoryScanner * self,
+                            GumPersistent<Function>::type * on_read,
+                            GArray * matches,
+                            gboolean done,
+                            const gchar * error)
+{
+  auto core = self->module->core;
+
+  ScriptScope scope (core->script);
+
+  auto callback = Local<Function>::New (core->isolate, *on_read);
+  delete on_read;
+
+  gum_memory_scanner_call (self, callback, matches, done, error);
+
+  _gum_v8_core_unpin (core);
+}
+
+/*
+ * Calls `callback` as callback(error, matches, done). Takes ownership of
+ * `matches`.
+ */
+static void
+gum_memory_scanner_call (GumMemoryScanner * self,
+                         Local<Function> callback,
+                         GArray * matches,
+                         gboolean done,
+                         const gchar * error)
+{
+  auto core = self->module->core;
+  auto isolate = core->isolate;
+  auto context = isolate->GetCurrentContext ();
+
+  auto values = Array::New (isolate, matches->len);
+  for (guint i = 0; i != matches->len; i++)
+  {
+    auto m = &g_array_index (matches, GumMemoryScanMatch, i);
+
+    auto match = Object::New (isolate);
+    _gum_v8_object_set_pointer (match, "address", m->address, core);
+    _gum_v8_object_set_uint (match, "size", m->size, core);
+    if (self->report_pattern_index)
+      _gum_v8_object_set_uint (match, "pattern", m->pattern_index, core);
+    values->Set (context, i, match).ToChecked ();
+  }
+
+  g_array_free (matches, TRUE);
+
+  Handle<Value> argv[] = {
+    (error != NULL)
+        ? Local<Value> (String::NewFromUtf8 (isolate, error))
+        : Local<Value> (Null (isolate)),
+    values,
+    Boolean::New (isolate, done)
+  };
+  callback->Call (Undefined (isolate), G_N_ELEMENTS (argv), argv);
+}
+
+GUMJS_DEFINE_CLASS_METHOD (gumjs_memory_scanner_read, GumMemoryScanner)
+{
+  Local<Function> callback;
+  if (!_gum_v8_args_parse (args, "F", &callback))
+    return;
+
+  g_mutex_lock (&self->mutex);
+
+  if (self->on_read != nullptr)
+  {
+    g_mutex_unlock (&self->mutex);
+    _gum_v8_throw_ascii_literal (isolate, "a read is already pending");
     return;
   }
 
+  if (!self->cancelled && !self->finished &&
+      self->queue_length < self->chunk_size)
+  {
+    self->on_read = new GumPersistent<Function>::type (isolate, callback);
+    _gum_v8_core_pin (core);
+    g_mutex_unlock (&self->mutex);
+    return;
+  }
+
+  auto matches = gum_memory_scanner_pop_chunk (self);
+  gboolean done = self->cancelled ||
+      (self->finished && self->queue_length == 0);
+  gchar * error = (done && !self->cancelled) ? g_strdup (self->error) : NULL;
+
+  g_mutex_unlock (&self->mutex);
+
+  gum_memory_scanner_call (self, callback, matches, done, error);
+
+  g_free (error);
+}
+
+GUMJS_DEFINE_CLASS_METHOD (gumjs_memory_scanner_cancel, GumMemoryScanner)
+{
+  g_mutex_lock (&self->mutex);
+
+  self->cancelled = TRUE;
+  self->queue_length = 0;
+  g_cond_broadcast (&self->cond);
+
+  auto on_read = self->on_read;
+  self->on_read = nullptr;
+
+  g_mutex_unlock (&self->mutex);
+
+  if (on_read != nullptr)
+  {
+    auto callback = Local<Function>::New (isolate, *on_read);
+    delete on_read;
+    _gum_v8_core_unpin (core);
+
+    gum_memory_scanner_call (self, callback,
+        g_array_new (FALSE, FALSE, sizeof (GumMemoryScanMatch)), TRUE, NULL);
+  }
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
+{
+  gpointer address;
+  gsize size;
+  Local<Value> match_value;
+  if (!_gum_v8_args_parse (args, "pZV", &address, &size, &match_value))
+    return;
+
+  GumMemoryRange range;
+  range.base_address = GUM_ADDRESS (address);
+  range.size = size;
+
+  gboolean is_multi;
+  auto patterns = gum_parse_match_patterns (match_value, &is_multi, core);
+  if (patterns == NULL)
+    return;
+
   GumMemoryScanSyncContext ctx;
   ctx.matches = Array::New (isolate);
+  ctx.report_pattern_index = is_multi;
   ctx.core = core;
 
   GumExceptorScope scope;
 
   if (gum_exceptor_try (core->exceptor, &scope))
   {
-    gum_memory_scan (&range, pattern, (GumMemoryScanMatchFunc) gum_append_match,
-        &ctx);
+    gum_memory_scan_multi (&range,
+        (const GumMatchPattern * const *) patterns->pdata, patterns->len,
+        (GumMemoryScanMultiMatchFunc) gum_append_match, &ctx);
   }
 
-  gum_match_pattern_free (pattern);
+  g_ptr_array_unref (patterns);
 
   if (gum_exceptor_catch (core->exceptor, &scope))
   {
@@ -1016,6 +1578,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_memory_scan_sync)
 static gboolean
 gum_append_match (GumAddress address,
                   gsize size,
+                  guint pattern_index,
                   GumMemoryScanSyncContext * ctx)
 {
   GumV8Core * core = ctx->core;
@@ -1023,12 +1586,88 @@ gum_append_match (GumAddress address,
   auto match = Object::New (core->isolate);
   _gum_v8_object_set_pointer (match, "address", address, core);
   _gum_v8_object_set_uint (match, "size", size, core);
+  if (ctx->report_pattern_index)
+    _gum_v8_object_set_uint (match, "pattern", pattern_index, core);
   ctx->matches->Set (core->isolate->GetCurrentContext (),
       ctx->matches->Length (), match).ToChecked ();
 
   return TRUE;
 }
 
+/*
+ * Accepts either a single pattern string, or an array of them to be scanned
+ * for in one pass. Throws and returns NULL if any of them is invalid.
+ */
+static GPtrArray *
+gum_parse_match_patterns (Handle<Value> value,
+                          gboolean * is_multi,
+                          GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  auto patterns = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_match_pattern_free);
+
+  Local<Array> strings;
+  if (value->IsString ())
+  {
+    *is_multi = FALSE;
+  }
+  else if (value->IsArray ())
+  {
+    *is_multi = TRUE;
+    strings = value.As<Array> ();
+  }
+  else
+  {
+    _gum_v8_throw_ascii_literal (isolate,
+        "expected a string or an array of strings");
+    goto invalid_argument;
+  }
+
+  {
+    auto context = isolate->GetCurrentContext ();
+    uint32_t n = *is_multi ? strings->Length () : 1;
+
+    for (uint32_t i = 0; i != n; i++)
+    {
+      Local<Value> element;
+      if (*is_multi)
+      {
+        if (!strings->Get (context, i).ToLocal (&element))
+          goto invalid_argument;
+      }
+      else
+      {
+        element = value;
+      }
+
+      if (!element->IsString ())
+      {
+        _gum_v8_throw_ascii_literal (isolate, "expected a string");
+        goto invalid_argument;
+      }
+
+      String::Utf8Value str (element);
+      auto pattern = gum_match_pattern_new_from_string (*str);
+      if (pattern == NULL)
+      {
+        _gum_v8_throw_ascii_literal (isolate, "invalid match pattern");
+        goto invalid_argument;
+      }
+      g_ptr_array_add (patterns, pattern);
+    }
+  }
+
+  return patterns;
+
+invalid_argument:
+  {
+    g_ptr_array_unref (patterns);
+    return NULL;
+  }
+}
+
 #ifdef _MSC_VER
 # pragma warning (pop)
 #endif
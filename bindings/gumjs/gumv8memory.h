@@ -7,6 +7,7 @@
 #ifndef __GUM_V8_MEMORY_H__
 #define __GUM_V8_MEMORY_H__
 
+#include "gummemorypool.h"
 #include "gumv8core.h"
 
 #include <gum/gummemoryaccessmonitor.h>
@@ -15,6 +16,13 @@ struct GumV8Memory
 {
   GumV8Core * core;
 
+  GumMemoryPool * pool;
+  GumMemoryArena * arena;
+  guint arena_depth;
+
+  GHashTable * scanners;
+  GumPersistent<v8::FunctionTemplate>::type * scanner;
+
   GumMemoryAccessMonitor * monitor;
   GumPersistent<v8::Function>::type * on_access;
 };
@@ -7,12 +7,16 @@
 #include "gumv8module.h"
 
 #include "gumv8macros.h"
+#include "gumv8scope.h"
 
 #include <gum/gum-init.h>
+#include <gum/gummodulesnapshot.h>
 #include <string.h>
 
 #define GUMJS_MODULE_NAME Module
 
+#define GUM_MATCH_BATCH_SIZE 256
+
 using namespace v8;
 
 struct GumV8ImportsContext
@@ -35,6 +39,15 @@ struct GumV8ImportsContext
   gboolean has_pending_exception;
 };
 
+struct GumV8EnumerateExportsJob
+{
+  gchar * module_name;
+  GumPersistent<Function>::type * on_match;
+  GumPersistent<Function>::type * on_complete;
+
+  GumV8Module * module;
+};
+
 struct GumV8ExportsContext
 {
   Local<Function> on_match;
@@ -63,11 +76,33 @@ struct GumV8MatchContext
   gboolean has_pending_exception;
 };
 
+struct GumV8ModuleTable
+{
+  GString * names;
+  GArray * name_offsets;
+  GArray * addresses;
+  GArray * types;
+
+  GArray * globals;
+  GArray * section_indices;
+  GHashTable * section_ids;
+  GPtrArray * sections;
+};
+
+struct GumV8ModuleTableSection
+{
+  gchar * id;
+  GumPageProtection prot;
+};
+
 struct GumV8ModuleMap
 {
   GumPersistent<Object>::type * wrapper;
   GumModuleMap * handle;
 
+  GPtrArray * names;
+  GPtrArray * paths;
+
   GumV8Module * module;
 };
 
@@ -83,28 +118,61 @@ GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_imports)
 static gboolean gum_emit_import (const GumImportDetails * details,
     GumV8ImportsContext * mc);
 GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_exports)
+static void gum_v8_exports_context_init (GumV8ExportsContext * ec,
+    Local<Function> on_match, Local<Function> on_complete,
+    GumV8Module * module);
 static gboolean gum_emit_export (const GumExportDetails * details,
     GumV8ExportsContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_exports_async)
+static void gum_v8_enumerate_exports_job_free (
+    GumV8EnumerateExportsJob * self);
+static void gum_v8_enumerate_exports_job_run (
+    GumV8EnumerateExportsJob * self);
+static gboolean gum_copy_export (const GumExportDetails * details,
+    GArray * exports);
+static void gum_export_details_clear (GumExportDetails * details);
 GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_symbols)
 static gboolean gum_emit_symbol (const GumSymbolDetails * details,
     GumV8MatchContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_exports_table)
+static gboolean gum_collect_export (const GumExportDetails * details,
+    GumV8ModuleTable * table);
+GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_symbols_table)
+static gboolean gum_collect_symbol (const GumSymbolDetails * details,
+    GumV8ModuleTable * table);
 GUMJS_DECLARE_FUNCTION (gumjs_module_enumerate_ranges)
 static gboolean gum_emit_range (const GumRangeDetails * details,
     GumV8MatchContext * mc);
 GUMJS_DECLARE_FUNCTION (gumjs_module_find_base_address)
 GUMJS_DECLARE_FUNCTION (gumjs_module_find_export_by_name)
 
+static void gum_v8_module_table_init (GumV8ModuleTable * table,
+    gboolean with_symbol_columns);
+static void gum_v8_module_table_add (GumV8ModuleTable * table,
+    const gchar * name, GumAddress address, guint8 type);
+static Local<Object> gum_v8_module_table_finish (GumV8ModuleTable * table,
+    GumV8Core * core);
+static void gum_v8_module_table_section_free (
+    GumV8ModuleTableSection * section);
+static Local<ArrayBuffer> gum_v8_array_buffer_steal (GArray * array,
+    Isolate * isolate);
+
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_module_map_construct)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_has)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_find)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_find_name)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_find_path)
+GUMJS_DECLARE_FUNCTION (gumjs_module_map_annotate)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_update)
 GUMJS_DECLARE_FUNCTION (gumjs_module_map_copy_values)
 
 static GumV8ModuleMap * gum_v8_module_map_new (Handle<Object> wrapper,
     GumModuleMap * handle, GumV8Module * module);
 static void gum_v8_module_map_free (GumV8ModuleMap * self);
+static Local<String> gum_v8_module_map_get_string (GumV8ModuleMap * self,
+    GPtrArray * cache, const GumModuleDetails * details, const gchar * str,
+    Isolate * isolate);
+static void gum_v8_module_map_string_free (GumPersistent<String>::type * str);
 static void gum_v8_module_map_on_weak_notify (
     const WeakCallbackInfo<GumV8ModuleMap> & info);
 
@@ -116,8 +184,11 @@ static const GumV8Function gumjs_module_functions[] =
 {
   { "ensureInitialized", gumjs_module_ensure_initialized },
   { "enumerateImports", gumjs_module_enumerate_imports },
-  { "enumerateExports", gumjs_module_enumerate_exports },
+  { "enumerateExports", gumjs_module_enumerate_exports_async },
+  { "_enumerateExports", gumjs_module_enumerate_exports },
   { "enumerateSymbols", gumjs_module_enumerate_symbols },
+  { "_enumerateExportsTable", gumjs_module_enumerate_exports_table },
+  { "_enumerateSymbolsTable", gumjs_module_enumerate_symbols_table },
   { "enumerateRanges", gumjs_module_enumerate_ranges },
   { "findBaseAddress", gumjs_module_find_base_address },
   { "findExportByName", gumjs_module_find_export_by_name },
@@ -131,6 +202,7 @@ static const GumV8Function gumjs_module_map_functions[] =
   { "find", gumjs_module_map_find },
   { "findName", gumjs_module_map_find_name },
   { "findPath", gumjs_module_map_find_path },
+  { "annotate", gumjs_module_map_annotate },
   { "update", gumjs_module_map_update },
   { "values", gumjs_module_map_copy_values },
 
@@ -364,22 +436,13 @@ gum_emit_import (const GumImportDetails * details,
 GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_exports)
 {
   gchar * name;
-  GumV8ExportsContext ec;
-  if (!_gum_v8_args_parse (args, "sF{onMatch,onComplete}", &name, &ec.on_match,
-      &ec.on_complete))
+  Local<Function> on_match, on_complete;
+  if (!_gum_v8_args_parse (args, "sF{onMatch,onComplete}", &name, &on_match,
+      &on_complete))
     return;
-  ec.receiver = Undefined (isolate);
-
-  ec.exp = Local<Object>::New (isolate, *module->export_value);
-  ec.type = Local<String>::New (isolate, *module->type_key);
-  ec.name = Local<String>::New (isolate, *module->name_key);
-  ec.address = Local<String>::New (isolate, *module->address_key);
-  ec.variable = Local<String>::New (isolate, *module->variable_value);
 
-  ec.core = core;
-  ec.context = isolate->GetCurrentContext ();
-
-  ec.has_pending_exception = FALSE;
+  GumV8ExportsContext ec;
+  gum_v8_exports_context_init (&ec, on_match, on_complete, module);
 
   gum_module_enumerate_exports (name, (GumFoundExportFunc) gum_emit_export,
       &ec);
@@ -392,6 +455,30 @@ GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_exports)
   g_free (name);
 }
 
+static void
+gum_v8_exports_context_init (GumV8ExportsContext * ec,
+                             Local<Function> on_match,
+                             Local<Function> on_complete,
+                             GumV8Module * module)
+{
+  auto isolate = module->core->isolate;
+
+  ec->on_match = on_match;
+  ec->on_complete = on_complete;
+  ec->receiver = Undefined (isolate);
+
+  ec->exp = Local<Object>::New (isolate, *module->export_value);
+  ec->type = Local<String>::New (isolate, *module->type_key);
+  ec->name = Local<String>::New (isolate, *module->name_key);
+  ec->address = Local<String>::New (isolate, *module->address_key);
+  ec->variable = Local<String>::New (isolate, *module->variable_value);
+
+  ec->core = module->core;
+  ec->context = isolate->GetCurrentContext ();
+
+  ec->has_pending_exception = FALSE;
+}
+
 static gboolean
 gum_emit_export (const GumExportDetails * details,
                  GumV8ExportsContext * ec)
@@ -429,6 +516,111 @@ gum_emit_export (const GumExportDetails * details,
   return proceed;
 }
 
+/*
+ * Collects the exports on the thread pool, and only locks the isolate to hand
+ * over one batch of them at a time, so the JS thread gets to run other
+ * callbacks in between.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_exports_async)
+{
+  gchar * name;
+  Local<Function> on_match, on_complete;
+  if (!_gum_v8_args_parse (args, "sF{onMatch,onComplete}", &name, &on_match,
+      &on_complete))
+    return;
+
+  auto job = g_slice_new (GumV8EnumerateExportsJob);
+  job->module_name = name;
+  job->on_match = new GumPersistent<Function>::type (isolate, on_match);
+  job->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+  job->module = module;
+
+  _gum_v8_core_pin (core);
+  _gum_v8_core_push_job (core,
+      (GumScriptJobFunc) gum_v8_enumerate_exports_job_run, job,
+      (GDestroyNotify) gum_v8_enumerate_exports_job_free);
+}
+
+static void
+gum_v8_enumerate_exports_job_free (GumV8EnumerateExportsJob * self)
+{
+  auto core = self->module->core;
+
+  g_free (self->module_name);
+
+  {
+    ScriptScope script_scope (core->script);
+
+    delete self->on_match;
+    delete self->on_complete;
+
+    _gum_v8_core_unpin (core);
+  }
+
+  g_slice_free (GumV8EnumerateExportsJob, self);
+}
+
+static void
+gum_v8_enumerate_exports_job_run (GumV8EnumerateExportsJob * self)
+{
+  auto core = self->module->core;
+  auto isolate = core->isolate;
+
+  auto exports = g_array_new (FALSE, FALSE, sizeof (GumExportDetails));
+  g_array_set_clear_func (exports, (GDestroyNotify) gum_export_details_clear);
+  gum_module_enumerate_exports (self->module_name,
+      (GumFoundExportFunc) gum_copy_export, exports);
+
+  guint i = 0;
+  gboolean finished = FALSE;
+
+  while (!finished)
+  {
+    ScriptScope script_scope (core->script);
+
+    GumV8ExportsContext ec;
+    gum_v8_exports_context_init (&ec,
+        Local<Function>::New (isolate, *self->on_match),
+        Local<Function>::New (isolate, *self->on_complete), self->module);
+
+    auto end = MIN (i + GUM_MATCH_BATCH_SIZE, exports->len);
+    gboolean proceed = TRUE;
+    while (proceed && i != end)
+    {
+      proceed = gum_emit_export (
+          &g_array_index (exports, GumExportDetails, i++), &ec);
+    }
+
+    finished = !proceed || i == exports->len;
+
+    if (finished && !ec.has_pending_exception)
+      ec.on_complete->Call (ec.receiver, 0, nullptr);
+  }
+
+  g_array_free (exports, TRUE);
+}
+
+static gboolean
+gum_copy_export (const GumExportDetails * details,
+                 GArray * exports)
+{
+  GumExportDetails copy;
+
+  copy.type = details->type;
+  copy.name = g_strdup (details->name);
+  copy.address = details->address;
+
+  g_array_append_val (exports, copy);
+
+  return TRUE;
+}
+
+static void
+gum_export_details_clear (GumExportDetails * details)
+{
+  g_free ((gchar *) details->name);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_symbols)
 {
   gchar * name;
@@ -492,6 +684,135 @@ gum_emit_symbol (const GumSymbolDetails * details,
   return proceed;
 }
 
+/*
+ * The table variants collect everything into flat columns and hand them over
+ * in one go, leaving it to the runtime to create wrapper objects on demand.
+ * This avoids a JS call and a handful of allocations per entry, which is
+ * what dominates on modules with hundreds of thousands of symbols.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_exports_table)
+{
+  gchar * name;
+  if (!_gum_v8_args_parse (args, "s", &name))
+    return;
+
+  GumV8ModuleTable table;
+  gum_v8_module_table_init (&table, FALSE);
+
+  gum_module_enumerate_exports (name, (GumFoundExportFunc) gum_collect_export,
+      &table);
+
+  auto result = gum_v8_module_table_finish (&table, core);
+
+  auto type_names = Array::New (isolate, GUM_EXPORT_VARIABLE + 1);
+  type_names->Set (GUM_EXPORT_FUNCTION,
+      _gum_v8_string_new_ascii (isolate, "function"));
+  type_names->Set (GUM_EXPORT_VARIABLE,
+      _gum_v8_string_new_ascii (isolate, "variable"));
+  _gum_v8_object_set (result, "typeNames", type_names, core);
+
+  info.GetReturnValue ().Set (result);
+
+  g_free (name);
+}
+
+static gboolean
+gum_collect_export (const GumExportDetails * details,
+                    GumV8ModuleTable * table)
+{
+  gum_v8_module_table_add (table, details->name, details->address,
+      details->type);
+
+  return TRUE;
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_symbols_table)
+{
+  gchar * name;
+  if (!_gum_v8_args_parse (args, "s", &name))
+    return;
+
+  GumV8ModuleTable table;
+  gum_v8_module_table_init (&table, TRUE);
+
+  gum_module_enumerate_symbols (name, (GumFoundSymbolFunc) gum_collect_symbol,
+      &table);
+
+  auto n_sections = table.sections->len;
+  auto sections = Array::New (isolate, n_sections);
+  for (guint i = 0; i != n_sections; i++)
+  {
+    auto s = (GumV8ModuleTableSection *) g_ptr_array_index (table.sections, i);
+
+    auto section = Object::New (isolate);
+    _gum_v8_object_set_ascii (section, "id", s->id, core);
+    _gum_v8_object_set_page_protection (section, "protection", s->prot, core);
+    sections->Set (i, section);
+  }
+
+  auto n = table.types->len;
+  auto globals = Uint8Array::New (
+      gum_v8_array_buffer_steal (table.globals, isolate), 0, n);
+  auto section_indices = Int32Array::New (
+      gum_v8_array_buffer_steal (table.section_indices, isolate), 0, n);
+  g_hash_table_unref (table.section_ids);
+  g_ptr_array_unref (table.sections);
+
+  auto result = gum_v8_module_table_finish (&table, core);
+
+  auto type_names = Array::New (isolate, GUM_SYMBOL_TLS + 1);
+  for (guint type = GUM_SYMBOL_UNKNOWN; type <= GUM_SYMBOL_TLS; type++)
+  {
+    type_names->Set (type, _gum_v8_string_new_ascii (isolate,
+        gum_symbol_type_to_string ((GumSymbolType) type)));
+  }
+  _gum_v8_object_set (result, "typeNames", type_names, core);
+
+  _gum_v8_object_set (result, "globals", globals, core);
+  _gum_v8_object_set (result, "sectionIndices", section_indices, core);
+  _gum_v8_object_set (result, "sections", sections, core);
+
+  info.GetReturnValue ().Set (result);
+
+  g_free (name);
+}
+
+static gboolean
+gum_collect_symbol (const GumSymbolDetails * details,
+                    GumV8ModuleTable * table)
+{
+  gum_v8_module_table_add (table, details->name, details->address,
+      details->type);
+
+  guint8 is_global = details->is_global;
+  g_array_append_val (table->globals, is_global);
+
+  gint32 section_index = -1;
+  auto s = details->section;
+  if (s != NULL)
+  {
+    gpointer index;
+    if (g_hash_table_lookup_extended (table->section_ids, s->id, NULL, &index))
+    {
+      section_index = GPOINTER_TO_INT (index);
+    }
+    else
+    {
+      auto section = g_slice_new (GumV8ModuleTableSection);
+      section->id = g_strdup (s->id);
+      section->prot = s->prot;
+
+      section_index = table->sections->len;
+      g_ptr_array_add (table->sections, section);
+      g_hash_table_insert (table->section_ids, section->id,
+          GINT_TO_POINTER (section_index));
+    }
+  }
+  g_array_append_val (table->section_indices, section_index);
+
+  return TRUE;
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_module_enumerate_ranges)
 {
   gchar * name;
@@ -574,7 +895,7 @@ GUMJS_DEFINE_FUNCTION (gumjs_module_find_export_by_name)
   {
     ScriptUnlocker unlocker (core);
 
-    address = gum_module_find_export_by_name (module_name, symbol_name);
+    address = gum_module_snapshot_lookup_export (module_name, symbol_name);
   }
 
   if (address != 0)
@@ -667,7 +988,8 @@ GUMJS_DEFINE_CLASS_METHOD (gumjs_module_map_find_name, GumV8ModuleMap)
     return;
   }
 
-  info.GetReturnValue ().Set (String::NewFromUtf8 (isolate, details->name));
+  info.GetReturnValue ().Set (gum_v8_module_map_get_string (self, self->names,
+      details, details->name, isolate));
 }
 
 GUMJS_DEFINE_CLASS_METHOD (gumjs_module_map_find_path, GumV8ModuleMap)
@@ -683,12 +1005,46 @@ GUMJS_DEFINE_CLASS_METHOD (gumjs_module_map_find_path, GumV8ModuleMap)
     return;
   }
 
-  info.GetReturnValue ().Set (String::NewFromUtf8 (isolate, details->path));
+  info.GetReturnValue ().Set (gum_v8_module_map_get_string (self, self->paths,
+      details, details->path, isolate));
+}
+
+/*
+ * Takes an ArrayBuffer of native pointers and returns one with an int32
+ * module index (into values(), or -1) and a uint32 offset for each of them.
+ */
+GUMJS_DEFINE_CLASS_METHOD (gumjs_module_map_annotate, GumV8ModuleMap)
+{
+  if (info.Length () < 1 || !info[0]->IsArrayBuffer ())
+  {
+    _gum_v8_throw_ascii_literal (isolate, "expected an ArrayBuffer");
+    return;
+  }
+
+  auto contents = info[0].As<ArrayBuffer> ()->GetContents ();
+  size_t size = contents.ByteLength ();
+  if (size % sizeof (gpointer) != 0)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid buffer shape");
+    return;
+  }
+
+  guint n = size / sizeof (gpointer);
+  auto result = ArrayBuffer::New (isolate, n * sizeof (GumModuleLocation));
+
+  gum_module_map_resolve_many (self->handle,
+      (const gpointer *) contents.Data (), n,
+      (GumModuleLocation *) result->GetContents ().Data ());
+
+  info.GetReturnValue ().Set (result);
 }
 
 GUMJS_DEFINE_CLASS_METHOD (gumjs_module_map_update, GumV8ModuleMap)
 {
   gum_module_map_update (self->handle);
+
+  g_ptr_array_set_size (self->names, 0);
+  g_ptr_array_set_size (self->paths, 0);
 }
 
 GUMJS_DEFINE_CLASS_METHOD (gumjs_module_map_copy_values, GumV8ModuleMap)
@@ -722,6 +1078,10 @@ gum_v8_module_map_new (Handle<Object> wrapper,
   map->wrapper->SetWeak (map, gum_v8_module_map_on_weak_notify,
       WeakCallbackType::kParameter);
   map->handle = handle;
+  map->names = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_v8_module_map_string_free);
+  map->paths = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_v8_module_map_string_free);
   map->module = module;
 
   g_hash_table_add (module->maps, map);
@@ -732,6 +1092,9 @@ gum_v8_module_map_new (Handle<Object> wrapper,
 static void
 gum_v8_module_map_free (GumV8ModuleMap * map)
 {
+  g_ptr_array_unref (map->paths);
+  g_ptr_array_unref (map->names);
+
   g_object_unref (map->handle);
 
   delete map->wrapper;
@@ -739,6 +1102,42 @@ gum_v8_module_map_free (GumV8ModuleMap * map)
   g_slice_free (GumV8ModuleMap, map);
 }
 
+/*
+ * Strings are created once per module and kept until the next update(),
+ * indexed by the module's position in the map, so repeated lookups of the
+ * same module hand back the same string instead of allocating.
+ */
+static Local<String>
+gum_v8_module_map_get_string (GumV8ModuleMap * self,
+                              GPtrArray * cache,
+                              const GumModuleDetails * details,
+                              const gchar * str,
+                              Isolate * isolate)
+{
+  auto values = gum_module_map_get_values (self->handle);
+  guint index = details - (const GumModuleDetails *) values->data;
+
+  if (cache->len != values->len)
+    g_ptr_array_set_size (cache, values->len);
+
+  auto entry = (GumPersistent<String>::type *) g_ptr_array_index (cache, index);
+  if (entry != NULL)
+    return Local<String>::New (isolate, *entry);
+
+  auto result = String::NewFromUtf8 (isolate, str,
+      NewStringType::kInternalized).ToLocalChecked ();
+  g_ptr_array_index (cache, index) =
+      new GumPersistent<String>::type (isolate, result);
+
+  return result;
+}
+
+static void
+gum_v8_module_map_string_free (GumPersistent<String>::type * str)
+{
+  delete str;
+}
+
 static void
 gum_v8_module_map_on_weak_notify (const WeakCallbackInfo<GumV8ModuleMap> & info)
 {
@@ -755,6 +1154,109 @@ gum_v8_module_filter_free (GumV8ModuleFilter * filter)
   g_slice_free (GumV8ModuleFilter, filter);
 }
 
+static void
+gum_v8_module_table_init (GumV8ModuleTable * table,
+                          gboolean with_symbol_columns)
+{
+  table->names = g_string_sized_new (4096);
+  table->name_offsets = g_array_sized_new (FALSE, FALSE, sizeof (guint32), 512);
+  table->addresses = g_array_sized_new (FALSE, FALSE, sizeof (guint32), 1024);
+  table->types = g_array_sized_new (FALSE, FALSE, sizeof (guint8), 512);
+
+  guint32 first_offset = 0;
+  g_array_append_val (table->name_offsets, first_offset);
+
+  if (with_symbol_columns)
+  {
+    table->globals = g_array_sized_new (FALSE, FALSE, sizeof (guint8), 512);
+    table->section_indices =
+        g_array_sized_new (FALSE, FALSE, sizeof (gint32), 512);
+    table->section_ids = g_hash_table_new (g_str_hash, g_str_equal);
+    table->sections = g_ptr_array_new_full (8,
+        (GDestroyNotify) gum_v8_module_table_section_free);
+  }
+  else
+  {
+    table->globals = NULL;
+    table->section_indices = NULL;
+    table->section_ids = NULL;
+    table->sections = NULL;
+  }
+}
+
+static void
+gum_v8_module_table_add (GumV8ModuleTable * table,
+                         const gchar * name,
+                         GumAddress address,
+                         guint8 type)
+{
+  /*
+   * Names become one-byte strings, just like in the callback-based API, so
+   * byte offsets are also character offsets on the JS side.
+   */
+  g_string_append (table->names, name);
+  guint32 end_offset = table->names->len;
+  g_array_append_val (table->name_offsets, end_offset);
+
+  /*
+   * Addresses are split into low and high halves so that they survive the
+   * trip through JS exactly, no matter the pointer size or byte order.
+   */
+  guint32 halves[2] = {
+    (guint32) (address & G_GUINT64_CONSTANT (0xffffffff)),
+    (guint32) (address >> 32)
+  };
+  g_array_append_vals (table->addresses, halves, G_N_ELEMENTS (halves));
+
+  g_array_append_val (table->types, type);
+}
+
+static Local<Object>
+gum_v8_module_table_finish (GumV8ModuleTable * table,
+                            GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  auto result = Object::New (isolate);
+
+  auto names = table->names;
+  _gum_v8_object_set (result, "names", String::NewFromOneByte (isolate,
+      (const uint8_t *) names->str, NewStringType::kNormal, names->len)
+      .ToLocalChecked (), core);
+  g_string_free (names, TRUE);
+
+  auto n = table->types->len;
+  _gum_v8_object_set (result, "nameOffsets", Uint32Array::New (
+      gum_v8_array_buffer_steal (table->name_offsets, isolate), 0, n + 1),
+      core);
+  _gum_v8_object_set (result, "addresses", Uint32Array::New (
+      gum_v8_array_buffer_steal (table->addresses, isolate), 0, n * 2),
+      core);
+  _gum_v8_object_set (result, "types", Uint8Array::New (
+      gum_v8_array_buffer_steal (table->types, isolate), 0, n), core);
+
+  return result;
+}
+
+static void
+gum_v8_module_table_section_free (GumV8ModuleTableSection * section)
+{
+  g_free (section->id);
+
+  g_slice_free (GumV8ModuleTableSection, section);
+}
+
+static Local<ArrayBuffer>
+gum_v8_array_buffer_steal (GArray * array,
+                           Isolate * isolate)
+{
+  auto size = array->len * g_array_get_element_size (array);
+  auto data = g_array_free (array, FALSE);
+
+  return ArrayBuffer::New (isolate, data, size,
+      ArrayBufferCreationMode::kInternalized);
+}
+
 static gboolean
 gum_v8_module_filter_matches (const GumModuleDetails * details,
                               GumV8ModuleFilter * self)
@@ -9,10 +9,13 @@
 #include "gumv8macros.h"
 #include "gumv8scope.h"
 
+#include <gum/gummodulesnapshot.h>
 #include <string.h>
 
 #define GUMJS_MODULE_NAME Process
 
+#define GUM_MATCH_BATCH_SIZE 256
+
 #if defined (HAVE_I386)
 # if GLIB_SIZEOF_VOID_P == 4
 #  define GUM_SCRIPT_ARCH "ia32"
@@ -54,6 +57,18 @@ struct GumV8MatchContext
   gboolean has_pending_exception;
 };
 
+struct GumV8EnumerateJob
+{
+  GumPageProtection prot;
+  GumPersistent<Function>::type * on_match;
+  GumPersistent<Function>::type * on_complete;
+
+  GumV8Core * core;
+};
+
+typedef gboolean (* GumV8EmitItemFunc) (gpointer items, guint index,
+    GumV8MatchContext * mc);
+
 GUMJS_DECLARE_FUNCTION (gumjs_process_is_debugger_attached)
 GUMJS_DECLARE_FUNCTION (gumjs_process_get_current_thread_id)
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_threads)
@@ -62,12 +77,29 @@ static gboolean gum_emit_thread (const GumThreadDetails * details,
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_modules)
 static gboolean gum_emit_module (const GumModuleDetails * details,
     GumV8MatchContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_modules_async)
+static void gum_v8_enumerate_job_run_modules (GumV8EnumerateJob * self);
+static gboolean gum_collect_module (const GumModuleDetails * details,
+    GPtrArray * modules);
+static gboolean gum_emit_collected_module (GPtrArray * modules, guint index,
+    GumV8MatchContext * mc);
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_ranges)
 static gboolean gum_emit_range (const GumRangeDetails * details,
     GumV8MatchContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_ranges_async)
+static void gum_v8_enumerate_job_run_ranges (GumV8EnumerateJob * self);
+static gboolean gum_emit_collected_range (GArray * entries, guint index,
+    GumV8MatchContext * mc);
+GUMJS_DECLARE_FUNCTION (gumjs_process_collect_ranges)
 GUMJS_DECLARE_FUNCTION (gumjs_process_enumerate_malloc_ranges)
 GUMJS_DECLARE_FUNCTION (gumjs_process_set_exception_handler)
 
+static GumV8EnumerateJob * gum_v8_enumerate_job_new (GumPageProtection prot,
+    Local<Function> on_match, Local<Function> on_complete, GumV8Core * core);
+static void gum_v8_enumerate_job_free (GumV8EnumerateJob * self);
+static void gum_v8_enumerate_job_emit (GumV8EnumerateJob * self,
+    gpointer items, guint n_items, GumV8EmitItemFunc emit);
+
 static GumV8ExceptionHandler * gum_v8_exception_handler_new (
     Handle<Function> callback, GumV8Core * core);
 static void gum_v8_exception_handler_free (
@@ -82,8 +114,11 @@ static const GumV8Function gumjs_process_functions[] =
   { "isDebuggerAttached", gumjs_process_is_debugger_attached },
   { "getCurrentThreadId", gumjs_process_get_current_thread_id },
   { "enumerateThreads", gumjs_process_enumerate_threads },
-  { "enumerateModules", gumjs_process_enumerate_modules },
+  { "enumerateModules", gumjs_process_enumerate_modules_async },
+  { "_enumerateModules", gumjs_process_enumerate_modules },
   { "_enumerateRanges", gumjs_process_enumerate_ranges },
+  { "_enumerateRangesAsync", gumjs_process_enumerate_ranges_async },
+  { "_collectRanges", gumjs_process_collect_ranges },
   { "enumerateMallocRanges", gumjs_process_enumerate_malloc_ranges },
   { "setExceptionHandler", gumjs_process_set_exception_handler },
 
@@ -211,7 +246,10 @@ GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_modules)
 
   mc.has_pending_exception = FALSE;
 
-  gum_process_enumerate_modules ((GumFoundModuleFunc) gum_emit_module, &mc);
+  auto snapshot = gum_module_snapshot_obtain ();
+  gum_module_snapshot_enumerate_modules (snapshot,
+      (GumFoundModuleFunc) gum_emit_module, &mc);
+  gum_module_snapshot_unref (snapshot);
 
   if (!mc.has_pending_exception)
   {
@@ -244,6 +282,59 @@ gum_emit_module (const GumModuleDetails * details,
   return proceed;
 }
 
+/*
+ * The asynchronous enumerations run on the thread pool, and only lock the
+ * isolate to hand over one batch of results at a time, so the JS thread gets
+ * to run other callbacks in between.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_modules_async)
+{
+  Local<Function> on_match, on_complete;
+  if (!_gum_v8_args_parse (args, "F{onMatch,onComplete}", &on_match,
+      &on_complete))
+    return;
+
+  auto job = gum_v8_enumerate_job_new (GUM_PAGE_NO_ACCESS, on_match,
+      on_complete, core);
+  _gum_v8_core_push_job (core,
+      (GumScriptJobFunc) gum_v8_enumerate_job_run_modules, job,
+      (GDestroyNotify) gum_v8_enumerate_job_free);
+}
+
+static void
+gum_v8_enumerate_job_run_modules (GumV8EnumerateJob * self)
+{
+  auto snapshot = gum_module_snapshot_obtain ();
+
+  auto modules = g_ptr_array_new ();
+  gum_module_snapshot_enumerate_modules (snapshot,
+      (GumFoundModuleFunc) gum_collect_module, modules);
+
+  gum_v8_enumerate_job_emit (self, modules, modules->len,
+      (GumV8EmitItemFunc) gum_emit_collected_module);
+
+  g_ptr_array_unref (modules);
+  gum_module_snapshot_unref (snapshot);
+}
+
+static gboolean
+gum_collect_module (const GumModuleDetails * details,
+                    GPtrArray * modules)
+{
+  g_ptr_array_add (modules, (gpointer) details);
+
+  return TRUE;
+}
+
+static gboolean
+gum_emit_collected_module (GPtrArray * modules,
+                           guint index,
+                           GumV8MatchContext * mc)
+{
+  return gum_emit_module (
+      (const GumModuleDetails *) g_ptr_array_index (modules, index), mc);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_ranges)
 {
   GumPageProtection prot;
@@ -302,6 +393,92 @@ gum_emit_range (const GumRangeDetails * details,
   return proceed;
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_process_enumerate_ranges_async)
+{
+  GumPageProtection prot;
+  Local<Function> on_match, on_complete;
+  if (!_gum_v8_args_parse (args, "mF{onMatch,onComplete}", &prot, &on_match,
+      &on_complete))
+    return;
+
+  auto job = gum_v8_enumerate_job_new (prot, on_match, on_complete, core);
+  _gum_v8_core_push_job (core,
+      (GumScriptJobFunc) gum_v8_enumerate_job_run_ranges, job,
+      (GDestroyNotify) gum_v8_enumerate_job_free);
+}
+
+static void
+gum_v8_enumerate_job_run_ranges (GumV8EnumerateJob * self)
+{
+  auto entries = gum_process_collect_ranges (self->prot);
+
+  gum_v8_enumerate_job_emit (self, entries, entries->len,
+      (GumV8EmitItemFunc) gum_emit_collected_range);
+
+  g_array_unref (entries);
+}
+
+static gboolean
+gum_emit_collected_range (GArray * entries,
+                          guint index,
+                          GumV8MatchContext * mc)
+{
+  auto e = &g_array_index (entries, GumRangeEntry, index);
+
+  GumRangeDetails details;
+  details.range = &e->range;
+  details.prot = e->prot;
+  details.file = (e->file.path != NULL) ? &e->file : NULL;
+
+  return gum_emit_range (&details, mc);
+}
+
+GUMJS_DEFINE_FUNCTION (gumjs_process_collect_ranges)
+{
+  GumPageProtection prot;
+  if (!_gum_v8_args_parse (args, "m", &prot))
+    return;
+
+  auto entries = gum_process_collect_ranges (prot);
+
+  auto ranges = Array::New (isolate, entries->len);
+
+  /* Paths are interned and neighbours tend to share one, so reuse it. */
+  const gchar * last_path = NULL;
+  Local<String> last_path_value;
+
+  for (guint i = 0; i != entries->len; i++)
+  {
+    auto e = &g_array_index (entries, GumRangeEntry, i);
+
+    auto range = Object::New (isolate);
+    _gum_v8_object_set_pointer (range, "base", e->range.base_address, core);
+    _gum_v8_object_set_uint (range, "size", e->range.size, core);
+    _gum_v8_object_set_page_protection (range, "protection", e->prot, core);
+
+    if (e->file.path != NULL)
+    {
+      if (e->file.path != last_path)
+      {
+        last_path = e->file.path;
+        last_path_value = String::NewFromUtf8 (isolate, last_path);
+      }
+
+      auto file = Object::New (isolate);
+      _gum_v8_object_set (file, "path", last_path_value, core);
+      _gum_v8_object_set_uint (file, "offset", e->file.offset, core);
+      _gum_v8_object_set_uint (file, "size", e->file.size, core);
+      _gum_v8_object_set (range, "file", file, core);
+    }
+
+    ranges->Set (i, range);
+  }
+
+  g_array_unref (entries);
+
+  info.GetReturnValue ().Set (ranges);
+}
+
 #if defined (G_OS_WIN32) || defined (HAVE_DARWIN)
 
 static gboolean gum_emit_malloc_range (const GumMallocRangeDetails * details,
@@ -381,6 +558,79 @@ GUMJS_DEFINE_FUNCTION (gumjs_process_set_exception_handler)
     gum_v8_exception_handler_free (old_handler);
 }
 
+static GumV8EnumerateJob *
+gum_v8_enumerate_job_new (GumPageProtection prot,
+                          Local<Function> on_match,
+                          Local<Function> on_complete,
+                          GumV8Core * core)
+{
+  auto isolate = core->isolate;
+
+  auto job = g_slice_new (GumV8EnumerateJob);
+  job->prot = prot;
+  job->on_match = new GumPersistent<Function>::type (isolate, on_match);
+  job->on_complete = new GumPersistent<Function>::type (isolate, on_complete);
+  job->core = core;
+
+  _gum_v8_core_pin (core);
+
+  return job;
+}
+
+static void
+gum_v8_enumerate_job_free (GumV8EnumerateJob * self)
+{
+  auto core = self->core;
+
+  {
+    ScriptScope script_scope (core->script);
+
+    delete self->on_match;
+    delete self->on_complete;
+
+    _gum_v8_core_unpin (core);
+  }
+
+  g_slice_free (GumV8EnumerateJob, self);
+}
+
+/*
+ * Calls onMatch for up to GUM_MATCH_BATCH_SIZE items per entry into the
+ * isolate, and onComplete once done, unless onMatch threw.
+ */
+static void
+gum_v8_enumerate_job_emit (GumV8EnumerateJob * self,
+                           gpointer items,
+                           guint n_items,
+                           GumV8EmitItemFunc emit)
+{
+  auto core = self->core;
+  auto isolate = core->isolate;
+  guint i = 0;
+  gboolean finished = FALSE;
+
+  while (!finished)
+  {
+    ScriptScope script_scope (core->script);
+
+    GumV8MatchContext mc;
+    mc.on_match = Local<Function>::New (isolate, *self->on_match);
+    mc.on_complete = Local<Function>::New (isolate, *self->on_complete);
+    mc.core = core;
+    mc.has_pending_exception = FALSE;
+
+    auto end = MIN (i + GUM_MATCH_BATCH_SIZE, n_items);
+    gboolean proceed = TRUE;
+    while (proceed && i != end)
+      proceed = emit (items, i++, &mc);
+
+    finished = !proceed || i == n_items;
+
+    if (finished && !mc.has_pending_exception)
+      mc.on_complete->Call (Undefined (isolate), 0, nullptr);
+  }
+}
+
 static GumV8ExceptionHandler *
 gum_v8_exception_handler_new (Handle<Function> callback,
                               GumV8Core * core)
@@ -10,7 +10,8 @@
 
 using namespace v8;
 
-ScriptScope::ScriptScope (GumV8Script * parent)
+ScriptScope::ScriptScope (GumV8Script * parent,
+                          GumV8CallbackStats * stats)
   : parent (parent),
     stalker_scope (parent),
     locker (parent->isolate),
@@ -29,7 +30,9 @@ ScriptScope::ScriptScope (GumV8Script * parent)
   core->current_scope = this;
 
   g_queue_init (&tick_callbacks);
-  g_queue_init (&scheduled_sources);
+
+  this->stats = stats;
+  start_time = (stats != nullptr) ? g_get_monotonic_time () : 0;
 }
 
 ScriptScope::~ScriptScope ()
@@ -40,6 +43,9 @@ ScriptScope::~ScriptScope ()
 
   PerformPendingIO ();
 
+  if (stats != nullptr)
+    _gum_v8_callback_stats_add (stats, g_get_monotonic_time () - start_time);
+
   core->current_scope = next;
 
   _gum_v8_core_unpin (core);
@@ -72,8 +78,6 @@ ScriptScope::ProcessAnyPendingException ()
 void
 ScriptScope::PerformPendingIO ()
 {
-  auto core = &parent->core;
-
   if (!g_queue_is_empty (&tick_callbacks))
   {
     auto isolate = parent->isolate;
@@ -91,18 +95,6 @@ ScriptScope::PerformPendingIO ()
       delete tick_callback;
     }
   }
-
-  GSource * source;
-  while ((source = (GSource *) g_queue_pop_head (&scheduled_sources)) != NULL)
-  {
-    if (!g_source_is_destroyed (source))
-    {
-      g_source_attach (source,
-          gum_script_scheduler_get_js_context (core->scheduler));
-    }
-
-    g_source_unref (source);
-  }
 }
 
 void
@@ -112,12 +104,6 @@ ScriptScope::AddTickCallback (Handle<Function> callback)
       parent->isolate, callback));
 }
 
-void
-ScriptScope::AddScheduledSource (GSource * source)
-{
-  g_queue_push_tail (&scheduled_sources, source);
-}
-
 ScriptInterceptorScope::ScriptInterceptorScope (GumV8Script * parent)
   : parent (parent)
 {
@@ -12,6 +12,7 @@
 #include <v8/v8.h>
 
 struct GumV8Core;
+struct GumV8CallbackStats;
 
 class ScriptInterceptorScope
 {
@@ -40,7 +41,7 @@ private:
 class ScriptScope
 {
 public:
-  ScriptScope (GumV8Script * parent);
+  ScriptScope (GumV8Script * parent, GumV8CallbackStats * stats = nullptr);
   ~ScriptScope ();
 
   bool HasPendingException () const { return trycatch.HasCaught (); }
@@ -48,7 +49,6 @@ public:
   void PerformPendingIO ();
 
   void AddTickCallback (v8::Handle<v8::Function> callback);
-  void AddScheduledSource (GSource * source);
 
   GumV8Script * parent;
   ScriptStalkerScope stalker_scope;
@@ -63,7 +63,8 @@ private:
   ScriptInterceptorScope interceptor_scope;
   ScriptScope * next;
   GQueue tick_callbacks;
-  GQueue scheduled_sources;
+  GumV8CallbackStats * stats;
+  gint64 start_time;
 };
 
 class ScriptUnlocker
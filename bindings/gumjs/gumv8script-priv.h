@@ -7,6 +7,7 @@
 #ifndef __GUM_V8_SCRIPT_PRIV_H__
 #define __GUM_V8_SCRIPT_PRIV_H__
 
+#include "gumscriptoutbox.h"
 #include "gumv8apiresolver.h"
 #include "gumv8coderelocator.h"
 #include "gumv8codewriter.h"
@@ -37,6 +38,7 @@ struct _GumV8Script
 
   gchar * name;
   gchar * source;
+  GBytes * code_cache;
   GMainContext * main_context;
   GumV8ScriptBackend * backend;
 
@@ -63,9 +65,7 @@ struct _GumV8Script
   GumPersistent<v8::Context>::type * context;
   GumPersistent<v8::Script>::type * code;
 
-  GumScriptMessageHandler message_handler;
-  gpointer message_handler_data;
-  GDestroyNotify message_handler_data_destroy;
+  GumScriptOutbox outbox;
 };
 
 #endif
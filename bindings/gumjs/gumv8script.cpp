@@ -26,6 +26,7 @@ enum
   PROP_0,
   PROP_NAME,
   PROP_SOURCE,
+  PROP_CODE_CACHE,
   PROP_MAIN_CONTEXT,
   PROP_BACKEND
 };
@@ -44,13 +45,6 @@ struct GumUnloadNotifyCallback
   GDestroyNotify data_destroy;
 };
 
-struct GumEmitData
-{
-  GumV8Script * script;
-  gchar * message;
-  GBytes * data;
-};
-
 struct GumPostData
 {
   GumV8Script * script;
@@ -97,6 +91,9 @@ static void gum_v8_script_once_unloaded (GumV8Script * self,
 static void gum_v8_script_set_message_handler (GumScript * script,
     GumScriptMessageHandler handler, gpointer data,
     GDestroyNotify data_destroy);
+static void gum_v8_script_set_message_batch_handler (GumScript * script,
+    GumScriptMessageBatchHandler handler, gpointer data,
+    GDestroyNotify data_destroy);
 static void gum_v8_script_post (GumScript * script, const gchar * message,
     GBytes * data);
 static void gum_v8_script_do_post (GumPostData * d);
@@ -106,8 +103,6 @@ static GumStalker * gum_v8_script_get_stalker (GumScript * script);
 
 static void gum_v8_script_emit (GumV8Script * self, const gchar * message,
     GBytes * data);
-static gboolean gum_v8_script_do_emit (GumEmitData * d);
-static void gum_v8_emit_data_free (GumEmitData * d);
 
 G_DEFINE_TYPE_EXTENDED (GumV8Script,
                         gum_v8_script,
@@ -137,6 +132,11 @@ gum_v8_script_class_init (GumV8ScriptClass * klass)
       g_param_spec_string ("source", "Source", "Source code", NULL,
       (GParamFlags) (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
       G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (object_class, PROP_CODE_CACHE,
+      g_param_spec_boxed ("code-cache", "CodeCache",
+      "V8 code cache for the source code", G_TYPE_BYTES,
+      (GParamFlags) (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY |
+      G_PARAM_STATIC_STRINGS)));
   g_object_class_install_property (object_class, PROP_MAIN_CONTEXT,
       g_param_spec_boxed ("main-context", "MainContext",
       "MainContext being used", G_TYPE_MAIN_CONTEXT,
@@ -170,6 +170,7 @@ gum_v8_script_iface_init (gpointer g_iface,
   iface->unload_sync = gum_v8_script_unload_sync;
 
   iface->set_message_handler = gum_v8_script_set_message_handler;
+  iface->set_message_batch_handler = gum_v8_script_set_message_batch_handler;
   iface->post = gum_v8_script_post;
 
   iface->get_stalker = gum_v8_script_get_stalker;
@@ -180,6 +181,8 @@ gum_v8_script_init (GumV8Script * self)
 {
   self->state = GUM_SCRIPT_STATE_UNLOADED;
   self->on_unload = NULL;
+
+  gum_script_outbox_init (&self->outbox, GUM_SCRIPT (self));
 }
 
 static void
@@ -199,6 +202,7 @@ gum_v8_script_dispose (GObject * object)
   auto script = GUM_SCRIPT (self);
 
   gum_v8_script_set_message_handler (script, NULL, NULL, NULL);
+  gum_v8_script_set_message_batch_handler (script, NULL, NULL, NULL);
 
   if (self->state == GUM_SCRIPT_STATE_LOADED)
   {
@@ -221,8 +225,11 @@ gum_v8_script_finalize (GObject * object)
 {
   auto self = GUM_V8_SCRIPT (object);
 
+  gum_script_outbox_finalize (&self->outbox);
+
   g_free (self->name);
   g_free (self->source);
+  g_clear_pointer (&self->code_cache, g_bytes_unref);
 
   G_OBJECT_CLASS (gum_v8_script_parent_class)->finalize (object);
 }
@@ -243,6 +250,9 @@ gum_v8_script_get_property (GObject * object,
     case PROP_SOURCE:
       g_value_set_string (value, self->source);
       break;
+    case PROP_CODE_CACHE:
+      g_value_set_boxed (value, self->code_cache);
+      break;
     case PROP_MAIN_CONTEXT:
       g_value_set_boxed (value, self->main_context);
       break;
@@ -272,6 +282,10 @@ gum_v8_script_set_property (GObject * object,
       g_free (self->source);
       self->source = g_value_dup_string (value);
       break;
+    case PROP_CODE_CACHE:
+      g_clear_pointer (&self->code_cache, g_bytes_unref);
+      self->code_cache = (GBytes *) g_value_dup_boxed (value);
+      break;
     case PROP_MAIN_CONTEXT:
       if (self->main_context != NULL)
         g_main_context_unref (self->main_context);
@@ -352,10 +366,23 @@ gum_v8_script_create_context (GumV8Script * self,
     ScriptOrigin origin (resource_name);
     g_free (resource_name_str);
 
-    auto source = String::NewFromUtf8 (isolate, self->source);
+    auto source_string = String::NewFromUtf8 (isolate, self->source);
+
+    ScriptCompiler::CachedData * cached_data = NULL;
+    auto options = ScriptCompiler::kNoCompileOptions;
+    if (self->code_cache != NULL)
+    {
+      gsize size;
+      auto data = (const uint8_t *) g_bytes_get_data (self->code_cache, &size);
+      cached_data = new ScriptCompiler::CachedData (data, (int) size);
+      options = ScriptCompiler::kConsumeCodeCache;
+    }
+
+    /* A cache that V8 rejects is ignored and the source compiled instead */
+    ScriptCompiler::Source source (source_string, origin, cached_data);
 
     TryCatch trycatch (isolate);
-    auto maybe_code = Script::Compile (context, source, &origin);
+    auto maybe_code = ScriptCompiler::Compile (context, &source, options);
     Local<Script> code;
     if (maybe_code.ToLocal (&code))
     {
@@ -652,11 +679,20 @@ gum_v8_script_set_message_handler (GumScript * script,
 {
   auto self = GUM_V8_SCRIPT (script);
 
-  if (self->message_handler_data_destroy != NULL)
-    self->message_handler_data_destroy (self->message_handler_data);
-  self->message_handler = handler;
-  self->message_handler_data = data;
-  self->message_handler_data_destroy = data_destroy;
+  gum_script_outbox_set_message_handler (&self->outbox, handler, data,
+      data_destroy);
+}
+
+static void
+gum_v8_script_set_message_batch_handler (GumScript * script,
+                                         GumScriptMessageBatchHandler handler,
+                                         gpointer data,
+                                         GDestroyNotify data_destroy)
+{
+  auto self = GUM_V8_SCRIPT (script);
+
+  gum_script_outbox_set_batch_handler (&self->outbox, handler, data,
+      data_destroy);
 }
 
 static void
@@ -709,39 +745,5 @@ gum_v8_script_emit (GumV8Script * self,
                     const gchar * message,
                     GBytes * data)
 {
-  auto d = g_slice_new (GumEmitData);
-  d->script = self;
-  g_object_ref (self);
-  d->message = g_strdup (message);
-  d->data = (data != NULL) ? g_bytes_ref (data) : NULL;
-
-  auto source = g_idle_source_new ();
-  g_source_set_callback (source, (GSourceFunc) gum_v8_script_do_emit, d,
-      (GDestroyNotify) gum_v8_emit_data_free);
-  g_source_attach (source, self->main_context);
-  g_source_unref (source);
-}
-
-static gboolean
-gum_v8_script_do_emit (GumEmitData * d)
-{
-  auto self = d->script;
-
-  if (self->message_handler != NULL)
-  {
-    self->message_handler (GUM_SCRIPT (self), d->message, d->data,
-        self->message_handler_data);
-  }
-
-  return FALSE;
-}
-
-static void
-gum_v8_emit_data_free (GumEmitData * d)
-{
-  g_bytes_unref (d->data);
-  g_free (d->message);
-  g_object_unref (d->script);
-
-  g_slice_free (GumEmitData, d);
+  gum_script_outbox_push (&self->outbox, message, data, self->main_context);
 }
@@ -45,6 +45,8 @@
     "--experimental-wasm-anyref " \
     "--expose-gc"
 
+#define GUM_V8_CODE_CACHE_MAGIC 0x63386d67
+
 using namespace v8;
 using namespace v8_inspector;
 
@@ -101,6 +103,14 @@ struct GumCompileScriptData
   gchar * source;
 };
 
+struct GumV8CodeCacheHeader
+{
+  guint32 magic;
+  guint32 name_size;
+  guint32 source_size;
+  guint32 cache_size;
+};
+
 struct GumEmitDebugMessageData
 {
   GumV8ScriptBackend * backend;
@@ -165,6 +175,9 @@ static void gum_create_script_task_run (GumScriptTask * task,
     GumV8ScriptBackend * self, GumCreateScriptData * d,
     GCancellable * cancellable);
 static void gum_create_script_data_free (GumCreateScriptData * d);
+static void gum_v8_script_backend_create_script (GumV8ScriptBackend * self,
+    const gchar * name, const gchar * source, GBytes * code_cache,
+    GumScriptTask * task);
 static void gum_v8_script_backend_create_from_bytes (GumScriptBackend * backend,
     GBytes * bytes, GCancellable * cancellable, GAsyncReadyCallback callback,
     gpointer user_data);
@@ -203,6 +216,10 @@ static void gum_compile_script_task_run (GumScriptTask * task,
     GumV8ScriptBackend * self, GumCompileScriptData * d,
     GCancellable * cancellable);
 static void gum_compile_script_data_free (GumCompileScriptData * d);
+static GBytes * gum_v8_code_cache_serialize (const gchar * name,
+    const gchar * source, const ScriptCompiler::CachedData * cache);
+static gboolean gum_v8_code_cache_parse (GBytes * bytes, const gchar ** name,
+    const gchar ** source, GBytes ** cache);
 
 static void gum_v8_script_backend_set_debug_message_handler (
     GumScriptBackend * backend, GumScriptBackendDebugMessageHandler handler,
@@ -471,12 +488,32 @@ gum_create_script_task_run (GumScriptTask * task,
                             GumV8ScriptBackend * self,
                             GumCreateScriptData * d,
                             GCancellable * cancellable)
+{
+  gum_v8_script_backend_create_script (self, d->name, d->source, NULL, task);
+}
+
+static void
+gum_create_script_data_free (GumCreateScriptData * d)
+{
+  g_free (d->name);
+  g_free (d->source);
+
+  g_slice_free (GumCreateScriptData, d);
+}
+
+static void
+gum_v8_script_backend_create_script (GumV8ScriptBackend * self,
+                                     const gchar * name,
+                                     const gchar * source,
+                                     GBytes * code_cache,
+                                     GumScriptTask * task)
 {
   auto isolate = GUM_V8_SCRIPT_BACKEND_GET_ISOLATE (self);
 
   auto script = GUM_V8_SCRIPT (g_object_new (GUM_V8_TYPE_SCRIPT,
-      "name", d->name,
-      "source", d->source,
+      "name", name,
+      "source", source,
+      "code-cache", code_cache,
       "main-context", gum_script_task_get_context (task),
       "backend", self,
       NULL));
@@ -506,15 +543,6 @@ gum_create_script_task_run (GumScriptTask * task,
   }
 }
 
-static void
-gum_create_script_data_free (GumCreateScriptData * d)
-{
-  g_free (d->name);
-  g_free (d->source);
-
-  g_slice_free (GumCreateScriptData, d);
-}
-
 static void
 gum_v8_script_backend_create_from_bytes (GumScriptBackend * backend,
                                          GBytes * bytes,
@@ -582,9 +610,19 @@ gum_create_script_from_bytes_task_run (GumScriptTask * task,
                                        GumCreateScriptFromBytesData * d,
                                        GCancellable * cancellable)
 {
-  auto error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
-      "not yet supported by the V8 runtime");
-  gum_script_task_return_error (task, error);
+  const gchar * name, * source;
+  GBytes * code_cache;
+  if (!gum_v8_code_cache_parse (d->bytes, &name, &source, &code_cache))
+  {
+    auto error = g_error_new (G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "invalid V8 code cache");
+    gum_script_task_return_error (task, error);
+    return;
+  }
+
+  gum_v8_script_backend_create_script (self, name, source, code_cache, task);
+
+  g_bytes_unref (code_cache);
 }
 
 static void
@@ -682,9 +720,48 @@ gum_compile_script_task_run (GumScriptTask * task,
                              GumCompileScriptData * d,
                              GCancellable * cancellable)
 {
-  auto error = g_error_new (G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
-      "not yet supported by the V8 runtime");
-  gum_script_task_return_error (task, error);
+  auto isolate = GUM_V8_SCRIPT_BACKEND_GET_ISOLATE (self);
+  GBytes * bytes = NULL;
+  GError * error = NULL;
+
+  {
+    Locker locker (isolate);
+    Isolate::Scope isolate_scope (isolate);
+    HandleScope handle_scope (isolate);
+    auto context = Context::New (isolate);
+    Context::Scope context_scope (context);
+
+    auto resource_name_str = g_strconcat ("/", d->name, ".js", NULL);
+    auto resource_name = String::NewFromUtf8 (isolate, resource_name_str);
+    ScriptOrigin origin (resource_name);
+    g_free (resource_name_str);
+
+    ScriptCompiler::Source source (String::NewFromUtf8 (isolate, d->source),
+        origin);
+
+    TryCatch trycatch (isolate);
+    Local<UnboundScript> code;
+    if (ScriptCompiler::CompileUnboundScript (isolate, &source)
+        .ToLocal (&code))
+    {
+      auto cache = ScriptCompiler::CreateCodeCache (code);
+      bytes = gum_v8_code_cache_serialize (d->name, d->source, cache);
+      delete cache;
+    }
+    else
+    {
+      Handle<Message> message = trycatch.Message ();
+      Handle<Value> exception = trycatch.Exception ();
+      String::Utf8Value exception_str (exception);
+      error = g_error_new (G_IO_ERROR, G_IO_ERROR_FAILED,
+          "Script(line %d): %s", message->GetLineNumber (), *exception_str);
+    }
+  }
+
+  if (error == NULL)
+    gum_script_task_return_pointer (task, bytes, (GDestroyNotify) g_bytes_unref);
+  else
+    gum_script_task_return_error (task, error);
 }
 
 static void
@@ -696,6 +773,81 @@ gum_compile_script_data_free (GumCompileScriptData * d)
   g_slice_free (GumCompileScriptData, d);
 }
 
+/*
+ * Compiled scripts are stored as a header followed by the name and source,
+ * each NUL-terminated, and the code cache V8 produced for them. V8 needs
+ * the source to validate the cache, and falls back to compiling it when
+ * the cache was made by a different V8 version or with different flags.
+ */
+static GBytes *
+gum_v8_code_cache_serialize (const gchar * name,
+                             const gchar * source,
+                             const ScriptCompiler::CachedData * cache)
+{
+  GumV8CodeCacheHeader header;
+  header.magic = GUM_V8_CODE_CACHE_MAGIC;
+  header.name_size = (name != NULL) ? strlen (name) + 1 : 0;
+  header.source_size = strlen (source) + 1;
+  header.cache_size = cache->length;
+
+  auto size = sizeof (header) + header.name_size + header.source_size +
+      header.cache_size;
+  auto data = (guint8 *) g_malloc (size);
+
+  auto cursor = data;
+  memcpy (cursor, &header, sizeof (header));
+  cursor += sizeof (header);
+  if (name != NULL)
+    memcpy (cursor, name, header.name_size);
+  cursor += header.name_size;
+  memcpy (cursor, source, header.source_size);
+  cursor += header.source_size;
+  memcpy (cursor, cache->data, header.cache_size);
+
+  return g_bytes_new_take (data, size);
+}
+
+static gboolean
+gum_v8_code_cache_parse (GBytes * bytes,
+                         const gchar ** name,
+                         const gchar ** source,
+                         GBytes ** cache)
+{
+  gsize size;
+  auto data = (const guint8 *) g_bytes_get_data (bytes, &size);
+
+  GumV8CodeCacheHeader header;
+  if (size < sizeof (header))
+    return FALSE;
+  memcpy (&header, data, sizeof (header));
+
+  if (header.magic != GUM_V8_CODE_CACHE_MAGIC || header.source_size == 0)
+    return FALSE;
+
+  auto payload_size = (guint64) header.name_size + header.source_size +
+      header.cache_size;
+  if (payload_size != size - sizeof (header))
+    return FALSE;
+
+  auto cursor = data + sizeof (header);
+
+  auto name_data = (const gchar *) cursor;
+  cursor += header.name_size;
+  if (header.name_size != 0 && name_data[header.name_size - 1] != '\0')
+    return FALSE;
+
+  auto source_data = (const gchar *) cursor;
+  cursor += header.source_size;
+  if (source_data[header.source_size - 1] != '\0')
+    return FALSE;
+
+  *name = (header.name_size != 0) ? name_data : NULL;
+  *source = source_data;
+  *cache = g_bytes_new_from_bytes (bytes, cursor - data, header.cache_size);
+
+  return TRUE;
+}
+
 static void
 gum_v8_script_backend_set_debug_message_handler (
     GumScriptBackend * backend,
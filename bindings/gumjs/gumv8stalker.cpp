@@ -17,6 +17,8 @@
 #define GUM_V8_CALLBACK_TRANSFORMER_CAST(obj) \
     ((GumV8CallbackTransformer *) (obj))
 
+#define GUM_V8_MAX_BLOCK_INSTRUCTIONS 256
+
 using namespace v8;
 
 struct GumV8CallbackTransformer
@@ -24,10 +26,24 @@ struct GumV8CallbackTransformer
   GObject parent;
 
   GumPersistent<Function>::type * callback;
+  gboolean batched;
 
   GumV8Stalker * module;
 };
 
+struct GumV8BlockInstruction
+{
+  guint64 address;
+  guint16 size;
+  guint id;
+};
+
+struct GumV8BlockCallout
+{
+  guint index;
+  Local<Function> callback;
+};
+
 struct GumV8CallbackTransformerClass
 {
   GObjectClass parent_class;
@@ -68,6 +84,8 @@ GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_capacity)
 GUMJS_DECLARE_GETTER (gumjs_stalker_get_queue_drain_interval)
 GUMJS_DECLARE_SETTER (gumjs_stalker_set_queue_drain_interval)
 
+GUMJS_DECLARE_GETTER (gumjs_stalker_get_stats)
+
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_flush)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_garbage_collect)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_follow)
@@ -75,10 +93,15 @@ GUMJS_DECLARE_FUNCTION (gumjs_stalker_unfollow)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_add_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_remove_call_probe)
 GUMJS_DECLARE_FUNCTION (gumjs_stalker_parse)
+GUMJS_DECLARE_FUNCTION (gumjs_stalker_parse_each)
 
 static void gum_v8_callback_transformer_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_v8_callback_transformer_dispose (GObject * object);
+static void gum_v8_callback_transformer_transform_batch (
+    GumV8CallbackTransformer * self, GumStalkerIterator * iterator);
+static GArray * gum_v8_stalker_decode_block (csh capstone,
+    const cs_insn * first);
 G_DEFINE_TYPE_EXTENDED (GumV8CallbackTransformer,
                         gum_v8_callback_transformer,
                         G_TYPE_OBJECT,
@@ -121,8 +144,12 @@ static GumV8InstructionValue * gum_v8_stalker_obtain_instruction (
 static void gum_v8_stalker_release_instruction (GumV8Stalker * self,
     GumV8InstructionValue * value);
 
+static gboolean gum_v8_stalker_get_events (Local<Value> value,
+    const GumEvent ** events, size_t * count, Isolate * isolate);
 static Local<Value> gum_make_pointer (gpointer value, gboolean stringify,
     GumV8Core * core);
+static Local<Value> gum_make_address (gpointer value, gboolean numeric,
+    gboolean stringify, GumV8Core * core);
 
 static const GumV8Property gumjs_stalker_values[] =
 {
@@ -141,6 +168,7 @@ static const GumV8Property gumjs_stalker_values[] =
     gumjs_stalker_get_queue_drain_interval,
     gumjs_stalker_set_queue_drain_interval
   },
+  { "stats", gumjs_stalker_get_stats, NULL },
 
   { NULL, NULL, NULL }
 };
@@ -154,6 +182,7 @@ static const GumV8Function gumjs_stalker_functions[] =
   { "addCallProbe", gumjs_stalker_add_call_probe },
   { "removeCallProbe", gumjs_stalker_remove_call_probe },
   { "_parse", gumjs_stalker_parse },
+  { "_parseEach", gumjs_stalker_parse_each },
 
   { NULL, NULL }
 };
@@ -183,6 +212,7 @@ _gum_v8_stalker_init (GumV8Stalker * self,
   self->stalker = NULL;
   self->queue_capacity = 16384;
   self->queue_drain_interval = 250;
+  self->shared_sink = NULL;
 
   self->flush_timer = NULL;
 
@@ -314,6 +344,8 @@ _gum_v8_stalker_dispose (GumV8Stalker * self)
 
   g_hash_table_unref (self->iterators);
   self->iterators = NULL;
+
+  g_clear_object (&self->shared_sink);
 }
 
 void
@@ -395,6 +427,49 @@ GUMJS_DEFINE_SETTER (gumjs_stalker_set_queue_drain_interval)
   module->queue_drain_interval = interval;
 }
 
+GUMJS_DEFINE_GETTER (gumjs_stalker_get_stats)
+{
+  auto stalker = _gum_v8_stalker_get (module);
+
+  GumStalkerStats stats;
+  gum_stalker_get_stats (stalker, &stats);
+
+  auto result = Object::New (isolate);
+  _gum_v8_object_set_uint64 (result, "blocksCompiled", stats.blocks_compiled,
+      core);
+  _gum_v8_object_set_uint64 (result, "bytesEmitted", stats.bytes_emitted, core);
+  _gum_v8_object_set_uint64 (result, "compileTime", stats.compile_time, core);
+  _gum_v8_object_set_uint64 (result, "trustFailures", stats.trust_failures,
+      core);
+  _gum_v8_object_set_uint64 (result, "codeCacheFlushes",
+      stats.code_cache_flushes, core);
+  _gum_v8_object_set_uint64 (result, "icHits", stats.ic_hits, core);
+  _gum_v8_object_set_uint64 (result, "icMisses", stats.ic_misses, core);
+
+  auto entrygates = Object::New (isolate);
+  _gum_v8_object_set_uint64 (entrygates, "callImm",
+      stats.call_imm_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "callIndirect",
+      stats.call_indirect_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "postCallInvoke",
+      stats.post_call_invoke_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "ret",
+      stats.ret_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "jmpImm",
+      stats.jmp_imm_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "jmpIndirect",
+      stats.jmp_indirect_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "jmpCond",
+      stats.jmp_cond_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "jmpContinuation",
+      stats.jmp_continuation_entrygates, core);
+  _gum_v8_object_set_uint64 (entrygates, "sysenter",
+      stats.sysenter_entrygates, core);
+  _gum_v8_object_set (result, "entrygates", entrygates, core);
+
+  info.GetReturnValue ().Set (result);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_flush)
 {
   auto stalker = _gum_v8_stalker_get (module);
@@ -423,10 +498,40 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
   so.queue_capacity = module->queue_capacity;
   so.queue_drain_interval = module->queue_drain_interval;
 
-  if (!_gum_v8_args_parse (args, "ZF?uF?F?", &thread_id, &transformer_callback,
-      &so.event_mask, &so.on_receive, &so.on_call_summary))
+  gboolean batched, shared;
+  if (!_gum_v8_args_parse (args, "ZF?tuF?F?tttt", &thread_id,
+      &transformer_callback, &batched, &so.event_mask, &so.on_receive,
+      &so.on_call_summary, &so.pack_call_summary, &so.block_when_full,
+      &so.compress_events, &shared))
     return;
 
+  gboolean sink_created = FALSE;
+  if (shared)
+  {
+    if (module->shared_sink == NULL)
+    {
+      GError * error = NULL;
+
+      module->shared_sink = gum_shared_event_sink_new (so.event_mask,
+          module->queue_capacity, &error);
+      if (module->shared_sink == NULL)
+      {
+        _gum_v8_throw_literal (isolate, error->message);
+        g_error_free (error);
+        return;
+      }
+
+      sink_created = TRUE;
+    }
+    else if (gum_event_sink_query_mask (
+        GUM_EVENT_SINK (module->shared_sink)) != so.event_mask)
+    {
+      _gum_v8_throw_ascii_literal (isolate, "the shared transport is already "
+          "in use with different events");
+      return;
+    }
+  }
+
   GumStalkerTransformer * transformer = NULL;
 
   if (!transformer_callback.IsEmpty ())
@@ -435,12 +540,18 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
         g_object_new (GUM_V8_TYPE_CALLBACK_TRANSFORMER, NULL);
     cbt->callback = new GumPersistent<Function>::type (isolate,
         transformer_callback);
+    cbt->batched = batched;
     cbt->module = module;
 
     transformer = GUM_STALKER_TRANSFORMER (cbt);
   }
 
-  auto sink = gum_v8_event_sink_new (&so);
+  GumEventSink * sink;
+  if (shared)
+    sink = GUM_EVENT_SINK (g_object_ref (module->shared_sink));
+  else
+    sink = gum_v8_event_sink_new (&so);
+
   if (thread_id == gum_process_get_current_thread_id ())
   {
     ScriptStalkerScope * scope = &core->current_scope->stalker_scope;
@@ -458,6 +569,16 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_follow)
     g_object_unref (sink);
     g_clear_object (&transformer);
   }
+
+  if (sink_created)
+  {
+    auto ring = Object::New (isolate);
+    _gum_v8_object_set_utf8 (ring, "path",
+        gum_shared_event_sink_get_path (module->shared_sink), core);
+    _gum_v8_object_set (ring, "size", Number::New (isolate,
+        (double) gum_shared_event_sink_get_size (module->shared_sink)), core);
+    info.GetReturnValue ().Set (ring);
+  }
 }
 
 GUMJS_DEFINE_FUNCTION (gumjs_stalker_unfollow)
@@ -511,22 +632,10 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
   if (!_gum_v8_args_parse (args, "Vtt", &events_value, &annotate, &stringify))
     return;
 
-  if (!events_value->IsArrayBuffer ())
-  {
-    _gum_v8_throw_ascii_literal (isolate, "expected an ArrayBuffer");
-    return;
-  }
-
-  auto events_contents = events_value.As<ArrayBuffer> ()->GetContents ();
-  const GumEvent * events = (const GumEvent *) events_contents.Data ();
-  size_t size = events_contents.ByteLength ();
-  if (size % sizeof (GumEvent) != 0)
-  {
-    _gum_v8_throw_ascii_literal (isolate, "invalid buffer shape");
+  const GumEvent * events;
+  size_t count;
+  if (!gum_v8_stalker_get_events (events_value, &events, &count, isolate))
     return;
-  }
-
-  size_t count = size / sizeof (GumEvent);
 
   auto rows = Array::New (isolate, (int) count);
 
@@ -659,6 +768,146 @@ GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse)
   info.GetReturnValue ().Set (rows);
 }
 
+/*
+ * Streams events one at a time into `callback`, without building any
+ * arrays. In numeric mode the event type is passed as its GumEventType
+ * value and addresses as plain numbers, so no objects are created at all.
+ */
+GUMJS_DEFINE_FUNCTION (gumjs_stalker_parse_each)
+{
+  Local<Value> events_value;
+  Local<Function> callback;
+  gboolean numeric, stringify;
+  if (!_gum_v8_args_parse (args, "VFtt", &events_value, &callback, &numeric,
+      &stringify))
+    return;
+
+  const GumEvent * events;
+  size_t count;
+  if (!gum_v8_stalker_get_events (events_value, &events, &count, isolate))
+    return;
+
+  auto context = isolate->GetCurrentContext ();
+  auto recv = Undefined (isolate);
+
+  Local<String> call_name, ret_name, exec_name, block_name, compile_name;
+  if (!numeric)
+  {
+    call_name = _gum_v8_string_new_ascii (isolate, "call");
+    ret_name = _gum_v8_string_new_ascii (isolate, "ret");
+    exec_name = _gum_v8_string_new_ascii (isolate, "exec");
+    block_name = _gum_v8_string_new_ascii (isolate, "block");
+    compile_name = _gum_v8_string_new_ascii (isolate, "compile");
+  }
+
+  const GumEvent * ev;
+  size_t i;
+  for (ev = events, i = 0; i != count; ev++, i++)
+  {
+    Local<Value> argv[4];
+    int argc = 0;
+
+    switch (ev->type)
+    {
+      case GUM_CALL:
+      {
+        const GumCallEvent * call = &ev->call;
+
+        argv[argc++] = call_name;
+        argv[argc++] = gum_make_address (call->location, numeric, stringify,
+            core);
+        argv[argc++] = gum_make_address (call->target, numeric, stringify,
+            core);
+        argv[argc++] = Integer::New (isolate, call->depth);
+
+        break;
+      }
+      case GUM_RET:
+      {
+        const GumRetEvent * ret = &ev->ret;
+
+        argv[argc++] = ret_name;
+        argv[argc++] = gum_make_address (ret->location, numeric, stringify,
+            core);
+        argv[argc++] = gum_make_address (ret->target, numeric, stringify,
+            core);
+        argv[argc++] = Integer::New (isolate, ret->depth);
+
+        break;
+      }
+      case GUM_EXEC:
+      {
+        const GumExecEvent * exec = &ev->exec;
+
+        argv[argc++] = exec_name;
+        argv[argc++] = gum_make_address (exec->location, numeric, stringify,
+            core);
+
+        break;
+      }
+      case GUM_BLOCK:
+      {
+        const GumBlockEvent * block = &ev->block;
+
+        argv[argc++] = block_name;
+        argv[argc++] = gum_make_address (block->begin, numeric, stringify,
+            core);
+        argv[argc++] = gum_make_address (block->end, numeric, stringify,
+            core);
+
+        break;
+      }
+      case GUM_COMPILE:
+      {
+        const GumCompileEvent * compile = &ev->compile;
+
+        argv[argc++] = compile_name;
+        argv[argc++] = gum_make_address (compile->begin, numeric, stringify,
+            core);
+        argv[argc++] = gum_make_address (compile->end, numeric, stringify,
+            core);
+
+        break;
+      }
+      default:
+        _gum_v8_throw_ascii_literal (isolate, "invalid event type");
+        return;
+    }
+
+    if (numeric)
+      argv[0] = Integer::NewFromUnsigned (isolate, ev->type);
+
+    if (callback->Call (context, recv, argc, argv).IsEmpty ())
+      return;
+  }
+}
+
+static gboolean
+gum_v8_stalker_get_events (Local<Value> value,
+                           const GumEvent ** events,
+                           size_t * count,
+                           Isolate * isolate)
+{
+  if (!value->IsArrayBuffer ())
+  {
+    _gum_v8_throw_ascii_literal (isolate, "expected an ArrayBuffer");
+    return FALSE;
+  }
+
+  auto contents = value.As<ArrayBuffer> ()->GetContents ();
+  size_t size = contents.ByteLength ();
+  if (size % sizeof (GumEvent) != 0)
+  {
+    _gum_v8_throw_ascii_literal (isolate, "invalid buffer shape");
+    return FALSE;
+  }
+
+  *events = (const GumEvent *) contents.Data ();
+  *count = size / sizeof (GumEvent);
+
+  return TRUE;
+}
+
 static void
 gum_v8_callback_transformer_transform_block (
     GumStalkerTransformer * transformer,
@@ -666,6 +915,13 @@ gum_v8_callback_transformer_transform_block (
     GumStalkerWriter * output)
 {
   auto self = GUM_V8_CALLBACK_TRANSFORMER_CAST (transformer);
+
+  if (self->batched)
+  {
+    gum_v8_callback_transformer_transform_batch (self, iterator);
+    return;
+  }
+
   auto module = self->module;
   auto core = module->core;
   ScriptScope scope (core->script);
@@ -687,6 +943,179 @@ gum_v8_callback_transformer_transform_block (
   gum_v8_stalker_release_iterator (module, iter_value);
 }
 
+/*
+ * Hands JS the whole block up front, as (address, size, id) triples in one
+ * Float64Array, and lets it answer with a bitset of instructions to keep and
+ * (index, callback) pairs of callouts to put before them. The list is
+ * decoded ahead of the iterator, so Stalker may end the block earlier or
+ * later than JS saw it; instructions JS did not see are kept.
+ */
+static void
+gum_v8_callback_transformer_transform_batch (GumV8CallbackTransformer * self,
+                                             GumStalkerIterator * iterator)
+{
+  auto module = self->module;
+  auto core = module->core;
+
+  const cs_insn * insn;
+  if (!gum_stalker_iterator_next (iterator, &insn))
+    return;
+
+  ScriptScope scope (core->script);
+  auto isolate = core->isolate;
+  auto context = isolate->GetCurrentContext ();
+
+  auto block = gum_v8_stalker_decode_block (module->instruction->capstone,
+      insn);
+  auto n = block->len;
+
+  auto buffer = ArrayBuffer::New (isolate, n * 3 * sizeof (gdouble));
+  auto triples = (gdouble *) buffer->GetContents ().Data ();
+  for (guint i = 0; i != n; i++)
+  {
+    auto bi = &g_array_index (block, GumV8BlockInstruction, i);
+
+    *triples++ = (gdouble) bi->address;
+    *triples++ = bi->size;
+    *triples++ = bi->id;
+  }
+
+  auto callback = Local<Function>::New (isolate, *self->callback);
+  Local<Value> argv[] = { Float64Array::New (buffer, 0, n * 3) };
+  Local<Value> result;
+  if (!callback->Call (context, Undefined (isolate), G_N_ELEMENTS (argv), argv)
+      .ToLocal (&result))
+  {
+    result = Undefined (isolate);
+  }
+
+  guint8 * keep = NULL;
+  size_t keep_size = 0;
+  auto callouts = g_array_new (FALSE, FALSE, sizeof (GumV8BlockCallout));
+
+  if (result->IsObject ())
+  {
+    auto decision = result.As<Object> ();
+
+    Local<Value> keep_value;
+    if (decision->Get (context, _gum_v8_string_new_ascii (isolate, "keep"))
+        .ToLocal (&keep_value) && keep_value->IsUint8Array ())
+    {
+      auto view = keep_value.As<Uint8Array> ();
+      keep_size = view->ByteLength ();
+      keep = (guint8 *) g_malloc (keep_size);
+      view->CopyContents (keep, keep_size);
+    }
+
+    Local<Value> callouts_value;
+    if (decision->Get (context,
+        _gum_v8_string_new_ascii (isolate, "callouts"))
+        .ToLocal (&callouts_value) && callouts_value->IsArray ())
+    {
+      auto entries = callouts_value.As<Array> ();
+      auto num_entries = entries->Length ();
+      for (uint32_t i = 0; i != num_entries; i++)
+      {
+        Local<Value> entry;
+        if (!entries->Get (context, i).ToLocal (&entry) || !entry->IsArray ())
+          continue;
+        auto pair = entry.As<Array> ();
+
+        Local<Value> index_value, callback_value;
+        if (!pair->Get (context, 0).ToLocal (&index_value) ||
+            !index_value->IsUint32 () ||
+            !pair->Get (context, 1).ToLocal (&callback_value) ||
+            !callback_value->IsFunction ())
+          continue;
+
+        GumV8BlockCallout callout;
+        callout.index = index_value.As<Uint32> ()->Value ();
+        callout.callback = callback_value.As<Function> ();
+        g_array_append_val (callouts, callout);
+      }
+    }
+  }
+
+  guint index = 0;
+  do
+  {
+    while (index != n &&
+        g_array_index (block, GumV8BlockInstruction, index).address <
+        insn->address)
+    {
+      index++;
+    }
+
+    gboolean seen = index != n &&
+        g_array_index (block, GumV8BlockInstruction, index).address ==
+        insn->address;
+
+    gboolean should_keep = TRUE;
+    if (seen)
+    {
+      for (guint i = 0; i != callouts->len; i++)
+      {
+        auto c = &g_array_index (callouts, GumV8BlockCallout, i);
+        if (c->index != index)
+          continue;
+
+        auto callout = g_slice_new (GumV8Callout);
+        callout->callback =
+            new GumPersistent<Function>::type (isolate, c->callback);
+        callout->module = module;
+
+        gum_stalker_iterator_put_callout (iterator,
+            (GumStalkerCallout) gum_v8_callout_on_invoke, callout,
+            (GDestroyNotify) gum_v8_callout_free);
+      }
+
+      if (keep != NULL && index / 8 < keep_size)
+        should_keep = (keep[index / 8] & (1 << (index % 8))) != 0;
+    }
+
+    if (should_keep)
+      gum_stalker_iterator_keep (iterator);
+  }
+  while (gum_stalker_iterator_next (iterator, &insn));
+
+  g_array_free (callouts, TRUE);
+  g_free (keep);
+  g_array_free (block, TRUE);
+}
+
+static GArray *
+gum_v8_stalker_decode_block (csh capstone,
+                             const cs_insn * first)
+{
+  auto block = g_array_sized_new (FALSE, FALSE,
+      sizeof (GumV8BlockInstruction), 16);
+
+  auto insn = cs_malloc (capstone);
+  auto code = (const uint8_t *) GSIZE_TO_POINTER (first->address);
+  size_t size = GUM_V8_MAX_BLOCK_INSTRUCTIONS * 16;
+  uint64_t address = first->address;
+
+  while (block->len != GUM_V8_MAX_BLOCK_INSTRUCTIONS &&
+      cs_disasm_iter (capstone, &code, &size, &address, insn))
+  {
+    GumV8BlockInstruction bi;
+    bi.address = insn->address;
+    bi.size = insn->size;
+    bi.id = insn->id;
+    g_array_append_val (block, bi);
+
+    if (cs_insn_group (capstone, insn, CS_GRP_JUMP) ||
+        cs_insn_group (capstone, insn, CS_GRP_CALL) ||
+        cs_insn_group (capstone, insn, CS_GRP_RET) ||
+        cs_insn_group (capstone, insn, CS_GRP_IRET))
+      break;
+  }
+
+  cs_free (insn, 1);
+
+  return block;
+}
+
 static void
 gum_v8_callback_transformer_class_init (GumV8CallbackTransformerClass * klass)
 {
@@ -1039,3 +1468,15 @@ gum_make_pointer (gpointer value,
     return _gum_v8_native_pointer_new (value, core);
   }
 }
+
+static Local<Value>
+gum_make_address (gpointer value,
+                  gboolean numeric,
+                  gboolean stringify,
+                  GumV8Core * core)
+{
+  if (numeric)
+    return Number::New (core->isolate, (gdouble) GPOINTER_TO_SIZE (value));
+
+  return gum_make_pointer (value, stringify, core);
+}
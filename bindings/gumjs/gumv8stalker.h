@@ -22,6 +22,7 @@ struct GumV8Stalker
   GumStalker * stalker;
   guint queue_capacity;
   guint queue_drain_interval;
+  GumSharedEventSink * shared_sink;
 
   GSource * flush_timer;
 
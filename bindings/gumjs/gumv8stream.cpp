@@ -65,7 +65,8 @@ struct GumV8CloseOutputOperation
 enum GumV8WriteStrategy
 {
   GUM_V8_WRITE_SOME,
-  GUM_V8_WRITE_ALL
+  GUM_V8_WRITE_ALL,
+  GUM_V8_WRITE_VECTORS
 };
 
 struct GumV8WriteOperation
@@ -73,6 +74,11 @@ struct GumV8WriteOperation
 {
   GumV8WriteStrategy strategy;
   GBytes * bytes;
+
+  GPtrArray * vectors;
+  guint vector_index;
+  gsize vectors_size;
+  gsize vectors_written;
 };
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_io_stream_construct)
@@ -106,12 +112,19 @@ static void gum_v8_close_output_operation_finish (GOutputStream * stream,
 GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write)
 GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write_all)
 GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write_memory_region)
+GUMJS_DECLARE_FUNCTION (gumjs_output_stream_write_vectors)
 static void gumjs_output_stream_write_with_strategy (GumV8OutputStream * self,
     const GumV8Args * args, GumV8WriteStrategy strategy);
 static void gum_v8_write_operation_dispose (GumV8WriteOperation * self);
 static void gum_v8_write_operation_start (GumV8WriteOperation * self);
 static void gum_v8_write_operation_finish (GOutputStream * stream,
     GAsyncResult * result, GumV8WriteOperation * self);
+static void gum_v8_write_operation_write_next_vector (
+    GumV8WriteOperation * self);
+static void gum_v8_write_operation_vector_written (GOutputStream * stream,
+    GAsyncResult * result, GumV8WriteOperation * self);
+static void gum_v8_write_operation_complete (GumV8WriteOperation * self,
+    gsize bytes_written, gsize expected_size, GError * error);
 
 GUMJS_DECLARE_CONSTRUCTOR (gumjs_native_input_stream_construct)
 
@@ -142,6 +155,7 @@ static const GumV8Function gumjs_output_stream_functions[] =
   { "_write", gumjs_output_stream_write },
   { "_writeAll", gumjs_output_stream_write_all },
   { "_writeMemoryRegion", gumjs_output_stream_write_memory_region },
+  { "_writeVectors", gumjs_output_stream_write_vectors },
 
   { NULL, NULL }
 };
@@ -603,9 +617,118 @@ GUMJS_DEFINE_CLASS_METHOD (gumjs_output_stream_write_memory_region, GumV8OutputS
       gum_v8_write_operation_start, gum_v8_write_operation_dispose);
   op->strategy = GUM_V8_WRITE_ALL;
   op->bytes = g_bytes_new_static (address, length);
+  op->vectors = NULL;
   gum_v8_object_operation_schedule (op);
 }
 
+/*
+ * Takes a flat array where each element is either bytes to copy, or a
+ * NativePointer followed by the length of the memory to write in place.
+ * Copied bytes that are next to each other are gathered into one buffer, so
+ * a batch of small writes ends up as a handful of large ones.
+ */
+GUMJS_DEFINE_CLASS_METHOD (gumjs_output_stream_write_vectors,
+    GumV8OutputStream)
+{
+  Local<Array> items;
+  Local<Function> callback;
+  if (!_gum_v8_args_parse (args, "AF", &items, &callback))
+    return;
+
+  auto context = isolate->GetCurrentContext ();
+  auto native_pointer = Local<FunctionTemplate>::New (isolate,
+      *core->native_pointer);
+
+  auto vectors = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) g_bytes_unref);
+  GByteArray * gathered = NULL;
+  gsize total_size = 0;
+
+  uint32_t n = items->Length ();
+  for (uint32_t i = 0; i != n; i++)
+  {
+    Local<Value> item;
+    if (!items->Get (context, i).ToLocal (&item))
+      goto propagate_exception;
+
+    if (native_pointer->HasInstance (item))
+    {
+      Local<Value> length_value;
+      gsize length;
+      if (i + 1 == n || !items->Get (context, ++i).ToLocal (&length_value) ||
+          !_gum_v8_size_get (length_value, &length, core))
+        goto invalid_vector;
+
+      if (gathered != NULL)
+      {
+        g_ptr_array_add (vectors,
+            g_byte_array_free_to_bytes (g_steal_pointer (&gathered)));
+      }
+
+      g_ptr_array_add (vectors, g_bytes_new_static (
+          GUMJS_NATIVE_POINTER_VALUE (item.As<Object> ()), length));
+      total_size += length;
+
+      continue;
+    }
+
+    if (gathered == NULL)
+      gathered = g_byte_array_new ();
+
+    if (item->IsArrayBuffer ())
+    {
+      auto contents = item.As<ArrayBuffer> ()->GetContents ();
+      g_byte_array_append (gathered, (const guint8 *) contents.Data (),
+          contents.ByteLength ());
+      total_size += contents.ByteLength ();
+    }
+    else
+    {
+      auto bytes = _gum_v8_bytes_get (item, core);
+      if (bytes == NULL)
+        goto propagate_exception;
+
+      gsize size;
+      auto data = g_bytes_get_data (bytes, &size);
+      g_byte_array_append (gathered, (const guint8 *) data, size);
+      total_size += size;
+
+      g_bytes_unref (bytes);
+    }
+  }
+
+  if (gathered != NULL)
+    g_ptr_array_add (vectors, g_byte_array_free_to_bytes (gathered));
+
+  {
+    auto op = gum_v8_object_operation_new (self, callback,
+        gum_v8_write_operation_start, gum_v8_write_operation_dispose);
+    op->strategy = GUM_V8_WRITE_VECTORS;
+    op->bytes = NULL;
+    op->vectors = vectors;
+    op->vector_index = 0;
+    op->vectors_size = total_size;
+    op->vectors_written = 0;
+    gum_v8_object_operation_schedule (op);
+  }
+
+  return;
+
+invalid_vector:
+  {
+    _gum_v8_throw_ascii_literal (isolate,
+        "expected a NativePointer to be followed by a length");
+    goto propagate_exception;
+  }
+propagate_exception:
+  {
+    if (gathered != NULL)
+      g_byte_array_unref (gathered);
+    g_ptr_array_unref (vectors);
+    return;
+  }
+}
+
 static void
 gumjs_output_stream_write_with_strategy (GumV8OutputStream * self,
                                          const GumV8Args * args,
@@ -620,13 +743,17 @@ gumjs_output_stream_write_with_strategy (GumV8OutputStream * self,
       gum_v8_write_operation_start, gum_v8_write_operation_dispose);
   op->strategy = strategy;
   op->bytes = bytes;
+  op->vectors = NULL;
   gum_v8_object_operation_schedule (op);
 }
 
 static void
 gum_v8_write_operation_dispose (GumV8WriteOperation * self)
 {
-  g_bytes_unref (self->bytes);
+  if (self->bytes != NULL)
+    g_bytes_unref (self->bytes);
+  if (self->vectors != NULL)
+    g_ptr_array_unref (self->vectors);
 }
 
 static void
@@ -634,7 +761,11 @@ gum_v8_write_operation_start (GumV8WriteOperation * self)
 {
   auto stream = self->object;
 
-  if (self->strategy == GUM_V8_WRITE_SOME)
+  if (self->strategy == GUM_V8_WRITE_VECTORS)
+  {
+    gum_v8_write_operation_write_next_vector (self);
+  }
+  else if (self->strategy == GUM_V8_WRITE_SOME)
   {
     g_output_stream_write_bytes_async (stream->handle, self->bytes,
         G_PRIORITY_DEFAULT, stream->cancellable,
@@ -676,6 +807,56 @@ gum_v8_write_operation_finish (GOutputStream * stream,
     g_output_stream_write_all_finish (stream, result, &bytes_written, &error);
   }
 
+  gum_v8_write_operation_complete (self, bytes_written,
+      g_bytes_get_size (self->bytes), error);
+}
+
+static void
+gum_v8_write_operation_write_next_vector (GumV8WriteOperation * self)
+{
+  auto stream = self->object;
+
+  gsize size = 0;
+  gconstpointer data = NULL;
+  if (self->vector_index != self->vectors->len)
+  {
+    data = g_bytes_get_data (
+        (GBytes *) g_ptr_array_index (self->vectors, self->vector_index),
+        &size);
+  }
+
+  g_output_stream_write_all_async (stream->handle, data, size,
+      G_PRIORITY_DEFAULT, stream->cancellable,
+      (GAsyncReadyCallback) gum_v8_write_operation_vector_written, self);
+}
+
+static void
+gum_v8_write_operation_vector_written (GOutputStream * stream,
+                                       GAsyncResult * result,
+                                       GumV8WriteOperation * self)
+{
+  gsize bytes_written = 0;
+  GError * error = NULL;
+
+  g_output_stream_write_all_finish (stream, result, &bytes_written, &error);
+  self->vectors_written += bytes_written;
+
+  if (error == NULL && ++self->vector_index < self->vectors->len)
+  {
+    gum_v8_write_operation_write_next_vector (self);
+    return;
+  }
+
+  gum_v8_write_operation_complete (self, self->vectors_written,
+      self->vectors_size, error);
+}
+
+static void
+gum_v8_write_operation_complete (GumV8WriteOperation * self,
+                                 gsize bytes_written,
+                                 gsize expected_size,
+                                 GError * error)
+{
   {
     auto core = self->core;
     ScriptScope scope (core->script);
@@ -684,8 +865,7 @@ gum_v8_write_operation_finish (GOutputStream * stream,
     Local<Value> error_value;
     auto size_value = Integer::NewFromUnsigned (isolate, bytes_written);
     auto null_value = Null (isolate);
-    if (self->strategy == GUM_V8_WRITE_ALL &&
-        bytes_written != g_bytes_get_size (self->bytes))
+    if (self->strategy != GUM_V8_WRITE_SOME && bytes_written != expected_size)
     {
       error_value = Exception::Error (
           String::NewFromUtf8 (isolate,
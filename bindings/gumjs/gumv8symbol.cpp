@@ -23,6 +23,7 @@ struct GumSymbol
 };
 
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_from_address)
+GUMJS_DECLARE_FUNCTION (gumjs_symbol_from_addresses)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_from_name)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_get_function_by_name)
 GUMJS_DECLARE_FUNCTION (gumjs_symbol_find_functions_named)
@@ -43,6 +44,7 @@ static void gum_symbol_on_weak_notify (
 static const GumV8Function gumjs_symbol_module_functions[] =
 {
   { "fromAddress", gumjs_symbol_from_address },
+  { "fromAddresses", gumjs_symbol_from_addresses },
   { "fromName", gumjs_symbol_from_name },
   { "getFunctionByName", gumjs_symbol_get_function_by_name },
   { "findFunctionsNamed", gumjs_symbol_find_functions_named },
@@ -145,6 +147,58 @@ GUMJS_DEFINE_FUNCTION (gumjs_symbol_from_address)
   info.GetReturnValue ().Set (object);
 }
 
+GUMJS_DEFINE_FUNCTION (gumjs_symbol_from_addresses)
+{
+  Local<Array> addresses_value;
+  if (!_gum_v8_args_parse (args, "A", &addresses_value))
+    return;
+
+  auto context = isolate->GetCurrentContext ();
+  auto n = addresses_value->Length ();
+
+  auto addresses = g_new (gpointer, n);
+  for (uint32_t i = 0; i != n; i++)
+  {
+    Local<Value> element;
+    if (!addresses_value->Get (context, i).ToLocal (&element) ||
+        !_gum_v8_native_pointer_get (element, &addresses[i], core))
+    {
+      g_free (addresses);
+      return;
+    }
+  }
+
+  auto details = g_new (GumDebugSymbolDetails, n);
+  auto resolved = g_new (gboolean, n);
+
+  {
+    ScriptUnlocker unlocker (core);
+
+    gum_symbol_details_from_addresses (addresses, n, details, resolved);
+  }
+
+  auto result = Array::New (isolate, n);
+  for (uint32_t i = 0; i != n; i++)
+  {
+    GumSymbol * symbol;
+    auto object = gum_symbol_new (module, &symbol);
+
+    symbol->resolved = resolved[i];
+    if (resolved[i])
+      symbol->details = details[i];
+    else
+      symbol->details.address = GPOINTER_TO_SIZE (addresses[i]);
+
+    result->Set (i, object);
+  }
+
+  info.GetReturnValue ().Set (result);
+
+  g_free (resolved);
+  g_free (details);
+  g_free (addresses);
+}
+
 GUMJS_DEFINE_FUNCTION (gumjs_symbol_from_name)
 {
   gchar * name;
@@ -90,10 +90,16 @@ _gum_v8_args_parse (const GumV8Args * args,
 {
   auto info = args->info;
   auto core = args->core;
-  auto isolate = info->GetIsolate ();
+  auto isolate = core->isolate;
+  auto values = args->values;
   GumV8ArgsParseScope scope;
   va_list ap;
-  int arg_index, arg_count = info->Length ();
+  int arg_index, arg_count;
+
+  if (info != nullptr)
+    arg_count = info->Length ();
+  else
+    arg_count = (int) values->Length () - (int) args->values_offset;
   const gchar * t;
   gboolean is_required;
 
@@ -122,7 +128,16 @@ _gum_v8_args_parse (const GumV8Args * args,
       }
     }
 
-    Local<Value> arg = (*info)[arg_index];
+    Local<Value> arg;
+    if (info != nullptr)
+    {
+      arg = (*info)[arg_index];
+    }
+    else
+    {
+      arg = values->Get (isolate->GetCurrentContext (),
+          args->values_offset + arg_index).ToLocalChecked ();
+    }
 
     switch (*t)
     {
@@ -642,6 +657,32 @@ _gum_v8_bytes_try_get (Handle<Value> value,
   return NULL;
 }
 
+/*
+ * Like _gum_v8_bytes_get(), except that an ArrayBuffer owned by V8 has its
+ * backing store handed over to the returned GBytes instead of being copied,
+ * leaving the buffer neutered. Anything else is copied as usual.
+ */
+GBytes *
+_gum_v8_bytes_take (Handle<Value> value,
+                    GumV8Core * core)
+{
+  if (value->IsArrayBuffer ())
+  {
+    auto buffer = value.As<ArrayBuffer> ();
+
+    if (!buffer->IsExternal () && buffer->IsNeuterable ())
+    {
+      auto contents = buffer->Externalize ();
+      buffer->Neuter ();
+
+      /* Backing stores come from GumV8ArrayBufferAllocator, i.e. g_malloc() */
+      return g_bytes_new_take (contents.Data (), contents.ByteLength ());
+    }
+  }
+
+  return _gum_v8_bytes_get (value, core);
+}
+
 GumV8NativeResource *
 _gum_v8_native_resource_new (gpointer data,
                              gsize size,
@@ -1136,6 +1177,20 @@ _gum_v8_native_pointer_parse (Handle<Value> value,
                               gpointer * ptr,
                               GumV8Core * core)
 {
+  auto native_pointer = Local<FunctionTemplate>::New (core->isolate,
+      *core->native_pointer);
+  if (native_pointer->HasInstance (value))
+  {
+    *ptr = GUMJS_NATIVE_POINTER_VALUE (value.As<Object> ());
+    return TRUE;
+  }
+
+  if (value->IsInt32 ())
+  {
+    *ptr = GSIZE_TO_POINTER ((gssize) value.As<Int32> ()->Value ());
+    return TRUE;
+  }
+
   if (value->IsString ())
   {
     String::Utf8Value ptr_as_utf8 (value);
@@ -9,9 +9,16 @@
 
 #include "gumv8core.h"
 
+/*
+ * Arguments are normally those of the call described by `info`. When `info`
+ * is NULL they are instead the elements of `values`, starting at
+ * `values_offset`, which lets one call carry the arguments of many.
+ */
 struct GumV8Args
 {
   const v8::FunctionCallbackInfo<v8::Value> * info;
+  v8::Local<v8::Array> values;
+  guint values_offset;
   GumV8Core * core;
 };
 
@@ -40,6 +47,8 @@ G_GNUC_INTERNAL GBytes * _gum_v8_bytes_parse (v8::Handle<v8::Value> value,
     GumV8Core * core);
 G_GNUC_INTERNAL GBytes * _gum_v8_bytes_try_get (v8::Handle<v8::Value> value,
     GumV8Core * core);
+G_GNUC_INTERNAL GBytes * _gum_v8_bytes_take (v8::Handle<v8::Value> value,
+    GumV8Core * core);
 
 G_GNUC_INTERNAL GumV8NativeResource * _gum_v8_native_resource_new (
     gpointer data, gsize size, GDestroyNotify notify, GumV8Core * core);
@@ -1,28 +1,37 @@
 'use strict';
 
-const hexdump = require('./hexdump');
-
 const engine = global;
 const slice = Array.prototype.slice;
 
+let emitLogMessage = sendLogMessage;
+
 class Console {
   log() {
-    sendLogMessage('info', slice.call(arguments));
+    emitLogMessage('info', slice.call(arguments));
   }
 
   warn() {
-    sendLogMessage('warning', slice.call(arguments));
+    emitLogMessage('warning', slice.call(arguments));
   }
 
   error() {
-    sendLogMessage('error', slice.call(arguments));
+    emitLogMessage('error', slice.call(arguments));
+  }
+
+  setOutput(output) {
+    if (output === 'host')
+      emitLogMessage = sendLogMessage;
+    else if (output === 'local')
+      emitLogMessage = writeLogMessage;
+    else
+      throw new Error('expected output to be either "host" or "local"');
   }
 }
 
 module.exports = Console;
 
 function sendLogMessage(level, values) {
-  const text = values.map(parseLogArgument).join(' ');
+  const text = formatLogMessage(values);
   const message = {
     type: 'log',
     level: level,
@@ -31,9 +40,21 @@ function sendLogMessage(level, values) {
   engine._send(JSON.stringify(message), null);
 }
 
+/*
+ * Goes through gum's per-thread log buffer, which a background thread
+ * drains to stderr, so high-rate logging from hooks stays cheap.
+ */
+function writeLogMessage(level, values) {
+  engine._writeLog(formatLogMessage(values) + '\n');
+}
+
+function formatLogMessage(values) {
+  return values.map(parseLogArgument).join(' ');
+}
+
 function parseLogArgument(value) {
   if (value instanceof ArrayBuffer)
-    return hexdump(value);
+    return engine.hexdump(value);
 
   if (value === undefined)
     return 'undefined';
@@ -1,7 +1,6 @@
 'use strict';
 
 const Console = require('./console');
-const hexdump = require('./hexdump');
 const MessageDispatcher = require('./message-dispatcher');
 
 const engine = global;
@@ -42,12 +41,13 @@ Object.defineProperties(engine, {
   },
   send: {
     enumerable: true,
-    value: function (payload, data) {
+    value: function (payload, data, options) {
       const message = {
         type: 'send',
         payload: payload
       };
-      engine._send(JSON.stringify(message), data || null);
+      const transfer = (options !== undefined) ? !!options.transfer : false;
+      engine._send(JSON.stringify(message), data || null, transfer);
     }
   },
   setTimeout: {
@@ -106,7 +106,12 @@ Object.defineProperties(engine, {
   },
   hexdump: {
     enumerable: true,
-    value: hexdump
+    configurable: true,
+    get: function () {
+      const m = require('./hexdump');
+      Object.defineProperty(engine, 'hexdump', { value: m });
+      return m;
+    }
   },
   ObjC: {
     enumerable: true,
@@ -153,8 +158,243 @@ if (Script.runtime === 'DUK') {
       return result;
     }, {});
   };
+
+  /*
+   * Calls cost next to nothing on Duktape, so there is no need for native
+   * batching like on V8.
+   */
+  [
+    global.X86Writer,
+    global.ArmWriter,
+    global.ThumbWriter,
+    global.Arm64Writer,
+    global.MipsWriter
+  ].filter(klass => klass !== undefined).forEach(klass => {
+    klass.prototype.putOps = function (ops) {
+      ops.forEach(([name, ...args]) => {
+        this[name](...args);
+      });
+    };
+  });
+
+  Module._enumerateExportsTable = function (name) {
+    return makeModuleColumns(Module.enumerateExportsSync(name), false);
+  };
+
+  Module._enumerateSymbolsTable = function (name) {
+    return makeModuleColumns(Module.enumerateSymbolsSync(name), true);
+  };
+
+  /*
+   * Matches already arrive one dispatch at a time here, so this buffers
+   * them up without applying backpressure, and a cancel takes effect at the
+   * next match.
+   */
+  Memory._openScan = function (address, size, pattern, chunkSize) {
+    return new BufferedMemoryScanner(address, size, pattern, chunkSize);
+  };
+}
+
+function BufferedMemoryScanner(address, size, pattern, chunkSize) {
+  const reportPatternIndex = pattern instanceof Array;
+
+  this._chunkSize = chunkSize;
+  this._queue = [];
+  this._finished = false;
+  this._cancelled = false;
+  this._error = null;
+  this._onRead = null;
+
+  Memory.scan(address, size, pattern, {
+    onMatch: (address, size, patternIndex) => {
+      if (this._cancelled)
+        return 'stop';
+
+      const match = { address: address, size: size };
+      if (reportPatternIndex)
+        match.pattern = patternIndex;
+      this._queue.push(match);
+
+      if (this._onRead !== null && this._queue.length >= this._chunkSize)
+        this._deliver();
+    },
+    onError: reason => {
+      this._error = reason;
+    },
+    onComplete: () => {
+      this._finished = true;
+
+      if (this._onRead !== null)
+        this._deliver();
+    }
+  });
 }
 
+BufferedMemoryScanner.prototype.read = function (callback) {
+  if (this._onRead !== null)
+    throw new Error('a read is already pending');
+
+  this._onRead = callback;
+
+  if (this._cancelled || this._finished ||
+      this._queue.length >= this._chunkSize)
+    this._deliver();
+};
+
+BufferedMemoryScanner.prototype.cancel = function () {
+  this._cancelled = true;
+  this._queue = [];
+
+  if (this._onRead !== null)
+    this._deliver();
+};
+
+BufferedMemoryScanner.prototype._deliver = function () {
+  const callback = this._onRead;
+  this._onRead = null;
+
+  const matches = this._queue.splice(0, this._chunkSize);
+  const done = this._cancelled ||
+      (this._finished && this._queue.length === 0);
+  const error = (done && !this._cancelled) ? this._error : null;
+
+  callback(error, matches, done);
+};
+
+function makeModuleColumns(items, hasSymbolColumns) {
+  const n = items.length;
+  const is64Bit = Process.pointerSize === 8;
+
+  const nameOffsets = new Uint32Array(n + 1);
+  const addresses = new Uint32Array(n * 2);
+  const types = new Uint8Array(n);
+  const typeNames = [];
+  const typeIndices = {};
+
+  let offset = 0;
+  items.forEach((item, i) => {
+    offset += item.name.length;
+    nameOffsets[i + 1] = offset;
+
+    const address = item.address;
+    addresses[i * 2] = address.toInt32();
+    addresses[(i * 2) + 1] = is64Bit ? address.shr(32).toInt32() : 0;
+
+    let typeIndex = typeIndices[item.type];
+    if (typeIndex === undefined) {
+      typeIndex = typeNames.length;
+      typeNames.push(item.type);
+      typeIndices[item.type] = typeIndex;
+    }
+    types[i] = typeIndex;
+  });
+
+  const columns = {
+    names: items.map(item => item.name).join(''),
+    nameOffsets: nameOffsets,
+    addresses: addresses,
+    types: types,
+    typeNames: typeNames
+  };
+
+  if (hasSymbolColumns) {
+    const globals = new Uint8Array(n);
+    const sectionIndices = new Int32Array(n);
+    const sections = [];
+    const sectionById = {};
+
+    items.forEach((item, i) => {
+      globals[i] = item.isGlobal ? 1 : 0;
+
+      const section = item.section;
+      if (section === undefined) {
+        sectionIndices[i] = -1;
+        return;
+      }
+      let sectionIndex = sectionById[section.id];
+      if (sectionIndex === undefined) {
+        sectionIndex = sections.length;
+        sections.push(section);
+        sectionById[section.id] = sectionIndex;
+      }
+      sectionIndices[i] = sectionIndex;
+    });
+
+    columns.globals = globals;
+    columns.sectionIndices = sectionIndices;
+    columns.sections = sections;
+  }
+
+  return columns;
+}
+
+/*
+ * Wraps the columns returned by Module._enumerate{Exports,Symbols}Table(),
+ * only creating objects for the entries that are actually looked at.
+ */
+function ModuleTable(columns, hasSymbolColumns) {
+  this.length = columns.types.length;
+  this._columns = columns;
+  this._hasSymbolColumns = hasSymbolColumns;
+}
+
+ModuleTable.prototype.getName = function (index) {
+  const columns = this._columns;
+  const offsets = columns.nameOffsets;
+  return columns.names.substring(offsets[index], offsets[index + 1]);
+};
+
+ModuleTable.prototype.getAddress = function (index) {
+  const addresses = this._columns.addresses;
+  const lo = addresses[index * 2];
+  const hi = addresses[(index * 2) + 1];
+  if (hi < 0x200000)
+    return ptr((hi * 0x100000000) + lo);
+  return ptr(hi).shl(32).or(lo);
+};
+
+ModuleTable.prototype.getType = function (index) {
+  const columns = this._columns;
+  return columns.typeNames[columns.types[index]];
+};
+
+ModuleTable.prototype.get = function (index) {
+  if (index < 0 || index >= this.length)
+    return undefined;
+
+  if (!this._hasSymbolColumns) {
+    return {
+      type: this.getType(index),
+      name: this.getName(index),
+      address: this.getAddress(index)
+    };
+  }
+
+  const columns = this._columns;
+  const symbol = {
+    isGlobal: columns.globals[index] !== 0,
+    type: this.getType(index)
+  };
+  const sectionIndex = columns.sectionIndices[index];
+  if (sectionIndex !== -1) {
+    const section = columns.sections[sectionIndex];
+    symbol.section = {
+      id: section.id,
+      protection: section.protection
+    };
+  }
+  symbol.name = this.getName(index);
+  symbol.address = this.getAddress(index);
+  return symbol;
+};
+
+ModuleTable.prototype.toArray = function () {
+  const result = [];
+  for (let i = 0; i !== this.length; i++)
+    result.push(this.get(i));
+  return result;
+};
+
 makeEnumerateRanges(Kernel);
 
 makeEnumerateThreads(Process);
@@ -178,59 +418,72 @@ function makeEnumerateThreads(mod) {
 }
 
 function makeEnumerateRanges(mod) {
+  const asyncImpl = (mod._enumerateRangesAsync !== undefined) ? '_enumerateRangesAsync' : '_enumerateRanges';
+
+  function enumerateRanges(impl, specifier, callbacks) {
+    let protection;
+    let coalesce = false;
+    if (typeof specifier === 'string') {
+      protection = specifier;
+    } else {
+      protection = specifier.protection;
+      coalesce = specifier.coalesce;
+    }
+
+    if (coalesce) {
+      let current = null;
+      const onMatch = callbacks.onMatch;
+      mod[impl](protection, {
+        onMatch: function (r) {
+          if (current !== null) {
+            if (r.base.equals(current.base.add(current.size)) && r.protection === current.protection) {
+              const coalescedRange = {
+                base: current.base,
+                size: current.size + r.size,
+                protection: current.protection
+              };
+              if (current.hasOwnProperty('file'))
+                coalescedRange.file = current.file;
+              Object.freeze(coalescedRange);
+              current = coalescedRange;
+            } else {
+              onMatch(current);
+              current = r;
+            }
+          } else {
+            current = r;
+          }
+        },
+        onComplete: function () {
+          if (current !== null)
+            onMatch(current);
+          callbacks.onComplete();
+        }
+      });
+    } else {
+      mod[impl](protection, callbacks);
+    }
+  }
+
   Object.defineProperties(mod, {
     enumerateRanges: {
       enumerable: true,
       value: function (specifier, callbacks) {
-        let protection;
-        let coalesce = false;
-        if (typeof specifier === 'string') {
-          protection = specifier;
-        } else {
-          protection = specifier.protection;
-          coalesce = specifier.coalesce;
-        }
-
-        if (coalesce) {
-          let current = null;
-          const onMatch = callbacks.onMatch;
-          mod._enumerateRanges(protection, {
-            onMatch: function (r) {
-              if (current !== null) {
-                if (r.base.equals(current.base.add(current.size)) && r.protection === current.protection) {
-                  const coalescedRange = {
-                    base: current.base,
-                    size: current.size + r.size,
-                    protection: current.protection
-                  };
-                  if (current.hasOwnProperty('file'))
-                    coalescedRange.file = current.file;
-                  Object.freeze(coalescedRange);
-                  current = coalescedRange;
-                } else {
-                  onMatch(current);
-                  current = r;
-                }
-              } else {
-                current = r;
-              }
-            },
-            onComplete: function () {
-              if (current !== null)
-                onMatch(current);
-              callbacks.onComplete();
-            }
-          });
-        } else {
-          mod._enumerateRanges(protection, callbacks);
-        }
+        enumerateRanges(asyncImpl, specifier, callbacks);
       }
     },
     enumerateRangesSync: {
       enumerable: true,
       value: function (specifier) {
+        if (mod._collectRanges !== undefined) {
+          if (typeof specifier === 'string')
+            return mod._collectRanges(specifier);
+          if (!specifier.coalesce)
+            return mod._collectRanges(specifier.protection);
+        }
+
         const ranges = [];
-        mod.enumerateRanges(specifier, {
+        enumerateRanges('_enumerateRanges', specifier, {
           onMatch: function (r) {
             ranges.push(r);
           },
@@ -289,14 +542,111 @@ Object.defineProperties(Memory, {
       Memory._patchCode(address, size, apply);
     }
   },
+  scanIterator: {
+    enumerable: true,
+    value: function (address, size, pattern, options) {
+      options = options || {};
+      const chunkSize = options.chunkSize || 256;
+      return new MemoryScanIterator(
+          Memory._openScan(address, size, pattern, chunkSize));
+    }
+  },
 });
 
+/*
+ * Pulls matches from a native scanner in chunks. The scanner stops once its
+ * queue is full, so matches are only produced as fast as they get consumed.
+ */
+function MemoryScanIterator(scanner) {
+  this._scanner = scanner;
+  this._buffer = [];
+  this._bufferIndex = 0;
+  this._pending = null;
+  this._done = false;
+  this._error = null;
+}
+
+/* Resolves to the next array of matches, or null when the scan is done. */
+MemoryScanIterator.prototype.readChunk = function () {
+  if (this._bufferIndex !== this._buffer.length) {
+    const chunk = this._buffer.slice(this._bufferIndex);
+    this._buffer = [];
+    this._bufferIndex = 0;
+    return Promise.resolve(chunk);
+  }
+
+  if (this._done) {
+    const error = this._error;
+    this._error = null;
+    return (error !== null) ? Promise.reject(error) : Promise.resolve(null);
+  }
+
+  if (this._pending !== null)
+    return this._pending;
+
+  let settled = false;
+  const pending = new Promise(resolve => {
+    this._scanner.read((error, matches, done) => {
+      settled = true;
+      this._pending = null;
+      if (done) {
+        this._done = true;
+        if (error !== null)
+          this._error = new Error(error);
+      }
+      resolve(matches);
+    });
+  }).then(matches => {
+    if (matches.length !== 0)
+      return matches;
+    return this.readChunk();
+  });
+  if (!settled)
+    this._pending = pending;
+  return pending;
+};
+
+MemoryScanIterator.prototype.next = function () {
+  if (this._bufferIndex !== this._buffer.length) {
+    return Promise.resolve({
+      value: this._buffer[this._bufferIndex++],
+      done: false
+    });
+  }
+
+  return this.readChunk().then(chunk => {
+    if (chunk === null)
+      return { value: undefined, done: true };
+    this._buffer = chunk;
+    this._bufferIndex = 1;
+    return { value: chunk[0], done: false };
+  });
+};
+
+MemoryScanIterator.prototype.cancel = function () {
+  this._buffer = [];
+  this._bufferIndex = 0;
+  this._done = true;
+  this._scanner.cancel();
+};
+
+MemoryScanIterator.prototype.return = function () {
+  this.cancel();
+  return Promise.resolve({ value: undefined, done: true });
+};
+
+if (typeof Symbol !== 'undefined' && Symbol.asyncIterator !== undefined) {
+  MemoryScanIterator.prototype[Symbol.asyncIterator] = function () {
+    return this;
+  };
+}
+
 Object.defineProperties(Process, {
   findModuleByAddress: {
     enumerable: true,
     value: function (address) {
       let module = null;
-      Process.enumerateModules({
+      Process._enumerateModules({
         onMatch: function (m) {
           const base = m.base;
           if (base.compare(address) <= 0 && base.add(m.size).compare(address) > 0) {
@@ -324,7 +674,7 @@ Object.defineProperties(Process, {
     value: function (name) {
       let module = null;
       const nameLowercase = name.toLowerCase();
-      Process.enumerateModules({
+      Process._enumerateModules({
         onMatch: function (m) {
           if (m.name.toLowerCase() === nameLowercase) {
             module = m;
@@ -350,7 +700,7 @@ Object.defineProperties(Process, {
     enumerable: true,
     value: function () {
       const modules = [];
-      Process.enumerateModules({
+      Process._enumerateModules({
         onMatch: function (m) {
           modules.push(m);
         },
@@ -390,7 +740,7 @@ if (Process.findRangeByAddress === undefined) {
     enumerable: true,
     value: function (address) {
       let range = null;
-      Process.enumerateRanges('---', {
+      Process._enumerateRanges('---', {
         onMatch: function (r) {
           const base = r.base;
           if (base.compare(address) <= 0 && base.add(r.size).compare(address) > 0) {
@@ -425,7 +775,7 @@ Object.defineProperties(Module, {
     enumerable: true,
     value: function (name) {
       const exports = [];
-      Module.enumerateExports(name, {
+      Module._enumerateExports(name, {
         onMatch: function (exp) {
           exports.push(exp);
         },
@@ -449,6 +799,18 @@ Object.defineProperties(Module, {
       return symbols;
     }
   },
+  enumerateExportsTable: {
+    enumerable: true,
+    value: function (name) {
+      return new ModuleTable(Module._enumerateExportsTable(name), false);
+    }
+  },
+  enumerateSymbolsTable: {
+    enumerable: true,
+    value: function (name) {
+      return new ModuleTable(Module._enumerateSymbolsTable(name), true);
+    }
+  },
   enumerateRangesSync: {
     enumerable: true,
     value: function (name, prot) {
@@ -498,11 +860,30 @@ Object.defineProperties(ModuleMap.prototype, {
 Object.defineProperties(Interceptor, {
   attach: {
     enumerable: true,
-    value: function (target, callbacks) {
+    value: function (target, callbacks, data) {
       Memory.readU8(target);
+      if (data !== undefined)
+        return Interceptor._attach(target, callbacks, data);
       return Interceptor._attach(target, callbacks);
     }
   },
+  attachDeferred: {
+    enumerable: true,
+    value: function (target, onCalls, options) {
+      Memory.readU8(target);
+      const args = (options !== undefined && options.args !== undefined) ? options.args : 0;
+      return Interceptor._attachDeferred(target, onCalls, args);
+    }
+  },
+  capture: {
+    enumerable: true,
+    value: function (target, options) {
+      Memory.readU8(target);
+      const args = (options !== undefined && options.args !== undefined) ? options.args : 0;
+      const retval = (options !== undefined && options.retval !== undefined) ? !!options.retval : false;
+      Interceptor._capture(target, args, retval);
+    }
+  },
   replace: {
     enumerable: true,
     value: function (target, replacement) {
@@ -520,6 +901,11 @@ const stalkerEventType = {
   compile: 16,
 };
 
+const stalkerEventName = Object.keys(stalkerEventType).reduce((result, name) => {
+  result[stalkerEventType[name]] = name;
+  return result;
+}, {});
+
 Object.defineProperties(Stalker, {
   follow: {
     enumerable: true,
@@ -542,14 +928,34 @@ Object.defineProperties(Stalker, {
 
       const {
         transform = null,
+        transformBlock = null,
         events = {},
         onReceive = null,
         onCallSummary = null,
+        callSummaryFormat = 'object',
+        queueOverflow = 'drop',
+        compression = 'none',
+        transport = 'script',
       } = options;
 
       if (events === null || typeof events !== 'object')
         throw new Error('events must be an object');
 
+      if (transform !== null && transformBlock !== null)
+        throw new Error('transform and transformBlock are mutually exclusive');
+
+      if (callSummaryFormat !== 'object' && callSummaryFormat !== 'packed')
+        throw new Error('callSummaryFormat must be either \'object\' or \'packed\'');
+
+      if (queueOverflow !== 'drop' && queueOverflow !== 'block')
+        throw new Error('queueOverflow must be either \'drop\' or \'block\'');
+
+      if (compression !== 'none' && compression !== 'deflate')
+        throw new Error('compression must be either \'none\' or \'deflate\'');
+
+      if (transport !== 'script' && transport !== 'shared')
+        throw new Error('transport must be either \'script\' or \'shared\'');
+
       const eventMask = Object.keys(events).reduce((result, name) => {
         const value = stalkerEventType[name];
         if (value === undefined)
@@ -562,7 +968,12 @@ Object.defineProperties(Stalker, {
         return enabled ? (result | value) : result;
       }, 0);
 
-      Stalker._follow(threadId, transform, eventMask, onReceive, onCallSummary);
+      const batched = transformBlock !== null;
+      const ring = Stalker._follow(threadId, batched ? transformBlock : transform, batched, eventMask,
+          onReceive, onCallSummary, callSummaryFormat === 'packed', queueOverflow === 'block',
+          compression === 'deflate', transport === 'shared');
+      if (ring !== undefined)
+        send({ type: 'stalker:shared-ring', path: ring.path, size: ring.size });
     }
   },
   parse: {
@@ -570,14 +981,59 @@ Object.defineProperties(Stalker, {
     value: function (events, options = {}) {
       const {
         annotate = true,
-        stringify = false
+        stringify = false,
+        onEvent = null,
+        numeric = false,
+        moduleMap = null,
       } = options;
 
-      return Stalker._parse(events, annotate, stringify);
+      if (onEvent === null)
+        return Stalker._parse(events, annotate, stringify);
+
+      if (moduleMap === null) {
+        Stalker._parseEach(events, onEvent, numeric, stringify);
+        return;
+      }
+
+      Stalker._parseEach(events, makeModuleRelativeEventHandler(onEvent, moduleMap, numeric), true, false);
     }
   }
 });
 
+function makeModuleRelativeEventHandler(onEvent, moduleMap, numeric) {
+  const locations = new Map();
+
+  function resolve(address) {
+    let location = locations.get(address);
+    if (location === undefined) {
+      const p = ptr(address);
+      const module = moduleMap.find(p);
+      location = (module !== null) ? module.name + '!' + p.sub(module.base) : p.toString();
+      locations.set(address, location);
+    }
+    return location;
+  }
+
+  return function (type, first, second, ...rest) {
+    const name = numeric ? type : stalkerEventName[type];
+    switch (type) {
+      case stalkerEventType.call:
+      case stalkerEventType.ret:
+        onEvent(name, resolve(first), resolve(second), ...rest);
+        break;
+      case stalkerEventType.exec:
+        if (second === undefined)
+          onEvent(name, resolve(first));
+        else
+          onEvent(name, resolve(first), second);
+        break;
+      default:
+        onEvent(name, resolve(first), resolve(second), ...rest);
+        break;
+    }
+  };
+}
+
 Object.defineProperty(Instruction, 'parse', {
   enumerable: true,
   value: function (target) {
@@ -586,6 +1042,14 @@ Object.defineProperty(Instruction, 'parse', {
   }
 });
 
+Object.defineProperty(Instruction, 'parseRange', {
+  enumerable: true,
+  value: function (target, count) {
+    Memory.readU8(target);
+    return Instruction._parseRange(target, count);
+  }
+});
+
 Object.defineProperty(ApiResolver.prototype, 'enumerateMatchesSync', {
   enumerable: true,
   value: function (query) {
@@ -684,6 +1148,9 @@ OutputStream.prototype.write = function (data) {
 const _writeAll = OutputStream.prototype._writeAll;
 OutputStream.prototype.writeAll = function (data) {
   const stream = this;
+  const corked = corkedWrites.get(stream);
+  if (corked !== undefined)
+    return queueCorkedWrite(corked, [data], dataSize(data));
   return new Promise(function (resolve, reject) {
     _writeAll.call(stream, data, function (error, size) {
       if (error === null) {
@@ -699,6 +1166,9 @@ OutputStream.prototype.writeAll = function (data) {
 const _writeMemoryRegion = OutputStream.prototype._writeMemoryRegion;
 OutputStream.prototype.writeMemoryRegion = function (address, length) {
   const stream = this;
+  const corked = corkedWrites.get(stream);
+  if (corked !== undefined)
+    return queueCorkedWrite(corked, [address, length], length);
   return new Promise(function (resolve, reject) {
     _writeMemoryRegion.call(stream, address, length, function (error, size) {
       if (error === null) {
@@ -711,6 +1181,98 @@ OutputStream.prototype.writeMemoryRegion = function (address, length) {
   });
 };
 
+/*
+ * Writes issued while a stream is corked are held back and handed to the
+ * native side as one vector when it is uncorked, so that many small writes
+ * cost a single operation. Memory regions are written in place.
+ */
+const corkedWrites = new WeakMap();
+
+OutputStream.prototype.cork = function () {
+  if (!corkedWrites.has(this))
+    corkedWrites.set(this, []);
+};
+
+OutputStream.prototype.uncork = function () {
+  const pending = corkedWrites.get(this);
+  corkedWrites.delete(this);
+  if (pending === undefined || pending.length === 0)
+    return Promise.resolve(0);
+
+  const vectors = pending.reduce((result, write) => {
+    result.push(...write.vector);
+    return result;
+  }, []);
+
+  return writeVectors(this, vectors).then(size => {
+    pending.forEach(write => write.resolve(write.size));
+    return size;
+  }, error => {
+    let offset = 0;
+    pending.forEach(write => {
+      const available = Math.max(error.partialSize - offset, 0);
+      if (available >= write.size) {
+        write.resolve(write.size);
+      } else {
+        const e = new Error(error.message);
+        e.partialSize = available;
+        write.reject(e);
+      }
+      offset += write.size;
+    });
+    throw error;
+  });
+};
+
+OutputStream.prototype.writev = function (items) {
+  if (!(items instanceof Array))
+    throw new Error('expected an array');
+
+  const vectors = [];
+  let size = 0;
+  items.forEach(item => {
+    if (item instanceof NativePointer)
+      throw new Error('memory regions must be given as [address, length]');
+    if (item instanceof Array && item[0] instanceof NativePointer) {
+      vectors.push(item[0], item[1]);
+      size += item[1];
+    } else {
+      vectors.push(item);
+      size += dataSize(item);
+    }
+  });
+
+  const corked = corkedWrites.get(this);
+  if (corked !== undefined)
+    return queueCorkedWrite(corked, vectors, size);
+
+  return writeVectors(this, vectors);
+};
+
+const _writeVectors = OutputStream.prototype._writeVectors;
+function writeVectors(stream, vectors) {
+  return new Promise(function (resolve, reject) {
+    _writeVectors.call(stream, vectors, function (error, size) {
+      if (error === null) {
+        resolve(size);
+      } else {
+        error.partialSize = size;
+        reject(error);
+      }
+    });
+  });
+}
+
+function queueCorkedWrite(pending, vector, size) {
+  return new Promise(function (resolve, reject) {
+    pending.push({ vector, size, resolve, reject });
+  });
+}
+
+function dataSize(data) {
+  return (data instanceof ArrayBuffer) ? data.byteLength : data.length;
+}
+
 const _closeListener = SocketListener.prototype._close;
 SocketListener.prototype.close = function () {
   const listener = this;
@@ -844,6 +1406,22 @@ Object.defineProperties(SqliteDatabase, {
 
       return SqliteDatabase._open(file, flagsValue);
     }
+  },
+  openInline: {
+    enumerable: true,
+    value: function (contents, options = {}) {
+      if (options === null || typeof options !== 'object')
+        throw new Error('invalid argument');
+
+      const {
+        memoryLimit = 0,
+      } = options;
+
+      if (typeof memoryLimit !== 'number' || memoryLimit < 0)
+        throw new Error('memoryLimit must be a non-negative number');
+
+      return SqliteDatabase._openInline(contents, memoryLimit);
+    }
   }
 });
 
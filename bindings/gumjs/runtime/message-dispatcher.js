@@ -22,46 +22,113 @@ function MessageDispatcher() {
   function handleMessage(rawMessage, data) {
     const message = JSON.parse(rawMessage);
     if (message instanceof Array && message[0] === 'frida:rpc') {
-      handleRpcMessage(message[1], message[2], message.slice(3));
+      handleRpcMessage(message[1], message[2], message.slice(3), data);
     } else {
       messages.push([message, data]);
       dispatchMessages();
     }
   }
 
-  function handleRpcMessage(id, operation, params) {
+  /*
+   * A 'call' may come with binary data, which is passed as an extra, last
+   * argument.
+   *
+   * A 'call-batch' carries several calls, each [method, args] or
+   * [method, args, offset, length], where the latter passes that slice of the
+   * binary data as an extra, last argument. It is answered by a single 'ok'
+   * once all calls have completed, with one entry per call: ['ok', value],
+   * ['error', message, name, stack], or ['ok', null, offset, length] for an
+   * ArrayBuffer value, which is found at that slice of the reply's data.
+   */
+  function handleRpcMessage(id, operation, params, data) {
     const exports = rpc.exports;
 
     if (operation === 'call') {
       const method = params[0];
-      const args = params[1];
-
-      if (!exports.hasOwnProperty(method)) {
-        reply(id, 'error', "unable to find method '" + method + "'");
+      const args = (data !== null) ? params[1].concat([data]) : params[1];
+
+      performCall(exports, method, args, (type, result, extra) => {
+        reply(id, type, result, extra);
+      });
+    } else if (operation === 'call-batch') {
+      const calls = params[0];
+      const results = new Array(calls.length);
+      let pending = calls.length;
+
+      if (pending === 0) {
+        replyBatch(id, results);
         return;
       }
 
-      try {
-        const result = exports[method].apply(exports, args);
-        if (typeof result === 'object' && typeof result.then === 'function') {
-          result
-          .then(value => {
-            reply(id, 'ok', value);
-          })
-          .catch(error => {
-            reply(id, 'error', error.message, [error.name, error.stack]);
-          });
-        } else {
-          reply(id, 'ok', result);
-        }
-      } catch (e) {
-        reply(id, 'error', e.message, [e.name, e.stack]);
-      }
+      calls.forEach(([method, args, offset, length], index) => {
+        if (offset !== undefined)
+          args = args.concat([data.slice(offset, offset + length)]);
+
+        performCall(exports, method, args, (type, result, extra) => {
+          results[index] = [type, result].concat(extra || []);
+          if (--pending === 0)
+            replyBatch(id, results);
+        });
+      });
     } else if (operation === 'list') {
       reply(id, 'ok', Object.keys(exports));
     }
   }
 
+  function performCall(exports, method, args, onComplete) {
+    if (!exports.hasOwnProperty(method)) {
+      onComplete('error', "unable to find method '" + method + "'");
+      return;
+    }
+
+    try {
+      const result = exports[method].apply(exports, args);
+      if (typeof result === 'object' && result !== null &&
+          typeof result.then === 'function') {
+        result
+        .then(value => {
+          onComplete('ok', value);
+        })
+        .catch(error => {
+          onComplete('error', error.message, [error.name, error.stack]);
+        });
+      } else {
+        onComplete('ok', result);
+      }
+    } catch (e) {
+      onComplete('error', e.message, [e.name, e.stack]);
+    }
+  }
+
+  function replyBatch(id, results) {
+    const buffers = [];
+    let size = 0;
+
+    results.forEach(result => {
+      const value = result[1];
+      if (result[0] === 'ok' && value instanceof ArrayBuffer) {
+        result[1] = null;
+        result.push(size, value.byteLength);
+        buffers.push(value);
+        size += value.byteLength;
+      }
+    });
+
+    if (buffers.length === 0) {
+      send(['frida:rpc', id, 'ok', results]);
+      return;
+    }
+
+    const data = new Uint8Array(size);
+    let offset = 0;
+    buffers.forEach(buffer => {
+      data.set(new Uint8Array(buffer), offset);
+      offset += buffer.byteLength;
+    });
+
+    send(['frida:rpc', id, 'ok', results], data.buffer);
+  }
+
   function reply(id, type, result, params) {
     params = params || [];
 
@@ -473,6 +473,15 @@ declare class ModuleMap {
      */
     getPath(address: NativePointerValue): string;
 
+    /**
+     * Resolves many addresses in one call, e.g. when post-processing a trace. Takes an ArrayBuffer of native
+     * pointers and returns an ArrayBuffer holding an Int32 module index into `values()`, or -1 if not found,
+     * followed by a Uint32 offset from that module's base, for each of them.
+     *
+     * @param addresses ArrayBuffer of pointers that might belong to modules in the map.
+     */
+    annotate(addresses: ArrayBuffer): ArrayBuffer;
+
     /**
      * Updates the map.
      *
@@ -516,6 +525,18 @@ declare namespace Memory {
      */
     function scanSync(address: NativePointerValue, size: number | UInt64, pattern: string): MemoryScanMatch[];
 
+    /**
+     * Pull-based version of `scan()`. Matches are buffered in a bounded queue and handed out in chunks as they
+     * are asked for, and the scan pauses whenever the queue is full.
+     *
+     * @param address Starting address to scan from.
+     * @param size Number of bytes to scan.
+     * @param pattern Match pattern, see `Memory.scan()` for details.
+     * @param options Options customizing the scan.
+     */
+    function scanIterator(address: NativePointerValue, size: number | UInt64, pattern: string,
+        options?: MemoryScanIteratorOptions): MemoryScanIterator;
+
     /**
      * Allocates `size` bytes of memory on Frida's private heap, or, if `size` is a multiple of Process#pageSize,
      * one or more raw memory pages managed by the OS. The allocated memory will be released when the returned
@@ -526,6 +547,16 @@ declare namespace Memory {
      */
     function alloc(size: number | UInt64): NativePointer;
 
+    /**
+     * Calls `fn` with allocations smaller than Process#pageSize made through Memory#alloc() served from a
+     * scratch arena instead of the garbage collected heap. All of them are released at once when the outermost
+     * arena() call returns, so pointers into the arena must not be kept around after that.
+     *
+     * @param fn Function to call.
+     * @returns The value returned by `fn`.
+     */
+    function arena<T>(fn: () => T): T;
+
     /**
      * Allocates, encodes and writes out `str` as a UTF-8 string on Frida's private heap.
      * See Memory#alloc() for details about its lifetime.
@@ -1044,6 +1075,35 @@ declare interface MemoryScanMatch {
     size: number;
 }
 
+declare interface MemoryScanIteratorOptions {
+    /**
+     * Maximum number of matches per chunk. Defaults to 256.
+     */
+    chunkSize?: number;
+}
+
+declare interface MemoryScanIterator {
+    /**
+     * Requests the next match.
+     */
+    next(): Promise<{ value: MemoryScanMatch | undefined, done: boolean }>;
+
+    /**
+     * Requests up to `chunkSize` matches at once, resolving to null once the scan is done.
+     */
+    readChunk(): Promise<MemoryScanMatch[] | null>;
+
+    /**
+     * Stops the scan, discarding any matches not yet consumed.
+     */
+    cancel(): void;
+
+    /**
+     * Same as `cancel()`, called when leaving a `for await` loop early.
+     */
+    return(): Promise<{ value: undefined, done: true }>;
+}
+
 declare interface KernelMemoryScanCallbacks {
     /**
      * Called with each occurence that was found.
@@ -2081,9 +2141,12 @@ declare namespace MemoryAccessMonitor {
 declare namespace Script {
     const fileName: string;
     const runtime: string;
+    function getStatistics(): any;
     function nextTick(callback: any, args: any): void;
     function pin(): any;
     function setGlobalAccessHandler(): any;
+    function startProfiling(samplingInterval?: number): void;
+    function stopProfiling(): string;
     function unpin(): any;
     namespace sourceMap {
         function resolve(generatedPosition: any): any;
@@ -2092,6 +2155,7 @@ declare namespace Script {
 declare namespace Stalker {
     const queueCapacity: number;
     const queueDrainInterval: number;
+    const stats: any;
     const trustThreshold: number;
     function addCallProbe(): any;
     function follow(first: any, second: any): any;
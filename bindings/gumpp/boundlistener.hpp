@@ -0,0 +1,284 @@
+#ifndef __GUMPP_BOUND_LISTENER_HPP__
+#define __GUMPP_BOUND_LISTENER_HPP__
+
+#include "gumpp.hpp"
+
+#include <gum/gum.h>
+
+/*
+ * A BoundListener<T> is a GumInvocationListener whose interface slots point
+ * straight at T::on_enter and T::on_leave, resolved at compile time. Unlike
+ * InvocationListener there is no proxy object and no virtual dispatch, and
+ * Invocation is a stack value whose accessors go directly to the C API,
+ * so a hook costs about the same as one written against Gum in C.
+ *
+ * T provides either or both of:
+ *
+ *   void on_enter (Gum::Invocation & invocation);
+ *   void on_leave (Gum::Invocation & invocation);
+ *
+ * A missing callback leaves its slot NULL, which the Interceptor skips.
+ */
+
+namespace Gum
+{
+  class Invocation
+  {
+  public:
+    explicit Invocation (GumInvocationContext * context) : context (context) {}
+
+    void * get_function () const
+    {
+      return GUM_FUNCPTR_TO_POINTER (context->function);
+    }
+
+    template <typename T>
+    T get_nth_argument (unsigned int n) const
+    {
+      return (T) GPOINTER_TO_SIZE (gum_cpu_context_get_nth_argument (context->cpu_context, n));
+    }
+
+    void replace_nth_argument (unsigned int n, void * value)
+    {
+      gum_cpu_context_replace_nth_argument (context->cpu_context, n, value);
+    }
+
+    template <typename T>
+    T get_return_value () const
+    {
+      return (T) GPOINTER_TO_SIZE (gum_cpu_context_get_return_value (context->cpu_context));
+    }
+
+    void replace_return_value (void * value)
+    {
+      gum_cpu_context_replace_return_value (context->cpu_context, value);
+    }
+
+    void * get_return_address () const
+    {
+      return gum_invocation_context_get_return_address (context);
+    }
+
+    unsigned int get_thread_id () const
+    {
+      return context->backend->get_thread_id (context);
+    }
+
+    unsigned int get_depth () const
+    {
+      return context->backend->get_depth (context);
+    }
+
+    template <typename T>
+    T * get_listener_thread_data () const
+    {
+      return static_cast<T *> (context->backend->get_listener_thread_data (context, sizeof (T)));
+    }
+
+    template <typename T>
+    T * get_listener_function_data () const
+    {
+      return static_cast<T *> (context->backend->get_listener_function_data (context));
+    }
+
+    template <typename T>
+    T * get_listener_function_invocation_data () const
+    {
+      return static_cast<T *> (context->backend->get_listener_function_invocation_data (context, sizeof (T)));
+    }
+
+    GumCpuContext * get_cpu_context () const
+    {
+      return context->cpu_context;
+    }
+
+    int get_system_error () const
+    {
+      return context->system_error;
+    }
+
+    void replace_system_error (int value)
+    {
+      context->system_error = value;
+    }
+
+    GumInvocationContext * get_handle () const
+    {
+      return context;
+    }
+
+  private:
+    GumInvocationContext * context;
+  };
+
+  namespace BoundListenerDetail
+  {
+    typedef char Yes;
+    typedef char No[2];
+
+    template <typename T>
+    struct HasOnEnter
+    {
+      template <typename U, void (U::*) (Invocation &)> struct Check;
+      template <typename U> static Yes & test (Check<U, &U::on_enter> *);
+      template <typename U> static No & test (...);
+
+      static const bool value = sizeof (test<T> (0)) == sizeof (Yes);
+    };
+
+    template <typename T>
+    struct HasOnLeave
+    {
+      template <typename U, void (U::*) (Invocation &)> struct Check;
+      template <typename U> static Yes & test (Check<U, &U::on_leave> *);
+      template <typename U> static No & test (...);
+
+      static const bool value = sizeof (test<T> (0)) == sizeof (Yes);
+    };
+
+    template <typename L, bool present> struct EnterThunk
+    {
+      static void (* get ()) (GumInvocationListener *, GumInvocationContext *)
+      {
+        return &invoke;
+      }
+
+      static void invoke (GumInvocationListener * listener, GumInvocationContext * context)
+      {
+        Invocation invocation (context);
+        reinterpret_cast<L *> (listener)->get_target ()->on_enter (invocation);
+      }
+    };
+
+    template <typename L> struct EnterThunk<L, false>
+    {
+      static void (* get ()) (GumInvocationListener *, GumInvocationContext *)
+      {
+        return 0;
+      }
+    };
+
+    template <typename L, bool present> struct LeaveThunk
+    {
+      static void (* get ()) (GumInvocationListener *, GumInvocationContext *)
+      {
+        return &invoke;
+      }
+
+      static void invoke (GumInvocationListener * listener, GumInvocationContext * context)
+      {
+        Invocation invocation (context);
+        reinterpret_cast<L *> (listener)->get_target ()->on_leave (invocation);
+      }
+    };
+
+    template <typename L> struct LeaveThunk<L, false>
+    {
+      static void (* get ()) (GumInvocationListener *, GumInvocationContext *)
+      {
+        return 0;
+      }
+    };
+  }
+
+  /*
+   * Instances are GObjects, created with create() and owned through ref()
+   * and unref(), so RefPtr<BoundListener<T> > works as for other objects.
+   * The target is borrowed and must outlive the listener's attachment.
+   */
+  template <typename T>
+  class BoundListener
+  {
+  public:
+    static BoundListener * create (T * target)
+    {
+      BoundListener * listener = static_cast<BoundListener *> (g_object_new (get_type (), NULL));
+      listener->target = target;
+      return listener;
+    }
+
+    void ref ()
+    {
+      g_object_ref (&parent);
+    }
+
+    void unref ()
+    {
+      g_object_unref (&parent);
+    }
+
+    void * get_handle () const
+    {
+      return const_cast<GObject *> (&parent);
+    }
+
+    GumInvocationListener * get_listener () const
+    {
+      return GUM_INVOCATION_LISTENER (get_handle ());
+    }
+
+    T * get_target () const
+    {
+      return target;
+    }
+
+    static GType get_type ()
+    {
+      static volatile gsize gonce_value = 0;
+
+      if (g_once_init_enter (&gonce_value))
+      {
+        static const GInterfaceInfo iface_info = { iface_init, NULL, NULL };
+        gchar * name;
+        GType type;
+
+        /* Unique per instantiation without relying on RTTI being enabled. */
+        name = g_strdup_printf ("GumppBoundListener%p", (void *) &gonce_value);
+        type = g_type_register_static_simple (G_TYPE_OBJECT, name,
+            sizeof (GObjectClass), NULL, sizeof (BoundListener), NULL,
+            static_cast<GTypeFlags> (0));
+        g_type_add_interface_static (type, GUM_TYPE_INVOCATION_LISTENER,
+            &iface_info);
+        g_free (name);
+
+        g_once_init_leave (&gonce_value, type);
+      }
+
+      return static_cast<GType> (gonce_value);
+    }
+
+  private:
+    static void iface_init (gpointer g_iface, gpointer iface_data)
+    {
+      GumInvocationListenerInterface * iface =
+          static_cast<GumInvocationListenerInterface *> (g_iface);
+
+      iface->on_enter = BoundListenerDetail::EnterThunk<BoundListener,
+          BoundListenerDetail::HasOnEnter<T>::value>::get ();
+      iface->on_leave = BoundListenerDetail::LeaveThunk<BoundListener,
+          BoundListenerDetail::HasOnLeave<T>::value>::get ();
+    }
+
+    GObject parent;
+    T * target;
+  };
+
+  template <typename T>
+  bool attach_listener (Interceptor * interceptor, void * function_address, BoundListener<T> * listener, void * listener_function_data = 0)
+  {
+    GumAttachReturn attach_ret = gum_interceptor_attach_listener (
+        static_cast<GumInterceptor *> (interceptor->get_handle ()),
+        function_address, listener->get_listener (), listener_function_data);
+    return attach_ret == GUM_ATTACH_OK;
+  }
+
+  template <typename T>
+  void detach_listener (Interceptor * interceptor, BoundListener<T> * listener)
+  {
+    gum_interceptor_detach_listener (
+        static_cast<GumInterceptor *> (interceptor->get_handle ()),
+        listener->get_listener ());
+  }
+}
+
+#endif
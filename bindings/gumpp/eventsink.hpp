@@ -0,0 +1,289 @@
+#ifndef __GUMPP_EVENT_SINK_HPP__
+#define __GUMPP_EVENT_SINK_HPP__
+
+#include "gumpp.hpp"
+
+#include <gum/gum.h>
+#include <new>
+#include <utility>
+
+/*
+ * A BoundEventSink<T> is a GumEventSink that copies each event into an
+ * EventBuffer and hands T whole batches, so consuming a trace costs no
+ * virtual call per event. T provides:
+ *
+ *   void on_events (Gum::EventBuffer && events);
+ *
+ * Moving out of `events` keeps the batch without copying it, and the sink
+ * allocates a replacement. Leaving it alone lets the sink reuse it.
+ *
+ * Batches are delivered on the followed thread when the buffer fills up,
+ * and on whichever thread flushes or stops the sink. Deliveries never
+ * overlap and arrive in order.
+ */
+
+namespace Gum
+{
+  class EventSpan
+  {
+  public:
+    EventSpan () : items (nullptr), count (0) {}
+    EventSpan (const GumEvent * items, size_t count) : items (items), count (count) {}
+
+    const GumEvent * begin () const { return items; }
+    const GumEvent * end () const { return items + count; }
+    const GumEvent * data () const { return items; }
+    size_t size () const { return count; }
+    bool empty () const { return count == 0; }
+
+    const GumEvent & operator[] (size_t index) const { return items[index]; }
+
+  private:
+    const GumEvent * items;
+    size_t count;
+  };
+
+  class EventBuffer
+  {
+  public:
+    EventBuffer () : items (nullptr), count (0), allocated (0) {}
+
+    explicit EventBuffer (size_t capacity)
+      : items (g_new (GumEvent, capacity)),
+        count (0),
+        allocated (capacity)
+    {
+    }
+
+    EventBuffer (EventBuffer && other)
+      : items (other.items),
+        count (other.count),
+        allocated (other.allocated)
+    {
+      other.items = nullptr;
+      other.count = 0;
+      other.allocated = 0;
+    }
+
+    EventBuffer & operator= (EventBuffer && other)
+    {
+      if (this != &other)
+      {
+        g_free (items);
+        items = other.items;
+        count = other.count;
+        allocated = other.allocated;
+        other.items = nullptr;
+        other.count = 0;
+        other.allocated = 0;
+      }
+      return *this;
+    }
+
+    EventBuffer (const EventBuffer &) = delete;
+    EventBuffer & operator= (const EventBuffer &) = delete;
+
+    ~EventBuffer ()
+    {
+      g_free (items);
+    }
+
+    const GumEvent * begin () const { return items; }
+    const GumEvent * end () const { return items + count; }
+    size_t size () const { return count; }
+    size_t capacity () const { return allocated; }
+    bool empty () const { return count == 0; }
+    bool is_null () const { return items == nullptr; }
+    bool is_full () const { return count == allocated; }
+
+    const GumEvent & operator[] (size_t index) const { return items[index]; }
+
+    EventSpan span () const
+    {
+      return EventSpan (items, count);
+    }
+
+    void push (const GumEvent & ev)
+    {
+      items[count++] = ev;
+    }
+
+    void clear ()
+    {
+      count = 0;
+    }
+
+  private:
+    GumEvent * items;
+    size_t count;
+    size_t allocated;
+  };
+
+  template <typename T>
+  class BoundEventSink
+  {
+  public:
+    static const size_t default_capacity = 4096;
+
+    static BoundEventSink * create (T * target, GumEventType mask, size_t capacity = default_capacity)
+    {
+      BoundEventSink * sink = static_cast<BoundEventSink *> (g_object_new (get_type (), NULL));
+      sink->target = target;
+      sink->mask = mask;
+      sink->buffer = EventBuffer (capacity);
+      return sink;
+    }
+
+    void ref ()
+    {
+      g_object_ref (&parent);
+    }
+
+    void unref ()
+    {
+      g_object_unref (&parent);
+    }
+
+    void * get_handle () const
+    {
+      return const_cast<GObject *> (&parent);
+    }
+
+    GumEventSink * get_sink () const
+    {
+      return GUM_EVENT_SINK (get_handle ());
+    }
+
+    T * get_target () const
+    {
+      return target;
+    }
+
+    static GType get_type ()
+    {
+      static volatile gsize gonce_value = 0;
+
+      if (g_once_init_enter (&gonce_value))
+      {
+        static const GInterfaceInfo iface_info = { iface_init, NULL, NULL };
+        gchar * name;
+        GType type;
+
+        /* Unique per instantiation without relying on RTTI being enabled. */
+        name = g_strdup_printf ("GumppBoundEventSink%p", (void *) &gonce_value);
+        type = g_type_register_static_simple (G_TYPE_OBJECT, name,
+            sizeof (GObjectClass), class_init, sizeof (BoundEventSink),
+            instance_init, static_cast<GTypeFlags> (0));
+        g_type_add_interface_static (type, GUM_TYPE_EVENT_SINK, &iface_info);
+        g_free (name);
+
+        g_once_init_leave (&gonce_value, type);
+      }
+
+      return static_cast<GType> (gonce_value);
+    }
+
+  private:
+    static void class_init (gpointer klass, gpointer class_data)
+    {
+      parent_class () = static_cast<GObjectClass *> (g_type_class_peek_parent (klass));
+      G_OBJECT_CLASS (klass)->finalize = finalize;
+    }
+
+    static void instance_init (GTypeInstance * instance, gpointer g_class)
+    {
+      BoundEventSink * self = reinterpret_cast<BoundEventSink *> (instance);
+
+      self->target = nullptr;
+      self->mask = GUM_NOTHING;
+      new (&self->buffer) EventBuffer ();
+      gum_spinlock_init (&self->lock);
+    }
+
+    static void finalize (GObject * object)
+    {
+      BoundEventSink * self = reinterpret_cast<BoundEventSink *> (object);
+
+      gum_spinlock_free (&self->lock);
+      self->buffer.~EventBuffer ();
+
+      parent_class ()->finalize (object);
+    }
+
+    static GObjectClass *& parent_class ()
+    {
+      static GObjectClass * klass = nullptr;
+      return klass;
+    }
+
+    static void iface_init (gpointer g_iface, gpointer iface_data)
+    {
+      GumEventSinkInterface * iface = static_cast<GumEventSinkInterface *> (g_iface);
+
+      iface->query_mask = query_mask;
+      iface->process = process;
+      iface->flush = flush;
+      iface->stop = flush;
+    }
+
+    static GumEventType query_mask (GumEventSink * sink)
+    {
+      return reinterpret_cast<BoundEventSink *> (sink)->mask;
+    }
+
+    static void process (GumEventSink * sink, const GumEvent * ev)
+    {
+      BoundEventSink * self = reinterpret_cast<BoundEventSink *> (sink);
+
+      gum_spinlock_acquire (&self->lock);
+      self->buffer.push (*ev);
+      if (self->buffer.is_full ())
+        self->deliver ();
+      gum_spinlock_release (&self->lock);
+    }
+
+    static void flush (GumEventSink * sink)
+    {
+      BoundEventSink * self = reinterpret_cast<BoundEventSink *> (sink);
+
+      gum_spinlock_acquire (&self->lock);
+      if (!self->buffer.empty ())
+        self->deliver ();
+      gum_spinlock_release (&self->lock);
+    }
+
+    void deliver ()
+    {
+      size_t capacity = buffer.capacity ();
+
+      target->on_events (std::move (buffer));
+
+      if (buffer.is_null ())
+        buffer = EventBuffer (capacity);
+      else
+        buffer.clear ();
+    }
+
+    GObject parent;
+    T * target;
+    GumEventType mask;
+    EventBuffer buffer;
+    GumSpinlock lock;
+  };
+
+  template <typename T>
+  void follow_me (Stalker * stalker, BoundEventSink<T> * sink)
+  {
+    gum_stalker_follow_me (static_cast<GumStalker *> (stalker->get_handle ()),
+        NULL, sink->get_sink ());
+  }
+
+  template <typename T>
+  void follow (Stalker * stalker, unsigned int thread_id, BoundEventSink<T> * sink)
+  {
+    gum_stalker_follow (static_cast<GumStalker *> (stalker->get_handle ()),
+        thread_id, NULL, sink->get_sink ());
+  }
+}
+
+#endif
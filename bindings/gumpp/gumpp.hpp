@@ -241,6 +241,24 @@ namespace Gum
 
   GUMPP_CAPI Profiler * Profiler_new (void);
 
+  struct Stalker : public Object
+  {
+    virtual void exclude (void * base_address, size_t size) = 0;
+
+    virtual int get_trust_threshold () = 0;
+    virtual void set_trust_threshold (int trust_threshold) = 0;
+
+    virtual void flush () = 0;
+    virtual void stop () = 0;
+    virtual bool garbage_collect () = 0;
+
+    virtual void unfollow_me () = 0;
+    virtual bool is_following_me () = 0;
+    virtual void unfollow (unsigned int thread_id) = 0;
+  };
+
+  GUMPP_CAPI Stalker * Stalker_new (void);
+
   GUMPP_CAPI void * find_function_ptr (const char * str);
   GUMPP_CAPI PtrArray * find_matching_functions_array (const char * str);
 
@@ -0,0 +1,74 @@
+#include "gumpp.hpp"
+
+#include "objectwrapper.hpp"
+#include "runtime.hpp"
+
+#include <gum/gum.h>
+
+namespace Gum
+{
+  class StalkerImpl : public ObjectWrapper<StalkerImpl, Stalker, GumStalker>
+  {
+  public:
+    StalkerImpl ()
+    {
+      Runtime::ref ();
+      assign_handle (gum_stalker_new ());
+    }
+
+    virtual ~StalkerImpl ()
+    {
+      Runtime::unref ();
+    }
+
+    virtual void exclude (void * base_address, size_t size)
+    {
+      GumMemoryRange range;
+      range.base_address = GUM_ADDRESS (base_address);
+      range.size = size;
+      gum_stalker_exclude (handle, &range);
+    }
+
+    virtual int get_trust_threshold ()
+    {
+      return gum_stalker_get_trust_threshold (handle);
+    }
+
+    virtual void set_trust_threshold (int trust_threshold)
+    {
+      gum_stalker_set_trust_threshold (handle, trust_threshold);
+    }
+
+    virtual void flush ()
+    {
+      gum_stalker_flush (handle);
+    }
+
+    virtual void stop ()
+    {
+      gum_stalker_stop (handle);
+    }
+
+    virtual bool garbage_collect ()
+    {
+      return gum_stalker_garbage_collect (handle) != FALSE;
+    }
+
+    virtual void unfollow_me ()
+    {
+      gum_stalker_unfollow_me (handle);
+    }
+
+    virtual bool is_following_me ()
+    {
+      return gum_stalker_is_following_me (handle) != FALSE;
+    }
+
+    virtual void unfollow (unsigned int thread_id)
+    {
+      gum_stalker_unfollow (handle, thread_id);
+    }
+  };
+
+  extern "C" Stalker * Stalker_new (void) { return new StalkerImpl; }
+}
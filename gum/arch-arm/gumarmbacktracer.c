@@ -79,6 +79,7 @@ gum_arm_backtracer_generate (GumBacktracer * backtracer,
 {
   GumArmBacktracer * self;
   GumInvocationStack * invocation_stack;
+  guint invocation_depth = 0;
   gsize * start_address;
   guint skips_pending, i;
   gsize * p;
@@ -120,8 +121,8 @@ gum_arm_backtracer_generate (GumBacktracer * backtracer,
     {
       gsize translated_value;
 
-      translated_value = GPOINTER_TO_SIZE (gum_invocation_stack_translate (
-          invocation_stack, GSIZE_TO_POINTER (value)));
+      translated_value = GPOINTER_TO_SIZE (gum_invocation_stack_translate_next (
+          invocation_stack, GSIZE_TO_POINTER (value), &invocation_depth));
       if (translated_value != value)
       {
         value = translated_value;
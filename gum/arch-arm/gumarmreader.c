@@ -4,6 +4,8 @@
 
 #include "gumarmreader.h"
 
+#include "gumcapstone.h"
+
 static cs_insn * disassemble_instruction_at (gconstpointer address);
 
 static guint gum_rotate_right_32bit (guint val, guint rotation);
@@ -117,18 +119,13 @@ static cs_insn *
 disassemble_instruction_at (gconstpointer address)
 {
   csh capstone;
-  cs_err err;
   cs_insn * insn = NULL;
 
-  err = cs_open (CS_ARCH_ARM, CS_MODE_ARM, &capstone);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
-  err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
+  capstone = gum_capstone_get (CS_ARCH_ARM, CS_MODE_ARM,
+      GUM_CAPSTONE_DETAIL_ON);
 
   cs_disasm (capstone, address, 4, GPOINTER_TO_SIZE (address), 1, &insn);
 
-  cs_close (&capstone);
-
   return insn;
 }
 
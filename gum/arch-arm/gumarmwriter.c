@@ -69,9 +69,9 @@ gum_arm_writer_init (GumArmWriter * writer,
 {
   writer->ref_count = 1;
 
-  writer->id_to_address = g_hash_table_new (NULL, NULL);
-  writer->label_refs = g_array_new (FALSE, FALSE, sizeof (GumArmLabelRef));
-  writer->literal_refs = g_array_new (FALSE, FALSE, sizeof (GumArmLiteralRef));
+  gum_label_table_init (&writer->label_defs);
+  gum_ref_array_init (&writer->label_refs, sizeof (GumArmLabelRef));
+  gum_ref_array_init (&writer->literal_refs, sizeof (GumArmLiteralRef));
 
   gum_arm_writer_reset (writer, code_address);
 }
@@ -81,9 +81,9 @@ gum_arm_writer_clear (GumArmWriter * writer)
 {
   gum_arm_writer_flush (writer);
 
-  g_hash_table_unref (writer->id_to_address);
-  g_array_free (writer->label_refs, TRUE);
-  g_array_free (writer->literal_refs, TRUE);
+  gum_label_table_free (&writer->label_defs);
+  gum_ref_array_free (&writer->label_refs);
+  gum_ref_array_free (&writer->literal_refs);
 }
 
 void
@@ -96,9 +96,9 @@ gum_arm_writer_reset (GumArmWriter * writer,
   writer->code = code_address;
   writer->pc = GUM_ADDRESS (code_address);
 
-  g_hash_table_remove_all (writer->id_to_address);
-  g_array_set_size (writer->label_refs, 0);
-  g_array_set_size (writer->literal_refs, 0);
+  gum_label_table_clear (&writer->label_defs);
+  gum_ref_array_clear (&writer->label_refs);
+  gum_ref_array_clear (&writer->literal_refs);
   writer->earliest_literal_insn = NULL;
 }
 
@@ -141,8 +141,8 @@ gum_arm_writer_flush (GumArmWriter * self)
 
 error:
   {
-    g_array_set_size (self->label_refs, 0);
-    g_array_set_size (self->literal_refs, 0);
+    gum_ref_array_clear (&self->label_refs);
+    gum_ref_array_clear (&self->literal_refs);
 
     return FALSE;
   }
@@ -152,39 +152,33 @@ gboolean
 gum_arm_writer_put_label (GumArmWriter * self,
                           gconstpointer id)
 {
-  if (g_hash_table_lookup (self->id_to_address, id) != NULL)
-    return FALSE;
-
-  g_hash_table_insert (self->id_to_address, (gpointer) id, self->code);
-  return TRUE;
+  return gum_label_table_insert (&self->label_defs, id, self->code);
 }
 
 static void
 gum_arm_writer_add_label_reference_here (GumArmWriter * self,
                                          gconstpointer id)
 {
-  GumArmLabelRef r;
+  GumArmLabelRef * r;
 
-  r.id = id;
-  r.insn = self->code;
-
-  g_array_append_val (self->label_refs, r);
+  r = gum_ref_array_append (&self->label_refs);
+  r->id = id;
+  r->insn = self->code;
 }
 
 static void
 gum_arm_writer_add_literal_reference_here (GumArmWriter * self,
                                            guint32 val)
 {
-  GumArmLiteralRef r;
-
-  r.insn = self->code;
-  r.val = val;
+  GumArmLiteralRef * r;
 
-  g_array_append_val (self->literal_refs, r);
+  r = gum_ref_array_append (&self->literal_refs);
+  r->insn = self->code;
+  r->val = val;
 
   if (self->earliest_literal_insn == NULL)
   {
-    self->earliest_literal_insn = r.insn;
+    self->earliest_literal_insn = r->insn;
   }
 }
 
@@ -329,7 +323,7 @@ gum_arm_writer_try_commit_label_refs (GumArmWriter * self)
 {
   guint num_refs, ref_index;
 
-  num_refs = self->label_refs->len;
+  num_refs = self->label_refs.length;
   for (ref_index = 0; ref_index != num_refs; ref_index++)
   {
     GumArmLabelRef * r;
@@ -337,9 +331,9 @@ gum_arm_writer_try_commit_label_refs (GumArmWriter * self)
     gssize distance;
     guint32 insn;
 
-    r = &g_array_index (self->label_refs, GumArmLabelRef, ref_index);
+    r = gum_ref_array_element_at (&self->label_refs, ref_index);
 
-    target_insn = g_hash_table_lookup (self->id_to_address, r->id);
+    target_insn = gum_label_table_lookup (&self->label_defs, r->id);
     if (target_insn == NULL)
       return FALSE;
 
@@ -352,7 +346,7 @@ gum_arm_writer_try_commit_label_refs (GumArmWriter * self)
     *r->insn = GUINT32_TO_LE (insn);
   }
 
-  g_array_set_size (self->label_refs, 0);
+  gum_ref_array_clear (&self->label_refs);
 
   return TRUE;
 }
@@ -367,7 +361,7 @@ gum_arm_writer_maybe_commit_literals (GumArmWriter * self)
     return;
 
   space_used = (self->code - self->earliest_literal_insn) * sizeof (guint32);
-  space_used += self->literal_refs->len * sizeof (guint32);
+  space_used += self->literal_refs.length * sizeof (guint32);
   if (space_used <= 4096)
     return;
 
@@ -384,7 +378,7 @@ gum_arm_writer_commit_literals (GumArmWriter * self)
   guint num_refs, ref_index;
   guint32 * first_slot, * last_slot;
 
-  num_refs = self->literal_refs->len;
+  num_refs = self->literal_refs.length;
   if (num_refs == 0)
     return;
 
@@ -398,7 +392,7 @@ gum_arm_writer_commit_literals (GumArmWriter * self)
     gint64 distance_in_words;
     guint32 insn;
 
-    r = &g_array_index (self->literal_refs, GumArmLiteralRef, ref_index);
+    r = gum_ref_array_element_at (&self->literal_refs, ref_index);
 
     for (cur_slot = first_slot; cur_slot != last_slot; cur_slot++)
     {
@@ -424,5 +418,5 @@ gum_arm_writer_commit_literals (GumArmWriter * self)
   self->code = last_slot;
   self->pc += (guint8 *) last_slot - (guint8 *) first_slot;
 
-  g_array_set_size (self->literal_refs, 0);
+  gum_ref_array_clear (&self->literal_refs);
 }
@@ -9,6 +9,7 @@
 
 #include <capstone/capstone.h>
 #include <gum/gumdefs.h>
+#include <gum/gumlabeltable.h>
 
 #define GUM_ARM_B_MAX_DISTANCE 0x01fffffc
 
@@ -26,9 +27,9 @@ struct _GumArmWriter
   guint32 * code;
   GumAddress pc;
 
-  GHashTable * id_to_address;
-  GArray * label_refs;
-  GArray * literal_refs;
+  GumLabelTable label_defs;
+  GumRefArray label_refs;
+  GumRefArray literal_refs;
   const guint32 * earliest_literal_insn;
 };
 
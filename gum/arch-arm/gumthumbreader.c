@@ -6,7 +6,7 @@
 
 #include "gumthumbreader.h"
 
-#include <capstone/capstone.h>
+#include "gumcapstone.h"
 
 static cs_insn * disassemble_instruction_at (gconstpointer address);
 
@@ -37,17 +37,12 @@ disassemble_instruction_at (gconstpointer address)
 {
   gconstpointer code = GSIZE_TO_POINTER (GPOINTER_TO_SIZE (address) & ~1);
   csh capstone;
-  cs_err err;
   cs_insn * insn = NULL;
 
-  err = cs_open (CS_ARCH_ARM, CS_MODE_THUMB, &capstone);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
-  err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
+  capstone = gum_capstone_get (CS_ARCH_ARM, CS_MODE_THUMB,
+      GUM_CAPSTONE_DETAIL_ON);
 
   cs_disasm (capstone, code, 16, GPOINTER_TO_SIZE (code), 1, &insn);
 
-  cs_close (&capstone);
-
   return insn;
 }
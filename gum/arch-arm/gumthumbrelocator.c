@@ -6,6 +6,7 @@
 
 #include "gumthumbrelocator.h"
 
+#include "gumcapstone.h"
 #include "gummemory.h"
 
 #define GUM_MAX_INPUT_INSN_COUNT (100)
@@ -410,15 +411,12 @@ gum_thumb_relocator_can_relocate (gpointer address,
   else
   {
     csh capstone;
-    cs_err err;
     cs_insn * insn;
     size_t count, i;
     gboolean eoi;
 
-    err = cs_open (CS_ARCH_ARM, CS_MODE_THUMB, &capstone);
-    g_assert_cmpint (err, == , CS_ERR_OK);
-    err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-    g_assert_cmpint (err, ==, CS_ERR_OK);
+    capstone = gum_capstone_get (CS_ARCH_ARM, CS_MODE_THUMB,
+        GUM_CAPSTONE_DETAIL_ON);
 
     count = cs_disasm (capstone, rl.input_cur, 1024, rl.input_pc, 0, &insn);
     g_assert (insn != NULL);
@@ -457,8 +455,6 @@ gum_thumb_relocator_can_relocate (gpointer address,
     }
 
     cs_free (insn, count);
-
-    cs_close (&capstone);
   }
 
   gum_thumb_relocator_clear (&rl);
@@ -110,11 +110,9 @@ gum_thumb_writer_init (GumThumbWriter * writer,
 {
   writer->ref_count = 1;
 
-  writer->id_to_address = g_hash_table_new (NULL, NULL);
-  writer->label_refs = g_array_new (FALSE, FALSE,
-      sizeof (GumThumbLabelRef));
-  writer->literal_refs = g_array_new (FALSE, FALSE,
-      sizeof (GumThumbLiteralRef));
+  gum_label_table_init (&writer->label_defs);
+  gum_ref_array_init (&writer->label_refs, sizeof (GumThumbLabelRef));
+  gum_ref_array_init (&writer->literal_refs, sizeof (GumThumbLiteralRef));
 
   gum_thumb_writer_reset (writer, code_address);
 }
@@ -124,9 +122,9 @@ gum_thumb_writer_clear (GumThumbWriter * writer)
 {
   gum_thumb_writer_flush (writer);
 
-  g_hash_table_unref (writer->id_to_address);
-  g_array_free (writer->label_refs, TRUE);
-  g_array_free (writer->literal_refs, TRUE);
+  gum_label_table_free (&writer->label_defs);
+  gum_ref_array_free (&writer->label_refs);
+  gum_ref_array_free (&writer->literal_refs);
 }
 
 void
@@ -139,9 +137,9 @@ gum_thumb_writer_reset (GumThumbWriter * writer,
   writer->code = code_address;
   writer->pc = GUM_ADDRESS (code_address);
 
-  g_hash_table_remove_all (writer->id_to_address);
-  g_array_set_size (writer->label_refs, 0);
-  g_array_set_size (writer->literal_refs, 0);
+  gum_label_table_clear (&writer->label_defs);
+  gum_ref_array_clear (&writer->label_refs);
+  gum_ref_array_clear (&writer->literal_refs);
   writer->earliest_literal_insn = NULL;
 }
 
@@ -184,8 +182,8 @@ gum_thumb_writer_flush (GumThumbWriter * self)
 
 error:
   {
-    g_array_set_size (self->label_refs, 0);
-    g_array_set_size (self->literal_refs, 0);
+    gum_ref_array_clear (&self->label_refs);
+    gum_ref_array_clear (&self->literal_refs);
 
     return FALSE;
   }
@@ -195,11 +193,7 @@ gboolean
 gum_thumb_writer_put_label (GumThumbWriter * self,
                             gconstpointer id)
 {
-  if (g_hash_table_lookup (self->id_to_address, id) != NULL)
-    return FALSE;
-
-  g_hash_table_insert (self->id_to_address, (gpointer) id, self->code);
-  return TRUE;
+  return gum_label_table_insert (&self->label_defs, id, self->code);
 }
 
 static void
@@ -207,30 +201,28 @@ gum_thumb_writer_add_label_reference_here (GumThumbWriter * self,
                                            gconstpointer id,
                                            GumThumbLabelRefType type)
 {
-  GumThumbLabelRef r;
+  GumThumbLabelRef * r;
 
-  r.id = id;
-  r.type = type;
-  r.insn = self->code;
-
-  g_array_append_val (self->label_refs, r);
+  r = gum_ref_array_append (&self->label_refs);
+  r->id = id;
+  r->type = type;
+  r->insn = self->code;
 }
 
 static void
 gum_thumb_writer_add_literal_reference_here (GumThumbWriter * self,
                                              guint32 val)
 {
-  GumThumbLiteralRef r;
-
-  r.val = val;
-  r.insn = self->code;
-  r.pc = self->pc + 4;
+  GumThumbLiteralRef * r;
 
-  g_array_append_val (self->literal_refs, r);
+  r = gum_ref_array_append (&self->literal_refs);
+  r->val = val;
+  r->insn = self->code;
+  r->pc = self->pc + 4;
 
   if (self->earliest_literal_insn == NULL)
   {
-    self->earliest_literal_insn = r.insn;
+    self->earliest_literal_insn = r->insn;
   }
 }
 
@@ -1139,7 +1131,7 @@ gum_thumb_writer_try_commit_label_refs (GumThumbWriter * self)
 {
   guint num_refs, ref_index;
 
-  num_refs = self->label_refs->len;
+  num_refs = self->label_refs.length;
   for (ref_index = 0; ref_index != num_refs; ref_index++)
   {
     GumThumbLabelRef * r;
@@ -1147,9 +1139,9 @@ gum_thumb_writer_try_commit_label_refs (GumThumbWriter * self)
     gssize distance;
     guint16 insn;
 
-    r = &g_array_index (self->label_refs, GumThumbLabelRef, ref_index);
+    r = gum_ref_array_element_at (&self->label_refs, ref_index);
 
-    target_insn = g_hash_table_lookup (self->id_to_address, r->id);
+    target_insn = gum_label_table_lookup (&self->label_defs, r->id);
     if (target_insn == NULL)
       return FALSE;
 
@@ -1254,7 +1246,7 @@ gum_thumb_writer_try_commit_label_refs (GumThumbWriter * self)
     *r->insn = GUINT16_TO_LE (insn);
   }
 
-  g_array_set_size (self->label_refs, 0);
+  gum_ref_array_clear (&self->label_refs);
 
   return TRUE;
 }
@@ -1269,7 +1261,7 @@ gum_thumb_writer_maybe_commit_literals (GumThumbWriter * self)
     return;
 
   space_used = (self->code - self->earliest_literal_insn) * sizeof (guint16);
-  space_used += self->literal_refs->len * sizeof (guint32);
+  space_used += self->literal_refs.length * sizeof (guint32);
   if (space_used <= 1024)
     return;
 
@@ -1287,7 +1279,7 @@ gum_thumb_writer_commit_literals (GumThumbWriter * self)
   gboolean need_alignment_padding;
   guint32 * first_slot, * last_slot;
 
-  num_refs = self->literal_refs->len;
+  num_refs = self->literal_refs.length;
   if (num_refs == 0)
     return;
 
@@ -1308,7 +1300,7 @@ gum_thumb_writer_commit_literals (GumThumbWriter * self)
     GumAddress slot_pc;
     gsize distance_in_bytes;
 
-    r = &g_array_index (self->literal_refs, GumThumbLiteralRef, ref_index);
+    r = gum_ref_array_element_at (&self->literal_refs, ref_index);
     insn = GUINT16_FROM_LE (r->insn[0]);
 
     for (slot = first_slot; slot != last_slot; slot++)
@@ -1341,7 +1333,7 @@ gum_thumb_writer_commit_literals (GumThumbWriter * self)
     }
   }
 
-  g_array_set_size (self->literal_refs, 0);
+  gum_ref_array_clear (&self->literal_refs);
 }
 
 static gboolean
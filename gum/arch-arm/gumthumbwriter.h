@@ -9,6 +9,7 @@
 
 #include <capstone/capstone.h>
 #include <gum/gumdefs.h>
+#include <gum/gumlabeltable.h>
 
 #define GUM_THUMB_B_MAX_DISTANCE 0x00fffffe
 
@@ -26,9 +27,9 @@ struct _GumThumbWriter
   guint16 * code;
   GumAddress pc;
 
-  GHashTable * id_to_address;
-  GArray * label_refs;
-  GArray * literal_refs;
+  GumLabelTable label_defs;
+  GumRefArray label_refs;
+  GumRefArray literal_refs;
   const guint16 * earliest_literal_insn;
 };
 
@@ -6,7 +6,7 @@
 
 #include "gumarm64reader.h"
 
-#include <capstone/capstone.h>
+#include "gumcapstone.h"
 
 static cs_insn * disassemble_instruction_at (gconstpointer address);
 
@@ -34,17 +34,12 @@ static cs_insn *
 disassemble_instruction_at (gconstpointer address)
 {
   csh capstone;
-  cs_err err;
   cs_insn * insn = NULL;
 
-  err = cs_open (CS_ARCH_ARM64, CS_MODE_LITTLE_ENDIAN, &capstone);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
-  err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
+  capstone = gum_capstone_get (CS_ARCH_ARM64, CS_MODE_LITTLE_ENDIAN,
+      GUM_CAPSTONE_DETAIL_ON);
 
   cs_disasm (capstone, address, 16, GPOINTER_TO_SIZE (address), 1, &insn);
 
-  cs_close (&capstone);
-
   return insn;
 }
@@ -8,11 +8,19 @@
 
 #include "gumarm64relocator.h"
 
+#include "gum-init.h"
+#include "gumcapstone.h"
 #include "gummemory.h"
 
+#include <string.h>
+
 #define GUM_MAX_INPUT_INSN_COUNT (100)
 
+#define GUM_MAX_ANALYSIS_CODE_SIZE 16
+#define GUM_MAX_CACHED_ANALYSES 1024
+
 typedef struct _GumCodeGenCtx GumCodeGenCtx;
+typedef struct _GumArm64Analysis GumArm64Analysis;
 
 struct _GumCodeGenCtx
 {
@@ -22,6 +30,27 @@ struct _GumCodeGenCtx
   GumArm64Writer * output;
 };
 
+struct _GumArm64Analysis
+{
+  guint8 code[GUM_MAX_ANALYSIS_CODE_SIZE];
+  guint code_size;
+  GumRelocationScenario scenario;
+
+  guint maximum;
+  arm64_reg scratch_reg;
+};
+
+static gboolean gum_arm64_analysis_try_init_key (GumArm64Analysis * key,
+    gconstpointer address, guint min_bytes, GumRelocationScenario scenario);
+static const GumArm64Analysis * gum_arm64_analysis_lookup (
+    const GumArm64Analysis * key);
+static void gum_arm64_analysis_insert (const GumArm64Analysis * analysis);
+static guint gum_arm64_analysis_hash (const GumArm64Analysis * analysis);
+static gboolean gum_arm64_analysis_equal (const GumArm64Analysis * a,
+    const GumArm64Analysis * b);
+static void gum_arm64_analysis_free (GumArm64Analysis * analysis);
+static void gum_arm64_analysis_cache_deinit (void);
+
 static gboolean gum_arm64_branch_is_unconditional (const cs_insn * insn);
 
 static gboolean gum_arm64_relocator_rewrite_ldr (GumArm64Relocator * self,
@@ -39,6 +68,9 @@ static gboolean gum_arm64_relocator_rewrite_cbz (GumArm64Relocator * self,
 static gboolean gum_arm64_relocator_rewrite_tbz (GumArm64Relocator * self,
     GumCodeGenCtx * ctx);
 
+G_LOCK_DEFINE_STATIC (gum_arm64_analysis_cache);
+static GHashTable * gum_arm64_analysis_cache = NULL;
+
 GumArm64Relocator *
 gum_arm64_relocator_new (gconstpointer input_code,
                          GumArm64Writer * output)
@@ -339,6 +371,33 @@ gum_arm64_relocator_can_relocate (gpointer address,
   GumArm64Writer cw;
   GumArm64Relocator rl;
   guint reloc_bytes;
+  GumArm64Analysis analysis;
+  gboolean cacheable;
+  arm64_reg scratch_reg;
+
+  /*
+   * When the code read ends the block, e.g. for a stub or thunk, the result
+   * depends on nothing but those bytes. Many targets share them, so such
+   * results are remembered and later lookups skip decoding altogether.
+   */
+  cacheable = gum_arm64_analysis_try_init_key (&analysis, address, min_bytes,
+      scenario);
+  if (cacheable)
+  {
+    const GumArm64Analysis * cached;
+
+    G_LOCK (gum_arm64_analysis_cache);
+    cached = gum_arm64_analysis_lookup (&analysis);
+    if (cached != NULL)
+    {
+      n = cached->maximum;
+      scratch_reg = cached->scratch_reg;
+    }
+    G_UNLOCK (gum_arm64_analysis_cache);
+
+    if (cached != NULL)
+      goto beach;
+  }
 
   buf = g_alloca (3 * min_bytes);
   gum_arm64_writer_init (&cw, buf);
@@ -382,23 +441,22 @@ gum_arm64_relocator_can_relocate (gpointer address,
 
   if (!rl.eoi)
   {
-    GHashTable * checked_targets, * targets_to_check;
+    GumLabelTable checked_targets;
+    GumRefArray targets_to_check;
     csh capstone;
-    cs_err err;
     cs_insn * insn;
     const guint8 * current_code;
     uint64_t current_address;
     size_t current_code_size;
     gpointer target;
-    GHashTableIter iter;
 
-    checked_targets = g_hash_table_new (NULL, NULL);
-    targets_to_check = g_hash_table_new (NULL, NULL);
+    cacheable = FALSE;
 
-    err = cs_open (CS_ARCH_ARM64, CS_MODE_LITTLE_ENDIAN, &capstone);
-    g_assert_cmpint (err, == , CS_ERR_OK);
-    err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-    g_assert_cmpint (err, ==, CS_ERR_OK);
+    gum_label_table_init (&checked_targets);
+    gum_ref_array_init (&targets_to_check, sizeof (gpointer));
+
+    capstone = gum_capstone_get (CS_ARCH_ARM64, CS_MODE_LITTLE_ENDIAN,
+        GUM_CAPSTONE_DETAIL_ON);
 
     insn = cs_malloc (capstone);
     current_code = rl.input_cur;
@@ -408,8 +466,14 @@ gum_arm64_relocator_can_relocate (gpointer address,
     do
     {
       gboolean carry_on = TRUE;
+      gssize offset;
+
+      gum_label_table_insert (&checked_targets, current_code,
+          (gpointer) current_code);
 
-      g_hash_table_add (checked_targets, (gpointer) current_code);
+      offset = (gssize) current_code - (gssize) address;
+      if (offset > 0 && offset < (gssize) n)
+        n = offset;
 
       while (carry_on && cs_disasm_iter (capstone, &current_code,
           &current_code_size, &current_address, insn))
@@ -424,8 +488,11 @@ gum_arm64_relocator_can_relocate (gpointer address,
 
             g_assert (op->type == ARM64_OP_IMM);
             target = GSIZE_TO_POINTER (op->imm);
-            if (!g_hash_table_contains (checked_targets, target))
-              g_hash_table_add (targets_to_check, target);
+            if (gum_label_table_lookup (&checked_targets, target) == NULL)
+            {
+              *((gpointer *) gum_ref_array_append (&targets_to_check)) =
+                  target;
+            }
 
             carry_on = d->cc != ARM64_CC_INVALID && d->cc != ARM64_CC_AL &&
                 d->cc != ARM64_CC_NV;
@@ -439,8 +506,11 @@ gum_arm64_relocator_can_relocate (gpointer address,
 
             g_assert (op->type == ARM64_OP_IMM);
             target = GSIZE_TO_POINTER (op->imm);
-            if (!g_hash_table_contains (checked_targets, target))
-              g_hash_table_add (targets_to_check, target);
+            if (gum_label_table_lookup (&checked_targets, target) == NULL)
+            {
+              *((gpointer *) gum_ref_array_append (&targets_to_check)) =
+                  target;
+            }
 
             break;
           }
@@ -451,8 +521,11 @@ gum_arm64_relocator_can_relocate (gpointer address,
 
             g_assert (op->type == ARM64_OP_IMM);
             target = GSIZE_TO_POINTER (op->imm);
-            if (!g_hash_table_contains (checked_targets, target))
-              g_hash_table_add (targets_to_check, target);
+            if (gum_label_table_lookup (&checked_targets, target) == NULL)
+            {
+              *((gpointer *) gum_ref_array_append (&targets_to_check)) =
+                  target;
+            }
 
             break;
           }
@@ -471,44 +544,31 @@ gum_arm64_relocator_can_relocate (gpointer address,
         }
       }
 
-      g_hash_table_iter_init (&iter, targets_to_check);
-      if (g_hash_table_iter_next (&iter, &target, NULL))
+      current_code = NULL;
+      while (current_code == NULL && targets_to_check.length != 0)
+      {
+        target = *((gpointer *) gum_ref_array_element_at (&targets_to_check,
+            --targets_to_check.length));
+        if (gum_label_table_lookup (&checked_targets, target) == NULL)
+          current_code = target;
+      }
+
+      if (current_code != NULL)
       {
-        current_code = target;
         if (current_code > rl.input_cur)
           current_address = (current_code - rl.input_cur) + rl.input_pc;
         else
           current_address = rl.input_pc - (rl.input_cur - current_code);
-        g_hash_table_iter_remove (&iter);
-      }
-      else
-      {
-        current_code = NULL;
       }
     }
     while (current_code != NULL);
 
-    g_hash_table_iter_init (&iter, checked_targets);
-    while (g_hash_table_iter_next (&iter, &target, NULL))
-    {
-      gssize offset = (gssize) target - (gssize) address;
-      if (offset > 0 && offset < (gssize) n)
-      {
-        n = offset;
-        if (n == 4)
-          break;
-      }
-    }
-
     cs_free (insn, 1);
 
-    cs_close (&capstone);
-
-    g_hash_table_unref (targets_to_check);
-    g_hash_table_unref (checked_targets);
+    gum_ref_array_free (&targets_to_check);
+    gum_label_table_free (&checked_targets);
   }
 
-  if (available_scratch_reg != NULL)
   {
     gboolean x16_used, x17_used;
     guint insn_index;
@@ -535,23 +595,128 @@ gum_arm64_relocator_can_relocate (gpointer address,
     }
 
     if (!x16_used)
-      *available_scratch_reg = ARM64_REG_X16;
+      scratch_reg = ARM64_REG_X16;
     else if (!x17_used)
-      *available_scratch_reg = ARM64_REG_X17;
+      scratch_reg = ARM64_REG_X17;
     else
-      *available_scratch_reg = ARM64_REG_INVALID;
+      scratch_reg = ARM64_REG_INVALID;
   }
 
   gum_arm64_relocator_clear (&rl);
 
   gum_arm64_writer_clear (&cw);
 
+  if (cacheable)
+  {
+    analysis.maximum = n;
+    analysis.scratch_reg = scratch_reg;
+
+    G_LOCK (gum_arm64_analysis_cache);
+    gum_arm64_analysis_insert (&analysis);
+    G_UNLOCK (gum_arm64_analysis_cache);
+  }
+
+beach:
   if (maximum != NULL)
     *maximum = n;
 
+  if (available_scratch_reg != NULL)
+    *available_scratch_reg = scratch_reg;
+
   return n >= min_bytes;
 }
 
+static gboolean
+gum_arm64_analysis_try_init_key (GumArm64Analysis * key,
+                                 gconstpointer address,
+                                 guint min_bytes,
+                                 GumRelocationScenario scenario)
+{
+  gsize page_size, page_offset;
+
+  if (min_bytes > GUM_MAX_ANALYSIS_CODE_SIZE)
+    return FALSE;
+
+  /* Don't read past the page that the first instruction lives on. */
+  page_size = gum_query_page_size ();
+  page_offset = GPOINTER_TO_SIZE (address) & (page_size - 1);
+  if (page_offset + min_bytes > page_size)
+    return FALSE;
+
+  memset (key, 0, sizeof (GumArm64Analysis));
+  memcpy (key->code, address, min_bytes);
+  key->code_size = min_bytes;
+  key->scenario = scenario;
+
+  return TRUE;
+}
+
+static const GumArm64Analysis *
+gum_arm64_analysis_lookup (const GumArm64Analysis * key)
+{
+  if (gum_arm64_analysis_cache == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (gum_arm64_analysis_cache, key);
+}
+
+static void
+gum_arm64_analysis_insert (const GumArm64Analysis * analysis)
+{
+  GumArm64Analysis * entry;
+
+  if (gum_arm64_analysis_cache == NULL)
+  {
+    gum_arm64_analysis_cache = g_hash_table_new_full (
+        (GHashFunc) gum_arm64_analysis_hash,
+        (GEqualFunc) gum_arm64_analysis_equal,
+        (GDestroyNotify) gum_arm64_analysis_free, NULL);
+    _gum_register_destructor (gum_arm64_analysis_cache_deinit);
+  }
+  else if (g_hash_table_size (gum_arm64_analysis_cache) ==
+      GUM_MAX_CACHED_ANALYSES)
+  {
+    g_hash_table_remove_all (gum_arm64_analysis_cache);
+  }
+
+  entry = g_slice_dup (GumArm64Analysis, analysis);
+  g_hash_table_replace (gum_arm64_analysis_cache, entry, entry);
+}
+
+static guint
+gum_arm64_analysis_hash (const GumArm64Analysis * analysis)
+{
+  guint result, i;
+
+  result = (analysis->code_size << 1) | analysis->scenario;
+  for (i = 0; i != analysis->code_size; i++)
+    result = (result * 31) + analysis->code[i];
+
+  return result;
+}
+
+static gboolean
+gum_arm64_analysis_equal (const GumArm64Analysis * a,
+                          const GumArm64Analysis * b)
+{
+  return a->code_size == b->code_size &&
+      a->scenario == b->scenario &&
+      memcmp (a->code, b->code, a->code_size) == 0;
+}
+
+static void
+gum_arm64_analysis_free (GumArm64Analysis * analysis)
+{
+  g_slice_free (GumArm64Analysis, analysis);
+}
+
+static void
+gum_arm64_analysis_cache_deinit (void)
+{
+  g_hash_table_unref (gum_arm64_analysis_cache);
+  gum_arm64_analysis_cache = NULL;
+}
+
 guint
 gum_arm64_relocator_relocate (gpointer from,
                               guint min_bytes,
@@ -186,11 +186,9 @@ gum_arm64_writer_init (GumArm64Writer * writer,
 {
   writer->ref_count = 1;
 
-  writer->id_to_address = g_hash_table_new (NULL, NULL);
-  writer->label_refs = g_array_new (FALSE, FALSE,
-      sizeof (GumArm64LabelRef));
-  writer->literal_refs = g_array_new (FALSE, FALSE,
-      sizeof (GumArm64LiteralRef));
+  gum_label_table_init (&writer->label_defs);
+  gum_ref_array_init (&writer->label_refs, sizeof (GumArm64LabelRef));
+  gum_ref_array_init (&writer->literal_refs, sizeof (GumArm64LiteralRef));
 
   gum_arm64_writer_reset (writer, code_address);
 }
@@ -200,9 +198,9 @@ gum_arm64_writer_clear (GumArm64Writer * writer)
 {
   gum_arm64_writer_flush (writer);
 
-  g_hash_table_unref (writer->id_to_address);
-  g_array_free (writer->label_refs, TRUE);
-  g_array_free (writer->literal_refs, TRUE);
+  gum_label_table_free (&writer->label_defs);
+  gum_ref_array_free (&writer->label_refs);
+  gum_ref_array_free (&writer->literal_refs);
 }
 
 void
@@ -213,9 +211,9 @@ gum_arm64_writer_reset (GumArm64Writer * writer,
   writer->code = code_address;
   writer->pc = GUM_ADDRESS (code_address);
 
-  g_hash_table_remove_all (writer->id_to_address);
-  g_array_set_size (writer->label_refs, 0);
-  g_array_set_size (writer->literal_refs, 0);
+  gum_label_table_clear (&writer->label_defs);
+  gum_ref_array_clear (&writer->label_refs);
+  gum_ref_array_clear (&writer->literal_refs);
   writer->earliest_literal_insn = NULL;
 }
 
@@ -251,8 +249,8 @@ gum_arm64_writer_flush (GumArm64Writer * self)
 
 error:
   {
-    g_array_set_size (self->label_refs, 0);
-    g_array_set_size (self->literal_refs, 0);
+    gum_ref_array_clear (&self->label_refs);
+    gum_ref_array_clear (&self->literal_refs);
 
     return FALSE;
   }
@@ -262,11 +260,7 @@ gboolean
 gum_arm64_writer_put_label (GumArm64Writer * self,
                             gconstpointer id)
 {
-  if (g_hash_table_lookup (self->id_to_address, id) != NULL)
-    return FALSE;
-
-  g_hash_table_insert (self->id_to_address, (gpointer) id, self->code);
-  return TRUE;
+  return gum_label_table_insert (&self->label_defs, id, self->code);
 }
 
 static void
@@ -274,29 +268,27 @@ gum_arm64_writer_add_label_reference_here (GumArm64Writer * self,
                                            gconstpointer id,
                                            GumArm64LabelRefType type)
 {
-  GumArm64LabelRef r;
+  GumArm64LabelRef * r;
 
-  r.id = id;
-  r.type = type;
-  r.insn = self->code;
-
-  g_array_append_val (self->label_refs, r);
+  r = gum_ref_array_append (&self->label_refs);
+  r->id = id;
+  r->type = type;
+  r->insn = self->code;
 }
 
 static void
 gum_arm64_writer_add_literal_reference_here (GumArm64Writer * self,
                                              guint64 val)
 {
-  GumArm64LiteralRef r;
-
-  r.insn = self->code;
-  r.val = val;
+  GumArm64LiteralRef * r;
 
-  g_array_append_val (self->literal_refs, r);
+  r = gum_ref_array_append (&self->literal_refs);
+  r->insn = self->code;
+  r->val = val;
 
   if (self->earliest_literal_insn == NULL)
   {
-    self->earliest_literal_insn = r.insn;
+    self->earliest_literal_insn = r->insn;
   }
 }
 
@@ -1312,7 +1304,7 @@ gum_arm64_writer_try_commit_label_refs (GumArm64Writer * self)
 {
   guint num_refs, ref_index;
 
-  num_refs = self->label_refs->len;
+  num_refs = self->label_refs.length;
   for (ref_index = 0; ref_index != num_refs; ref_index++)
   {
     GumArm64LabelRef * r;
@@ -1320,9 +1312,9 @@ gum_arm64_writer_try_commit_label_refs (GumArm64Writer * self)
     gssize distance;
     guint32 insn;
 
-    r = &g_array_index (self->label_refs, GumArm64LabelRef, ref_index);
+    r = gum_ref_array_element_at (&self->label_refs, ref_index);
 
-    target_insn = g_hash_table_lookup (self->id_to_address, r->id);
+    target_insn = gum_label_table_lookup (&self->label_defs, r->id);
     if (target_insn == NULL)
       return FALSE;
 
@@ -1357,7 +1349,7 @@ gum_arm64_writer_try_commit_label_refs (GumArm64Writer * self)
     *r->insn = GUINT32_TO_LE (insn);
   }
 
-  g_array_set_size (self->label_refs, 0);
+  gum_ref_array_clear (&self->label_refs);
 
   return TRUE;
 }
@@ -1372,7 +1364,7 @@ gum_arm64_writer_maybe_commit_literals (GumArm64Writer * self)
     return;
 
   space_used = (self->code - self->earliest_literal_insn) * sizeof (guint32);
-  space_used += self->literal_refs->len * sizeof (guint64);
+  space_used += self->literal_refs.length * sizeof (guint64);
   if (space_used <= 1048572)
     return;
 
@@ -1389,7 +1381,7 @@ gum_arm64_writer_commit_literals (GumArm64Writer * self)
   guint num_refs, ref_index;
   gint64 * first_slot, * last_slot;
 
-  num_refs = self->literal_refs->len;
+  num_refs = self->literal_refs.length;
   if (num_refs == 0)
     return;
 
@@ -1402,7 +1394,7 @@ gum_arm64_writer_commit_literals (GumArm64Writer * self)
     gint64 * cur_slot, distance;
     guint32 insn;
 
-    r = &g_array_index (self->literal_refs, GumArm64LiteralRef, ref_index);
+    r = gum_ref_array_element_at (&self->literal_refs, ref_index);
 
     for (cur_slot = first_slot; cur_slot != last_slot; cur_slot++)
     {
@@ -1427,7 +1419,7 @@ gum_arm64_writer_commit_literals (GumArm64Writer * self)
   self->code = (guint32 *) last_slot;
   self->pc += (guint8 *) last_slot - (guint8 *) first_slot;
 
-  g_array_set_size (self->literal_refs, 0);
+  gum_ref_array_clear (&self->literal_refs);
 }
 
 static void
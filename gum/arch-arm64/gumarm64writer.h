@@ -10,6 +10,7 @@
 
 #include <capstone/capstone.h>
 #include <gum/gumdefs.h>
+#include <gum/gumlabeltable.h>
 
 #define GUM_ARM64_ADRP_MAX_DISTANCE 0xfffff000
 #define GUM_ARM64_B_MAX_DISTANCE 0x07fffffc
@@ -27,9 +28,9 @@ struct _GumArm64Writer
   guint32 * code;
   GumAddress pc;
 
-  GHashTable * id_to_address;
-  GArray * label_refs;
-  GArray * literal_refs;
+  GumLabelTable label_defs;
+  GumRefArray label_refs;
+  GumRefArray literal_refs;
   const guint32 * earliest_literal_insn;
 };
 
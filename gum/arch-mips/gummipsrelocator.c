@@ -6,6 +6,7 @@
 
 #include "gummipsrelocator.h"
 
+#include "gumcapstone.h"
 #include "gummemory.h"
 
 #define GUM_MAX_INPUT_INSN_COUNT (100)
@@ -392,21 +393,17 @@ gum_mips_relocator_can_relocate (gpointer address,
   if (!rl.eoi)
   {
     csh capstone;
-    cs_err err;
     cs_insn * insn;
     size_t count, i;
     gboolean eoi;
 
 #if G_BYTE_ORDER == G_LITTLE_ENDIAN
-    err = cs_open (CS_ARCH_MIPS, CS_MODE_MIPS32 | CS_MODE_LITTLE_ENDIAN,
-        &capstone);
+    capstone = gum_capstone_get (CS_ARCH_MIPS,
+        CS_MODE_MIPS32 | CS_MODE_LITTLE_ENDIAN, GUM_CAPSTONE_DETAIL_ON);
 #else
-    err = cs_open (CS_ARCH_MIPS, CS_MODE_MIPS32 | CS_MODE_BIG_ENDIAN,
-        &capstone);
+    capstone = gum_capstone_get (CS_ARCH_MIPS,
+        CS_MODE_MIPS32 | CS_MODE_BIG_ENDIAN, GUM_CAPSTONE_DETAIL_ON);
 #endif
-    g_assert_cmpint (err, == , CS_ERR_OK);
-    err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-    g_assert_cmpint (err, ==, CS_ERR_OK);
 
     count = cs_disasm (capstone, rl.input_cur, 1024, rl.input_pc, 0, &insn);
     g_assert (insn != NULL);
@@ -471,8 +468,6 @@ gum_mips_relocator_can_relocate (gpointer address,
     }
 
     cs_free (insn, count);
-
-    cs_close (&capstone);
   }
 
   if (available_scratch_reg != NULL)
@@ -156,8 +156,8 @@ gum_mips_writer_init (GumMipsWriter * writer,
 {
   writer->ref_count = 1;
 
-  writer->id_to_address = g_hash_table_new (NULL, NULL);
-  writer->label_refs = g_array_new (FALSE, FALSE, sizeof (GumMipsLabelRef));
+  gum_label_table_init (&writer->label_defs);
+  gum_ref_array_init (&writer->label_refs, sizeof (GumMipsLabelRef));
 
   gum_mips_writer_reset (writer, code_address);
 }
@@ -167,8 +167,8 @@ gum_mips_writer_clear (GumMipsWriter * writer)
 {
   gum_mips_writer_flush (writer);
 
-  g_hash_table_unref (writer->id_to_address);
-  g_array_free (writer->label_refs, TRUE);
+  gum_label_table_free (&writer->label_defs);
+  gum_ref_array_free (&writer->label_refs);
 }
 
 void
@@ -179,8 +179,8 @@ gum_mips_writer_reset (GumMipsWriter * writer,
   writer->code = code_address;
   writer->pc = GUM_ADDRESS (code_address);
 
-  g_hash_table_remove_all (writer->id_to_address);
-  g_array_set_size (writer->label_refs, 0);
+  gum_label_table_clear (&writer->label_defs);
+  gum_ref_array_clear (&writer->label_refs);
 }
 
 gpointer
@@ -208,7 +208,7 @@ gum_mips_writer_flush (GumMipsWriter * self)
 {
   guint num_refs, ref_index;
 
-  num_refs = self->label_refs->len;
+  num_refs = self->label_refs.length;
   for (ref_index = 0; ref_index != num_refs; ref_index++)
   {
     GumMipsLabelRef * r;
@@ -216,9 +216,9 @@ gum_mips_writer_flush (GumMipsWriter * self)
     gssize distance;
     guint32 insn;
 
-    r = &g_array_index (self->label_refs, GumMipsLabelRef, ref_index);
+    r = gum_ref_array_element_at (&self->label_refs, ref_index);
 
-    target_insn = g_hash_table_lookup (self->id_to_address, r->id);
+    target_insn = gum_label_table_lookup (&self->label_defs, r->id);
     if (target_insn == NULL)
       goto error;
 
@@ -255,13 +255,13 @@ gum_mips_writer_flush (GumMipsWriter * self)
 
     *r->insn = insn;
   }
-  g_array_set_size (self->label_refs, 0);
+  gum_ref_array_clear (&self->label_refs);
 
   return TRUE;
 
 error:
   {
-    g_array_set_size (self->label_refs, 0);
+    gum_ref_array_clear (&self->label_refs);
 
     return FALSE;
   }
@@ -271,23 +271,18 @@ gboolean
 gum_mips_writer_put_label (GumMipsWriter * self,
                            gconstpointer id)
 {
-  if (g_hash_table_lookup (self->id_to_address, id) != NULL)
-    return FALSE;
-
-  g_hash_table_insert (self->id_to_address, (gpointer) id, self->code);
-  return TRUE;
+  return gum_label_table_insert (&self->label_defs, id, self->code);
 }
 
 static void
 gum_mips_writer_add_label_reference_here (GumMipsWriter * self,
                                           gconstpointer id)
 {
-  GumMipsLabelRef r;
-
-  r.id = id;
-  r.insn = self->code;
+  GumMipsLabelRef * r;
 
-  g_array_append_val (self->label_refs, r);
+  r = gum_ref_array_append (&self->label_refs);
+  r->id = id;
+  r->insn = self->code;
 }
 
 void
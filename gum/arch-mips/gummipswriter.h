@@ -9,6 +9,7 @@
 
 #include <capstone/capstone.h>
 #include <gum/gumdefs.h>
+#include <gum/gumlabeltable.h>
 
 #define GUM_MIPS_J_MAX_DISTANCE (1 << 28)
 
@@ -24,8 +25,8 @@ struct _GumMipsWriter
   guint32 * code;
   GumAddress pc;
 
-  GHashTable * id_to_address;
-  GArray * label_refs;
+  GumLabelTable label_defs;
+  GumRefArray label_refs;
 };
 
 GUM_API GumMipsWriter * gum_mips_writer_new (gpointer code_address);
@@ -82,6 +82,7 @@ gum_x86_backtracer_generate (GumBacktracer * backtracer,
 {
   GumX86Backtracer * self;
   GumInvocationStack * invocation_stack;
+  guint invocation_depth = 0;
   gsize * start_address;
   gsize first_address = 0;
   guint i;
@@ -119,8 +120,8 @@ gum_x86_backtracer_generate (GumBacktracer * backtracer,
     {
       gsize translated_value;
 
-      translated_value = GPOINTER_TO_SIZE (gum_invocation_stack_translate (
-          invocation_stack, GSIZE_TO_POINTER (value)));
+      translated_value = GPOINTER_TO_SIZE (gum_invocation_stack_translate_next (
+          invocation_stack, GSIZE_TO_POINTER (value), &invocation_depth));
       if (translated_value != value)
       {
         value = translated_value;
@@ -6,9 +6,83 @@
 
 #include "gumx86reader.h"
 
+#include "gumcapstone.h"
+
+#define GUM_OP_MODRM   0x01
+#define GUM_OP_IMM8    0x02
+#define GUM_OP_IMM16   0x04
+#define GUM_OP_IMMZ    0x08
+#define GUM_OP_IMMV    0x10
+#define GUM_OP_BRANCH  0x20
+#define GUM_OP_NO_X64  0x40
+#define GUM_OP_SPECIAL 0x80
+
+#define M  GUM_OP_MODRM
+#define I8 GUM_OP_IMM8
+#define IW GUM_OP_IMM16
+#define IZ GUM_OP_IMMZ
+#define IV GUM_OP_IMMV
+#define BR GUM_OP_BRANCH
+#define NX GUM_OP_NO_X64
+#define SP GUM_OP_SPECIAL
+
+static const guint8 gum_x86_one_byte_ops[256] =
+{
+  /* 0x00 */ M, M, M, M, I8, IZ, NX, NX, M, M, M, M, I8, IZ, NX, SP,
+  /* 0x10 */ M, M, M, M, I8, IZ, NX, NX, M, M, M, M, I8, IZ, NX, NX,
+  /* 0x20 */ M, M, M, M, I8, IZ, SP, NX, M, M, M, M, I8, IZ, SP, NX,
+  /* 0x30 */ M, M, M, M, I8, IZ, SP, NX, M, M, M, M, I8, IZ, SP, NX,
+  /* 0x40 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x50 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0x60 */ NX, NX, M | NX, M, SP, SP, SP, SP,
+             IZ, M | IZ, I8, M | I8, 0, 0, 0, 0,
+  /* 0x70 */ BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR,
+  /* 0x80 */ M | I8, M | IZ, M | I8 | NX, M | I8, M, M, M, M,
+             M, M, M, M, M, M, M, M,
+  /* 0x90 */ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, BR | NX, 0, 0, 0, 0, 0,
+  /* 0xa0 */ SP, SP, SP, SP, 0, 0, 0, 0, I8, IZ, 0, 0, 0, 0, 0, 0,
+  /* 0xb0 */ I8, I8, I8, I8, I8, I8, I8, I8, IV, IV, IV, IV, IV, IV, IV, IV,
+  /* 0xc0 */ M | I8, M | I8, BR, BR, M | NX, M | NX, M | I8, SP,
+             IW | I8, 0, BR, BR, BR, BR, BR | NX, BR,
+  /* 0xd0 */ M, M, M, M, I8 | NX, I8 | NX, NX, 0, M, M, M, M, M, M, M, M,
+  /* 0xe0 */ BR, BR, BR, BR, I8, I8, I8, I8, BR, BR, BR | NX, BR, 0, 0, 0, 0,
+  /* 0xf0 */ SP, BR, SP, SP, 0, 0, SP, SP, 0, 0, 0, 0, 0, 0, M, SP
+};
+
+static const guint8 gum_x86_two_byte_ops[256] =
+{
+  /* 0x00 */ M, M, M, M, SP, BR, 0, BR, 0, 0, SP, 0, SP, M, 0, SP,
+  /* 0x10 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0x20 */ M, M, M, M, SP, SP, SP, SP, M, M, M, M, M, M, M, M,
+  /* 0x30 */ 0, 0, 0, 0, BR, BR, SP, SP, SP, SP, SP, SP, SP, SP, SP, SP,
+  /* 0x40 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0x50 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0x60 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0x70 */ M | I8, M | I8, M | I8, M | I8, M, M, M, 0,
+             M, M, SP, SP, M, M, M, M,
+  /* 0x80 */ BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR, BR,
+  /* 0x90 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0xa0 */ 0, 0, 0, M, M | I8, M, SP, SP, 0, 0, 0, M, M | I8, M, M, M,
+  /* 0xb0 */ M, M, M, M, M, M, M, M, M, M, M | I8, M, M, M, M, M,
+  /* 0xc0 */ M, M, M | I8, M, M | I8, M | I8, M | I8, M, 0, 0, 0, 0, 0, 0, 0, 0,
+  /* 0xd0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0xe0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M,
+  /* 0xf0 */ M, M, M, M, M, M, M, M, M, M, M, M, M, M, M, M
+};
+
+#undef M
+#undef I8
+#undef IW
+#undef IZ
+#undef IV
+#undef BR
+#undef NX
+#undef SP
+
 static gpointer try_get_relative_call_or_jump_target (gconstpointer address,
     guint call_or_jump);
-static cs_insn * disassemble_instruction_at (gconstpointer address);
+static cs_insn * disassemble_instruction_at (gconstpointer address,
+    GumCapstoneDetail detail);
 
 guint
 gum_x86_reader_insn_length (guint8 * code)
@@ -16,7 +90,16 @@ gum_x86_reader_insn_length (guint8 * code)
   guint result;
   cs_insn * insn;
 
-  insn = disassemble_instruction_at (code);
+  switch (gum_x86_reader_classify_insn (code, GUM_NATIVE_CPU, &result))
+  {
+    case GUM_X86_INSN_PLAIN:
+    case GUM_X86_INSN_RIP_RELATIVE:
+      return result;
+    default:
+      break;
+  }
+
+  insn = disassemble_instruction_at (code, GUM_CAPSTONE_DETAIL_OFF);
   if (insn == NULL)
     return 0;
   result = insn->size;
@@ -25,6 +108,228 @@ gum_x86_reader_insn_length (guint8 * code)
   return result;
 }
 
+/*
+ * Decodes just enough of the instruction at address to tell its length and
+ * whether it can be copied elsewhere as-is, using the tables above instead
+ * of Capstone. Branches, system calls and anything the tables don't cover
+ * are left for Capstone, so the answer is only ever PLAIN or RIP_RELATIVE
+ * when the decoder is certain, and length is only set in those cases.
+ */
+GumX86InsnClass
+gum_x86_reader_classify_insn (gconstpointer address,
+                              GumCpuType cpu_type,
+                              guint * length)
+{
+  const guint8 * code = address;
+  const guint8 * p = code;
+  gboolean is_64 = cpu_type == GUM_CPU_AMD64;
+  gboolean operand_size_override = FALSE;
+  gboolean address_size_override = FALSE;
+  gboolean has_simd_prefix = FALSE;
+  gboolean has_rex = FALSE, rex_w = FALSE;
+  gboolean is_vex = FALSE, is_rip_relative = FALSE;
+  guint map = 0;
+  guint8 opcode, flags;
+  guint imm_size = 0;
+  gsize size;
+
+  for (; p - code != 14; p++)
+  {
+    switch (*p)
+    {
+      case 0x66:
+        operand_size_override = TRUE;
+        has_simd_prefix = TRUE;
+        continue;
+      case 0x67:
+        address_size_override = TRUE;
+        continue;
+      case 0xf0:
+      case 0xf2:
+      case 0xf3:
+        has_simd_prefix = TRUE;
+        continue;
+      case 0x26:
+      case 0x2e:
+      case 0x36:
+      case 0x3e:
+      case 0x64:
+      case 0x65:
+        continue;
+      default:
+        break;
+    }
+
+    break;
+  }
+
+  if (is_64 && (*p & 0xf0) == 0x40)
+  {
+    has_rex = TRUE;
+    rex_w = (*p & 0x08) != 0;
+    p++;
+  }
+
+  opcode = *p++;
+
+  if (opcode == 0x0f)
+  {
+    map = 1;
+    opcode = *p++;
+    if (opcode == 0x38 || opcode == 0x3a)
+    {
+      map = (opcode == 0x38) ? 2 : 3;
+      opcode = *p++;
+    }
+  }
+  else if ((opcode == 0xc4 || opcode == 0xc5 || opcode == 0x62) &&
+      (is_64 || (p[0] & 0xc0) == 0xc0))
+  {
+    if (has_simd_prefix || has_rex)
+      return GUM_X86_INSN_UNKNOWN;
+
+    switch (opcode)
+    {
+      case 0xc5:
+        map = 1;
+        p += 1;
+        break;
+      case 0xc4:
+        map = p[0] & 0x1f;
+        p += 2;
+        break;
+      case 0x62:
+        map = p[0] & 0x03;
+        p += 3;
+        break;
+    }
+    if (map < 1 || map > 3)
+      return GUM_X86_INSN_UNKNOWN;
+
+    is_vex = TRUE;
+    opcode = *p++;
+  }
+  else if (opcode == 0x8f && ((p[0] >> 3) & 7) != 0)
+  {
+    /* AMD XOP */
+    return GUM_X86_INSN_UNKNOWN;
+  }
+
+  switch (map)
+  {
+    case 0:
+      flags = gum_x86_one_byte_ops[opcode];
+      break;
+    case 1:
+      flags = gum_x86_two_byte_ops[opcode];
+      break;
+    case 2:
+      flags = GUM_OP_MODRM;
+      break;
+    default:
+      flags = GUM_OP_MODRM | GUM_OP_IMM8;
+      break;
+  }
+
+  if (map == 0)
+  {
+    guint reg = (p[0] >> 3) & 7;
+
+    switch (opcode)
+    {
+      case 0xa0:
+      case 0xa1:
+      case 0xa2:
+      case 0xa3:
+        if (is_64)
+          imm_size = address_size_override ? 4 : 8;
+        else
+          imm_size = address_size_override ? 2 : 4;
+        flags = 0;
+        break;
+      case 0xf6:
+        flags = (reg < 2) ? GUM_OP_MODRM | GUM_OP_IMM8 : GUM_OP_MODRM;
+        break;
+      case 0xf7:
+        flags = (reg < 2) ? GUM_OP_MODRM | GUM_OP_IMMZ : GUM_OP_MODRM;
+        break;
+      case 0xc7:
+        /* XBEGIN is relative to the next instruction. */
+        if (reg == 7)
+          return GUM_X86_INSN_UNKNOWN;
+        flags = GUM_OP_MODRM | GUM_OP_IMMZ;
+        break;
+      case 0xff:
+        if (reg >= 2 && reg <= 5)
+          return GUM_X86_INSN_BRANCH;
+        if (reg == 7)
+          return GUM_X86_INSN_UNKNOWN;
+        flags = GUM_OP_MODRM;
+        break;
+      default:
+        break;
+    }
+  }
+
+  if ((flags & GUM_OP_SPECIAL) != 0)
+    return GUM_X86_INSN_UNKNOWN;
+  if (is_64 && (flags & GUM_OP_NO_X64) != 0)
+    return GUM_X86_INSN_UNKNOWN;
+  if ((flags & GUM_OP_BRANCH) != 0)
+    return is_vex ? GUM_X86_INSN_UNKNOWN : GUM_X86_INSN_BRANCH;
+
+  if ((flags & GUM_OP_MODRM) != 0)
+  {
+    guint8 modrm, mod, rm;
+
+    /* 16-bit addressing uses a different ModRM layout. */
+    if (address_size_override && !is_64)
+      return GUM_X86_INSN_UNKNOWN;
+
+    modrm = *p++;
+    mod = modrm >> 6;
+    rm = modrm & 7;
+
+    if (mod != 3)
+    {
+      if (rm == 4)
+      {
+        guint8 sib = *p++;
+
+        if (mod == 0 && (sib & 7) == 5)
+          p += 4;
+      }
+      else if (mod == 0 && rm == 5)
+      {
+        p += 4;
+        is_rip_relative = is_64;
+      }
+
+      if (mod == 1)
+        p += 1;
+      else if (mod == 2)
+        p += 4;
+    }
+  }
+
+  if ((flags & GUM_OP_IMM8) != 0)
+    imm_size += 1;
+  if ((flags & GUM_OP_IMM16) != 0)
+    imm_size += 2;
+  if ((flags & GUM_OP_IMMZ) != 0)
+    imm_size += (operand_size_override && !rex_w) ? 2 : 4;
+  if ((flags & GUM_OP_IMMV) != 0)
+    imm_size += rex_w ? 8 : (operand_size_override ? 2 : 4);
+
+  size = (p - code) + imm_size;
+  if (size > 15)
+    return GUM_X86_INSN_UNKNOWN;
+
+  *length = size;
+
+  return is_rip_relative ? GUM_X86_INSN_RIP_RELATIVE : GUM_X86_INSN_PLAIN;
+}
+
 gboolean
 gum_x86_reader_insn_is_jcc (const cs_insn * insn)
 {
@@ -74,7 +379,7 @@ gum_x86_reader_try_get_indirect_jump_target (gconstpointer address)
   cs_insn * insn;
   cs_x86_op * op;
 
-  insn = disassemble_instruction_at (address);
+  insn = disassemble_instruction_at (address, GUM_CAPSTONE_DETAIL_ON);
   if (insn == NULL)
     return NULL;
 
@@ -105,7 +410,7 @@ try_get_relative_call_or_jump_target (gconstpointer address,
   cs_insn * insn;
   cs_x86_op * op;
 
-  insn = disassemble_instruction_at (address);
+  insn = disassemble_instruction_at (address, GUM_CAPSTONE_DETAIL_ON);
   if (insn == NULL)
     return NULL;
 
@@ -119,20 +424,15 @@ try_get_relative_call_or_jump_target (gconstpointer address,
 }
 
 static cs_insn *
-disassemble_instruction_at (gconstpointer address)
+disassemble_instruction_at (gconstpointer address,
+                            GumCapstoneDetail detail)
 {
   csh capstone;
-  cs_err err;
   cs_insn * insn = NULL;
 
-  err = cs_open (CS_ARCH_X86, GUM_CPU_MODE, &capstone);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
-  err = cs_option (capstone, CS_OPT_DETAIL, CS_OPT_ON);
-  g_assert_cmpint (err, ==, CS_ERR_OK);
+  capstone = gum_capstone_get (CS_ARCH_X86, GUM_CPU_MODE, detail);
 
   cs_disasm (capstone, address, 16, GPOINTER_TO_SIZE (address), 1, &insn);
 
-  cs_close (&capstone);
-
   return insn;
 }
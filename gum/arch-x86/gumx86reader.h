@@ -13,7 +13,16 @@
 
 G_BEGIN_DECLS
 
+typedef enum {
+  GUM_X86_INSN_UNKNOWN,
+  GUM_X86_INSN_PLAIN,
+  GUM_X86_INSN_RIP_RELATIVE,
+  GUM_X86_INSN_BRANCH
+} GumX86InsnClass;
+
 guint gum_x86_reader_insn_length (guint8 * code);
+GumX86InsnClass gum_x86_reader_classify_insn (gconstpointer address,
+    GumCpuType cpu_type, guint * length);
 gboolean gum_x86_reader_insn_is_jcc (const cs_insn * insn);
 
 gpointer gum_x86_reader_try_get_relative_call_target (gconstpointer address);
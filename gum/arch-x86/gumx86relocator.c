@@ -26,6 +26,8 @@ struct _GumCodeGenCtx
   GumX86Writer * code_writer;
 };
 
+static gboolean gum_x86_relocator_try_read_plain (GumX86Relocator * self,
+    cs_insn * insn);
 static gboolean gum_x86_relocator_write_one_instruction (GumX86Relocator * self);
 static void gum_x86_relocator_put_label_for (GumX86Relocator * self,
     cs_insn * insn);
@@ -92,6 +94,8 @@ gum_x86_relocator_init (GumX86Relocator * relocator,
 
   relocator->output = NULL;
 
+  relocator->detail_needed = TRUE;
+
   gum_x86_relocator_reset (relocator, input_code, output);
 }
 
@@ -137,6 +141,19 @@ gum_x86_relocator_reset (GumX86Relocator * relocator,
   relocator->eoi = FALSE;
 }
 
+/*
+ * Callers that only write instructions back out, without looking at them,
+ * can turn off detail. Instructions that can be copied as-is are then sized
+ * by gum_x86_reader_classify_insn() instead of Capstone, and are returned
+ * with id set to X86_INS_INVALID and no operand details.
+ */
+void
+gum_x86_relocator_set_detail_needed (GumX86Relocator * self,
+                                     gboolean needed)
+{
+  self->detail_needed = needed;
+}
+
 static guint
 gum_x86_relocator_inpos (GumX86Relocator * self)
 {
@@ -185,7 +202,8 @@ gum_x86_relocator_read_one (GumX86Relocator * self,
   address = GPOINTER_TO_SIZE (self->input_cur);
   insn = *insn_ptr;
 
-  if (!cs_disasm_iter (self->capstone, &code, &size, &address, insn))
+  if (!gum_x86_relocator_try_read_plain (self, insn) &&
+      !cs_disasm_iter (self->capstone, &code, &size, &address, insn))
   {
     gboolean handled = FALSE;
 
@@ -262,6 +280,30 @@ gum_x86_relocator_read_one (GumX86Relocator * self,
   return self->input_cur - self->input_start;
 }
 
+static gboolean
+gum_x86_relocator_try_read_plain (GumX86Relocator * self,
+                                  cs_insn * insn)
+{
+  guint length;
+
+  if (self->detail_needed)
+    return FALSE;
+
+  if (gum_x86_reader_classify_insn (self->input_cur, self->output->target_cpu,
+      &length) != GUM_X86_INSN_PLAIN)
+    return FALSE;
+
+  insn->id = X86_INS_INVALID;
+  insn->address = GPOINTER_TO_SIZE (self->input_cur);
+  insn->size = length;
+  memcpy (insn->bytes, self->input_cur, length);
+  insn->mnemonic[0] = '\0';
+  insn->op_str[0] = '\0';
+  insn->detail->x86.op_count = 0;
+
+  return TRUE;
+}
+
 cs_insn *
 gum_x86_relocator_peek_next_write_insn (GumX86Relocator * self)
 {
@@ -352,7 +394,8 @@ gum_x86_relocator_write_one_instruction (GumX86Relocator * self)
     default:
       if (gum_x86_reader_insn_is_jcc (ctx.insn))
         rewritten = gum_x86_relocator_rewrite_conditional_branch (self, &ctx);
-      else if (self->output->target_cpu == GUM_CPU_AMD64)
+      else if (ctx.insn->id != X86_INS_INVALID &&
+          self->output->target_cpu == GUM_CPU_AMD64)
         rewritten = gum_x86_relocator_rewrite_if_rip_relative (self, &ctx);
       break;
   }
@@ -408,6 +451,7 @@ gum_x86_relocator_can_relocate (gpointer address,
   gum_x86_writer_init (&cw, buf);
 
   gum_x86_relocator_init (&rl, address, &cw);
+  gum_x86_relocator_set_detail_needed (&rl, FALSE);
 
   do
   {
@@ -441,6 +485,7 @@ gum_x86_relocator_relocate (gpointer from,
   gum_x86_writer_init (&cw, to);
 
   gum_x86_relocator_init (&rl, from, &cw);
+  gum_x86_relocator_set_detail_needed (&rl, FALSE);
 
   do
   {
@@ -125,8 +125,8 @@ gum_x86_writer_init (GumX86Writer * writer,
 {
   writer->ref_count = 1;
 
-  writer->id_to_address = g_hash_table_new (NULL, NULL);
-  writer->label_refs = g_array_new (FALSE, FALSE, sizeof (GumX86LabelRef));
+  gum_label_table_init (&writer->label_defs);
+  gum_ref_array_init (&writer->label_refs, sizeof (GumX86LabelRef));
 
   gum_x86_writer_reset (writer, code_address);
 }
@@ -136,8 +136,8 @@ gum_x86_writer_clear (GumX86Writer * writer)
 {
   gum_x86_writer_flush (writer);
 
-  g_hash_table_unref (writer->id_to_address);
-  g_array_free (writer->label_refs, TRUE);
+  gum_label_table_free (&writer->label_defs);
+  gum_ref_array_free (&writer->label_refs);
 }
 
 void
@@ -155,8 +155,8 @@ gum_x86_writer_reset (GumX86Writer * writer,
   writer->code = (guint8 *) code_address;
   writer->pc = GUM_ADDRESS (code_address);
 
-  g_hash_table_remove_all (writer->id_to_address);
-  g_array_set_size (writer->label_refs, 0);
+  gum_label_table_clear (&writer->label_defs);
+  gum_ref_array_clear (&writer->label_refs);
 }
 
 void
@@ -198,16 +198,16 @@ gum_x86_writer_flush (GumX86Writer * self)
 {
   guint num_refs, ref_index;
 
-  num_refs = self->label_refs->len;
+  num_refs = self->label_refs.length;
   for (ref_index = 0; ref_index != num_refs; ref_index++)
   {
     GumX86LabelRef * r;
     gpointer target_address;
     gint32 distance;
 
-    r = &g_array_index (self->label_refs, GumX86LabelRef, ref_index);
+    r = gum_ref_array_element_at (&self->label_refs, ref_index);
 
-    target_address = g_hash_table_lookup (self->id_to_address, r->id);
+    target_address = gum_label_table_lookup (&self->label_defs, r->id);
     if (target_address == NULL)
       goto error;
 
@@ -244,13 +244,13 @@ gum_x86_writer_flush (GumX86Writer * self)
         g_assert_not_reached ();
     }
   }
-  g_array_set_size (self->label_refs, 0);
+  gum_ref_array_clear (&self->label_refs);
 
   return TRUE;
 
 error:
   {
-    g_array_set_size (self->label_refs, 0);
+    gum_ref_array_clear (&self->label_refs);
 
     return FALSE;
   }
@@ -307,11 +307,7 @@ gboolean
 gum_x86_writer_put_label (GumX86Writer * self,
                           gconstpointer id)
 {
-  if (g_hash_table_lookup (self->id_to_address, id) != NULL)
-    return FALSE;
-
-  g_hash_table_insert (self->id_to_address, (gpointer) id, self->code);
-  return TRUE;
+  return gum_label_table_insert (&self->label_defs, id, self->code);
 }
 
 static void
@@ -319,13 +315,12 @@ gum_x86_writer_add_label_reference_here (GumX86Writer * self,
                                          gconstpointer id,
                                          GumX86LabelRefSize size)
 {
-  GumX86LabelRef r;
+  GumX86LabelRef * r;
 
-  r.id = id;
-  r.address = self->code;
-  r.size = size;
-
-  g_array_append_val (self->label_refs, r);
+  r = gum_ref_array_append (&self->label_refs);
+  r->id = id;
+  r->address = self->code;
+  r->size = size;
 }
 
 gboolean
@@ -1541,7 +1536,7 @@ gum_x86_writer_put_inc_or_dec_reg_ptr (GumX86Writer * self,
   if (self->target_cpu == GUM_CPU_AMD64)
   {
     if (target == GUM_PTR_QWORD)
-      gum_x86_writer_put_u8 (self, 0x48 | ri.index_is_extended ? 0x01 : 0x00);
+      gum_x86_writer_put_u8 (self, 0x48 | (ri.index_is_extended ? 0x01 : 0x00));
     else if (ri.index_is_extended)
       gum_x86_writer_put_u8 (self, 0x41);
   }
@@ -1684,6 +1679,16 @@ gum_x86_writer_put_lock_inc_or_dec_imm32_ptr (GumX86Writer * self,
   return TRUE;
 }
 
+gboolean
+gum_x86_writer_put_lock_inc_reg_ptr (GumX86Writer * self,
+                                     GumPtrTarget target,
+                                     GumCpuReg reg)
+{
+  gum_x86_writer_put_u8 (self, 0xf0); /* lock prefix */
+
+  return gum_x86_writer_put_inc_or_dec_reg_ptr (self, target, reg, TRUE);
+}
+
 gboolean
 gum_x86_writer_put_lock_inc_imm32_ptr (GumX86Writer * self,
                                        gpointer target)
@@ -8,6 +8,7 @@
 #define __GUM_X86_WRITER_H__
 
 #include <gum/gumdefs.h>
+#include <gum/gumlabeltable.h>
 
 #include <capstone/capstone.h>
 
@@ -28,8 +29,8 @@ struct _GumX86Writer
   guint8 * code;
   GumAddress pc;
 
-  GHashTable * id_to_address;
-  GArray * label_refs;
+  GumLabelTable label_defs;
+  GumRefArray label_refs;
 };
 
 enum _GumCpuReg
@@ -226,6 +227,8 @@ GUM_API gboolean gum_x86_writer_put_lock_xadd_reg_ptr_reg (GumX86Writer * self,
     GumCpuReg dst_reg, GumCpuReg src_reg);
 GUM_API gboolean gum_x86_writer_put_lock_cmpxchg_reg_ptr_reg (
     GumX86Writer * self, GumCpuReg dst_reg, GumCpuReg src_reg);
+GUM_API gboolean gum_x86_writer_put_lock_inc_reg_ptr (GumX86Writer * self,
+    GumPtrTarget target, GumCpuReg reg);
 GUM_API gboolean gum_x86_writer_put_lock_inc_imm32_ptr (GumX86Writer * self,
     gpointer target);
 GUM_API gboolean gum_x86_writer_put_lock_dec_imm32_ptr (GumX86Writer * self,
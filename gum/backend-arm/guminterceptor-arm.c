@@ -176,6 +176,13 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
   function_address = _gum_interceptor_backend_get_function_address (ctx);
   is_thumb = FUNCTION_CONTEXT_ADDRESS_IS_THUMB (ctx);
 
+  /*
+   * Some of our redirects clobber LR on the way into the trampoline, which
+   * only the enter thunk knows how to undo.
+   */
+  if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+    return FALSE;
+
   if (!gum_interceptor_backend_prepare_trampoline (self, ctx))
     return FALSE;
 
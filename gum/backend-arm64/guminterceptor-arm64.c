@@ -17,6 +17,9 @@
 
 #define GUM_ARM64_LOGICAL_PAGE_SIZE 4096
 
+#define GUM_RESERVATION_MIN_MODULE_SIZE (1024 * 1024)
+#define GUM_RESERVATION_SIZE (1024 * 1024)
+
 #define GUM_FRAME_OFFSET_CPU_CONTEXT 8
 #define GUM_FRAME_OFFSET_NEXT_HOP \
     (GUM_FRAME_OFFSET_CPU_CONTEXT + (33 * 8) + (8 * 16))
@@ -62,6 +65,15 @@ _gum_interceptor_backend_create (GumCodeAllocator * allocator)
   backend = g_slice_new (GumInterceptorBackend);
   backend->allocator = allocator;
 
+  /*
+   * Keep trampolines for the big modules already loaded within reach of
+   * a single B, instead of having to deflect once their neighbourhood
+   * has filled up.
+   */
+  gum_code_allocator_reserve_near_modules (allocator,
+      GUM_RESERVATION_MIN_MODULE_SIZE, GUM_RESERVATION_SIZE,
+      GUM_ARM64_B_MAX_DISTANCE);
+
   gum_arm64_writer_init (&backend->writer, NULL);
   gum_arm64_relocator_init (&backend->relocator, NULL, &backend->writer);
 
@@ -189,9 +201,18 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
     gum_arm64_writer_put_pop_reg_reg (aw, ARM64_REG_X0, ARM64_REG_LR);
   }
 
-  gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X17, GUM_ADDRESS (ctx));
-  gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
-      GUM_ADDRESS (self->enter_thunk->data));
+  if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+  {
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
+        GUM_ADDRESS (ctx->replacement_function));
+  }
+  else
+  {
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X17,
+        GUM_ADDRESS (ctx));
+    gum_arm64_writer_put_ldr_reg_address (aw, ARM64_REG_X16,
+        GUM_ADDRESS (self->enter_thunk->data));
+  }
   gum_arm64_writer_put_br_reg (aw, ARM64_REG_X16);
 
   ctx->on_leave_trampoline = gum_arm64_writer_cur (aw);
@@ -322,8 +343,9 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
   GumArm64FunctionContextData * data = (GumArm64FunctionContextData *)
       &ctx->backend_data;
   GumAddress on_enter = GUM_ADDRESS (ctx->on_enter_trampoline);
+  guint32 code[4];
 
-  gum_arm64_writer_reset (aw, prologue);
+  gum_arm64_writer_reset (aw, code);
   aw->pc = GUM_ADDRESS (ctx->function_address);
 
   if (ctx->trampoline_deflector != NULL)
@@ -363,6 +385,8 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
 
   gum_arm64_writer_flush (aw);
   g_assert_cmpuint (gum_arm64_writer_offset (aw), <=, data->redirect_code_size);
+
+  _gum_interceptor_write_code (prologue, code, gum_arm64_writer_offset (aw));
 }
 
 void
@@ -370,7 +394,8 @@ _gum_interceptor_backend_deactivate_trampoline (GumInterceptorBackend * self,
                                                 GumFunctionContext * ctx,
                                                 gpointer prologue)
 {
-  memcpy (prologue, ctx->overwritten_prologue, ctx->overwritten_prologue_len);
+  _gum_interceptor_write_code (prologue, ctx->overwritten_prologue,
+      ctx->overwritten_prologue_len);
 }
 
 gpointer
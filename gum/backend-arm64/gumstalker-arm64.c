@@ -5,14 +5,15 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
 
 #include "gumarm64reader.h"
 #include "gumarm64relocator.h"
 #include "gumarm64writer.h"
 #include "gummemory.h"
-#include "gummetalhash.h"
+#include "gummetalmap.h"
 #include "gumspinlock.h"
+#include "gumtimestamp.h"
 #include "gumtls.h"
 
 #include <stdlib.h>
@@ -20,6 +21,12 @@
 
 #define GUM_CODE_SLAB_SIZE_IN_PAGES         1024
 #define GUM_EXEC_BLOCK_MIN_SIZE             1024
+#define GUM_DEFAULT_IC_ENTRIES                 2
+#define GUM_MAX_IC_ENTRIES                    32
+#define GUM_IC_ENTRY_MAX_CODE_SIZE            40
+#define GUM_EXCLUSIVE_ACCESS_MAX_LENGTH       32
+#define GUM_EXCLUSIVE_ACCESS_RESERVE        2048
+#define GUM_MAX_SPARE_EXEC_CTXS                8
 
 #define STALKER_REG_CTX ARM64_REG_X12
 
@@ -37,14 +44,17 @@
 
 typedef struct _GumInfectContext GumInfectContext;
 typedef struct _GumDisinfectContext GumDisinfectContext;
+typedef struct _GumBusyExecCtx GumBusyExecCtx;
 
 typedef struct _GumCallProbe GumCallProbe;
+typedef struct _GumCallProbeSlot GumCallProbeSlot;
 typedef struct _GumSlab GumSlab;
 
 typedef struct _GumExecFrame GumExecFrame;
 typedef struct _GumExecCtx GumExecCtx;
 typedef void (* GumExecHelperWriteFunc) (GumExecCtx * ctx, GumArm64Writer * cw);
 typedef struct _GumExecBlock GumExecBlock;
+typedef struct _GumIcEntry GumIcEntry;
 typedef gpointer (GUM_THUNK * GumExecCtxReplaceCurrentBlockFunc) (
     GumExecCtx * ctx, gpointer start_address);
 
@@ -52,8 +62,11 @@ typedef guint GumPrologType;
 typedef guint GumCodeContext;
 typedef struct _GumGeneratorContext GumGeneratorContext;
 typedef struct _GumCalloutEntry GumCalloutEntry;
+typedef struct _GumCalloutPage GumCalloutPage;
 typedef struct _GumInstruction GumInstruction;
 typedef struct _GumBranchTarget GumBranchTarget;
+typedef guint GumDeferredCodeType;
+typedef struct _GumDeferredCode GumDeferredCode;
 
 typedef guint GumVirtualizationRequirements;
 
@@ -64,16 +77,31 @@ struct _GumStalker
   guint page_size;
 
   GMutex mutex;
-  GSList * contexts;
+  GQueue contexts;
   GumTlsKey exec_ctx;
 
+  GumSpinlock spare_ctx_lock;
+  GumExecCtx * spare_ctxs;
+  guint n_spare_ctxs;
+
   GArray * exclusions;
+  GArray * scopes;
   gint trust_threshold;
+  guint ic_entries;
+  gboolean ic_fallback_enabled;
+  gboolean huge_pages_enabled;
+  gboolean timestamps_enabled;
+  guint block_sample_interval;
+  guint8 * coverage_bitmap;
+  gsize coverage_mask;
   volatile gboolean any_probes_attached;
   volatile gint last_probe_id;
   GumSpinlock probe_lock;
   GHashTable * probe_target_by_id;
-  GHashTable * probe_array_by_address;
+  GHashTable * probe_slot_by_address;
+  GArray * volatile probe_index;
+
+  GumStalkerStats retired_stats;
 };
 
 struct _GumInfectContext
@@ -90,6 +118,12 @@ struct _GumDisinfectContext
   gboolean success;
 };
 
+struct _GumBusyExecCtx
+{
+  GumExecCtx * ctx;
+  gint epoch;
+};
+
 struct _GumCallProbe
 {
   GumProbeId id;
@@ -98,6 +132,17 @@ struct _GumCallProbe
   GDestroyNotify user_notify;
 };
 
+/*
+ * One per probed target, alive until the GumStalker is finalized so that
+ * generated code can refer to it directly. The probes array is never
+ * modified once published, only replaced, so readers need no lock.
+ */
+struct _GumCallProbeSlot
+{
+  gpointer target_address;
+  GArray * volatile probes;
+};
+
 struct _GumSlab
 {
   guint8 * data;
@@ -123,19 +168,24 @@ struct _GumExecCtx
 {
   volatile guint state;
   volatile gboolean invalidate_pending;
+  volatile gint probe_epoch;
 
   GumStalker * stalker;
   GumThreadId thread_id;
+  GList link;
+  GumExecCtx * next_spare;
 
   GumArm64Writer code_writer;
   GumArm64Relocator relocator;
 
   GumStalkerTransformer * transformer;
-  GQueue callout_entries;
+  GumCalloutPage * callout_pages;
   GumSpinlock callout_lock;
   GumEventSink * sink;
   GumEventType sink_mask;
+  gboolean sink_has_location_mask;
   void (* sink_process_impl) (GumEventSink * self, const GumEvent * ev);
+  gboolean timestamps_enabled;
   GumEvent tmp_event;
 
   gboolean unfollow_called_while_still_following;
@@ -159,7 +209,15 @@ struct _GumExecCtx
   gpointer last_epilog_full;
   gpointer last_stack_push;
   gpointer last_stack_pop_and_go;
-  GumMetalHashTable * mappings;
+  GumMetalMap mappings;
+
+  guint ic_entries;
+  guint block_min_size;
+
+  GumStalkerStats stats;
+  guint64 ic_lookups;
+
+  gsize coverage_prev;
 };
 
 struct _GumExecBlock
@@ -175,6 +233,13 @@ struct _GumExecBlock
 
   gint recycle_count;
   gboolean has_call_to_excluded_range;
+  guint32 sample_countdown;
+};
+
+struct _GumIcEntry
+{
+  gpointer real_start;
+  gpointer code_start;
 };
 
 enum _GumPrologType
@@ -190,6 +255,20 @@ enum _GumCodeContext
   GUM_CODE_UNINTERRUPTIBLE
 };
 
+enum _GumDeferredCodeType
+{
+  GUM_DEFERRED_EXEC_EVENT,
+  GUM_DEFERRED_CALLOUT,
+  GUM_DEFERRED_COUNTER_INCREMENT
+};
+
+struct _GumDeferredCode
+{
+  GumDeferredCodeType type;
+  gpointer subject;
+  guint index;
+};
+
 struct _GumGeneratorContext
 {
   GumInstruction * instruction;
@@ -198,6 +277,9 @@ struct _GumGeneratorContext
   gpointer continuation_real_address;
   GumPrologType opened_prolog;
   gint exclusive_load_offset;
+  GumDeferredCode deferred_code[GUM_EXCLUSIVE_ACCESS_MAX_LENGTH];
+  guint n_deferred_code;
+  GumEventType sink_mask;
 };
 
 struct _GumInstruction
@@ -228,6 +310,20 @@ struct _GumCalloutEntry
   GumExecCtx * exec_context;
 };
 
+/*
+ * Generated code refers to its callout entries for as long as the ExecCtx
+ * lives, so they are bump-allocated from pages owned by the ExecCtx instead
+ * of going through the heap for each one.
+ */
+struct _GumCalloutPage
+{
+  GumCalloutPage * next;
+  guint num_entries;
+  guint capacity;
+
+  GumCalloutEntry entries[1];
+};
+
 struct _GumBranchTarget
 {
   gpointer origin_ip;
@@ -256,18 +352,48 @@ static void gum_stalker_infect (GumThreadId thread_id,
 static void gum_stalker_disinfect (GumThreadId thread_id,
     GumCpuContext * cpu_context, gpointer user_data);
 
+static GumCallProbeSlot * gum_stalker_obtain_call_probe_slot (
+    GumStalker * self, gpointer target_address, GArray ** old_index);
+static void gum_stalker_synchronize_call_probes (GumStalker * self);
+static gboolean gum_stalker_is_still_dispatching (GumStalker * self,
+    const GumBusyExecCtx * busy);
+static GArray * gum_call_probe_array_copy (GArray * probes, guint extra);
 static void gum_stalker_free_probe_array (gpointer data);
+static void gum_call_probe_slot_free (GumCallProbeSlot * slot);
+static GumCallProbeSlot * gum_call_probe_index_find (GArray * index,
+    gconstpointer target_address);
+
+static gboolean gum_stalker_is_excluding (GumStalker * self,
+    gconstpointer address);
+static gboolean gum_stalker_is_in_scope (GumStalker * self,
+    gconstpointer address);
+static void gum_memory_ranges_add (GArray * ranges,
+    const GumMemoryRange * range);
+static gboolean gum_memory_ranges_contain (GArray * ranges,
+    gconstpointer address);
 
 static GumExecCtx * gum_stalker_create_exec_ctx (GumStalker * self,
     GumThreadId thread_id, GumStalkerTransformer * transformer,
     GumEventSink * sink);
 static GumExecCtx * gum_stalker_get_exec_ctx (GumStalker * self);
+static void gum_stalker_recover_from_fork_in_child (GumStalker * self);
 static void gum_stalker_invalidate_caches (GumStalker * self);
 
 static void gum_exec_ctx_dispose_callouts (GumExecCtx * ctx);
+static GumCalloutEntry * gum_exec_ctx_alloc_callout_entry (GumExecCtx * ctx);
 static void gum_exec_ctx_free (GumExecCtx * ctx);
+static void gum_exec_ctx_clear (GumExecCtx * ctx);
+static void gum_exec_ctx_free_shell (GumExecCtx * ctx);
+static GumExecCtx * gum_stalker_take_spare_exec_ctx (GumStalker * self);
+static gboolean gum_stalker_recycle_exec_ctx (GumStalker * self,
+    GumExecCtx * ctx);
+static void gum_exec_ctx_collect_stats (GumExecCtx * ctx,
+    GumStalkerStats * stats);
 static void gum_exec_ctx_unfollow (GumExecCtx * ctx, gpointer resume_at);
 static gboolean gum_exec_ctx_has_executed (GumExecCtx * ctx);
+static void gum_exec_ctx_process_event (GumExecCtx * ctx,
+    const GumEvent * ev);
+static guint64 gum_exec_ctx_query_timestamp (GumExecCtx * ctx);
 static gpointer gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
     gpointer start_address);
 static void gum_exec_ctx_create_thunks (GumExecCtx * ctx);
@@ -321,7 +447,8 @@ static void gum_exec_ctx_load_real_register_from_full_frame_into (
 static GumExecBlock * gum_exec_block_new (GumExecCtx * ctx);
 static GumExecBlock * gum_exec_block_obtain (GumExecCtx * ctx,
     gpointer real_address, gpointer * code_address);
-static gboolean gum_exec_block_is_full (GumExecBlock * block);
+static gboolean gum_exec_block_is_full (GumExecBlock * block,
+    GumGeneratorContext * gc);
 static GumAddress gum_exec_block_check_address_for_exclusion (
     GumExecBlock * block, GumAddress address);
 static void gum_exec_block_commit (GumExecBlock * block);
@@ -338,6 +465,10 @@ static void gum_exec_block_write_call_invoke_code (GumExecBlock * block,
 static void gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
     const GumBranchTarget * target, GumExecCtxReplaceCurrentBlockFunc func,
     GumGeneratorContext * gc);
+static GumIcEntry * gum_exec_block_write_inline_cache_code (
+    GumExecBlock * block, arm64_reg target_reg, arm64_reg scratch_reg,
+    gconstpointer hit_label, gconstpointer miss_label,
+    GumGeneratorContext * gc);
 static void gum_exec_block_write_jmp_to_block_start (GumExecBlock * block,
     gpointer block_start);
 static void gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
@@ -349,11 +480,22 @@ static void gum_exec_block_write_call_event_code (GumExecBlock * block,
 static void gum_exec_block_write_ret_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 static void gum_exec_block_write_exec_event_code (GumExecBlock * block,
-    GumGeneratorContext * gc, GumCodeContext cc);
+    GumGeneratorContext * gc, gpointer location, GumCodeContext cc);
 static void gum_exec_block_write_block_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
+static void gum_exec_block_write_coverage_code (GumExecBlock * block,
+    GumGeneratorContext * gc);
 static void gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
+static void gum_exec_block_write_callout_code (GumExecBlock * block,
+    GumGeneratorContext * gc, GumCalloutEntry * entry);
+static void gum_exec_block_write_counter_increment_code (GumExecBlock * block,
+    GumGeneratorContext * gc, GumHitCounters * counters, guint index);
+static gboolean gum_exec_block_defer_code (GumExecBlock * block,
+    GumGeneratorContext * gc, GumDeferredCodeType type, gpointer subject,
+    guint index);
+static void gum_exec_block_write_deferred_code (GumExecBlock * block,
+    GumGeneratorContext * gc);
 
 static void gum_exec_block_write_call_probe_code (GumExecBlock * block,
     const GumBranchTarget * target, GumGeneratorContext * gc);
@@ -368,6 +510,9 @@ static void gum_exec_block_close_prolog (GumExecBlock * block,
 
 G_DEFINE_TYPE (GumStalker, gum_stalker, G_TYPE_OBJECT)
 
+G_LOCK_DEFINE_STATIC (gum_stalkers);
+static GSList * gum_stalkers = NULL;
+
 gboolean
 gum_stalker_is_supported (void)
 {
@@ -407,18 +552,35 @@ static void
 gum_stalker_init (GumStalker * self)
 {
   self->exclusions = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  self->scopes = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
   self->trust_threshold = 1;
+  self->ic_entries = GUM_DEFAULT_IC_ENTRIES;
+  self->ic_fallback_enabled = FALSE;
+  self->huge_pages_enabled = FALSE;
+  self->timestamps_enabled = FALSE;
+  self->block_sample_interval = 0;
+  self->coverage_bitmap = NULL;
+  self->coverage_mask = 0;
 
   gum_spinlock_init (&self->probe_lock);
   self->probe_target_by_id =
       g_hash_table_new_full (NULL, NULL, NULL, NULL);
-  self->probe_array_by_address =
-      g_hash_table_new_full (NULL, NULL, NULL, gum_stalker_free_probe_array);
+  self->probe_slot_by_address = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_call_probe_slot_free);
+  self->probe_index = g_array_new (FALSE, FALSE, sizeof (GumCallProbeSlot *));
 
   self->page_size = gum_query_page_size ();
   g_mutex_init (&self->mutex);
-  self->contexts = NULL;
+  g_queue_init (&self->contexts);
   self->exec_ctx = gum_tls_key_new ();
+
+  gum_spinlock_init (&self->spare_ctx_lock);
+  self->spare_ctxs = NULL;
+  self->n_spare_ctxs = 0;
+
+  G_LOCK (gum_stalkers);
+  gum_stalkers = g_slist_prepend (gum_stalkers, self);
+  G_UNLOCK (gum_stalkers);
 }
 
 static void
@@ -426,14 +588,30 @@ gum_stalker_finalize (GObject * object)
 {
   GumStalker * self = GUM_STALKER (object);
 
-  g_hash_table_unref (self->probe_array_by_address);
+  G_LOCK (gum_stalkers);
+  gum_stalkers = g_slist_remove (gum_stalkers, self);
+  G_UNLOCK (gum_stalkers);
+
+  g_array_free (self->probe_index, TRUE);
+  g_hash_table_unref (self->probe_slot_by_address);
   g_hash_table_unref (self->probe_target_by_id);
 
   gum_spinlock_free (&self->probe_lock);
 
+  g_array_free (self->scopes, TRUE);
   g_array_free (self->exclusions, TRUE);
 
-  g_assert (self->contexts == NULL);
+  g_assert (g_queue_is_empty (&self->contexts));
+
+  while (self->spare_ctxs != NULL)
+  {
+    GumExecCtx * ctx = self->spare_ctxs;
+
+    self->spare_ctxs = ctx->next_spare;
+    gum_exec_ctx_free_shell (ctx);
+  }
+  gum_spinlock_free (&self->spare_ctx_lock);
+
   gum_tls_key_free (self->exec_ctx);
   g_mutex_clear (&self->mutex);
 
@@ -446,11 +624,183 @@ gum_stalker_new (void)
   return g_object_new (GUM_TYPE_STALKER, NULL);
 }
 
+/*
+ * Keeps Stalkers from being created or destroyed until the fork is over, as
+ * the child walks the list of them.
+ */
+void
+_gum_stalker_prepare_to_fork (void)
+{
+  G_LOCK (gum_stalkers);
+}
+
+void
+_gum_stalker_recover_from_fork_in_parent (void)
+{
+  G_UNLOCK (gum_stalkers);
+}
+
+/*
+ * Only the thread that called fork() lives on in the child, so the contexts of
+ * all the other threads are treated as if those threads had unfollowed
+ * themselves, and left for gum_stalker_garbage_collect(). Nothing is freed
+ * here, and the locks of each Stalker, which those threads may have been
+ * holding, are reset rather than taken, as they would never be released.
+ */
+void
+_gum_stalker_recover_from_fork_in_child (void)
+{
+  GSList * cur;
+
+  for (cur = gum_stalkers; cur != NULL; cur = cur->next)
+    gum_stalker_recover_from_fork_in_child (cur->data);
+
+  G_UNLOCK (gum_stalkers);
+}
+
+static void
+gum_stalker_recover_from_fork_in_child (GumStalker * self)
+{
+  GumExecCtx * current_ctx;
+  GList * cur;
+
+  g_mutex_init (&self->mutex);
+  gum_spinlock_init (&self->spare_ctx_lock);
+
+  current_ctx = gum_stalker_get_exec_ctx (self);
+  if (current_ctx != NULL)
+    current_ctx->thread_id = gum_process_get_current_thread_id ();
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+  {
+    GumExecCtx * ctx = (GumExecCtx *) cur->data;
+
+    if (ctx == current_ctx || ctx->state == GUM_EXEC_CTX_DESTROY_PENDING)
+      continue;
+
+    ctx->state = GUM_EXEC_CTX_DESTROY_PENDING;
+  }
+}
+
+/*
+ * Exclusions and scopes are kept sorted by base address, with overlapping and
+ * adjacent ranges merged, so that lookups can binary search them. That
+ * matters because the lookup is done for every call site we compile, and on
+ * some architectures also at runtime for each indirect call.
+ */
 void
 gum_stalker_exclude (GumStalker * self,
                      const GumMemoryRange * range)
 {
-  g_array_append_val (self->exclusions, *range);
+  gum_memory_ranges_add (self->exclusions, range);
+}
+
+/*
+ * Once any scope has been added, calls to code outside of all of them are
+ * treated as calls to excluded ranges.
+ */
+void
+gum_stalker_add_scope (GumStalker * self,
+                       const GumMemoryRange * range)
+{
+  gum_memory_ranges_add (self->scopes, range);
+}
+
+/*
+ * Entering the scope through its entry points is only implemented on x86 so
+ * far. Here a followed thread is stalked everywhere, apart from its calls out
+ * of the scope.
+ */
+gboolean
+gum_stalker_add_scope_entry (GumStalker * self,
+                             gpointer function_address)
+{
+  return FALSE;
+}
+
+static gboolean
+gum_stalker_is_excluding (GumStalker * self,
+                          gconstpointer address)
+{
+  if (gum_memory_ranges_contain (self->exclusions, address))
+    return TRUE;
+
+  return !gum_stalker_is_in_scope (self, address);
+}
+
+static gboolean
+gum_stalker_is_in_scope (GumStalker * self,
+                         gconstpointer address)
+{
+  return self->scopes->len == 0 ||
+      gum_memory_ranges_contain (self->scopes, address);
+}
+
+static void
+gum_memory_ranges_add (GArray * ranges,
+                       const GumMemoryRange * range)
+{
+  guint i;
+  GumMemoryRange * cur;
+
+  for (i = 0; i != ranges->len; i++)
+  {
+    if (g_array_index (ranges, GumMemoryRange, i).base_address >
+        range->base_address)
+      break;
+  }
+  g_array_insert_val (ranges, i, *range);
+
+  if (i != 0)
+  {
+    GumMemoryRange * prev = &g_array_index (ranges, GumMemoryRange, i - 1);
+
+    if (prev->base_address + prev->size >= range->base_address)
+    {
+      prev->size = MAX (prev->base_address + prev->size,
+          range->base_address + range->size) - prev->base_address;
+      g_array_remove_index (ranges, i);
+      i--;
+    }
+  }
+
+  cur = &g_array_index (ranges, GumMemoryRange, i);
+  while (i + 1 != ranges->len)
+  {
+    GumMemoryRange * next = &g_array_index (ranges, GumMemoryRange, i + 1);
+
+    if (cur->base_address + cur->size < next->base_address)
+      break;
+
+    cur->size = MAX (cur->base_address + cur->size,
+        next->base_address + next->size) - cur->base_address;
+    g_array_remove_index (ranges, i + 1);
+  }
+}
+
+static gboolean
+gum_memory_ranges_contain (GArray * ranges,
+                           gconstpointer address)
+{
+  GumAddress needle = GUM_ADDRESS (address);
+  guint lo, hi;
+
+  lo = 0;
+  hi = ranges->len;
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+    GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, mid);
+
+    if (needle < r->base_address)
+      hi = mid;
+    else if (needle >= r->base_address + r->size)
+      lo = mid + 1;
+    else
+      return TRUE;
+  }
+
+  return FALSE;
 }
 
 gint
@@ -466,17 +816,136 @@ gum_stalker_set_trust_threshold (GumStalker * self,
   self->trust_threshold = trust_threshold;
 }
 
+guint
+gum_stalker_get_ic_entries (GumStalker * self)
+{
+  return self->ic_entries;
+}
+
+void
+gum_stalker_set_ic_entries (GumStalker * self,
+                            guint ic_entries)
+{
+  g_return_if_fail (ic_entries >= GUM_DEFAULT_IC_ENTRIES &&
+      ic_entries <= GUM_MAX_IC_ENTRIES);
+
+  self->ic_entries = ic_entries;
+}
+
+gboolean
+gum_stalker_get_ic_fallback_enabled (GumStalker * self)
+{
+  return self->ic_fallback_enabled;
+}
+
+void
+gum_stalker_set_ic_fallback_enabled (GumStalker * self,
+                                     gboolean enabled)
+{
+  self->ic_fallback_enabled = enabled;
+}
+
+gboolean
+gum_stalker_get_huge_pages_enabled (GumStalker * self)
+{
+  return self->huge_pages_enabled;
+}
+
+void
+gum_stalker_set_huge_pages_enabled (GumStalker * self,
+                                    gboolean enabled)
+{
+  self->huge_pages_enabled = enabled;
+}
+
+gboolean
+gum_stalker_get_timestamps_enabled (GumStalker * self)
+{
+  return self->timestamps_enabled;
+}
+
+void
+gum_stalker_set_timestamps_enabled (GumStalker * self,
+                                    gboolean enabled)
+{
+  self->timestamps_enabled = enabled;
+}
+
+gsize
+gum_stalker_get_code_budget (GumStalker * self)
+{
+  return 0;
+}
+
+/*
+ * The code cache can't be flushed while a thread is being followed on this
+ * architecture yet, so only the default of no limit is accepted.
+ */
+gboolean
+gum_stalker_set_code_budget (GumStalker * self,
+                             gsize budget)
+{
+  return budget == 0;
+}
+
+guint
+gum_stalker_get_block_sample_interval (GumStalker * self)
+{
+  return self->block_sample_interval;
+}
+
+void
+gum_stalker_set_block_sample_interval (GumStalker * self,
+                                       guint interval)
+{
+  self->block_sample_interval = interval;
+}
+
+void
+gum_stalker_set_coverage_bitmap (GumStalker * self,
+                                 guint8 * bitmap,
+                                 gsize size)
+{
+  g_assert (bitmap == NULL || (size != 0 && (size & (size - 1)) == 0));
+
+  self->coverage_bitmap = bitmap;
+  self->coverage_mask = (bitmap != NULL) ? size - 1 : 0;
+}
+
+void
+gum_stalker_reset_coverage (GumStalker * self)
+{
+  GList * cur;
+
+  if (self->coverage_bitmap == NULL)
+    return;
+
+  memset (self->coverage_bitmap, 0, self->coverage_mask + 1);
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+  {
+    GumExecCtx * ctx = (GumExecCtx *) cur->data;
+
+    ctx->coverage_prev = 0;
+  }
+
+  GUM_STALKER_UNLOCK (self);
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
   GSList * sinks, * cur;
+  GList * link;
 
   GUM_STALKER_LOCK (self);
 
   sinks = NULL;
-  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  for (link = self->contexts.head; link != NULL; link = link->next)
   {
-    GumExecCtx * ctx = cur->data;
+    GumExecCtx * ctx = link->data;
 
     sinks = g_slist_prepend (sinks, g_object_ref (ctx->sink));
   }
@@ -496,22 +965,38 @@ gum_stalker_flush (GumStalker * self)
 void
 gum_stalker_stop (GumStalker * self)
 {
+  GHashTableIter iter;
+  GumCallProbeSlot * slot;
+  GPtrArray * old_probes;
   gboolean rescan_needed;
-  GSList * cur;
+  GList * cur;
+
+  old_probes = g_ptr_array_new_with_free_func (gum_stalker_free_probe_array);
 
   gum_spinlock_acquire (&self->probe_lock);
   g_hash_table_remove_all (self->probe_target_by_id);
-  g_hash_table_remove_all (self->probe_array_by_address);
+  g_hash_table_iter_init (&iter, self->probe_slot_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &slot))
+  {
+    if (slot->probes != NULL)
+    {
+      g_ptr_array_add (old_probes, slot->probes);
+      g_atomic_pointer_set (&slot->probes, NULL);
+    }
+  }
   self->any_probes_attached = FALSE;
   gum_spinlock_release (&self->probe_lock);
 
+  gum_stalker_synchronize_call_probes (self);
+  g_ptr_array_unref (old_probes);
+
   GUM_STALKER_LOCK (self);
 
   do
   {
     rescan_needed = FALSE;
 
-    for (cur = self->contexts; cur != NULL; cur = cur->next)
+    for (cur = self->contexts.head; cur != NULL; cur = cur->next)
     {
       GumExecCtx * ctx = (GumExecCtx *) cur->data;
       if (ctx->state == GUM_EXEC_CTX_ACTIVE)
@@ -537,30 +1022,53 @@ gum_stalker_stop (GumStalker * self)
 gboolean
 gum_stalker_garbage_collect (GumStalker * self)
 {
-  GSList * keep = NULL, * cur;
+  GList * cur;
   gboolean pending_garbage;
 
   GUM_STALKER_LOCK (self);
 
-  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  cur = self->contexts.head;
+  while (cur != NULL)
   {
     GumExecCtx * ctx = (GumExecCtx *) cur->data;
+
+    cur = cur->next;
+
     if (ctx->state == GUM_EXEC_CTX_DESTROY_PENDING)
+    {
+      gum_exec_ctx_collect_stats (ctx, &self->retired_stats);
+      g_queue_unlink (&self->contexts, &ctx->link);
       gum_exec_ctx_free (ctx);
-    else
-      keep = g_slist_prepend (keep, ctx);
+    }
   }
 
-  g_slist_free (self->contexts);
-  self->contexts = keep;
-
-  pending_garbage = keep != NULL;
+  pending_garbage = !g_queue_is_empty (&self->contexts);
 
   GUM_STALKER_UNLOCK (self);
 
   return pending_garbage;
 }
 
+/*
+ * Threads still being followed keep on counting while we read, so their share
+ * is only approximate.
+ */
+void
+gum_stalker_get_stats (GumStalker * self,
+                       GumStalkerStats * stats)
+{
+  GList * cur;
+
+  GUM_STALKER_LOCK (self);
+
+  *stats = self->retired_stats;
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+    gum_exec_ctx_collect_stats ((GumExecCtx *) cur->data, stats);
+
+  GUM_STALKER_UNLOCK (self);
+}
+
 gpointer
 _gum_stalker_do_follow_me (GumStalker * self,
                            GumStalkerTransformer * transformer,
@@ -609,7 +1117,8 @@ gum_stalker_unfollow_me (GumStalker * self)
     gum_tls_key_set_value (self->exec_ctx, NULL);
 
     GUM_STALKER_LOCK (self);
-    self->contexts = g_slist_remove (self->contexts, ctx);
+    gum_exec_ctx_collect_stats (ctx, &self->retired_stats);
+    g_queue_unlink (&self->contexts, &ctx->link);
     GUM_STALKER_UNLOCK (self);
 
     gum_exec_ctx_free (ctx);
@@ -622,6 +1131,30 @@ gum_stalker_is_following_me (GumStalker * self)
   return gum_stalker_get_exec_ctx (self) != NULL;
 }
 
+/*
+ * Compiles the block at `address` ahead of time for the calling thread, which
+ * must be followed, so that a list of hot blocks recorded during a previous
+ * session (e.g. from GUM_COMPILE events) can warm up the cache right after
+ * attaching. Setting `recycle_count` to the trust threshold or above lets
+ * branches to the block be backpatched on first use.
+ */
+void
+gum_stalker_prefetch (GumStalker * self,
+                      gconstpointer address,
+                      gint recycle_count)
+{
+  GumExecCtx * ctx;
+  GumExecBlock * block;
+  gpointer code_address;
+
+  ctx = gum_stalker_get_exec_ctx (self);
+  g_assert (ctx != NULL);
+
+  block = gum_exec_ctx_obtain_block_for (ctx, (gpointer) address,
+      &code_address);
+  block->recycle_count = recycle_count;
+}
+
 void
 gum_stalker_follow (GumStalker * self,
                     GumThreadId thread_id,
@@ -642,6 +1175,22 @@ gum_stalker_follow (GumStalker * self,
   }
 }
 
+guint
+gum_stalker_follow_threads (GumStalker * self,
+                            const GumThreadId * thread_ids,
+                            guint num_threads,
+                            GumStalkerTransformer * transformer,
+                            GumEventSink * sink)
+{
+  GumInfectContext ctx;
+  ctx.stalker = self;
+  ctx.transformer = transformer;
+  ctx.sink = sink;
+
+  return gum_process_modify_threads (thread_ids, num_threads,
+      gum_stalker_infect, &ctx);
+}
+
 void
 gum_stalker_unfollow (GumStalker * self,
                       GumThreadId thread_id)
@@ -652,11 +1201,11 @@ gum_stalker_unfollow (GumStalker * self,
   }
   else
   {
-    GSList * cur;
+    GList * cur;
 
     GUM_STALKER_LOCK (self);
 
-    for (cur = self->contexts; cur != NULL; cur = cur->next)
+    for (cur = self->contexts.head; cur != NULL; cur = cur->next)
     {
       GumExecCtx * ctx = (GumExecCtx *) cur->data;
       if (ctx->thread_id == thread_id && ctx->state == GUM_EXEC_CTX_ACTIVE)
@@ -747,7 +1296,8 @@ gum_stalker_disinfect (GumThreadId thread_id,
   {
     cpu_context->pc = GPOINTER_TO_SIZE (ctx->current_block->real_begin);
 
-    self->contexts = g_slist_remove (self->contexts, ctx);
+    gum_exec_ctx_collect_stats (ctx, &self->retired_stats);
+    g_queue_unlink (&self->contexts, &ctx->link);
     gum_exec_ctx_free (ctx);
 
     disinfect_context->success = TRUE;
@@ -762,7 +1312,9 @@ gum_stalker_add_call_probe (GumStalker * self,
                             GDestroyNotify notify)
 {
   GumCallProbe probe;
-  GArray * probes;
+  GumCallProbeSlot * slot;
+  GArray * old_probes, * new_probes;
+  GArray * old_index = NULL;
 
   probe.id = g_atomic_int_add (&self->last_probe_id, 1) + 1;
   probe.callback = callback;
@@ -774,20 +1326,23 @@ gum_stalker_add_call_probe (GumStalker * self,
   g_hash_table_insert (self->probe_target_by_id, GSIZE_TO_POINTER (probe.id),
       target_address);
 
-  probes = (GArray *)
-      g_hash_table_lookup (self->probe_array_by_address, target_address);
-  if (probes == NULL)
-  {
-    probes = g_array_sized_new (FALSE, FALSE, sizeof (GumCallProbe), 4);
-    g_hash_table_insert (self->probe_array_by_address, target_address, probes);
-  }
+  slot = gum_stalker_obtain_call_probe_slot (self, target_address, &old_index);
 
-  g_array_append_val (probes, probe);
+  old_probes = slot->probes;
+  new_probes = gum_call_probe_array_copy (old_probes, 1);
+  g_array_append_val (new_probes, probe);
+  g_atomic_pointer_set (&slot->probes, new_probes);
 
   self->any_probes_attached = TRUE;
 
   gum_spinlock_release (&self->probe_lock);
 
+  gum_stalker_synchronize_call_probes (self);
+  if (old_probes != NULL)
+    g_array_free (old_probes, TRUE);
+  if (old_index != NULL)
+    g_array_free (old_index, TRUE);
+
   gum_stalker_invalidate_caches (self);
 
   return probe.id;
@@ -798,6 +1353,8 @@ gum_stalker_remove_call_probe (GumStalker * self,
                                GumProbeId id)
 {
   gpointer target_address;
+  GArray * old_probes = NULL;
+  GumCallProbe removed_probe = { 0, };
 
   gum_spinlock_acquire (&self->probe_lock);
 
@@ -805,44 +1362,161 @@ gum_stalker_remove_call_probe (GumStalker * self,
       g_hash_table_lookup (self->probe_target_by_id, GSIZE_TO_POINTER (id));
   if (target_address != NULL)
   {
-    GArray * probes;
-    gint match_index = -1;
+    GumCallProbeSlot * slot;
+    GArray * new_probes;
     guint i;
-    GumCallProbe * probe;
 
     g_hash_table_remove (self->probe_target_by_id, GSIZE_TO_POINTER (id));
 
-    probes = (GArray *)
-        g_hash_table_lookup (self->probe_array_by_address, target_address);
-    g_assert (probes != NULL);
+    slot = g_hash_table_lookup (self->probe_slot_by_address, target_address);
+    g_assert (slot != NULL);
+
+    old_probes = slot->probes;
+    new_probes = (old_probes->len > 1)
+        ? gum_call_probe_array_copy (NULL, old_probes->len - 1)
+        : NULL;
 
-    for (i = 0; i != probes->len; i++)
+    for (i = 0; i != old_probes->len; i++)
     {
-      if (g_array_index (probes, GumCallProbe, i).id == id)
-      {
-        match_index = i;
-        break;
-      }
-    }
-    g_assert_cmpint (match_index, !=, -1);
+      GumCallProbe * probe = &g_array_index (old_probes, GumCallProbe, i);
 
-    probe = &g_array_index (probes, GumCallProbe, match_index);
-    if (probe->user_notify != NULL)
-      probe->user_notify (probe->user_data);
-    g_array_remove_index (probes, match_index);
+      if (probe->id == id)
+        removed_probe = *probe;
+      else
+        g_array_append_val (new_probes, *probe);
+    }
+    g_assert_cmpuint (removed_probe.id, ==, id);
 
-    if (probes->len == 0)
-      g_hash_table_remove (self->probe_array_by_address, target_address);
+    g_atomic_pointer_set (&slot->probes, new_probes);
 
     self->any_probes_attached =
-        g_hash_table_size (self->probe_array_by_address) != 0;
+        g_hash_table_size (self->probe_target_by_id) != 0;
   }
 
   gum_spinlock_release (&self->probe_lock);
 
+  if (old_probes != NULL)
+  {
+    gum_stalker_synchronize_call_probes (self);
+
+    if (removed_probe.user_notify != NULL)
+      removed_probe.user_notify (removed_probe.user_data);
+    g_array_free (old_probes, TRUE);
+  }
+
   gum_stalker_invalidate_caches (self);
 }
 
+static GumCallProbeSlot *
+gum_stalker_obtain_call_probe_slot (GumStalker * self,
+                                    gpointer target_address,
+                                    GArray ** old_index)
+{
+  GumCallProbeSlot * slot;
+  GArray * index;
+  guint i;
+
+  slot = g_hash_table_lookup (self->probe_slot_by_address, target_address);
+  if (slot != NULL)
+    return slot;
+
+  slot = g_slice_new (GumCallProbeSlot);
+  slot->target_address = target_address;
+  slot->probes = NULL;
+  g_hash_table_insert (self->probe_slot_by_address, target_address, slot);
+
+  *old_index = self->probe_index;
+
+  index = g_array_sized_new (FALSE, FALSE, sizeof (GumCallProbeSlot *),
+      (*old_index)->len + 1);
+  g_array_append_vals (index, (*old_index)->data, (*old_index)->len);
+  for (i = 0; i != index->len; i++)
+  {
+    if (g_array_index (index, GumCallProbeSlot *, i)->target_address >
+        target_address)
+      break;
+  }
+  g_array_insert_val (index, i, slot);
+
+  g_atomic_pointer_set (&self->probe_index, index);
+
+  return slot;
+}
+
+/*
+ * Returns once no thread can still be looking at probes or an index that
+ * was just replaced. Readers make their context's probe_epoch odd while
+ * they are inside the dispatch code, so we only have to wait for those that
+ * are odd right now to move on. Must not be called from a probe callback.
+ *
+ * We never yield with the lock held, as a callback we are waiting for may
+ * want it too. Contexts are unlinked under the lock before being freed, so
+ * checking that one is still linked is enough to keep it safe to read.
+ */
+static void
+gum_stalker_synchronize_call_probes (GumStalker * self)
+{
+  GArray * busy_ctxs;
+  GList * cur;
+  guint i;
+
+  busy_ctxs = g_array_new (FALSE, FALSE, sizeof (GumBusyExecCtx));
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+  {
+    GumBusyExecCtx busy;
+
+    busy.ctx = (GumExecCtx *) cur->data;
+    busy.epoch = g_atomic_int_get (&busy.ctx->probe_epoch);
+    if ((busy.epoch & 1) != 0)
+      g_array_append_val (busy_ctxs, busy);
+  }
+
+  GUM_STALKER_UNLOCK (self);
+
+  for (i = 0; i != busy_ctxs->len; i++)
+  {
+    GumBusyExecCtx * busy = &g_array_index (busy_ctxs, GumBusyExecCtx, i);
+
+    while (gum_stalker_is_still_dispatching (self, busy))
+      g_thread_yield ();
+  }
+
+  g_array_free (busy_ctxs, TRUE);
+}
+
+static gboolean
+gum_stalker_is_still_dispatching (GumStalker * self,
+                                  const GumBusyExecCtx * busy)
+{
+  gboolean dispatching;
+
+  GUM_STALKER_LOCK (self);
+
+  dispatching = g_queue_find (&self->contexts, busy->ctx) != NULL &&
+      g_atomic_int_get (&busy->ctx->probe_epoch) == busy->epoch;
+
+  GUM_STALKER_UNLOCK (self);
+
+  return dispatching;
+}
+
+static GArray *
+gum_call_probe_array_copy (GArray * probes,
+                           guint extra)
+{
+  GArray * copy;
+  guint len = (probes != NULL) ? probes->len : 0;
+
+  copy = g_array_sized_new (FALSE, FALSE, sizeof (GumCallProbe), len + extra);
+  if (probes != NULL)
+    g_array_append_vals (copy, probes->data, probes->len);
+
+  return copy;
+}
+
 static void
 gum_stalker_free_probe_array (gpointer data)
 {
@@ -859,6 +1533,38 @@ gum_stalker_free_probe_array (gpointer data)
   g_array_free (probes, TRUE);
 }
 
+static void
+gum_call_probe_slot_free (GumCallProbeSlot * slot)
+{
+  if (slot->probes != NULL)
+    gum_stalker_free_probe_array (slot->probes);
+
+  g_slice_free (GumCallProbeSlot, slot);
+}
+
+static GumCallProbeSlot *
+gum_call_probe_index_find (GArray * index,
+                           gconstpointer target_address)
+{
+  guint lo = 0, hi = index->len;
+
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+    GumCallProbeSlot * slot = g_array_index (index, GumCallProbeSlot *, mid);
+
+    if (slot->target_address == target_address)
+      return slot;
+
+    if (slot->target_address < target_address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return NULL;
+}
+
 static GumExecCtx *
 gum_stalker_create_exec_ctx (GumStalker * self,
                              GumThreadId thread_id,
@@ -872,10 +1578,26 @@ gum_stalker_create_exec_ctx (GumStalker * self,
   if (sizeof (GumExecCtx) % self->page_size != 0)
     base_size++;
 
-  ctx = gum_alloc_n_pages (base_size + GUM_CODE_SLAB_SIZE_IN_PAGES + 1,
-      GUM_PAGE_RWX);
+  ctx = gum_stalker_take_spare_exec_ctx (self);
+  if (ctx == NULL)
+  {
+    ctx = gum_alloc_n_pages (base_size + GUM_CODE_SLAB_SIZE_IN_PAGES + 1,
+        GUM_PAGE_RWX);
+
+    gum_metal_map_init (&ctx->mappings);
+    gum_exec_ctx_create_thunks (ctx);
+
+    if (self->huge_pages_enabled)
+    {
+      gum_memory_advise_huge_pages (
+          ((guint8 *) ctx) + (base_size * self->page_size),
+          GUM_CODE_SLAB_SIZE_IN_PAGES * self->page_size);
+    }
+  }
   ctx->state = GUM_EXEC_CTX_ACTIVE;
   ctx->invalidate_pending = FALSE;
+  ctx->probe_epoch = 0;
+  ctx->coverage_prev = 0;
 
   ctx->code_slab = &ctx->first_code_slab;
   ctx->first_code_slab.data = ((guint8 *) ctx) + (base_size * self->page_size);
@@ -894,12 +1616,18 @@ gum_stalker_create_exec_ctx (GumStalker * self,
       ctx->code_slab->size + self->page_size - sizeof (GumExecFrame));
   ctx->current_frame = ctx->first_frame;
 
-  ctx->mappings = gum_metal_hash_table_new (NULL, NULL);
-
   ctx->resume_at = NULL;
   ctx->return_at = NULL;
   ctx->app_stack = NULL;
 
+  memset (&ctx->stats, 0, sizeof (ctx->stats));
+  ctx->ic_lookups = 0;
+
+  ctx->ic_entries = self->ic_entries;
+  ctx->block_min_size = GUM_EXEC_BLOCK_MIN_SIZE +
+      ((ctx->ic_entries - GUM_DEFAULT_IC_ENTRIES) *
+      GUM_IC_ENTRY_MAX_CODE_SIZE) + GUM_EXCLUSIVE_ACCESS_RESERVE;
+
   ctx->stalker = g_object_ref (self);
   ctx->thread_id = thread_id;
 
@@ -910,16 +1638,17 @@ gum_stalker_create_exec_ctx (GumStalker * self,
     ctx->transformer = g_object_ref (transformer);
   else
     ctx->transformer = gum_stalker_transformer_make_default ();
-  g_queue_init (&ctx->callout_entries);
+  ctx->callout_pages = NULL;
   gum_spinlock_init (&ctx->callout_lock);
   ctx->sink = (GumEventSink *) g_object_ref (sink);
   ctx->sink_mask = gum_event_sink_query_mask (sink);
+  ctx->sink_has_location_mask = gum_event_sink_has_location_mask (sink);
   ctx->sink_process_impl = GUM_EVENT_SINK_GET_IFACE (sink)->process;
-
-  gum_exec_ctx_create_thunks (ctx);
+  ctx->timestamps_enabled = self->timestamps_enabled;
 
   GUM_STALKER_LOCK (self);
-  self->contexts = g_slist_prepend (self->contexts, ctx);
+  ctx->link.data = ctx;
+  g_queue_push_head_link (&self->contexts, &ctx->link);
   GUM_STALKER_UNLOCK (self);
 
   gum_exec_ctx_ensure_inline_helpers_reachable (ctx);
@@ -936,11 +1665,11 @@ gum_stalker_get_exec_ctx (GumStalker * self)
 static void
 gum_stalker_invalidate_caches (GumStalker * self)
 {
-  GSList * cur;
+  GList * cur;
 
   GUM_STALKER_LOCK (self);
 
-  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
   {
     GumExecCtx * ctx = (GumExecCtx *) cur->data;
 
@@ -953,20 +1682,25 @@ gum_stalker_invalidate_caches (GumStalker * self)
 static void
 gum_exec_ctx_dispose_callouts (GumExecCtx * ctx)
 {
-  GList * cur;
+  GumCalloutPage * page;
 
   gum_spinlock_acquire (&ctx->callout_lock);
 
-  for (cur = ctx->callout_entries.head; cur != NULL; cur = cur->next)
+  for (page = ctx->callout_pages; page != NULL; page = page->next)
   {
-    GumCalloutEntry * entry = cur->data;
+    guint i;
 
-    if (entry->data_destroy != NULL)
-      entry->data_destroy (entry->data);
+    for (i = 0; i != page->num_entries; i++)
+    {
+      GumCalloutEntry * entry = &page->entries[i];
+
+      if (entry->data_destroy != NULL)
+        entry->data_destroy (entry->data);
 
-    entry->callout = NULL;
-    entry->data = NULL;
-    entry->data_destroy = NULL;
+      entry->callout = NULL;
+      entry->data = NULL;
+      entry->data_destroy = NULL;
+    }
   }
 
   gum_spinlock_release (&ctx->callout_lock);
@@ -975,24 +1709,62 @@ gum_exec_ctx_dispose_callouts (GumExecCtx * ctx)
 static void
 gum_exec_ctx_finalize_callouts (GumExecCtx * ctx)
 {
-  GList * cur;
+  GumCalloutPage * page = ctx->callout_pages;
+
+  while (page != NULL)
+  {
+    GumCalloutPage * next = page->next;
+    gum_free_pages (page);
+    page = next;
+  }
+
+  ctx->callout_pages = NULL;
+}
+
+static GumCalloutEntry *
+gum_exec_ctx_alloc_callout_entry (GumExecCtx * ctx)
+{
+  GumCalloutPage * page = ctx->callout_pages;
 
-  for (cur = ctx->callout_entries.head; cur != NULL; cur = cur->next)
+  if (page == NULL || page->num_entries == page->capacity)
   {
-    GumCalloutEntry * entry = cur->data;
+    GumCalloutPage * next = page;
+
+    page = gum_alloc_n_pages (1, GUM_PAGE_RW);
+    page->next = next;
+    page->num_entries = 0;
+    page->capacity = (gum_query_page_size () -
+        G_STRUCT_OFFSET (GumCalloutPage, entries)) / sizeof (GumCalloutEntry);
 
-    g_slice_free (GumCalloutEntry, entry);
+    ctx->callout_pages = page;
   }
 
-  g_queue_clear (&ctx->callout_entries);
+  return &page->entries[page->num_entries++];
 }
 
 static void
 gum_exec_ctx_free (GumExecCtx * ctx)
 {
-  GumSlab * slab;
+  GumStalker * stalker = ctx->stalker;
+
+  if (gum_stalker_recycle_exec_ctx (stalker, ctx))
+    return;
+
+  gum_exec_ctx_clear (ctx);
+  gum_exec_ctx_free_shell (ctx);
+
+  g_object_unref (stalker);
+}
 
-  gum_metal_hash_table_unref (ctx->mappings);
+/*
+ * Drops everything tied to the thread that was followed. What remains is the
+ * shell: the pages holding the context, its first slab and frames, plus the
+ * thunks and the mappings table.
+ */
+static void
+gum_exec_ctx_clear (GumExecCtx * ctx)
+{
+  GumSlab * slab;
 
   slab = ctx->code_slab;
   while (slab != &ctx->first_code_slab)
@@ -1002,8 +1774,6 @@ gum_exec_ctx_free (GumExecCtx * ctx)
     slab = next;
   }
 
-  gum_exec_ctx_destroy_thunks (ctx);
-
   g_object_unref (ctx->sink);
   gum_exec_ctx_finalize_callouts (ctx);
   gum_spinlock_free (&ctx->callout_lock);
@@ -1011,12 +1781,95 @@ gum_exec_ctx_free (GumExecCtx * ctx)
 
   gum_arm64_relocator_clear (&ctx->relocator);
   gum_arm64_writer_clear (&ctx->code_writer);
+}
 
-  g_object_unref (ctx->stalker);
+static void
+gum_exec_ctx_free_shell (GumExecCtx * ctx)
+{
+  gum_metal_map_free (&ctx->mappings);
+
+  gum_exec_ctx_destroy_thunks (ctx);
 
   gum_free_pages (ctx);
 }
 
+static GumExecCtx *
+gum_stalker_take_spare_exec_ctx (GumStalker * self)
+{
+  GumExecCtx * ctx;
+
+  gum_spinlock_acquire (&self->spare_ctx_lock);
+
+  ctx = self->spare_ctxs;
+  if (ctx != NULL)
+  {
+    self->spare_ctxs = ctx->next_spare;
+    self->n_spare_ctxs--;
+  }
+
+  gum_spinlock_release (&self->spare_ctx_lock);
+
+  return ctx;
+}
+
+/*
+ * Keeps the shell of a context for the next thread to be followed, so that
+ * short-lived threads do not pay for mapping and unmapping it every time. The
+ * rest is zeroed, just like fresh pages would be.
+ */
+static gboolean
+gum_stalker_recycle_exec_ctx (GumStalker * self,
+                              GumExecCtx * ctx)
+{
+  GumMetalMap mappings;
+  gpointer thunks, infect_thunk;
+
+  gum_spinlock_acquire (&self->spare_ctx_lock);
+  if (self->n_spare_ctxs == GUM_MAX_SPARE_EXEC_CTXS)
+  {
+    gum_spinlock_release (&self->spare_ctx_lock);
+    return FALSE;
+  }
+  self->n_spare_ctxs++;
+  gum_spinlock_release (&self->spare_ctx_lock);
+
+  gum_exec_ctx_clear (ctx);
+
+  gum_metal_map_remove_all (&ctx->mappings);
+
+  mappings = ctx->mappings;
+  thunks = ctx->thunks;
+  infect_thunk = ctx->infect_thunk;
+
+  memset (ctx, 0, sizeof (GumExecCtx));
+
+  ctx->mappings = mappings;
+  ctx->thunks = thunks;
+  ctx->infect_thunk = infect_thunk;
+
+  gum_spinlock_acquire (&self->spare_ctx_lock);
+  ctx->next_spare = self->spare_ctxs;
+  self->spare_ctxs = ctx;
+  gum_spinlock_release (&self->spare_ctx_lock);
+
+  g_object_unref (self);
+
+  return TRUE;
+}
+
+static void
+gum_exec_ctx_collect_stats (GumExecCtx * ctx,
+                            GumStalkerStats * stats)
+{
+  GumStalkerStats s = ctx->stats;
+
+  s.ic_hits = (ctx->ic_lookups > s.ic_misses)
+      ? ctx->ic_lookups - s.ic_misses
+      : 0;
+
+  _gum_stalker_stats_add (stats, &s);
+}
+
 static void
 gum_exec_ctx_unfollow (GumExecCtx * ctx,
                        gpointer resume_at)
@@ -1036,10 +1889,15 @@ gum_exec_ctx_has_executed (GumExecCtx * ctx)
 
 static gboolean counters_enabled = FALSE;
 static guint total_transitions = 0;
+static guint total_compilations = 0;
+static guint64 total_entrygate_time = 0;
+static guint64 total_compile_time = 0;
+static guint64 total_transform_time = 0;
+static guint64 total_sink_time = 0;
 
 #define GUM_ENTRYGATE(name) \
   gum_exec_ctx_replace_current_block_from_##name
-#define GUM_DEFINE_ENTRYGATE(name) \
+#define GUM_DEFINE_ENTRYGATE(name, kind) \
   static guint total_##name##s = 0; \
   \
   static gpointer GUM_THUNK \
@@ -1047,6 +1905,8 @@ static guint total_transitions = 0;
       GumExecCtx * ctx, \
       gpointer start_address) \
   { \
+    ctx->stats.kind##_entrygates++; \
+    \
     if (counters_enabled) \
       total_##name##s++; \
     \
@@ -1055,33 +1915,39 @@ static guint total_transitions = 0;
 #define GUM_PRINT_ENTRYGATE_COUNTER(name) \
   g_printerr ("\t" G_STRINGIFY (name) "s: %u\n", total_##name##s)
 
-GUM_DEFINE_ENTRYGATE (call_imm)
-GUM_DEFINE_ENTRYGATE (call_reg)
-GUM_DEFINE_ENTRYGATE (call_reg_excluded)
-GUM_DEFINE_ENTRYGATE (post_call_invoke)
-GUM_DEFINE_ENTRYGATE (ret)
+GUM_DEFINE_ENTRYGATE (call_imm, call_imm)
+GUM_DEFINE_ENTRYGATE (call_reg, call_indirect)
+GUM_DEFINE_ENTRYGATE (call_reg_excluded, call_indirect)
+GUM_DEFINE_ENTRYGATE (post_call_invoke, post_call_invoke)
+GUM_DEFINE_ENTRYGATE (ret, ret)
 
-GUM_DEFINE_ENTRYGATE (jmp_imm)
-GUM_DEFINE_ENTRYGATE (jmp_reg)
+GUM_DEFINE_ENTRYGATE (jmp_imm, jmp_imm)
+GUM_DEFINE_ENTRYGATE (jmp_reg, jmp_indirect)
 
-GUM_DEFINE_ENTRYGATE (jmp_cond_cbz)
-GUM_DEFINE_ENTRYGATE (jmp_cond_cbnz)
-GUM_DEFINE_ENTRYGATE (jmp_cond_tbz)
-GUM_DEFINE_ENTRYGATE (jmp_cond_tbnz)
-GUM_DEFINE_ENTRYGATE (jmp_cond_cc)
+GUM_DEFINE_ENTRYGATE (jmp_cond_cbz, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_cbnz, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_tbz, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_tbnz, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_cc, jmp_cond)
 
-GUM_DEFINE_ENTRYGATE (jmp_continuation)
+GUM_DEFINE_ENTRYGATE (jmp_continuation, jmp_continuation)
 
 static gpointer
 gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
                                          gpointer start_address)
 {
+  guint64 start_time = 0, compile_time_before = 0;
+
   if (counters_enabled)
+  {
     total_transitions++;
+    start_time = _gum_stalker_get_nanoseconds ();
+    compile_time_before = total_compile_time;
+  }
 
   if (ctx->invalidate_pending)
   {
-    gum_metal_hash_table_remove_all (ctx->mappings);
+    gum_metal_map_remove_all (&ctx->mappings);
 
     ctx->invalidate_pending = FALSE;
   }
@@ -1103,6 +1969,12 @@ gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
         &ctx->resume_at);
   }
 
+  if (start_time != 0 && counters_enabled)
+  {
+    total_entrygate_time += _gum_stalker_get_nanoseconds () - start_time -
+        (total_compile_time - compile_time_before);
+  }
+
   return ctx->resume_at;
 }
 
@@ -1138,6 +2010,8 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   GumGeneratorContext gc;
   GumStalkerIterator iterator;
   gboolean all_labels_resolved;
+  gboolean counting;
+  guint64 start_time, transform_start_time = 0, compile_time;
 
   if (ctx->stalker->trust_threshold >= 0)
   {
@@ -1153,16 +2027,22 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
       }
       else
       {
-        gum_metal_hash_table_remove (ctx->mappings, real_address);
+        ctx->stats.trust_failures++;
+        gum_metal_map_remove (&ctx->mappings, real_address);
       }
     }
   }
 
+  counting = counters_enabled;
+  if (counting)
+    total_compilations++;
+  start_time = _gum_stalker_get_nanoseconds ();
+
   block = gum_exec_block_new (ctx);
   *code_address_ptr = block->code_begin;
 
   if (ctx->stalker->trust_threshold >= 0)
-    gum_metal_hash_table_insert (ctx->mappings, real_address, block);
+    gum_metal_map_insert (&ctx->mappings, real_address, block);
 
   cw = &ctx->code_writer;
   rl = &ctx->relocator;
@@ -1176,6 +2056,8 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   gc.continuation_real_address = NULL;
   gc.opened_prolog = GUM_PROLOG_NONE;
   gc.exclusive_load_offset = GUM_INSTRUCTION_OFFSET_NONE;
+  gc.n_deferred_code = 0;
+  gc.sink_mask = ctx->sink_mask;
 
   iterator.exec_context = ctx;
   iterator.exec_block = block;
@@ -1189,13 +2071,26 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   gum_arm64_writer_put_ldp_reg_reg_reg_offset (cw, ARM64_REG_X16, ARM64_REG_X17,
       ARM64_REG_SP, 16 + GUM_RED_ZONE_SIZE, GUM_INDEX_POST_ADJUST);
 
+  gum_exec_block_write_coverage_code (block, &gc);
+
+  if (counting)
+    transform_start_time = _gum_stalker_get_nanoseconds ();
+
   gum_stalker_transformer_transform_block (ctx->transformer, &iterator,
       (GumStalkerWriter *) cw);
 
+  if (transform_start_time != 0 && counters_enabled)
+  {
+    total_transform_time +=
+        _gum_stalker_get_nanoseconds () - transform_start_time;
+  }
+
   if (gc.continuation_real_address != NULL)
   {
     GumBranchTarget continue_target = { 0, };
 
+    gum_exec_block_write_deferred_code (block, &gc);
+
     continue_target.absolute_address = gc.continuation_real_address;
     continue_target.reg = ARM64_REG_INVALID;
     gum_exec_block_write_jmp_transfer_code (block, &continue_target,
@@ -1219,10 +2114,20 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
     ctx->tmp_event.type = GUM_COMPILE;
     ctx->tmp_event.compile.begin = block->real_begin;
     ctx->tmp_event.compile.end = block->real_end;
+    ctx->tmp_event.compile.timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-    gum_event_sink_process (ctx->sink, &ctx->tmp_event);
+    gum_exec_ctx_process_event (ctx, &ctx->tmp_event);
   }
 
+  compile_time = _gum_stalker_get_nanoseconds () - start_time;
+
+  ctx->stats.blocks_compiled++;
+  ctx->stats.bytes_emitted += block->code_end - block->code_begin;
+  ctx->stats.compile_time += compile_time;
+
+  if (counting && counters_enabled)
+    total_compile_time += compile_time;
+
   return block;
 }
 
@@ -1249,7 +2154,7 @@ gum_stalker_iterator_next (GumStalkerIterator * self,
 
     block->code_end = gum_arm64_writer_cur (gc->code_writer);
 
-    if (gum_exec_block_is_full (block))
+    if (gum_exec_block_is_full (block, gc))
     {
       gc->continuation_real_address = instruction->end;
       return FALSE;
@@ -1285,12 +2190,19 @@ gum_stalker_iterator_next (GumStalkerIterator * self,
         break;
     }
 
+    /*
+     * Sequences longer than this are not guaranteed to make progress on real
+     * hardware either, so we give up on keeping them intact.
+     */
     if (gc->exclusive_load_offset != GUM_INSTRUCTION_OFFSET_NONE)
     {
       gc->exclusive_load_offset++;
-      if (gc->exclusive_load_offset == 4)
+      if (gc->exclusive_load_offset == GUM_EXCLUSIVE_ACCESS_MAX_LENGTH)
         gc->exclusive_load_offset = GUM_INSTRUCTION_OFFSET_NONE;
     }
+
+    if (gc->exclusive_load_offset == GUM_INSTRUCTION_OFFSET_NONE)
+      gum_exec_block_write_deferred_code (block, gc);
   }
 
   instruction = &self->instruction;
@@ -1304,6 +2216,14 @@ gum_stalker_iterator_next (GumStalkerIterator * self,
 
   self->generator_context->instruction = instruction;
 
+  if (self->exec_context->sink_has_location_mask)
+  {
+    GumExecCtx * ec = self->exec_context;
+
+    gc->sink_mask = ec->sink_mask &
+        gum_event_sink_query_location_mask (ec->sink, instruction->begin);
+  }
+
   if (insn != NULL)
     *insn = instruction->ci;
 
@@ -1338,10 +2258,12 @@ gum_stalker_iterator_keep (GumStalkerIterator * self)
       break;
   }
 
-  if ((ec->sink_mask & GUM_EXEC) != 0 &&
-      gc->exclusive_load_offset == GUM_INSTRUCTION_OFFSET_NONE)
+  if ((gc->sink_mask & GUM_EXEC) != 0 &&
+      !gum_exec_block_defer_code (block, gc, GUM_DEFERRED_EXEC_EVENT,
+          gc->instruction->begin, 0))
   {
-    gum_exec_block_write_exec_event_code (block, gc, GUM_CODE_INTERRUPTIBLE);
+    gum_exec_block_write_exec_event_code (block, gc, gc->instruction->begin,
+        GUM_CODE_INTERRUPTIBLE);
   }
 
   if ((ec->sink_mask & GUM_BLOCK) != 0 &&
@@ -1378,12 +2300,35 @@ gum_stalker_iterator_keep (GumStalkerIterator * self)
       requirements = GUM_REQUIRE_RELOCATION;
   }
 
-  gum_exec_block_close_prolog (block, gc);
+  gum_exec_block_close_prolog (block, gc);
+
+  if ((requirements & GUM_REQUIRE_RELOCATION) != 0)
+    gum_arm64_relocator_write_one (rl);
+
+  self->requirements = requirements;
+}
+
+static void
+gum_exec_ctx_process_event (GumExecCtx * ctx,
+                            const GumEvent * ev)
+{
+  guint64 start_time;
+
+  if (!counters_enabled)
+  {
+    ctx->sink_process_impl (ctx->sink, ev);
+    return;
+  }
 
-  if ((requirements & GUM_REQUIRE_RELOCATION) != 0)
-    gum_arm64_relocator_write_one (rl);
+  start_time = _gum_stalker_get_nanoseconds ();
+  ctx->sink_process_impl (ctx->sink, ev);
+  total_sink_time += _gum_stalker_get_nanoseconds () - start_time;
+}
 
-  self->requirements = requirements;
+static guint64
+gum_exec_ctx_query_timestamp (GumExecCtx * ctx)
+{
+  return ctx->timestamps_enabled ? gum_timestamp_now () : 0;
 }
 
 static void
@@ -1399,8 +2344,9 @@ gum_exec_ctx_emit_call_event (GumExecCtx * ctx,
   call->location = location;
   call->target = target;
   call->depth = ctx->first_frame - ctx->current_frame;
+  call->timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  gum_exec_ctx_process_event (ctx, &ev);
 }
 
 static void
@@ -1416,8 +2362,9 @@ gum_exec_ctx_emit_ret_event (GumExecCtx * ctx,
   ret->location = location;
   ret->target = target;
   ret->depth = ctx->first_frame - ctx->current_frame;
+  ret->timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  gum_exec_ctx_process_event (ctx, &ev);
 }
 
 static void
@@ -1430,8 +2377,9 @@ gum_exec_ctx_emit_exec_event (GumExecCtx * ctx,
   ev.type = GUM_EXEC;
 
   exec->location = location;
+  exec->timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  gum_exec_ctx_process_event (ctx, &ev);
 }
 
 static void
@@ -1446,8 +2394,9 @@ gum_exec_ctx_emit_block_event (GumExecCtx * ctx,
 
   block->begin = begin;
   block->end = end;
+  block->timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  gum_exec_ctx_process_event (ctx, &ev);
 }
 
 void
@@ -1461,25 +2410,39 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
   GumExecBlock * block = self->exec_block;
   GumGeneratorContext * gc = self->generator_context;
 
-  entry = g_slice_new (GumCalloutEntry);
+  gum_spinlock_acquire (&ec->callout_lock);
+  entry = gum_exec_ctx_alloc_callout_entry (ec);
   entry->callout = callout;
   entry->data = data;
   entry->data_destroy = data_destroy;
   entry->pc = gc->instruction->begin;
   entry->exec_context = ec;
+  gum_spinlock_release (&ec->callout_lock);
 
-  gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
+  if (!gum_exec_block_defer_code (block, gc, GUM_DEFERRED_CALLOUT, entry, 0))
+    gum_exec_block_write_callout_code (block, gc, entry);
+}
 
-  gum_arm64_writer_put_call_address_with_arguments (gc->code_writer,
-      GUM_ADDRESS (gum_stalker_invoke_callout), 2,
-      GUM_ARG_REGISTER, ARM64_REG_X20,
-      GUM_ARG_ADDRESS, GUM_ADDRESS (entry));
+/*
+ * Bumps `counters->values[index]` each time execution gets here, without
+ * leaving the block. An exclusive load/store loop is used so that we do not
+ * depend on ARMv8.1 atomics, and NZCV is left untouched.
+ */
+void
+gum_stalker_iterator_put_counter_increment (GumStalkerIterator * self,
+                                            GumHitCounters * counters,
+                                            guint index)
+{
+  GumExecBlock * block = self->exec_block;
+  GumGeneratorContext * gc = self->generator_context;
 
-  gum_exec_block_close_prolog (block, gc);
+  g_assert_cmpuint (index, <, counters->length);
 
-  gum_spinlock_acquire (&ec->callout_lock);
-  g_queue_push_head (&ec->callout_entries, entry);
-  gum_spinlock_release (&ec->callout_lock);
+  if (!gum_exec_block_defer_code (block, gc, GUM_DEFERRED_COUNTER_INCREMENT,
+      counters, index))
+  {
+    gum_exec_block_write_counter_increment_code (block, gc, counters, index);
+  }
 }
 
 static void
@@ -2005,7 +2968,7 @@ gum_exec_block_new (GumExecCtx * ctx)
 {
   GumSlab * slab = ctx->code_slab;
 
-  if (slab->size - slab->offset >= GUM_EXEC_BLOCK_MIN_SIZE)
+  if (slab->size - slab->offset >= ctx->block_min_size)
   {
     GumExecBlock * block = (GumExecBlock *) (slab->data + slab->offset);
 
@@ -2018,6 +2981,7 @@ gum_exec_block_new (GumExecCtx * ctx)
 
     block->recycle_count = 0;
     block->has_call_to_excluded_range = FALSE;
+    block->sample_countdown = 1;
 
     slab->offset += block->code_begin - (slab->data + slab->offset);
 
@@ -2036,6 +3000,11 @@ gum_exec_block_new (GumExecCtx * ctx)
   slab->offset = 0;
   slab->size = (GUM_CODE_SLAB_SIZE_IN_PAGES * ctx->stalker->page_size)
       - sizeof (GumSlab);
+  if (ctx->stalker->huge_pages_enabled)
+  {
+    gum_memory_advise_huge_pages (slab,
+        GUM_CODE_SLAB_SIZE_IN_PAGES * ctx->stalker->page_size);
+  }
   slab->next = ctx->code_slab;
   ctx->code_slab = slab;
 
@@ -2051,36 +3020,40 @@ gum_exec_block_obtain (GumExecCtx * ctx,
 {
   GumExecBlock * block;
 
-  block = gum_metal_hash_table_lookup (ctx->mappings, real_address);
+  block = gum_metal_map_lookup (&ctx->mappings, real_address);
   if (block != NULL)
     *code_address_ptr = block->code_begin;
 
   return block;
 }
 
+/*
+ * Ending a block between a load-exclusive and its store-exclusive would put
+ * our transfer code in between every time, so such a sequence is allowed to
+ * eat into the reserve set aside for it.
+ */
 static gboolean
-gum_exec_block_is_full (GumExecBlock * block)
+gum_exec_block_is_full (GumExecBlock * block,
+                        GumGeneratorContext * gc)
 {
   guint8 * slab_end = block->slab->data + block->slab->size;
+  guint min_size = block->ctx->block_min_size;
 
-  return slab_end - block->code_end < GUM_EXEC_BLOCK_MIN_SIZE;
+  if (gc->exclusive_load_offset != GUM_INSTRUCTION_OFFSET_NONE)
+    min_size -= GUM_EXCLUSIVE_ACCESS_RESERVE;
+
+  return slab_end - block->code_end < min_size;
 }
 
 static GumAddress
 gum_exec_block_check_address_for_exclusion (GumExecBlock * block,
                                             GumAddress address)
 {
-  GArray * exclusions = block->ctx->stalker->exclusions;
-  guint i;
-
-  for (i = 0; i != exclusions->len; i++)
+  if (gum_stalker_is_excluding (block->ctx->stalker,
+      GSIZE_TO_POINTER (address)))
   {
-    GumMemoryRange * r = &g_array_index (exclusions, GumMemoryRange, i);
-    if (GUM_MEMORY_RANGE_INCLUDES (r, address))
-    {
-      block->has_call_to_excluded_range = TRUE;
-      return GUM_ADDRESS (0);
-    }
+    block->has_call_to_excluded_range = TRUE;
+    return GUM_ADDRESS (0);
   }
 
   return address;
@@ -2234,7 +3207,7 @@ gum_exec_block_backpatch_ret (GumExecBlock * block,
 
 static void
 gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
-                                       gpointer * ic_entries)
+                                       GumIcEntry * ic_entries)
 {
   gboolean just_unfollowed;
   GumExecCtx * ctx;
@@ -2244,18 +3217,26 @@ gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
     return;
 
   ctx = block->ctx;
+  ctx->stats.ic_misses++;
 
   if (ctx->state == GUM_EXEC_CTX_ACTIVE &&
       block->recycle_count >= ctx->stalker->trust_threshold)
   {
-    guint offset;
-
-    offset = (ic_entries[0] == NULL) ? 0 : 2;
+    guint i;
 
-    if (ic_entries[offset + 0] == NULL)
+    for (i = 0; i != ctx->ic_entries; i++)
     {
-      ic_entries[offset + 0] = block->real_begin;
-      ic_entries[offset + 1] = block->code_begin;
+      GumIcEntry * entry = &ic_entries[i];
+
+      if (entry->real_start == block->real_begin)
+        return;
+
+      if (entry->real_start == NULL)
+      {
+        entry->real_start = block->real_begin;
+        entry->code_start = block->code_begin;
+        return;
+      }
     }
   }
 }
@@ -2338,7 +3319,7 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
   {
     gboolean target_is_excluded = FALSE;
 
-    if ((block->ctx->sink_mask & GUM_CALL) != 0)
+    if ((gc->sink_mask & GUM_CALL) != 0)
     {
       gum_exec_block_write_call_event_code (block, &target, gc,
           GUM_CODE_INTERRUPTIBLE);
@@ -2351,19 +3332,8 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
 
     if (target.reg == ARM64_REG_INVALID)
     {
-      GArray * exclusions = block->ctx->stalker->exclusions;
-      guint i;
-
-      for (i = 0; i != exclusions->len; i++)
-      {
-        GumMemoryRange * r = &g_array_index (exclusions, GumMemoryRange, i);
-        if (GUM_MEMORY_RANGE_INCLUDES (r,
-            GUM_ADDRESS (target.absolute_address)))
-        {
-          target_is_excluded = TRUE;
-          break;
-        }
-      }
+      target_is_excluded = gum_stalker_is_excluding (block->ctx->stalker,
+          target.absolute_address);
     }
 
     if (target_is_excluded)
@@ -2487,7 +3457,7 @@ gum_exec_block_virtualize_ret_insn (GumExecBlock * block,
   cs_arm64_op * op;
   arm64_reg ret_reg;
 
-  if ((block->ctx->sink_mask & GUM_RET) != 0)
+  if ((gc->sink_mask & GUM_RET) != 0)
     gum_exec_block_write_ret_event_code (block, gc, GUM_CODE_INTERRUPTIBLE);
 
   insn = gc->instruction;
@@ -2531,10 +3501,9 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
   guint ic_push_real_address_ref = 0;
   guint ic_push_code_address_ref = 0;
   guint ic_load_real_address_ref = 0;
-  gpointer * ic_entries = NULL;
+  GumIcEntry * ic_entries = NULL;
   GumExecCtxReplaceCurrentBlockFunc entry_func;
   gconstpointer perform_stack_push = cw->code + 1;
-  gconstpointer try_second = cw->code + 2;
   gconstpointer jump_to_cached = cw->code + 3;
   gconstpointer resolve_dynamically = cw->code + 4;
   gconstpointer keep_this_blr = cw->code + 5;
@@ -2550,8 +3519,6 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
       target->reg != ARM64_REG_INVALID)
   {
     arm64_reg scratch_reg;
-    guint ic1_real_ref, ic1_code_ref;
-    guint ic2_real_ref, ic2_code_ref;
 
     if (opened_prolog == GUM_PROLOG_NONE)
     {
@@ -2589,26 +3556,8 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
         ? ARM64_REG_X16
         : ARM64_REG_X17;
 
-    ic1_real_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_sub_reg_reg_reg (cw, scratch_reg, scratch_reg,
-        target->reg);
-    gum_arm64_writer_put_cbnz_reg_label (cw, scratch_reg, try_second);
-    ic1_code_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_b_label (cw, jump_to_cached);
-
-    gum_arm64_writer_put_label (cw, try_second);
-    ic2_real_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_sub_reg_reg_reg (cw, scratch_reg, scratch_reg,
-        target->reg);
-    gum_arm64_writer_put_cbnz_reg_label (cw, scratch_reg, resolve_dynamically);
-    ic2_code_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_b_label (cw, jump_to_cached);
-
-    ic_entries = gum_arm64_writer_cur (cw);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic1_real_ref, 0);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic1_code_ref, 0);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic2_real_ref, 0);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic2_code_ref, 0);
+    ic_entries = gum_exec_block_write_inline_cache_code (block, target->reg,
+        scratch_reg, jump_to_cached, resolve_dynamically, gc);
 
     gum_arm64_writer_put_label (cw, jump_to_cached);
     ic_load_real_address_ref =
@@ -2766,7 +3715,7 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   GumArm64Writer * cw;
   guint32 * code_start;
   GumPrologType opened_prolog;
-  gpointer * ic_entries = NULL;
+  GumIcEntry * ic_entries = NULL;
 
   cw = gc->code_writer;
   code_start = cw->code;
@@ -2775,11 +3724,8 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   if (block->ctx->stalker->trust_threshold >= 0 &&
       target->reg != ARM64_REG_INVALID)
   {
-    gconstpointer try_second = cw->code + 1;
     gconstpointer resolve_dynamically = cw->code + 2;
     arm64_reg scratch_reg;
-    guint ic1_real_ref, ic1_code_ref;
-    guint ic2_real_ref, ic2_code_ref;
 
     if (opened_prolog != GUM_PROLOG_NONE)
       gum_exec_block_close_prolog (block, gc);
@@ -2792,26 +3738,8 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
         ? ARM64_REG_X16
         : ARM64_REG_X17;
 
-    ic1_real_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_sub_reg_reg_reg (cw, scratch_reg, scratch_reg,
-        target->reg);
-    gum_arm64_writer_put_cbnz_reg_label (cw, scratch_reg, try_second);
-    ic1_code_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_br_reg (cw, scratch_reg);
-
-    gum_arm64_writer_put_label (cw, try_second);
-    ic2_real_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_sub_reg_reg_reg (cw, scratch_reg, scratch_reg,
-        target->reg);
-    gum_arm64_writer_put_cbnz_reg_label (cw, scratch_reg, resolve_dynamically);
-    ic2_code_ref = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
-    gum_arm64_writer_put_br_reg (cw, scratch_reg);
-
-    ic_entries = gum_arm64_writer_cur (cw);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic1_real_ref, 0);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic1_code_ref, 0);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic2_real_ref, 0);
-    gum_arm64_writer_put_ldr_reg_value (cw, ic2_code_ref, 0);
+    ic_entries = gum_exec_block_write_inline_cache_code (block, target->reg,
+        scratch_reg, NULL, resolve_dynamically, gc);
 
     gum_arm64_writer_put_label (cw, resolve_dynamically);
     gum_arm64_writer_put_ldp_reg_reg_reg_offset (cw, ARM64_REG_X16,
@@ -2859,6 +3787,80 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   gum_exec_block_write_exec_generated_code (cw, block->ctx);
 }
 
+/*
+ * Compares target_reg against each cached real address in turn, leaving the
+ * matching translated address in scratch_reg and branching to hit_label, or
+ * straight to it if hit_label is NULL. Ends with the entries themselves, which
+ * the fast path never falls into.
+ */
+static GumIcEntry *
+gum_exec_block_write_inline_cache_code (GumExecBlock * block,
+                                        arm64_reg target_reg,
+                                        arm64_reg scratch_reg,
+                                        gconstpointer hit_label,
+                                        gconstpointer miss_label,
+                                        GumGeneratorContext * gc)
+{
+  GumArm64Writer * cw = gc->code_writer;
+  guint n = block->ctx->ic_entries;
+  guint real_refs[GUM_MAX_IC_ENTRIES];
+  guint code_refs[GUM_MAX_IC_ENTRIES];
+  GumIcEntry * ic_entries;
+  gboolean need_spill;
+  arm64_reg address_reg, value_reg;
+  guint i;
+
+  /*
+   * Only lookups are counted here, keeping the hit path as short as it was.
+   * Misses end up in the backpatching code, which counts them. X16 and X17
+   * have been saved, but when one of them holds the target we borrow X0 and
+   * X1 instead.
+   */
+  need_spill = target_reg == ARM64_REG_X16 || target_reg == ARM64_REG_X17;
+  address_reg = need_spill ? ARM64_REG_X0 : ARM64_REG_X16;
+  value_reg = need_spill ? ARM64_REG_X1 : ARM64_REG_X17;
+  if (need_spill)
+    gum_arm64_writer_put_push_reg_reg (cw, ARM64_REG_X0, ARM64_REG_X1);
+  gum_arm64_writer_put_ldr_reg_address (cw, address_reg,
+      GUM_ADDRESS (&block->ctx->ic_lookups));
+  gum_arm64_writer_put_ldr_reg_reg_offset (cw, value_reg, address_reg, 0);
+  gum_arm64_writer_put_add_reg_reg_imm (cw, value_reg, value_reg, 1);
+  gum_arm64_writer_put_str_reg_reg_offset (cw, value_reg, address_reg, 0);
+  if (need_spill)
+    gum_arm64_writer_put_pop_reg_reg (cw, ARM64_REG_X0, ARM64_REG_X1);
+
+  for (i = 0; i != n; i++)
+  {
+    gboolean is_last = i == n - 1;
+    gconstpointer try_next;
+
+    real_refs[i] = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
+    gum_arm64_writer_put_sub_reg_reg_reg (cw, scratch_reg, scratch_reg,
+        target_reg);
+
+    /* The next probe starts right after the cbnz, ldr and b/br below */
+    try_next = is_last ? miss_label : cw->code + 3;
+    gum_arm64_writer_put_cbnz_reg_label (cw, scratch_reg, try_next);
+    code_refs[i] = gum_arm64_writer_put_ldr_reg_ref (cw, scratch_reg);
+    if (hit_label != NULL)
+      gum_arm64_writer_put_b_label (cw, hit_label);
+    else
+      gum_arm64_writer_put_br_reg (cw, scratch_reg);
+
+    if (!is_last)
+      gum_arm64_writer_put_label (cw, try_next);
+  }
+
+  ic_entries = gum_arm64_writer_cur (cw);
+  for (i = 0; i != n; i++)
+  {
+    gum_arm64_writer_put_ldr_reg_value (cw, real_refs[i], 0);
+    gum_arm64_writer_put_ldr_reg_value (cw, code_refs[i], 0);
+  }
+
+  return ic_entries;
+}
+
 static void
 gum_exec_block_write_jmp_to_block_start (GumExecBlock * block,
                                          gpointer block_start)
@@ -2885,7 +3887,9 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
                                         GumGeneratorContext * gc,
                                         arm64_reg ret_reg)
 {
+  GumExecCtx * ctx = block->ctx;
   GumArm64Writer * cw = gc->code_writer;
+  gconstpointer try_helper = cw->code + 1;
 
   gum_exec_block_close_prolog (block, gc);
 
@@ -2894,8 +3898,35 @@ gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
       GUM_INDEX_PRE_ADJUST);
   if (ret_reg != ARM64_REG_X16)
     gum_arm64_writer_put_mov_reg_reg (cw, ARM64_REG_X16, ret_reg);
-  gum_arm64_writer_put_b_imm (cw,
-      GUM_ADDRESS (block->ctx->last_stack_pop_and_go));
+
+  /*
+   * Inline fast path: same check as the stack-pop-and-go helper, sparing the
+   * branch there when the top frame of our shadow stack matches.
+   */
+  gum_arm64_writer_put_push_reg_reg (cw, ARM64_REG_X0, ARM64_REG_X1);
+
+  gum_arm64_writer_put_ldr_reg_address (cw, ARM64_REG_X0,
+      GUM_ADDRESS (&ctx->current_frame));
+  gum_arm64_writer_put_ldr_reg_reg_offset (cw, ARM64_REG_X1, ARM64_REG_X0, 0);
+
+  gum_arm64_writer_put_ldr_reg_reg_offset (cw, ARM64_REG_X17, ARM64_REG_X1,
+      G_STRUCT_OFFSET (GumExecFrame, real_address));
+  gum_arm64_writer_put_sub_reg_reg_reg (cw, ARM64_REG_X17, ARM64_REG_X17,
+      ARM64_REG_X16);
+  gum_arm64_writer_put_cbnz_reg_label (cw, ARM64_REG_X17, try_helper);
+
+  gum_arm64_writer_put_ldr_reg_reg_offset (cw, ARM64_REG_X17, ARM64_REG_X1,
+      G_STRUCT_OFFSET (GumExecFrame, code_address));
+  gum_arm64_writer_put_add_reg_reg_imm (cw, ARM64_REG_X1, ARM64_REG_X1,
+      sizeof (GumExecFrame));
+  gum_arm64_writer_put_str_reg_reg_offset (cw, ARM64_REG_X1, ARM64_REG_X0, 0);
+
+  gum_arm64_writer_put_pop_reg_reg (cw, ARM64_REG_X0, ARM64_REG_X1);
+  gum_arm64_writer_put_br_reg (cw, ARM64_REG_X17);
+
+  gum_arm64_writer_put_label (cw, try_helper);
+  gum_arm64_writer_put_pop_reg_reg (cw, ARM64_REG_X0, ARM64_REG_X1);
+  gum_arm64_writer_put_b_imm (cw, GUM_ADDRESS (ctx->last_stack_pop_and_go));
 }
 
 static void
@@ -2965,6 +3996,7 @@ gum_exec_block_write_ret_event_code (GumExecBlock * block,
 static void
 gum_exec_block_write_exec_event_code (GumExecBlock * block,
                                       GumGeneratorContext * gc,
+                                      gpointer location,
                                       GumCodeContext cc)
 {
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
@@ -2972,7 +4004,7 @@ gum_exec_block_write_exec_event_code (GumExecBlock * block,
   gum_arm64_writer_put_call_address_with_arguments (gc->code_writer,
       GUM_ADDRESS (gum_exec_ctx_emit_exec_event), 2,
       GUM_ARG_ADDRESS, GUM_ADDRESS (block->ctx),
-      GUM_ARG_ADDRESS, GUM_ADDRESS (gc->instruction->begin));
+      GUM_ARG_ADDRESS, GUM_ADDRESS (location));
 
   gum_exec_block_write_unfollow_check_code (block, gc, cc);
 }
@@ -2982,15 +4014,110 @@ gum_exec_block_write_block_event_code (GumExecBlock * block,
                                        GumGeneratorContext * gc,
                                        GumCodeContext cc)
 {
+  GumArm64Writer * cw = gc->code_writer;
+  guint interval = block->ctx->stalker->block_sample_interval;
+  gconstpointer skip_event = cw->code + 1;
+  gconstpointer beach = cw->code + 2;
+
+  if (interval > 1)
+  {
+    gum_exec_block_close_prolog (block, gc);
+
+    gum_arm64_writer_put_stp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+        ARM64_REG_X17, ARM64_REG_SP, -(16 + GUM_RED_ZONE_SIZE),
+        GUM_INDEX_PRE_ADJUST);
+    gum_arm64_writer_put_ldr_reg_address (cw, ARM64_REG_X16,
+        GUM_ADDRESS (&block->sample_countdown));
+    gum_arm64_writer_put_ldr_reg_reg_offset (cw, ARM64_REG_W17,
+        ARM64_REG_X16, 0);
+    gum_arm64_writer_put_sub_reg_reg_imm (cw, ARM64_REG_W17, ARM64_REG_W17, 1);
+    gum_arm64_writer_put_str_reg_reg_offset (cw, ARM64_REG_W17,
+        ARM64_REG_X16, 0);
+    gum_arm64_writer_put_cbnz_reg_label (cw, ARM64_REG_W17, skip_event);
+
+    gum_arm64_writer_put_ldr_reg_u64 (cw, ARM64_REG_X17, interval);
+    gum_arm64_writer_put_str_reg_reg_offset (cw, ARM64_REG_W17,
+        ARM64_REG_X16, 0);
+    gum_arm64_writer_put_ldp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+        ARM64_REG_X17, ARM64_REG_SP, 16 + GUM_RED_ZONE_SIZE,
+        GUM_INDEX_POST_ADJUST);
+  }
+
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
 
-  gum_arm64_writer_put_call_address_with_arguments (gc->code_writer,
+  gum_arm64_writer_put_call_address_with_arguments (cw,
       GUM_ADDRESS (gum_exec_ctx_emit_block_event), 3,
       GUM_ARG_ADDRESS, GUM_ADDRESS (block->ctx),
       GUM_ARG_ADDRESS, GUM_ADDRESS (gc->relocator->input_start),
       GUM_ARG_ADDRESS, GUM_ADDRESS (gc->relocator->input_cur));
 
   gum_exec_block_write_unfollow_check_code (block, gc, cc);
+
+  if (interval > 1)
+  {
+    gum_exec_block_close_prolog (block, gc);
+    gum_arm64_writer_put_b_label (cw, beach);
+
+    gum_arm64_writer_put_label (cw, skip_event);
+    gum_arm64_writer_put_ldp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+        ARM64_REG_X17, ARM64_REG_SP, 16 + GUM_RED_ZONE_SIZE,
+        GUM_INDEX_POST_ADJUST);
+
+    gum_arm64_writer_put_label (cw, beach);
+  }
+}
+
+/*
+ * The AFL edge update, done inline. None of the instructions used touch NZCV,
+ * so only the scratch registers need preserving.
+ */
+static void
+gum_exec_block_write_coverage_code (GumExecBlock * block,
+                                    GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumStalker * stalker = ctx->stalker;
+  GumArm64Writer * cw = gc->code_writer;
+  const guint32 eor_x17_x17_x15 = 0xca0f0231;
+  const guint32 ldrb_w17_x16 = 0x39400211;
+  const guint32 strb_w17_x16 = 0x39000211;
+  guint8 * bitmap;
+  gsize location, id;
+
+  bitmap = stalker->coverage_bitmap;
+  if (bitmap == NULL)
+    return;
+
+  location = GPOINTER_TO_SIZE (gc->relocator->input_start);
+  id = ((location >> 4) ^ (location << 8)) & stalker->coverage_mask;
+
+  gum_arm64_writer_put_stp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+      ARM64_REG_X17, ARM64_REG_SP, -(16 + GUM_RED_ZONE_SIZE),
+      GUM_INDEX_PRE_ADJUST);
+  gum_arm64_writer_put_push_reg_reg (cw, ARM64_REG_X14, ARM64_REG_X15);
+
+  gum_arm64_writer_put_ldr_reg_address (cw, ARM64_REG_X16,
+      GUM_ADDRESS (&ctx->coverage_prev));
+  gum_arm64_writer_put_ldr_reg_reg_offset (cw, ARM64_REG_X17,
+      ARM64_REG_X16, 0);
+  gum_arm64_writer_put_ldr_reg_u64 (cw, ARM64_REG_X15, id >> 1);
+  gum_arm64_writer_put_str_reg_reg_offset (cw, ARM64_REG_X15,
+      ARM64_REG_X16, 0);
+
+  gum_arm64_writer_put_ldr_reg_u64 (cw, ARM64_REG_X15, id);
+  gum_arm64_writer_put_instruction (cw, eor_x17_x17_x15);
+  gum_arm64_writer_put_ldr_reg_address (cw, ARM64_REG_X16,
+      GUM_ADDRESS (bitmap));
+  gum_arm64_writer_put_add_reg_reg_reg (cw, ARM64_REG_X16, ARM64_REG_X16,
+      ARM64_REG_X17);
+  gum_arm64_writer_put_instruction (cw, ldrb_w17_x16);
+  gum_arm64_writer_put_add_reg_reg_imm (cw, ARM64_REG_W17, ARM64_REG_W17, 1);
+  gum_arm64_writer_put_instruction (cw, strb_w17_x16);
+
+  gum_arm64_writer_put_pop_reg_reg (cw, ARM64_REG_X14, ARM64_REG_X15);
+  gum_arm64_writer_put_ldp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+      ARM64_REG_X17, ARM64_REG_SP, 16 + GUM_RED_ZONE_SIZE,
+      GUM_INDEX_POST_ADJUST);
 }
 
 static void
@@ -3033,18 +4160,125 @@ gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
 }
 
 static void
-gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
-                                              gpointer location,
-                                              gpointer target_address,
-                                              GumCpuContext * cpu_context)
+gum_exec_block_write_callout_code (GumExecBlock * block,
+                                   GumGeneratorContext * gc,
+                                   GumCalloutEntry * entry)
+{
+  gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
+
+  gum_arm64_writer_put_call_address_with_arguments (gc->code_writer,
+      GUM_ADDRESS (gum_stalker_invoke_callout), 2,
+      GUM_ARG_REGISTER, ARM64_REG_X20,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (entry));
+
+  gum_exec_block_close_prolog (block, gc);
+}
+
+static void
+gum_exec_block_write_counter_increment_code (GumExecBlock * block,
+                                             GumGeneratorContext * gc,
+                                             GumHitCounters * counters,
+                                             guint index)
+{
+  GumArm64Writer * cw = gc->code_writer;
+  gconstpointer retry = cw->code + 1;
+  const guint32 ldxr_x17_x16 = 0xc85f7e11;
+  const guint32 stxr_w15_x17_x16 = 0xc80f7e11;
+
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_arm64_writer_put_stp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+      ARM64_REG_X17, ARM64_REG_SP, -(16 + GUM_RED_ZONE_SIZE),
+      GUM_INDEX_PRE_ADJUST);
+  gum_arm64_writer_put_push_reg_reg (cw, ARM64_REG_X14, ARM64_REG_X15);
+
+  gum_arm64_writer_put_ldr_reg_address (cw, ARM64_REG_X16,
+      GUM_ADDRESS (&counters->values[index]));
+  gum_arm64_writer_put_label (cw, retry);
+  gum_arm64_writer_put_instruction (cw, ldxr_x17_x16);
+  gum_arm64_writer_put_add_reg_reg_imm (cw, ARM64_REG_X17, ARM64_REG_X17, 1);
+  gum_arm64_writer_put_instruction (cw, stxr_w15_x17_x16);
+  gum_arm64_writer_put_cbnz_reg_label (cw, ARM64_REG_W15, retry);
+
+  gum_arm64_writer_put_pop_reg_reg (cw, ARM64_REG_X14, ARM64_REG_X15);
+  gum_arm64_writer_put_ldp_reg_reg_reg_offset (cw, ARM64_REG_X16,
+      ARM64_REG_X17, ARM64_REG_SP, 16 + GUM_RED_ZONE_SIZE,
+      GUM_INDEX_POST_ADJUST);
+}
+
+/*
+ * Between a load-exclusive and its store-exclusive, anything we add that
+ * touches memory may clear the exclusive monitor, so that the store fails
+ * every time and the guest's retry loop never completes. Instrumentation
+ * that would land there is remembered instead, and written right after the
+ * store. Callouts thus see the CPU context as it is after the store, though
+ * with the pc of the instruction they were put at. If the block has to end
+ * before the store is reached, whatever is pending is written before the
+ * continuation, or dropped if that code would never be reached anyway.
+ */
+static gboolean
+gum_exec_block_defer_code (GumExecBlock * block,
+                           GumGeneratorContext * gc,
+                           GumDeferredCodeType type,
+                           gpointer subject,
+                           guint index)
+{
+  GumDeferredCode * code;
+
+  if (gc->exclusive_load_offset == GUM_INSTRUCTION_OFFSET_NONE)
+    return FALSE;
+
+  if (gc->n_deferred_code == G_N_ELEMENTS (gc->deferred_code))
+    return FALSE;
+
+  code = &gc->deferred_code[gc->n_deferred_code++];
+  code->type = type;
+  code->subject = subject;
+  code->index = index;
+
+  return TRUE;
+}
+
+static void
+gum_exec_block_write_deferred_code (GumExecBlock * block,
+                                    GumGeneratorContext * gc)
 {
-  GumStalker * stalker = block->ctx->stalker;
-  GArray * probes;
+  guint i;
+
+  for (i = 0; i != gc->n_deferred_code; i++)
+  {
+    const GumDeferredCode * code = &gc->deferred_code[i];
+
+    switch (code->type)
+    {
+      case GUM_DEFERRED_EXEC_EVENT:
+        gum_exec_block_write_exec_event_code (block, gc, code->subject,
+            GUM_CODE_UNINTERRUPTIBLE);
+        break;
+      case GUM_DEFERRED_CALLOUT:
+        gum_exec_block_close_prolog (block, gc);
+        gum_exec_block_write_callout_code (block, gc, code->subject);
+        break;
+      case GUM_DEFERRED_COUNTER_INCREMENT:
+        gum_exec_block_write_counter_increment_code (block, gc, code->subject,
+            code->index);
+        break;
+      default:
+        g_assert_not_reached ();
+    }
+  }
+
+  gum_exec_block_close_prolog (block, gc);
 
-  gum_spinlock_acquire (&stalker->probe_lock);
+  gc->n_deferred_code = 0;
+}
 
-  probes = (GArray *)
-      g_hash_table_lookup (stalker->probe_array_by_address, target_address);
+static void
+gum_exec_block_run_call_probes (GumExecBlock * block,
+                                GArray * probes,
+                                gpointer location,
+                                GumCpuContext * cpu_context)
+{
   if (probes != NULL)
   {
     GumCallSite call_site;
@@ -3064,8 +4298,44 @@ gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
       probe->callback (&call_site, probe->user_data);
     }
   }
+}
+
+static void
+gum_exec_block_invoke_call_probes (GumExecBlock * block,
+                                   GumCallProbeSlot * slot,
+                                   gpointer location,
+                                   GumCpuContext * cpu_context)
+{
+  GumExecCtx * ctx = block->ctx;
+
+  g_atomic_int_inc (&ctx->probe_epoch);
+
+  gum_exec_block_run_call_probes (block, g_atomic_pointer_get (&slot->probes),
+      location, cpu_context);
+
+  g_atomic_int_inc (&ctx->probe_epoch);
+}
+
+static void
+gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
+                                              gpointer location,
+                                              gpointer target_address,
+                                              GumCpuContext * cpu_context)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumCallProbeSlot * slot;
+
+  g_atomic_int_inc (&ctx->probe_epoch);
+
+  slot = gum_call_probe_index_find (
+      g_atomic_pointer_get (&ctx->stalker->probe_index), target_address);
+  if (slot != NULL)
+  {
+    gum_exec_block_run_call_probes (block,
+        g_atomic_pointer_get (&slot->probes), location, cpu_context);
+  }
 
-  gum_spinlock_release (&stalker->probe_lock);
+  g_atomic_int_inc (&ctx->probe_epoch);
 }
 
 static void
@@ -3074,7 +4344,7 @@ gum_exec_block_write_call_probe_code (GumExecBlock * block,
                                       GumGeneratorContext * gc)
 {
   GumArm64Writer * cw;
-  gboolean skip_probing = FALSE;
+  GumCallProbeSlot * slot;
 
   cw = gc->code_writer;
 
@@ -3082,13 +4352,32 @@ gum_exec_block_write_call_probe_code (GumExecBlock * block,
   {
     GumStalker * stalker = block->ctx->stalker;
 
+    /*
+     * The target is known, so resolve its probes now and have the generated
+     * code go straight to them.
+     */
     gum_spinlock_acquire (&stalker->probe_lock);
-    skip_probing = g_hash_table_lookup (stalker->probe_array_by_address,
-        target->absolute_address) == NULL;
+    slot = g_hash_table_lookup (stalker->probe_slot_by_address,
+        target->absolute_address);
+    if (slot != NULL && slot->probes == NULL)
+      slot = NULL;
     gum_spinlock_release (&stalker->probe_lock);
-  }
 
-  if (!skip_probing)
+    if (slot != NULL)
+    {
+      if (gc->opened_prolog != GUM_PROLOG_NONE)
+        gum_exec_block_close_prolog (block, gc);
+      gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
+
+      gum_arm64_writer_put_call_address_with_arguments (cw,
+          GUM_ADDRESS (gum_exec_block_invoke_call_probes), 4,
+          GUM_ARG_ADDRESS, GUM_ADDRESS (block),
+          GUM_ARG_ADDRESS, GUM_ADDRESS (slot),
+          GUM_ARG_ADDRESS, GUM_ADDRESS (gc->instruction->begin),
+          GUM_ARG_REGISTER, ARM64_REG_X20);
+    }
+  }
+  else
   {
     if (gc->opened_prolog != GUM_PROLOG_NONE)
       gum_exec_block_close_prolog (block, gc);
@@ -3161,3 +4450,27 @@ gum_stalker_dump_counters (void)
 
   GUM_PRINT_ENTRYGATE_COUNTER (jmp_continuation);
 }
+
+void
+gum_stalker_get_counters (GumStalkerCounters * counters)
+{
+  counters->transitions = total_transitions;
+  counters->compilations = total_compilations;
+
+  counters->entrygate_time = total_entrygate_time;
+  counters->compile_time = total_compile_time - total_transform_time;
+  counters->transform_time = total_transform_time;
+  counters->sink_time = total_sink_time;
+}
+
+void
+gum_stalker_reset_counters (void)
+{
+  total_transitions = 0;
+  total_compilations = 0;
+
+  total_entrygate_time = 0;
+  total_compile_time = 0;
+  total_transform_time = 0;
+  total_sink_time = 0;
+}
@@ -1,15 +1,17 @@
 /*
- * Copyright (C) 2016-2017 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ * Copyright (C) 2016-2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
  *
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
 #include "gumcodesegment.h"
 
+#include "gum-init.h"
 #include "gumcloak.h"
 #include "gumdarwin.h"
 
 #include <CommonCrypto/CommonDigest.h>
+#include <dispatch/dispatch.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <mach-o/loader.h>
@@ -25,9 +27,13 @@
 #define GUM_CS_HASH_SHA1 1
 #define GUM_CS_HASH_SHA1_SIZE 20
 
-#define GUM_OFFSET_NONE -1
+#define GUM_CODE_FILE_POOL_SIZE 8
+#define GUM_CS_PAGES_PER_HASH_JOB 64
 
+typedef struct _GumCodeFile GumCodeFile;
+typedef struct _GumCodeFilePool GumCodeFilePool;
 typedef struct _GumCodeLayout GumCodeLayout;
+typedef struct _GumCsHashJob GumCsHashJob;
 typedef struct _GumCsSuperBlob GumCsSuperBlob;
 typedef struct _GumCsBlobIndex GumCsBlobIndex;
 typedef struct _GumCsDirectory GumCsDirectory;
@@ -43,6 +49,21 @@ struct _GumCodeSegment
   gint fd;
 };
 
+struct _GumCodeFile
+{
+  gint fd;
+  gchar * path;
+};
+
+struct _GumCodeFilePool
+{
+  GMutex mutex;
+  GumCodeFile files[GUM_CODE_FILE_POOL_SIZE];
+  guint num_files;
+  gchar * directory;
+  gboolean destructor_registered;
+};
+
 struct _GumCodeLayout
 {
   gsize header_file_size;
@@ -98,6 +119,14 @@ struct _GumCsRequirements
   guint32 count;
 };
 
+struct _GumCsHashJob
+{
+  const guint8 * pages;
+  gsize num_pages;
+  gsize page_size;
+  guint8 * hashes;
+};
+
 static gboolean gum_code_segment_is_realize_supported (void);
 static gboolean gum_code_segment_try_realize (GumCodeSegment * self);
 static gboolean gum_code_segment_try_map (GumCodeSegment * self,
@@ -113,10 +142,21 @@ static void gum_put_mach_headers (const gchar * dylib_path,
 static void gum_put_code_signature (gconstpointer header, gconstpointer text,
     const GumCodeLayout * layout, gpointer output);
 
-static gint gum_file_open_tmp (const gchar * tmpl, gchar ** name_used);
-static void gum_file_write_all (gint fd, gssize offset, gconstpointer data,
+static void gum_hash_pages (const guint8 * pages, gsize num_pages,
+    gsize page_size, guint8 * hashes);
+static void gum_hash_pages_chunk (void * context, size_t chunk_index);
+
+static gint gum_code_file_take (gchar ** path);
+static void gum_code_file_pool_refill (GumCodeFilePool * pool);
+static void gum_code_file_pool_deinit (void);
+
+static gint gum_file_open_tmp (const gchar * directory, const gchar * tmpl,
+    gchar ** name_used);
+static void gum_file_write_all (gint fd, goffset offset, gconstpointer data,
     gsize size);
 
+static GumCodeFilePool gum_code_file_pool;
+
 gboolean
 gum_code_segment_is_supported (void)
 {
@@ -272,12 +312,10 @@ gum_code_segment_try_realize (GumCodeSegment * self)
   gint res;
   fsignatures_t sigs;
 
-  self->fd = gum_file_open_tmp ("frida-XXXXXX.dylib", &dylib_path);
+  self->fd = gum_code_file_take (&dylib_path);
   if (self->fd == -1)
     return FALSE;
 
-  unlink (dylib_path);
-
   gum_code_segment_compute_layout (self, &layout);
 
   dylib_header = g_malloc0 (layout.header_file_size);
@@ -286,8 +324,7 @@ gum_code_segment_try_realize (GumCodeSegment * self)
   code_signature = g_malloc0 (layout.code_signature_file_size);
   gum_put_code_signature (dylib_header, self->data, &layout, code_signature);
 
-  gum_file_write_all (self->fd, GUM_OFFSET_NONE, dylib_header,
-      dylib_header_size);
+  gum_file_write_all (self->fd, 0, dylib_header, dylib_header_size);
   gum_file_write_all (self->fd, layout.text_file_offset, self->data,
       layout.text_size);
   gum_file_write_all (self->fd, layout.code_signature_file_offset,
@@ -498,7 +535,7 @@ gum_put_code_signature (gconstpointer header,
   guint8 * ident, * hashes;
   gsize cs_hashes_size, cs_page_size;
   GumCsRequirements * req;
-  gsize i;
+  gsize num_header_pages;
 
   cs_hashes_size =
       (layout->code_signature_hash_count * layout->code_signature_hash_size);
@@ -543,61 +580,203 @@ gum_put_code_signature (gconstpointer header,
   CC_SHA1 (req, 12, ident + 1);
 
   cs_page_size = layout->code_signature_page_size;
+  num_header_pages = layout->header_file_size / cs_page_size;
+
+  gum_hash_pages (header, num_header_pages, cs_page_size, hashes);
+  hashes += num_header_pages * GUM_CS_HASH_SHA1_SIZE;
+
+  gum_hash_pages (text, layout->text_file_size / cs_page_size, cs_page_size,
+      hashes);
+}
+
+/*
+ * Large segments are hashed in chunks spread across GCD's worker threads,
+ * as each page hash is independent of the others.
+ */
+static void
+gum_hash_pages (const guint8 * pages,
+                gsize num_pages,
+                gsize page_size,
+                guint8 * hashes)
+{
+  GumCsHashJob job;
+  gsize num_chunks;
+
+  job.pages = pages;
+  job.num_pages = num_pages;
+  job.page_size = page_size;
+  job.hashes = hashes;
+
+  num_chunks = (num_pages + GUM_CS_PAGES_PER_HASH_JOB - 1) /
+      GUM_CS_PAGES_PER_HASH_JOB;
+
+  if (num_chunks <= 1)
+  {
+    gum_hash_pages_chunk (&job, 0);
+    return;
+  }
+
+  dispatch_apply_f (num_chunks,
+      dispatch_get_global_queue (DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), &job,
+      gum_hash_pages_chunk);
+}
+
+static void
+gum_hash_pages_chunk (void * context,
+                      size_t chunk_index)
+{
+  const GumCsHashJob * job = context;
+  gsize start, end, i;
+
+  start = chunk_index * GUM_CS_PAGES_PER_HASH_JOB;
+  end = MIN (start + GUM_CS_PAGES_PER_HASH_JOB, job->num_pages);
+
+  for (i = start; i != end; i++)
+  {
+    CC_SHA1 (job->pages + (i * job->page_size), job->page_size,
+        job->hashes + (i * GUM_CS_HASH_SHA1_SIZE));
+  }
+}
+
+/*
+ * Creating and unlinking a temporary file is a large part of the cost of
+ * realizing a segment, so we create them in batches and hand them out one
+ * at a time. The directory that worked last time is remembered so that we
+ * don't keep retrying one that is not writable.
+ *
+ * A file cannot be reused once a signature has been attached to it, so
+ * each fd is handed out only once.
+ */
+static gint
+gum_code_file_take (gchar ** path)
+{
+  GumCodeFilePool * pool = &gum_code_file_pool;
+  gint fd = -1;
+
+  *path = NULL;
+
+  g_mutex_lock (&pool->mutex);
 
-  for (i = 0; i != layout->header_file_size / cs_page_size; i++)
+  if (!pool->destructor_registered)
   {
-    CC_SHA1 (header + (i * cs_page_size), cs_page_size, hashes);
-    hashes += 20;
+    _gum_register_destructor (gum_code_file_pool_deinit);
+    pool->destructor_registered = TRUE;
   }
 
-  for (i = 0; i != layout->text_file_size / cs_page_size; i++)
+  if (pool->num_files == 0)
+    gum_code_file_pool_refill (pool);
+
+  if (pool->num_files != 0)
   {
-    CC_SHA1 (text + (i * cs_page_size), cs_page_size, hashes);
-    hashes += 20;
+    GumCodeFile * file = &pool->files[--pool->num_files];
+
+    fd = file->fd;
+    *path = file->path;
   }
+
+  g_mutex_unlock (&pool->mutex);
+
+  return fd;
+}
+
+static void
+gum_code_file_pool_refill (GumCodeFilePool * pool)
+{
+  const gchar * candidates[2];
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (candidates); i++)
+    candidates[i] = NULL;
+
+  if (pool->directory != NULL)
+  {
+    candidates[0] = pool->directory;
+  }
+  else
+  {
+    candidates[0] = g_get_tmp_dir ();
+    candidates[1] = "/Library/Caches";
+  }
+
+  for (i = 0; i != G_N_ELEMENTS (candidates) && pool->num_files == 0; i++)
+  {
+    const gchar * directory = candidates[i];
+
+    if (directory == NULL)
+      break;
+
+    while (pool->num_files != GUM_CODE_FILE_POOL_SIZE)
+    {
+      GumCodeFile * file = &pool->files[pool->num_files];
+
+      file->fd = gum_file_open_tmp (directory, "frida-XXXXXX.dylib",
+          &file->path);
+      if (file->fd == -1)
+      {
+        g_free (file->path);
+        break;
+      }
+
+      unlink (file->path);
+
+      pool->num_files++;
+    }
+
+    if (pool->num_files != 0 && pool->directory == NULL)
+      pool->directory = g_strdup (directory);
+  }
+}
+
+static void
+gum_code_file_pool_deinit (void)
+{
+  GumCodeFilePool * pool = &gum_code_file_pool;
+
+  while (pool->num_files != 0)
+  {
+    GumCodeFile * file = &pool->files[--pool->num_files];
+
+    close (file->fd);
+    g_free (file->path);
+  }
+
+  g_free (pool->directory);
+  pool->directory = NULL;
+
+  pool->destructor_registered = FALSE;
 }
 
 static gint
-gum_file_open_tmp (const gchar * tmpl,
+gum_file_open_tmp (const gchar * directory,
+                   const gchar * tmpl,
                    gchar ** name_used)
 {
   gint suffix_length;
   gchar * path;
-  gint res;
 
   suffix_length = strlen (tmpl) - (strrchr (tmpl, 'X') + 1 - tmpl);
 
-  path = g_build_filename (g_get_tmp_dir (), tmpl, NULL);
-  res = mkstemps (path, suffix_length);
-  if (res == -1)
-  {
-    g_free (path);
-    path = g_build_filename ("/Library/Caches", tmpl, NULL);
-    res = mkstemps (path, suffix_length);
-  }
+  path = g_build_filename (directory, tmpl, NULL);
 
   *name_used = path;
 
-  return res;
+  return mkstemps (path, suffix_length);
 }
 
 static void
 gum_file_write_all (gint fd,
-                    gssize offset,
+                    goffset offset,
                     gconstpointer data,
                     gsize size)
 {
   gssize written;
 
-  if (offset != GUM_OFFSET_NONE)
-    lseek (fd, offset, SEEK_SET);
-
   written = 0;
   do
   {
     gint res;
 
-    res = write (fd, data + written, size - written);
+    res = pwrite (fd, data + written, size - written, offset + written);
     if (res == -1)
     {
       if (errno == EINTR)
@@ -70,6 +70,7 @@ gum_darwin_backtracer_generate (GumBacktracer * backtracer,
   gpointer * cur;
   guint start_index, i;
   GumInvocationStack * invocation_stack;
+  guint invocation_depth = 0;
 
   thread = pthread_self ();
   stack_top = pthread_get_stackaddr_np (thread);
@@ -124,7 +125,7 @@ gum_darwin_backtracer_generate (GumBacktracer * backtracer,
   invocation_stack = gum_interceptor_get_current_stack ();
   for (i = 0; i != return_addresses->len; i++)
   {
-    return_addresses->items[i] = gum_invocation_stack_translate (
-        invocation_stack, return_addresses->items[i]);
+    return_addresses->items[i] = gum_invocation_stack_translate_next (
+        invocation_stack, return_addresses->items[i], &invocation_depth);
   }
 }
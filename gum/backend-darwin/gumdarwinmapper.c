@@ -45,6 +45,7 @@
 
 typedef struct _GumDarwinMapping GumDarwinMapping;
 typedef struct _GumDarwinSymbolValue GumDarwinSymbolValue;
+typedef struct _GumDarwinPrefetchJob GumDarwinPrefetchJob;
 
 typedef struct _GumAccumulateFootprintContext GumAccumulateFootprintContext;
 
@@ -74,6 +75,8 @@ struct _GumDarwinMapper
   gboolean cache_file_load_attempted;
   GSList * children;
   GHashTable * mappings;
+  GHashTable * prefetched;
+  GHashTable * symbol_values;
 };
 
 enum
@@ -99,6 +102,15 @@ struct _GumDarwinSymbolValue
   GumAddress resolver;
 };
 
+struct _GumDarwinPrefetchJob
+{
+  gchar * path;
+  GumDarwinModuleResolver * resolver;
+  GMappedFile * cache_file;
+
+  GumDarwinModule * module;
+};
+
 struct _GumAccumulateFootprintContext
 {
   GumDarwinMapper * mapper;
@@ -115,9 +127,14 @@ static void gum_darwin_mapper_set_property (GObject * object, guint property_id,
 static GumDarwinMapper * gum_darwin_mapper_new_from_file_with_parent (
     GumDarwinMapper * parent, const gchar * path,
     GumDarwinModuleResolver * resolver);
+static GMappedFile * gum_darwin_mapper_ensure_cache_file (
+    GumDarwinMapper * self);
 static GMappedFile * gum_darwin_mapper_try_load_cache_file (
     GumCpuType cpu_type);
 static void gum_darwin_mapper_init_dependencies (GumDarwinMapper * self);
+static void gum_darwin_mapper_prefetch_dependencies (GumDarwinMapper * self);
+static void gum_darwin_prefetch_job_run (GumDarwinPrefetchJob * job,
+    gpointer user_data);
 static void gum_darwin_mapper_init_footprint_budget (GumDarwinMapper * self);
 
 static void gum_emit_runtime (GumDarwinMapper * self);
@@ -132,11 +149,20 @@ static gpointer gum_darwin_mapper_data_from_offset (GumDarwinMapper * self,
     guint64 offset);
 static GumDarwinMapping * gum_darwin_mapper_dependency (GumDarwinMapper * self,
     gint ordinal);
+static GumDarwinModule * gum_darwin_mapper_find_existing_module (
+    GumDarwinMapper * self, const gchar * name);
+static gchar * gum_darwin_mapper_get_dependency_path (GumDarwinMapper * self,
+    const gchar * name);
 static GumDarwinMapping * gum_darwin_mapper_resolve_dependency (
     GumDarwinMapper * self, const gchar * name);
 static gboolean gum_darwin_mapper_resolve_symbol (GumDarwinMapper * self,
     GumDarwinModule * module, const gchar * symbol,
     GumDarwinSymbolValue * value);
+static gboolean gum_darwin_mapper_resolve_export (GumDarwinMapper * self,
+    GumDarwinModule * module, const gchar * symbol,
+    GumDarwinSymbolValue * value);
+static gboolean gum_darwin_mapper_is_mapping_module (GumDarwinMapper * self,
+    GumDarwinModule * module);
 static GumDarwinMapping * gum_darwin_mapper_add_existing_mapping (
     GumDarwinMapper * self, GumDarwinModule * module);
 static GumDarwinMapping * gum_darwin_mapper_add_pending_mapping (
@@ -223,6 +249,8 @@ gum_darwin_mapper_finalize (GObject * object)
 {
   GumDarwinMapper * self = GUM_DARWIN_MAPPER (object);
 
+  g_clear_pointer (&self->symbol_values, g_hash_table_unref);
+  g_clear_pointer (&self->prefetched, g_hash_table_unref);
   g_clear_pointer (&self->mappings, g_hash_table_unref);
   g_clear_pointer (&self->cache_file, g_mapped_file_unref);
 
@@ -341,7 +369,7 @@ gum_darwin_mapper_new_from_file_with_parent (GumDarwinMapper * parent,
                                              GumDarwinModuleResolver * resolver)
 {
   GMappedFile * cache_file;
-  GumDarwinModule * module;
+  GumDarwinModule * module = NULL;
   GumDarwinMapper * mapper;
 
   if (parent == NULL)
@@ -350,21 +378,26 @@ gum_darwin_mapper_new_from_file_with_parent (GumDarwinMapper * parent,
   }
   else
   {
-    if (parent->cache_file == NULL && !parent->cache_file_load_attempted)
+    cache_file = gum_darwin_mapper_ensure_cache_file (parent);
+    if (cache_file != NULL)
+      g_mapped_file_ref (cache_file);
+
+    if (parent->prefetched != NULL)
     {
-      parent->cache_file =
-          gum_darwin_mapper_try_load_cache_file (resolver->cpu_type);
-      parent->cache_file_load_attempted = TRUE;
+      module = g_hash_table_lookup (parent->prefetched, path);
+      if (module != NULL)
+      {
+        g_object_ref (module);
+        g_hash_table_remove (parent->prefetched, path);
+      }
     }
-
-    if (parent->cache_file != NULL)
-      cache_file = g_mapped_file_ref (parent->cache_file);
-    else
-      cache_file = NULL;
   }
 
-  module = gum_darwin_module_new_from_file (path, resolver->task,
-      resolver->cpu_type, resolver->page_size, cache_file, NULL);
+  if (module == NULL)
+  {
+    module = gum_darwin_module_new_from_file (path, resolver->task,
+        resolver->cpu_type, resolver->page_size, cache_file, NULL);
+  }
 
   mapper = g_object_new (GUM_DARWIN_TYPE_MAPPER,
       "name", path,
@@ -386,6 +419,19 @@ gum_darwin_mapper_new_from_file_with_parent (GumDarwinMapper * parent,
   return mapper;
 }
 
+static GMappedFile *
+gum_darwin_mapper_ensure_cache_file (GumDarwinMapper * self)
+{
+  if (self->cache_file == NULL && !self->cache_file_load_attempted)
+  {
+    self->cache_file =
+        gum_darwin_mapper_try_load_cache_file (self->resolver->cpu_type);
+    self->cache_file_load_attempted = TRUE;
+  }
+
+  return self->cache_file;
+}
+
 static GMappedFile *
 gum_darwin_mapper_try_load_cache_file (GumCpuType cpu_type)
 {
@@ -455,6 +501,8 @@ gum_darwin_mapper_init_dependencies (GumDarwinMapper * self)
     gum_darwin_mapper_add_pending_mapping (self, module->name, self);
   }
 
+  gum_darwin_mapper_prefetch_dependencies (self);
+
   dependencies = module->dependencies;
   for (i = 0; i != dependencies->len; i++)
   {
@@ -466,6 +514,114 @@ gum_darwin_mapper_init_dependencies (GumDarwinMapper * self)
   }
 }
 
+/*
+ * Dependencies that are not already loaded get parsed from disk one at a
+ * time as we recurse into them, which is slow for deep dependency graphs.
+ * So before we recurse we parse all of a module's missing dependencies in
+ * parallel. The resulting modules are then picked up as the child mappers
+ * are created.
+ */
+static void
+gum_darwin_mapper_prefetch_dependencies (GumDarwinMapper * self)
+{
+  GumDarwinMapper * root;
+  GPtrArray * dependencies, * jobs;
+  GMappedFile * cache_file;
+  GThreadPool * pool;
+  guint i;
+
+  root = self;
+  while (root->parent != NULL)
+    root = root->parent;
+
+  dependencies = self->module->dependencies;
+  jobs = g_ptr_array_sized_new (dependencies->len);
+
+  for (i = 0; i != dependencies->len; i++)
+  {
+    const gchar * name = g_ptr_array_index (dependencies, i);
+    gchar * path;
+    GumDarwinPrefetchJob * job;
+
+    if (g_hash_table_contains (root->mappings, name) ||
+        gum_darwin_mapper_find_existing_module (root, name) != NULL)
+    {
+      continue;
+    }
+
+    path = gum_darwin_mapper_get_dependency_path (root, name);
+    if (g_hash_table_contains (root->mappings, path) ||
+        (root->prefetched != NULL &&
+        g_hash_table_contains (root->prefetched, path)))
+    {
+      g_free (path);
+      continue;
+    }
+
+    job = g_slice_new (GumDarwinPrefetchJob);
+    job->path = path;
+    job->resolver = root->resolver;
+    job->cache_file = NULL;
+    job->module = NULL;
+
+    g_ptr_array_add (jobs, job);
+  }
+
+  if (jobs->len < 2)
+    goto beach;
+
+  if (root->prefetched == NULL)
+  {
+    root->prefetched = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+        g_object_unref);
+  }
+
+  cache_file = gum_darwin_mapper_ensure_cache_file (root);
+
+  pool = g_thread_pool_new ((GFunc) gum_darwin_prefetch_job_run, NULL,
+      g_get_num_processors (), FALSE, NULL);
+  for (i = 0; i != jobs->len; i++)
+  {
+    GumDarwinPrefetchJob * job = g_ptr_array_index (jobs, i);
+
+    job->cache_file = cache_file;
+
+    g_thread_pool_push (pool, job, NULL);
+  }
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i != jobs->len; i++)
+  {
+    GumDarwinPrefetchJob * job = g_ptr_array_index (jobs, i);
+
+    if (job->module != NULL)
+    {
+      g_hash_table_insert (root->prefetched, job->path, job->module);
+      job->path = NULL;
+    }
+  }
+
+beach:
+  for (i = 0; i != jobs->len; i++)
+  {
+    GumDarwinPrefetchJob * job = g_ptr_array_index (jobs, i);
+
+    g_free (job->path);
+    g_slice_free (GumDarwinPrefetchJob, job);
+  }
+  g_ptr_array_unref (jobs);
+}
+
+static void
+gum_darwin_prefetch_job_run (GumDarwinPrefetchJob * job,
+                             gpointer user_data)
+{
+  GumDarwinModuleResolver * resolver = job->resolver;
+
+  job->module = gum_darwin_module_new_from_file (job->path, resolver->task,
+      resolver->cpu_type, resolver->page_size, job->cache_file, NULL);
+}
+
 static void
 gum_darwin_mapper_init_footprint_budget (GumDarwinMapper * self)
 {
@@ -1339,59 +1495,82 @@ gum_darwin_mapper_dependency (GumDarwinMapper * self,
   return result;
 }
 
-static GumDarwinMapping *
-gum_darwin_mapper_resolve_dependency (GumDarwinMapper * self,
-                                      const gchar * name)
+static GumDarwinModule *
+gum_darwin_mapper_find_existing_module (GumDarwinMapper * self,
+                                        const gchar * name)
 {
   GumDarwinModuleResolver * resolver = self->resolver;
-  GumDarwinMapping * mapping;
-
-  if (self->parent != NULL)
-    return gum_darwin_mapper_resolve_dependency (self->parent, name);
+  GumDarwinModule * module = NULL;
+  gchar * candidate;
 
-  mapping = g_hash_table_lookup (self->mappings, name);
-
-  if (mapping == NULL)
+  if (resolver->sysroot != NULL)
   {
-    GumDarwinModule * module = NULL;
-    gchar * candidate;
+    candidate = g_strconcat (resolver->sysroot, "/", name, NULL);
+    module = gum_darwin_module_resolver_find_module (resolver, candidate);
+    g_free (candidate);
 
-    if (resolver->sysroot != NULL)
+    if (module == NULL && strcmp (name, "/usr/lib/libSystem.B.dylib") == 0)
     {
-      candidate = g_strconcat (resolver->sysroot, "/", name, NULL);
+      candidate = g_strconcat (resolver->sysroot, "/usr/lib/libSystem.dylib",
+          NULL);
       module = gum_darwin_module_resolver_find_module (resolver, candidate);
       g_free (candidate);
-
-      if (module == NULL && strcmp (name, "/usr/lib/libSystem.B.dylib") == 0)
-      {
-        candidate = g_strconcat (resolver->sysroot, "/usr/lib/libSystem.dylib",
-            NULL);
-        module = gum_darwin_module_resolver_find_module (resolver, candidate);
-        g_free (candidate);
-      }
-
-      if (module == NULL && g_str_has_prefix (name, "/usr/lib/system/"))
-      {
-        candidate = g_strconcat (resolver->sysroot,
-            "/usr/lib/system/introspection/", name + 16, NULL);
-        module = gum_darwin_module_resolver_find_module (resolver, candidate);
-        g_free (candidate);
-      }
-    }
-
-    if (module == NULL)
-    {
-      module = gum_darwin_module_resolver_find_module (resolver, name);
     }
 
     if (module == NULL && g_str_has_prefix (name, "/usr/lib/system/"))
     {
-      candidate = g_strconcat ("/usr/lib/system/introspection/", name + 16,
-          NULL);
+      candidate = g_strconcat (resolver->sysroot,
+          "/usr/lib/system/introspection/", name + 16, NULL);
       module = gum_darwin_module_resolver_find_module (resolver, candidate);
       g_free (candidate);
     }
+  }
+
+  if (module == NULL)
+  {
+    module = gum_darwin_module_resolver_find_module (resolver, name);
+  }
+
+  if (module == NULL && g_str_has_prefix (name, "/usr/lib/system/"))
+  {
+    candidate = g_strconcat ("/usr/lib/system/introspection/", name + 16,
+        NULL);
+    module = gum_darwin_module_resolver_find_module (resolver, candidate);
+    g_free (candidate);
+  }
+
+  return module;
+}
+
+static gchar *
+gum_darwin_mapper_get_dependency_path (GumDarwinMapper * self,
+                                       const gchar * name)
+{
+  GumDarwinModuleResolver * resolver = self->resolver;
+
+  if (resolver->sysroot != NULL)
+    return g_strconcat (resolver->sysroot, name, NULL);
+  else
+    return g_strdup (name);
+}
+
+static GumDarwinMapping *
+gum_darwin_mapper_resolve_dependency (GumDarwinMapper * self,
+                                      const gchar * name)
+{
+  GumDarwinModuleResolver * resolver = self->resolver;
+  GumDarwinMapping * mapping;
 
+  if (self->parent != NULL)
+    return gum_darwin_mapper_resolve_dependency (self->parent, name);
+
+  mapping = g_hash_table_lookup (self->mappings, name);
+
+  if (mapping == NULL)
+  {
+    GumDarwinModule * module;
+
+    module = gum_darwin_mapper_find_existing_module (self, name);
     if (module != NULL)
     {
       mapping = gum_darwin_mapper_add_existing_mapping (self, module);
@@ -1403,10 +1582,7 @@ gum_darwin_mapper_resolve_dependency (GumDarwinMapper * self,
     gchar * full_name;
     GumDarwinMapper * mapper;
 
-    if (resolver->sysroot != NULL)
-      full_name = g_strconcat (resolver->sysroot, name, NULL);
-    else
-      full_name = g_strdup (name);
+    full_name = gum_darwin_mapper_get_dependency_path (self, name);
 
     mapper = gum_darwin_mapper_new_from_file_with_parent (self, full_name,
         self->resolver);
@@ -1429,8 +1605,6 @@ gum_darwin_mapper_resolve_symbol (GumDarwinMapper * self,
                                   const gchar * name,
                                   GumDarwinSymbolValue * value)
 {
-  GumDarwinExportDetails details;
-
   if (self->parent != NULL)
   {
     return gum_darwin_mapper_resolve_symbol (self->parent, module, name, value);
@@ -1464,6 +1638,59 @@ gum_darwin_mapper_resolve_symbol (GumDarwinMapper * self,
     return TRUE;
   }
 
+  /*
+   * Values exported by modules that are already loaded never change, so we
+   * remember them for the whole mapper tree. Every bind gets resolved a few
+   * times: when sizing the runtime, when binding and when emitting the
+   * runtime, and the same targets tend to be bound by many dependencies.
+   * Modules that we are mapping ourselves move when mapped, so those are
+   * always resolved afresh.
+   */
+  if (!gum_darwin_mapper_is_mapping_module (self, module))
+  {
+    GHashTable * values;
+    GumDarwinSymbolValue * cached_value;
+
+    if (self->symbol_values == NULL)
+    {
+      self->symbol_values = g_hash_table_new_full (NULL, NULL, NULL,
+          (GDestroyNotify) g_hash_table_unref);
+    }
+
+    values = g_hash_table_lookup (self->symbol_values, module);
+    if (values == NULL)
+    {
+      values = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+      g_hash_table_insert (self->symbol_values, module, values);
+    }
+
+    cached_value = g_hash_table_lookup (values, name);
+    if (cached_value != NULL)
+    {
+      *value = *cached_value;
+      return TRUE;
+    }
+
+    if (!gum_darwin_mapper_resolve_export (self, module, name, value))
+      return FALSE;
+
+    g_hash_table_insert (values, g_strdup (name),
+        g_memdup (value, sizeof (GumDarwinSymbolValue)));
+
+    return TRUE;
+  }
+
+  return gum_darwin_mapper_resolve_export (self, module, name, value);
+}
+
+static gboolean
+gum_darwin_mapper_resolve_export (GumDarwinMapper * self,
+                                  GumDarwinModule * module,
+                                  const gchar * name,
+                                  GumDarwinSymbolValue * value)
+{
+  GumDarwinExportDetails details;
+
   if (!gum_darwin_module_resolve_export (module, name, &details))
   {
     if (gum_darwin_module_get_lacks_exports_for_reexports (module))
@@ -1526,6 +1753,26 @@ gum_darwin_mapper_resolve_symbol (GumDarwinMapper * self,
   }
 }
 
+static gboolean
+gum_darwin_mapper_is_mapping_module (GumDarwinMapper * self,
+                                     GumDarwinModule * module)
+{
+  GSList * cur;
+
+  if (module == self->module)
+    return TRUE;
+
+  for (cur = self->children; cur != NULL; cur = cur->next)
+  {
+    GumDarwinMapper * child = cur->data;
+
+    if (module == child->module)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
 static GumDarwinMapping *
 gum_darwin_mapper_add_existing_mapping (GumDarwinMapper * self,
                                         GumDarwinModule * module)
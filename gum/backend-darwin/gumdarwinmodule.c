@@ -6,6 +6,7 @@
 
 #include "gumdarwinmodule.h"
 
+#include "gum-init.h"
 #include "gumdarwin.h"
 #include "gumleb.h"
 #include "gumkernel.h"
@@ -15,6 +16,7 @@
 #include <mach-o/loader.h>
 
 #define MAX_METADATA_SIZE (64 * 1024)
+#define GUM_EXPORT_INDEX_THRESHOLD 32
 #define GUM_MEM_READ(task, addr, len, out_size) \
     (self->is_kernel ? gum_kernel_read (addr, len, out_size) \
       : gum_darwin_read (task, addr, len, out_size))
@@ -27,6 +29,7 @@ typedef struct _GumEmitInitPointersContext GumEmitInitPointersContext;
 typedef struct _GumEmitTermPointersContext GumEmitTermPointersContext;
 
 typedef struct _GumExportsTrieForeachContext GumExportsTrieForeachContext;
+typedef struct _GumBuildExportIndexContext GumBuildExportIndexContext;
 
 typedef struct _GumDyldCacheHeader GumDyldCacheHeader;
 typedef struct _GumDyldCacheMappingInfo GumDyldCacheMappingInfo;
@@ -91,6 +94,12 @@ struct _GumExportsTrieForeachContext
   const guint8 * exports_end;
 };
 
+struct _GumBuildExportIndexContext
+{
+  GHashTable * index;
+  GStringChunk * names;
+};
+
 struct _GumDyldCacheHeader
 {
   gchar magic[16];
@@ -160,6 +169,11 @@ static gboolean gum_add_text_range_if_text_section (
     const GumDarwinSectionDetails * details, gpointer user_data);
 static gboolean gum_section_flags_indicate_text_section (uint32_t flags);
 
+static void gum_darwin_module_cache_deinit (void);
+static GHashTable * gum_darwin_module_get_export_index (GumDarwinModule * self);
+static gboolean gum_add_export_to_index (
+    const GumDarwinExportDetails * details, gpointer user_data);
+
 static gboolean gum_exports_trie_find (const guint8 * exports,
     const guint8 * exports_end, const gchar * name,
     GumDarwinExportDetails * details);
@@ -189,6 +203,11 @@ G_DEFINE_TYPE_EXTENDED (GumDarwinModule,
                         G_IMPLEMENT_INTERFACE (G_TYPE_INITABLE,
                             gum_darwin_module_initable_iface_init))
 
+G_LOCK_DEFINE_STATIC (gum_darwin_module_cache);
+static GHashTable * gum_darwin_module_cache = NULL;
+
+G_LOCK_DEFINE_STATIC (gum_export_index);
+
 static void
 gum_darwin_module_class_init (GumDarwinModuleClass * klass)
 {
@@ -345,6 +364,12 @@ gum_darwin_module_finalize (GObject * object)
   g_ptr_array_unref (self->dependencies);
   g_ptr_array_unref (self->reexports);
 
+  if (self->export_index != NULL)
+  {
+    g_hash_table_unref (self->export_index);
+    g_string_chunk_free (self->export_names);
+  }
+
   g_free (self->rebases_malloc_data);
   g_free (self->binds_malloc_data);
   g_free (self->lazy_binds_malloc_data);
@@ -502,6 +527,79 @@ gum_darwin_module_new_from_memory (const gchar * name,
       NULL);
 }
 
+/*
+ * Like gum_darwin_module_new_from_memory(), but modules in our own process are
+ * parsed once and shared, keyed by the address of their Mach-O header. The
+ * dyld shared cache means the same few hundred images get opened by every
+ * resolver, so this saves reading and parsing each of them over and over.
+ * Modules in other tasks are not cached.
+ */
+GumDarwinModule *
+gum_darwin_module_obtain_from_memory (const gchar * name,
+                                      mach_port_t task,
+                                      GumCpuType cpu_type,
+                                      guint page_size,
+                                      GumAddress base_address,
+                                      GError ** error)
+{
+  GumDarwinModule * module;
+
+  if (task != mach_task_self ())
+  {
+    return gum_darwin_module_new_from_memory (name, task, cpu_type, page_size,
+        base_address, error);
+  }
+
+  G_LOCK (gum_darwin_module_cache);
+
+  if (gum_darwin_module_cache == NULL)
+  {
+    gum_darwin_module_cache = g_hash_table_new_full (NULL, NULL, NULL,
+        g_object_unref);
+    _gum_register_destructor (gum_darwin_module_cache_deinit);
+  }
+
+  module = g_hash_table_lookup (gum_darwin_module_cache,
+      GSIZE_TO_POINTER (base_address));
+  if (module != NULL && module->cpu_type == cpu_type &&
+      strcmp (module->name, name) == 0)
+  {
+    g_object_ref (module);
+    goto beach;
+  }
+
+  module = gum_darwin_module_new_from_memory (name, task, cpu_type, page_size,
+      base_address, error);
+  if (module == NULL)
+    goto beach;
+
+  /*
+   * Load the image up front so that the instances we share never have
+   * any lazy state left to initialize, other than the export index.
+   */
+  if (!gum_darwin_module_ensure_image_loaded (module, error))
+  {
+    g_object_unref (module);
+    module = NULL;
+    goto beach;
+  }
+
+  g_hash_table_insert (gum_darwin_module_cache,
+      GSIZE_TO_POINTER (base_address), g_object_ref (module));
+
+beach:
+  G_UNLOCK (gum_darwin_module_cache);
+
+  return module;
+}
+
+static void
+gum_darwin_module_cache_deinit (void)
+{
+  g_hash_table_unref (gum_darwin_module_cache);
+  gum_darwin_module_cache = NULL;
+}
+
 gboolean
 gum_darwin_module_resolve_export (GumDarwinModule * self,
                                   const gchar * name,
@@ -512,8 +610,23 @@ gum_darwin_module_resolve_export (GumDarwinModule * self,
 
   if (self->exports != NULL)
   {
-    return gum_exports_trie_find (self->exports, self->exports_end, name,
-        details);
+    GHashTable * index;
+    const GumDarwinExportDetails * d;
+
+    index = gum_darwin_module_get_export_index (self);
+    if (index == NULL)
+    {
+      return gum_exports_trie_find (self->exports, self->exports_end, name,
+          details);
+    }
+
+    d = g_hash_table_lookup (index, name);
+    if (d == NULL)
+      return FALSE;
+
+    *details = *d;
+
+    return TRUE;
   }
   else
   {
@@ -531,6 +644,66 @@ gum_darwin_module_resolve_export (GumDarwinModule * self,
   }
 }
 
+/*
+ * Each trie lookup walks the edges from the root, which adds up for modules
+ * like libSystem that are asked about all the time. Once a module has been
+ * queried often enough we flatten its trie into a hash table instead.
+ */
+static GHashTable *
+gum_darwin_module_get_export_index (GumDarwinModule * self)
+{
+  GHashTable * index;
+  GumBuildExportIndexContext ctx;
+
+  index = g_atomic_pointer_get (&self->export_index);
+  if (index != NULL)
+    return index;
+
+  if (g_atomic_int_add (&self->export_lookups, 1) < GUM_EXPORT_INDEX_THRESHOLD)
+    return NULL;
+
+  G_LOCK (gum_export_index);
+
+  index = self->export_index;
+  if (index == NULL)
+  {
+    ctx.index = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+    ctx.names = g_string_chunk_new (4096);
+
+    gum_exports_trie_foreach (self->exports, self->exports_end,
+        gum_add_export_to_index, &ctx);
+
+    self->export_names = ctx.names;
+
+    index = ctx.index;
+    g_atomic_pointer_set (&self->export_index, index);
+  }
+
+  G_UNLOCK (gum_export_index);
+
+  return index;
+}
+
+static gboolean
+gum_add_export_to_index (const GumDarwinExportDetails * details,
+                         gpointer user_data)
+{
+  GumBuildExportIndexContext * ctx = user_data;
+  GumDarwinExportDetails * d;
+
+  d = g_memdup (details, sizeof (GumDarwinExportDetails));
+  d->name = g_string_chunk_insert (ctx->names, details->name);
+  if ((details->flags & EXPORT_SYMBOL_FLAGS_REEXPORT) != 0 &&
+      details->reexport_symbol == details->name)
+  {
+    d->reexport_symbol = d->name;
+  }
+
+  g_hash_table_insert (ctx->index, (gpointer) d->name, d);
+
+  return TRUE;
+}
+
 GumAddress
 gum_darwin_module_resolve_symbol_address (GumDarwinModule * self,
                                           const gchar * name)
@@ -91,6 +91,9 @@ struct _GumDarwinModule
   const guint8 * exports;
   const guint8 * exports_end;
   gpointer exports_malloc_data;
+  volatile gint export_lookups;
+  GHashTable * export_index;
+  GStringChunk * export_names;
 
   GPtrArray * dependencies;
   GPtrArray * reexports;
@@ -211,6 +214,9 @@ GUM_API GumDarwinModule * gum_darwin_module_new_from_blob (GBytes * blob,
 GUM_API GumDarwinModule * gum_darwin_module_new_from_memory (const gchar * name,
     mach_port_t task, GumCpuType cpu_type, guint page_size,
     GumAddress base_address, GError ** error);
+GUM_API GumDarwinModule * gum_darwin_module_obtain_from_memory (
+    const gchar * name, mach_port_t task, GumCpuType cpu_type,
+    guint page_size, GumAddress base_address, GError ** error);
 
 GUM_API gboolean gum_darwin_module_resolve_export (GumDarwinModule * self,
     const gchar * symbol, GumDarwinExportDetails * details);
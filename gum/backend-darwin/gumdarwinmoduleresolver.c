@@ -316,8 +316,11 @@ gum_store_module (const GumModuleDetails * details,
     ctx->sysroot = g_strndup (details->path, ctx->sysroot_length);
   }
 
-  module = gum_darwin_module_new_from_memory (details->path, self->task,
+  module = gum_darwin_module_obtain_from_memory (details->path, self->task,
       self->cpu_type, self->page_size, details->range->base_address, NULL);
+  if (module == NULL)
+    goto beach;
+
   g_hash_table_insert (self->modules, g_strdup (details->name),
       module);
   g_hash_table_insert (self->modules, g_strdup (details->path),
@@ -328,6 +331,7 @@ gum_store_module (const GumModuleDetails * details,
         g_strdup (details->path + ctx->sysroot_length), g_object_ref (module));
   }
 
+beach:
   ctx->index++;
 
   return TRUE;
@@ -16,6 +16,9 @@
 
 #define GUM_KERNEL_SLIDE_OFFSET 0x1000000
 #define GUM_KERNEL_SLIDE_SIZE 0x200000
+#define GUM_KERNEL_FAILSAFE_PAGE_SIZE 2048
+#define GUM_KERNEL_MAX_READ_SIZE (1024 * 1024)
+#define GUM_KERNEL_MIN_REMAP_SIZE (4 * 1024 * 1024)
 
 typedef struct _GumKernelScanContext GumKernelScanContext;
 typedef struct _GumKernelEnumerateModuleRangesContext
@@ -78,6 +81,13 @@ struct _GumKernelKextByNameContext
 typedef gboolean (* GumFoundKextFunc) (GumDarwinModule * module,
     gpointer user_data);
 
+static gsize gum_kernel_read_into (mach_port_t task, GumAddress address,
+    guint8 * buffer, gsize len);
+static gsize gum_kernel_read_pages_into (mach_port_t task,
+    GumAddress address, guint8 * buffer, gsize len);
+static gboolean gum_kernel_scan_remapped (mach_port_t task,
+    const GumMemoryRange * range, const GumMatchPattern * pattern,
+    GumKernelScanContext * ctx);
 static gboolean gum_kernel_emit_match (GumAddress address, gsize size,
     GumKernelScanContext * ctx);
 static void gum_kernel_enumerate_kexts (GumFoundKextFunc func,
@@ -202,35 +212,94 @@ gum_kernel_read (GumAddress address,
                  gsize * n_bytes_read)
 {
   mach_port_t task;
-  guint page_size;
   guint8 * result;
   gsize offset;
-  kern_return_t kr;
 
   task = gum_kernel_get_task ();
   if (task == MACH_PORT_NULL)
     return NULL;
 
-  /* Failsafe size, smaller than the kernel page size. */
-  page_size = 2048;
   result = g_malloc (len);
+  offset = gum_kernel_read_into (task, address, result, len);
+
+  if (offset == 0)
+  {
+    g_free (result);
+    result = NULL;
+  }
+
+  if (n_bytes_read != NULL)
+    *n_bytes_read = offset;
+
+  return result;
+}
+
+/*
+ * Reads as much of the range as possible, stopping at the first hole.
+ * Returns the number of bytes read.
+ */
+static gsize
+gum_kernel_read_into (mach_port_t task,
+                      GumAddress address,
+                      guint8 * buffer,
+                      gsize len)
+{
+  gsize offset = 0;
+
+  while (offset != len)
+  {
+    gsize chunk_size, n;
+    mach_vm_size_t n_bytes_read;
+    kern_return_t kr;
+
+    chunk_size = MIN (len - offset, GUM_KERNEL_MAX_READ_SIZE);
+
+    /* mach_vm_read corrupts memory on iOS */
+    kr = mach_vm_read_overwrite (task, address + offset, chunk_size,
+        (vm_address_t) (buffer + offset), &n_bytes_read);
+    if (kr == KERN_SUCCESS && n_bytes_read == chunk_size)
+    {
+      offset += chunk_size;
+      continue;
+    }
+
+    /* Somewhere in this chunk there is a hole, find out where. */
+    n = gum_kernel_read_pages_into (task, address + offset, buffer + offset,
+        chunk_size);
+    offset += n;
+    if (n != chunk_size)
+      break;
+  }
+
+  return offset;
+}
+
+static gsize
+gum_kernel_read_pages_into (mach_port_t task,
+                            GumAddress address,
+                            guint8 * buffer,
+                            gsize len)
+{
+  gsize page_size, offset;
+
+  /* Failsafe size, smaller than the kernel page size. */
+  page_size = GUM_KERNEL_FAILSAFE_PAGE_SIZE;
   offset = 0;
 
   while (offset != len)
   {
     GumAddress chunk_address, page_address;
     gsize chunk_size, page_offset;
+    mach_vm_size_t n_bytes_read;
+    kern_return_t kr;
 
     chunk_address = address + offset;
     page_address = chunk_address & ~GUM_ADDRESS (page_size - 1);
     page_offset = chunk_address - page_address;
     chunk_size = MIN (len - offset, page_size - page_offset);
 
-    mach_vm_size_t n_bytes_read;
-
-    /* mach_vm_read corrupts memory on iOS */
     kr = mach_vm_read_overwrite (task, chunk_address, chunk_size,
-        (vm_address_t) (result + offset), &n_bytes_read);
+        (vm_address_t) (buffer + offset), &n_bytes_read);
     if (kr != KERN_SUCCESS)
       break;
     g_assert_cmpuint (n_bytes_read, ==, chunk_size);
@@ -238,16 +307,7 @@ gum_kernel_read (GumAddress address,
     offset += chunk_size;
   }
 
-  if (offset == 0)
-  {
-    g_free (result);
-    result = NULL;
-  }
-
-  if (n_bytes_read != NULL)
-    *n_bytes_read = offset;
-
-  return result;
+  return offset;
 }
 
 gboolean
@@ -285,30 +345,42 @@ gum_kernel_scan (const GumMemoryRange * range,
                  gpointer user_data)
 {
   GumKernelScanContext ctx;
+  mach_port_t task;
   GumAddress cursor, end;
   gsize size, max_chunk_size;
+  guint8 * haystack;
+
+  task = gum_kernel_get_task ();
+  if (task == MACH_PORT_NULL)
+    return;
 
   ctx.func = func;
   ctx.user_data = user_data;
+  ctx.carry_on = TRUE;
+
+  if (range->size >= GUM_KERNEL_MIN_REMAP_SIZE &&
+      gum_kernel_scan_remapped (task, range, pattern, &ctx))
+    return;
 
   cursor = range->base_address;
   size = range->size;
-  max_chunk_size = MAX (pattern->size * 2, 2048 * 512);
+  max_chunk_size = MAX (pattern->size * 2, GUM_KERNEL_MAX_READ_SIZE);
   end = cursor + size - pattern->size;
 
+  haystack = g_malloc (MIN (size, max_chunk_size));
+
   while (cursor <= end)
   {
-    gsize chunk_size;
-    guint8 * haystack;
+    gsize chunk_size, n;
     GumMemoryRange subrange;
 
     chunk_size = MIN (size, max_chunk_size);
-    haystack = gum_kernel_read (cursor, chunk_size, NULL);
-    if (haystack == NULL)
-      return;
+    n = gum_kernel_read_into (task, cursor, haystack, chunk_size);
+    if (n < pattern->size)
+      break;
 
     subrange.base_address = GUM_ADDRESS (haystack);
-    subrange.size = chunk_size;
+    subrange.size = n;
 
     ctx.cursor_userland = GUM_ADDRESS (haystack);
     ctx.cursor_kernel = GUM_ADDRESS (cursor);
@@ -316,14 +388,69 @@ gum_kernel_scan (const GumMemoryRange * range,
     gum_memory_scan (&subrange, pattern,
         (GumMemoryScanMatchFunc) gum_kernel_emit_match, &ctx);
 
-    g_free (haystack);
-
-    if (!ctx.carry_on)
-      return;
+    if (!ctx.carry_on || n != chunk_size)
+      break;
 
     cursor += chunk_size - pattern->size + 1;
     size -= chunk_size - pattern->size + 1;
   }
+
+  g_free (haystack);
+}
+
+/*
+ * Maps the range into our own address space so that it can be scanned in
+ * one go without copying. Fails if the range spans a hole, in which case
+ * the caller falls back to reading it piecewise.
+ */
+static gboolean
+gum_kernel_scan_remapped (mach_port_t task,
+                          const GumMemoryRange * range,
+                          const GumMatchPattern * pattern,
+                          GumKernelScanContext * ctx)
+{
+  mach_port_t self;
+  gsize page_size;
+  GumAddress aligned_address;
+  mach_vm_size_t aligned_size;
+  mach_vm_address_t local_address;
+  vm_prot_t cur_protection, max_protection;
+  GumMemoryRange subrange;
+  kern_return_t kr;
+
+  self = mach_task_self ();
+
+  page_size = vm_kernel_page_size;
+  aligned_address = range->base_address & ~GUM_ADDRESS (page_size - 1);
+  aligned_size = (range->base_address + range->size - aligned_address +
+      page_size - 1) & ~(mach_vm_size_t) (page_size - 1);
+
+  local_address = 0;
+  kr = mach_vm_remap (self, &local_address, aligned_size, 0,
+      VM_FLAGS_ANYWHERE, task, aligned_address, FALSE, &cur_protection,
+      &max_protection, VM_INHERIT_NONE);
+  if (kr != KERN_SUCCESS)
+    return FALSE;
+
+  if ((cur_protection & VM_PROT_READ) == 0)
+  {
+    mach_vm_deallocate (self, local_address, aligned_size);
+    return FALSE;
+  }
+
+  subrange.base_address =
+      local_address + (range->base_address - aligned_address);
+  subrange.size = range->size;
+
+  ctx->cursor_userland = subrange.base_address;
+  ctx->cursor_kernel = range->base_address;
+
+  gum_memory_scan (&subrange, pattern,
+      (GumMemoryScanMatchFunc) gum_kernel_emit_match, ctx);
+
+  mach_vm_deallocate (self, local_address, aligned_size);
+
+  return TRUE;
 }
 
 static gboolean
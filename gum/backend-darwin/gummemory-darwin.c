@@ -424,6 +424,13 @@ gum_try_mprotect (gpointer address,
   return kr == KERN_SUCCESS;
 }
 
+gboolean
+gum_memory_advise_huge_pages (gpointer base,
+                              gsize size)
+{
+  return FALSE;
+}
+
 void
 gum_clear_cache (gpointer address,
                  gsize size)
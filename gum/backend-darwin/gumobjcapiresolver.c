@@ -6,12 +6,24 @@
 
 #include "gumobjcapiresolver.h"
 
+#include "gum-init.h"
+
 #include <dlfcn.h>
 #include <gio/gio.h>
 #include <objc/runtime.h>
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * There is one resolver per process, kept until gum_deinit(), so the class
+ * snapshot and method index built for one query are there for the next one
+ * even when each query comes with a resolver of its own. Queries are
+ * serialized, and one made from inside another's callback leaves the
+ * snapshot as it is, since the outer query may still be walking it.
+ */
 
 typedef struct _GumObjcClassMetadata GumObjcClassMetadata;
+typedef struct _GumObjcMethodEntry GumObjcMethodEntry;
 
 struct _GumObjcApiResolver
 {
@@ -19,8 +31,13 @@ struct _GumObjcApiResolver
 
   GRegex * query_pattern;
 
+  GRecMutex mutex;
+  guint query_depth;
+
   gboolean available;
   GHashTable * class_by_handle;
+  gint class_count;
+  GHashTable * methods_by_name;
 
   gint (* objc_getClassList) (Class * buffer, gint class_count);
   Class (* class_getSuperclass) (Class klass);
@@ -43,11 +60,19 @@ struct _GumObjcClassMetadata
   Method * instance_methods;
   guint instance_method_count;
 
+  Class super_handle;
   GSList * subclasses;
 
   GumObjcApiResolver * resolver;
 };
 
+struct _GumObjcMethodEntry
+{
+  GumObjcClassMetadata * klass;
+  gchar type;
+  IMP implementation;
+};
+
 static void gum_objc_api_resolver_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_objc_api_resolver_finalize (GObject * object);
@@ -58,16 +83,33 @@ static gboolean gum_objc_api_resolver_enumerate_matches_for_class (
     GumObjcApiResolver * self, GumObjcClassMetadata * klass, gchar method_type,
     GPatternSpec * method_spec, GHashTable * visited_classes,
     GumFoundApiFunc func, gpointer user_data);
+static void gum_objc_api_resolver_enumerate_matches_for_selector (
+    GumObjcApiResolver * self, const gchar * method_name, gchar method_type,
+    GPatternSpec * class_spec, GumFoundApiFunc func, gpointer user_data);
+static gboolean gum_objc_api_resolver_class_or_ancestor_matches (
+    GumObjcApiResolver * self, GumObjcClassMetadata * klass,
+    GPatternSpec * class_spec);
+static gboolean gum_objc_api_resolver_emit_method (GumObjcApiResolver * self,
+    GumObjcClassMetadata * klass, gchar type, const gchar * method_name,
+    IMP implementation, GumFoundApiFunc func, gpointer user_data);
 
 static gchar gum_method_type_from_match_info (GMatchInfo * match_info,
     gint match_num);
 static GPatternSpec * gum_pattern_spec_from_match_info (GMatchInfo * match_info,
     gint match_num);
 
-static GHashTable * gum_objc_api_resolver_create_snapshot (
-    GumObjcApiResolver * resolver);
+static void gum_objc_api_resolver_deinit (void);
+
+static void gum_objc_api_resolver_update_snapshot (
+    GumObjcApiResolver * self);
+static GHashTable * gum_objc_api_resolver_get_methods_by_name (
+    GumObjcApiResolver * self);
+static void gum_objc_api_resolver_index_methods (GumObjcApiResolver * self,
+    GHashTable * methods_by_name, GumObjcClassMetadata * klass, gchar type);
 
 static void gum_objc_class_metadata_free (GumObjcClassMetadata * klass);
+static void gum_objc_class_metadata_forget_methods (
+    GumObjcClassMetadata * self);
 static const Method * gum_objc_class_metadata_get_methods (
     GumObjcClassMetadata * self, gchar type, guint * count);
 
@@ -78,6 +120,9 @@ G_DEFINE_TYPE_EXTENDED (GumObjcApiResolver,
                         G_IMPLEMENT_INTERFACE (GUM_TYPE_API_RESOLVER,
                             gum_objc_api_resolver_iface_init))
 
+static GMutex gum_objc_api_resolver_lock;
+static GumObjcApiResolver * gum_the_objc_api_resolver = NULL;
+
 static void
 gum_objc_api_resolver_class_init (GumObjcApiResolverClass * klass)
 {
@@ -103,6 +148,8 @@ gum_objc_api_resolver_init (GumObjcApiResolver * self)
   self->query_pattern = g_regex_new ("([+*-])\\[(\\S+)\\s+(\\S+)\\]", 0, 0,
       NULL);
 
+  g_rec_mutex_init (&self->mutex);
+
   objc = dlopen ("/usr/lib/libobjc.A.dylib", RTLD_LAZY | RTLD_GLOBAL | RTLD_NOLOAD);
   if (objc == NULL)
     goto beach;
@@ -122,7 +169,10 @@ gum_objc_api_resolver_init (GumObjcApiResolver * self)
   GUM_TRY_ASSIGN_OBJC_FUNC (sel_getName);
 
   self->available = TRUE;
-  self->class_by_handle = gum_objc_api_resolver_create_snapshot (self);
+  self->class_by_handle = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_objc_class_metadata_free);
+  self->class_count = 0;
+  gum_objc_api_resolver_update_snapshot (self);
 
 beach:
   if (objc != NULL)
@@ -134,8 +184,11 @@ gum_objc_api_resolver_finalize (GObject * object)
 {
   GumObjcApiResolver * self = GUM_OBJC_API_RESOLVER (object);
 
+  g_clear_pointer (&self->methods_by_name, g_hash_table_unref);
   g_clear_pointer (&self->class_by_handle, g_hash_table_unref);
 
+  g_rec_mutex_clear (&self->mutex);
+
   g_regex_unref (self->query_pattern);
 
   G_OBJECT_CLASS (gum_objc_api_resolver_parent_class)->finalize (object);
@@ -146,14 +199,36 @@ gum_objc_api_resolver_new (void)
 {
   GumObjcApiResolver * resolver;
 
-  resolver = g_object_new (GUM_TYPE_OBJC_API_RESOLVER, NULL);
-  if (!resolver->available)
+  g_mutex_lock (&gum_objc_api_resolver_lock);
+
+  resolver = gum_the_objc_api_resolver;
+  if (resolver == NULL)
   {
-    g_object_unref (resolver);
-    return NULL;
+    resolver = g_object_new (GUM_TYPE_OBJC_API_RESOLVER, NULL);
+    if (!resolver->available)
+    {
+      /* The runtime may yet be loaded, so try again next time. */
+      g_object_unref (resolver);
+      resolver = NULL;
+      goto beach;
+    }
+
+    gum_the_objc_api_resolver = resolver;
+    _gum_register_destructor (gum_objc_api_resolver_deinit);
   }
 
-  return GUM_API_RESOLVER (resolver);
+  g_object_ref (resolver);
+
+beach:
+  g_mutex_unlock (&gum_objc_api_resolver_lock);
+
+  return (resolver != NULL) ? GUM_API_RESOLVER (resolver) : NULL;
+}
+
+static void
+gum_objc_api_resolver_deinit (void)
+{
+  g_clear_object (&gum_the_objc_api_resolver);
 }
 
 static void
@@ -167,6 +242,7 @@ gum_objc_api_resolver_enumerate_matches (GumApiResolver * resolver,
   GMatchInfo * query_info;
   gchar method_type;
   GPatternSpec * class_spec, * method_spec;
+  gchar * method_name;
   GHashTableIter iter;
   gboolean carry_on;
   GHashTable * visited_classes;
@@ -179,9 +255,27 @@ gum_objc_api_resolver_enumerate_matches (GumApiResolver * resolver,
   method_type = gum_method_type_from_match_info (query_info, 1);
   class_spec = gum_pattern_spec_from_match_info (query_info, 2);
   method_spec = gum_pattern_spec_from_match_info (query_info, 3);
+  method_name = g_match_info_fetch (query_info, 3);
 
   g_match_info_free (query_info);
 
+  g_rec_mutex_lock (&self->mutex);
+
+  if (self->query_depth == 0)
+    gum_objc_api_resolver_update_snapshot (self);
+  self->query_depth++;
+
+  /*
+   * Looking for a specific selector is by far the most common query, so
+   * answer those from an index rather than by walking every class.
+   */
+  if (strpbrk (method_name, "*?") == NULL)
+  {
+    gum_objc_api_resolver_enumerate_matches_for_selector (self, method_name,
+        method_type, class_spec, func, user_data);
+    goto beach;
+  }
+
   g_hash_table_iter_init (&iter, self->class_by_handle);
   carry_on = TRUE;
   visited_classes = g_hash_table_new (NULL, NULL);
@@ -195,6 +289,12 @@ gum_objc_api_resolver_enumerate_matches (GumApiResolver * resolver,
   }
   g_hash_table_unref (visited_classes);
 
+beach:
+  self->query_depth--;
+
+  g_rec_mutex_unlock (&self->mutex);
+
+  g_free (method_name);
   g_pattern_spec_free (method_spec);
   g_pattern_spec_free (class_spec);
 
@@ -233,8 +333,6 @@ gum_objc_api_resolver_enumerate_matches_for_class (GumObjcApiResolver * self,
   {
     const Method * method_handles;
     guint method_count, method_index;
-    const gchar prefix[3] = { *t, '[', '\0' };
-    const gchar suffix[2] = { ']', '\0' };
 
     method_handles =
         gum_objc_class_metadata_get_methods (klass, *t, &method_count);
@@ -246,17 +344,9 @@ gum_objc_api_resolver_enumerate_matches_for_class (GumObjcApiResolver * self,
       method_name = self->sel_getName (self->method_getName (method_handle));
       if (g_pattern_match_string (method_spec, method_name))
       {
-        GumApiDetails details;
-
-        details.name =
-            g_strconcat (prefix, klass->name, " ", method_name, suffix, NULL);
-        details.address =
-            GUM_ADDRESS (self->method_getImplementation (method_handle));
-
-        carry_on = func (&details, user_data);
-
-        g_free ((gpointer) details.name);
-
+        carry_on = gum_objc_api_resolver_emit_method (self, klass, *t,
+            method_name, self->method_getImplementation (method_handle),
+            func, user_data);
         if (!carry_on)
           return FALSE;
       }
@@ -280,6 +370,85 @@ gum_objc_api_resolver_enumerate_matches_for_class (GumObjcApiResolver * self,
   return TRUE;
 }
 
+static void
+gum_objc_api_resolver_enumerate_matches_for_selector (
+    GumObjcApiResolver * self,
+    const gchar * method_name,
+    gchar method_type,
+    GPatternSpec * class_spec,
+    GumFoundApiFunc func,
+    gpointer user_data)
+{
+  GArray * entries;
+  guint i;
+
+  entries = g_hash_table_lookup (
+      gum_objc_api_resolver_get_methods_by_name (self), method_name);
+  if (entries == NULL)
+    return;
+
+  for (i = 0; i != entries->len; i++)
+  {
+    const GumObjcMethodEntry * entry =
+        &g_array_index (entries, GumObjcMethodEntry, i);
+
+    if (method_type != '*' && entry->type != method_type)
+      continue;
+
+    /* Matching a class extends to its subclasses, as in the full walk. */
+    if (!gum_objc_api_resolver_class_or_ancestor_matches (self, entry->klass,
+        class_spec))
+      continue;
+
+    if (!gum_objc_api_resolver_emit_method (self, entry->klass, entry->type,
+        method_name, entry->implementation, func, user_data))
+      return;
+  }
+}
+
+static gboolean
+gum_objc_api_resolver_class_or_ancestor_matches (GumObjcApiResolver * self,
+                                                 GumObjcClassMetadata * klass,
+                                                 GPatternSpec * class_spec)
+{
+  while (klass != NULL)
+  {
+    if (g_pattern_match_string (class_spec, klass->name))
+      return TRUE;
+
+    if (klass->super_handle == NULL)
+      break;
+    klass = g_hash_table_lookup (self->class_by_handle, klass->super_handle);
+  }
+
+  return FALSE;
+}
+
+static gboolean
+gum_objc_api_resolver_emit_method (GumObjcApiResolver * self,
+                                   GumObjcClassMetadata * klass,
+                                   gchar type,
+                                   const gchar * method_name,
+                                   IMP implementation,
+                                   GumFoundApiFunc func,
+                                   gpointer user_data)
+{
+  const gchar prefix[3] = { type, '[', '\0' };
+  const gchar suffix[2] = { ']', '\0' };
+  GumApiDetails details;
+  gboolean carry_on;
+
+  details.name =
+      g_strconcat (prefix, klass->name, " ", method_name, suffix, NULL);
+  details.address = GUM_ADDRESS (implementation);
+
+  carry_on = func (&details, user_data);
+
+  g_free ((gpointer) details.name);
+
+  return carry_on;
+}
+
 static gchar
 gum_method_type_from_match_info (GMatchInfo * match_info,
                                  gint match_num)
@@ -307,55 +476,138 @@ gum_pattern_spec_from_match_info (GMatchInfo * match_info,
   return spec;
 }
 
-static GHashTable *
-gum_objc_api_resolver_create_snapshot (GumObjcApiResolver * self)
+/*
+ * Classes only ever get added, as images are loaded, so a change in the
+ * class count is all it takes to notice that the snapshot is stale. Only the
+ * new classes are added, but the cached method lists are dropped across the
+ * board since new images may also have brought categories along.
+ */
+static void
+gum_objc_api_resolver_update_snapshot (GumObjcApiResolver * self)
 {
-  GHashTable * class_by_handle;
+  GHashTable * class_by_handle = self->class_by_handle;
   gint class_count, class_index;
   Class * classes;
-
-  class_by_handle = g_hash_table_new_full (NULL, NULL, NULL,
-      (GDestroyNotify) gum_objc_class_metadata_free);
+  GSList * new_classes, * cur;
+  GHashTableIter iter;
+  GumObjcClassMetadata * klass;
 
   class_count = self->objc_getClassList (NULL, 0);
+  if (class_count == self->class_count)
+    return;
+
   classes = g_malloc (class_count * sizeof (Class));
-  self->objc_getClassList (classes, class_count);
+  class_count = MIN (self->objc_getClassList (classes, class_count),
+      class_count);
 
+  g_hash_table_iter_init (&iter, class_by_handle);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &klass))
+    gum_objc_class_metadata_forget_methods (klass);
+  g_clear_pointer (&self->methods_by_name, g_hash_table_unref);
+
+  new_classes = NULL;
   for (class_index = 0; class_index != class_count; class_index++)
   {
     Class handle = classes[class_index];
-    GumObjcClassMetadata * klass;
+
+    if (g_hash_table_contains (class_by_handle, handle))
+      continue;
 
     klass = g_slice_new (GumObjcClassMetadata);
     klass->handle = handle;
     klass->name = self->class_getName (handle);
     klass->class_methods = NULL;
     klass->instance_methods = NULL;
+    klass->super_handle = self->class_getSuperclass (handle);
     klass->subclasses = NULL;
 
     klass->resolver = self;
 
     g_hash_table_insert (class_by_handle, handle, klass);
+    new_classes = g_slist_prepend (new_classes, klass);
   }
 
-  for (class_index = 0; class_index != class_count; class_index++)
+  for (cur = new_classes; cur != NULL; cur = cur->next)
   {
-    Class handle = classes[class_index];
-    Class super_handle;
+    GumObjcClassMetadata * superclass;
 
-    super_handle = self->class_getSuperclass (handle);
-    if (super_handle != NULL)
-    {
-      GumObjcClassMetadata * klass;
+    klass = cur->data;
+    if (klass->super_handle == NULL)
+      continue;
 
-      klass = g_hash_table_lookup (class_by_handle, super_handle);
-      klass->subclasses = g_slist_prepend (klass->subclasses, handle);
+    superclass = g_hash_table_lookup (class_by_handle, klass->super_handle);
+    if (superclass != NULL)
+    {
+      superclass->subclasses =
+          g_slist_prepend (superclass->subclasses, klass->handle);
     }
   }
 
+  g_slist_free (new_classes);
   g_free (classes);
 
-  return class_by_handle;
+  self->class_count = class_count;
+}
+
+static GHashTable *
+gum_objc_api_resolver_get_methods_by_name (GumObjcApiResolver * self)
+{
+  GHashTable * methods_by_name;
+  GHashTableIter iter;
+  GumObjcClassMetadata * klass;
+
+  if (self->methods_by_name != NULL)
+    return self->methods_by_name;
+
+  /* Selector names are interned by the runtime, so we can borrow them. */
+  methods_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) g_array_unref);
+
+  g_hash_table_iter_init (&iter, self->class_by_handle);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &klass))
+  {
+    gum_objc_api_resolver_index_methods (self, methods_by_name, klass, '+');
+    gum_objc_api_resolver_index_methods (self, methods_by_name, klass, '-');
+  }
+
+  self->methods_by_name = methods_by_name;
+
+  return methods_by_name;
+}
+
+static void
+gum_objc_api_resolver_index_methods (GumObjcApiResolver * self,
+                                     GHashTable * methods_by_name,
+                                     GumObjcClassMetadata * klass,
+                                     gchar type)
+{
+  const Method * method_handles;
+  guint method_count, method_index;
+
+  method_handles =
+      gum_objc_class_metadata_get_methods (klass, type, &method_count);
+
+  for (method_index = 0; method_index != method_count; method_index++)
+  {
+    Method method_handle = method_handles[method_index];
+    const gchar * method_name;
+    GArray * entries;
+    GumObjcMethodEntry entry;
+
+    method_name = self->sel_getName (self->method_getName (method_handle));
+
+    entries = g_hash_table_lookup (methods_by_name, method_name);
+    if (entries == NULL)
+    {
+      entries = g_array_new (FALSE, FALSE, sizeof (GumObjcMethodEntry));
+      g_hash_table_insert (methods_by_name, (gpointer) method_name, entries);
+    }
+
+    entry.klass = klass;
+    entry.type = type;
+    entry.implementation = self->method_getImplementation (method_handle);
+    g_array_append_val (entries, entry);
+  }
 }
 
 static void
@@ -363,15 +615,27 @@ gum_objc_class_metadata_free (GumObjcClassMetadata * klass)
 {
   g_slist_free (klass->subclasses);
 
-  if (klass->instance_methods != NULL)
-    free (klass->instance_methods);
-
-  if (klass->class_methods != NULL)
-    free (klass->class_methods);
+  gum_objc_class_metadata_forget_methods (klass);
 
   g_slice_free (GumObjcClassMetadata, klass);
 }
 
+static void
+gum_objc_class_metadata_forget_methods (GumObjcClassMetadata * self)
+{
+  if (self->instance_methods != NULL)
+  {
+    free (self->instance_methods);
+    self->instance_methods = NULL;
+  }
+
+  if (self->class_methods != NULL)
+  {
+    free (self->class_methods);
+    self->class_methods = NULL;
+  }
+}
+
 static const Method *
 gum_objc_class_metadata_get_methods (GumObjcClassMetadata * self,
                                      gchar type,
@@ -7,6 +7,7 @@
 
 #include "gumprocess-priv.h"
 
+#include "gum-init.h"
 #include "gumdarwin.h"
 #include "gumdarwinmodule.h"
 #include "gumleb.h"
@@ -48,6 +49,7 @@ typedef struct _GumFindEntrypointContext GumFindEntrypointContext;
 typedef struct _GumEnumerateModulesSlowContext GumEnumerateModulesSlowContext;
 typedef struct _GumEnumerateMallocRangesContext GumEnumerateMallocRangesContext;
 typedef struct _GumCanonicalizeNameContext GumCanonicalizeNameContext;
+typedef struct _GumCachedModule GumCachedModule;
 
 typedef union _DyldInfo DyldInfo;
 typedef struct _DyldInfoLegacy DyldInfoLegacy;
@@ -115,6 +117,13 @@ struct _GumCanonicalizeNameContext
   gchar * module_path;
 };
 
+struct _GumCachedModule
+{
+  gchar * name;
+  gchar * path;
+  GumMemoryRange range;
+};
+
 struct _DyldInfoLegacy
 {
   guint32 all_image_info_addr;
@@ -261,6 +270,13 @@ extern int __proc_info (int callnum, int pid, int flavor, uint64_t arg,
 typedef const struct dyld_all_image_infos * (* DyldGetAllImageInfosFunc) (
     void);
 
+static GArray * gum_obtain_cached_modules (void);
+static gboolean gum_cache_module (const GumModuleDetails * details,
+    gpointer user_data);
+static void gum_cached_module_clear (GumCachedModule * module);
+static void gum_module_cache_deinit (void);
+static const struct dyld_all_image_infos * gum_query_all_image_infos (void);
+
 static void gum_emit_malloc_ranges (task_t task,
     void * user_data, unsigned type, vm_range_t * ranges, unsigned count);
 static kern_return_t gum_read_malloc_memory (task_t remote_task,
@@ -300,6 +316,10 @@ static gboolean gum_darwin_fill_file_mapping (gint pid,
 static void gum_darwin_clamp_range_size (GumMemoryRange * range,
     GumFileMapping * file);
 
+static GMutex gum_module_cache_lock;
+static GArray * gum_cached_modules = NULL;
+static guint64 gum_cached_modules_generation = 0;
+
 gboolean
 gum_process_is_debugger_attached (void)
 {
@@ -411,18 +431,256 @@ gum_process_modify_thread (GumThreadId thread_id,
   return success;
 }
 
+/*
+ * Suspending our own task would also suspend the calling thread, so instead
+ * every thread is suspended up front, all of them are modified in a single
+ * pass, and then they are all resumed. They are thus kept stopped while func
+ * is called for each of them, so func must not take locks that any of them
+ * might be holding. Threads caught in a state that cannot be captured yet are
+ * retried one at a time once the others have been resumed.
+ */
+guint
+gum_process_modify_threads (const GumThreadId * thread_ids,
+                            guint num_threads,
+                            GumModifyThreadFunc func,
+                            gpointer user_data)
+{
+  guint num_modified = 0;
+  GumThreadId current_thread_id;
+  gboolean includes_current_thread = FALSE;
+  thread_t * suspended, * deferred;
+  guint num_suspended = 0, num_deferred = 0;
+  guint i;
+
+  current_thread_id = gum_process_get_current_thread_id ();
+
+  suspended = g_new (thread_t, num_threads);
+  deferred = g_new (thread_t, num_threads);
+
+  for (i = 0; i != num_threads; i++)
+  {
+    thread_t thread = thread_ids[i];
+
+    if (thread == current_thread_id)
+    {
+      includes_current_thread = TRUE;
+      continue;
+    }
+
+    if (thread_suspend (thread) == KERN_SUCCESS)
+      suspended[num_suspended++] = thread;
+  }
+
+  for (i = 0; i != num_suspended; i++)
+  {
+    thread_t thread = suspended[i];
+    GumDarwinUnifiedThreadState state;
+    mach_msg_type_number_t state_count = GUM_DARWIN_THREAD_STATE_COUNT;
+    thread_state_flavor_t state_flavor = GUM_DARWIN_THREAD_STATE_FLAVOR;
+    GumCpuContext cpu_context;
+
+    if (thread_get_state (thread, state_flavor, (thread_state_t) &state,
+        &state_count) != KERN_SUCCESS)
+    {
+      continue;
+    }
+
+    if (!gum_darwin_is_unified_thread_state_valid (&state))
+    {
+      deferred[num_deferred++] = thread;
+      continue;
+    }
+
+    gum_darwin_parse_unified_thread_state (&state, &cpu_context);
+    func (thread, &cpu_context, user_data);
+    gum_darwin_unparse_unified_thread_state (&cpu_context, &state);
+
+    if (thread_set_state (thread, state_flavor, (thread_state_t) &state,
+        state_count) == KERN_SUCCESS)
+    {
+      num_modified++;
+    }
+  }
+
+  for (i = 0; i != num_suspended; i++)
+    thread_resume (suspended[i]);
+
+  for (i = 0; i != num_deferred; i++)
+  {
+    if (gum_process_modify_thread (deferred[i], func, user_data))
+      num_modified++;
+  }
+
+  g_free (deferred);
+  g_free (suspended);
+
+  if (includes_current_thread &&
+      gum_process_modify_thread (current_thread_id, func, user_data))
+  {
+    num_modified++;
+  }
+
+  return num_modified;
+}
+
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
   gum_darwin_enumerate_threads (mach_task_self (), func, user_data);
 }
 
+/*
+ * Parsing the Mach-O header of every image is what makes enumerating the
+ * modules costly, so the parsed list is kept for as long as dyld's change
+ * timestamp says that its image list is unchanged.
+ */
 void
 gum_process_enumerate_modules (GumFoundModuleFunc func,
                                gpointer user_data)
 {
-  gum_darwin_enumerate_modules (mach_task_self (), func, user_data);
+  GArray * modules;
+  guint i;
+
+  modules = gum_obtain_cached_modules ();
+  if (modules == NULL)
+  {
+    gum_darwin_enumerate_modules (mach_task_self (), func, user_data);
+    return;
+  }
+
+  for (i = 0; i != modules->len; i++)
+  {
+    GumCachedModule * module = &g_array_index (modules, GumCachedModule, i);
+    GumModuleDetails details;
+
+    details.name = module->name;
+    details.range = &module->range;
+    details.path = module->path;
+
+    if (!func (&details, user_data))
+      break;
+  }
+
+  g_array_unref (modules);
+}
+
+static GArray *
+gum_obtain_cached_modules (void)
+{
+  GArray * modules;
+  guint64 generation, generation_after;
+
+  if (!_gum_process_query_module_generation (&generation))
+    return NULL;
+
+  g_mutex_lock (&gum_module_cache_lock);
+
+  if (gum_cached_modules != NULL &&
+      generation == gum_cached_modules_generation)
+  {
+    modules = g_array_ref (gum_cached_modules);
+
+    g_mutex_unlock (&gum_module_cache_lock);
+
+    return modules;
+  }
+
+  g_mutex_unlock (&gum_module_cache_lock);
+
+  modules = g_array_new (FALSE, FALSE, sizeof (GumCachedModule));
+  g_array_set_clear_func (modules, (GDestroyNotify) gum_cached_module_clear);
+  gum_darwin_enumerate_modules (mach_task_self (), gum_cache_module, modules);
+
+  /* Only keep a list that was not changing while we read it. */
+  if (!_gum_process_query_module_generation (&generation_after) ||
+      generation_after != generation)
+  {
+    return modules;
+  }
+
+  g_mutex_lock (&gum_module_cache_lock);
+
+  if (gum_cached_modules != NULL)
+    g_array_unref (gum_cached_modules);
+  else
+    _gum_register_destructor (gum_module_cache_deinit);
+  gum_cached_modules = g_array_ref (modules);
+  gum_cached_modules_generation = generation;
+
+  g_mutex_unlock (&gum_module_cache_lock);
+
+  return modules;
+}
+
+static gboolean
+gum_cache_module (const GumModuleDetails * details,
+                  gpointer user_data)
+{
+  GArray * modules = user_data;
+  GumCachedModule module;
+
+  module.name = g_strdup (details->name);
+  module.path = g_strdup (details->path);
+  module.range = *details->range;
+
+  g_array_append_val (modules, module);
+
+  return TRUE;
+}
+
+static void
+gum_cached_module_clear (GumCachedModule * module)
+{
+  g_free (module->name);
+  g_free (module->path);
+}
+
+static void
+gum_module_cache_deinit (void)
+{
+  g_array_unref (gum_cached_modules);
+  gum_cached_modules = NULL;
+}
+
+/*
+ * dyld stamps its image list every time it changes, and clears the list
+ * pointer while it is in the middle of doing so. Older versions of dyld
+ * lack the stamp, which leaves us unable to tell.
+ */
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  const struct dyld_all_image_infos * infos;
+
+  infos = gum_query_all_image_infos ();
+  if (infos == NULL || infos->version < 15 || infos->infoArray == NULL)
+    return FALSE;
+
+  *generation = infos->infoArrayChangeTimestamp;
+
+  return TRUE;
+}
+
+static const struct dyld_all_image_infos *
+gum_query_all_image_infos (void)
+{
+  static gsize cached_result = 0;
+
+  if (g_once_init_enter (&cached_result))
+  {
+    DyldGetAllImageInfosFunc get_all_image_infos;
+    const struct dyld_all_image_infos * infos = NULL;
+
+    get_all_image_infos = dlsym (RTLD_DEFAULT, "_dyld_get_all_image_infos");
+    if (get_all_image_infos != NULL)
+      infos = get_all_image_infos ();
+
+    g_once_init_leave (&cached_result, GPOINTER_TO_SIZE (infos) + 1);
+  }
+
+  return GSIZE_TO_POINTER (cached_result - 1);
 }
 
 void
@@ -9,6 +9,8 @@
 #include "gum-init.h"
 #include "gumdarwinsymbolicator.h"
 
+#include <string.h>
+
 static gpointer do_init (gpointer data);
 static void do_deinit (void);
 
@@ -60,6 +62,40 @@ gum_symbol_details_from_address (gpointer address,
       GUM_ADDRESS (address), details);
 }
 
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint n_addresses,
+                                   GumDebugSymbolDetails * details,
+                                   gboolean * resolved)
+{
+  GumDarwinSymbolicator * symbolicator;
+  guint n_resolved, i;
+
+  if ((symbolicator = gum_try_get_symbolicator ()) == NULL)
+  {
+    if (resolved != NULL)
+      memset (resolved, 0, n_addresses * sizeof (gboolean));
+    return 0;
+  }
+
+  n_resolved = 0;
+
+  for (i = 0; i != n_addresses; i++)
+  {
+    gboolean success;
+
+    success = gum_darwin_symbolicator_details_from_address (symbolicator,
+        GUM_ADDRESS (addresses[i]), &details[i]);
+    if (success)
+      n_resolved++;
+
+    if (resolved != NULL)
+      resolved[i] = success;
+  }
+
+  return n_resolved;
+}
+
 gchar *
 gum_symbol_name_from_address (gpointer address)
 {
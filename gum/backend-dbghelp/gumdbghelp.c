@@ -58,6 +58,7 @@ do_init (gpointer data)
   INIT_IMPL_FUNC (SymFromAddr);
   INIT_IMPL_FUNC (SymFunctionTableAccess64);
   INIT_IMPL_FUNC (SymGetLineFromAddr64);
+  INIT_IMPL_FUNC (SymEnumLines);
   INIT_IMPL_FUNC (SymGetModuleBase64);
   INIT_IMPL_FUNC (SymGetTypeInfo);
 
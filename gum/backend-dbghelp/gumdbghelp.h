@@ -45,6 +45,9 @@ struct _GumDbghelpImpl
       DWORD64 AddrBase);
   BOOL (WINAPI * SymGetLineFromAddr64) (HANDLE hProcess, DWORD64 qwAddr,
       PDWORD pdwDisplacement, PIMAGEHLP_LINE64 Line64);
+  BOOL (WINAPI * SymEnumLines) (HANDLE hProcess, ULONG64 Base, PCSTR Obj,
+      PCSTR File, PSYM_ENUMLINES_CALLBACK EnumLinesCallback,
+      PVOID UserContext);
   DWORD64 (WINAPI * SymGetModuleBase64) (HANDLE hProcess, DWORD64 qwAddr);
   BOOL (WINAPI * SymGetTypeInfo) (HANDLE hProcess, DWORD64 ModBase,
       ULONG TypeId, IMAGEHLP_SYMBOL_TYPE_INFO GetType, PVOID pInfo);
@@ -80,6 +80,7 @@ gum_dbghelp_backtracer_generate (GumBacktracer * backtracer,
   guint i;
   BOOL success;
   GumInvocationStack * invocation_stack;
+  guint invocation_depth = 0;
 
   self = GUM_DBGHELP_BACKTRACER (backtracer);
   dbghelp = self->dbghelp;
@@ -182,7 +183,7 @@ gum_dbghelp_backtracer_generate (GumBacktracer * backtracer,
   invocation_stack = gum_interceptor_get_current_stack ();
   for (i = 0; i != return_addresses->len; i++)
   {
-    return_addresses->items[i] = gum_invocation_stack_translate (
-        invocation_stack, return_addresses->items[i]);
+    return_addresses->items[i] = gum_invocation_stack_translate_next (
+        invocation_stack, return_addresses->items[i], &invocation_depth);
   }
 }
@@ -6,6 +6,7 @@
 
 #include "gumsymbolutil.h"
 
+#include "gum-init.h"
 #include "gumdbghelp.h"
 
 #include <psapi.h>
@@ -14,77 +15,157 @@
 #define GUM_SymTagFunction       5
 #define GUM_SymTagPublicSymbol  10
 
-typedef struct _GumSymbolInfo GumSymbolInfo;
+/*
+ * dbghelp is not thread-safe, so every call into it has to hold its global
+ * lock. Instead of querying it on each lookup, the first lookup that lands
+ * in a module copies that module's functions and line table out of dbghelp
+ * into a GumSymbolTable, sorted by address. Tables are never modified once
+ * published, so queries only take the reader side of a GRWLock and never
+ * wait for each other. A table is rebuilt if its module is replaced by a
+ * different image at the same base.
+ */
+
+typedef struct _GumSymbolTable GumSymbolTable;
+typedef struct _GumSymbolEntry GumSymbolEntry;
+typedef struct _GumLineEntry GumLineEntry;
 
-#ifdef _MSC_VER
-# pragma pack(push)
-# pragma pack(1)
-#else
-# error Fix this for other compilers
-#endif
+struct _GumSymbolTable
+{
+  HMODULE module;
+  DWORD size;
+  DWORD timestamp;
+  gchar * name;
+
+  GArray * symbols;
+  GArray * lines;
+  GStringChunk * strings;
+};
 
-struct _GumSymbolInfo
+struct _GumSymbolEntry
 {
-  SYMBOL_INFO sym_info;
-  gchar sym_name_buf[GUM_MAX_SYMBOL_NAME + 1];
+  GumAddress address;
+  const gchar * name;
 };
 
-#ifdef _MSC_VER
-# pragma pack(pop)
-#endif
+struct _GumLineEntry
+{
+  GumAddress address;
+  const gchar * file_name;
+  guint line_number;
+};
 
-static BOOL CALLBACK enum_functions_callback (SYMBOL_INFO * sym_info,
+static gboolean gum_symbol_details_fill (gpointer address,
+    GumDebugSymbolDetails * details);
+
+static const GumSymbolTable * gum_symbol_table_ensure (
+    GumDbghelpImpl * dbghelp, HMODULE module);
+static GumSymbolTable * gum_symbol_table_new (GumDbghelpImpl * dbghelp,
+    HMODULE module);
+static void gum_symbol_table_free (GumSymbolTable * table);
+static gboolean gum_symbol_table_is_current (const GumSymbolTable * table);
+static const GumSymbolEntry * gum_symbol_table_find_symbol (
+    const GumSymbolTable * self, GumAddress address);
+static const GumLineEntry * gum_symbol_table_find_line (
+    const GumSymbolTable * self, GumAddress address, GumAddress lower_bound);
+static BOOL CALLBACK gum_symbol_table_collect_symbol (SYMBOL_INFO * sym_info,
     gulong symbol_size, gpointer user_context);
+static BOOL CALLBACK gum_symbol_table_collect_line (SRCCODEINFO * line_info,
+    gpointer user_context);
+static gint gum_symbol_entry_compare (const GumSymbolEntry * a,
+    const GumSymbolEntry * b);
+static gint gum_line_entry_compare (const GumLineEntry * a,
+    const GumLineEntry * b);
+
+static gboolean gum_get_module_image_details (HMODULE module, DWORD * size,
+    DWORD * timestamp);
 static gboolean is_function (SYMBOL_INFO * sym_info);
 
+static void gum_symbol_util_deinitialize (void);
+
+static GRWLock gum_symbol_tables_lock;
+static GHashTable * gum_symbol_tables = NULL;
+
 gboolean
 gum_symbol_details_from_address (gpointer address,
                                  GumDebugSymbolDetails * details)
 {
-  GumDbghelpImpl * dbghelp;
-  GumSymbolInfo si = { 0, };
-  IMAGEHLP_LINE64 li = { 0, };
-  DWORD displacement_dw;
-  DWORD64 displacement_qw;
-  BOOL has_sym_info, has_file_info;
+  return gum_symbol_details_fill (address, details);
+}
 
-  dbghelp = gum_dbghelp_impl_try_obtain ();
-  if (dbghelp == NULL)
-    return FALSE;
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint n_addresses,
+                                   GumDebugSymbolDetails * details,
+                                   gboolean * resolved)
+{
+  guint n_resolved, i;
+
+  n_resolved = 0;
+
+  for (i = 0; i != n_addresses; i++)
+  {
+    gboolean success;
+
+    success = gum_symbol_details_fill (addresses[i], &details[i]);
+    if (success)
+      n_resolved++;
+
+    if (resolved != NULL)
+      resolved[i] = success;
+  }
+
+  return n_resolved;
+}
+
+static gboolean
+gum_symbol_details_fill (gpointer address,
+                         GumDebugSymbolDetails * details)
+{
+  GumDbghelpImpl * dbghelp;
+  HMODULE module;
+  const GumSymbolTable * table;
+  const GumSymbolEntry * symbol;
+  const GumLineEntry * line;
 
   memset (details, 0, sizeof (GumDebugSymbolDetails));
   details->address = GUM_ADDRESS (address);
 
-  si.sym_info.SizeOfStruct = sizeof (SYMBOL_INFO);
-  si.sym_info.MaxNameLen = sizeof (si.sym_name_buf);
+  dbghelp = gum_dbghelp_impl_try_obtain ();
+  if (dbghelp == NULL)
+    return FALSE;
 
-  li.SizeOfStruct = sizeof (li);
+  if (!GetModuleHandleExW (GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS |
+      GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT, address, &module))
+  {
+    return FALSE;
+  }
 
-  dbghelp->Lock ();
+  table = gum_symbol_table_ensure (dbghelp, module);
+  if (table == NULL)
+    return FALSE;
 
-  has_sym_info = dbghelp->SymFromAddr (GetCurrentProcess (),
-      (DWORD64) address, &displacement_qw, &si.sym_info);
-  if (has_sym_info)
+  /* Holding the reader lock keeps the table alive while it is copied from. */
+  symbol = gum_symbol_table_find_symbol (table, details->address);
+  if (symbol != NULL)
   {
-    HMODULE mod = GSIZE_TO_POINTER (si.sym_info.ModBase);
-
-    GetModuleBaseNameA (GetCurrentProcess (), mod, details->module_name,
-        sizeof (details->module_name) - 1);
-    strcpy_s (details->symbol_name, sizeof (details->symbol_name),
-        si.sym_info.Name);
+    g_strlcpy (details->module_name, table->name,
+        sizeof (details->module_name));
+    g_strlcpy (details->symbol_name, symbol->name,
+        sizeof (details->symbol_name));
   }
 
-  has_file_info = dbghelp->SymGetLineFromAddr64 (GetCurrentProcess (),
-      (DWORD64) address, &displacement_dw, &li);
-  if (has_file_info)
+  line = gum_symbol_table_find_line (table, details->address,
+      (symbol != NULL) ? symbol->address : 0);
+  if (line != NULL)
   {
-    strcpy_s (details->file_name, sizeof (details->file_name), li.FileName);
-    details->line_number = li.LineNumber;
+    g_strlcpy (details->file_name, line->file_name,
+        sizeof (details->file_name));
+    details->line_number = line->line_number;
   }
 
-  dbghelp->Unlock ();
+  g_rw_lock_reader_unlock (&gum_symbol_tables_lock);
 
-  return (has_sym_info || has_file_info);
+  return (symbol != NULL || line != NULL);
 }
 
 gchar *
@@ -123,9 +204,11 @@ gum_find_functions_matching (const gchar * str)
 {
   GArray * matches;
   GumDbghelpImpl * dbghelp;
-  gchar * match_formatted_str;
   HANDLE cur_process_handle;
-  guint64 any_module_base;
+  HMODULE * modules;
+  DWORD size_needed;
+  guint n_modules, i;
+  GPatternSpec * pspec;
 
   matches = g_array_new (FALSE, FALSE, sizeof (gpointer));
 
@@ -133,34 +216,317 @@ gum_find_functions_matching (const gchar * str)
   if (dbghelp == NULL)
     return matches;
 
-  match_formatted_str = g_strdup_printf ("*!%s", str);
+  cur_process_handle = GetCurrentProcess ();
+
+  if (!EnumProcessModules (cur_process_handle, NULL, 0, &size_needed))
+    return matches;
+  modules = g_malloc (size_needed);
+  if (!EnumProcessModules (cur_process_handle, modules, size_needed,
+      &size_needed))
+  {
+    g_free (modules);
+    return matches;
+  }
+  n_modules = size_needed / sizeof (HMODULE);
+
+  pspec = g_pattern_spec_new (str);
+
+  for (i = 0; i != n_modules; i++)
+  {
+    const GumSymbolTable * table;
+    guint j;
+
+    table = gum_symbol_table_ensure (dbghelp, modules[i]);
+    if (table == NULL)
+      continue;
+
+    for (j = 0; j != table->symbols->len; j++)
+    {
+      const GumSymbolEntry * symbol =
+          &g_array_index (table->symbols, GumSymbolEntry, j);
+
+      if (g_pattern_match_string (pspec, symbol->name))
+      {
+        gpointer address = GSIZE_TO_POINTER (symbol->address);
+        g_array_append_val (matches, address);
+      }
+    }
+
+    g_rw_lock_reader_unlock (&gum_symbol_tables_lock);
+  }
+
+  g_pattern_spec_free (pspec);
+  g_free (modules);
+
+  return matches;
+}
+
+/*
+ * Returns with the reader lock held when successful, so that the table
+ * stays valid until the caller is done with it.
+ */
+static const GumSymbolTable *
+gum_symbol_table_ensure (GumDbghelpImpl * dbghelp,
+                         HMODULE module)
+{
+  GumSymbolTable * table, * existing;
+
+  g_rw_lock_reader_lock (&gum_symbol_tables_lock);
+
+  if (gum_symbol_tables != NULL)
+  {
+    table = g_hash_table_lookup (gum_symbol_tables, module);
+    if (table != NULL && gum_symbol_table_is_current (table))
+      return table;
+  }
+
+  g_rw_lock_reader_unlock (&gum_symbol_tables_lock);
+
+  table = gum_symbol_table_new (dbghelp, module);
+  if (table == NULL)
+    return NULL;
+
+  g_rw_lock_writer_lock (&gum_symbol_tables_lock);
+
+  if (gum_symbol_tables == NULL)
+  {
+    gum_symbol_tables = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) gum_symbol_table_free);
+
+    _gum_register_destructor (gum_symbol_util_deinitialize);
+  }
+
+  /* Another thread may have loaded the same module while we did. */
+  existing = g_hash_table_lookup (gum_symbol_tables, module);
+  if (existing != NULL && gum_symbol_table_is_current (existing))
+  {
+    gum_symbol_table_free (table);
+  }
+  else
+  {
+    g_hash_table_insert (gum_symbol_tables, module, table);
+  }
+
+  g_rw_lock_writer_unlock (&gum_symbol_tables_lock);
+
+  /* GRWLock can't downgrade, so look it up again as a reader. */
+  return gum_symbol_table_ensure (dbghelp, module);
+}
+
+static GumSymbolTable *
+gum_symbol_table_new (GumDbghelpImpl * dbghelp,
+                      HMODULE module)
+{
+  GumSymbolTable * table;
+  HANDLE cur_process_handle;
+  gchar name[MAX_PATH + 1] = { 0, };
+  guint i, n;
+
+  table = g_slice_new (GumSymbolTable);
+  table->module = module;
+  if (!gum_get_module_image_details (module, &table->size, &table->timestamp))
+  {
+    g_slice_free (GumSymbolTable, table);
+    return NULL;
+  }
 
   cur_process_handle = GetCurrentProcess ();
-  any_module_base = 0;
+
+  GetModuleBaseNameA (cur_process_handle, module, name, sizeof (name) - 1);
+  table->name = g_strdup (name);
+
+  table->symbols = g_array_new (FALSE, FALSE, sizeof (GumSymbolEntry));
+  table->lines = g_array_new (FALSE, FALSE, sizeof (GumLineEntry));
+  table->strings = g_string_chunk_new (4096);
 
   dbghelp->Lock ();
-  dbghelp->SymEnumSymbols (cur_process_handle, any_module_base,
-      match_formatted_str, enum_functions_callback, matches);
+  dbghelp->SymEnumSymbols (cur_process_handle, GPOINTER_TO_SIZE (module), "*",
+      gum_symbol_table_collect_symbol, table);
+  dbghelp->SymEnumLines (cur_process_handle, GPOINTER_TO_SIZE (module), NULL,
+      NULL, gum_symbol_table_collect_line, table);
   dbghelp->Unlock ();
 
-  g_free (match_formatted_str);
+  g_array_sort (table->symbols, (GCompareFunc) gum_symbol_entry_compare);
+  g_array_sort (table->lines, (GCompareFunc) gum_line_entry_compare);
 
-  return matches;
+  /* A function is often reported both by its PDB record and as public. */
+  n = 0;
+  for (i = 0; i != table->symbols->len; i++)
+  {
+    const GumSymbolEntry * symbol =
+        &g_array_index (table->symbols, GumSymbolEntry, i);
+
+    if (n != 0)
+    {
+      const GumSymbolEntry * previous =
+          &g_array_index (table->symbols, GumSymbolEntry, n - 1);
+
+      if (previous->address == symbol->address &&
+          strcmp (previous->name, symbol->name) == 0)
+        continue;
+    }
+
+    g_array_index (table->symbols, GumSymbolEntry, n++) = *symbol;
+  }
+  g_array_set_size (table->symbols, n);
+
+  return table;
 }
 
-static BOOL CALLBACK
-enum_functions_callback (SYMBOL_INFO * sym_info,
-                         gulong symbol_size,
-                         gpointer user_context)
+static void
+gum_symbol_table_free (GumSymbolTable * table)
 {
-  GArray * result = user_context;
+  g_string_chunk_free (table->strings);
+  g_array_free (table->lines, TRUE);
+  g_array_free (table->symbols, TRUE);
+  g_free (table->name);
+
+  g_slice_free (GumSymbolTable, table);
+}
 
-  if (is_function (sym_info))
+static gboolean
+gum_symbol_table_is_current (const GumSymbolTable * table)
+{
+  DWORD size, timestamp;
+
+  if (!gum_get_module_image_details (table->module, &size, &timestamp))
+    return FALSE;
+
+  return size == table->size && timestamp == table->timestamp;
+}
+
+static const GumSymbolEntry *
+gum_symbol_table_find_symbol (const GumSymbolTable * self,
+                              GumAddress address)
+{
+  const GumSymbolEntry * symbols = (const GumSymbolEntry *) self->symbols->data;
+  guint lo, hi;
+
+  /* Like SymFromAddr(), this is the closest symbol at or below. */
+  lo = 0;
+  hi = self->symbols->len;
+  while (lo != hi)
   {
-    gpointer address = GSIZE_TO_POINTER (sym_info->Address);
-    g_array_append_val (result, address);
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (symbols[mid].address <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
   }
 
+  return (lo != 0) ? &symbols[lo - 1] : NULL;
+}
+
+static const GumLineEntry *
+gum_symbol_table_find_line (const GumSymbolTable * self,
+                            GumAddress address,
+                            GumAddress lower_bound)
+{
+  const GumLineEntry * lines = (const GumLineEntry *) self->lines->data;
+  guint lo, hi;
+
+  lo = 0;
+  hi = self->lines->len;
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (lines[mid].address <= address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo == 0)
+    return NULL;
+
+  /* A line that starts before the enclosing function belongs to another. */
+  if (lines[lo - 1].address < lower_bound)
+    return NULL;
+
+  return &lines[lo - 1];
+}
+
+static BOOL CALLBACK
+gum_symbol_table_collect_symbol (SYMBOL_INFO * sym_info,
+                                 gulong symbol_size,
+                                 gpointer user_context)
+{
+  GumSymbolTable * table = user_context;
+  GumSymbolEntry symbol;
+
+  if (!is_function (sym_info))
+    return TRUE;
+
+  symbol.address = sym_info->Address;
+  symbol.name = g_string_chunk_insert_const (table->strings, sym_info->Name);
+  g_array_append_val (table->symbols, symbol);
+
+  return TRUE;
+}
+
+static BOOL CALLBACK
+gum_symbol_table_collect_line (SRCCODEINFO * line_info,
+                               gpointer user_context)
+{
+  GumSymbolTable * table = user_context;
+  GumLineEntry line;
+
+  line.address = line_info->Address;
+  line.file_name = g_string_chunk_insert_const (table->strings,
+      line_info->FileName);
+  line.line_number = line_info->LineNumber;
+  g_array_append_val (table->lines, line);
+
+  return TRUE;
+}
+
+static gint
+gum_symbol_entry_compare (const GumSymbolEntry * a,
+                          const GumSymbolEntry * b)
+{
+  if (a->address < b->address)
+    return -1;
+
+  if (a->address > b->address)
+    return 1;
+
+  return strcmp (a->name, b->name);
+}
+
+static gint
+gum_line_entry_compare (const GumLineEntry * a,
+                        const GumLineEntry * b)
+{
+  if (a->address < b->address)
+    return -1;
+
+  if (a->address > b->address)
+    return 1;
+
+  return 0;
+}
+
+static gboolean
+gum_get_module_image_details (HMODULE module,
+                              DWORD * size,
+                              DWORD * timestamp)
+{
+  MODULEINFO mi;
+  const IMAGE_DOS_HEADER * dos_header;
+  const IMAGE_NT_HEADERS * nt_headers;
+
+  if (!GetModuleInformation (GetCurrentProcess (), module, &mi, sizeof (mi)))
+    return FALSE;
+
+  dos_header = (const IMAGE_DOS_HEADER *) module;
+  nt_headers = (const IMAGE_NT_HEADERS *)
+      ((const guint8 *) module + dos_header->e_lfanew);
+
+  *size = mi.SizeOfImage;
+  *timestamp = nt_headers->FileHeader.TimeDateStamp;
+
   return TRUE;
 }
 
@@ -182,3 +548,10 @@ is_function (SYMBOL_INFO * sym_info)
 
   return result;
 }
+
+static void
+gum_symbol_util_deinitialize (void)
+{
+  g_hash_table_unref (gum_symbol_tables);
+  gum_symbol_tables = NULL;
+}
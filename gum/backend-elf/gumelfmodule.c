@@ -7,6 +7,7 @@
 #include "gumelfmodule.h"
 
 #include <fcntl.h>
+#include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -15,6 +16,8 @@ typedef struct _GumElfEnumerateDepsContext GumElfEnumerateDepsContext;
 typedef struct _GumElfEnumerateImportsContext GumElfEnumerateImportsContext;
 typedef struct _GumElfEnumerateExportsContext GumElfEnumerateExportsContext;
 typedef struct _GumElfStoreSymtabParamsContext GumElfStoreSymtabParamsContext;
+typedef struct _GumElfStoreLookupParamsContext GumElfStoreLookupParamsContext;
+typedef struct _GumElfStoreRelocParamsContext GumElfStoreRelocParamsContext;
 
 enum
 {
@@ -36,6 +39,8 @@ struct _GumElfEnumerateImportsContext
 {
   GumFoundImportFunc func;
   gpointer user_data;
+
+  GHashTable * slots;
 };
 
 struct _GumElfEnumerateExportsContext
@@ -56,6 +61,31 @@ struct _GumElfStoreSymtabParamsContext
   GumElfModule * module;
 };
 
+struct _GumElfStoreLookupParamsContext
+{
+  gpointer entries;
+  gsize entry_size;
+  const guint32 * gnu_hash;
+  const guint32 * sysv_hash;
+
+  GumElfModule * module;
+};
+
+struct _GumElfStoreRelocParamsContext
+{
+  gpointer plt_entries;
+  gsize plt_size;
+  gboolean plt_is_rela;
+
+  gpointer rela_entries;
+  gsize rela_size;
+
+  gpointer rel_entries;
+  gsize rel_size;
+
+  GumElfModule * module;
+};
+
 struct _GumElfStoreFindStringTableContext
 {
   GumElfModule * module;
@@ -72,8 +102,25 @@ static gboolean gum_emit_each_needed (const GumElfDynamicEntryDetails * details,
     gpointer user_data);
 static gboolean gum_emit_elf_import (const GumElfSymbolDetails * details,
     gpointer user_data);
+static void gum_elf_module_collect_import_slots (GumElfModule * self,
+    GHashTable * slots);
+static void gum_elf_module_collect_import_slots_in (GumElfModule * self,
+    const GumElfStoreSymtabParamsContext * symtab, gconstpointer entries,
+    gsize size, gboolean is_rela, GHashTable * slots);
+static gboolean gum_store_reloc_params (
+    const GumElfDynamicEntryDetails * details, gpointer user_data);
 static gboolean gum_emit_elf_export (const GumElfSymbolDetails * details,
     gpointer user_data);
+static gboolean gum_elf_symbol_is_export (
+    const GumElfSymbolDetails * details);
+static void gum_elf_module_parse_dynamic_symbol (GumElfModule * self,
+    gconstpointer entry, GumElfSymbolDetails * details);
+static gboolean gum_store_lookup_params (
+    const GumElfDynamicEntryDetails * details, gpointer user_data);
+static GumAddress gum_elf_module_find_export_in_gnu_hash (GumElfModule * self,
+    const GumElfStoreLookupParamsContext * params, const gchar * name);
+static GumAddress gum_elf_module_find_export_in_sysv_hash (GumElfModule * self,
+    const GumElfStoreLookupParamsContext * params, const gchar * name);
 static gboolean gum_store_symtab_params (
     const GumElfDynamicEntryDetails * details, gpointer user_data);
 static void gum_elf_module_enumerate_symbols_in_section (GumElfModule * self,
@@ -309,7 +356,12 @@ gum_elf_module_enumerate_imports (GumElfModule * self,
   ctx.func = func;
   ctx.user_data = user_data;
 
+  ctx.slots = g_hash_table_new (g_str_hash, g_str_equal);
+  gum_elf_module_collect_import_slots (self, ctx.slots);
+
   gum_elf_module_enumerate_dynamic_symbols (self, gum_emit_elf_import, &ctx);
+
+  g_hash_table_unref (ctx.slots);
 }
 
 static gboolean
@@ -329,7 +381,7 @@ gum_emit_elf_import (const GumElfSymbolDetails * details,
     d.name = details->name;
     d.module = NULL;
     d.address = 0;
-    d.slot = 0; /* TODO */
+    d.slot = GUM_ADDRESS (g_hash_table_lookup (ctx->slots, details->name));
 
     if (!ctx->func (&d, ctx->user_data))
       return FALSE;
@@ -338,6 +390,156 @@ gum_emit_elf_import (const GumElfSymbolDetails * details,
   return TRUE;
 }
 
+/*
+ * Maps the name of each undefined dynamic symbol to the address the dynamic
+ * linker binds it at, i.e. its GOT slot. PLT relocations are looked at first
+ * so that a function's slot is the one its calls go through, even when its
+ * address is also taken elsewhere in the module.
+ */
+static void
+gum_elf_module_collect_import_slots (GumElfModule * self,
+                                     GHashTable * slots)
+{
+  GumElfStoreSymtabParamsContext symtab;
+  GumElfStoreRelocParamsContext reloc;
+
+  symtab.pending = 3;
+  symtab.found_hash = FALSE;
+
+  symtab.entries = NULL;
+  symtab.entry_size = 0;
+  symtab.entry_count = 0;
+
+  symtab.module = self;
+
+  gum_elf_module_enumerate_dynamic_entries (self, gum_store_symtab_params,
+      &symtab);
+  if (symtab.pending != 0)
+    return;
+
+  reloc.plt_entries = NULL;
+  reloc.plt_size = 0;
+  reloc.plt_is_rela = FALSE;
+
+  reloc.rela_entries = NULL;
+  reloc.rela_size = 0;
+
+  reloc.rel_entries = NULL;
+  reloc.rel_size = 0;
+
+  reloc.module = self;
+
+  gum_elf_module_enumerate_dynamic_entries (self, gum_store_reloc_params,
+      &reloc);
+
+  gum_elf_module_collect_import_slots_in (self, &symtab, reloc.plt_entries,
+      reloc.plt_size, reloc.plt_is_rela, slots);
+  gum_elf_module_collect_import_slots_in (self, &symtab, reloc.rela_entries,
+      reloc.rela_size, TRUE, slots);
+  gum_elf_module_collect_import_slots_in (self, &symtab, reloc.rel_entries,
+      reloc.rel_size, FALSE, slots);
+}
+
+static void
+gum_elf_module_collect_import_slots_in (
+    GumElfModule * self,
+    const GumElfStoreSymtabParamsContext * symtab,
+    gconstpointer entries,
+    gsize size,
+    gboolean is_rela,
+    GHashTable * slots)
+{
+  gsize entry_size, entry_count, entry_index;
+
+  if (entries == NULL)
+    return;
+
+  if (sizeof (gpointer) == 4)
+    entry_size = is_rela ? sizeof (Elf32_Rela) : sizeof (Elf32_Rel);
+  else
+    entry_size = is_rela ? sizeof (Elf64_Rela) : sizeof (Elf64_Rel);
+  entry_count = size / entry_size;
+
+  for (entry_index = 0; entry_index != entry_count; entry_index++)
+  {
+    gconstpointer entry = entries + (entry_index * entry_size);
+    GumAddress offset;
+    gsize symbol_index;
+    GumElfSymbolDetails symbol;
+
+    if (sizeof (gpointer) == 4)
+    {
+      const Elf32_Rel * rel = entry;
+
+      offset = rel->r_offset;
+      symbol_index = ELF32_R_SYM (rel->r_info);
+    }
+    else
+    {
+      const Elf64_Rel * rel = entry;
+
+      offset = rel->r_offset;
+      symbol_index = ELF64_R_SYM (rel->r_info);
+    }
+
+    if (symbol_index == 0 || symbol_index >= symtab->entry_count)
+      continue;
+
+    gum_elf_module_parse_dynamic_symbol (self,
+        symtab->entries + (symbol_index * symtab->entry_size), &symbol);
+    if (symbol.section_header_index != SHN_UNDEF ||
+        g_hash_table_contains (slots, symbol.name))
+    {
+      continue;
+    }
+
+    g_hash_table_insert (slots, (gpointer) symbol.name, GSIZE_TO_POINTER (
+        gum_elf_module_resolve_static_virtual_address (self, offset)));
+  }
+}
+
+static gboolean
+gum_store_reloc_params (const GumElfDynamicEntryDetails * details,
+                        gpointer user_data)
+{
+  GumElfStoreRelocParamsContext * ctx = user_data;
+
+  switch (details->type)
+  {
+    case DT_JMPREL:
+      ctx->plt_entries = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+    case DT_PLTRELSZ:
+      ctx->plt_size = details->value;
+      break;
+    case DT_PLTREL:
+      ctx->plt_is_rela = details->value == DT_RELA;
+      break;
+    case DT_RELA:
+      ctx->rela_entries = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+    case DT_RELASZ:
+      ctx->rela_size = details->value;
+      break;
+    case DT_REL:
+      ctx->rel_entries = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+    case DT_RELSZ:
+      ctx->rel_size = details->value;
+      break;
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
 void
 gum_elf_module_enumerate_exports (GumElfModule * self,
                                   GumFoundExportFunc func,
@@ -388,9 +590,7 @@ gum_emit_elf_export (const GumElfSymbolDetails * details,
 {
   GumElfEnumerateExportsContext * ctx = user_data;
 
-  if (details->section_header_index != SHN_UNDEF &&
-      (details->type == STT_FUNC || details->type == STT_OBJECT) &&
-      (details->bind == STB_GLOBAL || details->bind == STB_WEAK))
+  if (gum_elf_symbol_is_export (details))
   {
     GumExportDetails d;
 
@@ -414,7 +614,6 @@ gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
 {
   GumElfStoreSymtabParamsContext ctx;
   gsize entry_index;
-  const gchar * dynamic_strings = self->dynamic_strings;
 
   ctx.pending = 3;
   ctx.found_hash = FALSE;
@@ -432,40 +631,243 @@ gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
 
   for (entry_index = 1; entry_index != ctx.entry_count; entry_index++)
   {
-    gpointer entry = ctx.entries + (entry_index * ctx.entry_size);
     GumElfSymbolDetails details;
-    GumAddress raw_address;
 
-    if (sizeof (gpointer) == 4)
-    {
-      Elf32_Sym * sym = entry;
+    gum_elf_module_parse_dynamic_symbol (self,
+        ctx.entries + (entry_index * ctx.entry_size), &details);
 
-      details.name = dynamic_strings + sym->st_name;
-      details.type = GELF_ST_TYPE (sym->st_info);
-      details.bind = GELF_ST_BIND (sym->st_info);
-      details.section_header_index = sym->st_shndx;
+    if (!func (&details, user_data))
+      return;
+  }
+}
 
-      raw_address = sym->st_value;
-    }
-    else
+static gboolean
+gum_elf_symbol_is_export (const GumElfSymbolDetails * details)
+{
+  return details->section_header_index != SHN_UNDEF &&
+      (details->type == STT_FUNC || details->type == STT_OBJECT) &&
+      (details->bind == STB_GLOBAL || details->bind == STB_WEAK);
+}
+
+static void
+gum_elf_module_parse_dynamic_symbol (GumElfModule * self,
+                                     gconstpointer entry,
+                                     GumElfSymbolDetails * details)
+{
+  const gchar * dynamic_strings = self->dynamic_strings;
+  GumAddress raw_address;
+
+  if (sizeof (gpointer) == 4)
+  {
+    const Elf32_Sym * sym = entry;
+
+    details->name = dynamic_strings + sym->st_name;
+    details->type = GELF_ST_TYPE (sym->st_info);
+    details->bind = GELF_ST_BIND (sym->st_info);
+    details->section_header_index = sym->st_shndx;
+
+    raw_address = sym->st_value;
+  }
+  else
+  {
+    const Elf64_Sym * sym = entry;
+
+    details->name = dynamic_strings + sym->st_name;
+    details->type = GELF_ST_TYPE (sym->st_info);
+    details->bind = GELF_ST_BIND (sym->st_info);
+    details->section_header_index = sym->st_shndx;
+
+    raw_address = sym->st_value;
+  }
+
+  details->address = (raw_address != 0)
+      ? gum_elf_module_resolve_static_virtual_address (self, raw_address)
+      : 0;
+}
+
+/*
+ * Looks up an export through the module's own symbol hash table, as the
+ * dynamic linker would, without walking the rest of the symbols. Unlike
+ * dlsym() on a handle it never finds symbols in the module's dependencies.
+ */
+GumAddress
+gum_elf_module_find_export_by_name (GumElfModule * self,
+                                    const gchar * name)
+{
+  GumElfStoreLookupParamsContext params;
+
+  if (self->dynamic_strings == NULL)
+    return 0;
+
+  params.entries = NULL;
+  params.entry_size = 0;
+  params.gnu_hash = NULL;
+  params.sysv_hash = NULL;
+
+  params.module = self;
+
+  gum_elf_module_enumerate_dynamic_entries (self, gum_store_lookup_params,
+      &params);
+  if (params.entries == NULL || params.entry_size == 0)
+    return 0;
+
+  if (params.gnu_hash != NULL)
+    return gum_elf_module_find_export_in_gnu_hash (self, &params, name);
+  else if (params.sysv_hash != NULL)
+    return gum_elf_module_find_export_in_sysv_hash (self, &params, name);
+
+  return 0;
+}
+
+static gboolean
+gum_store_lookup_params (const GumElfDynamicEntryDetails * details,
+                         gpointer user_data)
+{
+  GumElfStoreLookupParamsContext * ctx = user_data;
+
+  switch (details->type)
+  {
+    case DT_SYMTAB:
+      ctx->entries = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+    case DT_SYMENT:
+      ctx->entry_size = details->value;
+      break;
+    case DT_HASH:
+      ctx->sysv_hash = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+#ifdef DT_GNU_HASH
+    case DT_GNU_HASH:
+      ctx->gnu_hash = GSIZE_TO_POINTER (
+          gum_elf_module_resolve_dynamic_virtual_address (ctx->module,
+              details->value));
+      break;
+#endif
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+static GumAddress
+gum_elf_module_find_export_in_gnu_hash (
+    GumElfModule * self,
+    const GumElfStoreLookupParamsContext * params,
+    const gchar * name)
+{
+  const guint32 * hash_params = params->gnu_hash;
+  const guint bits_per_word = sizeof (gsize) * 8;
+  guint32 nbuckets, symoffset, bloom_size, bloom_shift;
+  const gsize * bloom;
+  const guint32 * buckets, * chain;
+  guint32 hash, index;
+  const guint8 * p;
+  gsize mask;
+
+  nbuckets = hash_params[0];
+  symoffset = hash_params[1];
+  bloom_size = hash_params[2];
+  bloom_shift = hash_params[3];
+  bloom = (const gsize *) (hash_params + 4);
+  buckets = (const guint32 *) (bloom + bloom_size);
+  chain = buckets + nbuckets;
+
+  if (nbuckets == 0 || bloom_size == 0)
+    return 0;
+
+  hash = 5381;
+  for (p = (const guint8 *) name; *p != '\0'; p++)
+    hash = (hash << 5) + hash + *p;
+
+  mask = ((gsize) 1 << (hash % bits_per_word)) |
+      ((gsize) 1 << ((hash >> bloom_shift) % bits_per_word));
+  if ((bloom[(hash / bits_per_word) % bloom_size] & mask) != mask)
+    return 0;
+
+  index = buckets[hash % nbuckets];
+  if (index < symoffset)
+    return 0;
+
+  while (TRUE)
+  {
+    guint32 chain_hash = chain[index - symoffset];
+
+    if ((chain_hash | 1) == (hash | 1))
     {
-      Elf64_Sym * sym = entry;
+      GumElfSymbolDetails details;
 
-      details.name = dynamic_strings + sym->st_name;
-      details.type = GELF_ST_TYPE (sym->st_info);
-      details.bind = GELF_ST_BIND (sym->st_info);
-      details.section_header_index = sym->st_shndx;
+      gum_elf_module_parse_dynamic_symbol (self,
+          params->entries + (index * params->entry_size), &details);
 
-      raw_address = sym->st_value;
+      if (strcmp (details.name, name) == 0 &&
+          gum_elf_symbol_is_export (&details))
+      {
+        return details.address;
+      }
     }
 
-    details.address = (raw_address != 0)
-        ? gum_elf_module_resolve_static_virtual_address (self, raw_address)
-        : 0;
+    if ((chain_hash & 1) != 0)
+      break;
 
-    if (!func (&details, user_data))
-      return;
+    index++;
+  }
+
+  return 0;
+}
+
+static GumAddress
+gum_elf_module_find_export_in_sysv_hash (
+    GumElfModule * self,
+    const GumElfStoreLookupParamsContext * params,
+    const gchar * name)
+{
+  const guint32 * hash_params = params->sysv_hash;
+  guint32 nbucket;
+  const guint32 * buckets, * chain;
+  guint32 hash, index;
+  const guint8 * p;
+
+  nbucket = hash_params[0];
+  buckets = hash_params + 2;
+  chain = buckets + nbucket;
+
+  if (nbucket == 0)
+    return 0;
+
+  hash = 0;
+  for (p = (const guint8 *) name; *p != '\0'; p++)
+  {
+    guint32 high;
+
+    hash = (hash << 4) + *p;
+    high = hash & 0xf0000000;
+    if (high != 0)
+      hash ^= high >> 24;
+    hash &= ~high;
+  }
+
+  for (index = buckets[hash % nbucket];
+      index != STN_UNDEF;
+      index = chain[index])
+  {
+    GumElfSymbolDetails details;
+
+    gum_elf_module_parse_dynamic_symbol (self,
+        params->entries + (index * params->entry_size), &details);
+
+    if (strcmp (details.name, name) == 0 &&
+        gum_elf_symbol_is_export (&details))
+    {
+      return details.address;
+    }
   }
+
+  return 0;
 }
 
 static gboolean
@@ -110,6 +110,8 @@ void gum_elf_module_enumerate_imports (GumElfModule * self,
     GumFoundImportFunc func, gpointer user_data);
 void gum_elf_module_enumerate_exports (GumElfModule * self,
     GumFoundExportFunc func, gpointer user_data);
+GumAddress gum_elf_module_find_export_by_name (GumElfModule * self,
+    const gchar * name);
 void gum_elf_module_enumerate_dynamic_symbols (GumElfModule * self,
     GumElfFoundSymbolFunc func, gpointer user_data);
 void gum_elf_module_enumerate_symbols (GumElfModule * self,
@@ -22,14 +22,17 @@
 #include <strings.h>
 
 #define GUM_MAX_CACHE_AGE (0.5)
+#define GUM_SYMBOL_CACHE_SIZE 1024
 
 typedef struct _GumModuleEntry GumModuleEntry;
 
 typedef struct _GumNearestSymbolDetails GumNearestSymbolDetails;
-typedef struct _GumDwarfSymbolDetails GumDwarfSymbolDetails;
-typedef struct _GumDwarfSourceDetails GumDwarfSourceDetails;
-typedef struct _GumFindCuDieOperation GumFindCuDieOperation;
-typedef struct _GumFindSymbolOperation GumFindSymbolOperation;
+typedef struct _GumSymbolResolution GumSymbolResolution;
+typedef struct _GumDwarfIndex GumDwarfIndex;
+typedef struct _GumDwarfRange GumDwarfRange;
+typedef struct _GumDwarfUnit GumDwarfUnit;
+typedef struct _GumDwarfSymbol GumDwarfSymbol;
+typedef struct _GumDwarfLine GumDwarfLine;
 
 typedef struct _GumCuDieDetails GumCuDieDetails;
 typedef struct _GumDieDetails GumDieDetails;
@@ -43,6 +46,7 @@ struct _GumModuleEntry
 {
   GumElfModule * module;
   Dwarf_Debug dbg;
+  GumDwarfIndex * index;
   gboolean collected;
 };
 
@@ -52,30 +56,54 @@ struct _GumNearestSymbolDetails
   gpointer address;
 };
 
-struct _GumDwarfSymbolDetails
+struct _GumSymbolResolution
 {
-  gchar * name;
-  guint line_number;
+  gpointer address;
+  GumModuleEntry * entry;
+  GumNearestSymbolDetails nearest;
+  const GumDwarfSymbol * symbol;
+  const GumDwarfLine * line;
 };
 
-struct _GumDwarfSourceDetails
+/*
+ * Everything needed to go from an address to a symbol and source line is
+ * read out of a module's DWARF in one go the first time it's needed: each
+ * compilation unit's address ranges, plus its functions and variables, and
+ * its line program, each sorted by address. A lookup is then a few binary
+ * searches instead of walking DIEs.
+ */
+struct _GumDwarfIndex
 {
-  gchar * path;
-  guint line_number;
+  GArray * ranges;
+  GPtrArray * units;
+  GStringChunk * paths;
 };
 
-struct _GumFindCuDieOperation
+struct _GumDwarfRange
 {
-  Dwarf_Addr needle;
-  gboolean found;
-  Dwarf_Off cu_die_offset;
+  Dwarf_Addr start;
+  Dwarf_Addr end;
+  GumDwarfUnit * unit;
 };
 
-struct _GumFindSymbolOperation
+struct _GumDwarfUnit
 {
-  GumAddress needle;
-  GumDwarfSymbolDetails * symbol;
-  GumAddress closest_address;
+  GArray * symbols;
+  GArray * lines;
+};
+
+struct _GumDwarfSymbol
+{
+  Dwarf_Addr address;
+  gchar * name;
+  guint line_number;
+};
+
+struct _GumDwarfLine
+{
+  Dwarf_Addr address;
+  const gchar * path;
+  guint line_number;
 };
 
 struct _GumCuDieDetails
@@ -97,9 +125,15 @@ static GumModuleEntry * gum_module_entry_from_address (gpointer address,
     GumNearestSymbolDetails * nearest);
 static GumModuleEntry * gum_module_entry_from_path_and_base (const gchar * path,
     GumAddress base_address);
+static GumDwarfIndex * gum_module_entry_get_index (GumModuleEntry * self);
 static Dwarf_Addr gum_module_entry_virtual_address_to_file (
     GumModuleEntry * self, gpointer address);
 
+static gboolean gum_symbol_details_fill (gpointer address,
+    GumDebugSymbolDetails * details);
+static gboolean gum_resolve_symbol (gpointer address,
+    GumSymbolResolution * resolution);
+
 static GHashTable * gum_get_function_addresses (void);
 static gboolean gum_collect_module_functions (const GumModuleDetails * details,
     gpointer user_data);
@@ -111,17 +145,25 @@ static void gum_symbol_util_deinitialize (void);
 
 static void gum_on_dwarf_error (Dwarf_Error error, Dwarf_Ptr errarg);
 
-static Dwarf_Die gum_find_cu_die_by_virtual_address (Dwarf_Debug dbg,
+static GumDwarfIndex * gum_dwarf_index_new (Dwarf_Debug dbg);
+static void gum_dwarf_index_free (GumDwarfIndex * index);
+static gboolean gum_dwarf_index_add_unit (const GumCuDieDetails * details,
+    GumDwarfIndex * self);
+static GumDwarfUnit * gum_dwarf_index_find_unit (GumDwarfIndex * self,
+    Dwarf_Addr address);
+static void gum_dwarf_unit_free (GumDwarfUnit * unit);
+static gboolean gum_dwarf_unit_collect_symbol (const GumDieDetails * details,
+    GumDwarfUnit * self);
+static const GumDwarfSymbol * gum_dwarf_unit_find_symbol (GumDwarfUnit * self,
     Dwarf_Addr address);
-static gboolean gum_store_cu_die_offset_if_containing_address (
-    const GumCuDieDetails * details, GumFindCuDieOperation * op);
-static gboolean gum_find_symbol_by_virtual_address (Dwarf_Debug dbg,
-    Dwarf_Die cu_die, Dwarf_Addr address, GumDwarfSymbolDetails * details);
-static gboolean gum_collect_die_if_closest_so_far (
-    const GumDieDetails * details, GumFindSymbolOperation * op);
-static gboolean gum_find_line_by_virtual_address (Dwarf_Debug dbg,
-    Dwarf_Die cu_die, Dwarf_Addr address, guint symbol_line_number,
-    GumDwarfSourceDetails * details);
+static const GumDwarfLine * gum_dwarf_unit_find_line (GumDwarfUnit * self,
+    Dwarf_Addr address, guint symbol_line_number);
+static gint gum_dwarf_range_compare (const GumDwarfRange * a,
+    const GumDwarfRange * b);
+static gint gum_dwarf_symbol_compare (const GumDwarfSymbol * a,
+    const GumDwarfSymbol * b);
+static gint gum_dwarf_line_compare (const GumDwarfLine * a,
+    const GumDwarfLine * b);
 
 static void gum_enumerate_cu_dies (Dwarf_Debug dbg, gboolean is_info,
     GumFoundCuDieFunc func, gpointer user_data);
@@ -147,92 +189,99 @@ G_LOCK_DEFINE_STATIC (gum_symbol_util);
 static GHashTable * gum_module_entries = NULL;
 static GHashTable * gum_function_addresses = NULL;
 static GTimer * gum_cache_timer = NULL;
+static GumSymbolResolution * gum_symbol_cache = NULL;
 
 gboolean
 gum_symbol_details_from_address (gpointer address,
                                  GumDebugSymbolDetails * details)
 {
   gboolean success;
-  GumModuleEntry * entry;
-  GumNearestSymbolDetails nearest;
-  Dwarf_Addr file_address;
-  Dwarf_Die cu_die;
-  GumDwarfSymbolDetails symbol;
-  GumDwarfSourceDetails source;
-
-  success = FALSE;
 
   G_LOCK (gum_symbol_util);
+  success = gum_symbol_details_fill (address, details);
+  G_UNLOCK (gum_symbol_util);
 
-  entry = gum_module_entry_from_address (address, &nearest);
-  if (entry == NULL)
-    goto entry_not_found;
-  if (entry->dbg == NULL)
-    goto no_debug_info;
-
-  file_address = gum_module_entry_virtual_address_to_file (entry, address);
+  return success;
+}
 
-  cu_die = gum_find_cu_die_by_virtual_address (entry->dbg, file_address);
-  if (cu_die == NULL)
-    goto cu_die_not_found;
+/*
+ * Resolves `n_addresses` addresses into `details`, taking the lock once for
+ * all of them. If `resolved` is non-NULL it records which of them could be
+ * resolved. Returns how many could.
+ */
+guint
+gum_symbol_details_from_addresses (const gpointer * addresses,
+                                   guint n_addresses,
+                                   GumDebugSymbolDetails * details,
+                                   gboolean * resolved)
+{
+  guint n_resolved, i;
 
-  if (!gum_find_symbol_by_virtual_address (entry->dbg, cu_die, file_address,
-      &symbol))
-    goto symbol_not_found;
+  n_resolved = 0;
 
-  if (!gum_find_line_by_virtual_address (entry->dbg, cu_die, file_address,
-      symbol.line_number, &source))
-    goto line_not_found;
+  G_LOCK (gum_symbol_util);
 
-  details->address = GUM_ADDRESS (address);
+  for (i = 0; i != n_addresses; i++)
+  {
+    gboolean success;
 
-  g_strlcpy (details->module_name, entry->module->name,
-      sizeof (details->module_name));
-  g_strlcpy (details->symbol_name, symbol.name, sizeof (details->symbol_name));
+    success = gum_symbol_details_fill (addresses[i], &details[i]);
+    if (success)
+      n_resolved++;
 
-  g_strlcpy (details->file_name, source.path, sizeof (details->file_name));
-  details->line_number = source.line_number;
+    if (resolved != NULL)
+      resolved[i] = success;
+  }
 
-  success = TRUE;
+  G_UNLOCK (gum_symbol_util);
 
-  g_free (source.path);
+  return n_resolved;
+}
 
-line_not_found:
-  g_free (symbol.name);
+static gboolean
+gum_symbol_details_fill (gpointer address,
+                         GumDebugSymbolDetails * details)
+{
+  GumSymbolResolution resolution;
+  GumModuleEntry * entry;
 
-symbol_not_found:
-  dwarf_dealloc (entry->dbg, cu_die, DW_DLA_DIE);
+  if (!gum_resolve_symbol (address, &resolution))
+    return FALSE;
+  entry = resolution.entry;
 
-cu_die_not_found:
-  if (!success)
-    goto no_debug_info;
+  details->address = GUM_ADDRESS (address);
 
-entry_not_found:
-  G_UNLOCK (gum_symbol_util);
+  g_strlcpy (details->module_name, entry->module->name,
+      sizeof (details->module_name));
 
-  return success;
+  if (resolution.symbol != NULL && resolution.line != NULL)
+  {
+    g_strlcpy (details->symbol_name, resolution.symbol->name,
+        sizeof (details->symbol_name));
 
-no_debug_info:
+    g_strlcpy (details->file_name, resolution.line->path,
+        sizeof (details->file_name));
+    details->line_number = resolution.line->line_number;
+  }
+  else
   {
+    const GumNearestSymbolDetails * nearest = &resolution.nearest;
     gsize offset;
 
-    details->address = GUM_ADDRESS (address);
-
-    g_strlcpy (details->module_name, entry->module->name,
-        sizeof (details->module_name));
-    if (nearest.name != NULL)
+    if (nearest->name != NULL)
     {
-      offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
+      offset = GPOINTER_TO_SIZE (address) -
+          GPOINTER_TO_SIZE (nearest->address);
 
       if (offset == 0)
       {
-        g_strlcpy (details->symbol_name, nearest.name,
+        g_strlcpy (details->symbol_name, nearest->name,
             sizeof (details->symbol_name));
       }
       else
       {
         g_snprintf (details->symbol_name, sizeof (details->symbol_name),
-            "%s+0x%" G_GSIZE_MODIFIER "x", nearest.name, offset);
+            "%s+0x%" G_GSIZE_MODIFIER "x", nearest->name, offset);
       }
     }
     else
@@ -245,81 +294,59 @@ no_debug_info:
 
     details->file_name[0] = '\0';
     details->line_number = 0;
-
-    G_UNLOCK (gum_symbol_util);
-
-    return TRUE;
   }
+
+  return TRUE;
 }
 
 gchar *
 gum_symbol_name_from_address (gpointer address)
 {
-  GumDwarfSymbolDetails symbol;
-  GumModuleEntry * entry;
-  GumNearestSymbolDetails nearest;
-  Dwarf_Addr file_address;
-  Dwarf_Die cu_die;
+  gchar * name;
+  GumSymbolResolution resolution;
+  const GumNearestSymbolDetails * nearest;
+  gsize offset;
 
-  symbol.name = NULL;
+  name = NULL;
 
   G_LOCK (gum_symbol_util);
 
-  entry = gum_module_entry_from_address (address, &nearest);
-  if (entry == NULL)
-    goto entry_not_found;
-  if (entry->dbg == NULL)
-    goto no_debug_info;
-
-  file_address = gum_module_entry_virtual_address_to_file (entry, address);
+  if (!gum_resolve_symbol (address, &resolution))
+    goto beach;
 
-  cu_die = gum_find_cu_die_by_virtual_address (entry->dbg, file_address);
-  if (cu_die == NULL)
-    goto cu_die_not_found;
-
-  gum_find_symbol_by_virtual_address (entry->dbg, cu_die, file_address,
-      &symbol);
-
-  dwarf_dealloc (entry->dbg, cu_die, DW_DLA_DIE);
-
-cu_die_not_found:
-  if (symbol.name == NULL)
-    goto no_debug_info;
-
-entry_not_found:
-  G_UNLOCK (gum_symbol_util);
-
-  return symbol.name;
+  if (resolution.symbol != NULL)
+  {
+    name = g_strdup (resolution.symbol->name);
+    goto beach;
+  }
 
-no_debug_info:
+  nearest = &resolution.nearest;
+  if (nearest->name != NULL)
   {
-    gsize offset;
+    offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest->address);
 
-    if (nearest.name != NULL)
+    if (offset == 0)
     {
-      offset = GPOINTER_TO_SIZE (address) - GPOINTER_TO_SIZE (nearest.address);
-
-      if (offset == 0)
-      {
-        symbol.name = g_strdup (nearest.name);
-      }
-      else
-      {
-        symbol.name = g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x",
-            nearest.name, offset);
-      }
+      name = g_strdup (nearest->name);
     }
     else
     {
-      offset = GPOINTER_TO_SIZE (address) - entry->module->base_address;
-
-      symbol.name = g_strdup_printf ("0x%" G_GSIZE_MODIFIER "x", offset);
+      name = g_strdup_printf ("%s+0x%" G_GSIZE_MODIFIER "x",
+          nearest->name, offset);
     }
+  }
+  else
+  {
+    offset = GPOINTER_TO_SIZE (address) -
+        resolution.entry->module->base_address;
 
-    G_UNLOCK (gum_symbol_util);
-
-    return symbol.name;
+    name = g_strdup_printf ("0x%" G_GSIZE_MODIFIER "x", offset);
   }
+
+beach:
+  G_UNLOCK (gum_symbol_util);
+
+  return name;
 }
 
 gpointer
@@ -415,6 +442,66 @@ gum_find_functions_matching (const gchar * str)
   return matches;
 }
 
+/*
+ * Resolutions are remembered in a small direct-mapped cache, as backtraces
+ * tend to hit the same return addresses over and over, and dladdr() is not
+ * cheap either.
+ */
+static gboolean
+gum_resolve_symbol (gpointer address,
+                    GumSymbolResolution * resolution)
+{
+  GumSymbolResolution * cached;
+  GumModuleEntry * entry;
+  GumDwarfIndex * index;
+
+  gum_symbol_util_ensure_initialized ();
+
+  cached = &gum_symbol_cache[((GPOINTER_TO_SIZE (address) >> 2) ^
+      (GPOINTER_TO_SIZE (address) >> 12)) % GUM_SYMBOL_CACHE_SIZE];
+  if (cached->entry != NULL && cached->address == address)
+  {
+    *resolution = *cached;
+    return TRUE;
+  }
+
+  entry = gum_module_entry_from_address (address, &resolution->nearest);
+  if (entry == NULL)
+    return FALSE;
+
+  resolution->address = address;
+  resolution->entry = entry;
+  resolution->symbol = NULL;
+  resolution->line = NULL;
+
+  index = gum_module_entry_get_index (entry);
+  if (index != NULL)
+  {
+    Dwarf_Addr file_address;
+    GumDwarfUnit * unit;
+
+    file_address = gum_module_entry_virtual_address_to_file (entry, address);
+
+    unit = gum_dwarf_index_find_unit (index, file_address);
+    if (unit != NULL)
+    {
+      const GumDwarfSymbol * symbol;
+
+      symbol = gum_dwarf_unit_find_symbol (unit, file_address);
+      if (symbol != NULL && symbol->name != NULL)
+      {
+        resolution->symbol = symbol;
+        resolution->line = gum_dwarf_unit_find_line (unit, file_address,
+            symbol->line_number);
+      }
+    }
+  }
+
+  *cached = *resolution;
+
+  return TRUE;
+}
+
 static GumModuleEntry *
 gum_module_entry_from_address (gpointer address,
                                GumNearestSymbolDetails * nearest)
@@ -480,6 +567,7 @@ gum_module_entry_from_path_and_base (const gchar * path,
   entry = g_slice_new (GumModuleEntry);
   entry->module = module;
   entry->dbg = dbg;
+  entry->index = NULL;
   entry->collected = FALSE;
 
   g_hash_table_insert (gum_module_entries, g_strdup (path), entry);
@@ -488,6 +576,15 @@ have_entry:
   return (entry->module != NULL) ? entry : NULL;
 }
 
+static GumDwarfIndex *
+gum_module_entry_get_index (GumModuleEntry * self)
+{
+  if (self->index == NULL && self->dbg != NULL)
+    self->index = gum_dwarf_index_new (self->dbg);
+
+  return self->index;
+}
+
 static Dwarf_Addr
 gum_module_entry_virtual_address_to_file (GumModuleEntry * self,
                                           gpointer address)
@@ -499,6 +596,9 @@ gum_module_entry_virtual_address_to_file (GumModuleEntry * self,
 static void
 gum_module_entry_free (GumModuleEntry * entry)
 {
+  if (entry->index != NULL)
+    gum_dwarf_index_free (entry->index);
+
   if (entry->dbg != NULL)
     dwarf_finish (entry->dbg, NULL);
 
@@ -615,6 +715,7 @@ gum_symbol_util_ensure_initialized (void)
       (GDestroyNotify) gum_module_entry_free);
   gum_function_addresses = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, (GDestroyNotify) gum_function_addresses_free);
+  gum_symbol_cache = g_new0 (GumSymbolResolution, GUM_SYMBOL_CACHE_SIZE);
 
   _gum_register_destructor (gum_symbol_util_deinitialize);
 }
@@ -624,6 +725,9 @@ gum_symbol_util_deinitialize (void)
 {
   g_clear_pointer (&gum_cache_timer, g_timer_destroy);
 
+  g_free (gum_symbol_cache);
+  gum_symbol_cache = NULL;
+
   g_hash_table_unref (gum_function_addresses);
   gum_function_addresses = NULL;
 
@@ -637,110 +741,183 @@ gum_on_dwarf_error (Dwarf_Error error,
 {
 }
 
-static Dwarf_Die
-gum_find_cu_die_by_virtual_address (Dwarf_Debug dbg,
-                                    Dwarf_Addr address)
+static GumDwarfIndex *
+gum_dwarf_index_new (Dwarf_Debug dbg)
 {
-  Dwarf_Die result;
-  GumFindCuDieOperation op;
+  GumDwarfIndex * index;
 
-  op.needle = address;
-  op.found = FALSE;
-  op.cu_die_offset = 0;
+  index = g_slice_new (GumDwarfIndex);
+  index->ranges = g_array_new (FALSE, FALSE, sizeof (GumDwarfRange));
+  index->units = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_dwarf_unit_free);
+  index->paths = g_string_chunk_new (4096);
 
   gum_enumerate_cu_dies (dbg, TRUE,
-      (GumFoundCuDieFunc) gum_store_cu_die_offset_if_containing_address, &op);
+      (GumFoundCuDieFunc) gum_dwarf_index_add_unit, index);
 
-  if (!op.found)
-    return NULL;
+  g_array_sort (index->ranges, (GCompareFunc) gum_dwarf_range_compare);
 
-  result = NULL;
-  dwarf_offdie (dbg, op.cu_die_offset, &result, NULL);
+  return index;
+}
 
-  return result;
+static void
+gum_dwarf_index_free (GumDwarfIndex * index)
+{
+  g_string_chunk_free (index->paths);
+  g_ptr_array_unref (index->units);
+  g_array_free (index->ranges, TRUE);
+
+  g_slice_free (GumDwarfIndex, index);
 }
 
 static gboolean
-gum_store_cu_die_offset_if_containing_address (const GumCuDieDetails * details,
-                                               GumFindCuDieOperation * op)
+gum_dwarf_index_add_unit (const GumCuDieDetails * details,
+                          GumDwarfIndex * self)
 {
   Dwarf_Debug dbg = details->dbg;
-  Dwarf_Die die = details->cu_die;
+  Dwarf_Die cu_die = details->cu_die;
+  GumDwarfUnit * unit;
+  guint n_ranges_before;
   Dwarf_Off ranges_offset;
   Dwarf_Ranges * ranges;
   Dwarf_Signed range_count, range_index;
+  Dwarf_Line * lines;
+  Dwarf_Signed line_count, line_index;
 
-  if (!gum_read_attribute_offset (dbg, die, DW_AT_ranges, &ranges_offset))
-    goto skip;
+  unit = g_slice_new (GumDwarfUnit);
+  unit->symbols = g_array_new (FALSE, FALSE, sizeof (GumDwarfSymbol));
+  unit->lines = g_array_new (FALSE, FALSE, sizeof (GumDwarfLine));
 
-  if (dwarf_get_ranges_a (dbg, ranges_offset, die, &ranges, &range_count, NULL,
-      NULL) != DW_DLV_OK)
-    goto skip;
+  n_ranges_before = self->ranges->len;
 
-  for (range_index = 0; range_index < range_count; range_index++)
+  if (gum_read_attribute_offset (dbg, cu_die, DW_AT_ranges, &ranges_offset) &&
+      dwarf_get_ranges_a (dbg, ranges_offset, cu_die, &ranges, &range_count,
+      NULL, NULL) == DW_DLV_OK)
   {
-    Dwarf_Ranges * range = &ranges[range_index];
-
-    if (range->dwr_type != DW_RANGES_ENTRY)
-      break;
-
-    if (op->needle >= range->dwr_addr1 && op->needle < range->dwr_addr2)
+    for (range_index = 0; range_index < range_count; range_index++)
     {
-      op->found = TRUE;
-      dwarf_dieoffset (die, &op->cu_die_offset, NULL);
+      Dwarf_Ranges * range = &ranges[range_index];
+      GumDwarfRange r;
 
-      break;
+      if (range->dwr_type != DW_RANGES_ENTRY)
+        break;
+
+      r.start = range->dwr_addr1;
+      r.end = range->dwr_addr2;
+      r.unit = unit;
+      g_array_append_val (self->ranges, r);
     }
+
+    dwarf_ranges_dealloc (dbg, ranges, range_count);
+  }
+
+  if (self->ranges->len == n_ranges_before)
+  {
+    gum_dwarf_unit_free (unit);
+    return TRUE;
+  }
+
+  g_ptr_array_add (self->units, unit);
+
+  gum_enumerate_dies (dbg, cu_die,
+      (GumFoundDieFunc) gum_dwarf_unit_collect_symbol, unit);
+  g_array_sort (unit->symbols, (GCompareFunc) gum_dwarf_symbol_compare);
+
+  if (dwarf_srclines (cu_die, &lines, &line_count, NULL) != DW_DLV_OK)
+    return TRUE;
+
+  for (line_index = 0; line_index != line_count; line_index++)
+  {
+    Dwarf_Line line = lines[line_index];
+    GumDwarfLine l;
+    Dwarf_Unsigned line_number;
+    char * path;
+
+    if (dwarf_lineaddr (line, &l.address, NULL) != DW_DLV_OK)
+      continue;
+
+    if (dwarf_lineno (line, &line_number, NULL) != DW_DLV_OK)
+      continue;
+
+    if (dwarf_linesrc (line, &path, NULL) != DW_DLV_OK)
+      continue;
+
+    l.path = g_string_chunk_insert_const (self->paths, path);
+    l.line_number = line_number;
+    g_array_append_val (unit->lines, l);
+
+    dwarf_dealloc (dbg, path, DW_DLA_STRING);
   }
 
-  dwarf_ranges_dealloc (dbg, ranges, range_count);
+  dwarf_srclines_dealloc (dbg, lines, line_count);
+
+  g_array_sort (unit->lines, (GCompareFunc) gum_dwarf_line_compare);
 
-skip:
-  return !op->found;
+  return TRUE;
 }
 
-static gboolean
-gum_find_symbol_by_virtual_address (Dwarf_Debug dbg,
-                                    Dwarf_Die cu_die,
-                                    Dwarf_Addr address,
-                                    GumDwarfSymbolDetails * details)
+static GumDwarfUnit *
+gum_dwarf_index_find_unit (GumDwarfIndex * self,
+                           Dwarf_Addr address)
 {
-  GumFindSymbolOperation op;
+  GArray * ranges = self->ranges;
+  guint lower, upper;
+  const GumDwarfRange * range;
 
-  details->name = NULL;
-  details->line_number = 0;
+  lower = 0;
+  upper = ranges->len;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
 
-  op.needle = address;
-  op.symbol = details;
-  op.closest_address = 0;
+    if (g_array_index (ranges, GumDwarfRange, mid).start <= address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
 
-  gum_enumerate_dies (dbg, cu_die,
-      (GumFoundDieFunc) gum_collect_die_if_closest_so_far, &op);
+  if (lower == 0)
+    return NULL;
+
+  range = &g_array_index (ranges, GumDwarfRange, lower - 1);
+  if (address >= range->end)
+    return NULL;
+
+  return range->unit;
+}
+
+static void
+gum_dwarf_unit_free (GumDwarfUnit * unit)
+{
+  guint i;
 
-  return details->name != NULL;
+  for (i = 0; i != unit->symbols->len; i++)
+    g_free (g_array_index (unit->symbols, GumDwarfSymbol, i).name);
+  g_array_free (unit->symbols, TRUE);
+
+  g_array_free (unit->lines, TRUE);
+
+  g_slice_free (GumDwarfUnit, unit);
 }
 
 static gboolean
-gum_collect_die_if_closest_so_far (const GumDieDetails * details,
-                                   GumFindSymbolOperation * op)
+gum_dwarf_unit_collect_symbol (const GumDieDetails * details,
+                               GumDwarfUnit * self)
 {
   Dwarf_Debug dbg = details->dbg;
   Dwarf_Die die = details->die;
-  GumDwarfSymbolDetails * symbol = op->symbol;
-  Dwarf_Half tag;
-  Dwarf_Addr address;
+  GumDwarfSymbol symbol;
+  Dwarf_Unsigned line_number;
 
-  if (dwarf_tag (die, &tag, NULL) != DW_DLV_OK)
-    return TRUE;
-
-  if (tag == DW_TAG_subprogram)
+  if (details->tag == DW_TAG_subprogram)
   {
-    if (!gum_read_attribute_address (dbg, die, DW_AT_low_pc, &address))
+    if (!gum_read_attribute_address (dbg, die, DW_AT_low_pc, &symbol.address))
       return TRUE;
   }
-  else if (tag == DW_TAG_variable)
+  else if (details->tag == DW_TAG_variable)
   {
-    if (!gum_read_attribute_location (dbg, die, DW_AT_location, &address))
+    if (!gum_read_attribute_location (dbg, die, DW_AT_location,
+        &symbol.address))
       return TRUE;
   }
   else
@@ -748,80 +925,118 @@ gum_collect_die_if_closest_so_far (const GumDieDetails * details,
     return TRUE;
   }
 
-  if (op->needle < address)
-    return TRUE;
-
-  if (op->closest_address == 0 ||
-      (op->needle - address) < (op->needle - op->closest_address))
-  {
-    Dwarf_Unsigned line_number;
-
-    op->closest_address = address;
+  symbol.name = NULL;
+  gum_read_die_name (dbg, die, &symbol.name);
 
-    g_clear_pointer (&symbol->name, g_free);
-    gum_read_die_name (dbg, die, &symbol->name);
+  symbol.line_number =
+      gum_read_attribute_uint (dbg, die, DW_AT_decl_line, &line_number)
+      ? line_number
+      : 0;
 
-    if (gum_read_attribute_uint (dbg, die, DW_AT_decl_line, &line_number))
-    {
-      symbol->line_number = line_number;
-    }
-  }
+  g_array_append_val (self->symbols, symbol);
 
   return TRUE;
 }
 
-static gboolean
-gum_find_line_by_virtual_address (Dwarf_Debug dbg,
-                                  Dwarf_Die cu_die,
-                                  Dwarf_Addr address,
-                                  guint symbol_line_number,
-                                  GumDwarfSourceDetails * details)
+/*
+ * Finds the closest symbol at or below `address`, preferring the first one
+ * when several share the same address.
+ */
+static const GumDwarfSymbol *
+gum_dwarf_unit_find_symbol (GumDwarfUnit * self,
+                            Dwarf_Addr address)
 {
-  gboolean success;
-  Dwarf_Line * lines;
-  Dwarf_Signed line_count, line_index;
-
-  if (dwarf_srclines (cu_die, &lines, &line_count, NULL) != DW_DLV_OK)
-    return FALSE;
-
-  success = FALSE;
+  GArray * symbols = self->symbols;
+  guint lower, upper;
 
-  for (line_index = 0; line_index != line_count; line_index++)
+  lower = 0;
+  upper = symbols->len;
+  while (lower != upper)
   {
-    Dwarf_Line line = lines[line_index];
-    Dwarf_Addr line_address;
+    guint mid = lower + ((upper - lower) / 2);
 
-    if (dwarf_lineaddr (line, &line_address, NULL) != DW_DLV_OK)
-      continue;
+    if (g_array_index (symbols, GumDwarfSymbol, mid).address <= address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
 
-    if (line_address >= address)
-    {
-      Dwarf_Unsigned line_number;
-      char * path;
+  if (lower == 0)
+    return NULL;
+  lower--;
 
-      if (dwarf_lineno (line, &line_number, NULL) != DW_DLV_OK)
-        continue;
+  while (lower != 0 &&
+      g_array_index (symbols, GumDwarfSymbol, lower - 1).address ==
+      g_array_index (symbols, GumDwarfSymbol, lower).address)
+  {
+    lower--;
+  }
 
-      if (line_number < symbol_line_number)
-        continue;
+  return &g_array_index (symbols, GumDwarfSymbol, lower);
+}
 
-      if (dwarf_linesrc (line, &path, NULL) != DW_DLV_OK)
-        continue;
+static const GumDwarfLine *
+gum_dwarf_unit_find_line (GumDwarfUnit * self,
+                          Dwarf_Addr address,
+                          guint symbol_line_number)
+{
+  GArray * lines = self->lines;
+  guint lower, upper, i;
 
-      details->path = g_strdup (path);
-      details->line_number = line_number;
+  lower = 0;
+  upper = lines->len;
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
 
-      success = TRUE;
+    if (g_array_index (lines, GumDwarfLine, mid).address < address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
 
-      dwarf_dealloc (dbg, path, DW_DLA_STRING);
+  for (i = lower; i != lines->len; i++)
+  {
+    const GumDwarfLine * line = &g_array_index (lines, GumDwarfLine, i);
 
-      break;
-    }
+    if (line->line_number >= symbol_line_number)
+      return line;
   }
 
-  dwarf_srclines_dealloc (dbg, lines, line_count);
+  return NULL;
+}
 
-  return success;
+static gint
+gum_dwarf_range_compare (const GumDwarfRange * a,
+                         const GumDwarfRange * b)
+{
+  if (a->start < b->start)
+    return -1;
+  else if (a->start > b->start)
+    return 1;
+  return 0;
+}
+
+static gint
+gum_dwarf_symbol_compare (const GumDwarfSymbol * a,
+                          const GumDwarfSymbol * b)
+{
+  if (a->address < b->address)
+    return -1;
+  else if (a->address > b->address)
+    return 1;
+  return 0;
+}
+
+static gint
+gum_dwarf_line_compare (const GumDwarfLine * a,
+                        const GumDwarfLine * b)
+{
+  if (a->address < b->address)
+    return -1;
+  else if (a->address > b->address)
+    return 1;
+  return 0;
 }
 
 static void
@@ -35,6 +35,15 @@ G_DEFINE_TYPE_EXTENDED (GumUnwBacktracer,
 static void
 gum_unw_backtracer_class_init (GumUnwBacktracerClass * klass)
 {
+  /*
+   * libunwind can remember the unwind info it looked up for each module, as
+   * well as the register rules it derived for each PC, so that it neither
+   * walks dl_iterate_phdr() nor interprets CFI again when unwinding through
+   * code it has seen before. It is smart enough to notice when modules have
+   * been loaded or unloaded. Keeping the cache per-thread means capturing a
+   * backtrace never needs to take a lock, which matters on the malloc path.
+   */
+  unw_set_caching_policy (unw_local_addr_space, UNW_CACHE_PER_THREAD);
 }
 
 static void
@@ -66,6 +75,7 @@ gum_unw_backtracer_generate (GumBacktracer * backtracer,
   unw_cursor_t cursor;
   guint start_index, i;
   GumInvocationStack * invocation_stack;
+  guint invocation_depth = 0;
 
   if (cpu_context != NULL)
   {
@@ -112,8 +122,8 @@ gum_unw_backtracer_generate (GumBacktracer * backtracer,
   invocation_stack = gum_interceptor_get_current_stack ();
   for (i = 0; i != return_addresses->len; i++)
   {
-    return_addresses->items[i] = gum_invocation_stack_translate (
-        invocation_stack, return_addresses->items[i]);
+    return_addresses->items[i] = gum_invocation_stack_translate_next (
+        invocation_stack, return_addresses->items[i], &invocation_depth);
   }
 }
 
@@ -107,6 +107,22 @@ gum_try_mprotect (gpointer address,
   return result == 0;
 }
 
+/*
+ * Lets the kernel back the range with transparent huge pages, which only
+ * applies to the parts of it that are aligned to the huge page size. Fails
+ * where the kernel was built without support for them.
+ */
+gboolean
+gum_memory_advise_huge_pages (gpointer base,
+                              gsize size)
+{
+#ifdef MADV_HUGEPAGE
+  return madvise (base, size, MADV_HUGEPAGE) == 0;
+#else
+  return FALSE;
+#endif
+}
+
 void
 gum_clear_cache (gpointer address,
                  gsize size)
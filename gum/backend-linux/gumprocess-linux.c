@@ -6,13 +6,17 @@
 
 #include "gumprocess-priv.h"
 
+#include "gum-init.h"
+
 #include "backend-elf/gumelfmodule.h"
 #include "gumlinux.h"
 #include "gummodulemap.h"
+#include "gummodulesnapshot.h"
 #include "valgrind.h"
 
 #include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <link.h>
 #include <sched.h>
 #include <stdio.h>
@@ -39,6 +43,17 @@
 #define GUM_MAPS_LINE_SIZE (1024 + PATH_MAX)
 #define GUM_PSR_THUMB 0x20
 
+#define GUM_MALLOC_SIZE_SZ sizeof (gsize)
+#define GUM_MALLOC_MIN_CHUNK_SIZE (4 * GUM_MALLOC_SIZE_SZ)
+#define GUM_MALLOC_CHUNK_STEP (2 * GUM_MALLOC_SIZE_SZ)
+#define GUM_MALLOC_PREV_INUSE 0x1
+#define GUM_MALLOC_IS_MMAPPED 0x2
+#define GUM_MALLOC_SIZE_BITS 0x7
+#define GUM_MALLOC_HEAP_MAX_SIZE (2 * (GLIB_SIZEOF_VOID_P == 8 \
+    ? 4 * 1024 * 1024 * sizeof (glong) \
+    : 512 * 1024))
+#define GUM_MALLOC_HEAD_SEARCH_WINDOW 4096
+
 #if defined (HAVE_I386)
 # define GumRegs struct user_regs_struct
 #elif defined (HAVE_ARM)
@@ -65,6 +80,18 @@
 #ifndef NT_PRSTATUS
 # define NT_PRSTATUS 1
 #endif
+#ifndef PTRACE_PEEKUSER
+# define PTRACE_PEEKUSER 3
+#endif
+#ifndef PTRACE_POKEUSER
+# define PTRACE_POKEUSER 6
+#endif
+#define GUM_NT_ARM_HW_WATCH 0x403
+
+#if defined (HAVE_I386)
+# define GUM_DEBUG_REGISTER_OFFSET(n) \
+    (G_STRUCT_OFFSET (struct user, u_debugreg) + ((n) * sizeof (gsize)))
+#endif
 
 #define GUM_TEMP_FAILURE_RETRY(expression) \
   ({ \
@@ -77,22 +104,34 @@
   })
 
 typedef struct _GumModifyThreadContext GumModifyThreadContext;
+typedef struct _GumModifiedThread GumModifiedThread;
 typedef guint8 GumModifyThreadAck;
+typedef guint8 GumModifyThreadStatus;
 
+typedef struct _GumLinuxDirent64 GumLinuxDirent64;
+typedef struct _GumEnumerateThreadsContext GumEnumerateThreadsContext;
 typedef struct _GumEnumerateModulesContext GumEnumerateModulesContext;
-typedef struct _GumEmitExecutableModuleContext GumEmitExecutableModuleContext;
+typedef struct _GumLoaderGeneration GumLoaderGeneration;
+#ifdef HAVE_ANDROID
+typedef struct _GumAndroidDlPhdrInfo GumAndroidDlPhdrInfo;
+#endif
+typedef struct _GumCopyExecutableModuleContext GumCopyExecutableModuleContext;
 typedef struct _GumCopyLinkerModuleContext GumCopyLinkerModuleContext;
 typedef struct _GumEnumerateImportsContext GumEnumerateImportsContext;
-typedef struct _GumDependencyExport GumDependencyExport;
 typedef struct _GumEnumerateModuleSymbolContext GumEnumerateModuleSymbolContext;
 typedef struct _GumEnumerateModuleRangesContext GumEnumerateModuleRangesContext;
 typedef struct _GumResolveModuleNameContext GumResolveModuleNameContext;
+typedef struct _GumEnumerateMallocRangesContext GumEnumerateMallocRangesContext;
+typedef struct _GumMallocHeapInfo GumMallocHeapInfo;
 
 typedef gint (* GumFoundDlPhdrFunc) (struct dl_phdr_info * info,
     gsize size, gpointer data);
 typedef void (* GumDlIteratePhdrImpl) (GumFoundDlPhdrFunc func, gpointer data);
 
 typedef struct _GumUserDesc GumUserDesc;
+#ifdef HAVE_ARM64
+typedef struct _GumArm64HwDebugState GumArm64HwDebugState;
+#endif
 
 typedef gint (* GumCloneFunc) (gpointer arg);
 
@@ -102,18 +141,58 @@ enum _GumModifyThreadAck
   GUM_ACK_STOPPED,
   GUM_ACK_READ_CONTEXT,
   GUM_ACK_MODIFIED_CONTEXT,
-  GUM_ACK_WROTE_CONTEXT,
-  GUM_ACK_FAILED_TO_ATTACH,
-  GUM_ACK_FAILED_TO_READ,
-  GUM_ACK_FAILED_TO_WRITE,
-  GUM_ACK_FAILED_TO_DETACH
+  GUM_ACK_WROTE_CONTEXT
+};
+
+enum _GumModifyThreadStatus
+{
+  GUM_MODIFY_THREAD_PENDING,
+  GUM_MODIFY_THREAD_ATTACHED,
+  GUM_MODIFY_THREAD_GONE,
+  GUM_MODIFY_THREAD_STOPPED,
+  GUM_MODIFY_THREAD_READ,
+  GUM_MODIFY_THREAD_WRITTEN
 };
 
 struct _GumModifyThreadContext
 {
   gint fd[2];
+
+  GumModifyThreadFunc func;
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  GumModifyDebugRegistersFunc debug_func;
+#endif
+  gpointer user_data;
+
+  GumModifiedThread * threads;
+  guint num_threads;
+};
+
+struct _GumModifiedThread
+{
   GumThreadId thread_id;
+  volatile GumModifyThreadStatus status;
+
+  GumRegs regs;
   GumCpuContext cpu_context;
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  GumDebugRegisters debug_registers;
+#endif
+};
+
+struct _GumLinuxDirent64
+{
+  guint64 d_ino;
+  gint64 d_off;
+  guint16 d_reclen;
+  guint8 d_type;
+  gchar d_name[1];
+};
+
+struct _GumEnumerateThreadsContext
+{
+  GHashTable * threads;
+  GPtrArray * captured;
 };
 
 struct _GumEnumerateModulesContext
@@ -121,6 +200,7 @@ struct _GumEnumerateModulesContext
   GumFoundModuleFunc func;
   gpointer user_data;
 
+  GumDlIteratePhdrImpl iterate_phdr;
   GHashTable * names;
   GHashTable * sizes;
 
@@ -129,13 +209,36 @@ struct _GumEnumerateModulesContext
   GumModuleDetails * linker_module;
 };
 
-struct _GumEmitExecutableModuleContext
+struct _GumLoaderGeneration
 {
-  const gchar * executable_path;
-  GumFoundModuleFunc func;
-  gpointer user_data;
+  gboolean known;
+  guint64 adds;
+  guint64 subs;
+};
 
-  gboolean carry_on;
+#ifdef HAVE_ANDROID
+
+/*
+ * Bionic has the same counters as glibc since Android 11, but older NDK
+ * headers lack them, so we mirror its layout and look at the size we are
+ * given to tell whether they are there.
+ */
+struct _GumAndroidDlPhdrInfo
+{
+  ElfW(Addr) dlpi_addr;
+  const char * dlpi_name;
+  const ElfW(Phdr) * dlpi_phdr;
+  ElfW(Half) dlpi_phnum;
+  unsigned long long dlpi_adds;
+  unsigned long long dlpi_subs;
+};
+
+#endif
+
+struct _GumCopyExecutableModuleContext
+{
+  const gchar * executable_path;
+  GumModuleDetails * executable_module;
 };
 
 struct _GumCopyLinkerModuleContext
@@ -149,17 +252,10 @@ struct _GumEnumerateImportsContext
   GumFoundImportFunc func;
   gpointer user_data;
 
-  GHashTable * dependency_exports;
-  GumElfModule * current_dependency;
+  GPtrArray * dependencies;
   GumModuleMap * module_map;
 };
 
-struct _GumDependencyExport
-{
-  gchar * module;
-  GumAddress address;
-};
-
 struct _GumEnumerateModuleSymbolContext
 {
   GumFoundSymbolFunc func;
@@ -182,6 +278,23 @@ struct _GumResolveModuleNameContext
   GumAddress base;
 };
 
+struct _GumEnumerateMallocRangesContext
+{
+  GumFoundMallocRangeFunc func;
+  gpointer user_data;
+  gboolean carry_on;
+
+  GumAddress brk_end;
+};
+
+struct _GumMallocHeapInfo
+{
+  gpointer ar_ptr;
+  GumMallocHeapInfo * prev;
+  gsize size;
+  gsize mprotect_size;
+};
+
 struct _GumUserDesc
 {
   guint entry_number;
@@ -195,13 +308,37 @@ struct _GumUserDesc
   guint useable : 1;
 };
 
-static gint gum_do_modify_thread (gpointer data);
+#ifdef HAVE_ARM64
+
+struct _GumArm64HwDebugState
+{
+  guint32 dbg_info;
+  guint32 pad;
+
+  struct
+  {
+    guint64 addr;
+    guint32 ctrl;
+    guint32 pad;
+  } dbg_regs[GUM_MAX_DEBUG_WATCHPOINTS];
+};
+
+#endif
+
+static guint gum_modify_threads_using_helper (GumModifyThreadContext * ctx);
+static void gum_await_threads_stopped (GumModifyThreadContext * ctx);
+static gint gum_do_modify_threads (gpointer data);
+static gboolean gum_read_modified_thread (GumModifyThreadContext * ctx,
+    GumModifiedThread * thread);
+static gboolean gum_write_modified_thread (GumModifyThreadContext * ctx,
+    GumModifiedThread * thread);
 static gboolean gum_await_ack (gint fd, GumModifyThreadAck expected_ack);
 static void gum_put_ack (gint fd, GumModifyThreadAck ack);
 
 static void gum_store_cpu_context (GumThreadId thread_id,
     GumCpuContext * cpu_context, gpointer user_data);
 
+static GumDlIteratePhdrImpl gum_resolve_dl_iterate_phdr (void);
 static void gum_process_enumerate_modules_by_using_libc (
     GumDlIteratePhdrImpl iterate_phdr, GumFoundModuleFunc func,
     gpointer user_data);
@@ -209,33 +346,43 @@ static gint gum_emit_module_from_phdr (struct dl_phdr_info * info, gsize size,
     gpointer user_data);
 static GumAddress gum_resolve_base_address_from_phdr (
     struct dl_phdr_info * info);
+static void gum_enumerate_modules_context_ensure_indexes (
+    GumEnumerateModulesContext * ctx);
+#ifdef HAVE_ANDROID
+static gsize gum_resolve_module_size_from_phdr (struct dl_phdr_info * info,
+    GumAddress base_address);
+static const GumModuleDetails * gum_process_query_linker_module (void);
+#endif
 #ifndef HAVE_ANDROID
-static gboolean gum_emit_executable_module (const GumModuleDetails * details,
+static const GumModuleDetails * gum_process_query_executable_module (void);
+static gboolean gum_copy_executable_module (const GumModuleDetails * details,
     gpointer user_data);
 #endif
 
 static void gum_process_enumerate_modules_by_parsing_proc_maps (
     GumFoundModuleFunc func, gpointer user_data);
 
+static void gum_process_obtain_named_range_indexes (
+    GumDlIteratePhdrImpl iterate_phdr, GHashTable ** names,
+    GHashTable ** sizes);
+static gint gum_read_loader_generation (struct dl_phdr_info * info,
+    gsize size, gpointer user_data);
 static void gum_process_build_named_range_indexes (GHashTable ** names,
     GHashTable ** sizes);
+static void gum_module_cache_ensure_destructor (void);
+static void gum_module_cache_deinit (void);
 #ifdef HAVE_ANDROID
 static gboolean gum_copy_linker_module (const GumModuleDetails * details,
     gpointer user_data);
+#endif
 static GumModuleDetails * gum_module_details_dup (
     const GumModuleDetails * module);
 static void gum_module_details_free (GumModuleDetails * module);
-#endif
 
 static gboolean gum_emit_import (const GumImportDetails * details,
     gpointer user_data);
-static gboolean gum_collect_dependency_exports (
-    const GumElfDependencyDetails * details, gpointer user_data);
-static gboolean gum_collect_dependency_export (const GumExportDetails * details,
+static gboolean gum_collect_dependency (const GumElfDependencyDetails * details,
     gpointer user_data);
-static GumDependencyExport * gum_dependency_export_new (const gchar * module,
-    GumAddress address);
-static void gum_dependency_export_free (GumDependencyExport * export);
 static gboolean gum_emit_symbol (const GumElfSymbolDetails * details,
     gpointer user_data);
 static gboolean gum_append_symbol_section (const GumElfSectionDetails * details,
@@ -256,6 +403,20 @@ static GumElfModule * gum_open_elf_module (const gchar * name);
 static gboolean gum_module_name_is_android_linker (const gchar * name);
 #endif
 
+#ifdef HAVE_GLIBC
+static gboolean gum_malloc_is_glibc (void);
+static gboolean gum_emit_malloc_ranges_in_mapping (
+    const GumRangeDetails * details, gpointer user_data);
+static void gum_emit_malloc_ranges_in_arena_heap (
+    GumEnumerateMallocRangesContext * ctx, GumAddress lower_bound,
+    GumAddress end);
+static void gum_emit_malloc_ranges_in_mmapped_chunks (
+    GumEnumerateMallocRangesContext * ctx, GumAddress start, GumAddress end);
+static gboolean gum_malloc_chunks_are_linked (GumAddress start,
+    GumAddress end);
+#endif
+
+static GArray * gum_list_thread_ids (void);
 static gboolean gum_thread_read_state (GumThreadId tid, GumThreadState * state);
 static GumThreadState gum_thread_state_from_proc_status_character (gchar c);
 static GumPageProtection gum_page_protection_from_proc_perms_string (
@@ -263,6 +424,10 @@ static GumPageProtection gum_page_protection_from_proc_perms_string (
 
 static gssize gum_get_regs (pid_t pid, GumRegs * regs);
 static gssize gum_set_regs (pid_t pid, const GumRegs * regs);
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+static gssize gum_get_debug_regs (pid_t pid, GumDebugRegisters * regs);
+static gssize gum_set_debug_regs (pid_t pid, const GumDebugRegisters * regs);
+#endif
 
 static void gum_parse_regs (const GumRegs * regs, GumCpuContext * ctx);
 static void gum_unparse_regs (const GumCpuContext * ctx, GumRegs * regs);
@@ -280,6 +445,23 @@ static gssize gum_libc_syscall_4 (gsize n, gsize a, gsize b, gsize c, gsize d);
 
 static gboolean gum_is_regset_supported = TRUE;
 
+/*
+ * Building the path and size indexes means parsing all of /proc/self/maps,
+ * so they are kept around until the dynamic linker reports that objects have
+ * been loaded or unloaded since. The executable never moves and is only
+ * looked up once, as is the Android linker.
+ */
+static GMutex gum_module_cache_lock;
+static gboolean gum_module_cache_destructor_registered = FALSE;
+static GumLoaderGeneration gum_module_cache_generation;
+static GHashTable * gum_module_cache_names = NULL;
+static GHashTable * gum_module_cache_sizes = NULL;
+#ifndef HAVE_ANDROID
+static GumModuleDetails * gum_module_cache_executable = NULL;
+#else
+static GumModuleDetails * gum_module_cache_linker = NULL;
+#endif
+
 gboolean
 gum_process_is_debugger_attached (void)
 {
@@ -342,176 +524,340 @@ gum_process_modify_thread (GumThreadId thread_id,
   }
   else
   {
+    GumModifiedThread thread = { 0, };
     GumModifyThreadContext ctx;
-    gint res, fd;
-    gssize child;
-    gpointer stack, tls;
-    GumUserDesc * desc;
 
-    res = socketpair (AF_UNIX, SOCK_STREAM, 0, ctx.fd);
-    g_assert_cmpint (res, ==, 0);
-    ctx.thread_id = thread_id;
+    thread.thread_id = thread_id;
+
+    ctx.func = func;
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+    ctx.debug_func = NULL;
+#endif
+    ctx.user_data = user_data;
+    ctx.threads = &thread;
+    ctx.num_threads = 1;
+
+    success = gum_modify_threads_using_helper (&ctx) == 1;
+  }
+
+  return success;
+}
+
+/*
+ * All of the threads are kept stopped while func is called for each of
+ * them, so func must not take locks that any of them might be holding.
+ */
+guint
+gum_process_modify_threads (const GumThreadId * thread_ids,
+                            guint num_threads,
+                            GumModifyThreadFunc func,
+                            gpointer user_data)
+{
+  guint num_modified = 0;
+  GumThreadId current_thread_id;
+  gboolean includes_current_thread = FALSE;
+  GumModifyThreadContext ctx;
+  guint i;
+
+  current_thread_id = gum_process_get_current_thread_id ();
 
-    fd = ctx.fd[0];
+  ctx.func = func;
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  ctx.debug_func = NULL;
+#endif
+  ctx.user_data = user_data;
+  ctx.threads = g_new0 (GumModifiedThread, num_threads);
+  ctx.num_threads = 0;
 
-    stack = gum_alloc_n_pages (1, GUM_PAGE_RW);
-    tls = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  for (i = 0; i != num_threads; i++)
+  {
+    if (thread_ids[i] == current_thread_id)
+      includes_current_thread = TRUE;
+    else
+      ctx.threads[ctx.num_threads++].thread_id = thread_ids[i];
+  }
+
+  if (ctx.num_threads != 0)
+    num_modified += gum_modify_threads_using_helper (&ctx);
+
+  g_free (ctx.threads);
+
+  if (includes_current_thread &&
+      gum_process_modify_thread (current_thread_id, func, user_data))
+  {
+    num_modified++;
+  }
+
+  return num_modified;
+}
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+
+gboolean
+_gum_process_do_modify_debug_registers (GumThreadId thread_id,
+                                        GumModifyDebugRegistersFunc func,
+                                        gpointer user_data)
+{
+  GumModifiedThread thread = { 0, };
+  GumModifyThreadContext ctx;
+
+  thread.thread_id = thread_id;
+
+  ctx.func = NULL;
+  ctx.debug_func = func;
+  ctx.user_data = user_data;
+  ctx.threads = &thread;
+  ctx.num_threads = 1;
+
+  return gum_modify_threads_using_helper (&ctx) == 1;
+}
+
+#endif
+
+static guint
+gum_modify_threads_using_helper (GumModifyThreadContext * ctx)
+{
+  guint num_modified = 0;
+  gint res, fd;
+  gssize child;
+  gpointer stack, tls;
+  GumUserDesc * desc;
+  guint i;
+
+  res = socketpair (AF_UNIX, SOCK_STREAM, 0, ctx->fd);
+  g_assert_cmpint (res, ==, 0);
+
+  fd = ctx->fd[0];
+
+  stack = gum_alloc_n_pages (1, GUM_PAGE_RW);
+  tls = gum_alloc_n_pages (1, GUM_PAGE_RW);
 
 #if defined (HAVE_I386) && GLIB_SIZEOF_VOID_P == 4
-    GumUserDesc segment;
-    gint gs;
-
-    asm volatile (
-        "movw %%gs, %w0"
-        : "=q" (gs)
-    );
-
-    segment.entry_number = (gs & 0xffff) >> 3;
-    segment.base_addr = GPOINTER_TO_SIZE (tls);
-    segment.limit = 0xfffff;
-    segment.seg_32bit = 1;
-    segment.contents = 0;
-    segment.read_exec_only = 0;
-    segment.limit_in_pages = 1;
-    segment.seg_not_present = 0;
-    segment.useable = 1;
-
-    desc = &segment;
+  GumUserDesc segment;
+  gint gs;
+
+  asm volatile (
+      "movw %%gs, %w0"
+      : "=q" (gs)
+  );
+
+  segment.entry_number = (gs & 0xffff) >> 3;
+  segment.base_addr = GPOINTER_TO_SIZE (tls);
+  segment.limit = 0xfffff;
+  segment.seg_32bit = 1;
+  segment.contents = 0;
+  segment.read_exec_only = 0;
+  segment.limit_in_pages = 1;
+  segment.seg_not_present = 0;
+  segment.useable = 1;
+
+  desc = &segment;
 #else
-    desc = tls;
+  desc = tls;
 #endif
 
-    /*
-     * It seems like the only reliable way to read/write the registers of
-     * another thread is to use ptrace(). We used to accomplish this by
-     * hi-jacking the target thread by installing a signal handler and sending a
-     * real-time signal directed at the target thread, and thus relying on the
-     * signal handler getting called in that thread. The signal handler would
-     * then provide us with read/write access to its registers. This hack would
-     * however not work if a thread was for example blocking in poll(), as the
-     * signal would then just get queued and we'd end up waiting indefinitely.
-     *
-     * It is however not possible to ptrace() another thread when we're in the
-     * same process group. This used to be supported in old kernels, but it was
-     * buggy and eventually dropped. So in order to use ptrace() we will need to
-     * spawn a new thread in a different process group so that it can ptrace()
-     * the target thread inside our process group. This is also the solution
-     * recommended by Linus:
-     *
-     * https://lkml.org/lkml/2006/9/1/217
-     *
-     * Because libc implementations don't expose an API to do this, and the
-     * thread setup code is private, where the TLS part is crucial for even just
-     * the syscall wrappers - due to them accessing `errno` - we cannot make any
-     * libc calls in this thread. And because the libc's clone() syscall wrapper
-     * typically writes to the child thread's TLS structures, which we cannot
-     * portably set up correctly, we cannot use the libc clone() syscall wrapper
-     * either.
-     */
-    child = gum_libc_clone (
-        gum_do_modify_thread,
-        stack + gum_query_page_size (),
-        CLONE_VM | CLONE_SETTLS,
-        &ctx,
-        NULL,
-        desc,
-        NULL);
-    g_assert_cmpint (child, >, 0);
-
-    if (gum_await_ack (fd, GUM_ACK_ATTACHED))
+  /*
+   * It seems like the only reliable way to read/write the registers of
+   * another thread is to use ptrace(). We used to accomplish this by
+   * hi-jacking the target thread by installing a signal handler and sending a
+   * real-time signal directed at the target thread, and thus relying on the
+   * signal handler getting called in that thread. The signal handler would
+   * then provide us with read/write access to its registers. This hack would
+   * however not work if a thread was for example blocking in poll(), as the
+   * signal would then just get queued and we'd end up waiting indefinitely.
+   *
+   * It is however not possible to ptrace() another thread when we're in the
+   * same process group. This used to be supported in old kernels, but it was
+   * buggy and eventually dropped. So in order to use ptrace() we will need to
+   * spawn a new thread in a different process group so that it can ptrace()
+   * the target thread inside our process group. This is also the solution
+   * recommended by Linus:
+   *
+   * https://lkml.org/lkml/2006/9/1/217
+   *
+   * Because libc implementations don't expose an API to do this, and the
+   * thread setup code is private, where the TLS part is crucial for even just
+   * the syscall wrappers - due to them accessing `errno` - we cannot make any
+   * libc calls in this thread. And because the libc's clone() syscall wrapper
+   * typically writes to the child thread's TLS structures, which we cannot
+   * portably set up correctly, we cannot use the libc clone() syscall wrapper
+   * either.
+   */
+
+  /*
+   * The helper attaches to all of the threads up front and only detaches
+   * once every one of them has been taken care of, so the cost of spawning
+   * it is paid once per batch rather than once per thread.
+   */
+  child = gum_libc_clone (
+      gum_do_modify_threads,
+      stack + gum_query_page_size (),
+      CLONE_VM | CLONE_SETTLS,
+      ctx,
+      NULL,
+      desc,
+      NULL);
+  g_assert_cmpint (child, >, 0);
+
+  gum_await_ack (fd, GUM_ACK_ATTACHED);
+  gum_await_threads_stopped (ctx);
+  gum_put_ack (fd, GUM_ACK_STOPPED);
+
+  gum_await_ack (fd, GUM_ACK_READ_CONTEXT);
+  for (i = 0; i != ctx->num_threads; i++)
+  {
+    GumModifiedThread * thread = &ctx->threads[i];
+
+    if (thread->status != GUM_MODIFY_THREAD_READ)
+      continue;
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+    if (ctx->debug_func != NULL)
     {
-      GumThreadState state;
-      gboolean still_alive;
+      ctx->debug_func (thread->thread_id, &thread->debug_registers,
+          ctx->user_data);
+    }
+    else
+#endif
+    {
+      ctx->func (thread->thread_id, &thread->cpu_context, ctx->user_data);
+    }
+  }
+  gum_put_ack (fd, GUM_ACK_MODIFIED_CONTEXT);
 
-      while ((still_alive = gum_thread_read_state (thread_id, &state)) &&
-          state != GUM_THREAD_STOPPED)
-      {
-        g_usleep (G_USEC_PER_SEC / 100);
-      }
-      gum_put_ack (fd, GUM_ACK_STOPPED);
+  gum_await_ack (fd, GUM_ACK_WROTE_CONTEXT);
+  for (i = 0; i != ctx->num_threads; i++)
+  {
+    if (ctx->threads[i].status == GUM_MODIFY_THREAD_WRITTEN)
+      num_modified++;
+  }
 
-      if (still_alive)
-      {
-        gum_await_ack (fd, GUM_ACK_READ_CONTEXT);
-        func (thread_id, &ctx.cpu_context, user_data);
-        gum_put_ack (fd, GUM_ACK_MODIFIED_CONTEXT);
+  waitpid (child, NULL, __WCLONE);
 
-        success = gum_await_ack (fd, GUM_ACK_WROTE_CONTEXT);
-      }
-    }
+  gum_free_pages (tls);
+  gum_free_pages (stack);
 
-    waitpid (child, NULL, __WCLONE);
+  close (ctx->fd[0]);
+  close (ctx->fd[1]);
 
-    gum_free_pages (tls);
-    gum_free_pages (stack);
+  return num_modified;
+}
 
-    close (ctx.fd[0]);
-    close (ctx.fd[1]);
-  }
+static void
+gum_await_threads_stopped (GumModifyThreadContext * ctx)
+{
+  guint num_pending, i;
 
-  return success;
+  do
+  {
+    num_pending = 0;
+
+    for (i = 0; i != ctx->num_threads; i++)
+    {
+      GumModifiedThread * thread = &ctx->threads[i];
+      GumThreadState state;
+
+      if (thread->status != GUM_MODIFY_THREAD_ATTACHED)
+        continue;
+
+      if (!gum_thread_read_state (thread->thread_id, &state))
+        thread->status = GUM_MODIFY_THREAD_GONE;
+      else if (state == GUM_THREAD_STOPPED)
+        thread->status = GUM_MODIFY_THREAD_STOPPED;
+      else
+        num_pending++;
+    }
+
+    if (num_pending != 0)
+      g_usleep (G_USEC_PER_SEC / 100);
+  }
+  while (num_pending != 0);
 }
 
 static gint
-gum_do_modify_thread (gpointer data)
+gum_do_modify_threads (gpointer data)
 {
   GumModifyThreadContext * ctx = data;
   gint fd;
-  gssize res;
-  GumRegs regs;
+  guint i;
 
   fd = ctx->fd[1];
 
-  res = gum_libc_ptrace (PTRACE_ATTACH, ctx->thread_id, NULL, NULL);
-  if (res < 0)
-    goto failed_to_attach;
+  for (i = 0; i != ctx->num_threads; i++)
+  {
+    GumModifiedThread * thread = &ctx->threads[i];
+
+    if (gum_libc_ptrace (PTRACE_ATTACH, thread->thread_id, NULL, NULL) >= 0)
+      thread->status = GUM_MODIFY_THREAD_ATTACHED;
+  }
   gum_put_ack (fd, GUM_ACK_ATTACHED);
 
   gum_await_ack (fd, GUM_ACK_STOPPED);
-  res = gum_get_regs (ctx->thread_id, &regs);
-  if (res < 0)
-    goto failed_to_read;
-  gum_parse_regs (&regs, &ctx->cpu_context);
+  for (i = 0; i != ctx->num_threads; i++)
+  {
+    GumModifiedThread * thread = &ctx->threads[i];
+
+    if (thread->status == GUM_MODIFY_THREAD_STOPPED &&
+        gum_read_modified_thread (ctx, thread))
+    {
+      thread->status = GUM_MODIFY_THREAD_READ;
+    }
+  }
   gum_put_ack (fd, GUM_ACK_READ_CONTEXT);
 
   gum_await_ack (fd, GUM_ACK_MODIFIED_CONTEXT);
-  gum_unparse_regs (&ctx->cpu_context, &regs);
-  res = gum_set_regs (ctx->thread_id, &regs);
-  if (res < 0)
-    goto failed_to_write;
+  for (i = 0; i != ctx->num_threads; i++)
+  {
+    GumModifiedThread * thread = &ctx->threads[i];
 
-  res = gum_libc_ptrace (PTRACE_DETACH, ctx->thread_id, NULL, NULL);
-  if (res < 0)
-    goto failed_to_detach;
+    if (thread->status == GUM_MODIFY_THREAD_READ &&
+        gum_write_modified_thread (ctx, thread))
+    {
+      thread->status = GUM_MODIFY_THREAD_WRITTEN;
+    }
 
+    if (thread->status != GUM_MODIFY_THREAD_PENDING)
+      gum_libc_ptrace (PTRACE_DETACH, thread->thread_id, NULL, NULL);
+  }
   gum_put_ack (fd, GUM_ACK_WROTE_CONTEXT);
 
-  goto beach;
+  return 0;
+}
 
-failed_to_attach:
-  {
-    gum_put_ack (fd, GUM_ACK_FAILED_TO_ATTACH);
-    goto beach;
-  }
-failed_to_read:
-  {
-    gum_put_ack (fd, GUM_ACK_FAILED_TO_READ);
-    goto beach;
-  }
-failed_to_write:
+static gboolean
+gum_read_modified_thread (GumModifyThreadContext * ctx,
+                          GumModifiedThread * thread)
+{
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  if (ctx->debug_func != NULL)
   {
-    gum_put_ack (fd, GUM_ACK_FAILED_TO_WRITE);
-    goto beach;
+    return gum_get_debug_regs (thread->thread_id,
+        &thread->debug_registers) >= 0;
   }
-failed_to_detach:
-  {
-    gum_put_ack (fd, GUM_ACK_FAILED_TO_DETACH);
-    goto beach;
-  }
-beach:
+#endif
+
+  if (gum_get_regs (thread->thread_id, &thread->regs) < 0)
+    return FALSE;
+  gum_parse_regs (&thread->regs, &thread->cpu_context);
+
+  return TRUE;
+}
+
+static gboolean
+gum_write_modified_thread (GumModifyThreadContext * ctx,
+                           GumModifiedThread * thread)
+{
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  if (ctx->debug_func != NULL)
   {
-    return 0;
+    return gum_set_debug_regs (thread->thread_id,
+        &thread->debug_registers) >= 0;
   }
+#endif
+
+  gum_unparse_regs (&thread->cpu_context, &thread->regs);
+
+  return gum_set_regs (thread->thread_id, &thread->regs) >= 0;
 }
 
 static gboolean
@@ -539,32 +885,73 @@ gum_put_ack (gint fd,
 }
 
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
-  GDir * dir;
-  const gchar * name;
+  GArray * ids, * threads;
+  GumThreadId * thread_ids;
+  GumEnumerateThreadsContext ctx;
   gboolean carry_on = TRUE;
+  guint num_threads, i;
+
+  ids = gum_list_thread_ids ();
 
-  dir = g_dir_open ("/proc/self/task", 0, NULL);
-  g_assert (dir != NULL);
+  threads = g_array_sized_new (FALSE, TRUE, sizeof (GumThreadDetails),
+      ids->len);
+  g_array_set_size (threads, ids->len);
 
-  while (carry_on && (name = g_dir_read_name (dir)) != NULL)
+  num_threads = 0;
+  for (i = 0; i != ids->len; i++)
   {
-    GumThreadDetails details;
+    GumThreadDetails * details =
+        &g_array_index (threads, GumThreadDetails, num_threads);
 
-    details.id = atoi (name);
-    if (gum_thread_read_state (details.id, &details.state))
-    {
-      if (gum_process_modify_thread (details.id, gum_store_cpu_context,
-            &details.cpu_context))
-      {
-        carry_on = func (&details, user_data);
-      }
-    }
+    details->id = g_array_index (ids, GumThreadId, i);
+
+    if ((flags & GUM_THREAD_FLAGS_SKIP_STATE) == 0 &&
+        !gum_thread_read_state (details->id, &details->state))
+      continue;
+
+    num_threads++;
+  }
+  g_array_set_size (threads, num_threads);
+
+  g_array_free (ids, TRUE);
+
+  if ((flags & GUM_THREAD_FLAGS_SKIP_CPU_CONTEXT) != 0)
+  {
+    for (i = 0; i != threads->len && carry_on; i++)
+      carry_on = func (&g_array_index (threads, GumThreadDetails, i),
+          user_data);
+
+    g_array_free (threads, TRUE);
+    return;
   }
 
-  g_dir_close (dir);
+  ctx.threads = g_hash_table_new (NULL, NULL);
+  ctx.captured = g_ptr_array_sized_new (threads->len);
+
+  thread_ids = g_new (GumThreadId, threads->len);
+  for (i = 0; i != threads->len; i++)
+  {
+    GumThreadDetails * details = &g_array_index (threads, GumThreadDetails, i);
+
+    thread_ids[i] = details->id;
+    g_hash_table_insert (ctx.threads, GSIZE_TO_POINTER (details->id),
+        details);
+  }
+
+  gum_process_modify_threads (thread_ids, threads->len, gum_store_cpu_context,
+      &ctx);
+
+  for (i = 0; i != ctx.captured->len && carry_on; i++)
+    carry_on = func (g_ptr_array_index (ctx.captured, i), user_data);
+
+  g_free (thread_ids);
+  g_ptr_array_unref (ctx.captured);
+  g_hash_table_unref (ctx.threads);
+  g_array_free (threads, TRUE);
 }
 
 static void
@@ -572,16 +959,57 @@ gum_store_cpu_context (GumThreadId thread_id,
                        GumCpuContext * cpu_context,
                        gpointer user_data)
 {
-  memcpy (user_data, cpu_context, sizeof (GumCpuContext));
+  GumEnumerateThreadsContext * ctx = user_data;
+  GumThreadDetails * details;
+
+  details = g_hash_table_lookup (ctx->threads, GSIZE_TO_POINTER (thread_id));
+  memcpy (&details->cpu_context, cpu_context, sizeof (GumCpuContext));
+
+  g_ptr_array_add (ctx->captured, details);
 }
 
 void
 gum_process_enumerate_modules (GumFoundModuleFunc func,
                                gpointer user_data)
 {
-  static gsize iterate_phdr_value = 0;
   GumDlIteratePhdrImpl iterate_phdr;
 
+  iterate_phdr = gum_resolve_dl_iterate_phdr ();
+  if (iterate_phdr != NULL)
+  {
+    gum_process_enumerate_modules_by_using_libc (iterate_phdr, func, user_data);
+  }
+  else
+  {
+    gum_process_enumerate_modules_by_parsing_proc_maps (func, user_data);
+  }
+}
+
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  GumDlIteratePhdrImpl iterate_phdr;
+  GumLoaderGeneration current = { FALSE, 0, 0 };
+
+  iterate_phdr = gum_resolve_dl_iterate_phdr ();
+  if (iterate_phdr == NULL)
+    return FALSE;
+
+  iterate_phdr (gum_read_loader_generation, &current);
+  if (!current.known)
+    return FALSE;
+
+  /* Both counters only ever grow, so the sum moves whenever either does. */
+  *generation = current.adds + current.subs;
+
+  return TRUE;
+}
+
+static GumDlIteratePhdrImpl
+gum_resolve_dl_iterate_phdr (void)
+{
+  static gsize iterate_phdr_value = 0;
+
   if (g_once_init_enter (&iterate_phdr_value))
   {
     gsize impl;
@@ -591,15 +1019,7 @@ gum_process_enumerate_modules (GumFoundModuleFunc func,
     g_once_init_leave (&iterate_phdr_value, impl + 1);
   }
 
-  iterate_phdr = GSIZE_TO_POINTER (iterate_phdr_value - 1);
-  if (iterate_phdr != NULL)
-  {
-    gum_process_enumerate_modules_by_using_libc (iterate_phdr, func, user_data);
-  }
-  else
-  {
-    gum_process_enumerate_modules_by_parsing_proc_maps (func, user_data);
-  }
+  return GSIZE_TO_POINTER (iterate_phdr_value - 1);
 }
 
 static void
@@ -612,7 +1032,12 @@ gum_process_enumerate_modules_by_using_libc (GumDlIteratePhdrImpl iterate_phdr,
   ctx.func = func;
   ctx.user_data = user_data;
 
-  gum_process_build_named_range_indexes (&ctx.names, &ctx.sizes);
+  ctx.iterate_phdr = iterate_phdr;
+  ctx.names = NULL;
+  ctx.sizes = NULL;
+#ifndef HAVE_ANDROID
+  gum_enumerate_modules_context_ensure_indexes (&ctx);
+#endif
 
   ctx.index = 0;
   ctx.carry_on = TRUE;
@@ -623,30 +1048,28 @@ gum_process_enumerate_modules_by_using_libc (GumDlIteratePhdrImpl iterate_phdr,
 #ifdef HAVE_ANDROID
   if (ctx.carry_on)
   {
-    if (ctx.linker_module == NULL)
-    {
-      GumCopyLinkerModuleContext clmc;
-
-      clmc.address_in_linker = GUM_ADDRESS (dlsym (RTLD_DEFAULT, "dlopen"));
-      clmc.linker_module = NULL;
-
-      gum_process_enumerate_modules_by_parsing_proc_maps (
-          gum_copy_linker_module, &clmc);
-
-      ctx.linker_module = clmc.linker_module;
-    }
-
     if (ctx.linker_module != NULL)
     {
       func (ctx.linker_module, user_data);
     }
+    else
+    {
+      const GumModuleDetails * linker_module;
+
+      linker_module = gum_process_query_linker_module ();
+      if (linker_module != NULL)
+        func (linker_module, user_data);
+    }
   }
 
   gum_module_details_free (ctx.linker_module);
 #endif
 
-  g_hash_table_unref (ctx.sizes);
-  g_hash_table_unref (ctx.names);
+  if (ctx.names != NULL)
+  {
+    g_hash_table_unref (ctx.sizes);
+    g_hash_table_unref (ctx.names);
+  }
 }
 
 static gint
@@ -669,9 +1092,31 @@ gum_emit_module_from_phdr (struct dl_phdr_info * info,
 
   base_address = gum_resolve_base_address_from_phdr (info);
 
-  path = g_hash_table_lookup (ctx->names, GSIZE_TO_POINTER (base_address));
-  if (path == NULL)
+  range.base_address = base_address;
+
+#ifdef HAVE_ANDROID
+  /*
+   * The linker gives us real paths since Android 7, including for libraries
+   * mapped straight out of an APK, which look like "base.apk!/lib/x/y.so" and
+   * thus keep their own names rather than the name of the APK.
+   */
+  if (info->dlpi_name[0] == '/')
+  {
     path = info->dlpi_name;
+    range.size = gum_resolve_module_size_from_phdr (info, base_address);
+  }
+  else
+#endif
+  {
+    gum_enumerate_modules_context_ensure_indexes (ctx);
+
+    path = g_hash_table_lookup (ctx->names, GSIZE_TO_POINTER (base_address));
+    if (path == NULL)
+      path = info->dlpi_name;
+
+    range.size = GPOINTER_TO_SIZE (
+        g_hash_table_lookup (ctx->sizes, GSIZE_TO_POINTER (base_address)));
+  }
 
   is_special_module = path[0] == '[';
   if (is_special_module)
@@ -683,10 +1128,6 @@ gum_emit_module_from_phdr (struct dl_phdr_info * info,
   details.range = &range;
   details.path = path;
 
-  range.base_address = base_address;
-  range.size = GPOINTER_TO_SIZE (
-      g_hash_table_lookup (ctx->sizes, GSIZE_TO_POINTER (base_address)));
-
 #ifdef HAVE_ANDROID
   if (ctx->linker_module == NULL &&
       gum_module_name_is_android_linker (info->dlpi_name))
@@ -699,27 +1140,11 @@ gum_emit_module_from_phdr (struct dl_phdr_info * info,
 #ifndef HAVE_ANDROID
     if (ctx->index == 0)
     {
-      gchar * executable_path;
-
-      executable_path = g_file_read_link ("/proc/self/exe", NULL);
-      if (executable_path != NULL &&
-          strcmp (details.path, executable_path) != 0)
-      {
-        GumEmitExecutableModuleContext emc;
-
-        emc.executable_path = executable_path;
-        emc.func = ctx->func;
-        emc.user_data = ctx->user_data;
-
-        emc.carry_on = TRUE;
-
-        gum_process_enumerate_modules_by_parsing_proc_maps (
-            gum_emit_executable_module, &emc);
+      const GumModuleDetails * executable;
 
-        ctx->carry_on = emc.carry_on;
-      }
-
-      g_free (executable_path);
+      executable = gum_process_query_executable_module ();
+      if (executable != NULL && strcmp (details.path, executable->path) != 0)
+        ctx->carry_on = ctx->func (executable, ctx->user_data);
     }
 #endif
 
@@ -759,18 +1184,123 @@ gum_resolve_base_address_from_phdr (struct dl_phdr_info * info)
   return base_address;
 }
 
-#ifndef HAVE_ANDROID
+/*
+ * On Android this is called from within dl_iterate_phdr(), which is fine as
+ * bionic's loader lock is recursive.
+ */
+static void
+gum_enumerate_modules_context_ensure_indexes (GumEnumerateModulesContext * ctx)
+{
+  if (ctx->names != NULL)
+    return;
+
+  gum_process_obtain_named_range_indexes (ctx->iterate_phdr, &ctx->names,
+      &ctx->sizes);
+}
+
+#ifdef HAVE_ANDROID
+
+static gsize
+gum_resolve_module_size_from_phdr (struct dl_phdr_info * info,
+                                   GumAddress base_address)
+{
+  GumAddress end;
+  ElfW(Half) header_count, header_index;
+
+  end = base_address;
+
+  header_count = info->dlpi_phnum;
+  for (header_index = 0; header_index != header_count; header_index++)
+  {
+    const ElfW(Phdr) * phdr = &info->dlpi_phdr[header_index];
+
+    if (phdr->p_type == PT_LOAD)
+    {
+      end = MAX (end,
+          info->dlpi_addr + phdr->p_vaddr + phdr->p_memsz);
+    }
+  }
+
+  return GUM_ALIGN_SIZE (end, gum_query_page_size ()) - base_address;
+}
+
+/* Only needed where the linker leaves itself out of dl_iterate_phdr(). */
+static const GumModuleDetails *
+gum_process_query_linker_module (void)
+{
+  GumModuleDetails * linker;
+
+  g_mutex_lock (&gum_module_cache_lock);
+
+  if (gum_module_cache_linker == NULL)
+  {
+    GumCopyLinkerModuleContext clmc;
+
+    clmc.address_in_linker = GUM_ADDRESS (dlsym (RTLD_DEFAULT, "dlopen"));
+    clmc.linker_module = NULL;
+
+    gum_process_enumerate_modules_by_parsing_proc_maps (
+        gum_copy_linker_module, &clmc);
+
+    gum_module_cache_linker = clmc.linker_module;
+    gum_module_cache_ensure_destructor ();
+  }
+
+  linker = gum_module_cache_linker;
+
+  g_mutex_unlock (&gum_module_cache_lock);
+
+  return linker;
+}
+
+#else
+
+static const GumModuleDetails *
+gum_process_query_executable_module (void)
+{
+  GumModuleDetails * executable;
+
+  g_mutex_lock (&gum_module_cache_lock);
+
+  if (gum_module_cache_executable == NULL)
+  {
+    gchar * executable_path;
+
+    executable_path = g_file_read_link ("/proc/self/exe", NULL);
+    if (executable_path != NULL)
+    {
+      GumCopyExecutableModuleContext cemc;
+
+      cemc.executable_path = executable_path;
+      cemc.executable_module = NULL;
+
+      gum_process_enumerate_modules_by_parsing_proc_maps (
+          gum_copy_executable_module, &cemc);
+
+      gum_module_cache_executable = cemc.executable_module;
+      gum_module_cache_ensure_destructor ();
+    }
+
+    g_free (executable_path);
+  }
+
+  executable = gum_module_cache_executable;
+
+  g_mutex_unlock (&gum_module_cache_lock);
+
+  return executable;
+}
 
 static gboolean
-gum_emit_executable_module (const GumModuleDetails * details,
+gum_copy_executable_module (const GumModuleDetails * details,
                             gpointer user_data)
 {
-  GumEmitExecutableModuleContext * ctx = user_data;
+  GumCopyExecutableModuleContext * ctx = user_data;
 
   if (strcmp (details->path, ctx->executable_path) != 0)
     return TRUE;
 
-  ctx->carry_on = ctx->func (details, ctx->user_data);
+  ctx->executable_module = gum_module_details_dup (details);
 
   return FALSE;
 }
@@ -883,6 +1413,77 @@ gum_process_enumerate_modules_by_parsing_proc_maps (GumFoundModuleFunc func,
   fclose (fp);
 }
 
+static void
+gum_process_obtain_named_range_indexes (GumDlIteratePhdrImpl iterate_phdr,
+                                        GHashTable ** names,
+                                        GHashTable ** sizes)
+{
+  GumLoaderGeneration generation = { FALSE, 0, 0 };
+
+  iterate_phdr (gum_read_loader_generation, &generation);
+  if (!generation.known)
+  {
+    gum_process_build_named_range_indexes (names, sizes);
+    return;
+  }
+
+  g_mutex_lock (&gum_module_cache_lock);
+
+  if (gum_module_cache_names == NULL ||
+      generation.adds != gum_module_cache_generation.adds ||
+      generation.subs != gum_module_cache_generation.subs)
+  {
+    if (gum_module_cache_names != NULL)
+    {
+      g_hash_table_unref (gum_module_cache_sizes);
+      g_hash_table_unref (gum_module_cache_names);
+    }
+
+    gum_process_build_named_range_indexes (&gum_module_cache_names,
+        &gum_module_cache_sizes);
+    gum_module_cache_generation = generation;
+
+    gum_module_cache_ensure_destructor ();
+  }
+
+  *names = g_hash_table_ref (gum_module_cache_names);
+  *sizes = g_hash_table_ref (gum_module_cache_sizes);
+
+  g_mutex_unlock (&gum_module_cache_lock);
+}
+
+static gint
+gum_read_loader_generation (struct dl_phdr_info * info,
+                            gsize size,
+                            gpointer user_data)
+{
+#if defined (HAVE_GLIBC)
+  GumLoaderGeneration * generation = user_data;
+
+  if (size >= G_STRUCT_OFFSET (struct dl_phdr_info, dlpi_subs) +
+      sizeof (info->dlpi_subs))
+  {
+    generation->known = TRUE;
+    generation->adds = info->dlpi_adds;
+    generation->subs = info->dlpi_subs;
+  }
+#elif defined (HAVE_ANDROID)
+  GumLoaderGeneration * generation = user_data;
+  const GumAndroidDlPhdrInfo * android_info =
+      (const GumAndroidDlPhdrInfo *) info;
+
+  if (size >= G_STRUCT_OFFSET (GumAndroidDlPhdrInfo, dlpi_subs) +
+      sizeof (android_info->dlpi_subs))
+  {
+    generation->known = TRUE;
+    generation->adds = android_info->dlpi_adds;
+    generation->subs = android_info->dlpi_subs;
+  }
+#endif
+
+  return 1;
+}
+
 static void
 gum_process_build_named_range_indexes (GHashTable ** names,
                                        GHashTable ** sizes)
@@ -955,18 +1556,51 @@ gum_process_build_named_range_indexes (GHashTable ** names,
       }
     }
 
-    base = GSIZE_TO_POINTER (range.base_address);
-    g_hash_table_insert (*names, base, g_strdup (name));
-    g_hash_table_insert (*sizes, base, GSIZE_TO_POINTER (range.size));
-  }
-  while (carry_on);
+    base = GSIZE_TO_POINTER (range.base_address);
+    g_hash_table_insert (*names, base, g_strdup (name));
+    g_hash_table_insert (*sizes, base, GSIZE_TO_POINTER (range.size));
+  }
+  while (carry_on);
+
+  g_free (name);
+  g_free (next_name);
+
+  g_free (line);
+
+  fclose (fp);
+}
+
+static void
+gum_module_cache_ensure_destructor (void)
+{
+  if (gum_module_cache_destructor_registered)
+    return;
+
+  _gum_register_destructor (gum_module_cache_deinit);
+  gum_module_cache_destructor_registered = TRUE;
+}
+
+static void
+gum_module_cache_deinit (void)
+{
+  if (gum_module_cache_names != NULL)
+  {
+    g_hash_table_unref (gum_module_cache_sizes);
+    gum_module_cache_sizes = NULL;
 
-  g_free (name);
-  g_free (next_name);
+    g_hash_table_unref (gum_module_cache_names);
+    gum_module_cache_names = NULL;
+  }
 
-  g_free (line);
+#ifndef HAVE_ANDROID
+  gum_module_details_free (gum_module_cache_executable);
+  gum_module_cache_executable = NULL;
+#else
+  gum_module_details_free (gum_module_cache_linker);
+  gum_module_cache_linker = NULL;
+#endif
 
-  fclose (fp);
+  gum_module_cache_destructor_registered = FALSE;
 }
 
 #ifdef HAVE_ANDROID
@@ -985,6 +1619,8 @@ gum_copy_linker_module (const GumModuleDetails * details,
   return FALSE;
 }
 
+#endif
+
 static GumModuleDetails *
 gum_module_details_dup (const GumModuleDetails * module)
 {
@@ -1010,8 +1646,6 @@ gum_module_details_free (GumModuleDetails * module)
   g_slice_free (GumModuleDetails, module);
 }
 
-#endif
-
 void
 _gum_process_enumerate_ranges (GumPageProtection prot,
                                GumFoundRangeFunc func,
@@ -1092,13 +1726,250 @@ gum_linux_enumerate_ranges (pid_t pid,
   fclose (fp);
 }
 
+/*
+ * With glibc's allocator we walk its chunks directly, in one linear pass per
+ * heap and without any instrumentation, covering the main arena's brk heap,
+ * the heaps of the other arenas, and chunks that were mmap()ed separately.
+ * glibc offers no way to freeze its arenas from the outside, so chunk sizes
+ * are re-validated as we go and all reads stay within the heap's bounds.
+ * Chunks parked in tcache or fastbins are marked as in use by glibc itself
+ * and are thus reported as allocated.
+ */
 void
 gum_process_enumerate_malloc_ranges (GumFoundMallocRangeFunc func,
                                      gpointer user_data)
 {
-  /* Not implemented */
+#ifdef HAVE_GLIBC
+  GumEnumerateMallocRangesContext ctx;
+
+  if (!gum_malloc_is_glibc ())
+    return;
+
+  ctx.func = func;
+  ctx.user_data = user_data;
+  ctx.carry_on = TRUE;
+
+  ctx.brk_end = GUM_ADDRESS (sbrk (0));
+
+  _gum_process_enumerate_ranges (GUM_PAGE_RW,
+      gum_emit_malloc_ranges_in_mapping, &ctx);
+#endif
+}
+
+#ifdef HAVE_GLIBC
+
+static gboolean
+gum_malloc_is_glibc (void)
+{
+  gboolean is_glibc = FALSE;
+  gpointer libc;
+
+  libc = dlopen ("libc.so.6", RTLD_LAZY | RTLD_NOLOAD);
+  if (libc != NULL)
+  {
+    is_glibc = dlsym (libc, "malloc") == dlsym (RTLD_DEFAULT, "malloc");
+
+    dlclose (libc);
+  }
+
+  return is_glibc;
+}
+
+static gboolean
+gum_emit_malloc_ranges_in_mapping (const GumRangeDetails * details,
+                                   gpointer user_data)
+{
+  GumEnumerateMallocRangesContext * ctx = user_data;
+  GumAddress start, end, heap;
+
+  if (details->file != NULL)
+    return TRUE;
+
+  start = details->range->base_address;
+  end = start + details->range->size;
+
+  if (ctx->brk_end > start && ctx->brk_end <= end)
+  {
+    gum_emit_malloc_ranges_in_arena_heap (ctx, start, ctx->brk_end);
+    return ctx->carry_on;
+  }
+
+  /*
+   * Heaps of non-main arenas are aligned to their maximum size, and only
+   * their first `size` bytes are accessible. Fully grown neighbours may end
+   * up merged into one mapping.
+   */
+  for (heap = start;
+      heap % GUM_MALLOC_HEAP_MAX_SIZE == 0 &&
+      heap + sizeof (GumMallocHeapInfo) <= end;
+      heap += GUM_MALLOC_HEAP_MAX_SIZE)
+  {
+    const GumMallocHeapInfo * info = GSIZE_TO_POINTER (heap);
+
+    if (info->ar_ptr == NULL || info->size > GUM_MALLOC_HEAP_MAX_SIZE ||
+        info->size > end - heap || info->mprotect_size < info->size)
+    {
+      break;
+    }
+
+    gum_emit_malloc_ranges_in_arena_heap (ctx,
+        heap + sizeof (GumMallocHeapInfo), heap + info->size);
+    if (!ctx->carry_on)
+      return FALSE;
+
+    if (info->size != GUM_MALLOC_HEAP_MAX_SIZE)
+      return TRUE;
+  }
+
+  if (heap == start)
+    gum_emit_malloc_ranges_in_mmapped_chunks (ctx, start, end);
+
+  return ctx->carry_on;
+}
+
+static void
+gum_emit_malloc_ranges_in_arena_heap (GumEnumerateMallocRangesContext * ctx,
+                                      GumAddress lower_bound,
+                                      GumAddress end)
+{
+  GumAddress start, limit, chunk;
+  GumMemoryRange range;
+  GumMallocRangeDetails details;
+
+  /*
+   * The first chunk follows the heap header and, for an arena's first heap,
+   * also the arena itself, whose size varies between glibc versions. So we
+   * look for the first properly aligned offset from which the chunk chain
+   * lines up exactly with the end of the heap.
+   */
+  start = GUM_ALIGN_SIZE (lower_bound, GUM_MALLOC_CHUNK_STEP);
+  limit = MIN (start + GUM_MALLOC_HEAD_SEARCH_WINDOW, end);
+  while (start < limit && !gum_malloc_chunks_are_linked (start, end))
+    start += GUM_MALLOC_CHUNK_STEP;
+  if (start >= limit)
+    return;
+
+  details.range = &range;
+
+  chunk = start;
+  while (chunk + (2 * GUM_MALLOC_SIZE_SZ) <= end)
+  {
+    gsize head, size;
+    GumAddress next;
+    gsize next_head;
+
+    head = *((gsize *) GSIZE_TO_POINTER (chunk + GUM_MALLOC_SIZE_SZ));
+    size = head & ~GUM_MALLOC_SIZE_BITS;
+    if (size < GUM_MALLOC_MIN_CHUNK_SIZE || size > end - chunk)
+      break;
+
+    next = chunk + size;
+    if (next + (2 * GUM_MALLOC_SIZE_SZ) > end)
+      break;
+
+    next_head = *((gsize *) GSIZE_TO_POINTER (next + GUM_MALLOC_SIZE_SZ));
+    if ((next_head & GUM_MALLOC_PREV_INUSE) != 0)
+    {
+      range.base_address = chunk + (2 * GUM_MALLOC_SIZE_SZ);
+      range.size = size - GUM_MALLOC_SIZE_SZ;
+
+      ctx->carry_on = ctx->func (&details, ctx->user_data);
+      if (!ctx->carry_on)
+        return;
+    }
+
+    chunk = next;
+  }
+}
+
+static void
+gum_emit_malloc_ranges_in_mmapped_chunks (
+    GumEnumerateMallocRangesContext * ctx,
+    GumAddress start,
+    GumAddress end)
+{
+  const gsize page_size = gum_query_page_size ();
+  GumAddress mapping;
+  GumMemoryRange range;
+  GumMallocRangeDetails details;
+
+  details.range = &range;
+
+  /* Adjacent anonymous mappings may have been merged into one */
+  mapping = start;
+  while (mapping + (2 * GUM_MALLOC_SIZE_SZ) <= end)
+  {
+    gsize prev_size, head, size;
+
+    prev_size = *((gsize *) GSIZE_TO_POINTER (mapping));
+    head = *((gsize *) GSIZE_TO_POINTER (mapping + GUM_MALLOC_SIZE_SZ));
+    size = head & ~GUM_MALLOC_SIZE_BITS;
+
+    if ((head & GUM_MALLOC_IS_MMAPPED) == 0 || prev_size >= page_size ||
+        size < GUM_MALLOC_MIN_CHUNK_SIZE || size > end - mapping - prev_size ||
+        (prev_size + size) % page_size != 0)
+    {
+      return;
+    }
+
+    range.base_address = mapping + prev_size + (2 * GUM_MALLOC_SIZE_SZ);
+    range.size = size - (2 * GUM_MALLOC_SIZE_SZ);
+
+    ctx->carry_on = ctx->func (&details, ctx->user_data);
+    if (!ctx->carry_on)
+      return;
+
+    mapping += prev_size + size;
+  }
+}
+
+static gboolean
+gum_malloc_chunks_are_linked (GumAddress start,
+                              GumAddress end)
+{
+  GumAddress chunk;
+  gsize head;
+
+  head = *((gsize *) GSIZE_TO_POINTER (start + GUM_MALLOC_SIZE_SZ));
+  if ((head & GUM_MALLOC_PREV_INUSE) == 0)
+    return FALSE;
+
+  chunk = start;
+  while (chunk + (2 * GUM_MALLOC_SIZE_SZ) <= end)
+  {
+    gsize size;
+
+    head = *((gsize *) GSIZE_TO_POINTER (chunk + GUM_MALLOC_SIZE_SZ));
+    size = head & ~GUM_MALLOC_SIZE_BITS;
+
+    /*
+     * Once an arena grows into a new heap, the old one ends with a pair of
+     * fenceposts: a header of size 2 * SIZE_SZ followed by one of size zero.
+     */
+    if (size == GUM_MALLOC_CHUNK_STEP &&
+        chunk + (2 * GUM_MALLOC_CHUNK_STEP) <= end)
+    {
+      gsize fencepost = *((gsize *) GSIZE_TO_POINTER (
+          chunk + GUM_MALLOC_CHUNK_STEP + GUM_MALLOC_SIZE_SZ));
+
+      return (fencepost & ~GUM_MALLOC_SIZE_BITS) == 0;
+    }
+
+    if ((head & GUM_MALLOC_IS_MMAPPED) != 0 ||
+        size < GUM_MALLOC_MIN_CHUNK_SIZE || size % GUM_MALLOC_CHUNK_STEP != 0 ||
+        size > end - chunk)
+    {
+      return FALSE;
+    }
+
+    chunk += size;
+  }
+
+  return chunk == end;
 }
 
+#endif
+
 guint
 gum_thread_try_get_ranges (GumMemoryRange * ranges,
                            guint max_length)
@@ -1160,19 +2031,16 @@ gum_module_enumerate_imports (const gchar * module_name,
   ctx.func = func;
   ctx.user_data = user_data;
 
-  ctx.dependency_exports = g_hash_table_new_full (g_str_hash, g_str_equal,
-      g_free, (GDestroyNotify) gum_dependency_export_free);
-  ctx.current_dependency = NULL;
+  ctx.dependencies = g_ptr_array_new_with_free_func (g_object_unref);
   ctx.module_map = NULL;
 
-  gum_elf_module_enumerate_dependencies (module, gum_collect_dependency_exports,
-      &ctx);
+  gum_elf_module_enumerate_dependencies (module, gum_collect_dependency, &ctx);
 
   gum_elf_module_enumerate_imports (module, gum_emit_import, &ctx);
 
   if (ctx.module_map != NULL)
     g_object_unref (ctx.module_map);
-  g_hash_table_unref (ctx.dependency_exports);
+  g_ptr_array_unref (ctx.dependencies);
 
   g_object_unref (module);
 }
@@ -1183,21 +2051,28 @@ gum_emit_import (const GumImportDetails * details,
 {
   GumEnumerateImportsContext * ctx = user_data;
   GumImportDetails d;
-  GumDependencyExport * exp;
+  guint i;
 
   d.type = details->type;
   d.name = details->name;
+  d.module = NULL;
+  d.address = 0;
   d.slot = details->slot;
 
-  exp = g_hash_table_lookup (ctx->dependency_exports, details->name);
-  if (exp != NULL)
+  for (i = 0; i != ctx->dependencies->len; i++)
   {
-    d.module = exp->module;
-    d.address = exp->address;
+    GumElfModule * dependency = g_ptr_array_index (ctx->dependencies, i);
+
+    d.address = gum_elf_module_find_export_by_name (dependency, details->name);
+    if (d.address != 0)
+    {
+      d.module = dependency->path;
+      break;
+    }
   }
-  else
+
+  if (d.address == 0)
   {
-    d.module = NULL;
     d.address = GUM_ADDRESS (dlsym (RTLD_DEFAULT, details->name));
 
     if (d.address != 0)
@@ -1216,57 +2091,19 @@ gum_emit_import (const GumImportDetails * details,
 }
 
 static gboolean
-gum_collect_dependency_exports (const GumElfDependencyDetails * details,
-                                gpointer user_data)
+gum_collect_dependency (const GumElfDependencyDetails * details,
+                        gpointer user_data)
 {
   GumEnumerateImportsContext * ctx = user_data;
   GumElfModule * module;
 
   module = gum_open_elf_module (details->name);
-  if (module == NULL)
-    return TRUE;
-  ctx->current_dependency = module;
-  gum_elf_module_enumerate_exports (module, gum_collect_dependency_export, ctx);
-  ctx->current_dependency = NULL;
-  g_object_unref (module);
-
-  return TRUE;
-}
-
-static gboolean
-gum_collect_dependency_export (const GumExportDetails * details,
-                               gpointer user_data)
-{
-  GumEnumerateImportsContext * ctx = user_data;
-  GumElfModule * module = ctx->current_dependency;
-
-  g_hash_table_insert (ctx->dependency_exports,
-      g_strdup (details->name),
-      gum_dependency_export_new (module->path, details->address));
+  if (module != NULL)
+    g_ptr_array_add (ctx->dependencies, module);
 
   return TRUE;
 }
 
-static GumDependencyExport *
-gum_dependency_export_new (const gchar * module,
-                           GumAddress address)
-{
-  GumDependencyExport * export;
-
-  export = g_slice_new (GumDependencyExport);
-  export->module = g_strdup (module);
-  export->address = address;
-
-  return export;
-}
-
-static void
-gum_dependency_export_free (GumDependencyExport * export)
-{
-  g_free (export->module);
-  g_slice_free (GumDependencyExport, export);
-}
-
 void
 gum_module_enumerate_exports (const gchar * module_name,
                               GumFoundExportFunc func,
@@ -1587,6 +2424,7 @@ gum_resolve_module_name (const gchar * name,
                          GumAddress * base)
 {
   GumResolveModuleNameContext ctx;
+  guint64 generation;
 
   if (name[0] == '/' && base == NULL)
     return g_strdup (name);
@@ -1608,8 +2446,27 @@ gum_resolve_module_name (const gchar * name,
   ctx.path = NULL;
   ctx.base = 0;
 
-  gum_process_enumerate_modules (gum_store_module_path_and_base_if_name_matches,
-      &ctx);
+  if (_gum_process_query_module_generation (&generation))
+  {
+    GumModuleSnapshot * snapshot;
+    const GumModuleDetails * module;
+
+    snapshot = gum_module_snapshot_obtain ();
+
+    module = gum_module_snapshot_find_module (snapshot, ctx.name);
+    if (module != NULL)
+    {
+      ctx.path = g_strdup (module->path);
+      ctx.base = module->range->base_address;
+    }
+
+    gum_module_snapshot_unref (snapshot);
+  }
+  else
+  {
+    gum_process_enumerate_modules (
+        gum_store_module_path_and_base_if_name_matches, &ctx);
+  }
 
   g_free (ctx.name);
 
@@ -2154,28 +3011,92 @@ gum_unparse_regs (const GumCpuContext * ctx,
 #endif
 }
 
+/*
+ * Reads /proc/self/task with getdents64() so that a whole batch of entries
+ * comes back per system call, instead of going through GDir one name at a
+ * time.
+ */
+static GArray *
+gum_list_thread_ids (void)
+{
+  GArray * ids;
+  gint fd;
+  gchar * buffer;
+  const gsize buffer_size = 32768;
+
+  ids = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+
+  fd = open ("/proc/self/task", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  g_assert (fd != -1);
+
+  buffer = g_malloc (buffer_size);
+
+  while (TRUE)
+  {
+    glong n;
+    gsize offset;
+
+    n = syscall (SYS_getdents64, fd, buffer, buffer_size);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+
+    for (offset = 0; offset != (gsize) n;)
+    {
+      const GumLinuxDirent64 * entry =
+          (const GumLinuxDirent64 *) (buffer + offset);
+
+      if (entry->d_name[0] != '.')
+      {
+        GumThreadId id = strtoul (entry->d_name, NULL, 10);
+
+        g_array_append_val (ids, id);
+      }
+
+      offset += entry->d_reclen;
+    }
+  }
+
+  g_free (buffer);
+  close (fd);
+
+  return ids;
+}
+
 static gboolean
 gum_thread_read_state (GumThreadId tid,
                        GumThreadState * state)
 {
-  gboolean success = FALSE;
-  gchar * path, * info = NULL;
+  gchar path[64], info[1024];
+  gint fd;
+  gssize n;
+  gchar * p;
 
-  path = g_strdup_printf ("/proc/self/task/%" G_GSIZE_FORMAT "/stat", tid);
-  if (g_file_get_contents (path, &info, NULL, NULL))
-  {
-    gchar * p;
+  sprintf (path, "/proc/self/task/%" G_GSIZE_FORMAT "/stat", tid);
 
-    p = strrchr (info, ')') + 2;
+  fd = open (path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
 
-    *state = gum_thread_state_from_proc_status_character (*p);
-    success = TRUE;
-  }
+  do
+    n = read (fd, info, sizeof (info) - 1);
+  while (n == -1 && errno == EINTR);
 
-  g_free (info);
-  g_free (path);
+  close (fd);
 
-  return success;
+  if (n <= 0)
+    return FALSE;
+  info[n] = '\0';
+
+  /* The command name may itself contain ')', but the fields after it won't. */
+  p = strrchr (info, ')');
+  if (p == NULL || p[1] == '\0' || p[2] == '\0')
+    return FALSE;
+
+  *state = gum_thread_state_from_proc_status_character (p[2]);
+
+  return TRUE;
 }
 
 static GumThreadState
@@ -2255,6 +3176,126 @@ gum_set_regs (pid_t pid,
   return gum_libc_ptrace (PTRACE_SETREGS, pid, NULL, (gpointer) regs);
 }
 
+#if defined (HAVE_I386)
+
+static gssize
+gum_get_debug_regs (pid_t pid,
+                    GumDebugRegisters * regs)
+{
+  gssize res;
+  guint i;
+
+  for (i = 0; i != GUM_MAX_DEBUG_WATCHPOINTS; i++)
+  {
+    res = gum_libc_ptrace (PTRACE_PEEKUSER, pid,
+        GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (i)), &regs->dr[i]);
+    if (res < 0)
+      return res;
+  }
+
+  res = gum_libc_ptrace (PTRACE_PEEKUSER, pid,
+      GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (6)), &regs->dr6);
+  if (res < 0)
+    return res;
+
+  return gum_libc_ptrace (PTRACE_PEEKUSER, pid,
+      GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (7)), &regs->dr7);
+}
+
+static gssize
+gum_set_debug_regs (pid_t pid,
+                    const GumDebugRegisters * regs)
+{
+  gssize res;
+  guint i;
+
+  /*
+   * Disable everything first so the kernel never sees a half-updated
+   * combination of addresses and enable bits.
+   */
+  res = gum_libc_ptrace (PTRACE_POKEUSER, pid,
+      GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (7)), NULL);
+  if (res < 0)
+    return res;
+
+  for (i = 0; i != GUM_MAX_DEBUG_WATCHPOINTS; i++)
+  {
+    res = gum_libc_ptrace (PTRACE_POKEUSER, pid,
+        GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (i)),
+        GSIZE_TO_POINTER (regs->dr[i]));
+    if (res < 0)
+      return res;
+  }
+
+  res = gum_libc_ptrace (PTRACE_POKEUSER, pid,
+      GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (6)),
+      GSIZE_TO_POINTER (regs->dr6));
+  if (res < 0)
+    return res;
+
+  return gum_libc_ptrace (PTRACE_POKEUSER, pid,
+      GSIZE_TO_POINTER (GUM_DEBUG_REGISTER_OFFSET (7)),
+      GSIZE_TO_POINTER (regs->dr7));
+}
+
+#elif defined (HAVE_ARM64)
+
+static gssize
+gum_get_debug_regs (pid_t pid,
+                    GumDebugRegisters * regs)
+{
+  GumArm64HwDebugState state;
+  struct iovec io = {
+    .iov_base = &state,
+    .iov_len = sizeof (state)
+  };
+  gssize res;
+  guint i;
+
+  res = gum_libc_ptrace (PTRACE_GETREGSET, pid,
+      GSIZE_TO_POINTER (GUM_NT_ARM_HW_WATCH), &io);
+  if (res < 0)
+    return res;
+
+  regs->num_watchpoints = MIN (state.dbg_info & 0xff,
+      GUM_MAX_DEBUG_WATCHPOINTS);
+  for (i = 0; i != regs->num_watchpoints; i++)
+  {
+    regs->wvr[i] = state.dbg_regs[i].addr;
+    regs->wcr[i] = state.dbg_regs[i].ctrl;
+  }
+
+  return res;
+}
+
+static gssize
+gum_set_debug_regs (pid_t pid,
+                    const GumDebugRegisters * regs)
+{
+  GumArm64HwDebugState state;
+  struct iovec io;
+  guint i;
+
+  state.dbg_info = 0;
+  state.pad = 0;
+  for (i = 0; i != regs->num_watchpoints; i++)
+  {
+    state.dbg_regs[i].addr = regs->wvr[i];
+    state.dbg_regs[i].ctrl = regs->wcr[i];
+    state.dbg_regs[i].pad = 0;
+  }
+
+  /* the kernel rejects writes to slots beyond what the CPU implements */
+  io.iov_base = &state;
+  io.iov_len = G_STRUCT_OFFSET (GumArm64HwDebugState, dbg_regs) +
+      (regs->num_watchpoints * sizeof (state.dbg_regs[0]));
+
+  return gum_libc_ptrace (PTRACE_SETREGSET, pid,
+      GSIZE_TO_POINTER (GUM_NT_ARM_HW_WATCH), &io);
+}
+
+#endif
+
 static gssize
 gum_libc_clone (GumCloneFunc child_func,
                 gpointer child_stack,
@@ -156,10 +156,18 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
     g_assert_not_reached ();
   }
 
-  /* TODO: save $t0 on the stack? */
-  gum_mips_writer_put_la_reg_address (cw, MIPS_REG_T0, GUM_ADDRESS (ctx));
-  gum_mips_writer_put_la_reg_address (cw, MIPS_REG_AT,
-      GUM_ADDRESS (self->enter_thunk->data));
+  if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+  {
+    gum_mips_writer_put_la_reg_address (cw, MIPS_REG_AT,
+        GUM_ADDRESS (ctx->replacement_function));
+  }
+  else
+  {
+    /* TODO: save $t0 on the stack? */
+    gum_mips_writer_put_la_reg_address (cw, MIPS_REG_T0, GUM_ADDRESS (ctx));
+    gum_mips_writer_put_la_reg_address (cw, MIPS_REG_AT,
+        GUM_ADDRESS (self->enter_thunk->data));
+  }
   gum_mips_writer_put_jr_reg (cw, MIPS_REG_AT);
 
   ctx->on_leave_trampoline = gum_mips_writer_cur (cw);
@@ -4,7 +4,9 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
+
+#include <string.h>
 
 struct _GumStalker
 {
@@ -35,12 +37,40 @@ gum_stalker_new (void)
   return g_object_new (GUM_TYPE_STALKER, NULL);
 }
 
+void
+_gum_stalker_prepare_to_fork (void)
+{
+}
+
+void
+_gum_stalker_recover_from_fork_in_parent (void)
+{
+}
+
+void
+_gum_stalker_recover_from_fork_in_child (void)
+{
+}
+
 void
 gum_stalker_exclude (GumStalker * self,
                      const GumMemoryRange * range)
 {
 }
 
+void
+gum_stalker_add_scope (GumStalker * self,
+                       const GumMemoryRange * range)
+{
+}
+
+gboolean
+gum_stalker_add_scope_entry (GumStalker * self,
+                             gpointer function_address)
+{
+  return FALSE;
+}
+
 gint
 gum_stalker_get_trust_threshold (GumStalker * self)
 {
@@ -53,6 +83,91 @@ gum_stalker_set_trust_threshold (GumStalker * self,
 {
 }
 
+guint
+gum_stalker_get_ic_entries (GumStalker * self)
+{
+  return 0;
+}
+
+void
+gum_stalker_set_ic_entries (GumStalker * self,
+                            guint ic_entries)
+{
+}
+
+gboolean
+gum_stalker_get_ic_fallback_enabled (GumStalker * self)
+{
+  return FALSE;
+}
+
+void
+gum_stalker_set_ic_fallback_enabled (GumStalker * self,
+                                     gboolean enabled)
+{
+}
+
+gboolean
+gum_stalker_get_huge_pages_enabled (GumStalker * self)
+{
+  return FALSE;
+}
+
+void
+gum_stalker_set_huge_pages_enabled (GumStalker * self,
+                                    gboolean enabled)
+{
+}
+
+gboolean
+gum_stalker_get_timestamps_enabled (GumStalker * self)
+{
+  return FALSE;
+}
+
+void
+gum_stalker_set_timestamps_enabled (GumStalker * self,
+                                    gboolean enabled)
+{
+}
+
+gsize
+gum_stalker_get_code_budget (GumStalker * self)
+{
+  return 0;
+}
+
+gboolean
+gum_stalker_set_code_budget (GumStalker * self,
+                             gsize budget)
+{
+  return budget == 0;
+}
+
+guint
+gum_stalker_get_block_sample_interval (GumStalker * self)
+{
+  return 0;
+}
+
+void
+gum_stalker_set_block_sample_interval (GumStalker * self,
+                                       guint interval)
+{
+}
+
+void
+gum_stalker_set_coverage_bitmap (GumStalker * self,
+                                 guint8 * bitmap,
+                                 gsize size)
+{
+}
+
+void
+gum_stalker_reset_coverage (GumStalker * self)
+{
+}
+
 void
 gum_stalker_flush (GumStalker * self)
 {
@@ -69,6 +184,13 @@ gum_stalker_garbage_collect (GumStalker * self)
   return FALSE;
 }
 
+void
+gum_stalker_get_stats (GumStalker * self,
+                       GumStalkerStats * stats)
+{
+  memset (stats, 0, sizeof (GumStalkerStats));
+}
+
 void
 gum_stalker_follow_me (GumStalker * self,
                        GumStalkerTransformer * transformer,
@@ -87,6 +209,13 @@ gum_stalker_is_following_me (GumStalker * self)
   return FALSE;
 }
 
+void
+gum_stalker_prefetch (GumStalker * self,
+                      gconstpointer address,
+                      gint recycle_count)
+{
+}
+
 void
 gum_stalker_follow (GumStalker * self,
                     GumThreadId thread_id,
@@ -95,6 +224,16 @@ gum_stalker_follow (GumStalker * self,
 {
 }
 
+guint
+gum_stalker_follow_threads (GumStalker * self,
+                            const GumThreadId * thread_ids,
+                            guint num_threads,
+                            GumStalkerTransformer * transformer,
+                            GumEventSink * sink)
+{
+  return 0;
+}
+
 void
 gum_stalker_unfollow (GumStalker * self,
                       GumThreadId thread_id)
@@ -136,3 +275,31 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
                                   GDestroyNotify data_destroy)
 {
 }
+
+void
+gum_stalker_iterator_put_counter_increment (GumStalkerIterator * self,
+                                            GumHitCounters * counters,
+                                            guint index)
+{
+}
+
+void
+gum_stalker_set_counters_enabled (gboolean enabled)
+{
+}
+
+void
+gum_stalker_dump_counters (void)
+{
+}
+
+void
+gum_stalker_get_counters (GumStalkerCounters * counters)
+{
+  memset (counters, 0, sizeof (GumStalkerCounters));
+}
+
+void
+gum_stalker_reset_counters (void)
+{
+}
@@ -24,6 +24,12 @@
 # include <unix.h>
 #endif
 
+#ifdef TRAP_HWBKPT
+# define GUM_TRAP_HWBKPT TRAP_HWBKPT
+#else
+# define GUM_TRAP_HWBKPT 4
+#endif
+
 struct _GumExceptorBackend
 {
   GObject parent;
@@ -308,7 +314,11 @@ gum_exceptor_backend_on_signal (int sig,
       ed.type = GUM_EXCEPTION_ARITHMETIC;
       break;
     case SIGTRAP:
-      ed.type = GUM_EXCEPTION_BREAKPOINT;
+      /* hardware breakpoints and watchpoints, just like on Windows */
+      if (siginfo->si_code == GUM_TRAP_HWBKPT)
+        ed.type = GUM_EXCEPTION_SINGLE_STEP;
+      else
+        ed.type = GUM_EXCEPTION_BREAKPOINT;
       break;
     default:
       ed.type = GUM_EXCEPTION_SYSTEM;
@@ -334,10 +344,21 @@ gum_exceptor_backend_on_signal (int sig,
     case SIGBUS:
       if (siginfo->si_addr == ed.address)
         md->operation = GUM_MEMOP_EXECUTE;
+#if defined (HAVE_LINUX) && defined (HAVE_I386)
+      else if ((((ucontext_t *) context)->uc_mcontext.gregs[REG_ERR] & 2)
+          != 0)
+        md->operation = GUM_MEMOP_WRITE;
+#endif
       else
         md->operation = GUM_MEMOP_READ; /* FIXME */
       md->address = siginfo->si_addr;
       break;
+    case SIGTRAP:
+      md->operation = GUM_MEMOP_INVALID;
+      md->address = (ed.type == GUM_EXCEPTION_SINGLE_STEP)
+          ? siginfo->si_addr
+          : NULL;
+      break;
     default:
       md->operation = GUM_MEMOP_INVALID;
       md->address = NULL;
@@ -0,0 +1,488 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummemoryaccessmonitor.h"
+
+#include "gumexceptor.h"
+#include "gumprocess.h"
+#include "gumspinlock.h"
+
+#include <gio/gio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GUM_REARM_BATCH_SIZE 16
+
+typedef struct _GumPageDetails GumPageDetails;
+typedef struct _GumCollectPagesContext GumCollectPagesContext;
+
+struct _GumMemoryAccessMonitor
+{
+  GObject parent;
+
+  guint page_size;
+
+  gboolean enabled;
+  GumExceptor * exceptor;
+
+  GumMemoryRange * ranges;
+  guint num_ranges;
+  volatile gint pages_remaining;
+  gint pages_total;
+
+  GumPageProtection access_mask;
+  GumPageDetails * pages_details;
+  guint num_pages;
+  gboolean auto_reset;
+
+  GumSpinlock rearm_lock;
+  GumPageDetails * rearm_queue[GUM_REARM_BATCH_SIZE];
+  guint rearm_queue_length;
+
+  GumMemoryAccessNotify notify_func;
+  gpointer notify_data;
+  GDestroyNotify notify_data_destroy;
+};
+
+struct _GumPageDetails
+{
+  guint range_index;
+  gpointer address;
+  GumPageProtection original_protection;
+  GumPageProtection armed_protection;
+  volatile gint armed;
+  volatile guint completed;
+};
+
+struct _GumCollectPagesContext
+{
+  GumMemoryAccessMonitor * monitor;
+  GArray * pages;
+};
+
+static void gum_memory_access_monitor_dispose (GObject * object);
+static void gum_memory_access_monitor_finalize (GObject * object);
+
+static gboolean gum_collect_pages (const GumRangeDetails * details,
+    gpointer user_data);
+static gint gum_page_details_compare (const GumPageDetails * a,
+    const GumPageDetails * b);
+static gint gum_page_details_compare_indirect (GumPageDetails * const * a,
+    GumPageDetails * const * b);
+static gint gum_page_details_compare_address (gconstpointer address,
+    const GumPageDetails * page);
+
+static void gum_memory_access_monitor_protect_pages (
+    GumMemoryAccessMonitor * self, GumPageDetails ** pages, guint num_pages,
+    gboolean arm);
+static void gum_memory_access_monitor_queue_rearm (
+    GumMemoryAccessMonitor * self, GumPageDetails * page);
+
+static gboolean gum_memory_access_monitor_on_exception (
+    GumExceptionDetails * details, gpointer user_data);
+
+G_DEFINE_TYPE (GumMemoryAccessMonitor, gum_memory_access_monitor, G_TYPE_OBJECT)
+
+static void
+gum_memory_access_monitor_class_init (GumMemoryAccessMonitorClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_memory_access_monitor_dispose;
+  object_class->finalize = gum_memory_access_monitor_finalize;
+}
+
+static void
+gum_memory_access_monitor_init (GumMemoryAccessMonitor * self)
+{
+  self->page_size = gum_query_page_size ();
+
+  gum_spinlock_init (&self->rearm_lock);
+}
+
+static void
+gum_memory_access_monitor_dispose (GObject * object)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR (object);
+
+  gum_memory_access_monitor_disable (self);
+
+  if (self->notify_data_destroy != NULL)
+  {
+    self->notify_data_destroy (self->notify_data);
+    self->notify_data_destroy = NULL;
+  }
+  self->notify_data = NULL;
+  self->notify_func = NULL;
+
+  G_OBJECT_CLASS (gum_memory_access_monitor_parent_class)->dispose (object);
+}
+
+static void
+gum_memory_access_monitor_finalize (GObject * object)
+{
+  GumMemoryAccessMonitor * self = GUM_MEMORY_ACCESS_MONITOR (object);
+
+  gum_spinlock_free (&self->rearm_lock);
+
+  g_free (self->ranges);
+
+  G_OBJECT_CLASS (gum_memory_access_monitor_parent_class)->finalize (object);
+}
+
+GumMemoryAccessMonitor *
+gum_memory_access_monitor_new (const GumMemoryRange * ranges,
+                               guint num_ranges,
+                               GumPageProtection access_mask,
+                               gboolean auto_reset,
+                               GumMemoryAccessNotify func,
+                               gpointer data,
+                               GDestroyNotify data_destroy)
+{
+  GumMemoryAccessMonitor * monitor;
+  guint i;
+
+  monitor = g_object_new (GUM_TYPE_MEMORY_ACCESS_MONITOR, NULL);
+
+  monitor->ranges = g_memdup (ranges, num_ranges * sizeof (GumMemoryRange));
+  monitor->num_ranges = num_ranges;
+  monitor->access_mask = access_mask;
+  monitor->auto_reset = auto_reset;
+  for (i = 0; i != num_ranges; i++)
+  {
+    GumMemoryRange * r = &monitor->ranges[i];
+    gsize aligned_start, aligned_end;
+    guint num_pages;
+
+    aligned_start = r->base_address & ~((gsize) monitor->page_size - 1);
+    aligned_end = (r->base_address + r->size + monitor->page_size - 1) &
+        ~((gsize) monitor->page_size - 1);
+    r->base_address = aligned_start;
+    r->size = aligned_end - aligned_start;
+
+    num_pages = r->size / monitor->page_size;
+    g_atomic_int_add (&monitor->pages_remaining, num_pages);
+    monitor->pages_total += num_pages;
+  }
+
+  monitor->notify_func = func;
+  monitor->notify_data = data;
+  monitor->notify_data_destroy = data_destroy;
+
+  return monitor;
+}
+
+gboolean
+gum_memory_access_monitor_enable (GumMemoryAccessMonitor * self,
+                                  GError ** error)
+{
+  GumCollectPagesContext ctx;
+  GumPageDetails ** pages;
+  guint num_pages, i;
+
+  if (self->enabled)
+    return TRUE;
+
+  ctx.monitor = self;
+  ctx.pages = g_array_new (FALSE, FALSE, sizeof (GumPageDetails));
+  gum_process_enumerate_ranges (GUM_PAGE_NO_ACCESS, gum_collect_pages, &ctx);
+
+  if (ctx.pages->len != (guint) self->pages_total)
+    goto error_invalid_pages;
+
+  g_array_sort (ctx.pages, (GCompareFunc) gum_page_details_compare);
+
+  /*
+   * Pages whose protection would not change can't be monitored, and count
+   * as completed from the start.
+   */
+  for (i = 0; i != ctx.pages->len;)
+  {
+    GumPageDetails * page = &g_array_index (ctx.pages, GumPageDetails, i);
+
+    if (page->armed_protection == page->original_protection)
+    {
+      g_array_remove_index (ctx.pages, i);
+      g_atomic_int_add (&self->pages_remaining, -1);
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  self->num_pages = ctx.pages->len;
+  self->pages_details = (GumPageDetails *) g_array_free (ctx.pages, FALSE);
+  self->rearm_queue_length = 0;
+
+  self->exceptor = gum_exceptor_obtain ();
+  gum_exceptor_add_full (self->exceptor,
+      gum_memory_access_monitor_on_exception, self, FALSE);
+
+  num_pages = self->num_pages;
+  pages = g_new (GumPageDetails *, num_pages);
+  for (i = 0; i != num_pages; i++)
+    pages[i] = &self->pages_details[i];
+  gum_memory_access_monitor_protect_pages (self, pages, num_pages, TRUE);
+  g_free (pages);
+
+  self->enabled = TRUE;
+
+  return TRUE;
+
+error_invalid_pages:
+  {
+    g_array_free (ctx.pages, TRUE);
+
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "one or more pages are unallocated");
+    return FALSE;
+  }
+}
+
+void
+gum_memory_access_monitor_disable (GumMemoryAccessMonitor * self)
+{
+  GumPageDetails ** pages;
+  guint num_pages, i;
+
+  if (!self->enabled)
+    return;
+
+  num_pages = self->num_pages;
+  pages = g_new (GumPageDetails *, num_pages);
+  for (i = 0; i != num_pages; i++)
+    pages[i] = &self->pages_details[i];
+  gum_memory_access_monitor_protect_pages (self, pages, num_pages, FALSE);
+  g_free (pages);
+
+  gum_exceptor_remove (self->exceptor, gum_memory_access_monitor_on_exception,
+      self);
+  g_object_unref (self->exceptor);
+  self->exceptor = NULL;
+
+  g_free (self->pages_details);
+  self->num_pages = 0;
+  self->pages_details = NULL;
+  self->rearm_queue_length = 0;
+  self->enabled = FALSE;
+}
+
+static gboolean
+gum_collect_pages (const GumRangeDetails * details,
+                   gpointer user_data)
+{
+  GumCollectPagesContext * ctx = user_data;
+  GumMemoryAccessMonitor * self = ctx->monitor;
+  GumAddress live_start, live_end;
+  guint i;
+
+  live_start = details->range->base_address;
+  live_end = live_start + details->range->size;
+
+  for (i = 0; i != self->num_ranges; i++)
+  {
+    const GumMemoryRange * r = &self->ranges[i];
+    GumAddress start, end, cur;
+
+    start = MAX (r->base_address, live_start);
+    end = MIN (r->base_address + r->size, live_end);
+
+    for (cur = start; cur < end; cur += self->page_size)
+    {
+      GumPageDetails page;
+
+      page.range_index = i;
+      page.address = GSIZE_TO_POINTER (cur);
+      page.original_protection = details->prot;
+      if ((self->access_mask & GUM_PAGE_READ) != 0)
+        page.armed_protection = GUM_PAGE_NO_ACCESS;
+      else
+        page.armed_protection = details->prot & ~self->access_mask;
+      page.armed = FALSE;
+      page.completed = 0;
+
+      g_array_append_val (ctx->pages, page);
+    }
+  }
+
+  return TRUE;
+}
+
+static gint
+gum_page_details_compare (const GumPageDetails * a,
+                          const GumPageDetails * b)
+{
+  if (a->address < b->address)
+    return -1;
+  else if (a->address > b->address)
+    return 1;
+  else
+    return 0;
+}
+
+static gint
+gum_page_details_compare_indirect (GumPageDetails * const * a,
+                                   GumPageDetails * const * b)
+{
+  return gum_page_details_compare (*a, *b);
+}
+
+static gint
+gum_page_details_compare_address (gconstpointer address,
+                                  const GumPageDetails * page)
+{
+  if ((const guint8 *) address < (const guint8 *) page->address)
+    return -1;
+  else if ((const guint8 *) address >=
+      (const guint8 *) page->address + gum_query_page_size ())
+    return 1;
+  else
+    return 0;
+}
+
+/*
+ * Pages are protected in as few calls as possible, by merging runs of
+ * adjacent pages that end up with the same protection.
+ */
+static void
+gum_memory_access_monitor_protect_pages (GumMemoryAccessMonitor * self,
+                                         GumPageDetails ** pages,
+                                         guint num_pages,
+                                         gboolean arm)
+{
+  guint start, end, i;
+
+  for (start = 0; start != num_pages; start = end)
+  {
+    GumPageDetails * first = pages[start];
+    GumPageProtection prot;
+
+    prot = arm ? first->armed_protection : first->original_protection;
+
+    for (end = start + 1; end != num_pages; end++)
+    {
+      GumPageDetails * prev = pages[end - 1];
+      GumPageDetails * page = pages[end];
+      GumPageProtection page_prot;
+
+      page_prot = arm ? page->armed_protection : page->original_protection;
+
+      if ((guint8 *) page->address != (guint8 *) prev->address +
+          self->page_size || page_prot != prot)
+        break;
+    }
+
+    for (i = start; i != end; i++)
+      g_atomic_int_set (&pages[i]->armed, arm);
+
+    gum_try_mprotect (first->address, (end - start) * self->page_size, prot);
+  }
+}
+
+static void
+gum_memory_access_monitor_queue_rearm (GumMemoryAccessMonitor * self,
+                                       GumPageDetails * page)
+{
+  GumPageDetails * batch[GUM_REARM_BATCH_SIZE];
+  guint batch_size = 0;
+
+  gum_spinlock_acquire (&self->rearm_lock);
+
+  if (self->rearm_queue_length == GUM_REARM_BATCH_SIZE)
+  {
+    memcpy (batch, self->rearm_queue, sizeof (batch));
+    batch_size = GUM_REARM_BATCH_SIZE;
+    self->rearm_queue_length = 0;
+  }
+
+  self->rearm_queue[self->rearm_queue_length++] = page;
+
+  gum_spinlock_release (&self->rearm_lock);
+
+  if (batch_size != 0)
+  {
+    qsort (batch, batch_size, sizeof (GumPageDetails *),
+        (GCompareFunc) gum_page_details_compare_indirect);
+    gum_memory_access_monitor_protect_pages (self, batch, batch_size, TRUE);
+  }
+}
+
+static gboolean
+gum_memory_access_monitor_on_exception (GumExceptionDetails * details,
+                                        gpointer user_data)
+{
+  GumMemoryAccessMonitor * self;
+  GumMemoryAccessDetails d;
+  GumPageDetails * page;
+  const GumMemoryRange * r;
+  GumPageProtection required;
+  guint operation_mask, operations_reported;
+  guint pages_remaining;
+
+  self = GUM_MEMORY_ACCESS_MONITOR (user_data);
+
+  if (details->type != GUM_EXCEPTION_ACCESS_VIOLATION)
+    return FALSE;
+
+  d.operation = details->memory.operation;
+  d.from = details->address;
+  d.address = details->memory.address;
+
+  page = bsearch (d.address, self->pages_details, self->num_pages,
+      sizeof (GumPageDetails),
+      (GCompareFunc) gum_page_details_compare_address);
+  if (page == NULL)
+    return FALSE;
+
+  /* make sure that we don't swallow faults the page would have raised */
+  switch (d.operation)
+  {
+    case GUM_MEMOP_READ:
+      required = GUM_PAGE_READ;
+      break;
+    case GUM_MEMOP_WRITE:
+      required = GUM_PAGE_WRITE;
+      break;
+    case GUM_MEMOP_EXECUTE:
+      required = GUM_PAGE_EXECUTE;
+      break;
+    default:
+      return FALSE;
+  }
+  if ((page->original_protection & required) == 0)
+    return FALSE;
+
+  /* another thread got here first, so just retry the access */
+  if (!g_atomic_int_compare_and_exchange (&page->armed, TRUE, FALSE))
+    return TRUE;
+
+  gum_try_mprotect (page->address, self->page_size,
+      page->original_protection);
+
+  operation_mask = 1 << d.operation;
+  operations_reported = g_atomic_int_or (&page->completed, operation_mask);
+
+  if (operations_reported == 0)
+    pages_remaining = g_atomic_int_add (&self->pages_remaining, -1) - 1;
+  else
+    pages_remaining = g_atomic_int_get (&self->pages_remaining);
+
+  r = &self->ranges[page->range_index];
+
+  d.range_index = page->range_index;
+  d.page_index = ((guint8 *) page->address - (guint8 *) GSIZE_TO_POINTER (
+      r->base_address)) / self->page_size;
+  d.pages_completed = self->pages_total - pages_remaining;
+  d.pages_total = self->pages_total;
+
+  if (!self->auto_reset)
+    gum_memory_access_monitor_queue_rearm (self, page);
+
+  self->notify_func (self, &d, self->notify_data);
+
+  return TRUE;
+}
@@ -8,6 +8,53 @@
 
 #include <pthread.h>
 
+#if defined (HAVE_STATIC_TLS) && defined (HAVE_LINUX) && \
+    !defined (HAVE_ANDROID) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+# define GUM_TLS_HAVE_STATIC_SLOTS 1
+#endif
+
+#ifdef GUM_TLS_HAVE_STATIC_SLOTS
+
+/*
+ * The first few keys live in a static TLS block using the initial-exec
+ * model, so reading one is a single load relative to the thread pointer
+ * instead of a call into pthread_getspecific(). That model is only safe when
+ * we are part of the executable or one of the libraries it is linked with,
+ * which is why this is a build option.
+ *
+ * Each slot has a generation that is bumped when its key is freed, and the
+ * key carries the generation it was created with. A value stored under an
+ * older generation reads back as NULL, just like pthread does with its key
+ * sequence numbers, so slots can be handed out again. Once they run out we
+ * fall back to pthread keys, tagged by their lowest bit.
+ */
+
+# define GUM_TLS_NUM_STATIC_SLOTS 32
+# define GUM_TLS_SLOT_BITS 5
+
+# define GUM_TLS_KEY_IS_STATIC(k) (((k) & 1) == 0)
+# define GUM_TLS_KEY_SLOT(k) (((k) >> 1) & (GUM_TLS_NUM_STATIC_SLOTS - 1))
+# define GUM_TLS_KEY_GENERATION(k) ((guint) ((k) >> (GUM_TLS_SLOT_BITS + 1)))
+# define GUM_TLS_MAKE_STATIC_KEY(s, g) \
+    ((((GumTlsKey) (g) << GUM_TLS_SLOT_BITS) | (s)) << 1)
+
+typedef struct _GumTlsSlot GumTlsSlot;
+
+struct _GumTlsSlot
+{
+  gpointer value;
+  guint generation;
+};
+
+static __thread GumTlsSlot gum_tls_slots[GUM_TLS_NUM_STATIC_SLOTS]
+    __attribute__ ((tls_model ("initial-exec")));
+
+/* Odd while a slot is in use. */
+static guint gum_tls_slot_generations[GUM_TLS_NUM_STATIC_SLOTS];
+G_LOCK_DEFINE_STATIC (gum_tls_slots);
+
+#endif
+
 void
 _gum_tls_init (void)
 {
@@ -29,21 +76,70 @@ gum_tls_key_new (void)
   pthread_key_t key;
   gint res;
 
+#ifdef GUM_TLS_HAVE_STATIC_SLOTS
+  guint slot;
+
+  G_LOCK (gum_tls_slots);
+  for (slot = 0; slot != GUM_TLS_NUM_STATIC_SLOTS; slot++)
+  {
+    guint generation = gum_tls_slot_generations[slot];
+
+    if ((generation & 1) == 0)
+    {
+      gum_tls_slot_generations[slot] = ++generation;
+      G_UNLOCK (gum_tls_slots);
+
+      return GUM_TLS_MAKE_STATIC_KEY (slot, generation);
+    }
+  }
+  G_UNLOCK (gum_tls_slots);
+#endif
+
   res = pthread_key_create (&key, NULL);
   g_assert_cmpint (res, ==, 0);
 
+#ifdef GUM_TLS_HAVE_STATIC_SLOTS
+  return ((GumTlsKey) key << 1) | 1;
+#else
   return key;
+#endif
 }
 
 void
 gum_tls_key_free (GumTlsKey key)
 {
+#ifdef GUM_TLS_HAVE_STATIC_SLOTS
+  if (GUM_TLS_KEY_IS_STATIC (key))
+  {
+    G_LOCK (gum_tls_slots);
+    gum_tls_slot_generations[GUM_TLS_KEY_SLOT (key)]++;
+    G_UNLOCK (gum_tls_slots);
+    return;
+  }
+
+  key >>= 1;
+#endif
+
   pthread_key_delete (key);
 }
 
 gpointer
 gum_tls_key_get_value (GumTlsKey key)
 {
+#ifdef GUM_TLS_HAVE_STATIC_SLOTS
+  if (G_LIKELY (GUM_TLS_KEY_IS_STATIC (key)))
+  {
+    GumTlsSlot * slot = &gum_tls_slots[GUM_TLS_KEY_SLOT (key)];
+
+    if (slot->generation != GUM_TLS_KEY_GENERATION (key))
+      return NULL;
+
+    return slot->value;
+  }
+
+  key >>= 1;
+#endif
+
   return pthread_getspecific (key);
 }
 
@@ -51,5 +147,18 @@ void
 gum_tls_key_set_value (GumTlsKey key,
                        gpointer value)
 {
+#ifdef GUM_TLS_HAVE_STATIC_SLOTS
+  if (G_LIKELY (GUM_TLS_KEY_IS_STATIC (key)))
+  {
+    GumTlsSlot * slot = &gum_tls_slots[GUM_TLS_KEY_SLOT (key)];
+
+    slot->value = value;
+    slot->generation = GUM_TLS_KEY_GENERATION (key);
+    return;
+  }
+
+  key >>= 1;
+#endif
+
   pthread_setspecific (key, value);
 }
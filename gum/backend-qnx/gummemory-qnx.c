@@ -26,6 +26,13 @@ gum_clear_cache (gpointer address,
   msync (address, size, MS_SYNC | MS_INVALIDATE_ICACHE);
 }
 
+gboolean
+gum_memory_advise_huge_pages (gpointer base,
+                              gsize size)
+{
+  return FALSE;
+}
+
 gboolean
 gum_memory_is_readable (GumAddress address,
                         gsize len)
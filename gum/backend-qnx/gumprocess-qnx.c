@@ -153,7 +153,8 @@ gum_process_modify_thread (GumThreadId thread_id,
 }
 
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
   gint fd, res;
@@ -176,11 +177,18 @@ _gum_process_enumerate_threads (GumFoundThreadFunc func,
     details.id = thread.tid;
     details.state = gum_thread_state_from_system_thread_state (thread.state);
 
-    if (thread.state != STATE_DEAD &&
-        gum_process_modify_thread (details.id, gum_store_cpu_context,
-          &details.cpu_context))
+    if (thread.state != STATE_DEAD)
     {
-      carry_on = func (&details, user_data);
+      if ((flags & GUM_THREAD_FLAGS_SKIP_CPU_CONTEXT) != 0)
+      {
+        memset (&details.cpu_context, 0, sizeof (GumCpuContext));
+        carry_on = func (&details, user_data);
+      }
+      else if (gum_process_modify_thread (details.id, gum_store_cpu_context,
+          &details.cpu_context))
+      {
+        carry_on = func (&details, user_data);
+      }
     }
 
     thread.tid++;
@@ -258,6 +266,12 @@ gum_qnx_enumerate_ranges (pid_t pid,
   g_free (debuginfo);
 }
 
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  return FALSE;
+}
+
 void
 _gum_process_enumerate_ranges (GumPageProtection prot,
                                GumFoundRangeFunc func,
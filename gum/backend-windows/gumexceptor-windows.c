@@ -234,6 +234,18 @@ gum_exceptor_backend_dispatch (EXCEPTION_RECORD * exception_record,
       break;
   }
 
+  /*
+   * Processes raise these routinely, e.g. for every C++ throw and every
+   * OutputDebugString(), so skip all of the work below unless asked to.
+   */
+  if (ed.type == GUM_EXCEPTION_SYSTEM &&
+      !_gum_exceptor_wants_system_exceptions ())
+  {
+    system_handler = self->system_handler;
+
+    return system_handler (exception_record, context);
+  }
+
   ed.address = exception_record->ExceptionAddress;
 
   switch (exception_record->ExceptionCode)
@@ -171,6 +171,13 @@ gum_try_mprotect (gpointer address,
   return VirtualProtect (address, size, win_page_prot, &old_protect);
 }
 
+gboolean
+gum_memory_advise_huge_pages (gpointer base,
+                              gsize size)
+{
+  return FALSE;
+}
+
 void
 gum_clear_cache (gpointer address,
                  gsize size)
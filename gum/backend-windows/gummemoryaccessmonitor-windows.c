@@ -193,8 +193,8 @@ gum_memory_access_monitor_enable (GumMemoryAccessMonitor * self,
     goto error_guarded_pages;
 
   self->exceptor = gum_exceptor_obtain ();
-  gum_exceptor_add (self->exceptor, gum_memory_access_monitor_on_exception,
-      self);
+  gum_exceptor_add_full (self->exceptor,
+      gum_memory_access_monitor_on_exception, self, FALSE);
 
   self->num_pages = 0;
   self->pages_details = NULL;
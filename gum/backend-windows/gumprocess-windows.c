@@ -109,8 +109,69 @@ beach:
   return success;
 }
 
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+
+gboolean
+_gum_process_do_modify_debug_registers (GumThreadId thread_id,
+                                        GumModifyDebugRegistersFunc func,
+                                        gpointer user_data)
+{
+  gboolean success = FALSE;
+  HANDLE thread;
+  __declspec (align (64)) CONTEXT context = { 0, };
+  GumDebugRegisters regs;
+
+  thread = OpenThread (THREAD_GET_CONTEXT | THREAD_SET_CONTEXT |
+      THREAD_SUSPEND_RESUME, FALSE, thread_id);
+  if (thread == NULL)
+    goto beach;
+
+  if (SuspendThread (thread) == (DWORD) -1)
+    goto beach;
+
+  context.ContextFlags = CONTEXT_DEBUG_REGISTERS;
+  if (!GetThreadContext (thread, &context))
+  {
+    ResumeThread (thread);
+    goto beach;
+  }
+
+  regs.dr[0] = context.Dr0;
+  regs.dr[1] = context.Dr1;
+  regs.dr[2] = context.Dr2;
+  regs.dr[3] = context.Dr3;
+  regs.dr6 = context.Dr6;
+  regs.dr7 = context.Dr7;
+
+  func (thread_id, &regs, user_data);
+
+  context.Dr0 = regs.dr[0];
+  context.Dr1 = regs.dr[1];
+  context.Dr2 = regs.dr[2];
+  context.Dr3 = regs.dr[3];
+  context.Dr6 = regs.dr6;
+  context.Dr7 = regs.dr7;
+
+  if (!SetThreadContext (thread, &context))
+  {
+    ResumeThread (thread);
+    goto beach;
+  }
+
+  success = ResumeThread (thread) != (DWORD) -1;
+
+beach:
+  if (thread != NULL)
+    CloseHandle (thread);
+
+  return success;
+}
+
+#endif
+
 void
-_gum_process_enumerate_threads (GumFoundThreadFunc func,
+_gum_process_enumerate_threads (GumThreadFlags flags,
+                                GumFoundThreadFunc func,
                                 gpointer user_data)
 {
   DWORD this_process_id;
@@ -268,6 +329,12 @@ beach:
   g_free (modules);
 }
 
+gboolean
+_gum_process_query_module_generation (guint64 * generation)
+{
+  return FALSE;
+}
+
 void
 _gum_process_enumerate_ranges (GumPageProtection prot,
                                GumFoundRangeFunc func,
@@ -475,6 +542,7 @@ gum_module_enumerate_imports (const gchar * module_name,
   {
     GumImportDetails details;
     const IMAGE_THUNK_DATA * thunk_data;
+    const IMAGE_THUNK_DATA * iat_entry;
 
     if (desc->OriginalFirstThunk == 0)
       continue;
@@ -483,15 +551,18 @@ gum_module_enumerate_imports (const gchar * module_name,
     details.name = NULL;
     details.module = (const gchar *) (mod_base + desc->Name);
     details.address = 0;
-    details.slot = 0; /* TODO */
+    details.slot = 0;
 
     thunk_data = (const IMAGE_THUNK_DATA *)
         (mod_base + desc->OriginalFirstThunk);
-    for (; thunk_data->u1.AddressOfData != 0; thunk_data++)
+    iat_entry = (const IMAGE_THUNK_DATA *) (mod_base + desc->FirstThunk);
+    for (; thunk_data->u1.AddressOfData != 0; thunk_data++, iat_entry++)
     {
       if ((thunk_data->u1.AddressOfData & IMAGE_ORDINAL_FLAG) != 0)
         continue; /* FIXME: we ignore imports by ordinal */
 
+      details.slot = GUM_ADDRESS (&iat_entry->u1.Function);
+
       details.name = (const gchar *)
           (mod_base + thunk_data->u1.AddressOfData + 2);
       details.address =
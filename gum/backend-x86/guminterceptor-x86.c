@@ -45,8 +45,10 @@ static void gum_emit_enter_thunk (GumX86Writer * cw);
 static void gum_emit_leave_thunk (GumX86Writer * cw);
 
 static void gum_emit_prolog (GumX86Writer * cw,
-    gssize stack_displacement);
-static void gum_emit_epilog (GumX86Writer * cw);
+    gssize stack_displacement, gboolean save_fpu_state);
+static void gum_emit_epilog (GumX86Writer * cw, gboolean save_fpu_state);
+static void gum_emit_sse_argument_registers_transfer (GumX86Writer * cw,
+    guint8 opcode);
 
 GumInterceptorBackend *
 _gum_interceptor_backend_create (GumCodeAllocator * allocator)
@@ -58,6 +60,7 @@ _gum_interceptor_backend_create (GumCodeAllocator * allocator)
 
   gum_x86_writer_init (&backend->writer, NULL);
   gum_x86_relocator_init (&backend->relocator, NULL, &backend->writer);
+  gum_x86_relocator_set_detail_needed (&backend->relocator, FALSE);
 
   gum_interceptor_backend_create_thunks (backend);
 
@@ -119,8 +122,17 @@ _gum_interceptor_backend_create_trampoline (GumInterceptorBackend * self,
 
   ctx->on_enter_trampoline = gum_x86_writer_cur (cw);
 
-  gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
-  gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (self->enter_thunk->data));
+  if (ctx->type == GUM_INTERCEPTOR_TYPE_FAST)
+  {
+    gum_x86_writer_put_jmp_address (cw,
+        GUM_ADDRESS (ctx->replacement_function));
+  }
+  else
+  {
+    gum_x86_writer_put_push_near_ptr (cw, function_ctx_ptr);
+    gum_x86_writer_put_jmp_address (cw,
+        GUM_ADDRESS (self->enter_thunk->data));
+  }
 
   ctx->on_leave_trampoline = gum_x86_writer_cur (cw);
 
@@ -172,9 +184,10 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
                                               gpointer prologue)
 {
   GumX86Writer * cw = &self->writer;
+  guint8 code[sizeof (ctx->overwritten_prologue)];
   guint padding;
 
-  gum_x86_writer_reset (cw, prologue);
+  gum_x86_writer_reset (cw, code);
   cw->pc = GPOINTER_TO_SIZE (ctx->function_address);
   gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (ctx->on_enter_trampoline));
   gum_x86_writer_flush (cw);
@@ -185,6 +198,8 @@ _gum_interceptor_backend_activate_trampoline (GumInterceptorBackend * self,
   for (; padding != 0; padding--)
     gum_x86_writer_put_nop (cw);
   gum_x86_writer_flush (cw);
+
+  _gum_interceptor_write_code (prologue, code, gum_x86_writer_offset (cw));
 }
 
 void
@@ -192,7 +207,8 @@ _gum_interceptor_backend_deactivate_trampoline (GumInterceptorBackend * self,
                                                 GumFunctionContext * ctx,
                                                 gpointer prologue)
 {
-  memcpy (prologue, ctx->overwritten_prologue, ctx->overwritten_prologue_len);
+  _gum_interceptor_write_code (prologue, ctx->overwritten_prologue,
+      ctx->overwritten_prologue_len);
 }
 
 gpointer
@@ -245,7 +261,11 @@ gum_emit_enter_thunk (GumX86Writer * cw)
 {
   const gssize return_address_stack_displacement = 0;
 
-  gum_emit_prolog (cw, return_address_stack_displacement);
+  /*
+   * The ABI guarantees an empty x87 stack on entry, so only the SSE argument
+   * registers are live.
+   */
+  gum_emit_prolog (cw, return_address_stack_displacement, FALSE);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
       GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
@@ -261,7 +281,7 @@ gum_emit_enter_thunk (GumX86Writer * cw)
       GUM_ARG_REGISTER, GUM_REG_XDX,
       GUM_ARG_REGISTER, GUM_REG_XCX);
 
-  gum_emit_epilog (cw);
+  gum_emit_epilog (cw, FALSE);
 }
 
 static void
@@ -269,7 +289,7 @@ gum_emit_leave_thunk (GumX86Writer * cw)
 {
   const gssize next_hop_stack_displacement = -((gssize) sizeof (gpointer));
 
-  gum_emit_prolog (cw, next_hop_stack_displacement);
+  gum_emit_prolog (cw, next_hop_stack_displacement, TRUE);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSI,
       GUM_REG_XBP, GUM_FRAME_OFFSET_CPU_CONTEXT);
@@ -282,12 +302,13 @@ gum_emit_leave_thunk (GumX86Writer * cw)
       GUM_ARG_REGISTER, GUM_REG_XSI,
       GUM_ARG_REGISTER, GUM_REG_XDX);
 
-  gum_emit_epilog (cw);
+  gum_emit_epilog (cw, TRUE);
 }
 
 static void
 gum_emit_prolog (GumX86Writer * cw,
-                 gssize stack_displacement)
+                 gssize stack_displacement,
+                 gboolean save_fpu_state)
 {
   guint8 fxsave[] = {
     0x0f, 0xae, 0x04, 0x24 /* fxsave [esp] */
@@ -319,18 +340,36 @@ gum_emit_prolog (GumX86Writer * cw,
       GUM_FRAME_OFFSET_NEXT_HOP);
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBP, GUM_REG_XSP);
   gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XSP, (guint32) ~(16 - 1));
+
+#if GLIB_SIZEOF_VOID_P == 8
+  if (!save_fpu_state)
+  {
+    gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 8 * 16);
+    gum_emit_sse_argument_registers_transfer (cw, 0x7f);
+    return;
+  }
+#endif
+
   gum_x86_writer_put_sub_reg_imm (cw, GUM_REG_XSP, 512);
   gum_x86_writer_put_bytes (cw, fxsave, sizeof (fxsave));
 }
 
 static void
-gum_emit_epilog (GumX86Writer * cw)
+gum_emit_epilog (GumX86Writer * cw,
+                 gboolean save_fpu_state)
 {
   guint8 fxrstor[] = {
     0x0f, 0xae, 0x0c, 0x24 /* fxrstor [esp] */
   };
 
+#if GLIB_SIZEOF_VOID_P == 8
+  if (!save_fpu_state)
+    gum_emit_sse_argument_registers_transfer (cw, 0x6f);
+  else
+    gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
+#else
   gum_x86_writer_put_bytes (cw, fxrstor, sizeof (fxrstor));
+#endif
   gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XSP, GUM_REG_XBP);
 
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
@@ -340,3 +379,28 @@ gum_emit_epilog (GumX86Writer * cw)
   gum_x86_writer_put_popfx (cw);
   gum_x86_writer_put_ret (cw);
 }
+
+/*
+ * Emits movdqu between xmm0-7 and [rsp + 16 * n], storing with 0x7f and
+ * loading with 0x6f. That covers every SSE argument register on both the
+ * System V and Windows x64 ABIs, at a fraction of the cost of fxsave.
+ */
+static void
+gum_emit_sse_argument_registers_transfer (GumX86Writer * cw,
+                                          guint8 opcode)
+{
+  guint8 movdqu[] = {
+    0xf3, 0x0f, 0x00, 0x44, 0x24, 0x00 /* movdqu [rsp + disp8] */
+  };
+  guint i;
+
+  movdqu[2] = opcode;
+
+  for (i = 0; i != 8; i++)
+  {
+    movdqu[3] = 0x44 | (i << 3);
+    movdqu[5] = i * 16;
+
+    gum_x86_writer_put_bytes (cw, movdqu, sizeof (movdqu));
+  }
+}
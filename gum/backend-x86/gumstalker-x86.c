@@ -7,40 +7,63 @@
 
 #define ENABLE_DEBUG 0
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
 
-#include "gummetalhash.h"
+#include "gumcapstone.h"
+#include "gumcloak.h"
+#include "guminterceptor-priv.h"
+#include "gummetalmap.h"
 #include "gumx86reader.h"
 #include "gumx86writer.h"
 #include "gummemory.h"
 #include "gumx86relocator.h"
 #include "gumspinlock.h"
+#include "gumtimestamp.h"
 #include "gumtls.h"
-#ifdef G_OS_WIN32
-# include "gumexceptor.h"
-#endif
 
 #include <stdlib.h>
 #include <string.h>
 #ifdef G_OS_WIN32
 # define VC_EXTRALEAN
 # include <windows.h>
-# include <psapi.h>
-# include <tchar.h>
 #endif
 
 #define GUM_CODE_ALIGNMENT                     8
 #define GUM_DATA_ALIGNMENT                     8
 #define GUM_CODE_SLAB_SIZE_IN_PAGES         1024
 #define GUM_EXEC_BLOCK_MIN_SIZE             2048
+#define GUM_DEFAULT_IC_ENTRIES                 2
+#define GUM_MAX_IC_ENTRIES                    32
+#define GUM_IC_ENTRY_MAX_CODE_SIZE            64
+#define GUM_IC_FALLBACK_SIZE                4096
+#define GUM_IC_FALLBACK_MAX_CODE_SIZE        128
+#define GUM_EVENT_BUFFER_SIZE               1024
+#define GUM_SCOPE_STUB_SIZE                  256
+#define GUM_DEFLECTOR_SIZE                     5
+#define GUM_MAX_USER_CALLBACK_DEPTH           16
+/*
+ * Microseconds between a context being collected and its memory being
+ * unmapped. Once a thread has queued its context it only has the rest of the
+ * entry gate to run, i.e. the epilog and the jump to ctx->resume_at, so this
+ * is a heuristic: a thread descheduled for longer than this inside that
+ * window would fault. Nothing tells us when the thread is out, short of
+ * stopping it, which is what gum_stalker_garbage_collect() avoids.
+ */
+#define GUM_RECLAIM_GRACE_PERIOD           10000
+#define GUM_RECLAIM_STOP                   GSIZE_TO_POINTER (1)
+#define GUM_MAX_SPARE_EXEC_CTXS                8
 
 typedef struct _GumInfectContext GumInfectContext;
 typedef struct _GumDisinfectContext GumDisinfectContext;
+typedef struct _GumBusyExecCtx GumBusyExecCtx;
 
 typedef struct _GumCallProbe GumCallProbe;
+typedef struct _GumCallProbeSlot GumCallProbeSlot;
 typedef struct _GumSlab GumSlab;
+typedef struct _GumScopeEntry GumScopeEntry;
 
 typedef struct _GumExecFrame GumExecFrame;
+typedef struct _GumIcEntry GumIcEntry;
 typedef struct _GumExecCtx GumExecCtx;
 typedef void (* GumExecHelperWriteFunc) (GumExecCtx * ctx, GumX86Writer * cw);
 typedef struct _GumExecBlock GumExecBlock;
@@ -51,8 +74,12 @@ typedef guint GumPrologType;
 typedef guint GumCodeContext;
 typedef struct _GumGeneratorContext GumGeneratorContext;
 typedef struct _GumCalloutEntry GumCalloutEntry;
+typedef struct _GumCalloutPage GumCalloutPage;
 typedef struct _GumInstruction GumInstruction;
 typedef struct _GumBranchTarget GumBranchTarget;
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+typedef struct _GumUserCallback GumUserCallback;
+#endif
 
 typedef guint GumVirtualizationRequirements;
 
@@ -63,22 +90,54 @@ struct _GumStalker
   guint page_size;
 
   GMutex mutex;
-  GSList * contexts;
+  GQueue contexts;
   GumTlsKey exec_ctx;
 
+  GumExecCtx * volatile garbage;
+  GAsyncQueue * reclaim_queue;
+  GThread * reclaimer;
+
+  GumSpinlock spare_ctx_lock;
+  GumExecCtx * spare_ctxs;
+  guint n_spare_ctxs;
+
   GArray * exclusions;
+  GArray * scopes;
+  GHashTable * scope_entries;
+  GumInterceptor * interceptor;
+  GumCodeAllocator scope_stubs;
   gint trust_threshold;
+  guint ic_entries;
+  gboolean ic_fallback_enabled;
+  gboolean huge_pages_enabled;
+  gboolean timestamps_enabled;
+  gsize code_budget;
+  guint block_sample_interval;
+  guint8 * coverage_bitmap;
+  gsize coverage_mask;
   volatile gboolean any_probes_attached;
   volatile gint last_probe_id;
   GumSpinlock probe_lock;
   GHashTable * probe_target_by_id;
-  GHashTable * probe_array_by_address;
+  GHashTable * probe_slot_by_address;
+  GArray * volatile probe_index;
 
-#ifdef G_OS_WIN32
-  GumExceptor * exceptor;
-  gpointer user32_start, user32_end;
-  gpointer ki_user_callback_dispatcher_impl;
+  GumStalkerStats retired_stats;
+};
+
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+struct _GumUserCallback
+{
+  gpointer stack;
+  GumExecFrame * frame;
+};
 #endif
+
+struct _GumScopeEntry
+{
+  GumStalker * stalker;
+  gpointer original;
+  GumCodeSlice * stub;
 };
 
 struct _GumInfectContext
@@ -90,11 +149,16 @@ struct _GumInfectContext
 
 struct _GumDisinfectContext
 {
-  GumStalker * stalker;
   GumExecCtx * exec_ctx;
   gboolean success;
 };
 
+struct _GumBusyExecCtx
+{
+  GumExecCtx * ctx;
+  gint epoch;
+};
+
 struct _GumCallProbe
 {
   GumProbeId id;
@@ -103,6 +167,17 @@ struct _GumCallProbe
   GDestroyNotify user_notify;
 };
 
+/*
+ * One per probed target, alive until the GumStalker is finalized so that
+ * generated code can refer to it directly. The probes array is never
+ * modified once published, only replaced, so readers need no lock.
+ */
+struct _GumCallProbeSlot
+{
+  gpointer target_address;
+  GArray * volatile probes;
+};
+
 struct _GumSlab
 {
   guint8 * data;
@@ -117,54 +192,95 @@ struct _GumExecFrame
   gpointer code_address;
 };
 
+struct _GumIcEntry
+{
+  gpointer real_start;
+  gpointer code_start;
+};
+
 enum _GumExecCtxState
 {
   GUM_EXEC_CTX_ACTIVE,
   GUM_EXEC_CTX_UNFOLLOW_PENDING,
-  GUM_EXEC_CTX_DESTROY_PENDING
+  GUM_EXEC_CTX_DESTROY_PENDING,
+  GUM_EXEC_CTX_RECYCLE_PENDING
 };
 
 struct _GumExecCtx
 {
   volatile guint state;
   volatile gboolean invalidate_pending;
+  volatile gboolean flush_pending;
+  volatile gint probe_epoch;
 
   GumStalker * stalker;
   GumThreadId thread_id;
+  GList link;
+  GumExecCtx * next_garbage;
+  gint64 retired_at;
+  GumExecCtx * next_spare;
 
   GumX86Writer code_writer;
   GumX86Relocator relocator;
 
   GumStalkerTransformer * transformer;
-  GQueue callout_entries;
+  GumCalloutPage * callout_pages;
   GumSpinlock callout_lock;
   GumEventSink * sink;
   GumEventType sink_mask;
+  gboolean sink_has_location_mask;
   void (* sink_process_impl) (GumEventSink * self, const GumEvent * ev);
+  gboolean timestamps_enabled;
   GumEvent tmp_event;
+  GumEvent * event_buffer;
+  GumEvent * event_buffer_cur;
+  GumEvent * event_buffer_end;
 
   gboolean unfollow_called_while_still_following;
   GumExecBlock * current_block;
   GumExecFrame * current_frame;
   GumExecFrame * first_frame;
   GumExecFrame * frames;
+  guint scope_depth;
+  guint outermost_scope_depth;
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+  guint user_callback_depth;
+  GumUserCallback user_callbacks[GUM_MAX_USER_CALLBACK_DEPTH];
+#endif
 
   gpointer resume_at;
   gpointer return_at;
   gpointer app_stack;
 
+  guint ic_entries;
+  GumIcEntry * ic_fallback;
+  gpointer ic_fallback_code;
+  guint block_min_size;
+
+  GumStalkerStats stats;
+  guint64 ic_lookups;
+
+  gsize coverage_prev;
+
   gpointer thunks;
   gpointer infect_thunk;
+  gpointer infect_pc;
+  gpointer scope_exit_thunk;
 
   GumSlab * code_slab;
   GumSlab first_code_slab;
+  GumSlab * retired_slabs;
+  GumSlab * spare_slabs;
+  GumSlab * reserve_slab;
+  guint code_slab_count;
+  guint max_code_slabs;
   gpointer last_prolog_minimal;
   gpointer last_epilog_minimal;
   gpointer last_prolog_full;
   gpointer last_epilog_full;
   gpointer last_stack_push;
   gpointer last_stack_pop_and_go;
-  GumMetalHashTable * mappings;
+  GumMetalMap mappings;
 };
 
 struct _GumExecBlock
@@ -178,23 +294,9 @@ struct _GumExecBlock
   guint8 * code_begin;
   guint8 * code_end;
 
-  guint8 state;
   gint recycle_count;
   gboolean has_call_to_excluded_range;
-
-#ifdef G_OS_WIN32
-  DWORD previous_dr0;
-  DWORD previous_dr1;
-  DWORD previous_dr2;
-  DWORD previous_dr7;
-#endif
-};
-
-enum _GumExecState
-{
-  GUM_EXEC_NORMAL,
-  GUM_EXEC_SINGLE_STEPPING_ON_CALL,
-  GUM_EXEC_SINGLE_STEPPING_THROUGH_CALL
+  guint32 sample_countdown;
 };
 
 enum _GumPrologType
@@ -219,6 +321,7 @@ struct _GumGeneratorContext
   gpointer continuation_real_address;
   GumPrologType opened_prolog;
   guint accumulated_stack_delta;
+  GumEventType sink_mask;
 };
 
 struct _GumInstruction
@@ -249,6 +352,20 @@ struct _GumCalloutEntry
   GumExecCtx * exec_context;
 };
 
+/*
+ * Generated code refers to its callout entries for as long as the ExecCtx
+ * lives, so they are bump-allocated from pages owned by the ExecCtx instead
+ * of going through the heap for each one.
+ */
+struct _GumCalloutPage
+{
+  GumCalloutPage * next;
+  guint num_entries;
+  guint capacity;
+
+  GumCalloutEntry entries[1];
+};
+
 struct _GumBranchTarget
 {
   gpointer origin_ip;
@@ -267,8 +384,7 @@ enum _GumVirtualizationRequirements
 {
   GUM_REQUIRE_NOTHING         = 0,
 
-  GUM_REQUIRE_RELOCATION      = 1 << 0,
-  GUM_REQUIRE_SINGLE_STEP     = 1 << 1
+  GUM_REQUIRE_RELOCATION      = 1 << 0
 };
 
 #define GUM_STALKER_LOCK(o) g_mutex_lock (&(o)->mutex)
@@ -284,8 +400,10 @@ enum _GumVirtualizationRequirements
 #define GUM_FULL_PROLOG_RETURN_OFFSET \
     (sizeof (GumCpuContext) + sizeof (gpointer))
 #define GUM_THUNK_ARGLIST_STACK_RESERVE 64 /* x64 ABI compatibility */
+#define GUM_IC_FALLBACK_INDEX(a) \
+    (((GPOINTER_TO_SIZE (a) >> 4) ^ GPOINTER_TO_SIZE (a)) & \
+        (GUM_IC_FALLBACK_SIZE - 1))
 
-static void gum_stalker_dispose (GObject * object);
 static void gum_stalker_finalize (GObject * object);
 
 G_GNUC_INTERNAL void _gum_stalker_do_follow_me (GumStalker * self,
@@ -296,20 +414,80 @@ static void gum_stalker_infect (GumThreadId thread_id,
 static void gum_stalker_disinfect (GumThreadId thread_id,
     GumCpuContext * cpu_context, gpointer user_data);
 
+static GumCallProbeSlot * gum_stalker_obtain_call_probe_slot (
+    GumStalker * self, gpointer target_address, GArray ** old_index);
+static void gum_stalker_synchronize_call_probes (GumStalker * self);
+static gboolean gum_stalker_is_still_dispatching (GumStalker * self,
+    const GumBusyExecCtx * busy);
+static GArray * gum_call_probe_array_copy (GArray * probes, guint extra);
 static void gum_stalker_free_probe_array (gpointer data);
+static void gum_call_probe_slot_free (GumCallProbeSlot * slot);
+static GumCallProbeSlot * gum_call_probe_index_find (GArray * index,
+    gconstpointer target_address);
+
+static gboolean gum_stalker_is_excluding (GumStalker * self,
+    gconstpointer address);
+static gboolean gum_stalker_is_in_scope (GumStalker * self,
+    gconstpointer address);
+static void gum_memory_ranges_add (GArray * ranges,
+    const GumMemoryRange * range);
+static gboolean gum_memory_ranges_contain (GArray * ranges,
+    gconstpointer address);
+static void gum_scope_entry_free (GumScopeEntry * entry);
+static void gum_scope_entry_write_stub (GumScopeEntry * entry);
+static gpointer gum_scope_entry_enter (GumScopeEntry * entry,
+    gpointer * ret_addr_ptr);
+static void gum_write_scope_transition_code (GumX86Writer * cw,
+    gpointer func, gpointer data);
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+static void gum_hook_user_callback_dispatcher (void);
+static void gum_unhook_user_callback_dispatcher (void);
+static void gum_write_user_callback_deflector (guint8 * mem,
+    gpointer stub);
+static void gum_restore_user_callback_dispatcher (guint8 * mem,
+    gpointer user_data);
+static gpointer gum_enter_user_callback (gpointer trampoline,
+    gpointer * ret_addr_ptr);
+static void gum_exec_ctx_leave_user_callbacks (GumExecCtx * ctx);
+static void gum_exec_block_write_system_call_return_code (
+    GumExecBlock * block, GumGeneratorContext * gc);
+#endif
+static gboolean gum_exec_ctx_is_in_user_callback (GumExecCtx * ctx);
 
 static GumExecCtx * gum_stalker_create_exec_ctx (GumStalker * self,
     GumThreadId thread_id, GumStalkerTransformer * transformer,
     GumEventSink * sink);
 static GumExecCtx * gum_stalker_get_exec_ctx (GumStalker * self);
+static void gum_stalker_set_exec_ctx (GumStalker * self, GumExecCtx * ctx);
+static void gum_stalker_recover_from_fork_in_child (GumStalker * self);
 static void gum_stalker_invalidate_caches (GumStalker * self);
 
 static void gum_exec_ctx_dispose_callouts (GumExecCtx * ctx);
+static GumCalloutEntry * gum_exec_ctx_alloc_callout_entry (GumExecCtx * ctx);
 static void gum_exec_ctx_free (GumExecCtx * ctx);
+static void gum_exec_ctx_release (GumExecCtx * ctx);
+static void gum_exec_ctx_free_memory (GumExecCtx * ctx);
+static void gum_exec_ctx_clear (GumExecCtx * ctx);
+static void gum_exec_ctx_free_shell (GumExecCtx * ctx);
+static GumExecCtx * gum_stalker_take_spare_exec_ctx (GumStalker * self);
+static gboolean gum_stalker_recycle_exec_ctx (GumStalker * self,
+    GumExecCtx * ctx);
+static gpointer gum_stalker_reclaim_garbage (GAsyncQueue * queue);
+static void gum_exec_ctx_collect_stats (GumExecCtx * ctx,
+    GumStalkerStats * stats);
 static void gum_exec_ctx_unfollow (GumExecCtx * ctx, gpointer resume_at);
+static void gum_exec_ctx_push_garbage (GumExecCtx * ctx);
 static gboolean gum_exec_ctx_has_executed (GumExecCtx * ctx);
+static void gum_exec_ctx_flush_events (GumExecCtx * ctx);
+static guint64 gum_exec_ctx_query_timestamp (GumExecCtx * ctx);
+static void gum_exec_ctx_process_event (GumExecCtx * ctx,
+    const GumEvent * ev);
 static gpointer GUM_THUNK gum_exec_ctx_replace_current_block_with (
     GumExecCtx * ctx, gpointer start_address);
+static gpointer gum_exec_ctx_call_out_of_scope (GumExecCtx * ctx,
+    gpointer target);
+static gpointer gum_exec_ctx_leave_scope (GumExecCtx * ctx,
+    gpointer * ret_addr_ptr);
 static void gum_exec_ctx_create_thunks (GumExecCtx * ctx);
 static void gum_exec_ctx_destroy_thunks (GumExecCtx * ctx);
 
@@ -324,6 +502,12 @@ static void gum_exec_ctx_write_prolog (GumExecCtx * ctx, GumPrologType type,
 static void gum_exec_ctx_write_epilog (GumExecCtx * ctx, GumPrologType type,
     GumX86Writer * cw);
 
+static gboolean gum_exec_ctx_is_code_budget_exhausted (GumExecCtx * ctx);
+static gboolean gum_exec_ctx_is_nested (GumExecCtx * ctx);
+static void gum_exec_ctx_retire_code_slabs (GumExecCtx * ctx);
+static void gum_exec_ctx_reclaim_retired_code_slabs (GumExecCtx * ctx);
+static GumSlab * gum_exec_ctx_allocate_code_slab (GumExecCtx * ctx);
+static void gum_exec_ctx_free_code_slabs (GumSlab * slab);
 static void gum_exec_ctx_ensure_inline_helpers_reachable (GumExecCtx * ctx);
 static void gum_exec_ctx_write_minimal_prolog_helper (GumExecCtx * ctx,
     GumX86Writer * cw);
@@ -372,8 +556,12 @@ static void gum_exec_block_backpatch_call (GumExecBlock * block,
     gpointer ret_code_address);
 static void gum_exec_block_backpatch_jmp (GumExecBlock * block,
     gpointer code_start, GumPrologType opened_prolog);
+static void gum_exec_block_backpatch_jcc (GumExecBlock * block,
+    gpointer code_start, x86_insn jcc_id);
 static void gum_exec_block_backpatch_ret (GumExecBlock * block,
     gpointer code_start);
+static void gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
+    GumIcEntry * ic_entries);
 
 static GumVirtualizationRequirements gum_exec_block_virtualize_branch_insn (
     GumExecBlock * block, GumGeneratorContext * gc);
@@ -384,13 +572,16 @@ static GumVirtualizationRequirements gum_exec_block_virtualize_sysenter_insn (
 
 static void gum_exec_block_write_call_invoke_code (GumExecBlock * block,
     const GumBranchTarget * target, GumGeneratorContext * gc);
+static GumIcEntry * gum_exec_block_write_inline_cache_entries (
+    GumExecBlock * block, GumGeneratorContext * gc);
+static void gum_exec_block_write_inline_cache_lookup_code (GumExecBlock * block,
+    const GumBranchTarget * target, GumIcEntry * ic_entries,
+    GumGeneratorContext * gc);
 static void gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
     const GumBranchTarget * target, GumExecCtxReplaceCurrentBlockFunc func,
-    GumGeneratorContext * gc);
+    x86_insn jcc_id, GumGeneratorContext * gc);
 static void gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
     GumGeneratorContext * gc);
-static void gum_exec_block_write_single_step_transfer_code (
-    GumExecBlock * block, GumGeneratorContext * gc);
 
 static void gum_exec_block_write_call_event_code (GumExecBlock * block,
     const GumBranchTarget * target, GumGeneratorContext * gc,
@@ -401,6 +592,11 @@ static void gum_exec_block_write_exec_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 static void gum_exec_block_write_block_event_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
+static void gum_exec_block_write_coverage_code (GumExecBlock * block,
+    GumGeneratorContext * gc);
+static void gum_exec_block_write_buffered_event_code (GumExecBlock * block,
+    GumEventType type, gpointer a, gpointer b, GumGeneratorContext * gc,
+    GumCodeContext cc);
 static void gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
     GumGeneratorContext * gc, GumCodeContext cc);
 
@@ -418,13 +614,19 @@ static GumCpuReg gum_cpu_meta_reg_from_real_reg (GumCpuReg reg);
 static GumCpuReg gum_cpu_reg_from_capstone (x86_reg reg);
 static x86_insn gum_negate_jcc (x86_insn instruction_id);
 
-#ifdef G_OS_WIN32
-static gboolean gum_stalker_on_exception (GumExceptionDetails * details,
-    gpointer user_data);
-#endif
-
 G_DEFINE_TYPE (GumStalker, gum_stalker, G_TYPE_OBJECT)
 
+G_LOCK_DEFINE_STATIC (gum_stalkers);
+static GSList * gum_stalkers = NULL;
+
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+static guint8 * gum_user_callback_dispatcher = NULL;
+static guint8 gum_user_callback_dispatcher_original[GUM_DEFLECTOR_SIZE];
+static guint8 * gum_user_callback_stub = NULL;
+static GumTlsKey gum_user_callback_ctx;
+static gboolean gum_user_callback_ctx_created = FALSE;
+#endif
+
 gboolean
 gum_stalker_is_supported (void)
 {
@@ -436,7 +638,6 @@ gum_stalker_class_init (GumStalkerClass * klass)
 {
   GObjectClass * object_class = G_OBJECT_CLASS (klass);
 
-  object_class->dispose = gum_stalker_dispose;
   object_class->finalize = gum_stalker_finalize;
 }
 
@@ -444,84 +645,46 @@ static void
 gum_stalker_init (GumStalker * self)
 {
   self->exclusions = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  self->scopes = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  self->scope_entries = NULL;
+  self->interceptor = NULL;
   self->trust_threshold = 1;
+  self->ic_entries = GUM_DEFAULT_IC_ENTRIES;
+  self->ic_fallback_enabled = FALSE;
+  self->huge_pages_enabled = FALSE;
+  self->timestamps_enabled = FALSE;
+  self->code_budget = 0;
+  self->block_sample_interval = 0;
+  self->coverage_bitmap = NULL;
+  self->coverage_mask = 0;
 
   gum_spinlock_init (&self->probe_lock);
   self->probe_target_by_id =
       g_hash_table_new_full (NULL, NULL, NULL, NULL);
-  self->probe_array_by_address =
-      g_hash_table_new_full (NULL, NULL, NULL, gum_stalker_free_probe_array);
-
-#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
-  self->exceptor = gum_exceptor_obtain ();
-  gum_exceptor_add (self->exceptor, gum_stalker_on_exception, self);
-
-  {
-    HMODULE ntmod, usermod;
-    MODULEINFO mi;
-    BOOL success;
-    gboolean found_user32_code = FALSE;
-    guint8 * p;
-
-    ntmod = GetModuleHandle (_T ("ntdll.dll"));
-    usermod = GetModuleHandle (_T ("user32.dll"));
-    g_assert (ntmod != NULL && usermod != NULL);
-
-    success = GetModuleInformation (GetCurrentProcess (), usermod,
-        &mi, sizeof (mi));
-    g_assert (success);
-    self->user32_start = mi.lpBaseOfDll;
-    self->user32_end = (guint8 *) mi.lpBaseOfDll + mi.SizeOfImage;
-
-    for (p = (guint8 *) self->user32_start; p < (guint8 *) self->user32_end;)
-    {
-      MEMORY_BASIC_INFORMATION mbi;
-
-      success = VirtualQuery (p, &mbi, sizeof (mbi)) == sizeof (mbi);
-      g_assert (success);
-
-      if (mbi.Protect == PAGE_EXECUTE_READ ||
-          mbi.Protect == PAGE_EXECUTE_READWRITE ||
-          mbi.Protect == PAGE_EXECUTE_WRITECOPY)
-      {
-        self->user32_start = mbi.BaseAddress;
-        self->user32_end = (guint8 *) mbi.BaseAddress + mbi.RegionSize;
-
-        found_user32_code = TRUE;
-      }
-
-      p = (guint8 *) mbi.BaseAddress + mbi.RegionSize;
-    }
-
-    g_assert (found_user32_code);
-
-    self->ki_user_callback_dispatcher_impl = GUM_FUNCPTR_TO_POINTER (
-        GetProcAddress (ntmod, "KiUserCallbackDispatcher"));
-    g_assert (self->ki_user_callback_dispatcher_impl != NULL);
-  }
-#endif
+  self->probe_slot_by_address = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) gum_call_probe_slot_free);
+  self->probe_index = g_array_new (FALSE, FALSE, sizeof (GumCallProbeSlot *));
 
   self->page_size = gum_query_page_size ();
   g_mutex_init (&self->mutex);
-  self->contexts = NULL;
+  g_queue_init (&self->contexts);
   self->exec_ctx = gum_tls_key_new ();
-}
 
-static void
-gum_stalker_dispose (GObject * object)
-{
-#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
-  GumStalker * self = GUM_STALKER (object);
+  self->garbage = NULL;
+  self->reclaim_queue = g_async_queue_new ();
+  self->reclaimer = NULL;
 
-  if (self->exceptor != NULL)
-  {
-    gum_exceptor_remove (self->exceptor, gum_stalker_on_exception, self);
-    g_object_unref (self->exceptor);
-    self->exceptor = NULL;
-  }
-#endif
+  gum_spinlock_init (&self->spare_ctx_lock);
+  self->spare_ctxs = NULL;
+  self->n_spare_ctxs = 0;
 
-  G_OBJECT_CLASS (gum_stalker_parent_class)->dispose (object);
+  G_LOCK (gum_stalkers);
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+  if (gum_stalkers == NULL)
+    gum_hook_user_callback_dispatcher ();
+#endif
+  gum_stalkers = g_slist_prepend (gum_stalkers, self);
+  G_UNLOCK (gum_stalkers);
 }
 
 static void
@@ -529,14 +692,62 @@ gum_stalker_finalize (GObject * object)
 {
   GumStalker * self = GUM_STALKER (object);
 
-  g_hash_table_unref (self->probe_array_by_address);
+  G_LOCK (gum_stalkers);
+  gum_stalkers = g_slist_remove (gum_stalkers, self);
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+  if (gum_stalkers == NULL)
+    gum_unhook_user_callback_dispatcher ();
+#endif
+  G_UNLOCK (gum_stalkers);
+
+  g_array_free (self->probe_index, TRUE);
+  g_hash_table_unref (self->probe_slot_by_address);
   g_hash_table_unref (self->probe_target_by_id);
 
   gum_spinlock_free (&self->probe_lock);
 
+  if (self->interceptor != NULL)
+  {
+    GHashTableIter iter;
+    gpointer function_address;
+
+    gum_interceptor_begin_transaction (self->interceptor);
+    g_hash_table_iter_init (&iter, self->scope_entries);
+    while (g_hash_table_iter_next (&iter, &function_address, NULL))
+      gum_interceptor_revert_function (self->interceptor, function_address);
+    gum_interceptor_end_transaction (self->interceptor);
+
+    /* Threads may still be on their way out of a stub. */
+    while (!gum_interceptor_flush (self->interceptor))
+      g_thread_yield ();
+
+    g_hash_table_unref (self->scope_entries);
+    gum_code_allocator_free (&self->scope_stubs);
+    g_object_unref (self->interceptor);
+  }
+
+  g_array_free (self->scopes, TRUE);
   g_array_free (self->exclusions, TRUE);
 
-  g_assert (self->contexts == NULL);
+  g_assert (g_queue_is_empty (&self->contexts));
+  g_assert (self->garbage == NULL);
+
+  if (self->reclaimer != NULL)
+  {
+    g_async_queue_push (self->reclaim_queue, GUM_RECLAIM_STOP);
+    g_thread_join (self->reclaimer);
+  }
+  g_async_queue_unref (self->reclaim_queue);
+
+  while (self->spare_ctxs != NULL)
+  {
+    GumExecCtx * ctx = self->spare_ctxs;
+
+    self->spare_ctxs = ctx->next_spare;
+    gum_exec_ctx_free_shell (ctx);
+  }
+  gum_spinlock_free (&self->spare_ctx_lock);
+
   gum_tls_key_free (self->exec_ctx);
   g_mutex_clear (&self->mutex);
 
@@ -549,187 +760,967 @@ gum_stalker_new (void)
   return g_object_new (GUM_TYPE_STALKER, NULL);
 }
 
+/*
+ * The list of Stalkers is held on to across the fork, so that none of them
+ * can come or go while we are looking at them in the child.
+ */
 void
-gum_stalker_exclude (GumStalker * self,
-                     const GumMemoryRange * range)
-{
-  g_array_append_val (self->exclusions, *range);
-}
-
-gint
-gum_stalker_get_trust_threshold (GumStalker * self)
+_gum_stalker_prepare_to_fork (void)
 {
-  return self->trust_threshold;
+  G_LOCK (gum_stalkers);
 }
 
 void
-gum_stalker_set_trust_threshold (GumStalker * self,
-                                 gint trust_threshold)
+_gum_stalker_recover_from_fork_in_parent (void)
 {
-  self->trust_threshold = trust_threshold;
+  G_UNLOCK (gum_stalkers);
 }
 
+/*
+ * Only the thread that called fork() lives on in the child, so the contexts of
+ * all the other threads are treated as if those threads had unfollowed
+ * themselves, and left for gum_stalker_garbage_collect(). Nothing is freed
+ * here, and the locks of each Stalker, which those threads may have been
+ * holding, are reset rather than taken, as they would never be released.
+ */
 void
-gum_stalker_flush (GumStalker * self)
+_gum_stalker_recover_from_fork_in_child (void)
 {
-  GSList * sinks, * cur;
-
-  GUM_STALKER_LOCK (self);
-
-  sinks = NULL;
-  for (cur = self->contexts; cur != NULL; cur = cur->next)
-  {
-    GumExecCtx * ctx = cur->data;
-
-    sinks = g_slist_prepend (sinks, g_object_ref (ctx->sink));
-  }
-
-  GUM_STALKER_UNLOCK (self);
-
-  for (cur = sinks; cur != NULL; cur = cur->next)
-  {
-    GumEventSink * sink = cur->data;
+  GSList * cur;
 
-    gum_event_sink_flush (sink);
-  }
+  for (cur = gum_stalkers; cur != NULL; cur = cur->next)
+    gum_stalker_recover_from_fork_in_child (cur->data);
 
-  g_slist_free_full (sinks, g_object_unref);
+  G_UNLOCK (gum_stalkers);
 }
 
-void
-gum_stalker_stop (GumStalker * self)
+static void
+gum_stalker_recover_from_fork_in_child (GumStalker * self)
 {
-  gboolean rescan_needed;
-  GSList * cur;
+  GumExecCtx * current_ctx;
+  GList * cur;
 
-  gum_spinlock_acquire (&self->probe_lock);
-  g_hash_table_remove_all (self->probe_target_by_id);
-  g_hash_table_remove_all (self->probe_array_by_address);
-  self->any_probes_attached = FALSE;
-  gum_spinlock_release (&self->probe_lock);
+  g_mutex_init (&self->mutex);
+  gum_spinlock_init (&self->spare_ctx_lock);
 
-  GUM_STALKER_LOCK (self);
+  /* Any batches still queued are left behind with the reclaimer. */
+  g_async_queue_unref (self->reclaim_queue);
+  self->reclaim_queue = g_async_queue_new ();
+  self->reclaimer = NULL;
 
-  do
+  current_ctx = gum_stalker_get_exec_ctx (self);
+  if (current_ctx != NULL)
+    current_ctx->thread_id = gum_process_get_current_thread_id ();
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
   {
-    rescan_needed = FALSE;
+    GumExecCtx * ctx = (GumExecCtx *) cur->data;
 
-    for (cur = self->contexts; cur != NULL; cur = cur->next)
+    if (ctx == current_ctx || ctx->state == GUM_EXEC_CTX_DESTROY_PENDING ||
+        ctx->state == GUM_EXEC_CTX_RECYCLE_PENDING)
     {
-      GumExecCtx * ctx = (GumExecCtx *) cur->data;
-      if (ctx->state == GUM_EXEC_CTX_ACTIVE)
-      {
-        GumThreadId thread_id = ctx->thread_id;
-
-        GUM_STALKER_UNLOCK (self);
-        gum_stalker_unfollow (self, thread_id);
-        GUM_STALKER_LOCK (self);
-
-        rescan_needed = TRUE;
-        break;
-      }
+      continue;
     }
+
+    ctx->state = GUM_EXEC_CTX_DESTROY_PENDING;
+    gum_exec_ctx_push_garbage (ctx);
   }
-  while (rescan_needed);
+}
 
-  GUM_STALKER_UNLOCK (self);
+/*
+ * Exclusions and scopes are kept sorted by base address, with overlapping and
+ * adjacent ranges merged, so that lookups can binary search them. That
+ * matters because the lookup is done for every call site we compile, and on
+ * some architectures also at runtime for each indirect call.
+ */
+void
+gum_stalker_exclude (GumStalker * self,
+                     const GumMemoryRange * range)
+{
+  gum_memory_ranges_add (self->exclusions, range);
+}
 
-  gum_stalker_garbage_collect (self);
+/*
+ * Once any scope has been added, calls to code outside of all of them are
+ * treated as calls to excluded ranges.
+ */
+void
+gum_stalker_add_scope (GumStalker * self,
+                       const GumMemoryRange * range)
+{
+  gum_memory_ranges_add (self->scopes, range);
 }
 
+/*
+ * Replaces the function with a stub, so that a followed thread calling it
+ * while outside the scope is stalked until the function returns. Scopes and
+ * their entries are meant to be set up before any thread is followed.
+ * Returns FALSE if the function could not be replaced.
+ */
 gboolean
-gum_stalker_garbage_collect (GumStalker * self)
+gum_stalker_add_scope_entry (GumStalker * self,
+                             gpointer function_address)
 {
-  GSList * keep = NULL, * cur;
-  gboolean pending_garbage;
-
-  GUM_STALKER_LOCK (self);
+  GumScopeEntry * entry;
+  gpointer hooked_address;
+  gboolean success;
 
-  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  if (self->interceptor == NULL)
   {
-    GumExecCtx * ctx = (GumExecCtx *) cur->data;
-    if (ctx->state == GUM_EXEC_CTX_DESTROY_PENDING)
-      gum_exec_ctx_free (ctx);
-    else
-      keep = g_slist_prepend (keep, ctx);
+    self->interceptor = gum_interceptor_obtain ();
+    self->scope_entries = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) gum_scope_entry_free);
+    gum_code_allocator_init (&self->scope_stubs, GUM_SCOPE_STUB_SIZE);
   }
 
-  g_slist_free (self->contexts);
-  self->contexts = keep;
+  entry = g_slice_new (GumScopeEntry);
+  entry->stalker = self;
+  entry->original = NULL;
+  entry->stub = gum_code_allocator_alloc_slice (&self->scope_stubs);
+  gum_scope_entry_write_stub (entry);
+  gum_code_allocator_commit (&self->scope_stubs);
 
-  pending_garbage = keep != NULL;
-
-  GUM_STALKER_UNLOCK (self);
+  gum_interceptor_begin_transaction (self->interceptor);
 
-  return pending_garbage;
-}
+  success = gum_interceptor_replace_function (self->interceptor,
+      function_address, entry->stub->data, NULL) == GUM_REPLACE_OK;
+  if (success)
+  {
+    entry->original = _gum_interceptor_peek_original_function (
+        self->interceptor, function_address, &hooked_address);
+    g_hash_table_insert (self->scope_entries, hooked_address, entry);
+  }
+  else
+  {
+    gum_scope_entry_free (entry);
+  }
 
-#ifdef _MSC_VER
+  gum_interceptor_end_transaction (self->interceptor);
 
-#define RETURN_ADDRESS_POINTER_FROM_FIRST_ARGUMENT(arg)   \
-    ((gpointer *) ((volatile guint8 *) &arg - sizeof (gpointer)))
+  return success;
+}
 
-void
-gum_stalker_follow_me (GumStalker * self,
-                       GumStalkerTransformer * transformer,
-                       GumEventSink * sink)
+static void
+gum_scope_entry_free (GumScopeEntry * entry)
 {
-  volatile gpointer * ret_addr_ptr;
-
-  ret_addr_ptr = RETURN_ADDRESS_POINTER_FROM_FIRST_ARGUMENT (self);
+  gum_code_slice_free (entry->stub);
 
-  _gum_stalker_do_follow_me (self, transformer, sink, ret_addr_ptr);
+  g_slice_free (GumScopeEntry, entry);
 }
 
-#endif
-
-void
-_gum_stalker_do_follow_me (GumStalker * self,
-                           GumStalkerTransformer * transformer,
-                           GumEventSink * sink,
-                           volatile gpointer * ret_addr_ptr)
+/*
+ * The stub saves everything and asks gum_scope_entry_enter() where to go,
+ * which is either the original function or our code for it, and then returns
+ * there. The caller's return address is what tells us where the scope ends.
+ */
+static void
+gum_scope_entry_write_stub (GumScopeEntry * entry)
 {
-  GumExecCtx * ctx;
-  gpointer code_address;
-
-  ctx = gum_stalker_create_exec_ctx (self, gum_process_get_current_thread_id (),
-      transformer, sink);
-  gum_tls_key_set_value (self->exec_ctx, ctx);
-  ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, *ret_addr_ptr,
-      &code_address);
-  *ret_addr_ptr = code_address;
+  GumX86Writer cw;
 
-  gum_event_sink_start (sink);
+  gum_x86_writer_init (&cw, entry->stub->data);
+  gum_write_scope_transition_code (&cw, gum_scope_entry_enter, entry);
+  gum_x86_writer_flush (&cw);
+  g_assert_cmpuint (gum_x86_writer_offset (&cw), <=, GUM_SCOPE_STUB_SIZE);
+  gum_x86_writer_clear (&cw);
 }
 
-void
-gum_stalker_unfollow_me (GumStalker * self)
+static gpointer
+gum_scope_entry_enter (GumScopeEntry * entry,
+                       gpointer * ret_addr_ptr)
 {
   GumExecCtx * ctx;
+  gpointer code_address;
 
-  ctx = gum_stalker_get_exec_ctx (self);
-  g_assert (ctx != NULL);
-
-  gum_exec_ctx_dispose_callouts (ctx);
+  ctx = gum_stalker_get_exec_ctx (entry->stalker);
+  if (ctx == NULL)
+    return entry->original;
 
-  gum_event_sink_stop (ctx->sink);
+  code_address =
+      gum_exec_ctx_replace_current_block_with (ctx, entry->original);
+  if (ctx->current_block == NULL)
+    return code_address;
 
-  if (ctx->current_block != NULL &&
-      ctx->current_block->has_call_to_excluded_range)
+  if ((GPOINTER_TO_SIZE (ctx->current_frame) &
+      (entry->stalker->page_size - 1)) != 0)
   {
-    ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
+    ctx->current_frame--;
+    ctx->current_frame->real_address = *ret_addr_ptr;
+    ctx->current_frame->code_address = ctx->scope_exit_thunk;
   }
-  else
-  {
-    g_assert (ctx->unfollow_called_while_still_following);
 
-    gum_tls_key_set_value (self->exec_ctx, NULL);
+  ctx->scope_depth++;
 
-    GUM_STALKER_LOCK (self);
-    self->contexts = g_slist_remove (self->contexts, ctx);
-    GUM_STALKER_UNLOCK (self);
+  return code_address;
+}
+
+/*
+ * Calls func (data, ret_addr_ptr) with all registers preserved, and returns
+ * to the address it hands back. We get here through a call or a return, so
+ * there is nothing below the stack pointer that we need to stay clear of.
+ */
+static void
+gum_write_scope_transition_code (GumX86Writer * cw,
+                                 gpointer func,
+                                 gpointer data)
+{
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_pushax (cw);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XBX, GUM_REG_XSP,
+      sizeof (GumCpuContext) + sizeof (gpointer));
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (func), 2,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (data),
+      GUM_ARG_REGISTER, GUM_REG_XBX);
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XSP,
+      sizeof (GumCpuContext), GUM_REG_XAX);
+
+  gum_x86_writer_put_popax (cw);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_ret (cw);
+}
+
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+
+/*
+ * WoW64 system calls are made natively, and the kernel may re-enter user mode
+ * through KiUserCallbackDispatcher before it returns, e.g. to deliver window
+ * messages. We send it through a stub so that followed threads have those
+ * callbacks stalked. The stub returns to either our code for a relocated copy
+ * of its prologue, or to the copy itself, which carries on natively.
+ *
+ * The stub is built once and never freed: a thread may still be on its way
+ * through it, or through the relocated prologue, long after we unhook.
+ */
+static void
+gum_hook_user_callback_dispatcher (void)
+{
+  guint8 * dispatcher;
+
+  if (!gum_user_callback_ctx_created)
+  {
+    gum_user_callback_ctx = gum_tls_key_new ();
+    gum_user_callback_ctx_created = TRUE;
+  }
+
+  dispatcher = GUM_FUNCPTR_TO_POINTER (GetProcAddress (
+      GetModuleHandleW (L"ntdll.dll"), "KiUserCallbackDispatcher"));
+  if (dispatcher == NULL)
+    return;
+
+  if (gum_user_callback_stub == NULL)
+  {
+    guint8 * stub, * trampoline;
+    GumX86Writer cw;
+    guint reloc_size;
+
+    if (!gum_x86_relocator_can_relocate (dispatcher, GUM_DEFLECTOR_SIZE, NULL))
+      return;
+
+    stub = gum_alloc_n_pages (1, GUM_PAGE_RWX);
+
+    trampoline = stub + GUM_SCOPE_STUB_SIZE;
+    reloc_size = gum_x86_relocator_relocate (dispatcher, GUM_DEFLECTOR_SIZE,
+        trampoline);
+    gum_x86_writer_init (&cw, trampoline + reloc_size);
+    gum_x86_writer_put_jmp_address (&cw,
+        GUM_ADDRESS (dispatcher + reloc_size));
+    gum_x86_writer_clear (&cw);
+
+    gum_x86_writer_init (&cw, stub);
+    gum_write_scope_transition_code (&cw, gum_enter_user_callback,
+        trampoline);
+    gum_x86_writer_flush (&cw);
+    g_assert_cmpuint (gum_x86_writer_offset (&cw), <=, GUM_SCOPE_STUB_SIZE);
+    gum_x86_writer_clear (&cw);
+
+    gum_user_callback_stub = stub;
+  }
+
+  memcpy (gum_user_callback_dispatcher_original, dispatcher,
+      GUM_DEFLECTOR_SIZE);
+  gum_user_callback_dispatcher = dispatcher;
+
+  gum_memory_patch_code (GUM_ADDRESS (dispatcher), GUM_DEFLECTOR_SIZE,
+      (GumMemoryPatchApplyFunc) gum_write_user_callback_deflector,
+      gum_user_callback_stub);
+}
+
+static void
+gum_unhook_user_callback_dispatcher (void)
+{
+  if (gum_user_callback_dispatcher == NULL)
+    return;
+
+  gum_memory_patch_code (GUM_ADDRESS (gum_user_callback_dispatcher),
+      GUM_DEFLECTOR_SIZE,
+      (GumMemoryPatchApplyFunc) gum_restore_user_callback_dispatcher, NULL);
+  gum_user_callback_dispatcher = NULL;
+}
+
+static void
+gum_write_user_callback_deflector (guint8 * mem,
+                                   gpointer stub)
+{
+  GumX86Writer cw;
+
+  gum_x86_writer_init (&cw, mem);
+  cw.pc = GUM_ADDRESS (gum_user_callback_dispatcher);
+  gum_x86_writer_put_jmp_address (&cw, GUM_ADDRESS (stub));
+  gum_x86_writer_clear (&cw);
+}
+
+static void
+gum_restore_user_callback_dispatcher (guint8 * mem,
+                                      gpointer user_data)
+{
+  memcpy (mem, gum_user_callback_dispatcher_original,
+      GUM_DEFLECTOR_SIZE);
+}
+
+/*
+ * Callbacks that arrive while the thread is running natively, either unfollowed
+ * or outside the scope, are left alone. The thread gets back to the block that
+ * made the system call once the kernel returns, like with any excluded call.
+ *
+ * A callback never returns to us, it ends by asking the kernel to resume the
+ * system call it interrupted. We remember where its stack started, so that
+ * gum_exec_ctx_leave_user_callbacks() can tell once that system call is back,
+ * and drop the frames that the callback left behind.
+ */
+static gpointer
+gum_enter_user_callback (gpointer trampoline,
+                         gpointer * ret_addr_ptr)
+{
+  GumExecCtx * ctx;
+  GumUserCallback * callback;
+
+  ctx = gum_tls_key_get_value (gum_user_callback_ctx);
+
+  if (ctx == NULL || ctx->current_block == NULL ||
+      ctx->user_callback_depth == GUM_MAX_USER_CALLBACK_DEPTH)
+    return trampoline;
+
+  callback = &ctx->user_callbacks[ctx->user_callback_depth++];
+  callback->stack = ret_addr_ptr;
+  callback->frame = ctx->current_frame;
+
+  return gum_exec_ctx_replace_current_block_with (ctx, trampoline);
+}
+
+/*
+ * System calls made from inside a callback return below its stack, so any
+ * callback whose stack we are now above has finished.
+ */
+static void
+gum_exec_ctx_leave_user_callbacks (GumExecCtx * ctx)
+{
+  while (ctx->user_callback_depth != 0)
+  {
+    GumUserCallback * callback =
+        &ctx->user_callbacks[ctx->user_callback_depth - 1];
+
+    if ((guint8 *) ctx->app_stack <= (guint8 *) callback->stack)
+      break;
+
+    ctx->current_frame = callback->frame;
+    ctx->user_callback_depth--;
+  }
+}
+
+static void
+gum_exec_block_write_system_call_return_code (GumExecBlock * block,
+                                              GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  gconstpointer beach = cw->code + 1;
+
+  gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_EAX,
+      GUM_ADDRESS (&ctx->user_callback_depth));
+  gum_x86_writer_put_test_reg_reg (cw, GUM_REG_EAX, GUM_REG_EAX);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JE, beach, GUM_LIKELY);
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (gum_exec_ctx_leave_user_callbacks), 1,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
+  gum_x86_writer_put_label (cw, beach);
+
+  gum_exec_block_close_prolog (block, gc);
+}
+
+#endif
+
+static gboolean
+gum_exec_ctx_is_in_user_callback (GumExecCtx * ctx)
+{
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+  return ctx->user_callback_depth != 0;
+#else
+  return FALSE;
+#endif
+}
+
+static gboolean
+gum_stalker_is_excluding (GumStalker * self,
+                          gconstpointer address)
+{
+  if (gum_memory_ranges_contain (self->exclusions, address))
+    return TRUE;
+
+  return !gum_stalker_is_in_scope (self, address);
+}
+
+static gboolean
+gum_stalker_is_in_scope (GumStalker * self,
+                         gconstpointer address)
+{
+  return self->scopes->len == 0 ||
+      gum_memory_ranges_contain (self->scopes, address);
+}
+
+static void
+gum_memory_ranges_add (GArray * ranges,
+                       const GumMemoryRange * range)
+{
+  guint i;
+  GumMemoryRange * cur;
+
+  for (i = 0; i != ranges->len; i++)
+  {
+    if (g_array_index (ranges, GumMemoryRange, i).base_address >
+        range->base_address)
+      break;
+  }
+  g_array_insert_val (ranges, i, *range);
+
+  if (i != 0)
+  {
+    GumMemoryRange * prev = &g_array_index (ranges, GumMemoryRange, i - 1);
+
+    if (prev->base_address + prev->size >= range->base_address)
+    {
+      prev->size = MAX (prev->base_address + prev->size,
+          range->base_address + range->size) - prev->base_address;
+      g_array_remove_index (ranges, i);
+      i--;
+    }
+  }
+
+  cur = &g_array_index (ranges, GumMemoryRange, i);
+  while (i + 1 != ranges->len)
+  {
+    GumMemoryRange * next = &g_array_index (ranges, GumMemoryRange, i + 1);
+
+    if (cur->base_address + cur->size < next->base_address)
+      break;
+
+    cur->size = MAX (cur->base_address + cur->size,
+        next->base_address + next->size) - cur->base_address;
+    g_array_remove_index (ranges, i + 1);
+  }
+}
+
+static gboolean
+gum_memory_ranges_contain (GArray * ranges,
+                           gconstpointer address)
+{
+  GumAddress needle = GUM_ADDRESS (address);
+  guint lo, hi;
+
+  lo = 0;
+  hi = ranges->len;
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+    GumMemoryRange * r = &g_array_index (ranges, GumMemoryRange, mid);
+
+    if (needle < r->base_address)
+      hi = mid;
+    else if (needle >= r->base_address + r->size)
+      lo = mid + 1;
+    else
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+gint
+gum_stalker_get_trust_threshold (GumStalker * self)
+{
+  return self->trust_threshold;
+}
+
+void
+gum_stalker_set_trust_threshold (GumStalker * self,
+                                 gint trust_threshold)
+{
+  self->trust_threshold = trust_threshold;
+}
+
+guint
+gum_stalker_get_ic_entries (GumStalker * self)
+{
+  return self->ic_entries;
+}
+
+void
+gum_stalker_set_ic_entries (GumStalker * self,
+                            guint ic_entries)
+{
+  g_return_if_fail (ic_entries >= GUM_DEFAULT_IC_ENTRIES &&
+      ic_entries <= GUM_MAX_IC_ENTRIES);
+
+  self->ic_entries = ic_entries;
+}
+
+gboolean
+gum_stalker_get_ic_fallback_enabled (GumStalker * self)
+{
+  return self->ic_fallback_enabled;
+}
+
+void
+gum_stalker_set_ic_fallback_enabled (GumStalker * self,
+                                     gboolean enabled)
+{
+  self->ic_fallback_enabled = enabled;
+}
+
+gboolean
+gum_stalker_get_huge_pages_enabled (GumStalker * self)
+{
+  return self->huge_pages_enabled;
+}
+
+/*
+ * Asks for code slabs to be backed by huge pages where the OS supports it,
+ * which helps with iTLB misses when a lot of code gets translated. Only
+ * applies to slabs allocated after the call.
+ */
+void
+gum_stalker_set_huge_pages_enabled (GumStalker * self,
+                                    gboolean enabled)
+{
+  self->huge_pages_enabled = enabled;
+}
+
+gboolean
+gum_stalker_get_timestamps_enabled (GumStalker * self)
+{
+  return self->timestamps_enabled;
+}
+
+/*
+ * Asks for every event to carry a gum_timestamp_now() reading. Only applies
+ * to threads followed after the call.
+ */
+void
+gum_stalker_set_timestamps_enabled (GumStalker * self,
+                                    gboolean enabled)
+{
+  self->timestamps_enabled = enabled;
+}
+
+gsize
+gum_stalker_get_code_budget (GumStalker * self)
+{
+  return self->code_budget;
+}
+
+/*
+ * Bounds how much memory each followed thread may spend on generated code,
+ * in bytes, with 0 meaning no limit. Once the budget is spent the thread's
+ * code cache is flushed at the next block transition, and the memory behind
+ * it is reused for new blocks. This applies whatever the trust threshold.
+ * Only affects threads followed after the call. Returns FALSE if the budget
+ * is not supported, in which case it is ignored.
+ */
+gboolean
+gum_stalker_set_code_budget (GumStalker * self,
+                             gsize budget)
+{
+  self->code_budget = budget;
+
+  return TRUE;
+}
+
+guint
+gum_stalker_get_block_sample_interval (GumStalker * self)
+{
+  return self->block_sample_interval;
+}
+
+/*
+ * Makes GUM_BLOCK events statistical: each block only reports every
+ * `interval`th execution, starting with the first one. The countdown lives
+ * in the generated code, so skipped executions never leave it. 0 or 1 means
+ * that every execution is reported.
+ */
+void
+gum_stalker_set_block_sample_interval (GumStalker * self,
+                                       guint interval)
+{
+  self->block_sample_interval = interval;
+}
+
+/*
+ * Makes every block compiled from now on record the edge that led to it in
+ * `bitmap`, the way AFL does: the byte at the previous block's ID, shifted
+ * right by one, XORed with this block's ID is incremented, and may wrap. IDs
+ * are derived from block addresses, and `size` must be a power of two. The
+ * previous block is tracked per thread. Pass NULL to stop instrumenting new
+ * blocks; blocks that were already compiled keep their coverage code until
+ * flushed, so the bitmap must outlive them.
+ */
+void
+gum_stalker_set_coverage_bitmap (GumStalker * self,
+                                 guint8 * bitmap,
+                                 gsize size)
+{
+  g_assert (bitmap == NULL || (size != 0 && (size & (size - 1)) == 0));
+
+  self->coverage_bitmap = bitmap;
+  self->coverage_mask = (bitmap != NULL) ? size - 1 : 0;
+}
+
+/*
+ * Clears the bitmap and forgets each thread's previous block, so that the
+ * next run does not start with an edge from wherever the last one ended.
+ */
+void
+gum_stalker_reset_coverage (GumStalker * self)
+{
+  GList * cur;
+
+  if (self->coverage_bitmap == NULL)
+    return;
+
+  memset (self->coverage_bitmap, 0, self->coverage_mask + 1);
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+  {
+    GumExecCtx * ctx = (GumExecCtx *) cur->data;
+
+    ctx->coverage_prev = 0;
+  }
+
+  GUM_STALKER_UNLOCK (self);
+}
+
+/*
+ * Flushes the sink of each followed thread, and asks each thread to hand
+ * over the events it has buffered. The buffers are written to without any
+ * locking, so only their owner may drain them: it does so at its next block
+ * transition, and flushes its sink again right after. A thread that is
+ * blocked or running outside the scope holds on to its events until then.
+ */
+void
+gum_stalker_flush (GumStalker * self)
+{
+  GSList * sinks, * cur;
+  GList * link;
+
+  GUM_STALKER_LOCK (self);
+
+  sinks = NULL;
+  for (link = self->contexts.head; link != NULL; link = link->next)
+  {
+    GumExecCtx * ctx = link->data;
+
+    ctx->flush_pending = TRUE;
+
+    sinks = g_slist_prepend (sinks, g_object_ref (ctx->sink));
+  }
+
+  GUM_STALKER_UNLOCK (self);
+
+  for (cur = sinks; cur != NULL; cur = cur->next)
+  {
+    GumEventSink * sink = cur->data;
+
+    gum_event_sink_flush (sink);
+  }
+
+  g_slist_free_full (sinks, g_object_unref);
+}
+
+void
+gum_stalker_stop (GumStalker * self)
+{
+  GHashTableIter iter;
+  GumCallProbeSlot * slot;
+  GPtrArray * old_probes;
+  gboolean rescan_needed;
+  GList * cur;
+
+  old_probes = g_ptr_array_new_with_free_func (gum_stalker_free_probe_array);
+
+  gum_spinlock_acquire (&self->probe_lock);
+  g_hash_table_remove_all (self->probe_target_by_id);
+  g_hash_table_iter_init (&iter, self->probe_slot_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &slot))
+  {
+    if (slot->probes != NULL)
+    {
+      g_ptr_array_add (old_probes, slot->probes);
+      g_atomic_pointer_set (&slot->probes, NULL);
+    }
+  }
+  self->any_probes_attached = FALSE;
+  gum_spinlock_release (&self->probe_lock);
+
+  gum_stalker_synchronize_call_probes (self);
+  g_ptr_array_unref (old_probes);
+
+  GUM_STALKER_LOCK (self);
+
+  do
+  {
+    rescan_needed = FALSE;
+
+    for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+    {
+      GumExecCtx * ctx = (GumExecCtx *) cur->data;
+      if (ctx->state == GUM_EXEC_CTX_ACTIVE)
+      {
+        GumThreadId thread_id = ctx->thread_id;
+
+        GUM_STALKER_UNLOCK (self);
+        gum_stalker_unfollow (self, thread_id);
+        GUM_STALKER_LOCK (self);
+
+        rescan_needed = TRUE;
+        break;
+      }
+    }
+  }
+  while (rescan_needed);
+
+  GUM_STALKER_UNLOCK (self);
+
+  gum_stalker_garbage_collect (self);
+}
+
+/*
+ * Threads that unfollow themselves push their contexts onto self->garbage
+ * without taking any lock, so all we have to do here is take that list, unlink
+ * what is on it and drop the references it holds, while the code and data go
+ * to the reclaimer thread to be unmapped. That only happens after a grace
+ * period, as the threads may not have made it out of our code just yet.
+ *
+ * Contexts whose thread is known to be done with them are marked
+ * GUM_EXEC_CTX_RECYCLE_PENDING, and are recycled or freed right away instead.
+ * The references are only dropped once we have unlocked, as that may run the
+ * finalizers of the sink, the transformer or the Stalker itself.
+ */
+gboolean
+gum_stalker_garbage_collect (GumStalker * self)
+{
+  GumExecCtx * batch, * ctx, * doomed;
+  gboolean pending_garbage, any_doomed;
+
+  do
+  {
+    batch = g_atomic_pointer_get (&self->garbage);
+  }
+  while (batch != NULL &&
+      !g_atomic_pointer_compare_and_exchange (&self->garbage, batch, NULL));
+
+  GUM_STALKER_LOCK (self);
+
+  any_doomed = FALSE;
+  for (ctx = batch; ctx != NULL; ctx = ctx->next_garbage)
+  {
+    gum_exec_ctx_collect_stats (ctx, &self->retired_stats);
+    g_queue_unlink (&self->contexts, &ctx->link);
+    if (ctx->state != GUM_EXEC_CTX_RECYCLE_PENDING)
+      any_doomed = TRUE;
+  }
+
+  if (any_doomed && self->reclaimer == NULL)
+  {
+    self->reclaimer = g_thread_new ("gum-stalker-reclaimer",
+        (GThreadFunc) gum_stalker_reclaim_garbage,
+        g_async_queue_ref (self->reclaim_queue));
+  }
+
+  pending_garbage = !g_queue_is_empty (&self->contexts);
+
+  GUM_STALKER_UNLOCK (self);
+
+  doomed = NULL;
+  ctx = batch;
+  while (ctx != NULL)
+  {
+    GumExecCtx * next = ctx->next_garbage;
+
+    if (ctx->state == GUM_EXEC_CTX_RECYCLE_PENDING)
+    {
+      gum_exec_ctx_free (ctx);
+    }
+    else
+    {
+      gum_exec_ctx_release (ctx);
+      ctx->next_garbage = doomed;
+      doomed = ctx;
+    }
+
+    ctx = next;
+  }
+
+  if (doomed != NULL)
+  {
+    doomed->retired_at = g_get_monotonic_time ();
+    g_async_queue_push (self->reclaim_queue, doomed);
+  }
+
+  return pending_garbage;
+}
+
+/* Cloaked, so that it is never followed or suspended along with the app. */
+static gpointer
+gum_stalker_reclaim_garbage (GAsyncQueue * queue)
+{
+  GumThreadId thread_id;
+  GumExecCtx * batch;
+
+  thread_id = gum_process_get_current_thread_id ();
+  gum_cloak_add_thread (thread_id);
+
+  while ((batch = g_async_queue_pop (queue)) != GUM_RECLAIM_STOP)
+  {
+    gint64 delay;
+
+    delay = batch->retired_at + GUM_RECLAIM_GRACE_PERIOD -
+        g_get_monotonic_time ();
+    if (delay > 0)
+      g_usleep (delay);
+
+    while (batch != NULL)
+    {
+      GumExecCtx * next = batch->next_garbage;
+      gum_exec_ctx_free_memory (batch);
+      batch = next;
+    }
+  }
+
+  g_async_queue_unref (queue);
+
+  gum_cloak_remove_thread (thread_id);
+
+  return NULL;
+}
+
+/*
+ * Threads still being followed keep on counting while we read, so their share
+ * is only approximate.
+ */
+void
+gum_stalker_get_stats (GumStalker * self,
+                       GumStalkerStats * stats)
+{
+  GList * cur;
+
+  GUM_STALKER_LOCK (self);
+
+  *stats = self->retired_stats;
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+    gum_exec_ctx_collect_stats ((GumExecCtx *) cur->data, stats);
+
+  GUM_STALKER_UNLOCK (self);
+}
+
+#ifdef _MSC_VER
+
+#define RETURN_ADDRESS_POINTER_FROM_FIRST_ARGUMENT(arg)   \
+    ((gpointer *) ((volatile guint8 *) &arg - sizeof (gpointer)))
+
+void
+gum_stalker_follow_me (GumStalker * self,
+                       GumStalkerTransformer * transformer,
+                       GumEventSink * sink)
+{
+  volatile gpointer * ret_addr_ptr;
+
+  ret_addr_ptr = RETURN_ADDRESS_POINTER_FROM_FIRST_ARGUMENT (self);
+
+  _gum_stalker_do_follow_me (self, transformer, sink, ret_addr_ptr);
+}
+
+#endif
+
+void
+_gum_stalker_do_follow_me (GumStalker * self,
+                           GumStalkerTransformer * transformer,
+                           GumEventSink * sink,
+                           volatile gpointer * ret_addr_ptr)
+{
+  GumExecCtx * ctx;
+  gpointer code_address;
+
+  ctx = gum_stalker_create_exec_ctx (self, gum_process_get_current_thread_id (),
+      transformer, sink);
+  gum_stalker_set_exec_ctx (self, ctx);
+
+  if (gum_stalker_is_in_scope (self, *ret_addr_ptr))
+  {
+    ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, *ret_addr_ptr,
+        &code_address);
+    *ret_addr_ptr = code_address;
+
+    ctx->scope_depth = (self->scopes->len != 0) ? 1 : 0;
+    ctx->outermost_scope_depth = ctx->scope_depth;
+  }
+
+  gum_event_sink_start (sink);
+}
+
+void
+gum_stalker_unfollow_me (GumStalker * self)
+{
+  GumExecCtx * ctx;
+
+  ctx = gum_stalker_get_exec_ctx (self);
+  g_assert (ctx != NULL);
+
+  gum_exec_ctx_dispose_callouts (ctx);
+
+  gum_exec_ctx_flush_events (ctx);
+  gum_event_sink_stop (ctx->sink);
+
+  if (ctx->current_block != NULL &&
+      ctx->current_block->has_call_to_excluded_range)
+  {
+    ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
+  }
+  else if (ctx->current_block == NULL && ctx->scope_depth != 0)
+  {
+    ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
+  }
+  else if (gum_exec_ctx_is_in_user_callback (ctx))
+  {
+    ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
+  }
+  else
+  {
+    /* Unless we were called while outside the scope, running natively. */
+    g_assert (ctx->unfollow_called_while_still_following ||
+        ctx->current_block == NULL);
+
+    gum_stalker_set_exec_ctx (self, NULL);
 
-    gum_exec_ctx_free (ctx);
+    ctx->state = GUM_EXEC_CTX_RECYCLE_PENDING;
+    gum_exec_ctx_push_garbage (ctx);
+
+    gum_stalker_garbage_collect (self);
   }
 }
 
@@ -739,6 +1730,30 @@ gum_stalker_is_following_me (GumStalker * self)
   return gum_stalker_get_exec_ctx (self) != NULL;
 }
 
+/*
+ * Compiles the block at `address` ahead of time for the calling thread, which
+ * must be followed, so that a list of hot blocks recorded during a previous
+ * session (e.g. from GUM_COMPILE events) can warm up the cache right after
+ * attaching. Setting `recycle_count` to the trust threshold or above lets
+ * branches to the block be backpatched on first use.
+ */
+void
+gum_stalker_prefetch (GumStalker * self,
+                      gconstpointer address,
+                      gint recycle_count)
+{
+  GumExecCtx * ctx;
+  GumExecBlock * block;
+  gpointer code_address;
+
+  ctx = gum_stalker_get_exec_ctx (self);
+  g_assert (ctx != NULL);
+
+  block = gum_exec_ctx_obtain_block_for (ctx, (gpointer) address,
+      &code_address);
+  block->recycle_count = recycle_count;
+}
+
 void
 gum_stalker_follow (GumStalker * self,
                     GumThreadId thread_id,
@@ -759,6 +1774,27 @@ gum_stalker_follow (GumStalker * self,
   }
 }
 
+/*
+ * Like gum_stalker_follow() for each of `thread_ids`, which must not include
+ * the calling thread, except that they are all modified in one go. Returns
+ * how many of them were followed.
+ */
+guint
+gum_stalker_follow_threads (GumStalker * self,
+                            const GumThreadId * thread_ids,
+                            guint num_threads,
+                            GumStalkerTransformer * transformer,
+                            GumEventSink * sink)
+{
+  GumInfectContext ctx;
+  ctx.stalker = self;
+  ctx.transformer = transformer;
+  ctx.sink = sink;
+
+  return gum_process_modify_threads (thread_ids, num_threads,
+      gum_stalker_infect, &ctx);
+}
+
 void
 gum_stalker_unfollow (GumStalker * self,
                       GumThreadId thread_id)
@@ -769,11 +1805,12 @@ gum_stalker_unfollow (GumStalker * self,
   }
   else
   {
-    GSList * cur;
+    GList * cur;
+    gboolean disinfected = FALSE;
 
     GUM_STALKER_LOCK (self);
 
-    for (cur = self->contexts; cur != NULL; cur = cur->next)
+    for (cur = self->contexts.head; cur != NULL; cur = cur->next)
     {
       GumExecCtx * ctx = (GumExecCtx *) cur->data;
       if (ctx->thread_id == thread_id && ctx->state == GUM_EXEC_CTX_ACTIVE)
@@ -789,11 +1826,12 @@ gum_stalker_unfollow (GumStalker * self,
         else
         {
           GumDisinfectContext dc;
-          dc.stalker = self;
           dc.exec_ctx = ctx;
           dc.success = FALSE;
           gum_process_modify_thread (thread_id, gum_stalker_disinfect, &dc);
-          if (!dc.success)
+          if (dc.success)
+            disinfected = TRUE;
+          else
             ctx->state = GUM_EXEC_CTX_UNFOLLOW_PENDING;
         }
 
@@ -802,6 +1840,9 @@ gum_stalker_unfollow (GumStalker * self,
     }
 
     GUM_STALKER_UNLOCK (self);
+
+    if (disinfected)
+      gum_stalker_garbage_collect (self);
   }
 }
 
@@ -813,21 +1854,35 @@ gum_stalker_infect (GumThreadId thread_id,
   GumInfectContext * infect_context = (GumInfectContext *) user_data;
   GumStalker * self = infect_context->stalker;
   GumExecCtx * ctx;
-  gpointer code_address;
+  gpointer pc, code_address;
   GumX86Writer cw;
 
   ctx = gum_stalker_create_exec_ctx (self, thread_id,
       infect_context->transformer, infect_context->sink);
 
-  ctx->current_block = gum_exec_ctx_obtain_block_for (ctx,
-      GSIZE_TO_POINTER (GUM_CPU_CONTEXT_XIP (cpu_context)), &code_address);
+  pc = GSIZE_TO_POINTER (GUM_CPU_CONTEXT_XIP (cpu_context));
+
+  if (gum_stalker_is_in_scope (self, pc))
+  {
+    ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, pc,
+        &code_address);
+
+    ctx->scope_depth = (self->scopes->len != 0) ? 1 : 0;
+    ctx->outermost_scope_depth = ctx->scope_depth;
+  }
+  else
+  {
+    code_address = pc;
+    ctx->infect_pc = pc;
+  }
+
   GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (ctx->infect_thunk);
 
   gum_x86_writer_init (&cw, ctx->infect_thunk);
   gum_exec_ctx_write_prolog (ctx, GUM_PROLOG_MINIMAL, &cw);
   gum_x86_writer_put_call_address_with_aligned_arguments (&cw, GUM_CALL_CAPI,
-      GUM_ADDRESS (gum_tls_key_set_value), 2,
-      GUM_ARG_ADDRESS, GUM_ADDRESS (self->exec_ctx),
+      GUM_ADDRESS (gum_stalker_set_exec_ctx), 2,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (self),
       GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
   gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_MINIMAL, &cw);
   gum_x86_writer_put_jmp_address (&cw, GUM_ADDRESS (code_address));
@@ -842,7 +1897,6 @@ gum_stalker_disinfect (GumThreadId thread_id,
                        gpointer user_data)
 {
   GumDisinfectContext * disinfect_context = (GumDisinfectContext *) user_data;
-  GumStalker * self = disinfect_context->stalker;
   GumExecCtx * ctx = disinfect_context->exec_ctx;
   gboolean infection_not_active_yet;
 
@@ -850,11 +1904,13 @@ gum_stalker_disinfect (GumThreadId thread_id,
       GUM_CPU_CONTEXT_XIP (cpu_context) == GPOINTER_TO_SIZE (ctx->infect_thunk);
   if (infection_not_active_yet)
   {
-    GUM_CPU_CONTEXT_XIP (cpu_context) =
-        GPOINTER_TO_SIZE (ctx->current_block->real_begin);
+    GUM_CPU_CONTEXT_XIP (cpu_context) = GPOINTER_TO_SIZE (
+        (ctx->current_block != NULL)
+            ? ctx->current_block->real_begin
+            : ctx->infect_pc);
 
-    self->contexts = g_slist_remove (self->contexts, ctx);
-    gum_exec_ctx_free (ctx);
+    ctx->state = GUM_EXEC_CTX_RECYCLE_PENDING;
+    gum_exec_ctx_push_garbage (ctx);
 
     disinfect_context->success = TRUE;
   }
@@ -868,7 +1924,9 @@ gum_stalker_add_call_probe (GumStalker * self,
                             GDestroyNotify notify)
 {
   GumCallProbe probe;
-  GArray * probes;
+  GumCallProbeSlot * slot;
+  GArray * old_probes, * new_probes;
+  GArray * old_index = NULL;
 
   probe.id = g_atomic_int_add (&self->last_probe_id, 1) + 1;
   probe.callback = callback;
@@ -880,20 +1938,23 @@ gum_stalker_add_call_probe (GumStalker * self,
   g_hash_table_insert (self->probe_target_by_id, GSIZE_TO_POINTER (probe.id),
       target_address);
 
-  probes = (GArray *)
-      g_hash_table_lookup (self->probe_array_by_address, target_address);
-  if (probes == NULL)
-  {
-    probes = g_array_sized_new (FALSE, FALSE, sizeof (GumCallProbe), 4);
-    g_hash_table_insert (self->probe_array_by_address, target_address, probes);
-  }
+  slot = gum_stalker_obtain_call_probe_slot (self, target_address, &old_index);
 
-  g_array_append_val (probes, probe);
+  old_probes = slot->probes;
+  new_probes = gum_call_probe_array_copy (old_probes, 1);
+  g_array_append_val (new_probes, probe);
+  g_atomic_pointer_set (&slot->probes, new_probes);
 
   self->any_probes_attached = TRUE;
 
   gum_spinlock_release (&self->probe_lock);
 
+  gum_stalker_synchronize_call_probes (self);
+  if (old_probes != NULL)
+    g_array_free (old_probes, TRUE);
+  if (old_index != NULL)
+    g_array_free (old_index, TRUE);
+
   gum_stalker_invalidate_caches (self);
 
   return probe.id;
@@ -904,6 +1965,8 @@ gum_stalker_remove_call_probe (GumStalker * self,
                                GumProbeId id)
 {
   gpointer target_address;
+  GArray * old_probes = NULL;
+  GumCallProbe removed_probe = { 0, };
 
   gum_spinlock_acquire (&self->probe_lock);
 
@@ -911,44 +1974,162 @@ gum_stalker_remove_call_probe (GumStalker * self,
       g_hash_table_lookup (self->probe_target_by_id, GSIZE_TO_POINTER (id));
   if (target_address != NULL)
   {
-    GArray * probes;
-    gint match_index = -1;
+    GumCallProbeSlot * slot;
+    GArray * new_probes;
     guint i;
-    GumCallProbe * probe;
 
     g_hash_table_remove (self->probe_target_by_id, GSIZE_TO_POINTER (id));
 
-    probes = (GArray *)
-        g_hash_table_lookup (self->probe_array_by_address, target_address);
-    g_assert (probes != NULL);
+    slot = g_hash_table_lookup (self->probe_slot_by_address, target_address);
+    g_assert (slot != NULL);
 
-    for (i = 0; i != probes->len; i++)
+    old_probes = slot->probes;
+    new_probes = (old_probes->len > 1)
+        ? gum_call_probe_array_copy (NULL, old_probes->len - 1)
+        : NULL;
+
+    for (i = 0; i != old_probes->len; i++)
     {
-      if (g_array_index (probes, GumCallProbe, i).id == id)
-      {
-        match_index = i;
-        break;
-      }
-    }
-    g_assert_cmpint (match_index, !=, -1);
+      GumCallProbe * probe = &g_array_index (old_probes, GumCallProbe, i);
 
-    probe = &g_array_index (probes, GumCallProbe, match_index);
-    if (probe->user_notify != NULL)
-      probe->user_notify (probe->user_data);
-    g_array_remove_index (probes, match_index);
+      if (probe->id == id)
+        removed_probe = *probe;
+      else
+        g_array_append_val (new_probes, *probe);
+    }
+    g_assert_cmpuint (removed_probe.id, ==, id);
 
-    if (probes->len == 0)
-      g_hash_table_remove (self->probe_array_by_address, target_address);
+    g_atomic_pointer_set (&slot->probes, new_probes);
 
     self->any_probes_attached =
-        g_hash_table_size (self->probe_array_by_address) != 0;
+        g_hash_table_size (self->probe_target_by_id) != 0;
   }
 
   gum_spinlock_release (&self->probe_lock);
 
+  if (old_probes != NULL)
+  {
+    gum_stalker_synchronize_call_probes (self);
+
+    if (removed_probe.user_notify != NULL)
+      removed_probe.user_notify (removed_probe.user_data);
+    g_array_free (old_probes, TRUE);
+  }
+
   gum_stalker_invalidate_caches (self);
 }
 
+static GumCallProbeSlot *
+gum_stalker_obtain_call_probe_slot (GumStalker * self,
+                                    gpointer target_address,
+                                    GArray ** old_index)
+{
+  GumCallProbeSlot * slot;
+  GArray * index;
+  guint i;
+
+  slot = g_hash_table_lookup (self->probe_slot_by_address, target_address);
+  if (slot != NULL)
+    return slot;
+
+  slot = g_slice_new (GumCallProbeSlot);
+  slot->target_address = target_address;
+  slot->probes = NULL;
+  g_hash_table_insert (self->probe_slot_by_address, target_address, slot);
+
+  *old_index = self->probe_index;
+
+  index = g_array_sized_new (FALSE, FALSE, sizeof (GumCallProbeSlot *),
+      (*old_index)->len + 1);
+  g_array_append_vals (index, (*old_index)->data, (*old_index)->len);
+  for (i = 0; i != index->len; i++)
+  {
+    if (g_array_index (index, GumCallProbeSlot *, i)->target_address >
+        target_address)
+      break;
+  }
+  g_array_insert_val (index, i, slot);
+
+  g_atomic_pointer_set (&self->probe_index, index);
+
+  return slot;
+}
+
+/*
+ * Returns once no thread can still be looking at probes or an index that
+ * was just replaced. Readers make their context's probe_epoch odd while
+ * they are inside the dispatch code, so we only have to wait for those that
+ * are odd right now to move on. Must not be called from a probe callback.
+ *
+ * The callbacks we are waiting for may take the Stalker lock themselves, so
+ * it is only held to take a snapshot and then for each check, never while
+ * yielding. A context is only ever freed after being unlinked under the
+ * lock, so one that is still linked is safe to look at.
+ */
+static void
+gum_stalker_synchronize_call_probes (GumStalker * self)
+{
+  GArray * busy_ctxs;
+  GList * cur;
+  guint i;
+
+  busy_ctxs = g_array_new (FALSE, FALSE, sizeof (GumBusyExecCtx));
+
+  GUM_STALKER_LOCK (self);
+
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
+  {
+    GumBusyExecCtx busy;
+
+    busy.ctx = (GumExecCtx *) cur->data;
+    busy.epoch = g_atomic_int_get (&busy.ctx->probe_epoch);
+    if ((busy.epoch & 1) != 0)
+      g_array_append_val (busy_ctxs, busy);
+  }
+
+  GUM_STALKER_UNLOCK (self);
+
+  for (i = 0; i != busy_ctxs->len; i++)
+  {
+    GumBusyExecCtx * busy = &g_array_index (busy_ctxs, GumBusyExecCtx, i);
+
+    while (gum_stalker_is_still_dispatching (self, busy))
+      g_thread_yield ();
+  }
+
+  g_array_free (busy_ctxs, TRUE);
+}
+
+static gboolean
+gum_stalker_is_still_dispatching (GumStalker * self,
+                                  const GumBusyExecCtx * busy)
+{
+  gboolean dispatching;
+
+  GUM_STALKER_LOCK (self);
+
+  dispatching = g_queue_find (&self->contexts, busy->ctx) != NULL &&
+      g_atomic_int_get (&busy->ctx->probe_epoch) == busy->epoch;
+
+  GUM_STALKER_UNLOCK (self);
+
+  return dispatching;
+}
+
+static GArray *
+gum_call_probe_array_copy (GArray * probes,
+                           guint extra)
+{
+  GArray * copy;
+  guint len = (probes != NULL) ? probes->len : 0;
+
+  copy = g_array_sized_new (FALSE, FALSE, sizeof (GumCallProbe), len + extra);
+  if (probes != NULL)
+    g_array_append_vals (copy, probes->data, probes->len);
+
+  return copy;
+}
+
 static void
 gum_stalker_free_probe_array (gpointer data)
 {
@@ -965,6 +2146,38 @@ gum_stalker_free_probe_array (gpointer data)
   g_array_free (probes, TRUE);
 }
 
+static void
+gum_call_probe_slot_free (GumCallProbeSlot * slot)
+{
+  if (slot->probes != NULL)
+    gum_stalker_free_probe_array (slot->probes);
+
+  g_slice_free (GumCallProbeSlot, slot);
+}
+
+static GumCallProbeSlot *
+gum_call_probe_index_find (GArray * index,
+                           gconstpointer target_address)
+{
+  guint lo = 0, hi = index->len;
+
+  while (lo != hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+    GumCallProbeSlot * slot = g_array_index (index, GumCallProbeSlot *, mid);
+
+    if (slot->target_address == target_address)
+      return slot;
+
+    if (slot->target_address < target_address)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  return NULL;
+}
+
 static GumExecCtx *
 gum_stalker_create_exec_ctx (GumStalker * self,
                              GumThreadId thread_id,
@@ -978,17 +2191,42 @@ gum_stalker_create_exec_ctx (GumStalker * self,
   if (sizeof (GumExecCtx) % self->page_size != 0)
     base_size++;
 
-  ctx = (GumExecCtx *)
-      gum_alloc_n_pages (base_size + GUM_CODE_SLAB_SIZE_IN_PAGES + 1,
-          GUM_PAGE_RWX);
+  ctx = gum_stalker_take_spare_exec_ctx (self);
+  if (ctx == NULL)
+  {
+    ctx = (GumExecCtx *)
+        gum_alloc_n_pages (base_size + GUM_CODE_SLAB_SIZE_IN_PAGES + 1,
+            GUM_PAGE_RWX);
+
+    gum_metal_map_init (&ctx->mappings);
+    gum_exec_ctx_create_thunks (ctx);
+
+    if (self->huge_pages_enabled)
+    {
+      gum_memory_advise_huge_pages (
+          ((guint8 *) ctx) + (base_size * self->page_size),
+          GUM_CODE_SLAB_SIZE_IN_PAGES * self->page_size);
+    }
+  }
   ctx->state = GUM_EXEC_CTX_ACTIVE;
   ctx->invalidate_pending = FALSE;
+  ctx->flush_pending = FALSE;
+  ctx->probe_epoch = 0;
+  ctx->coverage_prev = 0;
 
   ctx->code_slab = &ctx->first_code_slab;
   ctx->first_code_slab.data = ((guint8 *) ctx) + (base_size * self->page_size);
   ctx->first_code_slab.offset = 0;
   ctx->first_code_slab.size = GUM_CODE_SLAB_SIZE_IN_PAGES * self->page_size;
   ctx->first_code_slab.next = NULL;
+  ctx->retired_slabs = NULL;
+  ctx->spare_slabs = NULL;
+  ctx->reserve_slab = NULL;
+  ctx->code_slab_count = 0;
+  ctx->max_code_slabs = (self->code_budget != 0)
+      ? MAX (self->code_budget /
+          (GUM_CODE_SLAB_SIZE_IN_PAGES * self->page_size), 2)
+      : 0;
   ctx->last_prolog_minimal = NULL;
   ctx->last_epilog_minimal = NULL;
   ctx->last_prolog_full = NULL;
@@ -1000,13 +2238,29 @@ gum_stalker_create_exec_ctx (GumStalker * self,
   ctx->first_frame = (GumExecFrame *) (ctx->code_slab->data +
       ctx->code_slab->size + self->page_size - sizeof (GumExecFrame));
   ctx->current_frame = ctx->first_frame;
-
-  ctx->mappings = gum_metal_hash_table_new (NULL, NULL);
+  ctx->scope_depth = 0;
+  ctx->outermost_scope_depth = 0;
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+  ctx->user_callback_depth = 0;
+#endif
 
   ctx->resume_at = NULL;
   ctx->return_at = NULL;
   ctx->app_stack = NULL;
 
+  memset (&ctx->stats, 0, sizeof (ctx->stats));
+  ctx->ic_lookups = 0;
+
+  ctx->ic_entries = self->ic_entries;
+  ctx->ic_fallback = self->ic_fallback_enabled
+      ? g_new0 (GumIcEntry, GUM_IC_FALLBACK_SIZE)
+      : NULL;
+  ctx->ic_fallback_code = NULL;
+  ctx->block_min_size = GUM_EXEC_BLOCK_MIN_SIZE +
+      ((ctx->ic_entries - GUM_DEFAULT_IC_ENTRIES) * GUM_IC_ENTRY_MAX_CODE_SIZE);
+  if (ctx->ic_fallback != NULL)
+    ctx->block_min_size += GUM_IC_FALLBACK_MAX_CODE_SIZE;
+
   ctx->stalker = g_object_ref (self);
   ctx->thread_id = thread_id;
 
@@ -1017,16 +2271,33 @@ gum_stalker_create_exec_ctx (GumStalker * self,
     ctx->transformer = g_object_ref (transformer);
   else
     ctx->transformer = gum_stalker_transformer_make_default ();
-  g_queue_init (&ctx->callout_entries);
+
+  /* Only custom transformers get to see the instructions. */
+  gum_x86_relocator_set_detail_needed (&ctx->relocator,
+      !GUM_IS_DEFAULT_STALKER_TRANSFORMER (ctx->transformer));
+  ctx->callout_pages = NULL;
   gum_spinlock_init (&ctx->callout_lock);
   ctx->sink = (GumEventSink *) g_object_ref (sink);
   ctx->sink_mask = gum_event_sink_query_mask (sink);
+  ctx->sink_has_location_mask = gum_event_sink_has_location_mask (sink);
   ctx->sink_process_impl = GUM_EVENT_SINK_GET_IFACE (sink)->process;
-
-  gum_exec_ctx_create_thunks (ctx);
+  ctx->timestamps_enabled = self->timestamps_enabled;
+  if ((ctx->sink_mask & (GUM_EXEC | GUM_BLOCK)) != 0)
+  {
+    ctx->event_buffer = g_new0 (GumEvent, GUM_EVENT_BUFFER_SIZE);
+    ctx->event_buffer_cur = ctx->event_buffer;
+    ctx->event_buffer_end = ctx->event_buffer + GUM_EVENT_BUFFER_SIZE;
+  }
+  else
+  {
+    ctx->event_buffer = NULL;
+    ctx->event_buffer_cur = NULL;
+    ctx->event_buffer_end = NULL;
+  }
 
   GUM_STALKER_LOCK (self);
-  self->contexts = g_slist_prepend (self->contexts, ctx);
+  ctx->link.data = ctx;
+  g_queue_push_head_link (&self->contexts, &ctx->link);
   GUM_STALKER_UNLOCK (self);
 
   gum_exec_ctx_ensure_inline_helpers_reachable (ctx);
@@ -1037,17 +2308,40 @@ gum_stalker_create_exec_ctx (GumStalker * self,
 static GumExecCtx *
 gum_stalker_get_exec_ctx (GumStalker * self)
 {
-  return (GumExecCtx *) gum_tls_key_get_value (self->exec_ctx);
+  return (GumExecCtx *) gum_tls_key_get_value (self->exec_ctx);
+}
+
+static void
+gum_stalker_set_exec_ctx (GumStalker * self,
+                          GumExecCtx * ctx)
+{
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+  /*
+   * Also kept where gum_enter_user_callback() can find it without walking
+   * gum_stalkers, which would mean taking a lock on every callback.
+   */
+  if (ctx != NULL)
+  {
+    gum_tls_key_set_value (gum_user_callback_ctx, ctx);
+  }
+  else if (gum_tls_key_get_value (gum_user_callback_ctx) ==
+      gum_stalker_get_exec_ctx (self))
+  {
+    gum_tls_key_set_value (gum_user_callback_ctx, NULL);
+  }
+#endif
+
+  gum_tls_key_set_value (self->exec_ctx, ctx);
 }
 
 static void
 gum_stalker_invalidate_caches (GumStalker * self)
 {
-  GSList * cur;
+  GList * cur;
 
   GUM_STALKER_LOCK (self);
 
-  for (cur = self->contexts; cur != NULL; cur = cur->next)
+  for (cur = self->contexts.head; cur != NULL; cur = cur->next)
   {
     GumExecCtx * ctx = (GumExecCtx *) cur->data;
 
@@ -1060,20 +2354,25 @@ gum_stalker_invalidate_caches (GumStalker * self)
 static void
 gum_exec_ctx_dispose_callouts (GumExecCtx * ctx)
 {
-  GList * cur;
+  GumCalloutPage * page;
 
   gum_spinlock_acquire (&ctx->callout_lock);
 
-  for (cur = ctx->callout_entries.head; cur != NULL; cur = cur->next)
+  for (page = ctx->callout_pages; page != NULL; page = page->next)
   {
-    GumCalloutEntry * entry = cur->data;
+    guint i;
+
+    for (i = 0; i != page->num_entries; i++)
+    {
+      GumCalloutEntry * entry = &page->entries[i];
 
-    if (entry->data_destroy != NULL)
-      entry->data_destroy (entry->data);
+      if (entry->data_destroy != NULL)
+        entry->data_destroy (entry->data);
 
-    entry->callout = NULL;
-    entry->data = NULL;
-    entry->data_destroy = NULL;
+      entry->callout = NULL;
+      entry->data = NULL;
+      entry->data_destroy = NULL;
+    }
   }
 
   gum_spinlock_release (&ctx->callout_lock);
@@ -1082,24 +2381,76 @@ gum_exec_ctx_dispose_callouts (GumExecCtx * ctx)
 static void
 gum_exec_ctx_finalize_callouts (GumExecCtx * ctx)
 {
-  GList * cur;
+  GumCalloutPage * page = ctx->callout_pages;
+
+  while (page != NULL)
+  {
+    GumCalloutPage * next = page->next;
+    gum_free_pages (page);
+    page = next;
+  }
+
+  ctx->callout_pages = NULL;
+}
 
-  for (cur = ctx->callout_entries.head; cur != NULL; cur = cur->next)
+static GumCalloutEntry *
+gum_exec_ctx_alloc_callout_entry (GumExecCtx * ctx)
+{
+  GumCalloutPage * page = ctx->callout_pages;
+
+  if (page == NULL || page->num_entries == page->capacity)
   {
-    GumCalloutEntry * entry = cur->data;
+    GumCalloutPage * next = page;
 
-    g_slice_free (GumCalloutEntry, entry);
+    page = gum_alloc_n_pages (1, GUM_PAGE_RW);
+    page->next = next;
+    page->num_entries = 0;
+    page->capacity = (gum_query_page_size () -
+        G_STRUCT_OFFSET (GumCalloutPage, entries)) / sizeof (GumCalloutEntry);
+
+    ctx->callout_pages = page;
   }
 
-  g_queue_clear (&ctx->callout_entries);
+  return &page->entries[page->num_entries++];
 }
 
 static void
 gum_exec_ctx_free (GumExecCtx * ctx)
+{
+  if (gum_stalker_recycle_exec_ctx (ctx->stalker, ctx))
+    return;
+
+  gum_exec_ctx_release (ctx);
+  gum_exec_ctx_free_memory (ctx);
+}
+
+static void
+gum_exec_ctx_release (GumExecCtx * ctx)
+{
+  g_object_unref (ctx->sink);
+  g_object_unref (ctx->transformer);
+  g_object_unref (ctx->stalker);
+}
+
+static void
+gum_exec_ctx_free_memory (GumExecCtx * ctx)
+{
+  gum_exec_ctx_clear (ctx);
+  gum_exec_ctx_free_shell (ctx);
+}
+
+/*
+ * Frees what is specific to the thread that was followed, leaving the shell:
+ * the allocation holding the context, its first code slab and its frames, as
+ * well as the thunks and the mappings table.
+ */
+static void
+gum_exec_ctx_clear (GumExecCtx * ctx)
 {
   GumSlab * slab;
 
-  gum_metal_hash_table_unref (ctx->mappings);
+  g_free (ctx->ic_fallback);
+  g_free (ctx->event_buffer);
 
   slab = ctx->code_slab;
   while (slab != &ctx->first_code_slab)
@@ -1108,31 +2459,139 @@ gum_exec_ctx_free (GumExecCtx * ctx)
     gum_free_pages (slab);
     slab = next;
   }
+  gum_exec_ctx_free_code_slabs (ctx->retired_slabs);
+  gum_exec_ctx_free_code_slabs (ctx->spare_slabs);
+  gum_exec_ctx_free_code_slabs (ctx->reserve_slab);
 
-  gum_exec_ctx_destroy_thunks (ctx);
-
-  g_object_unref (ctx->sink);
   gum_exec_ctx_finalize_callouts (ctx);
   gum_spinlock_free (&ctx->callout_lock);
-  g_object_unref (ctx->transformer);
 
   gum_x86_relocator_clear (&ctx->relocator);
   gum_x86_writer_clear (&ctx->code_writer);
+}
 
-  g_object_unref (ctx->stalker);
+static void
+gum_exec_ctx_free_shell (GumExecCtx * ctx)
+{
+  gum_metal_map_free (&ctx->mappings);
+
+  gum_exec_ctx_destroy_thunks (ctx);
 
   gum_free_pages (ctx);
 }
 
+static GumExecCtx *
+gum_stalker_take_spare_exec_ctx (GumStalker * self)
+{
+  GumExecCtx * ctx;
+
+  gum_spinlock_acquire (&self->spare_ctx_lock);
+
+  ctx = self->spare_ctxs;
+  if (ctx != NULL)
+  {
+    self->spare_ctxs = ctx->next_spare;
+    self->n_spare_ctxs--;
+  }
+
+  gum_spinlock_release (&self->spare_ctx_lock);
+
+  return ctx;
+}
+
+/*
+ * Threads that are only followed for a short while spend most of that time
+ * setting up and tearing down their context, so we keep a few shells around
+ * for the next thread to be followed. Everything but the shell is reset, so
+ * gum_stalker_create_exec_ctx() sees the same state as with fresh pages.
+ *
+ * Only contexts that gum_stalker_garbage_collect() knows to be unused are
+ * recycled. The ones that go through the reclaimer are not, as the Stalker
+ * may be gone by the time their grace period is over.
+ */
+static gboolean
+gum_stalker_recycle_exec_ctx (GumStalker * self,
+                              GumExecCtx * ctx)
+{
+  GumMetalMap mappings;
+  gpointer thunks, infect_thunk, scope_exit_thunk;
+
+  gum_spinlock_acquire (&self->spare_ctx_lock);
+  if (self->n_spare_ctxs == GUM_MAX_SPARE_EXEC_CTXS)
+  {
+    gum_spinlock_release (&self->spare_ctx_lock);
+    return FALSE;
+  }
+  self->n_spare_ctxs++;
+  gum_spinlock_release (&self->spare_ctx_lock);
+
+  g_object_unref (ctx->sink);
+  g_object_unref (ctx->transformer);
+  gum_exec_ctx_clear (ctx);
+
+  gum_metal_map_remove_all (&ctx->mappings);
+
+  mappings = ctx->mappings;
+  thunks = ctx->thunks;
+  infect_thunk = ctx->infect_thunk;
+  scope_exit_thunk = ctx->scope_exit_thunk;
+
+  memset (ctx, 0, sizeof (GumExecCtx));
+
+  ctx->mappings = mappings;
+  ctx->thunks = thunks;
+  ctx->infect_thunk = infect_thunk;
+  ctx->scope_exit_thunk = scope_exit_thunk;
+
+  gum_spinlock_acquire (&self->spare_ctx_lock);
+  ctx->next_spare = self->spare_ctxs;
+  self->spare_ctxs = ctx;
+  gum_spinlock_release (&self->spare_ctx_lock);
+
+  g_object_unref (self);
+
+  return TRUE;
+}
+
+static void
+gum_exec_ctx_collect_stats (GumExecCtx * ctx,
+                            GumStalkerStats * stats)
+{
+  GumStalkerStats s = ctx->stats;
+
+  s.ic_hits = (ctx->ic_lookups > s.ic_misses)
+      ? ctx->ic_lookups - s.ic_misses
+      : 0;
+
+  _gum_stalker_stats_add (stats, &s);
+}
+
 static void
 gum_exec_ctx_unfollow (GumExecCtx * ctx,
                        gpointer resume_at)
 {
+  gum_exec_ctx_flush_events (ctx);
+
   ctx->resume_at = resume_at;
 
-  gum_tls_key_set_value (ctx->stalker->exec_ctx, NULL);
+  gum_stalker_set_exec_ctx (ctx->stalker, NULL);
   ctx->current_block = NULL;
   ctx->state = GUM_EXEC_CTX_DESTROY_PENDING;
+
+  gum_exec_ctx_push_garbage (ctx);
+}
+
+static void
+gum_exec_ctx_push_garbage (GumExecCtx * ctx)
+{
+  GumStalker * stalker = ctx->stalker;
+
+  do
+  {
+    ctx->next_garbage = g_atomic_pointer_get (&stalker->garbage);
+  }
+  while (!g_atomic_pointer_compare_and_exchange (&stalker->garbage,
+      ctx->next_garbage, ctx));
 }
 
 static gboolean
@@ -1143,10 +2602,30 @@ gum_exec_ctx_has_executed (GumExecCtx * ctx)
 
 static gboolean counters_enabled = FALSE;
 static guint total_transitions = 0;
+static guint total_compilations = 0;
+static guint64 total_entrygate_time = 0;
+static guint64 total_compile_time = 0;
+static guint64 total_transform_time = 0;
+static guint64 total_sink_time = 0;
 
 #define GUM_ENTRYGATE(name) \
   gum_exec_ctx_replace_current_block_from_##name
-#define GUM_DEFINE_ENTRYGATE(name) \
+#define GUM_DEFINE_ENTRYGATE(name, kind) \
+  static guint total_##name##s = 0; \
+  \
+  static gpointer GUM_THUNK \
+  GUM_ENTRYGATE (name) ( \
+      GumExecCtx * ctx, \
+      gpointer start_address) \
+  { \
+    ctx->stats.kind##_entrygates++; \
+    \
+    if (counters_enabled) \
+      total_##name##s++; \
+    \
+    return gum_exec_ctx_replace_current_block_with (ctx, start_address); \
+  }
+#define GUM_DEFINE_CALL_ENTRYGATE(name, kind) \
   static guint total_##name##s = 0; \
   \
   static gpointer GUM_THUNK \
@@ -1154,66 +2633,305 @@ static guint total_transitions = 0;
       GumExecCtx * ctx, \
       gpointer start_address) \
   { \
+    ctx->stats.kind##_entrygates++; \
+    \
     if (counters_enabled) \
       total_##name##s++; \
     \
+    if (!gum_stalker_is_in_scope (ctx->stalker, start_address)) \
+      return gum_exec_ctx_call_out_of_scope (ctx, start_address); \
+    \
     return gum_exec_ctx_replace_current_block_with (ctx, start_address); \
   }
 #define GUM_PRINT_ENTRYGATE_COUNTER(name) \
   g_printerr ("\t" G_STRINGIFY (name) "s: %u\n", total_##name##s)
 
 #if GLIB_SIZEOF_VOID_P == 4 && !defined (HAVE_QNX)
-GUM_DEFINE_ENTRYGATE (sysenter_slow_path)
+GUM_DEFINE_ENTRYGATE (sysenter_slow_path, sysenter)
 #endif
 
-GUM_DEFINE_ENTRYGATE (call_imm)
-GUM_DEFINE_ENTRYGATE (call_reg)
-GUM_DEFINE_ENTRYGATE (call_mem)
-GUM_DEFINE_ENTRYGATE (post_call_invoke)
-GUM_DEFINE_ENTRYGATE (ret_slow_path)
+GUM_DEFINE_ENTRYGATE (call_imm, call_imm)
+GUM_DEFINE_CALL_ENTRYGATE (call_reg, call_indirect)
+GUM_DEFINE_CALL_ENTRYGATE (call_mem, call_indirect)
+GUM_DEFINE_ENTRYGATE (post_call_invoke, post_call_invoke)
+GUM_DEFINE_ENTRYGATE (ret_slow_path, ret)
 
-GUM_DEFINE_ENTRYGATE (jmp_imm)
-GUM_DEFINE_ENTRYGATE (jmp_mem)
-GUM_DEFINE_ENTRYGATE (jmp_reg)
+GUM_DEFINE_ENTRYGATE (jmp_imm, jmp_imm)
+GUM_DEFINE_ENTRYGATE (jmp_mem, jmp_indirect)
+GUM_DEFINE_ENTRYGATE (jmp_reg, jmp_indirect)
 
-GUM_DEFINE_ENTRYGATE (jmp_cond_imm)
-GUM_DEFINE_ENTRYGATE (jmp_cond_mem)
-GUM_DEFINE_ENTRYGATE (jmp_cond_reg)
-GUM_DEFINE_ENTRYGATE (jmp_cond_jcxz)
+GUM_DEFINE_ENTRYGATE (jmp_cond_imm, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_mem, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_reg, jmp_cond)
+GUM_DEFINE_ENTRYGATE (jmp_cond_jcxz, jmp_cond)
 
-GUM_DEFINE_ENTRYGATE (jmp_continuation)
+GUM_DEFINE_ENTRYGATE (jmp_continuation, jmp_continuation)
 
 static gpointer GUM_THUNK
 gum_exec_ctx_replace_current_block_with (GumExecCtx * ctx,
                                          gpointer start_address)
 {
+  guint64 start_time = 0, compile_time_before = 0;
+
   if (counters_enabled)
+  {
     total_transitions++;
+    start_time = _gum_stalker_get_nanoseconds ();
+    compile_time_before = total_compile_time;
+  }
 
   if (ctx->invalidate_pending)
   {
-    gum_metal_hash_table_remove_all (ctx->mappings);
+    gum_metal_map_remove_all (&ctx->mappings);
+
+    if (ctx->ic_fallback != NULL)
+      memset (ctx->ic_fallback, 0, GUM_IC_FALLBACK_SIZE * sizeof (GumIcEntry));
 
     ctx->invalidate_pending = FALSE;
   }
 
+  if (ctx->flush_pending)
+  {
+    ctx->flush_pending = FALSE;
+
+    gum_exec_ctx_flush_events (ctx);
+    gum_event_sink_flush (ctx->sink);
+  }
+
   if (start_address == gum_stalker_unfollow_me)
   {
     ctx->unfollow_called_while_still_following = TRUE;
     ctx->current_block = NULL;
     ctx->resume_at = start_address;
   }
-  else if (ctx->state == GUM_EXEC_CTX_UNFOLLOW_PENDING)
+  else if (ctx->state == GUM_EXEC_CTX_UNFOLLOW_PENDING &&
+      !gum_exec_ctx_is_in_user_callback (ctx))
   {
     gum_exec_ctx_unfollow (ctx, start_address);
   }
   else
   {
-    ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, start_address,
-        &ctx->resume_at);
+    if (ctx->retired_slabs != NULL)
+      gum_exec_ctx_reclaim_retired_code_slabs (ctx);
+
+    if (gum_exec_ctx_is_code_budget_exhausted (ctx) &&
+        !gum_exec_ctx_is_nested (ctx))
+    {
+      gum_exec_ctx_retire_code_slabs (ctx);
+    }
+
+    if (ctx->stalker->scope_entries != NULL)
+    {
+      GumScopeEntry * entry;
+
+      entry = g_hash_table_lookup (ctx->stalker->scope_entries,
+          start_address);
+      if (entry != NULL)
+        start_address = entry->original;
+    }
+
+    ctx->current_block = gum_exec_ctx_obtain_block_for (ctx, start_address,
+        &ctx->resume_at);
+  }
+
+  if (start_time != 0 && counters_enabled)
+  {
+    total_entrygate_time += _gum_stalker_get_nanoseconds () - start_time -
+        (total_compile_time - compile_time_before);
+  }
+
+  return ctx->resume_at;
+}
+
+/*
+ * An indirect call that leaves the scope. The invoke code has already pushed
+ * the real return address and a frame for it, so we point the return address
+ * at the block's code for the continuation instead, pop the frame, and let
+ * the callee run natively until it returns to us.
+ */
+static gpointer
+gum_exec_ctx_call_out_of_scope (GumExecCtx * ctx,
+                                gpointer target)
+{
+  gpointer * ret_addr_ptr = (gpointer *) ctx->app_stack;
+  GumExecFrame * frame = ctx->current_frame;
+
+  if (ctx->state != GUM_EXEC_CTX_ACTIVE || frame == ctx->first_frame ||
+      frame->real_address != *ret_addr_ptr)
+  {
+    return gum_exec_ctx_replace_current_block_with (ctx, target);
+  }
+
+  *ret_addr_ptr = frame->code_address;
+  ctx->current_frame = frame + 1;
+
+  ctx->current_block = NULL;
+  ctx->resume_at = target;
+
+  return target;
+}
+
+/*
+ * Reached through the frame pushed by gum_scope_entry_enter() once the entry
+ * point returns, so the frame is just below the current one.
+ */
+static gpointer
+gum_exec_ctx_leave_scope (GumExecCtx * ctx,
+                          gpointer * ret_addr_ptr)
+{
+  gpointer resume_at = (ctx->current_frame - 1)->real_address;
+
+  ctx->current_block = NULL;
+  ctx->scope_depth--;
+
+  if (ctx->state == GUM_EXEC_CTX_UNFOLLOW_PENDING && ctx->scope_depth == 0)
+    gum_exec_ctx_unfollow (ctx, resume_at);
+
+  return resume_at;
+}
+
+static gboolean
+gum_exec_ctx_is_code_budget_exhausted (GumExecCtx * ctx)
+{
+  GumSlab * slab = ctx->code_slab;
+
+  if (ctx->max_code_slabs == 0)
+    return FALSE;
+
+  if (slab->size - slab->offset >= ctx->block_min_size)
+    return FALSE;
+
+  return ctx->spare_slabs == NULL &&
+      ctx->code_slab_count + 1 >= ctx->max_code_slabs;
+}
+
+/*
+ * Whether we are inside a scope entry or a user callback delivered during a
+ * WoW64 system call. The application stack may then hold return addresses
+ * into our code, left there by the native call that got interrupted, and the
+ * shadow stack holds the frame that gets us out of the scope. The budget is
+ * allowed to overflow until we are back at the outermost level.
+ */
+static gboolean
+gum_exec_ctx_is_nested (GumExecCtx * ctx)
+{
+  return ctx->scope_depth > ctx->outermost_scope_depth ||
+      gum_exec_ctx_is_in_user_callback (ctx);
+}
+
+/*
+ * Flushes the code cache and starts over in the reserve slab. The slabs
+ * currently in use are retired rather than reused right away: the code that
+ * entered us, and the helpers it calls on the way out, may live in any one of
+ * them. Nothing compiled from here on can reach them, since mappings, inline
+ * caches, the shadow stack and the helpers all start afresh, so by the next
+ * transition they are safe to reuse. That only holds at the outermost level,
+ * which is why we are never called while nested. The first slab is never
+ * recycled as it shares its allocation with the ExecCtx.
+ */
+static void
+gum_exec_ctx_retire_code_slabs (GumExecCtx * ctx)
+{
+  GumSlab * slab;
+
+  ctx->stats.code_cache_flushes++;
+
+  gum_metal_map_remove_all (&ctx->mappings);
+
+  if (ctx->ic_fallback != NULL)
+    memset (ctx->ic_fallback, 0, GUM_IC_FALLBACK_SIZE * sizeof (GumIcEntry));
+
+  ctx->current_frame = ctx->first_frame;
+
+  slab = ctx->code_slab;
+  while (slab != &ctx->first_code_slab)
+  {
+    GumSlab * next = slab->next;
+    slab->next = ctx->retired_slabs;
+    ctx->retired_slabs = slab;
+    slab = next;
+  }
+  ctx->code_slab = &ctx->first_code_slab;
+
+  if (ctx->reserve_slab != NULL)
+  {
+    slab = ctx->reserve_slab;
+    ctx->reserve_slab = NULL;
+  }
+  else
+  {
+    slab = gum_exec_ctx_allocate_code_slab (ctx);
+  }
+  slab->offset = 0;
+  slab->next = ctx->code_slab;
+  ctx->code_slab = slab;
+
+  ctx->last_prolog_minimal = NULL;
+  ctx->last_epilog_minimal = NULL;
+  ctx->last_prolog_full = NULL;
+  ctx->last_epilog_full = NULL;
+  ctx->last_stack_push = NULL;
+  ctx->last_stack_pop_and_go = NULL;
+  gum_exec_ctx_ensure_inline_helpers_reachable (ctx);
+}
+
+static void
+gum_exec_ctx_reclaim_retired_code_slabs (GumExecCtx * ctx)
+{
+  GumSlab * slab = ctx->retired_slabs;
+
+  while (slab != NULL)
+  {
+    GumSlab * next = slab->next;
+
+    if (ctx->reserve_slab == NULL)
+    {
+      slab->next = NULL;
+      ctx->reserve_slab = slab;
+    }
+    else
+    {
+      slab->next = ctx->spare_slabs;
+      ctx->spare_slabs = slab;
+    }
+
+    slab = next;
+  }
+
+  ctx->retired_slabs = NULL;
+}
+
+static GumSlab *
+gum_exec_ctx_allocate_code_slab (GumExecCtx * ctx)
+{
+  GumSlab * slab;
+
+  slab = gum_alloc_n_pages (GUM_CODE_SLAB_SIZE_IN_PAGES, GUM_PAGE_RWX);
+  slab->data = (guint8 *) (slab + 1);
+  slab->offset = 0;
+  slab->size = (GUM_CODE_SLAB_SIZE_IN_PAGES * ctx->stalker->page_size)
+      - sizeof (GumSlab);
+  slab->next = NULL;
+  if (ctx->stalker->huge_pages_enabled)
+  {
+    gum_memory_advise_huge_pages (slab,
+        GUM_CODE_SLAB_SIZE_IN_PAGES * ctx->stalker->page_size);
+  }
+
+  ctx->code_slab_count++;
+
+  return slab;
+}
+
+static void
+gum_exec_ctx_free_code_slabs (GumSlab * slab)
+{
+  while (slab != NULL)
+  {
+    GumSlab * next = slab->next;
+    gum_free_pages (slab);
+    slab = next;
   }
-
-  return ctx->resume_at;
 }
 
 static void
@@ -1226,7 +2944,12 @@ gum_exec_ctx_create_thunks (GumExecCtx * ctx)
   ctx->thunks = gum_alloc_n_pages (1, GUM_PAGE_RWX);
   gum_x86_writer_init (&cw, ctx->thunks);
 
+  ctx->scope_exit_thunk = gum_x86_writer_cur (&cw);
+  gum_write_scope_transition_code (&cw, gum_exec_ctx_leave_scope, ctx);
+  gum_x86_writer_flush (&cw);
+
   ctx->infect_thunk = gum_x86_writer_cur (&cw);
+  ctx->infect_pc = NULL;
 
   gum_x86_writer_clear (&cw);
 }
@@ -1245,12 +2968,11 @@ gum_disasm (guint8 * code,
             const gchar * prefix)
 {
   csh capstone;
-  cs_err err;
   cs_insn * insn;
   size_t count, i;
 
-  err = cs_open (CS_ARCH_X86, GUM_CPU_MODE, &capstone);
-  g_assert_cmpint (err, == , CS_ERR_OK);
+  capstone = gum_capstone_get (CS_ARCH_X86, GUM_CPU_MODE,
+      GUM_CAPSTONE_DETAIL_OFF);
 
   count = cs_disasm (capstone, code, size, GPOINTER_TO_SIZE (code), 0, &insn);
   g_assert (insn != NULL);
@@ -1262,8 +2984,6 @@ gum_disasm (guint8 * code,
   }
 
   cs_free (insn, count);
-
-  cs_close (&capstone);
 }
 
 static void
@@ -1305,6 +3025,8 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   GumGeneratorContext gc;
   GumStalkerIterator iterator;
   gboolean all_labels_resolved;
+  gboolean counting;
+  guint64 start_time, transform_start_time = 0, compile_time;
 
   if (ctx->stalker->trust_threshold >= 0)
   {
@@ -1320,16 +3042,22 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
       }
       else
       {
-        gum_metal_hash_table_remove (ctx->mappings, real_address);
+        ctx->stats.trust_failures++;
+        gum_metal_map_remove (&ctx->mappings, real_address);
       }
     }
   }
 
+  counting = counters_enabled;
+  if (counting)
+    total_compilations++;
+  start_time = _gum_stalker_get_nanoseconds ();
+
   block = gum_exec_block_new (ctx);
   *code_address = block->code_begin;
 
   if (ctx->stalker->trust_threshold >= 0)
-    gum_metal_hash_table_insert (ctx->mappings, real_address, block);
+    gum_metal_map_insert (&ctx->mappings, real_address, block);
 
   cw = &ctx->code_writer;
   rl = &ctx->relocator;
@@ -1343,6 +3071,7 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   gc.continuation_real_address = NULL;
   gc.opened_prolog = GUM_PROLOG_NONE;
   gc.accumulated_stack_delta = 0;
+  gc.sink_mask = ctx->sink_mask;
 
 #if ENABLE_DEBUG
   printf ("\n\n***\n\nCreating block for %p:\n", real_address);
@@ -1357,9 +3086,20 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
   iterator.instruction.end = NULL;
   iterator.requirements = GUM_REQUIRE_NOTHING;
 
+  gum_exec_block_write_coverage_code (block, &gc);
+
+  if (counting)
+    transform_start_time = _gum_stalker_get_nanoseconds ();
+
   gum_stalker_transformer_transform_block (ctx->transformer, &iterator,
       (GumStalkerWriter *) cw);
 
+  if (transform_start_time != 0 && counters_enabled)
+  {
+    total_transform_time +=
+        _gum_stalker_get_nanoseconds () - transform_start_time;
+  }
+
   if (gc.continuation_real_address != NULL)
   {
     GumBranchTarget continue_target = { 0, };
@@ -1368,7 +3108,7 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
     continue_target.absolute_address = gc.continuation_real_address;
 
     gum_exec_block_write_jmp_transfer_code (block, &continue_target,
-        GUM_ENTRYGATE (jmp_continuation), &gc);
+        GUM_ENTRYGATE (jmp_continuation), X86_INS_INVALID, &gc);
   }
 
   gum_x86_writer_put_breakpoint (cw); /* Should never get here */
@@ -1386,13 +3126,25 @@ gum_exec_ctx_obtain_block_for (GumExecCtx * ctx,
 
   if ((ctx->sink_mask & GUM_COMPILE) != 0)
   {
+    gum_exec_ctx_flush_events (ctx);
+
     ctx->tmp_event.type = GUM_COMPILE;
     ctx->tmp_event.compile.begin = block->real_begin;
     ctx->tmp_event.compile.end = block->real_end;
+    ctx->tmp_event.compile.timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-    gum_event_sink_process (ctx->sink, &ctx->tmp_event);
+    gum_exec_ctx_process_event (ctx, &ctx->tmp_event);
   }
 
+  compile_time = _gum_stalker_get_nanoseconds () - start_time;
+
+  ctx->stats.blocks_compiled++;
+  ctx->stats.bytes_emitted += block->code_end - block->code_begin;
+  ctx->stats.compile_time += compile_time;
+
+  if (counting && counters_enabled)
+    total_compile_time += compile_time;
+
   return block;
 }
 
@@ -1464,6 +3216,14 @@ gum_stalker_iterator_next (GumStalkerIterator * self,
 
   self->generator_context->instruction = instruction;
 
+  if (self->exec_context->sink_has_location_mask)
+  {
+    GumExecCtx * ec = self->exec_context;
+
+    gc->sink_mask = ec->sink_mask &
+        gum_event_sink_query_location_mask (ec->sink, instruction->begin);
+  }
+
   if (insn != NULL)
     *insn = instruction->ci;
 
@@ -1480,7 +3240,7 @@ gum_stalker_iterator_keep (GumStalkerIterator * self)
   const cs_insn * insn = gc->instruction->ci;
   GumVirtualizationRequirements requirements;
 
-  if ((ec->sink_mask & GUM_EXEC) != 0)
+  if ((gc->sink_mask & GUM_EXEC) != 0)
     gum_exec_block_write_exec_event_code (block, gc, GUM_CODE_INTERRUPTIBLE);
 
   if ((ec->sink_mask & GUM_BLOCK) != 0 &&
@@ -1520,11 +3280,6 @@ gum_stalker_iterator_keep (GumStalkerIterator * self)
   {
     gum_x86_relocator_write_one_no_label (rl);
   }
-  else if ((requirements & GUM_REQUIRE_SINGLE_STEP) != 0)
-  {
-    gum_x86_relocator_skip_one_no_label (rl);
-    gum_exec_block_write_single_step_transfer_code (block, gc);
-  }
 
   self->requirements = requirements;
 }
@@ -1542,8 +3297,10 @@ gum_exec_ctx_emit_call_event (GumExecCtx * ctx,
   call->location = location;
   call->target = target;
   call->depth = ctx->first_frame - ctx->current_frame;
+  call->timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  gum_exec_ctx_flush_events (ctx);
+  gum_exec_ctx_process_event (ctx, &ev);
 }
 
 static void
@@ -1558,38 +3315,55 @@ gum_exec_ctx_emit_ret_event (GumExecCtx * ctx,
   ret->location = location;
   ret->target = *((gpointer *) ctx->app_stack);
   ret->depth = ctx->first_frame - ctx->current_frame;
+  ret->timestamp = gum_exec_ctx_query_timestamp (ctx);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  gum_exec_ctx_flush_events (ctx);
+  gum_exec_ctx_process_event (ctx, &ev);
 }
 
 static void
-gum_exec_ctx_emit_exec_event (GumExecCtx * ctx,
-                              gpointer location)
+gum_exec_ctx_flush_events (GumExecCtx * ctx)
 {
-  GumEvent ev;
-  GumExecEvent * exec = &ev.exec;
+  GumEvent * ev, * end;
+  guint64 start_time = 0;
+
+  if (ctx->event_buffer == NULL)
+    return;
+
+  end = ctx->event_buffer_cur;
+  ctx->event_buffer_cur = ctx->event_buffer;
 
-  ev.type = GUM_EXEC;
+  if (counters_enabled)
+    start_time = _gum_stalker_get_nanoseconds ();
 
-  exec->location = location;
+  for (ev = ctx->event_buffer; ev != end; ev++)
+    ctx->sink_process_impl (ctx->sink, ev);
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  if (start_time != 0 && counters_enabled)
+    total_sink_time += _gum_stalker_get_nanoseconds () - start_time;
 }
 
-static void
-gum_exec_ctx_emit_block_event (GumExecCtx * ctx,
-                               gpointer begin,
-                               gpointer end)
+static guint64
+gum_exec_ctx_query_timestamp (GumExecCtx * ctx)
 {
-  GumEvent ev;
-  GumBlockEvent * block = &ev.block;
+  return ctx->timestamps_enabled ? gum_timestamp_now () : 0;
+}
 
-  ev.type = GUM_BLOCK;
+static void
+gum_exec_ctx_process_event (GumExecCtx * ctx,
+                            const GumEvent * ev)
+{
+  guint64 start_time;
 
-  block->begin = begin;
-  block->end = end;
+  if (!counters_enabled)
+  {
+    ctx->sink_process_impl (ctx->sink, ev);
+    return;
+  }
 
-  ctx->sink_process_impl (ctx->sink, &ev);
+  start_time = _gum_stalker_get_nanoseconds ();
+  ctx->sink_process_impl (ctx->sink, ev);
+  total_sink_time += _gum_stalker_get_nanoseconds () - start_time;
 }
 
 void
@@ -1604,12 +3378,14 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
   GumGeneratorContext * gc = self->generator_context;
   GumX86Writer * cw = gc->code_writer;
 
-  entry = g_slice_new (GumCalloutEntry);
+  gum_spinlock_acquire (&ec->callout_lock);
+  entry = gum_exec_ctx_alloc_callout_entry (ec);
   entry->callout = callout;
   entry->data = data;
   entry->data_destroy = data_destroy;
   entry->pc = gc->instruction->begin;
   entry->exec_context = ec;
+  gum_spinlock_release (&ec->callout_lock);
 
   gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
 
@@ -1619,10 +3395,56 @@ gum_stalker_iterator_put_callout (GumStalkerIterator * self,
       GUM_ARG_ADDRESS, GUM_ADDRESS (entry));
 
   gum_exec_block_close_prolog (block, gc);
+}
 
-  gum_spinlock_acquire (&ec->callout_lock);
-  g_queue_push_head (&ec->callout_entries, entry);
-  gum_spinlock_release (&ec->callout_lock);
+/*
+ * Bumps `counters->values[index]` each time execution gets here, without
+ * leaving the block. Only the flags and one scratch register are preserved,
+ * which is far cheaper than the full context that a callout needs.
+ */
+void
+gum_stalker_iterator_put_counter_increment (GumStalkerIterator * self,
+                                            GumHitCounters * counters,
+                                            guint index)
+{
+  GumExecBlock * block = self->exec_block;
+  GumGeneratorContext * gc = self->generator_context;
+  GumX86Writer * cw = gc->code_writer;
+  guint64 * slot;
+
+  g_assert_cmpuint (index, <, counters->length);
+  slot = &counters->values[index];
+
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_pushfx (cw);
+
+#if GLIB_SIZEOF_VOID_P == 8
+  gum_x86_writer_put_push_reg (cw, GUM_REG_RAX);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_RAX, GUM_ADDRESS (slot));
+  gum_x86_writer_put_lock_inc_reg_ptr (cw, GUM_PTR_QWORD, GUM_REG_RAX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_RAX);
+#else
+  {
+    gconstpointer no_carry = cw->code + 1;
+
+    /*
+     * inc leaves CF alone, but ZF tells us that the low half wrapped, and
+     * the locked read-modify-write guarantees only one thread sees that.
+     */
+    gum_x86_writer_put_lock_inc_imm32_ptr (cw, slot);
+    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, no_carry,
+        GUM_LIKELY);
+    gum_x86_writer_put_lock_inc_imm32_ptr (cw, (guint32 *) slot + 1);
+    gum_x86_writer_put_label (cw, no_carry);
+  }
+#endif
+
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
 }
 
 static void
@@ -2379,7 +4201,7 @@ gum_exec_block_new (GumExecCtx * ctx)
 {
   GumSlab * slab = ctx->code_slab;
 
-  if (slab->size - slab->offset >= GUM_EXEC_BLOCK_MIN_SIZE)
+  if (slab->size - slab->offset >= ctx->block_min_size)
   {
     GumExecBlock * block = (GumExecBlock *) (slab->data + slab->offset);
 
@@ -2391,27 +4213,37 @@ gum_exec_block_new (GumExecCtx * ctx)
         GUM_CODE_ALIGNMENT);
     block->code_end = block->code_begin;
 
-    block->state = GUM_EXEC_NORMAL;
     block->recycle_count = 0;
     block->has_call_to_excluded_range = FALSE;
+    block->sample_countdown = 1;
 
     slab->offset += block->code_begin - (slab->data + slab->offset);
 
     return block;
   }
 
-  if (ctx->stalker->trust_threshold < 0)
+  /*
+   * Without trust nothing is looked up again, so we simply start over in the
+   * same slab. A code budget asks for the code cache to be flushed at a safe
+   * point instead, so in that case we take the same route as everyone else.
+   */
+  if (ctx->stalker->trust_threshold < 0 && ctx->max_code_slabs == 0)
   {
     ctx->code_slab->offset = 0;
 
     return gum_exec_block_new (ctx);
   }
 
-  slab = gum_alloc_n_pages (GUM_CODE_SLAB_SIZE_IN_PAGES, GUM_PAGE_RWX);
-  slab->data = (guint8 *) (slab + 1);
-  slab->offset = 0;
-  slab->size = (GUM_CODE_SLAB_SIZE_IN_PAGES * ctx->stalker->page_size)
-      - sizeof (GumSlab);
+  if (ctx->spare_slabs != NULL)
+  {
+    slab = ctx->spare_slabs;
+    ctx->spare_slabs = slab->next;
+    slab->offset = 0;
+  }
+  else
+  {
+    slab = gum_exec_ctx_allocate_code_slab (ctx);
+  }
   slab->next = ctx->code_slab;
   ctx->code_slab = slab;
 
@@ -2427,7 +4259,7 @@ gum_exec_block_obtain (GumExecCtx * ctx,
 {
   GumExecBlock * block;
 
-  block = gum_metal_hash_table_lookup (ctx->mappings, real_address);
+  block = gum_metal_map_lookup (&ctx->mappings, real_address);
   if (block != NULL)
     *code_address = block->code_begin;
 
@@ -2438,7 +4270,7 @@ static gboolean
 gum_exec_block_is_full (GumExecBlock * block)
 {
   guint8 * slab_end = block->slab->data + block->slab->size;
-  return slab_end - block->code_end < GUM_EXEC_BLOCK_MIN_SIZE;
+  return slab_end - block->code_end < block->ctx->block_min_size;
 }
 
 static void
@@ -2549,6 +4381,59 @@ gum_exec_block_backpatch_jmp (GumExecBlock * block,
   }
 }
 
+/*
+ * The taken side of a conditional branch is laid out right after the negated
+ * jcc that skips over it. Once its target is known we point the jcc straight
+ * at the target block and turn the start of the taken side into a jump to the
+ * not-taken side, so a loop's back-edge costs a single branch. Should the
+ * bytes preceding the taken side not be a near jcc after all, we fall back to
+ * patching the taken side only, like a plain jmp.
+ */
+static void
+gum_exec_block_backpatch_jcc (GumExecBlock * block,
+                              gpointer code_start,
+                              x86_insn jcc_id)
+{
+  gboolean just_unfollowed;
+  GumExecCtx * ctx;
+
+  just_unfollowed = block == NULL;
+  if (just_unfollowed)
+    return;
+
+  ctx = block->ctx;
+
+  if (ctx->state == GUM_EXEC_CTX_ACTIVE &&
+      block->recycle_count >= ctx->stalker->trust_threshold)
+  {
+    GumX86Writer * cw = &ctx->code_writer;
+    guint8 * jcc_start = (guint8 *) code_start - 6;
+    gboolean is_near_jcc;
+    gssize distance;
+
+    is_near_jcc = jcc_start[0] == 0x0f && (jcc_start[1] & 0xf0) == 0x80;
+    distance = (gssize) block->code_begin - (gssize) code_start;
+
+    if (is_near_jcc && GUM_IS_WITHIN_INT32_RANGE (distance))
+    {
+      gpointer not_taken_code = (guint8 *) code_start +
+          GINT32_FROM_LE (*((gint32 *) (jcc_start + 2)));
+
+      gum_x86_writer_reset (cw, jcc_start);
+      gum_x86_writer_put_jcc_near (cw, jcc_id, block->code_begin,
+          GUM_NO_HINT);
+      gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (not_taken_code));
+    }
+    else
+    {
+      gum_x86_writer_reset (cw, code_start);
+      gum_x86_writer_put_jmp_address (cw, GUM_ADDRESS (block->code_begin));
+    }
+
+    gum_x86_writer_flush (cw);
+  }
+}
+
 static void
 gum_exec_block_backpatch_ret (GumExecBlock * block,
                               gpointer code_start)
@@ -2575,7 +4460,7 @@ gum_exec_block_backpatch_ret (GumExecBlock * block,
 
 static void
 gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
-                                       gpointer * ic_entries)
+                                       GumIcEntry * ic_entries)
 {
   gboolean just_unfollowed;
   GumExecCtx * ctx;
@@ -2585,18 +4470,35 @@ gum_exec_block_backpatch_inline_cache (GumExecBlock * block,
     return;
 
   ctx = block->ctx;
+  ctx->stats.ic_misses++;
 
   if (ctx->state == GUM_EXEC_CTX_ACTIVE &&
       block->recycle_count >= ctx->stalker->trust_threshold)
   {
-    guint offset;
+    guint i;
 
-    offset = (ic_entries[0] == NULL) ? 0 : 2;
+    for (i = 0; i != ctx->ic_entries; i++)
+    {
+      GumIcEntry * entry = &ic_entries[i];
+
+      if (entry->real_start == block->real_begin)
+        return;
+
+      if (entry->real_start == NULL)
+      {
+        entry->real_start = block->real_begin;
+        entry->code_start = block->code_begin;
+        return;
+      }
+    }
 
-    if (ic_entries[offset + 0] == NULL)
+    if (ctx->ic_fallback != NULL)
     {
-      ic_entries[offset + 0] = block->real_begin;
-      ic_entries[offset + 1] = block->code_begin;
+      GumIcEntry * entry = &ctx->ic_fallback[
+          GUM_IC_FALLBACK_INDEX (block->real_begin)];
+
+      entry->real_start = block->real_begin;
+      entry->code_start = block->code_begin;
     }
   }
 }
@@ -2628,10 +4530,25 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
   }
   else if (op->type == X86_OP_MEM)
   {
-#ifdef G_OS_WIN32
-    /* Can't follow WoW64 */
+#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
+    /*
+     * Can't follow WoW64, so make the system call in place. The return
+     * address it pushes points right back into this block, so that is where
+     * the thread ends up once the kernel is done with it, however many times
+     * it re-entered user mode through KiUserCallbackDispatcher in between.
+     * Those callbacks are stalked through gum_enter_user_callback().
+     */
     if (op->mem.segment == X86_REG_FS && op->mem.disp == 0xc0)
-      return GUM_REQUIRE_SINGLE_STEP;
+    {
+      block->has_call_to_excluded_range = TRUE;
+      if (insn->ci->id != X86_INS_CALL)
+        return GUM_REQUIRE_RELOCATION;
+
+      gum_exec_block_close_prolog (block, gc);
+      gum_x86_relocator_write_one_no_label (gc->relocator);
+      gum_exec_block_write_system_call_return_code (block, gc);
+      return GUM_REQUIRE_NOTHING;
+    }
 #endif
 
     if (op->mem.base == X86_REG_INVALID && op->mem.index == X86_REG_INVALID)
@@ -2662,7 +4579,7 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
   {
     gboolean target_is_excluded = FALSE;
 
-    if ((block->ctx->sink_mask & GUM_CALL) != 0)
+    if ((gc->sink_mask & GUM_CALL) != 0)
     {
       gum_exec_block_write_call_event_code (block, &target, gc,
           GUM_CODE_INTERRUPTIBLE);
@@ -2673,19 +4590,8 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
 
     if (!target.is_indirect && target.base == X86_REG_INVALID)
     {
-      GArray * exclusions = block->ctx->stalker->exclusions;
-      guint i;
-
-      for (i = 0; i != exclusions->len; i++)
-      {
-        GumMemoryRange * r = &g_array_index (exclusions, GumMemoryRange, i);
-        if (GUM_MEMORY_RANGE_INCLUDES (r,
-            GUM_ADDRESS (target.absolute_address)))
-        {
-          target_is_excluded = TRUE;
-          break;
-        }
-      }
+      target_is_excluded = gum_stalker_is_excluding (block->ctx->stalker,
+          target.absolute_address);
     }
 
     if (target_is_excluded)
@@ -2716,13 +4622,13 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
 
     gum_x86_writer_put_label (cw, is_true);
     gum_exec_block_write_jmp_transfer_code (block, &target,
-        GUM_ENTRYGATE (jmp_cond_jcxz), gc);
+        GUM_ENTRYGATE (jmp_cond_jcxz), X86_INS_INVALID, gc);
 
     gum_x86_writer_put_label (cw, is_false);
     false_target.is_indirect = FALSE;
     false_target.absolute_address = insn->end;
     gum_exec_block_write_jmp_transfer_code (block, &false_target,
-        GUM_ENTRYGATE (jmp_cond_jcxz), gc);
+        GUM_ENTRYGATE (jmp_cond_jcxz), X86_INS_INVALID, gc);
   }
   else
   {
@@ -2760,8 +4666,16 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
       cond_entry_func = GUM_ENTRYGATE (jmp_cond_imm);
     }
 
-    gum_exec_block_write_jmp_transfer_code (block, &target,
-        is_conditional ? cond_entry_func : regular_entry_func, gc);
+    if (is_conditional)
+    {
+      gum_exec_block_write_jmp_transfer_code (block, &target, cond_entry_func,
+          insn->ci->id, gc);
+    }
+    else
+    {
+      gum_exec_block_write_jmp_transfer_code (block, &target,
+          regular_entry_func, X86_INS_INVALID, gc);
+    }
 
     if (is_conditional)
     {
@@ -2772,7 +4686,7 @@ gum_exec_block_virtualize_branch_insn (GumExecBlock * block,
 
       gum_x86_writer_put_label (cw, is_false);
       gum_exec_block_write_jmp_transfer_code (block, &cond_target,
-          cond_entry_func, gc);
+          cond_entry_func, X86_INS_INVALID, gc);
     }
   }
 
@@ -2783,7 +4697,7 @@ static GumVirtualizationRequirements
 gum_exec_block_virtualize_ret_insn (GumExecBlock * block,
                                     GumGeneratorContext * gc)
 {
-  if ((block->ctx->sink_mask & GUM_RET) != 0)
+  if ((gc->sink_mask & GUM_RET) != 0)
     gum_exec_block_write_ret_event_code (block, gc, GUM_CODE_INTERRUPTIBLE);
 
   gum_x86_relocator_skip_one_no_label (gc->relocator);
@@ -2852,7 +4766,7 @@ gum_exec_block_virtualize_sysenter_insn (GumExecBlock * block,
   gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_EDX,
       GUM_ADDRESS (saved_ret_addr));
 
-  if ((block->ctx->sink_mask & GUM_RET) != 0)
+  if ((gc->sink_mask & GUM_RET) != 0)
   {
     gum_exec_block_write_ret_event_code (block, gc, GUM_CODE_UNINTERRUPTIBLE);
     gum_exec_block_close_prolog (block, gc);
@@ -2938,14 +4852,12 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
   gpointer call_code_start;
   GumPrologType opened_prolog;
   gboolean can_backpatch_statically;
-  gpointer * ic_entries = NULL;
+  GumIcEntry * ic_entries = NULL;
   GumExecCtxReplaceCurrentBlockFunc entry_func;
   gconstpointer push_application_retaddr = cw->code + 1;
   gconstpointer perform_stack_push = cw->code + 2;
   gconstpointer look_in_cache = cw->code + 3;
-  gconstpointer try_second = cw->code + 4;
-  gconstpointer resolve_dynamically = cw->code + 5;
-  gconstpointer beach = cw->code + 6;
+  gconstpointer beach = cw->code + 4;
   gpointer ret_real_address, ret_code_address;
 
   call_code_start = cw->code;
@@ -2958,10 +4870,6 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
   if (block->ctx->stalker->trust_threshold >= 0 &&
       !can_backpatch_statically)
   {
-    gpointer null_ptr = NULL;
-    gpointer ic1_real, ic1_code;
-    gpointer ic2_real, ic2_code;
-
     if (opened_prolog == GUM_PROLOG_NONE)
     {
       gum_exec_block_open_prolog (block, GUM_PROLOG_IC, gc);
@@ -2986,44 +4894,12 @@ gum_exec_block_write_call_invoke_code (GumExecBlock * block,
       gc->accumulated_stack_delta += sizeof (gpointer);
     }
 
-    gum_x86_writer_put_jmp_short_label (cw, look_in_cache);
-
-    ic_entries = gum_x86_writer_cur (cw);
-    ic1_real = ic_entries;
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic1_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_real = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-
+    gum_x86_writer_put_jmp_near_label (cw, look_in_cache);
+    ic_entries = gum_exec_block_write_inline_cache_entries (block, gc);
     gum_x86_writer_put_label (cw, look_in_cache);
 
-    gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
-
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic1_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_second,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic1_code));
-
-    gum_x86_writer_put_label (cw, try_second);
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic2_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, resolve_dynamically,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic2_code));
-
-    gum_x86_writer_put_label (cw, resolve_dynamically);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_block_close_prolog (block, gc);
+    gum_exec_block_write_inline_cache_lookup_code (block, target, ic_entries,
+        gc);
   }
 
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
@@ -3150,16 +5026,15 @@ static void
 gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
                                         const GumBranchTarget * target,
                                         GumExecCtxReplaceCurrentBlockFunc func,
+                                        x86_insn jcc_id,
                                         GumGeneratorContext * gc)
 {
   GumX86Writer * cw = gc->code_writer;
   guint8 * code_start;
   GumPrologType opened_prolog;
   gboolean can_backpatch_statically;
-  gpointer * ic_entries = NULL;
+  GumIcEntry * ic_entries = NULL;
   gconstpointer look_in_cache = cw->code + 1;
-  gconstpointer try_second = cw->code + 2;
-  gconstpointer resolve_dynamically = cw->code + 3;
 
   code_start = cw->code;
   opened_prolog = gc->opened_prolog;
@@ -3171,51 +5046,16 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   if (block->ctx->stalker->trust_threshold >= 0 &&
       !can_backpatch_statically)
   {
-    gpointer null_ptr = NULL;
-    gpointer ic1_real, ic1_code;
-    gpointer ic2_real, ic2_code;
-
     gum_exec_block_close_prolog (block, gc);
 
-    gum_x86_writer_put_jmp_short_label (cw, look_in_cache);
-
-    ic_entries = gum_x86_writer_cur (cw);
-    ic1_real = ic_entries;
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic1_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_real = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-    ic2_code = gum_x86_writer_cur (cw);
-    gum_x86_writer_put_bytes (cw, (guint8 *) &null_ptr, sizeof (null_ptr));
-
+    gum_x86_writer_put_jmp_near_label (cw, look_in_cache);
+    ic_entries = gum_exec_block_write_inline_cache_entries (block, gc);
     gum_x86_writer_put_label (cw, look_in_cache);
-    gum_exec_block_open_prolog (block, GUM_PROLOG_IC, gc);
-
-    gum_exec_ctx_write_push_branch_target_address (block->ctx, target, gc);
-
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic1_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_second,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic1_code));
 
-    gum_x86_writer_put_label (cw, try_second);
-    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
-        GUM_ADDRESS (ic2_real));
-    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0, GUM_REG_XAX);
-    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, resolve_dynamically,
-        GUM_NO_HINT);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_ctx_write_epilog (block->ctx, GUM_PROLOG_IC, cw);
-    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (ic2_code));
+    gum_exec_block_open_prolog (block, GUM_PROLOG_IC, gc);
 
-    gum_x86_writer_put_label (cw, resolve_dynamically);
-    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
-    gum_exec_block_close_prolog (block, gc);
+    gum_exec_block_write_inline_cache_lookup_code (block, target, ic_entries,
+        gc);
   }
 
   gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
@@ -3237,7 +5077,16 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
         GUM_ADDRESS (&block->ctx->current_block));
   }
 
-  if (can_backpatch_statically)
+  if (can_backpatch_statically && jcc_id != X86_INS_INVALID &&
+      opened_prolog == GUM_PROLOG_NONE)
+  {
+    gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+        GUM_ADDRESS (gum_exec_block_backpatch_jcc), 3,
+        GUM_ARG_REGISTER, GUM_REG_XAX,
+        GUM_ARG_ADDRESS, GUM_ADDRESS (code_start),
+        GUM_ARG_ADDRESS, GUM_ADDRESS (jcc_id));
+  }
+  else if (can_backpatch_statically)
   {
     gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
         GUM_ADDRESS (gum_exec_block_backpatch_jmp), 3,
@@ -3259,39 +5108,181 @@ gum_exec_block_write_jmp_transfer_code (GumExecBlock * block,
   gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&block->ctx->resume_at));
 }
 
-static void
-gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
-                                        GumGeneratorContext * gc)
-{
-  GumX86Writer * cw = gc->code_writer;
+static GumIcEntry *
+gum_exec_block_write_inline_cache_entries (GumExecBlock * block,
+                                           GumGeneratorContext * gc)
+{
+  GumX86Writer * cw = gc->code_writer;
+  GumIcEntry * ic_entries;
+  GumIcEntry empty_entry = { NULL, NULL };
+  guint i;
+
+  ic_entries = gum_x86_writer_cur (cw);
+
+  for (i = 0; i != block->ctx->ic_entries; i++)
+  {
+    gum_x86_writer_put_bytes (cw, (guint8 *) &empty_entry,
+        sizeof (empty_entry));
+  }
+
+  return ic_entries;
+}
+
+/*
+ * Expects an open GUM_PROLOG_IC. Jumps straight to the cached code on a hit,
+ * otherwise falls through with the prolog closed so the caller can resolve
+ * the target dynamically.
+ */
+static void
+gum_exec_block_write_inline_cache_lookup_code (GumExecBlock * block,
+                                               const GumBranchTarget * target,
+                                               GumIcEntry * ic_entries,
+                                               GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  gconstpointer try_fallback = cw->code + 1;
+  gconstpointer resolve_dynamically = cw->code + 2;
+#if GLIB_SIZEOF_VOID_P == 4
+  gconstpointer no_carry = cw->code + 3;
+#endif
+  guint i;
+
+  gum_exec_ctx_write_push_branch_target_address (ctx, target, gc);
+
+  /*
+   * Only lookups are counted here, keeping the hit path as short as it was.
+   * Misses end up in the backpatching code, which counts them, and the
+   * difference is what hit.
+   */
+#if GLIB_SIZEOF_VOID_P == 8
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_RAX,
+      GUM_ADDRESS (&ctx->ic_lookups));
+  gum_x86_writer_put_inc_reg_ptr (cw, GUM_PTR_QWORD, GUM_REG_RAX);
+#else
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_EAX,
+      GUM_ADDRESS (&ctx->ic_lookups));
+  gum_x86_writer_put_inc_reg_ptr (cw, GUM_PTR_DWORD, GUM_REG_EAX);
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, no_carry, GUM_LIKELY);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_EAX,
+      GUM_ADDRESS ((guint32 *) &ctx->ic_lookups + 1));
+  gum_x86_writer_put_inc_reg_ptr (cw, GUM_PTR_DWORD, GUM_REG_EAX);
+  gum_x86_writer_put_label (cw, no_carry);
+#endif
+
+  for (i = 0; i != ctx->ic_entries; i++)
+  {
+    GumIcEntry * entry = &ic_entries[i];
+    gboolean is_last = i == ctx->ic_entries - 1;
+    gconstpointer try_next = is_last ? try_fallback : entry + 1;
+
+    gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+        GUM_ADDRESS (&entry->real_start));
+    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0,
+        GUM_REG_XAX);
+    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_next,
+        GUM_NO_HINT);
+    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+    gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_IC, cw);
+    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&entry->code_start));
+
+    gum_x86_writer_put_label (cw, try_next);
+  }
+
+  if (ctx->ic_fallback != NULL)
+  {
+    /* XBX is no longer needed for loading real registers at this point */
+    gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XAX, GUM_REG_XSP);
+    gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XBX, GUM_REG_XAX);
+    gum_x86_writer_put_shr_reg_u8 (cw, GUM_REG_XBX, 4);
+    gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_XBX, GUM_REG_XAX);
+    gum_x86_writer_put_and_reg_u32 (cw, GUM_REG_XBX, GUM_IC_FALLBACK_SIZE - 1);
+    gum_x86_writer_put_shl_reg_u8 (cw, GUM_REG_XBX,
+        (sizeof (gpointer) == 8) ? 4 : 3);
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+        GUM_ADDRESS (ctx->ic_fallback));
+    gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XBX, GUM_REG_XAX);
+
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XAX, GUM_REG_XBX,
+        G_STRUCT_OFFSET (GumIcEntry, real_start));
+    gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, 0,
+        GUM_REG_XAX);
+    gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, resolve_dynamically,
+        GUM_UNLIKELY);
+
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XAX, GUM_REG_XBX,
+        G_STRUCT_OFFSET (GumIcEntry, code_start));
+    gum_x86_writer_put_mov_near_ptr_reg (cw,
+        GUM_ADDRESS (&ctx->ic_fallback_code), GUM_REG_XAX);
+    gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+    gum_exec_ctx_write_epilog (ctx, GUM_PROLOG_IC, cw);
+    gum_x86_writer_put_jmp_near_ptr (cw, GUM_ADDRESS (&ctx->ic_fallback_code));
+  }
+
+  gum_x86_writer_put_label (cw, resolve_dynamically);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_exec_block_close_prolog (block, gc);
+}
+
+static void
+gum_exec_block_write_ret_transfer_code (GumExecBlock * block,
+                                        GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  const cs_insn * insn = gc->instruction->ci;
+  gconstpointer try_helper = cw->code + 1;
+  guint stack_delta = GUM_RED_ZONE_SIZE + (3 * sizeof (gpointer));
+
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+
+  /*
+   * Inline fast path: if the return address matches the frame at the top of
+   * our shadow stack, point it at the translated code and let a copy of the
+   * original instruction do the rest, sparing the trip through the helper
+   * and the indirect jump via return_at.
+   */
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&ctx->current_frame));
+  gum_x86_writer_put_mov_reg_reg_ptr (cw, GUM_REG_XAX, GUM_REG_XAX);
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX, GUM_REG_XAX,
+      G_STRUCT_OFFSET (GumExecFrame, real_address));
+  gum_x86_writer_put_cmp_reg_offset_ptr_reg (cw, GUM_REG_XSP, stack_delta,
+      GUM_REG_XCX);
+  gum_x86_writer_put_jcc_short_label (cw, X86_INS_JNE, try_helper,
+      GUM_UNLIKELY);
+
+  gum_x86_writer_put_mov_reg_reg_offset_ptr (cw, GUM_REG_XCX, GUM_REG_XAX,
+      G_STRUCT_OFFSET (GumExecFrame, code_address));
+  gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XSP, stack_delta,
+      GUM_REG_XCX);
 
-  gum_exec_block_close_prolog (block, gc);
+  gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XAX, sizeof (GumExecFrame));
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
+      GUM_ADDRESS (&ctx->current_frame));
+  gum_x86_writer_put_mov_reg_ptr_reg (cw, GUM_REG_XCX, GUM_REG_XAX);
 
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
   gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
-      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
-  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_bytes (cw, insn->bytes, insn->size);
+
+  gum_x86_writer_put_label (cw, try_helper);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
   gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX,
       GUM_ADDRESS (gc->instruction->begin));
   gum_x86_writer_put_jmp_address (cw,
-      GUM_ADDRESS (block->ctx->last_stack_pop_and_go));
-}
-
-static void
-gum_exec_block_write_single_step_transfer_code (GumExecBlock * block,
-                                                GumGeneratorContext * gc)
-{
-  guint8 code[] = {
-    0xc6, 0x05, 0x78, 0x56, 0x34, 0x12,       /* mov byte [X], state */
-          GUM_EXEC_SINGLE_STEPPING_ON_CALL,
-    0x9c,                                     /* pushfd              */
-    0x81, 0x0c, 0x24, 0x00, 0x01, 0x00, 0x00, /* or [esp], 0x100     */
-    0x9d                                      /* popfd               */
-  };
-
-  *((guint8 **) (code + 2)) = &block->state;
-  gum_x86_writer_put_bytes (gc->code_writer, code, sizeof (code));
-  gum_x86_writer_put_jmp_address (gc->code_writer,
-      GUM_ADDRESS (gc->instruction->begin));
+      GUM_ADDRESS (ctx->last_stack_pop_and_go));
 }
 
 static void
@@ -3336,14 +5327,8 @@ gum_exec_block_write_exec_event_code (GumExecBlock * block,
                                       GumGeneratorContext * gc,
                                       GumCodeContext cc)
 {
-  gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
-
-  gum_x86_writer_put_call_address_with_aligned_arguments (gc->code_writer,
-      GUM_CALL_CAPI, GUM_ADDRESS (gum_exec_ctx_emit_exec_event), 2,
-      GUM_ARG_ADDRESS, GUM_ADDRESS (block->ctx),
-      GUM_ARG_ADDRESS, GUM_ADDRESS (gc->instruction->begin));
-
-  gum_exec_block_write_unfollow_check_code (block, gc, cc);
+  gum_exec_block_write_buffered_event_code (block, GUM_EXEC,
+      gc->instruction->begin, NULL, gc, cc);
 }
 
 static void
@@ -3351,15 +5336,187 @@ gum_exec_block_write_block_event_code (GumExecBlock * block,
                                        GumGeneratorContext * gc,
                                        GumCodeContext cc)
 {
-  gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
+  GumX86Writer * cw = gc->code_writer;
+  guint interval = block->ctx->stalker->block_sample_interval;
+  gconstpointer skip_event = cw->code + 1;
+  gconstpointer beach = cw->code + 2;
 
-  gum_x86_writer_put_call_address_with_aligned_arguments (gc->code_writer,
-      GUM_CALL_CAPI, GUM_ADDRESS (gum_exec_ctx_emit_block_event), 3,
-      GUM_ARG_ADDRESS, GUM_ADDRESS (block->ctx),
-      GUM_ARG_ADDRESS, GUM_ADDRESS (gc->relocator->input_start),
-      GUM_ARG_ADDRESS, GUM_ADDRESS (gc->relocator->input_cur));
+  if (interval <= 1)
+  {
+    gum_exec_block_write_buffered_event_code (block, GUM_BLOCK,
+        gc->relocator->input_start, gc->relocator->input_cur, gc, cc);
+    return;
+  }
+
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&block->sample_countdown));
+  gum_x86_writer_put_dec_reg_ptr (cw, GUM_PTR_DWORD, GUM_REG_XAX);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JNE, skip_event, GUM_LIKELY);
+  gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw, GUM_REG_XAX, 0, interval);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+
+  gum_exec_block_write_buffered_event_code (block, GUM_BLOCK,
+      gc->relocator->input_start, gc->relocator->input_cur, gc, cc);
+  gum_x86_writer_put_jmp_near_label (cw, beach);
+
+  gum_x86_writer_put_label (cw, skip_event);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+
+  gum_x86_writer_put_label (cw, beach);
+}
+
+/*
+ * The AFL edge update, done inline with only the flags and two scratch
+ * registers preserved. This block's ID is known when compiling, so all that
+ * is loaded at runtime is the thread's previous ID.
+ */
+static void
+gum_exec_block_write_coverage_code (GumExecBlock * block,
+                                    GumGeneratorContext * gc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumStalker * stalker = ctx->stalker;
+  GumX86Writer * cw = gc->code_writer;
+  guint8 * bitmap;
+  gsize location, id;
+
+  bitmap = stalker->coverage_bitmap;
+  if (bitmap == NULL)
+    return;
+
+  location = GPOINTER_TO_SIZE (gc->relocator->input_start);
+  id = ((location >> 4) ^ (location << 8)) & stalker->coverage_mask;
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&ctx->coverage_prev));
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX, id);
+  gum_x86_writer_put_xor_reg_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX, GUM_ADDRESS (bitmap));
+  gum_x86_writer_put_add_reg_reg (cw, GUM_REG_XCX, GUM_REG_XAX);
+  gum_x86_writer_put_inc_reg_ptr (cw, GUM_PTR_BYTE, GUM_REG_XCX);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XAX, id >> 1);
+  gum_x86_writer_put_mov_near_ptr_reg (cw, GUM_ADDRESS (&ctx->coverage_prev),
+      GUM_REG_XAX);
+
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+}
+
+/*
+ * Appends the event to the thread's event buffer without leaving generated
+ * code, and only calls out to hand the batch over to the sink once the buffer
+ * is full. Anything buffered is also handed over before call, ret and compile
+ * events, and on unfollow, so the sink sees events in their original order.
+ * Timestamps are read inline too, leaving the buffer's zeroes in place when
+ * they are not wanted.
+ */
+static void
+gum_exec_block_write_buffered_event_code (GumExecBlock * block,
+                                          GumEventType type,
+                                          gpointer a,
+                                          gpointer b,
+                                          GumGeneratorContext * gc,
+                                          GumCodeContext cc)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumX86Writer * cw = gc->code_writer;
+  gconstpointer skip_flush = cw->code + 1;
+  gconstpointer beach = cw->code + 2;
+
+  gum_exec_block_close_prolog (block, gc);
+
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, -GUM_RED_ZONE_SIZE);
+  gum_x86_writer_put_pushfx (cw);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_push_reg (cw, GUM_REG_XCX);
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XAX,
+      GUM_ADDRESS (&ctx->event_buffer_cur));
+  gum_x86_writer_put_mov_reg_offset_ptr_u32 (cw, GUM_REG_XAX,
+      G_STRUCT_OFFSET (GumAnyEvent, type), type);
+  gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX, GUM_ADDRESS (a));
+  if (type == GUM_EXEC)
+  {
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+        G_STRUCT_OFFSET (GumExecEvent, location), GUM_REG_XCX);
+  }
+  else
+  {
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+        G_STRUCT_OFFSET (GumBlockEvent, begin), GUM_REG_XCX);
+    gum_x86_writer_put_mov_reg_address (cw, GUM_REG_XCX, GUM_ADDRESS (b));
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XAX,
+        G_STRUCT_OFFSET (GumBlockEvent, end), GUM_REG_XCX);
+  }
+  if (ctx->timestamps_enabled)
+  {
+    gssize timestamp_offset = (type == GUM_EXEC)
+        ? G_STRUCT_OFFSET (GumExecEvent, timestamp)
+        : G_STRUCT_OFFSET (GumBlockEvent, timestamp);
+
+    gum_x86_writer_put_push_reg (cw, GUM_REG_XDX);
+    gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XCX, GUM_REG_XAX);
+    gum_x86_writer_put_rdtsc (cw);
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XCX,
+        timestamp_offset, GUM_REG_EAX);
+    gum_x86_writer_put_mov_reg_offset_ptr_reg (cw, GUM_REG_XCX,
+        timestamp_offset + 4, GUM_REG_EDX);
+    gum_x86_writer_put_mov_reg_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+    gum_x86_writer_put_pop_reg (cw, GUM_REG_XDX);
+  }
+  gum_x86_writer_put_add_reg_imm (cw, GUM_REG_XAX, sizeof (GumEvent));
+  gum_x86_writer_put_mov_near_ptr_reg (cw,
+      GUM_ADDRESS (&ctx->event_buffer_cur), GUM_REG_XAX);
+
+  gum_x86_writer_put_mov_reg_near_ptr (cw, GUM_REG_XCX,
+      GUM_ADDRESS (&ctx->event_buffer_end));
+  gum_x86_writer_put_cmp_reg_reg (cw, GUM_REG_XAX, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XCX);
+  gum_x86_writer_put_pop_reg (cw, GUM_REG_XAX);
+  gum_x86_writer_put_jcc_near_label (cw, X86_INS_JNE, skip_flush, GUM_LIKELY);
+
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
 
+  gum_exec_block_open_prolog (block, GUM_PROLOG_MINIMAL, gc);
+  gum_x86_writer_put_call_address_with_aligned_arguments (cw, GUM_CALL_CAPI,
+      GUM_ADDRESS (gum_exec_ctx_flush_events), 1,
+      GUM_ARG_ADDRESS, GUM_ADDRESS (ctx));
   gum_exec_block_write_unfollow_check_code (block, gc, cc);
+  gum_exec_block_close_prolog (block, gc);
+  gum_x86_writer_put_jmp_near_label (cw, beach);
+
+  gum_x86_writer_put_label (cw, skip_flush);
+  gum_x86_writer_put_popfx (cw);
+  gum_x86_writer_put_lea_reg_reg_offset (cw, GUM_REG_XSP,
+      GUM_REG_XSP, GUM_RED_ZONE_SIZE);
+
+  gum_x86_writer_put_label (cw, beach);
 }
 
 static void
@@ -3393,19 +5550,12 @@ gum_exec_block_write_unfollow_check_code (GumExecBlock * block,
 }
 
 static void
-gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
-                                              gpointer location,
-                                              gpointer target_address,
-                                              gpointer return_address,
-                                              GumCpuContext * cpu_context)
+gum_exec_block_run_call_probes (GumExecBlock * block,
+                                GArray * probes,
+                                gpointer location,
+                                gpointer return_address,
+                                GumCpuContext * cpu_context)
 {
-  GumStalker * stalker = block->ctx->stalker;
-  GArray * probes;
-
-  gum_spinlock_acquire (&stalker->probe_lock);
-
-  probes = (GArray *)
-      g_hash_table_lookup (stalker->probe_array_by_address, target_address);
   if (probes != NULL)
   {
     GumCallSite call_site;
@@ -3429,8 +5579,47 @@ gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
       probe->callback (&call_site, probe->user_data);
     }
   }
+}
+
+static void
+gum_exec_block_invoke_call_probes (GumExecBlock * block,
+                                   GumCallProbeSlot * slot,
+                                   gpointer location,
+                                   gpointer return_address,
+                                   GumCpuContext * cpu_context)
+{
+  GumExecCtx * ctx = block->ctx;
+
+  g_atomic_int_inc (&ctx->probe_epoch);
+
+  gum_exec_block_run_call_probes (block, g_atomic_pointer_get (&slot->probes),
+      location, return_address, cpu_context);
+
+  g_atomic_int_inc (&ctx->probe_epoch);
+}
+
+static void
+gum_exec_block_invoke_call_probes_for_target (GumExecBlock * block,
+                                              gpointer location,
+                                              gpointer target_address,
+                                              gpointer return_address,
+                                              GumCpuContext * cpu_context)
+{
+  GumExecCtx * ctx = block->ctx;
+  GumCallProbeSlot * slot;
+
+  g_atomic_int_inc (&ctx->probe_epoch);
+
+  slot = gum_call_probe_index_find (
+      g_atomic_pointer_get (&ctx->stalker->probe_index), target_address);
+  if (slot != NULL)
+  {
+    gum_exec_block_run_call_probes (block,
+        g_atomic_pointer_get (&slot->probes), location, return_address,
+        cpu_context);
+  }
 
-  gum_spinlock_release (&stalker->probe_lock);
+  g_atomic_int_inc (&ctx->probe_epoch);
 }
 
 static void
@@ -3439,19 +5628,39 @@ gum_exec_block_write_call_probe_code (GumExecBlock * block,
                                       GumGeneratorContext * gc)
 {
   GumX86Writer * cw = gc->code_writer;
-  gboolean skip_probing = FALSE;
+  GumCallProbeSlot * slot;
 
   if (!target->is_indirect && target->base == X86_REG_INVALID)
   {
     GumStalker * stalker = block->ctx->stalker;
 
+    /*
+     * The target is known, so resolve its probes now and have the generated
+     * code go straight to them.
+     */
     gum_spinlock_acquire (&stalker->probe_lock);
-    skip_probing = g_hash_table_lookup (stalker->probe_array_by_address,
-        target->absolute_address) == NULL;
+    slot = g_hash_table_lookup (stalker->probe_slot_by_address,
+        target->absolute_address);
+    if (slot != NULL && slot->probes == NULL)
+      slot = NULL;
     gum_spinlock_release (&stalker->probe_lock);
-  }
 
-  if (!skip_probing)
+    if (slot != NULL)
+    {
+      if (gc->opened_prolog != GUM_PROLOG_NONE)
+        gum_exec_block_close_prolog (block, gc);
+      gum_exec_block_open_prolog (block, GUM_PROLOG_FULL, gc);
+
+      gum_x86_writer_put_call_address_with_aligned_arguments (cw,
+          GUM_CALL_CAPI, GUM_ADDRESS (gum_exec_block_invoke_call_probes), 5,
+          GUM_ARG_ADDRESS, GUM_ADDRESS (block),
+          GUM_ARG_ADDRESS, GUM_ADDRESS (slot),
+          GUM_ARG_ADDRESS, GUM_ADDRESS (gc->instruction->begin),
+          GUM_ARG_ADDRESS, GUM_ADDRESS (gc->instruction->end),
+          GUM_ARG_REGISTER, GUM_REG_XBX);
+    }
+  }
+  else
   {
     if (gc->opened_prolog != GUM_PROLOG_NONE)
       gum_exec_block_close_prolog (block, gc);
@@ -3629,144 +5838,6 @@ gum_negate_jcc (x86_insn instruction_id)
   }
 }
 
-#if defined (G_OS_WIN32) && GLIB_SIZEOF_VOID_P == 4
-
-static void
-enable_hardware_breakpoint (DWORD * dr7_reg, guint index)
-{
-  /* set both RWn and LENn to 00 */
-  *dr7_reg &= ~(0xf << (16 + (2 * index)));
-
-  /* set LE bit */
-  *dr7_reg |= 1 << (2 * index);
-}
-
-static gpointer
-find_system_call_above_us (GumStalker * stalker, gpointer * start_esp)
-{
-  gpointer * top_esp, * cur_esp;
-  guint8 call_fs_c0_code[] = { 0x64, 0xff, 0x15, 0xc0, 0x00, 0x00, 0x00 };
-  guint8 call_ebp_8_code[] = { 0xff, 0x55, 0x08 };
-  guint8 * minimum_address, * maximum_address;
-
-  __asm
-  {
-    mov eax, fs:[4];
-    mov [top_esp], eax;
-  }
-
-  if ((guint) ABS (top_esp - start_esp) > stalker->page_size)
-  {
-    top_esp = (gpointer *) ((GPOINTER_TO_SIZE (start_esp) +
-        (stalker->page_size - 1)) & ~(stalker->page_size - 1));
-  }
-
-  /* These boundaries are quite artificial... */
-  minimum_address = (guint8 *) stalker->user32_start + sizeof (call_fs_c0_code);
-  maximum_address = (guint8 *) stalker->user32_end - 1;
-
-  for (cur_esp = start_esp + 1; cur_esp < top_esp; cur_esp++)
-  {
-    guint8 * address = (guint8 *) *cur_esp;
-
-    if (address >= minimum_address && address <= maximum_address)
-    {
-      if (memcmp (address - sizeof (call_fs_c0_code), call_fs_c0_code,
-          sizeof (call_fs_c0_code)) == 0
-          || memcmp (address - sizeof (call_ebp_8_code), call_ebp_8_code,
-          sizeof (call_ebp_8_code)) == 0)
-      {
-        return address;
-      }
-    }
-  }
-
-  return NULL;
-}
-
-static gboolean
-gum_stalker_on_exception (GumExceptionDetails * details,
-                          gpointer user_data)
-{
-  GumStalker * self;
-  GumExecCtx * ctx;
-  GumExecBlock * block;
-  GumCpuContext * cpu_context = &details->context;
-  CONTEXT * context = details->native_context;
-
-  self = GUM_STALKER (user_data);
-
-  if (details->type != GUM_EXCEPTION_SINGLE_STEP)
-    return FALSE;
-
-  ctx = gum_stalker_get_exec_ctx (self);
-  if (ctx == NULL)
-    return FALSE;
-
-  block = ctx->current_block;
-
-  /*printf ("gum_stalker_handle_exception state=%u %p %08x\n",
-      block->state, context->Eip, exception_record->ExceptionCode);*/
-
-  switch (block->state)
-  {
-    case GUM_EXEC_NORMAL:
-    case GUM_EXEC_SINGLE_STEPPING_ON_CALL:
-    {
-      DWORD instruction_after_call_here;
-      DWORD instruction_after_call_above_us;
-
-      block->previous_dr0 = context->Dr0;
-      block->previous_dr1 = context->Dr1;
-      block->previous_dr2 = context->Dr2;
-      block->previous_dr7 = context->Dr7;
-
-      instruction_after_call_here = cpu_context->eip +
-          gum_x86_reader_insn_length ((guint8 *) cpu_context->eip);
-      context->Dr0 = instruction_after_call_here;
-      enable_hardware_breakpoint (&context->Dr7, 0);
-
-      context->Dr1 = (DWORD) self->ki_user_callback_dispatcher_impl;
-      enable_hardware_breakpoint (&context->Dr7, 1);
-
-      instruction_after_call_above_us = (DWORD)
-          find_system_call_above_us (self, (gpointer *) cpu_context->esp);
-      if (instruction_after_call_above_us != 0)
-      {
-        context->Dr2 = instruction_after_call_above_us;
-        enable_hardware_breakpoint (&context->Dr7, 2);
-      }
-
-      block->state = GUM_EXEC_SINGLE_STEPPING_THROUGH_CALL;
-
-      break;
-    }
-
-    case GUM_EXEC_SINGLE_STEPPING_THROUGH_CALL:
-    {
-      context->Dr0 = block->previous_dr0;
-      context->Dr1 = block->previous_dr1;
-      context->Dr2 = block->previous_dr2;
-      context->Dr7 = block->previous_dr7;
-
-      gum_exec_ctx_replace_current_block_with (ctx,
-          GSIZE_TO_POINTER (cpu_context->eip));
-      cpu_context->eip = (DWORD) ctx->resume_at;
-
-      block->state = GUM_EXEC_NORMAL;
-
-      break;
-    }
-
-    default:
-      g_assert_not_reached ();
-  }
-
-  return TRUE;
-}
-
-#endif
-
 void
 gum_stalker_set_counters_enabled (gboolean enabled)
 {
@@ -3807,3 +5878,27 @@ gum_stalker_dump_counters (void)
 
   GUM_PRINT_ENTRYGATE_COUNTER (jmp_continuation);
 }
+
+void
+gum_stalker_get_counters (GumStalkerCounters * counters)
+{
+  counters->transitions = total_transitions;
+  counters->compilations = total_compilations;
+
+  counters->entrygate_time = total_entrygate_time;
+  counters->compile_time = total_compile_time - total_transform_time;
+  counters->transform_time = total_transform_time;
+  counters->sink_time = total_sink_time;
+}
+
+void
+gum_stalker_reset_counters (void)
+{
+  total_transitions = 0;
+  total_compilations = 0;
+
+  total_entrygate_time = 0;
+  total_compile_time = 0;
+  total_transform_time = 0;
+  total_sink_time = 0;
+}
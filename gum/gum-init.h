@@ -18,6 +18,9 @@ G_GNUC_INTERNAL void _gum_register_early_destructor (
     GumDestructorFunc destructor);
 G_GNUC_INTERNAL void _gum_register_destructor (GumDestructorFunc destructor);
 
+G_GNUC_INTERNAL void _gum_record_init_timing (const gchar * subsystem,
+    gint64 start_time);
+
 G_GNUC_INTERNAL gpointer gum_cs_malloc (size_t size);
 G_GNUC_INTERNAL gpointer gum_cs_calloc (size_t count, size_t size);
 G_GNUC_INTERNAL gpointer gum_cs_realloc (gpointer mem, size_t size);
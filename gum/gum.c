@@ -11,10 +11,12 @@
 #include "guminterceptor-priv.h"
 #include "gummemory-priv.h"
 #include "gumprintf.h"
+#include "gumstalker-priv.h"
 #include "gumtls-priv.h"
 #include "valgrind.h"
 
 #include <ffi.h>
+#include <string.h>
 #include <glib-object.h>
 #include <gio/gio.h>
 #ifdef HAVE_WINDOWS
@@ -23,6 +25,8 @@
 
 #define DEBUG_HEAP_LEAKS 0
 
+#define GUM_MAX_INIT_TIMINGS 16
+
 typedef struct _GumInternalThreadDetails GumInternalThreadDetails;
 
 struct _GumInternalThreadDetails
@@ -103,7 +107,11 @@ static GSList * gum_final_destructors = NULL;
 static GPrivate gum_internal_thread_details_key = G_PRIVATE_INIT (
     (GDestroyNotify) gum_internal_thread_details_free);
 
-static GumInterceptor * gum_cached_interceptor = NULL;
+static gboolean gum_ignore_internal_threads = FALSE;
+
+G_LOCK_DEFINE_STATIC (gum_init_timings);
+static GumInitTiming gum_init_timings[GUM_MAX_INIT_TIMINGS];
+static guint gum_n_init_timings = 0;
 
 G_DEFINE_BOXED_TYPE (GumAddress, gum_address, gum_address_copy,
     gum_address_free)
@@ -141,6 +149,10 @@ gum_deinit (void)
 
   _gum_interceptor_deinit ();
 
+  G_LOCK (gum_init_timings);
+  gum_n_init_timings = 0;
+  G_UNLOCK (gum_init_timings);
+
   gum_initialized = FALSE;
 }
 
@@ -155,17 +167,79 @@ gum_do_init (void)
     (cs_vsnprintf_t) gum_vsnprintf
   };
 
+  gint64 start_time;
+
+  start_time = g_get_monotonic_time ();
   gum_memory_init ();
+  _gum_record_init_timing ("memory", start_time);
 
+  start_time = g_get_monotonic_time ();
   glib_init ();
+  _gum_record_init_timing ("glib", start_time);
+
+  start_time = g_get_monotonic_time ();
   gobject_init ();
+  _gum_record_init_timing ("gobject", start_time);
+
+  start_time = g_get_monotonic_time ();
   gio_init ();
+  _gum_record_init_timing ("gio", start_time);
 
   cs_option (0, CS_OPT_MEM, GPOINTER_TO_SIZE (&gum_cs_mem_callbacks));
 
+  start_time = g_get_monotonic_time ();
   _gum_tls_init ();
   _gum_interceptor_init ();
   _gum_tls_realize ();
+  _gum_record_init_timing ("tls", start_time);
+}
+
+/*
+ * Returns how long each subsystem took to initialize, in microseconds and in
+ * the order they were initialized. Subsystems that are only set up on first
+ * use, like the Interceptor and Capstone's heap, show up once that happens.
+ */
+GArray *
+gum_query_init_timings (void)
+{
+  GArray * timings;
+
+  timings = g_array_new (FALSE, FALSE, sizeof (GumInitTiming));
+
+  G_LOCK (gum_init_timings);
+  g_array_append_vals (timings, gum_init_timings, gum_n_init_timings);
+  G_UNLOCK (gum_init_timings);
+
+  return timings;
+}
+
+/*
+ * Subsystems that are initialized more than once, like GLib when embedded,
+ * only keep the timing of the first round, which is the one doing the work.
+ */
+void
+_gum_record_init_timing (const gchar * subsystem,
+                         gint64 start_time)
+{
+  GumInitTiming * timing;
+  guint i;
+
+  G_LOCK (gum_init_timings);
+
+  for (i = 0; i != gum_n_init_timings; i++)
+  {
+    if (strcmp (gum_init_timings[i].subsystem, subsystem) == 0)
+      break;
+  }
+
+  if (i == gum_n_init_timings && i != GUM_MAX_INIT_TIMINGS)
+  {
+    timing = &gum_init_timings[gum_n_init_timings++];
+    timing->subsystem = subsystem;
+    timing->duration = g_get_monotonic_time () - start_time;
+  }
+
+  G_UNLOCK (gum_init_timings);
 }
 
 void
@@ -222,6 +296,8 @@ gum_init_embedded (void)
   int tmp_flag;
 #endif
 
+  gint64 start_time;
+
   if (gum_initialized)
     return;
   gum_initialized = TRUE;
@@ -241,7 +317,10 @@ gum_init_embedded (void)
   _CrtSetDbgFlag (tmp_flag);
 #endif
 
+  start_time = g_get_monotonic_time ();
   gum_memory_init ();
+  _gum_record_init_timing ("memory", start_time);
+
   ffi_set_mem_callbacks (&ffi_callbacks);
   g_thread_set_callbacks (&thread_callbacks);
   g_platform_audit_set_fd_callbacks (&fd_callbacks);
@@ -257,7 +336,10 @@ gum_init_embedded (void)
 #else
   g_setenv ("G_SLICE", "always-malloc", TRUE);
 #endif
+  start_time = g_get_monotonic_time ();
   glib_init ();
+  _gum_record_init_timing ("glib", start_time);
+
   g_assertion_set_handler (gum_on_assert_failure, NULL);
   g_log_set_default_handler (gum_on_log_message, NULL);
   gum_do_init ();
@@ -266,7 +348,13 @@ gum_init_embedded (void)
   gum_libdl_prevent_unload ();
 #endif
 
-  gum_cached_interceptor = gum_interceptor_obtain ();
+  /*
+   * The Interceptor is only created once something asks for it, and from
+   * then on kept alive until we're deinitialized, so that hooks come and go
+   * without tearing it down each time.
+   */
+  _gum_interceptor_keep_alive (TRUE);
+  gum_ignore_internal_threads = TRUE;
 }
 
 void
@@ -278,7 +366,8 @@ gum_deinit_embedded (void)
   gio_shutdown ();
   glib_shutdown ();
 
-  g_clear_object (&gum_cached_interceptor);
+  gum_ignore_internal_threads = FALSE;
+  _gum_interceptor_keep_alive (FALSE);
 
   gum_deinit ();
   gio_deinit ();
@@ -289,22 +378,38 @@ gum_deinit_embedded (void)
   gum_initialized = FALSE;
 }
 
+/*
+ * Takes the locks that guard our global state, so that fork() waits for any
+ * thread that is in the middle of changing it. Must be followed by one of the
+ * two calls below, on either side of the fork, which release them again.
+ */
 void
 gum_prepare_to_fork (void)
 {
   _gum_exceptor_backend_prepare_to_fork ();
+  _gum_interceptor_prepare_to_fork ();
+  _gum_stalker_prepare_to_fork ();
 }
 
 void
 gum_recover_from_fork_in_parent (void)
 {
+  _gum_stalker_recover_from_fork_in_parent ();
+  _gum_interceptor_recover_from_fork_in_parent ();
   _gum_exceptor_backend_recover_from_fork_in_parent ();
 }
 
+/*
+ * Only the calling thread survives a fork, so anything we kept per thread is
+ * thrown out for the others, without freeing it one piece at a time, and the
+ * calling thread's state is carried over under its new thread ID.
+ */
 void
 gum_recover_from_fork_in_child (void)
 {
   _gum_exceptor_backend_recover_from_fork_in_child ();
+  _gum_interceptor_recover_from_fork_in_child ();
+  _gum_stalker_recover_from_fork_in_child ();
 }
 
 static void
@@ -338,7 +443,7 @@ gum_on_thread_realize (void)
   GumInternalThreadDetails * details;
   guint i;
 
-  gum_interceptor_ignore_current_thread (gum_cached_interceptor);
+  _gum_interceptor_ignore_current_thread ();
 
   details = g_slice_new (GumInternalThreadDetails);
   details->thread_id = gum_process_get_current_thread_id ();
@@ -358,15 +463,15 @@ gum_on_thread_realize (void)
 static void
 gum_on_thread_dispose (void)
 {
-  if (gum_cached_interceptor != NULL)
-    gum_interceptor_ignore_current_thread (gum_cached_interceptor);
+  if (gum_ignore_internal_threads)
+    _gum_interceptor_ignore_current_thread ();
 }
 
 static void
 gum_on_thread_finalize (void)
 {
-  if (gum_cached_interceptor != NULL)
-    gum_interceptor_unignore_current_thread (gum_cached_interceptor);
+  if (gum_ignore_internal_threads)
+    _gum_interceptor_unignore_current_thread ();
 }
 
 static void
@@ -11,32 +11,53 @@
 
 #include <gum/gumapiresolver.h>
 #include <gum/gumbacktracer.h>
+#include <gum/gumcallgraphsink.h>
 #include <gum/gumcloak.h>
 #include <gum/gumcodeallocator.h>
 #include <gum/gumcodesegment.h>
+#include <gum/gumdeferredlistener.h>
 #include <gum/gumevent.h>
+#include <gum/gumeventcodec.h>
 #include <gum/gumeventsink.h>
+#include <gum/gumeventrouter.h>
 #include <gum/gumexceptor.h>
 #include <gum/gumfunction.h>
+#include <gum/gumimporthooker.h>
 #include <gum/guminterceptor.h>
 #include <gum/guminvocationcontext.h>
 #include <gum/guminvocationlistener.h>
 #include <gum/gumkernel.h>
+#include <gum/gumlog.h>
 #include <gum/gummemory.h>
 #include <gum/gummemoryaccessmonitor.h>
 #include <gum/gummemorymap.h>
+#include <gum/gummemorysnapshot.h>
+#include <gum/gummemoryscan.h>
 #include <gum/gummoduleapiresolver.h>
 #include <gum/gummodulemap.h>
+#include <gum/gummodulesnapshot.h>
 #include <gum/gumprocess.h>
 #include <gum/gumreturnaddress.h>
+#include <gum/gumsharedeventsink.h>
 #include <gum/gumspinlock.h>
+#include <gum/gumstacktable.h>
 #include <gum/gumstalker.h>
 #include <gum/gumsymbolutil.h>
 #include <gum/gumsysinternals.h>
+#include <gum/gumtimestamp.h>
 #include <gum/gumtls.h>
+#include <gum/gumwatchpointmonitor.h>
 
 G_BEGIN_DECLS
 
+typedef struct _GumInitTiming GumInitTiming;
+
+struct _GumInitTiming
+{
+  const gchar * subsystem;
+  gint64 duration;
+};
+
 GUM_API void gum_init (void);
 GUM_API void gum_shutdown (void);
 GUM_API void gum_deinit (void);
@@ -44,6 +65,8 @@ GUM_API void gum_deinit (void);
 GUM_API void gum_init_embedded (void);
 GUM_API void gum_deinit_embedded (void);
 
+GUM_API GArray * gum_query_init_timings (void);
+
 GUM_API void gum_prepare_to_fork (void);
 GUM_API void gum_recover_from_fork_in_parent (void);
 GUM_API void gum_recover_from_fork_in_child (void);
@@ -6,6 +6,8 @@
 
 #include "gumbacktracer.h"
 
+#include "gumfpbacktracer.h"
+
 #ifdef G_OS_WIN32
 # include "backend-dbghelp/gumdbghelpbacktracer.h"
 # include "arch-x86/gumx86backtracer.h"
@@ -67,6 +69,29 @@ gum_backtracer_make_fuzzy (void)
 #endif
 }
 
+/*
+ * Walks frame pointers where the architecture and compiler let us, falling
+ * back to the accurate backtracer whenever the frame chain is broken.
+ * Intended for hot paths like allocation tracking.
+ */
+GumBacktracer *
+gum_backtracer_make_fast (void)
+{
+#if !defined (_MSC_VER) && (defined (HAVE_I386) || defined (HAVE_ARM64) || \
+    (defined (HAVE_ARM) && defined (HAVE_DARWIN)))
+  GumBacktracer * accurate, * fast;
+
+  accurate = gum_backtracer_make_accurate ();
+  fast = gum_fp_backtracer_new (accurate);
+  if (accurate != NULL)
+    g_object_unref (accurate);
+
+  return fast;
+#else
+  return gum_backtracer_make_accurate ();
+#endif
+}
+
 void
 gum_backtracer_generate (GumBacktracer * self,
                          const GumCpuContext * cpu_context,
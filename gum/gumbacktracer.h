@@ -26,6 +26,7 @@ struct _GumBacktracerInterface
 
 GUM_API GumBacktracer * gum_backtracer_make_accurate (void);
 GUM_API GumBacktracer * gum_backtracer_make_fuzzy (void);
+GUM_API GumBacktracer * gum_backtracer_make_fast (void);
 
 GUM_API void gum_backtracer_generate (GumBacktracer * self,
     const GumCpuContext * cpu_context,
@@ -0,0 +1,324 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumcallgraphsink.h"
+
+#include "gumspinlock.h"
+#include "gumtls.h"
+
+#include <string.h>
+
+/*
+ * Each thread counts its call events into its own fixed-size open addressing
+ * table, keyed by (location, target), plus a histogram of call depths. The
+ * table is handed to the user's function as one aggregate and cleared when
+ * it is three quarters full, when the flush interval has passed, and when
+ * the sink is flushed or stopped. Its spinlock only sees contention when
+ * another thread flushes, so counting a call stays a hash and an increment.
+ */
+
+#define GUM_CALL_GRAPH_TABLE_SIZE 4096
+#define GUM_CALL_GRAPH_TABLE_LIMIT ((GUM_CALL_GRAPH_TABLE_SIZE / 4) * 3)
+#define GUM_CALL_GRAPH_CHECK_INTERVAL 1024
+
+typedef struct _GumCallGraphTable GumCallGraphTable;
+
+struct _GumCallGraphSink
+{
+  GObject parent;
+
+  gint64 flush_interval;
+  GumCallGraphFunc func;
+  gpointer data;
+  GDestroyNotify data_destroy;
+
+  GumTlsKey table_key;
+  GMutex mutex;
+  GPtrArray * tables;
+};
+
+struct _GumCallGraphTable
+{
+  GumSpinlock lock;
+  GumThreadId thread_id;
+
+  guint n_used;
+  guint events_until_check;
+  gint64 last_flush;
+
+  guint64 depths[GUM_CALL_GRAPH_MAX_DEPTH];
+  GumCallGraphEdge edges[GUM_CALL_GRAPH_TABLE_SIZE];
+};
+
+static void gum_call_graph_sink_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_call_graph_sink_dispose (GObject * object);
+static void gum_call_graph_sink_finalize (GObject * object);
+
+static GumEventType gum_call_graph_sink_query_mask (GumEventSink * sink);
+static void gum_call_graph_sink_process (GumEventSink * sink,
+    const GumEvent * ev);
+static void gum_call_graph_sink_flush (GumEventSink * sink);
+
+static GumCallGraphTable * gum_call_graph_sink_get_table (
+    GumCallGraphSink * self);
+static void gum_call_graph_sink_flush_table (GumCallGraphSink * self,
+    GumCallGraphTable * table);
+static void gum_call_graph_table_free (GumCallGraphTable * table);
+
+G_DEFINE_TYPE_EXTENDED (GumCallGraphSink,
+                        gum_call_graph_sink,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_EVENT_SINK,
+                            gum_call_graph_sink_iface_init))
+
+static void
+gum_call_graph_sink_class_init (GumCallGraphSinkClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_call_graph_sink_dispose;
+  object_class->finalize = gum_call_graph_sink_finalize;
+}
+
+static void
+gum_call_graph_sink_iface_init (gpointer g_iface,
+                                gpointer iface_data)
+{
+  GumEventSinkInterface * iface = g_iface;
+
+  iface->query_mask = gum_call_graph_sink_query_mask;
+  iface->process = gum_call_graph_sink_process;
+  iface->flush = gum_call_graph_sink_flush;
+  iface->stop = gum_call_graph_sink_flush;
+}
+
+static void
+gum_call_graph_sink_init (GumCallGraphSink * self)
+{
+  self->table_key = gum_tls_key_new ();
+  g_mutex_init (&self->mutex);
+  self->tables = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_call_graph_table_free);
+}
+
+static void
+gum_call_graph_sink_dispose (GObject * object)
+{
+  GumCallGraphSink * self = GUM_CALL_GRAPH_SINK (object);
+
+  if (self->func != NULL)
+    gum_call_graph_sink_flush (GUM_EVENT_SINK (self));
+
+  if (self->data_destroy != NULL)
+    self->data_destroy (self->data);
+
+  self->func = NULL;
+  self->data = NULL;
+  self->data_destroy = NULL;
+
+  G_OBJECT_CLASS (gum_call_graph_sink_parent_class)->dispose (object);
+}
+
+static void
+gum_call_graph_sink_finalize (GObject * object)
+{
+  GumCallGraphSink * self = GUM_CALL_GRAPH_SINK (object);
+
+  g_ptr_array_unref (self->tables);
+  g_mutex_clear (&self->mutex);
+  gum_tls_key_free (self->table_key);
+
+  G_OBJECT_CLASS (gum_call_graph_sink_parent_class)->finalize (object);
+}
+
+/*
+ * flush_interval is in milliseconds, and 0 means that aggregates are only
+ * produced when a table fills up and when the sink is flushed or stopped.
+ * The function is called on whichever thread triggers the aggregate.
+ */
+GumCallGraphSink *
+gum_call_graph_sink_new (guint flush_interval,
+                         GumCallGraphFunc func,
+                         gpointer data,
+                         GDestroyNotify data_destroy)
+{
+  GumCallGraphSink * sink;
+
+  sink = g_object_new (GUM_TYPE_CALL_GRAPH_SINK, NULL);
+  sink->flush_interval = (gint64) flush_interval * G_TIME_SPAN_MILLISECOND;
+  sink->func = func;
+  sink->data = data;
+  sink->data_destroy = data_destroy;
+
+  return sink;
+}
+
+static GumEventType
+gum_call_graph_sink_query_mask (GumEventSink * sink)
+{
+  return GUM_CALL;
+}
+
+static void
+gum_call_graph_sink_process (GumEventSink * sink,
+                             const GumEvent * ev)
+{
+  GumCallGraphSink * self = GUM_CALL_GRAPH_SINK (sink);
+  const GumCallEvent * call = &ev->call;
+  GumCallGraphTable * table;
+  gsize hash;
+  guint index, depth;
+
+  if (ev->type != GUM_CALL)
+    return;
+
+  table = gum_call_graph_sink_get_table (self);
+
+  gum_spinlock_acquire (&table->lock);
+
+  hash = (GPOINTER_TO_SIZE (call->location) >> 2) * 0x9e3779b1U;
+  hash ^= GPOINTER_TO_SIZE (call->target) >> 4;
+  index = (guint) (hash ^ (hash >> 16)) & (GUM_CALL_GRAPH_TABLE_SIZE - 1);
+
+  while (TRUE)
+  {
+    GumCallGraphEdge * edge = &table->edges[index];
+
+    if (edge->count == 0)
+    {
+      edge->location = call->location;
+      edge->target = call->target;
+      edge->count = 1;
+      table->n_used++;
+      break;
+    }
+
+    if (edge->location == call->location && edge->target == call->target)
+    {
+      edge->count++;
+      break;
+    }
+
+    index = (index + 1) & (GUM_CALL_GRAPH_TABLE_SIZE - 1);
+  }
+
+  depth = MIN ((guint) MAX (call->depth, 0), GUM_CALL_GRAPH_MAX_DEPTH - 1);
+  table->depths[depth]++;
+
+  if (table->n_used >= GUM_CALL_GRAPH_TABLE_LIMIT)
+  {
+    gum_call_graph_sink_flush_table (self, table);
+  }
+  else if (--table->events_until_check == 0)
+  {
+    table->events_until_check = GUM_CALL_GRAPH_CHECK_INTERVAL;
+
+    if (self->flush_interval != 0 &&
+        g_get_monotonic_time () - table->last_flush >= self->flush_interval)
+    {
+      gum_call_graph_sink_flush_table (self, table);
+    }
+  }
+
+  gum_spinlock_release (&table->lock);
+}
+
+static void
+gum_call_graph_sink_flush (GumEventSink * sink)
+{
+  GumCallGraphSink * self = GUM_CALL_GRAPH_SINK (sink);
+  guint i;
+
+  g_mutex_lock (&self->mutex);
+
+  for (i = 0; i != self->tables->len; i++)
+  {
+    GumCallGraphTable * table = g_ptr_array_index (self->tables, i);
+
+    gum_spinlock_acquire (&table->lock);
+    gum_call_graph_sink_flush_table (self, table);
+    gum_spinlock_release (&table->lock);
+  }
+
+  g_mutex_unlock (&self->mutex);
+}
+
+static GumCallGraphTable *
+gum_call_graph_sink_get_table (GumCallGraphSink * self)
+{
+  GumCallGraphTable * table;
+
+  table = gum_tls_key_get_value (self->table_key);
+  if (table != NULL)
+    return table;
+
+  table = g_new0 (GumCallGraphTable, 1);
+  gum_spinlock_init (&table->lock);
+  table->thread_id = gum_process_get_current_thread_id ();
+  table->events_until_check = GUM_CALL_GRAPH_CHECK_INTERVAL;
+  table->last_flush = g_get_monotonic_time ();
+
+  g_mutex_lock (&self->mutex);
+  g_ptr_array_add (self->tables, table);
+  g_mutex_unlock (&self->mutex);
+
+  gum_tls_key_set_value (self->table_key, table);
+
+  return table;
+}
+
+/* Must be called with the table's lock held. */
+static void
+gum_call_graph_sink_flush_table (GumCallGraphSink * self,
+                                 GumCallGraphTable * table)
+{
+  GumCallGraphAggregate aggregate;
+  guint i, n;
+
+  table->last_flush = g_get_monotonic_time ();
+
+  if (table->n_used == 0)
+    return;
+
+  /* The hash layout is discarded anyway, so compact the edges in place. */
+  n = 0;
+  for (i = 0; i != GUM_CALL_GRAPH_TABLE_SIZE; i++)
+  {
+    if (table->edges[i].count != 0)
+    {
+      if (i != n)
+      {
+        table->edges[n] = table->edges[i];
+        table->edges[i].count = 0;
+      }
+      n++;
+    }
+  }
+
+  if (self->func != NULL)
+  {
+    aggregate.thread_id = table->thread_id;
+    aggregate.edges = table->edges;
+    aggregate.n_edges = n;
+    memcpy (aggregate.depths, table->depths, sizeof (table->depths));
+
+    self->func (&aggregate, self->data);
+  }
+
+  memset (table->edges, 0, n * sizeof (GumCallGraphEdge));
+  memset (table->depths, 0, sizeof (table->depths));
+  table->n_used = 0;
+}
+
+static void
+gum_call_graph_table_free (GumCallGraphTable * table)
+{
+  gum_spinlock_free (&table->lock);
+
+  g_free (table);
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_CALL_GRAPH_SINK_H__
+#define __GUM_CALL_GRAPH_SINK_H__
+
+#include <glib-object.h>
+#include <gum/gumeventsink.h>
+#include <gum/gumprocess.h>
+
+#define GUM_CALL_GRAPH_MAX_DEPTH 64
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_CALL_GRAPH_SINK (gum_call_graph_sink_get_type ())
+G_DECLARE_FINAL_TYPE (GumCallGraphSink, gum_call_graph_sink, GUM,
+    CALL_GRAPH_SINK, GObject)
+
+typedef struct _GumCallGraphEdge GumCallGraphEdge;
+typedef struct _GumCallGraphAggregate GumCallGraphAggregate;
+
+typedef void (* GumCallGraphFunc) (const GumCallGraphAggregate * aggregate,
+    gpointer user_data);
+
+struct _GumCallGraphEdge
+{
+  gpointer location;
+  gpointer target;
+  guint64 count;
+};
+
+/*
+ * Counts accumulated by one thread since its previous aggregate. Calls
+ * deeper than the histogram are counted in its last bucket.
+ */
+struct _GumCallGraphAggregate
+{
+  GumThreadId thread_id;
+
+  const GumCallGraphEdge * edges;
+  guint n_edges;
+
+  guint64 depths[GUM_CALL_GRAPH_MAX_DEPTH];
+};
+
+GUM_API GumCallGraphSink * gum_call_graph_sink_new (guint flush_interval,
+    GumCallGraphFunc func, gpointer data, GDestroyNotify data_destroy);
+
+G_END_DECLS
+
+#endif
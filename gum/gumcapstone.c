@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumcapstone.h"
+
+/*
+ * Opening a Capstone handle sets up the architecture's tables and decoder
+ * state, which costs far more than decoding the single instruction most
+ * callers are after. Handles for short-lived work are therefore kept for
+ * the lifetime of the calling thread and closed when it exits.
+ *
+ * A handle returned by gum_capstone_get() must not outlive the current call
+ * or be handed to another thread. Objects that keep a handle around, like the
+ * relocators, own their handles instead.
+ */
+
+typedef struct _GumCapstoneHandle GumCapstoneHandle;
+
+struct _GumCapstoneHandle
+{
+  cs_arch arch;
+  cs_mode mode;
+  GumCapstoneDetail detail;
+  csh handle;
+};
+
+static void gum_capstone_handles_free (GArray * handles);
+
+static GPrivate gum_capstone_handles =
+    G_PRIVATE_INIT ((GDestroyNotify) gum_capstone_handles_free);
+
+csh
+gum_capstone_get (cs_arch arch,
+                  cs_mode mode,
+                  GumCapstoneDetail detail)
+{
+  GArray * handles;
+  GumCapstoneHandle entry;
+  guint i;
+  cs_err err;
+
+  handles = g_private_get (&gum_capstone_handles);
+  if (handles == NULL)
+  {
+    handles = g_array_new (FALSE, FALSE, sizeof (GumCapstoneHandle));
+    g_private_set (&gum_capstone_handles, handles);
+  }
+
+  for (i = 0; i != handles->len; i++)
+  {
+    GumCapstoneHandle * cur = &g_array_index (handles, GumCapstoneHandle, i);
+
+    if (cur->arch == arch && cur->mode == mode && cur->detail == detail)
+      return cur->handle;
+  }
+
+  entry.arch = arch;
+  entry.mode = mode;
+  entry.detail = detail;
+
+  err = cs_open (arch, mode, &entry.handle);
+  g_assert_cmpint (err, ==, CS_ERR_OK);
+
+  if (detail == GUM_CAPSTONE_DETAIL_ON)
+  {
+    err = cs_option (entry.handle, CS_OPT_DETAIL, CS_OPT_ON);
+    g_assert_cmpint (err, ==, CS_ERR_OK);
+  }
+
+  g_array_append_val (handles, entry);
+
+  return entry.handle;
+}
+
+static void
+gum_capstone_handles_free (GArray * handles)
+{
+  guint i;
+
+  for (i = 0; i != handles->len; i++)
+    cs_close (&g_array_index (handles, GumCapstoneHandle, i).handle);
+
+  g_array_free (handles, TRUE);
+}
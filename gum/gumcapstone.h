@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_CAPSTONE_H__
+#define __GUM_CAPSTONE_H__
+
+#include <capstone/capstone.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GUM_CAPSTONE_DETAIL_OFF,
+  GUM_CAPSTONE_DETAIL_ON
+} GumCapstoneDetail;
+
+G_GNUC_INTERNAL csh gum_capstone_get (cs_arch arch, cs_mode mode,
+    GumCapstoneDetail detail);
+
+G_END_DECLS
+
+#endif
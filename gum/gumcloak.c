@@ -7,75 +7,155 @@
 #include "gumcloak.h"
 
 #include "gumlibc.h"
-#include "gummetalarray.h"
 #include "gumspinlock.h"
 
-#include <stdlib.h>
 #include <string.h>
 
+#define GUM_CLOAK_MIN_SET_CAPACITY 8
+#define GUM_CLOAK_NO_THREAD 0
+#define GUM_CLOAK_NO_FD -1
+
+typedef struct _GumCloakState GumCloakState;
 typedef struct _GumCloakedRange GumCloakedRange;
 
+/*
+ * Readers never take a lock. Writers serialize on cloak_lock, build a fresh
+ * immutable state next to the current one, publish it with a single pointer
+ * store, and then wait for readers of the old state to drain before
+ * freeing it. Readers announce themselves by bumping one of two counters,
+ * picked by the low bit of cloak_epoch, which lets writers wait for stragglers
+ * without ever blocking readers.
+ */
+struct _GumCloakState
+{
+  gsize size;
+
+  GumThreadId * threads;
+  guint thread_capacity;
+  guint num_threads;
+
+  gint * fds;
+  guint fd_capacity;
+  guint num_fds;
+
+  GumCloakedRange * ranges;
+  guint range_capacity;
+  guint num_ranges;
+};
+
 struct _GumCloakedRange
 {
   const guint8 * start;
   const guint8 * end;
 };
 
-static gint gum_cloak_index_of_thread (GumThreadId id);
-static gint gum_thread_id_compare (gconstpointer element_a,
-    gconstpointer element_b);
-static gint gum_cloak_index_of_fd (gint fd);
-static gint gum_fd_compare (gconstpointer element_a, gconstpointer element_b);
+static guint gum_cloak_read_begin (void);
+static void gum_cloak_read_end (guint slot);
+static void gum_cloak_publish (GumCloakState * state);
+
+static GumCloakState * gum_cloak_state_new (guint num_threads, guint num_fds,
+    guint num_ranges);
+static void gum_cloak_state_free (GumCloakState * state);
+static void gum_cloak_state_copy_threads (GumCloakState * dst,
+    const GumCloakState * src, GumThreadId except);
+static void gum_cloak_state_copy_fds (GumCloakState * dst,
+    const GumCloakState * src, gint except);
+static void gum_cloak_state_copy_ranges (GumCloakState * dst,
+    const GumCloakState * src);
+static gboolean gum_cloak_state_find_overlap (const GumCloakState * self,
+    const guint8 * start, const guint8 * end, GumCloakedRange * overlap);
+
+static guint gum_cloak_set_capacity_for (guint n);
+static guint gum_cloak_hash (gsize value);
+static gboolean gum_cloak_thread_set_contains (const GumCloakState * self,
+    GumThreadId id);
+static void gum_cloak_thread_set_add (GumCloakState * self, GumThreadId id);
+static gboolean gum_cloak_fd_set_contains (const GumCloakState * self,
+    gint fd);
+static void gum_cloak_fd_set_add (GumCloakState * self, gint fd);
 
 static GumSpinlock cloak_lock;
-static GumMetalArray cloaked_threads;
-static GumMetalArray cloaked_ranges;
-static GumMetalArray cloaked_fds;
+static GumCloakState * volatile cloak_state = NULL;
+static volatile gint cloak_epoch = 0;
+static volatile gint cloak_readers[2] = { 0, 0 };
 
 void
 _gum_cloak_init (void)
 {
   gum_spinlock_init (&cloak_lock);
 
-  gum_metal_array_init (&cloaked_threads, sizeof (GumThreadId));
-  gum_metal_array_init (&cloaked_ranges, sizeof (GumCloakedRange));
-  gum_metal_array_init (&cloaked_fds, sizeof (gint));
+  cloak_state = gum_cloak_state_new (0, 0, 0);
 }
 
 void
 _gum_cloak_deinit (void)
 {
-  gum_metal_array_free (&cloaked_fds);
-  gum_metal_array_free (&cloaked_ranges);
-  gum_metal_array_free (&cloaked_threads);
+  gum_cloak_state_free (cloak_state);
+  cloak_state = NULL;
 
   gum_spinlock_free (&cloak_lock);
 }
 
-void
-gum_cloak_add_thread (GumThreadId id)
+static guint
+gum_cloak_read_begin (void)
 {
-  GumThreadId * element, * elements;
-  gint i;
+  guint slot;
 
-  gum_spinlock_acquire (&cloak_lock);
+  slot = g_atomic_int_get (&cloak_epoch) & 1;
+  g_atomic_int_inc (&cloak_readers[slot]);
+
+  return slot;
+}
+
+static void
+gum_cloak_read_end (guint slot)
+{
+  g_atomic_int_dec_and_test (&cloak_readers[slot]);
+}
+
+static void
+gum_cloak_publish (GumCloakState * state)
+{
+  GumCloakState * old_state;
+  guint phase;
 
-  element = NULL;
+  old_state = cloak_state;
+  g_atomic_pointer_set (&cloak_state, state);
 
-  elements = cloaked_threads.data;
-  for (i = (gint) cloaked_threads.length - 1; i >= 0; i--)
+  /*
+   * A reader may have sampled the epoch before the previous flip, so we
+   * go around twice to be sure that both counters have drained.
+   */
+  for (phase = 0; phase != 2; phase++)
   {
-    if (id >= elements[i])
-    {
-      element = gum_metal_array_insert_at (&cloaked_threads, i + 1);
-      break;
-    }
+    guint slot = g_atomic_int_add (&cloak_epoch, 1) & 1;
+
+    while (g_atomic_int_get (&cloak_readers[slot]) != 0)
+      g_thread_yield ();
   }
 
-  if (element == NULL)
-    element = gum_metal_array_insert_at (&cloaked_threads, 0);
+  gum_cloak_state_free (old_state);
+}
+
+void
+gum_cloak_add_thread (GumThreadId id)
+{
+  GumCloakState * old_state, * state;
+
+  gum_spinlock_acquire (&cloak_lock);
 
-  *element = id;
+  old_state = cloak_state;
+  if (!gum_cloak_thread_set_contains (old_state, id))
+  {
+    state = gum_cloak_state_new (old_state->num_threads + 1,
+        old_state->num_fds, old_state->num_ranges);
+    gum_cloak_state_copy_threads (state, old_state, GUM_CLOAK_NO_THREAD);
+    gum_cloak_thread_set_add (state, id);
+    gum_cloak_state_copy_fds (state, old_state, GUM_CLOAK_NO_FD);
+    gum_cloak_state_copy_ranges (state, old_state);
+
+    gum_cloak_publish (state);
+  }
 
   gum_spinlock_release (&cloak_lock);
 }
@@ -83,13 +163,21 @@ gum_cloak_add_thread (GumThreadId id)
 void
 gum_cloak_remove_thread (GumThreadId id)
 {
-  gint index_;
+  GumCloakState * old_state, * state;
 
   gum_spinlock_acquire (&cloak_lock);
 
-  index_ = gum_cloak_index_of_thread (id);
-  if (index_ != -1)
-    gum_metal_array_remove_at (&cloaked_threads, index_);
+  old_state = cloak_state;
+  if (gum_cloak_thread_set_contains (old_state, id))
+  {
+    state = gum_cloak_state_new (old_state->num_threads - 1,
+        old_state->num_fds, old_state->num_ranges);
+    gum_cloak_state_copy_threads (state, old_state, id);
+    gum_cloak_state_copy_fds (state, old_state, GUM_CLOAK_NO_FD);
+    gum_cloak_state_copy_ranges (state, old_state);
+
+    gum_cloak_publish (state);
+  }
 
   gum_spinlock_release (&cloak_lock);
 }
@@ -98,12 +186,14 @@ gboolean
 gum_cloak_has_thread (GumThreadId id)
 {
   gboolean result;
+  guint slot;
 
-  gum_spinlock_acquire (&cloak_lock);
+  slot = gum_cloak_read_begin ();
 
-  result = gum_cloak_index_of_thread (id) != -1;
+  result = gum_cloak_thread_set_contains (g_atomic_pointer_get (&cloak_state),
+      id);
 
-  gum_spinlock_release (&cloak_lock);
+  gum_cloak_read_end (slot);
 
   return result;
 }
@@ -112,17 +202,24 @@ void
 gum_cloak_enumerate_threads (GumCloakFoundThreadFunc func,
                              gpointer user_data)
 {
-  guint length, size, i;
+  guint slot, length, i;
+  const GumCloakState * state;
   GumThreadId * threads;
 
-  gum_spinlock_acquire (&cloak_lock);
+  slot = gum_cloak_read_begin ();
 
-  length = cloaked_threads.length;
-  size = length * cloaked_threads.element_size;
-  threads = g_alloca (size);
-  gum_memcpy (threads, cloaked_threads.data, size);
+  state = g_atomic_pointer_get (&cloak_state);
+  length = 0;
+  threads = NULL;
+  if (state != NULL)
+    threads = g_alloca (MAX (state->num_threads, 1) * sizeof (GumThreadId));
+  for (i = 0; state != NULL && i != state->thread_capacity; i++)
+  {
+    if (state->threads[i] != GUM_CLOAK_NO_THREAD)
+      threads[length++] = state->threads[i];
+  }
 
-  gum_spinlock_release (&cloak_lock);
+  gum_cloak_read_end (slot);
 
   for (i = 0; i != length; i++)
   {
@@ -131,45 +228,59 @@ gum_cloak_enumerate_threads (GumCloakFoundThreadFunc func,
   }
 }
 
-static gint
-gum_cloak_index_of_thread (GumThreadId id)
+void
+gum_cloak_add_range (const GumMemoryRange * range)
 {
-  GumThreadId * elements, * element;
+  GumCloakState * old_state, * state;
+  GumCloakedRange merged;
+  gboolean inserted;
+  guint i;
 
-  elements = cloaked_threads.data;
+  if (range->size == 0)
+    return;
 
-  element = bsearch (&id, elements, cloaked_threads.length,
-      cloaked_threads.element_size, gum_thread_id_compare);
-  if (element == NULL)
-    return -1;
+  gum_spinlock_acquire (&cloak_lock);
 
-  return element - elements;
-}
+  old_state = cloak_state;
 
-static gint
-gum_thread_id_compare (gconstpointer element_a,
-                       gconstpointer element_b)
-{
-  GumThreadId a = *((GumThreadId *) element_a);
-  GumThreadId b = *((GumThreadId *) element_b);
-
-  if (a == b)
-    return 0;
-  if (a < b)
-    return -1;
-  return 1;
-}
+  state = gum_cloak_state_new (old_state->num_threads, old_state->num_fds,
+      old_state->num_ranges + 1);
+  gum_cloak_state_copy_threads (state, old_state, GUM_CLOAK_NO_THREAD);
+  gum_cloak_state_copy_fds (state, old_state, GUM_CLOAK_NO_FD);
 
-void
-gum_cloak_add_range (const GumMemoryRange * range)
-{
-  GumCloakedRange * r;
+  /* keep the ranges sorted and coalesced so that lookups can bisect */
+  merged.start = GSIZE_TO_POINTER (range->base_address);
+  merged.end = merged.start + range->size;
+  inserted = FALSE;
 
-  gum_spinlock_acquire (&cloak_lock);
+  for (i = 0; i != old_state->num_ranges; i++)
+  {
+    const GumCloakedRange * r = &old_state->ranges[i];
+
+    if (r->end < merged.start)
+    {
+      state->ranges[state->num_ranges++] = *r;
+    }
+    else if (r->start > merged.end)
+    {
+      if (!inserted)
+      {
+        state->ranges[state->num_ranges++] = merged;
+        inserted = TRUE;
+      }
+      state->ranges[state->num_ranges++] = *r;
+    }
+    else
+    {
+      merged.start = MIN (merged.start, r->start);
+      merged.end = MAX (merged.end, r->end);
+    }
+  }
+
+  if (!inserted)
+    state->ranges[state->num_ranges++] = merged;
 
-  r = gum_metal_array_append (&cloaked_ranges);
-  r->start = GSIZE_TO_POINTER (range->base_address);
-  r->end = r->start + range->size;
+  gum_cloak_publish (state);
 
   gum_spinlock_release (&cloak_lock);
 }
@@ -177,195 +288,113 @@ gum_cloak_add_range (const GumMemoryRange * range)
 void
 gum_cloak_remove_range (const GumMemoryRange * range)
 {
+  GumCloakState * old_state, * state;
   const guint8 * start, * end;
-  gboolean found_match;
+  GumCloakedRange overlap;
+  guint i;
 
   start = GSIZE_TO_POINTER (range->base_address);
   end = start + range->size;
 
-  do
+  gum_spinlock_acquire (&cloak_lock);
+
+  old_state = cloak_state;
+
+  if (start == end ||
+      !gum_cloak_state_find_overlap (old_state, start, end, &overlap) ||
+      overlap.start == (const guint8 *) old_state)
   {
-    guint i;
+    gum_spinlock_release (&cloak_lock);
+    return;
+  }
 
-    found_match = FALSE;
+  /* only one range can straddle both ends, so we grow by at most one */
+  state = gum_cloak_state_new (old_state->num_threads, old_state->num_fds,
+      old_state->num_ranges + 1);
+  gum_cloak_state_copy_threads (state, old_state, GUM_CLOAK_NO_THREAD);
+  gum_cloak_state_copy_fds (state, old_state, GUM_CLOAK_NO_FD);
 
-    gum_spinlock_acquire (&cloak_lock);
+  for (i = 0; i != old_state->num_ranges; i++)
+  {
+    const GumCloakedRange * r = &old_state->ranges[i];
 
-    for (i = 0; i != cloaked_ranges.length && !found_match; i++)
+    if (r->end <= start || r->start >= end)
     {
-      GumCloakedRange * cloaked;
-      gsize bottom_remainder, top_remainder;
-      gboolean slot_available;
-
-      cloaked = gum_metal_array_element_at (&cloaked_ranges, i);
+      state->ranges[state->num_ranges++] = *r;
+      continue;
+    }
 
-      if (cloaked->start >= end || start >= cloaked->end)
-        continue;
+    if (r->start < start)
+    {
+      GumCloakedRange * bottom = &state->ranges[state->num_ranges++];
 
-      bottom_remainder = MAX (cloaked->start, start) - cloaked->start;
-      top_remainder = cloaked->end - MIN (cloaked->end, end);
+      bottom->start = r->start;
+      bottom->end = start;
+    }
 
-      found_match = TRUE;
-      slot_available = TRUE;
+    if (r->end > end)
+    {
+      GumCloakedRange * top = &state->ranges[state->num_ranges++];
 
-      if (bottom_remainder + top_remainder == 0)
-      {
-        gum_metal_array_remove_at (&cloaked_ranges, i);
-      }
-      else
-      {
-        if (bottom_remainder != 0)
-        {
-          cloaked->end = cloaked->start + bottom_remainder;
-          slot_available = FALSE;
-        }
-
-        if (top_remainder != 0)
-        {
-          GumMemoryRange top;
-
-          top.base_address = GUM_ADDRESS (cloaked->end - top_remainder);
-          top.size = top_remainder;
-
-          if (slot_available)
-          {
-            cloaked->start = GSIZE_TO_POINTER (top.base_address);
-            cloaked->end = cloaked->start + top.size;
-          }
-          else
-          {
-            gum_spinlock_release (&cloak_lock);
-            gum_cloak_add_range (&top);
-            gum_spinlock_acquire (&cloak_lock);
-          }
-        }
-      }
+      top->start = end;
+      top->end = r->end;
     }
-
-    gum_spinlock_release (&cloak_lock);
   }
-  while (found_match);
+
+  gum_cloak_publish (state);
+
+  gum_spinlock_release (&cloak_lock);
 }
 
 GArray *
 gum_cloak_clip_range (const GumMemoryRange * range)
 {
-  GArray * chunks;
-  gboolean found_match, dirty;
-
-  chunks = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange), 2);
-  g_array_append_val (chunks, *range);
-
-  dirty = FALSE;
-
-  do
+  GArray * chunks = NULL;
+  const guint8 * cursor, * end;
+  GumCloakedRange cloaked;
+  GumMemoryRange chunk;
+
+  cursor = GSIZE_TO_POINTER (range->base_address);
+  end = cursor + range->size;
+
+  /*
+   * Growing the array may end up calling back into us through our own
+   * allocator, so only one overlap is looked up per read-side section.
+   */
+  while (cursor < end)
   {
-    guint chunk_index;
+    gboolean found;
+    guint slot;
+
+    slot = gum_cloak_read_begin ();
+    found = gum_cloak_state_find_overlap (g_atomic_pointer_get (&cloak_state),
+        cursor, end, &cloaked);
+    gum_cloak_read_end (slot);
 
-    found_match = FALSE;
+    if (!found)
+      break;
 
-    gum_spinlock_acquire (&cloak_lock);
+    if (chunks == NULL)
+      chunks = g_array_sized_new (FALSE, FALSE, sizeof (GumMemoryRange), 2);
 
-    for (chunk_index = 0;
-        chunk_index != chunks->len && !found_match;
-        chunk_index++)
+    if (cloaked.start > cursor)
     {
-      GumMemoryRange * chunk;
-      const guint8 * chunk_start, * chunk_end;
-      guint cloaked_index;
-      GumCloakedRange threads;
-      GumCloakedRange ranges;
-
-      chunk = &g_array_index (chunks, GumMemoryRange, chunk_index);
-      chunk_start = GSIZE_TO_POINTER (chunk->base_address);
-      chunk_end = chunk_start + chunk->size;
-
-      gum_metal_array_get_extents (&cloaked_threads,
-          (gpointer *) &threads.start, (gpointer *) &threads.end);
-      gum_metal_array_get_extents (&cloaked_ranges,
-          (gpointer *) &ranges.start, (gpointer *) &ranges.end);
-
-      /* FIXME: also consider the arrays themselves */
-
-      for (cloaked_index = 0;
-          cloaked_index != 2 + cloaked_ranges.length && !found_match;
-          cloaked_index++)
-      {
-        const GumCloakedRange * cloaked;
-        const guint8 * lower_bound, * upper_bound;
-        gsize bottom_remainder, top_remainder;
-        gboolean chunk_available;
-
-        if (cloaked_index == 0)
-        {
-          cloaked = &threads;
-        }
-        else if (cloaked_index == 1)
-        {
-          cloaked = &ranges;
-        }
-        else
-        {
-          cloaked = gum_metal_array_element_at (&cloaked_ranges,
-              cloaked_index - 2);
-        }
-
-        lower_bound = MAX (cloaked->start, chunk_start);
-        upper_bound = MIN (cloaked->end, chunk_end);
-        if (lower_bound >= upper_bound)
-          continue;
-
-        bottom_remainder = lower_bound - chunk_start;
-        top_remainder = chunk_end - upper_bound;
-
-        found_match = TRUE;
-        dirty = TRUE;
-        chunk_available = TRUE;
-
-        if (bottom_remainder + top_remainder == 0)
-        {
-          g_array_remove_index (chunks, chunk_index);
-        }
-        else
-        {
-          if (bottom_remainder != 0)
-          {
-            chunk->base_address = GUM_ADDRESS (chunk_start);
-            chunk->size = bottom_remainder;
-            chunk_available = FALSE;
-          }
-
-          if (top_remainder != 0)
-          {
-            GumMemoryRange top;
-
-            top.base_address = GUM_ADDRESS (chunk_end - top_remainder);
-            top.size = top_remainder;
-
-            if (chunk_available)
-            {
-              chunk->base_address = top.base_address;
-              chunk->size = top.size;
-            }
-            else
-            {
-              gum_spinlock_release (&cloak_lock);
-              g_array_insert_val (chunks, chunk_index + 1, top);
-              gum_spinlock_acquire (&cloak_lock);
-            }
-          }
-        }
-      }
+      chunk.base_address = GUM_ADDRESS (cursor);
+      chunk.size = cloaked.start - cursor;
+      g_array_append_val (chunks, chunk);
     }
 
-    gum_spinlock_release (&cloak_lock);
+    cursor = cloaked.end;
   }
-  while (found_match);
 
-  if (!dirty)
-  {
-    g_array_free (chunks, TRUE);
+  if (chunks == NULL)
     return NULL;
+
+  if (cursor < end)
+  {
+    chunk.base_address = GUM_ADDRESS (cursor);
+    chunk.size = end - cursor;
+    g_array_append_val (chunks, chunk);
   }
 
   return chunks;
@@ -375,17 +404,24 @@ void
 gum_cloak_enumerate_ranges (GumCloakFoundRangeFunc func,
                             gpointer user_data)
 {
-  guint length, size, i;
+  guint slot, length, i;
+  const GumCloakState * state;
   GumMemoryRange * ranges;
 
-  gum_spinlock_acquire (&cloak_lock);
+  slot = gum_cloak_read_begin ();
+
+  state = g_atomic_pointer_get (&cloak_state);
+  length = (state != NULL) ? state->num_ranges : 0;
+  ranges = g_alloca (MAX (length, 1) * sizeof (GumMemoryRange));
+  for (i = 0; i != length; i++)
+  {
+    const GumCloakedRange * r = &state->ranges[i];
 
-  length = cloaked_ranges.length;
-  size = length * cloaked_ranges.element_size;
-  ranges = g_alloca (size);
-  gum_memcpy (ranges, cloaked_ranges.data, size);
+    ranges[i].base_address = GUM_ADDRESS (r->start);
+    ranges[i].size = r->end - r->start;
+  }
 
-  gum_spinlock_release (&cloak_lock);
+  gum_cloak_read_end (slot);
 
   for (i = 0; i != length; i++)
   {
@@ -397,41 +433,44 @@ gum_cloak_enumerate_ranges (GumCloakFoundRangeFunc func,
 void
 gum_cloak_add_file_descriptor (gint fd)
 {
-  gint * element, * elements;
-  gint i;
+  GumCloakState * old_state, * state;
 
   gum_spinlock_acquire (&cloak_lock);
 
-  element = NULL;
-
-  elements = cloaked_fds.data;
-  for (i = (gint) cloaked_fds.length - 1; i >= 0; i--)
+  old_state = cloak_state;
+  if (!gum_cloak_fd_set_contains (old_state, fd))
   {
-    if (fd >= elements[i])
-    {
-      element = gum_metal_array_insert_at (&cloaked_fds, i + 1);
-      break;
-    }
+    state = gum_cloak_state_new (old_state->num_threads,
+        old_state->num_fds + 1, old_state->num_ranges);
+    gum_cloak_state_copy_threads (state, old_state, GUM_CLOAK_NO_THREAD);
+    gum_cloak_state_copy_fds (state, old_state, GUM_CLOAK_NO_FD);
+    gum_cloak_fd_set_add (state, fd);
+    gum_cloak_state_copy_ranges (state, old_state);
+
+    gum_cloak_publish (state);
   }
 
-  if (element == NULL)
-    element = gum_metal_array_insert_at (&cloaked_fds, 0);
-
-  *element = fd;
-
   gum_spinlock_release (&cloak_lock);
 }
 
 void
 gum_cloak_remove_file_descriptor (gint fd)
 {
-  gint index_;
+  GumCloakState * old_state, * state;
 
   gum_spinlock_acquire (&cloak_lock);
 
-  index_ = gum_cloak_index_of_fd (fd);
-  if (index_ != -1)
-    gum_metal_array_remove_at (&cloaked_fds, index_);
+  old_state = cloak_state;
+  if (gum_cloak_fd_set_contains (old_state, fd))
+  {
+    state = gum_cloak_state_new (old_state->num_threads,
+        old_state->num_fds - 1, old_state->num_ranges);
+    gum_cloak_state_copy_threads (state, old_state, GUM_CLOAK_NO_THREAD);
+    gum_cloak_state_copy_fds (state, old_state, fd);
+    gum_cloak_state_copy_ranges (state, old_state);
+
+    gum_cloak_publish (state);
+  }
 
   gum_spinlock_release (&cloak_lock);
 }
@@ -440,12 +479,13 @@ gboolean
 gum_cloak_has_file_descriptor (gint fd)
 {
   gboolean result;
+  guint slot;
 
-  gum_spinlock_acquire (&cloak_lock);
+  slot = gum_cloak_read_begin ();
 
-  result = gum_cloak_index_of_fd (fd) != -1;
+  result = gum_cloak_fd_set_contains (g_atomic_pointer_get (&cloak_state), fd);
 
-  gum_spinlock_release (&cloak_lock);
+  gum_cloak_read_end (slot);
 
   return result;
 }
@@ -454,17 +494,24 @@ void
 gum_cloak_enumerate_file_descriptors (GumCloakFoundFDFunc func,
                                       gpointer user_data)
 {
-  guint length, size, i;
+  guint slot, length, i;
+  const GumCloakState * state;
   gint * fds;
 
-  gum_spinlock_acquire (&cloak_lock);
+  slot = gum_cloak_read_begin ();
 
-  length = cloaked_fds.length;
-  size = length * cloaked_fds.element_size;
-  fds = g_alloca (size);
-  gum_memcpy (fds, cloaked_fds.data, size);
+  state = g_atomic_pointer_get (&cloak_state);
+  length = 0;
+  fds = NULL;
+  if (state != NULL)
+    fds = g_alloca (MAX (state->num_fds, 1) * sizeof (gint));
+  for (i = 0; state != NULL && i != state->fd_capacity; i++)
+  {
+    if (state->fds[i] != GUM_CLOAK_NO_FD)
+      fds[length++] = state->fds[i];
+  }
 
-  gum_spinlock_release (&cloak_lock);
+  gum_cloak_read_end (slot);
 
   for (i = 0; i != length; i++)
   {
@@ -473,31 +520,237 @@ gum_cloak_enumerate_file_descriptors (GumCloakFoundFDFunc func,
   }
 }
 
-static gint
-gum_cloak_index_of_fd (gint fd)
+static GumCloakState *
+gum_cloak_state_new (guint num_threads,
+                     guint num_fds,
+                     guint num_ranges)
+{
+  GumCloakState * state;
+  guint thread_capacity, fd_capacity, page_size, n_pages, i;
+  gsize size;
+  guint8 * cursor;
+
+  thread_capacity = gum_cloak_set_capacity_for (num_threads);
+  fd_capacity = gum_cloak_set_capacity_for (num_fds);
+
+  size = sizeof (GumCloakState) +
+      (num_ranges * sizeof (GumCloakedRange)) +
+      (thread_capacity * sizeof (GumThreadId)) +
+      (fd_capacity * sizeof (gint));
+
+  page_size = gum_query_page_size ();
+  n_pages = (size + page_size - 1) / page_size;
+
+  state = gum_alloc_n_pages (n_pages, GUM_PAGE_RW);
+  state->size = n_pages * page_size;
+
+  cursor = (guint8 *) (state + 1);
+
+  state->ranges = (GumCloakedRange *) cursor;
+  state->range_capacity = num_ranges;
+  state->num_ranges = 0;
+  cursor += num_ranges * sizeof (GumCloakedRange);
+
+  state->threads = (GumThreadId *) cursor;
+  state->thread_capacity = thread_capacity;
+  state->num_threads = 0;
+  cursor += thread_capacity * sizeof (GumThreadId);
+
+  state->fds = (gint *) cursor;
+  state->fd_capacity = fd_capacity;
+  state->num_fds = 0;
+  for (i = 0; i != fd_capacity; i++)
+    state->fds[i] = GUM_CLOAK_NO_FD;
+
+  return state;
+}
+
+static void
+gum_cloak_state_free (GumCloakState * state)
+{
+  if (state != NULL)
+    gum_free_pages (state);
+}
+
+static void
+gum_cloak_state_copy_threads (GumCloakState * dst,
+                              const GumCloakState * src,
+                              GumThreadId except)
+{
+  guint i;
+
+  for (i = 0; i != src->thread_capacity; i++)
+  {
+    GumThreadId id = src->threads[i];
+
+    if (id != GUM_CLOAK_NO_THREAD && id != except)
+      gum_cloak_thread_set_add (dst, id);
+  }
+}
+
+static void
+gum_cloak_state_copy_fds (GumCloakState * dst,
+                          const GumCloakState * src,
+                          gint except)
+{
+  guint i;
+
+  for (i = 0; i != src->fd_capacity; i++)
+  {
+    gint fd = src->fds[i];
+
+    if (fd != GUM_CLOAK_NO_FD && fd != except)
+      gum_cloak_fd_set_add (dst, fd);
+  }
+}
+
+static void
+gum_cloak_state_copy_ranges (GumCloakState * dst,
+                             const GumCloakState * src)
+{
+  gum_memcpy (dst->ranges, src->ranges,
+      src->num_ranges * sizeof (GumCloakedRange));
+  dst->num_ranges = src->num_ranges;
+}
+
+/*
+ * Finds the lowest cloaked range overlapping [start, end). The pages
+ * holding the state itself are considered cloaked too.
+ */
+static gboolean
+gum_cloak_state_find_overlap (const GumCloakState * self,
+                              const guint8 * start,
+                              const guint8 * end,
+                              GumCloakedRange * overlap)
+{
+  gboolean found = FALSE;
+  guint lo, hi;
+  const guint8 * self_start, * self_end;
+
+  if (self == NULL)
+    return FALSE;
+
+  lo = 0;
+  hi = self->num_ranges;
+  while (lo < hi)
+  {
+    guint mid = lo + ((hi - lo) / 2);
+
+    if (self->ranges[mid].end <= start)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  if (lo != self->num_ranges && self->ranges[lo].start < end)
+  {
+    *overlap = self->ranges[lo];
+    found = TRUE;
+  }
+
+  self_start = (const guint8 *) self;
+  self_end = self_start + self->size;
+  if (self_start < end && start < self_end &&
+      (!found || self_start < overlap->start))
+  {
+    overlap->start = self_start;
+    overlap->end = self_end;
+    found = TRUE;
+  }
+
+  return found;
+}
+
+static guint
+gum_cloak_set_capacity_for (guint n)
+{
+  guint capacity = GUM_CLOAK_MIN_SET_CAPACITY;
+
+  /* stay at most half full so that probe sequences remain short */
+  while (capacity < 2 * n)
+    capacity *= 2;
+
+  return capacity;
+}
+
+static guint
+gum_cloak_hash (gsize value)
+{
+  value ^= value >> 16;
+  value *= 0x45d9f3b;
+  value ^= value >> 16;
+
+  return value;
+}
+
+static gboolean
+gum_cloak_thread_set_contains (const GumCloakState * self,
+                               GumThreadId id)
+{
+  guint mask, i;
+
+  if (self == NULL || self->num_threads == 0)
+    return FALSE;
+
+  mask = self->thread_capacity - 1;
+  for (i = gum_cloak_hash (id) & mask;
+      self->threads[i] != GUM_CLOAK_NO_THREAD;
+      i = (i + 1) & mask)
+  {
+    if (self->threads[i] == id)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gum_cloak_thread_set_add (GumCloakState * self,
+                          GumThreadId id)
+{
+  guint mask, i;
+
+  mask = self->thread_capacity - 1;
+  i = gum_cloak_hash (id) & mask;
+  while (self->threads[i] != GUM_CLOAK_NO_THREAD)
+    i = (i + 1) & mask;
+
+  self->threads[i] = id;
+  self->num_threads++;
+}
+
+static gboolean
+gum_cloak_fd_set_contains (const GumCloakState * self,
+                           gint fd)
 {
-  gint * elements, * element;
+  guint mask, i;
 
-  elements = cloaked_fds.data;
+  if (self == NULL || self->num_fds == 0)
+    return FALSE;
 
-  element = bsearch (&fd, elements, cloaked_fds.length,
-      cloaked_fds.element_size, gum_fd_compare);
-  if (element == NULL)
-    return -1;
+  mask = self->fd_capacity - 1;
+  for (i = gum_cloak_hash ((guint) fd) & mask;
+      self->fds[i] != GUM_CLOAK_NO_FD;
+      i = (i + 1) & mask)
+  {
+    if (self->fds[i] == fd)
+      return TRUE;
+  }
 
-  return element - elements;
+  return FALSE;
 }
 
-static gint
-gum_fd_compare (gconstpointer element_a,
-                gconstpointer element_b)
+static void
+gum_cloak_fd_set_add (GumCloakState * self,
+                      gint fd)
 {
-  gint a = *((gint *) element_a);
-  gint b = *((gint *) element_b);
-
-  if (a == b)
-    return 0;
-  if (a < b)
-    return -1;
-  return 1;
+  guint mask, i;
+
+  mask = self->fd_capacity - 1;
+  i = gum_cloak_hash ((guint) fd) & mask;
+  while (self->fds[i] != GUM_CLOAK_NO_FD)
+    i = (i + 1) & mask;
+
+  self->fds[i] = fd;
+  self->num_fds++;
 }
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2010-2017 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ * Copyright (C) 2010-2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
  *
  * Licence: wxWindows Library Licence, Version 3.1
  */
@@ -33,11 +33,13 @@
 #endif
 
 typedef struct _GumCodePages GumCodePages;
+typedef struct _GumCodeReservation GumCodeReservation;
 typedef struct _GumCodeSliceElement GumCodeSliceElement;
 typedef struct _GumCodeDeflectorDispatcher GumCodeDeflectorDispatcher;
 typedef struct _GumCodeDeflectorImpl GumCodeDeflectorImpl;
 typedef struct _GumProbeRangeForCodeCaveContext GumProbeRangeForCodeCaveContext;
 typedef struct _GumInsertDeflectorContext GumInsertDeflectorContext;
+typedef struct _GumReserveNearModuleContext GumReserveNearModuleContext;
 
 struct _GumCodeSliceElement
 {
@@ -54,13 +56,28 @@ struct _GumCodePages
   gsize size;
 
   GumCodeAllocator * allocator;
+  GumCodeReservation * reservation;
+
+  GList link;
+  GList * free_slices;
+  guint n_free_slices;
 
   GumCodeSliceElement elements[1];
 };
 
+struct _GumCodeReservation
+{
+  gpointer data;
+  gsize size;
+
+  gpointer * free_batches;
+  guint n_free_batches;
+};
+
 struct _GumCodeDeflectorDispatcher
 {
   GSList * callers;
+  GHashTable * targets;
 
   GumAddress address;
 
@@ -77,6 +94,7 @@ struct _GumCodeDeflectorImpl
   GumCodeDeflector parent;
 
   GumCodeAllocator * allocator;
+  GumCodeDeflectorDispatcher * dispatcher;
 };
 
 struct _GumProbeRangeForCodeCaveContext
@@ -96,16 +114,50 @@ struct _GumInsertDeflectorContext
   GumCodeDeflectorDispatcher * dispatcher;
 };
 
+struct _GumReserveNearModuleContext
+{
+  GumCodeAllocator * allocator;
+  gsize min_module_size;
+  gsize size;
+  gsize max_distance;
+};
+
 static GumCodeSlice * gum_code_allocator_try_alloc_batch_near (
     GumCodeAllocator * self, const GumAddressSpec * spec);
 
+static void gum_code_allocator_drop_free_slices (GumCodeAllocator * self);
+
+static gpointer gum_code_allocator_try_take_reserved_batch (
+    GumCodeAllocator * self, const GumAddressSpec * spec,
+    GumPageProtection protection, GumCodeReservation ** reservation);
+static void gum_code_reservation_put_batch (GumCodeReservation * self,
+    gpointer batch, gsize size);
+static void gum_code_reservation_free (GumCodeReservation * reservation);
+static gboolean gum_reserve_near_module (const GumModuleDetails * details,
+    gpointer user_data);
+
+static GumCodeSlice * gum_code_pages_try_take_slice (GumCodePages * self,
+    const GumAddressSpec * spec, gsize alignment);
+static void gum_code_pages_put_slice (GumCodePages * self,
+    GumCodeSliceElement * element);
 static void gum_code_pages_unref (GumCodePages * self);
 
 static gboolean gum_code_slice_is_near (const GumCodeSlice * self,
     const GumAddressSpec * spec);
+static gboolean gum_code_range_is_near (gpointer data, gsize size,
+    const GumAddressSpec * spec);
+static gboolean gum_code_range_is_out_of_reach (gpointer data, gsize size,
+    const GumAddressSpec * spec);
 static gboolean gum_code_slice_is_aligned (const GumCodeSlice * slice,
     gsize alignment);
 
+static GumCodeDeflectorDispatcher * gum_code_allocator_find_dispatcher_near (
+    GumCodeAllocator * self, const GumAddressSpec * caller);
+static void gum_code_allocator_add_dispatcher (GumCodeAllocator * self,
+    GumCodeDeflectorDispatcher * dispatcher);
+static guint gum_code_allocator_find_dispatcher_index (GumCodeAllocator * self,
+    GumAddress address);
+
 static GumCodeDeflectorDispatcher * gum_code_deflector_dispatcher_new (
     const GumAddressSpec * caller, gpointer return_address,
     gpointer dedicated_target);
@@ -136,25 +188,30 @@ gum_code_allocator_init (GumCodeAllocator * allocator,
 
   allocator->uncommitted_pages = NULL;
   allocator->dirty_pages = g_hash_table_new (NULL, NULL);
-  allocator->free_slices = NULL;
+  allocator->free_pages = NULL;
 
-  allocator->dispatchers = NULL;
+  allocator->dispatchers = g_ptr_array_new ();
+
+  allocator->reservations = NULL;
 }
 
 void
 gum_code_allocator_free (GumCodeAllocator * allocator)
 {
-  g_slist_foreach (allocator->dispatchers,
+  g_ptr_array_foreach (allocator->dispatchers,
       (GFunc) gum_code_deflector_dispatcher_free, NULL);
-  g_slist_free (allocator->dispatchers);
+  g_ptr_array_unref (allocator->dispatchers);
   allocator->dispatchers = NULL;
 
-  g_list_foreach (allocator->free_slices, (GFunc) gum_code_pages_unref, NULL);
+  gum_code_allocator_drop_free_slices (allocator);
   g_hash_table_unref (allocator->dirty_pages);
   g_slist_free (allocator->uncommitted_pages);
   allocator->uncommitted_pages = NULL;
   allocator->dirty_pages = NULL;
-  allocator->free_slices = NULL;
+
+  g_slist_free_full (allocator->reservations,
+      (GDestroyNotify) gum_code_reservation_free);
+  allocator->reservations = NULL;
 }
 
 GumCodeSlice *
@@ -170,22 +227,19 @@ gum_code_allocator_try_alloc_slice_near (GumCodeAllocator * self,
 {
   GList * cur;
 
-  for (cur = self->free_slices; cur != NULL; cur = cur->next)
+  /*
+   * Only batches with at least one free slice are on this list, so the
+   * common case of an unconstrained request is served by its first entry.
+   * Near requests are first checked against the whole batch, and slices
+   * are only looked at one by one for a batch near the edge of the range.
+   */
+  for (cur = self->free_pages; cur != NULL; cur = cur->next)
   {
-    GumCodeSliceElement * element = (GumCodeSliceElement *) cur;
-    GumCodeSlice * slice = &element->slice;
-
-    if (gum_code_slice_is_near (slice, spec) &&
-        gum_code_slice_is_aligned (slice, alignment))
-    {
-      GumCodePages * pages = element->parent.data;
-
-      self->free_slices = g_list_remove_link (self->free_slices, cur);
-
-      g_hash_table_add (self->dirty_pages, pages);
+    GumCodeSlice * slice;
 
+    slice = gum_code_pages_try_take_slice (cur->data, spec, alignment);
+    if (slice != NULL)
       return slice;
-    }
   }
 
   return gum_code_allocator_try_alloc_batch_near (self, spec);
@@ -231,10 +285,199 @@ gum_code_allocator_commit (GumCodeAllocator * self)
   g_hash_table_remove_all (self->dirty_pages);
 
   if (!rwx_supported)
+    gum_code_allocator_drop_free_slices (self);
+}
+
+/*
+ * Where the address space around a module fills up early, as it tends to
+ * around the big ones, near requests end up falling back to deflectors and
+ * indirect branches. Reserving inaccessible address space up front lets
+ * later batches be carved out of it, while it is still within reach.
+ */
+gboolean
+gum_code_allocator_reserve_near (GumCodeAllocator * self,
+                                 const GumAddressSpec * spec,
+                                 gsize size)
+{
+  GumCodeReservation * reservation;
+  gsize batch_size;
+  guint n_batches, i;
+  gpointer data;
+  GumMemoryRange range;
+  GSList * cur;
+
+  if (!gum_query_is_rwx_supported () && gum_code_segment_is_supported ())
+    return FALSE;
+
+  for (cur = self->reservations; cur != NULL; cur = cur->next)
   {
-    g_list_foreach (self->free_slices, (GFunc) gum_code_pages_unref, NULL);
-    self->free_slices = NULL;
+    GumCodeReservation * r = cur->data;
+
+    if (gum_code_range_is_near (r->data, r->size, spec))
+      return TRUE;
   }
+
+  batch_size = self->pages_per_batch * gum_query_page_size ();
+  n_batches = MAX (size / batch_size, 1);
+
+  data = gum_try_alloc_n_pages_near (n_batches * self->pages_per_batch,
+      GUM_PAGE_NO_ACCESS, spec);
+  if (data == NULL)
+    return FALSE;
+
+  gum_query_page_allocation_range (data, n_batches * batch_size, &range);
+  gum_cloak_add_range (&range);
+
+  /*
+   * Reservations are meant to hold a lot of trampolines, so they are worth
+   * backing with huge pages wherever the OS lets us.
+   */
+  gum_memory_advise_huge_pages (data, n_batches * batch_size);
+
+  reservation = g_slice_new (GumCodeReservation);
+  reservation->data = data;
+  reservation->size = n_batches * batch_size;
+  reservation->free_batches = g_new (gpointer, n_batches);
+  reservation->n_free_batches = n_batches;
+  for (i = 0; i != n_batches; i++)
+  {
+    reservation->free_batches[i] =
+        (guint8 *) data + ((n_batches - 1 - i) * batch_size);
+  }
+
+  self->reservations = g_slist_prepend (self->reservations, reservation);
+
+  return TRUE;
+}
+
+void
+gum_code_allocator_reserve_near_modules (GumCodeAllocator * self,
+                                         gsize min_module_size,
+                                         gsize size,
+                                         gsize max_distance)
+{
+  GumReserveNearModuleContext ctx;
+
+  ctx.allocator = self;
+  ctx.min_module_size = min_module_size;
+  ctx.size = size;
+  ctx.max_distance = max_distance;
+
+  gum_process_enumerate_modules (gum_reserve_near_module, &ctx);
+}
+
+static gboolean
+gum_reserve_near_module (const GumModuleDetails * details,
+                         gpointer user_data)
+{
+  GumReserveNearModuleContext * ctx = user_data;
+  const GumMemoryRange * range = details->range;
+  gsize half_size;
+  GumAddressSpec spec;
+
+  if (range->size < ctx->min_module_size)
+    return TRUE;
+
+  half_size = range->size / 2;
+  if (half_size >= ctx->max_distance)
+    return TRUE;
+
+  spec.near_address = GSIZE_TO_POINTER (range->base_address + half_size);
+  spec.max_distance = ctx->max_distance - half_size;
+
+  gum_code_allocator_reserve_near (ctx->allocator, &spec, ctx->size);
+
+  return TRUE;
+}
+
+static gpointer
+gum_code_allocator_try_take_reserved_batch (GumCodeAllocator * self,
+                                            const GumAddressSpec * spec,
+                                            GumPageProtection protection,
+                                            GumCodeReservation ** reservation)
+{
+  gsize batch_size;
+  GSList * cur;
+
+  batch_size = self->pages_per_batch * gum_query_page_size ();
+
+  for (cur = self->reservations; cur != NULL; cur = cur->next)
+  {
+    GumCodeReservation * r = cur->data;
+    guint i;
+
+    if (r->n_free_batches == 0 ||
+        gum_code_range_is_out_of_reach (r->data, r->size, spec))
+      continue;
+
+    for (i = r->n_free_batches; i != 0; i--)
+    {
+      gpointer batch = r->free_batches[i - 1];
+
+      if (!gum_code_range_is_near (batch, batch_size, spec))
+        continue;
+
+      r->n_free_batches--;
+      r->free_batches[i - 1] = r->free_batches[r->n_free_batches];
+
+      gum_mprotect (batch, batch_size, protection);
+
+      *reservation = r;
+      return batch;
+    }
+  }
+
+  return NULL;
+}
+
+static void
+gum_code_reservation_put_batch (GumCodeReservation * self,
+                                gpointer batch,
+                                gsize size)
+{
+  gum_mprotect (batch, size, GUM_PAGE_NO_ACCESS);
+
+  self->free_batches[self->n_free_batches++] = batch;
+}
+
+static void
+gum_code_reservation_free (GumCodeReservation * reservation)
+{
+  GumMemoryRange range;
+
+  gum_free_pages (reservation->data);
+
+  gum_query_page_allocation_range (reservation->data, reservation->size,
+      &range);
+  gum_cloak_remove_range (&range);
+
+  g_free (reservation->free_batches);
+
+  g_slice_free (GumCodeReservation, reservation);
+}
+
+static void
+gum_code_allocator_drop_free_slices (GumCodeAllocator * self)
+{
+  GList * cur, * next;
+
+  for (cur = self->free_pages; cur != NULL; cur = next)
+  {
+    GumCodePages * pages = cur->data;
+    guint n = pages->n_free_slices;
+
+    next = cur->next;
+
+    cur->prev = NULL;
+    cur->next = NULL;
+    pages->free_slices = NULL;
+    pages->n_free_slices = 0;
+
+    pages->ref_count -= n - 1;
+    gum_code_pages_unref (pages);
+  }
+
+  self->free_pages = NULL;
 }
 
 static GumCodeSlice *
@@ -245,6 +488,7 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
   gboolean rwx_supported, code_segment_supported;
   gsize page_size, size_in_pages, size_in_bytes;
   GumCodeSegment * segment;
+  GumCodeReservation * reservation;
   gpointer data;
   GumCodePages * pages;
   guint i;
@@ -264,9 +508,13 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
     protection = rwx_supported ? GUM_PAGE_RWX : GUM_PAGE_RW;
 
     segment = NULL;
+    reservation = NULL;
     if (spec != NULL)
     {
-      data = gum_try_alloc_n_pages_near (size_in_pages, protection, spec);
+      data = gum_code_allocator_try_take_reserved_batch (self, spec,
+          protection, &reservation);
+      if (data == NULL)
+        data = gum_try_alloc_n_pages_near (size_in_pages, protection, spec);
       if (data == NULL)
         return NULL;
     }
@@ -275,11 +523,15 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
       data = gum_alloc_n_pages (size_in_pages, protection);
     }
 
-    gum_query_page_allocation_range (data, size_in_bytes, &range);
-    gum_cloak_add_range (&range);
+    if (reservation == NULL)
+    {
+      gum_query_page_allocation_range (data, size_in_bytes, &range);
+      gum_cloak_add_range (&range);
+    }
   }
   else
   {
+    reservation = NULL;
     segment = gum_code_segment_new (size_in_bytes, spec);
     if (segment == NULL)
       return NULL;
@@ -294,6 +546,13 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
   pages->size = size_in_bytes;
 
   pages->allocator = self;
+  pages->reservation = reservation;
+
+  pages->link.data = pages;
+  pages->link.prev = NULL;
+  pages->link.next = NULL;
+  pages->free_slices = NULL;
+  pages->n_free_slices = 0;
 
   for (i = self->slices_per_batch; i != 0; i--)
   {
@@ -309,18 +568,11 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
     link = &element->parent;
     link->data = pages;
     link->prev = NULL;
+    link->next = NULL;
     if (slice_index == 0)
-    {
-      link->next = NULL;
       result = slice;
-    }
     else
-    {
-      if (self->free_slices != NULL)
-        self->free_slices->prev = link;
-      link->next = self->free_slices;
-      self->free_slices = link;
-    }
+      gum_code_pages_put_slice (pages, element);
   }
 
   if (!rwx_supported)
@@ -331,6 +583,69 @@ gum_code_allocator_try_alloc_batch_near (GumCodeAllocator * self,
   return result;
 }
 
+static GumCodeSlice *
+gum_code_pages_try_take_slice (GumCodePages * self,
+                               const GumAddressSpec * spec,
+                               gsize alignment)
+{
+  GumCodeAllocator * allocator = self->allocator;
+  gboolean check_each_slice = FALSE;
+  GList ** link;
+
+  if (spec != NULL && !gum_code_range_is_near (self->data, self->size, spec))
+  {
+    if (gum_code_range_is_out_of_reach (self->data, self->size, spec))
+      return NULL;
+    check_each_slice = TRUE;
+  }
+
+  for (link = &self->free_slices; *link != NULL; link = &(*link)->next)
+  {
+    GumCodeSliceElement * element = (GumCodeSliceElement *) *link;
+    GumCodeSlice * slice = &element->slice;
+
+    if (check_each_slice && !gum_code_slice_is_near (slice, spec))
+      continue;
+    if (!gum_code_slice_is_aligned (slice, alignment))
+      continue;
+
+    *link = element->parent.next;
+    element->parent.next = NULL;
+
+    self->n_free_slices--;
+    if (self->n_free_slices == 0)
+    {
+      allocator->free_pages =
+          g_list_remove_link (allocator->free_pages, &self->link);
+    }
+
+    g_hash_table_add (allocator->dirty_pages, self);
+
+    return slice;
+  }
+
+  return NULL;
+}
+
+static void
+gum_code_pages_put_slice (GumCodePages * self,
+                          GumCodeSliceElement * element)
+{
+  element->parent.next = self->free_slices;
+  self->free_slices = &element->parent;
+
+  if (self->n_free_slices++ == 0)
+  {
+    GumCodeAllocator * allocator = self->allocator;
+    GList * link = &self->link;
+
+    if (allocator->free_pages != NULL)
+      allocator->free_pages->prev = link;
+    link->next = allocator->free_pages;
+    allocator->free_pages = link;
+  }
+}
+
 static void
 gum_code_pages_unref (GumCodePages * self)
 {
@@ -341,6 +656,11 @@ gum_code_pages_unref (GumCodePages * self)
     {
       gum_code_segment_free (self->segment);
     }
+    else if (self->reservation != NULL)
+    {
+      gum_code_reservation_put_batch (self->reservation, self->data,
+          self->size);
+    }
     else
     {
       GumMemoryRange range;
@@ -368,15 +688,7 @@ gum_code_slice_free (GumCodeSlice * slice)
   pages = element->parent.data;
 
   if (gum_query_is_rwx_supported ())
-  {
-    GumCodeAllocator * allocator = pages->allocator;
-    GList * link = &element->parent;
-
-    if (allocator->free_slices != NULL)
-      allocator->free_slices->prev = link;
-    link->next = allocator->free_slices;
-    allocator->free_slices = link;
-  }
+    gum_code_pages_put_slice (pages, element);
   else
   {
     gum_code_pages_unref (pages);
@@ -387,25 +699,56 @@ static gboolean
 gum_code_slice_is_near (const GumCodeSlice * self,
                         const GumAddressSpec * spec)
 {
-  gssize near_address;
-  gssize slice_start, slice_end;
-  gsize distance_start, distance_end;
-
   if (spec == NULL)
     return TRUE;
 
+  return gum_code_range_is_near (self->data, self->size, spec);
+}
+
+static gboolean
+gum_code_range_is_near (gpointer data,
+                        gsize size,
+                        const GumAddressSpec * spec)
+{
+  gssize near_address;
+  gssize range_start, range_end;
+  gsize distance_start, distance_end;
+
   near_address = (gssize) spec->near_address;
 
-  slice_start = (gssize) self->data;
-  slice_end = slice_start + self->size - 1;
+  range_start = (gssize) data;
+  range_end = range_start + size - 1;
 
-  distance_start = ABS (near_address - slice_start);
-  distance_end = ABS (near_address - slice_end);
+  distance_start = ABS (near_address - range_start);
+  distance_end = ABS (near_address - range_end);
 
   return distance_start <= spec->max_distance &&
       distance_end <= spec->max_distance;
 }
 
+static gboolean
+gum_code_range_is_out_of_reach (gpointer data,
+                                gsize size,
+                                const GumAddressSpec * spec)
+{
+  gssize near_address;
+  gssize range_start, range_end;
+  gsize distance_start, distance_end;
+
+  near_address = (gssize) spec->near_address;
+
+  range_start = (gssize) data;
+  range_end = range_start + size - 1;
+
+  if (near_address >= range_start && near_address <= range_end)
+    return FALSE;
+
+  distance_start = ABS (near_address - range_start);
+  distance_end = ABS (near_address - range_end);
+
+  return MIN (distance_start, distance_end) > spec->max_distance;
+}
+
 static gboolean
 gum_code_slice_is_aligned (const GumCodeSlice * slice,
                            gsize alignment)
@@ -424,25 +767,11 @@ gum_code_allocator_alloc_deflector (GumCodeAllocator * self,
                                     gboolean dedicated)
 {
   GumCodeDeflectorDispatcher * dispatcher = NULL;
-  GSList * cur;
   GumCodeDeflectorImpl * impl;
   GumCodeDeflector * deflector;
 
   if (!dedicated)
-  {
-    for (cur = self->dispatchers; cur != NULL; cur = cur->next)
-    {
-      GumCodeDeflectorDispatcher * d = cur->data;
-      gsize distance;
-
-      distance = ABS ((gssize) d->address - (gssize) caller->near_address);
-      if (distance <= caller->max_distance)
-      {
-        dispatcher = d;
-        break;
-      }
-    }
-  }
+    dispatcher = gum_code_allocator_find_dispatcher_near (self, caller);
 
   if (dispatcher == NULL)
   {
@@ -450,7 +779,7 @@ gum_code_allocator_alloc_deflector (GumCodeAllocator * self,
         dedicated ? target : NULL);
     if (dispatcher == NULL)
       return NULL;
-    self->dispatchers = g_slist_prepend (self->dispatchers, dispatcher);
+    gum_code_allocator_add_dispatcher (self, dispatcher);
   }
 
   impl = g_slice_new (GumCodeDeflectorImpl);
@@ -461,47 +790,134 @@ gum_code_allocator_alloc_deflector (GumCodeAllocator * self,
   deflector->trampoline = dispatcher->trampoline;
 
   impl->allocator = self;
+  impl->dispatcher = dispatcher;
 
   dispatcher->callers = g_slist_prepend (dispatcher->callers, deflector);
+  if (dispatcher->targets != NULL)
+    g_hash_table_insert (dispatcher->targets, return_address, deflector);
 
   return deflector;
 }
 
+/*
+ * Dispatchers are kept sorted by address, so the shared ones within reach
+ * of a caller are found by a binary search followed by a walk outwards that
+ * stops as soon as the distance gets too large. Dedicated dispatchers jump
+ * straight to their single target and are never handed out again.
+ */
+static GumCodeDeflectorDispatcher *
+gum_code_allocator_find_dispatcher_near (GumCodeAllocator * self,
+                                         const GumAddressSpec * caller)
+{
+  GPtrArray * dispatchers = self->dispatchers;
+  GumAddress near_address = GUM_ADDRESS (caller->near_address);
+  guint start, i;
+
+  start = gum_code_allocator_find_dispatcher_index (self, near_address);
+
+  for (i = start; i != dispatchers->len; i++)
+  {
+    GumCodeDeflectorDispatcher * d = g_ptr_array_index (dispatchers, i);
+
+    if (d->address - near_address > caller->max_distance)
+      break;
+
+    if (d->targets != NULL)
+      return d;
+  }
+
+  for (i = start; i != 0; i--)
+  {
+    GumCodeDeflectorDispatcher * d = g_ptr_array_index (dispatchers, i - 1);
+
+    if (near_address - d->address > caller->max_distance)
+      break;
+
+    if (d->targets != NULL)
+      return d;
+  }
+
+  return NULL;
+}
+
+static void
+gum_code_allocator_add_dispatcher (GumCodeAllocator * self,
+                                   GumCodeDeflectorDispatcher * dispatcher)
+{
+  g_ptr_array_insert (self->dispatchers,
+      gum_code_allocator_find_dispatcher_index (self, dispatcher->address),
+      dispatcher);
+}
+
+static guint
+gum_code_allocator_find_dispatcher_index (GumCodeAllocator * self,
+                                          GumAddress address)
+{
+  GPtrArray * dispatchers = self->dispatchers;
+  guint lower, upper;
+
+  lower = 0;
+  upper = dispatchers->len;
+
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+    GumCodeDeflectorDispatcher * d = g_ptr_array_index (dispatchers, mid);
+
+    if (d->address < address)
+      lower = mid + 1;
+    else
+      upper = mid;
+  }
+
+  return lower;
+}
+
 void
 gum_code_deflector_free (GumCodeDeflector * deflector)
 {
   GumCodeDeflectorImpl * impl = (GumCodeDeflectorImpl *) deflector;
   GumCodeAllocator * allocator;
-  GSList * cur;
+  GumCodeDeflectorDispatcher * dispatcher;
 
   if (deflector == NULL)
     return;
 
   allocator = impl->allocator;
+  dispatcher = impl->dispatcher;
+
+  dispatcher->callers = g_slist_remove (dispatcher->callers, deflector);
 
-  for (cur = allocator->dispatchers; cur != NULL; cur = cur->next)
+  if (dispatcher->targets != NULL &&
+      g_hash_table_lookup (dispatcher->targets, deflector->return_address) ==
+      deflector)
   {
-    GumCodeDeflectorDispatcher * dispatcher = cur->data;
-    GSList * entry;
+    GSList * cur;
 
-    entry = g_slist_find (dispatcher->callers, deflector);
-    if (entry != NULL)
+    g_hash_table_remove (dispatcher->targets, deflector->return_address);
+
+    for (cur = dispatcher->callers; cur != NULL; cur = cur->next)
     {
-      g_slice_free (GumCodeDeflectorImpl, impl);
+      GumCodeDeflector * other = cur->data;
 
-      dispatcher->callers = g_slist_delete_link (dispatcher->callers, entry);
-      if (dispatcher->callers == NULL)
+      if (other->return_address == deflector->return_address)
       {
-        gum_code_deflector_dispatcher_free (dispatcher);
-        allocator->dispatchers = g_slist_remove (allocator->dispatchers,
-            dispatcher);
+        g_hash_table_insert (dispatcher->targets, other->return_address,
+            other);
+        break;
       }
-
-      return;
     }
   }
 
-  g_assert_not_reached ();
+  g_slice_free (GumCodeDeflectorImpl, impl);
+
+  if (dispatcher->callers == NULL)
+  {
+    g_ptr_array_remove_index (allocator->dispatchers,
+        gum_code_allocator_find_dispatcher_index (allocator,
+            dispatcher->address));
+    gum_code_deflector_dispatcher_free (dispatcher);
+  }
 }
 
 static GumCodeDeflectorDispatcher *
@@ -549,6 +965,8 @@ gum_code_deflector_dispatcher_new (const GumAddressSpec * caller,
     range.base_address = GUM_ADDRESS (dispatcher->thunk);
     range.size = thunk_size;
     gum_cloak_add_range (&range);
+
+    dispatcher->targets = g_hash_table_new (NULL, NULL);
   }
 
   insert_ctx.pc = dispatcher->address;
@@ -574,6 +992,8 @@ gum_code_deflector_dispatcher_new (const GumAddressSpec * caller,
 static void
 gum_code_deflector_dispatcher_free (GumCodeDeflectorDispatcher * dispatcher)
 {
+  GSList * cur;
+
   gum_memory_patch_code (dispatcher->address, dispatcher->original_size,
       (GumMemoryPatchApplyFunc) gum_remove_deflector, dispatcher);
 
@@ -590,7 +1010,11 @@ gum_code_deflector_dispatcher_free (GumCodeDeflectorDispatcher * dispatcher)
 
   g_free (dispatcher->original_data);
 
-  g_slist_foreach (dispatcher->callers, (GFunc) gum_code_deflector_free, NULL);
+  if (dispatcher->targets != NULL)
+    g_hash_table_unref (dispatcher->targets);
+
+  for (cur = dispatcher->callers; cur != NULL; cur = cur->next)
+    g_slice_free (GumCodeDeflectorImpl, cur->data);
   g_slist_free (dispatcher->callers);
 
   g_slice_free (GumCodeDeflectorDispatcher, dispatcher);
@@ -757,17 +1181,13 @@ static gpointer
 gum_code_deflector_dispatcher_lookup (GumCodeDeflectorDispatcher * self,
                                       gpointer return_address)
 {
-  GSList * cur;
-
-  for (cur = self->callers; cur != NULL; cur = cur->next)
-  {
-    GumCodeDeflector * caller = cur->data;
+  GumCodeDeflector * caller;
 
-    if (caller->return_address == return_address)
-      return caller->target;
-  }
+  caller = g_hash_table_lookup (self->targets, return_address);
+  if (caller == NULL)
+    return NULL;
 
-  return NULL;
+  return caller->target;
 }
 
 static gboolean
@@ -22,9 +22,11 @@ struct _GumCodeAllocator
 
   GSList * uncommitted_pages;
   GHashTable * dirty_pages;
-  GList * free_slices;
+  GList * free_pages;
 
-  GSList * dispatchers;
+  GPtrArray * dispatchers;
+
+  GSList * reservations;
 };
 
 struct _GumCodeSlice
@@ -47,6 +49,10 @@ GumCodeSlice * gum_code_allocator_alloc_slice (GumCodeAllocator * self);
 GumCodeSlice * gum_code_allocator_try_alloc_slice_near (GumCodeAllocator * self,
     const GumAddressSpec * spec, gsize alignment);
 void gum_code_allocator_commit (GumCodeAllocator * self);
+gboolean gum_code_allocator_reserve_near (GumCodeAllocator * self,
+    const GumAddressSpec * spec, gsize size);
+void gum_code_allocator_reserve_near_modules (GumCodeAllocator * self,
+    gsize min_module_size, gsize size, gsize max_distance);
 void gum_code_slice_free (GumCodeSlice * slice);
 
 GumCodeDeflector * gum_code_allocator_alloc_deflector (GumCodeAllocator * self,
@@ -0,0 +1,364 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumdeferredlistener.h"
+
+#include "guminterceptor.h"
+#include "gumtimestamp.h"
+
+#include <string.h>
+
+/*
+ * Calls are recorded on leave, as one GumDeferredInvocation each, into a ring
+ * owned by the calling thread. Each ring has exactly one producer and one
+ * consumer, so pushing a record is a couple of loads and a store. A worker
+ * thread periodically hands whatever has accumulated to the user's function,
+ * in batches taken straight out of the rings. When a ring is full the
+ * record is dropped rather than making the hooked thread wait.
+ *
+ * Timing is taken from the raw cycle counter, so the hooked thread only pays
+ * for a counter read, and the worker converts records to nanoseconds right
+ * before handing them over.
+ */
+
+#define GUM_DEFERRED_RING_CAPACITY 1024
+#define GUM_DEFERRED_FLUSH_INTERVAL (10 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct _GumDeferredRing GumDeferredRing;
+typedef struct _GumDeferredFrame GumDeferredFrame;
+
+struct _GumDeferredListener
+{
+  GObject parent;
+
+  guint n_args;
+  GumDeferredInvocationFunc func;
+  gpointer data;
+  GDestroyNotify data_destroy;
+
+  GMutex mutex;
+  GCond cond;
+  GPtrArray * rings;
+  gboolean stopping;
+  GThread * worker;
+
+  GMutex drain_mutex;
+  volatile gint dropped_count;
+};
+
+struct _GumDeferredRing
+{
+  volatile guint head;
+  volatile guint tail;
+  GumDeferredInvocation records[GUM_DEFERRED_RING_CAPACITY];
+};
+
+struct _GumDeferredFrame
+{
+  guint64 timestamp;
+  gpointer args[GUM_DEFERRED_MAX_ARGS];
+};
+
+static void gum_deferred_listener_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_deferred_listener_dispose (GObject * object);
+static void gum_deferred_listener_finalize (GObject * object);
+
+static void gum_deferred_listener_on_enter (GumInvocationListener * listener,
+    GumInvocationContext * context);
+static void gum_deferred_listener_on_leave (GumInvocationListener * listener,
+    GumInvocationContext * context);
+
+static GumDeferredRing * gum_deferred_listener_get_ring (
+    GumDeferredListener * self, GumInvocationContext * context);
+static gpointer gum_deferred_listener_process (gpointer data);
+static void gum_deferred_listener_drain_ring (GumDeferredListener * self,
+    GumDeferredRing * ring);
+
+G_DEFINE_TYPE_EXTENDED (GumDeferredListener,
+                        gum_deferred_listener,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_INVOCATION_LISTENER,
+                            gum_deferred_listener_iface_init))
+
+static void
+gum_deferred_listener_class_init (GumDeferredListenerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_deferred_listener_dispose;
+  object_class->finalize = gum_deferred_listener_finalize;
+}
+
+static void
+gum_deferred_listener_iface_init (gpointer g_iface,
+                                  gpointer iface_data)
+{
+  GumInvocationListenerInterface * iface = g_iface;
+
+  iface->on_enter = gum_deferred_listener_on_enter;
+  iface->on_leave = gum_deferred_listener_on_leave;
+}
+
+static void
+gum_deferred_listener_init (GumDeferredListener * self)
+{
+  g_mutex_init (&self->mutex);
+  g_cond_init (&self->cond);
+  self->rings = g_ptr_array_new_with_free_func (g_free);
+
+  g_mutex_init (&self->drain_mutex);
+}
+
+static void
+gum_deferred_listener_dispose (GObject * object)
+{
+  GumDeferredListener * self = GUM_DEFERRED_LISTENER (object);
+
+  if (self->worker != NULL)
+  {
+    g_mutex_lock (&self->mutex);
+    self->stopping = TRUE;
+    g_cond_signal (&self->cond);
+    g_mutex_unlock (&self->mutex);
+
+    g_thread_join (self->worker);
+    self->worker = NULL;
+
+    gum_deferred_listener_flush (self);
+  }
+
+  if (self->data_destroy != NULL)
+    self->data_destroy (self->data);
+
+  self->func = NULL;
+  self->data = NULL;
+  self->data_destroy = NULL;
+
+  G_OBJECT_CLASS (gum_deferred_listener_parent_class)->dispose (object);
+}
+
+static void
+gum_deferred_listener_finalize (GObject * object)
+{
+  GumDeferredListener * self = GUM_DEFERRED_LISTENER (object);
+
+  g_mutex_clear (&self->drain_mutex);
+
+  g_ptr_array_unref (self->rings);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (gum_deferred_listener_parent_class)->finalize (object);
+}
+
+/*
+ * Creates a listener that records the first `n_args` arguments, the return
+ * value, and when and for how long each call ran, then passes the records
+ * to `func` on a worker thread. The listener must be detached before the
+ * last reference is dropped.
+ */
+GumDeferredListener *
+gum_deferred_listener_new (guint n_args,
+                           GumDeferredInvocationFunc func,
+                           gpointer data,
+                           GDestroyNotify data_destroy)
+{
+  GumDeferredListener * listener;
+
+  g_return_val_if_fail (n_args <= GUM_DEFERRED_MAX_ARGS, NULL);
+
+  listener = g_object_new (GUM_TYPE_DEFERRED_LISTENER, NULL);
+  listener->n_args = n_args;
+  listener->func = func;
+  listener->data = data;
+  listener->data_destroy = data_destroy;
+
+  listener->worker = g_thread_new ("gum-deferred-listener",
+      gum_deferred_listener_process, listener);
+
+  return listener;
+}
+
+/*
+ * Hands every record captured so far to the user's function before
+ * returning. It runs on the calling thread, serialized with the worker.
+ */
+void
+gum_deferred_listener_flush (GumDeferredListener * self)
+{
+  GumDeferredRing ** rings;
+  guint n_rings, i;
+
+  g_mutex_lock (&self->mutex);
+  n_rings = self->rings->len;
+  rings = g_memdup (self->rings->pdata, n_rings * sizeof (GumDeferredRing *));
+  g_mutex_unlock (&self->mutex);
+
+  g_mutex_lock (&self->drain_mutex);
+  for (i = 0; i != n_rings; i++)
+    gum_deferred_listener_drain_ring (self, rings[i]);
+  g_mutex_unlock (&self->drain_mutex);
+
+  g_free (rings);
+}
+
+guint
+gum_deferred_listener_get_dropped_count (GumDeferredListener * self)
+{
+  return g_atomic_int_get (&self->dropped_count);
+}
+
+static void
+gum_deferred_listener_on_enter (GumInvocationListener * listener,
+                                GumInvocationContext * context)
+{
+  GumDeferredListener * self = GUM_DEFERRED_LISTENER (listener);
+  GumDeferredFrame * frame;
+  guint i;
+
+  frame = GUM_LINCTX_GET_FUNC_INVDATA (context, GumDeferredFrame);
+
+  for (i = 0; i != self->n_args; i++)
+    frame->args[i] = gum_invocation_context_get_nth_argument (context, i);
+
+  frame->timestamp = gum_timestamp_now ();
+}
+
+static void
+gum_deferred_listener_on_leave (GumInvocationListener * listener,
+                                GumInvocationContext * context)
+{
+  GumDeferredListener * self = GUM_DEFERRED_LISTENER (listener);
+  guint64 now;
+  GumDeferredFrame * frame;
+  GumDeferredRing * ring;
+  guint head;
+  GumDeferredInvocation * invocation;
+
+  now = gum_timestamp_now ();
+
+  frame = GUM_LINCTX_GET_FUNC_INVDATA (context, GumDeferredFrame);
+
+  ring = gum_deferred_listener_get_ring (self, context);
+  if (ring == NULL)
+    return;
+
+  head = ring->head;
+  if (head - g_atomic_int_get (&ring->tail) == GUM_DEFERRED_RING_CAPACITY)
+  {
+    g_atomic_int_inc (&self->dropped_count);
+    return;
+  }
+
+  invocation = &ring->records[head % GUM_DEFERRED_RING_CAPACITY];
+  invocation->function = GUM_FUNCPTR_TO_POINTER (context->function);
+  invocation->function_data =
+      gum_invocation_context_get_listener_function_data (context);
+  invocation->thread_id = gum_invocation_context_get_thread_id (context);
+  invocation->depth = gum_invocation_context_get_depth (context);
+  invocation->timestamp = frame->timestamp;
+  invocation->duration = now - frame->timestamp;
+  memcpy (invocation->args, frame->args, self->n_args * sizeof (gpointer));
+  invocation->return_value = gum_invocation_context_get_return_value (context);
+
+  g_atomic_int_set (&ring->head, head + 1);
+}
+
+static GumDeferredRing *
+gum_deferred_listener_get_ring (GumDeferredListener * self,
+                                GumInvocationContext * context)
+{
+  GumDeferredRing ** slot;
+
+  slot = GUM_LINCTX_GET_THREAD_DATA (context, GumDeferredRing *);
+  if (slot == NULL)
+    return NULL;
+
+  if (*slot == NULL)
+  {
+    GumDeferredRing * ring;
+
+    ring = g_new0 (GumDeferredRing, 1);
+
+    g_mutex_lock (&self->mutex);
+    g_ptr_array_add (self->rings, ring);
+    g_mutex_unlock (&self->mutex);
+
+    *slot = ring;
+  }
+
+  return *slot;
+}
+
+static gpointer
+gum_deferred_listener_process (gpointer data)
+{
+  GumDeferredListener * self = data;
+  GumInterceptor * interceptor;
+
+  interceptor = gum_interceptor_obtain ();
+  gum_interceptor_ignore_current_thread (interceptor);
+
+  g_mutex_lock (&self->mutex);
+  while (!self->stopping)
+  {
+    g_mutex_unlock (&self->mutex);
+    gum_deferred_listener_flush (self);
+    g_mutex_lock (&self->mutex);
+
+    if (!self->stopping)
+    {
+      g_cond_wait_until (&self->cond, &self->mutex,
+          g_get_monotonic_time () + GUM_DEFERRED_FLUSH_INTERVAL);
+    }
+  }
+  g_mutex_unlock (&self->mutex);
+
+  gum_interceptor_unignore_current_thread (interceptor);
+  g_object_unref (interceptor);
+
+  return NULL;
+}
+
+static void
+gum_deferred_listener_drain_ring (GumDeferredListener * self,
+                                  GumDeferredRing * ring)
+{
+  guint tail, head;
+
+  tail = ring->tail;
+  head = g_atomic_int_get (&ring->head);
+
+  while (tail != head)
+  {
+    guint offset, n;
+
+    offset = tail % GUM_DEFERRED_RING_CAPACITY;
+    n = MIN (head - tail, GUM_DEFERRED_RING_CAPACITY - offset);
+
+    if (self->func != NULL)
+    {
+      guint i;
+
+      for (i = 0; i != n; i++)
+      {
+        GumDeferredInvocation * invocation = &ring->records[offset + i];
+
+        invocation->timestamp =
+            gum_timestamp_to_nanoseconds (invocation->timestamp);
+        invocation->duration =
+            gum_timestamp_to_nanoseconds (invocation->duration);
+      }
+
+      self->func (&ring->records[offset], n, self->data);
+    }
+
+    tail += n;
+    g_atomic_int_set (&ring->tail, tail);
+  }
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_DEFERRED_LISTENER_H__
+#define __GUM_DEFERRED_LISTENER_H__
+
+#include <glib-object.h>
+#include <gum/guminvocationlistener.h>
+
+#define GUM_DEFERRED_MAX_ARGS 8
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_DEFERRED_LISTENER (gum_deferred_listener_get_type ())
+G_DECLARE_FINAL_TYPE (GumDeferredListener, gum_deferred_listener, GUM,
+    DEFERRED_LISTENER, GObject)
+
+typedef struct _GumDeferredInvocation GumDeferredInvocation;
+
+typedef void (* GumDeferredInvocationFunc) (
+    const GumDeferredInvocation * invocations, guint n_invocations,
+    gpointer user_data);
+
+struct _GumDeferredInvocation
+{
+  gpointer function;
+  gpointer function_data;
+  GumThreadId thread_id;
+  guint depth;
+
+  gint64 timestamp;
+  gint64 duration;
+
+  gpointer args[GUM_DEFERRED_MAX_ARGS];
+  gpointer return_value;
+};
+
+GUM_API GumDeferredListener * gum_deferred_listener_new (guint n_args,
+    GumDeferredInvocationFunc func, gpointer data,
+    GDestroyNotify data_destroy);
+
+GUM_API void gum_deferred_listener_flush (GumDeferredListener * self);
+GUM_API guint gum_deferred_listener_get_dropped_count (
+    GumDeferredListener * self);
+
+G_END_DECLS
+
+#endif
@@ -45,6 +45,8 @@ struct _GumCallEvent
   gpointer location;
   gpointer target;
   gint depth;
+
+  guint64 timestamp;
 };
 
 struct _GumRetEvent
@@ -54,6 +56,8 @@ struct _GumRetEvent
   gpointer location;
   gpointer target;
   gint depth;
+
+  guint64 timestamp;
 };
 
 struct _GumExecEvent
@@ -61,6 +65,8 @@ struct _GumExecEvent
   GumEventType type;
 
   gpointer location;
+
+  guint64 timestamp;
 };
 
 struct _GumBlockEvent
@@ -69,6 +75,8 @@ struct _GumBlockEvent
 
   gpointer begin;
   gpointer end;
+
+  guint64 timestamp;
 };
 
 struct _GumCompileEvent
@@ -77,6 +85,8 @@ struct _GumCompileEvent
 
   gpointer begin;
   gpointer end;
+
+  guint64 timestamp;
 };
 
 union _GumEvent
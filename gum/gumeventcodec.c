@@ -0,0 +1,599 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumeventcodec.h"
+
+#include "gumleb.h"
+
+#include <gio/gio.h>
+
+/*
+ * Each record starts with a GumEventRecordType byte, followed by LEB128
+ * encoded fields. Addresses are stored as signed deltas against the address
+ * where execution was last known to be, so a trace does not depend on where
+ * modules were loaded, and hot code ends up as one or two bytes per address.
+ * Blocks are assigned an ID the first time they are seen, and referred to by
+ * that ID from then on. Events that carry a timestamp have the high bit of
+ * the type byte set, and the timestamp follows it as a signed delta against
+ * the previous one, so traces without timestamps pay nothing for them.
+ */
+
+typedef guint GumEventRecordType;
+typedef struct _GumEventCodecBlock GumEventCodecBlock;
+
+enum _GumEventRecordType
+{
+  GUM_EVENT_RECORD_CALL,
+  GUM_EVENT_RECORD_RET,
+  GUM_EVENT_RECORD_EXEC,
+  GUM_EVENT_RECORD_BLOCK_DEFINE,
+  GUM_EVENT_RECORD_BLOCK_REF,
+  GUM_EVENT_RECORD_COMPILE
+};
+
+#define GUM_EVENT_RECORD_TIMESTAMPED 0x80
+
+struct _GumEventCodecBlock
+{
+  gpointer begin;
+  gpointer end;
+};
+
+struct _GumEventEncoder
+{
+  GByteArray * buffer;
+  GumAddress previous_address;
+  guint64 previous_timestamp;
+  GHashTable * block_ids;
+  GArray * blocks;
+};
+
+struct _GumEventDecoder
+{
+  GumAddress previous_address;
+  guint64 previous_timestamp;
+  GArray * blocks;
+};
+
+static void gum_event_encoder_encode_block (GumEventEncoder * self,
+    GumEventRecordType type, gpointer begin, gpointer end, guint64 timestamp);
+static void gum_event_encoder_put_type (GumEventEncoder * self,
+    GumEventRecordType type, guint64 timestamp);
+static void gum_event_encoder_put_address (GumEventEncoder * self,
+    gpointer address);
+static void gum_event_encoder_put_target (GumEventEncoder * self,
+    gpointer location, gpointer target);
+
+static gboolean gum_event_decoder_define_block (GumEventDecoder * self,
+    GumEvent * ev, GumEventType type, const guint8 ** data,
+    const guint8 * end);
+static gboolean gum_event_decoder_read_address (GumEventDecoder * self,
+    const guint8 ** data, const guint8 * end, gpointer * address);
+static gboolean gum_event_decoder_read_target (GumEventDecoder * self,
+    gpointer location, const guint8 ** data, const guint8 * end,
+    gpointer * target);
+static gboolean gum_try_read_sleb128 (const guint8 ** data,
+    const guint8 * end, gint64 * value);
+static gboolean gum_try_read_uleb128 (const guint8 ** data,
+    const guint8 * end, guint64 * value);
+static gboolean gum_has_complete_leb128 (const guint8 * data,
+    const guint8 * end);
+
+static guint64 gum_event_get_timestamp (const GumEvent * ev);
+static void gum_event_set_timestamp (GumEvent * ev, guint64 timestamp);
+
+GumEventEncoder *
+gum_event_encoder_new (void)
+{
+  GumEventEncoder * encoder;
+
+  encoder = g_slice_new (GumEventEncoder);
+
+  encoder->buffer = g_byte_array_new ();
+  encoder->previous_address = 0;
+  encoder->previous_timestamp = 0;
+  encoder->block_ids = g_hash_table_new (NULL, NULL);
+  encoder->blocks = g_array_new (FALSE, FALSE, sizeof (GumEventCodecBlock));
+
+  return encoder;
+}
+
+void
+gum_event_encoder_free (GumEventEncoder * encoder)
+{
+  g_array_free (encoder->blocks, TRUE);
+  g_hash_table_unref (encoder->block_ids);
+  g_byte_array_unref (encoder->buffer);
+
+  g_slice_free (GumEventEncoder, encoder);
+}
+
+void
+gum_event_encoder_encode (GumEventEncoder * self,
+                          const GumEvent * ev)
+{
+  guint64 timestamp;
+
+  timestamp = gum_event_get_timestamp (ev);
+
+  switch (ev->type)
+  {
+    case GUM_CALL:
+    {
+      const GumCallEvent * call = &ev->call;
+
+      gum_event_encoder_put_type (self, GUM_EVENT_RECORD_CALL, timestamp);
+      gum_event_encoder_put_address (self, call->location);
+      gum_event_encoder_put_target (self, call->location, call->target);
+      gum_write_sleb128 (self->buffer, call->depth);
+
+      break;
+    }
+    case GUM_RET:
+    {
+      const GumRetEvent * ret = &ev->ret;
+
+      gum_event_encoder_put_type (self, GUM_EVENT_RECORD_RET, timestamp);
+      gum_event_encoder_put_address (self, ret->location);
+      gum_event_encoder_put_target (self, ret->location, ret->target);
+      gum_write_sleb128 (self->buffer, ret->depth);
+
+      break;
+    }
+    case GUM_EXEC:
+    {
+      gum_event_encoder_put_type (self, GUM_EVENT_RECORD_EXEC, timestamp);
+      gum_event_encoder_put_address (self, ev->exec.location);
+
+      break;
+    }
+    case GUM_BLOCK:
+    {
+      gum_event_encoder_encode_block (self, GUM_EVENT_RECORD_BLOCK_DEFINE,
+          ev->block.begin, ev->block.end, timestamp);
+
+      break;
+    }
+    case GUM_COMPILE:
+    {
+      gum_event_encoder_encode_block (self, GUM_EVENT_RECORD_COMPILE,
+          ev->compile.begin, ev->compile.end, timestamp);
+
+      break;
+    }
+    default:
+      g_assert_not_reached ();
+  }
+}
+
+static void
+gum_event_encoder_encode_block (GumEventEncoder * self,
+                                GumEventRecordType type,
+                                gpointer begin,
+                                gpointer end,
+                                guint64 timestamp)
+{
+  gpointer id_value;
+  guint id;
+  GumEventCodecBlock * block;
+
+  if (type == GUM_EVENT_RECORD_BLOCK_DEFINE &&
+      g_hash_table_lookup_extended (self->block_ids, begin, NULL, &id_value))
+  {
+    id = GPOINTER_TO_UINT (id_value);
+    block = &g_array_index (self->blocks, GumEventCodecBlock, id);
+
+    if (block->end == end)
+    {
+      gum_event_encoder_put_type (self, GUM_EVENT_RECORD_BLOCK_REF,
+          timestamp);
+      gum_write_uleb128 (self->buffer, id);
+      self->previous_address = GUM_ADDRESS (end);
+
+      return;
+    }
+  }
+
+  id = self->blocks->len;
+  g_array_set_size (self->blocks, id + 1);
+  block = &g_array_index (self->blocks, GumEventCodecBlock, id);
+  block->begin = begin;
+  block->end = end;
+  g_hash_table_insert (self->block_ids, begin, GUINT_TO_POINTER (id));
+
+  gum_event_encoder_put_type (self, type, timestamp);
+  gum_event_encoder_put_address (self, begin);
+  gum_write_uleb128 (self->buffer, GUM_ADDRESS (end) - GUM_ADDRESS (begin));
+  self->previous_address = GUM_ADDRESS (end);
+}
+
+gsize
+gum_event_encoder_get_pending_size (GumEventEncoder * self)
+{
+  return self->buffer->len;
+}
+
+/*
+ * Returns everything encoded since the previous flush. Chunks carry state
+ * over, so they must be handed to a single decoder in the order they were
+ * flushed.
+ */
+GBytes *
+gum_event_encoder_flush (GumEventEncoder * self)
+{
+  GBytes * chunk;
+
+  chunk = g_byte_array_free_to_bytes (self->buffer);
+  self->buffer = g_byte_array_new ();
+
+  return chunk;
+}
+
+static void
+gum_event_encoder_put_type (GumEventEncoder * self,
+                            GumEventRecordType type,
+                            guint64 timestamp)
+{
+  guint8 value = type;
+
+  if (timestamp != 0)
+    value |= GUM_EVENT_RECORD_TIMESTAMPED;
+
+  g_byte_array_append (self->buffer, &value, sizeof (value));
+
+  if (timestamp != 0)
+  {
+    gum_write_sleb128 (self->buffer,
+        (gint64) (timestamp - self->previous_timestamp));
+    self->previous_timestamp = timestamp;
+  }
+}
+
+static void
+gum_event_encoder_put_address (GumEventEncoder * self,
+                               gpointer address)
+{
+  gum_write_sleb128 (self->buffer,
+      (gint64) (GUM_ADDRESS (address) - self->previous_address));
+  self->previous_address = GUM_ADDRESS (address);
+}
+
+static void
+gum_event_encoder_put_target (GumEventEncoder * self,
+                              gpointer location,
+                              gpointer target)
+{
+  gum_write_sleb128 (self->buffer,
+      (gint64) (GUM_ADDRESS (target) - GUM_ADDRESS (location)));
+  self->previous_address = GUM_ADDRESS (target);
+}
+
+GumEventDecoder *
+gum_event_decoder_new (void)
+{
+  GumEventDecoder * decoder;
+
+  decoder = g_slice_new (GumEventDecoder);
+
+  decoder->previous_address = 0;
+  decoder->previous_timestamp = 0;
+  decoder->blocks = g_array_new (FALSE, FALSE, sizeof (GumEventCodecBlock));
+
+  return decoder;
+}
+
+void
+gum_event_decoder_free (GumEventDecoder * decoder)
+{
+  g_array_free (decoder->blocks, TRUE);
+
+  g_slice_free (GumEventDecoder, decoder);
+}
+
+/*
+ * Appends the GumEvent records found in `chunk` to `events`. The chunk must
+ * come from gum_event_encoder_flush(). Returns FALSE if it is truncated or
+ * otherwise malformed, in which case `events` is left as it was, and the
+ * decoder should not be fed any further chunks.
+ */
+gboolean
+gum_event_decoder_decode (GumEventDecoder * self,
+                          GBytes * chunk,
+                          GArray * events,
+                          GError ** error)
+{
+  const guint8 * data, * end;
+  gsize size;
+  guint original_length;
+  GumEventRecordType type;
+  guint64 id;
+
+  data = g_bytes_get_data (chunk, &size);
+  end = data + size;
+
+  original_length = events->len;
+
+  while (data != end)
+  {
+    GumEvent ev;
+    guint64 timestamp = 0;
+    gint64 delta;
+
+    type = *data++;
+    if ((type & GUM_EVENT_RECORD_TIMESTAMPED) != 0)
+    {
+      type &= ~GUM_EVENT_RECORD_TIMESTAMPED;
+      if (!gum_try_read_sleb128 (&data, end, &delta))
+        goto truncated;
+      self->previous_timestamp += delta;
+      timestamp = self->previous_timestamp;
+    }
+
+    switch (type)
+    {
+      case GUM_EVENT_RECORD_CALL:
+      {
+        GumCallEvent * call = &ev.call;
+
+        ev.type = GUM_CALL;
+        if (!gum_event_decoder_read_address (self, &data, end,
+            &call->location))
+          goto truncated;
+        if (!gum_event_decoder_read_target (self, call->location, &data, end,
+            &call->target))
+          goto truncated;
+        if (!gum_try_read_sleb128 (&data, end, &delta))
+          goto truncated;
+        call->depth = delta;
+
+        break;
+      }
+      case GUM_EVENT_RECORD_RET:
+      {
+        GumRetEvent * ret = &ev.ret;
+
+        ev.type = GUM_RET;
+        if (!gum_event_decoder_read_address (self, &data, end,
+            &ret->location))
+          goto truncated;
+        if (!gum_event_decoder_read_target (self, ret->location, &data, end,
+            &ret->target))
+          goto truncated;
+        if (!gum_try_read_sleb128 (&data, end, &delta))
+          goto truncated;
+        ret->depth = delta;
+
+        break;
+      }
+      case GUM_EVENT_RECORD_EXEC:
+      {
+        ev.type = GUM_EXEC;
+        if (!gum_event_decoder_read_address (self, &data, end,
+            &ev.exec.location))
+          goto truncated;
+
+        break;
+      }
+      case GUM_EVENT_RECORD_BLOCK_DEFINE:
+      {
+        if (!gum_event_decoder_define_block (self, &ev, GUM_BLOCK, &data, end))
+          goto truncated;
+
+        break;
+      }
+      case GUM_EVENT_RECORD_BLOCK_REF:
+      {
+        GumEventCodecBlock * block;
+
+        if (!gum_try_read_uleb128 (&data, end, &id))
+          goto truncated;
+        if (id >= self->blocks->len)
+          goto invalid_block_id;
+        block = &g_array_index (self->blocks, GumEventCodecBlock, id);
+
+        ev.type = GUM_BLOCK;
+        ev.block.begin = block->begin;
+        ev.block.end = block->end;
+        self->previous_address = GUM_ADDRESS (block->end);
+
+        break;
+      }
+      case GUM_EVENT_RECORD_COMPILE:
+      {
+        if (!gum_event_decoder_define_block (self, &ev, GUM_COMPILE, &data,
+            end))
+          goto truncated;
+
+        break;
+      }
+      default:
+        goto invalid_type;
+    }
+
+    gum_event_set_timestamp (&ev, timestamp);
+
+    g_array_append_val (events, ev);
+  }
+
+  return TRUE;
+
+truncated:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "truncated event record");
+    goto propagate_error;
+  }
+invalid_type:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "unknown event record type: %u", type);
+    goto propagate_error;
+  }
+invalid_block_id:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+        "reference to undefined block: %" G_GUINT64_FORMAT, id);
+    goto propagate_error;
+  }
+propagate_error:
+  {
+    g_array_set_size (events, original_length);
+
+    return FALSE;
+  }
+}
+
+static gboolean
+gum_event_decoder_define_block (GumEventDecoder * self,
+                                GumEvent * ev,
+                                GumEventType type,
+                                const guint8 ** data,
+                                const guint8 * end)
+{
+  GumEventCodecBlock block;
+  guint64 size;
+
+  if (!gum_event_decoder_read_address (self, data, end, &block.begin))
+    return FALSE;
+  if (!gum_try_read_uleb128 (data, end, &size))
+    return FALSE;
+  block.end = GSIZE_TO_POINTER (GUM_ADDRESS (block.begin) + size);
+  g_array_append_val (self->blocks, block);
+  self->previous_address = GUM_ADDRESS (block.end);
+
+  ev->type = type;
+  ev->block.begin = block.begin;
+  ev->block.end = block.end;
+
+  return TRUE;
+}
+
+static gboolean
+gum_event_decoder_read_address (GumEventDecoder * self,
+                                const guint8 ** data,
+                                const guint8 * end,
+                                gpointer * address)
+{
+  gint64 delta;
+
+  if (!gum_try_read_sleb128 (data, end, &delta))
+    return FALSE;
+
+  self->previous_address += delta;
+  *address = GSIZE_TO_POINTER (self->previous_address);
+
+  return TRUE;
+}
+
+static gboolean
+gum_event_decoder_read_target (GumEventDecoder * self,
+                               gpointer location,
+                               const guint8 ** data,
+                               const guint8 * end,
+                               gpointer * target)
+{
+  gint64 delta;
+
+  if (!gum_try_read_sleb128 (data, end, &delta))
+    return FALSE;
+
+  self->previous_address = GUM_ADDRESS (location) + delta;
+  *target = GSIZE_TO_POINTER (self->previous_address);
+
+  return TRUE;
+}
+
+static gboolean
+gum_try_read_sleb128 (const guint8 ** data,
+                      const guint8 * end,
+                      gint64 * value)
+{
+  if (!gum_has_complete_leb128 (*data, end))
+    return FALSE;
+
+  *value = gum_read_sleb128 (data, end);
+
+  return TRUE;
+}
+
+static gboolean
+gum_try_read_uleb128 (const guint8 ** data,
+                      const guint8 * end,
+                      guint64 * value)
+{
+  if (!gum_has_complete_leb128 (*data, end))
+    return FALSE;
+
+  *value = gum_read_uleb128 (data, end);
+
+  return TRUE;
+}
+
+/*
+ * The readers in gumleb.c assert on malformed input, which is fine for the
+ * images they were written for, but not for chunks that may have come from
+ * anywhere. A 64-bit value takes at most ten bytes.
+ */
+static gboolean
+gum_has_complete_leb128 (const guint8 * data,
+                         const guint8 * end)
+{
+  const guint8 * p;
+
+  for (p = data; p != end && p != data + 10; p++)
+  {
+    if ((*p & 0x80) == 0)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static guint64
+gum_event_get_timestamp (const GumEvent * ev)
+{
+  switch (ev->type)
+  {
+    case GUM_CALL:
+      return ev->call.timestamp;
+    case GUM_RET:
+      return ev->ret.timestamp;
+    case GUM_EXEC:
+      return ev->exec.timestamp;
+    case GUM_BLOCK:
+      return ev->block.timestamp;
+    case GUM_COMPILE:
+      return ev->compile.timestamp;
+    default:
+      return 0;
+  }
+}
+
+static void
+gum_event_set_timestamp (GumEvent * ev,
+                         guint64 timestamp)
+{
+  switch (ev->type)
+  {
+    case GUM_CALL:
+      ev->call.timestamp = timestamp;
+      break;
+    case GUM_RET:
+      ev->ret.timestamp = timestamp;
+      break;
+    case GUM_EXEC:
+      ev->exec.timestamp = timestamp;
+      break;
+    case GUM_BLOCK:
+      ev->block.timestamp = timestamp;
+      break;
+    case GUM_COMPILE:
+      ev->compile.timestamp = timestamp;
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
@@ -0,0 +1,34 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_EVENT_CODEC_H__
+#define __GUM_EVENT_CODEC_H__
+
+#include <gum/gumdefs.h>
+#include <gum/gumevent.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GumEventEncoder GumEventEncoder;
+typedef struct _GumEventDecoder GumEventDecoder;
+
+GUM_API GumEventEncoder * gum_event_encoder_new (void);
+GUM_API void gum_event_encoder_free (GumEventEncoder * encoder);
+
+GUM_API void gum_event_encoder_encode (GumEventEncoder * self,
+    const GumEvent * ev);
+GUM_API gsize gum_event_encoder_get_pending_size (GumEventEncoder * self);
+GUM_API GBytes * gum_event_encoder_flush (GumEventEncoder * self);
+
+GUM_API GumEventDecoder * gum_event_decoder_new (void);
+GUM_API void gum_event_decoder_free (GumEventDecoder * decoder);
+
+GUM_API gboolean gum_event_decoder_decode (GumEventDecoder * self,
+    GBytes * chunk, GArray * events, GError ** error);
+
+G_END_DECLS
+
+#endif
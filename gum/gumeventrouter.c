@@ -0,0 +1,420 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumeventrouter.h"
+
+#include "gumprocess.h"
+
+#include <string.h>
+
+/*
+ * The router is the one sink a Stalker session writes to, and hands each
+ * event to every route whose filter it passes. Routes narrow the types
+ * their sink asked for, and the union of what remains is the mask the
+ * Stalker sees, so types no route wants are never generated at all.
+ *
+ * It also answers gum_event_sink_query_location_mask(), which lets the
+ * Stalker leave out the code for exec, call and ret events whose
+ * instruction no route's location filter covers. That decision is made
+ * once per compiled block, so routes added while following only get the
+ * kinds of events that were already being generated.
+ */
+
+typedef struct _GumEventRoute GumEventRoute;
+typedef struct _GumFindModuleContext GumFindModuleContext;
+
+struct _GumEventRouter
+{
+  GObject parent;
+
+  GRWLock lock;
+  GArray * routes;
+  guint next_route_id;
+  gboolean started;
+};
+
+struct _GumEventRoute
+{
+  guint id;
+  GumEventSink * sink;
+  GumEventFilter filter;
+};
+
+struct _GumFindModuleContext
+{
+  const gchar * name;
+  GumMemoryRange * range;
+  gboolean found;
+};
+
+static void gum_event_router_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_event_router_dispose (GObject * object);
+static void gum_event_router_finalize (GObject * object);
+
+static GumEventType gum_event_router_query_mask (GumEventSink * sink);
+static GumEventType gum_event_router_query_location_mask (GumEventSink * sink,
+    gconstpointer location);
+static void gum_event_router_start (GumEventSink * sink);
+static void gum_event_router_process (GumEventSink * sink,
+    const GumEvent * ev);
+static void gum_event_router_flush (GumEventSink * sink);
+static void gum_event_router_stop (GumEventSink * sink);
+
+static gboolean gum_event_filter_find_module_range (const gchar * module_name,
+    GumMemoryRange * range);
+static gboolean gum_event_filter_collect_module_range (
+    const GumModuleDetails * details, gpointer user_data);
+
+G_DEFINE_TYPE_EXTENDED (GumEventRouter,
+                        gum_event_router,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_EVENT_SINK,
+                            gum_event_router_iface_init))
+
+static void
+gum_event_router_class_init (GumEventRouterClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_event_router_dispose;
+  object_class->finalize = gum_event_router_finalize;
+}
+
+static void
+gum_event_router_iface_init (gpointer g_iface,
+                             gpointer iface_data)
+{
+  GumEventSinkInterface * iface = g_iface;
+
+  iface->query_mask = gum_event_router_query_mask;
+  iface->query_location_mask = gum_event_router_query_location_mask;
+  iface->start = gum_event_router_start;
+  iface->process = gum_event_router_process;
+  iface->flush = gum_event_router_flush;
+  iface->stop = gum_event_router_stop;
+}
+
+static void
+gum_event_router_init (GumEventRouter * self)
+{
+  g_rw_lock_init (&self->lock);
+  self->routes = g_array_new (FALSE, FALSE, sizeof (GumEventRoute));
+  self->next_route_id = 1;
+}
+
+static void
+gum_event_router_dispose (GObject * object)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (object);
+  guint i;
+
+  for (i = 0; i != self->routes->len; i++)
+  {
+    GumEventRoute * route = &g_array_index (self->routes, GumEventRoute, i);
+
+    g_object_unref (route->sink);
+  }
+  g_array_set_size (self->routes, 0);
+
+  G_OBJECT_CLASS (gum_event_router_parent_class)->dispose (object);
+}
+
+static void
+gum_event_router_finalize (GObject * object)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (object);
+
+  g_array_free (self->routes, TRUE);
+  g_rw_lock_clear (&self->lock);
+
+  G_OBJECT_CLASS (gum_event_router_parent_class)->finalize (object);
+}
+
+GumEventRouter *
+gum_event_router_new (void)
+{
+  return g_object_new (GUM_TYPE_EVENT_ROUTER, NULL);
+}
+
+guint
+gum_event_router_add_route (GumEventRouter * self,
+                            GumEventSink * sink,
+                            const GumEventFilter * filter)
+{
+  GumEventRoute route;
+
+  route.sink = g_object_ref (sink);
+  if (filter != NULL)
+    route.filter = *filter;
+  else
+    gum_event_filter_init (&route.filter, ~GUM_NOTHING);
+  route.filter.types &= gum_event_sink_query_mask (sink);
+
+  g_rw_lock_writer_lock (&self->lock);
+
+  route.id = self->next_route_id++;
+  g_array_append_val (self->routes, route);
+
+  if (self->started)
+    gum_event_sink_start (sink);
+
+  g_rw_lock_writer_unlock (&self->lock);
+
+  return route.id;
+}
+
+void
+gum_event_router_remove_route (GumEventRouter * self,
+                               guint route_id)
+{
+  GumEventSink * sink = NULL;
+  guint i;
+
+  g_rw_lock_writer_lock (&self->lock);
+
+  for (i = 0; i != self->routes->len; i++)
+  {
+    GumEventRoute * route = &g_array_index (self->routes, GumEventRoute, i);
+
+    if (route->id == route_id)
+    {
+      sink = route->sink;
+      g_array_remove_index (self->routes, i);
+      break;
+    }
+  }
+
+  g_rw_lock_writer_unlock (&self->lock);
+
+  if (sink != NULL)
+    g_object_unref (sink);
+}
+
+static GumEventType
+gum_event_router_query_mask (GumEventSink * sink)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (sink);
+  GumEventType mask = GUM_NOTHING;
+  guint i;
+
+  g_rw_lock_reader_lock (&self->lock);
+
+  for (i = 0; i != self->routes->len; i++)
+    mask |= g_array_index (self->routes, GumEventRoute, i).filter.types;
+
+  g_rw_lock_reader_unlock (&self->lock);
+
+  return mask;
+}
+
+static GumEventType
+gum_event_router_query_location_mask (GumEventSink * sink,
+                                      gconstpointer location)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (sink);
+  GumEventType mask = GUM_NOTHING;
+  guint i;
+
+  g_rw_lock_reader_lock (&self->lock);
+
+  for (i = 0; i != self->routes->len; i++)
+  {
+    const GumEventFilter * filter =
+        &g_array_index (self->routes, GumEventRoute, i).filter;
+
+    if (filter->location.size == 0 ||
+        GUM_MEMORY_RANGE_INCLUDES (&filter->location, GUM_ADDRESS (location)))
+    {
+      mask |= filter->types;
+    }
+  }
+
+  g_rw_lock_reader_unlock (&self->lock);
+
+  return mask;
+}
+
+static void
+gum_event_router_start (GumEventSink * sink)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (sink);
+  guint i;
+
+  g_rw_lock_writer_lock (&self->lock);
+
+  self->started = TRUE;
+
+  for (i = 0; i != self->routes->len; i++)
+    gum_event_sink_start (g_array_index (self->routes, GumEventRoute, i).sink);
+
+  g_rw_lock_writer_unlock (&self->lock);
+}
+
+static void
+gum_event_router_process (GumEventSink * sink,
+                          const GumEvent * ev)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (sink);
+  guint i;
+
+  g_rw_lock_reader_lock (&self->lock);
+
+  for (i = 0; i != self->routes->len; i++)
+  {
+    GumEventRoute * route = &g_array_index (self->routes, GumEventRoute, i);
+
+    if (gum_event_filter_matches (&route->filter, ev))
+      gum_event_sink_process (route->sink, ev);
+  }
+
+  g_rw_lock_reader_unlock (&self->lock);
+}
+
+static void
+gum_event_router_flush (GumEventSink * sink)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (sink);
+  guint i;
+
+  g_rw_lock_reader_lock (&self->lock);
+
+  for (i = 0; i != self->routes->len; i++)
+    gum_event_sink_flush (g_array_index (self->routes, GumEventRoute, i).sink);
+
+  g_rw_lock_reader_unlock (&self->lock);
+}
+
+static void
+gum_event_router_stop (GumEventSink * sink)
+{
+  GumEventRouter * self = GUM_EVENT_ROUTER (sink);
+  guint i;
+
+  g_rw_lock_writer_lock (&self->lock);
+
+  self->started = FALSE;
+
+  for (i = 0; i != self->routes->len; i++)
+    gum_event_sink_stop (g_array_index (self->routes, GumEventRoute, i).sink);
+
+  g_rw_lock_writer_unlock (&self->lock);
+}
+
+void
+gum_event_filter_init (GumEventFilter * filter,
+                       GumEventType types)
+{
+  memset (filter, 0, sizeof (GumEventFilter));
+  filter->types = types;
+}
+
+gboolean
+gum_event_filter_set_location_module (GumEventFilter * filter,
+                                      const gchar * module_name)
+{
+  return gum_event_filter_find_module_range (module_name, &filter->location);
+}
+
+gboolean
+gum_event_filter_set_target_module (GumEventFilter * filter,
+                                    const gchar * module_name)
+{
+  return gum_event_filter_find_module_range (module_name, &filter->target);
+}
+
+gboolean
+gum_event_filter_matches (const GumEventFilter * filter,
+                          const GumEvent * ev)
+{
+  if ((filter->types & ev->type) == 0)
+    return FALSE;
+
+  if (filter->location.size != 0)
+  {
+    gpointer location;
+
+    switch (ev->type)
+    {
+      case GUM_CALL:
+        location = ev->call.location;
+        break;
+      case GUM_RET:
+        location = ev->ret.location;
+        break;
+      case GUM_EXEC:
+        location = ev->exec.location;
+        break;
+      case GUM_BLOCK:
+        location = ev->block.begin;
+        break;
+      case GUM_COMPILE:
+        location = ev->compile.begin;
+        break;
+      default:
+        return FALSE;
+    }
+
+    if (!GUM_MEMORY_RANGE_INCLUDES (&filter->location, GUM_ADDRESS (location)))
+      return FALSE;
+  }
+
+  if (filter->target.size != 0)
+  {
+    gpointer target;
+
+    switch (ev->type)
+    {
+      case GUM_CALL:
+        target = ev->call.target;
+        break;
+      case GUM_RET:
+        target = ev->ret.target;
+        break;
+      default:
+        return FALSE;
+    }
+
+    if (!GUM_MEMORY_RANGE_INCLUDES (&filter->target, GUM_ADDRESS (target)))
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static gboolean
+gum_event_filter_find_module_range (const gchar * module_name,
+                                    GumMemoryRange * range)
+{
+  GumFindModuleContext ctx;
+
+  ctx.name = module_name;
+  ctx.range = range;
+  ctx.found = FALSE;
+
+  gum_process_enumerate_modules (gum_event_filter_collect_module_range, &ctx);
+
+  return ctx.found;
+}
+
+static gboolean
+gum_event_filter_collect_module_range (const GumModuleDetails * details,
+                                       gpointer user_data)
+{
+  GumFindModuleContext * ctx = user_data;
+
+  if (strcmp (details->name, ctx->name) != 0 &&
+      strcmp (details->path, ctx->name) != 0)
+  {
+    return TRUE;
+  }
+
+  *ctx->range = *details->range;
+  ctx->found = TRUE;
+
+  return FALSE;
+}
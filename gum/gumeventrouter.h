@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_EVENT_ROUTER_H__
+#define __GUM_EVENT_ROUTER_H__
+
+#include <glib-object.h>
+#include <gum/gumeventsink.h>
+#include <gum/gummemory.h>
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_EVENT_ROUTER (gum_event_router_get_type ())
+G_DECLARE_FINAL_TYPE (GumEventRouter, gum_event_router, GUM, EVENT_ROUTER,
+    GObject)
+
+typedef struct _GumEventFilter GumEventFilter;
+
+/*
+ * An event passes a filter when its type is in `types` and, for each range
+ * whose size is non-zero, its location or target falls inside that range.
+ * Block and compile events are located at their first instruction, and only
+ * call and ret events have a target.
+ */
+struct _GumEventFilter
+{
+  GumEventType types;
+  GumMemoryRange location;
+  GumMemoryRange target;
+};
+
+GUM_API GumEventRouter * gum_event_router_new (void);
+
+GUM_API guint gum_event_router_add_route (GumEventRouter * self,
+    GumEventSink * sink, const GumEventFilter * filter);
+GUM_API void gum_event_router_remove_route (GumEventRouter * self,
+    guint route_id);
+
+GUM_API void gum_event_filter_init (GumEventFilter * filter,
+    GumEventType types);
+GUM_API gboolean gum_event_filter_set_location_module (GumEventFilter * filter,
+    const gchar * module_name);
+GUM_API gboolean gum_event_filter_set_target_module (GumEventFilter * filter,
+    const gchar * module_name);
+GUM_API gboolean gum_event_filter_matches (const GumEventFilter * filter,
+    const GumEvent * ev);
+
+G_END_DECLS
+
+#endif
@@ -23,6 +23,24 @@ gum_event_sink_query_mask (GumEventSink * self)
   return iface->query_mask (self);
 }
 
+gboolean
+gum_event_sink_has_location_mask (GumEventSink * self)
+{
+  return GUM_EVENT_SINK_GET_IFACE (self)->query_location_mask != NULL;
+}
+
+GumEventType
+gum_event_sink_query_location_mask (GumEventSink * self,
+                                    gconstpointer location)
+{
+  GumEventSinkInterface * iface = GUM_EVENT_SINK_GET_IFACE (self);
+
+  if (iface->query_location_mask == NULL)
+    return gum_event_sink_query_mask (self);
+
+  return iface->query_location_mask (self, location);
+}
+
 void
 gum_event_sink_start (GumEventSink * self)
 {
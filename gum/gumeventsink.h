@@ -16,11 +16,18 @@ G_BEGIN_DECLS
 #define GUM_TYPE_EVENT_SINK (gum_event_sink_get_type ())
 G_DECLARE_INTERFACE (GumEventSink, gum_event_sink, GUM, EVENT_SINK, GObject)
 
+/*
+ * query_location_mask() is optional, and narrows the mask for exec, call
+ * and ret events generated by the instruction at `location`. The Stalker
+ * asks it while compiling so that unwanted events cost nothing at runtime.
+ */
 struct _GumEventSinkInterface
 {
   GTypeInterface parent;
 
   GumEventType (* query_mask) (GumEventSink * self);
+  GumEventType (* query_location_mask) (GumEventSink * self,
+      gconstpointer location);
   void (* start) (GumEventSink * self);
   void (* process) (GumEventSink * self, const GumEvent * ev);
   void (* flush) (GumEventSink * self);
@@ -28,6 +35,9 @@ struct _GumEventSinkInterface
 };
 
 GUM_API GumEventType gum_event_sink_query_mask (GumEventSink * self);
+GUM_API gboolean gum_event_sink_has_location_mask (GumEventSink * self);
+GUM_API GumEventType gum_event_sink_query_location_mask (GumEventSink * self,
+    gconstpointer location);
 GUM_API void gum_event_sink_start (GumEventSink * self);
 GUM_API void gum_event_sink_process (GumEventSink * self, const GumEvent * ev);
 GUM_API void gum_event_sink_flush (GumEventSink * self);
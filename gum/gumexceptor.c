@@ -6,11 +6,40 @@
 
 #include "gumexceptor.h"
 
+#include "gumcodeallocator.h"
 #include "gumexceptorbackend.h"
+#include "gumtls.h"
+#if defined (HAVE_I386)
+# include "gumx86writer.h"
+#elif defined (HAVE_ARM64)
+# include "gumarm64writer.h"
+#endif
 
 #include <string.h>
 
+/*
+ * Mach exceptions are handled on a dedicated thread, so on Darwin try-scopes
+ * have to be looked up by thread ID. Elsewhere the faulting thread handles
+ * its own exceptions, and the scope chain lives in TLS.
+ */
+#ifdef HAVE_DARWIN
+# define GUM_EXCEPTOR_SCOPES_NEED_THREAD_LOOKUP 1
+#endif
+
+/*
+ * Guarded loads are tiny functions that copy a value of 1, 2, 4 or 8 bytes
+ * and return TRUE. When one of them faults, the exception is recognized by
+ * its PC and resumed at a stub that returns FALSE instead, so a read that
+ * might fault costs a call rather than a setjmp().
+ */
+#if defined (HAVE_I386) || defined (HAVE_ARM64)
+# define GUM_EXCEPTOR_HAVE_GUARDED_LOADS 1
+# define GUM_GUARDED_LOADS_SIZE 128
+#endif
+
 typedef struct _GumExceptionHandlerEntry GumExceptionHandlerEntry;
+typedef gboolean (* GumGuardedLoadFunc) (gconstpointer address,
+    gpointer value);
 
 #define GUM_EXCEPTOR_LOCK()   (g_mutex_lock (&self->mutex))
 #define GUM_EXCEPTOR_UNLOCK() (g_mutex_unlock (&self->mutex))
@@ -21,16 +50,32 @@ struct _GumExceptor
 
   GMutex mutex;
 
-  GSList * handlers;
+  GumExceptionHandlerEntry * volatile handlers;
+  guint n_handlers;
+  volatile gint n_system_handlers;
+  GSList * retired_handlers;
+
+#ifdef GUM_EXCEPTOR_SCOPES_NEED_THREAD_LOOKUP
   GHashTable * scopes;
+#else
+  GumTlsKey scope_key;
+#endif
 
   GumExceptorBackend * backend;
+
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+  GumCodeAllocator guarded_load_allocator;
+  GumCodeSlice * guarded_load_slice;
+  GumGuardedLoadFunc guarded_loads[4];
+  GumAddress guarded_load_recovery;
+#endif
 };
 
 struct _GumExceptionHandlerEntry
 {
   GumExceptionHandler func;
   gpointer user_data;
+  gboolean include_system;
 };
 
 static void gum_exceptor_dispose (GObject * object);
@@ -40,8 +85,22 @@ static void the_exceptor_weak_notify (gpointer data,
 
 static gboolean gum_exceptor_handle_exception (GumExceptionDetails * details,
     GumExceptor * self);
-static gboolean gum_exceptor_handle_scope_exception (
-    GumExceptionDetails * details, gpointer user_data);
+static void gum_exceptor_replace_handlers (GumExceptor * self,
+    GumExceptionHandlerEntry * handlers, guint n_handlers);
+static gboolean gum_exceptor_handle_scope_exception (GumExceptor * self,
+    GumExceptionDetails * details);
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+static void gum_exceptor_create_guarded_loads (GumExceptor * self);
+static void gum_exceptor_write_guarded_loads (GumExceptor * self,
+    gpointer code);
+static gboolean gum_exceptor_handle_guarded_load_exception (
+    GumExceptor * self, GumExceptionDetails * details);
+#endif
+
+static GumExceptorScope * gum_exceptor_get_scope (GumExceptor * self,
+    GumThreadId thread_id);
+static void gum_exceptor_set_current_scope (GumExceptor * self,
+    GumExceptorScope * scope);
 
 static void gum_exceptor_scope_perform_longjmp (GumExceptorScope * scope);
 
@@ -64,9 +123,19 @@ gum_exceptor_init (GumExceptor * self)
 {
   g_mutex_init (&self->mutex);
 
+  self->handlers = g_new0 (GumExceptionHandlerEntry, 1);
+  self->n_handlers = 0;
+  self->retired_handlers = NULL;
+
+#ifdef GUM_EXCEPTOR_SCOPES_NEED_THREAD_LOOKUP
   self->scopes = g_hash_table_new (NULL, NULL);
+#else
+  self->scope_key = gum_tls_key_new ();
+#endif
 
-  gum_exceptor_add (self, gum_exceptor_handle_scope_exception, self);
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+  gum_exceptor_create_guarded_loads (self);
+#endif
 
   self->backend = gum_exceptor_backend_new (
       (GumExceptionHandler) gum_exceptor_handle_exception, self);
@@ -87,9 +156,19 @@ gum_exceptor_finalize (GObject * object)
 {
   GumExceptor * self = GUM_EXCEPTOR (object);
 
-  gum_exceptor_remove (self, gum_exceptor_handle_scope_exception, self);
-
+#ifdef GUM_EXCEPTOR_SCOPES_NEED_THREAD_LOOKUP
   g_hash_table_unref (self->scopes);
+#else
+  gum_tls_key_free (self->scope_key);
+#endif
+
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+  gum_code_slice_free (self->guarded_load_slice);
+  gum_code_allocator_free (&self->guarded_load_allocator);
+#endif
+
+  g_slist_free_full (self->retired_handlers, g_free);
+  g_free (self->handlers);
 
   g_mutex_clear (&self->mutex);
 
@@ -137,14 +216,39 @@ gum_exceptor_add (GumExceptor * self,
                   GumExceptionHandler func,
                   gpointer user_data)
 {
-  GumExceptionHandlerEntry * entry;
+  gum_exceptor_add_full (self, func, user_data, TRUE);
+}
 
-  entry = g_slice_new (GumExceptionHandlerEntry);
-  entry->func = func;
-  entry->user_data = user_data;
+/*
+ * Handlers that only care about faults, such as guard page hits or single
+ * steps, should pass FALSE for include_system. Exceptions raised by software,
+ * like C++ throws and debug output on Windows, are then never dispatched to
+ * them, and when no handler or try-scope wants those they bypass Gum.
+ */
+void
+gum_exceptor_add_full (GumExceptor * self,
+                       GumExceptionHandler func,
+                       gpointer user_data,
+                       gboolean include_system)
+{
+  GumExceptionHandlerEntry * handlers;
+  guint n;
 
   GUM_EXCEPTOR_LOCK ();
-  self->handlers = g_slist_append (self->handlers, entry);
+
+  n = self->n_handlers;
+
+  handlers = g_new (GumExceptionHandlerEntry, n + 2);
+  memcpy (handlers, self->handlers, n * sizeof (GumExceptionHandlerEntry));
+  handlers[n].func = func;
+  handlers[n].user_data = user_data;
+  handlers[n].include_system = include_system;
+  handlers[n + 1].func = NULL;
+  handlers[n + 1].user_data = NULL;
+  handlers[n + 1].include_system = FALSE;
+
+  gum_exceptor_replace_handlers (self, handlers, n + 1);
+
   GUM_EXCEPTOR_UNLOCK ();
 }
 
@@ -153,101 +257,175 @@ gum_exceptor_remove (GumExceptor * self,
                      GumExceptionHandler func,
                      gpointer user_data)
 {
-  GumExceptionHandlerEntry * matching_entry;
-  GSList * cur;
+  GumExceptionHandlerEntry * handlers;
+  guint n, i, j;
 
   GUM_EXCEPTOR_LOCK ();
 
-  for (matching_entry = NULL, cur = self->handlers;
-      matching_entry == NULL && cur != NULL;
-      cur = cur->next)
+  n = self->n_handlers;
+
+  handlers = g_new (GumExceptionHandlerEntry, n);
+  for (i = 0, j = 0; i != n; i++)
   {
-    GumExceptionHandlerEntry * entry = (GumExceptionHandlerEntry *) cur->data;
+    const GumExceptionHandlerEntry * entry = &self->handlers[i];
 
-    if (entry->func == func && entry->user_data == user_data)
-      matching_entry = entry;
+    if (j == i && entry->func == func && entry->user_data == user_data)
+      continue;
+
+    handlers[j++] = *entry;
   }
 
-  g_assert (matching_entry != NULL);
+  g_assert (j == n - 1);
+
+  handlers[j].func = NULL;
+  handlers[j].user_data = NULL;
+  handlers[j].include_system = FALSE;
 
-  self->handlers = g_slist_remove (self->handlers, matching_entry);
+  gum_exceptor_replace_handlers (self, handlers, n - 1);
 
   GUM_EXCEPTOR_UNLOCK ();
+}
 
-  g_slice_free (GumExceptionHandlerEntry, matching_entry);
+/*
+ * The handler array is never modified in place, and retired arrays are only
+ * freed with the exceptor, so the exception path can walk whichever array is
+ * current without taking the lock.
+ */
+static void
+gum_exceptor_replace_handlers (GumExceptor * self,
+                               GumExceptionHandlerEntry * handlers,
+                               guint n_handlers)
+{
+  guint n_system_handlers, i;
+
+  self->retired_handlers =
+      g_slist_prepend (self->retired_handlers, self->handlers);
+
+  n_system_handlers = 0;
+  for (i = 0; i != n_handlers; i++)
+  {
+    if (handlers[i].include_system)
+      n_system_handlers++;
+  }
+
+  g_atomic_pointer_set (&self->handlers, handlers);
+  self->n_handlers = n_handlers;
+  g_atomic_int_set (&self->n_system_handlers, n_system_handlers);
+}
+
+/*
+ * Lets a backend pass exceptions raised by software straight on to the
+ * system without building the details, when nothing in Gum would act on
+ * them: no handler asked for them, and the thread is not in a try-scope.
+ */
+gboolean
+_gum_exceptor_wants_system_exceptions (void)
+{
+  GumExceptor * self = the_exceptor;
+
+  if (self == NULL)
+    return FALSE;
+
+  if (g_atomic_int_get (&self->n_system_handlers) != 0)
+    return TRUE;
+
+  return gum_exceptor_get_scope (self,
+      gum_process_get_current_thread_id ()) != NULL;
 }
 
 static gboolean
 gum_exceptor_handle_exception (GumExceptionDetails * details,
                                GumExceptor * self)
 {
-  gboolean handled = FALSE;
-  GSList * invoked = NULL;
-  GumExceptionHandlerEntry e;
+  const GumExceptionHandlerEntry * entry;
+
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+  if (gum_exceptor_handle_guarded_load_exception (self, details))
+    return TRUE;
+#endif
 
-  do
+  if (gum_exceptor_handle_scope_exception (self, details))
+    return TRUE;
+
+  for (entry = g_atomic_pointer_get (&self->handlers);
+      entry->func != NULL;
+      entry++)
   {
-    GSList * cur;
-
-    e.func = NULL;
-    e.user_data = NULL;
-
-    GUM_EXCEPTOR_LOCK ();
-    for (cur = self->handlers; e.func == NULL && cur != NULL; cur = cur->next)
-    {
-      GumExceptionHandlerEntry * entry = (GumExceptionHandlerEntry *) cur->data;
-
-      if (g_slist_find (invoked, entry) == NULL)
-      {
-        invoked = g_slist_prepend (invoked, entry);
-        e = *entry;
-      }
-    }
-    GUM_EXCEPTOR_UNLOCK ();
-
-    if (e.func != NULL)
-      handled = e.func (details, e.user_data);
-  }
-  while (!handled && e.func != NULL);
+    if (details->type == GUM_EXCEPTION_SYSTEM && !entry->include_system)
+      continue;
 
-  g_slist_free (invoked);
+    if (entry->func (details, entry->user_data))
+      return TRUE;
+  }
 
-  return handled;
+  return FALSE;
 }
 
 void
 _gum_exceptor_prepare_try (GumExceptor * self,
                            GumExceptorScope * scope)
 {
-  gpointer thread_id_key;
-
-  thread_id_key = GSIZE_TO_POINTER (gum_process_get_current_thread_id ());
-
   scope->exception_occurred = FALSE;
 #ifdef HAVE_ANDROID
   /* Workaround for Bionic bug up to and including Android L */
   sigprocmask (SIG_SETMASK, NULL, &scope->mask);
 #endif
 
-  GUM_EXCEPTOR_LOCK ();
-  scope->next = g_hash_table_lookup (self->scopes, thread_id_key);
-  g_hash_table_insert (self->scopes, thread_id_key, scope);
-  GUM_EXCEPTOR_UNLOCK ();
+  scope->next = gum_exceptor_get_scope (self,
+      gum_process_get_current_thread_id ());
+  gum_exceptor_set_current_scope (self, scope);
 }
 
 gboolean
 gum_exceptor_catch (GumExceptor * self,
                     GumExceptorScope * scope)
 {
-  gpointer thread_id_key;
+  gum_exceptor_set_current_scope (self, scope->next);
 
-  thread_id_key = GSIZE_TO_POINTER (gum_process_get_current_thread_id ());
+  return scope->exception_occurred;
+}
 
-  GUM_EXCEPTOR_LOCK ();
-  g_hash_table_insert (self->scopes, thread_id_key, scope->next);
-  GUM_EXCEPTOR_UNLOCK ();
+/*
+ * Copies `size` bytes, which must be 1, 2, 4 or 8, from `address` to
+ * `value`, returning FALSE if that faulted. Cheaper than a try-scope, but
+ * tells nothing about the fault.
+ */
+gboolean
+gum_exceptor_try_read (GumExceptor * self,
+                       gconstpointer address,
+                       guint size,
+                       gpointer value)
+{
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+  GumGuardedLoadFunc load;
 
-  return scope->exception_occurred;
+  g_assert (size == 1 || size == 2 || size == 4 || size == 8);
+
+  load = self->guarded_loads[g_bit_nth_lsf (size, -1)];
+
+  return load (address, value);
+#else
+  return _gum_exceptor_try_read_in_scope (self, address, size, value);
+#endif
+}
+
+/* The fallback used where there are no guarded loads. */
+gboolean
+_gum_exceptor_try_read_in_scope (GumExceptor * self,
+                                 gconstpointer address,
+                                 guint size,
+                                 gpointer value)
+{
+  GumExceptorScope scope;
+
+  g_assert (size == 1 || size == 2 || size == 4 || size == 8);
+
+  if (gum_exceptor_try (self, &scope))
+  {
+    memcpy (value, address, size);
+  }
+
+  return !gum_exceptor_catch (self, &scope);
 }
 
 gchar *
@@ -300,17 +478,13 @@ gum_exception_details_to_string (const GumExceptionDetails * details)
 }
 
 static gboolean
-gum_exceptor_handle_scope_exception (GumExceptionDetails * details,
-                                     gpointer user_data)
+gum_exceptor_handle_scope_exception (GumExceptor * self,
+                                     GumExceptionDetails * details)
 {
-  GumExceptor * self = GUM_EXCEPTOR (user_data);
   GumExceptorScope * scope;
   GumCpuContext * context = &details->context;
 
-  GUM_EXCEPTOR_LOCK ();
-  scope = g_hash_table_lookup (self->scopes,
-      GSIZE_TO_POINTER (details->thread_id));
-  GUM_EXCEPTOR_UNLOCK ();
+  scope = gum_exceptor_get_scope (self, details->thread_id);
   if (scope == NULL)
     return FALSE;
 
@@ -393,6 +567,171 @@ gum_exceptor_handle_scope_exception (GumExceptionDetails * details,
   return TRUE;
 }
 
+#ifdef GUM_EXCEPTOR_HAVE_GUARDED_LOADS
+
+static void
+gum_exceptor_create_guarded_loads (GumExceptor * self)
+{
+  gum_code_allocator_init (&self->guarded_load_allocator,
+      GUM_GUARDED_LOADS_SIZE);
+
+  self->guarded_load_slice =
+      gum_code_allocator_alloc_slice (&self->guarded_load_allocator);
+  gum_exceptor_write_guarded_loads (self, self->guarded_load_slice->data);
+  gum_code_allocator_commit (&self->guarded_load_allocator);
+}
+
+static void
+gum_exceptor_write_guarded_loads (GumExceptor * self,
+                                  gpointer code)
+{
+  guint i;
+#if defined (HAVE_I386)
+  static const guint8 load_1[] = { 0x8a, 0x01, 0x88, 0x02 };
+  static const guint8 load_2[] = { 0x66, 0x8b, 0x01, 0x66, 0x89, 0x02 };
+  static const guint8 load_4[] = { 0x8b, 0x01, 0x89, 0x02 };
+# if GLIB_SIZEOF_VOID_P == 8
+  static const guint8 load_8[] = { 0x48, 0x8b, 0x01, 0x48, 0x89, 0x02 };
+# else
+  static const guint8 load_8[] = {
+    0x8b, 0x01,       /* mov eax, [ecx]     */
+    0x8b, 0x49, 0x04, /* mov ecx, [ecx + 4] */
+    0x89, 0x02,       /* mov [edx], eax     */
+    0x89, 0x4a, 0x04  /* mov [edx + 4], ecx */
+  };
+# endif
+  static const struct { const guint8 * code; gsize size; } loads[] = {
+    { load_1, sizeof (load_1) },
+    { load_2, sizeof (load_2) },
+    { load_4, sizeof (load_4) },
+    { load_8, sizeof (load_8) }
+  };
+  GumX86Writer cw;
+
+  gum_x86_writer_init (&cw, code);
+
+  for (i = 0; i != G_N_ELEMENTS (loads); i++)
+  {
+    self->guarded_loads[i] = GUM_POINTER_TO_FUNCPTR (GumGuardedLoadFunc,
+        gum_x86_writer_cur (&cw));
+
+    /* Copy from [xcx] to [xdx], whatever the calling convention. */
+# if GLIB_SIZEOF_VOID_P == 4
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (&cw, GUM_REG_ECX,
+        GUM_REG_ESP, 4);
+    gum_x86_writer_put_mov_reg_reg_offset_ptr (&cw, GUM_REG_EDX,
+        GUM_REG_ESP, 8);
+# elif GUM_NATIVE_ABI_IS_UNIX
+    gum_x86_writer_put_mov_reg_reg (&cw, GUM_REG_RCX, GUM_REG_RDI);
+    gum_x86_writer_put_mov_reg_reg (&cw, GUM_REG_RDX, GUM_REG_RSI);
+# endif
+    gum_x86_writer_put_bytes (&cw, loads[i].code, loads[i].size);
+    gum_x86_writer_put_mov_reg_u32 (&cw, GUM_REG_EAX, TRUE);
+    gum_x86_writer_put_ret (&cw);
+  }
+
+  self->guarded_load_recovery = GUM_ADDRESS (gum_x86_writer_cur (&cw));
+  gum_x86_writer_put_xor_reg_reg (&cw, GUM_REG_EAX, GUM_REG_EAX);
+  gum_x86_writer_put_ret (&cw);
+
+  gum_x86_writer_flush (&cw);
+  g_assert_cmpuint (gum_x86_writer_offset (&cw), <=, GUM_GUARDED_LOADS_SIZE);
+  gum_x86_writer_clear (&cw);
+#elif defined (HAVE_ARM64)
+  static const guint32 loads[][2] = {
+    { 0x39400002, 0x39000022 }, /* ldrb w2, [x0]; strb w2, [x1] */
+    { 0x79400002, 0x79000022 }, /* ldrh w2, [x0]; strh w2, [x1] */
+    { 0xb9400002, 0xb9000022 }, /* ldr w2, [x0]; str w2, [x1] */
+    { 0xf9400002, 0xf9000022 }  /* ldr x2, [x0]; str x2, [x1] */
+  };
+  GumArm64Writer cw;
+
+  gum_arm64_writer_init (&cw, code);
+
+  for (i = 0; i != G_N_ELEMENTS (loads); i++)
+  {
+    self->guarded_loads[i] = GUM_POINTER_TO_FUNCPTR (GumGuardedLoadFunc,
+        gum_arm64_writer_cur (&cw));
+
+    gum_arm64_writer_put_instruction (&cw, loads[i][0]);
+    gum_arm64_writer_put_instruction (&cw, loads[i][1]);
+    gum_arm64_writer_put_instruction (&cw, 0x52800020); /* mov w0, #1 */
+    gum_arm64_writer_put_ret (&cw);
+  }
+
+  self->guarded_load_recovery = GUM_ADDRESS (gum_arm64_writer_cur (&cw));
+  gum_arm64_writer_put_instruction (&cw, 0x52800000); /* mov w0, #0 */
+  gum_arm64_writer_put_ret (&cw);
+
+  gum_arm64_writer_flush (&cw);
+  g_assert_cmpuint (gum_arm64_writer_offset (&cw), <=,
+      GUM_GUARDED_LOADS_SIZE);
+  gum_arm64_writer_clear (&cw);
+#endif
+}
+
+static gboolean
+gum_exceptor_handle_guarded_load_exception (GumExceptor * self,
+                                            GumExceptionDetails * details)
+{
+  GumAddress start, pc;
+
+  start = GUM_ADDRESS (GUM_FUNCPTR_TO_POINTER (self->guarded_loads[0]));
+#if defined (HAVE_I386)
+  pc = GUM_CPU_CONTEXT_XIP (&details->context);
+#else
+  pc = details->context.pc;
+#endif
+
+  /* The recovery stub directly follows the last load. */
+  if (pc < start || pc >= self->guarded_load_recovery)
+    return FALSE;
+
+#if defined (HAVE_I386)
+  GUM_CPU_CONTEXT_XIP (&details->context) = self->guarded_load_recovery;
+#else
+  details->context.pc = self->guarded_load_recovery;
+#endif
+
+  return TRUE;
+}
+
+#endif
+
+static GumExceptorScope *
+gum_exceptor_get_scope (GumExceptor * self,
+                        GumThreadId thread_id)
+{
+#ifdef GUM_EXCEPTOR_SCOPES_NEED_THREAD_LOOKUP
+  GumExceptorScope * scope;
+
+  GUM_EXCEPTOR_LOCK ();
+  scope = g_hash_table_lookup (self->scopes, GSIZE_TO_POINTER (thread_id));
+  GUM_EXCEPTOR_UNLOCK ();
+
+  return scope;
+#else
+  return gum_tls_key_get_value (self->scope_key);
+#endif
+}
+
+static void
+gum_exceptor_set_current_scope (GumExceptor * self,
+                                GumExceptorScope * scope)
+{
+#ifdef GUM_EXCEPTOR_SCOPES_NEED_THREAD_LOOKUP
+  gpointer thread_id_key;
+
+  thread_id_key = GSIZE_TO_POINTER (gum_process_get_current_thread_id ());
+
+  GUM_EXCEPTOR_LOCK ();
+  g_hash_table_insert (self->scopes, thread_id_key, scope);
+  GUM_EXCEPTOR_UNLOCK ();
+#else
+  gum_tls_key_set_value (self->scope_key, scope);
+#endif
+}
+
 static void
 gum_exceptor_scope_perform_longjmp (GumExceptorScope * self)
 {
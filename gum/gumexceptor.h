@@ -83,6 +83,8 @@ GUM_API GumExceptor * gum_exceptor_obtain (void);
 
 GUM_API void gum_exceptor_add (GumExceptor * self, GumExceptionHandler func,
     gpointer user_data);
+GUM_API void gum_exceptor_add_full (GumExceptor * self,
+    GumExceptionHandler func, gpointer user_data, gboolean include_system);
 GUM_API void gum_exceptor_remove (GumExceptor * self, GumExceptionHandler func,
     gpointer user_data);
 
@@ -105,11 +107,16 @@ GUM_API void gum_exceptor_remove (GumExceptor * self, GumExceptionHandler func,
 GUM_API gboolean gum_exceptor_catch (GumExceptor * self,
     GumExceptorScope * scope);
 
+GUM_API gboolean gum_exceptor_try_read (GumExceptor * self,
+    gconstpointer address, guint size, gpointer value);
+
 GUM_API gchar * gum_exception_details_to_string (
     const GumExceptionDetails * details);
 
 GUM_API void _gum_exceptor_prepare_try (GumExceptor * self,
     GumExceptorScope * scope);
+GUM_API gboolean _gum_exceptor_try_read_in_scope (GumExceptor * self,
+    gconstpointer address, guint size, gpointer value);
 
 G_END_DECLS
 
@@ -17,6 +17,8 @@ G_GNUC_INTERNAL void _gum_exceptor_backend_prepare_to_fork (void);
 G_GNUC_INTERNAL void _gum_exceptor_backend_recover_from_fork_in_parent (void);
 G_GNUC_INTERNAL void _gum_exceptor_backend_recover_from_fork_in_child (void);
 
+G_GNUC_INTERNAL gboolean _gum_exceptor_wants_system_exceptions (void);
+
 #define GUM_TYPE_EXCEPTOR_BACKEND (gum_exceptor_backend_get_type ())
 G_DECLARE_FINAL_TYPE (GumExceptorBackend, gum_exceptor_backend, GUM,
     EXCEPTOR_BACKEND, GObject)
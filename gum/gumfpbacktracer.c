@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumfpbacktracer.h"
+
+#include "guminterceptor.h"
+#include "gumprocess.h"
+
+#ifdef G_OS_WIN32
+# define VC_EXTRALEAN
+# include <windows.h>
+#endif
+#if defined (HAVE_DARWIN) || defined (HAVE_LINUX)
+# include <pthread.h>
+#endif
+
+/*
+ * Walks the chain of saved frame pointers, which costs a couple of loads per
+ * frame. Every frame pointer is checked against the bounds of the current
+ * thread's stack, looked up once per thread and cached. Code built without
+ * frame pointers breaks the chain, and when that happens we hand over to the
+ * fallback backtracer instead of returning a truncated backtrace.
+ */
+
+#if defined (HAVE_I386) || defined (HAVE_ARM64) || \
+    (defined (HAVE_ARM) && defined (HAVE_DARWIN))
+# define GUM_FP_CHAIN_SUPPORTED 1
+#endif
+
+#define GUM_FP_LINK_OFFSET 1
+#define GUM_FP_IS_ALIGNED(F) \
+    ((GPOINTER_TO_SIZE (F) & (sizeof (gpointer) - 1)) == 0)
+
+struct _GumFpBacktracer
+{
+  GObject parent;
+
+  GumBacktracer * fallback;
+};
+
+static void gum_fp_backtracer_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_fp_backtracer_dispose (GObject * object);
+static void gum_fp_backtracer_generate (GumBacktracer * backtracer,
+    const GumCpuContext * cpu_context,
+    GumReturnAddressArray * return_addresses);
+
+static const GumMemoryRange * gum_fp_backtracer_get_stack_bounds (void);
+static gboolean gum_query_stack_bounds (GumMemoryRange * bounds);
+
+G_DEFINE_TYPE_EXTENDED (GumFpBacktracer,
+                        gum_fp_backtracer,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_BACKTRACER,
+                            gum_fp_backtracer_iface_init))
+
+static GPrivate gum_fp_stack_bounds = G_PRIVATE_INIT (g_free);
+
+static void
+gum_fp_backtracer_class_init (GumFpBacktracerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_fp_backtracer_dispose;
+}
+
+static void
+gum_fp_backtracer_iface_init (gpointer g_iface,
+                              gpointer iface_data)
+{
+  GumBacktracerInterface * iface = g_iface;
+
+  iface->generate = gum_fp_backtracer_generate;
+}
+
+static void
+gum_fp_backtracer_init (GumFpBacktracer * self)
+{
+}
+
+static void
+gum_fp_backtracer_dispose (GObject * object)
+{
+  GumFpBacktracer * self = GUM_FP_BACKTRACER (object);
+
+  g_clear_object (&self->fallback);
+
+  G_OBJECT_CLASS (gum_fp_backtracer_parent_class)->dispose (object);
+}
+
+GumBacktracer *
+gum_fp_backtracer_new (GumBacktracer * fallback)
+{
+  GumFpBacktracer * backtracer;
+
+  backtracer = g_object_new (GUM_TYPE_FP_BACKTRACER, NULL);
+  if (fallback != NULL)
+    backtracer->fallback = g_object_ref (fallback);
+
+  return GUM_BACKTRACER (backtracer);
+}
+
+static void
+gum_fp_backtracer_generate (GumBacktracer * backtracer,
+                            const GumCpuContext * cpu_context,
+                            GumReturnAddressArray * return_addresses)
+{
+  GumFpBacktracer * self = GUM_FP_BACKTRACER (backtracer);
+  const GumMemoryRange * stack;
+  gpointer * stack_bottom, * stack_top, * cur;
+  guint start_index, i;
+  gboolean chain_broken;
+  GumInvocationStack * invocation_stack;
+  guint invocation_depth = 0;
+
+  stack = gum_fp_backtracer_get_stack_bounds ();
+  if (stack == NULL)
+    goto fallback;
+
+  stack_bottom = GSIZE_TO_POINTER (stack->base_address);
+  stack_top = (gpointer *) GSIZE_TO_POINTER (stack->base_address +
+      stack->size) - (GUM_FP_LINK_OFFSET + 1);
+
+  if (cpu_context != NULL)
+  {
+#if defined (HAVE_I386)
+    cur = GSIZE_TO_POINTER (GUM_CPU_CONTEXT_XBP (cpu_context));
+
+    return_addresses->items[0] = *((GumReturnAddress *) GSIZE_TO_POINTER (
+        GUM_CPU_CONTEXT_XSP (cpu_context)));
+#elif defined (HAVE_ARM) && defined (HAVE_DARWIN)
+    cur = GSIZE_TO_POINTER (cpu_context->r[7]);
+
+    return_addresses->items[0] = GSIZE_TO_POINTER (cpu_context->lr);
+#elif defined (HAVE_ARM64)
+    cur = GSIZE_TO_POINTER (cpu_context->fp);
+
+    return_addresses->items[0] = GSIZE_TO_POINTER (cpu_context->lr);
+#else
+    goto fallback;
+#endif
+    start_index = 1;
+  }
+  else
+  {
+#if defined (GUM_FP_CHAIN_SUPPORTED) && !defined (_MSC_VER)
+    cur = __builtin_frame_address (0);
+#else
+    goto fallback;
+#endif
+
+    start_index = 0;
+  }
+
+  chain_broken = FALSE;
+  for (i = start_index; i != G_N_ELEMENTS (return_addresses->items); i++)
+  {
+    gpointer * next;
+
+    if (cur < stack_bottom || cur > stack_top || !GUM_FP_IS_ALIGNED (cur))
+    {
+      chain_broken = TRUE;
+      break;
+    }
+
+    return_addresses->items[i] = *(cur + GUM_FP_LINK_OFFSET);
+
+    next = *cur;
+    if (next == NULL)
+    {
+      i++;
+      break;
+    }
+    if (next <= cur)
+    {
+      chain_broken = TRUE;
+      break;
+    }
+    cur = next;
+  }
+  return_addresses->len = i;
+
+  if (chain_broken)
+    goto fallback;
+
+  invocation_stack = gum_interceptor_get_current_stack ();
+  for (i = 0; i != return_addresses->len; i++)
+  {
+    return_addresses->items[i] = gum_invocation_stack_translate_next (
+        invocation_stack, return_addresses->items[i], &invocation_depth);
+  }
+
+  return;
+
+fallback:
+  if (self->fallback != NULL)
+    gum_backtracer_generate (self->fallback, cpu_context, return_addresses);
+  else
+    return_addresses->len = 0;
+}
+
+static const GumMemoryRange *
+gum_fp_backtracer_get_stack_bounds (void)
+{
+  GumMemoryRange * bounds;
+
+  bounds = g_private_get (&gum_fp_stack_bounds);
+  if (bounds == NULL)
+  {
+    bounds = g_new (GumMemoryRange, 1);
+    if (!gum_query_stack_bounds (bounds))
+      bounds->size = 0;
+
+    g_private_set (&gum_fp_stack_bounds, bounds);
+  }
+
+  if (bounds->size == 0)
+    return NULL;
+
+  return bounds;
+}
+
+static gboolean
+gum_query_stack_bounds (GumMemoryRange * bounds)
+{
+  GumMemoryRange ranges[GUM_MAX_THREAD_RANGES];
+  GumAddress here;
+  guint n, i;
+
+  here = GUM_ADDRESS (&here);
+
+  n = gum_thread_try_get_ranges (ranges, G_N_ELEMENTS (ranges));
+  for (i = 0; i != n; i++)
+  {
+    const GumMemoryRange * r = &ranges[i];
+
+    if (here >= r->base_address && here < r->base_address + r->size)
+    {
+      *bounds = *r;
+      return TRUE;
+    }
+  }
+
+#if defined (G_OS_WIN32)
+  {
+    NT_TIB * tib = (NT_TIB *) NtCurrentTeb ();
+
+    bounds->base_address = GUM_ADDRESS (tib->StackLimit);
+    bounds->size = GUM_ADDRESS (tib->StackBase) - bounds->base_address;
+
+    return TRUE;
+  }
+#elif defined (HAVE_DARWIN)
+  {
+    pthread_t thread;
+    gpointer stack_top;
+    gsize stack_size;
+
+    thread = pthread_self ();
+    stack_top = pthread_get_stackaddr_np (thread);
+    stack_size = pthread_get_stacksize_np (thread);
+
+    bounds->base_address = GUM_ADDRESS (stack_top) - stack_size;
+    bounds->size = stack_size;
+
+    return TRUE;
+  }
+#elif defined (HAVE_LINUX)
+  {
+    pthread_attr_t attr;
+    gpointer stack_addr;
+    size_t stack_size;
+    gboolean success;
+
+    if (pthread_getattr_np (pthread_self (), &attr) != 0)
+      return FALSE;
+
+    success = pthread_attr_getstack (&attr, &stack_addr, &stack_size) == 0;
+    if (success)
+    {
+      bounds->base_address = GUM_ADDRESS (stack_addr);
+      bounds->size = stack_size;
+    }
+
+    pthread_attr_destroy (&attr);
+
+    return success;
+  }
+#else
+  return FALSE;
+#endif
+}
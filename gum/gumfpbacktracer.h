@@ -0,0 +1,23 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_FP_BACKTRACER_H__
+#define __GUM_FP_BACKTRACER_H__
+
+#include <glib-object.h>
+#include <gum/gumbacktracer.h>
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_FP_BACKTRACER (gum_fp_backtracer_get_type ())
+G_DECLARE_FINAL_TYPE (GumFpBacktracer, gum_fp_backtracer, GUM, FP_BACKTRACER,
+    GObject)
+
+GUM_API GumBacktracer * gum_fp_backtracer_new (GumBacktracer * fallback);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,524 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumimporthooker.h"
+
+#include "gum-init.h"
+#include "gumcodeallocator.h"
+#include "gummemory.h"
+#include "gumprocess.h"
+#if defined (HAVE_I386)
+# include "gumx86writer.h"
+#elif defined (HAVE_ARM)
+# include "gumthumbwriter.h"
+#elif defined (HAVE_ARM64)
+# include "gumarm64writer.h"
+#elif defined (HAVE_MIPS)
+# include "gummipswriter.h"
+#endif
+
+#include <string.h>
+
+/*
+ * Hooks an import by rewriting the slots that calls from one module go
+ * through, i.e. its GOT entries, IAT entries or Mach-O binds, so that no
+ * other caller of the function pays for the hook. Listeners are attached
+ * through the Interceptor to a stub that jumps to the real function, and the
+ * slots are pointed at that stub instead. Stubs are shared by every hooker
+ * in the process, one per target function, and live until gum_deinit() since
+ * the Interceptor may still hold on to them.
+ *
+ * Rewriting a slot also changes the address that module sees when taking the
+ * import's address, as both are typically bound through the same slot.
+ */
+
+#define GUM_IMPORT_STUB_SIZE 64
+#define GUM_IMPORT_STUB_PADDING 16
+
+#define GUM_IMPORT_HOOKER_LOCK(o) g_mutex_lock (&(o)->mutex)
+#define GUM_IMPORT_HOOKER_UNLOCK(o) g_mutex_unlock (&(o)->mutex)
+
+typedef struct _GumImportHook GumImportHook;
+typedef struct _GumImportSlot GumImportSlot;
+typedef struct _GumCollectSlotsContext GumCollectSlotsContext;
+typedef struct _GumFindProtectionContext GumFindProtectionContext;
+
+struct _GumImportHooker
+{
+  GObject parent;
+
+  GMutex mutex;
+  GArray * hooks;
+  GumInterceptor * interceptor;
+};
+
+struct _GumImportHook
+{
+  gchar * module_name;
+  gchar * import_name;
+  gpointer * slot;
+  gpointer previous_value;
+};
+
+struct _GumImportSlot
+{
+  gpointer * slot;
+  gpointer target;
+};
+
+struct _GumCollectSlotsContext
+{
+  const gchar * import_name;
+  GArray * slots;
+};
+
+struct _GumFindProtectionContext
+{
+  GumAddress address;
+  GumPageProtection prot;
+  gboolean found;
+};
+
+static void gum_import_hooker_dispose (GObject * object);
+static void gum_import_hooker_finalize (GObject * object);
+
+static GArray * gum_import_hooker_collect_slots (GumImportHooker * self,
+    const gchar * module_name, const gchar * import_name);
+static gboolean gum_collect_slot (const GumImportDetails * details,
+    gpointer user_data);
+static void gum_import_hooker_add_hook (GumImportHooker * self,
+    const gchar * module_name, const gchar * import_name, gpointer * slot,
+    gpointer value);
+static gboolean gum_import_hooker_is_hooking (GumImportHooker * self,
+    gpointer * slot);
+static void gum_import_hook_clear (GumImportHook * hook);
+
+static gboolean gum_write_slot (gpointer * slot, gpointer value);
+static gboolean gum_find_protection (const GumRangeDetails * details,
+    gpointer user_data);
+
+static gpointer gum_import_stub_obtain (gpointer target);
+static gpointer gum_import_stub_write (gpointer code, gpointer target);
+static void gum_import_stub_deinit (void);
+
+G_DEFINE_TYPE (GumImportHooker, gum_import_hooker, G_TYPE_OBJECT)
+
+static GMutex gum_import_stub_lock;
+static GumCodeAllocator gum_import_stub_allocator;
+static GHashTable * gum_import_stub_by_target = NULL;
+
+static void
+gum_import_hooker_class_init (GumImportHookerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_import_hooker_dispose;
+  object_class->finalize = gum_import_hooker_finalize;
+}
+
+static void
+gum_import_hooker_init (GumImportHooker * self)
+{
+  g_mutex_init (&self->mutex);
+  self->hooks = g_array_new (FALSE, FALSE, sizeof (GumImportHook));
+  g_array_set_clear_func (self->hooks, (GDestroyNotify) gum_import_hook_clear);
+  self->interceptor = gum_interceptor_obtain ();
+}
+
+static void
+gum_import_hooker_dispose (GObject * object)
+{
+  GumImportHooker * self = GUM_IMPORT_HOOKER (object);
+
+  gum_import_hooker_revert (self, NULL, NULL);
+
+  G_OBJECT_CLASS (gum_import_hooker_parent_class)->dispose (object);
+}
+
+static void
+gum_import_hooker_finalize (GObject * object)
+{
+  GumImportHooker * self = GUM_IMPORT_HOOKER (object);
+
+  g_object_unref (self->interceptor);
+  g_array_free (self->hooks, TRUE);
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (gum_import_hooker_parent_class)->finalize (object);
+}
+
+GumImportHooker *
+gum_import_hooker_new (void)
+{
+  return g_object_new (GUM_TYPE_IMPORT_HOOKER, NULL);
+}
+
+/*
+ * Points every slot through which `module_name` calls `import_name` at
+ * `replacement`, and returns how many were rewritten. Slots this hooker has
+ * already rewritten are left alone. `original` is set to the function the
+ * first slot resolved to, for the replacement to call.
+ */
+guint
+gum_import_hooker_replace (GumImportHooker * self,
+                           const gchar * module_name,
+                           const gchar * import_name,
+                           gpointer replacement,
+                           gpointer * original)
+{
+  GArray * slots;
+  guint n_rewritten, i;
+
+  if (original != NULL)
+    *original = NULL;
+
+  slots = gum_import_hooker_collect_slots (self, module_name, import_name);
+
+  GUM_IMPORT_HOOKER_LOCK (self);
+
+  n_rewritten = 0;
+  for (i = 0; i != slots->len; i++)
+  {
+    GumImportSlot * s = &g_array_index (slots, GumImportSlot, i);
+
+    if (original != NULL && *original == NULL)
+      *original = s->target;
+
+    if (gum_import_hooker_is_hooking (self, s->slot))
+      continue;
+
+    gum_import_hooker_add_hook (self, module_name, import_name, s->slot,
+        replacement);
+    n_rewritten++;
+  }
+
+  GUM_IMPORT_HOOKER_UNLOCK (self);
+
+  g_array_free (slots, TRUE);
+
+  return n_rewritten;
+}
+
+/*
+ * Like gum_interceptor_attach_listener(), except that the listener only sees
+ * the calls made by `module_name`. Returns how many slots were rewritten.
+ * The listener is detached with gum_interceptor_detach_listener() as usual,
+ * which also leaves the rewritten slots calling straight through.
+ */
+guint
+gum_import_hooker_attach_listener (GumImportHooker * self,
+                                   const gchar * module_name,
+                                   const gchar * import_name,
+                                   GumInvocationListener * listener,
+                                   gpointer listener_function_data)
+{
+  GArray * slots;
+  guint n_rewritten, i;
+
+  slots = gum_import_hooker_collect_slots (self, module_name, import_name);
+
+  GUM_IMPORT_HOOKER_LOCK (self);
+
+  n_rewritten = 0;
+  for (i = 0; i != slots->len; i++)
+  {
+    GumImportSlot * s = &g_array_index (slots, GumImportSlot, i);
+    gpointer stub;
+    GumAttachReturn attach_ret;
+
+    if (gum_import_hooker_is_hooking (self, s->slot))
+      continue;
+
+    stub = gum_import_stub_obtain (s->target);
+
+    attach_ret = gum_interceptor_attach_listener (self->interceptor, stub,
+        listener, listener_function_data);
+    if (attach_ret != GUM_ATTACH_OK &&
+        attach_ret != GUM_ATTACH_ALREADY_ATTACHED)
+    {
+      continue;
+    }
+
+    gum_import_hooker_add_hook (self, module_name, import_name, s->slot,
+        stub);
+    n_rewritten++;
+  }
+
+  GUM_IMPORT_HOOKER_UNLOCK (self);
+
+  g_array_free (slots, TRUE);
+
+  return n_rewritten;
+}
+
+/*
+ * Restores the slots rewritten for `import_name` in `module_name`, where
+ * NULL matches any.
+ */
+void
+gum_import_hooker_revert (GumImportHooker * self,
+                          const gchar * module_name,
+                          const gchar * import_name)
+{
+  guint i;
+
+  GUM_IMPORT_HOOKER_LOCK (self);
+
+  i = 0;
+  while (i != self->hooks->len)
+  {
+    GumImportHook * hook = &g_array_index (self->hooks, GumImportHook, i);
+
+    if ((module_name == NULL || strcmp (hook->module_name, module_name) == 0) &&
+        (import_name == NULL || strcmp (hook->import_name, import_name) == 0))
+    {
+      gum_write_slot (hook->slot, hook->previous_value);
+      g_array_remove_index_fast (self->hooks, i);
+    }
+    else
+    {
+      i++;
+    }
+  }
+
+  GUM_IMPORT_HOOKER_UNLOCK (self);
+}
+
+static GArray *
+gum_import_hooker_collect_slots (GumImportHooker * self,
+                                 const gchar * module_name,
+                                 const gchar * import_name)
+{
+  GumCollectSlotsContext ctx;
+
+  ctx.import_name = import_name;
+  ctx.slots = g_array_new (FALSE, FALSE, sizeof (GumImportSlot));
+
+  gum_module_enumerate_imports (module_name, gum_collect_slot, &ctx);
+
+  return ctx.slots;
+}
+
+static gboolean
+gum_collect_slot (const GumImportDetails * details,
+                  gpointer user_data)
+{
+  GumCollectSlotsContext * ctx = user_data;
+  GumImportSlot s;
+
+  if (details->slot == 0 || details->name == NULL ||
+      strcmp (details->name, ctx->import_name) != 0)
+  {
+    return TRUE;
+  }
+
+  s.slot = GSIZE_TO_POINTER (details->slot);
+
+  /*
+   * A lazily bound slot may still point at the dynamic linker's resolver,
+   * which would overwrite it on the first call going through the stub.
+   */
+  s.target = (details->address != 0)
+      ? GSIZE_TO_POINTER (details->address)
+      : *s.slot;
+
+  g_array_append_val (ctx->slots, s);
+
+  return TRUE;
+}
+
+static void
+gum_import_hooker_add_hook (GumImportHooker * self,
+                            const gchar * module_name,
+                            const gchar * import_name,
+                            gpointer * slot,
+                            gpointer value)
+{
+  GumImportHook hook;
+
+  hook.previous_value = *slot;
+  if (!gum_write_slot (slot, value))
+    return;
+
+  hook.module_name = g_strdup (module_name);
+  hook.import_name = g_strdup (import_name);
+  hook.slot = slot;
+  g_array_append_val (self->hooks, hook);
+}
+
+static gboolean
+gum_import_hooker_is_hooking (GumImportHooker * self,
+                              gpointer * slot)
+{
+  guint i;
+
+  for (i = 0; i != self->hooks->len; i++)
+  {
+    if (g_array_index (self->hooks, GumImportHook, i).slot == slot)
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gum_import_hook_clear (GumImportHook * hook)
+{
+  g_free (hook->module_name);
+  g_free (hook->import_name);
+}
+
+/* Slots are often in RELRO or otherwise read-only once bound. */
+static gboolean
+gum_write_slot (gpointer * slot,
+                gpointer value)
+{
+  GumFindProtectionContext ctx;
+  gsize page_size;
+  gpointer page;
+  gboolean writable;
+
+  ctx.address = GUM_ADDRESS (slot);
+  ctx.found = FALSE;
+  gum_process_enumerate_ranges (GUM_PAGE_NO_ACCESS, gum_find_protection,
+      &ctx);
+  if (!ctx.found)
+    return FALSE;
+
+  page_size = gum_query_page_size ();
+  page = GSIZE_TO_POINTER (GPOINTER_TO_SIZE (slot) & ~(page_size - 1));
+
+  writable = (ctx.prot & GUM_PAGE_WRITE) != 0;
+  if (!writable &&
+      !gum_try_mprotect (page, page_size, ctx.prot | GUM_PAGE_WRITE))
+  {
+    return FALSE;
+  }
+
+  g_atomic_pointer_set (slot, value);
+
+  if (!writable)
+    gum_mprotect (page, page_size, ctx.prot);
+
+  return TRUE;
+}
+
+static gboolean
+gum_find_protection (const GumRangeDetails * details,
+                     gpointer user_data)
+{
+  GumFindProtectionContext * ctx = user_data;
+
+  if (!GUM_MEMORY_RANGE_INCLUDES (details->range, ctx->address))
+    return TRUE;
+
+  ctx->prot = details->prot;
+  ctx->found = TRUE;
+
+  return FALSE;
+}
+
+static gpointer
+gum_import_stub_obtain (gpointer target)
+{
+  GumCodeSlice * slice;
+  gpointer stub;
+
+  g_mutex_lock (&gum_import_stub_lock);
+
+  if (gum_import_stub_by_target == NULL)
+  {
+    gum_code_allocator_init (&gum_import_stub_allocator, GUM_IMPORT_STUB_SIZE);
+    gum_import_stub_by_target = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) gum_code_slice_free);
+    _gum_register_destructor (gum_import_stub_deinit);
+  }
+
+  slice = g_hash_table_lookup (gum_import_stub_by_target, target);
+  if (slice == NULL)
+  {
+    slice = gum_code_allocator_alloc_slice (&gum_import_stub_allocator);
+    gum_import_stub_write (slice->data, target);
+    gum_code_allocator_commit (&gum_import_stub_allocator);
+
+    g_hash_table_insert (gum_import_stub_by_target, target, slice);
+  }
+
+#ifdef HAVE_ARM
+  stub = (guint8 *) slice->data + 1;
+#else
+  stub = slice->data;
+#endif
+
+  g_mutex_unlock (&gum_import_stub_lock);
+
+  return stub;
+}
+
+/*
+ * The padding leaves the Interceptor room to redirect the stub without
+ * having to relocate the jump itself.
+ */
+static gpointer
+gum_import_stub_write (gpointer code,
+                       gpointer target)
+{
+#if defined (HAVE_I386)
+  GumX86Writer cw;
+
+  gum_x86_writer_init (&cw, code);
+  while (gum_x86_writer_offset (&cw) != GUM_IMPORT_STUB_PADDING)
+    gum_x86_writer_put_nop (&cw);
+  gum_x86_writer_put_jmp_address (&cw, GUM_ADDRESS (target));
+  gum_x86_writer_flush (&cw);
+  g_assert_cmpuint (gum_x86_writer_offset (&cw), <=, GUM_IMPORT_STUB_SIZE);
+  gum_x86_writer_clear (&cw);
+#elif defined (HAVE_ARM)
+  GumThumbWriter cw;
+
+  gum_thumb_writer_init (&cw, code);
+  while (gum_thumb_writer_offset (&cw) != GUM_IMPORT_STUB_PADDING)
+    gum_thumb_writer_put_nop (&cw);
+  gum_thumb_writer_put_ldr_reg_address (&cw, ARM_REG_PC, GUM_ADDRESS (target));
+  gum_thumb_writer_flush (&cw);
+  g_assert_cmpuint (gum_thumb_writer_offset (&cw), <=, GUM_IMPORT_STUB_SIZE);
+  gum_thumb_writer_clear (&cw);
+#elif defined (HAVE_ARM64)
+  GumArm64Writer cw;
+
+  gum_arm64_writer_init (&cw, code);
+  while (gum_arm64_writer_offset (&cw) != GUM_IMPORT_STUB_PADDING)
+    gum_arm64_writer_put_nop (&cw);
+  gum_arm64_writer_put_ldr_reg_address (&cw, ARM64_REG_X16,
+      GUM_ADDRESS (target));
+  gum_arm64_writer_put_br_reg (&cw, ARM64_REG_X16);
+  gum_arm64_writer_flush (&cw);
+  g_assert_cmpuint (gum_arm64_writer_offset (&cw), <=, GUM_IMPORT_STUB_SIZE);
+  gum_arm64_writer_clear (&cw);
+#elif defined (HAVE_MIPS)
+  GumMipsWriter cw;
+
+  gum_mips_writer_init (&cw, code);
+  while (gum_mips_writer_offset (&cw) != GUM_IMPORT_STUB_PADDING)
+    gum_mips_writer_put_nop (&cw);
+  gum_mips_writer_put_la_reg_address (&cw, MIPS_REG_T9, GUM_ADDRESS (target));
+  gum_mips_writer_put_jr_reg (&cw, MIPS_REG_T9);
+  gum_mips_writer_flush (&cw);
+  g_assert_cmpuint (gum_mips_writer_offset (&cw), <=, GUM_IMPORT_STUB_SIZE);
+  gum_mips_writer_clear (&cw);
+#endif
+
+  return code;
+}
+
+static void
+gum_import_stub_deinit (void)
+{
+  g_hash_table_unref (gum_import_stub_by_target);
+  gum_import_stub_by_target = NULL;
+
+  gum_code_allocator_free (&gum_import_stub_allocator);
+}
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_IMPORT_HOOKER_H__
+#define __GUM_IMPORT_HOOKER_H__
+
+#include <glib-object.h>
+#include <gum/guminterceptor.h>
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_IMPORT_HOOKER (gum_import_hooker_get_type ())
+G_DECLARE_FINAL_TYPE (GumImportHooker, gum_import_hooker, GUM, IMPORT_HOOKER,
+    GObject)
+
+GUM_API GumImportHooker * gum_import_hooker_new (void);
+
+GUM_API guint gum_import_hooker_replace (GumImportHooker * self,
+    const gchar * module_name, const gchar * import_name,
+    gpointer replacement, gpointer * original);
+GUM_API guint gum_import_hooker_attach_listener (GumImportHooker * self,
+    const gchar * module_name, const gchar * import_name,
+    GumInvocationListener * listener, gpointer listener_function_data);
+GUM_API void gum_import_hooker_revert (GumImportHooker * self,
+    const gchar * module_name, const gchar * import_name);
+
+G_END_DECLS
+
+#endif
@@ -17,6 +17,14 @@
 typedef struct _GumInterceptorBackend GumInterceptorBackend;
 typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumFunctionContextBackendData GumFunctionContextBackendData;
+typedef struct _GumProbeEntry GumProbeEntry;
+typedef struct _GumCaptureEntry GumCaptureEntry;
+
+typedef enum
+{
+  GUM_INTERCEPTOR_TYPE_DEFAULT,
+  GUM_INTERCEPTOR_TYPE_FAST
+} GumInterceptorType;
 
 struct _GumFunctionContextBackendData
 {
@@ -26,10 +34,12 @@ struct _GumFunctionContextBackendData
 struct _GumFunctionContext
 {
   gpointer function_address;
+  GumInterceptorType type;
 
   gboolean destroyed;
   gboolean activated;
   gboolean has_on_leave_listener;
+  gboolean thread_filtered;
 
   GumCodeSlice * trampoline_slice;
   GumCodeDeflector * trampoline_deflector;
@@ -44,17 +54,32 @@ struct _GumFunctionContext
   gpointer on_leave_trampoline;
 
   volatile GPtrArray * listener_entries;
+  GArray * volatile enter_calls;
+  GArray * volatile leave_calls;
+
+  GumProbeEntry * volatile probe_entry;
+  GumCaptureEntry * volatile capture_entry;
+  gboolean enter_only;
 
   gpointer replacement_function;
   gpointer replacement_function_data;
 
   GumFunctionContextBackendData backend_data;
 
+  guint statistics_index;
+  guint statistics_id;
+
   GumInterceptor * interceptor;
 };
 
 G_GNUC_INTERNAL void _gum_interceptor_init (void);
 G_GNUC_INTERNAL void _gum_interceptor_deinit (void);
+G_GNUC_INTERNAL void _gum_interceptor_prepare_to_fork (void);
+G_GNUC_INTERNAL void _gum_interceptor_recover_from_fork_in_parent (void);
+G_GNUC_INTERNAL void _gum_interceptor_recover_from_fork_in_child (void);
+G_GNUC_INTERNAL void _gum_interceptor_keep_alive (gboolean enabled);
+G_GNUC_INTERNAL void _gum_interceptor_ignore_current_thread (void);
+G_GNUC_INTERNAL void _gum_interceptor_unignore_current_thread (void);
 
 G_GNUC_INTERNAL void _gum_function_context_begin_invocation (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context,
@@ -83,8 +108,14 @@ G_GNUC_INTERNAL gpointer _gum_interceptor_backend_resolve_redirect (
 G_GNUC_INTERNAL gboolean _gum_interceptor_backend_can_intercept (
     GumInterceptorBackend * self, gpointer function_address);
 
+G_GNUC_INTERNAL void _gum_interceptor_write_code (gpointer destination,
+    gconstpointer code, gsize size);
+
 G_GNUC_INTERNAL gpointer _gum_interceptor_peek_top_caller_return_address (void);
 G_GNUC_INTERNAL gpointer _gum_interceptor_translate_top_return_address (
     gpointer return_address);
+G_GNUC_INTERNAL gpointer _gum_interceptor_peek_original_function (
+    GumInterceptor * self, gpointer function_address,
+    gpointer * hooked_address);
 
 #endif
@@ -9,10 +9,12 @@
 
 #include "guminterceptor-priv.h"
 
+#include "gum-init.h"
 #include "gumcodesegment.h"
 #include "gumlibc.h"
 #include "gummemory.h"
 #include "gumprocess.h"
+#include "gumtimestamp.h"
 #include "gumtls.h"
 
 #include <string.h>
@@ -23,6 +25,13 @@
 #define GUM_INTERCEPTOR_CODE_SLICE_SIZE 256
 #endif
 
+#define GUM_STATISTICS_CHUNK_SIZE 256
+#define GUM_STATISTICS_MAX_CHUNKS 256
+#define GUM_STATISTICS_INDEX_NONE G_MAXUINT
+
+#define GUM_CAPTURE_RING_CAPACITY 1024
+#define GUM_CAPTURE_EXITED_LIMIT (16 * GUM_CAPTURE_RING_CAPACITY)
+
 #define GUM_INTERCEPTOR_LOCK(o) g_rec_mutex_lock (&(o)->mutex)
 #define GUM_INTERCEPTOR_UNLOCK(o) g_rec_mutex_unlock (&(o)->mutex)
 
@@ -30,10 +39,14 @@ typedef struct _GumInterceptorTransaction GumInterceptorTransaction;
 typedef struct _GumDestroyTask GumDestroyTask;
 typedef struct _GumPrologueWrite GumPrologueWrite;
 typedef struct _ListenerEntry ListenerEntry;
+typedef struct _ListenerCall ListenerCall;
+typedef struct _ListenerThreadFilter ListenerThreadFilter;
 typedef struct _InterceptorThreadContext InterceptorThreadContext;
 typedef struct _GumInvocationStackEntry GumInvocationStackEntry;
 typedef struct _ListenerDataSlot ListenerDataSlot;
+typedef struct _GumFunctionStatisticsShard GumFunctionStatisticsShard;
 typedef struct _ListenerInvocationState ListenerInvocationState;
+typedef struct _GumCaptureRing GumCaptureRing;
 
 typedef void (* GumPrologueWriteFunc) (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
@@ -55,12 +68,19 @@ struct _GumInterceptor
   GRecMutex mutex;
 
   GHashTable * function_by_address;
+  GPtrArray * listener_data_owners;
+  GHashTable * thread_filter_by_listener;
 
   GumInterceptorBackend * backend;
   GumCodeAllocator allocator;
 
   volatile guint selected_thread_id;
 
+  volatile gboolean statistics_enabled;
+  GArray * free_statistics_indices;
+  guint next_statistics_index;
+  guint next_statistics_id;
+
   GumInterceptorTransaction current_transaction;
 };
 
@@ -82,6 +102,46 @@ struct _ListenerEntry
   GumInvocationListenerInterface * listener_interface;
   GumInvocationListener * listener_instance;
   gpointer function_data;
+  guint listener_data_index;
+  ListenerThreadFilter * thread_filter;
+};
+
+/*
+ * Never modified once created, only replaced, so each thread can remember
+ * its verdict for the filter's id.
+ */
+struct _ListenerThreadFilter
+{
+  volatile gint ref_count;
+  guint id;
+  GHashTable * thread_ids;
+};
+
+struct _ListenerCall
+{
+  void (* callback) (GumInvocationListener * self,
+      GumInvocationContext * context);
+  ListenerEntry entry;
+  guint listener_index;
+};
+
+struct _GumProbeEntry
+{
+  GumInterceptorProbeCallback callback;
+  gpointer user_data;
+};
+
+struct _GumCaptureEntry
+{
+  guint n_args;
+  gboolean capture_return;
+};
+
+struct _GumCaptureRing
+{
+  volatile guint head;
+  volatile guint tail;
+  GumCapturedCall records[GUM_CAPTURE_RING_CAPACITY];
 };
 
 struct _InterceptorThreadContext
@@ -90,10 +150,16 @@ struct _InterceptorThreadContext
   GumInvocationBackend replacement_backend;
 
   gint ignore_level;
+  GumThreadId thread_id;
 
   GumInvocationStack * stack;
+  GByteArray * invocation_data;
 
   GArray * listener_data_slots;
+
+  GumFunctionStatisticsShard * volatile statistics[GUM_STATISTICS_MAX_CHUNKS];
+
+  GumCaptureRing * volatile capture_ring;
 };
 
 struct _GumInvocationStackEntry
@@ -102,16 +168,32 @@ struct _GumInvocationStackEntry
   gpointer caller_ret_addr;
   GumInvocationContext invocation_context;
   GumCpuContext cpu_context;
-  guint8 listener_invocation_data[GUM_MAX_LISTENERS_PER_FUNCTION]
-      [GUM_MAX_LISTENER_DATA];
+  guint listener_invocation_data_offset[GUM_MAX_LISTENERS_PER_FUNCTION];
+  guint listener_invocation_data_size[GUM_MAX_LISTENERS_PER_FUNCTION];
+  guint listener_invocation_data_end;
+  guint listener_invocation_data_used;
   gboolean calling_replacement;
   gint original_system_error;
+  gboolean capture_pending;
+  guint capture_n_args;
+  guint64 capture_timestamp;
+  gpointer capture_args[GUM_CAPTURE_MAX_ARGS];
 };
 
 struct _ListenerDataSlot
 {
   GumInvocationListener * owner;
   guint8 data[GUM_MAX_LISTENER_DATA];
+  guint thread_filter_id;
+  gboolean thread_selected;
+};
+
+struct _GumFunctionStatisticsShard
+{
+  guint id;
+  guint64 calls;
+  guint64 bypassed_calls;
+  guint64 listener_time;
 };
 
 struct _ListenerInvocationState
@@ -119,17 +201,28 @@ struct _ListenerInvocationState
   GumPointCut point_cut;
   ListenerEntry * entry;
   InterceptorThreadContext * interceptor_ctx;
-  guint8 * invocation_data;
+  GumInvocationStackEntry * stack_entry;
+  guint listener_index;
 };
 
 static void gum_interceptor_dispose (GObject * object);
 static void gum_interceptor_finalize (GObject * object);
 
+static void gum_interceptor_release_fork_locks (void);
 static void the_interceptor_weak_notify (gpointer data,
     GObject * where_the_object_was);
 
+static GumAttachReturn gum_interceptor_do_attach_listener (
+    GumInterceptor * self, gpointer function_address,
+    GumInvocationListener * listener, gpointer listener_function_data);
+static guint gum_interceptor_claim_listener_data_index (GumInterceptor * self,
+    GumInvocationListener * listener);
+static gint gum_interceptor_find_listener_data_index (GumInterceptor * self,
+    GumInvocationListener * listener);
 static GumFunctionContext * gum_interceptor_instrument (GumInterceptor * self,
     gpointer function_address);
+static void gum_interceptor_assign_statistics_index (GumInterceptor * self,
+    GumFunctionContext * ctx);
 static void gum_interceptor_activate (GumInterceptor * self,
     GumFunctionContext * ctx, gpointer prologue);
 static void gum_interceptor_deactivate (GumInterceptor * self,
@@ -163,15 +256,45 @@ static void gum_function_context_add_listener (
 static void gum_function_context_remove_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static void listener_entry_free (ListenerEntry * entry);
+static gboolean gum_function_context_update_thread_filter (
+    GumFunctionContext * function_ctx, GumInvocationListener * listener,
+    ListenerThreadFilter * filter);
+static gboolean gum_function_context_selects_current_thread (
+    GumFunctionContext * function_ctx, InterceptorThreadContext * thread_ctx);
+static void gum_function_context_update_calls (
+    GumFunctionContext * function_ctx);
+static GArray * listener_call_array_new (void);
 static gboolean gum_function_context_has_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_listener (
     GumFunctionContext * function_ctx, GumInvocationListener * listener);
 static ListenerEntry ** gum_function_context_find_taken_listener_slot (
     GumFunctionContext * function_ctx);
+static void gum_function_context_update_enter_only (
+    GumFunctionContext * function_ctx);
+static void gum_function_context_invoke_probe (
+    GumFunctionContext * function_ctx, GumCpuContext * cpu_context);
+static void probe_entry_free (GumProbeEntry * entry);
+static void gum_function_context_capture_enter (
+    GumFunctionContext * function_ctx, GumCaptureEntry * capture,
+    InterceptorThreadContext * interceptor_ctx, GumCpuContext * cpu_context,
+    GumInvocationStackEntry * stack_entry);
+static void gum_function_context_capture_leave (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * interceptor_ctx, GumCpuContext * cpu_context,
+    GumInvocationStackEntry * stack_entry);
+static void capture_entry_free (GumCaptureEntry * entry);
 static void gum_function_context_fixup_cpu_context (
     GumFunctionContext * function_ctx, GumCpuContext * cpu_context);
 
+static void gum_interceptor_replace_thread_filter (GumInterceptor * self,
+    GumInvocationListener * listener, ListenerThreadFilter * filter);
+static ListenerThreadFilter * listener_thread_filter_new (
+    ListenerThreadFilter * base);
+static ListenerThreadFilter * listener_thread_filter_ref (
+    ListenerThreadFilter * filter);
+static void listener_thread_filter_unref (ListenerThreadFilter * filter);
+
 static InterceptorThreadContext * get_interceptor_thread_context (void);
 static void release_interceptor_thread_context (
     InterceptorThreadContext * context);
@@ -179,10 +302,22 @@ static InterceptorThreadContext * interceptor_thread_context_new (void);
 static void interceptor_thread_context_destroy (
     InterceptorThreadContext * context);
 static gpointer interceptor_thread_context_get_listener_data (
-    InterceptorThreadContext * self, GumInvocationListener * listener,
+    InterceptorThreadContext * self, ListenerEntry * entry,
     gsize required_size);
+static gboolean interceptor_thread_context_selects (
+    InterceptorThreadContext * self, const ListenerEntry * entry);
 static void interceptor_thread_context_forget_listener_data (
-    InterceptorThreadContext * self, GumInvocationListener * listener);
+    InterceptorThreadContext * self, guint listener_data_index);
+static GumCapturedCall * interceptor_thread_context_reserve_capture (
+    InterceptorThreadContext * self);
+static void interceptor_thread_context_commit_capture (
+    InterceptorThreadContext * self);
+static void interceptor_thread_context_salvage_captures (
+    InterceptorThreadContext * self);
+static guint gum_capture_ring_drain (GumCaptureRing * ring,
+    GumCapturedCall * calls, guint max_calls);
+static GumFunctionStatisticsShard * interceptor_thread_context_get_statistics (
+    InterceptorThreadContext * self, GumFunctionContext * function_ctx);
 static GumInvocationStackEntry * gum_invocation_stack_push (
     GumInvocationStack * stack, GumFunctionContext * function_ctx,
     gpointer caller_ret_addr);
@@ -196,17 +331,26 @@ static gboolean gum_interceptor_has (GumInterceptor * self,
     gpointer function_address);
 
 static gpointer gum_page_address_from_pointer (gpointer ptr);
+static GList * gum_page_run_end (GList * pages, guint page_size,
+    gsize * run_size);
 static gint gum_page_address_compare (gconstpointer a, gconstpointer b);
 
 G_DEFINE_TYPE (GumInterceptor, gum_interceptor, G_TYPE_OBJECT)
 
 static GMutex _gum_interceptor_lock;
 static GumInterceptor * _the_interceptor = NULL;
+static gboolean gum_interceptor_keep_alive_enabled = FALSE;
+static GumInterceptor * gum_interceptor_kept_alive = NULL;
+static GumInterceptor * gum_interceptor_locked_for_fork = NULL;
 
 static GumSpinlock gum_interceptor_thread_context_lock;
 static GHashTable * gum_interceptor_thread_contexts;
+static GSList * gum_interceptor_orphaned_thread_contexts = NULL;
+static GArray * gum_interceptor_exited_captures = NULL;
+static volatile gint gum_interceptor_dropped_capture_count = 0;
 static GPrivate gum_interceptor_context_private =
     G_PRIVATE_INIT ((GDestroyNotify) release_interceptor_thread_context);
+static GumTlsKey gum_interceptor_context_key;
 static GumTlsKey gum_interceptor_guard_key;
 
 static GumInvocationStack _gum_interceptor_empty_stack = { NULL, 0 };
@@ -227,6 +371,7 @@ _gum_interceptor_init (void)
   gum_interceptor_thread_contexts = g_hash_table_new_full (NULL, NULL,
       (GDestroyNotify) interceptor_thread_context_destroy, NULL);
 
+  gum_interceptor_context_key = gum_tls_key_new ();
   gum_interceptor_guard_key = gum_tls_key_new ();
 }
 
@@ -234,13 +379,90 @@ void
 _gum_interceptor_deinit (void)
 {
   gum_tls_key_free (gum_interceptor_guard_key);
+  gum_tls_key_free (gum_interceptor_context_key);
 
   g_hash_table_unref (gum_interceptor_thread_contexts);
   gum_interceptor_thread_contexts = NULL;
 
+  g_slist_free_full (gum_interceptor_orphaned_thread_contexts,
+      (GDestroyNotify) g_hash_table_unref);
+  gum_interceptor_orphaned_thread_contexts = NULL;
+
+  g_clear_pointer (&gum_interceptor_exited_captures, g_array_unref);
+
   gum_spinlock_free (&gum_interceptor_thread_context_lock);
 }
 
+/*
+ * Holds on to the Interceptor's locks until the fork is over, so they are
+ * never copied into the child while some other thread has them taken.
+ */
+void
+_gum_interceptor_prepare_to_fork (void)
+{
+  g_mutex_lock (&_gum_interceptor_lock);
+
+  gum_interceptor_locked_for_fork = _the_interceptor;
+  if (gum_interceptor_locked_for_fork != NULL)
+    GUM_INTERCEPTOR_LOCK (gum_interceptor_locked_for_fork);
+}
+
+void
+_gum_interceptor_recover_from_fork_in_parent (void)
+{
+  gum_interceptor_release_fork_locks ();
+}
+
+/*
+ * The contexts of the threads that did not survive the fork are set aside as
+ * a whole, to be freed along with the rest of us, so this takes the same time
+ * no matter how many threads there were.
+ */
+void
+_gum_interceptor_recover_from_fork_in_child (void)
+{
+  InterceptorThreadContext * context;
+  GArray * slots;
+  guint i;
+
+  gum_spinlock_init (&gum_interceptor_thread_context_lock);
+
+  context = gum_tls_key_get_value (gum_interceptor_context_key);
+  if (context != NULL)
+  {
+    g_hash_table_steal (gum_interceptor_thread_contexts, context);
+
+    context->thread_id = gum_process_get_current_thread_id ();
+
+    slots = context->listener_data_slots;
+    for (i = 0; i != slots->len; i++)
+      g_array_index (slots, ListenerDataSlot, i).thread_filter_id = 0;
+  }
+
+  gum_interceptor_orphaned_thread_contexts = g_slist_prepend (
+      gum_interceptor_orphaned_thread_contexts,
+      gum_interceptor_thread_contexts);
+  gum_interceptor_thread_contexts = g_hash_table_new_full (NULL, NULL,
+      (GDestroyNotify) interceptor_thread_context_destroy, NULL);
+
+  if (context != NULL)
+    g_hash_table_add (gum_interceptor_thread_contexts, context);
+
+  gum_interceptor_release_fork_locks ();
+}
+
+static void
+gum_interceptor_release_fork_locks (void)
+{
+  if (gum_interceptor_locked_for_fork != NULL)
+  {
+    GUM_INTERCEPTOR_UNLOCK (gum_interceptor_locked_for_fork);
+    gum_interceptor_locked_for_fork = NULL;
+  }
+
+  g_mutex_unlock (&_gum_interceptor_lock);
+}
+
 static void
 gum_interceptor_init (GumInterceptor * self)
 {
@@ -248,6 +470,12 @@ gum_interceptor_init (GumInterceptor * self)
 
   self->function_by_address = g_hash_table_new_full (NULL, NULL, NULL,
       (GDestroyNotify) gum_function_context_destroy);
+  self->listener_data_owners = g_ptr_array_new ();
+  self->thread_filter_by_listener = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) listener_thread_filter_unref);
+
+  self->free_statistics_indices = g_array_new (FALSE, FALSE, sizeof (guint));
+  self->next_statistics_id = 1;
 
   gum_code_allocator_init (&self->allocator, GUM_INTERCEPTOR_CODE_SLICE_SIZE);
   self->backend = _gum_interceptor_backend_create (&self->allocator);
@@ -284,6 +512,9 @@ gum_interceptor_finalize (GObject * object)
   g_rec_mutex_clear (&self->mutex);
 
   g_hash_table_unref (self->function_by_address);
+  g_ptr_array_unref (self->listener_data_owners);
+  g_hash_table_unref (self->thread_filter_by_listener);
+  g_array_free (self->free_statistics_indices, TRUE);
 
   gum_code_allocator_free (&self->allocator);
 
@@ -303,11 +534,23 @@ gum_interceptor_obtain (void)
   }
   else
   {
+    gint64 start_time;
+
+    start_time = g_get_monotonic_time ();
+
     _the_interceptor = g_object_new (GUM_TYPE_INTERCEPTOR, NULL);
     g_object_weak_ref (G_OBJECT (_the_interceptor),
         the_interceptor_weak_notify, NULL);
 
     interceptor = _the_interceptor;
+
+    if (gum_interceptor_keep_alive_enabled &&
+        gum_interceptor_kept_alive == NULL)
+    {
+      gum_interceptor_kept_alive = g_object_ref (interceptor);
+    }
+
+    _gum_record_init_timing ("interceptor", start_time);
   }
 
   g_mutex_unlock (&_gum_interceptor_lock);
@@ -315,6 +558,29 @@ gum_interceptor_obtain (void)
   return interceptor;
 }
 
+/*
+ * While enabled, the first Interceptor to be obtained is held on to until
+ * this is disabled again, instead of going away along with its last user.
+ */
+void
+_gum_interceptor_keep_alive (gboolean enabled)
+{
+  GumInterceptor * kept_alive;
+
+  g_mutex_lock (&_gum_interceptor_lock);
+
+  gum_interceptor_keep_alive_enabled = enabled;
+
+  kept_alive = enabled ? NULL : gum_interceptor_kept_alive;
+  if (!enabled)
+    gum_interceptor_kept_alive = NULL;
+
+  g_mutex_unlock (&_gum_interceptor_lock);
+
+  if (kept_alive != NULL)
+    g_object_unref (kept_alive);
+}
+
 static void
 the_interceptor_weak_notify (gpointer data,
                              GObject * where_the_object_was)
@@ -332,9 +598,231 @@ gum_interceptor_attach_listener (GumInterceptor * self,
                                  gpointer function_address,
                                  GumInvocationListener * listener,
                                  gpointer listener_function_data)
+{
+  GumAttachReturn result;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    return GUM_ATTACH_POLICY_VIOLATION;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  result = gum_interceptor_do_attach_listener (self, function_address,
+      listener, listener_function_data);
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+
+  return result;
+}
+
+/*
+ * Attaches the same listener to many functions under a single lock and
+ * transaction, so their trampolines get committed together and each
+ * affected page is made writable, patched and flushed only once. Returns
+ * how many were attached, and if results is non-NULL it receives one status
+ * per function.
+ */
+guint
+gum_interceptor_attach_many (GumInterceptor * self,
+                             const gpointer * function_addresses,
+                             guint n_functions,
+                             GumInvocationListener * listener,
+                             gpointer listener_function_data,
+                             GumAttachReturn * results)
+{
+  guint n_attached = 0;
+  guint i;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+  {
+    if (results != NULL)
+    {
+      for (i = 0; i != n_functions; i++)
+        results[i] = GUM_ATTACH_POLICY_VIOLATION;
+    }
+
+    return 0;
+  }
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  for (i = 0; i != n_functions; i++)
+  {
+    GumAttachReturn result;
+
+    result = gum_interceptor_do_attach_listener (self, function_addresses[i],
+        listener, listener_function_data);
+    if (result == GUM_ATTACH_OK)
+      n_attached++;
+
+    if (results != NULL)
+      results[i] = result;
+  }
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+
+  return n_attached;
+}
+
+/*
+ * Each listener gets a small index while it is attached, used to look up its
+ * per-thread data without searching. Indexes are handed out lowest first and
+ * reused once the listener is detached.
+ */
+static guint
+gum_interceptor_claim_listener_data_index (GumInterceptor * self,
+                                           GumInvocationListener * listener)
+{
+  GPtrArray * owners = self->listener_data_owners;
+  gint index;
+  guint i;
+
+  index = gum_interceptor_find_listener_data_index (self, listener);
+  if (index != -1)
+    return index;
+
+  for (i = 0; i != owners->len; i++)
+  {
+    if (g_ptr_array_index (owners, i) == NULL)
+    {
+      g_ptr_array_index (owners, i) = listener;
+      return i;
+    }
+  }
+
+  g_ptr_array_add (owners, listener);
+
+  return owners->len - 1;
+}
+
+static gint
+gum_interceptor_find_listener_data_index (GumInterceptor * self,
+                                          GumInvocationListener * listener)
+{
+  GPtrArray * owners = self->listener_data_owners;
+  guint i;
+
+  for (i = 0; i != owners->len; i++)
+  {
+    if (g_ptr_array_index (owners, i) == listener)
+      return i;
+  }
+
+  return -1;
+}
+
+static GumAttachReturn
+gum_interceptor_do_attach_listener (GumInterceptor * self,
+                                    gpointer function_address,
+                                    GumInvocationListener * listener,
+                                    gpointer listener_function_data)
+{
+  GumFunctionContext * function_ctx;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address);
+  if (function_ctx == NULL)
+    return GUM_ATTACH_WRONG_SIGNATURE;
+
+  if (gum_function_context_has_listener (function_ctx, listener))
+    return GUM_ATTACH_ALREADY_ATTACHED;
+
+  gum_function_context_add_listener (function_ctx, listener,
+      listener_function_data);
+
+  return GUM_ATTACH_OK;
+}
+
+void
+gum_interceptor_detach_listener (GumInterceptor * self,
+                                 GumInvocationListener * listener)
+{
+  GHashTableIter iter;
+  GumFunctionContext * function_ctx;
+  ListenerThreadFilter * thread_filter;
+  gint listener_data_index;
+  InterceptorThreadContext * thread_ctx;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  thread_filter = g_hash_table_lookup (self->thread_filter_by_listener,
+      listener);
+
+  g_hash_table_iter_init (&iter, self->function_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
+  {
+    if (gum_function_context_has_listener (function_ctx, listener))
+    {
+      gum_function_context_remove_listener (function_ctx, listener);
+
+      gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
+          function_ctx, g_object_unref, g_object_ref (listener));
+      if (thread_filter != NULL)
+      {
+        gum_interceptor_transaction_schedule_destroy (
+            &self->current_transaction, function_ctx,
+            (GDestroyNotify) listener_thread_filter_unref,
+            listener_thread_filter_ref (thread_filter));
+      }
+
+      if (gum_function_context_is_empty (function_ctx))
+      {
+        g_hash_table_iter_remove (&iter);
+      }
+    }
+  }
+
+  listener_data_index = gum_interceptor_find_listener_data_index (self,
+      listener);
+  if (listener_data_index != -1)
+  {
+    gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+    g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+    {
+      interceptor_thread_context_forget_listener_data (thread_ctx,
+          listener_data_index);
+    }
+    gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+    g_ptr_array_index (self->listener_data_owners, listener_data_index) = NULL;
+  }
+
+  g_hash_table_remove (self->thread_filter_by_listener, listener);
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
+
+/*
+ * A probe is a bare callback that runs on entry to the function. When it is
+ * all that is attached, calls take a short path that skips the invocation
+ * stack and per-thread bookkeeping, so it also ignores
+ * gum_interceptor_ignore_current_thread() and friends.
+ */
+GumAttachReturn
+gum_interceptor_attach_probe (GumInterceptor * self,
+                              gpointer function_address,
+                              GumInterceptorProbeCallback callback,
+                              gpointer user_data)
 {
   GumAttachReturn result = GUM_ATTACH_OK;
   GumFunctionContext * function_ctx;
+  GumProbeEntry * entry;
 
   if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
     goto policy_violation;
@@ -350,11 +838,15 @@ gum_interceptor_attach_listener (GumInterceptor * self,
   if (function_ctx == NULL)
     goto wrong_signature;
 
-  if (gum_function_context_has_listener (function_ctx, listener))
+  if (function_ctx->probe_entry != NULL)
     goto already_attached;
 
-  gum_function_context_add_listener (function_ctx, listener,
-      listener_function_data);
+  entry = g_slice_new (GumProbeEntry);
+  entry->callback = callback;
+  entry->user_data = user_data;
+  g_atomic_pointer_set (&function_ctx->probe_entry, entry);
+
+  gum_function_context_update_enter_only (function_ctx);
 
   goto beach;
 
@@ -383,51 +875,285 @@ beach:
 }
 
 void
-gum_interceptor_detach_listener (GumInterceptor * self,
-                                 GumInvocationListener * listener)
+gum_interceptor_detach_probe (GumInterceptor * self,
+                              gpointer function_address)
 {
-  GHashTableIter iter;
   GumFunctionContext * function_ctx;
-  InterceptorThreadContext * thread_ctx;
+  GumProbeEntry * entry;
 
   gum_interceptor_ignore_current_thread (self);
   GUM_INTERCEPTOR_LOCK (self);
   gum_interceptor_transaction_begin (&self->current_transaction);
   self->current_transaction.is_dirty = TRUE;
 
-  g_hash_table_iter_init (&iter, self->function_by_address);
-  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx == NULL)
+    goto beach;
+
+  entry = function_ctx->probe_entry;
+  if (entry == NULL)
+    goto beach;
+
+  g_atomic_pointer_set (&function_ctx->probe_entry, NULL);
+  gum_function_context_update_enter_only (function_ctx);
+
+  gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
+      function_ctx, (GDestroyNotify) probe_entry_free, entry);
+
+  if (gum_function_context_is_empty (function_ctx))
   {
-    if (gum_function_context_has_listener (function_ctx, listener))
-    {
-      gum_function_context_remove_listener (function_ctx, listener);
+    g_hash_table_remove (self->function_by_address, function_address);
+  }
 
-      gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
-          function_ctx, g_object_unref, g_object_ref (listener));
+beach:
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
 
-      if (gum_function_context_is_empty (function_ctx))
-      {
-        g_hash_table_iter_remove (&iter);
-      }
-    }
+/*
+ * A capture records the first `n_args` arguments of each call, and with
+ * `capture_return` also its return value, as one GumCapturedCall in a ring
+ * owned by the calling thread, to be collected later through
+ * gum_interceptor_drain_captures(). No callback runs, and without the return
+ * value calls take the same short path as probes. Recording the return value
+ * still needs an invocation stack entry to keep the caller's return address
+ * in, but nothing else of the listener machinery.
+ */
+GumAttachReturn
+gum_interceptor_attach_capture (GumInterceptor * self,
+                                gpointer function_address,
+                                guint n_args,
+                                gboolean capture_return)
+{
+  GumAttachReturn result = GUM_ATTACH_OK;
+  GumFunctionContext * function_ctx;
+  GumCaptureEntry * entry;
+
+  g_return_val_if_fail (n_args <= GUM_CAPTURE_MAX_ARGS,
+      GUM_ATTACH_WRONG_SIGNATURE);
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    goto policy_violation;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address);
+  if (function_ctx == NULL)
+    goto wrong_signature;
+
+  if (function_ctx->capture_entry != NULL)
+    goto already_attached;
+
+  entry = g_slice_new (GumCaptureEntry);
+  entry->n_args = n_args;
+  entry->capture_return = capture_return;
+  g_atomic_pointer_set (&function_ctx->capture_entry, entry);
+
+  gum_function_context_update_enter_only (function_ctx);
+
+  goto beach;
+
+policy_violation:
+  {
+    return GUM_ATTACH_POLICY_VIOLATION;
+  }
+wrong_signature:
+  {
+    result = GUM_ATTACH_WRONG_SIGNATURE;
+    goto beach;
+  }
+already_attached:
+  {
+    result = GUM_ATTACH_ALREADY_ATTACHED;
+    goto beach;
+  }
+beach:
+  {
+    gum_interceptor_transaction_end (&self->current_transaction);
+    GUM_INTERCEPTOR_UNLOCK (self);
+    gum_interceptor_unignore_current_thread (self);
+
+    return result;
+  }
+}
+
+/* Calls captured so far stay in the rings until drained. */
+void
+gum_interceptor_detach_capture (GumInterceptor * self,
+                                gpointer function_address)
+{
+  GumFunctionContext * function_ctx;
+  GumCaptureEntry * entry;
+
+  gum_interceptor_ignore_current_thread (self);
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx == NULL)
+    goto beach;
+
+  entry = function_ctx->capture_entry;
+  if (entry == NULL)
+    goto beach;
+
+  g_atomic_pointer_set (&function_ctx->capture_entry, NULL);
+  gum_function_context_update_enter_only (function_ctx);
+
+  gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
+      function_ctx, (GDestroyNotify) capture_entry_free, entry);
+
+  if (gum_function_context_is_empty (function_ctx))
+  {
+    g_hash_table_remove (self->function_by_address, function_address);
+  }
+
+beach:
+  gum_interceptor_transaction_end (&self->current_transaction);
+  GUM_INTERCEPTOR_UNLOCK (self);
+  gum_interceptor_unignore_current_thread (self);
+}
+
+/*
+ * Moves up to `max_calls` captured calls into `calls`, and returns how many
+ * were moved. Calls of the same thread come out in the order they were
+ * recorded, but threads are visited one after the other, so a caller should
+ * keep draining until fewer than `max_calls` come back. Calls recorded by
+ * threads that have since exited are kept until drained, up to a limit.
+ * Timestamps are converted to nanoseconds on the way out.
+ */
+guint
+gum_interceptor_drain_captures (GumInterceptor * self,
+                                GumCapturedCall * calls,
+                                guint max_calls)
+{
+  guint n = 0;
+  GHashTableIter iter;
+  InterceptorThreadContext * thread_ctx;
+  guint i;
+
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+
+  if (gum_interceptor_exited_captures != NULL)
+  {
+    GArray * exited = gum_interceptor_exited_captures;
+
+    n = MIN (exited->len, max_calls);
+    memcpy (calls, exited->data, n * sizeof (GumCapturedCall));
+    g_array_remove_range (exited, 0, n);
+  }
+
+  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
+  while (n != max_calls &&
+      g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
+  {
+    GumCaptureRing * ring;
+
+    ring = g_atomic_pointer_get (&thread_ctx->capture_ring);
+    if (ring == NULL)
+      continue;
+
+    n += gum_capture_ring_drain (ring, calls + n, max_calls - n);
+  }
+
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+
+  for (i = 0; i != n; i++)
+    calls[i].timestamp = gum_timestamp_to_nanoseconds (calls[i].timestamp);
+
+  return n;
+}
+
+/* Calls that did not fit in their thread's ring, counted across threads. */
+guint
+gum_interceptor_get_dropped_capture_count (GumInterceptor * self)
+{
+  return g_atomic_int_get (&gum_interceptor_dropped_capture_count);
+}
+
+GumReplaceReturn
+gum_interceptor_replace_function (GumInterceptor * self,
+                                  gpointer function_address,
+                                  gpointer replacement_function,
+                                  gpointer replacement_function_data)
+{
+  GumReplaceReturn result = GUM_REPLACE_OK;
+  GumFunctionContext * function_ctx;
+
+  if (gum_process_get_code_signing_policy () == GUM_CODE_SIGNING_REQUIRED)
+    goto policy_violation;
+
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = gum_interceptor_instrument (self, function_address);
+  if (function_ctx == NULL)
+    goto wrong_signature;
+
+  if (function_ctx->replacement_function != NULL)
+    goto already_replaced;
+
+  function_ctx->replacement_function_data = replacement_function_data;
+  function_ctx->replacement_function = replacement_function;
+  gum_function_context_update_enter_only (function_ctx);
+
+  goto beach;
+
+policy_violation:
+  {
+    return GUM_REPLACE_POLICY_VIOLATION;
+  }
+wrong_signature:
+  {
+    result = GUM_REPLACE_WRONG_SIGNATURE;
+    goto beach;
+  }
+already_replaced:
+  {
+    result = GUM_REPLACE_ALREADY_REPLACED;
+    goto beach;
   }
+beach:
+  {
+    gum_interceptor_transaction_end (&self->current_transaction);
+    GUM_INTERCEPTOR_UNLOCK (self);
 
-  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
-  g_hash_table_iter_init (&iter, gum_interceptor_thread_contexts);
-  while (g_hash_table_iter_next (&iter, (gpointer *) &thread_ctx, NULL))
-    interceptor_thread_context_forget_listener_data (thread_ctx, listener);
-  gum_spinlock_release (&gum_interceptor_thread_context_lock);
-
-  gum_interceptor_transaction_end (&self->current_transaction);
-  GUM_INTERCEPTOR_UNLOCK (self);
-  gum_interceptor_unignore_current_thread (self);
+    return result;
+  }
 }
 
+/*
+ * Like gum_interceptor_replace_function(), except that the function's
+ * prologue jumps straight to the replacement, which calls the original through
+ * the pointer stored in original_function. Calls cost nothing beyond that
+ * jump, as there is no invocation context, no statistics and no stack of
+ * return addresses, so the replacement must not use
+ * gum_interceptor_get_current_invocation(). Such a function cannot have
+ * listeners or probes attached, and gum_interceptor_flush() cannot tell
+ * whether a thread is still inside the replacement or the original, so make
+ * sure none are before reverting it.
+ */
 GumReplaceReturn
-gum_interceptor_replace_function (GumInterceptor * self,
-                                  gpointer function_address,
-                                  gpointer replacement_function,
-                                  gpointer replacement_function_data)
+gum_interceptor_replace_function_fast (GumInterceptor * self,
+                                       gpointer function_address,
+                                       gpointer replacement_function,
+                                       gpointer * original_function)
 {
   GumReplaceReturn result = GUM_REPLACE_OK;
   GumFunctionContext * function_ctx;
@@ -441,16 +1167,30 @@ gum_interceptor_replace_function (GumInterceptor * self,
 
   function_address = gum_interceptor_resolve (self, function_address);
 
-  function_ctx = gum_interceptor_instrument (self, function_address);
-  if (function_ctx == NULL)
-    goto wrong_signature;
-
-  if (function_ctx->replacement_function != NULL)
+  if (g_hash_table_lookup (self->function_by_address, function_address) !=
+      NULL)
     goto already_replaced;
 
-  function_ctx->replacement_function_data = replacement_function_data;
+  function_ctx = gum_function_context_new (self, function_address);
+  function_ctx->type = GUM_INTERCEPTOR_TYPE_FAST;
   function_ctx->replacement_function = replacement_function;
 
+  if (!_gum_interceptor_backend_create_trampoline (self->backend,
+      function_ctx))
+  {
+    gum_function_context_finalize (function_ctx);
+    goto wrong_signature;
+  }
+
+  g_hash_table_insert (self->function_by_address, function_address,
+      function_ctx);
+
+  gum_interceptor_transaction_schedule_prologue_write (
+      &self->current_transaction, function_ctx, gum_interceptor_activate);
+
+  if (original_function != NULL)
+    *original_function = function_ctx->on_invoke_trampoline;
+
   goto beach;
 
 policy_violation:
@@ -495,6 +1235,7 @@ gum_interceptor_revert_function (GumInterceptor * self,
 
   function_ctx->replacement_function = NULL;
   function_ctx->replacement_function_data = NULL;
+  gum_function_context_update_enter_only (function_ctx);
 
   if (gum_function_context_is_empty (function_ctx))
   {
@@ -543,6 +1284,79 @@ gum_interceptor_flush (GumInterceptor * self)
   return flushed;
 }
 
+/*
+ * Statistics are off by default. While on, every call through a trampoline
+ * is counted in a shard owned by the calling thread, along with the calls
+ * that skipped the listeners, e.g. because of the reentrancy guard or an
+ * ignored thread, and the time spent in the probe and listener callbacks.
+ */
+void
+gum_interceptor_set_statistics_enabled (GumInterceptor * self,
+                                        gboolean enabled)
+{
+  self->statistics_enabled = enabled;
+}
+
+/*
+ * Sums up the per-thread shards into one GumFunctionStatistics per
+ * instrumented function. Reads race with the threads doing the counting, so
+ * the numbers are approximate while calls are in flight. Times are in
+ * microseconds. Free the array with g_array_free().
+ */
+GArray *
+gum_interceptor_get_statistics (GumInterceptor * self)
+{
+  GArray * result;
+  GHashTableIter iter;
+  GumFunctionContext * function_ctx;
+
+  result = g_array_new (FALSE, FALSE, sizeof (GumFunctionStatistics));
+
+  GUM_INTERCEPTOR_LOCK (self);
+  gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+
+  g_hash_table_iter_init (&iter, self->function_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
+  {
+    guint index = function_ctx->statistics_index;
+    GumFunctionStatistics stats = { 0, };
+    GHashTableIter thread_iter;
+    InterceptorThreadContext * thread_ctx;
+
+    if (index == GUM_STATISTICS_INDEX_NONE)
+      continue;
+
+    stats.function_address = function_ctx->function_address;
+
+    g_hash_table_iter_init (&thread_iter, gum_interceptor_thread_contexts);
+    while (g_hash_table_iter_next (&thread_iter, (gpointer *) &thread_ctx,
+        NULL))
+    {
+      GumFunctionStatisticsShard * chunk, * shard;
+
+      chunk = g_atomic_pointer_get (
+          &thread_ctx->statistics[index / GUM_STATISTICS_CHUNK_SIZE]);
+      if (chunk == NULL)
+        continue;
+
+      shard = &chunk[index % GUM_STATISTICS_CHUNK_SIZE];
+      if (shard->id != function_ctx->statistics_id)
+        continue;
+
+      stats.calls += shard->calls;
+      stats.bypassed_calls += shard->bypassed_calls;
+      stats.listener_time += shard->listener_time;
+    }
+
+    g_array_append_val (result, stats);
+  }
+
+  gum_spinlock_release (&gum_interceptor_thread_context_lock);
+  GUM_INTERCEPTOR_UNLOCK (self);
+
+  return result;
+}
+
 GumInvocationContext *
 gum_interceptor_get_current_invocation (void)
 {
@@ -562,7 +1376,7 @@ gum_interceptor_get_current_stack (void)
 {
   InterceptorThreadContext * context;
 
-  context = g_private_get (&gum_interceptor_context_private);
+  context = gum_tls_key_get_value (gum_interceptor_context_key);
   if (context == NULL)
     return &_gum_interceptor_empty_stack;
 
@@ -571,6 +1385,22 @@ gum_interceptor_get_current_stack (void)
 
 void
 gum_interceptor_ignore_current_thread (GumInterceptor * self)
+{
+  _gum_interceptor_ignore_current_thread ();
+}
+
+void
+gum_interceptor_unignore_current_thread (GumInterceptor * self)
+{
+  _gum_interceptor_unignore_current_thread ();
+}
+
+/*
+ * The ignore level lives with the thread rather than with the Interceptor,
+ * so threads can be ignored before there is an Interceptor to ignore them.
+ */
+void
+_gum_interceptor_ignore_current_thread (void)
 {
   InterceptorThreadContext * interceptor_ctx;
 
@@ -579,7 +1409,7 @@ gum_interceptor_ignore_current_thread (GumInterceptor * self)
 }
 
 void
-gum_interceptor_unignore_current_thread (GumInterceptor * self)
+_gum_interceptor_unignore_current_thread (void)
 {
   InterceptorThreadContext * interceptor_ctx;
 
@@ -601,6 +1431,165 @@ gum_interceptor_unignore_other_threads (GumInterceptor * self)
   self->selected_thread_id = 0;
 }
 
+/*
+ * Makes the listener fire only on the given threads, or on all of them again
+ * if `n_thread_ids` is zero. Other threads walk past it without touching the
+ * invocation stack, as long as every listener on the function is filtered and
+ * it has no probe. The filter may be set before the listener is attached, and
+ * is forgotten once it is detached.
+ */
+void
+gum_interceptor_set_listener_threads (GumInterceptor * self,
+                                      GumInvocationListener * listener,
+                                      const GumThreadId * thread_ids,
+                                      guint n_thread_ids)
+{
+  ListenerThreadFilter * filter = NULL;
+  guint i;
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  if (n_thread_ids != 0)
+  {
+    filter = listener_thread_filter_new (NULL);
+    for (i = 0; i != n_thread_ids; i++)
+    {
+      g_hash_table_add (filter->thread_ids,
+          GSIZE_TO_POINTER (thread_ids[i]));
+    }
+  }
+
+  gum_interceptor_replace_thread_filter (self, listener, filter);
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+void
+gum_interceptor_add_listener_thread (GumInterceptor * self,
+                                     GumInvocationListener * listener,
+                                     GumThreadId thread_id)
+{
+  ListenerThreadFilter * filter;
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  filter = listener_thread_filter_new (
+      g_hash_table_lookup (self->thread_filter_by_listener, listener));
+  g_hash_table_add (filter->thread_ids, GSIZE_TO_POINTER (thread_id));
+
+  gum_interceptor_replace_thread_filter (self, listener, filter);
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+/*
+ * The listener stays filtered when its last thread is removed, so it will not
+ * fire anywhere until threads are added back or the filter is cleared.
+ */
+void
+gum_interceptor_remove_listener_thread (GumInterceptor * self,
+                                        GumInvocationListener * listener,
+                                        GumThreadId thread_id)
+{
+  ListenerThreadFilter * old_filter, * filter;
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  old_filter = g_hash_table_lookup (self->thread_filter_by_listener, listener);
+  if (old_filter != NULL)
+  {
+    filter = listener_thread_filter_new (old_filter);
+    g_hash_table_remove (filter->thread_ids, GSIZE_TO_POINTER (thread_id));
+
+    gum_interceptor_replace_thread_filter (self, listener, filter);
+  }
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+}
+
+static void
+gum_interceptor_replace_thread_filter (GumInterceptor * self,
+                                       GumInvocationListener * listener,
+                                       ListenerThreadFilter * filter)
+{
+  ListenerThreadFilter * old_filter;
+  GHashTableIter iter;
+  GumFunctionContext * function_ctx;
+
+  gum_interceptor_transaction_begin (&self->current_transaction);
+  self->current_transaction.is_dirty = TRUE;
+
+  old_filter = g_hash_table_lookup (self->thread_filter_by_listener, listener);
+  if (old_filter != NULL)
+    listener_thread_filter_ref (old_filter);
+
+  if (filter != NULL)
+    g_hash_table_insert (self->thread_filter_by_listener, listener, filter);
+  else
+    g_hash_table_remove (self->thread_filter_by_listener, listener);
+
+  g_hash_table_iter_init (&iter, self->function_by_address);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &function_ctx))
+  {
+    if (gum_function_context_update_thread_filter (function_ctx, listener,
+        filter) && old_filter != NULL)
+    {
+      gum_interceptor_transaction_schedule_destroy (&self->current_transaction,
+          function_ctx, (GDestroyNotify) listener_thread_filter_unref,
+          listener_thread_filter_ref (old_filter));
+    }
+  }
+
+  if (old_filter != NULL)
+    listener_thread_filter_unref (old_filter);
+
+  gum_interceptor_transaction_end (&self->current_transaction);
+}
+
+/* Ids are unique across interceptors, as they share the thread contexts. */
+static ListenerThreadFilter *
+listener_thread_filter_new (ListenerThreadFilter * base)
+{
+  static volatile gint last_id = 0;
+  ListenerThreadFilter * filter;
+
+  filter = g_slice_new (ListenerThreadFilter);
+  filter->ref_count = 1;
+  filter->id = g_atomic_int_add (&last_id, 1) + 1;
+  filter->thread_ids = g_hash_table_new (NULL, NULL);
+
+  if (base != NULL)
+  {
+    GHashTableIter iter;
+    gpointer thread_id;
+
+    g_hash_table_iter_init (&iter, base->thread_ids);
+    while (g_hash_table_iter_next (&iter, &thread_id, NULL))
+      g_hash_table_add (filter->thread_ids, thread_id);
+  }
+
+  return filter;
+}
+
+static ListenerThreadFilter *
+listener_thread_filter_ref (ListenerThreadFilter * filter)
+{
+  g_atomic_int_inc (&filter->ref_count);
+
+  return filter;
+}
+
+static void
+listener_thread_filter_unref (ListenerThreadFilter * filter)
+{
+  if (!g_atomic_int_dec_and_test (&filter->ref_count))
+    return;
+
+  g_hash_table_unref (filter->thread_ids);
+
+  g_slice_free (ListenerThreadFilter, filter);
+}
+
 gpointer
 gum_invocation_stack_translate (GumInvocationStack * self,
                                 gpointer return_address)
@@ -619,6 +1608,72 @@ gum_invocation_stack_translate (GumInvocationStack * self,
   return return_address;
 }
 
+/*
+ * Like gum_invocation_stack_translate(), for walking a backtrace from the
+ * innermost frame outwards. The trampoline return addresses then turn up in
+ * the same order as the stack's entries from the top down, so each address is
+ * only compared to the next entry whose return was trapped, which takes
+ * constant time. `depth` keeps track of how far down the stack we are, and
+ * must start out as zero.
+ */
+gpointer
+gum_invocation_stack_translate_next (GumInvocationStack * self,
+                                     gpointer return_address,
+                                     guint * depth)
+{
+  guint i;
+
+  for (i = self->len - *depth; i != 0; i--)
+  {
+    GumInvocationStackEntry * entry;
+
+    entry = &g_array_index (self, GumInvocationStackEntry, i - 1);
+    if (entry->trampoline_ret_addr == NULL)
+      continue;
+
+    if (entry->trampoline_ret_addr != return_address)
+      break;
+
+    *depth = self->len - (i - 1);
+
+    return entry->caller_ret_addr;
+  }
+
+  return return_address;
+}
+
+/*
+ * Used by the backends to put redirects in place and to take them out again.
+ * When the bytes fit inside one aligned machine word they are written with a
+ * single store, so a thread racing into the function sees either the old or
+ * the new prologue, never a mix of the two. A redirect that straddles a word
+ * boundary falls back to a plain copy.
+ */
+void
+_gum_interceptor_write_code (gpointer destination,
+                             gconstpointer code,
+                             gsize size)
+{
+  gsize start, word_start;
+
+  start = GPOINTER_TO_SIZE (destination);
+  word_start = start & ~((gsize) sizeof (gpointer) - 1);
+
+  if (start - word_start + size <= sizeof (gpointer))
+  {
+    gpointer * word = GSIZE_TO_POINTER (word_start);
+    gpointer value;
+
+    value = *word;
+    memcpy ((guint8 *) &value + (start - word_start), code, size);
+    g_atomic_pointer_set (word, value);
+  }
+  else
+  {
+    memcpy (destination, code, size);
+  }
+}
+
 gpointer
 _gum_interceptor_peek_top_caller_return_address (void)
 {
@@ -654,6 +1709,37 @@ fallback:
   return return_address;
 }
 
+/*
+ * Looks up the trampoline that runs the original code of an instrumented
+ * function. The address that was actually instrumented is stored in
+ * `hooked_address`, as it differs from `function_address` when the latter
+ * is a redirect.
+ */
+gpointer
+_gum_interceptor_peek_original_function (GumInterceptor * self,
+                                         gpointer function_address,
+                                         gpointer * hooked_address)
+{
+  GumFunctionContext * function_ctx;
+  gpointer original = NULL;
+
+  GUM_INTERCEPTOR_LOCK (self);
+
+  function_address = gum_interceptor_resolve (self, function_address);
+
+  function_ctx = (GumFunctionContext *) g_hash_table_lookup (
+      self->function_by_address, function_address);
+  if (function_ctx != NULL)
+  {
+    original = function_ctx->on_invoke_trampoline;
+    *hooked_address = function_address;
+  }
+
+  GUM_INTERCEPTOR_UNLOCK (self);
+
+  return original;
+}
+
 static GumFunctionContext *
 gum_interceptor_instrument (GumInterceptor * self,
                             gpointer function_address)
@@ -663,7 +1749,7 @@ gum_interceptor_instrument (GumInterceptor * self,
   ctx = (GumFunctionContext *) g_hash_table_lookup (self->function_by_address,
       function_address);
   if (ctx != NULL)
-    return ctx;
+    return (ctx->type == GUM_INTERCEPTOR_TYPE_DEFAULT) ? ctx : NULL;
 
   ctx = gum_function_context_new (self, function_address);
   if (ctx == NULL)
@@ -676,6 +1762,7 @@ gum_interceptor_instrument (GumInterceptor * self,
   }
 
   g_hash_table_insert (self->function_by_address, function_address, ctx);
+  gum_interceptor_assign_statistics_index (self, ctx);
 
   gum_interceptor_transaction_schedule_prologue_write (
       &self->current_transaction, ctx, gum_interceptor_activate);
@@ -683,6 +1770,37 @@ gum_interceptor_instrument (GumInterceptor * self,
   return ctx;
 }
 
+/*
+ * The index picks the function's shard in each thread and is recycled once
+ * the function is no longer instrumented. The id is never reused, so that a
+ * shard left behind by a previous owner of the index is recognized and
+ * reset rather than added to the new function's numbers.
+ */
+static void
+gum_interceptor_assign_statistics_index (GumInterceptor * self,
+                                         GumFunctionContext * ctx)
+{
+  GArray * free_indices = self->free_statistics_indices;
+
+  if (free_indices->len != 0)
+  {
+    ctx->statistics_index =
+        g_array_index (free_indices, guint, free_indices->len - 1);
+    g_array_set_size (free_indices, free_indices->len - 1);
+  }
+  else if (self->next_statistics_index !=
+      GUM_STATISTICS_CHUNK_SIZE * GUM_STATISTICS_MAX_CHUNKS)
+  {
+    ctx->statistics_index = self->next_statistics_index++;
+  }
+  else
+  {
+    return;
+  }
+
+  ctx->statistics_id = self->next_statistics_id++;
+}
+
 static void
 gum_interceptor_activate (GumInterceptor * self,
                           GumFunctionContext * ctx,
@@ -793,11 +1911,14 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
 
     protection = rwx_supported ? GUM_PAGE_RWX : GUM_PAGE_RW;
 
-    for (cur = addresses; cur != NULL; cur = cur->next)
+    for (cur = addresses; cur != NULL;)
     {
       gpointer target_page = cur->data;
+      gsize run_size;
 
-      gum_mprotect (target_page, page_size, protection);
+      cur = gum_page_run_end (cur, page_size, &run_size);
+
+      gum_mprotect (target_page, run_size, protection);
     }
 
     for (cur = addresses; cur != NULL; cur = cur->next)
@@ -821,21 +1942,17 @@ gum_interceptor_transaction_end (GumInterceptorTransaction * self)
       }
     }
 
-    if (!rwx_supported)
+    for (cur = addresses; cur != NULL;)
     {
-      for (cur = addresses; cur != NULL; cur = cur->next)
-      {
-        gpointer target_page = cur->data;
+      gpointer target_page = cur->data;
+      gsize run_size;
 
-        gum_mprotect (target_page, page_size, GUM_PAGE_RX);
-      }
-    }
+      cur = gum_page_run_end (cur, page_size, &run_size);
 
-    for (cur = addresses; cur != NULL; cur = cur->next)
-    {
-      gpointer target_page = cur->data;
+      if (!rwx_supported)
+        gum_mprotect (target_page, run_size, GUM_PAGE_RX);
 
-      gum_clear_cache (target_page, page_size);
+      gum_clear_cache (target_page, run_size);
     }
   }
   else
@@ -993,6 +2110,10 @@ gum_function_context_new (GumInterceptor * interceptor,
 
   ctx->listener_entries =
       g_ptr_array_new_full (1, (GDestroyNotify) listener_entry_free);
+  ctx->enter_calls = listener_call_array_new ();
+  ctx->leave_calls = listener_call_array_new ();
+
+  ctx->statistics_index = GUM_STATISTICS_INDEX_NONE;
 
   ctx->interceptor = interceptor;
 
@@ -1005,6 +2126,13 @@ gum_function_context_finalize (GumFunctionContext * function_ctx)
   g_assert (function_ctx->trampoline_slice == NULL);
 
   g_ptr_array_unref (g_atomic_pointer_get (&function_ctx->listener_entries));
+  g_array_unref (g_atomic_pointer_get (&function_ctx->enter_calls));
+  g_array_unref (g_atomic_pointer_get (&function_ctx->leave_calls));
+
+  if (function_ctx->probe_entry != NULL)
+    probe_entry_free (function_ctx->probe_entry);
+  if (function_ctx->capture_entry != NULL)
+    capture_entry_free (function_ctx->capture_entry);
 
   g_slice_free (GumFunctionContext, function_ctx);
 }
@@ -1018,6 +2146,12 @@ gum_function_context_destroy (GumFunctionContext * function_ctx)
   g_assert (!function_ctx->destroyed);
   function_ctx->destroyed = TRUE;
 
+  if (function_ctx->statistics_index != GUM_STATISTICS_INDEX_NONE)
+  {
+    g_array_append_val (function_ctx->interceptor->free_statistics_indices,
+        function_ctx->statistics_index);
+  }
+
   if (function_ctx->activated)
   {
     gum_interceptor_transaction_schedule_prologue_write (transaction,
@@ -1043,6 +2177,12 @@ gum_function_context_is_empty (GumFunctionContext * function_ctx)
   if (function_ctx->replacement_function != NULL)
     return FALSE;
 
+  if (function_ctx->probe_entry != NULL)
+    return FALSE;
+
+  if (function_ctx->capture_entry != NULL)
+    return FALSE;
+
   return gum_function_context_find_taken_listener_slot (function_ctx) == NULL;
 }
 
@@ -1059,6 +2199,10 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
   entry->listener_interface = GUM_INVOCATION_LISTENER_GET_IFACE (listener);
   entry->listener_instance = listener;
   entry->function_data = function_data;
+  entry->listener_data_index = gum_interceptor_claim_listener_data_index (
+      function_ctx->interceptor, listener);
+  entry->thread_filter = g_hash_table_lookup (
+      function_ctx->interceptor->thread_filter_by_listener, listener);
 
   old_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
   new_entries = g_ptr_array_new_full (old_entries->len + 1,
@@ -1076,10 +2220,8 @@ gum_function_context_add_listener (GumFunctionContext * function_ctx,
       &function_ctx->interceptor->current_transaction, function_ctx,
       (GDestroyNotify) g_ptr_array_unref, old_entries);
 
-  if (entry->listener_interface->on_leave != NULL)
-  {
-    function_ctx->has_on_leave_listener = TRUE;
-  }
+  gum_function_context_update_calls (function_ctx);
+  gum_function_context_update_enter_only (function_ctx);
 }
 
 static void
@@ -1093,27 +2235,131 @@ gum_function_context_remove_listener (GumFunctionContext * function_ctx,
                                       GumInvocationListener * listener)
 {
   ListenerEntry ** slot;
-  gboolean has_on_leave_listener;
-  GPtrArray * listener_entries;
-  guint i;
 
   slot = gum_function_context_find_listener (function_ctx, listener);
   g_assert (slot != NULL);
   listener_entry_free (*slot);
   *slot = NULL;
 
-  has_on_leave_listener = FALSE;
+  gum_function_context_update_calls (function_ctx);
+  gum_function_context_update_enter_only (function_ctx);
+}
+
+/*
+ * Flattens the listener entries into one array of calls per point cut,
+ * holding only the listeners that implement that callback, each with its
+ * callback resolved and a private copy of its entry. The hot paths just walk
+ * these, and like the entries they are replaced rather than modified, with
+ * the old arrays freed once the transaction is over.
+ */
+static void
+gum_function_context_update_calls (GumFunctionContext * function_ctx)
+{
+  GumInterceptorTransaction * transaction =
+      &function_ctx->interceptor->current_transaction;
+  GPtrArray * listener_entries;
+  GArray * enter_calls, * leave_calls;
+  gboolean thread_filtered = TRUE;
+  guint i;
+
+  enter_calls = listener_call_array_new ();
+  leave_calls = listener_call_array_new ();
+
   listener_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
   for (i = 0; i != listener_entries->len; i++)
   {
-    ListenerEntry * entry = g_ptr_array_index (listener_entries, i);
-    if (entry != NULL && entry->listener_interface->on_leave != NULL)
+    ListenerEntry * entry;
+    ListenerCall call;
+
+    entry = g_ptr_array_index (listener_entries, i);
+    if (entry == NULL)
+      continue;
+
+    call.entry = *entry;
+    call.listener_index = i;
+
+    if (entry->thread_filter == NULL)
+      thread_filtered = FALSE;
+
+    if (entry->listener_interface->on_enter != NULL)
     {
-      has_on_leave_listener = TRUE;
-      break;
+      call.callback = entry->listener_interface->on_enter;
+      g_array_append_val (enter_calls, call);
+    }
+
+    if (entry->listener_interface->on_leave != NULL)
+    {
+      call.callback = entry->listener_interface->on_leave;
+      g_array_append_val (leave_calls, call);
     }
   }
-  function_ctx->has_on_leave_listener = has_on_leave_listener;
+
+  function_ctx->has_on_leave_listener = leave_calls->len != 0;
+  function_ctx->thread_filtered = thread_filtered &&
+      (enter_calls->len != 0 || leave_calls->len != 0);
+
+  gum_interceptor_transaction_schedule_destroy (transaction, function_ctx,
+      (GDestroyNotify) g_array_unref,
+      g_atomic_pointer_get (&function_ctx->enter_calls));
+  gum_interceptor_transaction_schedule_destroy (transaction, function_ctx,
+      (GDestroyNotify) g_array_unref,
+      g_atomic_pointer_get (&function_ctx->leave_calls));
+
+  g_atomic_pointer_set (&function_ctx->enter_calls, enter_calls);
+  g_atomic_pointer_set (&function_ctx->leave_calls, leave_calls);
+}
+
+static gboolean
+gum_function_context_update_thread_filter (GumFunctionContext * function_ctx,
+                                           GumInvocationListener * listener,
+                                           ListenerThreadFilter * filter)
+{
+  ListenerEntry ** slot;
+
+  slot = gum_function_context_find_listener (function_ctx, listener);
+  if (slot == NULL)
+    return FALSE;
+
+  (*slot)->thread_filter = filter;
+  gum_function_context_update_calls (function_ctx);
+
+  return TRUE;
+}
+
+static gboolean
+gum_function_context_selects_current_thread (
+    GumFunctionContext * function_ctx,
+    InterceptorThreadContext * thread_ctx)
+{
+  GArray * calls;
+  guint i;
+
+  calls = g_atomic_pointer_get (&function_ctx->enter_calls);
+  for (i = 0; i != calls->len; i++)
+  {
+    ListenerCall * call = &g_array_index (calls, ListenerCall, i);
+
+    if (interceptor_thread_context_selects (thread_ctx, &call->entry))
+      return TRUE;
+  }
+
+  calls = g_atomic_pointer_get (&function_ctx->leave_calls);
+  for (i = 0; i != calls->len; i++)
+  {
+    ListenerCall * call = &g_array_index (calls, ListenerCall, i);
+
+    if (interceptor_thread_context_selects (thread_ctx, &call->entry))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static GArray *
+listener_call_array_new (void)
+{
+  return g_array_sized_new (FALSE, FALSE, sizeof (ListenerCall),
+      GUM_MAX_LISTENERS_PER_FUNCTION);
 }
 
 static gboolean
@@ -1161,6 +2407,118 @@ gum_function_context_find_taken_listener_slot (
   return NULL;
 }
 
+/*
+ * Whether calls can take the short path, i.e. a probe or a capture without
+ * the return value is all there is to do.
+ */
+static void
+gum_function_context_update_enter_only (GumFunctionContext * function_ctx)
+{
+  GumCaptureEntry * capture = function_ctx->capture_entry;
+
+  function_ctx->enter_only = (function_ctx->probe_entry != NULL ||
+      (capture != NULL && !capture->capture_return)) &&
+      function_ctx->replacement_function == NULL &&
+      gum_function_context_find_taken_listener_slot (function_ctx) == NULL;
+}
+
+static void
+gum_function_context_invoke_probe (GumFunctionContext * function_ctx,
+                                   GumCpuContext * cpu_context)
+{
+  GumProbeEntry * entry;
+
+  entry = g_atomic_pointer_get (&function_ctx->probe_entry);
+  if (entry == NULL)
+    return;
+
+  gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
+
+  entry->callback (cpu_context, entry->user_data);
+}
+
+static void
+probe_entry_free (GumProbeEntry * entry)
+{
+  g_slice_free (GumProbeEntry, entry);
+}
+
+/*
+ * Calls that also want the return value are recorded on leave, so the
+ * arguments and the time of entry wait in the stack entry until then.
+ */
+static void
+gum_function_context_capture_enter (GumFunctionContext * function_ctx,
+                                    GumCaptureEntry * capture,
+                                    InterceptorThreadContext * interceptor_ctx,
+                                    GumCpuContext * cpu_context,
+                                    GumInvocationStackEntry * stack_entry)
+{
+  guint64 timestamp;
+  GumCapturedCall * call;
+  guint i;
+
+  timestamp = gum_timestamp_now ();
+
+  if (capture->capture_return && stack_entry != NULL)
+  {
+    stack_entry->capture_pending = TRUE;
+    stack_entry->capture_n_args = capture->n_args;
+    stack_entry->capture_timestamp = timestamp;
+    for (i = 0; i != capture->n_args; i++)
+    {
+      stack_entry->capture_args[i] =
+          gum_cpu_context_get_nth_argument (cpu_context, i);
+    }
+    return;
+  }
+
+  call = interceptor_thread_context_reserve_capture (interceptor_ctx);
+  if (call == NULL)
+    return;
+
+  call->function = function_ctx->function_address;
+  call->thread_id = interceptor_ctx->thread_id;
+  call->timestamp = timestamp;
+  call->n_args = capture->n_args;
+  call->has_return_value = FALSE;
+  for (i = 0; i != capture->n_args; i++)
+    call->args[i] = gum_cpu_context_get_nth_argument (cpu_context, i);
+  call->return_value = NULL;
+
+  interceptor_thread_context_commit_capture (interceptor_ctx);
+}
+
+static void
+gum_function_context_capture_leave (GumFunctionContext * function_ctx,
+                                    InterceptorThreadContext * interceptor_ctx,
+                                    GumCpuContext * cpu_context,
+                                    GumInvocationStackEntry * stack_entry)
+{
+  GumCapturedCall * call;
+
+  call = interceptor_thread_context_reserve_capture (interceptor_ctx);
+  if (call == NULL)
+    return;
+
+  call->function = function_ctx->function_address;
+  call->thread_id = interceptor_ctx->thread_id;
+  call->timestamp = stack_entry->capture_timestamp;
+  call->n_args = stack_entry->capture_n_args;
+  call->has_return_value = TRUE;
+  memcpy (call->args, stack_entry->capture_args,
+      stack_entry->capture_n_args * sizeof (gpointer));
+  call->return_value = gum_cpu_context_get_return_value (cpu_context);
+
+  interceptor_thread_context_commit_capture (interceptor_ctx);
+}
+
+static void
+capture_entry_free (GumCaptureEntry * entry)
+{
+  g_slice_free (GumCaptureEntry, entry);
+}
+
 void
 _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
                                         GumCpuContext * cpu_context,
@@ -1172,9 +2530,12 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   GumInvocationStack * stack;
   GumInvocationStackEntry * stack_entry;
   GumInvocationContext * invocation_ctx = NULL;
+  GumCaptureEntry * capture;
   gint system_error;
   gboolean invoke_listeners = TRUE;
   gboolean will_trap_on_leave;
+  GumFunctionStatisticsShard * shard = NULL;
+  gint64 start_time = 0;
 
   g_atomic_int_inc (&function_ctx->trampoline_usage_counter);
 
@@ -1186,19 +2547,79 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
 
   if (gum_tls_key_get_value (gum_interceptor_guard_key) == interceptor)
   {
+    interceptor_ctx = interceptor->statistics_enabled
+        ? gum_tls_key_get_value (gum_interceptor_context_key)
+        : NULL;
+    if (interceptor_ctx != NULL)
+    {
+      shard = interceptor_thread_context_get_statistics (interceptor_ctx,
+          function_ctx);
+      if (shard != NULL)
+      {
+        shard->calls++;
+        shard->bypassed_calls++;
+      }
+    }
+
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
   }
   gum_tls_key_set_value (gum_interceptor_guard_key, interceptor);
 
+  if (function_ctx->enter_only)
+  {
+#ifndef G_OS_WIN32
+    system_error = gum_thread_get_system_error ();
+#endif
+
+    if (interceptor->statistics_enabled)
+    {
+      shard = interceptor_thread_context_get_statistics (
+          get_interceptor_thread_context (), function_ctx);
+    }
+    if (shard != NULL)
+    {
+      shard->calls++;
+      start_time = g_get_monotonic_time ();
+    }
+
+    gum_function_context_invoke_probe (function_ctx, cpu_context);
+
+    capture = g_atomic_pointer_get (&function_ctx->capture_entry);
+    if (capture != NULL)
+    {
+      gum_function_context_capture_enter (function_ctx, capture,
+          get_interceptor_thread_context (), cpu_context, NULL);
+    }
+
+    if (shard != NULL)
+      shard->listener_time += g_get_monotonic_time () - start_time;
+
+    gum_thread_set_system_error (system_error);
+    gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
+    *next_hop = function_ctx->on_invoke_trampoline;
+    goto bypass;
+  }
+
   interceptor_ctx = get_interceptor_thread_context ();
   stack = interceptor_ctx->stack;
 
+  if (interceptor->statistics_enabled)
+  {
+    shard = interceptor_thread_context_get_statistics (interceptor_ctx,
+        function_ctx);
+  }
+  if (shard != NULL)
+    shard->calls++;
+
   stack_entry = gum_invocation_stack_peek_top (stack);
   if (stack_entry != NULL && stack_entry->calling_replacement &&
       stack_entry->invocation_context.function ==
       function_ctx->function_address)
   {
+    if (shard != NULL)
+      shard->bypassed_calls++;
+
     gum_tls_key_set_value (gum_interceptor_guard_key, NULL);
     *next_hop = function_ctx->on_invoke_trampoline;
     goto bypass;
@@ -1219,8 +2640,21 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
     invoke_listeners = (interceptor_ctx->ignore_level <= 0);
   }
 
+  capture = g_atomic_pointer_get (&function_ctx->capture_entry);
+
+  if (invoke_listeners && function_ctx->thread_filtered &&
+      function_ctx->probe_entry == NULL && capture == NULL)
+  {
+    invoke_listeners = gum_function_context_selects_current_thread (
+        function_ctx, interceptor_ctx);
+  }
+
+  if (!invoke_listeners && shard != NULL)
+    shard->bypassed_calls++;
+
   will_trap_on_leave = function_ctx->replacement_function != NULL ||
-      (invoke_listeners && function_ctx->has_on_leave_listener);
+      (invoke_listeners && (function_ctx->has_on_leave_listener ||
+      (capture != NULL && capture->capture_return)));
   if (will_trap_on_leave)
   {
     stack_entry = gum_invocation_stack_push (stack, function_ctx,
@@ -1231,6 +2665,7 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
   {
     stack_entry = gum_invocation_stack_push (stack, function_ctx,
         function_ctx->function_address);
+    stack_entry->trampoline_ret_addr = NULL;
     invocation_ctx = &stack_entry->invocation_context;
   }
 
@@ -1241,35 +2676,48 @@ _gum_function_context_begin_invocation (GumFunctionContext * function_ctx,
 
   if (invoke_listeners)
   {
-    GPtrArray * listener_entries;
+    GArray * calls;
+    ListenerInvocationState state;
     guint i;
 
     invocation_ctx->cpu_context = cpu_context;
     invocation_ctx->backend = &interceptor_ctx->listener_backend;
 
-    listener_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
-    for (i = 0; i != listener_entries->len; i++)
+    if (shard != NULL)
+      start_time = g_get_monotonic_time ();
+
+    gum_function_context_invoke_probe (function_ctx, cpu_context);
+
+    if (capture != NULL)
+    {
+      gum_function_context_capture_enter (function_ctx, capture,
+          interceptor_ctx, cpu_context,
+          will_trap_on_leave ? stack_entry : NULL);
+    }
+
+    state.point_cut = GUM_POINT_ENTER;
+    state.interceptor_ctx = interceptor_ctx;
+    state.stack_entry = stack_entry;
+    invocation_ctx->backend->data = &state;
+
+    calls = g_atomic_pointer_get (&function_ctx->enter_calls);
+    for (i = 0; i != calls->len; i++)
     {
-      ListenerEntry * listener_entry;
-      ListenerInvocationState state;
+      ListenerCall * call = &g_array_index (calls, ListenerCall, i);
 
-      listener_entry = g_ptr_array_index (listener_entries, i);
-      if (listener_entry == NULL)
+      if (call->entry.thread_filter != NULL &&
+          !interceptor_thread_context_selects (interceptor_ctx, &call->entry))
         continue;
 
-      state.point_cut = GUM_POINT_ENTER;
-      state.entry = listener_entry;
-      state.interceptor_ctx = interceptor_ctx;
-      state.invocation_data = stack_entry->listener_invocation_data[i];
-      invocation_ctx->backend->data = &state;
+      state.entry = &call->entry;
+      state.listener_index = call->listener_index;
 
-      if (listener_entry->listener_interface->on_enter != NULL)
-      {
-        listener_entry->listener_interface->on_enter (
-            listener_entry->listener_instance, invocation_ctx);
-      }
+      call->callback (call->entry.listener_instance, invocation_ctx);
     }
 
+    if (shard != NULL)
+      shard->listener_time += g_get_monotonic_time () - start_time;
+
     system_error = invocation_ctx->system_error;
   }
 
@@ -1323,8 +2771,11 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
   InterceptorThreadContext * interceptor_ctx;
   GumInvocationStackEntry * stack_entry;
   GumInvocationContext * invocation_ctx;
-  GPtrArray * listener_entries;
+  ListenerInvocationState state;
+  GArray * calls;
   guint i;
+  GumFunctionStatisticsShard * shard = NULL;
+  gint64 start_time = 0;
 
 #ifdef G_OS_WIN32
   system_error = gum_thread_get_system_error ();
@@ -1356,29 +2807,43 @@ _gum_function_context_end_invocation (GumFunctionContext * function_ctx,
 
   gum_function_context_fixup_cpu_context (function_ctx, cpu_context);
 
-  listener_entries = g_atomic_pointer_get (&function_ctx->listener_entries);
-  for (i = 0; i != listener_entries->len; i++)
+  if (function_ctx->interceptor->statistics_enabled)
   {
-    ListenerEntry * listener_entry;
-    ListenerInvocationState state;
+    shard = interceptor_thread_context_get_statistics (interceptor_ctx,
+        function_ctx);
+  }
+  if (shard != NULL)
+    start_time = g_get_monotonic_time ();
+
+  if (stack_entry->capture_pending)
+  {
+    gum_function_context_capture_leave (function_ctx, interceptor_ctx,
+        cpu_context, stack_entry);
+  }
 
-    listener_entry = g_ptr_array_index (listener_entries, i);
-    if (listener_entry == NULL)
+  state.point_cut = GUM_POINT_LEAVE;
+  state.interceptor_ctx = interceptor_ctx;
+  state.stack_entry = stack_entry;
+  invocation_ctx->backend->data = &state;
+
+  calls = g_atomic_pointer_get (&function_ctx->leave_calls);
+  for (i = 0; i != calls->len; i++)
+  {
+    ListenerCall * call = &g_array_index (calls, ListenerCall, i);
+
+    if (call->entry.thread_filter != NULL &&
+        !interceptor_thread_context_selects (interceptor_ctx, &call->entry))
       continue;
 
-    state.point_cut = GUM_POINT_LEAVE;
-    state.entry = listener_entry;
-    state.interceptor_ctx = interceptor_ctx;
-    state.invocation_data = stack_entry->listener_invocation_data[i];
-    invocation_ctx->backend->data = &state;
+    state.entry = &call->entry;
+    state.listener_index = call->listener_index;
 
-    if (listener_entry->listener_interface->on_leave != NULL)
-    {
-      listener_entry->listener_interface->on_leave (
-          listener_entry->listener_instance, invocation_ctx);
-    }
+    call->callback (call->entry.listener_instance, invocation_ctx);
   }
 
+  if (shard != NULL)
+    shard->listener_time += g_get_monotonic_time () - start_time;
+
   gum_thread_set_system_error (invocation_ctx->system_error);
 
   gum_invocation_stack_pop (interceptor_ctx->stack);
@@ -1421,7 +2886,11 @@ get_interceptor_thread_context (void)
 {
   InterceptorThreadContext * context;
 
-  context = g_private_get (&gum_interceptor_context_private);
+  /*
+   * The GPrivate is only there to get us a destructor on thread exit, the
+   * lookup on the hot path goes through our own TLS key.
+   */
+  context = gum_tls_key_get_value (gum_interceptor_context_key);
   if (context == NULL)
   {
     context = interceptor_thread_context_new ();
@@ -1431,6 +2900,7 @@ get_interceptor_thread_context (void)
     gum_spinlock_release (&gum_interceptor_thread_context_lock);
 
     g_private_set (&gum_interceptor_context_private, context);
+    gum_tls_key_set_value (gum_interceptor_context_key, context);
   }
 
   return context;
@@ -1442,7 +2912,10 @@ release_interceptor_thread_context (InterceptorThreadContext * context)
   if (gum_interceptor_thread_contexts == NULL)
     return;
 
+  gum_tls_key_set_value (gum_interceptor_context_key, NULL);
+
   gum_spinlock_acquire (&gum_interceptor_thread_context_lock);
+  interceptor_thread_context_salvage_captures (context);
   g_hash_table_remove (gum_interceptor_thread_contexts, context);
   gum_spinlock_release (&gum_interceptor_thread_context_lock);
 }
@@ -1485,7 +2958,7 @@ gum_interceptor_invocation_get_listener_thread_data (
       (ListenerInvocationState *) context->backend->data;
 
   return interceptor_thread_context_get_listener_data (data->interceptor_ctx,
-      data->entry->listener_instance, required_size);
+      data->entry, required_size);
 }
 
 static gpointer
@@ -1502,13 +2975,52 @@ gum_interceptor_invocation_get_listener_function_invocation_data (
     gsize required_size)
 {
   ListenerInvocationState * data;
+  GumInvocationStackEntry * entry;
+  GByteArray * invocation_data;
+  guint index, used_bit, offset, size;
 
   data = (ListenerInvocationState *) context->backend->data;
+  entry = data->stack_entry;
+  invocation_data = data->interceptor_ctx->invocation_data;
+  index = data->listener_index;
 
-  if (required_size > GUM_MAX_LISTENER_DATA)
+  if (required_size > GUM_MAX_LISTENER_DATA ||
+      index >= GUM_MAX_LISTENERS_PER_FUNCTION)
     return NULL;
 
-  return data->invocation_data;
+  used_bit = 1 << index;
+  if ((entry->listener_invocation_data_used & used_bit) != 0 &&
+      required_size <= entry->listener_invocation_data_size[index])
+  {
+    return invocation_data->data +
+        entry->listener_invocation_data_offset[index];
+  }
+
+  /*
+   * Listeners only run while their frame is on top of the stack, so the
+   * frame's data always ends where free space begins, and space is carved
+   * out of the per-thread buffer in the size actually asked for. A later
+   * request for more than was first asked for moves the data to the end.
+   */
+  offset = entry->listener_invocation_data_end;
+  size = MAX ((required_size + 15) & ~((gsize) 15), 16);
+  if (invocation_data->len < offset + size)
+    g_byte_array_set_size (invocation_data, offset + size);
+
+  gum_memset (invocation_data->data + offset, 0, size);
+  if ((entry->listener_invocation_data_used & used_bit) != 0)
+  {
+    gum_memcpy (invocation_data->data + offset, invocation_data->data +
+        entry->listener_invocation_data_offset[index],
+        entry->listener_invocation_data_size[index]);
+  }
+
+  entry->listener_invocation_data_offset[index] = offset;
+  entry->listener_invocation_data_size[index] = size;
+  entry->listener_invocation_data_end = offset + size;
+  entry->listener_invocation_data_used |= used_bit;
+
+  return invocation_data->data + offset;
 }
 
 static gpointer
@@ -1571,9 +3083,12 @@ interceptor_thread_context_new (void)
   context->replacement_backend.state = context;
 
   context->ignore_level = 0;
+  context->thread_id = gum_process_get_current_thread_id ();
 
-  context->stack = g_array_sized_new (FALSE, TRUE,
+  context->stack = g_array_sized_new (FALSE, FALSE,
       sizeof (GumInvocationStackEntry), GUM_MAX_CALL_DEPTH);
+  context->invocation_data = g_byte_array_sized_new (
+      GUM_MAX_LISTENERS_PER_FUNCTION * GUM_MAX_LISTENER_DATA);
 
   context->listener_data_slots = g_array_sized_new (FALSE, TRUE,
       sizeof (ListenerDataSlot), GUM_MAX_LISTENERS_PER_FUNCTION);
@@ -1584,8 +3099,16 @@ interceptor_thread_context_new (void)
 static void
 interceptor_thread_context_destroy (InterceptorThreadContext * context)
 {
+  guint i;
+
+  for (i = 0; i != GUM_STATISTICS_MAX_CHUNKS; i++)
+    g_free (context->statistics[i]);
+
+  g_free (context->capture_ring);
+
   g_array_free (context->listener_data_slots, TRUE);
 
+  g_byte_array_unref (context->invocation_data);
   g_array_free (context->stack, TRUE);
 
   g_slice_free (InterceptorThreadContext, context);
@@ -1593,61 +3116,190 @@ interceptor_thread_context_destroy (InterceptorThreadContext * context)
 
 static gpointer
 interceptor_thread_context_get_listener_data (InterceptorThreadContext * self,
-                                              GumInvocationListener * listener,
+                                              ListenerEntry * entry,
                                               gsize required_size)
 {
-  guint i;
-  ListenerDataSlot * available_slot = NULL;
+  GArray * slots = self->listener_data_slots;
+  guint index = entry->listener_data_index;
+  ListenerDataSlot * slot;
 
   if (required_size > GUM_MAX_LISTENER_DATA)
     return NULL;
 
-  for (i = 0; i != self->listener_data_slots->len; i++)
+  if (index >= slots->len)
+    g_array_set_size (slots, index + 1);
+
+  slot = &g_array_index (slots, ListenerDataSlot, index);
+  if (slot->owner != entry->listener_instance)
+  {
+    gum_memset (slot->data, 0, sizeof (slot->data));
+    slot->owner = entry->listener_instance;
+  }
+
+  return slot->data;
+}
+
+/*
+ * Asks the filter once per thread and filter, as the answer is kept in the
+ * listener's slot. Unfiltered listeners are always selected.
+ */
+static gboolean
+interceptor_thread_context_selects (InterceptorThreadContext * self,
+                                    const ListenerEntry * entry)
+{
+  ListenerThreadFilter * filter = entry->thread_filter;
+  GArray * slots = self->listener_data_slots;
+  guint index = entry->listener_data_index;
+  ListenerDataSlot * slot;
+
+  if (filter == NULL)
+    return TRUE;
+
+  if (index >= slots->len)
+    g_array_set_size (slots, index + 1);
+
+  slot = &g_array_index (slots, ListenerDataSlot, index);
+  if (slot->thread_filter_id != filter->id)
   {
-    ListenerDataSlot * slot;
+    slot->thread_selected = g_hash_table_contains (filter->thread_ids,
+        GSIZE_TO_POINTER (self->thread_id));
+    slot->thread_filter_id = filter->id;
+  }
+
+  return slot->thread_selected;
+}
 
-    slot = &g_array_index (self->listener_data_slots, ListenerDataSlot, i);
-    if (slot->owner == listener)
-      return slot->data;
-    else if (slot->owner == NULL)
-      available_slot = slot;
+static void
+interceptor_thread_context_forget_listener_data (
+    InterceptorThreadContext * self,
+    guint listener_data_index)
+{
+  if (listener_data_index < self->listener_data_slots->len)
+  {
+    g_array_index (self->listener_data_slots, ListenerDataSlot,
+        listener_data_index).owner = NULL;
   }
+}
+
+/*
+ * The owning thread is the only producer of its ring, and drains happen with
+ * the thread context lock held, so there is only ever one consumer too.
+ */
+static GumCapturedCall *
+interceptor_thread_context_reserve_capture (InterceptorThreadContext * self)
+{
+  GumCaptureRing * ring = self->capture_ring;
+  guint head;
 
-  if (available_slot == NULL)
+  if (ring == NULL)
   {
-    g_array_set_size (self->listener_data_slots,
-        self->listener_data_slots->len + 1);
-    available_slot = &g_array_index (self->listener_data_slots,
-        ListenerDataSlot, self->listener_data_slots->len - 1);
+    ring = g_new0 (GumCaptureRing, 1);
+    g_atomic_pointer_set (&self->capture_ring, ring);
   }
-  else
+
+  head = ring->head;
+  if (head - g_atomic_int_get (&ring->tail) == GUM_CAPTURE_RING_CAPACITY)
   {
-    gum_memset (available_slot->data, 0, sizeof (available_slot->data));
+    g_atomic_int_inc (&gum_interceptor_dropped_capture_count);
+    return NULL;
   }
 
-  available_slot->owner = listener;
+  return &ring->records[head % GUM_CAPTURE_RING_CAPACITY];
+}
+
+static void
+interceptor_thread_context_commit_capture (InterceptorThreadContext * self)
+{
+  GumCaptureRing * ring = self->capture_ring;
 
-  return available_slot->data;
+  g_atomic_int_set (&ring->head, ring->head + 1);
 }
 
+/* Called with the thread context lock held, as the thread goes away. */
 static void
-interceptor_thread_context_forget_listener_data (
-    InterceptorThreadContext * self,
-    GumInvocationListener * listener)
+interceptor_thread_context_salvage_captures (InterceptorThreadContext * self)
 {
-  guint i;
+  GumCaptureRing * ring = self->capture_ring;
+  GArray * exited;
+  guint pending, room;
+
+  if (ring == NULL)
+    return;
+
+  pending = ring->head - ring->tail;
+  if (pending == 0)
+    return;
+
+  exited = gum_interceptor_exited_captures;
+  if (exited == NULL)
+  {
+    exited = g_array_new (FALSE, FALSE, sizeof (GumCapturedCall));
+    gum_interceptor_exited_captures = exited;
+  }
 
-  for (i = 0; i != self->listener_data_slots->len; i++)
+  room = GUM_CAPTURE_EXITED_LIMIT - MIN (exited->len,
+      GUM_CAPTURE_EXITED_LIMIT);
+  if (pending > room)
   {
-    ListenerDataSlot * slot;
+    g_atomic_int_add (&gum_interceptor_dropped_capture_count, pending - room);
+    pending = room;
+  }
 
-    slot = &g_array_index (self->listener_data_slots, ListenerDataSlot, i);
-    if (slot->owner == listener)
-    {
-      slot->owner = NULL;
-      return;
-    }
+  g_array_set_size (exited, exited->len + pending);
+  gum_capture_ring_drain (ring, &g_array_index (exited, GumCapturedCall,
+      exited->len - pending), pending);
+}
+
+static guint
+gum_capture_ring_drain (GumCaptureRing * ring,
+                        GumCapturedCall * calls,
+                        guint max_calls)
+{
+  guint tail, head, n, offset, first;
+
+  tail = ring->tail;
+  head = g_atomic_int_get (&ring->head);
+  n = MIN (head - tail, max_calls);
+
+  offset = tail % GUM_CAPTURE_RING_CAPACITY;
+  first = MIN (n, GUM_CAPTURE_RING_CAPACITY - offset);
+  memcpy (calls, &ring->records[offset], first * sizeof (GumCapturedCall));
+  memcpy (calls + first, &ring->records[0],
+      (n - first) * sizeof (GumCapturedCall));
+
+  g_atomic_int_set (&ring->tail, tail + n);
+
+  return n;
+}
+
+static GumFunctionStatisticsShard *
+interceptor_thread_context_get_statistics (InterceptorThreadContext * self,
+                                           GumFunctionContext * function_ctx)
+{
+  guint index = function_ctx->statistics_index;
+  GumFunctionStatisticsShard * chunk, * shard;
+
+  if (index == GUM_STATISTICS_INDEX_NONE)
+    return NULL;
+
+  chunk = self->statistics[index / GUM_STATISTICS_CHUNK_SIZE];
+  if (chunk == NULL)
+  {
+    chunk = g_new0 (GumFunctionStatisticsShard, GUM_STATISTICS_CHUNK_SIZE);
+    g_atomic_pointer_set (&self->statistics[index / GUM_STATISTICS_CHUNK_SIZE],
+        chunk);
   }
+
+  shard = &chunk[index % GUM_STATISTICS_CHUNK_SIZE];
+  if (shard->id != function_ctx->statistics_id)
+  {
+    shard->calls = 0;
+    shard->bypassed_calls = 0;
+    shard->listener_time = 0;
+    shard->id = function_ctx->statistics_id;
+  }
+
+  return shard;
 }
 
 static GumInvocationStackEntry *
@@ -1663,10 +3315,20 @@ gum_invocation_stack_push (GumInvocationStack * stack,
       &g_array_index (stack, GumInvocationStackEntry, stack->len - 1);
   entry->trampoline_ret_addr = function_ctx->on_leave_trampoline;
   entry->caller_ret_addr = caller_ret_addr;
+  entry->listener_invocation_data_end = (stack->len > 1)
+      ? g_array_index (stack, GumInvocationStackEntry,
+          stack->len - 2).listener_invocation_data_end
+      : 0;
+  entry->listener_invocation_data_used = 0;
+  entry->calling_replacement = FALSE;
+  entry->original_system_error = 0;
+  entry->capture_pending = FALSE;
 
   ctx = &entry->invocation_context;
   ctx->function =
       GUM_POINTER_TO_FUNCPTR (GCallback, function_ctx->function_address);
+  ctx->cpu_context = NULL;
+  ctx->system_error = 0;
 
   ctx->backend = NULL;
 
@@ -1728,6 +3390,26 @@ gum_page_address_from_pointer (gpointer ptr)
       GPOINTER_TO_SIZE (ptr) & ~((gsize) gum_query_page_size () - 1));
 }
 
+/*
+ * Given a sorted list of page addresses, returns the first node past the run
+ * of contiguous pages starting at `pages`, and stores the run's size.
+ */
+static GList *
+gum_page_run_end (GList * pages,
+                  guint page_size,
+                  gsize * run_size)
+{
+  guint8 * expected = pages->data;
+  GList * cur;
+
+  for (cur = pages; cur != NULL && cur->data == expected; cur = cur->next)
+    expected += page_size;
+
+  *run_size = expected - (guint8 *) pages->data;
+
+  return cur;
+}
+
 static gint
 gum_page_address_compare (gconstpointer a,
                           gconstpointer b)
@@ -11,6 +11,9 @@
 #include <glib-object.h>
 #include <gum/gumdefs.h>
 #include <gum/guminvocationlistener.h>
+#include <gum/gumprocess.h>
+
+#define GUM_CAPTURE_MAX_ARGS 8
 
 G_BEGIN_DECLS
 
@@ -19,6 +22,11 @@ G_DECLARE_FINAL_TYPE (GumInterceptor, gum_interceptor, GUM, INTERCEPTOR,
     GObject)
 
 typedef GArray GumInvocationStack;
+typedef struct _GumFunctionStatistics GumFunctionStatistics;
+typedef struct _GumCapturedCall GumCapturedCall;
+
+typedef void (* GumInterceptorProbeCallback) (GumCpuContext * cpu_context,
+    gpointer user_data);
 
 typedef enum
 {
@@ -36,6 +44,26 @@ typedef enum
   GUM_REPLACE_POLICY_VIOLATION = -3
 } GumReplaceReturn;
 
+struct _GumFunctionStatistics
+{
+  gpointer function_address;
+  guint64 calls;
+  guint64 bypassed_calls;
+  guint64 listener_time;
+};
+
+struct _GumCapturedCall
+{
+  gpointer function;
+  GumThreadId thread_id;
+  guint64 timestamp;
+
+  guint n_args;
+  gboolean has_return_value;
+  gpointer args[GUM_CAPTURE_MAX_ARGS];
+  gpointer return_value;
+};
+
 GUM_API GumInterceptor * gum_interceptor_obtain (void);
 
 GUM_API GumAttachReturn gum_interceptor_attach_listener (GumInterceptor * self,
@@ -43,10 +71,32 @@ GUM_API GumAttachReturn gum_interceptor_attach_listener (GumInterceptor * self,
     gpointer listener_function_data);
 GUM_API void gum_interceptor_detach_listener (GumInterceptor * self,
     GumInvocationListener * listener);
+GUM_API guint gum_interceptor_attach_many (GumInterceptor * self,
+    const gpointer * function_addresses, guint n_functions,
+    GumInvocationListener * listener, gpointer listener_function_data,
+    GumAttachReturn * results);
+
+GUM_API GumAttachReturn gum_interceptor_attach_probe (GumInterceptor * self,
+    gpointer function_address, GumInterceptorProbeCallback callback,
+    gpointer user_data);
+GUM_API void gum_interceptor_detach_probe (GumInterceptor * self,
+    gpointer function_address);
+
+GUM_API GumAttachReturn gum_interceptor_attach_capture (GumInterceptor * self,
+    gpointer function_address, guint n_args, gboolean capture_return);
+GUM_API void gum_interceptor_detach_capture (GumInterceptor * self,
+    gpointer function_address);
+GUM_API guint gum_interceptor_drain_captures (GumInterceptor * self,
+    GumCapturedCall * calls, guint max_calls);
+GUM_API guint gum_interceptor_get_dropped_capture_count (
+    GumInterceptor * self);
 
 GUM_API GumReplaceReturn gum_interceptor_replace_function (
     GumInterceptor * self, gpointer function_address,
     gpointer replacement_function, gpointer replacement_function_data);
+GUM_API GumReplaceReturn gum_interceptor_replace_function_fast (
+    GumInterceptor * self, gpointer function_address,
+    gpointer replacement_function, gpointer * original_function);
 GUM_API void gum_interceptor_revert_function (GumInterceptor * self,
     gpointer function_address);
 
@@ -54,6 +104,10 @@ GUM_API void gum_interceptor_begin_transaction (GumInterceptor * self);
 GUM_API void gum_interceptor_end_transaction (GumInterceptor * self);
 GUM_API gboolean gum_interceptor_flush (GumInterceptor * self);
 
+GUM_API void gum_interceptor_set_statistics_enabled (GumInterceptor * self,
+    gboolean enabled);
+GUM_API GArray * gum_interceptor_get_statistics (GumInterceptor * self);
+
 GUM_API GumInvocationContext * gum_interceptor_get_current_invocation (void);
 GUM_API GumInvocationStack * gum_interceptor_get_current_stack (void);
 
@@ -63,8 +117,18 @@ GUM_API void gum_interceptor_unignore_current_thread (GumInterceptor * self);
 GUM_API void gum_interceptor_ignore_other_threads (GumInterceptor * self);
 GUM_API void gum_interceptor_unignore_other_threads (GumInterceptor * self);
 
+GUM_API void gum_interceptor_set_listener_threads (GumInterceptor * self,
+    GumInvocationListener * listener, const GumThreadId * thread_ids,
+    guint n_thread_ids);
+GUM_API void gum_interceptor_add_listener_thread (GumInterceptor * self,
+    GumInvocationListener * listener, GumThreadId thread_id);
+GUM_API void gum_interceptor_remove_listener_thread (GumInterceptor * self,
+    GumInvocationListener * listener, GumThreadId thread_id);
+
 GUM_API gpointer gum_invocation_stack_translate (GumInvocationStack * self,
     gpointer return_address);
+GUM_API gpointer gum_invocation_stack_translate_next (
+    GumInvocationStack * self, gpointer return_address, guint * depth);
 
 G_END_DECLS
 
@@ -6,6 +6,18 @@
 
 #include "gumkernel.h"
 
+GArray *
+gum_kernel_collect_ranges (GumPageProtection prot)
+{
+  GArray * entries;
+
+  entries = g_array_new (FALSE, FALSE, sizeof (GumRangeEntry));
+  gum_kernel_enumerate_ranges (prot,
+      (GumFoundRangeFunc) gum_range_entry_collect, entries);
+
+  return entries;
+}
+
 #ifndef HAVE_DARWIN
 
 gboolean
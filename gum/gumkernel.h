@@ -38,6 +38,7 @@ GUM_API void gum_kernel_scan (const GumMemoryRange * range,
     gpointer user_data);
 GUM_API void gum_kernel_enumerate_ranges (GumPageProtection prot,
     GumFoundRangeFunc func, gpointer user_data);
+GUM_API GArray * gum_kernel_collect_ranges (GumPageProtection prot);
 GUM_API void gum_kernel_enumerate_module_ranges (const gchar * module_name,
     GumPageProtection prot, GumFoundKernelModuleRangeFunc func,
     gpointer user_data);
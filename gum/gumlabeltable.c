@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumlabeltable.h"
+
+#include <string.h>
+
+/*
+ * Writers are reset for every block that Stalker and friends emit, so both
+ * containers start out in storage embedded in the writer and only move to
+ * the heap once a block outgrows it. Heap storage, once acquired, is kept
+ * across clears so that a busy writer stops allocating after warming up.
+ */
+
+static GumLabelTableEntry * gum_label_table_get_entries (GumLabelTable * self);
+static GumLabelTableEntry * gum_label_table_find (GumLabelTableEntry * entries,
+    guint capacity, gconstpointer id);
+static void gum_label_table_grow (GumLabelTable * self);
+
+static void gum_ref_array_grow (GumRefArray * self);
+
+void
+gum_label_table_init (GumLabelTable * self)
+{
+  self->heap_entries = NULL;
+  self->capacity = GUM_LABEL_TABLE_INLINE_CAPACITY;
+  self->size = 0;
+
+  memset (self->inline_entries, 0, sizeof (self->inline_entries));
+}
+
+void
+gum_label_table_free (GumLabelTable * self)
+{
+  g_free (self->heap_entries);
+  self->heap_entries = NULL;
+
+  self->capacity = 0;
+  self->size = 0;
+}
+
+void
+gum_label_table_clear (GumLabelTable * self)
+{
+  if (self->size == 0)
+    return;
+
+  memset (gum_label_table_get_entries (self), 0,
+      self->capacity * sizeof (GumLabelTableEntry));
+  self->size = 0;
+}
+
+gpointer
+gum_label_table_lookup (GumLabelTable * self,
+                        gconstpointer id)
+{
+  GumLabelTableEntry * entry;
+
+  if (self->size == 0)
+    return NULL;
+
+  entry = gum_label_table_find (gum_label_table_get_entries (self),
+      self->capacity, id);
+
+  return entry->address;
+}
+
+gboolean
+gum_label_table_insert (GumLabelTable * self,
+                        gconstpointer id,
+                        gpointer address)
+{
+  GumLabelTableEntry * entry;
+
+  g_assert (id != NULL);
+
+  if ((self->size + 1) * 4 > self->capacity * 3)
+    gum_label_table_grow (self);
+
+  entry = gum_label_table_find (gum_label_table_get_entries (self),
+      self->capacity, id);
+  if (entry->id != NULL)
+    return FALSE;
+
+  entry->id = id;
+  entry->address = address;
+  self->size++;
+
+  return TRUE;
+}
+
+static GumLabelTableEntry *
+gum_label_table_get_entries (GumLabelTable * self)
+{
+  return (self->heap_entries != NULL)
+      ? self->heap_entries
+      : self->inline_entries;
+}
+
+static GumLabelTableEntry *
+gum_label_table_find (GumLabelTableEntry * entries,
+                      guint capacity,
+                      gconstpointer id)
+{
+  guint mask, index_;
+  gsize hash;
+
+  hash = GPOINTER_TO_SIZE (id);
+  hash ^= hash >> 16;
+  hash *= 0x9e3779b1;
+  hash ^= hash >> 15;
+
+  mask = capacity - 1;
+
+  index_ = hash & mask;
+  while (entries[index_].id != NULL && entries[index_].id != id)
+    index_ = (index_ + 1) & mask;
+
+  return &entries[index_];
+}
+
+static void
+gum_label_table_grow (GumLabelTable * self)
+{
+  GumLabelTableEntry * old_entries, * new_entries;
+  guint old_capacity, new_capacity, i;
+
+  old_entries = gum_label_table_get_entries (self);
+  old_capacity = self->capacity;
+
+  new_capacity = old_capacity * 2;
+  new_entries = g_new0 (GumLabelTableEntry, new_capacity);
+
+  for (i = 0; i != old_capacity; i++)
+  {
+    const GumLabelTableEntry * entry = &old_entries[i];
+
+    if (entry->id != NULL)
+      *gum_label_table_find (new_entries, new_capacity, entry->id) = *entry;
+  }
+
+  g_free (self->heap_entries);
+  self->heap_entries = new_entries;
+  self->capacity = new_capacity;
+}
+
+void
+gum_ref_array_init (GumRefArray * self,
+                    guint element_size)
+{
+  self->heap_data = NULL;
+  self->length = 0;
+  self->capacity = GUM_REF_ARRAY_INLINE_SIZE / element_size;
+
+  self->element_size = element_size;
+}
+
+void
+gum_ref_array_free (GumRefArray * self)
+{
+  self->element_size = 0;
+
+  self->capacity = 0;
+  self->length = 0;
+  g_free (self->heap_data);
+  self->heap_data = NULL;
+}
+
+void
+gum_ref_array_clear (GumRefArray * self)
+{
+  self->length = 0;
+}
+
+gpointer
+gum_ref_array_element_at (GumRefArray * self,
+                          guint index_)
+{
+  guint8 * data;
+
+  data = (self->heap_data != NULL)
+      ? self->heap_data
+      : self->inline_data.bytes;
+
+  return data + (index_ * self->element_size);
+}
+
+gpointer
+gum_ref_array_append (GumRefArray * self)
+{
+  if (self->length == self->capacity)
+    gum_ref_array_grow (self);
+
+  return gum_ref_array_element_at (self, self->length++);
+}
+
+static void
+gum_ref_array_grow (GumRefArray * self)
+{
+  guint new_capacity;
+
+  new_capacity = self->capacity * 2;
+
+  if (self->heap_data != NULL)
+  {
+    self->heap_data = g_realloc (self->heap_data,
+        new_capacity * self->element_size);
+  }
+  else
+  {
+    self->heap_data = g_malloc (new_capacity * self->element_size);
+    memcpy (self->heap_data, self->inline_data.bytes,
+        self->length * self->element_size);
+  }
+
+  self->capacity = new_capacity;
+}
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_LABEL_TABLE_H__
+#define __GUM_LABEL_TABLE_H__
+
+#include <glib.h>
+
+#define GUM_LABEL_TABLE_INLINE_CAPACITY 32
+#define GUM_REF_ARRAY_INLINE_SIZE 512
+
+G_BEGIN_DECLS
+
+typedef struct _GumLabelTable GumLabelTable;
+typedef struct _GumLabelTableEntry GumLabelTableEntry;
+typedef struct _GumRefArray GumRefArray;
+
+struct _GumLabelTableEntry
+{
+  gconstpointer id;
+  gpointer address;
+};
+
+struct _GumLabelTable
+{
+  GumLabelTableEntry * heap_entries;
+  guint capacity;
+  guint size;
+
+  GumLabelTableEntry inline_entries[GUM_LABEL_TABLE_INLINE_CAPACITY];
+};
+
+struct _GumRefArray
+{
+  gpointer heap_data;
+  guint length;
+  guint capacity;
+
+  guint element_size;
+
+  union
+  {
+    guint64 alignment;
+    guint8 bytes[GUM_REF_ARRAY_INLINE_SIZE];
+  } inline_data;
+};
+
+void gum_label_table_init (GumLabelTable * self);
+void gum_label_table_free (GumLabelTable * self);
+void gum_label_table_clear (GumLabelTable * self);
+
+gpointer gum_label_table_lookup (GumLabelTable * self, gconstpointer id);
+gboolean gum_label_table_insert (GumLabelTable * self, gconstpointer id,
+    gpointer address);
+
+void gum_ref_array_init (GumRefArray * self, guint element_size);
+void gum_ref_array_free (GumRefArray * self);
+void gum_ref_array_clear (GumRefArray * self);
+
+gpointer gum_ref_array_element_at (GumRefArray * self, guint index_);
+gpointer gum_ref_array_append (GumRefArray * self);
+
+G_END_DECLS
+
+#endif
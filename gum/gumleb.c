@@ -72,3 +72,45 @@ gum_skip_uleb128 (const guint8 ** data)
   p++;
   *data = p;
 }
+
+void
+gum_write_sleb128 (GByteArray * buffer,
+                   gint64 value)
+{
+  gboolean more;
+
+  do
+  {
+    guint8 chunk;
+
+    chunk = value & 0x7f;
+    value >>= 7;
+
+    more = !((value == 0 && (chunk & 0x40) == 0) ||
+        (value == -1 && (chunk & 0x40) != 0));
+    if (more)
+      chunk |= 0x80;
+
+    g_byte_array_append (buffer, &chunk, 1);
+  }
+  while (more);
+}
+
+void
+gum_write_uleb128 (GByteArray * buffer,
+                   guint64 value)
+{
+  do
+  {
+    guint8 chunk;
+
+    chunk = value & 0x7f;
+    value >>= 7;
+
+    if (value != 0)
+      chunk |= 0x80;
+
+    g_byte_array_append (buffer, &chunk, 1);
+  }
+  while (value != 0);
+}
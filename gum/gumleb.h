@@ -15,6 +15,9 @@ G_GNUC_INTERNAL gint64 gum_read_sleb128 (const guint8 ** data, const guint8 * en
 G_GNUC_INTERNAL guint64 gum_read_uleb128 (const guint8 ** data, const guint8 * end);
 G_GNUC_INTERNAL void gum_skip_uleb128 (const guint8 ** data);
 
+G_GNUC_INTERNAL void gum_write_sleb128 (GByteArray * buffer, gint64 value);
+G_GNUC_INTERNAL void gum_write_uleb128 (GByteArray * buffer, guint64 value);
+
 G_END_DECLS
 
 #endif
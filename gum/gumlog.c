@@ -0,0 +1,411 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumlog.h"
+
+#include "gum-init.h"
+#include "gumlibc.h"
+#include "gummemory.h"
+#include "gumprintf.h"
+#include "gumspinlock.h"
+#include "gumtls.h"
+
+#include <stdio.h>
+
+/*
+ * Each thread appends to its own single-producer single-consumer ring, so
+ * the hot path is a couple of memcpy()s and one atomic store. A background
+ * thread drains all rings periodically and hands the bytes to the sink.
+ * Records from one thread are kept in order, but there is no ordering
+ * across threads. When a ring is full the record is dropped and accounted
+ * for, rather than blocking the caller.
+ */
+
+#define GUM_LOG_BUFFER_SIZE (16 * 1024)
+#define GUM_LOG_INLINE_RECORD_SIZE 1024
+#define GUM_LOG_FLUSH_INTERVAL (20 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct _GumLogBuffer GumLogBuffer;
+
+struct _GumLogBuffer
+{
+  GumLogBuffer * next;
+  volatile gint orphaned;
+  volatile gint dropped;
+
+  volatile guint head;
+  volatile guint tail;
+  gchar data[GUM_LOG_BUFFER_SIZE];
+};
+
+static void gum_log_start (void);
+static void gum_log_stop (void);
+static gpointer gum_log_flusher_main (gpointer data);
+static void gum_log_drain (void);
+
+static GumLogBuffer * gum_log_buffer_get (void);
+static void gum_log_buffer_release (GumLogBuffer * buffer);
+static void gum_log_buffer_drain (GumLogBuffer * buffer, GString * output);
+
+static void gum_log_write_to_stderr (const gchar * data, gsize size,
+    gpointer user_data);
+
+static GMutex gum_log_mutex;
+static GCond gum_log_cond;
+static volatile gint gum_log_started = FALSE;
+static gboolean gum_log_stopping = FALSE;
+static gboolean gum_log_destructor_registered = FALSE;
+static GThread * gum_log_flusher = NULL;
+
+static GumTlsKey gum_log_buffer_key;
+static GPrivate gum_log_buffer_private =
+    G_PRIVATE_INIT ((GDestroyNotify) gum_log_buffer_release);
+static GumSpinlock gum_log_buffers_lock;
+static GumLogBuffer * gum_log_buffers = NULL;
+
+static GMutex gum_log_drain_mutex;
+static GString * gum_log_staging = NULL;
+static GumLogSinkFunc gum_log_sink_func = gum_log_write_to_stderr;
+static gpointer gum_log_sink_data = NULL;
+static GDestroyNotify gum_log_sink_data_destroy = NULL;
+
+void
+gum_log_printf (const gchar * format,
+                ...)
+{
+  va_list args;
+
+  va_start (args, format);
+  gum_log_vprintf (format, args);
+  va_end (args);
+}
+
+void
+gum_log_vprintf (const gchar * format,
+                 va_list args)
+{
+  gchar record[GUM_LOG_INLINE_RECORD_SIZE];
+  va_list args_copy;
+  gint length;
+
+  G_VA_COPY (args_copy, args);
+
+  length = gum_vsnprintf (record, sizeof (record), format, args);
+  if (length >= 0 && length < (gint) sizeof (record))
+  {
+    gum_log_write (record, length);
+  }
+  else if (length >= 0)
+  {
+    gchar * large_record;
+
+    length = gum_vasprintf (&large_record, format, args_copy);
+    if (length >= 0)
+    {
+      gum_log_write (large_record, length);
+      g_free (large_record);
+    }
+  }
+
+  va_end (args_copy);
+}
+
+void
+gum_log_write (const gchar * data,
+               gsize size)
+{
+  GumLogBuffer * buffer;
+  guint head, tail, offset, chunk_size;
+
+  if (size == 0)
+    return;
+
+  buffer = gum_log_buffer_get ();
+
+  head = buffer->head;
+  tail = g_atomic_int_get (&buffer->tail);
+
+  if (size > GUM_LOG_BUFFER_SIZE - (head - tail))
+  {
+    g_atomic_int_add (&buffer->dropped, size);
+    return;
+  }
+
+  offset = head & (GUM_LOG_BUFFER_SIZE - 1);
+  chunk_size = MIN (size, GUM_LOG_BUFFER_SIZE - offset);
+
+  gum_memcpy (buffer->data + offset, data, chunk_size);
+  gum_memcpy (buffer->data, data + chunk_size, size - chunk_size);
+
+  g_atomic_int_set (&buffer->head, head + size);
+}
+
+void
+gum_log_flush (void)
+{
+  if (!g_atomic_int_get (&gum_log_started))
+    return;
+
+  gum_log_drain ();
+}
+
+void
+gum_log_set_sink (GumLogSinkFunc func,
+                  gpointer data,
+                  GDestroyNotify data_destroy)
+{
+  gpointer old_data;
+  GDestroyNotify old_data_destroy;
+
+  g_mutex_lock (&gum_log_drain_mutex);
+
+  old_data = gum_log_sink_data;
+  old_data_destroy = gum_log_sink_data_destroy;
+
+  if (func != NULL)
+  {
+    gum_log_sink_func = func;
+    gum_log_sink_data = data;
+    gum_log_sink_data_destroy = data_destroy;
+  }
+  else
+  {
+    gum_log_sink_func = gum_log_write_to_stderr;
+    gum_log_sink_data = NULL;
+    gum_log_sink_data_destroy = NULL;
+  }
+
+  g_mutex_unlock (&gum_log_drain_mutex);
+
+  if (old_data_destroy != NULL)
+    old_data_destroy (old_data);
+}
+
+static void
+gum_log_start (void)
+{
+  g_mutex_lock (&gum_log_mutex);
+
+  if (!gum_log_started)
+  {
+    gum_spinlock_init (&gum_log_buffers_lock);
+    gum_log_buffer_key = gum_tls_key_new ();
+
+    gum_log_staging = g_string_sized_new (GUM_LOG_BUFFER_SIZE);
+
+    gum_log_stopping = FALSE;
+    gum_log_flusher = g_thread_new ("gum-log-flusher", gum_log_flusher_main,
+        NULL);
+
+    if (!gum_log_destructor_registered)
+    {
+      _gum_register_destructor (gum_log_stop);
+      gum_log_destructor_registered = TRUE;
+    }
+
+    g_atomic_int_set (&gum_log_started, TRUE);
+  }
+
+  g_mutex_unlock (&gum_log_mutex);
+}
+
+static void
+gum_log_stop (void)
+{
+  GumLogBuffer * buffer;
+
+  gum_log_destructor_registered = FALSE;
+
+  if (!gum_log_started)
+    return;
+
+  g_mutex_lock (&gum_log_mutex);
+  gum_log_stopping = TRUE;
+  g_cond_signal (&gum_log_cond);
+  g_mutex_unlock (&gum_log_mutex);
+
+  g_thread_join (gum_log_flusher);
+  gum_log_flusher = NULL;
+
+  gum_log_drain ();
+
+  gum_spinlock_acquire (&gum_log_buffers_lock);
+  buffer = gum_log_buffers;
+  gum_log_buffers = NULL;
+  gum_spinlock_release (&gum_log_buffers_lock);
+
+  while (buffer != NULL)
+  {
+    GumLogBuffer * next = buffer->next;
+
+    gum_free (buffer);
+
+    buffer = next;
+  }
+
+  gum_tls_key_set_value (gum_log_buffer_key, NULL);
+  gum_tls_key_free (gum_log_buffer_key);
+
+  g_string_free (gum_log_staging, TRUE);
+  gum_log_staging = NULL;
+
+  g_atomic_int_set (&gum_log_started, FALSE);
+}
+
+static gpointer
+gum_log_flusher_main (gpointer data)
+{
+  g_mutex_lock (&gum_log_mutex);
+
+  while (!gum_log_stopping)
+  {
+    g_cond_wait_until (&gum_log_cond, &gum_log_mutex,
+        g_get_monotonic_time () + GUM_LOG_FLUSH_INTERVAL);
+
+    g_mutex_unlock (&gum_log_mutex);
+    gum_log_drain ();
+    g_mutex_lock (&gum_log_mutex);
+  }
+
+  g_mutex_unlock (&gum_log_mutex);
+
+  return NULL;
+}
+
+static void
+gum_log_drain (void)
+{
+  GumLogBuffer * buffer, ** link, * orphans;
+
+  g_mutex_lock (&gum_log_drain_mutex);
+
+  orphans = NULL;
+
+  gum_spinlock_acquire (&gum_log_buffers_lock);
+
+  link = &gum_log_buffers;
+  while ((buffer = *link) != NULL)
+  {
+    /* Checked before draining so that a thread's final records make it. */
+    gboolean orphaned = g_atomic_int_get (&buffer->orphaned);
+
+    gum_log_buffer_drain (buffer, gum_log_staging);
+
+    if (orphaned)
+    {
+      *link = buffer->next;
+      buffer->next = orphans;
+      orphans = buffer;
+    }
+    else
+    {
+      link = &buffer->next;
+    }
+  }
+
+  gum_spinlock_release (&gum_log_buffers_lock);
+
+  while (orphans != NULL)
+  {
+    GumLogBuffer * next = orphans->next;
+
+    gum_free (orphans);
+
+    orphans = next;
+  }
+
+  if (gum_log_staging->len != 0)
+  {
+    gum_log_sink_func (gum_log_staging->str, gum_log_staging->len,
+        gum_log_sink_data);
+    g_string_truncate (gum_log_staging, 0);
+  }
+
+  g_mutex_unlock (&gum_log_drain_mutex);
+}
+
+static GumLogBuffer *
+gum_log_buffer_get (void)
+{
+  GumLogBuffer * buffer;
+
+  if (!g_atomic_int_get (&gum_log_started))
+    gum_log_start ();
+
+  buffer = gum_tls_key_get_value (gum_log_buffer_key);
+  if (buffer != NULL)
+    return buffer;
+
+  buffer = gum_malloc0 (sizeof (GumLogBuffer));
+
+  gum_spinlock_acquire (&gum_log_buffers_lock);
+  buffer->next = gum_log_buffers;
+  gum_log_buffers = buffer;
+  gum_spinlock_release (&gum_log_buffers_lock);
+
+  gum_tls_key_set_value (gum_log_buffer_key, buffer);
+  g_private_set (&gum_log_buffer_private, buffer);
+
+  return buffer;
+}
+
+static void
+gum_log_buffer_release (GumLogBuffer * buffer)
+{
+  GumLogBuffer * cur;
+
+  gum_spinlock_acquire (&gum_log_buffers_lock);
+
+  /* Might be stale if we got stopped while this thread was alive. */
+  for (cur = gum_log_buffers; cur != NULL && cur != buffer; cur = cur->next)
+    ;
+
+  if (cur != NULL)
+    g_atomic_int_set (&buffer->orphaned, TRUE);
+
+  gum_spinlock_release (&gum_log_buffers_lock);
+
+  if (cur != NULL)
+    gum_tls_key_set_value (gum_log_buffer_key, NULL);
+}
+
+static void
+gum_log_buffer_drain (GumLogBuffer * buffer,
+                      GString * output)
+{
+  guint head, tail, offset, chunk_size;
+  gint dropped;
+
+  head = g_atomic_int_get (&buffer->head);
+  tail = buffer->tail;
+
+  if (head != tail)
+  {
+    offset = tail & (GUM_LOG_BUFFER_SIZE - 1);
+    chunk_size = MIN (head - tail, GUM_LOG_BUFFER_SIZE - offset);
+
+    g_string_append_len (output, buffer->data + offset, chunk_size);
+    g_string_append_len (output, buffer->data, (head - tail) - chunk_size);
+
+    g_atomic_int_set (&buffer->tail, head);
+  }
+
+  dropped = g_atomic_int_get (&buffer->dropped);
+  if (dropped != 0)
+  {
+    g_atomic_int_add (&buffer->dropped, -dropped);
+    g_string_append_printf (output, "[gum-log: %d bytes dropped]\n", dropped);
+  }
+}
+
+static void
+gum_log_write_to_stderr (const gchar * data,
+                         gsize size,
+                         gpointer user_data)
+{
+  fwrite (data, 1, size, stderr);
+  fflush (stderr);
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_LOG_H__
+#define __GUM_LOG_H__
+
+#include <gum/gumdefs.h>
+
+G_BEGIN_DECLS
+
+typedef void (* GumLogSinkFunc) (const gchar * data, gsize size,
+    gpointer user_data);
+
+GUM_API void gum_log_printf (const gchar * format, ...) G_GNUC_PRINTF (1, 2);
+GUM_API void gum_log_vprintf (const gchar * format, va_list args);
+GUM_API void gum_log_write (const gchar * data, gsize size);
+GUM_API void gum_log_flush (void);
+
+GUM_API void gum_log_set_sink (GumLogSinkFunc func, gpointer data,
+    GDestroyNotify data_destroy);
+
+G_END_DECLS
+
+#endif
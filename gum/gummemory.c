@@ -6,10 +6,13 @@
 
 #include "gummemory.h"
 
+#include "gum-init.h"
 #include "gumcloak-priv.h"
 #include "gumcodesegment.h"
 #include "gumlibc.h"
 #include "gummemory-priv.h"
+#include "gumspinlock.h"
+#include "gumtls.h"
 
 #include <string.h>
 
@@ -42,7 +45,78 @@
 # pragma warning (pop)
 #endif
 
+#define GUM_HEAP_BIN_GRANULARITY 16
+#define GUM_HEAP_NUM_BINS 16
+#define GUM_HEAP_MAX_CACHED_SIZE \
+    (GUM_HEAP_NUM_BINS * GUM_HEAP_BIN_GRANULARITY)
+#define GUM_HEAP_MAX_CHUNKS_PER_BIN 32
+
+typedef guint GumHeapId;
+typedef struct _GumHeapCache GumHeapCache;
+typedef struct _GumHeapBin GumHeapBin;
+
+typedef struct _GumScanMultiAnchor GumScanMultiAnchor;
+typedef struct _GumScanSingleContext GumScanSingleContext;
+
+enum _GumHeapId
+{
+  GUM_HEAP_MAIN,
+  GUM_HEAP_CAPSTONE,
+
+  GUM_HEAP_COUNT
+};
+
+struct _GumHeapBin
+{
+  gpointer head;
+  guint count;
+};
+
+/*
+ * Each thread keeps a small cache of recently freed chunks in front of the
+ * mspaces, which take a lock on every call. Chunks stay allocated as far as
+ * dlmalloc is concerned, so realloc() and usable size queries keep working
+ * on them, and a chunk freed by a thread other than the one that allocated
+ * it simply ends up in the freeing thread's cache.
+ */
+struct _GumHeapCache
+{
+  GumHeapCache * prev;
+  GumHeapCache * next;
+
+  GumHeapBin bins[GUM_HEAP_COUNT][GUM_HEAP_NUM_BINS];
+};
+
+struct _GumScanMultiAnchor
+{
+  guint pattern_index;
+  guint offset;
+};
+
+struct _GumScanSingleContext
+{
+  GumMemoryScanMultiMatchFunc func;
+  gpointer user_data;
+};
+
+static void gum_capstone_heap_ensure (void);
+static gpointer gum_heap_alloc (GumHeapId heap, gsize size);
+static void gum_heap_free (GumHeapId heap, gpointer mem);
+static GumHeapCache * gum_heap_cache_get (void);
+static void gum_heap_cache_release (GumHeapCache * cache);
+static void gum_heap_cache_flush (GumHeapCache * cache);
+
+static gboolean gum_memory_patch_page_run (
+    const GumMemoryPatch * const * patches, guint n_patches);
+static gint gum_memory_patch_compare (const GumMemoryPatch ** a,
+    const GumMemoryPatch ** b);
+
+static gboolean gum_scan_single_emit_match (GumAddress address, gsize size,
+    GumScanSingleContext * ctx);
+
 static GumMatchPattern * gum_match_pattern_new (void);
+static GumMatchToken * gum_match_pattern_get_needle (
+    const GumMatchPattern * self);
 static void gum_match_pattern_update_computed_size (GumMatchPattern * self);
 static GumMatchToken * gum_match_pattern_get_longest_token (
     const GumMatchPattern * self, GumMatchType type);
@@ -56,6 +130,7 @@ static gboolean gum_match_pattern_seal (GumMatchPattern * self);
 
 static GumMatchToken * gum_match_token_new (GumMatchType type);
 static void gum_match_token_free (GumMatchToken * token);
+static gint gum_match_token_find_anchor (const GumMatchToken * self);
 static void gum_match_token_append (GumMatchToken * self, guint8 byte);
 static void gum_match_token_append_with_mask (GumMatchToken * self,
     guint8 byte, guint8 mask);
@@ -66,8 +141,16 @@ static void gum_memory_range_free (GumMemoryRange * range);
 static gboolean gum_memory_initialized = FALSE;
 static mspace gum_mspace_main = NULL;
 static mspace gum_mspace_capstone = NULL;
+static mspace gum_mspaces[GUM_HEAP_COUNT];
 static guint gum_cached_page_size;
 
+static GumTlsKey gum_heap_cache_key;
+static GPrivate gum_heap_cache_private =
+    G_PRIVATE_INIT ((GDestroyNotify) gum_heap_cache_release);
+static GumSpinlock gum_heap_cache_lock;
+static GumHeapCache * gum_heap_caches = NULL;
+static GumSpinlock gum_capstone_heap_lock;
+
 G_DEFINE_BOXED_TYPE (GumMemoryRange, gum_memory_range, gum_memory_range_copy,
     gum_memory_range_free)
 
@@ -84,8 +167,13 @@ gum_memory_init (void)
 
   _gum_cloak_init ();
 
+  /* Capstone's heap is only created once it allocates something. */
   gum_mspace_main = create_mspace (0, TRUE);
-  gum_mspace_capstone = create_mspace (0, TRUE);
+  gum_mspaces[GUM_HEAP_MAIN] = gum_mspace_main;
+
+  gum_spinlock_init (&gum_capstone_heap_lock);
+  gum_spinlock_init (&gum_heap_cache_lock);
+  gum_heap_cache_key = gum_tls_key_new ();
 }
 
 void
@@ -93,8 +181,23 @@ gum_memory_deinit (void)
 {
   g_assert (gum_memory_initialized);
 
-  destroy_mspace (gum_mspace_capstone);
-  gum_mspace_capstone = NULL;
+  /* The caches live inside the mspaces, so they go away along with them. */
+  gum_spinlock_acquire (&gum_heap_cache_lock);
+  gum_heap_caches = NULL;
+  gum_spinlock_release (&gum_heap_cache_lock);
+
+  gum_tls_key_set_value (gum_heap_cache_key, NULL);
+  gum_tls_key_free (gum_heap_cache_key);
+
+  gum_mspaces[GUM_HEAP_MAIN] = NULL;
+  gum_mspaces[GUM_HEAP_CAPSTONE] = NULL;
+
+  if (gum_mspace_capstone != NULL)
+  {
+    destroy_mspace (gum_mspace_capstone);
+    gum_mspace_capstone = NULL;
+  }
+  gum_spinlock_free (&gum_capstone_heap_lock);
 
   destroy_mspace (gum_mspace_main);
   gum_mspace_main = NULL;
@@ -179,17 +282,98 @@ gum_memory_patch_code (GumAddress address,
                        gsize size,
                        GumMemoryPatchApplyFunc apply,
                        gpointer apply_data)
+{
+  GumMemoryPatch patch;
+  const GumMemoryPatch * patches[1];
+
+  patch.address = address;
+  patch.size = size;
+  patch.apply = apply;
+  patch.apply_data = apply_data;
+
+  patches[0] = &patch;
+
+  return gum_memory_patch_page_run (patches, 1);
+}
+
+/*
+ * Applies many patches at once, in address order. Patches whose pages touch
+ * or overlap are grouped into runs, and each run is made writable, patched,
+ * made executable again and flushed from the cache in one go, instead of
+ * once per patch. Stops at the first run that cannot be made writable, with
+ * the runs before it already applied.
+ */
+gboolean
+gum_memory_patch_code_many (const GumMemoryPatch * patches,
+                            guint n_patches)
+{
+  GPtrArray * sorted_patches;
+  const GumMemoryPatch ** sorted;
+  gsize page_size;
+  gboolean success = TRUE;
+  guint first, i;
+
+  if (n_patches == 0)
+    return TRUE;
+
+  page_size = gum_query_page_size ();
+
+  sorted_patches = g_ptr_array_sized_new (n_patches);
+  for (i = 0; i != n_patches; i++)
+    g_ptr_array_add (sorted_patches, (gpointer) &patches[i]);
+  g_ptr_array_sort (sorted_patches, (GCompareFunc) gum_memory_patch_compare);
+  sorted = (const GumMemoryPatch **) sorted_patches->pdata;
+
+  first = 0;
+  while (first != n_patches && success)
+  {
+    GumAddress run_end;
+
+    run_end = GUM_ALIGN_SIZE (sorted[first]->address + sorted[first]->size,
+        page_size);
+
+    for (i = first + 1; i != n_patches; i++)
+    {
+      const GumMemoryPatch * patch = sorted[i];
+
+      if ((patch->address & ~((GumAddress) page_size - 1)) > run_end)
+        break;
+
+      run_end = MAX (run_end,
+          GUM_ALIGN_SIZE (patch->address + patch->size, page_size));
+    }
+
+    success = gum_memory_patch_page_run (sorted + first, i - first);
+
+    first = i;
+  }
+
+  g_ptr_array_unref (sorted_patches);
+
+  return success;
+}
+
+/* Expects the patches sorted by address, and their pages to form one run. */
+static gboolean
+gum_memory_patch_page_run (const GumMemoryPatch * const * patches,
+                           guint n_patches)
 {
   gsize page_size;
+  GumAddress start, end;
   guint8 * start_page, * end_page;
-  gsize page_offset, range_size;
+  gsize range_size;
   gboolean rwx_supported;
+  guint i;
 
   page_size = gum_query_page_size ();
-  start_page = GSIZE_TO_POINTER (((gsize) address) & ~(page_size - 1));
-  end_page = GSIZE_TO_POINTER (
-      ((gsize) (address + size - 1)) & ~(page_size - 1));
-  page_offset = ((guint8 *) GSIZE_TO_POINTER (address)) - start_page;
+
+  start = patches[0]->address;
+  end = start;
+  for (i = 0; i != n_patches; i++)
+    end = MAX (end, patches[i]->address + patches[i]->size);
+
+  start_page = GSIZE_TO_POINTER (((gsize) start) & ~(page_size - 1));
+  end_page = GSIZE_TO_POINTER (((gsize) (end - 1)) & ~(page_size - 1));
   range_size = (end_page + page_size) - start_page;
 
   rwx_supported = gum_query_is_rwx_supported ();
@@ -203,7 +387,12 @@ gum_memory_patch_code (GumAddress address,
     if (!gum_try_mprotect (start_page, range_size, protection))
       return FALSE;
 
-    apply (GSIZE_TO_POINTER (address), apply_data);
+    for (i = 0; i != n_patches; i++)
+    {
+      const GumMemoryPatch * patch = patches[i];
+
+      patch->apply (GSIZE_TO_POINTER (patch->address), patch->apply_data);
+    }
 
     if (!gum_try_mprotect (start_page, range_size, GUM_PAGE_RX))
       return FALSE;
@@ -217,18 +406,38 @@ gum_memory_patch_code (GumAddress address,
     scratch_page = gum_code_segment_get_address (segment);
     memcpy (scratch_page, start_page, range_size);
 
-    apply (scratch_page + page_offset, apply_data);
+    for (i = 0; i != n_patches; i++)
+    {
+      const GumMemoryPatch * patch = patches[i];
+
+      patch->apply (scratch_page +
+          ((guint8 *) GSIZE_TO_POINTER (patch->address) - start_page),
+          patch->apply_data);
+    }
 
     gum_code_segment_realize (segment);
     gum_code_segment_map (segment, 0, range_size, start_page);
     gum_code_segment_free (segment);
   }
 
-  gum_clear_cache (GSIZE_TO_POINTER (address), size);
+  gum_clear_cache (GSIZE_TO_POINTER (start), end - start);
 
   return TRUE;
 }
 
+static gint
+gum_memory_patch_compare (const GumMemoryPatch ** a,
+                          const GumMemoryPatch ** b)
+{
+  GumAddress lhs = (*a)->address;
+  GumAddress rhs = (*b)->address;
+
+  if (lhs == rhs)
+    return 0;
+
+  return (lhs < rhs) ? -1 : 1;
+}
+
 void
 gum_memory_scan (const GumMemoryRange * range,
                  const GumMatchPattern * pattern,
@@ -237,40 +446,70 @@ gum_memory_scan (const GumMemoryRange * range,
 {
   GumMatchToken * needle;
   guint8 * needle_data, * mask_data = NULL;
-  guint needle_len;
+  guint needle_len, last;
+  guint8 last_value, last_mask;
+  gint anchor;
   guint8 * cur, * end_address;
 
-  needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_EXACT);
-  if (needle == NULL)
-  {
-    needle = gum_match_pattern_get_longest_token (pattern, GUM_MATCH_MASK);
+  if (range->size < pattern->size)
+    return;
+
+  needle = gum_match_pattern_get_needle (pattern);
+  if (needle->type == GUM_MATCH_MASK)
     mask_data = (guint8 *) needle->masks->data;
-  }
 
   needle_data = (guint8 *) needle->bytes->data;
   needle_len = needle->bytes->len;
 
+  last = needle_len - 1;
+  last_mask = (mask_data != NULL) ? mask_data[last] : 0xff;
+  last_value = needle_data[last] & last_mask;
+
+  anchor = gum_match_token_find_anchor (needle);
+
   cur = GSIZE_TO_POINTER (range->base_address);
   end_address = cur + range->size - (pattern->size - needle->offset) + 1;
 
-  for (; cur < end_address; cur++)
+  /*
+   * Candidates are found by letting memchr() look for one byte of the needle
+   * that has to match exactly, as libc implementations are vectorized and
+   * pick the best kernel for the CPU at runtime. The needle's last byte is
+   * then checked before comparing all of it.
+   */
+  while (cur < end_address)
   {
     guint8 * start;
 
+    if (anchor != -1)
+    {
+      guint8 * hit;
+
+      hit = memchr (cur + anchor, needle_data[anchor], end_address - cur);
+      if (hit == NULL)
+        return;
+      cur = hit - anchor;
+    }
+
+    if ((cur[last] & last_mask) != last_value)
+    {
+      cur++;
+      continue;
+    }
+
     if (mask_data == NULL)
     {
-      if (cur[0] != needle_data[0] ||
-          memcmp (cur, needle_data, needle_len) != 0)
+      if (memcmp (cur, needle_data, needle_len) != 0)
       {
+        cur++;
         continue;
       }
     }
     else
     {
-      if ((cur[0] & mask_data[0]) != (needle_data[0] & mask_data[0]) ||
-          gum_memcmp_mask ((guint8 *) cur, (guint8 *) needle_data,
-              (guint8 *) mask_data, needle_len) != 0)
+      if (gum_memcmp_mask ((guint8 *) cur, (guint8 *) needle_data,
+          (guint8 *) mask_data, needle_len) != 0)
       {
+        cur++;
         continue;
       }
     }
@@ -282,9 +521,169 @@ gum_memory_scan (const GumMemoryRange * range,
       if (!func (GUM_ADDRESS (start), pattern->size, user_data))
         return;
 
-      cur = start + pattern->size - 1;
+      cur = start + pattern->size;
+    }
+    else
+    {
+      cur++;
+    }
+  }
+}
+
+/*
+ * Scans for all of the patterns in a single pass. Every pattern contributes
+ * one anchor byte, and a table indexed by byte value lists the patterns that
+ * may start at a fixed distance before it. Each byte of the range thus
+ * costs one lookup, plus a full match attempt for every pattern whose anchor
+ * it is. Patterns without any byte that has to match exactly are tried at
+ * every offset. Matches of the same pattern do not overlap, but matches of
+ * different patterns are reported in the order their anchors were found.
+ */
+void
+gum_memory_scan_multi (const GumMemoryRange * range,
+                       const GumMatchPattern * const * patterns,
+                       guint n_patterns,
+                       GumMemoryScanMultiMatchFunc func,
+                       gpointer user_data)
+{
+  guint first_anchor[G_MAXUINT8 + 2] = { 0, };
+  guint next_anchor[G_MAXUINT8 + 1];
+  GumScanMultiAnchor * anchors;
+  guint8 * anchor_values;
+  gint * anchor_offsets;
+  GArray * unanchored;
+  guint8 ** resume_at;
+  guint8 * base, * end, * cur;
+  guint i;
+
+  if (n_patterns == 1)
+  {
+    GumScanSingleContext ctx;
+
+    ctx.func = func;
+    ctx.user_data = user_data;
+
+    gum_memory_scan (range, patterns[0],
+        (GumMemoryScanMatchFunc) gum_scan_single_emit_match, &ctx);
+
+    return;
+  }
+
+  if (n_patterns == 0)
+    return;
+
+  anchors = g_new (GumScanMultiAnchor, n_patterns);
+  anchor_values = g_new (guint8, n_patterns);
+  anchor_offsets = g_new (gint, n_patterns);
+  unanchored = g_array_new (FALSE, FALSE, sizeof (guint));
+  resume_at = g_new (guint8 *, n_patterns);
+
+  base = GSIZE_TO_POINTER (range->base_address);
+  end = base + range->size;
+
+  for (i = 0; i != n_patterns; i++)
+  {
+    GumMatchToken * needle;
+    gint anchor;
+
+    needle = gum_match_pattern_get_needle (patterns[i]);
+    anchor = gum_match_token_find_anchor (needle);
+    if (anchor != -1)
+    {
+      anchor_values[i] = ((guint8 *) needle->bytes->data)[anchor];
+      anchor_offsets[i] = needle->offset + anchor;
+      first_anchor[anchor_values[i] + 1]++;
+    }
+    else
+    {
+      anchor_offsets[i] = -1;
+      g_array_append_val (unanchored, i);
+    }
+
+    resume_at[i] = base;
+  }
+
+  for (i = 1; i != G_N_ELEMENTS (first_anchor); i++)
+    first_anchor[i] += first_anchor[i - 1];
+
+  memcpy (next_anchor, first_anchor, sizeof (next_anchor));
+
+  for (i = 0; i != n_patterns; i++)
+  {
+    GumScanMultiAnchor * a;
+
+    if (anchor_offsets[i] == -1)
+      continue;
+
+    a = &anchors[next_anchor[anchor_values[i]]++];
+    a->pattern_index = i;
+    a->offset = anchor_offsets[i];
+  }
+
+  for (cur = base; cur != end; cur++)
+  {
+    guint8 value = *cur;
+    guint j;
+
+    for (j = first_anchor[value]; j != first_anchor[value + 1]; j++)
+    {
+      const GumScanMultiAnchor * a = &anchors[j];
+      const GumMatchPattern * pattern = patterns[a->pattern_index];
+      guint8 * start;
+
+      if ((gsize) (cur - base) < a->offset)
+        continue;
+      start = cur - a->offset;
+
+      if (start < resume_at[a->pattern_index] ||
+          (gsize) (end - start) < pattern->size ||
+          !gum_match_pattern_try_match_on (pattern, start))
+      {
+        continue;
+      }
+
+      resume_at[a->pattern_index] = start + pattern->size;
+
+      if (!func (GUM_ADDRESS (start), pattern->size, a->pattern_index,
+          user_data))
+      {
+        goto beach;
+      }
+    }
+
+    for (j = 0; j != unanchored->len; j++)
+    {
+      guint pattern_index = g_array_index (unanchored, guint, j);
+      const GumMatchPattern * pattern = patterns[pattern_index];
+
+      if (cur < resume_at[pattern_index] ||
+          (gsize) (end - cur) < pattern->size ||
+          !gum_match_pattern_try_match_on (pattern, cur))
+      {
+        continue;
+      }
+
+      resume_at[pattern_index] = cur + pattern->size;
+
+      if (!func (GUM_ADDRESS (cur), pattern->size, pattern_index, user_data))
+        goto beach;
     }
   }
+
+beach:
+  g_free (resume_at);
+  g_array_free (unanchored, TRUE);
+  g_free (anchor_offsets);
+  g_free (anchor_values);
+  g_free (anchors);
+}
+
+static gboolean
+gum_scan_single_emit_match (GumAddress address,
+                            gsize size,
+                            GumScanSingleContext * ctx)
+{
+  return ctx->func (address, size, 0, ctx->user_data);
 }
 
 GumMatchPattern *
@@ -453,6 +852,18 @@ gum_match_pattern_get_longest_token (const GumMatchPattern * self,
   return longest;
 }
 
+static GumMatchToken *
+gum_match_pattern_get_needle (const GumMatchPattern * self)
+{
+  GumMatchToken * needle;
+
+  needle = gum_match_pattern_get_longest_token (self, GUM_MATCH_EXACT);
+  if (needle == NULL)
+    needle = gum_match_pattern_get_longest_token (self, GUM_MATCH_MASK);
+
+  return needle;
+}
+
 static gboolean
 gum_match_pattern_try_match_on (const GumMatchPattern * self,
                                 guint8 * bytes)
@@ -525,6 +936,37 @@ gum_memcmp_mask (const guint8 * haystack,
   return 0;
 }
 
+/*
+ * Returns the offset of a byte in the token that has to match exactly, or -1
+ * if there is none. Bytes other than 0x00 and 0xff are preferred, as those
+ * two tend to be common in memory.
+ */
+static gint
+gum_match_token_find_anchor (const GumMatchToken * self)
+{
+  const guint8 * bytes = (const guint8 *) self->bytes->data;
+  const guint8 * masks = NULL;
+  gint fallback = -1;
+  guint i;
+
+  if (self->type == GUM_MATCH_MASK)
+    masks = (const guint8 *) self->masks->data;
+
+  for (i = 0; i != self->bytes->len; i++)
+  {
+    if (masks != NULL && masks[i] != 0xff)
+      continue;
+
+    if (bytes[i] != 0x00 && bytes[i] != 0xff)
+      return i;
+
+    if (fallback == -1)
+      fallback = i;
+  }
+
+  return fallback;
+}
+
 static GumMatchToken *
 gum_match_pattern_push_token (GumMatchPattern * self,
                               GumMatchType type)
@@ -630,20 +1072,38 @@ gum_peek_private_memory_usage (void)
 gpointer
 gum_malloc (gsize size)
 {
-  return mspace_malloc (gum_mspace_main, size);
+  return gum_heap_alloc (GUM_HEAP_MAIN, size);
 }
 
 gpointer
 gum_malloc0 (gsize size)
 {
-  return mspace_calloc (gum_mspace_main, 1, size);
+  gpointer result;
+
+  if (size > GUM_HEAP_MAX_CACHED_SIZE)
+    return mspace_calloc (gum_mspace_main, 1, size);
+
+  result = gum_heap_alloc (GUM_HEAP_MAIN, size);
+  if (result != NULL)
+    memset (result, 0, size);
+
+  return result;
 }
 
 gpointer
 gum_calloc (gsize count,
             gsize size)
 {
-  return mspace_calloc (gum_mspace_main, count, size);
+  gpointer result;
+
+  if (size == 0 || count > GUM_HEAP_MAX_CACHED_SIZE / size)
+    return mspace_calloc (gum_mspace_main, count, size);
+
+  result = gum_heap_alloc (GUM_HEAP_MAIN, count * size);
+  if (result != NULL)
+    memset (result, 0, count * size);
+
+  return result;
 }
 
 gpointer
@@ -659,7 +1119,7 @@ gum_memdup (gconstpointer mem,
 {
   gpointer result;
 
-  result = mspace_malloc (gum_mspace_main, byte_size);
+  result = gum_heap_alloc (GUM_HEAP_MAIN, byte_size);
   memcpy (result, mem, byte_size);
 
   return result;
@@ -668,33 +1128,231 @@ gum_memdup (gconstpointer mem,
 void
 gum_free (gpointer mem)
 {
-  mspace_free (gum_mspace_main, mem);
+  gum_heap_free (GUM_HEAP_MAIN, mem);
 }
 
 gpointer
 gum_cs_malloc (size_t size)
 {
-  return mspace_malloc (gum_mspace_capstone, size);
+  gum_capstone_heap_ensure ();
+
+  return gum_heap_alloc (GUM_HEAP_CAPSTONE, size);
 }
 
 gpointer
 gum_cs_calloc (size_t count,
                size_t size)
 {
-  return mspace_calloc (gum_mspace_capstone, count, size);
+  gpointer result;
+
+  gum_capstone_heap_ensure ();
+
+  if (size == 0 || count > GUM_HEAP_MAX_CACHED_SIZE / size)
+    return mspace_calloc (gum_mspace_capstone, count, size);
+
+  result = gum_heap_alloc (GUM_HEAP_CAPSTONE, count * size);
+  if (result != NULL)
+    memset (result, 0, count * size);
+
+  return result;
 }
 
 gpointer
 gum_cs_realloc (gpointer mem,
                 size_t size)
 {
+  gum_capstone_heap_ensure ();
+
   return mspace_realloc (gum_mspace_capstone, mem, size);
 }
 
 void
 gum_cs_free (gpointer mem)
 {
-  mspace_free (gum_mspace_capstone, mem);
+  gum_heap_free (GUM_HEAP_CAPSTONE, mem);
+}
+
+static void
+gum_capstone_heap_ensure (void)
+{
+  gint64 start_time;
+
+  if (g_atomic_pointer_get (&gum_mspaces[GUM_HEAP_CAPSTONE]) != NULL)
+    return;
+
+  gum_spinlock_acquire (&gum_capstone_heap_lock);
+
+  if (gum_mspace_capstone == NULL)
+  {
+    start_time = g_get_monotonic_time ();
+
+    gum_mspace_capstone = create_mspace (0, TRUE);
+    g_atomic_pointer_set (&gum_mspaces[GUM_HEAP_CAPSTONE],
+        gum_mspace_capstone);
+
+    _gum_record_init_timing ("capstone-heap", start_time);
+  }
+
+  gum_spinlock_release (&gum_capstone_heap_lock);
+}
+
+static gpointer
+gum_heap_alloc (GumHeapId heap,
+                gsize size)
+{
+  guint bin_index;
+  GumHeapCache * cache;
+  GumHeapBin * bin;
+  gpointer chunk;
+
+  if (size > GUM_HEAP_MAX_CACHED_SIZE)
+    return mspace_malloc (gum_mspaces[heap], size);
+
+  cache = gum_tls_key_get_value (gum_heap_cache_key);
+  if (cache == NULL)
+    return mspace_malloc (gum_mspaces[heap], size);
+
+  bin_index = (MAX (size, 1) + GUM_HEAP_BIN_GRANULARITY - 1) /
+      GUM_HEAP_BIN_GRANULARITY - 1;
+  bin = &cache->bins[heap][bin_index];
+
+  chunk = bin->head;
+  if (chunk == NULL)
+    return mspace_malloc (gum_mspaces[heap], size);
+
+  bin->head = *((gpointer *) chunk);
+  bin->count--;
+
+  return chunk;
+}
+
+static void
+gum_heap_free (GumHeapId heap,
+               gpointer mem)
+{
+  gsize usable_size;
+  guint bin_index;
+  GumHeapCache * cache;
+  GumHeapBin * bin;
+
+  if (mem == NULL)
+    return;
+
+  /*
+   * Chunks handed out for sizes that we cache are never padded by as much as
+   * the granularity, so anything larger came from an uncached request.
+   */
+  usable_size = mspace_usable_size (mem);
+  if (usable_size < GUM_HEAP_BIN_GRANULARITY ||
+      usable_size >= GUM_HEAP_MAX_CACHED_SIZE + GUM_HEAP_BIN_GRANULARITY)
+    goto no_cache;
+
+  /* Pick the largest size class that this chunk is able to satisfy. */
+  bin_index = MIN (usable_size / GUM_HEAP_BIN_GRANULARITY,
+      GUM_HEAP_NUM_BINS) - 1;
+
+  cache = gum_heap_cache_get ();
+  if (cache == NULL)
+    goto no_cache;
+
+  bin = &cache->bins[heap][bin_index];
+  if (bin->count == GUM_HEAP_MAX_CHUNKS_PER_BIN)
+    goto no_cache;
+
+  *((gpointer *) mem) = bin->head;
+  bin->head = mem;
+  bin->count++;
+
+  return;
+
+no_cache:
+  mspace_free (gum_mspaces[heap], mem);
+}
+
+static GumHeapCache *
+gum_heap_cache_get (void)
+{
+  GumHeapCache * cache;
+
+  cache = gum_tls_key_get_value (gum_heap_cache_key);
+  if (cache != NULL)
+    return cache;
+
+  cache = mspace_calloc (gum_mspace_main, 1, sizeof (GumHeapCache));
+  if (cache == NULL)
+    return NULL;
+
+  gum_spinlock_acquire (&gum_heap_cache_lock);
+  cache->next = gum_heap_caches;
+  if (gum_heap_caches != NULL)
+    gum_heap_caches->prev = cache;
+  gum_heap_caches = cache;
+  gum_spinlock_release (&gum_heap_cache_lock);
+
+  /*
+   * The GPrivate is only there to get us a destructor on thread exit, the
+   * lookup on the hot path goes through our own TLS key.
+   */
+  gum_tls_key_set_value (gum_heap_cache_key, cache);
+  g_private_set (&gum_heap_cache_private, cache);
+
+  return cache;
+}
+
+static void
+gum_heap_cache_release (GumHeapCache * cache)
+{
+  GumHeapCache * cur;
+
+  gum_spinlock_acquire (&gum_heap_cache_lock);
+
+  /* Might be stale if we got deinitialized while this thread was alive. */
+  for (cur = gum_heap_caches; cur != NULL && cur != cache; cur = cur->next)
+    ;
+
+  if (cur != NULL)
+  {
+    if (cache->prev != NULL)
+      cache->prev->next = cache->next;
+    else
+      gum_heap_caches = cache->next;
+    if (cache->next != NULL)
+      cache->next->prev = cache->prev;
+  }
+
+  gum_spinlock_release (&gum_heap_cache_lock);
+
+  if (cur == NULL)
+    return;
+
+  gum_tls_key_set_value (gum_heap_cache_key, NULL);
+
+  gum_heap_cache_flush (cache);
+  mspace_free (gum_mspace_main, cache);
+}
+
+static void
+gum_heap_cache_flush (GumHeapCache * cache)
+{
+  GumHeapId heap;
+  guint i;
+
+  for (heap = 0; heap != GUM_HEAP_COUNT; heap++)
+  {
+    for (i = 0; i != GUM_HEAP_NUM_BINS; i++)
+    {
+      GumHeapBin * bin = &cache->bins[heap][i];
+
+      while (bin->head != NULL)
+      {
+        gpointer chunk = bin->head;
+
+        bin->head = *((gpointer *) chunk);
+        mspace_free (gum_mspaces[heap], chunk);
+      }
+      bin->count = 0;
+    }
+  }
 }
 
 gpointer
@@ -16,6 +16,7 @@ typedef guint GumPageProtection;
 typedef struct _GumAddressSpec GumAddressSpec;
 typedef struct _GumMemoryRange GumMemoryRange;
 typedef struct _GumMatchPattern GumMatchPattern;
+typedef struct _GumMemoryPatch GumMemoryPatch;
 
 typedef gboolean (* GumMemoryIsNearFunc) (gpointer memory, gpointer address);
 
@@ -59,8 +60,19 @@ struct _GumMemoryRange
 G_BEGIN_DECLS
 
 typedef void (* GumMemoryPatchApplyFunc) (gpointer mem, gpointer user_data);
+
+struct _GumMemoryPatch
+{
+  GumAddress address;
+  gsize size;
+  GumMemoryPatchApplyFunc apply;
+  gpointer apply_data;
+};
+
 typedef gboolean (* GumMemoryScanMatchFunc) (GumAddress address, gsize size,
     gpointer user_data);
+typedef gboolean (* GumMemoryScanMultiMatchFunc) (GumAddress address,
+    gsize size, guint pattern_index, gpointer user_data);
 
 GUM_API void gum_memory_init (void);
 GUM_API void gum_memory_deinit (void);
@@ -74,10 +86,15 @@ GUM_API gboolean gum_memory_write (GumAddress address, const guint8 * bytes,
     gsize len);
 GUM_API gboolean gum_memory_patch_code (GumAddress address, gsize size,
     GumMemoryPatchApplyFunc apply, gpointer apply_data);
+GUM_API gboolean gum_memory_patch_code_many (const GumMemoryPatch * patches,
+    guint n_patches);
 
 GUM_API void gum_memory_scan (const GumMemoryRange * range,
     const GumMatchPattern * pattern, GumMemoryScanMatchFunc func,
     gpointer user_data);
+GUM_API void gum_memory_scan_multi (const GumMemoryRange * range,
+    const GumMatchPattern * const * patterns, guint n_patterns,
+    GumMemoryScanMultiMatchFunc func, gpointer user_data);
 
 GUM_API GumMatchPattern * gum_match_pattern_new_from_string (
     const gchar * match_combined_str);
@@ -124,6 +141,7 @@ GUM_API gboolean gum_memory_uncommit (gpointer base, gsize size);
 GUM_API gboolean gum_memory_release_partial (gpointer base, gsize size,
     gpointer free_start, gsize free_size);
 GUM_API gboolean gum_memory_release (gpointer base, gsize size);
+GUM_API gboolean gum_memory_advise_huge_pages (gpointer base, gsize size);
 
 GUM_API GType gum_memory_range_get_type (void) G_GNUC_CONST;
 
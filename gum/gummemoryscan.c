@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummemoryscan.h"
+
+#include "gummemory-priv.h"
+
+/*
+ * Ranges are split into chunks that are handed out to a pool of worker
+ * threads. Each chunk extends past its own end by the size of the longest
+ * pattern minus one, so matches straddling a boundary are still found, but
+ * only matches starting inside the chunk proper are kept. Workers collect
+ * their matches and report completed chunks through a queue, and all
+ * callbacks are made from the calling thread. When ordered, chunks are
+ * delivered in the order they appear in, and a match overlapping the
+ * previous match of the same pattern is dropped, just like a sequential
+ * scan would. A fault ends the scan once everything before it has been
+ * delivered, unless asked to skip faults, in which case the chunk carries on
+ * from the page after the one that could not be read. Memory is read in
+ * place either way, so ranges which may get unmapped while being scanned
+ * need neither probing nor copying up front.
+ */
+
+#define GUM_SCAN_CHUNK_SIZE (4 * 1024 * 1024)
+
+typedef struct _GumParallelScan GumParallelScan;
+typedef struct _GumScanChunk GumScanChunk;
+typedef struct _GumScanMatch GumScanMatch;
+
+struct _GumParallelScan
+{
+  const GumMatchPattern * const * patterns;
+  guint n_patterns;
+
+  GumScanChunk * chunks;
+  guint n_chunks;
+  gboolean skip_faults;
+  volatile gint next_chunk;
+  volatile gint cancelled;
+
+  GAsyncQueue * completed;
+  GumExceptor * exceptor;
+};
+
+struct _GumScanChunk
+{
+  GumMemoryRange range;
+  GumAddress owned_end;
+  guint range_index;
+
+  GArray * matches;
+  gboolean faulted;
+  GumExceptionDetails fault;
+  gboolean ready;
+
+  GumParallelScan * scan;
+};
+
+struct _GumScanMatch
+{
+  GumAddress address;
+  gsize size;
+  guint pattern_index;
+};
+
+static gpointer gum_parallel_scan_process (gpointer data);
+static void gum_scan_chunk_process (GumScanChunk * self);
+static gboolean gum_scan_chunk_collect_match (GumAddress address, gsize size,
+    guint pattern_index, GumScanChunk * self);
+
+/*
+ * Scans `ranges` for `patterns` using `n_workers` threads, or one per CPU if
+ * zero. Callbacks are always made from the calling thread. Returns FALSE and
+ * fills in `fault`, when provided, if reading memory failed.
+ */
+gboolean
+gum_memory_scan_ranges (const GumMemoryRange * ranges,
+                        guint n_ranges,
+                        const GumMatchPattern * const * patterns,
+                        guint n_patterns,
+                        guint n_workers,
+                        GumMemoryScanFlags flags,
+                        GumMemoryScanMultiMatchFunc func,
+                        gpointer user_data,
+                        GumExceptionDetails * fault)
+{
+  gboolean success = TRUE;
+  GumParallelScan scan;
+  GArray * chunks;
+  gsize overlap = 0;
+  GumAddress * resume_at;
+  guint * resume_range;
+  GPtrArray * threads;
+  guint n_threads, n_received, next_to_deliver, i;
+
+  if (n_patterns == 0)
+    return TRUE;
+
+  for (i = 0; i != n_patterns; i++)
+    overlap = MAX (overlap, patterns[i]->size - 1);
+
+  chunks = g_array_new (FALSE, TRUE, sizeof (GumScanChunk));
+  for (i = 0; i != n_ranges; i++)
+  {
+    const GumMemoryRange * r = &ranges[i];
+    gsize offset;
+
+    for (offset = 0; offset < r->size; offset += GUM_SCAN_CHUNK_SIZE)
+    {
+      GumScanChunk chunk = { { 0, }, };
+
+      chunk.range.base_address = r->base_address + offset;
+      chunk.range.size = MIN (GUM_SCAN_CHUNK_SIZE + overlap, r->size - offset);
+      chunk.owned_end = chunk.range.base_address + GUM_SCAN_CHUNK_SIZE;
+      chunk.range_index = i;
+      chunk.scan = &scan;
+
+      g_array_append_val (chunks, chunk);
+    }
+  }
+
+  scan.patterns = patterns;
+  scan.n_patterns = n_patterns;
+
+  scan.n_chunks = chunks->len;
+  scan.chunks = (GumScanChunk *) g_array_free (chunks, FALSE);
+  scan.skip_faults = (flags & GUM_MEMORY_SCAN_SKIP_FAULTS) != 0;
+  scan.next_chunk = 0;
+  scan.cancelled = FALSE;
+
+  scan.completed = g_async_queue_new ();
+  scan.exceptor = gum_exceptor_obtain ();
+
+  resume_at = g_new0 (GumAddress, n_patterns);
+  resume_range = g_new0 (guint, n_patterns);
+
+  n_threads = (n_workers != 0) ? n_workers : g_get_num_processors ();
+  n_threads = MIN (n_threads, scan.n_chunks);
+
+  threads = g_ptr_array_new ();
+  if (n_threads > 1)
+  {
+    for (i = 0; i != n_threads; i++)
+    {
+      g_ptr_array_add (threads, g_thread_new ("gum-memory-scan",
+          gum_parallel_scan_process, &scan));
+    }
+  }
+
+  next_to_deliver = 0;
+  for (n_received = 0;
+      n_received != scan.n_chunks && !g_atomic_int_get (&scan.cancelled);
+      n_received++)
+  {
+    GumScanChunk * chunk;
+
+    if (threads->len == 0)
+    {
+      chunk = &scan.chunks[scan.next_chunk++];
+      gum_scan_chunk_process (chunk);
+    }
+    else
+    {
+      chunk = g_async_queue_pop (scan.completed);
+    }
+
+    chunk->ready = TRUE;
+
+    while (!g_atomic_int_get (&scan.cancelled))
+    {
+      GumScanChunk * next;
+      guint j;
+
+      if ((flags & GUM_MEMORY_SCAN_UNORDERED) != 0)
+      {
+        if (chunk == NULL)
+          break;
+        next = chunk;
+        chunk = NULL;
+      }
+      else
+      {
+        if (next_to_deliver == scan.n_chunks ||
+            !scan.chunks[next_to_deliver].ready)
+        {
+          break;
+        }
+        next = &scan.chunks[next_to_deliver++];
+      }
+
+      for (j = 0; j != next->matches->len; j++)
+      {
+        GumScanMatch * m = &g_array_index (next->matches, GumScanMatch, j);
+
+        if ((flags & GUM_MEMORY_SCAN_UNORDERED) == 0)
+        {
+          if (resume_range[m->pattern_index] == next->range_index &&
+              m->address < resume_at[m->pattern_index])
+          {
+            continue;
+          }
+
+          resume_at[m->pattern_index] = m->address + m->size;
+          resume_range[m->pattern_index] = next->range_index;
+        }
+
+        if (!func (m->address, m->size, m->pattern_index, user_data))
+        {
+          g_atomic_int_set (&scan.cancelled, TRUE);
+          break;
+        }
+      }
+
+      if (next->faulted && !g_atomic_int_get (&scan.cancelled))
+      {
+        if (fault != NULL)
+          *fault = next->fault;
+        success = FALSE;
+
+        g_atomic_int_set (&scan.cancelled, TRUE);
+      }
+    }
+  }
+
+  g_atomic_int_set (&scan.cancelled, TRUE);
+  for (i = 0; i != threads->len; i++)
+    g_thread_join (g_ptr_array_index (threads, i));
+  g_ptr_array_unref (threads);
+
+  for (i = 0; i != scan.n_chunks; i++)
+  {
+    GArray * matches = scan.chunks[i].matches;
+
+    if (matches != NULL)
+      g_array_free (matches, TRUE);
+  }
+
+  g_free (resume_range);
+  g_free (resume_at);
+
+  g_object_unref (scan.exceptor);
+  g_async_queue_unref (scan.completed);
+  g_free (scan.chunks);
+
+  return success;
+}
+
+static gpointer
+gum_parallel_scan_process (gpointer data)
+{
+  GumParallelScan * self = data;
+
+  while (!g_atomic_int_get (&self->cancelled))
+  {
+    guint index;
+    GumScanChunk * chunk;
+
+    index = g_atomic_int_add (&self->next_chunk, 1);
+    if (index >= self->n_chunks)
+      break;
+
+    chunk = &self->chunks[index];
+    gum_scan_chunk_process (chunk);
+
+    g_async_queue_push (self->completed, chunk);
+  }
+
+  return NULL;
+}
+
+#ifdef _MSC_VER
+# pragma warning (push)
+# pragma warning (disable: 4611)
+#endif
+
+static void
+gum_scan_chunk_process (GumScanChunk * self)
+{
+  GumParallelScan * scan = self->scan;
+  GumMemoryRange remaining;
+  gsize page_size;
+
+  self->matches = g_array_new (FALSE, FALSE, sizeof (GumScanMatch));
+
+  remaining = self->range;
+  page_size = gum_query_page_size ();
+
+  while (remaining.size != 0)
+  {
+    GumExceptorScope scope;
+    GumAddress end, resume_at;
+
+    if (gum_exceptor_try (scan->exceptor, &scope))
+    {
+      gum_memory_scan_multi (&remaining, scan->patterns, scan->n_patterns,
+          (GumMemoryScanMultiMatchFunc) gum_scan_chunk_collect_match, self);
+    }
+
+    if (!gum_exceptor_catch (scan->exceptor, &scope))
+      break;
+
+    if (!scan->skip_faults || scope.exception.type !=
+        GUM_EXCEPTION_ACCESS_VIOLATION)
+    {
+      self->faulted = TRUE;
+      self->fault = scope.exception;
+      break;
+    }
+
+    end = remaining.base_address + remaining.size;
+    resume_at = (GUM_ADDRESS (scope.exception.memory.address) + page_size) &
+        ~((GumAddress) page_size - 1);
+    if (resume_at <= remaining.base_address || resume_at >= end)
+      break;
+
+    remaining.size = end - resume_at;
+    remaining.base_address = resume_at;
+  }
+}
+
+#ifdef _MSC_VER
+# pragma warning (pop)
+#endif
+
+static gboolean
+gum_scan_chunk_collect_match (GumAddress address,
+                              gsize size,
+                              guint pattern_index,
+                              GumScanChunk * self)
+{
+  if (address < self->owned_end)
+  {
+    GumScanMatch m;
+
+    m.address = address;
+    m.size = size;
+    m.pattern_index = pattern_index;
+
+    g_array_append_val (self->matches, m);
+  }
+
+  return !g_atomic_int_get (&self->scan->cancelled);
+}
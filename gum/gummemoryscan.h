@@ -0,0 +1,30 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_MEMORY_SCAN_H__
+#define __GUM_MEMORY_SCAN_H__
+
+#include <gum/gumexceptor.h>
+#include <gum/gummemory.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  GUM_MEMORY_SCAN_ORDERED     = 0,
+  GUM_MEMORY_SCAN_UNORDERED   = (1 << 0),
+  GUM_MEMORY_SCAN_SKIP_FAULTS = (1 << 1)
+} GumMemoryScanFlags;
+
+GUM_API gboolean gum_memory_scan_ranges (const GumMemoryRange * ranges,
+    guint n_ranges, const GumMatchPattern * const * patterns,
+    guint n_patterns, guint n_workers, GumMemoryScanFlags flags,
+    GumMemoryScanMultiMatchFunc func, gpointer user_data,
+    GumExceptionDetails * fault);
+
+G_END_DECLS
+
+#endif
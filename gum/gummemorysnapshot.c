@@ -0,0 +1,350 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummemorysnapshot.h"
+
+#include "gumcloak.h"
+#include "gumprocess.h"
+
+#include <string.h>
+#ifdef HAVE_LINUX
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
+/*
+ * A snapshot keeps a copy of every page in its ranges, and restoring it puts
+ * back the pages that were written to since. On Linux the kernel's soft-dirty
+ * bits tell us which those are: they are cleared when the snapshot is taken
+ * and after every restore, and the pagemap entries of the ranges are read to
+ * find the pages that got written to in between. Clearing them is process
+ * wide, so this does not mix with anything else relying on them. Elsewhere,
+ * or when the kernel lacks support, each page is compared with its copy.
+ *
+ * The copies and all bookkeeping live in pages of their own that are cloaked,
+ * so they are never part of a snapshot taken of the whole process, and are
+ * not themselves rolled back halfway through a restore. Threads other than
+ * the one restoring should be quiescent while it does.
+ */
+
+#define GUM_PAGEMAP_SOFT_DIRTY (G_GUINT64_CONSTANT (1) << 55)
+#define GUM_PAGEMAP_BATCH_SIZE 512
+
+typedef struct _GumSnapshotRange GumSnapshotRange;
+
+struct _GumMemorySnapshot
+{
+  GumSnapshotRange * ranges;
+  guint n_ranges;
+  gsize page_size;
+  gint pagemap_fd;
+  GumMemoryRange storage;
+};
+
+struct _GumSnapshotRange
+{
+  guint8 * base;
+  gsize size;
+  guint8 * copy;
+};
+
+static gboolean gum_memory_snapshot_collect_writable_range (
+    const GumRangeDetails * details, gpointer user_data);
+static gint gum_memory_snapshot_open_pagemap (void);
+static void gum_memory_snapshot_close_pagemap (gint fd);
+static gboolean gum_memory_snapshot_clear_soft_dirty_bits (void);
+
+static guint gum_snapshot_range_restore_dirty_pages (
+    const GumSnapshotRange * range, gsize page_size, gint pagemap_fd);
+static guint gum_snapshot_range_restore_changed_pages (
+    const GumSnapshotRange * range, gsize first_page, gsize n_pages,
+    gsize page_size);
+
+/*
+ * The ranges are widened to page boundaries, and must be writable for as long
+ * as the snapshot is used.
+ */
+GumMemorySnapshot *
+gum_memory_snapshot_new (const GumMemoryRange * ranges,
+                         guint n_ranges)
+{
+  GumMemorySnapshot * snapshot;
+  gsize page_size, header_size, total_size;
+  guint8 * block, * cursor;
+  guint i;
+
+  page_size = gum_query_page_size ();
+
+  header_size = GUM_ALIGN_SIZE (sizeof (GumMemorySnapshot) +
+      (n_ranges * sizeof (GumSnapshotRange)), page_size);
+  total_size = header_size;
+  for (i = 0; i != n_ranges; i++)
+  {
+    const GumMemoryRange * r = &ranges[i];
+    GumAddress start, end;
+
+    start = r->base_address & ~((GumAddress) page_size - 1);
+    end = GUM_ALIGN_SIZE (r->base_address + r->size, page_size);
+    total_size += end - start;
+  }
+
+  block = gum_alloc_n_pages (total_size / page_size, GUM_PAGE_RW);
+
+  snapshot = (GumMemorySnapshot *) block;
+  snapshot->ranges = (GumSnapshotRange *) (snapshot + 1);
+  snapshot->n_ranges = n_ranges;
+  snapshot->page_size = page_size;
+
+  gum_query_page_allocation_range (block, total_size, &snapshot->storage);
+  gum_cloak_add_range (&snapshot->storage);
+
+  /* Clear first, so that a write racing with the copy is seen as one. */
+  snapshot->pagemap_fd = gum_memory_snapshot_open_pagemap ();
+
+  cursor = block + header_size;
+  for (i = 0; i != n_ranges; i++)
+  {
+    const GumMemoryRange * r = &ranges[i];
+    GumSnapshotRange * range = &snapshot->ranges[i];
+    GumAddress start, end;
+
+    start = r->base_address & ~((GumAddress) page_size - 1);
+    end = GUM_ALIGN_SIZE (r->base_address + r->size, page_size);
+
+    range->base = GSIZE_TO_POINTER (start);
+    range->size = end - start;
+    range->copy = cursor;
+
+    memcpy (range->copy, range->base, range->size);
+
+    cursor += range->size;
+  }
+
+  return snapshot;
+}
+
+/*
+ * Takes a snapshot of every writable range in the process, apart from cloaked
+ * ones and the stack of the calling thread, which is still in use when the
+ * snapshot is restored.
+ */
+GumMemorySnapshot *
+gum_memory_snapshot_new_writable (void)
+{
+  GumMemorySnapshot * snapshot;
+  GArray * ranges;
+
+  ranges = g_array_new (FALSE, FALSE, sizeof (GumMemoryRange));
+  gum_process_enumerate_ranges (GUM_PAGE_RW,
+      gum_memory_snapshot_collect_writable_range, ranges);
+
+  snapshot = gum_memory_snapshot_new ((const GumMemoryRange *) ranges->data,
+      ranges->len);
+
+  g_array_free (ranges, TRUE);
+
+  return snapshot;
+}
+
+static gboolean
+gum_memory_snapshot_collect_writable_range (const GumRangeDetails * details,
+                                            gpointer user_data)
+{
+  GArray * ranges = user_data;
+
+  if (GUM_MEMORY_RANGE_INCLUDES (details->range, GUM_ADDRESS (&ranges)))
+    return TRUE;
+
+  g_array_append_val (ranges, *details->range);
+
+  return TRUE;
+}
+
+void
+gum_memory_snapshot_free (GumMemorySnapshot * self)
+{
+  GumMemoryRange storage;
+
+  if (self == NULL)
+    return;
+
+  gum_memory_snapshot_close_pagemap (self->pagemap_fd);
+
+  storage = self->storage;
+  gum_free_pages (self);
+  gum_cloak_remove_range (&storage);
+}
+
+/* Returns the number of pages that had to be copied back. */
+guint
+gum_memory_snapshot_restore (GumMemorySnapshot * self)
+{
+  guint n_restored = 0;
+  guint i;
+
+  for (i = 0; i != self->n_ranges; i++)
+  {
+    const GumSnapshotRange * range = &self->ranges[i];
+
+    if (self->pagemap_fd != -1)
+    {
+      n_restored += gum_snapshot_range_restore_dirty_pages (range,
+          self->page_size, self->pagemap_fd);
+    }
+    else
+    {
+      n_restored += gum_snapshot_range_restore_changed_pages (range, 0,
+          range->size / self->page_size, self->page_size);
+    }
+  }
+
+  if (self->pagemap_fd != -1)
+    gum_memory_snapshot_clear_soft_dirty_bits ();
+
+  return n_restored;
+}
+
+/*
+ * Whether restoring only looks at the pages that were written to, as opposed
+ * to comparing every page with its copy.
+ */
+gboolean
+gum_memory_snapshot_is_tracking_writes (GumMemorySnapshot * self)
+{
+  return self->pagemap_fd != -1;
+}
+
+static gint
+gum_memory_snapshot_open_pagemap (void)
+{
+#ifdef HAVE_LINUX
+  gint fd;
+
+  fd = open ("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return -1;
+
+  if (!gum_memory_snapshot_clear_soft_dirty_bits ())
+  {
+    close (fd);
+    return -1;
+  }
+
+  gum_cloak_add_file_descriptor (fd);
+
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+static void
+gum_memory_snapshot_close_pagemap (gint fd)
+{
+#ifdef HAVE_LINUX
+  if (fd == -1)
+    return;
+
+  gum_cloak_remove_file_descriptor (fd);
+  close (fd);
+#endif
+}
+
+static gboolean
+gum_memory_snapshot_clear_soft_dirty_bits (void)
+{
+#ifdef HAVE_LINUX
+  gint fd;
+  gboolean success;
+
+  fd = open ("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    return FALSE;
+
+  /* Kernels built without soft-dirty support reject this with EINVAL. */
+  success = write (fd, "4", 1) == 1;
+
+  close (fd);
+
+  return success;
+#else
+  return FALSE;
+#endif
+}
+
+static guint
+gum_snapshot_range_restore_dirty_pages (const GumSnapshotRange * range,
+                                        gsize page_size,
+                                        gint pagemap_fd)
+{
+#ifdef HAVE_LINUX
+  guint n_restored = 0;
+  guint64 entries[GUM_PAGEMAP_BATCH_SIZE];
+  gsize first_page, n_pages, offset;
+
+  first_page = GPOINTER_TO_SIZE (range->base) / page_size;
+  n_pages = range->size / page_size;
+
+  for (offset = 0; offset < n_pages; offset += GUM_PAGEMAP_BATCH_SIZE)
+  {
+    gsize n, i;
+    gssize size;
+
+    n = MIN (n_pages - offset, GUM_PAGEMAP_BATCH_SIZE);
+    size = n * sizeof (guint64);
+
+    if (pread (pagemap_fd, entries, size,
+        (first_page + offset) * sizeof (guint64)) != size)
+    {
+      n_restored += gum_snapshot_range_restore_changed_pages (range, offset,
+          n, page_size);
+      continue;
+    }
+
+    for (i = 0; i != n; i++)
+    {
+      gsize page_offset;
+
+      if ((entries[i] & GUM_PAGEMAP_SOFT_DIRTY) == 0)
+        continue;
+
+      page_offset = (offset + i) * page_size;
+      memcpy (range->base + page_offset, range->copy + page_offset,
+          page_size);
+      n_restored++;
+    }
+  }
+
+  return n_restored;
+#else
+  return gum_snapshot_range_restore_changed_pages (range, 0,
+      range->size / page_size, page_size);
+#endif
+}
+
+static guint
+gum_snapshot_range_restore_changed_pages (const GumSnapshotRange * range,
+                                          gsize first_page,
+                                          gsize n_pages,
+                                          gsize page_size)
+{
+  guint n_restored = 0;
+  gsize i;
+
+  for (i = first_page; i != first_page + n_pages; i++)
+  {
+    guint8 * page = range->base + (i * page_size);
+    const guint8 * copy = range->copy + (i * page_size);
+
+    if (memcmp (page, copy, page_size) != 0)
+    {
+      memcpy (page, copy, page_size);
+      n_restored++;
+    }
+  }
+
+  return n_restored;
+}
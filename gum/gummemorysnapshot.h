@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_MEMORY_SNAPSHOT_H__
+#define __GUM_MEMORY_SNAPSHOT_H__
+
+#include <gum/gummemory.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GumMemorySnapshot GumMemorySnapshot;
+
+GUM_API GumMemorySnapshot * gum_memory_snapshot_new (
+    const GumMemoryRange * ranges, guint n_ranges);
+GUM_API GumMemorySnapshot * gum_memory_snapshot_new_writable (void);
+GUM_API void gum_memory_snapshot_free (GumMemorySnapshot * self);
+
+GUM_API guint gum_memory_snapshot_restore (GumMemorySnapshot * self);
+
+GUM_API gboolean gum_memory_snapshot_is_tracking_writes (
+    GumMemorySnapshot * self);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,383 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummetalmap.h"
+
+#include "gumlibc.h"
+#include "gummemory.h"
+
+#if defined (__SSE2__) || defined (_M_X64) || \
+    (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+# define GUM_METAL_MAP_USE_SSE2 1
+# include <emmintrin.h>
+#elif defined (__aarch64__) && defined (__ARM_NEON)
+# define GUM_METAL_MAP_USE_NEON 1
+# include <arm_neon.h>
+#endif
+
+/*
+ * Open addressing with the control bytes kept apart from the slots, in the
+ * spirit of SwissTable. Each control byte is either EMPTY, DELETED, or the
+ * low seven bits of the hash of the key in the corresponding slot. Probing
+ * moves in aligned groups of sixteen control bytes so that one SIMD compare
+ * narrows a whole group down to the few slots whose keys are worth looking
+ * at. Storage comes straight from gum_alloc_n_pages() so that Stalker can
+ * use this from any context.
+ */
+
+#define GUM_METAL_MAP_GROUP_SIZE 16
+#define GUM_METAL_MAP_MIN_CAPACITY 128
+
+#define GUM_CTRL_EMPTY   0x80
+#define GUM_CTRL_DELETED 0xfe
+
+typedef guint GumMetalMapMask;
+
+static void gum_metal_map_allocate (GumMetalMap * self, guint capacity);
+static void gum_metal_map_resize (GumMetalMap * self, guint capacity);
+static GumMetalMapSlot * gum_metal_map_find (const GumMetalMap * self,
+    gconstpointer key, gsize hash);
+static guint gum_metal_map_find_free (const GumMetalMap * self, gsize hash);
+
+static gsize gum_metal_map_hash (gconstpointer key);
+static GumMetalMapMask gum_metal_map_group_match (const guint8 * group,
+    guint8 value);
+static GumMetalMapMask gum_metal_map_group_match_empty (const guint8 * group);
+static GumMetalMapMask gum_metal_map_group_match_free (const guint8 * group);
+
+#define GUM_METAL_MAP_H1(hash) ((hash) >> 7)
+#define GUM_METAL_MAP_H2(hash) ((guint8) ((hash) & 0x7f))
+
+void
+gum_metal_map_init (GumMetalMap * self)
+{
+  gum_metal_map_allocate (self, GUM_METAL_MAP_MIN_CAPACITY);
+}
+
+void
+gum_metal_map_free (GumMetalMap * self)
+{
+  gum_free_pages (self->ctrl);
+  self->ctrl = NULL;
+  self->slots = NULL;
+
+  self->capacity = 0;
+  self->size = 0;
+  self->tombstones = 0;
+}
+
+gpointer
+gum_metal_map_lookup (GumMetalMap * self,
+                      gconstpointer key)
+{
+  GumMetalMapSlot * slot;
+
+  slot = gum_metal_map_find (self, key, gum_metal_map_hash (key));
+
+  return (slot != NULL) ? slot->value : NULL;
+}
+
+void
+gum_metal_map_insert (GumMetalMap * self,
+                      gconstpointer key,
+                      gpointer value)
+{
+  gsize hash;
+  GumMetalMapSlot * slot;
+  guint index_;
+
+  hash = gum_metal_map_hash (key);
+
+  slot = gum_metal_map_find (self, key, hash);
+  if (slot != NULL)
+  {
+    slot->value = value;
+    return;
+  }
+
+  /* Keep at least one in eight control bytes EMPTY so that probes end. */
+  if ((self->size + self->tombstones + 1) * 8 > self->capacity * 7)
+  {
+    guint capacity = self->capacity;
+
+    if ((self->size + 1) * 2 > capacity)
+      capacity *= 2;
+
+    gum_metal_map_resize (self, capacity);
+  }
+
+  index_ = gum_metal_map_find_free (self, hash);
+  if (self->ctrl[index_] == GUM_CTRL_DELETED)
+    self->tombstones--;
+
+  self->ctrl[index_] = GUM_METAL_MAP_H2 (hash);
+  self->slots[index_].key = key;
+  self->slots[index_].value = value;
+  self->size++;
+}
+
+gboolean
+gum_metal_map_remove (GumMetalMap * self,
+                      gconstpointer key)
+{
+  GumMetalMapSlot * slot;
+  guint index_;
+
+  slot = gum_metal_map_find (self, key, gum_metal_map_hash (key));
+  if (slot == NULL)
+    return FALSE;
+
+  index_ = slot - self->slots;
+  self->ctrl[index_] = GUM_CTRL_DELETED;
+  slot->key = NULL;
+  slot->value = NULL;
+
+  self->size--;
+  self->tombstones++;
+
+  return TRUE;
+}
+
+void
+gum_metal_map_remove_all (GumMetalMap * self)
+{
+  if (self->size == 0 && self->tombstones == 0)
+    return;
+
+  gum_memset (self->ctrl, GUM_CTRL_EMPTY, self->capacity);
+  self->size = 0;
+  self->tombstones = 0;
+}
+
+static void
+gum_metal_map_allocate (GumMetalMap * self,
+                        guint capacity)
+{
+  gsize size;
+  guint page_size, n_pages;
+
+  size = capacity + (capacity * sizeof (GumMetalMapSlot));
+  page_size = gum_query_page_size ();
+  n_pages = (size + page_size - 1) / page_size;
+
+  self->ctrl = gum_alloc_n_pages (n_pages, GUM_PAGE_RW);
+  self->slots = (GumMetalMapSlot *) (self->ctrl + capacity);
+  self->capacity = capacity;
+  self->size = 0;
+  self->tombstones = 0;
+
+  gum_memset (self->ctrl, GUM_CTRL_EMPTY, capacity);
+}
+
+static void
+gum_metal_map_resize (GumMetalMap * self,
+                      guint capacity)
+{
+  GumMetalMap old = *self;
+  guint i;
+
+  gum_metal_map_allocate (self, capacity);
+
+  for (i = 0; i != old.capacity; i++)
+  {
+    const GumMetalMapSlot * slot;
+    gsize hash;
+    guint index_;
+
+    if ((old.ctrl[i] & 0x80) != 0)
+      continue;
+
+    slot = &old.slots[i];
+    hash = gum_metal_map_hash (slot->key);
+
+    index_ = gum_metal_map_find_free (self, hash);
+    self->ctrl[index_] = GUM_METAL_MAP_H2 (hash);
+    self->slots[index_] = *slot;
+    self->size++;
+  }
+
+  gum_free_pages (old.ctrl);
+}
+
+static GumMetalMapSlot *
+gum_metal_map_find (const GumMetalMap * self,
+                    gconstpointer key,
+                    gsize hash)
+{
+  guint group_mask, group_index, probe;
+  guint8 h2;
+
+  group_mask = (self->capacity / GUM_METAL_MAP_GROUP_SIZE) - 1;
+  group_index = GUM_METAL_MAP_H1 (hash) & group_mask;
+  h2 = GUM_METAL_MAP_H2 (hash);
+
+  for (probe = 1; TRUE; probe++)
+  {
+    const guint8 * group;
+    GumMetalMapSlot * slots;
+    GumMetalMapMask matches;
+
+    group = self->ctrl + (group_index * GUM_METAL_MAP_GROUP_SIZE);
+    slots = self->slots + (group_index * GUM_METAL_MAP_GROUP_SIZE);
+
+    for (matches = gum_metal_map_group_match (group, h2);
+        matches != 0;
+        matches &= matches - 1)
+    {
+      GumMetalMapSlot * slot = &slots[g_bit_nth_lsf (matches, -1)];
+
+      if (slot->key == key)
+        return slot;
+    }
+
+    if (gum_metal_map_group_match_empty (group) != 0)
+      return NULL;
+
+    /* Triangular steps visit every group when their count is a power of 2. */
+    group_index = (group_index + probe) & group_mask;
+  }
+}
+
+static guint
+gum_metal_map_find_free (const GumMetalMap * self,
+                         gsize hash)
+{
+  guint group_mask, group_index, probe;
+
+  group_mask = (self->capacity / GUM_METAL_MAP_GROUP_SIZE) - 1;
+  group_index = GUM_METAL_MAP_H1 (hash) & group_mask;
+
+  for (probe = 1; TRUE; probe++)
+  {
+    GumMetalMapMask candidates;
+
+    candidates = gum_metal_map_group_match_free (
+        self->ctrl + (group_index * GUM_METAL_MAP_GROUP_SIZE));
+    if (candidates != 0)
+    {
+      return (group_index * GUM_METAL_MAP_GROUP_SIZE) +
+          g_bit_nth_lsf (candidates, -1);
+    }
+
+    group_index = (group_index + probe) & group_mask;
+  }
+}
+
+static gsize
+gum_metal_map_hash (gconstpointer key)
+{
+  guint64 hash;
+
+  hash = GPOINTER_TO_SIZE (key);
+  hash ^= hash >> 33;
+  hash *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  hash ^= hash >> 33;
+
+  return (gsize) hash;
+}
+
+#if defined (GUM_METAL_MAP_USE_SSE2)
+
+static GumMetalMapMask
+gum_metal_map_group_match (const guint8 * group,
+                           guint8 value)
+{
+  __m128i ctrl = _mm_load_si128 ((const __m128i *) group);
+
+  return _mm_movemask_epi8 (_mm_cmpeq_epi8 (ctrl, _mm_set1_epi8 (value)));
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match_empty (const guint8 * group)
+{
+  return gum_metal_map_group_match (group, GUM_CTRL_EMPTY);
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match_free (const guint8 * group)
+{
+  /* Both EMPTY and DELETED have the top bit set, FULL never does. */
+  return _mm_movemask_epi8 (_mm_load_si128 ((const __m128i *) group));
+}
+
+#elif defined (GUM_METAL_MAP_USE_NEON)
+
+static GumMetalMapMask
+gum_metal_map_mask_from_lanes (uint8x16_t lanes)
+{
+  static const guint8 weights[GUM_METAL_MAP_GROUP_SIZE] = {
+    1, 2, 4, 8, 16, 32, 64, 128,
+    1, 2, 4, 8, 16, 32, 64, 128
+  };
+  uint8x16_t bits;
+
+  bits = vandq_u8 (lanes, vld1q_u8 (weights));
+
+  return vaddv_u8 (vget_low_u8 (bits)) |
+      (vaddv_u8 (vget_high_u8 (bits)) << 8);
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match (const guint8 * group,
+                           guint8 value)
+{
+  return gum_metal_map_mask_from_lanes (
+      vceqq_u8 (vld1q_u8 (group), vdupq_n_u8 (value)));
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match_empty (const guint8 * group)
+{
+  return gum_metal_map_group_match (group, GUM_CTRL_EMPTY);
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match_free (const guint8 * group)
+{
+  return gum_metal_map_mask_from_lanes (
+      vcltzq_s8 (vreinterpretq_s8_u8 (vld1q_u8 (group))));
+}
+
+#else
+
+static GumMetalMapMask
+gum_metal_map_group_match (const guint8 * group,
+                           guint8 value)
+{
+  GumMetalMapMask mask = 0;
+  guint i;
+
+  for (i = 0; i != GUM_METAL_MAP_GROUP_SIZE; i++)
+  {
+    if (group[i] == value)
+      mask |= 1 << i;
+  }
+
+  return mask;
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match_empty (const guint8 * group)
+{
+  return gum_metal_map_group_match (group, GUM_CTRL_EMPTY);
+}
+
+static GumMetalMapMask
+gum_metal_map_group_match_free (const guint8 * group)
+{
+  GumMetalMapMask mask = 0;
+  guint i;
+
+  for (i = 0; i != GUM_METAL_MAP_GROUP_SIZE; i++)
+  {
+    if ((group[i] & 0x80) != 0)
+      mask |= 1 << i;
+  }
+
+  return mask;
+}
+
+#endif
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_METAL_MAP_H__
+#define __GUM_METAL_MAP_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GumMetalMap GumMetalMap;
+typedef struct _GumMetalMapSlot GumMetalMapSlot;
+
+struct _GumMetalMapSlot
+{
+  gconstpointer key;
+  gpointer value;
+};
+
+struct _GumMetalMap
+{
+  guint8 * ctrl;
+  GumMetalMapSlot * slots;
+  guint capacity;
+  guint size;
+  guint tombstones;
+};
+
+void gum_metal_map_init (GumMetalMap * self);
+void gum_metal_map_free (GumMetalMap * self);
+
+gpointer gum_metal_map_lookup (GumMetalMap * self, gconstpointer key);
+void gum_metal_map_insert (GumMetalMap * self, gconstpointer key,
+    gpointer value);
+gboolean gum_metal_map_remove (GumMetalMap * self, gconstpointer key);
+void gum_metal_map_remove_all (GumMetalMap * self);
+
+G_END_DECLS
+
+#endif
@@ -6,12 +6,31 @@
 
 #include "gummoduleapiresolver.h"
 
-#include "gumprocess.h"
+#include "gum-init.h"
+#include "gummodulesnapshot.h"
 
 #include <gio/gio.h>
+#include <string.h>
+
+/*
+ * Module metadata is shared by all resolvers in the process, and kept for as
+ * long as the module stays loaded at the same address. The modules come from
+ * the process-wide module snapshot, and the table mapping their names to
+ * metadata is only rebuilt when the snapshot's version moves on. Imports and
+ * exports are kept sorted by name, so a query starting with a literal prefix
+ * only visits the names sharing it. Each table also keeps a small filter of
+ * the trigrams found in its names, which lets a query skip modules that
+ * cannot contain the literal parts of its function pattern.
+ */
+
+#define GUM_TRIGRAM_FILTER_ORDER 12
+#define GUM_TRIGRAM_FILTER_WORDS ((1 << GUM_TRIGRAM_FILTER_ORDER) / 32)
 
 typedef struct _GumModuleMetadata GumModuleMetadata;
+typedef struct _GumFunctionTable GumFunctionTable;
 typedef struct _GumFunctionMetadata GumFunctionMetadata;
+typedef struct _GumFunctionQuery GumFunctionQuery;
+typedef struct _GumCreateSnapshotContext GumCreateSnapshotContext;
 
 struct _GumModuleApiResolver
 {
@@ -24,20 +43,42 @@ struct _GumModuleApiResolver
 
 struct _GumModuleMetadata
 {
-  gint ref_count;
+  volatile gint ref_count;
 
   gchar * name;
   gchar * path;
+  GumAddress base_address;
+
+  GumFunctionTable * imports;
+  GumFunctionTable * exports;
+};
 
-  GHashTable * import_by_name;
-  GHashTable * export_by_name;
+struct _GumFunctionTable
+{
+  GArray * functions;
+  guint32 trigrams[GUM_TRIGRAM_FILTER_WORDS];
 };
 
 struct _GumFunctionMetadata
 {
   gchar * name;
   GumAddress address;
-  gchar * module;
+  const gchar * module;
+};
+
+struct _GumFunctionQuery
+{
+  gchar * pattern;
+  GPatternSpec * spec;
+  gsize prefix_length;
+  gboolean is_literal;
+  guint32 trigrams[GUM_TRIGRAM_FILTER_WORDS];
+};
+
+struct _GumCreateSnapshotContext
+{
+  GHashTable * module_by_name;
+  GHashTable * module_by_path;
 };
 
 static void gum_module_api_resolver_iface_init (gpointer g_iface,
@@ -46,25 +87,51 @@ static void gum_module_api_resolver_finalize (GObject * object);
 static void gum_module_api_resolver_enumerate_matches (
     GumApiResolver * resolver, const gchar * query, GumFoundApiFunc func,
     gpointer user_data, GError ** error);
-
-static GPatternSpec * gum_pattern_spec_from_match_info (GMatchInfo * match_info,
-    gint match_num);
+static gboolean gum_module_api_resolver_emit_matches (
+    GumModuleMetadata * module, gboolean imports,
+    const GumFunctionQuery * query, GumFoundApiFunc func, gpointer user_data);
 
 static GHashTable * gum_module_api_resolver_create_snapshot (void);
 static gboolean gum_module_api_resolver_collect_module (
     const GumModuleDetails * details, gpointer user_data);
+static void gum_module_api_resolver_deinit_cache (void);
 
+static GumModuleMetadata * gum_module_metadata_new (
+    const GumModuleDetails * details);
+static GumModuleMetadata * gum_module_metadata_ref (GumModuleMetadata * module);
 static void gum_module_metadata_unref (GumModuleMetadata * module);
-static GHashTable * gum_module_metadata_get_imports (GumModuleMetadata * self);
-static GHashTable * gum_module_metadata_get_exports (GumModuleMetadata * self);
+static GumFunctionTable * gum_module_metadata_get_imports (
+    GumModuleMetadata * self);
+static GumFunctionTable * gum_module_metadata_get_exports (
+    GumModuleMetadata * self);
 static gboolean gum_module_metadata_collect_import (
     const GumImportDetails * details, gpointer user_data);
 static gboolean gum_module_metadata_collect_export (
     const GumExportDetails * details, gpointer user_data);
 
-static GumFunctionMetadata * gum_function_metadata_new (const gchar * name,
-    GumAddress address, const gchar * module);
-static void gum_function_metadata_free (GumFunctionMetadata * function);
+static GumFunctionTable * gum_function_table_new (void);
+static void gum_function_table_free (GumFunctionTable * table);
+static void gum_function_table_add (GumFunctionTable * self,
+    const gchar * name, GumAddress address, const gchar * module);
+static void gum_function_table_seal (GumFunctionTable * self);
+static guint gum_function_table_find_first (GumFunctionTable * self,
+    const gchar * prefix, gsize prefix_length);
+static gint gum_function_metadata_compare (const GumFunctionMetadata * a,
+    const GumFunctionMetadata * b);
+
+static void gum_function_query_init (GumFunctionQuery * query,
+    gchar * pattern);
+static void gum_function_query_destroy (GumFunctionQuery * query);
+static gboolean gum_function_query_may_match (const GumFunctionQuery * self,
+    const GumFunctionTable * table);
+
+static void gum_trigram_filter_add (guint32 * filter, const gchar * str,
+    gsize length);
+
+static GMutex gum_module_metadata_lock;
+static GHashTable * gum_module_metadata_by_path = NULL;
+static GHashTable * gum_module_metadata_by_name = NULL;
+static guint gum_module_metadata_version = 0;
 
 G_DEFINE_TYPE_EXTENDED (GumModuleApiResolver,
                         gum_module_api_resolver,
@@ -125,11 +192,9 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
 {
   GumModuleApiResolver * self = GUM_MODULE_API_RESOLVER (resolver);
   GMatchInfo * query_info;
-  gchar * collection;
-  GPatternSpec * module_spec, * function_spec;
-  GHashTableIter module_iter;
-  GHashTable * seen_modules;
-  gboolean carry_on;
+  gchar * collection, * module_pattern;
+  gboolean imports;
+  GumFunctionQuery function_query;
   GumModuleMetadata * module;
 
   g_regex_match (self->query_pattern, query, 0, &query_info);
@@ -137,129 +202,254 @@ gum_module_api_resolver_enumerate_matches (GumApiResolver * resolver,
     goto invalid_query;
 
   collection = g_match_info_fetch (query_info, 1);
-  module_spec = gum_pattern_spec_from_match_info (query_info, 2);
-  function_spec = gum_pattern_spec_from_match_info (query_info, 3);
-
-  g_hash_table_iter_init (&module_iter, self->module_by_name);
-  seen_modules = g_hash_table_new (NULL, NULL);
-  carry_on = TRUE;
+  imports = collection[0] == 'i';
+  module_pattern = g_match_info_fetch (query_info, 2);
+  gum_function_query_init (&function_query,
+      g_match_info_fetch (query_info, 3));
 
-  while (carry_on &&
-      g_hash_table_iter_next (&module_iter, NULL, (gpointer *) &module))
+  if (strpbrk (module_pattern, "*?") == NULL)
   {
-    if (g_hash_table_contains (seen_modules, module))
-      continue;
-    g_hash_table_add (seen_modules, module);
-
-    if (g_pattern_match_string (module_spec, module->name) ||
-        g_pattern_match_string (module_spec, module->path))
+    module = g_hash_table_lookup (self->module_by_name, module_pattern);
+    if (module != NULL)
     {
-      GHashTable * functions;
-      GHashTableIter function_iter;
-      GumFunctionMetadata * function;
-
-      functions = (collection[0] == 'i')
-          ? gum_module_metadata_get_imports (module)
-          : gum_module_metadata_get_exports (module);
+      gum_module_api_resolver_emit_matches (module, imports, &function_query,
+          func, user_data);
+    }
+  }
+  else
+  {
+    GPatternSpec * module_spec;
+    GHashTableIter module_iter;
+    GHashTable * seen_modules;
+    gboolean carry_on;
 
-      g_hash_table_iter_init (&function_iter, functions);
-      while (carry_on &&
-          g_hash_table_iter_next (&function_iter, NULL, (gpointer *) &function))
-      {
-        if (g_pattern_match_string (function_spec, function->name))
-        {
-          GumApiDetails details;
+    module_spec = g_pattern_spec_new (module_pattern);
 
-          details.name = g_strconcat (
-              (function->module != NULL) ? function->module : module->path,
-              "!",
-              function->name,
-              NULL);
-          details.address = function->address;
+    g_hash_table_iter_init (&module_iter, self->module_by_name);
+    seen_modules = g_hash_table_new (NULL, NULL);
+    carry_on = TRUE;
 
-          carry_on = func (&details, user_data);
+    while (carry_on &&
+        g_hash_table_iter_next (&module_iter, NULL, (gpointer *) &module))
+    {
+      if (g_hash_table_contains (seen_modules, module))
+        continue;
+      g_hash_table_add (seen_modules, module);
 
-          g_free ((gpointer) details.name);
-        }
+      if (g_pattern_match_string (module_spec, module->name) ||
+          g_pattern_match_string (module_spec, module->path))
+      {
+        carry_on = gum_module_api_resolver_emit_matches (module, imports,
+            &function_query, func, user_data);
       }
     }
-  }
 
-  g_hash_table_unref (seen_modules);
+    g_hash_table_unref (seen_modules);
 
-  g_pattern_spec_free (function_spec);
-  g_pattern_spec_free (module_spec);
+    g_pattern_spec_free (module_spec);
+  }
+
+  gum_function_query_destroy (&function_query);
+  g_free (module_pattern);
   g_free (collection);
 
+  g_match_info_free (query_info);
+
   return;
 
 invalid_query:
   {
+    g_match_info_free (query_info);
+
     g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
         "invalid query; format is: "
         "exports:*!open*, exports:libc.so!* or imports:notepad.exe!*");
   }
 }
 
-static GPatternSpec *
-gum_pattern_spec_from_match_info (GMatchInfo * match_info,
-                                  gint match_num)
+static gboolean
+gum_module_api_resolver_emit_matches (GumModuleMetadata * module,
+                                      gboolean imports,
+                                      const GumFunctionQuery * query,
+                                      GumFoundApiFunc func,
+                                      gpointer user_data)
 {
-  gchar * pattern;
-  GPatternSpec * spec;
+  GumFunctionTable * table;
+  GArray * functions;
+  guint i;
+  gboolean carry_on = TRUE;
+
+  table = imports
+      ? gum_module_metadata_get_imports (module)
+      : gum_module_metadata_get_exports (module);
+
+  if (!gum_function_query_may_match (query, table))
+    return TRUE;
+
+  functions = table->functions;
+
+  for (i = gum_function_table_find_first (table, query->pattern,
+          query->prefix_length);
+      carry_on && i != functions->len;
+      i++)
+  {
+    GumFunctionMetadata * function;
+    GumApiDetails details;
+
+    function = &g_array_index (functions, GumFunctionMetadata, i);
+
+    if (strncmp (function->name, query->pattern, query->prefix_length) != 0)
+      break;
+
+    if (query->is_literal)
+    {
+      if (function->name[query->prefix_length] != '\0')
+        continue;
+    }
+    else if (!g_pattern_match_string (query->spec, function->name))
+    {
+      continue;
+    }
+
+    details.name = g_strconcat (
+        (function->module != NULL) ? function->module : module->path,
+        "!",
+        function->name,
+        NULL);
+    details.address = function->address;
 
-  pattern = g_match_info_fetch (match_info, match_num);
-  spec = g_pattern_spec_new (pattern);
-  g_free (pattern);
+    carry_on = func (&details, user_data);
 
-  return spec;
+    g_free ((gpointer) details.name);
+  }
+
+  return carry_on;
 }
 
 static GHashTable *
 gum_module_api_resolver_create_snapshot (void)
 {
-  GHashTable * module_by_name;
+  GumModuleSnapshot * snapshot;
+  guint version;
+  GumCreateSnapshotContext ctx;
 
-  module_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+  snapshot = gum_module_snapshot_obtain ();
+  version = gum_module_snapshot_get_version (snapshot);
+
+  g_mutex_lock (&gum_module_metadata_lock);
+
+  if (gum_module_metadata_by_name != NULL &&
+      version == gum_module_metadata_version)
+  {
+    ctx.module_by_name = g_hash_table_ref (gum_module_metadata_by_name);
+    goto beach;
+  }
+
+  ctx.module_by_name = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) gum_module_metadata_unref);
+  ctx.module_by_path = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
       (GDestroyNotify) gum_module_metadata_unref);
 
-  gum_process_enumerate_modules (gum_module_api_resolver_collect_module,
-      module_by_name);
+  gum_module_snapshot_enumerate_modules (snapshot,
+      gum_module_api_resolver_collect_module, &ctx);
 
-  return module_by_name;
+  if (gum_module_metadata_by_path != NULL)
+  {
+    g_hash_table_unref (gum_module_metadata_by_name);
+    g_hash_table_unref (gum_module_metadata_by_path);
+  }
+  else
+  {
+    _gum_register_destructor (gum_module_api_resolver_deinit_cache);
+  }
+  gum_module_metadata_by_name = g_hash_table_ref (ctx.module_by_name);
+  gum_module_metadata_by_path = ctx.module_by_path;
+  gum_module_metadata_version = version;
+
+beach:
+  g_mutex_unlock (&gum_module_metadata_lock);
+
+  gum_module_snapshot_unref (snapshot);
+
+  return ctx.module_by_name;
 }
 
 static gboolean
 gum_module_api_resolver_collect_module (const GumModuleDetails * details,
                                         gpointer user_data)
 {
-  GHashTable * module_by_name = user_data;
+  GumCreateSnapshotContext * ctx = user_data;
+  GumModuleMetadata * module = NULL;
+
+  if (gum_module_metadata_by_path != NULL)
+  {
+    module = g_hash_table_lookup (gum_module_metadata_by_path, details->path);
+    if (module != NULL &&
+        module->base_address != details->range->base_address)
+    {
+      module = NULL;
+    }
+  }
+
+  if (module != NULL)
+    gum_module_metadata_ref (module);
+  else
+    module = gum_module_metadata_new (details);
+
+  g_hash_table_insert (ctx->module_by_path, g_strdup (module->path), module);
+
+  g_hash_table_insert (ctx->module_by_name, g_strdup (module->name),
+      gum_module_metadata_ref (module));
+  g_hash_table_insert (ctx->module_by_name, g_strdup (module->path),
+      gum_module_metadata_ref (module));
+
+  return TRUE;
+}
+
+static void
+gum_module_api_resolver_deinit_cache (void)
+{
+  g_hash_table_unref (gum_module_metadata_by_name);
+  gum_module_metadata_by_name = NULL;
+
+  g_hash_table_unref (gum_module_metadata_by_path);
+  gum_module_metadata_by_path = NULL;
+}
+
+static GumModuleMetadata *
+gum_module_metadata_new (const GumModuleDetails * details)
+{
   GumModuleMetadata * module;
 
   module = g_slice_new (GumModuleMetadata);
-  module->ref_count = 2;
+  module->ref_count = 1;
   module->name = g_strdup (details->name);
   module->path = g_strdup (details->path);
-  module->import_by_name = NULL;
-  module->export_by_name = NULL;
+  module->base_address = details->range->base_address;
+  module->imports = NULL;
+  module->exports = NULL;
 
-  g_hash_table_insert (module_by_name, g_strdup (module->name), module);
-  g_hash_table_insert (module_by_name, g_strdup (module->path), module);
+  return module;
+}
 
-  return TRUE;
+static GumModuleMetadata *
+gum_module_metadata_ref (GumModuleMetadata * module)
+{
+  g_atomic_int_inc (&module->ref_count);
+
+  return module;
 }
 
 static void
 gum_module_metadata_unref (GumModuleMetadata * module)
 {
-  module->ref_count--;
-  if (module->ref_count == 0)
+  if (g_atomic_int_dec_and_test (&module->ref_count))
   {
-    if (module->export_by_name != NULL)
-      g_hash_table_unref (module->export_by_name);
+    if (module->exports != NULL)
+      gum_function_table_free (module->exports);
 
-    if (module->import_by_name != NULL)
-      g_hash_table_unref (module->import_by_name);
+    if (module->imports != NULL)
+      gum_function_table_free (module->imports);
 
     g_free (module->path);
     g_free (module->name);
@@ -268,47 +458,64 @@ gum_module_metadata_unref (GumModuleMetadata * module)
   }
 }
 
-static GHashTable *
+static GumFunctionTable *
 gum_module_metadata_get_imports (GumModuleMetadata * self)
 {
-  if (self->import_by_name == NULL)
+  GumFunctionTable * imports;
+
+  g_mutex_lock (&gum_module_metadata_lock);
+
+  if (self->imports == NULL)
   {
-    self->import_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify) gum_function_metadata_free);
+    imports = gum_function_table_new ();
     gum_module_enumerate_imports (self->path,
-        gum_module_metadata_collect_import, self->import_by_name);
+        gum_module_metadata_collect_import, imports);
+    gum_function_table_seal (imports);
+
+    self->imports = imports;
   }
 
-  return self->import_by_name;
+  imports = self->imports;
+
+  g_mutex_unlock (&gum_module_metadata_lock);
+
+  return imports;
 }
 
-static GHashTable *
+static GumFunctionTable *
 gum_module_metadata_get_exports (GumModuleMetadata * self)
 {
-  if (self->export_by_name == NULL)
+  GumFunctionTable * exports;
+
+  g_mutex_lock (&gum_module_metadata_lock);
+
+  if (self->exports == NULL)
   {
-    self->export_by_name = g_hash_table_new_full (g_str_hash, g_str_equal,
-        g_free, (GDestroyNotify) gum_function_metadata_free);
+    exports = gum_function_table_new ();
     gum_module_enumerate_exports (self->path,
-        gum_module_metadata_collect_export, self->export_by_name);
+        gum_module_metadata_collect_export, exports);
+    gum_function_table_seal (exports);
+
+    self->exports = exports;
   }
 
-  return self->export_by_name;
+  exports = self->exports;
+
+  g_mutex_unlock (&gum_module_metadata_lock);
+
+  return exports;
 }
 
 static gboolean
 gum_module_metadata_collect_import (const GumImportDetails * details,
                                     gpointer user_data)
 {
-  GHashTable * import_by_name = user_data;
+  GumFunctionTable * imports = user_data;
 
   if (details->type == GUM_IMPORT_FUNCTION && details->address != 0)
   {
-    GumFunctionMetadata * function;
-
-    function = gum_function_metadata_new (details->name, details->address,
+    gum_function_table_add (imports, details->name, details->address,
         details->module);
-    g_hash_table_insert (import_by_name, g_strdup (function->name), function);
   }
 
   return TRUE;
@@ -318,40 +525,188 @@ static gboolean
 gum_module_metadata_collect_export (const GumExportDetails * details,
                                     gpointer user_data)
 {
-  GHashTable * export_by_name = user_data;
+  GumFunctionTable * exports = user_data;
 
   if (details->type == GUM_EXPORT_FUNCTION)
   {
-    GumFunctionMetadata * function;
-
-    function = gum_function_metadata_new (details->name, details->address,
-        NULL);
-    g_hash_table_insert (export_by_name, g_strdup (function->name), function);
+    gum_function_table_add (exports, details->name, details->address, NULL);
   }
 
   return TRUE;
 }
 
-static GumFunctionMetadata *
-gum_function_metadata_new (const gchar * name,
-                           GumAddress address,
-                           const gchar * module)
+static GumFunctionTable *
+gum_function_table_new (void)
 {
-  GumFunctionMetadata * function;
+  GumFunctionTable * table;
 
-  function = g_slice_new (GumFunctionMetadata);
-  function->name = g_strdup (name);
-  function->address = address;
-  function->module = g_strdup (module);
+  table = g_slice_new0 (GumFunctionTable);
+  table->functions = g_array_new (FALSE, FALSE, sizeof (GumFunctionMetadata));
 
-  return function;
+  return table;
 }
 
 static void
-gum_function_metadata_free (GumFunctionMetadata * function)
+gum_function_table_free (GumFunctionTable * table)
 {
-  g_free (function->module);
-  g_free (function->name);
+  GArray * functions = table->functions;
+  guint i;
+
+  for (i = 0; i != functions->len; i++)
+    g_free (g_array_index (functions, GumFunctionMetadata, i).name);
+  g_array_free (functions, TRUE);
+
+  g_slice_free (GumFunctionTable, table);
+}
+
+static void
+gum_function_table_add (GumFunctionTable * self,
+                        const gchar * name,
+                        GumAddress address,
+                        const gchar * module)
+{
+  GumFunctionMetadata function;
+
+  function.name = g_strdup (name);
+  function.address = address;
+  function.module = (module != NULL) ? g_intern_string (module) : NULL;
 
-  g_slice_free (GumFunctionMetadata, function);
+  g_array_append_val (self->functions, function);
+}
+
+/*
+ * Sorts the functions by name, keeping only the first of any duplicates, and
+ * fills in the trigram filter.
+ */
+static void
+gum_function_table_seal (GumFunctionTable * self)
+{
+  GArray * functions = self->functions;
+  guint i, n;
+
+  g_array_sort (functions, (GCompareFunc) gum_function_metadata_compare);
+
+  n = 0;
+  for (i = 0; i != functions->len; i++)
+  {
+    GumFunctionMetadata * function =
+        &g_array_index (functions, GumFunctionMetadata, i);
+
+    if (n != 0 && strcmp (function->name,
+        g_array_index (functions, GumFunctionMetadata, n - 1).name) == 0)
+    {
+      g_free (function->name);
+      continue;
+    }
+
+    gum_trigram_filter_add (self->trigrams, function->name,
+        strlen (function->name));
+
+    g_array_index (functions, GumFunctionMetadata, n++) = *function;
+  }
+  g_array_set_size (functions, n);
+}
+
+static guint
+gum_function_table_find_first (GumFunctionTable * self,
+                               const gchar * prefix,
+                               gsize prefix_length)
+{
+  GArray * functions = self->functions;
+  guint lower, upper;
+
+  lower = 0;
+  upper = functions->len;
+
+  while (lower != upper)
+  {
+    guint mid = lower + ((upper - lower) / 2);
+
+    if (strncmp (g_array_index (functions, GumFunctionMetadata, mid).name,
+        prefix, prefix_length) < 0)
+    {
+      lower = mid + 1;
+    }
+    else
+    {
+      upper = mid;
+    }
+  }
+
+  return lower;
+}
+
+static gint
+gum_function_metadata_compare (const GumFunctionMetadata * a,
+                               const GumFunctionMetadata * b)
+{
+  return strcmp (a->name, b->name);
+}
+
+static void
+gum_function_query_init (GumFunctionQuery * query,
+                         gchar * pattern)
+{
+  const gchar * segment, * cursor;
+
+  query->pattern = pattern;
+  query->spec = g_pattern_spec_new (pattern);
+  query->prefix_length = strcspn (pattern, "*?");
+  query->is_literal = pattern[query->prefix_length] == '\0';
+
+  memset (query->trigrams, 0, sizeof (query->trigrams));
+  segment = pattern;
+  for (cursor = pattern; TRUE; cursor++)
+  {
+    if (*cursor == '*' || *cursor == '?' || *cursor == '\0')
+    {
+      gum_trigram_filter_add (query->trigrams, segment, cursor - segment);
+
+      if (*cursor == '\0')
+        break;
+
+      segment = cursor + 1;
+    }
+  }
+}
+
+static void
+gum_function_query_destroy (GumFunctionQuery * query)
+{
+  g_pattern_spec_free (query->spec);
+  g_free (query->pattern);
+}
+
+static gboolean
+gum_function_query_may_match (const GumFunctionQuery * self,
+                              const GumFunctionTable * table)
+{
+  guint i;
+
+  for (i = 0; i != GUM_TRIGRAM_FILTER_WORDS; i++)
+  {
+    if ((self->trigrams[i] & ~table->trigrams[i]) != 0)
+      return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+gum_trigram_filter_add (guint32 * filter,
+                        const gchar * str,
+                        gsize length)
+{
+  const guint8 * s = (const guint8 *) str;
+  gsize i;
+
+  for (i = 0; i + 3 <= length; i++)
+  {
+    guint32 trigram, bit;
+
+    trigram = s[i] | (s[i + 1] << 8) | (s[i + 2] << 16);
+    bit = (trigram * 2654435761U) >> (32 - GUM_TRIGRAM_FILTER_ORDER);
+
+    filter[bit / 32] |= 1U << (bit % 32);
+  }
 }
@@ -6,26 +6,56 @@
 
 #include "gummodulemap.h"
 
+#include "gumtls.h"
+
 #include <stdlib.h>
+#include <string.h>
+
+/*
+ * Lookups search `starts`, a packed copy of the sorted base addresses, rather
+ * than the wide GumModuleDetails entries, whose ranges live in separate
+ * allocations. Each thread also remembers the last module it found together
+ * with the serial of the map contents it came from, and checks that module
+ * first, as consecutive lookups tend to hit the same module. Serials are
+ * unique across all maps, so a stale hit can never be mistaken for a fresh
+ * one, even from a different map.
+ */
+
+#define GUM_MODULE_MAP_SORT_THRESHOLD 32
+
+typedef struct _GumUpdateModuleMapContext GumUpdateModuleMapContext;
 
 struct _GumModuleMap
 {
   GObject parent;
 
   GArray * modules;
+  GumAddress * starts;
+  GumAddress * ends;
+  gsize serial;
 
   GumModuleMapFilterFunc filter_func;
   gpointer filter_data;
   GDestroyNotify filter_data_destroy;
 };
 
+struct _GumUpdateModuleMapContext
+{
+  GumModuleMap * map;
+  GArray * previous_modules;
+};
+
 static void gum_module_map_dispose (GObject * object);
 static void gum_module_map_finalize (GObject * object);
 
+static void gum_module_map_index (GumModuleMap * self);
 static void gum_module_map_clear (GumModuleMap * self);
+static void gum_module_details_array_clear (GArray * modules);
 static gboolean gum_add_module (const GumModuleDetails * details,
     gpointer user_data);
 
+static gint gum_module_map_compare_addresses (const guint * lhs,
+    const guint * rhs, const gpointer * addresses);
 static gint gum_module_details_compare_base (
     const GumModuleDetails * lhs_module, const GumModuleDetails * rhs_module);
 static gint gum_module_details_compare_to_key (const GumAddress * key_ptr,
@@ -33,6 +63,10 @@ static gint gum_module_details_compare_to_key (const GumAddress * key_ptr,
 
 G_DEFINE_TYPE (GumModuleMap, gum_module_map, G_TYPE_OBJECT)
 
+static GumTlsKey gum_module_map_last_serial_key;
+static GumTlsKey gum_module_map_last_index_key;
+static volatile gint gum_module_map_next_serial = 1;
+
 static void
 gum_module_map_class_init (GumModuleMapClass * klass)
 {
@@ -40,6 +74,9 @@ gum_module_map_class_init (GumModuleMapClass * klass)
 
   object_class->dispose = gum_module_map_dispose;
   object_class->finalize = gum_module_map_finalize;
+
+  gum_module_map_last_serial_key = gum_tls_key_new ();
+  gum_module_map_last_index_key = gum_tls_key_new ();
 }
 
 static void
@@ -70,6 +107,8 @@ gum_module_map_finalize (GObject * object)
 
   gum_module_map_clear (self);
   g_array_free (self->modules, TRUE);
+  g_free (self->starts);
+  g_free (self->ends);
 
   G_OBJECT_CLASS (gum_module_map_parent_class)->finalize (object);
 }
@@ -107,17 +146,160 @@ const GumModuleDetails *
 gum_module_map_find (GumModuleMap * self,
                      GumAddress address)
 {
-  return bsearch (&address, self->modules->data, self->modules->len,
-      sizeof (GumModuleDetails),
-      (GCompareFunc) gum_module_details_compare_to_key);
+  const GumAddress * starts = self->starts;
+  guint n, base, index;
+
+  n = self->modules->len;
+  if (n == 0)
+    return NULL;
+
+  if (GPOINTER_TO_SIZE (gum_tls_key_get_value (
+      gum_module_map_last_serial_key)) == self->serial)
+  {
+    index = GPOINTER_TO_UINT (gum_tls_key_get_value (
+        gum_module_map_last_index_key));
+    if (address >= starts[index] && address < self->ends[index])
+      return &g_array_index (self->modules, GumModuleDetails, index);
+  }
+
+  /* Find the last start <= address without a data-dependent branch. */
+  base = 0;
+  while (n > 1)
+  {
+    guint half = n / 2;
+
+    base = (starts[base + half] <= address) ? base + half : base;
+    n -= half;
+  }
+
+  if (address < starts[base] || address >= self->ends[base])
+    return NULL;
+
+  gum_tls_key_set_value (gum_module_map_last_serial_key,
+      GSIZE_TO_POINTER (self->serial));
+  gum_tls_key_set_value (gum_module_map_last_index_key,
+      GUINT_TO_POINTER (base));
+
+  return &g_array_index (self->modules, GumModuleDetails, base);
+}
+
+/*
+ * Large batches are visited in address order, which turns the lookups into
+ * a single merge-like sweep over the modules instead of one search each.
+ */
+void
+gum_module_map_resolve_many (GumModuleMap * self,
+                             const gpointer * addresses,
+                             guint n_addresses,
+                             GumModuleLocation * locations)
+{
+  const GumAddress * starts = self->starts;
+  const GumAddress * ends = self->ends;
+  guint n_modules = self->modules->len;
+  guint * order;
+  guint i, module_index;
+
+  if (n_addresses < GUM_MODULE_MAP_SORT_THRESHOLD || n_modules == 0)
+  {
+    for (i = 0; i != n_addresses; i++)
+    {
+      GumAddress address = GUM_ADDRESS (addresses[i]);
+      const GumModuleDetails * details;
+      GumModuleLocation * location = &locations[i];
+
+      details = gum_module_map_find (self, address);
+      if (details != NULL)
+      {
+        location->index = details -
+            (const GumModuleDetails *) self->modules->data;
+        location->offset = (guint32) (address - details->range->base_address);
+      }
+      else
+      {
+        location->index = -1;
+        location->offset = 0;
+      }
+    }
+
+    return;
+  }
+
+  order = g_new (guint, n_addresses);
+  for (i = 0; i != n_addresses; i++)
+    order[i] = i;
+  g_qsort_with_data (order, n_addresses, sizeof (guint),
+      (GCompareDataFunc) gum_module_map_compare_addresses,
+      (gpointer) addresses);
+
+  module_index = 0;
+  for (i = 0; i != n_addresses; i++)
+  {
+    guint address_index = order[i];
+    GumAddress address = GUM_ADDRESS (addresses[address_index]);
+    GumModuleLocation * location = &locations[address_index];
+
+    while (module_index + 1 < n_modules && starts[module_index + 1] <= address)
+      module_index++;
+
+    if (address >= starts[module_index] && address < ends[module_index])
+    {
+      location->index = module_index;
+      location->offset = (guint32) (address - starts[module_index]);
+    }
+    else
+    {
+      location->index = -1;
+      location->offset = 0;
+    }
+  }
+
+  g_free (order);
 }
 
+/*
+ * Modules that are still loaded at the same place keep their existing
+ * entries, so a refresh after a few loads and unloads only allocates for the
+ * modules that actually changed.
+ */
 void
 gum_module_map_update (GumModuleMap * self)
 {
-  gum_module_map_clear (self);
-  gum_process_enumerate_modules (gum_add_module, self);
+  GumUpdateModuleMapContext ctx;
+
+  ctx.map = self;
+  ctx.previous_modules = self->modules;
+
+  self->modules = g_array_sized_new (FALSE, FALSE, sizeof (GumModuleDetails),
+      ctx.previous_modules->len);
+
+  gum_process_enumerate_modules (gum_add_module, &ctx);
   g_array_sort (self->modules, (GCompareFunc) gum_module_details_compare_base);
+
+  gum_module_details_array_clear (ctx.previous_modules);
+  g_array_free (ctx.previous_modules, TRUE);
+
+  gum_module_map_index (self);
+}
+
+static void
+gum_module_map_index (GumModuleMap * self)
+{
+  guint n = self->modules->len;
+  guint i;
+
+  self->starts = g_renew (GumAddress, self->starts, MAX (n, 1));
+  self->ends = g_renew (GumAddress, self->ends, MAX (n, 1));
+
+  for (i = 0; i != n; i++)
+  {
+    const GumMemoryRange * range =
+        g_array_index (self->modules, GumModuleDetails, i).range;
+
+    self->starts[i] = range->base_address;
+    self->ends[i] = range->base_address + range->size;
+  }
+
+  self->serial = (gsize) g_atomic_int_add (&gum_module_map_next_serial, 1);
 }
 
 GArray *
@@ -128,25 +310,35 @@ gum_module_map_get_values (GumModuleMap * self)
 
 static void
 gum_module_map_clear (GumModuleMap * self)
+{
+  gum_module_details_array_clear (self->modules);
+}
+
+static void
+gum_module_details_array_clear (GArray * modules)
 {
   guint i;
 
-  for (i = 0; i < self->modules->len; i++)
+  for (i = 0; i < modules->len; i++)
   {
-    GumModuleDetails * d = &g_array_index (self->modules, GumModuleDetails, i);
+    GumModuleDetails * d = &g_array_index (modules, GumModuleDetails, i);
+    if (d->name == NULL)
+      continue;
     g_free ((gchar *) d->name);
     g_slice_free (GumMemoryRange, (GumMemoryRange *) d->range);
     g_free ((gchar *) d->path);
   }
-  g_array_set_size (self->modules, 0);
+  g_array_set_size (modules, 0);
 }
 
 static gboolean
 gum_add_module (const GumModuleDetails * details,
                 gpointer user_data)
 {
-  GumModuleMap * self = user_data;
-  GumModuleDetails copy;
+  GumUpdateModuleMapContext * ctx = user_data;
+  GumModuleMap * self = ctx->map;
+  GArray * previous_modules = ctx->previous_modules;
+  GumModuleDetails * existing, copy;
 
   if (self->filter_func != NULL)
   {
@@ -154,6 +346,22 @@ gum_add_module (const GumModuleDetails * details,
       return TRUE;
   }
 
+  existing = bsearch (&details->range->base_address, previous_modules->data,
+      previous_modules->len, sizeof (GumModuleDetails),
+      (GCompareFunc) gum_module_details_compare_to_key);
+  if (existing != NULL && existing->name != NULL &&
+      existing->range->base_address == details->range->base_address &&
+      existing->range->size == details->range->size &&
+      g_strcmp0 (existing->path, details->path) == 0 &&
+      strcmp (existing->name, details->name) == 0)
+  {
+    g_array_append_val (self->modules, *existing);
+
+    /* Ownership moved; the range stays behind for bsearch() to look at. */
+    existing->name = NULL;
+    return TRUE;
+  }
+
   copy.name = g_strdup (details->name);
   copy.range = g_slice_dup (GumMemoryRange, details->range);
   copy.path = g_strdup (details->path);
@@ -163,6 +371,23 @@ gum_add_module (const GumModuleDetails * details,
   return TRUE;
 }
 
+static gint
+gum_module_map_compare_addresses (const guint * lhs,
+                                  const guint * rhs,
+                                  const gpointer * addresses)
+{
+  gsize a = GPOINTER_TO_SIZE (addresses[*lhs]);
+  gsize b = GPOINTER_TO_SIZE (addresses[*rhs]);
+
+  if (a < b)
+    return -1;
+
+  if (a > b)
+    return 1;
+
+  return 0;
+}
+
 static gint
 gum_module_details_compare_base (const GumModuleDetails * lhs_module,
                                  const GumModuleDetails * rhs_module)
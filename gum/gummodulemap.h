@@ -15,15 +15,30 @@ G_BEGIN_DECLS
 #define GUM_TYPE_MODULE_MAP (gum_module_map_get_type ())
 G_DECLARE_FINAL_TYPE (GumModuleMap, gum_module_map, GUM, MODULE_MAP, GObject)
 
+typedef struct _GumModuleLocation GumModuleLocation;
+
 typedef gboolean (* GumModuleMapFilterFunc) (const GumModuleDetails * details,
     gpointer user_data);
 
+/*
+ * Where an address falls: the index of its module in the map's values, or -1
+ * if there is none, and its offset from that module's base.
+ */
+struct _GumModuleLocation
+{
+  gint index;
+  guint32 offset;
+};
+
 GUM_API GumModuleMap * gum_module_map_new (void);
 GUM_API GumModuleMap * gum_module_map_new_filtered (GumModuleMapFilterFunc func,
     gpointer data, GDestroyNotify data_destroy);
 
 GUM_API const GumModuleDetails * gum_module_map_find (GumModuleMap * self,
     GumAddress address);
+GUM_API void gum_module_map_resolve_many (GumModuleMap * self,
+    const gpointer * addresses, guint n_addresses,
+    GumModuleLocation * locations);
 
 GUM_API void gum_module_map_update (GumModuleMap * self);
 
@@ -0,0 +1,404 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gummodulesnapshot.h"
+
+#include "gum-init.h"
+#include "gumprocess-priv.h"
+
+#include <string.h>
+
+/*
+ * There is one current snapshot for the whole process, and it is handed out
+ * by reference to everyone who asks, so scripts and resolvers share both the
+ * module list and what has been learnt about each module's exports. A new
+ * version is only built when the list of loaded modules actually differs,
+ * and it takes over the entries of modules that are still loaded at the same
+ * base, so their export lookups carry over.
+ *
+ * Where the loader keeps a generation count, an unchanged count means the
+ * current snapshot can be handed out right away. Elsewhere every request
+ * enumerates the modules and compares them with the current snapshot, which
+ * costs as much as an enumeration but still keeps the version stable.
+ *
+ * Snapshots are immutable once published, apart from the export lookups of
+ * their entries, which are guarded by the snapshot lock. That lock is never
+ * held while calling into the loader.
+ */
+
+typedef struct _GumModuleSnapshotEntry GumModuleSnapshotEntry;
+
+struct _GumModuleSnapshot
+{
+  volatile gint ref_count;
+
+  guint version;
+  GPtrArray * entries;
+  GHashTable * entry_by_name;
+};
+
+struct _GumModuleSnapshotEntry
+{
+  volatile gint ref_count;
+
+  GumModuleDetails details;
+  GumMemoryRange range;
+
+  GHashTable * exports;
+};
+
+static GumModuleSnapshot * gum_module_snapshot_new (GPtrArray * entries,
+    GumModuleSnapshot * previous);
+static gboolean gum_module_snapshot_has_entries (GumModuleSnapshot * self,
+    GPtrArray * entries);
+static void gum_module_snapshot_deinit (void);
+
+static gboolean gum_module_snapshot_collect_entry (
+    const GumModuleDetails * details, gpointer user_data);
+
+static GumModuleSnapshotEntry * gum_module_snapshot_entry_new (
+    const GumModuleDetails * details);
+static GumModuleSnapshotEntry * gum_module_snapshot_entry_ref (
+    GumModuleSnapshotEntry * entry);
+static void gum_module_snapshot_entry_unref (GumModuleSnapshotEntry * entry);
+static gboolean gum_module_snapshot_entry_equals (
+    const GumModuleSnapshotEntry * a, const GumModuleSnapshotEntry * b);
+
+static GMutex gum_module_snapshot_lock;
+static GumModuleSnapshot * gum_current_snapshot = NULL;
+static gboolean gum_current_generation_known = FALSE;
+static guint64 gum_current_generation = 0;
+static guint gum_last_snapshot_version = 0;
+
+GumModuleSnapshot *
+gum_module_snapshot_obtain (void)
+{
+  GumModuleSnapshot * snapshot;
+  gboolean generation_known;
+  guint64 generation;
+  GPtrArray * entries;
+
+  generation_known = _gum_process_query_module_generation (&generation);
+
+  g_mutex_lock (&gum_module_snapshot_lock);
+
+  if (gum_current_snapshot != NULL && generation_known &&
+      gum_current_generation_known && generation == gum_current_generation)
+  {
+    snapshot = gum_module_snapshot_ref (gum_current_snapshot);
+
+    g_mutex_unlock (&gum_module_snapshot_lock);
+
+    return snapshot;
+  }
+
+  g_mutex_unlock (&gum_module_snapshot_lock);
+
+  entries = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_module_snapshot_entry_unref);
+  gum_process_enumerate_modules (gum_module_snapshot_collect_entry, entries);
+
+  g_mutex_lock (&gum_module_snapshot_lock);
+
+  if (gum_current_snapshot != NULL &&
+      gum_module_snapshot_has_entries (gum_current_snapshot, entries))
+  {
+    snapshot = gum_module_snapshot_ref (gum_current_snapshot);
+  }
+  else
+  {
+    snapshot = gum_module_snapshot_new (entries, gum_current_snapshot);
+
+    if (gum_current_snapshot != NULL)
+      gum_module_snapshot_unref (gum_current_snapshot);
+    else
+      _gum_register_destructor (gum_module_snapshot_deinit);
+    gum_current_snapshot = gum_module_snapshot_ref (snapshot);
+  }
+
+  /*
+   * The generation was read before enumerating, so if the modules changed in
+   * between, the next request sees a newer count and enumerates again.
+   */
+  gum_current_generation_known = generation_known;
+  gum_current_generation = generation;
+
+  g_mutex_unlock (&gum_module_snapshot_lock);
+
+  g_ptr_array_unref (entries);
+
+  return snapshot;
+}
+
+GumModuleSnapshot *
+gum_module_snapshot_ref (GumModuleSnapshot * self)
+{
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+gum_module_snapshot_unref (GumModuleSnapshot * self)
+{
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+  {
+    g_hash_table_unref (self->entry_by_name);
+    g_ptr_array_unref (self->entries);
+
+    g_slice_free (GumModuleSnapshot, self);
+  }
+}
+
+/*
+ * Versions start at 1 and grow by one for every change to the module list
+ * that has been observed.
+ */
+guint
+gum_module_snapshot_get_version (GumModuleSnapshot * self)
+{
+  return self->version;
+}
+
+void
+gum_module_snapshot_enumerate_modules (GumModuleSnapshot * self,
+                                       GumFoundModuleFunc func,
+                                       gpointer user_data)
+{
+  guint i;
+
+  for (i = 0; i != self->entries->len; i++)
+  {
+    GumModuleSnapshotEntry * entry = g_ptr_array_index (self->entries, i);
+
+    if (!func (&entry->details, user_data))
+      return;
+  }
+}
+
+/* Looks up a module by its exact name or path. */
+const GumModuleDetails *
+gum_module_snapshot_find_module (GumModuleSnapshot * self,
+                                 const gchar * name)
+{
+  GumModuleSnapshotEntry * entry;
+
+  entry = g_hash_table_lookup (self->entry_by_name, name);
+  if (entry == NULL)
+    return NULL;
+
+  return &entry->details;
+}
+
+/*
+ * Gives the same answer as gum_module_find_export_by_name(), remembering it
+ * for as long as the module stays loaded at the same base. Lookups without a
+ * module, or for one the snapshot knows no exact match for, are passed
+ * straight through.
+ */
+GumAddress
+gum_module_snapshot_find_export_by_name (GumModuleSnapshot * self,
+                                         const gchar * module_name,
+                                         const gchar * symbol_name)
+{
+  GumModuleSnapshotEntry * entry;
+  gpointer value;
+  gboolean found;
+  GumAddress address;
+
+  if (module_name == NULL)
+    return gum_module_find_export_by_name (NULL, symbol_name);
+
+  entry = g_hash_table_lookup (self->entry_by_name, module_name);
+  if (entry == NULL)
+    return gum_module_find_export_by_name (module_name, symbol_name);
+
+  g_mutex_lock (&gum_module_snapshot_lock);
+  found = entry->exports != NULL && g_hash_table_lookup_extended (
+      entry->exports, symbol_name, NULL, &value);
+  g_mutex_unlock (&gum_module_snapshot_lock);
+
+  if (found)
+    return GUM_ADDRESS (value);
+
+  address = gum_module_find_export_by_name (entry->details.path, symbol_name);
+
+  g_mutex_lock (&gum_module_snapshot_lock);
+  if (entry->exports == NULL)
+  {
+    entry->exports =
+        g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  }
+  g_hash_table_insert (entry->exports, g_strdup (symbol_name),
+      GSIZE_TO_POINTER (address));
+  g_mutex_unlock (&gum_module_snapshot_lock);
+
+  return address;
+}
+
+/*
+ * Uses the current snapshot where the loader lets us tell cheaply that it is
+ * still up to date, and goes straight to gum_module_find_export_by_name()
+ * elsewhere, where confirming that would cost more than the lookup itself.
+ */
+GumAddress
+gum_module_snapshot_lookup_export (const gchar * module_name,
+                                   const gchar * symbol_name)
+{
+  guint64 generation;
+  GumModuleSnapshot * snapshot;
+  GumAddress address;
+
+  if (module_name == NULL ||
+      !_gum_process_query_module_generation (&generation))
+  {
+    return gum_module_find_export_by_name (module_name, symbol_name);
+  }
+
+  snapshot = gum_module_snapshot_obtain ();
+  address = gum_module_snapshot_find_export_by_name (snapshot, module_name,
+      symbol_name);
+  gum_module_snapshot_unref (snapshot);
+
+  return address;
+}
+
+static GumModuleSnapshot *
+gum_module_snapshot_new (GPtrArray * entries,
+                         GumModuleSnapshot * previous)
+{
+  GumModuleSnapshot * snapshot;
+  guint i;
+
+  snapshot = g_slice_new (GumModuleSnapshot);
+  snapshot->ref_count = 1;
+  snapshot->version = ++gum_last_snapshot_version;
+  snapshot->entries = g_ptr_array_new_full (entries->len,
+      (GDestroyNotify) gum_module_snapshot_entry_unref);
+  snapshot->entry_by_name = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i != entries->len; i++)
+  {
+    GumModuleSnapshotEntry * entry = g_ptr_array_index (entries, i);
+
+    if (previous != NULL)
+    {
+      GumModuleSnapshotEntry * old_entry;
+
+      old_entry = g_hash_table_lookup (previous->entry_by_name,
+          entry->details.path);
+      if (old_entry != NULL && gum_module_snapshot_entry_equals (old_entry,
+          entry))
+      {
+        entry = old_entry;
+      }
+    }
+
+    g_ptr_array_add (snapshot->entries, gum_module_snapshot_entry_ref (entry));
+
+    if (!g_hash_table_contains (snapshot->entry_by_name, entry->details.name))
+    {
+      g_hash_table_insert (snapshot->entry_by_name,
+          (gpointer) entry->details.name, entry);
+    }
+    if (!g_hash_table_contains (snapshot->entry_by_name, entry->details.path))
+    {
+      g_hash_table_insert (snapshot->entry_by_name,
+          (gpointer) entry->details.path, entry);
+    }
+  }
+
+  return snapshot;
+}
+
+static gboolean
+gum_module_snapshot_has_entries (GumModuleSnapshot * self,
+                                 GPtrArray * entries)
+{
+  guint i;
+
+  if (entries->len != self->entries->len)
+    return FALSE;
+
+  for (i = 0; i != entries->len; i++)
+  {
+    if (!gum_module_snapshot_entry_equals (g_ptr_array_index (entries, i),
+        g_ptr_array_index (self->entries, i)))
+    {
+      return FALSE;
+    }
+  }
+
+  return TRUE;
+}
+
+static void
+gum_module_snapshot_deinit (void)
+{
+  gum_module_snapshot_unref (gum_current_snapshot);
+  gum_current_snapshot = NULL;
+  gum_current_generation_known = FALSE;
+}
+
+static gboolean
+gum_module_snapshot_collect_entry (const GumModuleDetails * details,
+                                   gpointer user_data)
+{
+  GPtrArray * entries = user_data;
+
+  g_ptr_array_add (entries, gum_module_snapshot_entry_new (details));
+
+  return TRUE;
+}
+
+static GumModuleSnapshotEntry *
+gum_module_snapshot_entry_new (const GumModuleDetails * details)
+{
+  GumModuleSnapshotEntry * entry;
+
+  entry = g_slice_new (GumModuleSnapshotEntry);
+  entry->ref_count = 1;
+  entry->details.name = g_strdup (details->name);
+  entry->details.range = &entry->range;
+  entry->details.path = g_strdup (details->path);
+  entry->range = *details->range;
+  entry->exports = NULL;
+
+  return entry;
+}
+
+static GumModuleSnapshotEntry *
+gum_module_snapshot_entry_ref (GumModuleSnapshotEntry * entry)
+{
+  g_atomic_int_inc (&entry->ref_count);
+
+  return entry;
+}
+
+static void
+gum_module_snapshot_entry_unref (GumModuleSnapshotEntry * entry)
+{
+  if (g_atomic_int_dec_and_test (&entry->ref_count))
+  {
+    if (entry->exports != NULL)
+      g_hash_table_unref (entry->exports);
+
+    g_free ((gchar *) entry->details.path);
+    g_free ((gchar *) entry->details.name);
+
+    g_slice_free (GumModuleSnapshotEntry, entry);
+  }
+}
+
+static gboolean
+gum_module_snapshot_entry_equals (const GumModuleSnapshotEntry * a,
+                                  const GumModuleSnapshotEntry * b)
+{
+  return a->range.base_address == b->range.base_address &&
+      a->range.size == b->range.size &&
+      strcmp (a->details.path, b->details.path) == 0 &&
+      strcmp (a->details.name, b->details.name) == 0;
+}
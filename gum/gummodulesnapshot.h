@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_MODULE_SNAPSHOT_H__
+#define __GUM_MODULE_SNAPSHOT_H__
+
+#include <gum/gumprocess.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GumModuleSnapshot GumModuleSnapshot;
+
+GUM_API GumModuleSnapshot * gum_module_snapshot_obtain (void);
+GUM_API GumModuleSnapshot * gum_module_snapshot_ref (GumModuleSnapshot * self);
+GUM_API void gum_module_snapshot_unref (GumModuleSnapshot * self);
+
+GUM_API guint gum_module_snapshot_get_version (GumModuleSnapshot * self);
+
+GUM_API void gum_module_snapshot_enumerate_modules (GumModuleSnapshot * self,
+    GumFoundModuleFunc func, gpointer user_data);
+GUM_API const GumModuleDetails * gum_module_snapshot_find_module (
+    GumModuleSnapshot * self, const gchar * name);
+GUM_API GumAddress gum_module_snapshot_find_export_by_name (
+    GumModuleSnapshot * self, const gchar * module_name,
+    const gchar * symbol_name);
+
+GUM_API GumAddress gum_module_snapshot_lookup_export (
+    const gchar * module_name, const gchar * symbol_name);
+
+G_END_DECLS
+
+#endif
@@ -9,12 +9,54 @@
 
 #include "gumprocess.h"
 
+#if (defined (HAVE_LINUX) && (defined (HAVE_I386) || defined (HAVE_ARM64))) \
+    || (defined (G_OS_WIN32) && defined (HAVE_I386))
+# define GUM_HAVE_DEBUG_REGISTERS 1
+#endif
+
+#if defined (HAVE_I386)
+# define GUM_MAX_DEBUG_WATCHPOINTS 4
+#elif defined (HAVE_ARM64)
+# define GUM_MAX_DEBUG_WATCHPOINTS 16
+#endif
+
 G_BEGIN_DECLS
 
-G_GNUC_INTERNAL void _gum_process_enumerate_threads (GumFoundThreadFunc func,
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+
+typedef struct _GumDebugRegisters GumDebugRegisters;
+
+typedef void (* GumModifyDebugRegistersFunc) (GumThreadId thread_id,
+    GumDebugRegisters * regs, gpointer user_data);
+
+struct _GumDebugRegisters
+{
+#if defined (HAVE_I386)
+  gsize dr[GUM_MAX_DEBUG_WATCHPOINTS];
+  gsize dr6;
+  gsize dr7;
+#elif defined (HAVE_ARM64)
+  guint num_watchpoints;
+  guint64 wvr[GUM_MAX_DEBUG_WATCHPOINTS];
+  guint32 wcr[GUM_MAX_DEBUG_WATCHPOINTS];
+#endif
+};
+
+G_GNUC_INTERNAL gboolean _gum_process_modify_debug_registers (
+    GumThreadId thread_id, GumModifyDebugRegistersFunc func,
+    gpointer user_data);
+G_GNUC_INTERNAL gboolean _gum_process_do_modify_debug_registers (
+    GumThreadId thread_id, GumModifyDebugRegistersFunc func,
     gpointer user_data);
+
+#endif
+
+G_GNUC_INTERNAL void _gum_process_enumerate_threads (GumThreadFlags flags,
+    GumFoundThreadFunc func, gpointer user_data);
 G_GNUC_INTERNAL void _gum_process_enumerate_ranges (GumPageProtection prot,
     GumFoundRangeFunc func, gpointer user_data);
+G_GNUC_INTERNAL gboolean _gum_process_query_module_generation (
+    guint64 * generation);
 
 G_END_DECLS
 
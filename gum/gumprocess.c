@@ -10,6 +10,7 @@
 
 typedef struct _GumEmitThreadsContext GumEmitThreadsContext;
 typedef struct _GumEmitRangesContext GumEmitRangesContext;
+typedef struct _GumModifyDebugRegistersContext GumModifyDebugRegistersContext;
 
 struct _GumEmitThreadsContext
 {
@@ -23,11 +24,27 @@ struct _GumEmitRangesContext
   gpointer user_data;
 };
 
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+
+struct _GumModifyDebugRegistersContext
+{
+  GumThreadId thread_id;
+  GumModifyDebugRegistersFunc func;
+  gpointer user_data;
+};
+
+#endif
+
 static gboolean gum_emit_thread_if_not_cloaked (
     const GumThreadDetails * details, gpointer user_data);
 static gboolean gum_emit_range_if_not_cloaked (const GumRangeDetails * details,
     gpointer user_data);
 
+static GArray * gum_range_entries_new (void);
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+static gpointer gum_modify_debug_registers_from_helper (gpointer data);
+#endif
+
 static GumCodeSigningPolicy gum_code_signing_policy = GUM_CODE_SIGNING_OPTIONAL;
 
 GumOS
@@ -62,15 +79,55 @@ gum_process_set_code_signing_policy (GumCodeSigningPolicy policy)
   gum_code_signing_policy = policy;
 }
 
+#if !defined (HAVE_LINUX) && !defined (HAVE_DARWIN)
+
+/*
+ * Only the Linux and Darwin backends have a per-thread cost worth
+ * amortizing, so the others simply modify one thread at a time.
+ */
+guint
+gum_process_modify_threads (const GumThreadId * thread_ids,
+                            guint num_threads,
+                            GumModifyThreadFunc func,
+                            gpointer user_data)
+{
+  guint num_modified = 0;
+  guint i;
+
+  for (i = 0; i != num_threads; i++)
+  {
+    if (gum_process_modify_thread (thread_ids[i], func, user_data))
+      num_modified++;
+  }
+
+  return num_modified;
+}
+
+#endif
+
 void
 gum_process_enumerate_threads (GumFoundThreadFunc func,
                                gpointer user_data)
+{
+  gum_process_enumerate_threads_with_flags (GUM_THREAD_FLAGS_NONE, func,
+      user_data);
+}
+
+/*
+ * Fields that the flags ask to skip are zeroed. Backends where a field comes
+ * for free may still fill it in.
+ */
+void
+gum_process_enumerate_threads_with_flags (GumThreadFlags flags,
+                                          GumFoundThreadFunc func,
+                                          gpointer user_data)
 {
   GumEmitThreadsContext ctx;
 
   ctx.func = func;
   ctx.user_data = user_data;
-  _gum_process_enumerate_threads (gum_emit_thread_if_not_cloaked, &ctx);
+  _gum_process_enumerate_threads (flags, gum_emit_thread_if_not_cloaked,
+      &ctx);
 }
 
 static gboolean
@@ -97,6 +154,68 @@ gum_process_enumerate_ranges (GumPageProtection prot,
   _gum_process_enumerate_ranges (prot, gum_emit_range_if_not_cloaked, &ctx);
 }
 
+/*
+ * Hands back all matching ranges in one flat array, which spares bindings
+ * a round-trip per range. Release it with g_array_unref().
+ */
+GArray *
+gum_process_collect_ranges (GumPageProtection prot)
+{
+  GArray * entries;
+
+  entries = gum_range_entries_new ();
+  gum_process_enumerate_ranges (prot,
+      (GumFoundRangeFunc) gum_range_entry_collect, entries);
+
+  return entries;
+}
+
+GArray *
+gum_module_collect_ranges (const gchar * module_name,
+                           GumPageProtection prot)
+{
+  GArray * entries;
+
+  entries = gum_range_entries_new ();
+  gum_module_enumerate_ranges (module_name, prot,
+      (GumFoundRangeFunc) gum_range_entry_collect, entries);
+
+  return entries;
+}
+
+gboolean
+gum_range_entry_collect (const GumRangeDetails * details,
+                         GArray * entries)
+{
+  GumRangeEntry * entry;
+
+  g_array_set_size (entries, entries->len + 1);
+  entry = &g_array_index (entries, GumRangeEntry, entries->len - 1);
+
+  entry->range = *details->range;
+  entry->prot = details->prot;
+  if (details->file != NULL)
+  {
+    entry->file.path = g_intern_string (details->file->path);
+    entry->file.offset = details->file->offset;
+    entry->file.size = details->file->size;
+  }
+  else
+  {
+    entry->file.path = NULL;
+    entry->file.offset = 0;
+    entry->file.size = 0;
+  }
+
+  return TRUE;
+}
+
+static GArray *
+gum_range_entries_new (void)
+{
+  return g_array_sized_new (FALSE, FALSE, sizeof (GumRangeEntry), 256);
+}
+
 static gboolean
 gum_emit_range_if_not_cloaked (const GumRangeDetails * details,
                                gpointer user_data)
@@ -191,3 +310,47 @@ gum_symbol_type_to_string (GumSymbolType type)
   g_assert_not_reached ();
   return NULL;
 }
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+
+gboolean
+_gum_process_modify_debug_registers (GumThreadId thread_id,
+                                     GumModifyDebugRegistersFunc func,
+                                     gpointer user_data)
+{
+  GumModifyDebugRegistersContext ctx;
+  GThread * helper;
+
+  if (thread_id != gum_process_get_current_thread_id ())
+  {
+    return _gum_process_do_modify_debug_registers (thread_id, func,
+        user_data);
+  }
+
+  /*
+   * A thread cannot suspend or ptrace() itself, so we let a short-lived
+   * helper thread do it while we're blocked waiting for it to finish.
+   */
+  ctx.thread_id = thread_id;
+  ctx.func = func;
+  ctx.user_data = user_data;
+
+  helper = g_thread_new ("gum-debug-registers",
+      gum_modify_debug_registers_from_helper, &ctx);
+
+  return GPOINTER_TO_SIZE (g_thread_join (helper));
+}
+
+static gpointer
+gum_modify_debug_registers_from_helper (gpointer data)
+{
+  GumModifyDebugRegistersContext * ctx = data;
+  gboolean success;
+
+  success = _gum_process_do_modify_debug_registers (ctx->thread_id,
+      ctx->func, ctx->user_data);
+
+  return GSIZE_TO_POINTER (success);
+}
+
+#endif
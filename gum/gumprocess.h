@@ -26,6 +26,7 @@ typedef struct _GumSymbolDetails GumSymbolDetails;
 typedef struct _GumSymbolSection GumSymbolSection;
 typedef struct _GumRangeDetails GumRangeDetails;
 typedef struct _GumFileMapping GumFileMapping;
+typedef struct _GumRangeEntry GumRangeEntry;
 typedef struct _GumMallocRangeDetails GumMallocRangeDetails;
 
 enum _GumCodeSigningPolicy
@@ -43,6 +44,13 @@ enum _GumThreadState
   GUM_THREAD_HALTED
 };
 
+typedef enum
+{
+  GUM_THREAD_FLAGS_NONE             = 0,
+  GUM_THREAD_FLAGS_SKIP_STATE       = (1 << 0),
+  GUM_THREAD_FLAGS_SKIP_CPU_CONTEXT = (1 << 1)
+} GumThreadFlags;
+
 struct _GumThreadDetails
 {
   GumThreadId id;
@@ -135,6 +143,18 @@ struct _GumFileMapping
   gsize size;
 };
 
+/*
+ * Flat copy of a GumRangeDetails, used by the gum_*_collect_ranges() family.
+ * `file.path` is NULL for anonymous ranges and otherwise interned, so equal
+ * paths share the same pointer.
+ */
+struct _GumRangeEntry
+{
+  GumMemoryRange range;
+  GumPageProtection prot;
+  GumFileMapping file;
+};
+
 struct _GumMallocRangeDetails
 {
   const GumMemoryRange * range;
@@ -167,12 +187,17 @@ GUM_API GumProcessId gum_process_get_id (void);
 GUM_API GumThreadId gum_process_get_current_thread_id (void);
 GUM_API gboolean gum_process_modify_thread (GumThreadId thread_id,
     GumModifyThreadFunc func, gpointer user_data);
+GUM_API guint gum_process_modify_threads (const GumThreadId * thread_ids,
+    guint num_threads, GumModifyThreadFunc func, gpointer user_data);
 GUM_API void gum_process_enumerate_threads (GumFoundThreadFunc func,
     gpointer user_data);
+GUM_API void gum_process_enumerate_threads_with_flags (GumThreadFlags flags,
+    GumFoundThreadFunc func, gpointer user_data);
 GUM_API void gum_process_enumerate_modules (GumFoundModuleFunc func,
     gpointer user_data);
 GUM_API void gum_process_enumerate_ranges (GumPageProtection prot,
     GumFoundRangeFunc func, gpointer user_data);
+GUM_API GArray * gum_process_collect_ranges (GumPageProtection prot);
 GUM_API void gum_process_enumerate_malloc_ranges (
     GumFoundMallocRangeFunc func, gpointer user_data);
 GUM_API guint gum_thread_try_get_ranges (GumMemoryRange * ranges,
@@ -188,6 +213,8 @@ GUM_API void gum_module_enumerate_symbols (const gchar * module_name,
     GumFoundSymbolFunc func, gpointer user_data);
 GUM_API void gum_module_enumerate_ranges (const gchar * module_name,
     GumPageProtection prot, GumFoundRangeFunc func, gpointer user_data);
+GUM_API GArray * gum_module_collect_ranges (const gchar * module_name,
+    GumPageProtection prot);
 GUM_API GumAddress gum_module_find_base_address (const gchar * module_name);
 GUM_API GumAddress gum_module_find_export_by_name (const gchar * module_name,
     const gchar * symbol_name);
@@ -197,6 +224,9 @@ GUM_API const gchar * gum_code_signing_policy_to_string (
     GumCodeSigningPolicy policy);
 GUM_API const gchar * gum_symbol_type_to_string (GumSymbolType type);
 
+GUM_API gboolean gum_range_entry_collect (const GumRangeDetails * details,
+    GArray * entries);
+
 G_END_DECLS
 
 #endif
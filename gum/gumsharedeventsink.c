@@ -0,0 +1,362 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumsharedeventsink.h"
+
+#include "gumcloak.h"
+#include "gumprocess.h"
+#include "gumspinlock.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#ifdef HAVE_WINDOWS
+# define VC_EXTRALEAN
+# include <windows.h>
+#else
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+#ifdef HAVE_LINUX
+# include <sys/syscall.h>
+#endif
+
+/*
+ * Events are copied as-is into a ring in memory that another process on the
+ * same machine maps too, so a host can read them without going through the
+ * script runtime, and without any copies beyond the one into the ring. The
+ * memory is a memfd on Linux, found by the host at /proc/<pid>/fd/<fd>, a
+ * named POSIX shared memory object on other UNIX systems, and a named file
+ * mapping on Windows. Its path only needs to be handed over once.
+ *
+ * Threads in this process serialize on a spinlock to append, and publish
+ * each record by storing the new head. The reader owns the tail. A full ring
+ * drops the event and counts it, rather than making the traced thread wait
+ * for a process it cannot see.
+ */
+
+struct _GumSharedEventSink
+{
+  GObject parent;
+
+  GumEventType mask;
+
+  GumSpinlock lock;
+  GumEventRing * ring;
+  GumEvent * records;
+  guint capacity;
+  gsize size;
+  gchar * path;
+  GumMemoryRange range;
+
+#ifdef HAVE_WINDOWS
+  HANDLE mapping;
+#else
+  gint fd;
+  gchar * shm_name;
+#endif
+};
+
+static void gum_shared_event_sink_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_shared_event_sink_finalize (GObject * object);
+
+static gboolean gum_shared_event_sink_map (GumSharedEventSink * self,
+    GError ** error);
+static void gum_shared_event_sink_unmap (GumSharedEventSink * self);
+
+static GumEventType gum_shared_event_sink_query_mask (GumEventSink * sink);
+static void gum_shared_event_sink_process (GumEventSink * sink,
+    const GumEvent * ev);
+
+G_DEFINE_TYPE_EXTENDED (GumSharedEventSink,
+                        gum_shared_event_sink,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_EVENT_SINK,
+                            gum_shared_event_sink_iface_init))
+
+static volatile gint gum_next_ring_id = 1;
+
+static void
+gum_shared_event_sink_class_init (GumSharedEventSinkClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gum_shared_event_sink_finalize;
+}
+
+static void
+gum_shared_event_sink_iface_init (gpointer g_iface,
+                                  gpointer iface_data)
+{
+  GumEventSinkInterface * iface = g_iface;
+
+  iface->query_mask = gum_shared_event_sink_query_mask;
+  iface->process = gum_shared_event_sink_process;
+}
+
+static void
+gum_shared_event_sink_init (GumSharedEventSink * self)
+{
+  gum_spinlock_init (&self->lock);
+
+#ifdef HAVE_WINDOWS
+  self->mapping = NULL;
+#else
+  self->fd = -1;
+#endif
+}
+
+static void
+gum_shared_event_sink_finalize (GObject * object)
+{
+  GumSharedEventSink * self = GUM_SHARED_EVENT_SINK (object);
+
+  gum_shared_event_sink_unmap (self);
+
+  g_free (self->path);
+  gum_spinlock_free (&self->lock);
+
+  G_OBJECT_CLASS (gum_shared_event_sink_parent_class)->finalize (object);
+}
+
+/*
+ * The capacity is in events, and is rounded up to a power of two so that the
+ * wrapping counters keep pointing at the same slots.
+ */
+GumSharedEventSink *
+gum_shared_event_sink_new (GumEventType mask,
+                           guint capacity,
+                           GError ** error)
+{
+  GumSharedEventSink * sink;
+
+  sink = g_object_new (GUM_TYPE_SHARED_EVENT_SINK, NULL);
+  sink->mask = mask;
+  sink->capacity = 1;
+  while (sink->capacity < MAX (capacity, 1))
+    sink->capacity <<= 1;
+  sink->size = GUM_ALIGN_SIZE (sizeof (GumEventRing) +
+      (sink->capacity * sizeof (GumEvent)), gum_query_page_size ());
+
+  if (!gum_shared_event_sink_map (sink, error))
+  {
+    g_object_unref (sink);
+    return NULL;
+  }
+
+  sink->records = GUM_EVENT_RING_RECORDS (sink->ring);
+  sink->ring->record_size = sizeof (GumEvent);
+  sink->ring->capacity = sink->capacity;
+  sink->ring->head = 0;
+  sink->ring->dropped_count = 0;
+  sink->ring->tail = 0;
+  g_atomic_int_set (&sink->ring->magic, GUM_EVENT_RING_MAGIC);
+
+  sink->range.base_address = GUM_ADDRESS (sink->ring);
+  sink->range.size = sink->size;
+  gum_cloak_add_range (&sink->range);
+
+  return sink;
+}
+
+/* Where the host finds the memory, as described above. */
+const gchar *
+gum_shared_event_sink_get_path (GumSharedEventSink * self)
+{
+  return self->path;
+}
+
+gsize
+gum_shared_event_sink_get_size (GumSharedEventSink * self)
+{
+  return self->size;
+}
+
+GumEventRing *
+gum_shared_event_sink_get_ring (GumSharedEventSink * self)
+{
+  return self->ring;
+}
+
+static gboolean
+gum_shared_event_sink_map (GumSharedEventSink * self,
+                           GError ** error)
+{
+  guint id;
+
+  id = g_atomic_int_add (&gum_next_ring_id, 1);
+
+#ifdef HAVE_WINDOWS
+  {
+    gunichar2 * name_utf16;
+
+    self->path = g_strdup_printf ("Local\\gum-event-ring-%u-%u",
+        (guint) gum_process_get_id (), id);
+    name_utf16 = g_utf8_to_utf16 (self->path, -1, NULL, NULL, NULL);
+
+    self->mapping = CreateFileMappingW (INVALID_HANDLE_VALUE, NULL,
+        PAGE_READWRITE, 0, (DWORD) self->size, (WCHAR *) name_utf16);
+
+    g_free (name_utf16);
+
+    if (self->mapping == NULL)
+      goto map_failed;
+
+    self->ring = MapViewOfFile (self->mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+        self->size);
+    if (self->ring == NULL)
+      goto map_failed;
+  }
+#else
+# if defined (HAVE_LINUX) && defined (__NR_memfd_create)
+  self->fd = syscall (__NR_memfd_create, "gum-event-ring", 1 /* CLOEXEC */);
+  if (self->fd != -1)
+  {
+    self->path = g_strdup_printf ("/proc/%u/fd/%d",
+        (guint) gum_process_get_id (), self->fd);
+  }
+# endif
+# ifndef HAVE_ANDROID
+  if (self->fd == -1)
+  {
+    self->shm_name = g_strdup_printf ("/gum-event-ring-%u-%u",
+        (guint) gum_process_get_id (), id);
+    self->fd = shm_open (self->shm_name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (self->fd == -1)
+      goto map_failed;
+    self->path = g_strdup (self->shm_name);
+  }
+# endif
+  if (self->fd == -1)
+    goto map_failed;
+
+  gum_cloak_add_file_descriptor (self->fd);
+
+  if (ftruncate (self->fd, self->size) != 0)
+    goto map_failed;
+
+  self->ring = mmap (NULL, self->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      self->fd, 0);
+  if (self->ring == MAP_FAILED)
+  {
+    self->ring = NULL;
+    goto map_failed;
+  }
+#endif
+
+  return TRUE;
+
+map_failed:
+  {
+#ifdef HAVE_WINDOWS
+    gchar * message = g_win32_error_message (GetLastError ());
+#else
+    const gchar * message = g_strerror (errno);
+#endif
+
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "unable to create shared memory: %s", message);
+
+#ifdef HAVE_WINDOWS
+    g_free (message);
+#endif
+
+    return FALSE;
+  }
+}
+
+static void
+gum_shared_event_sink_unmap (GumSharedEventSink * self)
+{
+  if (self->ring != NULL)
+    gum_cloak_remove_range (&self->range);
+
+#ifdef HAVE_WINDOWS
+  if (self->ring != NULL)
+    UnmapViewOfFile (self->ring);
+  if (self->mapping != NULL)
+    CloseHandle (self->mapping);
+#else
+  if (self->ring != NULL)
+    munmap (self->ring, self->size);
+  if (self->fd != -1)
+  {
+    gum_cloak_remove_file_descriptor (self->fd);
+    close (self->fd);
+  }
+  if (self->shm_name != NULL)
+  {
+    shm_unlink (self->shm_name);
+    g_free (self->shm_name);
+  }
+#endif
+
+  self->ring = NULL;
+}
+
+static GumEventType
+gum_shared_event_sink_query_mask (GumEventSink * sink)
+{
+  return GUM_SHARED_EVENT_SINK (sink)->mask;
+}
+
+static void
+gum_shared_event_sink_process (GumEventSink * sink,
+                               const GumEvent * ev)
+{
+  GumSharedEventSink * self = GUM_SHARED_EVENT_SINK (sink);
+  GumEventRing * ring = self->ring;
+  guint head;
+
+  gum_spinlock_acquire (&self->lock);
+
+  head = ring->head;
+  if (head - g_atomic_int_get (&ring->tail) == self->capacity)
+  {
+    g_atomic_int_inc (&ring->dropped_count);
+  }
+  else
+  {
+    self->records[head & (self->capacity - 1)] = *ev;
+    g_atomic_int_set (&ring->head, head + 1);
+  }
+
+  gum_spinlock_release (&self->lock);
+}
+
+/*
+ * Takes up to `max_events` events out of a ring mapped by the reader, in the
+ * order they were appended, and returns how many were taken. There must only
+ * be one reader per ring.
+ */
+guint
+gum_event_ring_drain (GumEventRing * ring,
+                      GumEvent * events,
+                      guint max_events)
+{
+  const GumEvent * records = GUM_EVENT_RING_RECORDS (ring);
+  guint tail, head, n, i;
+
+  if (g_atomic_int_get (&ring->magic) != GUM_EVENT_RING_MAGIC ||
+      ring->record_size != sizeof (GumEvent))
+  {
+    return 0;
+  }
+
+  tail = ring->tail;
+  head = g_atomic_int_get (&ring->head);
+  n = MIN (head - tail, max_events);
+
+  for (i = 0; i != n; i++)
+    events[i] = records[(tail + i) & (ring->capacity - 1)];
+
+  g_atomic_int_set (&ring->tail, tail + n);
+
+  return n;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_SHARED_EVENT_SINK_H__
+#define __GUM_SHARED_EVENT_SINK_H__
+
+#include <glib-object.h>
+#include <gum/gumeventsink.h>
+
+#define GUM_EVENT_RING_MAGIC 0x474e4952
+
+#define GUM_EVENT_RING_RECORDS(ring) ((GumEvent *) ((ring) + 1))
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_SHARED_EVENT_SINK (gum_shared_event_sink_get_type ())
+G_DECLARE_FINAL_TYPE (GumSharedEventSink, gum_shared_event_sink, GUM,
+    SHARED_EVENT_SINK, GObject)
+
+typedef struct _GumEventRing GumEventRing;
+
+/*
+ * The start of the shared memory, followed by `capacity` records of
+ * `record_size` bytes each. The agent only ever writes `head` and
+ * `dropped_count`, and the reader only ever writes `tail`, which is why they
+ * live on cache lines of their own. Both counters wrap, and the record at a
+ * counter's value is found at that value modulo the capacity.
+ */
+struct _GumEventRing
+{
+  guint32 magic;
+  guint32 record_size;
+  guint32 capacity;
+  guint32 reserved[13];
+
+  volatile guint32 head;
+  volatile guint32 dropped_count;
+  guint32 producer_reserved[14];
+
+  volatile guint32 tail;
+  guint32 consumer_reserved[15];
+};
+
+GUM_API GumSharedEventSink * gum_shared_event_sink_new (GumEventType mask,
+    guint capacity, GError ** error);
+
+GUM_API const gchar * gum_shared_event_sink_get_path (
+    GumSharedEventSink * self);
+GUM_API gsize gum_shared_event_sink_get_size (GumSharedEventSink * self);
+GUM_API GumEventRing * gum_shared_event_sink_get_ring (
+    GumSharedEventSink * self);
+
+GUM_API guint gum_event_ring_drain (GumEventRing * ring, GumEvent * events,
+    guint max_events);
+
+G_END_DECLS
+
+#endif
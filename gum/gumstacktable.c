@@ -0,0 +1,242 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumstacktable.h"
+
+#include <string.h>
+
+/*
+ * Each unique stack is stored once and given an ID that stays valid for the
+ * lifetime of the table. Stacks are spread across shards by hash so that
+ * threads interning different stacks rarely contend for the same lock, and
+ * the shard is encoded in the low bits of the ID so lookups go straight to
+ * the right one.
+ */
+
+#define GUM_STACK_TABLE_SHARD_BITS 4
+#define GUM_STACK_TABLE_N_SHARDS (1 << GUM_STACK_TABLE_SHARD_BITS)
+
+typedef struct _GumStackShard GumStackShard;
+typedef struct _GumStackEntry GumStackEntry;
+
+struct _GumStackTable
+{
+  GObject parent;
+
+  GumStackShard * shards;
+};
+
+struct _GumStackShard
+{
+  GMutex mutex;
+  GHashTable * ids;
+  GPtrArray * entries;
+};
+
+struct _GumStackEntry
+{
+  guint hash;
+  guint len;
+  GumReturnAddress items[GUM_MAX_BACKTRACE_DEPTH];
+};
+
+static void gum_stack_table_finalize (GObject * object);
+
+static void gum_stack_entry_init (GumStackEntry * entry,
+    const GumReturnAddressArray * stack);
+static guint gum_stack_entry_hash (const GumStackEntry * entry);
+static gboolean gum_stack_entry_equal (const GumStackEntry * a,
+    const GumStackEntry * b);
+
+G_DEFINE_TYPE (GumStackTable, gum_stack_table, G_TYPE_OBJECT)
+
+static void
+gum_stack_table_class_init (GumStackTableClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gum_stack_table_finalize;
+}
+
+static void
+gum_stack_table_init (GumStackTable * self)
+{
+  guint i;
+
+  self->shards = g_new (GumStackShard, GUM_STACK_TABLE_N_SHARDS);
+
+  for (i = 0; i != GUM_STACK_TABLE_N_SHARDS; i++)
+  {
+    GumStackShard * shard = &self->shards[i];
+
+    g_mutex_init (&shard->mutex);
+    shard->ids = g_hash_table_new ((GHashFunc) gum_stack_entry_hash,
+        (GEqualFunc) gum_stack_entry_equal);
+    shard->entries = g_ptr_array_new_with_free_func (g_free);
+  }
+}
+
+static void
+gum_stack_table_finalize (GObject * object)
+{
+  GumStackTable * self = GUM_STACK_TABLE (object);
+  guint i;
+
+  for (i = 0; i != GUM_STACK_TABLE_N_SHARDS; i++)
+  {
+    GumStackShard * shard = &self->shards[i];
+
+    g_hash_table_unref (shard->ids);
+    g_ptr_array_unref (shard->entries);
+    g_mutex_clear (&shard->mutex);
+  }
+
+  g_free (self->shards);
+
+  G_OBJECT_CLASS (gum_stack_table_parent_class)->finalize (object);
+}
+
+GumStackTable *
+gum_stack_table_new (void)
+{
+  return g_object_new (GUM_TYPE_STACK_TABLE, NULL);
+}
+
+/*
+ * Returns the ID of `stack`, adding it to the table if it has not been seen
+ * before. Empty stacks are always GUM_STACK_ID_NONE.
+ */
+GumStackId
+gum_stack_table_intern (GumStackTable * self,
+                        const GumReturnAddressArray * stack)
+{
+  GumStackEntry probe;
+  guint shard_index;
+  GumStackShard * shard;
+  gpointer id;
+
+  if (stack->len == 0)
+    return GUM_STACK_ID_NONE;
+
+  gum_stack_entry_init (&probe, stack);
+
+  shard_index = probe.hash & (GUM_STACK_TABLE_N_SHARDS - 1);
+  shard = &self->shards[shard_index];
+
+  g_mutex_lock (&shard->mutex);
+
+  id = g_hash_table_lookup (shard->ids, &probe);
+  if (id == NULL)
+  {
+    gsize size;
+    GumStackEntry * entry;
+
+    size = G_STRUCT_OFFSET (GumStackEntry, items) +
+        (probe.len * sizeof (GumReturnAddress));
+    entry = g_malloc (size);
+    memcpy (entry, &probe, size);
+
+    g_ptr_array_add (shard->entries, entry);
+
+    id = GUINT_TO_POINTER (
+        (((shard->entries->len - 1) << GUM_STACK_TABLE_SHARD_BITS) |
+        shard_index) + 1);
+    g_hash_table_insert (shard->ids, entry, id);
+  }
+
+  g_mutex_unlock (&shard->mutex);
+
+  return GPOINTER_TO_UINT (id);
+}
+
+gboolean
+gum_stack_table_lookup (GumStackTable * self,
+                        GumStackId id,
+                        GumReturnAddressArray * stack)
+{
+  guint shard_index, entry_index;
+  GumStackShard * shard;
+  gboolean found = FALSE;
+
+  if (id == GUM_STACK_ID_NONE)
+  {
+    stack->len = 0;
+    return TRUE;
+  }
+
+  shard_index = (id - 1) & (GUM_STACK_TABLE_N_SHARDS - 1);
+  entry_index = (id - 1) >> GUM_STACK_TABLE_SHARD_BITS;
+  shard = &self->shards[shard_index];
+
+  g_mutex_lock (&shard->mutex);
+
+  if (entry_index < shard->entries->len)
+  {
+    const GumStackEntry * entry =
+        g_ptr_array_index (shard->entries, entry_index);
+
+    stack->len = entry->len;
+    memcpy (stack->items, entry->items, entry->len * sizeof (GumReturnAddress));
+
+    found = TRUE;
+  }
+
+  g_mutex_unlock (&shard->mutex);
+
+  return found;
+}
+
+guint
+gum_stack_table_get_size (GumStackTable * self)
+{
+  guint size = 0;
+  guint i;
+
+  for (i = 0; i != GUM_STACK_TABLE_N_SHARDS; i++)
+  {
+    GumStackShard * shard = &self->shards[i];
+
+    g_mutex_lock (&shard->mutex);
+    size += shard->entries->len;
+    g_mutex_unlock (&shard->mutex);
+  }
+
+  return size;
+}
+
+static void
+gum_stack_entry_init (GumStackEntry * entry,
+                      const GumReturnAddressArray * stack)
+{
+  guint hash = 5381;
+  guint i;
+
+  entry->len = stack->len;
+
+  for (i = 0; i != stack->len; i++)
+  {
+    GumReturnAddress item = stack->items[i];
+
+    entry->items[i] = item;
+    hash = (hash * 33) ^ (guint) (GPOINTER_TO_SIZE (item) >> 2);
+  }
+
+  entry->hash = hash;
+}
+
+static guint
+gum_stack_entry_hash (const GumStackEntry * entry)
+{
+  return entry->hash >> GUM_STACK_TABLE_SHARD_BITS;
+}
+
+static gboolean
+gum_stack_entry_equal (const GumStackEntry * a,
+                       const GumStackEntry * b)
+{
+  return a->hash == b->hash && a->len == b->len &&
+      memcmp (a->items, b->items, a->len * sizeof (GumReturnAddress)) == 0;
+}
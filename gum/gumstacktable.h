@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_STACK_TABLE_H__
+#define __GUM_STACK_TABLE_H__
+
+#include <glib-object.h>
+#include <gum/gumreturnaddress.h>
+
+#define GUM_STACK_ID_NONE 0
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_STACK_TABLE (gum_stack_table_get_type ())
+G_DECLARE_FINAL_TYPE (GumStackTable, gum_stack_table, GUM, STACK_TABLE,
+    GObject)
+
+typedef guint32 GumStackId;
+
+GUM_API GumStackTable * gum_stack_table_new (void);
+
+GUM_API GumStackId gum_stack_table_intern (GumStackTable * self,
+    const GumReturnAddressArray * stack);
+GUM_API gboolean gum_stack_table_lookup (GumStackTable * self, GumStackId id,
+    GumReturnAddressArray * stack);
+GUM_API guint gum_stack_table_get_size (GumStackTable * self);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,25 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_STALKER_PRIV_H__
+#define __GUM_STALKER_PRIV_H__
+
+#include "gumstalker.h"
+
+G_BEGIN_DECLS
+
+G_GNUC_INTERNAL guint64 _gum_stalker_get_nanoseconds (void);
+
+G_GNUC_INTERNAL void _gum_stalker_stats_add (GumStalkerStats * self,
+    const GumStalkerStats * other);
+
+G_GNUC_INTERNAL void _gum_stalker_prepare_to_fork (void);
+G_GNUC_INTERNAL void _gum_stalker_recover_from_fork_in_parent (void);
+G_GNUC_INTERNAL void _gum_stalker_recover_from_fork_in_child (void);
+
+G_END_DECLS
+
+#endif
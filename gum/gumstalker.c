@@ -4,7 +4,23 @@
  * Licence: wxWindows Library Licence, Version 3.1
  */
 
-#include "gumstalker.h"
+#include "gumstalker-priv.h"
+
+#include "gumprocess.h"
+
+#include <string.h>
+#if defined (HAVE_WINDOWS)
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h>
+#elif defined (HAVE_DARWIN)
+# include <mach/mach_time.h>
+#else
+# include <time.h>
+#endif
+
+typedef struct _GumAddScopeExportsContext GumAddScopeExportsContext;
 
 struct _GumDefaultStalkerTransformer
 {
@@ -20,6 +36,12 @@ struct _GumCallbackStalkerTransformer
   GDestroyNotify data_destroy;
 };
 
+struct _GumAddScopeExportsContext
+{
+  GumStalker * stalker;
+  gboolean success;
+};
+
 static void gum_default_stalker_transformer_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_default_stalker_transformer_transform_block (
@@ -33,6 +55,13 @@ static void gum_callback_stalker_transformer_transform_block (
     GumStalkerTransformer * transformer, GumStalkerIterator * iterator,
     GumStalkerWriter * output);
 
+static gboolean gum_stalker_add_scope_range (const GumRangeDetails * details,
+    gpointer user_data);
+static gboolean gum_stalker_add_scope_export (const GumExportDetails * details,
+    gpointer user_data);
+static gboolean gum_stalker_collect_other_thread (
+    const GumThreadDetails * details, gpointer user_data);
+
 G_DEFINE_INTERFACE (GumStalkerTransformer, gum_stalker_transformer,
     G_TYPE_OBJECT)
 
@@ -171,3 +200,256 @@ gum_callback_stalker_transformer_transform_block (
 
   self->callback (iterator, output, self->data);
 }
+
+/*
+ * Puts the code of `module_name` in scope and hooks each of its exported
+ * functions as an entry point, so that a followed thread is only stalked
+ * while it is running code of that module. Returns FALSE if any of them could
+ * not be hooked.
+ */
+gboolean
+gum_stalker_add_scope_module (GumStalker * self,
+                              const gchar * module_name)
+{
+  GumAddScopeExportsContext ctx;
+
+  ctx.stalker = self;
+  ctx.success = TRUE;
+
+  gum_module_enumerate_ranges (module_name, GUM_PAGE_EXECUTE,
+      gum_stalker_add_scope_range, self);
+  gum_module_enumerate_exports (module_name, gum_stalker_add_scope_export,
+      &ctx);
+
+  return ctx.success;
+}
+
+/*
+ * Calls `func` over and over on the calling thread while following it, until
+ * it returns FALSE, and returns how many times it was called. The thread is
+ * only followed once, so its exec context, thunks and code cache stay warm
+ * across iterations instead of being set up and torn down for each one, and
+ * each iteration starts from a fresh call frame, so there is no register
+ * state to restore. The coverage bitmap is reset before every iteration;
+ * any other state that must not leak between iterations is up to `func`.
+ */
+guint
+gum_stalker_run_loop (GumStalker * self,
+                      GumStalkerTransformer * transformer,
+                      GumEventSink * sink,
+                      GumStalkerLoopFunc func,
+                      gpointer user_data)
+{
+  guint n = 0;
+  gboolean carry_on;
+
+  gum_stalker_follow_me (self, transformer, sink);
+
+  do
+  {
+    gum_stalker_reset_coverage (self);
+
+    carry_on = func (n++, user_data);
+  }
+  while (carry_on);
+
+  gum_stalker_unfollow_me (self);
+
+  return n;
+}
+
+/*
+ * Follows every thread in the process apart from the calling one, which may
+ * use gum_stalker_follow_me(), and the ones cloaked by Gum. The threads are
+ * infected in one batch through gum_process_modify_threads(), which on Linux
+ * and Darwin stops them all just once instead of once per thread. Threads
+ * created afterwards are not followed. Returns how many threads were
+ * followed.
+ */
+guint
+gum_stalker_follow_all (GumStalker * self,
+                        GumStalkerTransformer * transformer,
+                        GumEventSink * sink)
+{
+  GArray * thread_ids;
+  guint num_followed;
+
+  thread_ids = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+  gum_process_enumerate_threads_with_flags (
+      GUM_THREAD_FLAGS_SKIP_STATE | GUM_THREAD_FLAGS_SKIP_CPU_CONTEXT,
+      gum_stalker_collect_other_thread, thread_ids);
+
+  num_followed = gum_stalker_follow_threads (self,
+      (const GumThreadId *) thread_ids->data, thread_ids->len, transformer,
+      sink);
+
+  g_array_free (thread_ids, TRUE);
+
+  return num_followed;
+}
+
+static gboolean
+gum_stalker_collect_other_thread (const GumThreadDetails * details,
+                                  gpointer user_data)
+{
+  GArray * thread_ids = user_data;
+
+  if (details->id != gum_process_get_current_thread_id ())
+    g_array_append_val (thread_ids, details->id);
+
+  return TRUE;
+}
+
+static gboolean
+gum_stalker_add_scope_range (const GumRangeDetails * details,
+                             gpointer user_data)
+{
+  GumStalker * self = user_data;
+
+  gum_stalker_add_scope (self, details->range);
+
+  return TRUE;
+}
+
+static gboolean
+gum_stalker_add_scope_export (const GumExportDetails * details,
+                              gpointer user_data)
+{
+  GumAddScopeExportsContext * ctx = user_data;
+
+  if (details->type == GUM_EXPORT_FUNCTION &&
+      !gum_stalker_add_scope_entry (ctx->stalker,
+          GSIZE_TO_POINTER (details->address)))
+  {
+    ctx->success = FALSE;
+  }
+
+  return TRUE;
+}
+
+GumHitCounters *
+gum_hit_counters_new (guint length)
+{
+  GumHitCounters * counters;
+
+  counters = g_slice_new (GumHitCounters);
+  counters->values = g_new0 (guint64, length);
+  counters->length = length;
+
+  return counters;
+}
+
+void
+gum_hit_counters_free (GumHitCounters * counters)
+{
+  if (counters == NULL)
+    return;
+
+  g_free (counters->values);
+
+  g_slice_free (GumHitCounters, counters);
+}
+
+/*
+ * Copies the current values. Increments may land while the copy is being
+ * made, so the snapshot is only consistent per slot, not across slots.
+ */
+GumHitCounters *
+gum_hit_counters_snapshot (GumHitCounters * self)
+{
+  GumHitCounters * snapshot;
+
+  snapshot = g_slice_new (GumHitCounters);
+  snapshot->values = g_memdup (self->values, self->length * sizeof (guint64));
+  snapshot->length = self->length;
+
+  return snapshot;
+}
+
+void
+gum_hit_counters_reset (GumHitCounters * self)
+{
+  memset (self->values, 0, self->length * sizeof (guint64));
+}
+
+/*
+ * Returns how much each slot grew since `previous` was snapshotted. Slots that
+ * were reset in the meantime are reported with their current value.
+ */
+GumHitCounters *
+gum_hit_counters_diff (GumHitCounters * self,
+                       GumHitCounters * previous)
+{
+  GumHitCounters * delta;
+  guint i;
+
+  g_assert_cmpuint (previous->length, ==, self->length);
+
+  delta = gum_hit_counters_new (self->length);
+
+  for (i = 0; i != self->length; i++)
+  {
+    guint64 current = self->values[i];
+    guint64 earlier = previous->values[i];
+
+    delta->values[i] = (current >= earlier) ? current - earlier : current;
+  }
+
+  return delta;
+}
+
+/*
+ * g_get_monotonic_time() only has microsecond resolution, which is coarser
+ * than a single transition, so the phase timers need a finer clock.
+ */
+guint64
+_gum_stalker_get_nanoseconds (void)
+{
+#if defined (HAVE_WINDOWS)
+  static LARGE_INTEGER frequency = { 0, };
+  LARGE_INTEGER counter;
+
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency (&frequency);
+  QueryPerformanceCounter (&counter);
+
+  return (guint64) ((counter.QuadPart * 1e9) / frequency.QuadPart);
+#elif defined (HAVE_DARWIN)
+  static mach_timebase_info_data_t timebase = { 0, 0 };
+
+  if (timebase.denom == 0)
+    mach_timebase_info (&timebase);
+
+  return (mach_absolute_time () * timebase.numer) / timebase.denom;
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000)) + ts.tv_nsec;
+#endif
+}
+
+void
+_gum_stalker_stats_add (GumStalkerStats * self,
+                        const GumStalkerStats * other)
+{
+  self->blocks_compiled += other->blocks_compiled;
+  self->bytes_emitted += other->bytes_emitted;
+  self->compile_time += other->compile_time;
+  self->trust_failures += other->trust_failures;
+  self->code_cache_flushes += other->code_cache_flushes;
+
+  self->ic_hits += other->ic_hits;
+  self->ic_misses += other->ic_misses;
+
+  self->call_imm_entrygates += other->call_imm_entrygates;
+  self->call_indirect_entrygates += other->call_indirect_entrygates;
+  self->post_call_invoke_entrygates += other->post_call_invoke_entrygates;
+  self->ret_entrygates += other->ret_entrygates;
+  self->jmp_imm_entrygates += other->jmp_imm_entrygates;
+  self->jmp_indirect_entrygates += other->jmp_indirect_entrygates;
+  self->jmp_cond_entrygates += other->jmp_cond_entrygates;
+  self->jmp_continuation_entrygates += other->jmp_continuation_entrygates;
+  self->sysenter_entrygates += other->sysenter_entrygates;
+}
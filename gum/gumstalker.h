@@ -46,6 +46,11 @@ typedef void (* GumStalkerTransformerCallback) (GumStalkerIterator * iterator,
     GumStalkerWriter * output, gpointer user_data);
 typedef void (* GumStalkerCallout) (GumCpuContext * cpu_context,
     gpointer user_data);
+typedef gboolean (* GumStalkerLoopFunc) (guint iteration, gpointer user_data);
+
+typedef struct _GumHitCounters GumHitCounters;
+typedef struct _GumStalkerCounters GumStalkerCounters;
+typedef struct _GumStalkerStats GumStalkerStats;
 
 typedef guint GumProbeId;
 typedef struct _GumCallSite GumCallSite;
@@ -68,6 +73,56 @@ union _GumStalkerWriter
   GumMipsWriter mips;
 };
 
+struct _GumHitCounters
+{
+  guint64 * values;
+  guint length;
+};
+
+/*
+ * Times are in nanoseconds and only accumulate while counters are enabled.
+ * They are exclusive: entrygate_time leaves out the compilation a transition
+ * triggered, and compile_time leaves out the transform callback. Events may
+ * be delivered from within any of them though, so sink_time can overlap.
+ */
+struct _GumStalkerCounters
+{
+  guint64 transitions;
+  guint64 compilations;
+
+  guint64 entrygate_time;
+  guint64 compile_time;
+  guint64 transform_time;
+  guint64 sink_time;
+};
+
+/*
+ * Always collected, per thread, and summed up on request. Entrygates are
+ * counted by the kind of branch that brought execution back into Stalker.
+ * compile_time is in nanoseconds.
+ */
+struct _GumStalkerStats
+{
+  guint64 blocks_compiled;
+  guint64 bytes_emitted;
+  guint64 compile_time;
+  guint64 trust_failures;
+  guint64 code_cache_flushes;
+
+  guint64 ic_hits;
+  guint64 ic_misses;
+
+  guint64 call_imm_entrygates;
+  guint64 call_indirect_entrygates;
+  guint64 post_call_invoke_entrygates;
+  guint64 ret_entrygates;
+  guint64 jmp_imm_entrygates;
+  guint64 jmp_indirect_entrygates;
+  guint64 jmp_cond_entrygates;
+  guint64 jmp_continuation_entrygates;
+  guint64 sysenter_entrygates;
+};
+
 struct _GumCallSite
 {
   gpointer block_address;
@@ -81,23 +136,61 @@ GUM_API GumStalker * gum_stalker_new (void);
 
 GUM_API void gum_stalker_exclude (GumStalker * self,
     const GumMemoryRange * range);
+GUM_API void gum_stalker_add_scope (GumStalker * self,
+    const GumMemoryRange * range);
+GUM_API gboolean gum_stalker_add_scope_entry (GumStalker * self,
+    gpointer function_address);
+GUM_API gboolean gum_stalker_add_scope_module (GumStalker * self,
+    const gchar * module_name);
 
 GUM_API gint gum_stalker_get_trust_threshold (GumStalker * self);
 GUM_API void gum_stalker_set_trust_threshold (GumStalker * self,
     gint trust_threshold);
 
+GUM_API guint gum_stalker_get_ic_entries (GumStalker * self);
+GUM_API void gum_stalker_set_ic_entries (GumStalker * self, guint ic_entries);
+GUM_API gboolean gum_stalker_get_ic_fallback_enabled (GumStalker * self);
+GUM_API void gum_stalker_set_ic_fallback_enabled (GumStalker * self,
+    gboolean enabled);
+GUM_API gboolean gum_stalker_get_huge_pages_enabled (GumStalker * self);
+GUM_API void gum_stalker_set_huge_pages_enabled (GumStalker * self,
+    gboolean enabled);
+GUM_API gboolean gum_stalker_get_timestamps_enabled (GumStalker * self);
+GUM_API void gum_stalker_set_timestamps_enabled (GumStalker * self,
+    gboolean enabled);
+GUM_API gsize gum_stalker_get_code_budget (GumStalker * self);
+GUM_API gboolean gum_stalker_set_code_budget (GumStalker * self,
+    gsize budget);
+GUM_API guint gum_stalker_get_block_sample_interval (GumStalker * self);
+GUM_API void gum_stalker_set_block_sample_interval (GumStalker * self,
+    guint interval);
+GUM_API void gum_stalker_set_coverage_bitmap (GumStalker * self,
+    guint8 * bitmap, gsize size);
+GUM_API void gum_stalker_reset_coverage (GumStalker * self);
+
 GUM_API void gum_stalker_flush (GumStalker * self);
 GUM_API void gum_stalker_stop (GumStalker * self);
 GUM_API gboolean gum_stalker_garbage_collect (GumStalker * self);
+GUM_API void gum_stalker_get_stats (GumStalker * self, GumStalkerStats * stats);
 
 GUM_API void gum_stalker_follow_me (GumStalker * self,
     GumStalkerTransformer * transformer, GumEventSink * sink);
 GUM_API void gum_stalker_unfollow_me (GumStalker * self);
+GUM_API guint gum_stalker_run_loop (GumStalker * self,
+    GumStalkerTransformer * transformer, GumEventSink * sink,
+    GumStalkerLoopFunc func, gpointer user_data);
 GUM_API gboolean gum_stalker_is_following_me (GumStalker * self);
+GUM_API void gum_stalker_prefetch (GumStalker * self, gconstpointer address,
+    gint recycle_count);
 
 GUM_API void gum_stalker_follow (GumStalker * self, GumThreadId thread_id,
     GumStalkerTransformer * transformer, GumEventSink * sink);
 GUM_API void gum_stalker_unfollow (GumStalker * self, GumThreadId thread_id);
+GUM_API guint gum_stalker_follow_threads (GumStalker * self,
+    const GumThreadId * thread_ids, guint num_threads,
+    GumStalkerTransformer * transformer, GumEventSink * sink);
+GUM_API guint gum_stalker_follow_all (GumStalker * self,
+    GumStalkerTransformer * transformer, GumEventSink * sink);
 
 GUM_API GumProbeId gum_stalker_add_call_probe (GumStalker * self,
     gpointer target_address, GumCallProbeCallback callback, gpointer data,
@@ -124,9 +217,20 @@ GUM_API gboolean gum_stalker_iterator_next (GumStalkerIterator * self,
 GUM_API void gum_stalker_iterator_keep (GumStalkerIterator * self);
 GUM_API void gum_stalker_iterator_put_callout (GumStalkerIterator * self,
     GumStalkerCallout callout, gpointer data, GDestroyNotify data_destroy);
+GUM_API void gum_stalker_iterator_put_counter_increment (
+    GumStalkerIterator * self, GumHitCounters * counters, guint index);
+
+GUM_API GumHitCounters * gum_hit_counters_new (guint length);
+GUM_API void gum_hit_counters_free (GumHitCounters * counters);
+GUM_API GumHitCounters * gum_hit_counters_snapshot (GumHitCounters * self);
+GUM_API void gum_hit_counters_reset (GumHitCounters * self);
+GUM_API GumHitCounters * gum_hit_counters_diff (GumHitCounters * self,
+    GumHitCounters * previous);
 
 GUM_API void gum_stalker_set_counters_enabled (gboolean enabled);
 GUM_API void gum_stalker_dump_counters (void);
+GUM_API void gum_stalker_get_counters (GumStalkerCounters * counters);
+GUM_API void gum_stalker_reset_counters (void);
 
 G_END_DECLS
 
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumtimestamp.h"
+
+#if defined (_MSC_VER) && defined (HAVE_I386)
+# include <intrin.h>
+#endif
+
+/*
+ * Timestamps are raw reads of the CPU's cycle counter: the TSC on x86 and the
+ * virtual counter on arm64, which are cheap enough to take for every event.
+ * They only mean something relative to each other, and are turned into
+ * nanoseconds with gum_timestamp_to_nanoseconds(). On x86 this relies on the
+ * TSC ticking at a constant rate shared by all cores, which is the case for
+ * any CPU with an invariant TSC. Elsewhere they fall back to the monotonic
+ * clock, counted in microseconds.
+ */
+
+#if (defined (HAVE_I386) && (defined (_MSC_VER) || defined (__GNUC__))) || \
+    (defined (HAVE_ARM64) && defined (__GNUC__))
+# define GUM_HAVE_CYCLE_COUNTER 1
+#endif
+
+#define GUM_CALIBRATION_PERIOD 10000
+
+static gpointer gum_timestamp_calibrate (gpointer data);
+
+guint64
+gum_timestamp_now (void)
+{
+#if defined (HAVE_I386) && defined (_MSC_VER)
+  return __rdtsc ();
+#elif defined (HAVE_I386) && defined (__GNUC__)
+  guint32 lo, hi;
+
+  asm volatile ("rdtsc" : "=a" (lo), "=d" (hi));
+
+  return ((guint64) hi << 32) | lo;
+#elif defined (HAVE_ARM64) && defined (__GNUC__)
+  guint64 ticks;
+
+  asm volatile ("mrs %0, cntvct_el0" : "=r" (ticks));
+
+  return ticks;
+#else
+  return g_get_monotonic_time ();
+#endif
+}
+
+/* Ticks per second, measured once on x86 where the CPU does not tell us. */
+guint64
+gum_timestamp_get_frequency (void)
+{
+  static GOnce calibration = G_ONCE_INIT;
+
+  g_once (&calibration, gum_timestamp_calibrate, NULL);
+
+  return *((guint64 *) calibration.retval);
+}
+
+guint64
+gum_timestamp_to_nanoseconds (guint64 ticks)
+{
+  guint64 frequency;
+
+  frequency = gum_timestamp_get_frequency ();
+
+  return ((ticks / frequency) * G_GUINT64_CONSTANT (1000000000)) +
+      (((ticks % frequency) * G_GUINT64_CONSTANT (1000000000)) / frequency);
+}
+
+static gpointer
+gum_timestamp_calibrate (gpointer data)
+{
+  static guint64 frequency;
+#if defined (HAVE_I386) && defined (GUM_HAVE_CYCLE_COUNTER)
+  gint64 start_time, end_time;
+  guint64 start_ticks, end_ticks;
+
+  start_time = g_get_monotonic_time ();
+  start_ticks = gum_timestamp_now ();
+  g_usleep (GUM_CALIBRATION_PERIOD);
+  end_time = g_get_monotonic_time ();
+  end_ticks = gum_timestamp_now ();
+
+  frequency = ((end_ticks - start_ticks) * G_USEC_PER_SEC) /
+      MAX (end_time - start_time, 1);
+#elif defined (HAVE_ARM64) && defined (GUM_HAVE_CYCLE_COUNTER)
+  asm volatile ("mrs %0, cntfrq_el0" : "=r" (frequency));
+#else
+  frequency = G_USEC_PER_SEC;
+#endif
+
+  return &frequency;
+}
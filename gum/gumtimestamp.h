@@ -0,0 +1,20 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_TIMESTAMP_H__
+#define __GUM_TIMESTAMP_H__
+
+#include <gum/gumdefs.h>
+
+G_BEGIN_DECLS
+
+GUM_API guint64 gum_timestamp_now (void);
+GUM_API guint64 gum_timestamp_get_frequency (void);
+GUM_API guint64 gum_timestamp_to_nanoseconds (guint64 ticks);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,645 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumwatchpointmonitor.h"
+
+#include "gumexceptor.h"
+#include "gumprocess-priv.h"
+
+#include <gio/gio.h>
+#ifdef G_OS_WIN32
+# define VC_EXTRALEAN
+# include <windows.h>
+#endif
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+# define GUM_NUM_WATCHPOINTS GUM_MAX_DEBUG_WATCHPOINTS
+#else
+# define GUM_NUM_WATCHPOINTS 1
+#endif
+
+#if defined (HAVE_I386)
+# define GUM_DR7_ENABLE(i) (1 << ((i) * 2))
+# define GUM_DR7_MASK(i) \
+    ((3 << ((i) * 2)) | (G_GUINT64_CONSTANT (0xf) << (16 + ((i) * 4))))
+# define GUM_DR7_RW_WRITE 1
+# define GUM_DR7_RW_READ_WRITE 3
+# define GUM_DR6_HITS_MASK 0xf
+#elif defined (HAVE_ARM64)
+# define GUM_WCR_ENABLE (1 << 0)
+# define GUM_WCR_EL0 (2 << 1)
+# define GUM_WCR_LOAD (1 << 3)
+# define GUM_WCR_STORE (2 << 3)
+# define GUM_WCR_BAS_SHIFT 5
+#endif
+
+typedef struct _GumWatchpoint GumWatchpoint;
+typedef struct _GumApplyWatchpointsContext GumApplyWatchpointsContext;
+
+struct _GumWatchpointMonitor
+{
+  GObject parent;
+
+  GMutex mutex;
+
+  GumExceptor * exceptor;
+
+  GumWatchpoint * staged;
+  GumWatchpoint * applied;
+  volatile gint num_applied;
+  GArray * threads;
+
+  GumWatchpointNotify notify_func;
+  gpointer notify_data;
+  GDestroyNotify notify_data_destroy;
+};
+
+struct _GumWatchpoint
+{
+  GumAddress address;
+  gsize size;
+  GumWatchConditions conditions;
+};
+
+struct _GumApplyWatchpointsContext
+{
+  GumWatchpointMonitor * monitor;
+  gboolean out_of_slots;
+};
+
+static void gum_watchpoint_monitor_dispose (GObject * object);
+static void gum_watchpoint_monitor_finalize (GObject * object);
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+static gboolean gum_watchpoint_monitor_apply_to_thread (
+    GumWatchpointMonitor * self, GumThreadId thread_id, GError ** error);
+static void gum_watchpoint_monitor_track_thread (GumWatchpointMonitor * self,
+    GumThreadId thread_id);
+static gboolean gum_collect_thread_id (const GumThreadDetails * details,
+    gpointer user_data);
+static void gum_apply_watchpoints (GumThreadId thread_id,
+    GumDebugRegisters * regs, gpointer user_data);
+
+static gboolean gum_watchpoint_monitor_on_exception (
+    GumExceptionDetails * details, gpointer user_data);
+static gint gum_watchpoint_monitor_find_hit (GumWatchpointMonitor * self,
+    GumExceptionDetails * details);
+# if defined (HAVE_I386) && !defined (G_OS_WIN32)
+static void gum_read_and_clear_dr6 (GumThreadId thread_id,
+    GumDebugRegisters * regs, gpointer user_data);
+# endif
+# ifdef HAVE_ARM64
+static void gum_disarm_watchpoint (GumThreadId thread_id,
+    GumDebugRegisters * regs, gpointer user_data);
+# endif
+#endif
+
+G_DEFINE_TYPE (GumWatchpointMonitor, gum_watchpoint_monitor, G_TYPE_OBJECT)
+
+static void
+gum_watchpoint_monitor_class_init (GumWatchpointMonitorClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_watchpoint_monitor_dispose;
+  object_class->finalize = gum_watchpoint_monitor_finalize;
+}
+
+static void
+gum_watchpoint_monitor_init (GumWatchpointMonitor * self)
+{
+  g_mutex_init (&self->mutex);
+
+  self->staged = g_new0 (GumWatchpoint, GUM_NUM_WATCHPOINTS);
+  self->applied = g_new0 (GumWatchpoint, GUM_NUM_WATCHPOINTS);
+  self->threads = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+}
+
+static void
+gum_watchpoint_monitor_dispose (GObject * object)
+{
+  GumWatchpointMonitor * self = GUM_WATCHPOINT_MONITOR (object);
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  if (self->threads->len != 0)
+  {
+    guint i;
+
+    for (i = 0; i != GUM_NUM_WATCHPOINTS; i++)
+      gum_watchpoint_monitor_unset (self, i);
+    gum_watchpoint_monitor_apply (self,
+        (const GumThreadId *) self->threads->data, self->threads->len, NULL);
+    g_array_set_size (self->threads, 0);
+  }
+#endif
+
+  if (self->exceptor != NULL)
+  {
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+    gum_exceptor_remove (self->exceptor, gum_watchpoint_monitor_on_exception,
+        self);
+#endif
+    g_object_unref (self->exceptor);
+    self->exceptor = NULL;
+  }
+
+  if (self->notify_data_destroy != NULL)
+  {
+    self->notify_data_destroy (self->notify_data);
+    self->notify_data_destroy = NULL;
+  }
+  self->notify_data = NULL;
+  self->notify_func = NULL;
+
+  G_OBJECT_CLASS (gum_watchpoint_monitor_parent_class)->dispose (object);
+}
+
+static void
+gum_watchpoint_monitor_finalize (GObject * object)
+{
+  GumWatchpointMonitor * self = GUM_WATCHPOINT_MONITOR (object);
+
+  g_array_free (self->threads, TRUE);
+  g_free (self->applied);
+  g_free (self->staged);
+
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (gum_watchpoint_monitor_parent_class)->finalize (object);
+}
+
+GumWatchpointMonitor *
+gum_watchpoint_monitor_new (GumWatchpointNotify func,
+                            gpointer data,
+                            GDestroyNotify data_destroy)
+{
+  GumWatchpointMonitor * monitor;
+
+  monitor = g_object_new (GUM_TYPE_WATCHPOINT_MONITOR, NULL);
+
+  monitor->notify_func = func;
+  monitor->notify_data = data;
+  monitor->notify_data_destroy = data_destroy;
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  monitor->exceptor = gum_exceptor_obtain ();
+  gum_exceptor_add_full (monitor->exceptor,
+      gum_watchpoint_monitor_on_exception, monitor, FALSE);
+#endif
+
+  return monitor;
+}
+
+/*
+ * Staged changes take effect on the next call to
+ * gum_watchpoint_monitor_apply(), so that several watchpoints can be
+ * updated with a single pass over the threads.
+ */
+gboolean
+gum_watchpoint_monitor_set (GumWatchpointMonitor * self,
+                            guint watchpoint_id,
+                            GumAddress address,
+                            gsize size,
+                            GumWatchConditions conditions,
+                            GError ** error)
+{
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  GumWatchpoint * wp;
+
+  if (watchpoint_id >= GUM_NUM_WATCHPOINTS)
+    goto invalid_id;
+
+  switch (size)
+  {
+    case 1:
+    case 2:
+    case 4:
+#if GLIB_SIZEOF_VOID_P == 8
+    case 8:
+#endif
+      break;
+    default:
+      goto invalid_size;
+  }
+
+  if ((address & (size - 1)) != 0)
+    goto invalid_alignment;
+
+  if ((conditions & (GUM_WATCH_READ | GUM_WATCH_WRITE)) == 0 ||
+      (conditions & ~(GUM_WATCH_READ | GUM_WATCH_WRITE)) != 0)
+    goto invalid_conditions;
+
+  g_mutex_lock (&self->mutex);
+
+  wp = &self->staged[watchpoint_id];
+  wp->address = address;
+  wp->size = size;
+  wp->conditions = conditions;
+
+  g_mutex_unlock (&self->mutex);
+
+  return TRUE;
+
+invalid_id:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "watchpoint ID must be below %u", GUM_NUM_WATCHPOINTS);
+    return FALSE;
+  }
+invalid_size:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "unsupported watchpoint size");
+    return FALSE;
+  }
+invalid_alignment:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "watchpoint address must be aligned to its size");
+    return FALSE;
+  }
+invalid_conditions:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+        "watchpoint conditions must be read, write, or both");
+    return FALSE;
+  }
+#else
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+      "hardware watchpoints are not supported on this platform");
+  return FALSE;
+#endif
+}
+
+void
+gum_watchpoint_monitor_unset (GumWatchpointMonitor * self,
+                              guint watchpoint_id)
+{
+  g_return_if_fail (watchpoint_id < GUM_NUM_WATCHPOINTS);
+
+  g_mutex_lock (&self->mutex);
+  self->staged[watchpoint_id].conditions = 0;
+  g_mutex_unlock (&self->mutex);
+}
+
+/*
+ * Programs the staged watchpoints into the given threads, or into all
+ * threads if thread_ids is NULL. Threads created later are not covered
+ * until the next call.
+ */
+gboolean
+gum_watchpoint_monitor_apply (GumWatchpointMonitor * self,
+                              const GumThreadId * thread_ids,
+                              guint num_threads,
+                              GError ** error)
+{
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+  gboolean success = TRUE;
+  GArray * all_threads = NULL;
+  guint num_applied, i;
+
+  g_mutex_lock (&self->mutex);
+
+  /*
+   * Publish the new layout before touching any thread, so that hits
+   * raised while we're still busy updating are attributed correctly.
+   */
+  num_applied = 0;
+  for (i = 0; i != GUM_NUM_WATCHPOINTS; i++)
+  {
+    self->applied[i] = self->staged[i];
+    if (self->applied[i].conditions != 0)
+      num_applied++;
+  }
+  g_atomic_int_set (&self->num_applied, num_applied);
+
+  if (thread_ids == NULL)
+  {
+    all_threads = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+    gum_process_enumerate_threads_with_flags (GUM_THREAD_FLAGS_SKIP_STATE |
+        GUM_THREAD_FLAGS_SKIP_CPU_CONTEXT, gum_collect_thread_id,
+        all_threads);
+
+    for (i = 0; i != all_threads->len && success; i++)
+    {
+      GumThreadId thread_id = g_array_index (all_threads, GumThreadId, i);
+      GError * thread_error = NULL;
+
+      /* threads may exit while we're iterating, so failures are expected */
+      if (gum_watchpoint_monitor_apply_to_thread (self, thread_id,
+          &thread_error))
+      {
+        gum_watchpoint_monitor_track_thread (self, thread_id);
+      }
+      else if (g_error_matches (thread_error, G_IO_ERROR,
+          G_IO_ERROR_NOT_SUPPORTED))
+      {
+        g_propagate_error (error, thread_error);
+        success = FALSE;
+      }
+      else
+      {
+        g_error_free (thread_error);
+      }
+    }
+
+    g_array_free (all_threads, TRUE);
+  }
+  else
+  {
+    for (i = 0; i != num_threads && success; i++)
+    {
+      success = gum_watchpoint_monitor_apply_to_thread (self, thread_ids[i],
+          error);
+      if (success)
+        gum_watchpoint_monitor_track_thread (self, thread_ids[i]);
+    }
+  }
+
+  g_mutex_unlock (&self->mutex);
+
+  return success;
+#else
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+      "hardware watchpoints are not supported on this platform");
+  return FALSE;
+#endif
+}
+
+#ifdef GUM_HAVE_DEBUG_REGISTERS
+
+static gboolean
+gum_watchpoint_monitor_apply_to_thread (GumWatchpointMonitor * self,
+                                        GumThreadId thread_id,
+                                        GError ** error)
+{
+  GumApplyWatchpointsContext ctx;
+
+  ctx.monitor = self;
+  ctx.out_of_slots = FALSE;
+
+  if (!_gum_process_modify_debug_registers (thread_id, gum_apply_watchpoints,
+      &ctx))
+    goto modify_failed;
+
+  if (ctx.out_of_slots)
+    goto out_of_slots;
+
+  return TRUE;
+
+modify_failed:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+        "unable to modify debug registers of thread %" G_GSIZE_MODIFIER "u",
+        thread_id);
+    return FALSE;
+  }
+out_of_slots:
+  {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+        "the CPU does not implement enough watchpoint registers");
+    return FALSE;
+  }
+}
+
+static void
+gum_watchpoint_monitor_track_thread (GumWatchpointMonitor * self,
+                                     GumThreadId thread_id)
+{
+  guint i;
+
+  for (i = 0; i != self->threads->len; i++)
+  {
+    if (g_array_index (self->threads, GumThreadId, i) == thread_id)
+      return;
+  }
+
+  g_array_append_val (self->threads, thread_id);
+}
+
+static gboolean
+gum_collect_thread_id (const GumThreadDetails * details,
+                       gpointer user_data)
+{
+  GArray * thread_ids = user_data;
+
+  g_array_append_val (thread_ids, details->id);
+
+  return TRUE;
+}
+
+static void
+gum_apply_watchpoints (GumThreadId thread_id,
+                       GumDebugRegisters * regs,
+                       gpointer user_data)
+{
+  GumApplyWatchpointsContext * ctx = user_data;
+  const GumWatchpoint * watchpoints = ctx->monitor->applied;
+  guint i;
+
+  for (i = 0; i != GUM_NUM_WATCHPOINTS; i++)
+  {
+    const GumWatchpoint * wp = &watchpoints[i];
+#if defined (HAVE_I386)
+    gsize rw, len;
+
+    regs->dr7 &= ~GUM_DR7_MASK (i);
+
+    if (wp->conditions == 0)
+    {
+      regs->dr[i] = 0;
+      continue;
+    }
+
+    /* x86 can't watch for reads alone, so those trap on writes too */
+    rw = ((wp->conditions & GUM_WATCH_READ) != 0)
+        ? GUM_DR7_RW_READ_WRITE
+        : GUM_DR7_RW_WRITE;
+
+    switch (wp->size)
+    {
+      case 1: len = 0; break;
+      case 2: len = 1; break;
+      case 8: len = 2; break;
+      default: len = 3; break;
+    }
+
+    regs->dr[i] = wp->address;
+    regs->dr7 |= GUM_DR7_ENABLE (i) | (((len << 2) | rw) << (16 + (i * 4)));
+#elif defined (HAVE_ARM64)
+    guint32 wcr;
+
+    if (i >= regs->num_watchpoints)
+    {
+      if (wp->conditions != 0)
+        ctx->out_of_slots = TRUE;
+      continue;
+    }
+
+    if (wp->conditions == 0)
+    {
+      regs->wvr[i] = 0;
+      regs->wcr[i] = 0;
+      continue;
+    }
+
+    wcr = GUM_WCR_ENABLE | GUM_WCR_EL0;
+    if ((wp->conditions & GUM_WATCH_READ) != 0)
+      wcr |= GUM_WCR_LOAD;
+    if ((wp->conditions & GUM_WATCH_WRITE) != 0)
+      wcr |= GUM_WCR_STORE;
+    wcr |= ((1 << wp->size) - 1) << GUM_WCR_BAS_SHIFT;
+
+    regs->wvr[i] = wp->address;
+    regs->wcr[i] = wcr;
+#endif
+  }
+
+#ifdef HAVE_I386
+  regs->dr6 = 0;
+#endif
+}
+
+static gboolean
+gum_watchpoint_monitor_on_exception (GumExceptionDetails * details,
+                                     gpointer user_data)
+{
+  GumWatchpointMonitor * self = GUM_WATCHPOINT_MONITOR (user_data);
+  gint id;
+  const GumWatchpoint * wp;
+  GumWatchpointDetails d;
+
+  if (details->type != GUM_EXCEPTION_SINGLE_STEP)
+    return FALSE;
+
+  if (g_atomic_int_get (&self->num_applied) == 0)
+    return FALSE;
+
+  id = gum_watchpoint_monitor_find_hit (self, details);
+  if (id == -1)
+    return FALSE;
+  wp = &self->applied[id];
+
+  d.watchpoint_id = id;
+  d.thread_id = details->thread_id;
+  d.from = details->address;
+  d.address = GSIZE_TO_POINTER (wp->address);
+  d.size = wp->size;
+
+  self->notify_func (self, &d, self->notify_data);
+
+#ifdef HAVE_ARM64
+  /*
+   * Watchpoints fire before the access takes place, so we have to get out
+   * of the way for it to make progress. This makes them one-shot per
+   * thread, until re-armed by gum_watchpoint_monitor_apply().
+   */
+  _gum_process_modify_debug_registers (details->thread_id,
+      gum_disarm_watchpoint, GINT_TO_POINTER (id));
+#endif
+
+  return TRUE;
+}
+
+static gint
+gum_watchpoint_monitor_find_hit (GumWatchpointMonitor * self,
+                                 GumExceptionDetails * details)
+{
+  const GumWatchpoint * watchpoints = self->applied;
+  gint i;
+#if defined (HAVE_I386)
+  gsize dr6;
+# ifdef G_OS_WIN32
+  CONTEXT * context = details->native_context;
+
+  dr6 = context->Dr6;
+  context->Dr6 = 0;
+# else
+  /*
+   * The status register can only be read through ptrace(), so avoid that
+   * round-trip when there is only one candidate.
+   */
+  if (g_atomic_int_get (&self->num_applied) == 1)
+  {
+    for (i = 0; i != GUM_NUM_WATCHPOINTS; i++)
+    {
+      if (watchpoints[i].conditions != 0)
+        return i;
+    }
+  }
+
+  dr6 = 0;
+  _gum_process_modify_debug_registers (details->thread_id,
+      gum_read_and_clear_dr6, &dr6);
+# endif
+
+  for (i = 0; i != GUM_NUM_WATCHPOINTS; i++)
+  {
+    if (watchpoints[i].conditions != 0 && (dr6 & (1 << i)) != 0)
+      return i;
+  }
+#elif defined (HAVE_ARM64)
+  GumAddress accessed;
+  gint candidate = -1;
+
+  /*
+   * The reported address may be anywhere within the access, which can
+   * start below the watched bytes, so match on the enclosing doubleword.
+   */
+  accessed = GUM_ADDRESS (details->memory.address);
+
+  for (i = 0; i != GUM_NUM_WATCHPOINTS; i++)
+  {
+    const GumWatchpoint * wp = &watchpoints[i];
+
+    if (wp->conditions == 0)
+      continue;
+
+    if ((accessed & ~G_GUINT64_CONSTANT (7)) ==
+        (wp->address & ~G_GUINT64_CONSTANT (7)))
+      return i;
+
+    candidate = (candidate == -1) ? i : -2;
+  }
+
+  if (candidate >= 0)
+    return candidate;
+#endif
+
+  return -1;
+}
+
+# if defined (HAVE_I386) && !defined (G_OS_WIN32)
+
+static void
+gum_read_and_clear_dr6 (GumThreadId thread_id,
+                        GumDebugRegisters * regs,
+                        gpointer user_data)
+{
+  gsize * dr6 = user_data;
+
+  *dr6 = regs->dr6 & GUM_DR6_HITS_MASK;
+  regs->dr6 = 0;
+}
+
+# endif
+
+# ifdef HAVE_ARM64
+
+static void
+gum_disarm_watchpoint (GumThreadId thread_id,
+                       GumDebugRegisters * regs,
+                       gpointer user_data)
+{
+  guint id = GPOINTER_TO_INT (user_data);
+
+  if (id < regs->num_watchpoints)
+    regs->wcr[id] &= ~GUM_WCR_ENABLE;
+}
+
+# endif
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_WATCHPOINT_MONITOR_H__
+#define __GUM_WATCHPOINT_MONITOR_H__
+
+#include <glib-object.h>
+#include <gum/gumprocess.h>
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_WATCHPOINT_MONITOR (gum_watchpoint_monitor_get_type ())
+G_DECLARE_FINAL_TYPE (GumWatchpointMonitor, gum_watchpoint_monitor, GUM,
+    WATCHPOINT_MONITOR, GObject)
+
+typedef guint GumWatchConditions;
+typedef struct _GumWatchpointDetails GumWatchpointDetails;
+
+typedef void (* GumWatchpointNotify) (GumWatchpointMonitor * monitor,
+    const GumWatchpointDetails * details, gpointer user_data);
+
+enum _GumWatchConditions
+{
+  GUM_WATCH_READ  = (1 << 0),
+  GUM_WATCH_WRITE = (1 << 1),
+};
+
+struct _GumWatchpointDetails
+{
+  guint watchpoint_id;
+  GumThreadId thread_id;
+  gpointer from;
+  gpointer address;
+  gsize size;
+};
+
+GUM_API GumWatchpointMonitor * gum_watchpoint_monitor_new (
+    GumWatchpointNotify func, gpointer data, GDestroyNotify data_destroy);
+
+GUM_API gboolean gum_watchpoint_monitor_set (GumWatchpointMonitor * self,
+    guint watchpoint_id, GumAddress address, gsize size,
+    GumWatchConditions conditions, GError ** error);
+GUM_API void gum_watchpoint_monitor_unset (GumWatchpointMonitor * self,
+    guint watchpoint_id);
+
+GUM_API gboolean gum_watchpoint_monitor_apply (GumWatchpointMonitor * self,
+    const GumThreadId * thread_ids, guint num_threads, GError ** error);
+
+G_END_DECLS
+
+#endif
@@ -13,9 +13,12 @@
 #include <gum/prof/gumcallcountsampler.h>
 #include <gum/prof/gumcyclesampler.h>
 #include <gum/prof/gummalloccountsampler.h>
+#include <gum/prof/gumperfeventsampler.h>
 #include <gum/prof/gumprofiler.h>
 #include <gum/prof/gumprofilereport.h>
 #include <gum/prof/gumsampler.h>
+#include <gum/prof/gumsamplingprofiler.h>
+#include <gum/prof/gumtimestampsampler.h>
 #include <gum/prof/gumwallclocksampler.h>
 
 #endif
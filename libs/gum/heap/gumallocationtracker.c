@@ -6,6 +6,7 @@
 
 #include "gumallocationtracker.h"
 
+#include <math.h>
 #include <string.h>
 
 #include "gumallocationblock.h"
@@ -13,8 +14,44 @@
 #include "gummemory.h"
 #include "gumreturnaddress.h"
 #include "gumbacktracer.h"
+#include "gumstacktable.h"
+#include "gumsymbolutil.h"
 
+/*
+ * Live blocks are spread across shards by address, and size groups across
+ * shards by size, each with its own lock. Threads allocating concurrently
+ * thus rarely contend, while group peaks are still tracked exactly. The
+ * block count and total size are maintained atomically.
+ *
+ * With a sample interval set, each thread counts down the bytes it allocates
+ * and only the allocation that crosses zero is tracked, after which the next
+ * distance is drawn from an exponential distribution with the interval as
+ * its mean. A block of size S is then sampled with probability
+ * 1 - e^(-S / interval), so it is counted with the inverse of that as its
+ * weight, which only depends on its size and is thus recomputed on free.
+ *
+ * With a backtracer, blocks are also aggregated per allocation site, keyed
+ * by their interned stack, in a third set of shards. Each site keeps what is
+ * in use along with running totals of what was allocated and freed, and the
+ * totals as of the last delta report, so reporting is a walk over the sites
+ * rather than over the blocks.
+ */
+
+#define GUM_ALLOCATION_TRACKER_N_SHARDS 16
+
+typedef struct _GumAllocationTrackerShard GumAllocationTrackerShard;
 typedef struct _GumAllocationTrackerBlock GumAllocationTrackerBlock;
+typedef struct _GumAllocationSampler GumAllocationSampler;
+typedef struct _GumAllocationSiteTotals GumAllocationSiteTotals;
+typedef struct _GumAllocationSite GumAllocationSite;
+typedef struct _GumAllocationSiteSample GumAllocationSiteSample;
+typedef struct _GumPprofBuilder GumPprofBuilder;
+
+struct _GumAllocationTrackerShard
+{
+  GMutex mutex;
+  GHashTable * table;
+};
 
 struct _GumAllocationTracker
 {
@@ -22,17 +59,19 @@ struct _GumAllocationTracker
 
   gboolean disposed;
 
-  GMutex mutex;
-
   volatile gint enabled;
 
   GumAllocationTrackerFilterFunction filter_func;
   gpointer filter_func_user_data;
 
-  guint block_count;
-  guint block_total_size;
-  GHashTable * known_blocks_ht;
-  GHashTable * block_groups_ht;
+  guint sample_interval;
+
+  volatile gint block_count;
+  volatile gint block_total_size;
+  GumAllocationTrackerShard block_shards[GUM_ALLOCATION_TRACKER_N_SHARDS];
+  GumAllocationTrackerShard group_shards[GUM_ALLOCATION_TRACKER_N_SHARDS];
+  GumAllocationTrackerShard site_shards[GUM_ALLOCATION_TRACKER_N_SHARDS];
+  GumStackTable * stacks;
 
   GumBacktracerInterface * backtracer_iface;
   GumBacktracer * backtracer_instance;
@@ -47,11 +86,47 @@ enum
 struct _GumAllocationTrackerBlock
 {
   guint size;
-  GumReturnAddress return_addresses[1];
+  GumStackId stack;
 };
 
-#define GUM_ALLOCATION_TRACKER_LOCK(o) g_mutex_lock (&(o)->mutex)
-#define GUM_ALLOCATION_TRACKER_UNLOCK(o) g_mutex_unlock (&(o)->mutex)
+struct _GumAllocationSampler
+{
+  gint64 bytes_until_sample;
+  guint32 seed;
+};
+
+struct _GumAllocationSiteTotals
+{
+  guint64 allocated_count;
+  guint64 allocated_size;
+  guint64 freed_count;
+  guint64 freed_size;
+};
+
+struct _GumAllocationSite
+{
+  guint64 live_count;
+  guint64 live_size;
+  GumAllocationSiteTotals totals;
+  GumAllocationSiteTotals reported;
+};
+
+struct _GumAllocationSiteSample
+{
+  GumStackId stack;
+  GumAllocationSite site;
+};
+
+struct _GumPprofBuilder
+{
+  GPtrArray * strings;
+  GHashTable * string_indices;
+  GArray * functions;
+  GHashTable * function_ids;
+};
+
+#define GUM_ALLOCATION_TRACKER_SHARD_LOCK(s) g_mutex_lock (&(s)->mutex)
+#define GUM_ALLOCATION_TRACKER_SHARD_UNLOCK(s) g_mutex_unlock (&(s)->mutex)
 
 static void gum_allocation_tracker_constructed (GObject * object);
 static void gum_allocation_tracker_set_property (GObject * object,
@@ -61,13 +136,54 @@ static void gum_allocation_tracker_get_property (GObject * object,
 static void gum_allocation_tracker_dispose (GObject * object);
 static void gum_allocation_tracker_finalize (GObject * object);
 
+static GumAllocationTrackerShard * gum_allocation_tracker_get_block_shard (
+    GumAllocationTracker * self, gpointer address);
+static GumAllocationTrackerShard * gum_allocation_tracker_get_group_shard (
+    GumAllocationTracker * self, guint size);
+static GumAllocationTrackerShard * gum_allocation_tracker_get_site_shard (
+    GumAllocationTracker * self, GumStackId stack);
+static guint gum_allocation_tracker_append_shard_blocks (
+    GumAllocationTracker * self, GumAllocationTrackerShard * shard,
+    GList ** blocks);
+static void gum_allocation_tracker_block_free (
+    GumAllocationTrackerBlock * block);
+static void gum_allocation_site_free (GumAllocationSite * site);
+
+static gboolean gum_allocation_tracker_should_sample (
+    GumAllocationTracker * self, guint size);
+static guint gum_allocation_tracker_get_weight (GumAllocationTracker * self,
+    guint size);
+static gint64 gum_allocation_sampler_next_distance (
+    GumAllocationSampler * sampler, guint interval);
+
 static void gum_allocation_tracker_size_stats_add_block (
     GumAllocationTracker * self, guint size);
 static void gum_allocation_tracker_size_stats_remove_block (
     GumAllocationTracker * self, guint size);
+static void gum_allocation_tracker_site_stats_add_block (
+    GumAllocationTracker * self, GumStackId stack, guint size);
+static void gum_allocation_tracker_site_stats_remove_block (
+    GumAllocationTracker * self, GumStackId stack, guint size);
+
+static void gum_allocation_tracker_emit_pprof (GumAllocationTracker * self,
+    GArray * samples, GumAllocationTrackerOutputFunc func,
+    gpointer user_data);
+static guint gum_pprof_builder_intern_string (GumPprofBuilder * self,
+    const gchar * str);
+static guint64 gum_pprof_builder_intern_function (GumPprofBuilder * self,
+    gpointer address);
+static void gum_pprof_append_varint (GByteArray * buf, guint64 value);
+static void gum_pprof_append_uint_field (GByteArray * buf, guint field,
+    guint64 value);
+static void gum_pprof_append_bytes_field (GByteArray * buf, guint field,
+    gconstpointer data, gsize size);
+static void gum_pprof_emit_message (guint field, GByteArray * message,
+    GumAllocationTrackerOutputFunc func, gpointer user_data);
 
 G_DEFINE_TYPE (GumAllocationTracker, gum_allocation_tracker, G_TYPE_OBJECT)
 
+static GPrivate gum_allocation_sampler = G_PRIVATE_INIT (g_free);
+
 static void
 gum_allocation_tracker_class_init (GumAllocationTrackerClass * klass)
 {
@@ -89,25 +205,42 @@ gum_allocation_tracker_class_init (GumAllocationTrackerClass * klass)
 static void
 gum_allocation_tracker_init (GumAllocationTracker * self)
 {
-  g_mutex_init (&self->mutex);
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    g_mutex_init (&self->block_shards[i].mutex);
+    g_mutex_init (&self->group_shards[i].mutex);
+    g_mutex_init (&self->site_shards[i].mutex);
+  }
 }
 
 static void
 gum_allocation_tracker_constructed (GObject * object)
 {
   GumAllocationTracker * self = GUM_ALLOCATION_TRACKER (object);
+  guint i;
 
   if (self->backtracer_instance != NULL)
+    self->stacks = gum_stack_table_new ();
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
   {
-    self->known_blocks_ht = g_hash_table_new_full (NULL, NULL, NULL, g_free);
-  }
-  else
-  {
-    self->known_blocks_ht = g_hash_table_new (NULL, NULL);
-  }
+    if (self->backtracer_instance != NULL)
+    {
+      self->block_shards[i].table = g_hash_table_new_full (NULL, NULL, NULL,
+          (GDestroyNotify) gum_allocation_tracker_block_free);
+    }
+    else
+    {
+      self->block_shards[i].table = g_hash_table_new (NULL, NULL);
+    }
 
-  self->block_groups_ht = g_hash_table_new_full (NULL, NULL, NULL,
-      (GDestroyNotify) gum_allocation_group_free);
+    self->group_shards[i].table = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) gum_allocation_group_free);
+    self->site_shards[i].table = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) gum_allocation_site_free);
+  }
 }
 
 static void
@@ -163,6 +296,7 @@ static void
 gum_allocation_tracker_dispose (GObject * object)
 {
   GumAllocationTracker * self = GUM_ALLOCATION_TRACKER (object);
+  guint i;
 
   if (!self->disposed)
   {
@@ -171,11 +305,19 @@ gum_allocation_tracker_dispose (GObject * object)
     g_clear_object (&self->backtracer_instance);
     self->backtracer_iface = NULL;
 
-    g_hash_table_unref (self->known_blocks_ht);
-    self->known_blocks_ht = NULL;
+    for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+    {
+      g_hash_table_unref (self->block_shards[i].table);
+      self->block_shards[i].table = NULL;
+
+      g_hash_table_unref (self->group_shards[i].table);
+      self->group_shards[i].table = NULL;
+
+      g_hash_table_unref (self->site_shards[i].table);
+      self->site_shards[i].table = NULL;
+    }
 
-    g_hash_table_unref (self->block_groups_ht);
-    self->block_groups_ht = NULL;
+    g_clear_object (&self->stacks);
   }
 
   G_OBJECT_CLASS (gum_allocation_tracker_parent_class)->dispose (object);
@@ -185,8 +327,14 @@ static void
 gum_allocation_tracker_finalize (GObject * object)
 {
   GumAllocationTracker * self = GUM_ALLOCATION_TRACKER (object);
+  guint i;
 
-  g_mutex_clear (&self->mutex);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    g_mutex_clear (&self->block_shards[i].mutex);
+    g_mutex_clear (&self->group_shards[i].mutex);
+    g_mutex_clear (&self->site_shards[i].mutex);
+  }
 
   G_OBJECT_CLASS (gum_allocation_tracker_parent_class)->finalize (object);
 }
@@ -216,14 +364,41 @@ gum_allocation_tracker_set_filter_function (GumAllocationTracker * self,
   self->filter_func_user_data = user_data;
 }
 
+/*
+ * Makes the tracker sample roughly one allocation per `interval` bytes
+ * allocated, instead of tracking every single one. Counts, sizes and groups
+ * are scaled so they estimate the totals. Zero turns sampling off.
+ */
+void
+gum_allocation_tracker_set_sample_interval (GumAllocationTracker * self,
+                                            guint interval)
+{
+  g_assert (g_atomic_int_get (&self->enabled) == FALSE);
+
+  self->sample_interval = interval;
+}
+
 void
 gum_allocation_tracker_begin (GumAllocationTracker * self)
 {
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  self->block_count = 0;
-  self->block_total_size = 0;
-  g_hash_table_remove_all (self->known_blocks_ht);
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    GumAllocationTrackerShard * blocks = &self->block_shards[i];
+    GumAllocationTrackerShard * sites = &self->site_shards[i];
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (blocks);
+    g_hash_table_remove_all (blocks->table);
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (blocks);
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (sites);
+    g_hash_table_remove_all (sites->table);
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (sites);
+  }
+
+  g_atomic_int_set (&self->block_count, 0);
+  g_atomic_int_set (&self->block_total_size, 0);
 
   g_atomic_int_set (&self->enabled, TRUE);
 }
@@ -231,78 +406,224 @@ gum_allocation_tracker_begin (GumAllocationTracker * self)
 void
 gum_allocation_tracker_end (GumAllocationTracker * self)
 {
+  guint i;
+
   g_atomic_int_set (&self->enabled, FALSE);
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  self->block_count = 0;
-  self->block_total_size = 0;
-  g_hash_table_remove_all (self->known_blocks_ht);
-  g_hash_table_remove_all (self->block_groups_ht);
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    GumAllocationTrackerShard * blocks = &self->block_shards[i];
+    GumAllocationTrackerShard * groups = &self->group_shards[i];
+    GumAllocationTrackerShard * sites = &self->site_shards[i];
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (blocks);
+    g_hash_table_remove_all (blocks->table);
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (blocks);
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (groups);
+    g_hash_table_remove_all (groups->table);
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (groups);
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (sites);
+    g_hash_table_remove_all (sites->table);
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (sites);
+  }
+
+  g_atomic_int_set (&self->block_count, 0);
+  g_atomic_int_set (&self->block_total_size, 0);
 }
 
 guint
 gum_allocation_tracker_peek_block_count (GumAllocationTracker * self)
 {
-  return self->block_count;
+  return (guint) g_atomic_int_get (&self->block_count);
 }
 
 guint
 gum_allocation_tracker_peek_block_total_size (GumAllocationTracker * self)
 {
-  return self->block_total_size;
+  return (guint) g_atomic_int_get (&self->block_total_size);
 }
 
 GList *
 gum_allocation_tracker_peek_block_list (GumAllocationTracker * self)
 {
   GList * blocks = NULL;
+  guint i;
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    gum_allocation_tracker_append_shard_blocks (self, &self->block_shards[i],
+        &blocks);
+  }
+
+  return blocks;
+}
+
+/*
+ * Copies the blocks of one or more shards, starting at `*position`, until at
+ * least `max_blocks` have been copied or every shard has been visited. Only
+ * one shard is locked at a time, so a full walk can be spread across calls
+ * while allocations keep being tracked. `*position` should start at zero and
+ * is advanced past the shards visited. Returns FALSE once there is nothing
+ * left to walk.
+ */
+gboolean
+gum_allocation_tracker_peek_block_list_step (GumAllocationTracker * self,
+                                             guint * position,
+                                             guint max_blocks,
+                                             GList ** blocks)
+{
+  guint copied = 0;
+
+  while (*position < GUM_ALLOCATION_TRACKER_N_SHARDS && copied < max_blocks)
+  {
+    copied += gum_allocation_tracker_append_shard_blocks (self,
+        &self->block_shards[*position], blocks);
+    (*position)++;
+  }
+
+  return *position < GUM_ALLOCATION_TRACKER_N_SHARDS;
+}
+
+static guint
+gum_allocation_tracker_append_shard_blocks (GumAllocationTracker * self,
+                                            GumAllocationTrackerShard * shard,
+                                            GList ** blocks)
+{
+  guint count;
   GHashTableIter iter;
   gpointer key, value;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  g_hash_table_iter_init (&iter, self->known_blocks_ht);
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  count = g_hash_table_size (shard->table);
+
+  g_hash_table_iter_init (&iter, shard->table);
   while (g_hash_table_iter_next (&iter, &key, &value))
   {
     if (self->backtracer_instance != NULL)
     {
       GumAllocationTrackerBlock * tb = (GumAllocationTrackerBlock *) value;
       GumAllocationBlock * block;
-      guint i;
 
       block = gum_allocation_block_new (key, tb->size);
+      gum_stack_table_lookup (self->stacks, tb->stack,
+          &block->return_addresses);
 
-      for (i = 0; tb->return_addresses[i] != NULL; i++)
-        block->return_addresses.items[i] = tb->return_addresses[i];
-      block->return_addresses.len = i;
-
-      blocks = g_list_prepend (blocks, block);
+      *blocks = g_list_prepend (*blocks, block);
     }
     else
     {
-      blocks = g_list_prepend (blocks,
+      *blocks = g_list_prepend (*blocks,
           gum_allocation_block_new (key, GPOINTER_TO_UINT (value)));
     }
   }
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
 
-  return blocks;
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+
+  return count;
 }
 
 GList *
 gum_allocation_tracker_peek_block_groups (GumAllocationTracker * self)
 {
-  GList * groups, * cur;
+  GList * groups = NULL;
+  guint i;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
-  groups = g_hash_table_get_values (self->block_groups_ht);
-  for (cur = groups; cur != NULL; cur = cur->next)
-    cur->data = gum_allocation_group_copy ((GumAllocationGroup *) cur->data);
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    GumAllocationTrackerShard * shard = &self->group_shards[i];
+    GHashTableIter iter;
+    gpointer value;
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+    g_hash_table_iter_init (&iter, shard->table);
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      groups = g_list_prepend (groups,
+          gum_allocation_group_copy ((GumAllocationGroup *) value));
+    }
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+  }
 
   return groups;
 }
 
+/*
+ * Writes a pprof heap profile with one sample per allocation site. Objects
+ * and space allocated and freed are running totals, or with `delta` what
+ * changed since the previous delta report, while those in use are current.
+ * Delta reports also forget sites that have nothing left in use, so the
+ * totals only cover sites still known. Sites are told apart by their stacks,
+ * so without a backtracer the profile has no samples. Returns the number of
+ * samples written.
+ */
+guint
+gum_allocation_tracker_emit_site_profile (GumAllocationTracker * self,
+                                          gboolean delta,
+                                          GumAllocationTrackerOutputFunc func,
+                                          gpointer user_data)
+{
+  GArray * samples;
+  guint n_samples, i;
+
+  samples = g_array_new (FALSE, FALSE, sizeof (GumAllocationSiteSample));
+
+  for (i = 0; i != GUM_ALLOCATION_TRACKER_N_SHARDS; i++)
+  {
+    GumAllocationTrackerShard * shard = &self->site_shards[i];
+    GHashTableIter iter;
+    gpointer key, value;
+
+    GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+    g_hash_table_iter_init (&iter, shard->table);
+    while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GumAllocationSite * site = value;
+      GumAllocationSiteSample sample;
+
+      sample.stack = GPOINTER_TO_UINT (key);
+      sample.site = *site;
+
+      if (delta)
+      {
+        GumAllocationSiteTotals * totals = &sample.site.totals;
+
+        totals->allocated_count -= site->reported.allocated_count;
+        totals->allocated_size -= site->reported.allocated_size;
+        totals->freed_count -= site->reported.freed_count;
+        totals->freed_size -= site->reported.freed_size;
+
+        site->reported = site->totals;
+
+        if (site->live_count == 0)
+          g_hash_table_iter_remove (&iter);
+      }
+
+      if (sample.site.live_count == 0 &&
+          sample.site.totals.allocated_count == 0 &&
+          sample.site.totals.freed_count == 0)
+      {
+        continue;
+      }
+
+      g_array_append_val (samples, sample);
+    }
+
+    GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+  }
+
+  gum_allocation_tracker_emit_pprof (self, samples, func, user_data);
+
+  n_samples = samples->len;
+
+  g_array_free (samples, TRUE);
+
+  return n_samples;
+}
+
 void
 gum_allocation_tracker_on_malloc (GumAllocationTracker * self,
                                   gpointer address,
@@ -335,10 +656,16 @@ gum_allocation_tracker_on_malloc_full (GumAllocationTracker * self,
                                        const GumCpuContext * cpu_context)
 {
   gpointer value;
+  GumStackId stack = GUM_STACK_ID_NONE;
+  GumAllocationTrackerShard * shard;
 
   if (!g_atomic_int_get (&self->enabled))
     return;
 
+  if (self->sample_interval != 0 &&
+      !gum_allocation_tracker_should_sample (self, size))
+    return;
+
   if (self->backtracer_instance != NULL)
   {
     gboolean do_backtrace = TRUE;
@@ -361,17 +688,10 @@ gum_allocation_tracker_on_malloc_full (GumAllocationTracker * self,
       return_addresses.len = 0;
     }
 
-    block = (GumAllocationTrackerBlock *)
-        g_malloc (sizeof (GumAllocationTrackerBlock) +
-            (return_addresses.len * sizeof (GumReturnAddress)));
+    block = g_slice_new (GumAllocationTrackerBlock);
     block->size = size;
-    block->return_addresses[return_addresses.len] = NULL;
-
-    if (return_addresses.len > 0)
-    {
-      memcpy (block->return_addresses, &return_addresses.items,
-          return_addresses.len * sizeof (GumReturnAddress));
-    }
+    block->stack = gum_stack_table_intern (self->stacks, &return_addresses);
+    stack = block->stack;
 
     value = block;
   }
@@ -380,13 +700,15 @@ gum_allocation_tracker_on_malloc_full (GumAllocationTracker * self,
     value = GUINT_TO_POINTER (size);
   }
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
+  shard = gum_allocation_tracker_get_block_shard (self, address);
 
-  g_hash_table_insert (self->known_blocks_ht, address, value);
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+  g_hash_table_insert (shard->table, address, value);
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
 
   gum_allocation_tracker_size_stats_add_block (self, size);
-
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  if (self->backtracer_instance != NULL)
+    gum_allocation_tracker_site_stats_add_block (self, stack, size);
 }
 
 void
@@ -394,29 +716,44 @@ gum_allocation_tracker_on_free_full (GumAllocationTracker * self,
                                      gpointer address,
                                      const GumCpuContext * cpu_context)
 {
+  GumAllocationTrackerShard * shard;
   gpointer value;
+  guint size = 0;
+  GumStackId stack = GUM_STACK_ID_NONE;
 
   if (!g_atomic_int_get (&self->enabled))
     return;
 
-  GUM_ALLOCATION_TRACKER_LOCK (self);
+  shard = gum_allocation_tracker_get_block_shard (self, address);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
 
-  value = g_hash_table_lookup (self->known_blocks_ht, address);
+  value = g_hash_table_lookup (shard->table, address);
   if (value != NULL)
   {
-    guint size;
-
     if (self->backtracer_instance != NULL)
-      size = ((GumAllocationTrackerBlock *) value)->size;
+    {
+      GumAllocationTrackerBlock * block = value;
+
+      size = block->size;
+      stack = block->stack;
+    }
     else
+    {
       size = GPOINTER_TO_UINT (value);
+    }
 
-    gum_allocation_tracker_size_stats_remove_block (self, size);
-
-    g_hash_table_remove (self->known_blocks_ht, address);
+    g_hash_table_remove (shard->table, address);
   }
 
-  GUM_ALLOCATION_TRACKER_UNLOCK (self);
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+
+  if (value == NULL)
+    return;
+
+  gum_allocation_tracker_size_stats_remove_block (self, size);
+  if (self->backtracer_instance != NULL)
+    gum_allocation_tracker_site_stats_remove_block (self, stack, size);
 }
 
 void
@@ -433,41 +770,55 @@ gum_allocation_tracker_on_realloc_full (GumAllocationTracker * self,
   {
     if (new_size != 0)
     {
+      GumAllocationTrackerShard * shard;
       gpointer value;
+      guint old_size;
+      GumStackId stack = GUM_STACK_ID_NONE;
 
-      GUM_ALLOCATION_TRACKER_LOCK (self);
+      shard = gum_allocation_tracker_get_block_shard (self, old_address);
 
-      value = g_hash_table_lookup (self->known_blocks_ht, old_address);
+      GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+      value = g_hash_table_lookup (shard->table, old_address);
       if (value != NULL)
+        g_hash_table_steal (shard->table, old_address);
+      GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+
+      if (value == NULL)
+        return;
+
+      if (self->backtracer_instance != NULL)
       {
-        guint old_size;
+        GumAllocationTrackerBlock * block;
 
-        g_hash_table_steal (self->known_blocks_ht, old_address);
+        block = (GumAllocationTrackerBlock *) value;
 
-        if (self->backtracer_instance != NULL)
-        {
-          GumAllocationTrackerBlock * block;
+        old_size = block->size;
+        block->size = new_size;
+        stack = block->stack;
+      }
+      else
+      {
+        old_size = GPOINTER_TO_UINT (value);
 
-          block = (GumAllocationTrackerBlock *) value;
+        value = GUINT_TO_POINTER (new_size);
+      }
 
-          g_hash_table_insert (self->known_blocks_ht, new_address, block);
+      shard = gum_allocation_tracker_get_block_shard (self, new_address);
 
-          old_size = block->size;
-          block->size = new_size;
-        }
-        else
-        {
-          g_hash_table_insert (self->known_blocks_ht, new_address,
-              GUINT_TO_POINTER (new_size));
+      GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+      g_hash_table_insert (shard->table, new_address, value);
+      GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
 
-          old_size = GPOINTER_TO_UINT (value);
-        }
+      gum_allocation_tracker_size_stats_remove_block (self, old_size);
+      gum_allocation_tracker_size_stats_add_block (self, new_size);
 
-        gum_allocation_tracker_size_stats_remove_block (self, old_size);
-        gum_allocation_tracker_size_stats_add_block (self, new_size);
+      /* The block keeps its site, which sees a free and an allocation. */
+      if (self->backtracer_instance != NULL)
+      {
+        gum_allocation_tracker_site_stats_remove_block (self, stack,
+            old_size);
+        gum_allocation_tracker_site_stats_add_block (self, stack, new_size);
       }
-
-      GUM_ALLOCATION_TRACKER_UNLOCK (self);
     }
     else
     {
@@ -481,39 +832,422 @@ gum_allocation_tracker_on_realloc_full (GumAllocationTracker * self,
   }
 }
 
+static GumAllocationTrackerShard *
+gum_allocation_tracker_get_block_shard (GumAllocationTracker * self,
+                                        gpointer address)
+{
+  gsize a = GPOINTER_TO_SIZE (address);
+
+  return &self->block_shards[((a >> 4) ^ (a >> 12)) &
+      (GUM_ALLOCATION_TRACKER_N_SHARDS - 1)];
+}
+
+static GumAllocationTrackerShard *
+gum_allocation_tracker_get_group_shard (GumAllocationTracker * self,
+                                        guint size)
+{
+  return &self->group_shards[(size * 2654435761U) >> 28];
+}
+
+static GumAllocationTrackerShard *
+gum_allocation_tracker_get_site_shard (GumAllocationTracker * self,
+                                       GumStackId stack)
+{
+  return &self->site_shards[(stack * 2654435761U) >> 28];
+}
+
+static void
+gum_allocation_tracker_block_free (GumAllocationTrackerBlock * block)
+{
+  g_slice_free (GumAllocationTrackerBlock, block);
+}
+
+static void
+gum_allocation_site_free (GumAllocationSite * site)
+{
+  g_slice_free (GumAllocationSite, site);
+}
+
+static gboolean
+gum_allocation_tracker_should_sample (GumAllocationTracker * self,
+                                      guint size)
+{
+  GumAllocationSampler * sampler;
+
+  sampler = g_private_get (&gum_allocation_sampler);
+  if (sampler == NULL)
+  {
+    sampler = g_new (GumAllocationSampler, 1);
+    sampler->seed = (guint32) (GPOINTER_TO_SIZE (&sampler) ^
+        (gsize) g_get_monotonic_time ()) | 1;
+    sampler->bytes_until_sample = gum_allocation_sampler_next_distance (
+        sampler, self->sample_interval);
+
+    g_private_set (&gum_allocation_sampler, sampler);
+  }
+
+  sampler->bytes_until_sample -= size;
+  if (sampler->bytes_until_sample > 0)
+    return FALSE;
+
+  sampler->bytes_until_sample = gum_allocation_sampler_next_distance (sampler,
+      self->sample_interval);
+
+  return TRUE;
+}
+
+static guint
+gum_allocation_tracker_get_weight (GumAllocationTracker * self,
+                                   guint size)
+{
+  gdouble probability;
+
+  if (self->sample_interval == 0)
+    return 1;
+
+  probability = 1.0 - exp (-((gdouble) size / self->sample_interval));
+  if (probability <= 0.0)
+    return self->sample_interval;
+
+  return MAX ((guint) ((1.0 / probability) + 0.5), 1);
+}
+
+static gint64
+gum_allocation_sampler_next_distance (GumAllocationSampler * sampler,
+                                      guint interval)
+{
+  guint32 x = sampler->seed;
+  gdouble u;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sampler->seed = x;
+
+  u = ((x >> 8) + 1) / (gdouble) (1 << 24);
+
+  return (gint64) (-log (u) * interval) + 1;
+}
+
 static void
 gum_allocation_tracker_size_stats_add_block (GumAllocationTracker * self,
                                              guint size)
 {
+  GumAllocationTrackerShard * shard;
   GumAllocationGroup * group;
+  guint weight;
+
+  weight = gum_allocation_tracker_get_weight (self, size);
 
-  self->block_count++;
-  self->block_total_size += size;
+  g_atomic_int_add (&self->block_count, weight);
+  g_atomic_int_add (&self->block_total_size, weight * size);
 
-  group = g_hash_table_lookup (self->block_groups_ht, GUINT_TO_POINTER (size));
+  shard = gum_allocation_tracker_get_group_shard (self, size);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  group = g_hash_table_lookup (shard->table, GUINT_TO_POINTER (size));
 
   if (group == NULL)
   {
     group = gum_allocation_group_new (size);
-    g_hash_table_insert (self->block_groups_ht, GUINT_TO_POINTER (size),
-        group);
+    g_hash_table_insert (shard->table, GUINT_TO_POINTER (size), group);
   }
 
-  group->alive_now++;
+  group->alive_now += weight;
   if (group->alive_now > group->alive_peak)
     group->alive_peak = group->alive_now;
-  group->total_peak++;
+  group->total_peak += weight;
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
 }
 
 static void
 gum_allocation_tracker_size_stats_remove_block (GumAllocationTracker * self,
                                                 guint size)
 {
+  GumAllocationTrackerShard * shard;
   GumAllocationGroup * group;
+  guint weight;
+
+  weight = gum_allocation_tracker_get_weight (self, size);
+
+  g_atomic_int_add (&self->block_count, -((gint) weight));
+  g_atomic_int_add (&self->block_total_size, -((gint) (weight * size)));
+
+  shard = gum_allocation_tracker_get_group_shard (self, size);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  group = g_hash_table_lookup (shard->table, GUINT_TO_POINTER (size));
+  if (group != NULL)
+    group->alive_now -= weight;
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+}
+
+static void
+gum_allocation_tracker_site_stats_add_block (GumAllocationTracker * self,
+                                             GumStackId stack,
+                                             guint size)
+{
+  GumAllocationTrackerShard * shard;
+  GumAllocationSite * site;
+  guint weight;
+
+  weight = gum_allocation_tracker_get_weight (self, size);
+
+  shard = gum_allocation_tracker_get_site_shard (self, stack);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  site = g_hash_table_lookup (shard->table, GUINT_TO_POINTER (stack));
+  if (site == NULL)
+  {
+    site = g_slice_new0 (GumAllocationSite);
+    g_hash_table_insert (shard->table, GUINT_TO_POINTER (stack), site);
+  }
+
+  site->live_count += weight;
+  site->live_size += (guint64) weight * size;
+  site->totals.allocated_count += weight;
+  site->totals.allocated_size += (guint64) weight * size;
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+}
+
+static void
+gum_allocation_tracker_site_stats_remove_block (GumAllocationTracker * self,
+                                                GumStackId stack,
+                                                guint size)
+{
+  GumAllocationTrackerShard * shard;
+  GumAllocationSite * site;
+  guint weight;
+
+  weight = gum_allocation_tracker_get_weight (self, size);
+
+  shard = gum_allocation_tracker_get_site_shard (self, stack);
+
+  GUM_ALLOCATION_TRACKER_SHARD_LOCK (shard);
+
+  site = g_hash_table_lookup (shard->table, GUINT_TO_POINTER (stack));
+  if (site != NULL)
+  {
+    site->live_count -= weight;
+    site->live_size -= (guint64) weight * size;
+    site->totals.freed_count += weight;
+    site->totals.freed_size += (guint64) weight * size;
+  }
+
+  GUM_ALLOCATION_TRACKER_SHARD_UNLOCK (shard);
+}
+
+static void
+gum_allocation_tracker_emit_pprof (GumAllocationTracker * self,
+                                   GArray * samples,
+                                   GumAllocationTrackerOutputFunc func,
+                                   gpointer user_data)
+{
+  GumPprofBuilder builder;
+  GPtrArray * names;
+  GByteArray * message, * packed;
+  const gchar * value_types[6][2] = {
+    { "alloc_objects", "count" },
+    { "alloc_space", "bytes" },
+    { "free_objects", "count" },
+    { "free_space", "bytes" },
+    { "inuse_objects", "count" },
+    { "inuse_space", "bytes" }
+  };
+  guint i;
+
+  builder.strings = g_ptr_array_new ();
+  builder.string_indices = g_hash_table_new (g_str_hash, g_str_equal);
+  builder.functions = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  builder.function_ids = g_hash_table_new (NULL, NULL);
+
+  gum_pprof_builder_intern_string (&builder, "");
+
+  names = g_ptr_array_new_with_free_func (g_free);
+  message = g_byte_array_new ();
+  packed = g_byte_array_new ();
+
+  for (i = 0; i != G_N_ELEMENTS (value_types); i++)
+  {
+    g_byte_array_set_size (message, 0);
+    gum_pprof_append_uint_field (message, 1,
+        gum_pprof_builder_intern_string (&builder, value_types[i][0]));
+    gum_pprof_append_uint_field (message, 2,
+        gum_pprof_builder_intern_string (&builder, value_types[i][1]));
+    gum_pprof_emit_message (1, message, func, user_data);
+  }
+
+  for (i = 0; i != samples->len; i++)
+  {
+    GumAllocationSiteSample * sample =
+        &g_array_index (samples, GumAllocationSiteSample, i);
+    const GumAllocationSite * site = &sample->site;
+    GumReturnAddressArray stack;
+    guint j;
+
+    if (!gum_stack_table_lookup (self->stacks, sample->stack, &stack))
+      stack.len = 0;
+
+    g_byte_array_set_size (message, 0);
+
+    g_byte_array_set_size (packed, 0);
+    for (j = 0; j != stack.len; j++)
+    {
+      gum_pprof_append_varint (packed,
+          gum_pprof_builder_intern_function (&builder, stack.items[j]));
+    }
+    gum_pprof_append_bytes_field (message, 1, packed->data, packed->len);
+
+    g_byte_array_set_size (packed, 0);
+    gum_pprof_append_varint (packed, site->totals.allocated_count);
+    gum_pprof_append_varint (packed, site->totals.allocated_size);
+    gum_pprof_append_varint (packed, site->totals.freed_count);
+    gum_pprof_append_varint (packed, site->totals.freed_size);
+    gum_pprof_append_varint (packed, site->live_count);
+    gum_pprof_append_varint (packed, site->live_size);
+    gum_pprof_append_bytes_field (message, 2, packed->data, packed->len);
+
+    gum_pprof_emit_message (2, message, func, user_data);
+  }
+
+  for (i = 0; i != builder.functions->len; i++)
+  {
+    gpointer address = g_array_index (builder.functions, gpointer, i);
+    guint64 id = i + 1;
+    gchar * name;
+    guint name_index;
+
+    g_byte_array_set_size (message, 0);
+    gum_pprof_append_uint_field (message, 1, id);
+    gum_pprof_append_uint_field (message, 3, GPOINTER_TO_SIZE (address));
+    g_byte_array_set_size (packed, 0);
+    gum_pprof_append_uint_field (packed, 1, id);
+    gum_pprof_append_bytes_field (message, 4, packed->data, packed->len);
+    gum_pprof_emit_message (4, message, func, user_data);
+
+    name = gum_symbol_name_from_address (address);
+    g_ptr_array_add (names, name);
+    name_index = gum_pprof_builder_intern_string (&builder, name);
+
+    g_byte_array_set_size (message, 0);
+    gum_pprof_append_uint_field (message, 1, id);
+    gum_pprof_append_uint_field (message, 2, name_index);
+    gum_pprof_append_uint_field (message, 3, name_index);
+    gum_pprof_emit_message (5, message, func, user_data);
+  }
+
+  for (i = 0; i != builder.strings->len; i++)
+  {
+    const gchar * str = g_ptr_array_index (builder.strings, i);
+
+    g_byte_array_set_size (message, 0);
+    g_byte_array_append (message, (const guint8 *) str, strlen (str));
+    gum_pprof_emit_message (6, message, func, user_data);
+  }
+
+  g_byte_array_unref (packed);
+  g_byte_array_unref (message);
+  g_ptr_array_unref (names);
+
+  g_hash_table_unref (builder.function_ids);
+  g_array_free (builder.functions, TRUE);
+  g_hash_table_unref (builder.string_indices);
+  g_ptr_array_unref (builder.strings);
+}
+
+static guint
+gum_pprof_builder_intern_string (GumPprofBuilder * self,
+                                 const gchar * str)
+{
+  gpointer index;
+
+  if (g_hash_table_lookup_extended (self->string_indices, str, NULL, &index))
+    return GPOINTER_TO_UINT (index);
+
+  index = GUINT_TO_POINTER (self->strings->len);
+  g_ptr_array_add (self->strings, (gpointer) str);
+  g_hash_table_insert (self->string_indices, (gpointer) str, index);
+
+  return GPOINTER_TO_UINT (index);
+}
+
+static guint64
+gum_pprof_builder_intern_function (GumPprofBuilder * self,
+                                   gpointer address)
+{
+  gpointer id;
+
+  id = g_hash_table_lookup (self->function_ids, address);
+  if (id == NULL)
+  {
+    g_array_append_val (self->functions, address);
+    id = GUINT_TO_POINTER (self->functions->len);
+    g_hash_table_insert (self->function_ids, address, id);
+  }
+
+  return GPOINTER_TO_UINT (id);
+}
+
+static void
+gum_pprof_append_varint (GByteArray * buf,
+                         guint64 value)
+{
+  guint8 bytes[10];
+  guint n = 0;
+
+  do
+  {
+    bytes[n] = value & 0x7f;
+    value >>= 7;
+    if (value != 0)
+      bytes[n] |= 0x80;
+    n++;
+  }
+  while (value != 0);
+
+  g_byte_array_append (buf, bytes, n);
+}
+
+static void
+gum_pprof_append_uint_field (GByteArray * buf,
+                             guint field,
+                             guint64 value)
+{
+  gum_pprof_append_varint (buf, field << 3);
+  gum_pprof_append_varint (buf, value);
+}
+
+static void
+gum_pprof_append_bytes_field (GByteArray * buf,
+                              guint field,
+                              gconstpointer data,
+                              gsize size)
+{
+  gum_pprof_append_varint (buf, (field << 3) | 2);
+  gum_pprof_append_varint (buf, size);
+  g_byte_array_append (buf, data, size);
+}
+
+static void
+gum_pprof_emit_message (guint field,
+                        GByteArray * message,
+                        GumAllocationTrackerOutputFunc func,
+                        gpointer user_data)
+{
+  GByteArray * header;
+
+  header = g_byte_array_sized_new (12);
+  gum_pprof_append_varint (header, (field << 3) | 2);
+  gum_pprof_append_varint (header, message->len);
 
-  self->block_count--;
-  self->block_total_size -= size;
+  func (header->data, header->len, user_data);
+  func (message->data, message->len, user_data);
 
-  group = g_hash_table_lookup (self->block_groups_ht, GUINT_TO_POINTER (size));
-  group->alive_now--;
+  g_byte_array_unref (header);
 }
@@ -20,6 +20,8 @@ G_DECLARE_FINAL_TYPE (GumAllocationTracker, gum_allocation_tracker, GUM,
 typedef gboolean (* GumAllocationTrackerFilterFunction) (
     GumAllocationTracker * tracker, gpointer address, guint size,
     gpointer user_data);
+typedef void (* GumAllocationTrackerOutputFunc) (gconstpointer data,
+    gsize size, gpointer user_data);
 
 GUM_API GumAllocationTracker * gum_allocation_tracker_new (void);
 GUM_API GumAllocationTracker * gum_allocation_tracker_new_with_backtracer (
@@ -28,6 +30,8 @@ GUM_API GumAllocationTracker * gum_allocation_tracker_new_with_backtracer (
 GUM_API void gum_allocation_tracker_set_filter_function (
     GumAllocationTracker * self, GumAllocationTrackerFilterFunction filter,
     gpointer user_data);
+GUM_API void gum_allocation_tracker_set_sample_interval (
+    GumAllocationTracker * self, guint interval);
 
 GUM_API void gum_allocation_tracker_begin (GumAllocationTracker * self);
 GUM_API void gum_allocation_tracker_end (GumAllocationTracker * self);
@@ -38,9 +42,16 @@ GUM_API guint gum_allocation_tracker_peek_block_total_size (
     GumAllocationTracker * self);
 GUM_API GList * gum_allocation_tracker_peek_block_list (
     GumAllocationTracker * self);
+GUM_API gboolean gum_allocation_tracker_peek_block_list_step (
+    GumAllocationTracker * self, guint * position, guint max_blocks,
+    GList ** blocks);
 GUM_API GList * gum_allocation_tracker_peek_block_groups (
     GumAllocationTracker * self);
 
+GUM_API guint gum_allocation_tracker_emit_site_profile (
+    GumAllocationTracker * self, gboolean delta,
+    GumAllocationTrackerOutputFunc func, gpointer user_data);
+
 /*< Internal API */
 void gum_allocation_tracker_on_malloc (GumAllocationTracker * self,
     gpointer address, guint size);
@@ -44,6 +44,7 @@ struct _GumAllocatorProbe
 
   GumInterceptor * interceptor;
   GPtrArray * function_contexts;
+  GHashTable * attached_functions;
   GumAllocationTracker * allocation_tracker;
 
   gboolean enable_counters;
@@ -238,6 +239,7 @@ gum_allocator_probe_init (GumAllocatorProbe * self)
 {
   self->interceptor = gum_interceptor_obtain ();
   self->function_contexts = g_ptr_array_sized_new (3);
+  self->attached_functions = g_hash_table_new (NULL, NULL);
 
   self->enable_counters = DEFAULT_ENABLE_COUNTERS;
 }
@@ -266,6 +268,7 @@ gum_allocator_probe_finalize (GObject * object)
 {
   GumAllocatorProbe * self = GUM_ALLOCATOR_PROBE (object);
 
+  g_hash_table_unref (self->attached_functions);
   g_ptr_array_free (self->function_contexts, TRUE);
 
   G_OBJECT_CLASS (gum_allocator_probe_parent_class)->finalize (object);
@@ -558,6 +561,9 @@ gum_allocator_probe_attach (GumAllocatorProbe * self)
 #define GUM_ATTACH_TO_API_FUNC(name) \
     attach_to_function (self, GUM_FUNCPTR_TO_POINTER (api->name), \
         &gum_##name##_handlers, NULL)
+#define GUM_ATTACH_TO_API_FUNC_AS(name, kind) \
+    attach_to_function (self, GUM_FUNCPTR_TO_POINTER (api->name), \
+        &gum_##kind##_handlers, NULL)
 #define GUM_ATTACH_TO_API_FUNC_WITH_DATA(name, data) \
     attach_to_function (self, GUM_FUNCPTR_TO_POINTER (api->name), \
         &gum_##name##_handlers, data)
@@ -588,6 +594,19 @@ gum_allocator_probe_attach_to_apis (GumAllocatorProbe * self,
       GUM_ATTACH_TO_API_FUNC_WITH_DATA (_free_dbg,
           GUM_FUNCPTR_TO_POINTER (api->_CrtReportBlockType));
     }
+
+    GUM_ATTACH_TO_API_FUNC_AS (mallocx, malloc);
+    GUM_ATTACH_TO_API_FUNC_AS (rallocx, realloc);
+    GUM_ATTACH_TO_API_FUNC_AS (dallocx, free);
+    GUM_ATTACH_TO_API_FUNC_AS (sdallocx, free);
+
+    GUM_ATTACH_TO_API_FUNC_AS (free_sized, free);
+    GUM_ATTACH_TO_API_FUNC_AS (operator_new, malloc);
+    GUM_ATTACH_TO_API_FUNC_AS (operator_new_array, malloc);
+    GUM_ATTACH_TO_API_FUNC_AS (operator_delete, free);
+    GUM_ATTACH_TO_API_FUNC_AS (operator_delete_array, free);
+    GUM_ATTACH_TO_API_FUNC_AS (operator_delete_sized, free);
+    GUM_ATTACH_TO_API_FUNC_AS (operator_delete_array_sized, free);
   }
 
   gum_allocator_probe_apply_default_suppressions (self);
@@ -614,6 +633,7 @@ gum_allocator_probe_detach (GumAllocatorProbe * self)
   }
 
   g_ptr_array_set_size (self->function_contexts, 0);
+  g_hash_table_remove_all (self->attached_functions);
 
   self->malloc_count = 0;
   self->realloc_count = 0;
@@ -631,6 +651,16 @@ attach_to_function (GumAllocatorProbe * self,
   GumInvocationListener * listener = GUM_INVOCATION_LISTENER (self);
   FunctionContext * function_ctx;
 
+  /*
+   * Optional entry points may be missing, and allocators commonly alias one
+   * entry point to another, e.g. free and sdallocx, or list the same libc
+   * functions as another API. Each function is only attached to once.
+   */
+  if (function_address == NULL ||
+      g_hash_table_contains (self->attached_functions, function_address))
+    return;
+  g_hash_table_add (self->attached_functions, function_address);
+
   function_ctx = g_new0 (FunctionContext, 1);
   function_ctx->handlers = *function_handlers;
   function_ctx->handler_data = user_data;
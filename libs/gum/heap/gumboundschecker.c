@@ -17,8 +17,7 @@
 #define DEFAULT_POOL_SIZE       4096
 #define DEFAULT_FRONT_ALIGNMENT   16
 
-#define GUM_BOUNDS_CHECKER_LOCK() g_mutex_lock (&self->mutex)
-#define GUM_BOUNDS_CHECKER_UNLOCK() g_mutex_unlock (&self->mutex)
+typedef struct _GumBoundsSampler GumBoundsSampler;
 
 #define BLOCK_ALLOC_RETADDRS(b) \
     ((GumReturnAddressArray *) (b)->guard)
@@ -31,8 +30,6 @@ struct _GumBoundsChecker
 
   gboolean disposed;
 
-  GMutex mutex;
-
   GumBacktracerInterface * backtracer_iface;
   GumBacktracer * backtracer_instance;
   GumBoundsOutputFunc output;
@@ -46,20 +43,29 @@ struct _GumBoundsChecker
   volatile gboolean handled_invalid_access;
 
   guint pool_size;
+  guint max_pool_size;
   guint front_alignment;
+  volatile guint sample_rate;
   GumPagePool * page_pool;
 };
 
+struct _GumBoundsSampler
+{
+  guint countdown;
+  guint32 seed;
+};
+
 enum
 {
   PROP_0,
   PROP_BACKTRACER,
   PROP_POOL_SIZE,
-  PROP_FRONT_ALIGNMENT
+  PROP_MAX_POOL_SIZE,
+  PROP_FRONT_ALIGNMENT,
+  PROP_SAMPLE_RATE
 };
 
 static void gum_bounds_checker_dispose (GObject * object);
-static void gum_bounds_checker_finalize (GObject * object);
 
 static void gum_bounds_checker_get_property (GObject * object,
     guint property_id, GValue * value, GParamSpec * pspec);
@@ -72,6 +78,9 @@ static gpointer replacement_realloc (gpointer old_address,
     gsize new_size);
 static void replacement_free (gpointer address);
 
+static gboolean gum_bounds_checker_should_guard (GumBoundsChecker * self);
+static guint gum_bounds_sampler_next_countdown (GumBoundsSampler * sampler,
+    guint rate);
 static gpointer gum_bounds_checker_try_alloc (GumBoundsChecker * self,
     guint size, GumInvocationContext * ctx);
 static gboolean gum_bounds_checker_try_free (GumBoundsChecker * self,
@@ -84,13 +93,14 @@ static void gum_bounds_checker_append_backtrace (
 
 G_DEFINE_TYPE (GumBoundsChecker, gum_bounds_checker, G_TYPE_OBJECT)
 
+static GPrivate gum_bounds_sampler = G_PRIVATE_INIT (g_free);
+
 static void
 gum_bounds_checker_class_init (GumBoundsCheckerClass * klass)
 {
   GObjectClass * object_class = G_OBJECT_CLASS (klass);
 
   object_class->dispose = gum_bounds_checker_dispose;
-  object_class->finalize = gum_bounds_checker_finalize;
   object_class->get_property = gum_bounds_checker_get_property;
   object_class->set_property = gum_bounds_checker_set_property;
 
@@ -105,24 +115,35 @@ gum_bounds_checker_class_init (GumBoundsCheckerClass * klass)
       2, G_MAXUINT, DEFAULT_POOL_SIZE,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_MAX_POOL_SIZE,
+      g_param_spec_uint ("max-pool-size", "Max Pool Size",
+      "Pool size in number of pages to grow up to, zero to never grow",
+      0, G_MAXUINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (object_class, PROP_FRONT_ALIGNMENT,
       g_param_spec_uint ("front-alignment", "Front Alignment",
       "Front alignment requirement",
       1, 64, DEFAULT_FRONT_ALIGNMENT,
       G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  g_object_class_install_property (object_class, PROP_SAMPLE_RATE,
+      g_param_spec_uint ("sample-rate", "Sample Rate",
+      "Guard about one in this many allocations, zero to guard all",
+      0, G_MAXUINT, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 static void
 gum_bounds_checker_init (GumBoundsChecker * self)
 {
-  g_mutex_init (&self->mutex);
-
   self->interceptor = gum_interceptor_obtain ();
   self->exceptor = gum_exceptor_obtain ();
   self->pool_size = DEFAULT_POOL_SIZE;
   self->front_alignment = DEFAULT_FRONT_ALIGNMENT;
 
-  gum_exceptor_add (self->exceptor, gum_bounds_checker_on_exception, self);
+  gum_exceptor_add_full (self->exceptor, gum_bounds_checker_on_exception,
+      self, FALSE);
 }
 
 static void
@@ -150,16 +171,6 @@ gum_bounds_checker_dispose (GObject * object)
   G_OBJECT_CLASS (gum_bounds_checker_parent_class)->dispose (object);
 }
 
-static void
-gum_bounds_checker_finalize (GObject * object)
-{
-  GumBoundsChecker * self = GUM_BOUNDS_CHECKER (object);
-
-  g_mutex_clear (&self->mutex);
-
-  G_OBJECT_CLASS (gum_bounds_checker_parent_class)->finalize (object);
-}
-
 static void
 gum_bounds_checker_get_property (GObject * object,
                                  guint property_id,
@@ -176,9 +187,15 @@ gum_bounds_checker_get_property (GObject * object,
     case PROP_POOL_SIZE:
       g_value_set_uint (value, gum_bounds_checker_get_pool_size (self));
       break;
+    case PROP_MAX_POOL_SIZE:
+      g_value_set_uint (value, gum_bounds_checker_get_max_pool_size (self));
+      break;
     case PROP_FRONT_ALIGNMENT:
       g_value_set_uint (value, gum_bounds_checker_get_front_alignment (self));
       break;
+    case PROP_SAMPLE_RATE:
+      g_value_set_uint (value, gum_bounds_checker_get_sample_rate (self));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -213,9 +230,15 @@ gum_bounds_checker_set_property (GObject * object,
     case PROP_POOL_SIZE:
       gum_bounds_checker_set_pool_size (self, g_value_get_uint (value));
       break;
+    case PROP_MAX_POOL_SIZE:
+      gum_bounds_checker_set_max_pool_size (self, g_value_get_uint (value));
+      break;
     case PROP_FRONT_ALIGNMENT:
       gum_bounds_checker_set_front_alignment (self, g_value_get_uint (value));
       break;
+    case PROP_SAMPLE_RATE:
+      gum_bounds_checker_set_sample_rate (self, g_value_get_uint (value));
+      break;
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
   }
@@ -252,6 +275,20 @@ gum_bounds_checker_set_pool_size (GumBoundsChecker * self,
   self->pool_size = pool_size;
 }
 
+guint
+gum_bounds_checker_get_max_pool_size (GumBoundsChecker * self)
+{
+  return self->max_pool_size;
+}
+
+void
+gum_bounds_checker_set_max_pool_size (GumBoundsChecker * self,
+                                      guint max_pool_size)
+{
+  g_assert (self->page_pool == NULL);
+  self->max_pool_size = max_pool_size;
+}
+
 guint
 gum_bounds_checker_get_front_alignment (GumBoundsChecker * self)
 {
@@ -266,6 +303,24 @@ gum_bounds_checker_set_front_alignment (GumBoundsChecker * self,
   self->front_alignment = pool_size;
 }
 
+guint
+gum_bounds_checker_get_sample_rate (GumBoundsChecker * self)
+{
+  return self->sample_rate;
+}
+
+/*
+ * Puts only about one in `rate` allocations on guard pages, leaving the rest
+ * to the original allocator, so overflows are still caught given enough
+ * traffic at a fraction of the cost. May be changed while attached.
+ */
+void
+gum_bounds_checker_set_sample_rate (GumBoundsChecker * self,
+                                    guint rate)
+{
+  self->sample_rate = rate;
+}
+
 void
 gum_bounds_checker_attach (GumBoundsChecker * self)
 {
@@ -286,7 +341,9 @@ gum_bounds_checker_attach_to_apis (GumBoundsChecker * self,
   g_assert (self->page_pool == NULL);
   self->page_pool = gum_page_pool_new (GUM_PROTECT_MODE_ABOVE,
       self->pool_size);
-  g_object_set (self->page_pool, "front-alignment", self->front_alignment,
+  g_object_set (self->page_pool,
+      "max-size", self->max_pool_size,
+      "front-alignment", self->front_alignment,
       NULL);
 
   gum_interceptor_begin_transaction (self->interceptor);
@@ -363,12 +420,11 @@ replacement_malloc (gsize size)
   ctx = gum_interceptor_get_current_invocation ();
   self = GUM_RINCTX_GET_FUNC_DATA (ctx, GumBoundsChecker *);
 
-  if (self->detaching || self->handled_invalid_access)
+  if (self->detaching || self->handled_invalid_access ||
+      !gum_bounds_checker_should_guard (self))
     goto fallback;
 
-  GUM_BOUNDS_CHECKER_LOCK ();
   result = gum_bounds_checker_try_alloc (self, MAX (size, 1), ctx);
-  GUM_BOUNDS_CHECKER_UNLOCK ();
   if (result == NULL)
     goto fallback;
 
@@ -389,12 +445,11 @@ replacement_calloc (gsize num,
   ctx = gum_interceptor_get_current_invocation ();
   self = GUM_RINCTX_GET_FUNC_DATA (ctx, GumBoundsChecker *);
 
-  if (self->detaching || self->handled_invalid_access)
+  if (self->detaching || self->handled_invalid_access ||
+      !gum_bounds_checker_should_guard (self))
     goto fallback;
 
-  GUM_BOUNDS_CHECKER_LOCK ();
   result = gum_bounds_checker_try_alloc (self, MAX (num * size, 1), ctx);
-  GUM_BOUNDS_CHECKER_UNLOCK ();
   if (result != NULL)
     gum_memset (result, 0, num * size);
   else
@@ -430,29 +485,19 @@ replacement_realloc (gpointer old_address,
   if (self->detaching || self->handled_invalid_access)
     goto fallback;
 
-  GUM_BOUNDS_CHECKER_LOCK ();
-
   if (!gum_page_pool_query_block_details (self->page_pool, old_address,
       &old_block))
-  {
-    GUM_BOUNDS_CHECKER_UNLOCK ();
-
     goto fallback;
-  }
 
   result = gum_bounds_checker_try_alloc (self, new_size, ctx);
 
-  GUM_BOUNDS_CHECKER_UNLOCK ();
-
   if (result == NULL)
     result = malloc (new_size);
 
   if (result != NULL)
     gum_memcpy (result, old_address, MIN (old_block.size, new_size));
 
-  GUM_BOUNDS_CHECKER_LOCK ();
   gum_bounds_checker_try_free (self, old_address, ctx);
-  GUM_BOUNDS_CHECKER_UNLOCK ();
 
   return result;
 
@@ -470,14 +515,55 @@ replacement_free (gpointer address)
   ctx = gum_interceptor_get_current_invocation ();
   self = GUM_RINCTX_GET_FUNC_DATA (ctx, GumBoundsChecker *);
 
-  GUM_BOUNDS_CHECKER_LOCK ();
   freed = gum_bounds_checker_try_free (self, address, ctx);
-  GUM_BOUNDS_CHECKER_UNLOCK ();
 
   if (!freed)
     free (address);
 }
 
+static gboolean
+gum_bounds_checker_should_guard (GumBoundsChecker * self)
+{
+  guint rate;
+  GumBoundsSampler * sampler;
+
+  rate = self->sample_rate;
+  if (rate <= 1)
+    return TRUE;
+
+  sampler = g_private_get (&gum_bounds_sampler);
+  if (sampler == NULL)
+  {
+    sampler = g_new (GumBoundsSampler, 1);
+    sampler->seed = (guint32) (GPOINTER_TO_SIZE (&sampler) ^
+        (gsize) g_get_monotonic_time ()) | 1;
+    sampler->countdown = gum_bounds_sampler_next_countdown (sampler, rate);
+
+    g_private_set (&gum_bounds_sampler, sampler);
+  }
+
+  if (--sampler->countdown != 0)
+    return FALSE;
+
+  sampler->countdown = gum_bounds_sampler_next_countdown (sampler, rate);
+
+  return TRUE;
+}
+
+static guint
+gum_bounds_sampler_next_countdown (GumBoundsSampler * sampler,
+                                   guint rate)
+{
+  guint32 x = sampler->seed;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sampler->seed = x;
+
+  return 1 + (x % MIN ((guint64) rate * 2, G_MAXUINT32));
+}
+
 static gpointer
 gum_bounds_checker_try_alloc (GumBoundsChecker * self,
                               guint size,
@@ -513,16 +599,17 @@ gum_bounds_checker_try_free (GumBoundsChecker * self,
                              gpointer address,
                              GumInvocationContext * ctx)
 {
-  gboolean freed;
+  GumBlockDetails block;
 
-  freed = gum_page_pool_try_free (self->page_pool, address);
+  if (!gum_page_pool_query_block_details (self->page_pool, address, &block))
+    return FALSE;
 
-  if (freed && self->backtracer_instance != NULL)
+  /*
+   * Record where it was freed while the block is still ours, as its pages
+   * may be handed to another thread as soon as they are released.
+   */
+  if (block.allocated && self->backtracer_instance != NULL)
   {
-    GumBlockDetails block;
-
-    gum_page_pool_query_block_details (self->page_pool, address, &block);
-
     gum_mprotect (block.guard, block.guard_size, GUM_PAGE_RW);
 
     g_assert_cmpuint (block.guard_size / 2,
@@ -533,7 +620,7 @@ gum_bounds_checker_try_free (GumBoundsChecker * self,
     gum_mprotect (block.guard, block.guard_size, GUM_PAGE_NO_ACCESS);
   }
 
-  return freed;
+  return gum_page_pool_try_free (self->page_pool, address);
 }
 
 static gboolean
@@ -8,12 +8,27 @@
 
 #include "gumcobject.h"
 #include "guminterceptor.h"
+#include "gumstacktable.h"
 
 #include <stdlib.h>
 #include <string.h>
 
+/*
+ * Live objects are spread across shards by address, each with its own lock,
+ * and per-type counts are maintained atomically. An object only costs a small
+ * record unless a backtracer was given, in which case its backtrace is
+ * interned in a stack table and shared with every other object constructed
+ * from the same call site. GumCObjects are only materialized when a list is
+ * peeked. Each record also remembers its snapshot generation so that two
+ * snapshots can be compared without copying the live set at either point.
+ */
+
 #define GUM_COBJECT_TRACKER_CAST(o) ((GumCObjectTracker *) (o))
 
+#define GUM_COBJECT_TRACKER_N_SHARDS 16
+
+typedef struct _GumCObjectTrackerShard GumCObjectTrackerShard;
+typedef struct _GumCObjectRecord       GumCObjectRecord;
 typedef struct _ObjectType             ObjectType;
 typedef struct _CObjectFunctionContext CObjectFunctionContext;
 typedef struct _CObjectThreadContext   CObjectThreadContext;
@@ -26,15 +41,23 @@ typedef void (* CObjectLeaveHandler) (GumCObjectTracker * self,
     gpointer handler_context, CObjectThreadContext * thread_context,
     GumInvocationContext * invocation_context);
 
+struct _GumCObjectTrackerShard
+{
+  GMutex mutex;
+  GHashTable * objects_ht;
+};
+
 struct _GumCObjectTracker
 {
   GObject parent;
 
   gboolean disposed;
 
-  GMutex mutex;
   GHashTable * types_ht;
-  GHashTable * objects_ht;
+  volatile gint object_count;
+  volatile gint generation;
+  GumCObjectTrackerShard shards[GUM_COBJECT_TRACKER_N_SHARDS];
+  GumStackTable * stacks;
   GumInterceptor * interceptor;
   GPtrArray * function_contexts;
 
@@ -48,10 +71,17 @@ enum
   PROP_BACKTRACER,
 };
 
+struct _GumCObjectRecord
+{
+  ObjectType * type;
+  guint generation;
+  GumStackId stack;
+};
+
 struct _ObjectType
 {
   gchar * name;
-  guint count;
+  volatile gint count;
 };
 
 struct _CObjectHandlers
@@ -71,8 +101,8 @@ struct _CObjectFunctionContext
   gpointer context;
 };
 
-#define GUM_COBJECT_TRACKER_LOCK() g_mutex_lock (&self->mutex)
-#define GUM_COBJECT_TRACKER_UNLOCK() g_mutex_unlock (&self->mutex)
+#define GUM_COBJECT_TRACKER_SHARD_LOCK(s) g_mutex_lock (&(s)->mutex)
+#define GUM_COBJECT_TRACKER_SHARD_UNLOCK(s) g_mutex_unlock (&(s)->mutex)
 
 static void gum_cobject_tracker_listener_iface_init (gpointer g_iface,
     gpointer iface_data);
@@ -86,8 +116,14 @@ static void gum_cobject_tracker_finalize (GObject * object);
 static ObjectType * object_type_new (const gchar * name);
 static void object_type_free (ObjectType * t);
 
+static void gum_cobject_record_free (GumCObjectRecord * record);
+
+static GumCObjectTrackerShard * gum_cobject_tracker_get_shard (
+    GumCObjectTracker * self, gconstpointer address);
+static GList * gum_cobject_tracker_collect_objects (GumCObjectTracker * self,
+    guint from_generation, guint to_generation);
 static void gum_cobject_tracker_add_object (GumCObjectTracker * self,
-    GumCObject * cobject);
+    gpointer address, ObjectType * object_type, GumStackId stack);
 static void gum_cobject_tracker_maybe_remove_object (GumCObjectTracker * self,
     gpointer address);
 
@@ -161,13 +197,21 @@ static const CObjectHandlers g_slice_free1_cobject_handlers =
 static void
 gum_cobject_tracker_init (GumCObjectTracker * self)
 {
-  g_mutex_init (&self->mutex);
+  guint i;
 
   self->types_ht = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, (GDestroyNotify) object_type_free);
 
-  self->objects_ht = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-      NULL, (GDestroyNotify) gum_cobject_free);
+  for (i = 0; i != GUM_COBJECT_TRACKER_N_SHARDS; i++)
+  {
+    GumCObjectTrackerShard * shard = &self->shards[i];
+
+    g_mutex_init (&shard->mutex);
+    shard->objects_ht = g_hash_table_new_full (NULL, NULL, NULL,
+        (GDestroyNotify) gum_cobject_record_free);
+  }
+
+  self->stacks = gum_stack_table_new ();
 
   self->interceptor = gum_interceptor_obtain ();
 
@@ -241,6 +285,8 @@ gum_cobject_tracker_dispose (GObject * object)
 
   if (!self->disposed)
   {
+    guint i;
+
     self->disposed = TRUE;
 
     gum_interceptor_detach_listener (self->interceptor,
@@ -251,8 +297,15 @@ gum_cobject_tracker_dispose (GObject * object)
     g_clear_object (&self->backtracer_instance);
     self->backtracer_iface = NULL;
 
-    g_hash_table_unref (self->objects_ht);
-    self->objects_ht = NULL;
+    for (i = 0; i != GUM_COBJECT_TRACKER_N_SHARDS; i++)
+    {
+      GumCObjectTrackerShard * shard = &self->shards[i];
+
+      g_hash_table_unref (shard->objects_ht);
+      shard->objects_ht = NULL;
+    }
+
+    g_clear_object (&self->stacks);
 
     g_hash_table_unref (self->types_ht);
     self->types_ht = NULL;
@@ -265,11 +318,13 @@ static void
 gum_cobject_tracker_finalize (GObject * object)
 {
   GumCObjectTracker * self = GUM_COBJECT_TRACKER (object);
+  guint i;
 
   g_ptr_array_foreach (self->function_contexts, (GFunc) g_free, NULL);
   g_ptr_array_free (self->function_contexts, TRUE);
 
-  g_mutex_clear (&self->mutex);
+  for (i = 0; i != GUM_COBJECT_TRACKER_N_SHARDS; i++)
+    g_mutex_clear (&self->shards[i].mutex);
 
   G_OBJECT_CLASS (gum_cobject_tracker_parent_class)->finalize (object);
 }
@@ -326,9 +381,6 @@ gum_cobject_tracker_peek_total_count (GumCObjectTracker * self,
 {
   guint result;
 
-  GUM_COBJECT_TRACKER_LOCK ();
-  gum_interceptor_ignore_current_thread (self->interceptor);
-
   if (type_name != NULL)
   {
     ObjectType * object_type;
@@ -336,35 +388,81 @@ gum_cobject_tracker_peek_total_count (GumCObjectTracker * self,
     object_type = g_hash_table_lookup (self->types_ht, type_name);
     g_assert (object_type != NULL);
 
-    result = object_type->count;
+    result = g_atomic_int_get (&object_type->count);
   }
   else
   {
-    result = g_hash_table_size (self->objects_ht);
+    result = g_atomic_int_get (&self->object_count);
   }
 
-  gum_interceptor_unignore_current_thread (self->interceptor);
-  GUM_COBJECT_TRACKER_UNLOCK ();
-
   return result;
 }
 
 GList *
 gum_cobject_tracker_peek_object_list (GumCObjectTracker * self)
 {
-  GList * result = NULL, * cur;
+  return gum_cobject_tracker_collect_objects (self, 0, G_MAXUINT);
+}
+
+/*
+ * Starts a new generation and returns the one that just ended, so that
+ * gum_cobject_tracker_peek_object_list_between() can later list the objects
+ * constructed between two snapshots that are still alive.
+ */
+guint
+gum_cobject_tracker_take_snapshot (GumCObjectTracker * self)
+{
+  return g_atomic_int_add (&self->generation, 1);
+}
+
+GList *
+gum_cobject_tracker_peek_object_list_between (GumCObjectTracker * self,
+                                              guint from_snapshot,
+                                              guint to_snapshot)
+{
+  return gum_cobject_tracker_collect_objects (self, from_snapshot + 1,
+      to_snapshot);
+}
+
+static GList *
+gum_cobject_tracker_collect_objects (GumCObjectTracker * self,
+                                     guint from_generation,
+                                     guint to_generation)
+{
+  GList * result = NULL;
+  guint i;
 
-  GUM_COBJECT_TRACKER_LOCK ();
   gum_interceptor_ignore_current_thread (self->interceptor);
 
-  result = g_hash_table_get_values (self->objects_ht);
-  for (cur = result; cur != NULL; cur = cur->next)
+  for (i = 0; i != GUM_COBJECT_TRACKER_N_SHARDS; i++)
   {
-    cur->data = gum_cobject_copy ((GumCObject *) cur->data);
+    GumCObjectTrackerShard * shard = &self->shards[i];
+    GHashTableIter iter;
+    gpointer address;
+    GumCObjectRecord * record;
+
+    GUM_COBJECT_TRACKER_SHARD_LOCK (shard);
+
+    g_hash_table_iter_init (&iter, shard->objects_ht);
+    while (g_hash_table_iter_next (&iter, &address, (gpointer *) &record))
+    {
+      GumCObject * cobject;
+
+      if (record->generation < from_generation ||
+          record->generation > to_generation)
+        continue;
+
+      cobject = gum_cobject_new (address, record->type->name);
+      gum_stack_table_lookup (self->stacks, record->stack,
+          &cobject->return_addresses);
+
+      result = g_list_prepend (result, cobject);
+    }
+
+    GUM_COBJECT_TRACKER_SHARD_UNLOCK (shard);
   }
 
   gum_interceptor_unignore_current_thread (self->interceptor);
-  GUM_COBJECT_TRACKER_UNLOCK ();
 
   return result;
 }
@@ -387,37 +485,81 @@ object_type_free (ObjectType * t)
   g_free (t);
 }
 
+static void
+gum_cobject_record_free (GumCObjectRecord * record)
+{
+  g_slice_free (GumCObjectRecord, record);
+}
+
+static GumCObjectTrackerShard *
+gum_cobject_tracker_get_shard (GumCObjectTracker * self,
+                               gconstpointer address)
+{
+  gsize a = GPOINTER_TO_SIZE (address);
+
+  return &self->shards[((a >> 4) ^ (a >> 12)) &
+      (GUM_COBJECT_TRACKER_N_SHARDS - 1)];
+}
+
 static void
 gum_cobject_tracker_add_object (GumCObjectTracker * self,
-                                GumCObject * cobject)
+                                gpointer address,
+                                ObjectType * object_type,
+                                GumStackId stack)
 {
-  ObjectType * object_type = cobject->data;
+  GumCObjectTrackerShard * shard;
+  GumCObjectRecord * record, * stale_record;
+  ObjectType * stale_type = NULL;
 
-  GUM_COBJECT_TRACKER_LOCK ();
+  record = g_slice_new (GumCObjectRecord);
+  record->type = object_type;
+  record->generation = g_atomic_int_get (&self->generation);
+  record->stack = stack;
 
-  g_hash_table_insert (self->objects_ht, cobject->address, cobject);
-  object_type->count++;
+  shard = gum_cobject_tracker_get_shard (self, address);
 
-  GUM_COBJECT_TRACKER_UNLOCK ();
+  GUM_COBJECT_TRACKER_SHARD_LOCK (shard);
+
+  stale_record = g_hash_table_lookup (shard->objects_ht, address);
+  if (stale_record != NULL)
+    stale_type = stale_record->type;
+  g_hash_table_insert (shard->objects_ht, address, record);
+
+  GUM_COBJECT_TRACKER_SHARD_UNLOCK (shard);
+
+  if (stale_type != NULL)
+    g_atomic_int_add (&stale_type->count, -1);
+  else
+    g_atomic_int_inc (&self->object_count);
+  g_atomic_int_inc (&object_type->count);
 }
 
 static void
 gum_cobject_tracker_maybe_remove_object (GumCObjectTracker * self,
                                          gpointer address)
 {
-  GumCObject * cobject;
+  GumCObjectTrackerShard * shard;
+  GumCObjectRecord * record;
+  ObjectType * object_type = NULL;
 
-  GUM_COBJECT_TRACKER_LOCK ();
+  shard = gum_cobject_tracker_get_shard (self, address);
 
-  cobject = g_hash_table_lookup (self->objects_ht, address);
-  if (cobject != NULL)
+  GUM_COBJECT_TRACKER_SHARD_LOCK (shard);
+
+  record = g_hash_table_lookup (shard->objects_ht, address);
+  if (record != NULL)
   {
-    ObjectType * object_type = cobject->data;
-    object_type->count--;
-    g_hash_table_remove (self->objects_ht, address);
+    object_type = record->type;
+    g_hash_table_remove (shard->objects_ht, address);
   }
 
-  GUM_COBJECT_TRACKER_UNLOCK ();
+  GUM_COBJECT_TRACKER_SHARD_UNLOCK (shard);
+
+  if (object_type != NULL)
+  {
+    g_atomic_int_add (&object_type->count, -1);
+    g_atomic_int_add (&self->object_count, -1);
+  }
 }
 
 static void
@@ -479,18 +621,19 @@ on_constructor_enter_handler (GumCObjectTracker * self,
                               CObjectThreadContext * thread_context,
                               GumInvocationContext * invocation_context)
 {
-  GumCObject * cobject;
-
-  cobject = gum_cobject_new (NULL, object_type->name);
-  cobject->data = object_type;
+  GumStackId stack = GUM_STACK_ID_NONE;
 
   if (self->backtracer_instance != NULL)
   {
+    GumReturnAddressArray return_addresses;
+
     self->backtracer_iface->generate (self->backtracer_instance,
-        invocation_context->cpu_context, &cobject->return_addresses);
+        invocation_context->cpu_context, &return_addresses);
+
+    stack = gum_stack_table_intern (self->stacks, &return_addresses);
   }
 
-  thread_context->data = cobject;
+  thread_context->data = GUINT_TO_POINTER (stack);
 }
 
 static void
@@ -499,11 +642,9 @@ on_constructor_leave_handler (GumCObjectTracker * self,
                               CObjectThreadContext * thread_context,
                               GumInvocationContext * invocation_context)
 {
-  GumCObject * cobject = (GumCObject *) thread_context->data;
-
-  cobject->address =
-      gum_invocation_context_get_return_value (invocation_context);
-  gum_cobject_tracker_add_object (self, cobject);
+  gum_cobject_tracker_add_object (self,
+      gum_invocation_context_get_return_value (invocation_context),
+      object_type, GPOINTER_TO_UINT (thread_context->data));
 }
 
 static void
@@ -30,6 +30,10 @@ GUM_API guint gum_cobject_tracker_peek_total_count (GumCObjectTracker * self,
     const gchar * type_name);
 GUM_API GList * gum_cobject_tracker_peek_object_list (GumCObjectTracker * self);
 
+GUM_API guint gum_cobject_tracker_take_snapshot (GumCObjectTracker * self);
+GUM_API GList * gum_cobject_tracker_peek_object_list_between (
+    GumCObjectTracker * self, guint from_snapshot, guint to_snapshot);
+
 G_END_DECLS
 
 #endif
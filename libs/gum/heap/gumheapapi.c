@@ -11,18 +11,68 @@
 #include <gmodule.h>
 #include <string.h>
 
-static gboolean gum_collect_heap_api_if_crt_module (
+typedef struct _GumHeapApiDescriptor GumHeapApiDescriptor;
+
+typedef enum
+{
+  GUM_HEAP_API_STANDARD = 1 << 0,
+  GUM_HEAP_API_JEMALLOC = 1 << 1,
+  GUM_HEAP_API_CXX      = 1 << 2,
+} GumHeapApiKind;
+
+struct _GumHeapApiDescriptor
+{
+  const gchar * module_prefix;
+  guint kinds;
+};
+
+static gboolean gum_collect_heap_api_if_known_module (
     const GumModuleDetails * details, gpointer user_data);
+static guint gum_heap_api_kinds_from_module_name (const gchar * name);
 static void gum_init_field_from_module_symbol (gpointer * field,
     GModule * module, const gchar * name);
 
+#if GLIB_SIZEOF_SIZE_T == 8
+# define GUM_CXX_SIZE_T_MANGLED "m"
+#else
+# define GUM_CXX_SIZE_T_MANGLED "j"
+#endif
+
+/*
+ * Modules whose heap entry points we know how to find. Replacement
+ * allocators typically also export the standard functions, which may or may
+ * not end up being the ones libc resolves to, so we pick those up as well.
+ * Calls made by one of these into another, e.g. operator new calling malloc,
+ * are only reported once, as the probe ignores calls made while already
+ * inside one it is tracking.
+ */
+static const GumHeapApiDescriptor gum_heap_api_descriptors[] =
+{
+#if defined (G_OS_WIN32)
+  { "msvcr",         GUM_HEAP_API_STANDARD },
+#elif defined (HAVE_DARWIN)
+  { "libSystem.B",   GUM_HEAP_API_STANDARD },
+  { "libc++.",       GUM_HEAP_API_CXX },
+#else
+  { "libc.so",       GUM_HEAP_API_STANDARD },
+  { "libstdc++.so",  GUM_HEAP_API_CXX },
+  { "libc++.so",     GUM_HEAP_API_CXX },
+#endif
+#ifndef G_OS_WIN32
+  { "libjemalloc",   GUM_HEAP_API_STANDARD | GUM_HEAP_API_JEMALLOC |
+                     GUM_HEAP_API_CXX },
+  { "libtcmalloc",   GUM_HEAP_API_STANDARD | GUM_HEAP_API_CXX },
+  { "libmimalloc",   GUM_HEAP_API_STANDARD | GUM_HEAP_API_CXX },
+#endif
+};
+
 GumHeapApiList *
 gum_process_find_heap_apis (void)
 {
   GumHeapApiList * list;
 
   list = gum_heap_api_list_new ();
-  gum_process_enumerate_modules (gum_collect_heap_api_if_crt_module, list);
+  gum_process_enumerate_modules (gum_collect_heap_api_if_known_module, list);
 
   return list;
 }
@@ -30,34 +80,34 @@ gum_process_find_heap_apis (void)
 #define GUM_API_INIT_FIELD(name) \
     gum_init_field_from_module_symbol ((gpointer *) &api.name, module, \
         G_STRINGIFY (name))
+#define GUM_API_INIT_FIELD_FROM_SYMBOL(name, symbol) \
+    gum_init_field_from_module_symbol ((gpointer *) &api.name, module, symbol)
 
 static gboolean
-gum_collect_heap_api_if_crt_module (const GumModuleDetails * details,
-                                    gpointer user_data)
+gum_collect_heap_api_if_known_module (const GumModuleDetails * details,
+                                      gpointer user_data)
 {
   const gchar * name = details->name;
   GumHeapApiList * list = (GumHeapApiList *) user_data;
-  gboolean is_libc_module;
+  guint kinds;
+  GumHeapApi api = { 0, };
+  GModule * module;
 
-#if defined (G_OS_WIN32)
-  is_libc_module = g_ascii_strncasecmp (name, "msvcr", 5) == 0;
-#elif defined (HAVE_DARWIN)
-  is_libc_module = g_ascii_strncasecmp (name, "libSystem.B", 11) == 0;
-#else
-  is_libc_module = strcmp (name, "libc.so") == 0;
-#endif
+  kinds = gum_heap_api_kinds_from_module_name (name);
+  if (kinds == 0)
+    return TRUE;
 
-  if (is_libc_module)
-  {
-    GumHeapApi api = { 0, };
-    GModule * module;
-
-    module = g_module_open (details->path, (GModuleFlags) 0);
+  module = g_module_open (details->path, (GModuleFlags) 0);
+  if (module == NULL)
+    return TRUE;
 
+  if ((kinds & GUM_HEAP_API_STANDARD) != 0)
+  {
     GUM_API_INIT_FIELD (malloc);
     GUM_API_INIT_FIELD (calloc);
     GUM_API_INIT_FIELD (realloc);
     GUM_API_INIT_FIELD (free);
+    GUM_API_INIT_FIELD (free_sized);
 
 #ifdef G_OS_WIN32
     if (g_str_has_suffix (name, "d.dll"))
@@ -69,15 +119,58 @@ gum_collect_heap_api_if_crt_module (const GumModuleDetails * details,
       GUM_API_INIT_FIELD (_CrtReportBlockType);
     }
 #endif
+  }
 
-    g_module_close (module);
+  if ((kinds & GUM_HEAP_API_JEMALLOC) != 0)
+  {
+    GUM_API_INIT_FIELD (mallocx);
+    GUM_API_INIT_FIELD (rallocx);
+    GUM_API_INIT_FIELD (dallocx);
+    GUM_API_INIT_FIELD (sdallocx);
+  }
 
-    gum_heap_api_list_add (list, &api);
+#ifndef G_OS_WIN32
+  if ((kinds & GUM_HEAP_API_CXX) != 0)
+  {
+    GUM_API_INIT_FIELD_FROM_SYMBOL (operator_new,
+        "_Znw" GUM_CXX_SIZE_T_MANGLED);
+    GUM_API_INIT_FIELD_FROM_SYMBOL (operator_new_array,
+        "_Zna" GUM_CXX_SIZE_T_MANGLED);
+    GUM_API_INIT_FIELD_FROM_SYMBOL (operator_delete, "_ZdlPv");
+    GUM_API_INIT_FIELD_FROM_SYMBOL (operator_delete_array, "_ZdaPv");
+    GUM_API_INIT_FIELD_FROM_SYMBOL (operator_delete_sized,
+        "_ZdlPv" GUM_CXX_SIZE_T_MANGLED);
+    GUM_API_INIT_FIELD_FROM_SYMBOL (operator_delete_array_sized,
+        "_ZdaPv" GUM_CXX_SIZE_T_MANGLED);
   }
+#endif
+
+  g_module_close (module);
+
+  gum_heap_api_list_add (list, &api);
 
   return TRUE;
 }
 
+static guint
+gum_heap_api_kinds_from_module_name (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (gum_heap_api_descriptors); i++)
+  {
+    const GumHeapApiDescriptor * d = &gum_heap_api_descriptors[i];
+
+    if (g_ascii_strncasecmp (name, d->module_prefix,
+        strlen (d->module_prefix)) == 0)
+    {
+      return d->kinds;
+    }
+  }
+
+  return 0;
+}
+
 static void
 gum_init_field_from_module_symbol (gpointer * field,
                                    GModule * module,
@@ -28,6 +28,21 @@ struct _GumHeapApi
       gint block_type, const gchar * filename, gint linenumber);
   void (* _free_dbg) (gpointer address, gint block_type);
   gint (* _CrtReportBlockType) (gpointer block);
+
+  /* for jemalloc's non-standard API: */
+  gpointer (* mallocx) (gsize size, gint flags);
+  gpointer (* rallocx) (gpointer address, gsize size, gint flags);
+  void (* dallocx) (gpointer address, gint flags);
+  void (* sdallocx) (gpointer address, gsize size, gint flags);
+
+  /* for C++ and sized deallocation: */
+  void (* free_sized) (gpointer address, gsize size);
+  gpointer (* operator_new) (gsize size);
+  gpointer (* operator_new_array) (gsize size);
+  void (* operator_delete) (gpointer address);
+  void (* operator_delete_array) (gpointer address);
+  void (* operator_delete_sized) (gpointer address, gsize size);
+  void (* operator_delete_array_sized) (gpointer address, gsize size);
 };
 
 G_BEGIN_DECLS
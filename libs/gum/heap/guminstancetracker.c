@@ -11,7 +11,25 @@
 
 #include <gmodule.h>
 
+/*
+ * Instances are spread across shards by address, each with its own lock and
+ * its own per-type counters, so threads creating and destroying instances
+ * concurrently rarely contend. Each instance remembers the snapshot
+ * generation it was born in, which lets two snapshots be compared by walking
+ * the survivors born between them, without copying the live set up front.
+ */
+
+#define GUM_INSTANCE_TRACKER_N_SHARDS 16
+
 typedef enum _FunctionId FunctionId;
+typedef struct _GumInstanceTrackerShard GumInstanceTrackerShard;
+
+struct _GumInstanceTrackerShard
+{
+  GMutex mutex;
+  GHashTable * counter_ht;
+  GHashTable * instances_ht;
+};
 
 struct _GumInstanceTracker
 {
@@ -19,9 +37,9 @@ struct _GumInstanceTracker
 
   gboolean disposed;
 
-  GMutex mutex;
-  GHashTable * counter_ht;
-  GHashTable * instances_ht;
+  volatile gint instance_count;
+  volatile gint generation;
+  GumInstanceTrackerShard shards[GUM_INSTANCE_TRACKER_N_SHARDS];
   GumInterceptor * interceptor;
 
   gboolean is_active;
@@ -37,19 +55,28 @@ enum _FunctionId
   FUNCTION_ID_FREE_INSTANCE
 };
 
-#define GUM_INSTANCE_TRACKER_LOCK() g_mutex_lock (&self->mutex)
-#define GUM_INSTANCE_TRACKER_UNLOCK() g_mutex_unlock (&self->mutex)
+#define GUM_INSTANCE_TRACKER_SHARD_LOCK(s) g_mutex_lock (&(s)->mutex)
+#define GUM_INSTANCE_TRACKER_SHARD_UNLOCK(s) g_mutex_unlock (&(s)->mutex)
 
-#define COUNTER_TABLE_GET(gtype) GPOINTER_TO_UINT (g_hash_table_lookup (\
-    self->counter_ht, GUINT_TO_POINTER (gtype)))
-#define COUNTER_TABLE_SET(gtype, count) g_hash_table_insert (\
-    self->counter_ht, GUINT_TO_POINTER (gtype), GUINT_TO_POINTER (count))
+#define COUNTER_TABLE_GET(s, gtype) GPOINTER_TO_UINT (g_hash_table_lookup (\
+    (s)->counter_ht, GSIZE_TO_POINTER (gtype)))
+#define COUNTER_TABLE_SET(s, gtype, count) g_hash_table_insert (\
+    (s)->counter_ht, GSIZE_TO_POINTER (gtype), GUINT_TO_POINTER (count))
 
 static void gum_instance_tracker_listener_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_instance_tracker_dispose (GObject * object);
 static void gum_instance_tracker_finalize (GObject * object);
 
+static GumInstanceTrackerShard * gum_instance_tracker_get_shard (
+    GumInstanceTracker * self, gconstpointer instance);
+static void gum_instance_tracker_walk_shards (GumInstanceTracker * self,
+    guint from_snapshot, guint to_snapshot, GumWalkInstanceFunc func,
+    gpointer user_data);
+static guint gum_instance_tracker_walk_shard (GumInstanceTracker * self,
+    GumInstanceTrackerShard * shard, guint from_generation,
+    guint to_generation, GumWalkInstanceFunc func, gpointer user_data);
+
 static void gum_instance_tracker_on_enter (GumInvocationListener * listener,
     GumInvocationContext * context);
 static void gum_instance_tracker_on_leave (GumInvocationListener * listener,
@@ -84,14 +111,16 @@ gum_instance_tracker_listener_iface_init (gpointer g_iface,
 static void
 gum_instance_tracker_init (GumInstanceTracker * self)
 {
-  g_mutex_init (&self->mutex);
+  guint i;
 
-  self->counter_ht = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-      NULL, NULL);
-  g_assert (self->counter_ht != NULL);
+  for (i = 0; i != GUM_INSTANCE_TRACKER_N_SHARDS; i++)
+  {
+    GumInstanceTrackerShard * shard = &self->shards[i];
 
-  self->instances_ht = g_hash_table_new_full (g_direct_hash, g_direct_equal,
-      NULL, NULL);
+    g_mutex_init (&shard->mutex);
+    shard->counter_ht = g_hash_table_new (NULL, NULL);
+    shard->instances_ht = g_hash_table_new (NULL, NULL);
+  }
 
   self->interceptor = gum_interceptor_obtain ();
 }
@@ -103,6 +132,8 @@ gum_instance_tracker_dispose (GObject * object)
 
   if (!self->disposed)
   {
+    guint i;
+
     self->disposed = TRUE;
 
     if (self->is_active)
@@ -110,11 +141,16 @@ gum_instance_tracker_dispose (GObject * object)
 
     g_object_unref (self->interceptor);
 
-    g_hash_table_unref (self->counter_ht);
-    self->counter_ht = NULL;
+    for (i = 0; i != GUM_INSTANCE_TRACKER_N_SHARDS; i++)
+    {
+      GumInstanceTrackerShard * shard = &self->shards[i];
+
+      g_hash_table_unref (shard->counter_ht);
+      shard->counter_ht = NULL;
 
-    g_hash_table_unref (self->instances_ht);
-    self->instances_ht = NULL;
+      g_hash_table_unref (shard->instances_ht);
+      shard->instances_ht = NULL;
+    }
   }
 
   G_OBJECT_CLASS (gum_instance_tracker_parent_class)->dispose (object);
@@ -124,8 +160,10 @@ static void
 gum_instance_tracker_finalize (GObject * object)
 {
   GumInstanceTracker * self = GUM_INSTANCE_TRACKER (object);
+  guint i;
 
-  g_mutex_clear (&self->mutex);
+  for (i = 0; i != GUM_INSTANCE_TRACKER_N_SHARDS; i++)
+    g_mutex_clear (&self->shards[i].mutex);
 
   G_OBJECT_CLASS (gum_instance_tracker_parent_class)->finalize (object);
 }
@@ -249,16 +287,21 @@ gum_instance_tracker_peek_total_count (GumInstanceTracker * self,
 
     if (gtype != 0)
     {
-      GUM_INSTANCE_TRACKER_LOCK ();
-      result = COUNTER_TABLE_GET (gtype);
-      GUM_INSTANCE_TRACKER_UNLOCK ();
+      guint i;
+
+      for (i = 0; i != GUM_INSTANCE_TRACKER_N_SHARDS; i++)
+      {
+        GumInstanceTrackerShard * shard = &self->shards[i];
+
+        GUM_INSTANCE_TRACKER_SHARD_LOCK (shard);
+        result += COUNTER_TABLE_GET (shard, gtype);
+        GUM_INSTANCE_TRACKER_SHARD_UNLOCK (shard);
+      }
     }
   }
   else
   {
-    GUM_INSTANCE_TRACKER_LOCK ();
-    result = g_hash_table_size (self->instances_ht);
-    GUM_INSTANCE_TRACKER_UNLOCK ();
+    result = g_atomic_int_get (&self->instance_count);
   }
 
   return result;
@@ -267,11 +310,18 @@ gum_instance_tracker_peek_total_count (GumInstanceTracker * self,
 GList *
 gum_instance_tracker_peek_instances (GumInstanceTracker * self)
 {
-  GList * result;
+  GList * result = NULL;
+  guint i;
 
-  GUM_INSTANCE_TRACKER_LOCK ();
-  result = g_hash_table_get_keys (self->instances_ht);
-  GUM_INSTANCE_TRACKER_UNLOCK ();
+  for (i = 0; i != GUM_INSTANCE_TRACKER_N_SHARDS; i++)
+  {
+    GumInstanceTrackerShard * shard = &self->shards[i];
+
+    GUM_INSTANCE_TRACKER_SHARD_LOCK (shard);
+    result = g_list_concat (g_hash_table_get_keys (shard->instances_ht),
+        result);
+    GUM_INSTANCE_TRACKER_SHARD_UNLOCK (shard);
+  }
 
   return result;
 }
@@ -281,21 +331,100 @@ gum_instance_tracker_walk_instances (GumInstanceTracker * self,
                                      GumWalkInstanceFunc func,
                                      gpointer user_data)
 {
+  gum_instance_tracker_walk_shards (self, 0, G_MAXUINT, func, user_data);
+}
+
+/*
+ * Starts a new generation and returns the one that just ended. Instances
+ * created from here on belong to later generations, so passing two results
+ * of this function to gum_instance_tracker_walk_instances_between() visits
+ * the instances created between the two calls that are still alive.
+ */
+guint
+gum_instance_tracker_take_snapshot (GumInstanceTracker * self)
+{
+  return g_atomic_int_add (&self->generation, 1);
+}
+
+void
+gum_instance_tracker_walk_instances_between (GumInstanceTracker * self,
+                                             guint from_snapshot,
+                                             guint to_snapshot,
+                                             GumWalkInstanceFunc func,
+                                             gpointer user_data)
+{
+  gum_instance_tracker_walk_shards (self, from_snapshot + 1, to_snapshot,
+      func, user_data);
+}
+
+/*
+ * Walks the instances of one or more shards, starting at `*position`, until
+ * at least `max_instances` have been visited or every shard has been. See
+ * gum_allocation_tracker_peek_block_list_step() for how `*position` is used.
+ */
+gboolean
+gum_instance_tracker_walk_instances_step (GumInstanceTracker * self,
+                                          guint * position,
+                                          guint max_instances,
+                                          GumWalkInstanceFunc func,
+                                          gpointer user_data)
+{
+  guint visited = 0;
+
+  while (*position < GUM_INSTANCE_TRACKER_N_SHARDS && visited < max_instances)
+  {
+    visited += gum_instance_tracker_walk_shard (self,
+        &self->shards[*position], 0, G_MAXUINT, func, user_data);
+    (*position)++;
+  }
+
+  return *position < GUM_INSTANCE_TRACKER_N_SHARDS;
+}
+
+static void
+gum_instance_tracker_walk_shards (GumInstanceTracker * self,
+                                  guint from_generation,
+                                  guint to_generation,
+                                  GumWalkInstanceFunc func,
+                                  gpointer user_data)
+{
+  guint i;
+
+  for (i = 0; i != GUM_INSTANCE_TRACKER_N_SHARDS; i++)
+  {
+    gum_instance_tracker_walk_shard (self, &self->shards[i], from_generation,
+        to_generation, func, user_data);
+  }
+}
+
+static guint
+gum_instance_tracker_walk_shard (GumInstanceTracker * self,
+                                 GumInstanceTrackerShard * shard,
+                                 guint from_generation,
+                                 guint to_generation,
+                                 GumWalkInstanceFunc func,
+                                 gpointer user_data)
+{
+  guint visited = 0;
+  GType gobject_type;
   GHashTableIter iter;
   gpointer key, value;
-  GType gobject_type;
 
   gobject_type = G_TYPE_OBJECT;
 
-  GUM_INSTANCE_TRACKER_LOCK ();
+  GUM_INSTANCE_TRACKER_SHARD_LOCK (shard);
 
-  g_hash_table_iter_init (&iter, self->instances_ht);
+  g_hash_table_iter_init (&iter, shard->instances_ht);
   while (g_hash_table_iter_next (&iter, &key, &value))
   {
     const GTypeInstance * instance = (const GTypeInstance *) key;
+    guint generation = GPOINTER_TO_UINT (value);
     GType type;
     GumInstanceDetails details;
 
+    if (generation < from_generation || generation > to_generation)
+      continue;
+
     type = G_TYPE_FROM_INSTANCE (instance);
 
     details.address = instance;
@@ -306,9 +435,12 @@ gum_instance_tracker_walk_instances (GumInstanceTracker * self,
     details.type_name = self->vtable.type_id_to_name (type);
 
     func (&details, user_data);
+    visited++;
   }
 
-  GUM_INSTANCE_TRACKER_UNLOCK ();
+  GUM_INSTANCE_TRACKER_SHARD_UNLOCK (shard);
+
+  return visited;
 }
 
 void
@@ -316,7 +448,8 @@ gum_instance_tracker_add_instance (GumInstanceTracker * self,
                                    gpointer instance,
                                    GType instance_type)
 {
-  guint count;
+  GumInstanceTrackerShard * shard;
+  guint generation, count;
 
   if (instance_type == G_TYPE_FROM_INSTANCE (self))
     return;
@@ -330,15 +463,21 @@ gum_instance_tracker_add_instance (GumInstanceTracker * self,
     }
   }
 
-  GUM_INSTANCE_TRACKER_LOCK ();
+  shard = gum_instance_tracker_get_shard (self, instance);
+  generation = g_atomic_int_get (&self->generation);
+
+  GUM_INSTANCE_TRACKER_SHARD_LOCK (shard);
 
-  g_assert (g_hash_table_lookup (self->instances_ht, instance) == NULL);
-  g_hash_table_add (self->instances_ht, instance);
+  g_assert (!g_hash_table_contains (shard->instances_ht, instance));
+  g_hash_table_insert (shard->instances_ht, instance,
+      GUINT_TO_POINTER (generation));
 
-  count = COUNTER_TABLE_GET (instance_type);
-  COUNTER_TABLE_SET (instance_type, count + 1);
+  count = COUNTER_TABLE_GET (shard, instance_type);
+  COUNTER_TABLE_SET (shard, instance_type, count + 1);
 
-  GUM_INSTANCE_TRACKER_UNLOCK ();
+  GUM_INSTANCE_TRACKER_SHARD_UNLOCK (shard);
+
+  g_atomic_int_inc (&self->instance_count);
 }
 
 void
@@ -346,18 +485,38 @@ gum_instance_tracker_remove_instance (GumInstanceTracker * self,
                                       gpointer instance,
                                       GType instance_type)
 {
+  GumInstanceTrackerShard * shard;
+  gboolean removed;
   guint count;
 
-  GUM_INSTANCE_TRACKER_LOCK ();
+  shard = gum_instance_tracker_get_shard (self, instance);
+
+  GUM_INSTANCE_TRACKER_SHARD_LOCK (shard);
 
-  if (g_hash_table_remove (self->instances_ht, instance))
+  removed = g_hash_table_remove (shard->instances_ht, instance);
+  if (removed)
   {
-    count = COUNTER_TABLE_GET (instance_type);
-    if (count > 0)
-      COUNTER_TABLE_SET (instance_type, count - 1);
+    count = COUNTER_TABLE_GET (shard, instance_type);
+    if (count > 1)
+      COUNTER_TABLE_SET (shard, instance_type, count - 1);
+    else
+      g_hash_table_remove (shard->counter_ht, GSIZE_TO_POINTER (instance_type));
   }
 
-  GUM_INSTANCE_TRACKER_UNLOCK ();
+  GUM_INSTANCE_TRACKER_SHARD_UNLOCK (shard);
+
+  if (removed)
+    g_atomic_int_add (&self->instance_count, -1);
+}
+
+static GumInstanceTrackerShard *
+gum_instance_tracker_get_shard (GumInstanceTracker * self,
+                                gconstpointer instance)
+{
+  gsize a = GPOINTER_TO_SIZE (instance);
+
+  return &self->shards[((a >> 4) ^ (a >> 12)) &
+      (GUM_INSTANCE_TRACKER_N_SHARDS - 1)];
 }
 
 static void
@@ -57,6 +57,14 @@ GUM_API guint gum_instance_tracker_peek_total_count (GumInstanceTracker * self,
 GUM_API GList * gum_instance_tracker_peek_instances (GumInstanceTracker * self);
 GUM_API void gum_instance_tracker_walk_instances (GumInstanceTracker * self,
     GumWalkInstanceFunc func, gpointer user_data);
+GUM_API gboolean gum_instance_tracker_walk_instances_step (
+    GumInstanceTracker * self, guint * position, guint max_instances,
+    GumWalkInstanceFunc func, gpointer user_data);
+
+GUM_API guint gum_instance_tracker_take_snapshot (GumInstanceTracker * self);
+GUM_API void gum_instance_tracker_walk_instances_between (
+    GumInstanceTracker * self, guint from_snapshot, guint to_snapshot,
+    GumWalkInstanceFunc func, gpointer user_data);
 
 /*< Internal API */
 void gum_instance_tracker_add_instance (GumInstanceTracker * self,
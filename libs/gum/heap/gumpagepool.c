@@ -13,6 +13,22 @@
 #define DEFAULT_POOL_SIZE       G_MAXUINT16
 #define DEFAULT_FRONT_ALIGNMENT 16
 
+/*
+ * The pool starts out as a single chunk of `size` pages and, if allowed to by
+ * `max-size`, grows by adding more chunks when it runs out. Chunks are kept
+ * sorted by address so the chunk owning an address is found with a binary
+ * search, and from there the page's block details are indexed directly.
+ *
+ * Allocations are first carved out of never-used pages after the cursor of
+ * the most recently used chunk. After that, freed spans are reused in the
+ * order they were freed, through per-size free lists, which keeps freed
+ * pages protected for as long as possible. Only when neither works do we
+ * fall back to scanning for free pages. Page protections are changed outside
+ * the lock so concurrent allocations only serialize on the bookkeeping.
+ */
+
+typedef struct _GumPageChunk      GumPageChunk;
+typedef struct _GumPageSpan       GumPageSpan;
 typedef struct _AlignmentCriteria AlignmentCriteria;
 typedef struct _TailAlignResult   TailAlignResult;
 
@@ -25,21 +41,39 @@ struct _GumPagePool
   guint page_size;
   GumProtectMode protect_mode;
   guint size;
+  guint max_size;
   guint front_alignment;
 
+  GMutex mutex;
+  guint total;
   guint available;
+  GPtrArray * chunks;
+  GumPageChunk * current;
+  GHashTable * free_spans;
+};
+
+struct _GumPageChunk
+{
+  guint8 * start;
+  guint8 * end;
+  guint n_pages;
   guint cur_offset;
-  guint8 * pool;
-  guint8 * pool_end;
   GumBlockDetails * block_details;
 };
 
+struct _GumPageSpan
+{
+  GumPageChunk * chunk;
+  guint start_index;
+};
+
 enum
 {
   PROP_0,
   PROP_PAGE_SIZE,
   PROP_PROTECT_MODE,
   PROP_SIZE,
+  PROP_MAX_SIZE,
   PROP_FRONT_ALIGNMENT
 };
 
@@ -56,6 +90,9 @@ struct _TailAlignResult
   gsize gap_size;
 };
 
+#define GUM_PAGE_POOL_LOCK() g_mutex_lock (&self->mutex)
+#define GUM_PAGE_POOL_UNLOCK() g_mutex_unlock (&self->mutex)
+
 static void gum_page_pool_constructed (GObject * object);
 static void gum_page_pool_finalize (GObject * object);
 static void gum_page_pool_get_property (GObject * object,
@@ -63,17 +100,26 @@ static void gum_page_pool_get_property (GObject * object,
 static void gum_page_pool_set_property (GObject * object,
     guint property_id, const GValue * value, GParamSpec * pspec);
 
-static gint find_start_index_with_n_free_pages (GumPagePool * self,
+static GumPageChunk * gum_page_pool_add_chunk (GumPagePool * self,
+    guint n_pages);
+static void gum_page_chunk_free (GumPageChunk * chunk);
+static GumPageChunk * gum_page_pool_find_chunk (GumPagePool * self,
+    const guint8 * p);
+
+static gboolean gum_page_pool_find_free_span (GumPagePool * self,
+    guint n_pages, GumPageSpan * span);
+static gboolean gum_page_pool_pop_free_span (GumPagePool * self,
+    guint n_pages, GumPageSpan * span);
+static void gum_page_pool_push_free_span (GumPagePool * self,
+    guint n_pages, const GumPageSpan * span);
+
+static gint find_start_index_with_n_free_pages (GumPageChunk * chunk,
+    guint first_index, guint n_pages);
+static gboolean span_is_free (GumPageChunk * chunk, guint start_index,
     guint n_pages);
-static gint find_start_index_for_address (GumPagePool * self, const guint8 * p);
 
 static guint num_pages_needed_for (GumPagePool * self, guint size);
 
-static gpointer claim_n_pages_at (GumPagePool * self, guint n_pages,
-    guint start_index);
-static gpointer release_n_pages_at (GumPagePool * self, guint n_pages,
-    guint start_index);
-
 static void tail_align (gpointer ptr, gsize size,
     const AlignmentCriteria * criteria, TailAlignResult * result);
 
@@ -104,6 +150,12 @@ gum_page_pool_class_init (GumPagePoolClass * klass)
       MIN_POOL_SIZE, MAX_POOL_SIZE, DEFAULT_POOL_SIZE,
       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY | G_PARAM_STATIC_STRINGS));
 
+  g_object_class_install_property (object_class, PROP_MAX_SIZE,
+      g_param_spec_uint ("max-size", "Max Size",
+      "Size in number of pages to grow up to, zero to never grow",
+      0, MAX_POOL_SIZE, 0,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
   g_object_class_install_property (object_class, PROP_FRONT_ALIGNMENT,
       g_param_spec_uint ("front-alignment", "Front Alignment",
       "Front alignment requirement",
@@ -118,6 +170,8 @@ gum_page_pool_init (GumPagePool * self)
   self->protect_mode = DEFAULT_PROTECT_MODE;
   self->size = DEFAULT_POOL_SIZE;
   self->front_alignment = DEFAULT_FRONT_ALIGNMENT;
+
+  g_mutex_init (&self->mutex);
 }
 
 static void
@@ -125,10 +179,12 @@ gum_page_pool_constructed (GObject * object)
 {
   GumPagePool * self = GUM_PAGE_POOL (object);
 
-  self->available = self->size;
-  self->pool = gum_alloc_n_pages (self->size, GUM_PAGE_NO_ACCESS);
-  self->pool_end = self->pool + (self->size * self->page_size);
-  self->block_details = g_malloc0 (self->size * sizeof (GumBlockDetails));
+  self->chunks = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_page_chunk_free);
+  self->free_spans = g_hash_table_new_full (NULL, NULL, NULL,
+      (GDestroyNotify) g_array_unref);
+
+  self->current = gum_page_pool_add_chunk (self, self->size);
 }
 
 static void
@@ -136,8 +192,10 @@ gum_page_pool_finalize (GObject * object)
 {
   GumPagePool * self = GUM_PAGE_POOL (object);
 
-  g_free (self->block_details);
-  gum_free_pages (self->pool);
+  g_hash_table_unref (self->free_spans);
+  g_ptr_array_unref (self->chunks);
+
+  g_mutex_clear (&self->mutex);
 
   G_OBJECT_CLASS (gum_page_pool_parent_class)->finalize (object);
 }
@@ -161,6 +219,9 @@ gum_page_pool_get_property (GObject * object,
     case PROP_SIZE:
       g_value_set_uint (value, self->size);
       break;
+    case PROP_MAX_SIZE:
+      g_value_set_uint (value, self->max_size);
+      break;
     case PROP_FRONT_ALIGNMENT:
       g_value_set_uint (value, self->front_alignment);
       break;
@@ -185,6 +246,9 @@ gum_page_pool_set_property (GObject * object,
     case PROP_SIZE:
       self->size = g_value_get_uint (value);
       break;
+    case PROP_MAX_SIZE:
+      self->max_size = g_value_get_uint (value);
+      break;
     case PROP_FRONT_ALIGNMENT:
       self->front_alignment = g_value_get_uint (value);
       break;
@@ -207,62 +271,97 @@ gpointer
 gum_page_pool_try_alloc (GumPagePool * self,
                          guint size)
 {
-  gpointer result = NULL;
   guint n_pages;
+  GumPageSpan span;
+  guint8 * page_start;
+  AlignmentCriteria align_criteria;
+  TailAlignResult align_result;
+  guint i;
 
   g_assert (size != 0);
 
   n_pages = num_pages_needed_for (self, size);
 
-  if (n_pages <= self->available)
-  {
-    gint start_index;
+  GUM_PAGE_POOL_LOCK ();
 
-    start_index = find_start_index_with_n_free_pages (self, n_pages);
-    if (start_index >= 0)
-    {
-      guint8 * page_start;
-      AlignmentCriteria align_criteria;
-      TailAlignResult align_result;
-      guint i;
+  if (!gum_page_pool_find_free_span (self, n_pages, &span))
+  {
+    GUM_PAGE_POOL_UNLOCK ();
+    return NULL;
+  }
 
-      page_start = claim_n_pages_at (self, n_pages, start_index);
+  page_start = span.chunk->start + (span.start_index * self->page_size);
 
-      align_criteria.front = self->front_alignment;
-      align_criteria.tail = self->page_size;
-      tail_align (page_start, size, &align_criteria, &align_result);
+  align_criteria.front = self->front_alignment;
+  align_criteria.tail = self->page_size;
+  tail_align (page_start, size, &align_criteria, &align_result);
 
-      for (i = start_index; i < start_index + n_pages; i++)
-      {
-        GumBlockDetails * details = &self->block_details[i];
+  for (i = span.start_index; i != span.start_index + n_pages; i++)
+  {
+    GumBlockDetails * details = &span.chunk->block_details[i];
 
-        details->address = align_result.aligned_ptr;
-        details->size = size;
+    details->address = align_result.aligned_ptr;
+    details->size = size;
 
-        details->guard = page_start + ((n_pages - 1) * self->page_size);
-        details->guard_size = self->page_size;
-      }
+    details->guard = page_start + ((n_pages - 1) * self->page_size);
+    details->guard_size = self->page_size;
 
-      result = align_result.aligned_ptr;
-    }
+    details->allocated = TRUE;
   }
 
-  return result;
+  self->current = span.chunk;
+  span.chunk->cur_offset = MAX (span.chunk->cur_offset,
+      span.start_index + n_pages);
+  self->available -= n_pages;
+
+  GUM_PAGE_POOL_UNLOCK ();
+
+  gum_mprotect (page_start, (n_pages - 1) * self->page_size,
+      GUM_PAGE_READ | GUM_PAGE_WRITE);
+
+  return align_result.aligned_ptr;
 }
 
 gboolean
 gum_page_pool_try_free (GumPagePool * self,
                         gpointer mem)
 {
-  gint start_index;
-  guint n_pages;
+  GumPageChunk * chunk;
+  GumPageSpan span;
+  guint n_pages, i;
+  gpointer start_address;
+
+  GUM_PAGE_POOL_LOCK ();
 
-  start_index = find_start_index_for_address (self, mem);
-  if (start_index < 0)
+  chunk = gum_page_pool_find_chunk (self, mem);
+  if (chunk == NULL)
+  {
+    GUM_PAGE_POOL_UNLOCK ();
     return FALSE;
+  }
+
+  span.chunk = chunk;
+  span.start_index = ((guint8 *) mem - chunk->start) / self->page_size;
+  n_pages = num_pages_needed_for (self,
+      chunk->block_details[span.start_index].size);
+  n_pages = MIN (n_pages, chunk->n_pages - span.start_index);
 
-  n_pages = num_pages_needed_for (self, self->block_details[start_index].size);
-  release_n_pages_at (self, n_pages, start_index);
+  GUM_PAGE_POOL_UNLOCK ();
+
+  start_address = chunk->start + (span.start_index * self->page_size);
+  gum_mprotect (start_address, (n_pages - 1) * self->page_size,
+      GUM_PAGE_NO_ACCESS);
+
+  GUM_PAGE_POOL_LOCK ();
+
+  for (i = span.start_index; i != span.start_index + n_pages; i++)
+    chunk->block_details[i].allocated = FALSE;
+
+  self->available += n_pages;
+
+  gum_page_pool_push_free_span (self, n_pages, &span);
+
+  GUM_PAGE_POOL_UNLOCK ();
 
   return TRUE;
 }
@@ -270,22 +369,47 @@ gum_page_pool_try_free (GumPagePool * self,
 guint
 gum_page_pool_peek_available (GumPagePool * self)
 {
-  return self->available;
+  guint available;
+
+  GUM_PAGE_POOL_LOCK ();
+  available = self->available;
+  GUM_PAGE_POOL_UNLOCK ();
+
+  return available;
 }
 
 guint
 gum_page_pool_peek_used (GumPagePool * self)
 {
-  return self->size - self->available;
+  guint used;
+
+  GUM_PAGE_POOL_LOCK ();
+  used = self->total - self->available;
+  GUM_PAGE_POOL_UNLOCK ();
+
+  return used;
 }
 
+/*
+ * Once the pool has grown the bounds span all of its chunks, which may have
+ * unrelated mappings in between.
+ */
 void
 gum_page_pool_get_bounds (GumPagePool * self,
                           guint8 ** lower,
                           guint8 ** upper)
 {
-  *lower = self->pool;
-  *upper = self->pool_end;
+  GumPageChunk * first, * last;
+
+  GUM_PAGE_POOL_LOCK ();
+
+  first = g_ptr_array_index (self->chunks, 0);
+  last = g_ptr_array_index (self->chunks, self->chunks->len - 1);
+
+  *lower = first->start;
+  *upper = last->end;
+
+  GUM_PAGE_POOL_UNLOCK ();
 }
 
 gboolean
@@ -293,31 +417,197 @@ gum_page_pool_query_block_details (GumPagePool * self,
                                    gconstpointer mem,
                                    GumBlockDetails * details)
 {
-  gint start_index;
+  GumPageChunk * chunk;
+
+  GUM_PAGE_POOL_LOCK ();
+
+  chunk = gum_page_pool_find_chunk (self, mem);
+  if (chunk != NULL)
+  {
+    *details = chunk->block_details[
+        ((const guint8 *) mem - chunk->start) / self->page_size];
+  }
+
+  GUM_PAGE_POOL_UNLOCK ();
+
+  return chunk != NULL;
+}
+
+static GumPageChunk *
+gum_page_pool_add_chunk (GumPagePool * self,
+                         guint n_pages)
+{
+  GumPageChunk * chunk;
+  guint i;
+
+  chunk = g_slice_new (GumPageChunk);
+  chunk->start = gum_alloc_n_pages (n_pages, GUM_PAGE_NO_ACCESS);
+  chunk->end = chunk->start + (n_pages * self->page_size);
+  chunk->n_pages = n_pages;
+  chunk->cur_offset = 0;
+  chunk->block_details = g_malloc0 (n_pages * sizeof (GumBlockDetails));
+
+  for (i = 0; i != self->chunks->len; i++)
+  {
+    GumPageChunk * other = g_ptr_array_index (self->chunks, i);
+
+    if (chunk->start < other->start)
+      break;
+  }
+  g_ptr_array_insert (self->chunks, i, chunk);
+
+  self->total += n_pages;
+  self->available += n_pages;
+
+  return chunk;
+}
+
+static void
+gum_page_chunk_free (GumPageChunk * chunk)
+{
+  g_free (chunk->block_details);
+  gum_free_pages (chunk->start);
+
+  g_slice_free (GumPageChunk, chunk);
+}
+
+static GumPageChunk *
+gum_page_pool_find_chunk (GumPagePool * self,
+                          const guint8 * p)
+{
+  guint lo, hi;
+
+  lo = 0;
+  hi = self->chunks->len;
+
+  while (lo != hi)
+  {
+    guint mid;
+    GumPageChunk * chunk;
+
+    mid = lo + ((hi - lo) / 2);
+    chunk = g_ptr_array_index (self->chunks, mid);
+
+    if (p < chunk->start)
+      hi = mid;
+    else if (p >= chunk->end)
+      lo = mid + 1;
+    else
+      return chunk;
+  }
+
+  return NULL;
+}
+
+static gboolean
+gum_page_pool_find_free_span (GumPagePool * self,
+                              guint n_pages,
+                              GumPageSpan * span)
+{
+  GumPageChunk * chunk = self->current;
+  guint limit, grow_by, i;
+
+  if (chunk->cur_offset + n_pages <= chunk->n_pages &&
+      span_is_free (chunk, chunk->cur_offset, n_pages))
+  {
+    span->chunk = chunk;
+    span->start_index = chunk->cur_offset;
+    return TRUE;
+  }
+
+  if (gum_page_pool_pop_free_span (self, n_pages, span))
+    return TRUE;
+
+  if (n_pages <= self->available)
+  {
+    for (i = 0; i != self->chunks->len; i++)
+    {
+      gint start_index;
 
-  start_index = find_start_index_for_address (self, mem);
-  if (start_index < 0)
+      chunk = g_ptr_array_index (self->chunks, i);
+
+      start_index = find_start_index_with_n_free_pages (chunk,
+          (chunk == self->current) ? chunk->cur_offset : 0, n_pages);
+      if (start_index >= 0)
+      {
+        span->chunk = chunk;
+        span->start_index = start_index;
+        return TRUE;
+      }
+    }
+  }
+
+  limit = MAX (self->max_size, self->size);
+  if (self->total + n_pages > limit)
     return FALSE;
+  grow_by = MIN (MAX (self->size, n_pages), limit - self->total);
+
+  span->chunk = gum_page_pool_add_chunk (self, grow_by);
+  span->start_index = 0;
 
-  *details = self->block_details[start_index];
   return TRUE;
 }
 
+static gboolean
+gum_page_pool_pop_free_span (GumPagePool * self,
+                             guint n_pages,
+                             GumPageSpan * span)
+{
+  GArray * spans;
+
+  spans = g_hash_table_lookup (self->free_spans, GUINT_TO_POINTER (n_pages));
+  if (spans == NULL)
+    return FALSE;
+
+  while (spans->len != 0)
+  {
+    *span = g_array_index (spans, GumPageSpan, 0);
+    g_array_remove_index (spans, 0);
+
+    if (span_is_free (span->chunk, span->start_index, n_pages))
+      return TRUE;
+  }
+
+  return FALSE;
+}
+
+static void
+gum_page_pool_push_free_span (GumPagePool * self,
+                              guint n_pages,
+                              const GumPageSpan * span)
+{
+  GArray * spans;
+
+  spans = g_hash_table_lookup (self->free_spans, GUINT_TO_POINTER (n_pages));
+  if (spans == NULL)
+  {
+    spans = g_array_new (FALSE, FALSE, sizeof (GumPageSpan));
+    g_hash_table_insert (self->free_spans, GUINT_TO_POINTER (n_pages), spans);
+  }
+
+  /*
+   * Spans reused through a scan stay listed until popped, so bound the list
+   * by how many such spans could possibly exist.
+   */
+  if (spans->len >= self->total / n_pages)
+    g_array_remove_index (spans, 0);
+
+  g_array_append_val (spans, *span);
+}
+
 static gint
-find_start_index_with_n_free_pages (GumPagePool * self,
+find_start_index_with_n_free_pages (GumPageChunk * chunk,
+                                    guint first_index,
                                     guint n_pages)
 {
   gint result = -1;
-  guint first_index;
   guint i, n;
 
-  first_index = self->cur_offset;
-
 start_over:
 
-  for (i = first_index, n = 0; i < self->size && n < n_pages; i++)
+  for (i = first_index, n = 0; i < chunk->n_pages && n < n_pages; i++)
   {
-    if (!self->block_details[i].allocated)
+    if (!chunk->block_details[i].allocated)
       n++;
     else
       n = 0;
@@ -336,14 +626,23 @@ start_over:
   return result;
 }
 
-static gint
-find_start_index_for_address (GumPagePool * self,
-                              const guint8 * p)
+static gboolean
+span_is_free (GumPageChunk * chunk,
+              guint start_index,
+              guint n_pages)
 {
-  if (p < self->pool || p > self->pool_end)
-    return -1;
+  guint i;
+
+  if (start_index + n_pages > chunk->n_pages)
+    return FALSE;
+
+  for (i = start_index; i != start_index + n_pages; i++)
+  {
+    if (chunk->block_details[i].allocated)
+      return FALSE;
+  }
 
-  return (p - self->pool) / self->page_size;
+  return TRUE;
 }
 
 static guint
@@ -359,56 +658,6 @@ num_pages_needed_for (GumPagePool * self,
   return n_pages;
 }
 
-#define POOL_ADDRESS_FROM_PAGE_INDEX(n) (self->pool + (n * self->page_size))
-
-static gpointer
-claim_n_pages_at (GumPagePool * self,
-                  guint n_pages,
-                  guint start_index)
-{
-  gpointer start_address;
-  guint i;
-
-  start_address = POOL_ADDRESS_FROM_PAGE_INDEX (start_index);
-
-  self->cur_offset = start_index + n_pages;
-  self->available -= n_pages;
-
-  for (i = start_index; i < start_index + n_pages; i++)
-  {
-    GumBlockDetails * details = &self->block_details[i];
-
-    details->allocated = TRUE;
-  }
-
-  gum_mprotect (start_address, (n_pages - 1) * self->page_size,
-      GUM_PAGE_READ | GUM_PAGE_WRITE);
-  return start_address;
-}
-
-static gpointer
-release_n_pages_at (GumPagePool * self,
-                    guint n_pages,
-                    guint start_index)
-{
-  gpointer start_address;
-  guint i;
-
-  self->available += n_pages;
-
-  for (i = start_index; i < start_index + n_pages; i++)
-  {
-    GumBlockDetails * details = &self->block_details[i];
-
-    details->allocated = FALSE;
-  }
-
-  start_address = POOL_ADDRESS_FROM_PAGE_INDEX (start_index);
-  gum_mprotect (start_address, n_pages - 1, GUM_PAGE_NO_ACCESS);
-
-  return start_address;
-}
-
 static void
 tail_align (gpointer ptr,
             gsize size,
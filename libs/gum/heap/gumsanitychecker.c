@@ -12,6 +12,7 @@
 #include "gumallocationgroup.h"
 #include "gumboundschecker.h"
 #include "guminstancetracker.h"
+#include "guminterceptor.h"
 #include "gummemory.h"
 
 #include <string.h>
@@ -30,6 +31,14 @@ struct _GumSanityCheckerPrivate
   GumAllocationTracker * alloc_tracker;
 
   GumBoundsChecker * bounds_checker;
+
+  gboolean instances_scanned;
+  guint instance_position;
+  GList * scanned_instances;
+
+  gboolean blocks_scanned;
+  guint block_position;
+  GList * scanned_blocks;
 };
 
 static gboolean gum_sanity_checker_filter_out_gparam (
@@ -38,6 +47,13 @@ static gboolean gum_sanity_checker_filter_backtrace_block_size (
     GumAllocationTracker * tracker, gpointer address, guint size,
     gpointer user_data);
 
+static gboolean gum_sanity_checker_report_leaks (GumSanityChecker * self,
+    GList * stale_instances, GList * stale_blocks);
+static void gum_sanity_checker_reset_scan (GumSanityChecker * self);
+static void gum_sanity_checker_append_instance (GumInstanceDetails * details,
+    gpointer user_data);
+static void gum_sanity_checker_free_instance_list (GList * instances);
+
 static void gum_sanity_checker_print_instance_leaks_summary (
     GumSanityChecker * self, GList * stale);
 static void gum_sanity_checker_print_instance_leaks_details (
@@ -50,9 +66,6 @@ static void gum_sanity_checker_print_block_leaks_details (
 static GHashTable * gum_sanity_checker_count_leaks_by_type_name (
     GumSanityChecker * self, GList * instances);
 
-static void gum_sanity_checker_details_from_instance (GumSanityChecker * self,
-    GumInstanceDetails * details, gconstpointer instance);
-
 static gint gum_sanity_checker_compare_type_names (gconstpointer a,
     gconstpointer b, gpointer user_data);
 static gint gum_sanity_checker_compare_instances (gconstpointer a,
@@ -108,6 +121,8 @@ gum_sanity_checker_destroy (GumSanityChecker * checker)
 {
   GumSanityCheckerPrivate * priv = checker->priv;
 
+  gum_sanity_checker_reset_scan (checker);
+
   g_clear_object (&priv->bounds_checker);
 
   g_clear_object (&priv->instance_tracker);
@@ -246,72 +261,175 @@ gum_sanity_checker_end (GumSanityChecker * self)
     priv->bounds_checker = NULL;
   }
 
-  if (priv->instance_tracker != NULL)
+  gum_sanity_checker_reset_scan (self);
+
+  if (priv->instance_tracker != NULL || priv->alloc_probe != NULL)
   {
-    GList * stale_instances;
+    GList * stale_instances = NULL;
+    GList * stale_blocks = NULL;
 
-    gum_instance_tracker_end (priv->instance_tracker);
+    if (priv->instance_tracker != NULL)
+    {
+      gum_instance_tracker_end (priv->instance_tracker);
 
-    stale_instances =
-        gum_instance_tracker_peek_instances (priv->instance_tracker);
+      gum_instance_tracker_walk_instances (priv->instance_tracker,
+          gum_sanity_checker_append_instance, &stale_instances);
+    }
 
-    if (stale_instances != NULL)
+    if (priv->alloc_probe != NULL)
     {
-      all_checks_passed = FALSE;
-
-      gum_sanity_checker_printf (self, "Instance leaks detected:\n\n");
-      gum_sanity_checker_print_instance_leaks_summary (self, stale_instances);
-      gum_sanity_checker_print (self, "\n");
-      gum_sanity_checker_print_instance_leaks_details (self, stale_instances);
+      gum_allocator_probe_detach (priv->alloc_probe);
 
-      g_list_free (stale_instances);
+      stale_blocks =
+          gum_allocation_tracker_peek_block_list (priv->alloc_tracker);
     }
 
-    g_object_unref (priv->instance_tracker);
-    priv->instance_tracker = NULL;
+    all_checks_passed =
+        gum_sanity_checker_report_leaks (self, stale_instances, stale_blocks);
+
+    gum_sanity_checker_free_instance_list (stale_instances);
+    gum_allocation_block_list_free (stale_blocks);
   }
 
-  if (priv->alloc_probe != NULL)
+  g_clear_object (&priv->instance_tracker);
+
+  g_clear_object (&priv->alloc_probe);
+  g_clear_object (&priv->alloc_tracker);
+
+  return all_checks_passed;
+}
+
+/*
+ * Performs a bounded slice of the leak checks while the checks started by
+ * gum_sanity_checker_begin() keep running, so leaks can be checked
+ * periodically from inside a live process. Each call visits roughly
+ * `max_items` instances or blocks, locking only a small part of the
+ * trackers at a time, and returns GUM_SANITY_CHECK_IN_PROGRESS until the
+ * whole heap has been walked. The call after that prints the leaks found,
+ * just like gum_sanity_checker_end() would, and returns the verdict. The
+ * next call then starts over.
+ */
+GumSanityCheckStatus
+gum_sanity_checker_check_step (GumSanityChecker * self,
+                               guint max_items)
+{
+  GumSanityCheckerPrivate * priv = self->priv;
+  GumSanityCheckStatus status = GUM_SANITY_CHECK_IN_PROGRESS;
+  GumInterceptor * interceptor;
+
+  /* Our own bookkeeping must not show up as leaks while the probe is on */
+  interceptor = gum_interceptor_obtain ();
+  gum_interceptor_ignore_current_thread (interceptor);
+
+  if (priv->instance_tracker != NULL && !priv->instances_scanned)
+  {
+    priv->instances_scanned = !gum_instance_tracker_walk_instances_step (
+        priv->instance_tracker, &priv->instance_position, max_items,
+        gum_sanity_checker_append_instance, &priv->scanned_instances);
+  }
+  else if (priv->alloc_tracker != NULL && !priv->blocks_scanned)
   {
-    GList * stale_blocks;
+    priv->blocks_scanned = !gum_allocation_tracker_peek_block_list_step (
+        priv->alloc_tracker, &priv->block_position, max_items,
+        &priv->scanned_blocks);
+  }
+  else
+  {
+    status = gum_sanity_checker_report_leaks (self, priv->scanned_instances,
+        priv->scanned_blocks)
+        ? GUM_SANITY_CHECK_PASSED
+        : GUM_SANITY_CHECK_FAILED;
 
-    gum_allocator_probe_detach (priv->alloc_probe);
+    gum_sanity_checker_reset_scan (self);
+  }
 
-    stale_blocks =
-        gum_allocation_tracker_peek_block_list (priv->alloc_tracker);
+  gum_interceptor_unignore_current_thread (interceptor);
+  g_object_unref (interceptor);
 
-    if (stale_blocks != NULL)
-    {
-      if (all_checks_passed)
-      {
-        GList * block_groups;
+  return status;
+}
 
-        block_groups =
-            gum_allocation_tracker_peek_block_groups (priv->alloc_tracker);
+static gboolean
+gum_sanity_checker_report_leaks (GumSanityChecker * self,
+                                 GList * stale_instances,
+                                 GList * stale_blocks)
+{
+  gboolean all_checks_passed = TRUE;
 
-        gum_sanity_checker_printf (self, "Block leaks detected:\n\n");
-        gum_sanity_checker_print_block_leaks_summary (self, block_groups);
-        gum_sanity_checker_print (self, "\n");
-        gum_sanity_checker_print_block_leaks_details (self, stale_blocks);
+  if (stale_instances != NULL)
+  {
+    all_checks_passed = FALSE;
 
-        gum_allocation_group_list_free (block_groups);
-      }
+    gum_sanity_checker_printf (self, "Instance leaks detected:\n\n");
+    gum_sanity_checker_print_instance_leaks_summary (self, stale_instances);
+    gum_sanity_checker_print (self, "\n");
+    gum_sanity_checker_print_instance_leaks_details (self, stale_instances);
+  }
 
-      all_checks_passed = FALSE;
+  if (stale_blocks != NULL)
+  {
+    if (all_checks_passed)
+    {
+      GList * block_groups;
 
-      gum_allocation_block_list_free (stale_blocks);
-    }
+      block_groups =
+          gum_allocation_tracker_peek_block_groups (self->priv->alloc_tracker);
 
-    g_object_unref (priv->alloc_probe);
-    priv->alloc_probe = NULL;
+      gum_sanity_checker_printf (self, "Block leaks detected:\n\n");
+      gum_sanity_checker_print_block_leaks_summary (self, block_groups);
+      gum_sanity_checker_print (self, "\n");
+      gum_sanity_checker_print_block_leaks_details (self, stale_blocks);
+
+      gum_allocation_group_list_free (block_groups);
+    }
 
-    g_object_unref (priv->alloc_tracker);
-    priv->alloc_tracker = NULL;
+    all_checks_passed = FALSE;
   }
 
   return all_checks_passed;
 }
 
+static void
+gum_sanity_checker_reset_scan (GumSanityChecker * self)
+{
+  GumSanityCheckerPrivate * priv = self->priv;
+
+  gum_sanity_checker_free_instance_list (priv->scanned_instances);
+  priv->scanned_instances = NULL;
+  priv->instance_position = 0;
+  priv->instances_scanned = FALSE;
+
+  gum_allocation_block_list_free (priv->scanned_blocks);
+  priv->scanned_blocks = NULL;
+  priv->block_position = 0;
+  priv->blocks_scanned = FALSE;
+}
+
+/*
+ * Instances are copied rather than referenced, as those still alive when a
+ * step scan is reporting may be freed by then.
+ */
+static void
+gum_sanity_checker_append_instance (GumInstanceDetails * details,
+                                    gpointer user_data)
+{
+  GList ** instances = (GList **) user_data;
+
+  *instances = g_list_prepend (*instances,
+      g_slice_dup (GumInstanceDetails, details));
+}
+
+static void
+gum_sanity_checker_free_instance_list (GList * instances)
+{
+  GList * cur;
+
+  for (cur = instances; cur != NULL; cur = cur->next)
+    g_slice_free (GumInstanceDetails, cur->data);
+
+  g_list_free (instances);
+}
+
 static gboolean
 gum_sanity_checker_filter_out_gparam (GumInstanceTracker * tracker,
                                       GType gtype,
@@ -382,15 +500,13 @@ gum_sanity_checker_print_instance_leaks_details (GumSanityChecker * self,
 
   for (cur = instances; cur != NULL; cur = cur->next)
   {
-    GumInstanceDetails details;
-
-    gum_sanity_checker_details_from_instance (self, &details, cur->data);
+    GumInstanceDetails * details = (GumInstanceDetails *) cur->data;
 
     gum_sanity_checker_printf (self, "\t%p\t%d%s\t%s\n",
-        details.address,
-        details.ref_count,
-        details.ref_count <= 9 ? "\t" : "",
-        details.type_name);
+        details->address,
+        details->ref_count,
+        details->ref_count <= 9 ? "\t" : "",
+        details->type_name);
   }
 
   g_list_free (instances);
@@ -475,20 +591,16 @@ gum_sanity_checker_count_leaks_by_type_name (GumSanityChecker * self,
                                              GList * instances)
 {
   GHashTable * count_by_type;
-  const GumInstanceVTable * vtable;
   GList * cur;
 
   count_by_type = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
 
-  vtable =
-      gum_instance_tracker_get_current_vtable (self->priv->instance_tracker);
-
   for (cur = instances; cur != NULL; cur = cur->next)
   {
     const gchar * type_name;
     guint count;
 
-    type_name = vtable->type_id_to_name (G_TYPE_FROM_INSTANCE (cur->data));
+    type_name = ((GumInstanceDetails *) cur->data)->type_name;
     count = GPOINTER_TO_UINT (g_hash_table_lookup (count_by_type,
         type_name));
     count++;
@@ -499,26 +611,6 @@ gum_sanity_checker_count_leaks_by_type_name (GumSanityChecker * self,
   return count_by_type;
 }
 
-static void
-gum_sanity_checker_details_from_instance (GumSanityChecker * self,
-                                          GumInstanceDetails * details,
-                                          gconstpointer instance)
-{
-  const GumInstanceVTable * vtable;
-  GType type;
-
-  vtable =
-      gum_instance_tracker_get_current_vtable (self->priv->instance_tracker);
-
-  details->address = instance;
-  type = G_TYPE_FROM_INSTANCE (instance);
-  details->type_name = vtable->type_id_to_name (type);
-  if (g_type_is_a (type, G_TYPE_OBJECT))
-    details->ref_count = ((GObject *) instance)->ref_count;
-  else
-    details->ref_count = 1;
-}
-
 static gint
 gum_sanity_checker_compare_type_names (gconstpointer a,
                                        gconstpointer b,
@@ -544,25 +636,22 @@ gum_sanity_checker_compare_instances (gconstpointer a,
                                       gconstpointer b,
                                       gpointer user_data)
 {
-  GumSanityChecker * self = (GumSanityChecker *) user_data;
-  GumInstanceDetails da, db;
+  const GumInstanceDetails * da = (const GumInstanceDetails *) a;
+  const GumInstanceDetails * db = (const GumInstanceDetails *) b;
   gint name_equality;
 
-  gum_sanity_checker_details_from_instance (self, &da, a);
-  gum_sanity_checker_details_from_instance (self, &db, b);
-
-  name_equality = strcmp (da.type_name, db.type_name);
+  name_equality = strcmp (da->type_name, db->type_name);
   if (name_equality != 0)
     return name_equality;
 
-  if (da.ref_count > db.ref_count)
+  if (da->ref_count > db->ref_count)
     return -1;
-  else if (da.ref_count < db.ref_count)
+  else if (da->ref_count < db->ref_count)
     return 1;
 
-  if (da.address > db.address)
+  if (da->address > db->address)
     return -1;
-  else if (da.address < db.address)
+  else if (da->address < db->address)
     return 1;
   else
     return 0;
@@ -10,6 +10,7 @@
 #include "gumheapapi.h"
 
 typedef guint GumSanityCheckFlags;
+typedef enum _GumSanityCheckStatus GumSanityCheckStatus;
 
 typedef struct _GumSanityChecker GumSanityChecker;
 typedef struct _GumSanityCheckerPrivate GumSanityCheckerPrivate;
@@ -24,6 +25,13 @@ enum _GumSanityCheckFlags
   GUM_CHECK_BOUNDS          = (1 << 2)
 };
 
+enum _GumSanityCheckStatus
+{
+  GUM_SANITY_CHECK_IN_PROGRESS,
+  GUM_SANITY_CHECK_PASSED,
+  GUM_SANITY_CHECK_FAILED
+};
+
 struct _GumSanityChecker
 {
   GumSanityCheckerPrivate * priv;
@@ -51,6 +59,9 @@ GUM_API gboolean gum_sanity_checker_run (GumSanityChecker * self,
 GUM_API void gum_sanity_checker_begin (GumSanityChecker * self, guint flags);
 GUM_API gboolean gum_sanity_checker_end (GumSanityChecker * self);
 
+GUM_API GumSanityCheckStatus gum_sanity_checker_check_step (
+    GumSanityChecker * self, guint max_items);
+
 G_END_DECLS
 
 #endif
@@ -11,6 +11,32 @@
 #include "gumsymbolutil.h"
 #include "gumtls.h"
 
+/*
+ * Each thread counts into its own counter, padded out to a cache line so that
+ * threads calling the same functions never write to a shared line, and the
+ * total is only summed up when asked for.
+ *
+ * By default calls are counted through a listener which ignores the current
+ * thread for the duration of the call, so calls made from inside a counted
+ * function are not counted. When nested calls are to be counted as well a
+ * bare interceptor probe is attached instead, which skips the invocation stack
+ * entirely and is therefore much cheaper. The listener is still used for
+ * functions that already have a probe. While a thread's counter is being
+ * created its key holds GUM_CALL_COUNTER_PENDING, so that counting malloc()
+ * does not recurse.
+ */
+
+#define GUM_CACHE_LINE_SIZE 64
+#define GUM_CALL_COUNTER_PENDING GSIZE_TO_POINTER (1)
+
+typedef struct _GumCallCounter GumCallCounter;
+
+struct _GumCallCounter
+{
+  volatile GumSample count;
+  gpointer allocation;
+};
+
 static void gum_call_count_sampler_sampler_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_call_count_sampler_listener_iface_init (gpointer g_iface,
@@ -24,6 +50,12 @@ static void gum_call_count_sampler_on_enter (
     GumInvocationListener * listener, GumInvocationContext * context);
 static void gum_call_count_sampler_on_leave (
     GumInvocationListener * listener, GumInvocationContext * context);
+static void gum_call_count_sampler_on_probe (GumCpuContext * cpu_context,
+    gpointer user_data);
+static GumCallCounter * gum_call_count_sampler_get_thread_counter (
+    GumCallCountSampler * self);
+
+static void gum_call_counter_free (GumCallCounter * counter);
 
 struct _GumCallCountSampler
 {
@@ -32,8 +64,8 @@ struct _GumCallCountSampler
   gboolean disposed;
 
   GumInterceptor * interceptor;
-
-  volatile gint total_count;
+  gboolean count_nested_calls;
+  GArray * probes;
 
   GumTlsKey tls_key;
   GMutex mutex;
@@ -81,6 +113,7 @@ static void
 gum_call_count_sampler_init (GumCallCountSampler * self)
 {
   self->interceptor = gum_interceptor_obtain ();
+  self->probes = g_array_new (FALSE, FALSE, sizeof (gpointer));
 
   self->tls_key = gum_tls_key_new ();
   g_mutex_init (&self->mutex);
@@ -93,10 +126,19 @@ gum_call_count_sampler_dispose (GObject * object)
 
   if (!self->disposed)
   {
+    guint i;
+
     self->disposed = TRUE;
 
+    gum_interceptor_begin_transaction (self->interceptor);
+    for (i = 0; i != self->probes->len; i++)
+    {
+      gum_interceptor_detach_probe (self->interceptor,
+          g_array_index (self->probes, gpointer, i));
+    }
     gum_interceptor_detach_listener (self->interceptor,
         GUM_INVOCATION_LISTENER (self));
+    gum_interceptor_end_transaction (self->interceptor);
     g_object_unref (self->interceptor);
   }
 
@@ -111,8 +153,8 @@ gum_call_count_sampler_finalize (GObject * object)
   gum_tls_key_free (self->tls_key);
   g_mutex_clear (&self->mutex);
 
-  g_slist_foreach (self->counters, (GFunc) g_free, NULL);
-  g_slist_free (self->counters);
+  g_slist_free_full (self->counters, (GDestroyNotify) gum_call_counter_free);
+  g_array_free (self->probes, TRUE);
 
   G_OBJECT_CLASS (gum_call_count_sampler_parent_class)->finalize (object);
 }
@@ -208,10 +250,29 @@ gum_call_count_sampler_new_by_name_valist (const gchar * first_function_name,
   return GUM_SAMPLER (sampler);
 }
 
+/*
+ * Whether calls made from within a counted function are counted too. Must be
+ * set before adding functions, and only affects functions added afterwards.
+ */
+void
+gum_call_count_sampler_set_count_nested_calls (GumCallCountSampler * self,
+                                               gboolean enabled)
+{
+  self->count_nested_calls = enabled;
+}
+
 void
 gum_call_count_sampler_add_function (GumCallCountSampler * self,
                                      gpointer function)
 {
+  if (self->count_nested_calls &&
+      gum_interceptor_attach_probe (self->interceptor, function,
+          gum_call_count_sampler_on_probe, self) == GUM_ATTACH_OK)
+  {
+    g_array_append_val (self->probes, function);
+    return;
+  }
+
   gum_interceptor_attach_listener (self->interceptor, function,
       GUM_INVOCATION_LISTENER (self), NULL);
 }
@@ -219,20 +280,32 @@ gum_call_count_sampler_add_function (GumCallCountSampler * self,
 GumSample
 gum_call_count_sampler_peek_total_count (GumCallCountSampler * self)
 {
-  return g_atomic_int_get (&self->total_count);
+  GumSample total = 0;
+  GSList * cur;
+
+  g_mutex_lock (&self->mutex);
+  for (cur = self->counters; cur != NULL; cur = cur->next)
+  {
+    GumCallCounter * counter = cur->data;
+
+    total += counter->count;
+  }
+  g_mutex_unlock (&self->mutex);
+
+  return total;
 }
 
 static GumSample
 gum_call_count_sampler_sample (GumSampler * sampler)
 {
   GumCallCountSampler * self;
-  GumSample * counter;
+  GumCallCounter * counter;
 
   self = GUM_CALL_COUNT_SAMPLER (sampler);
 
-  counter = (GumSample *) gum_tls_key_get_value (self->tls_key);
-  if (counter != NULL)
-    return *counter;
+  counter = gum_tls_key_get_value (self->tls_key);
+  if (counter != NULL && counter != GUM_CALL_COUNTER_PENDING)
+    return counter->count;
   else
     return 0;
 }
@@ -242,26 +315,15 @@ gum_call_count_sampler_on_enter (GumInvocationListener * listener,
                                  GumInvocationContext * context)
 {
   GumCallCountSampler * self;
-  GumSample * counter;
+  GumCallCounter * counter;
 
   self = GUM_CALL_COUNT_SAMPLER (listener);
 
   gum_interceptor_ignore_current_thread (self->interceptor);
 
-  counter = (GumSample *) gum_tls_key_get_value (self->tls_key);
-  if (counter == NULL)
-  {
-    counter = g_new0 (GumSample, 1);
-
-    g_mutex_lock (&self->mutex);
-    self->counters = g_slist_prepend (self->counters, counter);
-    g_mutex_unlock (&self->mutex);
-
-    gum_tls_key_set_value (self->tls_key, counter);
-  }
-
-  g_atomic_int_inc (&self->total_count);
-  (*counter)++;
+  counter = gum_call_count_sampler_get_thread_counter (self);
+  if (counter != NULL)
+    counter->count++;
 }
 
 static void
@@ -272,3 +334,49 @@ gum_call_count_sampler_on_leave (GumInvocationListener * listener,
 
   gum_interceptor_unignore_current_thread (self->interceptor);
 }
+
+static void
+gum_call_count_sampler_on_probe (GumCpuContext * cpu_context,
+                                 gpointer user_data)
+{
+  GumCallCountSampler * self = user_data;
+  GumCallCounter * counter;
+
+  counter = gum_call_count_sampler_get_thread_counter (self);
+  if (counter != NULL)
+    counter->count++;
+}
+
+static GumCallCounter *
+gum_call_count_sampler_get_thread_counter (GumCallCountSampler * self)
+{
+  GumCallCounter * counter;
+  gpointer allocation;
+
+  counter = gum_tls_key_get_value (self->tls_key);
+  if (counter == GUM_CALL_COUNTER_PENDING)
+    return NULL;
+  if (counter != NULL)
+    return counter;
+
+  gum_tls_key_set_value (self->tls_key, GUM_CALL_COUNTER_PENDING);
+
+  allocation = g_malloc0 (2 * GUM_CACHE_LINE_SIZE);
+  counter = GSIZE_TO_POINTER ((GPOINTER_TO_SIZE (allocation) +
+      GUM_CACHE_LINE_SIZE - 1) & ~((gsize) GUM_CACHE_LINE_SIZE - 1));
+  counter->allocation = allocation;
+
+  g_mutex_lock (&self->mutex);
+  self->counters = g_slist_prepend (self->counters, counter);
+  g_mutex_unlock (&self->mutex);
+
+  gum_tls_key_set_value (self->tls_key, counter);
+
+  return counter;
+}
+
+static void
+gum_call_counter_free (GumCallCounter * counter)
+{
+  g_free (counter->allocation);
+}
@@ -24,6 +24,8 @@ GUM_API GumSampler * gum_call_count_sampler_new_by_name (
 GUM_API GumSampler * gum_call_count_sampler_new_by_name_valist (
     const gchar * first_function_name, va_list args);
 
+GUM_API void gum_call_count_sampler_set_count_nested_calls (
+    GumCallCountSampler * self, gboolean enabled);
 GUM_API void gum_call_count_sampler_add_function (GumCallCountSampler * self,
     gpointer function);
 
@@ -7,14 +7,12 @@
 #include "gumcyclesampler.h"
 
 #include "gumlibc.h"
+#include "gumperfevent-priv.h"
 
 #include <string.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 
-# define PERF_TYPE_HARDWARE       0
-# define PERF_COUNT_HW_CPU_CYCLES 0
-
 struct _GumCycleSampler
 {
   GObject parent;
@@ -22,48 +20,6 @@ struct _GumCycleSampler
   gint device;
 };
 
-struct perf_event_attr
-{
-  guint32 type;
-  guint32 size;
-  guint64 config;
-
-  union
-  {
-    guint64 sample_period;
-    guint64 sample_freq;
-  };
-
-  guint64 sample_type;
-  guint64 read_format;
-
-  guint64 disabled       :  1,
-          inherit        :  1,
-          pinned         :  1,
-          exclusive      :  1,
-          exclude_user   :  1,
-          exclude_kernel :  1,
-          exclude_hv     :  1,
-          exclude_idle   :  1,
-          mmap           :  1,
-          comm           :  1,
-          freq           :  1,
-          inherit_stat   :  1,
-          enable_on_exec :  1,
-          task           :  1,
-          watermark      :  1,
-          __reserved_1   : 49;
-
-  union
-  {
-    guint32 wakeup_events;
-    guint32 wakeup_watermark;
-  };
-
-  guint32 __reserved_2;
-  guint64 __reserved_3;
-};
-
 static void gum_cycle_sampler_iface_init (gpointer g_iface,
     gpointer iface_data);
 static void gum_cycle_sampler_dispose (GObject * object);
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015-2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_PERF_EVENT_PRIV_H__
+#define __GUM_PERF_EVENT_PRIV_H__
+
+#include <glib.h>
+
+#define PERF_TYPE_HARDWARE               0
+#define PERF_TYPE_SOFTWARE               1
+
+#define PERF_COUNT_HW_CPU_CYCLES         0
+#define PERF_COUNT_HW_INSTRUCTIONS       1
+#define PERF_COUNT_HW_CACHE_MISSES       3
+#define PERF_COUNT_HW_BRANCH_MISSES      5
+
+#define PERF_COUNT_SW_CONTEXT_SWITCHES   3
+
+#define GUM_PERF_CAP_USER_RDPMC (G_GUINT64_CONSTANT (1) << 2)
+
+struct perf_event_attr
+{
+  guint32 type;
+  guint32 size;
+  guint64 config;
+
+  union
+  {
+    guint64 sample_period;
+    guint64 sample_freq;
+  };
+
+  guint64 sample_type;
+  guint64 read_format;
+
+  guint64 disabled       :  1,
+          inherit        :  1,
+          pinned         :  1,
+          exclusive      :  1,
+          exclude_user   :  1,
+          exclude_kernel :  1,
+          exclude_hv     :  1,
+          exclude_idle   :  1,
+          mmap           :  1,
+          comm           :  1,
+          freq           :  1,
+          inherit_stat   :  1,
+          enable_on_exec :  1,
+          task           :  1,
+          watermark      :  1,
+          __reserved_1   : 49;
+
+  union
+  {
+    guint32 wakeup_events;
+    guint32 wakeup_watermark;
+  };
+
+  guint32 __reserved_2;
+  guint64 __reserved_3;
+};
+
+/*
+ * The leading part of the page a counter can be mapped into, which tells
+ * whether and how it can be read with rdpmc.
+ */
+struct perf_event_mmap_page
+{
+  volatile guint32 version;
+  volatile guint32 compat_version;
+  volatile guint32 lock;
+  volatile guint32 index;
+  volatile gint64 offset;
+  volatile guint64 time_enabled;
+  volatile guint64 time_running;
+  volatile guint64 capabilities;
+  volatile guint16 pmc_width;
+};
+
+#endif
@@ -0,0 +1,472 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumperfeventsampler.h"
+
+#ifdef HAVE_LINUX
+# include "gummemory.h"
+# include "gumperfevent-priv.h"
+
+# include <string.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+#endif
+
+/*
+ * Counts the calling thread's events through perf_event_open(), so that,
+ * like the other samplers, the difference between two samples taken on one
+ * thread is what that thread did in between. Each thread lazily opens its own
+ * counter the first time it samples. On x86 the counter page is mapped and,
+ * when the kernel allows it, read with rdpmc without entering the kernel,
+ * falling back to read() whenever the counter is not currently on the PMU.
+ * Software events such as context switches are always read().
+ */
+
+typedef struct _GumPerfEventCounter GumPerfEventCounter;
+typedef struct _GumPerfEventThreadCounter GumPerfEventThreadCounter;
+
+enum
+{
+  PROP_0,
+  PROP_KIND
+};
+
+struct _GumPerfEventSampler
+{
+  GObject parent;
+
+  GumPerfEventKind kind;
+
+#ifdef HAVE_LINUX
+  guint id;
+  struct perf_event_attr attr;
+  gboolean available;
+
+  GMutex mutex;
+  GPtrArray * counters;
+#endif
+};
+
+#ifdef HAVE_LINUX
+
+/*
+ * Shared between the sampler and the thread using it, and closed by whichever
+ * lets go last. The sampler prunes its references to counters of threads that
+ * have exited, and threads drop counters orphaned by a finalized sampler the
+ * next time they sample.
+ */
+struct _GumPerfEventCounter
+{
+  volatile gint ref_count;
+  volatile gint orphaned;
+
+  gint fd;
+  struct perf_event_mmap_page * page;
+};
+
+struct _GumPerfEventThreadCounter
+{
+  guint sampler_id;
+  GumPerfEventCounter * counter;
+};
+
+#endif
+
+static void gum_perf_event_sampler_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void gum_perf_event_sampler_constructed (GObject * object);
+static void gum_perf_event_sampler_finalize (GObject * object);
+static void gum_perf_event_sampler_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gum_perf_event_sampler_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static GumSample gum_perf_event_sampler_sample (GumSampler * sampler);
+
+#ifdef HAVE_LINUX
+static GumPerfEventCounter * gum_perf_event_sampler_get_thread_counter (
+    GumPerfEventSampler * self);
+static void gum_perf_event_thread_counters_free (GArray * counters);
+
+static GumPerfEventCounter * gum_perf_event_counter_open (
+    struct perf_event_attr * attr);
+static void gum_perf_event_counter_unref (GumPerfEventCounter * counter);
+static GumSample gum_perf_event_counter_read (GumPerfEventCounter * self);
+#endif
+
+G_DEFINE_TYPE_EXTENDED (GumPerfEventSampler,
+                        gum_perf_event_sampler,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_SAMPLER,
+                            gum_perf_event_sampler_iface_init))
+
+#ifdef HAVE_LINUX
+static GPrivate gum_perf_event_thread_counters = G_PRIVATE_INIT (
+    (GDestroyNotify) gum_perf_event_thread_counters_free);
+static volatile gint gum_perf_event_next_sampler_id = 1;
+#endif
+
+static void
+gum_perf_event_sampler_class_init (GumPerfEventSamplerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gum_perf_event_sampler_constructed;
+  object_class->finalize = gum_perf_event_sampler_finalize;
+  object_class->get_property = gum_perf_event_sampler_get_property;
+  object_class->set_property = gum_perf_event_sampler_set_property;
+
+  g_object_class_install_property (object_class, PROP_KIND,
+      g_param_spec_uint ("kind", "Kind", "Kind of event to count",
+      GUM_PERF_EVENT_INSTRUCTIONS, GUM_PERF_EVENT_CONTEXT_SWITCHES,
+      GUM_PERF_EVENT_INSTRUCTIONS,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | G_PARAM_CONSTRUCT_ONLY));
+}
+
+static void
+gum_perf_event_sampler_iface_init (gpointer g_iface,
+                                   gpointer iface_data)
+{
+  GumSamplerInterface * iface = g_iface;
+
+  iface->sample = gum_perf_event_sampler_sample;
+}
+
+static void
+gum_perf_event_sampler_init (GumPerfEventSampler * self)
+{
+#ifdef HAVE_LINUX
+  g_mutex_init (&self->mutex);
+  self->counters = g_ptr_array_new_with_free_func (
+      (GDestroyNotify) gum_perf_event_counter_unref);
+#endif
+}
+
+static void
+gum_perf_event_sampler_constructed (GObject * object)
+{
+#ifdef HAVE_LINUX
+  GumPerfEventSampler * self = GUM_PERF_EVENT_SAMPLER (object);
+  struct perf_event_attr * attr = &self->attr;
+
+  self->id = g_atomic_int_add (&gum_perf_event_next_sampler_id, 1);
+
+  memset (attr, 0, sizeof (struct perf_event_attr));
+  attr->size = sizeof (struct perf_event_attr);
+
+  switch (self->kind)
+  {
+    case GUM_PERF_EVENT_INSTRUCTIONS:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case GUM_PERF_EVENT_CACHE_MISSES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case GUM_PERF_EVENT_BRANCH_MISSES:
+      attr->type = PERF_TYPE_HARDWARE;
+      attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case GUM_PERF_EVENT_CONTEXT_SWITCHES:
+      attr->type = PERF_TYPE_SOFTWARE;
+      attr->config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+
+  if (attr->type == PERF_TYPE_HARDWARE)
+  {
+    attr->exclude_kernel = TRUE;
+    attr->exclude_hv = TRUE;
+  }
+
+  self->available = gum_perf_event_sampler_get_thread_counter (self) != NULL;
+#endif
+
+  G_OBJECT_CLASS (gum_perf_event_sampler_parent_class)->constructed (object);
+}
+
+static void
+gum_perf_event_sampler_finalize (GObject * object)
+{
+#ifdef HAVE_LINUX
+  GumPerfEventSampler * self = GUM_PERF_EVENT_SAMPLER (object);
+  guint i;
+
+  for (i = 0; i != self->counters->len; i++)
+  {
+    GumPerfEventCounter * counter = g_ptr_array_index (self->counters, i);
+
+    g_atomic_int_set (&counter->orphaned, TRUE);
+  }
+  g_ptr_array_unref (self->counters);
+
+  g_mutex_clear (&self->mutex);
+#endif
+
+  G_OBJECT_CLASS (gum_perf_event_sampler_parent_class)->finalize (object);
+}
+
+static void
+gum_perf_event_sampler_get_property (GObject * object,
+                                     guint property_id,
+                                     GValue * value,
+                                     GParamSpec * pspec)
+{
+  GumPerfEventSampler * self = GUM_PERF_EVENT_SAMPLER (object);
+
+  switch (property_id)
+  {
+    case PROP_KIND:
+      g_value_set_uint (value, self->kind);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gum_perf_event_sampler_set_property (GObject * object,
+                                     guint property_id,
+                                     const GValue * value,
+                                     GParamSpec * pspec)
+{
+  GumPerfEventSampler * self = GUM_PERF_EVENT_SAMPLER (object);
+
+  switch (property_id)
+  {
+    case PROP_KIND:
+      self->kind = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+GumSampler *
+gum_perf_event_sampler_new (GumPerfEventKind kind)
+{
+  return g_object_new (GUM_TYPE_PERF_EVENT_SAMPLER,
+      "kind", kind,
+      NULL);
+}
+
+gboolean
+gum_perf_event_sampler_is_available (GumPerfEventSampler * self)
+{
+#ifdef HAVE_LINUX
+  return self->available;
+#else
+  return FALSE;
+#endif
+}
+
+static GumSample
+gum_perf_event_sampler_sample (GumSampler * sampler)
+{
+#ifdef HAVE_LINUX
+  GumPerfEventSampler * self = GUM_PERF_EVENT_SAMPLER (sampler);
+  GumPerfEventCounter * counter;
+
+  if (!self->available)
+    return 0;
+
+  counter = gum_perf_event_sampler_get_thread_counter (self);
+  if (counter == NULL)
+    return 0;
+
+  return gum_perf_event_counter_read (counter);
+#else
+  return 0;
+#endif
+}
+
+#ifdef HAVE_LINUX
+
+static GumPerfEventCounter *
+gum_perf_event_sampler_get_thread_counter (GumPerfEventSampler * self)
+{
+  GArray * counters;
+  GumPerfEventThreadCounter entry;
+  guint i;
+
+  counters = g_private_get (&gum_perf_event_thread_counters);
+  if (counters == NULL)
+  {
+    counters = g_array_new (FALSE, FALSE, sizeof (GumPerfEventThreadCounter));
+    g_private_set (&gum_perf_event_thread_counters, counters);
+  }
+
+  for (i = 0; i != counters->len;)
+  {
+    GumPerfEventThreadCounter * e =
+        &g_array_index (counters, GumPerfEventThreadCounter, i);
+
+    if (e->sampler_id == self->id)
+      return e->counter;
+
+    if (e->counter != NULL && g_atomic_int_get (&e->counter->orphaned))
+    {
+      gum_perf_event_counter_unref (e->counter);
+      g_array_remove_index_fast (counters, i);
+      continue;
+    }
+
+    i++;
+  }
+
+  entry.sampler_id = self->id;
+  entry.counter = gum_perf_event_counter_open (&self->attr);
+  g_array_append_val (counters, entry);
+
+  if (entry.counter != NULL)
+  {
+    g_mutex_lock (&self->mutex);
+
+    for (i = self->counters->len; i != 0; i--)
+    {
+      GumPerfEventCounter * counter =
+          g_ptr_array_index (self->counters, i - 1);
+
+      if (g_atomic_int_get (&counter->ref_count) == 1)
+        g_ptr_array_remove_index_fast (self->counters, i - 1);
+    }
+
+    g_atomic_int_inc (&entry.counter->ref_count);
+    g_ptr_array_add (self->counters, entry.counter);
+
+    g_mutex_unlock (&self->mutex);
+  }
+
+  return entry.counter;
+}
+
+static void
+gum_perf_event_thread_counters_free (GArray * counters)
+{
+  guint i;
+
+  for (i = 0; i != counters->len; i++)
+  {
+    GumPerfEventCounter * counter =
+        g_array_index (counters, GumPerfEventThreadCounter, i).counter;
+
+    if (counter != NULL)
+      gum_perf_event_counter_unref (counter);
+  }
+
+  g_array_free (counters, TRUE);
+}
+
+static GumPerfEventCounter *
+gum_perf_event_counter_open (struct perf_event_attr * attr)
+{
+  gint fd;
+  GumPerfEventCounter * counter;
+
+  fd = syscall (__NR_perf_event_open, attr, 0, -1, -1, 0);
+  if (fd == -1)
+    return NULL;
+
+  counter = g_slice_new0 (GumPerfEventCounter);
+  counter->ref_count = 1;
+  counter->fd = fd;
+
+#ifdef HAVE_I386
+  if (attr->type == PERF_TYPE_HARDWARE)
+  {
+    gpointer page;
+
+    page = mmap (NULL, gum_query_page_size (), PROT_READ, MAP_SHARED, fd, 0);
+    if (page != MAP_FAILED)
+    {
+      counter->page = page;
+
+      if ((counter->page->capabilities & GUM_PERF_CAP_USER_RDPMC) == 0 ||
+          counter->page->pmc_width == 0)
+      {
+        munmap (page, gum_query_page_size ());
+        counter->page = NULL;
+      }
+    }
+  }
+#endif
+
+  return counter;
+}
+
+static void
+gum_perf_event_counter_unref (GumPerfEventCounter * counter)
+{
+  if (!g_atomic_int_dec_and_test (&counter->ref_count))
+    return;
+
+  if (counter->page != NULL)
+    munmap (counter->page, gum_query_page_size ());
+  close (counter->fd);
+
+  g_slice_free (GumPerfEventCounter, counter);
+}
+
+#ifdef HAVE_I386
+
+static guint64
+gum_rdpmc (guint32 counter)
+{
+  guint32 low, high;
+
+  __asm__ __volatile__ ("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+
+  return ((guint64) high << 32) | low;
+}
+
+#endif
+
+static GumSample
+gum_perf_event_counter_read (GumPerfEventCounter * self)
+{
+  guint64 value;
+
+#ifdef HAVE_I386
+  if (self->page != NULL)
+  {
+    struct perf_event_mmap_page * pc = self->page;
+    guint32 seq, index;
+    gint64 count;
+
+    do
+    {
+      seq = pc->lock;
+      __asm__ __volatile__ ("" : : : "memory");
+
+      index = pc->index;
+      count = pc->offset;
+      if (index != 0)
+      {
+        guint shift = 64 - pc->pmc_width;
+
+        count += (gint64) (gum_rdpmc (index - 1) << shift) >> shift;
+      }
+
+      __asm__ __volatile__ ("" : : : "memory");
+    }
+    while (pc->lock != seq);
+
+    if (index != 0)
+      return count;
+  }
+#endif
+
+  if (read (self->fd, &value, sizeof (value)) != sizeof (value))
+    return 0;
+
+  return value;
+}
+
+#endif
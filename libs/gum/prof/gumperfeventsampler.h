@@ -0,0 +1,33 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_PERF_EVENT_SAMPLER_H__
+#define __GUM_PERF_EVENT_SAMPLER_H__
+
+#include "gumsampler.h"
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_PERF_EVENT_SAMPLER (gum_perf_event_sampler_get_type ())
+G_DECLARE_FINAL_TYPE (GumPerfEventSampler, gum_perf_event_sampler, GUM,
+    PERF_EVENT_SAMPLER, GObject)
+
+typedef enum
+{
+  GUM_PERF_EVENT_INSTRUCTIONS,
+  GUM_PERF_EVENT_CACHE_MISSES,
+  GUM_PERF_EVENT_BRANCH_MISSES,
+  GUM_PERF_EVENT_CONTEXT_SWITCHES
+} GumPerfEventKind;
+
+GUM_API GumSampler * gum_perf_event_sampler_new (GumPerfEventKind kind);
+
+GUM_API gboolean gum_perf_event_sampler_is_available (
+    GumPerfEventSampler * self);
+
+G_END_DECLS
+
+#endif
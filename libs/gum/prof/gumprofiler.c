@@ -21,6 +21,9 @@ typedef struct _GumFunctionContext GumFunctionContext;
 typedef struct _GumWorstCaseInfo GumWorstCaseInfo;
 typedef struct _GumWorstCase GumWorstCase;
 typedef struct _GumFunctionThreadContext GumFunctionThreadContext;
+typedef struct _GumThreadContextTable GumThreadContextTable;
+typedef struct _GumProfileStack GumProfileStack;
+typedef struct _GumPprofBuilder GumPprofBuilder;
 
 struct _GumProfiler
 {
@@ -33,6 +36,7 @@ struct _GumProfiler
   GumInterceptor * interceptor;
   GHashTable * function_by_address;
   GSList * stacks;
+  volatile gint next_thread_slot;
 };
 
 struct _GumProfilerInvocation
@@ -47,6 +51,7 @@ struct _GumProfilerInvocation
 struct _GumProfilerContext
 {
   GArray * stack;
+  guint thread_slot;
 };
 
 struct _GumWorstCaseInfo
@@ -87,8 +92,46 @@ struct _GumFunctionContext
   GumWorstCaseInspectorFunc inspector_func;
   gpointer inspector_user_data;
 
-  GumFunctionThreadContext thread_contexts[GUM_MAX_THREADS];
-  volatile gint thread_context_count;
+  GumThreadContextTable * volatile thread_table;
+  GSList * retired_tables;
+  GPtrArray * thread_contexts;
+};
+
+/*
+ * Every thread making calls into instrumented functions is given a slot
+ * number, unique within the profiler, which indexes straight into each
+ * function's table of per-thread statistics. Tables grow as new threads show
+ * up, and are replaced rather than resized in place so threads can look up
+ * their slot without taking any lock. Replaced tables are kept around until
+ * the function is uninstrumented. thread_contexts lists the contexts in the
+ * order in which threads first called the function, for reporting.
+ */
+struct _GumThreadContextTable
+{
+  guint capacity;
+  GumFunctionThreadContext * items[1];
+};
+
+/*
+ * A unique path through the call graph, root first, along with the calls
+ * made to its last frame and the time spent there excluding its child.
+ */
+struct _GumProfileStack
+{
+  guint hash;
+  GArray * frames;
+  guint64 total_calls;
+  GumSample self_duration;
+
+  gchar * path;
+};
+
+struct _GumPprofBuilder
+{
+  GPtrArray * strings;
+  GHashTable * string_indices;
+  GArray * functions;
+  GHashTable * function_ids;
 };
 
 static void gum_profiler_invocation_listener_iface_init (gpointer g_iface,
@@ -104,7 +147,7 @@ static void gum_profiler_on_leave (GumInvocationListener * listener,
 static void unstrument_and_free_function (gpointer key, gpointer value,
     gpointer user_data);
 
-static void add_to_report_if_root_node (gpointer key, gpointer value,
+static void collect_root_nodes (gpointer key, gpointer value,
     gpointer user_data);
 static GumProfileReportNode * make_node_from_thread_context (
     GumFunctionThreadContext * thread_ctx, GHashTable ** processed_nodes);
@@ -115,11 +158,43 @@ static void thread_context_register_child_timing (
     GumFunctionThreadContext * parent_ctx,
     GumFunctionThreadContext * child_ctx);
 
+static void gum_profiler_collect_stacks (GumFunctionThreadContext * root_ctx,
+    GHashTable * stacks);
+static void gum_profiler_emit_collapsed_stacks (GPtrArray * stacks,
+    GumProfileOutputFunc func, gpointer user_data);
+static void gum_profiler_emit_pprof (GPtrArray * stacks,
+    GHashTable * names, GumProfileOutputFunc func, gpointer user_data);
+static gint gum_profile_stack_compare (const GumProfileStack ** a,
+    const GumProfileStack ** b);
+static guint gum_profile_stack_hash_frames (GArray * frames);
+static guint gum_profile_stack_hash (const GumProfileStack * stack);
+static gboolean gum_profile_stack_equal (const GumProfileStack * a,
+    const GumProfileStack * b);
+static void gum_profile_stack_free (GumProfileStack * stack);
+
+static guint gum_pprof_builder_intern_string (GumPprofBuilder * self,
+    const gchar * str);
+static guint64 gum_pprof_builder_intern_function (GumPprofBuilder * self,
+    gpointer address);
+static void gum_pprof_append_varint (GByteArray * buf, guint64 value);
+static void gum_pprof_append_uint_field (GByteArray * buf, guint field,
+    guint64 value);
+static void gum_pprof_append_bytes_field (GByteArray * buf, guint field,
+    gconstpointer data, gsize size);
+static void gum_pprof_emit_message (guint field, GByteArray * message,
+    GumProfileOutputFunc func, gpointer user_data);
+
 static void get_number_of_threads_foreach (gpointer key, gpointer value,
     gpointer user_data);
 
 static GumFunctionThreadContext * gum_function_context_get_current_thread (
-    GumFunctionContext * function_ctx, GumInvocationContext * context);
+    GumFunctionContext * function_ctx, GumProfilerContext * profiler_ctx,
+    GumProfiler * profiler, GumInvocationContext * context);
+static GumFunctionThreadContext * gum_function_context_add_thread (
+    GumFunctionContext * function_ctx, guint slot, GumProfiler * profiler,
+    GumInvocationContext * context);
+static GumFunctionThreadContext * gum_function_context_get_nth_thread (
+    GumFunctionContext * function_ctx, guint n);
 
 G_DEFINE_TYPE_EXTENDED (GumProfiler,
                         gum_profiler,
@@ -203,6 +278,7 @@ static void
 gum_profiler_on_enter (GumInvocationListener * listener,
                        GumInvocationContext * context)
 {
+  GumProfiler * self = GUM_PROFILER (listener);
   GumProfilerInvocation * inv;
   GumFunctionContext * fctx;
   GumFunctionThreadContext * tctx;
@@ -212,10 +288,10 @@ gum_profiler_on_enter (GumInvocationListener * listener,
   inv->profiler = GUM_LINCTX_GET_THREAD_DATA (context, GumProfilerContext);
   if (inv->profiler->stack == NULL)
   {
-    GumProfiler * self = GUM_PROFILER (listener);
-
     inv->profiler->stack = g_array_sized_new (FALSE, FALSE,
         sizeof (GumFunctionThreadContext *), GUM_MAX_CALL_DEPTH);
+    inv->profiler->thread_slot =
+        g_atomic_int_add (&self->next_thread_slot, 1);
 
     GUM_PROFILER_LOCK ();
     self->stacks = g_slist_prepend (self->stacks, inv->profiler->stack);
@@ -224,7 +300,7 @@ gum_profiler_on_enter (GumInvocationListener * listener,
 
   inv->function = GUM_LINCTX_GET_FUNC_DATA (context, GumFunctionContext *);
   inv->thread = gum_function_context_get_current_thread (inv->function,
-      context);
+      inv->profiler, self, context);
 
   fctx = inv->function;
   tctx = inv->thread;
@@ -371,6 +447,7 @@ gum_profiler_instrument_function_with_inspector (
   GumAttachReturn attach_ret;
 
   ctx = g_new0 (GumFunctionContext, 1);
+  ctx->thread_contexts = g_ptr_array_new_with_free_func (g_free);
 
   attach_ret = gum_interceptor_attach_listener (self->interceptor,
       function_address, GUM_INVOCATION_LISTENER (self), ctx);
@@ -390,6 +467,7 @@ gum_profiler_instrument_function_with_inspector (
   return result;
 
 error:
+  g_ptr_array_unref (ctx->thread_contexts);
   g_free (ctx);
 
   if (attach_ret == GUM_ATTACH_WRONG_SIGNATURE)
@@ -410,6 +488,9 @@ unstrument_and_free_function (gpointer key,
   GumFunctionContext * function_ctx = (GumFunctionContext *) value;
 
   g_object_unref (function_ctx->sampler_instance);
+  g_ptr_array_unref (function_ctx->thread_contexts);
+  g_free (function_ctx->thread_table);
+  g_slist_free_full (function_ctx->retired_tables, g_free);
   g_free (function_ctx);
 }
 
@@ -417,43 +498,49 @@ GumProfileReport *
 gum_profiler_generate_report (GumProfiler * self)
 {
   GumProfileReport * report;
+  GPtrArray * root_nodes;
+  guint i;
+
+  root_nodes = g_ptr_array_new ();
+  GUM_PROFILER_LOCK ();
+  g_hash_table_foreach (self->function_by_address, collect_root_nodes,
+      root_nodes);
+  GUM_PROFILER_UNLOCK ();
 
   report = gum_profile_report_new ();
-  g_hash_table_foreach (self->function_by_address, add_to_report_if_root_node,
-      report);
+  for (i = 0; i != root_nodes->len; i++)
+  {
+    GumFunctionThreadContext * thread_ctx = g_ptr_array_index (root_nodes, i);
+    GHashTable * processed_nodes = NULL;
+    GumProfileReportNode * root_node;
+
+    root_node = make_node_from_thread_context (thread_ctx, &processed_nodes);
+    _gum_profile_report_append_thread_root_node (report,
+        thread_ctx->thread_id, root_node);
+  }
   _gum_profile_report_sort (report);
 
+  g_ptr_array_unref (root_nodes);
+
   return report;
 }
 
 static void
-add_to_report_if_root_node (gpointer key,
-                            gpointer value,
-                            gpointer user_data)
+collect_root_nodes (gpointer key,
+                    gpointer value,
+                    gpointer user_data)
 {
-  GumProfileReport * report = GUM_PROFILE_REPORT (user_data);
+  GPtrArray * root_nodes = user_data;
   GumFunctionContext * function_ctx = (GumFunctionContext *) value;
+  guint i;
 
-  if (function_ctx->thread_context_count > 0)
+  for (i = 0; i != function_ctx->thread_contexts->len; i++)
   {
-    gint i;
-
-    for (i = 0; i != function_ctx->thread_context_count; i++)
-    {
-      GumFunctionThreadContext * thread_ctx =
-          &function_ctx->thread_contexts[i];
+    GumFunctionThreadContext * thread_ctx =
+        g_ptr_array_index (function_ctx->thread_contexts, i);
 
-      if (thread_ctx->is_root_node)
-      {
-        GHashTable * processed_nodes = NULL;
-        GumProfileReportNode * root_node;
-
-        root_node = make_node_from_thread_context (thread_ctx,
-            &processed_nodes);
-        _gum_profile_report_append_thread_root_node (report,
-            thread_ctx->thread_id, root_node);
-      }
-    }
+    if (thread_ctx->is_root_node)
+      g_ptr_array_add (root_nodes, thread_ctx);
   }
 }
 
@@ -519,6 +606,417 @@ make_node (gchar * name,
   return node;
 }
 
+/*
+ * Streams the call graph to `func` without building a report first. Each
+ * path from a root node down its chain of heaviest children becomes a stack,
+ * and identical stacks seen on different threads are merged, so the output
+ * grows with the number of distinct paths rather than with the number of
+ * threads or calls. Samples carry self time, i.e. the time spent in the last
+ * frame minus that spent in its child.
+ *
+ * GUM_PROFILE_FORMAT_COLLAPSED_STACKS produces one "a;b;c value" line per
+ * stack, as consumed by flamegraph.pl. GUM_PROFILE_FORMAT_PPROF produces an
+ * uncompressed profile.proto message, with "calls" and "duration" values per
+ * sample, the latter in whatever unit the sampler uses.
+ */
+void
+gum_profiler_export (GumProfiler * self,
+                     GumProfileFormat format,
+                     GumProfileOutputFunc func,
+                     gpointer user_data)
+{
+  GPtrArray * root_nodes, * sorted;
+  GHashTable * stacks, * names;
+  GHashTableIter iter;
+  GumProfileStack * stack;
+  guint i;
+
+  root_nodes = g_ptr_array_new ();
+  GUM_PROFILER_LOCK ();
+  g_hash_table_foreach (self->function_by_address, collect_root_nodes,
+      root_nodes);
+  GUM_PROFILER_UNLOCK ();
+
+  stacks = g_hash_table_new_full ((GHashFunc) gum_profile_stack_hash,
+      (GEqualFunc) gum_profile_stack_equal,
+      (GDestroyNotify) gum_profile_stack_free, NULL);
+  for (i = 0; i != root_nodes->len; i++)
+    gum_profiler_collect_stacks (g_ptr_array_index (root_nodes, i), stacks);
+  g_ptr_array_unref (root_nodes);
+
+  names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  sorted = g_ptr_array_sized_new (g_hash_table_size (stacks));
+
+  g_hash_table_iter_init (&iter, stacks);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &stack, NULL))
+  {
+    GString * path;
+    guint j;
+
+    path = g_string_new ("");
+
+    for (j = 0; j != stack->frames->len; j++)
+    {
+      gpointer address = g_array_index (stack->frames, gpointer, j);
+      gchar * name;
+
+      name = g_hash_table_lookup (names, address);
+      if (name == NULL)
+      {
+        name = g_strdelimit (gum_symbol_name_from_address (address), ";\n",
+            '_');
+        g_hash_table_insert (names, address, name);
+      }
+
+      if (j != 0)
+        g_string_append_c (path, ';');
+      g_string_append (path, name);
+    }
+
+    stack->path = g_string_free (path, FALSE);
+
+    g_ptr_array_add (sorted, stack);
+  }
+
+  g_ptr_array_sort (sorted, (GCompareFunc) gum_profile_stack_compare);
+
+  switch (format)
+  {
+    case GUM_PROFILE_FORMAT_COLLAPSED_STACKS:
+      gum_profiler_emit_collapsed_stacks (sorted, func, user_data);
+      break;
+    case GUM_PROFILE_FORMAT_PPROF:
+      gum_profiler_emit_pprof (sorted, names, func, user_data);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+
+  g_ptr_array_unref (sorted);
+  g_hash_table_unref (names);
+  g_hash_table_unref (stacks);
+}
+
+static void
+gum_profiler_collect_stacks (GumFunctionThreadContext * root_ctx,
+                             GHashTable * stacks)
+{
+  GArray * frames;
+  GHashTable * processed_nodes;
+  GumFunctionThreadContext * thread_ctx;
+
+  frames = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  processed_nodes = g_hash_table_new (NULL, NULL);
+
+  for (thread_ctx = root_ctx;
+      thread_ctx != NULL &&
+      !g_hash_table_contains (processed_nodes, thread_ctx);
+      thread_ctx = thread_ctx->child_ctx)
+  {
+    GumFunctionThreadContext * child_ctx = thread_ctx->child_ctx;
+    GumProfileStack probe, * stack;
+
+    g_hash_table_add (processed_nodes, thread_ctx);
+    g_array_append_val (frames, thread_ctx->function_ctx->function_address);
+
+    probe.frames = frames;
+    probe.hash = gum_profile_stack_hash_frames (frames);
+    probe.total_calls = thread_ctx->total_calls;
+    probe.self_duration = thread_ctx->total_duration;
+    if (child_ctx != NULL &&
+        !g_hash_table_contains (processed_nodes, child_ctx))
+    {
+      probe.self_duration -= MIN (child_ctx->total_duration,
+          probe.self_duration);
+    }
+
+    stack = g_hash_table_lookup (stacks, &probe);
+    if (stack != NULL)
+    {
+      stack->total_calls += probe.total_calls;
+      stack->self_duration += probe.self_duration;
+    }
+    else
+    {
+      stack = g_slice_dup (GumProfileStack, &probe);
+      stack->frames = g_array_sized_new (FALSE, FALSE, sizeof (gpointer),
+          frames->len);
+      g_array_append_vals (stack->frames, frames->data, frames->len);
+      stack->path = NULL;
+
+      g_hash_table_add (stacks, stack);
+    }
+  }
+
+  g_hash_table_unref (processed_nodes);
+  g_array_free (frames, TRUE);
+}
+
+static void
+gum_profiler_emit_collapsed_stacks (GPtrArray * stacks,
+                                    GumProfileOutputFunc func,
+                                    gpointer user_data)
+{
+  GString * line;
+  guint i;
+
+  line = g_string_sized_new (256);
+
+  for (i = 0; i != stacks->len; i++)
+  {
+    GumProfileStack * stack = g_ptr_array_index (stacks, i);
+
+    if (stack->self_duration == 0)
+      continue;
+
+    g_string_printf (line, "%s %" G_GINT64_MODIFIER "u\n", stack->path,
+        (guint64) stack->self_duration);
+    func (line->str, line->len, user_data);
+  }
+
+  g_string_free (line, TRUE);
+}
+
+static void
+gum_profiler_emit_pprof (GPtrArray * stacks,
+                         GHashTable * names,
+                         GumProfileOutputFunc func,
+                         gpointer user_data)
+{
+  GumPprofBuilder builder;
+  GByteArray * message, * packed;
+  const gchar * value_types[2][2] = {
+    { "calls", "count" },
+    { "duration", "units" }
+  };
+  guint i;
+
+  builder.strings = g_ptr_array_new ();
+  builder.string_indices = g_hash_table_new (g_str_hash, g_str_equal);
+  builder.functions = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  builder.function_ids = g_hash_table_new (NULL, NULL);
+
+  gum_pprof_builder_intern_string (&builder, "");
+
+  message = g_byte_array_new ();
+  packed = g_byte_array_new ();
+
+  for (i = 0; i != G_N_ELEMENTS (value_types); i++)
+  {
+    g_byte_array_set_size (message, 0);
+    gum_pprof_append_uint_field (message, 1,
+        gum_pprof_builder_intern_string (&builder, value_types[i][0]));
+    gum_pprof_append_uint_field (message, 2,
+        gum_pprof_builder_intern_string (&builder, value_types[i][1]));
+    gum_pprof_emit_message (1, message, func, user_data);
+  }
+
+  for (i = 0; i != stacks->len; i++)
+  {
+    GumProfileStack * stack = g_ptr_array_index (stacks, i);
+    guint j;
+
+    g_byte_array_set_size (message, 0);
+
+    g_byte_array_set_size (packed, 0);
+    for (j = stack->frames->len; j != 0; j--)
+    {
+      gum_pprof_append_varint (packed, gum_pprof_builder_intern_function (
+          &builder, g_array_index (stack->frames, gpointer, j - 1)));
+    }
+    gum_pprof_append_bytes_field (message, 1, packed->data, packed->len);
+
+    g_byte_array_set_size (packed, 0);
+    gum_pprof_append_varint (packed, stack->total_calls);
+    gum_pprof_append_varint (packed, stack->self_duration);
+    gum_pprof_append_bytes_field (message, 2, packed->data, packed->len);
+
+    gum_pprof_emit_message (2, message, func, user_data);
+  }
+
+  for (i = 0; i != builder.functions->len; i++)
+  {
+    gpointer address = g_array_index (builder.functions, gpointer, i);
+    guint64 id = i + 1;
+    guint name_index;
+
+    g_byte_array_set_size (message, 0);
+    gum_pprof_append_uint_field (message, 1, id);
+    gum_pprof_append_uint_field (message, 3, GPOINTER_TO_SIZE (address));
+    g_byte_array_set_size (packed, 0);
+    gum_pprof_append_uint_field (packed, 1, id);
+    gum_pprof_append_bytes_field (message, 4, packed->data, packed->len);
+    gum_pprof_emit_message (4, message, func, user_data);
+
+    name_index = gum_pprof_builder_intern_string (&builder,
+        g_hash_table_lookup (names, address));
+
+    g_byte_array_set_size (message, 0);
+    gum_pprof_append_uint_field (message, 1, id);
+    gum_pprof_append_uint_field (message, 2, name_index);
+    gum_pprof_append_uint_field (message, 3, name_index);
+    gum_pprof_emit_message (5, message, func, user_data);
+  }
+
+  for (i = 0; i != builder.strings->len; i++)
+  {
+    const gchar * str = g_ptr_array_index (builder.strings, i);
+
+    g_byte_array_set_size (message, 0);
+    g_byte_array_append (message, (const guint8 *) str, strlen (str));
+    gum_pprof_emit_message (6, message, func, user_data);
+  }
+
+  g_byte_array_unref (packed);
+  g_byte_array_unref (message);
+
+  g_hash_table_unref (builder.function_ids);
+  g_array_free (builder.functions, TRUE);
+  g_hash_table_unref (builder.string_indices);
+  g_ptr_array_unref (builder.strings);
+}
+
+static gint
+gum_profile_stack_compare (const GumProfileStack ** a,
+                           const GumProfileStack ** b)
+{
+  return strcmp ((*a)->path, (*b)->path);
+}
+
+static guint
+gum_profile_stack_hash_frames (GArray * frames)
+{
+  guint hash = 5381;
+  guint i;
+
+  for (i = 0; i != frames->len; i++)
+  {
+    hash = (hash * 33) ^
+        (guint) (GPOINTER_TO_SIZE (g_array_index (frames, gpointer, i)) >> 2);
+  }
+
+  return hash;
+}
+
+static guint
+gum_profile_stack_hash (const GumProfileStack * stack)
+{
+  return stack->hash;
+}
+
+static gboolean
+gum_profile_stack_equal (const GumProfileStack * a,
+                         const GumProfileStack * b)
+{
+  return a->hash == b->hash && a->frames->len == b->frames->len &&
+      memcmp (a->frames->data, b->frames->data,
+          a->frames->len * sizeof (gpointer)) == 0;
+}
+
+static void
+gum_profile_stack_free (GumProfileStack * stack)
+{
+  g_free (stack->path);
+  g_array_free (stack->frames, TRUE);
+
+  g_slice_free (GumProfileStack, stack);
+}
+
+static guint
+gum_pprof_builder_intern_string (GumPprofBuilder * self,
+                                 const gchar * str)
+{
+  gpointer index;
+
+  if (g_hash_table_lookup_extended (self->string_indices, str, NULL, &index))
+    return GPOINTER_TO_UINT (index);
+
+  index = GUINT_TO_POINTER (self->strings->len);
+  g_ptr_array_add (self->strings, (gpointer) str);
+  g_hash_table_insert (self->string_indices, (gpointer) str, index);
+
+  return GPOINTER_TO_UINT (index);
+}
+
+static guint64
+gum_pprof_builder_intern_function (GumPprofBuilder * self,
+                                   gpointer address)
+{
+  gpointer id;
+
+  id = g_hash_table_lookup (self->function_ids, address);
+  if (id == NULL)
+  {
+    g_array_append_val (self->functions, address);
+    id = GUINT_TO_POINTER (self->functions->len);
+    g_hash_table_insert (self->function_ids, address, id);
+  }
+
+  return GPOINTER_TO_UINT (id);
+}
+
+static void
+gum_pprof_append_varint (GByteArray * buf,
+                         guint64 value)
+{
+  guint8 bytes[10];
+  guint n = 0;
+
+  do
+  {
+    bytes[n] = value & 0x7f;
+    value >>= 7;
+    if (value != 0)
+      bytes[n] |= 0x80;
+    n++;
+  }
+  while (value != 0);
+
+  g_byte_array_append (buf, bytes, n);
+}
+
+static void
+gum_pprof_append_uint_field (GByteArray * buf,
+                             guint field,
+                             guint64 value)
+{
+  gum_pprof_append_varint (buf, field << 3);
+  gum_pprof_append_varint (buf, value);
+}
+
+static void
+gum_pprof_append_bytes_field (GByteArray * buf,
+                              guint field,
+                              gconstpointer data,
+                              gsize size)
+{
+  gum_pprof_append_varint (buf, (field << 3) | 2);
+  gum_pprof_append_varint (buf, size);
+  g_byte_array_append (buf, data, size);
+}
+
+/*
+ * Top-level fields of a message may appear in any order and repeated fields
+ * are simply concatenated, so the profile is streamed one field at a time.
+ */
+static void
+gum_pprof_emit_message (guint field,
+                        GByteArray * message,
+                        GumProfileOutputFunc func,
+                        gpointer user_data)
+{
+  GByteArray * header;
+
+  header = g_byte_array_sized_new (12);
+  gum_pprof_append_varint (header, (field << 3) | 2);
+  gum_pprof_append_varint (header, message->len);
+
+  func (header->data, header->len, user_data);
+  func (message->data, message->len, user_data);
+
+  g_byte_array_unref (header);
+}
+
 guint
 gum_profiler_get_number_of_threads (GumProfiler * self)
 {
@@ -541,18 +1039,21 @@ gum_profiler_get_total_duration_of (GumProfiler * self,
                                     guint thread_index,
                                     gpointer function_address)
 {
+  GumSample result = 0;
   GumFunctionContext * function_ctx;
+  GumFunctionThreadContext * thread_ctx = NULL;
 
   GUM_PROFILER_LOCK ();
   function_ctx = (GumFunctionContext *)
       g_hash_table_lookup (self->function_by_address, function_address);
+  if (function_ctx != NULL)
+    thread_ctx = gum_function_context_get_nth_thread (function_ctx,
+        thread_index);
+  if (thread_ctx != NULL)
+    result = thread_ctx->total_duration;
   GUM_PROFILER_UNLOCK ();
 
-  if (function_ctx != NULL
-      && (gint) thread_index < function_ctx->thread_context_count)
-    return function_ctx->thread_contexts[thread_index].total_duration;
-  else
-    return 0;
+  return result;
 }
 
 GumSample
@@ -560,18 +1061,21 @@ gum_profiler_get_worst_case_duration_of (GumProfiler * self,
                                          guint thread_index,
                                          gpointer function_address)
 {
+  GumSample result = 0;
   GumFunctionContext * function_ctx;
+  GumFunctionThreadContext * thread_ctx = NULL;
 
   GUM_PROFILER_LOCK ();
   function_ctx = (GumFunctionContext *)
       g_hash_table_lookup (self->function_by_address, function_address);
+  if (function_ctx != NULL)
+    thread_ctx = gum_function_context_get_nth_thread (function_ctx,
+        thread_index);
+  if (thread_ctx != NULL)
+    result = thread_ctx->worst_case.duration;
   GUM_PROFILER_UNLOCK ();
 
-  if (function_ctx != NULL
-      && (gint) thread_index < function_ctx->thread_context_count)
-    return function_ctx->thread_contexts[thread_index].worst_case.duration;
-  else
-    return 0;
+  return result;
 }
 
 const gchar *
@@ -579,18 +1083,21 @@ gum_profiler_get_worst_case_info_of (GumProfiler * self,
                                      guint thread_index,
                                      gpointer function_address)
 {
+  const gchar * result = "";
   GumFunctionContext * function_ctx;
+  GumFunctionThreadContext * thread_ctx = NULL;
 
   GUM_PROFILER_LOCK ();
   function_ctx = (GumFunctionContext *)
       g_hash_table_lookup (self->function_by_address, function_address);
+  if (function_ctx != NULL)
+    thread_ctx = gum_function_context_get_nth_thread (function_ctx,
+        thread_index);
+  if (thread_ctx != NULL)
+    result = thread_ctx->worst_case.info.buf;
   GUM_PROFILER_UNLOCK ();
 
-  if (function_ctx != NULL
-      && (gint) thread_index < function_ctx->thread_context_count)
-    return function_ctx->thread_contexts[thread_index].worst_case.info.buf;
-  else
-    return "";
+  return result;
 }
 
 static void
@@ -617,41 +1124,94 @@ get_number_of_threads_foreach (gpointer key,
 {
   GumFunctionContext * function_ctx = value;
   GHashTable * unique_thread_id_set = user_data;
-  guint thread_count = function_ctx->thread_context_count;
   guint i;
 
-  for (i = 0; i < thread_count; i++)
+  for (i = 0; i != function_ctx->thread_contexts->len; i++)
   {
+    GumFunctionThreadContext * thread_ctx =
+        g_ptr_array_index (function_ctx->thread_contexts, i);
+
     g_hash_table_insert (unique_thread_id_set,
-        GUINT_TO_POINTER (function_ctx->thread_contexts[i].thread_id), NULL);
+        GUINT_TO_POINTER (thread_ctx->thread_id), NULL);
   }
 }
 
-GumFunctionThreadContext *
+static GumFunctionThreadContext *
 gum_function_context_get_current_thread (GumFunctionContext * function_ctx,
+                                         GumProfilerContext * profiler_ctx,
+                                         GumProfiler * profiler,
                                          GumInvocationContext * context)
 {
-  guint32 current_thread_id;
-  guint thread_count;
-  guint i;
+  guint slot = profiler_ctx->thread_slot;
+  GumThreadContextTable * table;
+
+  table = g_atomic_pointer_get (&function_ctx->thread_table);
+  if (table != NULL && slot < table->capacity && table->items[slot] != NULL)
+    return table->items[slot];
+
+  return gum_function_context_add_thread (function_ctx, slot, profiler,
+      context);
+}
+
+static GumFunctionThreadContext *
+gum_function_context_add_thread (GumFunctionContext * function_ctx,
+                                 guint slot,
+                                 GumProfiler * profiler,
+                                 GumInvocationContext * context)
+{
+  GumProfiler * self = profiler;
+  GumThreadContextTable * table;
   GumFunctionThreadContext * thread_ctx;
 
-  current_thread_id = gum_invocation_context_get_thread_id (context);
+  GUM_PROFILER_LOCK ();
+
+  table = function_ctx->thread_table;
+  if (table == NULL || slot >= table->capacity)
+  {
+    guint capacity;
+    GumThreadContextTable * new_table;
+
+    capacity = (table != NULL) ? table->capacity : 8;
+    while (capacity <= slot)
+      capacity *= 2;
 
-  thread_count = g_atomic_int_get (&function_ctx->thread_context_count);
-  for (i = 0; i != thread_count; i++)
+    new_table = g_malloc0 (G_STRUCT_OFFSET (GumThreadContextTable, items) +
+        (capacity * sizeof (GumFunctionThreadContext *)));
+    new_table->capacity = capacity;
+    if (table != NULL)
+    {
+      memcpy (new_table->items, table->items,
+          table->capacity * sizeof (GumFunctionThreadContext *));
+      function_ctx->retired_tables =
+          g_slist_prepend (function_ctx->retired_tables, table);
+    }
+
+    g_atomic_pointer_set (&function_ctx->thread_table, new_table);
+    table = new_table;
+  }
+
+  thread_ctx = table->items[slot];
+  if (thread_ctx == NULL)
   {
-    thread_ctx = &function_ctx->thread_contexts[i];
+    thread_ctx = g_new0 (GumFunctionThreadContext, 1);
+    thread_ctx->function_ctx = function_ctx;
+    thread_ctx->thread_id = gum_invocation_context_get_thread_id (context);
 
-    if (thread_ctx->thread_id == current_thread_id)
-      return thread_ctx;
+    g_ptr_array_add (function_ctx->thread_contexts, thread_ctx);
+    g_atomic_pointer_set (&table->items[slot], thread_ctx);
   }
 
-  i = g_atomic_int_add (&function_ctx->thread_context_count, 1);
-  g_assert (i < G_N_ELEMENTS (function_ctx->thread_contexts));
-  thread_ctx = &function_ctx->thread_contexts[i];
-  thread_ctx->function_ctx = function_ctx;
-  thread_ctx->thread_id = current_thread_id;
+  GUM_PROFILER_UNLOCK ();
 
   return thread_ctx;
 }
+
+static GumFunctionThreadContext *
+gum_function_context_get_nth_thread (GumFunctionContext * function_ctx,
+                                     guint n)
+{
+  if (n >= function_ctx->thread_contexts->len)
+    return NULL;
+
+  return g_ptr_array_index (function_ctx->thread_contexts, n);
+}
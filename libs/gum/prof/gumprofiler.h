@@ -30,6 +30,15 @@ typedef gboolean (* GumFunctionMatchFilterFunc) (const gchar * function_name,
 typedef void (* GumWorstCaseInspectorFunc) (GumInvocationContext * context,
     gchar * output_buf, guint output_buf_len, gpointer user_data);
 
+typedef enum
+{
+  GUM_PROFILE_FORMAT_COLLAPSED_STACKS,
+  GUM_PROFILE_FORMAT_PPROF
+} GumProfileFormat;
+
+typedef void (* GumProfileOutputFunc) (gconstpointer data, gsize size,
+    gpointer user_data);
+
 GUM_API GumProfiler * gum_profiler_new (void);
 
 GUM_API void gum_profiler_instrument_functions_matching (GumProfiler * self,
@@ -42,6 +51,8 @@ GUM_API GumInstrumentReturn gum_profiler_instrument_function_with_inspector (
     GumWorstCaseInspectorFunc inspector_func, gpointer user_data);
 
 GUM_API GumProfileReport * gum_profiler_generate_report (GumProfiler * self);
+GUM_API void gum_profiler_export (GumProfiler * self, GumProfileFormat format,
+    GumProfileOutputFunc func, gpointer user_data);
 
 GUM_API guint gum_profiler_get_number_of_threads (GumProfiler * self);
 GUM_API GumSample gum_profiler_get_total_duration_of (GumProfiler * self,
@@ -0,0 +1,786 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumsamplingprofiler.h"
+
+#include "gumprocess.h"
+#include "gumstacktable.h"
+#include "gumsymbolutil.h"
+
+#include <string.h>
+#ifdef HAVE_LINUX
+# include "backend-linux/gumlinux.h"
+
+# include <errno.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/syscall.h>
+# include <sys/time.h>
+# include <sys/uio.h>
+#else
+# include "gumexceptor.h"
+#endif
+
+/*
+ * Nothing is instrumented: every `interval` microseconds the stack of a
+ * running thread is captured by walking its frame pointers, interned, and
+ * counted. Code built without frame pointers yields shorter stacks but is
+ * still attributed by program counter.
+ *
+ * On Linux an ITIMER_PROF timer delivers SIGPROF to whichever thread is
+ * burning CPU, so samples are proportional to CPU time. The handler has to be
+ * async-signal-safe: it reads the stack through process_vm_readv(), which
+ * fails gracefully on a bad frame pointer, and writes into a fixed ring of
+ * slots that a helper thread drains into the stack table. Samples arriving
+ * while the ring is full are dropped and counted. As SIGPROF is process-wide
+ * only one sampling profiler can run at a time, and the handler stays
+ * installed once started, chaining to any previous handler, so a stray timer
+ * signal never terminates the process.
+ *
+ * Elsewhere a helper thread suspends each thread in turn, walks its stack
+ * with faults caught by the exceptor, and resumes it before interning
+ * anything, since the suspended thread may be holding the heap lock. All
+ * threads are sampled, so time spent blocked shows up too.
+ */
+
+#define GUM_DEFAULT_SAMPLING_INTERVAL 1000
+
+#if defined (HAVE_I386)
+# define GUM_SAMPLE_PC(c) GUM_CPU_CONTEXT_XIP (c)
+# define GUM_SAMPLE_FP(c) GUM_CPU_CONTEXT_XBP (c)
+#elif defined (HAVE_ARM64)
+# define GUM_SAMPLE_PC(c) ((c)->pc)
+# define GUM_SAMPLE_FP(c) ((c)->fp)
+#elif defined (HAVE_ARM) && defined (HAVE_DARWIN)
+# define GUM_SAMPLE_PC(c) ((c)->pc)
+# define GUM_SAMPLE_FP(c) ((c)->r[7])
+#else
+# define GUM_SAMPLE_PC(c) ((c)->pc)
+#endif
+#define GUM_FP_IS_ALIGNED(F) \
+    ((GPOINTER_TO_SIZE (F) & (sizeof (gpointer) - 1)) == 0)
+
+#ifdef HAVE_LINUX
+# define GUM_SAMPLE_SLOT_COUNT 1024
+# define GUM_DRAIN_INTERVAL (10 * 1000)
+#else
+# define GUM_THREAD_REFRESH_TICKS 50
+#endif
+
+typedef struct _GumSampleSlot GumSampleSlot;
+typedef struct _GumSuspendedCapture GumSuspendedCapture;
+typedef struct _GumHotFunction GumHotFunction;
+
+enum
+{
+  PROP_0,
+  PROP_INTERVAL
+};
+
+struct _GumSamplingProfiler
+{
+  GObject parent;
+
+  guint interval;
+  gboolean running;
+  volatile gint stopping;
+  GThread * thread;
+
+  GMutex mutex;
+  GumStackTable * stacks;
+  GHashTable * stack_counts;
+  volatile gint total_samples;
+  volatile gint dropped_samples;
+
+#ifdef HAVE_LINUX
+  GumSampleSlot * slots;
+  volatile gint next_slot;
+#else
+  GumExceptor * exceptor;
+  GumThreadId sampler_thread_id;
+  GArray * threads;
+#endif
+};
+
+#ifdef HAVE_LINUX
+
+enum _GumSampleSlotState
+{
+  GUM_SAMPLE_SLOT_EMPTY,
+  GUM_SAMPLE_SLOT_WRITING,
+  GUM_SAMPLE_SLOT_FULL
+};
+
+struct _GumSampleSlot
+{
+  volatile gint state;
+  GumReturnAddressArray stack;
+};
+
+#else
+
+struct _GumSuspendedCapture
+{
+  GumExceptor * exceptor;
+  GumReturnAddressArray stack;
+};
+
+#endif
+
+struct _GumHotFunction
+{
+  GumHotFunctionDetails details;
+  guint last_stack;
+};
+
+static void gum_sampling_profiler_dispose (GObject * object);
+static void gum_sampling_profiler_finalize (GObject * object);
+static void gum_sampling_profiler_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gum_sampling_profiler_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+
+static void gum_sampling_profiler_start_backend (GumSamplingProfiler * self);
+static void gum_sampling_profiler_stop_backend (GumSamplingProfiler * self);
+#ifdef HAVE_LINUX
+static gpointer gum_sampling_profiler_drain_loop (gpointer data);
+static void gum_sampling_profiler_drain (GumSamplingProfiler * self);
+static void gum_sampling_profiler_on_sigprof (int sig, siginfo_t * siginfo,
+    void * context);
+#else
+static gpointer gum_sampling_profiler_suspend_loop (gpointer data);
+static gboolean gum_sampling_profiler_collect_thread (
+    const GumThreadDetails * details, gpointer user_data);
+static void gum_sampling_profiler_capture_suspended (GumThreadId thread_id,
+    GumCpuContext * cpu_context, gpointer user_data);
+#endif
+static void gum_sampling_profiler_add_sample (GumSamplingProfiler * self,
+    const GumReturnAddressArray * stack);
+static void gum_sampling_profiler_walk_stack (
+    const GumCpuContext * cpu_context, GumReturnAddressArray * stack);
+static gboolean gum_sampling_profiler_read_frame (gpointer * frame,
+    gpointer * link);
+
+static gint gum_hot_function_compare (const GumHotFunction ** a,
+    const GumHotFunction ** b);
+static void gum_hot_function_free (GumHotFunction * function);
+
+G_DEFINE_TYPE (GumSamplingProfiler, gum_sampling_profiler, G_TYPE_OBJECT)
+
+#ifdef HAVE_LINUX
+G_LOCK_DEFINE_STATIC (gum_sigprof);
+static gboolean gum_sigprof_installed = FALSE;
+static struct sigaction gum_sigprof_previous_action;
+static gpointer gum_sigprof_profiler = NULL;
+static volatile gint gum_sigprof_in_flight = 0;
+#endif
+
+static void
+gum_sampling_profiler_class_init (GumSamplingProfilerClass * klass)
+{
+  GObjectClass * object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gum_sampling_profiler_dispose;
+  object_class->finalize = gum_sampling_profiler_finalize;
+  object_class->get_property = gum_sampling_profiler_get_property;
+  object_class->set_property = gum_sampling_profiler_set_property;
+
+  g_object_class_install_property (object_class, PROP_INTERVAL,
+      g_param_spec_uint ("interval", "Interval",
+      "Sampling interval in microseconds",
+      1, G_MAXUINT, GUM_DEFAULT_SAMPLING_INTERVAL,
+      G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gum_sampling_profiler_init (GumSamplingProfiler * self)
+{
+  self->interval = GUM_DEFAULT_SAMPLING_INTERVAL;
+
+  g_mutex_init (&self->mutex);
+  self->stacks = gum_stack_table_new ();
+  self->stack_counts = g_hash_table_new (NULL, NULL);
+}
+
+static void
+gum_sampling_profiler_dispose (GObject * object)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER (object);
+
+  gum_sampling_profiler_stop (self);
+
+  G_OBJECT_CLASS (gum_sampling_profiler_parent_class)->dispose (object);
+}
+
+static void
+gum_sampling_profiler_finalize (GObject * object)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER (object);
+
+#ifdef HAVE_LINUX
+  g_free (self->slots);
+#endif
+
+  g_hash_table_unref (self->stack_counts);
+  g_object_unref (self->stacks);
+  g_mutex_clear (&self->mutex);
+
+  G_OBJECT_CLASS (gum_sampling_profiler_parent_class)->finalize (object);
+}
+
+static void
+gum_sampling_profiler_get_property (GObject * object,
+                                    guint property_id,
+                                    GValue * value,
+                                    GParamSpec * pspec)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER (object);
+
+  switch (property_id)
+  {
+    case PROP_INTERVAL:
+      g_value_set_uint (value, gum_sampling_profiler_get_interval (self));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+static void
+gum_sampling_profiler_set_property (GObject * object,
+                                    guint property_id,
+                                    const GValue * value,
+                                    GParamSpec * pspec)
+{
+  GumSamplingProfiler * self = GUM_SAMPLING_PROFILER (object);
+
+  switch (property_id)
+  {
+    case PROP_INTERVAL:
+      gum_sampling_profiler_set_interval (self, g_value_get_uint (value));
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+  }
+}
+
+GumSamplingProfiler *
+gum_sampling_profiler_new (void)
+{
+  return g_object_new (GUM_TYPE_SAMPLING_PROFILER, NULL);
+}
+
+guint
+gum_sampling_profiler_get_interval (GumSamplingProfiler * self)
+{
+  return self->interval;
+}
+
+void
+gum_sampling_profiler_set_interval (GumSamplingProfiler * self,
+                                    guint interval)
+{
+  g_return_if_fail (!self->running);
+  g_return_if_fail (interval != 0);
+
+  self->interval = interval;
+}
+
+void
+gum_sampling_profiler_start (GumSamplingProfiler * self)
+{
+  if (self->running)
+    return;
+
+  self->running = TRUE;
+  self->stopping = FALSE;
+
+  gum_sampling_profiler_start_backend (self);
+}
+
+void
+gum_sampling_profiler_stop (GumSamplingProfiler * self)
+{
+  if (!self->running)
+    return;
+
+  gum_sampling_profiler_stop_backend (self);
+
+  self->running = FALSE;
+}
+
+guint
+gum_sampling_profiler_get_total_samples (GumSamplingProfiler * self)
+{
+  return g_atomic_int_get (&self->total_samples);
+}
+
+guint
+gum_sampling_profiler_get_dropped_samples (GumSamplingProfiler * self)
+{
+  return g_atomic_int_get (&self->dropped_samples);
+}
+
+/*
+ * Calls `func` for each function seen so far, hottest first. Self samples are
+ * those where the function was executing, total samples those where it was
+ * anywhere on the stack, counting recursive calls once.
+ */
+void
+gum_sampling_profiler_enumerate_hot_functions (GumSamplingProfiler * self,
+                                               GumFoundHotFunctionFunc func,
+                                               gpointer user_data)
+{
+  GArray * counts;
+  GHashTable * names, * functions;
+  GPtrArray * sorted;
+  GHashTableIter iter;
+  gpointer id, count, function;
+  guint i;
+
+  counts = g_array_new (FALSE, FALSE, sizeof (gpointer));
+  g_mutex_lock (&self->mutex);
+  g_hash_table_iter_init (&iter, self->stack_counts);
+  while (g_hash_table_iter_next (&iter, &id, &count))
+  {
+    g_array_append_val (counts, id);
+    g_array_append_val (counts, count);
+  }
+  g_mutex_unlock (&self->mutex);
+
+  names = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  functions = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+      (GDestroyNotify) gum_hot_function_free);
+
+  for (i = 0; i != counts->len; i += 2)
+  {
+    GumReturnAddressArray stack;
+    guint n, j;
+
+    if (!gum_stack_table_lookup (self->stacks,
+        GPOINTER_TO_UINT (g_array_index (counts, gpointer, i)), &stack))
+      continue;
+    n = GPOINTER_TO_UINT (g_array_index (counts, gpointer, i + 1));
+
+    for (j = 0; j != stack.len; j++)
+    {
+      gpointer address = stack.items[j];
+      gchar * name;
+      GumHotFunction * function;
+
+      name = g_hash_table_lookup (names, address);
+      if (name == NULL)
+      {
+        name = gum_symbol_name_from_address (address);
+        g_hash_table_insert (names, address, name);
+      }
+
+      function = g_hash_table_lookup (functions, name);
+      if (function == NULL)
+      {
+        function = g_slice_new0 (GumHotFunction);
+        function->details.name = g_strdup (name);
+        g_hash_table_insert (functions, (gpointer) function->details.name,
+            function);
+      }
+
+      if (j == 0)
+        function->details.self_samples += n;
+
+      if (function->last_stack != i + 1)
+      {
+        function->details.total_samples += n;
+        function->last_stack = i + 1;
+      }
+    }
+  }
+
+  sorted = g_ptr_array_sized_new (g_hash_table_size (functions));
+  g_hash_table_iter_init (&iter, functions);
+  while (g_hash_table_iter_next (&iter, NULL, &function))
+    g_ptr_array_add (sorted, function);
+  g_ptr_array_sort (sorted, (GCompareFunc) gum_hot_function_compare);
+
+  for (i = 0; i != sorted->len; i++)
+  {
+    GumHotFunction * function = g_ptr_array_index (sorted, i);
+
+    if (!func (&function->details, user_data))
+      break;
+  }
+
+  g_ptr_array_unref (sorted);
+  g_hash_table_unref (functions);
+  g_hash_table_unref (names);
+  g_array_free (counts, TRUE);
+}
+
+#ifdef HAVE_LINUX
+
+static void
+gum_sampling_profiler_start_backend (GumSamplingProfiler * self)
+{
+  struct itimerval timer;
+
+  if (self->slots == NULL)
+    self->slots = g_new0 (GumSampleSlot, GUM_SAMPLE_SLOT_COUNT);
+
+  G_LOCK (gum_sigprof);
+
+  g_assert (gum_sigprof_profiler == NULL);
+  g_atomic_pointer_set (&gum_sigprof_profiler, self);
+
+  if (!gum_sigprof_installed)
+  {
+    struct sigaction action;
+
+    memset (&action, 0, sizeof (action));
+    action.sa_sigaction = gum_sampling_profiler_on_sigprof;
+    sigemptyset (&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigaction (SIGPROF, &action, &gum_sigprof_previous_action);
+
+    gum_sigprof_installed = TRUE;
+  }
+
+  timer.it_interval.tv_sec = self->interval / G_USEC_PER_SEC;
+  timer.it_interval.tv_usec = self->interval % G_USEC_PER_SEC;
+  timer.it_value = timer.it_interval;
+  setitimer (ITIMER_PROF, &timer, NULL);
+
+  G_UNLOCK (gum_sigprof);
+
+  self->thread = g_thread_new ("gum-sampling-profiler",
+      gum_sampling_profiler_drain_loop, self);
+}
+
+static void
+gum_sampling_profiler_stop_backend (GumSamplingProfiler * self)
+{
+  struct itimerval timer;
+
+  G_LOCK (gum_sigprof);
+
+  memset (&timer, 0, sizeof (timer));
+  setitimer (ITIMER_PROF, &timer, NULL);
+
+  g_atomic_pointer_set (&gum_sigprof_profiler, NULL);
+  while (g_atomic_int_get (&gum_sigprof_in_flight) != 0)
+    g_thread_yield ();
+
+  G_UNLOCK (gum_sigprof);
+
+  g_atomic_int_set (&self->stopping, TRUE);
+  g_thread_join (self->thread);
+  self->thread = NULL;
+
+  gum_sampling_profiler_drain (self);
+}
+
+static gpointer
+gum_sampling_profiler_drain_loop (gpointer data)
+{
+  GumSamplingProfiler * self = data;
+
+  while (!g_atomic_int_get (&self->stopping))
+  {
+    g_usleep (GUM_DRAIN_INTERVAL);
+
+    gum_sampling_profiler_drain (self);
+  }
+
+  return NULL;
+}
+
+static void
+gum_sampling_profiler_drain (GumSamplingProfiler * self)
+{
+  guint i;
+
+  for (i = 0; i != GUM_SAMPLE_SLOT_COUNT; i++)
+  {
+    GumSampleSlot * slot = &self->slots[i];
+
+    if (g_atomic_int_get (&slot->state) != GUM_SAMPLE_SLOT_FULL)
+      continue;
+
+    gum_sampling_profiler_add_sample (self, &slot->stack);
+
+    g_atomic_int_set (&slot->state, GUM_SAMPLE_SLOT_EMPTY);
+  }
+}
+
+static void
+gum_sampling_profiler_on_sigprof (int sig,
+                                  siginfo_t * siginfo,
+                                  void * context)
+{
+  gint saved_errno = errno;
+  GumSamplingProfiler * self;
+
+  g_atomic_int_inc (&gum_sigprof_in_flight);
+
+  self = g_atomic_pointer_get (&gum_sigprof_profiler);
+  if (self != NULL)
+  {
+    GumSampleSlot * slot;
+
+    slot = &self->slots[(guint) g_atomic_int_add (&self->next_slot, 1) %
+        GUM_SAMPLE_SLOT_COUNT];
+
+    if (g_atomic_int_compare_and_exchange (&slot->state,
+        GUM_SAMPLE_SLOT_EMPTY, GUM_SAMPLE_SLOT_WRITING))
+    {
+      GumCpuContext cpu_context;
+
+      gum_linux_parse_ucontext (context, &cpu_context);
+      gum_sampling_profiler_walk_stack (&cpu_context, &slot->stack);
+
+      g_atomic_int_set (&slot->state, GUM_SAMPLE_SLOT_FULL);
+    }
+    else
+    {
+      g_atomic_int_inc (&self->dropped_samples);
+    }
+  }
+  else if ((gum_sigprof_previous_action.sa_flags & SA_SIGINFO) != 0)
+  {
+    if (gum_sigprof_previous_action.sa_sigaction != NULL)
+      gum_sigprof_previous_action.sa_sigaction (sig, siginfo, context);
+  }
+  else if (gum_sigprof_previous_action.sa_handler != SIG_DFL &&
+      gum_sigprof_previous_action.sa_handler != SIG_IGN)
+  {
+    gum_sigprof_previous_action.sa_handler (sig);
+  }
+
+  g_atomic_int_add (&gum_sigprof_in_flight, -1);
+
+  errno = saved_errno;
+}
+
+static gboolean
+gum_sampling_profiler_read_frame (gpointer * frame,
+                                  gpointer * link)
+{
+#ifdef __NR_process_vm_readv
+  struct iovec local, remote;
+
+  local.iov_base = link;
+  local.iov_len = 2 * sizeof (gpointer);
+  remote.iov_base = frame;
+  remote.iov_len = local.iov_len;
+
+  return syscall (__NR_process_vm_readv, getpid (), &local, 1, &remote, 1,
+      0) == (gssize) local.iov_len;
+#else
+  return FALSE;
+#endif
+}
+
+#else
+
+static void
+gum_sampling_profiler_start_backend (GumSamplingProfiler * self)
+{
+  self->exceptor = gum_exceptor_obtain ();
+  self->threads = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+
+  self->thread = g_thread_new ("gum-sampling-profiler",
+      gum_sampling_profiler_suspend_loop, self);
+}
+
+static void
+gum_sampling_profiler_stop_backend (GumSamplingProfiler * self)
+{
+  g_atomic_int_set (&self->stopping, TRUE);
+  g_thread_join (self->thread);
+  self->thread = NULL;
+
+  g_array_free (self->threads, TRUE);
+  self->threads = NULL;
+
+  g_object_unref (self->exceptor);
+  self->exceptor = NULL;
+}
+
+#ifdef _MSC_VER
+# pragma warning (push)
+# pragma warning (disable: 4611)
+#endif
+
+static gpointer
+gum_sampling_profiler_suspend_loop (gpointer data)
+{
+  GumSamplingProfiler * self = data;
+  GumSuspendedCapture capture;
+  GumExceptorScope scope;
+  guint tick;
+
+  self->sampler_thread_id = gum_process_get_current_thread_id ();
+
+  capture.exceptor = self->exceptor;
+
+  /*
+   * Set up this thread's exceptor state while no other thread is suspended,
+   * as that may allocate.
+   */
+  if (gum_exceptor_try (self->exceptor, &scope))
+  {
+  }
+  gum_exceptor_catch (self->exceptor, &scope);
+
+  for (tick = 0; !g_atomic_int_get (&self->stopping); tick++)
+  {
+    guint i;
+
+    if (tick % GUM_THREAD_REFRESH_TICKS == 0)
+    {
+      g_array_set_size (self->threads, 0);
+      gum_process_enumerate_threads (gum_sampling_profiler_collect_thread,
+          self);
+    }
+
+    for (i = 0; i != self->threads->len; i++)
+    {
+      capture.stack.len = 0;
+
+      if (gum_process_modify_thread (
+          g_array_index (self->threads, GumThreadId, i),
+          gum_sampling_profiler_capture_suspended, &capture) &&
+          capture.stack.len != 0)
+      {
+        gum_sampling_profiler_add_sample (self, &capture.stack);
+      }
+    }
+
+    g_usleep (self->interval);
+  }
+
+  return NULL;
+}
+
+static gboolean
+gum_sampling_profiler_collect_thread (const GumThreadDetails * details,
+                                      gpointer user_data)
+{
+  GumSamplingProfiler * self = user_data;
+
+  if (details->id != self->sampler_thread_id)
+    g_array_append_val (self->threads, details->id);
+
+  return TRUE;
+}
+
+static void
+gum_sampling_profiler_capture_suspended (GumThreadId thread_id,
+                                         GumCpuContext * cpu_context,
+                                         gpointer user_data)
+{
+  GumSuspendedCapture * capture = user_data;
+  GumExceptorScope scope;
+
+  if (gum_exceptor_try (capture->exceptor, &scope))
+    gum_sampling_profiler_walk_stack (cpu_context, &capture->stack);
+
+  gum_exceptor_catch (capture->exceptor, &scope);
+}
+
+#ifdef _MSC_VER
+# pragma warning (pop)
+#endif
+
+static gboolean
+gum_sampling_profiler_read_frame (gpointer * frame,
+                                  gpointer * link)
+{
+  link[0] = frame[0];
+  link[1] = frame[1];
+
+  return TRUE;
+}
+
+#endif
+
+static void
+gum_sampling_profiler_add_sample (GumSamplingProfiler * self,
+                                  const GumReturnAddressArray * stack)
+{
+  gpointer id;
+  guint count;
+
+  id = GUINT_TO_POINTER (gum_stack_table_intern (self->stacks, stack));
+
+  g_mutex_lock (&self->mutex);
+  count = GPOINTER_TO_UINT (g_hash_table_lookup (self->stack_counts, id));
+  g_hash_table_insert (self->stack_counts, id, GUINT_TO_POINTER (count + 1));
+  g_mutex_unlock (&self->mutex);
+
+  g_atomic_int_inc (&self->total_samples);
+}
+
+/*
+ * Must not allocate or take locks, as it runs in a signal handler on Linux
+ * and with another thread suspended elsewhere.
+ */
+static void
+gum_sampling_profiler_walk_stack (const GumCpuContext * cpu_context,
+                                  GumReturnAddressArray * stack)
+{
+#ifdef GUM_SAMPLE_FP
+  gpointer * frame;
+  guint i;
+#endif
+
+  stack->items[0] = GSIZE_TO_POINTER (GUM_SAMPLE_PC (cpu_context));
+  stack->len = 1;
+
+#ifdef GUM_SAMPLE_FP
+  frame = GSIZE_TO_POINTER (GUM_SAMPLE_FP (cpu_context));
+
+  for (i = 1; i != G_N_ELEMENTS (stack->items); i++)
+  {
+    gpointer link[2];
+
+    if (frame == NULL || !GUM_FP_IS_ALIGNED (frame) ||
+        !gum_sampling_profiler_read_frame (frame, link) || link[1] == NULL)
+    {
+      break;
+    }
+
+    stack->items[i] = link[1];
+    stack->len = i + 1;
+
+    if ((gpointer *) link[0] <= frame)
+      break;
+    frame = link[0];
+  }
+#endif
+}
+
+static gint
+gum_hot_function_compare (const GumHotFunction ** a,
+                          const GumHotFunction ** b)
+{
+  const GumHotFunctionDetails * x = &(*a)->details;
+  const GumHotFunctionDetails * y = &(*b)->details;
+
+  if (x->self_samples != y->self_samples)
+    return (x->self_samples > y->self_samples) ? -1 : 1;
+
+  if (x->total_samples != y->total_samples)
+    return (x->total_samples > y->total_samples) ? -1 : 1;
+
+  return strcmp (x->name, y->name);
+}
+
+static void
+gum_hot_function_free (GumHotFunction * function)
+{
+  g_free ((gchar *) function->details.name);
+
+  g_slice_free (GumHotFunction, function);
+}
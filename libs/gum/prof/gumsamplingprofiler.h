@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_SAMPLING_PROFILER_H__
+#define __GUM_SAMPLING_PROFILER_H__
+
+#include <glib-object.h>
+#include <gum/gumdefs.h>
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_SAMPLING_PROFILER (gum_sampling_profiler_get_type ())
+G_DECLARE_FINAL_TYPE (GumSamplingProfiler, gum_sampling_profiler, GUM,
+    SAMPLING_PROFILER, GObject)
+
+typedef struct _GumHotFunctionDetails GumHotFunctionDetails;
+
+typedef gboolean (* GumFoundHotFunctionFunc) (
+    const GumHotFunctionDetails * details, gpointer user_data);
+
+struct _GumHotFunctionDetails
+{
+  const gchar * name;
+  guint self_samples;
+  guint total_samples;
+};
+
+GUM_API GumSamplingProfiler * gum_sampling_profiler_new (void);
+
+GUM_API guint gum_sampling_profiler_get_interval (GumSamplingProfiler * self);
+GUM_API void gum_sampling_profiler_set_interval (GumSamplingProfiler * self,
+    guint interval);
+
+GUM_API void gum_sampling_profiler_start (GumSamplingProfiler * self);
+GUM_API void gum_sampling_profiler_stop (GumSamplingProfiler * self);
+
+GUM_API guint gum_sampling_profiler_get_total_samples (
+    GumSamplingProfiler * self);
+GUM_API guint gum_sampling_profiler_get_dropped_samples (
+    GumSamplingProfiler * self);
+GUM_API void gum_sampling_profiler_enumerate_hot_functions (
+    GumSamplingProfiler * self, GumFoundHotFunctionFunc func,
+    gpointer user_data);
+
+G_END_DECLS
+
+#endif
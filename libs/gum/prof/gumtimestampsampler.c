@@ -0,0 +1,60 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumtimestampsampler.h"
+
+#include <gum/gumtimestamp.h>
+
+struct _GumTimestampSampler
+{
+  GObject parent;
+};
+
+static void gum_timestamp_sampler_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static GumSample gum_timestamp_sampler_sample (GumSampler * sampler);
+
+G_DEFINE_TYPE_EXTENDED (GumTimestampSampler,
+                        gum_timestamp_sampler,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_SAMPLER,
+                            gum_timestamp_sampler_iface_init))
+
+static void
+gum_timestamp_sampler_class_init (GumTimestampSamplerClass * klass)
+{
+}
+
+static void
+gum_timestamp_sampler_iface_init (gpointer g_iface,
+                                  gpointer iface_data)
+{
+  GumSamplerInterface * iface = g_iface;
+
+  iface->sample = gum_timestamp_sampler_sample;
+}
+
+static void
+gum_timestamp_sampler_init (GumTimestampSampler * self)
+{
+}
+
+/*
+ * Samples the clock that Stalker and the deferred listener take their
+ * timestamps from, in nanoseconds, so samples line up with their events.
+ */
+GumSampler *
+gum_timestamp_sampler_new (void)
+{
+  return g_object_new (GUM_TYPE_TIMESTAMP_SAMPLER, NULL);
+}
+
+static GumSample
+gum_timestamp_sampler_sample (GumSampler * sampler)
+{
+  return gum_timestamp_to_nanoseconds (gum_timestamp_now ());
+}
@@ -0,0 +1,22 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_TIMESTAMP_SAMPLER_H__
+#define __GUM_TIMESTAMP_SAMPLER_H__
+
+#include "gumsampler.h"
+
+G_BEGIN_DECLS
+
+#define GUM_TYPE_TIMESTAMP_SAMPLER (gum_timestamp_sampler_get_type ())
+G_DECLARE_FINAL_TYPE (GumTimestampSampler, gum_timestamp_sampler, GUM,
+    TIMESTAMP_SAMPLER, GObject)
+
+GUM_API GumSampler * gum_timestamp_sampler_new (void);
+
+G_END_DECLS
+
+#endif
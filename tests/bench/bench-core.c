@@ -0,0 +1,196 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumbench.h"
+
+#if defined (HAVE_WINDOWS)
+# define BENCH_EXPORT_MODULE "kernel32.dll"
+# define BENCH_EXPORT_NAME "Sleep"
+#elif defined (HAVE_DARWIN)
+# define BENCH_EXPORT_MODULE "libSystem.B.dylib"
+# define BENCH_EXPORT_NAME "sendto"
+#else
+# define BENCH_EXPORT_MODULE NULL
+# define BENCH_EXPORT_NAME "sendto"
+#endif
+
+#define BENCH_SCAN_SIZE (16 * 1024 * 1024)
+
+typedef struct _BenchScanFixture BenchScanFixture;
+
+struct _BenchScanFixture
+{
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  guint num_matches;
+};
+
+static gint bench_target_function (gint value);
+
+static gpointer bench_scan_setup (void);
+static void bench_scan_teardown (gpointer fixture);
+static void bench_scan (gpointer fixture, guint iterations);
+static gboolean bench_on_scan_match (GumAddress address, gsize size,
+    gpointer user_data);
+
+static void bench_enumerate_modules (gpointer fixture, guint iterations);
+static gboolean bench_on_module (const GumModuleDetails * details,
+    gpointer user_data);
+static void bench_enumerate_ranges (gpointer fixture, guint iterations);
+static gboolean bench_on_range (const GumRangeDetails * details,
+    gpointer user_data);
+static void bench_find_export (gpointer fixture, guint iterations);
+static void bench_symbol_from_address (gpointer fixture, guint iterations);
+
+const GumBenchmark gum_bench_core_benchmarks[] =
+{
+  { "memory/scan-16m", 1,
+    bench_scan_setup, bench_scan, bench_scan_teardown },
+  { "process/enumerate-modules", 10,
+    NULL, bench_enumerate_modules, NULL },
+  { "process/enumerate-ranges", 10,
+    NULL, bench_enumerate_ranges, NULL },
+  { "module/find-export", 1000,
+    NULL, bench_find_export, NULL },
+  { "symbol/details-from-address", 100,
+    NULL, bench_symbol_from_address, NULL },
+  GUM_BENCHMARK_LIST_END
+};
+
+volatile gint bench_dummy_global_to_trick_optimizer = 0;
+
+static gint GUM_NOINLINE
+bench_target_function (gint value)
+{
+  gint result = value;
+  guint i;
+
+  for (i = 0; i != 3; i++)
+    result = (result * 31) + bench_dummy_global_to_trick_optimizer;
+
+  return result;
+}
+
+static gpointer
+bench_scan_setup (void)
+{
+  BenchScanFixture * fixture;
+
+  fixture = g_slice_new (BenchScanFixture);
+  fixture->range.base_address = GUM_ADDRESS (g_malloc0 (BENCH_SCAN_SIZE));
+  fixture->range.size = BENCH_SCAN_SIZE;
+  fixture->pattern = gum_match_pattern_new_from_string ("13 37 ?? ff");
+  fixture->num_matches = 0;
+
+  return fixture;
+}
+
+static void
+bench_scan_teardown (gpointer fixture)
+{
+  BenchScanFixture * f = fixture;
+
+  gum_match_pattern_free (f->pattern);
+  g_free (GSIZE_TO_POINTER (f->range.base_address));
+
+  g_slice_free (BenchScanFixture, f);
+}
+
+static void
+bench_scan (gpointer fixture,
+            guint iterations)
+{
+  BenchScanFixture * f = fixture;
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+    gum_memory_scan (&f->range, f->pattern, bench_on_scan_match, f);
+}
+
+static gboolean
+bench_on_scan_match (GumAddress address,
+                     gsize size,
+                     gpointer user_data)
+{
+  BenchScanFixture * f = user_data;
+
+  f->num_matches++;
+
+  return TRUE;
+}
+
+static void
+bench_enumerate_modules (gpointer fixture,
+                         guint iterations)
+{
+  guint i, count = 0;
+
+  for (i = 0; i != iterations; i++)
+    gum_process_enumerate_modules (bench_on_module, &count);
+}
+
+static gboolean
+bench_on_module (const GumModuleDetails * details,
+                 gpointer user_data)
+{
+  guint * count = user_data;
+
+  (*count)++;
+
+  return TRUE;
+}
+
+static void
+bench_enumerate_ranges (gpointer fixture,
+                        guint iterations)
+{
+  guint i, count = 0;
+
+  for (i = 0; i != iterations; i++)
+    gum_process_enumerate_ranges (GUM_PAGE_NO_ACCESS, bench_on_range, &count);
+}
+
+static gboolean
+bench_on_range (const GumRangeDetails * details,
+                gpointer user_data)
+{
+  guint * count = user_data;
+
+  (*count)++;
+
+  return TRUE;
+}
+
+static void
+bench_find_export (gpointer fixture,
+                   guint iterations)
+{
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+  {
+    GumAddress address;
+
+    address = gum_module_find_export_by_name (BENCH_EXPORT_MODULE,
+        BENCH_EXPORT_NAME);
+    g_assert (address != 0);
+  }
+}
+
+static void
+bench_symbol_from_address (gpointer fixture,
+                           guint iterations)
+{
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+  {
+    GumDebugSymbolDetails details;
+
+    gum_symbol_details_from_address (
+        GUM_FUNCPTR_TO_POINTER (bench_target_function), &details);
+  }
+}
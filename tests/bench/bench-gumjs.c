@@ -0,0 +1,201 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumbench.h"
+
+#include "gumscriptbackend.h"
+
+#define BENCH_HOOK_SCRIPT \
+    "Interceptor.attach(ptr('0x%" G_GSIZE_MODIFIER "x'), {" \
+    "  onEnter: function (args) {}," \
+    "  onLeave: function (retval) {}" \
+    "});"
+#define BENCH_ECHO_SCRIPT \
+    "recv(function onMessage(message) {" \
+    "  send(message.payload);" \
+    "  recv(onMessage);" \
+    "});"
+
+typedef struct _BenchScriptFixture BenchScriptFixture;
+
+struct _BenchScriptFixture
+{
+  GumScript * script;
+  GMainContext * context;
+  guint num_messages;
+};
+
+static gint bench_script_target_function (gint value);
+
+static gpointer bench_duk_hook_setup (void);
+static gpointer bench_duk_echo_setup (void);
+#ifdef HAVE_V8
+static gpointer bench_v8_hook_setup (void);
+static gpointer bench_v8_echo_setup (void);
+#endif
+static gpointer bench_script_hook_setup (GumScriptBackend * backend);
+static gpointer bench_script_setup (GumScriptBackend * backend,
+    const gchar * source);
+static void bench_script_teardown (gpointer fixture);
+static void bench_script_on_message (GumScript * script,
+    const gchar * message, GBytes * data, gpointer user_data);
+
+static void bench_script_call_hooked (gpointer fixture, guint iterations);
+static void bench_script_send_round_trip (gpointer fixture,
+    guint iterations);
+
+const GumBenchmark gum_bench_gumjs_benchmarks[] =
+{
+  { "gumjs/duk/hook-enter-leave", 1000,
+    bench_duk_hook_setup, bench_script_call_hooked, bench_script_teardown },
+  { "gumjs/duk/send-round-trip", 100,
+    bench_duk_echo_setup, bench_script_send_round_trip,
+    bench_script_teardown },
+#ifdef HAVE_V8
+  { "gumjs/v8/hook-enter-leave", 1000,
+    bench_v8_hook_setup, bench_script_call_hooked, bench_script_teardown },
+  { "gumjs/v8/send-round-trip", 100,
+    bench_v8_echo_setup, bench_script_send_round_trip,
+    bench_script_teardown },
+#endif
+  GUM_BENCHMARK_LIST_END
+};
+
+volatile gint bench_script_dummy_global_to_trick_optimizer = 0;
+
+static gint GUM_NOINLINE
+bench_script_target_function (gint value)
+{
+  gint result = value;
+  guint i;
+
+  for (i = 0; i != 3; i++)
+    result = (result * 31) + bench_script_dummy_global_to_trick_optimizer;
+
+  return result;
+}
+
+static gpointer
+bench_duk_hook_setup (void)
+{
+  return bench_script_hook_setup (gum_script_backend_obtain_duk ());
+}
+
+static gpointer
+bench_duk_echo_setup (void)
+{
+  return bench_script_setup (gum_script_backend_obtain_duk (),
+      BENCH_ECHO_SCRIPT);
+}
+
+#ifdef HAVE_V8
+
+static gpointer
+bench_v8_hook_setup (void)
+{
+  return bench_script_hook_setup (gum_script_backend_obtain_v8 ());
+}
+
+static gpointer
+bench_v8_echo_setup (void)
+{
+  return bench_script_setup (gum_script_backend_obtain_v8 (),
+      BENCH_ECHO_SCRIPT);
+}
+
+#endif
+
+static gpointer
+bench_script_hook_setup (GumScriptBackend * backend)
+{
+  gpointer fixture;
+  gchar * source;
+
+  source = g_strdup_printf (BENCH_HOOK_SCRIPT,
+      GPOINTER_TO_SIZE (bench_script_target_function));
+  fixture = bench_script_setup (backend, source);
+  g_free (source);
+
+  return fixture;
+}
+
+static gpointer
+bench_script_setup (GumScriptBackend * backend,
+                    const gchar * source)
+{
+  BenchScriptFixture * fixture;
+  GError * error = NULL;
+
+  g_assert (backend != NULL);
+
+  fixture = g_slice_new (BenchScriptFixture);
+  fixture->context = g_main_context_ref_thread_default ();
+  fixture->num_messages = 0;
+
+  fixture->script = gum_script_backend_create_sync (backend, "bench", source,
+      NULL, &error);
+  g_assert_no_error (error);
+
+  gum_script_set_message_handler (fixture->script, bench_script_on_message,
+      fixture, NULL);
+  gum_script_load_sync (fixture->script, NULL);
+
+  return fixture;
+}
+
+static void
+bench_script_teardown (gpointer fixture)
+{
+  BenchScriptFixture * f = fixture;
+
+  gum_script_unload_sync (f->script, NULL);
+  g_object_unref (f->script);
+
+  while (g_main_context_pending (f->context))
+    g_main_context_iteration (f->context, FALSE);
+  g_main_context_unref (f->context);
+
+  g_slice_free (BenchScriptFixture, f);
+}
+
+static void
+bench_script_on_message (GumScript * script,
+                         const gchar * message,
+                         GBytes * data,
+                         gpointer user_data)
+{
+  BenchScriptFixture * f = user_data;
+
+  f->num_messages++;
+}
+
+static void
+bench_script_call_hooked (gpointer fixture,
+                          guint iterations)
+{
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+    bench_script_target_function (i);
+}
+
+static void
+bench_script_send_round_trip (gpointer fixture,
+                              guint iterations)
+{
+  BenchScriptFixture * f = fixture;
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+  {
+    guint expected = f->num_messages + 1;
+
+    gum_script_post (f->script, "{\"payload\":1}", NULL);
+
+    while (f->num_messages != expected)
+      g_main_context_iteration (f->context, TRUE);
+  }
+}
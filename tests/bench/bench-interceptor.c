@@ -0,0 +1,368 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumbench.h"
+
+/*
+ * Every call benchmark below calls the same target, so subtracting the
+ * interceptor/call-unhooked result from any of them gives the cost that
+ * the Interceptor adds for that listener shape on the current backend.
+ */
+
+typedef struct _BenchListener BenchListener;
+typedef struct _BenchListenerClass BenchListenerClass;
+typedef struct _BenchInterceptorFixture BenchInterceptorFixture;
+
+struct _BenchListener
+{
+  GObject parent;
+};
+
+struct _BenchListenerClass
+{
+  GObjectClass parent_class;
+};
+
+struct _BenchInterceptorFixture
+{
+  GumInterceptor * interceptor;
+  GPtrArray * listeners;
+  gboolean replaced;
+};
+
+#define BENCH_TYPE_LISTENER (bench_listener_get_type ())
+#define BENCH_TYPE_ENTER_LISTENER (bench_enter_listener_get_type ())
+#define BENCH_TYPE_LEAVE_LISTENER (bench_leave_listener_get_type ())
+
+typedef BenchListener BenchEnterListener;
+typedef BenchListenerClass BenchEnterListenerClass;
+typedef BenchListener BenchLeaveListener;
+typedef BenchListenerClass BenchLeaveListenerClass;
+
+static void bench_listener_iface_init (gpointer g_iface, gpointer iface_data);
+static void bench_enter_listener_iface_init (gpointer g_iface,
+    gpointer iface_data);
+static void bench_leave_listener_iface_init (gpointer g_iface,
+    gpointer iface_data);
+
+static gint bench_target_function (gint value);
+static gint bench_replacement_function (gint value);
+
+static void bench_call_target (gpointer fixture, guint iterations);
+static gpointer bench_enter_only_setup (void);
+static gpointer bench_leave_only_setup (void);
+static gpointer bench_enter_leave_setup (void);
+static gpointer bench_stacked_4_setup (void);
+static gpointer bench_stacked_16_setup (void);
+static gpointer bench_replace_setup (void);
+static gpointer bench_interceptor_setup (GType listener_type,
+    guint num_listeners);
+static gpointer bench_interceptor_attached_setup (GType listener_type,
+    guint num_listeners);
+static void bench_interceptor_teardown (gpointer fixture);
+static void bench_interceptor_attached_teardown (gpointer fixture);
+static gpointer bench_attach_detach_setup (void);
+static void bench_interceptor_attach_detach (gpointer fixture,
+    guint iterations);
+
+const GumBenchmark gum_bench_interceptor_benchmarks[] =
+{
+  { "interceptor/call-unhooked", 100000,
+    NULL, bench_call_target, NULL },
+  { "interceptor/enter", 10000,
+    bench_enter_only_setup, bench_call_target,
+    bench_interceptor_attached_teardown },
+  { "interceptor/leave", 10000,
+    bench_leave_only_setup, bench_call_target,
+    bench_interceptor_attached_teardown },
+  { "interceptor/enter-leave", 10000,
+    bench_enter_leave_setup, bench_call_target,
+    bench_interceptor_attached_teardown },
+  { "interceptor/enter-leave-x4", 10000,
+    bench_stacked_4_setup, bench_call_target,
+    bench_interceptor_attached_teardown },
+  { "interceptor/enter-leave-x16", 1000,
+    bench_stacked_16_setup, bench_call_target,
+    bench_interceptor_attached_teardown },
+  { "interceptor/replace", 10000,
+    bench_replace_setup, bench_call_target,
+    bench_interceptor_attached_teardown },
+  { "interceptor/attach-detach", 100,
+    bench_attach_detach_setup, bench_interceptor_attach_detach,
+    bench_interceptor_teardown },
+  GUM_BENCHMARK_LIST_END
+};
+
+static volatile gint bench_dummy_global = 0;
+
+G_DEFINE_TYPE_EXTENDED (BenchListener,
+                        bench_listener,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_INVOCATION_LISTENER,
+                            bench_listener_iface_init))
+
+G_DEFINE_TYPE_EXTENDED (BenchEnterListener,
+                        bench_enter_listener,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_INVOCATION_LISTENER,
+                            bench_enter_listener_iface_init))
+
+G_DEFINE_TYPE_EXTENDED (BenchLeaveListener,
+                        bench_leave_listener,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_INVOCATION_LISTENER,
+                            bench_leave_listener_iface_init))
+
+static void
+bench_listener_on_enter (GumInvocationListener * listener,
+                         GumInvocationContext * context)
+{
+}
+
+static void
+bench_listener_on_leave (GumInvocationListener * listener,
+                         GumInvocationContext * context)
+{
+}
+
+static void
+bench_listener_iface_init (gpointer g_iface,
+                           gpointer iface_data)
+{
+  GumInvocationListenerInterface * iface = g_iface;
+
+  iface->on_enter = bench_listener_on_enter;
+  iface->on_leave = bench_listener_on_leave;
+}
+
+static void
+bench_listener_class_init (BenchListenerClass * klass)
+{
+}
+
+static void
+bench_listener_init (BenchListener * self)
+{
+}
+
+static void
+bench_enter_listener_iface_init (gpointer g_iface,
+                                 gpointer iface_data)
+{
+  GumInvocationListenerInterface * iface = g_iface;
+
+  iface->on_enter = bench_listener_on_enter;
+  iface->on_leave = NULL;
+}
+
+static void
+bench_enter_listener_class_init (BenchEnterListenerClass * klass)
+{
+}
+
+static void
+bench_enter_listener_init (BenchEnterListener * self)
+{
+}
+
+static void
+bench_leave_listener_iface_init (gpointer g_iface,
+                                 gpointer iface_data)
+{
+  GumInvocationListenerInterface * iface = g_iface;
+
+  iface->on_enter = NULL;
+  iface->on_leave = bench_listener_on_leave;
+}
+
+static void
+bench_leave_listener_class_init (BenchLeaveListenerClass * klass)
+{
+}
+
+static void
+bench_leave_listener_init (BenchLeaveListener * self)
+{
+}
+
+static gint GUM_NOINLINE
+bench_target_function (gint value)
+{
+  gint result = value;
+  guint i;
+
+  for (i = 0; i != 3; i++)
+    result = (result * 31) + bench_dummy_global;
+
+  return result;
+}
+
+/* Does the same work as the target so only the redirection is measured. */
+static gint GUM_NOINLINE
+bench_replacement_function (gint value)
+{
+  gint result = value;
+  guint i;
+
+  for (i = 0; i != 3; i++)
+    result = (result * 31) + bench_dummy_global;
+
+  return result;
+}
+
+static void
+bench_call_target (gpointer fixture,
+                   guint iterations)
+{
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+    bench_target_function (i);
+}
+
+static gpointer
+bench_enter_only_setup (void)
+{
+  return bench_interceptor_attached_setup (BENCH_TYPE_ENTER_LISTENER, 1);
+}
+
+static gpointer
+bench_leave_only_setup (void)
+{
+  return bench_interceptor_attached_setup (BENCH_TYPE_LEAVE_LISTENER, 1);
+}
+
+static gpointer
+bench_enter_leave_setup (void)
+{
+  return bench_interceptor_attached_setup (BENCH_TYPE_LISTENER, 1);
+}
+
+static gpointer
+bench_stacked_4_setup (void)
+{
+  return bench_interceptor_attached_setup (BENCH_TYPE_LISTENER, 4);
+}
+
+static gpointer
+bench_stacked_16_setup (void)
+{
+  return bench_interceptor_attached_setup (BENCH_TYPE_LISTENER, 16);
+}
+
+static gpointer
+bench_replace_setup (void)
+{
+  BenchInterceptorFixture * fixture;
+  GumReplaceReturn replace_ret;
+
+  fixture = bench_interceptor_setup (G_TYPE_NONE, 0);
+
+  replace_ret = gum_interceptor_replace_function (fixture->interceptor,
+      GUM_FUNCPTR_TO_POINTER (bench_target_function),
+      GUM_FUNCPTR_TO_POINTER (bench_replacement_function), NULL);
+  g_assert (replace_ret == GUM_REPLACE_OK);
+  fixture->replaced = TRUE;
+
+  return fixture;
+}
+
+static gpointer
+bench_interceptor_setup (GType listener_type,
+                         guint num_listeners)
+{
+  BenchInterceptorFixture * fixture;
+  guint i;
+
+  fixture = g_slice_new (BenchInterceptorFixture);
+  fixture->interceptor = gum_interceptor_obtain ();
+  fixture->listeners = g_ptr_array_new_with_free_func (g_object_unref);
+  fixture->replaced = FALSE;
+
+  for (i = 0; i != num_listeners; i++)
+    g_ptr_array_add (fixture->listeners, g_object_new (listener_type, NULL));
+
+  return fixture;
+}
+
+static gpointer
+bench_interceptor_attached_setup (GType listener_type,
+                                  guint num_listeners)
+{
+  BenchInterceptorFixture * fixture;
+  guint i;
+
+  fixture = bench_interceptor_setup (listener_type, num_listeners);
+
+  for (i = 0; i != num_listeners; i++)
+  {
+    GumAttachReturn attach_ret;
+
+    attach_ret = gum_interceptor_attach_listener (fixture->interceptor,
+        GUM_FUNCPTR_TO_POINTER (bench_target_function),
+        g_ptr_array_index (fixture->listeners, i), NULL);
+    g_assert (attach_ret == GUM_ATTACH_OK);
+  }
+
+  return fixture;
+}
+
+static void
+bench_interceptor_teardown (gpointer fixture)
+{
+  BenchInterceptorFixture * f = fixture;
+
+  g_ptr_array_unref (f->listeners);
+  g_object_unref (f->interceptor);
+
+  g_slice_free (BenchInterceptorFixture, f);
+}
+
+static void
+bench_interceptor_attached_teardown (gpointer fixture)
+{
+  BenchInterceptorFixture * f = fixture;
+  guint i;
+
+  for (i = 0; i != f->listeners->len; i++)
+  {
+    gum_interceptor_detach_listener (f->interceptor,
+        g_ptr_array_index (f->listeners, i));
+  }
+
+  if (f->replaced)
+  {
+    gum_interceptor_revert_function (f->interceptor,
+        GUM_FUNCPTR_TO_POINTER (bench_target_function));
+  }
+
+  bench_interceptor_teardown (f);
+}
+
+static gpointer
+bench_attach_detach_setup (void)
+{
+  return bench_interceptor_setup (BENCH_TYPE_LISTENER, 1);
+}
+
+static void
+bench_interceptor_attach_detach (gpointer fixture,
+                                 guint iterations)
+{
+  BenchInterceptorFixture * f = fixture;
+  GumInvocationListener * listener = g_ptr_array_index (f->listeners, 0);
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+  {
+    gum_interceptor_attach_listener (f->interceptor,
+        GUM_FUNCPTR_TO_POINTER (bench_target_function), listener, NULL);
+    gum_interceptor_detach_listener (f->interceptor, listener);
+  }
+}
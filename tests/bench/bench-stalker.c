@@ -0,0 +1,504 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumbench.h"
+
+#include "fakeeventsink.h"
+
+#if defined (HAVE_I386) || defined (HAVE_ARM64)
+# define BENCH_HAVE_STALKER 1
+#endif
+
+#ifdef BENCH_HAVE_STALKER
+
+#define BENCH_NUM_SHAPES 64
+#define BENCH_FIB_DEPTH 18
+#define BENCH_KEY_FILE_DATA \
+    "[stalker]\n" \
+    "trust-threshold=1\n" \
+    "ic-entries=2\n" \
+    "excluded=libc;libm;libpthread\n" \
+    "\n" \
+    "[workload]\n" \
+    "name=compile-heavy\n" \
+    "weight=0.75\n"
+#define BENCH_VARIANT_TEXT \
+    "{'modules': <[('libc', uint64 4096), ('libm', 8192)]>, " \
+    "'ranges': <[(0, 'r-x'), (4096, 'rw-')]>, 'verbose': <true>}"
+
+typedef struct _BenchNullSink BenchNullSink;
+typedef struct _BenchNullSinkClass BenchNullSinkClass;
+typedef struct _BenchStalkerFixture BenchStalkerFixture;
+typedef struct _BenchShape BenchShape;
+typedef struct _BenchShapeClass BenchShapeClass;
+
+struct _BenchNullSink
+{
+  GObject parent;
+};
+
+struct _BenchNullSinkClass
+{
+  GObjectClass parent_class;
+};
+
+struct _BenchStalkerFixture
+{
+  GumStalker * stalker;
+  GumStalkerTransformer * transformer;
+  GumEventSink * sink;
+};
+
+/*
+ * Stands in for a C++ class hierarchy: every call goes through a vtable, and
+ * the receivers are interleaved so consecutive call sites see different
+ * targets.
+ */
+struct _BenchShapeClass
+{
+  gint (* area) (const BenchShape * shape);
+  gint (* perimeter) (const BenchShape * shape);
+};
+
+struct _BenchShape
+{
+  const BenchShapeClass * klass;
+  gint a;
+  gint b;
+};
+
+#define BENCH_TYPE_NULL_SINK (bench_null_sink_get_type ())
+
+static void bench_null_sink_iface_init (gpointer g_iface,
+    gpointer iface_data);
+
+static gint bench_target_function (gint value);
+
+static gpointer bench_stalker_setup (void);
+static gpointer bench_stalker_exec_setup (void);
+static gpointer bench_stalker_setup_with_sink (GumEventSink * sink);
+static void bench_stalker_teardown (gpointer fixture);
+static guint bench_stalker_phases (gpointer fixture, GumBenchPhase * phases);
+
+static void bench_stalker_compile (gpointer fixture, guint iterations);
+static void bench_stalker_dispatch (gpointer fixture, guint iterations);
+
+static void bench_stalker_compile_heavy (gpointer fixture, guint iterations);
+static void bench_stalker_dispatch_heavy (gpointer fixture, guint iterations);
+static void bench_stalker_ret_heavy (gpointer fixture, guint iterations);
+static void bench_stalker_event_heavy (gpointer fixture, guint iterations);
+
+static void bench_parse_configuration (void);
+static gint bench_dispatch_shapes (guint rounds);
+static gint bench_fib (gint n);
+
+static gint bench_rectangle_area (const BenchShape * shape);
+static gint bench_rectangle_perimeter (const BenchShape * shape);
+static gint bench_square_area (const BenchShape * shape);
+static gint bench_square_perimeter (const BenchShape * shape);
+static gint bench_triangle_area (const BenchShape * shape);
+static gint bench_triangle_perimeter (const BenchShape * shape);
+static gint bench_circle_area (const BenchShape * shape);
+static gint bench_circle_perimeter (const BenchShape * shape);
+
+#endif
+
+const GumBenchmark gum_bench_stalker_benchmarks[] =
+{
+#ifdef BENCH_HAVE_STALKER
+  { "stalker/compile", 50,
+    bench_stalker_setup, bench_stalker_compile, bench_stalker_teardown,
+    bench_stalker_phases },
+  { "stalker/dispatch", 10000,
+    bench_stalker_setup, bench_stalker_dispatch, bench_stalker_teardown,
+    bench_stalker_phases },
+  { "stalker/workload/compile-heavy", 5,
+    bench_stalker_setup, bench_stalker_compile_heavy, bench_stalker_teardown,
+    bench_stalker_phases },
+  { "stalker/workload/dispatch-heavy", 100,
+    bench_stalker_setup, bench_stalker_dispatch_heavy,
+    bench_stalker_teardown, bench_stalker_phases },
+  { "stalker/workload/ret-heavy", 10,
+    bench_stalker_setup, bench_stalker_ret_heavy, bench_stalker_teardown,
+    bench_stalker_phases },
+  { "stalker/workload/event-heavy", 100,
+    bench_stalker_exec_setup, bench_stalker_event_heavy,
+    bench_stalker_teardown, bench_stalker_phases },
+#endif
+  GUM_BENCHMARK_LIST_END
+};
+
+#ifdef BENCH_HAVE_STALKER
+
+static const BenchShapeClass bench_rectangle_class =
+{
+  bench_rectangle_area,
+  bench_rectangle_perimeter
+};
+
+static const BenchShapeClass bench_square_class =
+{
+  bench_square_area,
+  bench_square_perimeter
+};
+
+static const BenchShapeClass bench_triangle_class =
+{
+  bench_triangle_area,
+  bench_triangle_perimeter
+};
+
+static const BenchShapeClass bench_circle_class =
+{
+  bench_circle_area,
+  bench_circle_perimeter
+};
+
+volatile gint bench_stalker_dummy_global_to_trick_optimizer = 0;
+
+G_DEFINE_TYPE_EXTENDED (BenchNullSink,
+                        bench_null_sink,
+                        G_TYPE_OBJECT,
+                        0,
+                        G_IMPLEMENT_INTERFACE (GUM_TYPE_EVENT_SINK,
+                            bench_null_sink_iface_init))
+
+static GumEventType
+bench_null_sink_query_mask (GumEventSink * sink)
+{
+  return GUM_EXEC;
+}
+
+static void
+bench_null_sink_process (GumEventSink * sink,
+                         const GumEvent * ev)
+{
+}
+
+static void
+bench_null_sink_iface_init (gpointer g_iface,
+                            gpointer iface_data)
+{
+  GumEventSinkInterface * iface = g_iface;
+
+  iface->query_mask = bench_null_sink_query_mask;
+  iface->process = bench_null_sink_process;
+}
+
+static void
+bench_null_sink_class_init (BenchNullSinkClass * klass)
+{
+}
+
+static void
+bench_null_sink_init (BenchNullSink * self)
+{
+}
+
+static gint GUM_NOINLINE
+bench_target_function (gint value)
+{
+  gint result = value;
+  guint i;
+
+  for (i = 0; i != 3; i++)
+    result = (result * 31) + bench_stalker_dummy_global_to_trick_optimizer;
+
+  return result;
+}
+
+static gpointer
+bench_stalker_setup (void)
+{
+  return bench_stalker_setup_with_sink (gum_fake_event_sink_new ());
+}
+
+static gpointer
+bench_stalker_exec_setup (void)
+{
+  return bench_stalker_setup_with_sink (
+      g_object_new (BENCH_TYPE_NULL_SINK, NULL));
+}
+
+static gpointer
+bench_stalker_setup_with_sink (GumEventSink * sink)
+{
+  BenchStalkerFixture * fixture;
+
+  fixture = g_slice_new (BenchStalkerFixture);
+  fixture->stalker = gum_stalker_new ();
+  fixture->transformer = gum_stalker_transformer_make_default ();
+  fixture->sink = sink;
+
+  gum_stalker_reset_counters ();
+  gum_stalker_set_counters_enabled (TRUE);
+
+  return fixture;
+}
+
+static void
+bench_stalker_teardown (gpointer fixture)
+{
+  BenchStalkerFixture * f = fixture;
+
+  gum_stalker_set_counters_enabled (FALSE);
+
+  while (gum_stalker_garbage_collect (f->stalker))
+    g_usleep (G_USEC_PER_SEC / 100);
+
+  g_object_unref (f->sink);
+  g_object_unref (f->transformer);
+  g_object_unref (f->stalker);
+
+  g_slice_free (BenchStalkerFixture, f);
+}
+
+static guint
+bench_stalker_phases (gpointer fixture,
+                      GumBenchPhase * phases)
+{
+  GumStalkerCounters counters;
+
+  gum_stalker_get_counters (&counters);
+  gum_stalker_reset_counters ();
+
+  phases[0].name = "entrygate";
+  phases[0].nanoseconds = counters.entrygate_time;
+  phases[1].name = "compile";
+  phases[1].nanoseconds = counters.compile_time;
+  phases[2].name = "transform";
+  phases[2].nanoseconds = counters.transform_time;
+  phases[3].name = "sink";
+  phases[3].nanoseconds = counters.sink_time;
+
+  return 4;
+}
+
+/*
+ * Every follow starts out with an empty code cache, so this is dominated by
+ * block compilation.
+ */
+static void
+bench_stalker_compile (gpointer fixture,
+                       guint iterations)
+{
+  BenchStalkerFixture * f = fixture;
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+  {
+    gum_stalker_follow_me (f->stalker, f->transformer, f->sink);
+    bench_target_function (i);
+    gum_stalker_unfollow_me (f->stalker);
+  }
+
+  gum_stalker_garbage_collect (f->stalker);
+}
+
+static void
+bench_stalker_dispatch (gpointer fixture,
+                        guint iterations)
+{
+  BenchStalkerFixture * f = fixture;
+  guint i;
+
+  gum_stalker_follow_me (f->stalker, f->transformer, f->sink);
+  for (i = 0; i != iterations; i++)
+    bench_target_function (i);
+  gum_stalker_unfollow_me (f->stalker);
+
+  gum_stalker_garbage_collect (f->stalker);
+}
+
+/*
+ * Cold starts over a good chunk of GLib: key file and GVariant parsing,
+ * checksumming and string handling each pull in a few hundred blocks.
+ */
+static void
+bench_stalker_compile_heavy (gpointer fixture,
+                             guint iterations)
+{
+  BenchStalkerFixture * f = fixture;
+  guint i;
+
+  for (i = 0; i != iterations; i++)
+  {
+    gum_stalker_follow_me (f->stalker, f->transformer, f->sink);
+    bench_parse_configuration ();
+    gum_stalker_unfollow_me (f->stalker);
+  }
+
+  gum_stalker_garbage_collect (f->stalker);
+}
+
+static void
+bench_stalker_dispatch_heavy (gpointer fixture,
+                              guint iterations)
+{
+  BenchStalkerFixture * f = fixture;
+
+  gum_stalker_follow_me (f->stalker, f->transformer, f->sink);
+  bench_dispatch_shapes (iterations);
+  gum_stalker_unfollow_me (f->stalker);
+
+  gum_stalker_garbage_collect (f->stalker);
+}
+
+static void
+bench_stalker_ret_heavy (gpointer fixture,
+                         guint iterations)
+{
+  BenchStalkerFixture * f = fixture;
+  guint i;
+
+  gum_stalker_follow_me (f->stalker, f->transformer, f->sink);
+  for (i = 0; i != iterations; i++)
+    bench_fib (BENCH_FIB_DEPTH);
+  gum_stalker_unfollow_me (f->stalker);
+
+  gum_stalker_garbage_collect (f->stalker);
+}
+
+static void
+bench_stalker_event_heavy (gpointer fixture,
+                           guint iterations)
+{
+  BenchStalkerFixture * f = fixture;
+  guint i;
+
+  gum_stalker_follow_me (f->stalker, f->transformer, f->sink);
+  for (i = 0; i != iterations; i++)
+    bench_dispatch_shapes (1);
+  gum_stalker_unfollow_me (f->stalker);
+
+  gum_stalker_garbage_collect (f->stalker);
+}
+
+static void GUM_NOINLINE
+bench_parse_configuration (void)
+{
+  GKeyFile * key_file;
+  gchar ** excluded, * joined, * digest;
+  GVariant * variant;
+  GError * error = NULL;
+
+  key_file = g_key_file_new ();
+  g_key_file_load_from_data (key_file, BENCH_KEY_FILE_DATA, -1,
+      G_KEY_FILE_NONE, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (g_key_file_get_integer (key_file, "stalker",
+      "trust-threshold", NULL), ==, 1);
+  g_key_file_get_double (key_file, "workload", "weight", NULL);
+  excluded = g_key_file_get_string_list (key_file, "stalker", "excluded",
+      NULL, NULL);
+  g_key_file_free (key_file);
+
+  joined = g_strjoinv (",", excluded);
+  digest = g_compute_checksum_for_string (G_CHECKSUM_SHA256, joined, -1);
+  g_free (digest);
+  g_free (joined);
+  g_strfreev (excluded);
+
+  variant = g_variant_parse (NULL, BENCH_VARIANT_TEXT, NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_free (g_variant_print (variant, TRUE));
+  g_variant_unref (variant);
+}
+
+static gint GUM_NOINLINE
+bench_dispatch_shapes (guint rounds)
+{
+  static const BenchShapeClass * classes[] = {
+    &bench_rectangle_class,
+    &bench_square_class,
+    &bench_triangle_class,
+    &bench_circle_class,
+  };
+  BenchShape shapes[BENCH_NUM_SHAPES];
+  gint total = 0;
+  guint round, i;
+
+  for (i = 0; i != BENCH_NUM_SHAPES; i++)
+  {
+    BenchShape * shape = &shapes[i];
+
+    shape->klass = classes[(i * 7) % G_N_ELEMENTS (classes)];
+    shape->a = i + 1;
+    shape->b = (i % 5) + 2;
+  }
+
+  for (round = 0; round != rounds; round++)
+  {
+    for (i = 0; i != BENCH_NUM_SHAPES; i++)
+    {
+      const BenchShape * shape = &shapes[i];
+
+      total += shape->klass->area (shape);
+      total -= shape->klass->perimeter (shape);
+    }
+  }
+
+  return total;
+}
+
+static gint GUM_NOINLINE
+bench_fib (gint n)
+{
+  if (n < 2)
+    return n + bench_stalker_dummy_global_to_trick_optimizer;
+
+  return bench_fib (n - 1) + bench_fib (n - 2);
+}
+
+static gint GUM_NOINLINE
+bench_rectangle_area (const BenchShape * shape)
+{
+  return shape->a * shape->b;
+}
+
+static gint GUM_NOINLINE
+bench_rectangle_perimeter (const BenchShape * shape)
+{
+  return 2 * (shape->a + shape->b);
+}
+
+static gint GUM_NOINLINE
+bench_square_area (const BenchShape * shape)
+{
+  return shape->a * shape->a;
+}
+
+static gint GUM_NOINLINE
+bench_square_perimeter (const BenchShape * shape)
+{
+  return 4 * shape->a;
+}
+
+static gint GUM_NOINLINE
+bench_triangle_area (const BenchShape * shape)
+{
+  return (shape->a * shape->b) / 2;
+}
+
+static gint GUM_NOINLINE
+bench_triangle_perimeter (const BenchShape * shape)
+{
+  return shape->a + shape->b + bench_stalker_dummy_global_to_trick_optimizer;
+}
+
+static gint GUM_NOINLINE
+bench_circle_area (const BenchShape * shape)
+{
+  return (355 * shape->a * shape->a) / 113;
+}
+
+static gint GUM_NOINLINE
+bench_circle_perimeter (const BenchShape * shape)
+{
+  return (710 * shape->a) / 113;
+}
+
+#endif
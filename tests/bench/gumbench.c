@@ -0,0 +1,384 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumbench.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined (HAVE_WINDOWS)
+# ifndef WIN32_LEAN_AND_MEAN
+#  define WIN32_LEAN_AND_MEAN
+# endif
+# include <windows.h>
+#elif defined (HAVE_DARWIN)
+# include <mach/mach_time.h>
+#else
+# include <time.h>
+#endif
+
+typedef struct _GumBenchResult GumBenchResult;
+
+struct _GumBenchResult
+{
+  const gchar * name;
+  guint iterations;
+  guint samples;
+
+  gdouble min;
+  gdouble median;
+  gdouble p90;
+  gdouble p99;
+  gdouble max;
+  gdouble mean;
+  gdouble stddev;
+
+  guint num_phases;
+  GumBenchPhase phases[GUM_BENCH_MAX_PHASES];
+};
+
+static void gum_bench_run (const GumBenchmark * benchmark, guint num_warmups,
+    guint num_samples, GumBenchResult * result);
+static void gum_bench_compute_statistics (gdouble * samples,
+    guint num_samples, GumBenchResult * result);
+static gdouble gum_bench_percentile (const gdouble * sorted_samples,
+    guint num_samples, guint percentile);
+static gint gum_bench_compare_samples (gconstpointer a, gconstpointer b);
+
+static void gum_bench_print_table (const GArray * results);
+static void gum_bench_print_json (const GArray * results);
+
+static guint64 gum_bench_now (void);
+
+gint
+main (gint argc,
+      gchar * argv[])
+{
+  static gboolean json = FALSE;
+  static gboolean list = FALSE;
+  static gint num_warmups = 5;
+  static gint num_samples = 31;
+  static gchar * filter = NULL;
+  static GOptionEntry entries[] =
+  {
+    { "json", 0, 0, G_OPTION_ARG_NONE, &json,
+        "Output results as JSON", NULL },
+    { "list", 'l', 0, G_OPTION_ARG_NONE, &list,
+        "List benchmarks without running them", NULL },
+    { "warmup", 'w', 0, G_OPTION_ARG_INT, &num_warmups,
+        "Number of untimed samples to run first", "N" },
+    { "samples", 's', 0, G_OPTION_ARG_INT, &num_samples,
+        "Number of timed samples", "N" },
+    { "filter", 'f', 0, G_OPTION_ARG_STRING, &filter,
+        "Only run benchmarks whose name contains STRING", "STRING" },
+    { NULL }
+  };
+  const GumBenchmark * lists[] = {
+    gum_bench_interceptor_benchmarks,
+    gum_bench_core_benchmarks,
+    gum_bench_stalker_benchmarks,
+#ifdef HAVE_GUMJS
+    gum_bench_gumjs_benchmarks,
+#endif
+  };
+  GOptionContext * context;
+  GError * error = NULL;
+  GArray * results;
+  guint i;
+
+  gum_init_embedded ();
+
+  context = g_option_context_new ("- run Gum microbenchmarks");
+  g_option_context_add_main_entries (context, entries, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+  {
+    g_printerr ("%s\n", error->message);
+    return 1;
+  }
+  g_option_context_free (context);
+
+  if (num_warmups < 0 || num_samples < 1)
+  {
+    g_printerr ("expected at least one sample and no negative warmups\n");
+    return 1;
+  }
+
+  results = g_array_new (FALSE, FALSE, sizeof (GumBenchResult));
+
+  for (i = 0; i != G_N_ELEMENTS (lists); i++)
+  {
+    const GumBenchmark * benchmark;
+
+    for (benchmark = lists[i]; benchmark->name != NULL; benchmark++)
+    {
+      GumBenchResult result;
+
+      if (filter != NULL && strstr (benchmark->name, filter) == NULL)
+        continue;
+
+      if (list)
+      {
+        g_print ("%s\n", benchmark->name);
+        continue;
+      }
+
+      gum_bench_run (benchmark, num_warmups, num_samples, &result);
+      g_array_append_val (results, result);
+    }
+  }
+
+  if (!list)
+  {
+    if (json)
+      gum_bench_print_json (results);
+    else
+      gum_bench_print_table (results);
+  }
+
+  g_array_free (results, TRUE);
+  g_free (filter);
+
+  gum_deinit_embedded ();
+
+  return 0;
+}
+
+static void
+gum_bench_run (const GumBenchmark * benchmark,
+               guint num_warmups,
+               guint num_samples,
+               GumBenchResult * result)
+{
+  gpointer fixture;
+  gdouble * samples;
+  guint i, j;
+
+  result->num_phases = 0;
+
+  fixture = (benchmark->setup != NULL) ? benchmark->setup () : NULL;
+
+  for (i = 0; i != num_warmups; i++)
+  {
+    benchmark->run (fixture, benchmark->iterations);
+
+    if (benchmark->phases != NULL)
+    {
+      GumBenchPhase phases[GUM_BENCH_MAX_PHASES];
+
+      benchmark->phases (fixture, phases);
+    }
+  }
+
+  samples = g_new (gdouble, num_samples);
+
+  for (i = 0; i != num_samples; i++)
+  {
+    guint64 start, end;
+
+    start = gum_bench_now ();
+    benchmark->run (fixture, benchmark->iterations);
+    end = gum_bench_now ();
+
+    samples[i] = (gdouble) (end - start) / (gdouble) benchmark->iterations;
+
+    if (benchmark->phases != NULL)
+    {
+      GumBenchPhase phases[GUM_BENCH_MAX_PHASES];
+
+      result->num_phases = benchmark->phases (fixture, phases);
+      g_assert_cmpuint (result->num_phases, <=, GUM_BENCH_MAX_PHASES);
+
+      for (j = 0; j != result->num_phases; j++)
+      {
+        GumBenchPhase * p = &result->phases[j];
+
+        if (i == 0)
+        {
+          p->name = phases[j].name;
+          p->nanoseconds = 0;
+        }
+
+        p->nanoseconds += phases[j].nanoseconds /
+            ((gdouble) benchmark->iterations * num_samples);
+      }
+    }
+  }
+
+  if (benchmark->teardown != NULL)
+    benchmark->teardown (fixture);
+
+  result->name = benchmark->name;
+  result->iterations = benchmark->iterations;
+  result->samples = num_samples;
+  gum_bench_compute_statistics (samples, num_samples, result);
+
+  g_free (samples);
+}
+
+static void
+gum_bench_compute_statistics (gdouble * samples,
+                              guint num_samples,
+                              GumBenchResult * result)
+{
+  gdouble sum, variance;
+  guint i;
+
+  qsort (samples, num_samples, sizeof (gdouble), gum_bench_compare_samples);
+
+  sum = 0;
+  for (i = 0; i != num_samples; i++)
+    sum += samples[i];
+  result->mean = sum / num_samples;
+
+  variance = 0;
+  for (i = 0; i != num_samples; i++)
+  {
+    gdouble delta = samples[i] - result->mean;
+
+    variance += delta * delta;
+  }
+  result->stddev = (num_samples > 1) ? sqrt (variance / (num_samples - 1)) : 0;
+
+  result->min = samples[0];
+  result->median = gum_bench_percentile (samples, num_samples, 50);
+  result->p90 = gum_bench_percentile (samples, num_samples, 90);
+  result->p99 = gum_bench_percentile (samples, num_samples, 99);
+  result->max = samples[num_samples - 1];
+}
+
+static gdouble
+gum_bench_percentile (const gdouble * sorted_samples,
+                      guint num_samples,
+                      guint percentile)
+{
+  guint rank;
+
+  rank = (percentile * num_samples + 99) / 100;
+  if (rank == 0)
+    rank = 1;
+
+  return sorted_samples[rank - 1];
+}
+
+static gint
+gum_bench_compare_samples (gconstpointer a,
+                           gconstpointer b)
+{
+  gdouble x = *((const gdouble *) a);
+  gdouble y = *((const gdouble *) b);
+
+  if (x < y)
+    return -1;
+  if (x > y)
+    return 1;
+  return 0;
+}
+
+static void
+gum_bench_print_table (const GArray * results)
+{
+  guint i;
+
+  g_print ("%-36s %12s %12s %12s %12s %10s\n",
+      "benchmark (ns/iteration)", "min", "median", "p90", "p99", "stddev");
+
+  for (i = 0; i != results->len; i++)
+  {
+    const GumBenchResult * r = &g_array_index (results, GumBenchResult, i);
+
+    guint j;
+
+    g_print ("%-36s %12.1f %12.1f %12.1f %12.1f %10.1f\n",
+        r->name, r->min, r->median, r->p90, r->p99, r->stddev);
+
+    for (j = 0; j != r->num_phases; j++)
+    {
+      const GumBenchPhase * p = &r->phases[j];
+
+      g_print ("  %-34s %12.1f %11.1f%%\n",
+          p->name, p->nanoseconds, 100.0 * p->nanoseconds / r->mean);
+    }
+  }
+}
+
+static void
+gum_bench_print_json (const GArray * results)
+{
+  GString * json;
+  guint i;
+
+  json = g_string_new ("{\n  \"unit\": \"ns\",\n  \"benchmarks\": [");
+
+  for (i = 0; i != results->len; i++)
+  {
+    const GumBenchResult * r = &g_array_index (results, GumBenchResult, i);
+    guint j;
+
+    g_string_append_printf (json,
+        "%s\n    {\n"
+        "      \"name\": \"%s\",\n"
+        "      \"iterations\": %u,\n"
+        "      \"samples\": %u,\n"
+        "      \"min\": %.1f,\n"
+        "      \"median\": %.1f,\n"
+        "      \"p90\": %.1f,\n"
+        "      \"p99\": %.1f,\n"
+        "      \"max\": %.1f,\n"
+        "      \"mean\": %.1f,\n"
+        "      \"stddev\": %.1f",
+        (i != 0) ? "," : "",
+        r->name, r->iterations, r->samples,
+        r->min, r->median, r->p90, r->p99, r->max, r->mean, r->stddev);
+
+    if (r->num_phases != 0)
+    {
+      g_string_append (json, ",\n      \"phases\": {");
+      for (j = 0; j != r->num_phases; j++)
+      {
+        g_string_append_printf (json, "%s\n        \"%s\": %.1f",
+            (j != 0) ? "," : "", r->phases[j].name,
+            r->phases[j].nanoseconds);
+      }
+      g_string_append (json, "\n      }");
+    }
+
+    g_string_append (json, "\n    }");
+  }
+
+  g_string_append (json, "\n  ]\n}\n");
+
+  g_print ("%s", json->str);
+
+  g_string_free (json, TRUE);
+}
+
+static guint64
+gum_bench_now (void)
+{
+#if defined (HAVE_WINDOWS)
+  static LARGE_INTEGER frequency = { 0, };
+  LARGE_INTEGER counter;
+
+  if (frequency.QuadPart == 0)
+    QueryPerformanceFrequency (&frequency);
+  QueryPerformanceCounter (&counter);
+
+  return (guint64) ((counter.QuadPart * 1e9) / frequency.QuadPart);
+#elif defined (HAVE_DARWIN)
+  static mach_timebase_info_data_t timebase = { 0, 0 };
+
+  if (timebase.denom == 0)
+    mach_timebase_info (&timebase);
+
+  return (mach_absolute_time () * timebase.numer) / timebase.denom;
+#else
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+
+  return ((guint64) ts.tv_sec * G_GUINT64_CONSTANT (1000000000)) + ts.tv_nsec;
+#endif
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#ifndef __GUM_BENCH_H__
+#define __GUM_BENCH_H__
+
+#include <gum/gum.h>
+
+#define GUM_BENCH_MAX_PHASES 8
+
+#define GUM_BENCHMARK_LIST_END { NULL, 0, NULL, NULL, NULL, NULL }
+
+G_BEGIN_DECLS
+
+typedef struct _GumBenchmark GumBenchmark;
+typedef struct _GumBenchPhase GumBenchPhase;
+
+typedef gpointer (* GumBenchmarkSetupFunc) (void);
+typedef void (* GumBenchmarkRunFunc) (gpointer fixture, guint iterations);
+typedef void (* GumBenchmarkTeardownFunc) (gpointer fixture);
+typedef guint (* GumBenchmarkPhasesFunc) (gpointer fixture,
+    GumBenchPhase * phases);
+
+/*
+ * A sample times one call to run(), which is expected to perform the
+ * operation being measured `iterations` times. Results are reported per
+ * iteration, so pick a count that makes a sample last about a millisecond.
+ */
+struct _GumBenchmark
+{
+  const gchar * name;
+  guint iterations;
+  GumBenchmarkSetupFunc setup;
+  GumBenchmarkRunFunc run;
+  GumBenchmarkTeardownFunc teardown;
+  GumBenchmarkPhasesFunc phases;
+};
+
+/*
+ * The optional phases() is called after each sample to break it down. It
+ * fills in at most GUM_BENCH_MAX_PHASES entries covering that sample alone,
+ * so whatever it reads should be reset, and returns how many it filled in.
+ */
+struct _GumBenchPhase
+{
+  const gchar * name;
+  gdouble nanoseconds;
+};
+
+extern const GumBenchmark gum_bench_core_benchmarks[];
+extern const GumBenchmark gum_bench_interceptor_benchmarks[];
+extern const GumBenchmark gum_bench_stalker_benchmarks[];
+#ifdef HAVE_GUMJS
+extern const GumBenchmark gum_bench_gumjs_benchmarks[];
+#endif
+
+G_END_DECLS
+
+#endif
@@ -44,6 +44,8 @@ test_api_resolver_fixture_teardown (TestApiResolverFixture * fixture,
   g_clear_object (&fixture->resolver);
 }
 
+static gboolean check_exact_match (const GumApiDetails * details,
+    gpointer user_data);
 static gboolean check_module_import (const GumApiDetails * details,
     gpointer user_data);
 static gboolean match_found_cb (const GumApiDetails * details,
@@ -8,6 +8,7 @@
 
 TEST_LIST_BEGIN (api_resolver)
   API_RESOLVER_TESTENTRY (module_exports_can_be_resolved)
+  API_RESOLVER_TESTENTRY (module_exports_can_be_resolved_by_exact_name)
   API_RESOLVER_TESTENTRY (module_imports_can_be_resolved)
   API_RESOLVER_TESTENTRY (objc_methods_can_be_resolved)
 
@@ -44,6 +45,47 @@ API_RESOLVER_TESTCASE (module_exports_can_be_resolved)
   g_assert_cmpuint (ctx.number_of_calls, ==, 1);
 }
 
+API_RESOLVER_TESTCASE (module_exports_can_be_resolved_by_exact_name)
+{
+  GError * error = NULL;
+#ifdef G_OS_WIN32
+  const gchar * query = "exports:*!_open";
+  const gchar * suffix = "!_open";
+#else
+  const gchar * query = "exports:*!open";
+  const gchar * suffix = "!open";
+#endif
+  TestForEachContext ctx;
+  GumApiResolver * second_resolver;
+
+  fixture->resolver = gum_api_resolver_make ("module");
+  g_assert (fixture->resolver != NULL);
+
+  gum_api_resolver_enumerate_matches (fixture->resolver, query,
+      check_exact_match, (gpointer) suffix, &error);
+  g_assert (error == NULL);
+
+  second_resolver = gum_api_resolver_make ("module");
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  gum_api_resolver_enumerate_matches (second_resolver, query, match_found_cb,
+      &ctx, &error);
+  g_assert (error == NULL);
+  g_assert_cmpuint (ctx.number_of_calls, >=, 1);
+  g_object_unref (second_resolver);
+}
+
+static gboolean
+check_exact_match (const GumApiDetails * details,
+                   gpointer user_data)
+{
+  const gchar * suffix = user_data;
+
+  g_assert (g_str_has_suffix (details->name, suffix));
+
+  return TRUE;
+}
+
 API_RESOLVER_TESTCASE (module_imports_can_be_resolved)
 {
 #ifdef HAVE_DARWIN
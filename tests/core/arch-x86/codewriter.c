@@ -9,6 +9,7 @@
 TEST_LIST_BEGIN (codewriter)
   CODEWRITER_TESTENTRY (jump_label)
   CODEWRITER_TESTENTRY (call_label)
+  CODEWRITER_TESTENTRY (many_labels)
   CODEWRITER_TESTENTRY (call_indirect)
   CODEWRITER_TESTENTRY (call_indirect_label)
   CODEWRITER_TESTENTRY (call_capi_eax_with_xdi_argument_for_ia32)
@@ -41,6 +42,8 @@ TEST_LIST_BEGIN (codewriter)
   CODEWRITER_TESTENTRY (lock_xadd_rcx_ptr_rax)
   CODEWRITER_TESTENTRY (lock_xadd_r15_ptr_eax)
   CODEWRITER_TESTENTRY (lock_inc_dec_imm32_ptr)
+  CODEWRITER_TESTENTRY (lock_inc_rax_ptr)
+  CODEWRITER_TESTENTRY (lock_inc_r9_ptr)
 
   CODEWRITER_TESTENTRY (and_ecx_edx)
   CODEWRITER_TESTENTRY (and_rdx_rsi)
@@ -346,6 +349,40 @@ CODEWRITER_TESTCASE (flush_on_free)
   assert_output_equals (expected_code);
 }
 
+CODEWRITER_TESTCASE (many_labels)
+{
+  guint8 code[2 * 300];
+  guint8 ids[300];
+  GumX86Writer cw;
+  guint round, i;
+
+  gum_x86_writer_init (&cw, code);
+
+  for (round = 0; round != 2; round++)
+  {
+    memset (code, 0xcc, sizeof (code));
+
+    for (i = 0; i != G_N_ELEMENTS (ids); i++)
+    {
+      gum_x86_writer_put_jmp_short_label (&cw, &ids[i]);
+      g_assert (gum_x86_writer_put_label (&cw, &ids[i]));
+      g_assert (!gum_x86_writer_put_label (&cw, &ids[i]));
+    }
+
+    g_assert (gum_x86_writer_flush (&cw));
+    g_assert_cmpuint (gum_x86_writer_offset (&cw), ==, sizeof (code));
+    for (i = 0; i != G_N_ELEMENTS (ids); i++)
+    {
+      g_assert_cmphex (code[(i * 2) + 0], ==, 0xeb);
+      g_assert_cmphex (code[(i * 2) + 1], ==, 0x00);
+    }
+
+    gum_x86_writer_reset (&cw, code);
+  }
+
+  gum_x86_writer_clear (&cw);
+}
+
 CODEWRITER_TESTCASE (jmp_rcx)
 {
   const guint8 expected_code[] = { 0xff, 0xe1 };
@@ -489,6 +526,24 @@ CODEWRITER_TESTCASE (lock_inc_dec_imm32_ptr)
   assert_output_equals (expected_code);
 }
 
+CODEWRITER_TESTCASE (lock_inc_rax_ptr)
+{
+  const guint8 expected_code[] = { 0xf0, 0x48, 0xff, 0x00 };
+  gum_x86_writer_set_target_cpu (&fixture->cw, GUM_CPU_AMD64);
+  gum_x86_writer_put_lock_inc_reg_ptr (&fixture->cw, GUM_PTR_QWORD,
+      GUM_REG_RAX);
+  assert_output_equals (expected_code);
+}
+
+CODEWRITER_TESTCASE (lock_inc_r9_ptr)
+{
+  const guint8 expected_code[] = { 0xf0, 0x49, 0xff, 0x01 };
+  gum_x86_writer_set_target_cpu (&fixture->cw, GUM_CPU_AMD64);
+  gum_x86_writer_put_lock_inc_reg_ptr (&fixture->cw, GUM_PTR_QWORD,
+      GUM_REG_R9);
+  assert_output_equals (expected_code);
+}
+
 CODEWRITER_TESTCASE (and_ecx_edx)
 {
   const guint8 expected_code[] = { 0x21, 0xd1 };
@@ -8,6 +8,7 @@
 
 TEST_LIST_BEGIN (relocator)
   RELOCATOR_TESTENTRY (one_to_one)
+  RELOCATOR_TESTENTRY (one_to_one_without_detail)
   RELOCATOR_TESTENTRY (call_near_relative)
   RELOCATOR_TESTENTRY (call_near_relative_to_next_instruction)
 #if GLIB_SIZEOF_VOID_P == 4
@@ -72,6 +73,45 @@ RELOCATOR_TESTCASE (one_to_one)
   g_assert (!gum_x86_relocator_write_one (&fixture->rl));
 }
 
+RELOCATOR_TESTCASE (one_to_one_without_detail)
+{
+  guint8 input[] = {
+    0x55,                               /* push ebp                    */
+    0x8b, 0xec,                         /* mov ebp, esp                */
+    0x81, 0xec, 0x00, 0x01, 0x00, 0x00, /* sub esp, 0x100              */
+    0xc7, 0x45, 0xfc, 0x2a, 0x00, 0x00, /* mov dword [ebp - 4], 42     */
+          0x00,
+    0x66, 0x0f, 0x6f, 0x04, 0x24,       /* movdqa xmm0, [esp]          */
+    0x0f, 0xb6, 0x44, 0x24, 0x08,       /* movzx eax, byte [esp + 8]   */
+    0xf6, 0xc1, 0x01,                   /* test cl, 1                  */
+    0xc3                                /* ret                         */
+  };
+  const guint ends[] = { 1, 3, 9, 16, 21, 26, 29 };
+  const cs_insn * insn;
+  guint i;
+
+  SETUP_RELOCATOR_WITH (input);
+  gum_x86_relocator_set_detail_needed (&fixture->rl, FALSE);
+
+  for (i = 0; i != G_N_ELEMENTS (ends); i++)
+  {
+    insn = NULL;
+    g_assert_cmpuint (gum_x86_relocator_read_one (&fixture->rl, &insn), ==,
+        ends[i]);
+    g_assert_cmpint (insn->id, ==, X86_INS_INVALID);
+    g_assert (!gum_x86_relocator_eob (&fixture->rl));
+  }
+
+  insn = NULL;
+  g_assert_cmpuint (gum_x86_relocator_read_one (&fixture->rl, &insn), ==,
+      sizeof (input));
+  g_assert_cmpint (insn->id, ==, X86_INS_RET);
+  g_assert (gum_x86_relocator_eoi (&fixture->rl));
+
+  gum_x86_relocator_write_all (&fixture->rl);
+  assert_output_equals (input);
+}
+
 RELOCATOR_TESTCASE (call_near_relative)
 {
   guint8 input[] = {
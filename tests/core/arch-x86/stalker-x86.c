@@ -16,9 +16,15 @@ TEST_LIST_BEGIN (stalker)
   STALKER_TESTENTRY (call)
   STALKER_TESTENTRY (ret)
   STALKER_TESTENTRY (exec)
+  STALKER_TESTENTRY (exec_beyond_event_buffer)
+  STALKER_TESTENTRY (flush_should_deliver_buffered_events)
+  STALKER_TESTENTRY (exec_after_refollow)
+  STALKER_TESTENTRY (exec_with_timestamps)
   STALKER_TESTENTRY (call_depth)
   STALKER_TESTENTRY (call_probe)
+  STALKER_TESTENTRY (call_probe_should_be_removable_while_dispatching)
   STALKER_TESTENTRY (custom_transformer)
+  STALKER_TESTENTRY (hit_counters)
 
   STALKER_TESTENTRY (unconditional_jumps)
   STALKER_TESTENTRY (short_conditional_jump_true)
@@ -26,6 +32,10 @@ TEST_LIST_BEGIN (stalker)
   STALKER_TESTENTRY (short_conditional_jcxz_true)
   STALKER_TESTENTRY (short_conditional_jcxz_false)
   STALKER_TESTENTRY (long_conditional_jump)
+  STALKER_TESTENTRY (conditional_jump_loop)
+  STALKER_TESTENTRY (block_sampling)
+  STALKER_TESTENTRY (coverage_bitmap)
+  STALKER_TESTENTRY (run_loop)
   STALKER_TESTENTRY (follow_return)
   STALKER_TESTENTRY (follow_stdcall)
   STALKER_TESTENTRY (follow_repne_ret)
@@ -55,10 +65,22 @@ TEST_LIST_BEGIN (stalker)
 #endif
   STALKER_TESTENTRY (no_red_zone_clobber)
   STALKER_TESTENTRY (big_block)
+  STALKER_TESTENTRY (megamorphic_indirect_calls)
+  STALKER_TESTENTRY (stats)
+  STALKER_TESTENTRY (code_budget_should_retire_slabs)
+  STALKER_TESTENTRY (code_budget_should_apply_without_trust)
+  STALKER_TESTENTRY (deep_recursion)
+  STALKER_TESTENTRY (event_router_filters_and_fans_out)
+  STALKER_TESTENTRY (call_graph_sink_aggregates_edges)
+  STALKER_TESTENTRY (prefetch)
 
   STALKER_TESTENTRY (heap_api)
   STALKER_TESTENTRY (follow_syscall)
   STALKER_TESTENTRY (follow_thread)
+  STALKER_TESTENTRY (follow_threads)
+  STALKER_TESTENTRY (scope_entry_should_be_stalked_until_it_returns)
+  STALKER_TESTENTRY (unfollow_while_parked_should_succeed)
+  STALKER_TESTENTRY (unfollow_before_infection_should_disinfect)
 #ifndef G_OS_WIN32
   STALKER_TESTENTRY (performance)
 #endif
@@ -69,6 +91,9 @@ TEST_LIST_BEGIN (stalker)
 # endif
   STALKER_TESTENTRY (win32_messagebeep_api)
   STALKER_TESTENTRY (win32_follow_user_to_kernel_to_callback)
+# if GLIB_SIZEOF_VOID_P == 4
+  STALKER_TESTENTRY (win32_callback_from_kernel_should_be_followed)
+# endif
   STALKER_TESTENTRY (win32_follow_callback_to_kernel_to_user)
 #endif
 TEST_LIST_END ()
@@ -78,12 +103,19 @@ static gboolean store_range_of_test_runner (const GumModuleDetails * details,
     gpointer user_data);
 static void pretend_workload (GumMemoryRange * runner_range);
 #endif
+static void follow_victim (TestStalkerFixture * fixture, gboolean batched);
 static gpointer stalker_victim (gpointer data);
+static gpointer stalker_idle_victim (gpointer data);
 static void insert_extra_increment_after_xor (GumStalkerIterator * iterator,
     GumStalkerWriter * output, gpointer user_data);
 static void store_xax (GumCpuContext * cpu_context, gpointer user_data);
+static void count_instructions_in_range (GumStalkerIterator * iterator,
+    GumStalkerWriter * output, gpointer user_data);
 static void invoke_follow_return_code (TestStalkerFixture * fixture);
 static void invoke_unfollow_deep_code (TestStalkerFixture * fixture);
+static guint recursive_fib (guint n);
+static gint invoke_megamorphic_targets (gint (* const * targets) (gint),
+    guint n_targets);
 
 gint gum_stalker_dummy_global_to_trick_optimizer = 0;
 
@@ -104,6 +136,335 @@ STALKER_TESTCASE (heap_api)
   /*gum_fake_event_sink_dump (fixture->sink);*/
 }
 
+#define MEGAMORPHIC_TARGET(n) \
+    static gint \
+    megamorphic_target_##n (gint value) \
+    { \
+      return value + n; \
+    }
+
+MEGAMORPHIC_TARGET (1)
+MEGAMORPHIC_TARGET (2)
+MEGAMORPHIC_TARGET (3)
+MEGAMORPHIC_TARGET (4)
+MEGAMORPHIC_TARGET (5)
+MEGAMORPHIC_TARGET (6)
+MEGAMORPHIC_TARGET (7)
+MEGAMORPHIC_TARGET (8)
+
+STALKER_TESTCASE (megamorphic_indirect_calls)
+{
+  gint (* const targets[]) (gint) = {
+    megamorphic_target_1, megamorphic_target_2, megamorphic_target_3,
+    megamorphic_target_4, megamorphic_target_5, megamorphic_target_6,
+    megamorphic_target_7, megamorphic_target_8
+  };
+  gint expected, actual;
+
+  expected = invoke_megamorphic_targets (targets, G_N_ELEMENTS (targets));
+
+  fixture->sink->mask = GUM_NOTHING;
+
+  gum_stalker_set_trust_threshold (fixture->stalker, 0);
+  gum_stalker_set_ic_entries (fixture->stalker, 4);
+  gum_stalker_set_ic_fallback_enabled (fixture->stalker, TRUE);
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  actual = invoke_megamorphic_targets (targets, G_N_ELEMENTS (targets));
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpint (actual, ==, expected);
+}
+
+static gint
+invoke_megamorphic_targets (gint (* const * targets) (gint),
+                            guint n_targets)
+{
+  gint result = 0;
+  guint round, i;
+
+  for (round = 0; round != 16; round++)
+  {
+    for (i = 0; i != n_targets; i++)
+    {
+      result = targets[i] (result) +
+          gum_stalker_dummy_global_to_trick_optimizer;
+    }
+  }
+
+  return result;
+}
+
+STALKER_TESTCASE (stats)
+{
+  gint (* const targets[]) (gint) = {
+    megamorphic_target_1, megamorphic_target_2
+  };
+  gint expected, actual;
+  GumStalkerStats stats;
+
+  expected = invoke_megamorphic_targets (targets, G_N_ELEMENTS (targets));
+
+  fixture->sink->mask = GUM_NOTHING;
+
+  gum_stalker_set_trust_threshold (fixture->stalker, 0);
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  actual = invoke_megamorphic_targets (targets, G_N_ELEMENTS (targets));
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpint (actual, ==, expected);
+
+  gum_stalker_get_stats (fixture->stalker, &stats);
+  g_assert_cmpuint (stats.blocks_compiled, >, 0);
+  g_assert_cmpuint (stats.bytes_emitted, >, 0);
+  g_assert_cmpuint (stats.trust_failures, ==, 0);
+  g_assert_cmpuint (stats.ic_misses, >, 0);
+  g_assert_cmpuint (stats.ic_hits, >, stats.ic_misses);
+  g_assert_cmpuint (stats.call_indirect_entrygates, >, 0);
+}
+
+#define BUDGET_BLOCK_COUNT (1 << 18)
+
+STALKER_TESTCASE (code_budget_should_retire_slabs)
+{
+  gsize size;
+  guint8 * code_template, * p;
+  StalkerTestFunc func;
+  gint actual[2];
+  GumStalkerStats stats;
+  guint i;
+
+  size = 2 + (BUDGET_BLOCK_COUNT * 4) + 1;
+  code_template = g_malloc (size);
+  p = code_template;
+  *p++ = 0x31; *p++ = 0xc0;   /* xor eax, eax */
+  for (i = 0; i != BUDGET_BLOCK_COUNT; i++)
+  {
+    *p++ = 0xff; *p++ = 0xc0; /* inc eax      */
+    *p++ = 0xeb; *p++ = 0x00; /* jmp short +0 */
+  }
+  *p++ = 0xc3;                /* ret          */
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code_template, size));
+  g_free (code_template);
+
+  fixture->sink->mask = GUM_NOTHING;
+
+  g_assert_true (gum_stalker_set_code_budget (fixture->stalker, 1));
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  for (i = 0; i != G_N_ELEMENTS (actual); i++)
+    actual[i] = func (0);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  for (i = 0; i != G_N_ELEMENTS (actual); i++)
+    g_assert_cmpint (actual[i], ==, BUDGET_BLOCK_COUNT);
+
+  gum_stalker_get_stats (fixture->stalker, &stats);
+  g_assert_cmpuint (stats.blocks_compiled, >, BUDGET_BLOCK_COUNT);
+  g_assert_cmpuint (stats.code_cache_flushes, >, 0);
+}
+
+STALKER_TESTCASE (code_budget_should_apply_without_trust)
+{
+  const guint8 code_template[] = {
+    0xb8, 0x39, 0x05, 0x00, 0x00, /* mov eax, 1337 */
+    0xc3                          /* ret           */
+  };
+  StalkerTestFunc func;
+  guint i, mismatches;
+  GumStalkerStats stats;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code_template,
+          sizeof (code_template)));
+
+  fixture->sink->mask = GUM_NOTHING;
+
+  /* Every block gets compiled again each time it runs */
+  gum_stalker_set_trust_threshold (fixture->stalker, -1);
+  g_assert_true (gum_stalker_set_code_budget (fixture->stalker, 1));
+  mismatches = 0;
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  for (i = 0; i != BUDGET_BLOCK_COUNT / 2; i++)
+  {
+    if (func (0) != 1337)
+      mismatches++;
+  }
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpuint (mismatches, ==, 0);
+
+  gum_stalker_get_stats (fixture->stalker, &stats);
+  g_assert_cmpuint (stats.code_cache_flushes, >, 0);
+}
+
+STALKER_TESTCASE (deep_recursion)
+{
+  guint expected, actual;
+
+  expected = recursive_fib (20);
+
+  fixture->sink->mask = (GumEventType) (GUM_CALL | GUM_RET);
+
+  gum_stalker_set_trust_threshold (fixture->stalker, 0);
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  actual = recursive_fib (20);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpuint (actual, ==, expected);
+  g_assert_cmpuint (fixture->sink->events->len, >, 0);
+}
+
+STALKER_TESTCASE (event_router_filters_and_fans_out)
+{
+  GumEventRouter * router;
+  GumFakeEventSink * calls_sink, * nowhere_sink;
+  GumEventFilter filter;
+  guint expected, actual, i;
+
+  expected = recursive_fib (10);
+
+  router = gum_event_router_new ();
+
+  calls_sink = GUM_FAKE_EVENT_SINK (gum_fake_event_sink_new ());
+  calls_sink->mask = (GumEventType) (GUM_CALL | GUM_RET);
+  gum_event_filter_init (&filter, GUM_CALL);
+  gum_event_router_add_route (router, GUM_EVENT_SINK (calls_sink), &filter);
+
+  nowhere_sink = GUM_FAKE_EVENT_SINK (gum_fake_event_sink_new ());
+  nowhere_sink->mask = (GumEventType) (GUM_CALL | GUM_EXEC);
+  gum_event_filter_init (&filter, GUM_CALL | GUM_EXEC);
+  filter.location.base_address = 1;
+  filter.location.size = 1;
+  gum_event_router_add_route (router, GUM_EVENT_SINK (nowhere_sink), &filter);
+
+  g_assert_cmpuint (gum_event_sink_query_mask (GUM_EVENT_SINK (router)), ==,
+      GUM_CALL | GUM_EXEC);
+  g_assert_cmpuint (gum_event_sink_query_location_mask (
+      GUM_EVENT_SINK (router), GSIZE_TO_POINTER (1)), ==, GUM_CALL | GUM_EXEC);
+  g_assert_cmpuint (gum_event_sink_query_location_mask (
+      GUM_EVENT_SINK (router), GSIZE_TO_POINTER (2)), ==, GUM_CALL);
+
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (router));
+  actual = recursive_fib (10);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpuint (actual, ==, expected);
+  g_assert_cmpuint (calls_sink->events->len, >, 0);
+  for (i = 0; i != calls_sink->events->len; i++)
+  {
+    g_assert_cmpint (g_array_index (calls_sink->events, GumEvent, i).type, ==,
+        GUM_CALL);
+  }
+  g_assert_cmpuint (nowhere_sink->events->len, ==, 0);
+
+  g_object_unref (nowhere_sink);
+  g_object_unref (calls_sink);
+  g_object_unref (router);
+}
+
+typedef struct _CallGraphTotals CallGraphTotals;
+
+struct _CallGraphTotals
+{
+  guint num_aggregates;
+  guint64 fib_calls;
+  guint64 total_calls;
+  guint64 total_depths;
+};
+
+static void
+on_call_graph_aggregate (const GumCallGraphAggregate * aggregate,
+                         gpointer user_data)
+{
+  CallGraphTotals * totals = user_data;
+  guint i;
+
+  totals->num_aggregates++;
+
+  for (i = 0; i != aggregate->n_edges; i++)
+  {
+    const GumCallGraphEdge * edge = &aggregate->edges[i];
+
+    if (edge->target == GUM_FUNCPTR_TO_POINTER (recursive_fib))
+      totals->fib_calls += edge->count;
+    totals->total_calls += edge->count;
+  }
+
+  for (i = 0; i != GUM_CALL_GRAPH_MAX_DEPTH; i++)
+    totals->total_depths += aggregate->depths[i];
+}
+
+STALKER_TESTCASE (call_graph_sink_aggregates_edges)
+{
+  CallGraphTotals totals = { 0, };
+  GumCallGraphSink * sink;
+  guint expected, actual;
+
+  expected = recursive_fib (10);
+
+  sink = gum_call_graph_sink_new (0, on_call_graph_aggregate, &totals, NULL);
+
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (sink));
+  actual = recursive_fib (10);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpuint (actual, ==, expected);
+  g_assert_cmpuint (totals.num_aggregates, >=, 1);
+  g_assert_cmpuint (totals.fib_calls, >=, 176);
+  g_assert_cmpuint (totals.total_depths, ==, totals.total_calls);
+
+  g_object_unref (sink);
+}
+
+static guint
+recursive_fib (guint n)
+{
+  if (n < 2)
+    return n + gum_stalker_dummy_global_to_trick_optimizer;
+
+  return recursive_fib (n - 1) + recursive_fib (n - 2);
+}
+
+STALKER_TESTCASE (prefetch)
+{
+  StalkerTestFunc func;
+  gint ret;
+  guint compile_count, i;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, flat_code, sizeof (flat_code)));
+
+  fixture->sink->mask = GUM_COMPILE;
+
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  gum_stalker_prefetch (fixture->stalker, func,
+      gum_stalker_get_trust_threshold (fixture->stalker));
+  ret = func (42);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_cmpint (ret, ==, 2);
+
+  compile_count = 0;
+  for (i = 0; i != fixture->sink->events->len; i++)
+  {
+    GumCompileEvent * ev =
+        &g_array_index (fixture->sink->events, GumEvent, i).compile;
+
+    if (GUM_ADDRESS (ev->begin) == GUM_ADDRESS (func))
+      compile_count++;
+  }
+  g_assert_cmpuint (compile_count, ==, 1);
+}
+
 STALKER_TESTCASE (follow_syscall)
 {
 #ifdef G_OS_WIN32
@@ -127,6 +488,18 @@ STALKER_TESTCASE (follow_syscall)
 }
 
 STALKER_TESTCASE (follow_thread)
+{
+  follow_victim (fixture, FALSE);
+}
+
+STALKER_TESTCASE (follow_threads)
+{
+  follow_victim (fixture, TRUE);
+}
+
+static void
+follow_victim (TestStalkerFixture * fixture,
+               gboolean batched)
 {
   StalkerVictimContext ctx;
   GumThreadId thread_id;
@@ -155,8 +528,16 @@ STALKER_TESTCASE (follow_thread)
 
   /* 4: Follow and notify victim about it */
   fixture->sink->mask = (GumEventType) (GUM_EXEC | GUM_CALL | GUM_RET);
-  gum_stalker_follow (fixture->stalker, thread_id, NULL,
-      GUM_EVENT_SINK (fixture->sink));
+  if (batched)
+  {
+    g_assert_cmpuint (gum_stalker_follow_threads (fixture->stalker,
+        &thread_id, 1, NULL, GUM_EVENT_SINK (fixture->sink)), ==, 1);
+  }
+  else
+  {
+    gum_stalker_follow (fixture->stalker, thread_id, NULL,
+        GUM_EVENT_SINK (fixture->sink));
+  }
   g_mutex_lock (&ctx.mutex);
   ctx.state = STALKER_VICTIM_IS_FOLLOWED;
   g_cond_signal (&ctx.cond);
@@ -236,6 +617,161 @@ stalker_victim (gpointer data)
   return NULL;
 }
 
+static const guint8 scoped_code[] = {
+    0x90, 0x90, 0x90, 0x90,       /* nop x 16        */
+    0x90, 0x90, 0x90, 0x90,
+    0x90, 0x90, 0x90, 0x90,
+    0x90, 0x90, 0x90, 0x90,
+    0xb8, 0x39, 0x05, 0x00, 0x00, /* mov eax, 1337   */
+    0xc3,                         /* ret             */
+
+    0xcc, 0xcc, 0xcc, 0xcc,       /* int3 padding    */
+    0xcc, 0xcc, 0xcc, 0xcc,
+    0xcc, 0xcc,
+
+    0xb8, 0x2a, 0x00, 0x00, 0x00, /* mov eax, 42     */
+    0xc3                          /* ret             */
+};
+
+#define SCOPED_CODE_ENTRY_SIZE 22
+#define SCOPED_CODE_OTHER_OFFSET 32
+
+STALKER_TESTCASE (scope_entry_should_be_stalked_until_it_returns)
+{
+  guint8 * code;
+  StalkerTestFunc func, other;
+  GumMemoryRange scope;
+  guint i;
+
+  code = test_stalker_fixture_dup_code (fixture, scoped_code,
+      sizeof (scoped_code));
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc, code);
+  other = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      code + SCOPED_CODE_OTHER_OFFSET);
+
+  scope.base_address = GUM_ADDRESS (code);
+  scope.size = SCOPED_CODE_ENTRY_SIZE;
+  gum_stalker_add_scope (fixture->stalker, &scope);
+  g_assert_true (gum_stalker_add_scope_entry (fixture->stalker, code));
+
+  fixture->sink->mask = GUM_EXEC;
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  g_assert_cmpint (func (0), ==, 1337);
+  g_assert_cmpint (other (0), ==, 42);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_false (gum_stalker_is_following_me (fixture->stalker));
+
+  g_assert_cmpuint (fixture->sink->events->len, >, 0);
+  GUM_ASSERT_CMPADDR (g_array_index (fixture->sink->events, GumEvent,
+      fixture->sink->events->len - 1).exec.location,
+      ==, code + SCOPED_CODE_ENTRY_SIZE - 1);
+  for (i = 0; i != fixture->sink->events->len; i++)
+  {
+    GumExecEvent * ev =
+        &g_array_index (fixture->sink->events, GumEvent, i).exec;
+
+    g_assert_false ((guint8 *) ev->location >=
+        code + SCOPED_CODE_OTHER_OFFSET &&
+        (guint8 *) ev->location < code + sizeof (scoped_code));
+  }
+}
+
+STALKER_TESTCASE (unfollow_while_parked_should_succeed)
+{
+  const guint8 code_template[] = {
+    0xb8, 0x02, 0x00, 0x00, 0x00, /* mov eax, 2 */
+    0xc3                          /* ret        */
+  };
+  guint8 * code;
+  StalkerTestFunc func;
+  GumMemoryRange scope;
+
+  code = test_stalker_fixture_dup_code (fixture, code_template,
+      sizeof (code_template));
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc, code);
+
+  scope.base_address = GUM_ADDRESS (code);
+  scope.size = sizeof (code_template);
+  gum_stalker_add_scope (fixture->stalker, &scope);
+
+  fixture->sink->mask = GUM_EXEC;
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  g_assert_true (gum_stalker_is_following_me (fixture->stalker));
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  g_assert_false (gum_stalker_is_following_me (fixture->stalker));
+
+  g_assert_cmpint (func (0), ==, 2);
+  g_assert_cmpuint (fixture->sink->events->len, ==, 0);
+}
+
+STALKER_TESTCASE (unfollow_before_infection_should_disinfect)
+{
+  StalkerVictimContext ctx;
+  GumThreadId thread_id;
+  GThread * thread;
+
+#if defined (G_OS_WIN32) || defined (HAVE_LINUX)
+  if (!g_test_slow ())
+  {
+    g_print ("<not yet stable on this OS; skipping, run in slow mode> ");
+    return;
+  }
+#endif
+
+  ctx.state = STALKER_VICTIM_CREATED;
+  g_mutex_init (&ctx.mutex);
+  g_cond_init (&ctx.cond);
+
+  thread = g_thread_new ("stalker-test-victim", stalker_idle_victim, &ctx);
+
+  g_mutex_lock (&ctx.mutex);
+  while (ctx.state != STALKER_VICTIM_READY_FOR_FOLLOW)
+    g_cond_wait (&ctx.cond, &ctx.mutex);
+  thread_id = ctx.thread_id;
+
+  /* The victim is blocked until we signal it, so it can't get infected */
+  fixture->sink->mask = (GumEventType) (GUM_EXEC | GUM_CALL | GUM_RET);
+  gum_stalker_follow (fixture->stalker, thread_id, NULL,
+      GUM_EVENT_SINK (fixture->sink));
+  gum_stalker_unfollow (fixture->stalker, thread_id);
+
+  g_assert_false (gum_stalker_garbage_collect (fixture->stalker));
+
+  ctx.state = STALKER_VICTIM_IS_UNFOLLOWED;
+  g_cond_signal (&ctx.cond);
+  g_mutex_unlock (&ctx.mutex);
+
+  g_thread_join (thread);
+
+  g_assert_cmpuint (fixture->sink->events->len, ==, 0);
+
+  g_mutex_clear (&ctx.mutex);
+  g_cond_clear (&ctx.cond);
+}
+
+static gpointer
+stalker_idle_victim (gpointer data)
+{
+  StalkerVictimContext * ctx = (StalkerVictimContext *) data;
+
+  g_mutex_lock (&ctx->mutex);
+
+  ctx->state = STALKER_VICTIM_READY_FOR_FOLLOW;
+  ctx->thread_id = gum_process_get_current_thread_id ();
+  g_cond_signal (&ctx->cond);
+
+  while (ctx->state != STALKER_VICTIM_IS_UNFOLLOWED)
+    g_cond_wait (&ctx->cond, &ctx->mutex);
+
+  g_mutex_unlock (&ctx->mutex);
+
+  return NULL;
+}
+
 #ifndef G_OS_WIN32
 
 STALKER_TESTCASE (performance)
@@ -434,6 +970,93 @@ STALKER_TESTCASE (exec)
   GUM_ASSERT_CMPADDR (ev->location, ==, func);
 }
 
+STALKER_TESTCASE (exec_beyond_event_buffer)
+{
+  const guint8 code[] = {
+      0xb9, 0xe8, 0x03, 0x00, 0x00, /* mov ecx, 1000 */
+      0xff, 0xc9,                   /* dec ecx       */
+      0x75, 0xfc,                   /* jnz -4        */
+      0xb8, 0x39, 0x05, 0x00, 0x00, /* mov eax, 1337 */
+      0xc3,                         /* ret           */
+  };
+  StalkerTestFunc func;
+  guint impl_insn_count = 1 + (1000 * 2) + 2;
+  gint ret;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code, sizeof (code)));
+
+  fixture->sink->mask = GUM_EXEC;
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, 0);
+  g_assert_cmpint (ret, ==, 1337);
+
+  g_assert_cmpuint (fixture->sink->events->len, ==,
+      INVOKER_INSN_COUNT + impl_insn_count);
+  GUM_ASSERT_CMPADDR (NTH_EXEC_EVENT_LOCATION (INVOKER_IMPL_OFFSET + 1),
+      ==, fixture->code + 5);
+  GUM_ASSERT_CMPADDR (NTH_EXEC_EVENT_LOCATION (INVOKER_IMPL_OFFSET +
+      impl_insn_count - 1), ==, fixture->code + 14);
+}
+
+STALKER_TESTCASE (flush_should_deliver_buffered_events)
+{
+  guint events_before_flush, events_after_flush;
+
+  fixture->sink->mask = GUM_EXEC;
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  events_before_flush = fixture->sink->events->len;
+  gum_stalker_flush (fixture->stalker);
+  events_after_flush = fixture->sink->events->len;
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  /* Far fewer than GUM_EVENT_BUFFER_SIZE, so nothing got through on its own */
+  g_assert_cmpuint (events_before_flush, ==, 0);
+  g_assert_cmpuint (events_after_flush, >, 0);
+}
+
+STALKER_TESTCASE (exec_after_refollow)
+{
+  StalkerTestFunc func;
+  gint ret;
+
+  func = invoke_flat (fixture, GUM_EXEC);
+  g_assert_cmpuint (fixture->sink->events->len, ==, INVOKER_INSN_COUNT + 4);
+
+  gum_fake_event_sink_reset (fixture->sink);
+  fixture->sink->mask = GUM_EXEC;
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, -1);
+  g_assert_cmpint (ret, ==, 2);
+
+  g_assert_cmpuint (fixture->sink->events->len, ==, INVOKER_INSN_COUNT + 4);
+  GUM_ASSERT_CMPADDR (NTH_EXEC_EVENT_LOCATION (INVOKER_IMPL_OFFSET), ==, func);
+}
+
+STALKER_TESTCASE (exec_with_timestamps)
+{
+  guint64 before, after;
+  guint i;
+
+  gum_stalker_set_timestamps_enabled (fixture->stalker, TRUE);
+
+  before = gum_timestamp_now ();
+  invoke_flat (fixture, GUM_EXEC);
+  after = gum_timestamp_now ();
+
+  g_assert_cmpuint (fixture->sink->events->len, ==, INVOKER_INSN_COUNT + 4);
+  for (i = 1; i != fixture->sink->events->len; i++)
+  {
+    GumExecEvent * previous = &g_array_index (fixture->sink->events, GumEvent,
+        i - 1).exec;
+    GumExecEvent * ev = &g_array_index (fixture->sink->events, GumEvent,
+        i).exec;
+
+    g_assert_cmpuint (previous->timestamp, >=, before);
+    g_assert_cmpuint (ev->timestamp, >=, previous->timestamp);
+    g_assert_cmpuint (ev->timestamp, <=, after);
+  }
+}
+
 STALKER_TESTCASE (call_depth)
 {
   const guint8 code[] =
@@ -579,6 +1202,99 @@ probe_func_a_invocation (GumCallSite * site,
 #endif
 }
 
+typedef struct _ProbeDispatchContext ProbeDispatchContext;
+
+struct _ProbeDispatchContext
+{
+  TestStalkerFixture * fixture;
+  StalkerTestFunc func;
+  volatile gint stop;
+  volatile gint callback_count;
+};
+
+static gpointer dispatch_probes_until_stopped (gpointer data);
+static void probe_taking_stalker_lock (GumCallSite * site,
+    gpointer user_data);
+
+STALKER_TESTCASE (call_probe_should_be_removable_while_dispatching)
+{
+  const guint8 code_template[] =
+  {
+    0xe8, 0x01, 0x00, 0x00, 0x00, /* call func_a */
+    0xc3,                         /* ret         */
+
+    /* func_a: */
+    0xc3,                         /* ret         */
+  };
+  ProbeDispatchContext ctx;
+  guint8 * func_a_address;
+  GumProbeId first_id;
+  GThread * thread;
+  guint i;
+
+  ctx.fixture = fixture;
+  ctx.func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, code_template,
+          sizeof (code_template)));
+  ctx.stop = FALSE;
+  ctx.callback_count = 0;
+
+  func_a_address = fixture->code + 6;
+
+  fixture->sink->mask = GUM_NOTHING;
+
+  first_id = gum_stalker_add_call_probe (fixture->stalker, func_a_address,
+      probe_taking_stalker_lock, &ctx, NULL);
+
+  thread = g_thread_new ("stalker-test-dispatcher",
+      dispatch_probes_until_stopped, &ctx);
+  while (g_atomic_int_get (&ctx.callback_count) == 0)
+    g_thread_yield ();
+
+  /* Each removal waits for the dispatcher, whose callback takes the lock */
+  for (i = 0; i != 100; i++)
+  {
+    GumProbeId id;
+
+    id = gum_stalker_add_call_probe (fixture->stalker, func_a_address,
+        probe_taking_stalker_lock, &ctx, NULL);
+    gum_stalker_remove_call_probe (fixture->stalker, id);
+  }
+  gum_stalker_remove_call_probe (fixture->stalker, first_id);
+
+  g_atomic_int_set (&ctx.stop, TRUE);
+  g_thread_join (thread);
+
+  g_assert_cmpint (g_atomic_int_get (&ctx.callback_count), >, 0);
+}
+
+static gpointer
+dispatch_probes_until_stopped (gpointer data)
+{
+  ProbeDispatchContext * ctx = (ProbeDispatchContext *) data;
+  TestStalkerFixture * fixture = ctx->fixture;
+
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  while (!g_atomic_int_get (&ctx->stop))
+    ctx->func (0);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  return NULL;
+}
+
+static void
+probe_taking_stalker_lock (GumCallSite * site,
+                           gpointer user_data)
+{
+  ProbeDispatchContext * ctx = (ProbeDispatchContext *) user_data;
+  GumStalkerStats stats;
+
+  gum_stalker_get_stats (ctx->fixture->stalker, &stats);
+
+  g_atomic_int_inc (&ctx->callback_count);
+}
+
 static const guint8 jumpy_code[] = {
     0x31, 0xc0,                   /* xor eax, eax */
     0xeb, 0x01,                   /* jmp short +1 */
@@ -659,6 +1375,82 @@ store_xax (GumCpuContext * cpu_context,
   *last_xax = GUM_CPU_CONTEXT_XAX (cpu_context);
 }
 
+typedef struct _HitCounterContext HitCounterContext;
+
+struct _HitCounterContext
+{
+  GumHitCounters * counters;
+  const guint8 * code_start;
+};
+
+STALKER_TESTCASE (hit_counters)
+{
+  HitCounterContext ctx;
+  StalkerTestFunc func;
+  GumHitCounters * before, * delta;
+  gint ret;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, jumpy_code, sizeof (jumpy_code)));
+
+  ctx.counters = gum_hit_counters_new (sizeof (jumpy_code));
+  ctx.code_start = fixture->code;
+
+  fixture->transformer = gum_stalker_transformer_make_from_callback (
+      count_instructions_in_range, &ctx, NULL);
+
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, -1);
+  g_assert_cmpint (ret, ==, 1);
+
+  g_assert_cmpuint (ctx.counters->values[0], ==, 1);
+  g_assert_cmpuint (ctx.counters->values[2], ==, 1);
+  g_assert_cmpuint (ctx.counters->values[4], ==, 0);
+  g_assert_cmpuint (ctx.counters->values[5], ==, 1);
+  g_assert_cmpuint (ctx.counters->values[7], ==, 1);
+  g_assert_cmpuint (ctx.counters->values[14], ==, 1);
+
+  before = gum_hit_counters_snapshot (ctx.counters);
+
+  ret = test_stalker_fixture_follow_and_invoke (fixture, func, -1);
+  g_assert_cmpint (ret, ==, 1);
+
+  delta = gum_hit_counters_diff (ctx.counters, before);
+  g_assert_cmpuint (ctx.counters->values[0], ==, 2);
+  g_assert_cmpuint (delta->values[0], ==, 1);
+  g_assert_cmpuint (delta->values[4], ==, 0);
+  g_assert_cmpuint (delta->values[14], ==, 1);
+
+  gum_hit_counters_reset (ctx.counters);
+  g_assert_cmpuint (ctx.counters->values[0], ==, 0);
+
+  gum_hit_counters_free (delta);
+  gum_hit_counters_free (before);
+  gum_hit_counters_free (ctx.counters);
+}
+
+static void
+count_instructions_in_range (GumStalkerIterator * iterator,
+                             GumStalkerWriter * output,
+                             gpointer user_data)
+{
+  HitCounterContext * ctx = user_data;
+  const cs_insn * insn;
+
+  while (gum_stalker_iterator_next (iterator, &insn))
+  {
+    gsize offset = insn->address - GUM_ADDRESS (ctx->code_start);
+
+    if (insn->address >= GUM_ADDRESS (ctx->code_start) &&
+        offset < ctx->counters->length)
+    {
+      gum_stalker_iterator_put_counter_increment (iterator, ctx->counters,
+          offset);
+    }
+
+    gum_stalker_iterator_keep (iterator);
+  }
+}
+
 STALKER_TESTCASE (unconditional_jumps)
 {
   invoke_jumpy (fixture, GUM_EXEC);
@@ -862,6 +1654,144 @@ STALKER_TESTCASE (long_conditional_jump)
   invoke_long_condy (fixture, GUM_EXEC, FALSE);
 }
 
+static const guint8 loopy_code[] = {
+    0x31, 0xc0,                   /* xor eax, eax    */
+    0xb9, 0x64, 0x00, 0x00, 0x00, /* mov ecx, 100    */
+    0x83, 0xc0, 0x02,             /* add eax, 2      */
+    0xff, 0xc9,                   /* dec ecx         */
+    0x75, 0xf9,                   /* jnz short -7    */
+    0xc3                          /* ret             */
+};
+
+STALKER_TESTCASE (conditional_jump_loop)
+{
+  StalkerTestFunc func;
+  guint i;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, loopy_code, sizeof (loopy_code)));
+
+  for (i = 0; i != 2; i++)
+  {
+    g_assert_cmpint (test_stalker_fixture_follow_and_invoke (fixture, func, 0),
+        ==, 200);
+  }
+}
+
+STALKER_TESTCASE (block_sampling)
+{
+  StalkerTestFunc func;
+  guint i, n;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, loopy_code, sizeof (loopy_code)));
+
+  gum_stalker_set_block_sample_interval (fixture->stalker, 10);
+
+  fixture->sink->mask = GUM_BLOCK;
+  g_assert_cmpint (test_stalker_fixture_follow_and_invoke (fixture, func, 0),
+      ==, 200);
+
+  n = 0;
+  for (i = 0; i != fixture->sink->events->len; i++)
+  {
+    GumEvent * ev = &g_array_index (fixture->sink->events, GumEvent, i);
+
+    if (ev->type == GUM_BLOCK && ev->block.begin == fixture->code + 7)
+      n++;
+  }
+
+  /* The loop body runs 99 times as its own block: hits 1, 11, ..., 91. */
+  g_assert_cmpuint (n, ==, 10);
+}
+
+STALKER_TESTCASE (coverage_bitmap)
+{
+  const gsize size = 65536;
+  StalkerTestFunc func;
+  guint8 * bitmap;
+  gsize body, id, i;
+
+  func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, loopy_code, sizeof (loopy_code)));
+
+  bitmap = g_malloc0 (size);
+  gum_stalker_set_coverage_bitmap (fixture->stalker, bitmap, size);
+
+  g_assert_cmpint (test_stalker_fixture_follow_and_invoke (fixture, func, 0),
+      ==, 200);
+
+  /* The loop body branches back to itself on all but its first entry. */
+  body = GPOINTER_TO_SIZE (fixture->code + 7);
+  id = ((body >> 4) ^ (body << 8)) & (size - 1);
+  g_assert_cmpuint (bitmap[(id >> 1) ^ id], >=, 98);
+
+  gum_stalker_reset_coverage (fixture->stalker);
+  for (i = 0; i != size; i++)
+    g_assert_cmpuint (bitmap[i], ==, 0);
+
+  gum_stalker_set_coverage_bitmap (fixture->stalker, NULL, 0);
+  g_free (bitmap);
+}
+
+typedef struct _LoopContext LoopContext;
+
+struct _LoopContext
+{
+  StalkerTestFunc func;
+  const guint8 * edge;
+  gint results[3];
+  guint8 edge_hits[3];
+};
+
+static gboolean run_loopy_code (guint iteration, gpointer user_data);
+
+STALKER_TESTCASE (run_loop)
+{
+  const gsize size = 65536;
+  LoopContext ctx;
+  guint8 * bitmap;
+  gsize body, id;
+  guint n, i;
+
+  ctx.func = GUM_POINTER_TO_FUNCPTR (StalkerTestFunc,
+      test_stalker_fixture_dup_code (fixture, loopy_code, sizeof (loopy_code)));
+
+  bitmap = g_malloc0 (size);
+  gum_stalker_set_coverage_bitmap (fixture->stalker, bitmap, size);
+
+  body = GPOINTER_TO_SIZE (fixture->code + 7);
+  id = ((body >> 4) ^ (body << 8)) & (size - 1);
+  ctx.edge = &bitmap[(id >> 1) ^ id];
+
+  n = gum_stalker_run_loop (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink), run_loopy_code, &ctx);
+  g_assert_cmpuint (n, ==, G_N_ELEMENTS (ctx.results));
+
+  /* The bitmap starts out clean each time, so the counts do not pile up. */
+  for (i = 0; i != n; i++)
+  {
+    g_assert_cmpint (ctx.results[i], ==, 200);
+    g_assert_cmpuint (ctx.edge_hits[i], >=, 98);
+    g_assert_cmpuint (ctx.edge_hits[i], ==, ctx.edge_hits[0]);
+  }
+
+  gum_stalker_set_coverage_bitmap (fixture->stalker, NULL, 0);
+  g_free (bitmap);
+}
+
+static gboolean
+run_loopy_code (guint iteration,
+                gpointer user_data)
+{
+  LoopContext * ctx = user_data;
+
+  ctx->results[iteration] = ctx->func (0);
+  ctx->edge_hits[iteration] = *ctx->edge;
+
+  return iteration + 1 != G_N_ELEMENTS (ctx->results);
+}
+
 #if GLIB_SIZEOF_VOID_P == 4
 # define FOLLOW_RETURN_EXTRA_INSN_COUNT 2
 #elif GLIB_SIZEOF_VOID_P == 8
@@ -1837,6 +2767,7 @@ struct _TestWindow
 
 static void do_follow (TestWindow * window, gpointer user_data);
 static void do_unfollow (TestWindow * window, gpointer user_data);
+static void do_nothing (TestWindow * window, gpointer user_data);
 
 static TestWindow * create_test_window (GumStalker * stalker);
 static void destroy_test_window (TestWindow * window);
@@ -1941,6 +2872,43 @@ STALKER_TESTCASE (win32_follow_user_to_kernel_to_callback)
   destroy_test_window (window);
 }
 
+#if GLIB_SIZEOF_VOID_P == 4
+
+STALKER_TESTCASE (win32_callback_from_kernel_should_be_followed)
+{
+  TestWindow * window;
+  gboolean window_proc_called = FALSE;
+  guint i;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  window = create_test_window (fixture->stalker);
+
+  fixture->sink->mask = GUM_CALL;
+  gum_stalker_follow_me (fixture->stalker, fixture->transformer,
+      GUM_EVENT_SINK (fixture->sink));
+  send_message_and_pump_messages_briefly (window, do_nothing, NULL);
+  gum_stalker_unfollow_me (fixture->stalker);
+
+  for (i = 0; i != fixture->sink->events->len; i++)
+  {
+    GumCallEvent * ev =
+        &g_array_index (fixture->sink->events, GumEvent, i).call;
+
+    if (ev->target == GUM_FUNCPTR_TO_POINTER (test_window_proc))
+      window_proc_called = TRUE;
+  }
+  g_assert (window_proc_called);
+
+  destroy_test_window (window);
+}
+
+#endif
+
 STALKER_TESTCASE (win32_follow_callback_to_kernel_to_user)
 {
   TestWindow * window;
@@ -1972,6 +2940,11 @@ do_unfollow (TestWindow * window, gpointer user_data)
   gum_stalker_unfollow_me (window->stalker);
 }
 
+static void
+do_nothing (TestWindow * window, gpointer user_data)
+{
+}
+
 static TestWindow *
 create_test_window (GumStalker * stalker)
 {
@@ -13,6 +13,8 @@ TEST_LIST_BEGIN (backtracer)
   BACKTRACER_TESTENTRY (basics)
   BACKTRACER_TESTENTRY (full_cycle_with_interceptor)
   BACKTRACER_TESTENTRY (full_cycle_with_allocation_tracker)
+  BACKTRACER_TESTENTRY (fast_backtracer_should_capture_caller)
+  BACKTRACER_TESTENTRY (stack_table_should_intern_identical_stacks)
 #if ENABLE_PERFORMANCE_TEST
   BACKTRACER_TESTENTRY (performance)
 #endif
@@ -189,6 +191,84 @@ BACKTRACER_TESTCASE (full_cycle_with_allocation_tracker)
   g_object_unref (tracker);
 }
 
+BACKTRACER_TESTCASE (fast_backtracer_should_capture_caller)
+{
+  GumBacktracer * backtracer;
+  GumInterceptor * interceptor;
+  BacktraceCollector * collector;
+  int (* close_impl) (int fd);
+  GumReturnAddressDetails on_enter;
+
+  backtracer = gum_backtracer_make_fast ();
+  if (backtracer == NULL)
+  {
+    g_print ("<skipping, no backtracer available> ");
+    return;
+  }
+
+  interceptor = gum_interceptor_obtain ();
+  collector = backtrace_collector_new_with_backtracer (backtracer);
+
+#ifdef G_OS_WIN32
+  close_impl = _close;
+#else
+  close_impl =
+      GSIZE_TO_POINTER (gum_module_find_export_by_name (NULL, "close"));
+#endif
+
+  gum_interceptor_attach_listener (interceptor, close_impl,
+      GUM_INVOCATION_LISTENER (collector), NULL);
+  close_impl (-1);
+  gum_interceptor_detach_listener (interceptor,
+      GUM_INVOCATION_LISTENER (collector));
+
+  g_assert_cmpuint (collector->last_on_enter.len, !=, 0);
+  g_assert (gum_return_address_details_from_address (
+      collector->last_on_enter.items[0], &on_enter));
+  g_assert_cmpstr (on_enter.function_name, ==, __FUNCTION__);
+
+  g_object_unref (collector);
+  g_object_unref (interceptor);
+  g_object_unref (backtracer);
+}
+
+BACKTRACER_TESTCASE (stack_table_should_intern_identical_stacks)
+{
+  GumStackTable * table;
+  GumReturnAddressArray a = { 0, }, b = { 0, }, empty = { 0, }, result;
+  GumStackId a_id, b_id;
+  guint i;
+
+  for (i = 0; i != 3; i++)
+  {
+    a.items[i] = GSIZE_TO_POINTER (0x1000 + (i * 0x10));
+    b.items[i] = GSIZE_TO_POINTER (0x2000 + (i * 0x10));
+  }
+  a.len = 3;
+  b.len = 2;
+
+  table = gum_stack_table_new ();
+
+  a_id = gum_stack_table_intern (table, &a);
+  b_id = gum_stack_table_intern (table, &b);
+  g_assert_cmpuint (a_id, !=, GUM_STACK_ID_NONE);
+  g_assert_cmpuint (b_id, !=, GUM_STACK_ID_NONE);
+  g_assert_cmpuint (a_id, !=, b_id);
+  g_assert_cmpuint (gum_stack_table_intern (table, &a), ==, a_id);
+  g_assert_cmpuint (gum_stack_table_intern (table, &empty), ==,
+      GUM_STACK_ID_NONE);
+  g_assert_cmpuint (gum_stack_table_get_size (table), ==, 2);
+
+  g_assert (gum_stack_table_lookup (table, a_id, &result));
+  g_assert (gum_return_address_array_is_equal (&result, &a));
+  g_assert (gum_stack_table_lookup (table, b_id, &result));
+  g_assert (gum_return_address_array_is_equal (&result, &b));
+  g_assert (gum_stack_table_lookup (table, GUM_STACK_ID_NONE, &result));
+  g_assert_cmpuint (result.len, ==, 0);
+
+  g_object_unref (table);
+}
+
 #if ENABLE_PERFORMANCE_TEST
 
 BACKTRACER_TESTCASE (performance)
@@ -19,6 +19,7 @@ TEST_LIST_BEGIN (cloak)
   CLOAK_TESTENTRY (range_clip_should_handle_top_clip)
   CLOAK_TESTENTRY (full_range_removal_should_impact_clip)
   CLOAK_TESTENTRY (partial_range_removal_should_impact_clip)
+  CLOAK_TESTENTRY (adjacent_ranges_should_be_removable_individually)
 TEST_LIST_END ()
 
 CLOAK_TESTCASE (range_clip_should_not_include_uncloaked)
@@ -219,3 +220,46 @@ CLOAK_TESTCASE (partial_range_removal_should_impact_clip)
 
   gum_free_pages (pages);
 }
+
+CLOAK_TESTCASE (adjacent_ranges_should_be_removable_individually)
+{
+  gpointer pages;
+  guint page_size;
+  GumMemoryRange first, second, full_range;
+  GArray * clipped;
+  GumMemoryRange * r;
+
+  pages = gum_alloc_n_pages (2, GUM_PAGE_RW);
+
+  page_size = gum_query_page_size ();
+
+  first.base_address = GUM_ADDRESS (pages);
+  first.size = page_size;
+  second.base_address = GUM_ADDRESS (pages) + page_size;
+  second.size = page_size;
+  gum_cloak_add_range (&second);
+  gum_cloak_add_range (&first);
+
+  full_range.base_address = GUM_ADDRESS (pages);
+  full_range.size = 2 * page_size;
+  clipped = gum_cloak_clip_range (&full_range);
+  g_assert (clipped != NULL);
+  g_assert_cmpuint (clipped->len, ==, 0);
+  g_array_free (clipped, TRUE);
+
+  gum_cloak_remove_range (&first);
+
+  clipped = gum_cloak_clip_range (&full_range);
+  g_assert (clipped != NULL);
+  g_assert_cmpuint (clipped->len, ==, 1);
+  r = &g_array_index (clipped, GumMemoryRange, 0);
+  g_assert_cmphex (r->base_address, ==, first.base_address);
+  g_assert_cmpuint (r->size, ==, page_size);
+  g_array_free (clipped, TRUE);
+
+  gum_cloak_remove_range (&second);
+
+  g_assert (gum_cloak_clip_range (&full_range) == NULL);
+
+  gum_free_pages (pages);
+}
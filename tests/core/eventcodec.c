@@ -0,0 +1,289 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#define EVENTCODEC_TESTCASE(NAME) \
+    void test_event_codec_ ## NAME (void)
+#define EVENTCODEC_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/EventCodec", test_event_codec, NAME)
+
+TEST_LIST_BEGIN (eventcodec)
+  EVENTCODEC_TESTENTRY (events_should_survive_round_trip)
+  EVENTCODEC_TESTENTRY (repeated_block_should_be_encoded_compactly)
+  EVENTCODEC_TESTENTRY (state_should_carry_across_chunks)
+  EVENTCODEC_TESTENTRY (timestamps_should_survive_round_trip)
+  EVENTCODEC_TESTENTRY (unknown_record_type_should_be_rejected)
+  EVENTCODEC_TESTENTRY (truncated_record_should_be_rejected)
+  EVENTCODEC_TESTENTRY (undefined_block_should_be_rejected)
+TEST_LIST_END ()
+
+static void assert_events_equal (const GumEvent * a, const GumEvent * b);
+static void assert_chunk_is_rejected (const guint8 * data, gsize size);
+
+EVENTCODEC_TESTCASE (events_should_survive_round_trip)
+{
+  GumEvent input[6];
+  GumEventEncoder * encoder;
+  GumEventDecoder * decoder;
+  GBytes * chunk;
+  GArray * output;
+  guint i;
+
+  memset (input, 0, sizeof (input));
+
+  input[0].type = GUM_COMPILE;
+  input[0].compile.begin = GSIZE_TO_POINTER (0x10001000);
+  input[0].compile.end = GSIZE_TO_POINTER (0x10001020);
+
+  input[1].type = GUM_BLOCK;
+  input[1].block.begin = GSIZE_TO_POINTER (0x10001000);
+  input[1].block.end = GSIZE_TO_POINTER (0x10001020);
+
+  input[2].type = GUM_EXEC;
+  input[2].exec.location = GSIZE_TO_POINTER (0x10001004);
+
+  input[3].type = GUM_CALL;
+  input[3].call.location = GSIZE_TO_POINTER (0x1000101b);
+  input[3].call.target = GSIZE_TO_POINTER (0x0fff0000);
+  input[3].call.depth = 3;
+
+  input[4].type = GUM_RET;
+  input[4].ret.location = GSIZE_TO_POINTER (0x0fff0010);
+  input[4].ret.target = GSIZE_TO_POINTER (0x10001020);
+  input[4].ret.depth = 4;
+
+  input[5].type = GUM_BLOCK;
+  input[5].block.begin = GSIZE_TO_POINTER (0x10001000);
+  input[5].block.end = GSIZE_TO_POINTER (0x10001010);
+
+  encoder = gum_event_encoder_new ();
+  for (i = 0; i != G_N_ELEMENTS (input); i++)
+    gum_event_encoder_encode (encoder, &input[i]);
+  chunk = gum_event_encoder_flush (encoder);
+  g_assert_cmpuint (gum_event_encoder_get_pending_size (encoder), ==, 0);
+  gum_event_encoder_free (encoder);
+
+  g_assert_cmpuint (g_bytes_get_size (chunk), <, sizeof (input) / 2);
+
+  output = g_array_new (FALSE, TRUE, sizeof (GumEvent));
+  decoder = gum_event_decoder_new ();
+  g_assert_true (gum_event_decoder_decode (decoder, chunk, output, NULL));
+  g_assert_cmpuint (output->len, ==, G_N_ELEMENTS (input));
+  gum_event_decoder_free (decoder);
+
+  for (i = 0; i != G_N_ELEMENTS (input); i++)
+    assert_events_equal (&g_array_index (output, GumEvent, i), &input[i]);
+
+  g_array_free (output, TRUE);
+  g_bytes_unref (chunk);
+}
+
+EVENTCODEC_TESTCASE (repeated_block_should_be_encoded_compactly)
+{
+  GumEvent ev = { 0, };
+  GumEventEncoder * encoder;
+  gsize first_size, second_size;
+
+  ev.type = GUM_BLOCK;
+  ev.block.begin = GSIZE_TO_POINTER (0x12345000);
+  ev.block.end = GSIZE_TO_POINTER (0x12345040);
+
+  encoder = gum_event_encoder_new ();
+
+  gum_event_encoder_encode (encoder, &ev);
+  first_size = gum_event_encoder_get_pending_size (encoder);
+
+  gum_event_encoder_encode (encoder, &ev);
+  second_size = gum_event_encoder_get_pending_size (encoder) - first_size;
+
+  g_assert_cmpuint (second_size, ==, 2);
+  g_assert_cmpuint (second_size, <, first_size);
+
+  gum_event_encoder_free (encoder);
+}
+
+EVENTCODEC_TESTCASE (state_should_carry_across_chunks)
+{
+  GumEvent ev = { 0, };
+  GumEventEncoder * encoder;
+  GumEventDecoder * decoder;
+  GBytes * first, * second;
+  GArray * output;
+
+  ev.type = GUM_BLOCK;
+  ev.block.begin = GSIZE_TO_POINTER (0x20000);
+  ev.block.end = GSIZE_TO_POINTER (0x20010);
+
+  encoder = gum_event_encoder_new ();
+  gum_event_encoder_encode (encoder, &ev);
+  first = gum_event_encoder_flush (encoder);
+  gum_event_encoder_encode (encoder, &ev);
+  second = gum_event_encoder_flush (encoder);
+  gum_event_encoder_free (encoder);
+
+  output = g_array_new (FALSE, TRUE, sizeof (GumEvent));
+  decoder = gum_event_decoder_new ();
+  g_assert_true (gum_event_decoder_decode (decoder, first, output, NULL));
+  g_assert_true (gum_event_decoder_decode (decoder, second, output, NULL));
+  g_assert_cmpuint (output->len, ==, 2);
+  gum_event_decoder_free (decoder);
+
+  assert_events_equal (&g_array_index (output, GumEvent, 1), &ev);
+
+  g_array_free (output, TRUE);
+  g_bytes_unref (second);
+  g_bytes_unref (first);
+}
+
+EVENTCODEC_TESTCASE (timestamps_should_survive_round_trip)
+{
+  GumEvent input[3];
+  GumEventEncoder * encoder;
+  GumEventDecoder * decoder;
+  GBytes * chunk;
+  GArray * output;
+  guint i;
+
+  memset (input, 0, sizeof (input));
+
+  input[0].type = GUM_EXEC;
+  input[0].exec.location = GSIZE_TO_POINTER (0x30000);
+  input[0].exec.timestamp = G_GUINT64_CONSTANT (0x123456789a);
+
+  input[1].type = GUM_EXEC;
+  input[1].exec.location = GSIZE_TO_POINTER (0x30004);
+
+  input[2].type = GUM_CALL;
+  input[2].call.location = GSIZE_TO_POINTER (0x30008);
+  input[2].call.target = GSIZE_TO_POINTER (0x40000);
+  input[2].call.timestamp = G_GUINT64_CONSTANT (0x12345678f0);
+
+  encoder = gum_event_encoder_new ();
+  for (i = 0; i != G_N_ELEMENTS (input); i++)
+    gum_event_encoder_encode (encoder, &input[i]);
+  chunk = gum_event_encoder_flush (encoder);
+  gum_event_encoder_free (encoder);
+
+  output = g_array_new (FALSE, TRUE, sizeof (GumEvent));
+  decoder = gum_event_decoder_new ();
+  g_assert_true (gum_event_decoder_decode (decoder, chunk, output, NULL));
+  g_assert_cmpuint (output->len, ==, G_N_ELEMENTS (input));
+  gum_event_decoder_free (decoder);
+
+  for (i = 0; i != G_N_ELEMENTS (input); i++)
+    assert_events_equal (&g_array_index (output, GumEvent, i), &input[i]);
+
+  g_array_free (output, TRUE);
+  g_bytes_unref (chunk);
+}
+
+EVENTCODEC_TESTCASE (unknown_record_type_should_be_rejected)
+{
+  const guint8 data[] = { 0x7f, 0x00 };
+
+  assert_chunk_is_rejected (data, sizeof (data));
+}
+
+EVENTCODEC_TESTCASE (truncated_record_should_be_rejected)
+{
+  GumEvent ev = { 0, };
+  GumEventEncoder * encoder;
+  GBytes * chunk;
+  const guint8 * data;
+  gsize size, i;
+
+  ev.type = GUM_CALL;
+  ev.call.location = GSIZE_TO_POINTER (0x50000);
+  ev.call.target = GSIZE_TO_POINTER (0x7fff0000);
+  ev.call.depth = 200;
+  ev.call.timestamp = G_GUINT64_CONSTANT (0x123456789a);
+
+  encoder = gum_event_encoder_new ();
+  gum_event_encoder_encode (encoder, &ev);
+  chunk = gum_event_encoder_flush (encoder);
+  gum_event_encoder_free (encoder);
+
+  data = g_bytes_get_data (chunk, &size);
+  for (i = 1; i != size; i++)
+    assert_chunk_is_rejected (data, i);
+
+  g_bytes_unref (chunk);
+}
+
+EVENTCODEC_TESTCASE (undefined_block_should_be_rejected)
+{
+  const guint8 data[] = { 0x04, 0x05 };
+
+  assert_chunk_is_rejected (data, sizeof (data));
+}
+
+static void
+assert_chunk_is_rejected (const guint8 * data,
+                          gsize size)
+{
+  GumEventDecoder * decoder;
+  GBytes * chunk;
+  GArray * output;
+  GumEvent ev = { 0, };
+  GError * error = NULL;
+
+  chunk = g_bytes_new (data, size);
+  output = g_array_new (FALSE, TRUE, sizeof (GumEvent));
+  g_array_append_val (output, ev);
+  decoder = gum_event_decoder_new ();
+
+  g_assert_false (gum_event_decoder_decode (decoder, chunk, output, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_assert_cmpuint (output->len, ==, 1);
+
+  g_error_free (error);
+  gum_event_decoder_free (decoder);
+  g_array_free (output, TRUE);
+  g_bytes_unref (chunk);
+}
+
+static void
+assert_events_equal (const GumEvent * a,
+                     const GumEvent * b)
+{
+  g_assert_cmpint (a->type, ==, b->type);
+
+  switch (a->type)
+  {
+    case GUM_CALL:
+      GUM_ASSERT_CMPADDR (a->call.location, ==, b->call.location);
+      GUM_ASSERT_CMPADDR (a->call.target, ==, b->call.target);
+      g_assert_cmpint (a->call.depth, ==, b->call.depth);
+      g_assert_cmpuint (a->call.timestamp, ==, b->call.timestamp);
+      break;
+    case GUM_RET:
+      GUM_ASSERT_CMPADDR (a->ret.location, ==, b->ret.location);
+      GUM_ASSERT_CMPADDR (a->ret.target, ==, b->ret.target);
+      g_assert_cmpint (a->ret.depth, ==, b->ret.depth);
+      g_assert_cmpuint (a->ret.timestamp, ==, b->ret.timestamp);
+      break;
+    case GUM_EXEC:
+      GUM_ASSERT_CMPADDR (a->exec.location, ==, b->exec.location);
+      g_assert_cmpuint (a->exec.timestamp, ==, b->exec.timestamp);
+      break;
+    case GUM_BLOCK:
+      GUM_ASSERT_CMPADDR (a->block.begin, ==, b->block.begin);
+      GUM_ASSERT_CMPADDR (a->block.end, ==, b->block.end);
+      g_assert_cmpuint (a->block.timestamp, ==, b->block.timestamp);
+      break;
+    case GUM_COMPILE:
+      GUM_ASSERT_CMPADDR (a->compile.begin, ==, b->compile.begin);
+      GUM_ASSERT_CMPADDR (a->compile.end, ==, b->compile.end);
+      g_assert_cmpuint (a->compile.timestamp, ==, b->compile.timestamp);
+      break;
+    default:
+      g_assert_not_reached ();
+  }
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include <string.h>
+
+#define EXCEPTOR_TESTCASE(NAME) \
+    void test_exceptor_ ## NAME (void)
+#define EXCEPTOR_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/Exceptor", test_exceptor, NAME)
+
+TEST_LIST_BEGIN (exceptor)
+  EXCEPTOR_TESTENTRY (try_read_should_copy_readable_memory)
+  EXCEPTOR_TESTENTRY (try_read_should_fail_on_inaccessible_memory)
+  EXCEPTOR_TESTENTRY (try_read_in_scope_should_copy_readable_memory)
+  EXCEPTOR_TESTENTRY (try_read_in_scope_should_fail_on_inaccessible_memory)
+TEST_LIST_END ()
+
+typedef gboolean (* TryReadFunc) (GumExceptor * self, gconstpointer address,
+    guint size, gpointer value);
+
+static void assert_readable_memory_is_copied (TryReadFunc try_read);
+static void assert_inaccessible_memory_is_not_read (TryReadFunc try_read);
+
+static const guint sizes[] = { 1, 2, 4, 8 };
+
+EXCEPTOR_TESTCASE (try_read_should_copy_readable_memory)
+{
+  assert_readable_memory_is_copied (gum_exceptor_try_read);
+}
+
+EXCEPTOR_TESTCASE (try_read_should_fail_on_inaccessible_memory)
+{
+  assert_inaccessible_memory_is_not_read (gum_exceptor_try_read);
+}
+
+EXCEPTOR_TESTCASE (try_read_in_scope_should_copy_readable_memory)
+{
+  assert_readable_memory_is_copied (_gum_exceptor_try_read_in_scope);
+}
+
+EXCEPTOR_TESTCASE (try_read_in_scope_should_fail_on_inaccessible_memory)
+{
+  assert_inaccessible_memory_is_not_read (_gum_exceptor_try_read_in_scope);
+}
+
+static void
+assert_readable_memory_is_copied (TryReadFunc try_read)
+{
+  GumExceptor * exceptor;
+  const guint8 data[8] = { 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88 };
+  guint i;
+
+  exceptor = gum_exceptor_obtain ();
+
+  for (i = 0; i != G_N_ELEMENTS (sizes); i++)
+  {
+    guint8 value[8];
+
+    memset (value, 0, sizeof (value));
+    g_assert_true (try_read (exceptor, data, sizes[i], value));
+    g_assert_cmpint (memcmp (value, data, sizes[i]), ==, 0);
+    if (sizes[i] != sizeof (value))
+      g_assert_cmpuint (value[sizes[i]], ==, 0);
+  }
+
+  g_object_unref (exceptor);
+}
+
+static void
+assert_inaccessible_memory_is_not_read (TryReadFunc try_read)
+{
+  GumExceptor * exceptor;
+  gpointer page;
+  guint i;
+  gsize readable = 42, copy;
+
+  exceptor = gum_exceptor_obtain ();
+  page = gum_alloc_n_pages (1, GUM_PAGE_NO_ACCESS);
+
+  for (i = 0; i != G_N_ELEMENTS (sizes); i++)
+  {
+    guint8 value[8];
+
+    g_assert_false (try_read (exceptor, page, sizes[i], value));
+  }
+
+  /* A fault must not break the reads that follow it */
+  g_assert_true (try_read (exceptor, &readable, sizeof (readable), &copy));
+  g_assert_cmpuint (copy, ==, 42);
+
+  gum_free_pages (page);
+  g_object_unref (exceptor);
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FORK_TESTCASE(NAME) \
+    void test_fork_ ## NAME (void)
+#define FORK_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/Fork", test_fork, NAME)
+
+TEST_LIST_BEGIN (fork)
+  FORK_TESTENTRY (locks_taken_by_other_threads_should_not_reach_child)
+TEST_LIST_END ()
+
+#define FORK_ROUNDS 50
+
+typedef struct _TransactionChurnContext TransactionChurnContext;
+
+struct _TransactionChurnContext
+{
+  GumInterceptor * interceptor;
+  volatile gint stop;
+};
+
+static gpointer churn_transactions (gpointer data);
+static void use_locks_in_child (void);
+
+FORK_TESTCASE (locks_taken_by_other_threads_should_not_reach_child)
+{
+  TransactionChurnContext ctx;
+  GThread * thread;
+  guint i;
+
+  ctx.interceptor = gum_interceptor_obtain ();
+  ctx.stop = FALSE;
+
+  /* Keeps taking the Interceptor lock, so forks are likely to land on it */
+  thread = g_thread_new ("fork-test-churn", churn_transactions, &ctx);
+
+  for (i = 0; i != FORK_ROUNDS; i++)
+  {
+    pid_t pid;
+    int status;
+
+    gum_prepare_to_fork ();
+    pid = fork ();
+    g_assert_cmpint (pid, !=, -1);
+
+    if (pid == 0)
+    {
+      gum_recover_from_fork_in_child ();
+      use_locks_in_child ();
+      _exit (0);
+    }
+
+    gum_recover_from_fork_in_parent ();
+
+    g_assert_cmpint (waitpid (pid, &status, 0), ==, pid);
+    g_assert_true (WIFEXITED (status));
+    g_assert_cmpint (WEXITSTATUS (status), ==, 0);
+  }
+
+  g_atomic_int_set (&ctx.stop, TRUE);
+  g_thread_join (thread);
+
+  g_object_unref (ctx.interceptor);
+}
+
+static gpointer
+churn_transactions (gpointer data)
+{
+  TransactionChurnContext * ctx = data;
+
+  while (!g_atomic_int_get (&ctx->stop))
+  {
+    gum_interceptor_begin_transaction (ctx->interceptor);
+    gum_interceptor_end_transaction (ctx->interceptor);
+  }
+
+  return NULL;
+}
+
+static void
+use_locks_in_child (void)
+{
+  GumInterceptor * interceptor;
+  GumStalker * stalker;
+
+  /* Die rather than hang if a lock did make it across */
+  signal (SIGALRM, SIG_DFL);
+  alarm (10);
+
+  interceptor = gum_interceptor_obtain ();
+  gum_interceptor_begin_transaction (interceptor);
+  gum_interceptor_end_transaction (interceptor);
+  g_object_unref (interceptor);
+
+  stalker = gum_stalker_new ();
+  g_object_unref (stalker);
+}
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include "interceptor-callbacklistener.c"
+
+#ifndef G_OS_WIN32
+# include <unistd.h>
+# define TEST_IMPORT_NAME "getpid"
+# define test_get_process_id() ((guint) getpid ())
+#else
+# include <windows.h>
+# define TEST_IMPORT_NAME "GetCurrentProcessId"
+# define test_get_process_id() ((guint) GetCurrentProcessId ())
+#endif
+
+#define IMPORTHOOKER_TESTCASE(NAME) \
+    void test_import_hooker_ ## NAME (void)
+#define IMPORTHOOKER_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/ImportHooker", test_import_hooker, NAME)
+
+TEST_LIST_BEGIN (importhooker)
+  IMPORTHOOKER_TESTENTRY (replace_and_revert)
+  IMPORTHOOKER_TESTENTRY (attach_listener)
+TEST_LIST_END ()
+
+#ifndef G_OS_WIN32
+static pid_t replacement_get_process_id (void);
+#else
+static DWORD WINAPI replacement_get_process_id (void);
+#endif
+static void count_on_enter (gpointer user_data,
+    GumInvocationContext * context);
+
+IMPORTHOOKER_TESTCASE (replace_and_revert)
+{
+#ifndef HAVE_QNX
+  GumImportHooker * hooker;
+  guint real_id, n;
+  gpointer original = NULL;
+
+  real_id = test_get_process_id ();
+
+  hooker = gum_import_hooker_new ();
+
+  n = gum_import_hooker_replace (hooker, GUM_TESTS_MODULE_NAME,
+      TEST_IMPORT_NAME, replacement_get_process_id, &original);
+  g_assert_cmpuint (n, >=, 1);
+  g_assert (original != NULL);
+  g_assert_cmpuint (test_get_process_id (), ==, 1337);
+
+  n = gum_import_hooker_replace (hooker, GUM_TESTS_MODULE_NAME,
+      TEST_IMPORT_NAME, replacement_get_process_id, NULL);
+  g_assert_cmpuint (n, ==, 0);
+
+  gum_import_hooker_revert (hooker, GUM_TESTS_MODULE_NAME, TEST_IMPORT_NAME);
+  g_assert_cmpuint (test_get_process_id (), ==, real_id);
+
+  gum_import_hooker_replace (hooker, GUM_TESTS_MODULE_NAME,
+      TEST_IMPORT_NAME, replacement_get_process_id, NULL);
+  g_object_unref (hooker);
+  g_assert_cmpuint (test_get_process_id (), ==, real_id);
+#endif
+}
+
+IMPORTHOOKER_TESTCASE (attach_listener)
+{
+#ifndef HAVE_QNX
+  GumInterceptor * interceptor;
+  GumImportHooker * hooker;
+  TestCallbackListener * listener;
+  guint real_id, n, counter = 0, counter_after_call;
+
+  real_id = test_get_process_id ();
+
+  interceptor = gum_interceptor_obtain ();
+  hooker = gum_import_hooker_new ();
+  listener = test_callback_listener_new ();
+  listener->on_enter = count_on_enter;
+  listener->user_data = &counter;
+
+  n = gum_import_hooker_attach_listener (hooker, GUM_TESTS_MODULE_NAME,
+      TEST_IMPORT_NAME, GUM_INVOCATION_LISTENER (listener), NULL);
+  g_assert_cmpuint (n, >=, 1);
+
+  g_assert_cmpuint (test_get_process_id (), ==, real_id);
+  g_assert_cmpuint (counter, >=, 1);
+  counter_after_call = counter;
+
+  gum_import_hooker_revert (hooker, NULL, NULL);
+  g_assert_cmpuint (test_get_process_id (), ==, real_id);
+  g_assert_cmpuint (counter, ==, counter_after_call);
+
+  gum_interceptor_detach_listener (interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  g_object_unref (listener);
+  g_object_unref (hooker);
+  g_object_unref (interceptor);
+#endif
+}
+
+#ifndef G_OS_WIN32
+
+static pid_t
+replacement_get_process_id (void)
+{
+  return 1337;
+}
+
+#else
+
+static DWORD WINAPI
+replacement_get_process_id (void)
+{
+  return 1337;
+}
+
+#endif
+
+static void
+count_on_enter (gpointer user_data,
+                GumInvocationContext * context)
+{
+  guint * counter = user_data;
+
+  (*counter)++;
+}
@@ -48,9 +48,17 @@ TEST_LIST_BEGIN (interceptor)
   INTERCEPTOR_TESTENTRY (ignore_current_thread)
   INTERCEPTOR_TESTENTRY (ignore_current_thread_nested)
   INTERCEPTOR_TESTENTRY (ignore_other_threads)
+  INTERCEPTOR_TESTENTRY (listener_threads)
   INTERCEPTOR_TESTENTRY (detach)
   INTERCEPTOR_TESTENTRY (listener_ref_count)
   INTERCEPTOR_TESTENTRY (function_data)
+  INTERCEPTOR_TESTENTRY (attach_probe)
+  INTERCEPTOR_TESTENTRY (attach_probe_and_listener)
+  INTERCEPTOR_TESTENTRY (attach_capture)
+  INTERCEPTOR_TESTENTRY (attach_capture_with_return)
+  INTERCEPTOR_TESTENTRY (attach_many)
+  INTERCEPTOR_TESTENTRY (deferred_listener)
+  INTERCEPTOR_TESTENTRY (statistics)
 
   INTERCEPTOR_TESTENTRY (i_can_has_replaceability)
   INTERCEPTOR_TESTENTRY (already_replaced)
@@ -59,6 +67,9 @@ TEST_LIST_BEGIN (interceptor)
   INTERCEPTOR_TESTENTRY (two_replaced_functions)
 # endif
   INTERCEPTOR_TESTENTRY (replace_function_then_attach_to_it)
+#ifndef HAVE_ARM
+  INTERCEPTOR_TESTENTRY (replace_function_fast)
+#endif
 
 #ifdef HAVE_QNX
   INTERCEPTOR_TESTENTRY (intercept_malloc_and_create_thread)
@@ -74,6 +85,14 @@ static gpointer hit_target_function_repeatedly (gpointer data);
 #endif
 static gpointer replacement_malloc (gsize size);
 static gpointer replacement_target_function (GString * str);
+#ifndef HAVE_ARM
+static gpointer replacement_target_function_fast (GString * str);
+#endif
+static void count_listener_enter (guint * counter,
+    GumInvocationContext * context);
+static void collect_deferred_invocations (
+    const GumDeferredInvocation * invocations, guint n_invocations,
+    GArray * collected);
 
 INTERCEPTOR_TESTCASE (attach_one)
 {
@@ -332,6 +351,43 @@ INTERCEPTOR_TESTCASE (ignore_other_threads)
   g_assert_cmpstr (fixture->result->str, ==, ">|<|>|<");
 }
 
+INTERCEPTOR_TESTCASE (listener_threads)
+{
+  GumInvocationListener * listener;
+  GumThreadId current_thread_id;
+
+  current_thread_id = gum_process_get_current_thread_id ();
+
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+  listener = GUM_INVOCATION_LISTENER (fixture->listener_context[0]);
+
+  gum_interceptor_set_listener_threads (fixture->interceptor, listener,
+      &current_thread_id, 1);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<");
+
+  g_thread_join (g_thread_new ("interceptor-test-listener-threads-a",
+      (GThreadFunc) target_function, fixture->result));
+  g_assert_cmpstr (fixture->result->str, ==, ">|<|");
+
+  gum_interceptor_remove_listener_thread (fixture->interceptor, listener,
+      current_thread_id);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<||");
+
+  gum_interceptor_add_listener_thread (fixture->interceptor, listener,
+      current_thread_id);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<||>|<");
+
+  gum_interceptor_set_listener_threads (fixture->interceptor, listener,
+      NULL, 0);
+  g_thread_join (g_thread_new ("interceptor-test-listener-threads-b",
+      (GThreadFunc) target_function, fixture->result));
+  g_assert_cmpstr (fixture->result->str, ==, ">|<||>|<>|<");
+}
+
 INTERCEPTOR_TESTCASE (detach)
 {
   interceptor_fixture_attach_listener (fixture, 0, target_function, 'a', 'b');
@@ -687,6 +743,277 @@ replacement_target_function (GString * str)
   return result;
 }
 
+#ifndef HAVE_ARM
+
+static gpointer (* original_target_function) (GString * str) = NULL;
+
+INTERCEPTOR_TESTCASE (replace_function_fast)
+{
+  g_assert_cmpint (gum_interceptor_replace_function_fast (
+      fixture->interceptor, target_function, replacement_target_function_fast,
+      (gpointer *) &original_target_function), ==, GUM_REPLACE_OK);
+  g_assert_cmpint (gum_interceptor_replace_function_fast (
+      fixture->interceptor, target_function, replacement_target_function_fast,
+      NULL), ==, GUM_REPLACE_ALREADY_REPLACED);
+  g_assert_cmpint (interceptor_fixture_try_attaching_listener (fixture, 0,
+      target_function, '>', '<'), ==, GUM_ATTACH_WRONG_SIGNATURE);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\");
+
+  gum_interceptor_revert_function (fixture->interceptor, target_function);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "/|\\|");
+}
+
+static gpointer
+replacement_target_function_fast (GString * str)
+{
+  gpointer result;
+
+  g_string_append_c (str, '/');
+  result = original_target_function (str);
+  g_string_append_c (str, '\\');
+
+  return result;
+}
+
+#endif
+
+static void count_probe_hit (GumCpuContext * cpu_context, gpointer user_data);
+
+INTERCEPTOR_TESTCASE (attach_probe)
+{
+  guint counter = 0;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, count_probe_hit, &counter), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, count_probe_hit, &counter), ==,
+      GUM_ATTACH_ALREADY_ATTACHED);
+
+  target_function (fixture->result);
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "||");
+  g_assert_cmpuint (counter, ==, 2);
+
+  gum_interceptor_detach_probe (fixture->interceptor, target_function);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, "|||");
+  g_assert_cmpuint (counter, ==, 2);
+}
+
+INTERCEPTOR_TESTCASE (attach_probe_and_listener)
+{
+  guint counter = 0;
+
+  g_assert_cmpint (gum_interceptor_attach_probe (fixture->interceptor,
+      target_function, count_probe_hit, &counter), ==, GUM_ATTACH_OK);
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<");
+  g_assert_cmpuint (counter, ==, 1);
+
+  interceptor_fixture_detach_listener (fixture, 0);
+
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<|");
+  g_assert_cmpuint (counter, ==, 2);
+
+  gum_interceptor_detach_probe (fixture->interceptor, target_function);
+}
+
+INTERCEPTOR_TESTCASE (attach_capture)
+{
+  GumCapturedCall calls[4];
+
+  while (gum_interceptor_drain_captures (fixture->interceptor, calls,
+      G_N_ELEMENTS (calls)) != 0)
+    ;
+
+  g_assert_cmpint (gum_interceptor_attach_capture (fixture->interceptor,
+      target_nop_function_a, 1, FALSE), ==, GUM_ATTACH_OK);
+  g_assert_cmpint (gum_interceptor_attach_capture (fixture->interceptor,
+      target_nop_function_a, 1, FALSE), ==, GUM_ATTACH_ALREADY_ATTACHED);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x1234));
+  target_nop_function_a (GSIZE_TO_POINTER (0x5678));
+
+  gum_interceptor_detach_capture (fixture->interceptor, target_nop_function_a);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x9abc));
+
+  g_assert_cmpuint (gum_interceptor_drain_captures (fixture->interceptor,
+      calls, G_N_ELEMENTS (calls)), ==, 2);
+  GUM_ASSERT_CMPADDR (calls[0].function, ==, target_nop_function_a);
+  g_assert_cmpuint (calls[0].thread_id, ==,
+      gum_process_get_current_thread_id ());
+  g_assert_cmpuint (calls[0].n_args, ==, 1);
+  g_assert (!calls[0].has_return_value);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (calls[0].args[0]), ==, 0x1234);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (calls[1].args[0]), ==, 0x5678);
+  g_assert_cmpuint (calls[1].timestamp, >=, calls[0].timestamp);
+
+  g_assert_cmpuint (gum_interceptor_drain_captures (fixture->interceptor,
+      calls, G_N_ELEMENTS (calls)), ==, 0);
+}
+
+INTERCEPTOR_TESTCASE (attach_capture_with_return)
+{
+  GumCapturedCall calls[4];
+
+  while (gum_interceptor_drain_captures (fixture->interceptor, calls,
+      G_N_ELEMENTS (calls)) != 0)
+    ;
+
+  g_assert_cmpint (gum_interceptor_attach_capture (fixture->interceptor,
+      target_nop_function_a, 1, TRUE), ==, GUM_ATTACH_OK);
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x1234));
+  target_function (fixture->result);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<");
+
+  gum_interceptor_detach_capture (fixture->interceptor, target_nop_function_a);
+
+  g_assert_cmpuint (gum_interceptor_drain_captures (fixture->interceptor,
+      calls, G_N_ELEMENTS (calls)), ==, 1);
+  GUM_ASSERT_CMPADDR (calls[0].function, ==, target_nop_function_a);
+  g_assert_cmpuint (calls[0].n_args, ==, 1);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (calls[0].args[0]), ==, 0x1234);
+  g_assert (calls[0].has_return_value);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (calls[0].return_value), ==, 0x1337);
+  g_assert_cmpuint (gum_interceptor_get_dropped_capture_count (
+      fixture->interceptor), ==, 0);
+}
+
+INTERCEPTOR_TESTCASE (attach_many)
+{
+  TestCallbackListener * listener;
+  guint counter = 0;
+  gpointer functions[3];
+  GumAttachReturn results[3];
+
+  listener = test_callback_listener_new ();
+  listener->on_enter = (TestCallbackListenerFunc) count_listener_enter;
+  listener->user_data = &counter;
+
+  functions[0] = target_nop_function_a;
+  functions[1] = target_nop_function_b;
+  functions[2] = target_nop_function_a;
+
+  g_assert_cmpuint (gum_interceptor_attach_many (fixture->interceptor,
+      functions, G_N_ELEMENTS (functions), GUM_INVOCATION_LISTENER (listener),
+      NULL, results), ==, 2);
+  g_assert_cmpint (results[0], ==, GUM_ATTACH_OK);
+  g_assert_cmpint (results[1], ==, GUM_ATTACH_OK);
+  g_assert_cmpint (results[2], ==, GUM_ATTACH_ALREADY_ATTACHED);
+
+  target_nop_function_a (NULL);
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (counter, ==, 2);
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+
+  target_nop_function_a (NULL);
+  target_nop_function_b (NULL);
+  g_assert_cmpuint (counter, ==, 2);
+
+  g_object_unref (listener);
+}
+
+static void
+count_listener_enter (guint * counter,
+                      GumInvocationContext * context)
+{
+  (*counter)++;
+}
+
+INTERCEPTOR_TESTCASE (deferred_listener)
+{
+  GArray * collected;
+  GumDeferredListener * listener;
+  GumDeferredInvocation * invocation;
+
+  collected = g_array_new (FALSE, FALSE, sizeof (GumDeferredInvocation));
+  listener = gum_deferred_listener_new (1,
+      (GumDeferredInvocationFunc) collect_deferred_invocations, collected,
+      NULL);
+
+  g_assert_cmpint (gum_interceptor_attach_listener (fixture->interceptor,
+      target_nop_function_a, GUM_INVOCATION_LISTENER (listener),
+      GSIZE_TO_POINTER (42)), ==, GUM_ATTACH_OK);
+
+  target_nop_function_a (GSIZE_TO_POINTER (0x1234));
+  target_nop_function_a (GSIZE_TO_POINTER (0x5678));
+
+  gum_interceptor_detach_listener (fixture->interceptor,
+      GUM_INVOCATION_LISTENER (listener));
+  gum_deferred_listener_flush (listener);
+
+  g_assert_cmpuint (collected->len, ==, 2);
+  invocation = &g_array_index (collected, GumDeferredInvocation, 0);
+  GUM_ASSERT_CMPADDR (invocation->function, ==, target_nop_function_a);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (invocation->function_data), ==, 42);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (invocation->args[0]), ==, 0x1234);
+  g_assert_cmpuint (invocation->thread_id, ==,
+      gum_process_get_current_thread_id ());
+  g_assert_cmpint (invocation->duration, >=, 0);
+  invocation = &g_array_index (collected, GumDeferredInvocation, 1);
+  g_assert_cmpuint (GPOINTER_TO_SIZE (invocation->args[0]), ==, 0x5678);
+  g_assert_cmpuint (gum_deferred_listener_get_dropped_count (listener), ==, 0);
+
+  g_object_unref (listener);
+  g_array_free (collected, TRUE);
+}
+
+static void
+collect_deferred_invocations (const GumDeferredInvocation * invocations,
+                              guint n_invocations,
+                              GArray * collected)
+{
+  g_array_append_vals (collected, invocations, n_invocations);
+}
+
+INTERCEPTOR_TESTCASE (statistics)
+{
+  GArray * statistics;
+  GumFunctionStatistics * stats;
+
+  gum_interceptor_set_statistics_enabled (fixture->interceptor, TRUE);
+
+  interceptor_fixture_attach_listener (fixture, 0, target_function, '>', '<');
+
+  target_function (fixture->result);
+  target_function (fixture->result);
+  gum_interceptor_ignore_current_thread (fixture->interceptor);
+  target_function (fixture->result);
+  gum_interceptor_unignore_current_thread (fixture->interceptor);
+  g_assert_cmpstr (fixture->result->str, ==, ">|<>|<|");
+
+  statistics = gum_interceptor_get_statistics (fixture->interceptor);
+  g_assert_cmpuint (statistics->len, ==, 1);
+  stats = &g_array_index (statistics, GumFunctionStatistics, 0);
+  GUM_ASSERT_CMPADDR (stats->function_address, ==, target_function);
+  g_assert_cmpuint (stats->calls, ==, 3);
+  g_assert_cmpuint (stats->bypassed_calls, ==, 1);
+  g_array_free (statistics, TRUE);
+
+  gum_interceptor_set_statistics_enabled (fixture->interceptor, FALSE);
+}
+
+static void
+count_probe_hit (GumCpuContext * cpu_context,
+                 gpointer user_data)
+{
+  guint * counter = user_data;
+
+  (*counter)++;
+}
+
 INTERCEPTOR_TESTCASE (i_can_has_replaceability)
 {
   UnsupportedFunction * unsupported_functions;
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include <string.h>
+
+#define LOG_TESTCASE(NAME) \
+    void test_log_ ## NAME (void)
+#define LOG_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/Log", test_log, NAME)
+
+TEST_LIST_BEGIN (log)
+  LOG_TESTENTRY (records_should_reach_sink_on_flush)
+  LOG_TESTENTRY (records_from_other_threads_should_be_kept_whole)
+TEST_LIST_END ()
+
+static gpointer log_from_other_thread (gpointer data);
+static void append_to_string (const gchar * data, gsize size,
+    gpointer user_data);
+
+LOG_TESTCASE (records_should_reach_sink_on_flush)
+{
+  GString * output;
+
+  gum_log_flush ();
+
+  output = g_string_new ("");
+  gum_log_set_sink (append_to_string, output, NULL);
+
+  gum_log_printf ("%s=%d\n", "answer", 42);
+  gum_log_write ("done\n", 5);
+  gum_log_flush ();
+
+  g_assert_cmpstr (output->str, ==, "answer=42\ndone\n");
+
+  gum_log_set_sink (NULL, NULL, NULL);
+  g_string_free (output, TRUE);
+}
+
+LOG_TESTCASE (records_from_other_threads_should_be_kept_whole)
+{
+  GString * output;
+  GThread * thread;
+
+  gum_log_flush ();
+
+  output = g_string_new ("");
+  gum_log_set_sink (append_to_string, output, NULL);
+
+  gum_log_write ("main\n", 5);
+  thread = g_thread_new ("log-test-other", log_from_other_thread, NULL);
+  g_thread_join (thread);
+  gum_log_flush ();
+
+  g_assert_cmpuint (output->len, ==, 11);
+  g_assert (strstr (output->str, "main\n") != NULL);
+  g_assert (strstr (output->str, "other\n") != NULL);
+
+  gum_log_set_sink (NULL, NULL, NULL);
+  g_string_free (output, TRUE);
+}
+
+static gpointer
+log_from_other_thread (gpointer data)
+{
+  gum_log_printf ("%s\n", "other");
+
+  return NULL;
+}
+
+static void
+append_to_string (const gchar * data,
+                  gsize size,
+                  gpointer user_data)
+{
+  GString * output = user_data;
+
+  g_string_append_len (output, data, size);
+}
@@ -7,6 +7,9 @@
 #include "testutil.h"
 
 #include "gummemory-priv.h"
+#include "valgrind.h"
+
+#include <string.h>
 
 #define MEMORY_TESTCASE(NAME) \
     void test_memory_ ## NAME (void)
@@ -25,10 +28,19 @@ TEST_LIST_BEGIN (memory)
   MEMORY_TESTENTRY (scan_range_finds_three_exact_matches)
   MEMORY_TESTENTRY (scan_range_finds_three_wildcarded_matches)
   MEMORY_TESTENTRY (scan_range_finds_three_masked_matches)
+  MEMORY_TESTENTRY (scan_range_finds_match_at_end_of_range)
+  MEMORY_TESTENTRY (scan_range_finds_multiple_patterns_in_one_pass)
+  MEMORY_TESTENTRY (parallel_scan_reports_matches_in_order)
+  MEMORY_TESTENTRY (parallel_scan_can_skip_unreadable_pages)
   MEMORY_TESTENTRY (is_memory_readable_handles_mixed_page_protections)
   MEMORY_TESTENTRY (alloc_n_pages_returns_aligned_rw_address)
   MEMORY_TESTENTRY (alloc_n_pages_near_returns_aligned_rw_address_within_range)
   MEMORY_TESTENTRY (mprotect_handles_page_boundaries)
+  MEMORY_TESTENTRY (patch_code_many_applies_scattered_patches)
+  MEMORY_TESTENTRY (snapshot_restores_only_modified_pages)
+  MEMORY_TESTENTRY (heap_cache_reuses_freed_chunks)
+  MEMORY_TESTENTRY (heap_cache_passes_large_chunks_through)
+  MEMORY_TESTENTRY (heap_cache_is_flushed_on_thread_exit)
 TEST_LIST_END ()
 
 typedef struct _TestForEachContext {
@@ -39,8 +51,19 @@ typedef struct _TestForEachContext {
   guint expected_size;
 } TestForEachContext;
 
+typedef struct _TestScanMultiContext {
+  guint number_of_calls;
+
+  gpointer expected_address[3];
+  guint expected_pattern_index[3];
+} TestScanMultiContext;
+
 static gboolean match_found_cb (GumAddress address, gsize size,
     gpointer user_data);
+static gboolean multi_match_found_cb (GumAddress address, gsize size,
+    guint pattern_index, gpointer user_data);
+static void store_two_bytes (gpointer mem, gpointer user_data);
+static gpointer churn_small_chunks (gpointer data);
 
 MEMORY_TESTCASE (read_from_valid_address_should_succeed)
 {
@@ -377,6 +400,166 @@ MEMORY_TESTCASE (scan_range_finds_three_masked_matches)
   gum_match_pattern_free (pattern);
 }
 
+MEMORY_TESTCASE (scan_range_finds_match_at_end_of_range)
+{
+  guint8 buf[64];
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  TestForEachContext ctx;
+
+  memset (buf, 0x12, sizeof (buf));
+  buf[61] = 0x00;
+  buf[62] = 0x34;
+  buf[63] = 0x56;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  pattern = gum_match_pattern_new_from_string ("12 00 34 56");
+  g_assert (pattern != NULL);
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+
+  ctx.expected_address[0] = buf + 60;
+  ctx.expected_size = 4;
+
+  gum_memory_scan (&range, pattern, match_found_cb, &ctx);
+
+  g_assert_cmpuint (ctx.number_of_calls, ==, 1);
+
+  gum_match_pattern_free (pattern);
+}
+
+MEMORY_TESTCASE (scan_range_finds_multiple_patterns_in_one_pass)
+{
+  guint8 buf[] = {
+    0x13, 0x37,
+    0x00,
+    0x12, 0x11, 0x56,
+    0x13, 0x37
+  };
+  GumMemoryRange range;
+  GumMatchPattern * patterns[2];
+  TestScanMultiContext ctx;
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = sizeof (buf);
+
+  patterns[0] = gum_match_pattern_new_from_string ("13 37");
+  patterns[1] = gum_match_pattern_new_from_string ("12 ?? 56");
+
+  ctx.number_of_calls = 0;
+
+  ctx.expected_address[0] = buf + 0;
+  ctx.expected_pattern_index[0] = 0;
+  ctx.expected_address[1] = buf + 3;
+  ctx.expected_pattern_index[1] = 1;
+  ctx.expected_address[2] = buf + 6;
+  ctx.expected_pattern_index[2] = 0;
+
+  gum_memory_scan_multi (&range, (const GumMatchPattern * const *) patterns,
+      G_N_ELEMENTS (patterns), multi_match_found_cb, &ctx);
+
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+
+  gum_match_pattern_free (patterns[1]);
+  gum_match_pattern_free (patterns[0]);
+}
+
+MEMORY_TESTCASE (parallel_scan_reports_matches_in_order)
+{
+  const guint8 needle[] = { 0x12, 0x34, 0x56, 0x78 };
+  const gsize chunk_size = 4 * 1024 * 1024;
+  guint8 * buf;
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  TestScanMultiContext ctx;
+  gboolean success;
+
+  buf = g_malloc0 (3 * chunk_size);
+  memcpy (buf + 10, needle, sizeof (needle));
+  memcpy (buf + chunk_size - 1, needle, sizeof (needle));
+  memcpy (buf + (2 * chunk_size) + 5, needle, sizeof (needle));
+
+  range.base_address = GUM_ADDRESS (buf);
+  range.size = 3 * chunk_size;
+
+  pattern = gum_match_pattern_new_from_string ("12 34 56 78");
+
+  ctx.number_of_calls = 0;
+
+  ctx.expected_address[0] = buf + 10;
+  ctx.expected_pattern_index[0] = 0;
+  ctx.expected_address[1] = buf + chunk_size - 1;
+  ctx.expected_pattern_index[1] = 0;
+  ctx.expected_address[2] = buf + (2 * chunk_size) + 5;
+  ctx.expected_pattern_index[2] = 0;
+
+  success = gum_memory_scan_ranges (&range, 1,
+      (const GumMatchPattern * const *) &pattern, 1, 3,
+      GUM_MEMORY_SCAN_ORDERED, multi_match_found_cb, &ctx, NULL);
+  g_assert (success);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 3);
+
+  gum_match_pattern_free (pattern);
+  g_free (buf);
+}
+
+MEMORY_TESTCASE (parallel_scan_can_skip_unreadable_pages)
+{
+  const guint8 needle[] = { 0x12, 0x34, 0x56, 0x78 };
+  guint8 * pages;
+  guint page_size;
+  GumMemoryRange range;
+  GumMatchPattern * pattern;
+  TestScanMultiContext ctx;
+  GumExceptionDetails fault;
+  gboolean success;
+
+  if (RUNNING_ON_VALGRIND)
+  {
+    g_print ("<skipping, not compatible with Valgrind> ");
+    return;
+  }
+
+  page_size = gum_query_page_size ();
+
+  pages = gum_alloc_n_pages (3, GUM_PAGE_RW);
+  memcpy (pages + 16, needle, sizeof (needle));
+  memcpy (pages + (2 * page_size) + 16, needle, sizeof (needle));
+  gum_mprotect (pages + page_size, page_size, GUM_PAGE_NO_ACCESS);
+
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = 3 * page_size;
+
+  pattern = gum_match_pattern_new_from_string ("12 34 56 78");
+
+  ctx.number_of_calls = 0;
+  ctx.expected_address[0] = pages + 16;
+  ctx.expected_pattern_index[0] = 0;
+  ctx.expected_address[1] = pages + (2 * page_size) + 16;
+  ctx.expected_pattern_index[1] = 0;
+
+  success = gum_memory_scan_ranges (&range, 1,
+      (const GumMatchPattern * const *) &pattern, 1, 1,
+      GUM_MEMORY_SCAN_ORDERED, multi_match_found_cb, &ctx, &fault);
+  g_assert (!success);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 1);
+  g_assert_cmpint (fault.type, ==, GUM_EXCEPTION_ACCESS_VIOLATION);
+
+  ctx.number_of_calls = 0;
+  success = gum_memory_scan_ranges (&range, 1,
+      (const GumMatchPattern * const *) &pattern, 1, 1,
+      GUM_MEMORY_SCAN_SKIP_FAULTS, multi_match_found_cb, &ctx, NULL);
+  g_assert (success);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 2);
+
+  gum_match_pattern_free (pattern);
+  gum_mprotect (pages + page_size, page_size, GUM_PAGE_RW);
+  gum_free_pages (pages);
+}
+
 MEMORY_TESTCASE (is_memory_readable_handles_mixed_page_protections)
 {
   guint8 * pages;
@@ -477,6 +660,144 @@ MEMORY_TESTCASE (mprotect_handles_page_boundaries)
   gum_free_pages (pages);
 }
 
+MEMORY_TESTCASE (patch_code_many_applies_scattered_patches)
+{
+  guint8 * pages;
+  guint page_size;
+  GumMemoryPatch patches[3];
+
+  page_size = gum_query_page_size ();
+  pages = gum_alloc_n_pages (4, GUM_PAGE_RW);
+  gum_mprotect (pages, 4 * page_size, GUM_PAGE_RX);
+
+  patches[0].address = GUM_ADDRESS (pages + (3 * page_size) + 16);
+  patches[0].size = 2;
+  patches[0].apply = store_two_bytes;
+  patches[0].apply_data = GSIZE_TO_POINTER (0x33);
+
+  patches[1].address = GUM_ADDRESS (pages + 8);
+  patches[1].size = 2;
+  patches[1].apply = store_two_bytes;
+  patches[1].apply_data = GSIZE_TO_POINTER (0x11);
+
+  patches[2].address = GUM_ADDRESS (pages + page_size - 1);
+  patches[2].size = 2;
+  patches[2].apply = store_two_bytes;
+  patches[2].apply_data = GSIZE_TO_POINTER (0x22);
+
+  g_assert (gum_memory_patch_code_many (patches, G_N_ELEMENTS (patches)));
+
+  g_assert_cmphex (pages[8], ==, 0x11);
+  g_assert_cmphex (pages[page_size - 1], ==, 0x22);
+  g_assert_cmphex (pages[page_size], ==, 0x22);
+  g_assert_cmphex (pages[2 * page_size], ==, 0x00);
+  g_assert_cmphex (pages[(3 * page_size) + 16], ==, 0x33);
+
+  g_assert (gum_memory_patch_code_many (NULL, 0));
+
+  gum_free_pages (pages);
+}
+
+MEMORY_TESTCASE (snapshot_restores_only_modified_pages)
+{
+  guint8 * pages;
+  guint page_size, i;
+  GumMemoryRange range;
+  GumMemorySnapshot * snapshot;
+
+  page_size = gum_query_page_size ();
+  pages = gum_alloc_n_pages (4, GUM_PAGE_RW);
+  for (i = 0; i != 4; i++)
+    pages[i * page_size] = i;
+
+  range.base_address = GUM_ADDRESS (pages);
+  range.size = 4 * page_size;
+  snapshot = gum_memory_snapshot_new (&range, 1);
+
+  g_assert_cmpuint (gum_memory_snapshot_restore (snapshot), ==, 0);
+
+  pages[1 * page_size] = 0x42;
+  pages[(3 * page_size) + 7] = 0x13;
+  g_assert_cmpuint (gum_memory_snapshot_restore (snapshot), ==, 2);
+  for (i = 0; i != 4; i++)
+    g_assert_cmpuint (pages[i * page_size], ==, i);
+  g_assert_cmpuint (pages[(3 * page_size) + 7], ==, 0);
+
+  /* Restoring does not count as a modification by itself. */
+  g_assert_cmpuint (gum_memory_snapshot_restore (snapshot), ==, 0);
+
+  /* Written to, but with the same contents as before. */
+  pages[2 * page_size] = 2;
+  g_assert_cmpuint (gum_memory_snapshot_restore (snapshot), ==,
+      gum_memory_snapshot_is_tracking_writes (snapshot) ? 1 : 0);
+
+  gum_memory_snapshot_free (snapshot);
+  gum_free_pages (pages);
+}
+
+MEMORY_TESTCASE (heap_cache_reuses_freed_chunks)
+{
+  gpointer a, b;
+
+  /* Multiples of the granularity, so the chunk fits its own size class. */
+  a = gum_malloc (48);
+  gum_free (a);
+  b = gum_malloc (48);
+  g_assert (b == a);
+  gum_free (b);
+
+  a = gum_malloc (192);
+  gum_free (a);
+  b = gum_malloc (192);
+  g_assert (b == a);
+  gum_free (b);
+}
+
+MEMORY_TESTCASE (heap_cache_passes_large_chunks_through)
+{
+  guint before, after;
+  gpointer mem;
+
+  before = gum_peek_private_memory_usage ();
+  mem = gum_malloc (4096);
+  gum_free (mem);
+  after = gum_peek_private_memory_usage ();
+
+  g_assert_cmpuint (after, ==, before);
+}
+
+#define CHURN_CHUNK_COUNT 32
+#define CHURN_CHUNK_SIZE 192
+
+MEMORY_TESTCASE (heap_cache_is_flushed_on_thread_exit)
+{
+  guint before, after;
+  GThread * thread;
+
+  before = gum_peek_private_memory_usage ();
+  thread = g_thread_new ("gum-test-heap-churn", churn_small_chunks, NULL);
+  g_thread_join (thread);
+  after = gum_peek_private_memory_usage ();
+
+  /* Allow for what GLib itself holds on to after the thread is gone. */
+  g_assert_cmpuint (after, <,
+      before + CHURN_CHUNK_COUNT * CHURN_CHUNK_SIZE);
+}
+
+static gpointer
+churn_small_chunks (gpointer data)
+{
+  gpointer chunks[CHURN_CHUNK_COUNT];
+  guint i;
+
+  for (i = 0; i != CHURN_CHUNK_COUNT; i++)
+    chunks[i] = gum_malloc (CHURN_CHUNK_SIZE);
+  for (i = 0; i != CHURN_CHUNK_COUNT; i++)
+    gum_free (chunks[i]);
+
+  return NULL;
+}
+
 static gboolean
 match_found_cb (GumAddress address,
                 gsize size,
@@ -494,3 +815,33 @@ match_found_cb (GumAddress address,
 
   return ctx->value_to_return;
 }
+
+static void
+store_two_bytes (gpointer mem,
+                 gpointer user_data)
+{
+  guint8 * bytes = mem;
+
+  bytes[0] = GPOINTER_TO_SIZE (user_data);
+  bytes[1] = GPOINTER_TO_SIZE (user_data);
+}
+
+static gboolean
+multi_match_found_cb (GumAddress address,
+                      gsize size,
+                      guint pattern_index,
+                      gpointer user_data)
+{
+  TestScanMultiContext * ctx = (TestScanMultiContext *) user_data;
+
+  g_assert_cmpuint (ctx->number_of_calls, <, 3);
+
+  g_assert (address ==
+      GUM_ADDRESS (ctx->expected_address[ctx->number_of_calls]));
+  g_assert_cmpuint (pattern_index, ==,
+      ctx->expected_pattern_index[ctx->number_of_calls]);
+
+  ctx->number_of_calls++;
+
+  return TRUE;
+}
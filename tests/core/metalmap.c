@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include "gummetalmap.h"
+
+#define METALMAP_TESTCASE(NAME) \
+    void test_metal_map_ ## NAME (void)
+#define METALMAP_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/MetalMap", test_metal_map, NAME)
+
+TEST_LIST_BEGIN (metalmap)
+  METALMAP_TESTENTRY (insert_should_overwrite_existing_key)
+  METALMAP_TESTENTRY (remove_should_only_remove_the_given_key)
+  METALMAP_TESTENTRY (removed_slots_should_be_reused)
+  METALMAP_TESTENTRY (map_should_grow_with_the_workload)
+  METALMAP_TESTENTRY (lookup_should_miss_after_removal)
+  METALMAP_TESTENTRY (remove_all_should_empty_the_map)
+TEST_LIST_END ()
+
+#define KEY(i) GSIZE_TO_POINTER (((gsize) (i) + 1) * 16)
+#define VALUE(i) GSIZE_TO_POINTER (((gsize) (i) << 1) | 1)
+
+static void assert_map_holds_range (GumMetalMap * map, guint start,
+    guint end);
+
+METALMAP_TESTCASE (insert_should_overwrite_existing_key)
+{
+  GumMetalMap map;
+
+  gum_metal_map_init (&map);
+
+  g_assert_null (gum_metal_map_lookup (&map, KEY (0)));
+
+  gum_metal_map_insert (&map, KEY (0), VALUE (1));
+  g_assert_cmphex (GPOINTER_TO_SIZE (gum_metal_map_lookup (&map, KEY (0))),
+      ==, GPOINTER_TO_SIZE (VALUE (1)));
+  g_assert_cmpuint (map.size, ==, 1);
+
+  gum_metal_map_insert (&map, KEY (0), VALUE (2));
+  g_assert_cmphex (GPOINTER_TO_SIZE (gum_metal_map_lookup (&map, KEY (0))),
+      ==, GPOINTER_TO_SIZE (VALUE (2)));
+  g_assert_cmpuint (map.size, ==, 1);
+
+  gum_metal_map_free (&map);
+}
+
+METALMAP_TESTCASE (remove_should_only_remove_the_given_key)
+{
+  GumMetalMap map;
+
+  gum_metal_map_init (&map);
+
+  gum_metal_map_insert (&map, KEY (0), VALUE (0));
+  gum_metal_map_insert (&map, KEY (1), VALUE (1));
+
+  g_assert_true (gum_metal_map_remove (&map, KEY (0)));
+  g_assert_false (gum_metal_map_remove (&map, KEY (0)));
+  g_assert_false (gum_metal_map_remove (&map, KEY (2)));
+  g_assert_cmpuint (map.size, ==, 1);
+
+  g_assert_null (gum_metal_map_lookup (&map, KEY (0)));
+  assert_map_holds_range (&map, 1, 2);
+
+  gum_metal_map_free (&map);
+}
+
+METALMAP_TESTCASE (removed_slots_should_be_reused)
+{
+  GumMetalMap map;
+  guint initial_capacity, i;
+
+  gum_metal_map_init (&map);
+  initial_capacity = map.capacity;
+
+  /*
+   * Never more than one key alive, so each insert lands on tombstones left
+   * behind by earlier keys, or has them swept away by a same-size rehash.
+   */
+  for (i = 0; i != 100 * initial_capacity; i++)
+  {
+    gum_metal_map_insert (&map, KEY (i), VALUE (i));
+    g_assert_true (gum_metal_map_remove (&map, KEY (i)));
+
+    g_assert_cmpuint (map.size + map.tombstones, <, map.capacity);
+  }
+
+  g_assert_cmpuint (map.capacity, ==, initial_capacity);
+  g_assert_cmpuint (map.size, ==, 0);
+
+  for (i = 0; i != 100 * initial_capacity; i++)
+    g_assert_null (gum_metal_map_lookup (&map, KEY (i)));
+
+  gum_metal_map_free (&map);
+}
+
+METALMAP_TESTCASE (map_should_grow_with_the_workload)
+{
+  const guint sizes[] = { 1, 100, 1000, 10000, 100000 };
+  guint i;
+
+  for (i = 0; i != G_N_ELEMENTS (sizes); i++)
+  {
+    GumMetalMap map;
+    guint j;
+
+    gum_metal_map_init (&map);
+
+    for (j = 0; j != sizes[i]; j++)
+      gum_metal_map_insert (&map, KEY (j), VALUE (j));
+
+    g_assert_cmpuint (map.size, ==, sizes[i]);
+    g_assert_cmpuint (map.capacity & (map.capacity - 1), ==, 0);
+    g_assert_cmpuint (map.size * 8, <=, map.capacity * 7);
+    assert_map_holds_range (&map, 0, sizes[i]);
+    g_assert_null (gum_metal_map_lookup (&map, KEY (sizes[i])));
+
+    gum_metal_map_free (&map);
+  }
+}
+
+METALMAP_TESTCASE (lookup_should_miss_after_removal)
+{
+  GumMetalMap map;
+  guint i;
+
+  gum_metal_map_init (&map);
+
+  for (i = 0; i != 5000; i++)
+    gum_metal_map_insert (&map, KEY (i), VALUE (i));
+
+  for (i = 0; i != 5000; i += 2)
+    g_assert_true (gum_metal_map_remove (&map, KEY (i)));
+
+  g_assert_cmpuint (map.size, ==, 2500);
+  for (i = 0; i != 5000; i++)
+  {
+    if (i % 2 == 0)
+    {
+      g_assert_null (gum_metal_map_lookup (&map, KEY (i)));
+    }
+    else
+    {
+      g_assert_cmphex (GPOINTER_TO_SIZE (gum_metal_map_lookup (&map, KEY (i))),
+          ==, GPOINTER_TO_SIZE (VALUE (i)));
+    }
+  }
+
+  gum_metal_map_free (&map);
+}
+
+METALMAP_TESTCASE (remove_all_should_empty_the_map)
+{
+  GumMetalMap map;
+  guint i;
+
+  gum_metal_map_init (&map);
+
+  for (i = 0; i != 1000; i++)
+    gum_metal_map_insert (&map, KEY (i), VALUE (i));
+  gum_metal_map_remove (&map, KEY (0));
+
+  gum_metal_map_remove_all (&map);
+  g_assert_cmpuint (map.size, ==, 0);
+  g_assert_cmpuint (map.tombstones, ==, 0);
+  for (i = 0; i != 1000; i++)
+    g_assert_null (gum_metal_map_lookup (&map, KEY (i)));
+
+  for (i = 500; i != 600; i++)
+    gum_metal_map_insert (&map, KEY (i), VALUE (i));
+  assert_map_holds_range (&map, 500, 600);
+  g_assert_null (gum_metal_map_lookup (&map, KEY (0)));
+
+  gum_metal_map_free (&map);
+}
+
+static void
+assert_map_holds_range (GumMetalMap * map,
+                        guint start,
+                        guint end)
+{
+  guint i;
+
+  for (i = start; i != end; i++)
+  {
+    g_assert_cmphex (GPOINTER_TO_SIZE (gum_metal_map_lookup (map, KEY (i))),
+        ==, GPOINTER_TO_SIZE (VALUE (i)));
+  }
+}
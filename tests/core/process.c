@@ -27,16 +27,22 @@
 TEST_LIST_BEGIN (process)
   PROCESS_TESTENTRY (process_threads)
   PROCESS_TESTENTRY (process_threads_exclude_cloaked)
+  PROCESS_TESTENTRY (process_threads_can_be_enumerated_without_details)
+  PROCESS_TESTENTRY (process_threads_can_be_modified_in_batch)
   PROCESS_TESTENTRY (process_modules)
   PROCESS_TESTENTRY (process_ranges)
   PROCESS_TESTENTRY (process_ranges_exclude_cloaked)
+  PROCESS_TESTENTRY (process_ranges_can_be_collected)
   PROCESS_TESTENTRY (module_imports)
   PROCESS_TESTENTRY (module_exports)
   PROCESS_TESTENTRY (module_symbols)
   PROCESS_TESTENTRY (module_ranges_can_be_enumerated)
   PROCESS_TESTENTRY (module_base)
+  PROCESS_TESTENTRY (module_map_finds_every_module)
+  PROCESS_TESTENTRY (module_map_resolves_many)
   PROCESS_TESTENTRY (module_export_can_be_found)
   PROCESS_TESTENTRY (module_export_matches_system_lookup)
+  PROCESS_TESTENTRY (module_snapshot_is_shared_until_modules_change)
 #ifdef G_OS_WIN32
   PROCESS_TESTENTRY (get_set_system_error)
   PROCESS_TESTENTRY (get_current_thread_id)
@@ -48,7 +54,7 @@ TEST_LIST_BEGIN (process)
   PROCESS_TESTENTRY (darwin_module_exports)
   PROCESS_TESTENTRY (darwin_module_exports_should_support_dyld)
 #endif
-#if defined (G_OS_WIN32) || defined (HAVE_DARWIN)
+#if defined (G_OS_WIN32) || defined (HAVE_DARWIN) || defined (HAVE_GLIBC)
   PROCESS_TESTENTRY (process_malloc_ranges)
 #endif
 #ifdef HAVE_LINUX
@@ -106,6 +112,10 @@ static gboolean thread_found_cb (const GumThreadDetails * details,
     gpointer user_data);
 static gboolean thread_check_cb (const GumThreadDetails * details,
     gpointer user_data);
+static gboolean thread_collect_cb (const GumThreadDetails * details,
+    gpointer user_data);
+static void thread_modify_cb (GumThreadId thread_id,
+    GumCpuContext * cpu_context, gpointer user_data);
 static gboolean module_found_cb (const GumModuleDetails * details,
     gpointer user_data);
 static gboolean import_found_cb (const GumImportDetails * details,
@@ -120,7 +130,7 @@ static gboolean range_check_cb (const GumRangeDetails * details,
     gpointer user_data);
 static gboolean store_first_range (const GumRangeDetails * details,
     gpointer user_data);
-#if defined (G_OS_WIN32) || defined (HAVE_DARWIN)
+#if defined (G_OS_WIN32) || defined (HAVE_DARWIN) || defined (HAVE_GLIBC)
 static gboolean malloc_range_found_cb (
     const GumMallocRangeDetails * details, gpointer user_data);
 static gboolean malloc_range_check_cb (
@@ -197,6 +207,59 @@ PROCESS_TESTCASE (process_threads_exclude_cloaked)
   gum_cloak_remove_thread (ctx.needle);
 }
 
+PROCESS_TESTCASE (process_threads_can_be_enumerated_without_details)
+{
+  TestThreadContext ctx;
+
+  ctx.needle = gum_process_get_current_thread_id ();
+  ctx.found = FALSE;
+  gum_process_enumerate_threads_with_flags (GUM_THREAD_FLAGS_SKIP_STATE |
+      GUM_THREAD_FLAGS_SKIP_CPU_CONTEXT, thread_check_cb, &ctx);
+  g_assert (ctx.found);
+}
+
+PROCESS_TESTCASE (process_threads_can_be_modified_in_batch)
+{
+  volatile gboolean done = FALSE;
+  GThread * thread_a, * thread_b;
+  GArray * thread_ids;
+  guint number_of_calls, number_modified;
+
+#if defined (HAVE_ANDROID) || defined (HAVE_MIPS)
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+#endif
+
+  if (RUNNING_ON_VALGRIND)
+  {
+    g_print ("<skipping, not compatible with Valgrind> ");
+    return;
+  }
+
+  thread_a = create_sleeping_dummy_thread_sync (&done);
+  thread_b = create_sleeping_dummy_thread_sync (&done);
+
+  thread_ids = g_array_new (FALSE, FALSE, sizeof (GumThreadId));
+  gum_process_enumerate_threads (thread_collect_cb, thread_ids);
+  g_assert_cmpuint (thread_ids->len, >=, 3);
+
+  number_of_calls = 0;
+  number_modified = gum_process_modify_threads (
+      (const GumThreadId *) thread_ids->data, thread_ids->len,
+      thread_modify_cb, &number_of_calls);
+  g_assert_cmpuint (number_modified, ==, number_of_calls);
+  g_assert_cmpuint (number_modified, >=, 2);
+
+  g_array_free (thread_ids, TRUE);
+
+  done = TRUE;
+  g_thread_join (thread_b);
+  g_thread_join (thread_a);
+}
+
 PROCESS_TESTCASE (process_modules)
 {
   TestForEachContext ctx;
@@ -348,6 +411,42 @@ PROCESS_TESTCASE (process_ranges)
   }
 }
 
+PROCESS_TESTCASE (process_ranges_can_be_collected)
+{
+  TestForEachContext ctx;
+  GArray * entries;
+  const gsize buf_size = 100;
+  guint8 * buf;
+  guint i;
+  gboolean found;
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = TRUE;
+  buf = malloc (buf_size);
+
+  gum_process_enumerate_ranges (GUM_PAGE_RW, range_found_cb, &ctx);
+  entries = gum_process_collect_ranges (GUM_PAGE_RW);
+  g_assert_cmpuint (entries->len, >, 1);
+  g_assert_cmpint (ABS ((gint) entries->len - (gint) ctx.number_of_calls),
+      <=, 2);
+
+  found = FALSE;
+  for (i = 0; i != entries->len && !found; i++)
+  {
+    const GumRangeEntry * e = &g_array_index (entries, GumRangeEntry, i);
+
+    g_assert ((e->prot & GUM_PAGE_RW) == GUM_PAGE_RW);
+    if (e->file.path != NULL)
+      g_assert (e->file.path == g_intern_string (e->file.path));
+
+    found = GUM_MEMORY_RANGE_INCLUDES (&e->range, GUM_ADDRESS (buf));
+  }
+  g_assert (found);
+
+  g_array_unref (entries);
+  free (buf);
+}
+
 PROCESS_TESTCASE (process_ranges_exclude_cloaked)
 {
   GumMemoryRange first = { 0, };
@@ -375,7 +474,7 @@ PROCESS_TESTCASE (process_ranges_exclude_cloaked)
   g_assert (!ctx.found);
 }
 
-#if defined (G_OS_WIN32) || defined (HAVE_DARWIN)
+#if defined (G_OS_WIN32) || defined (HAVE_DARWIN) || defined (HAVE_GLIBC)
 
 #define TEST_STACK_BUFFER_SIZE 50
 
@@ -514,12 +613,150 @@ PROCESS_TESTCASE (module_base)
   g_assert (gum_module_find_base_address (SYSTEM_MODULE_NAME) != 0);
 }
 
+PROCESS_TESTCASE (module_map_finds_every_module)
+{
+  GumModuleMap * map;
+  GArray * modules;
+  guint round, i;
+
+  map = gum_module_map_new ();
+  modules = gum_module_map_get_values (map);
+  g_assert_cmpuint (modules->len, >, 0);
+
+  g_assert (gum_module_map_find (map, 0) == NULL);
+
+  /* Twice, so the second round also goes through the last-hit cache. */
+  for (round = 0; round != 2; round++)
+  {
+    for (i = 0; i != modules->len; i++)
+    {
+      const GumModuleDetails * d =
+          &g_array_index (modules, GumModuleDetails, i);
+      const GumMemoryRange * r = d->range;
+
+      g_assert (gum_module_map_find (map, r->base_address) == d);
+      g_assert (gum_module_map_find (map, r->base_address) == d);
+      g_assert (gum_module_map_find (map, r->base_address + r->size - 1) == d);
+      g_assert (gum_module_map_find (map, r->base_address + r->size) != d);
+    }
+  }
+
+  gum_module_map_update (map);
+  modules = gum_module_map_get_values (map);
+  for (i = 0; i != modules->len; i++)
+  {
+    const GumModuleDetails * d = &g_array_index (modules, GumModuleDetails, i);
+
+    g_assert (gum_module_map_find (map, d->range->base_address) == d);
+  }
+
+  g_object_unref (map);
+}
+
+PROCESS_TESTCASE (module_map_resolves_many)
+{
+  GumModuleMap * map;
+  GArray * modules;
+  guint n, i;
+  gpointer * addresses;
+  GumModuleLocation * locations, few[3];
+
+  map = gum_module_map_new ();
+  modules = gum_module_map_get_values (map);
+
+  /* Reversed and interleaved with misses, so the sorted path has work. */
+  n = 3 * modules->len + 32;
+  addresses = g_new0 (gpointer, n);
+  locations = g_new (GumModuleLocation, n);
+  for (i = 0; i != modules->len; i++)
+  {
+    const GumMemoryRange * r = g_array_index (modules, GumModuleDetails,
+        modules->len - 1 - i).range;
+
+    addresses[(3 * i) + 0] = GSIZE_TO_POINTER (r->base_address + r->size - 1);
+    addresses[(3 * i) + 1] = GSIZE_TO_POINTER (1);
+    addresses[(3 * i) + 2] = GSIZE_TO_POINTER (r->base_address);
+  }
+
+  gum_module_map_resolve_many (map, (const gpointer *) addresses, n,
+      locations);
+
+  for (i = 0; i != n; i++)
+  {
+    const GumModuleLocation * l = &locations[i];
+    const GumModuleDetails * d;
+
+    d = gum_module_map_find (map, GUM_ADDRESS (addresses[i]));
+    if (d != NULL)
+    {
+      g_assert_cmpint (l->index, ==,
+          d - (const GumModuleDetails *) modules->data);
+      g_assert_cmpuint (l->offset, ==,
+          GUM_ADDRESS (addresses[i]) - d->range->base_address);
+    }
+    else
+    {
+      g_assert_cmpint (l->index, ==, -1);
+    }
+  }
+
+  /* Below the sorting threshold, where each address is looked up directly. */
+  gum_module_map_resolve_many (map, (const gpointer *) addresses, 3, few);
+  for (i = 0; i != G_N_ELEMENTS (few); i++)
+  {
+    g_assert_cmpint (few[i].index, ==, locations[i].index);
+    g_assert_cmpuint (few[i].offset, ==, locations[i].offset);
+  }
+
+  g_free (locations);
+  g_free (addresses);
+  g_object_unref (map);
+}
+
 PROCESS_TESTCASE (module_export_can_be_found)
 {
   g_assert (gum_module_find_export_by_name (SYSTEM_MODULE_NAME,
       SYSTEM_MODULE_EXPORT) != 0);
 }
 
+PROCESS_TESTCASE (module_snapshot_is_shared_until_modules_change)
+{
+  GumModuleSnapshot * first, * second;
+  const GumModuleDetails * details;
+  TestForEachContext ctx;
+  GumAddress expected;
+
+  first = gum_module_snapshot_obtain ();
+  second = gum_module_snapshot_obtain ();
+  g_assert_cmpuint (gum_module_snapshot_get_version (first), ==,
+      gum_module_snapshot_get_version (second));
+
+  details = gum_module_snapshot_find_module (first, GUM_TESTS_MODULE_NAME);
+  g_assert (details != NULL);
+  g_assert (gum_module_snapshot_find_module (first, details->path) == details);
+  g_assert (gum_module_snapshot_find_module (first, "nope.so") == NULL);
+
+  ctx.number_of_calls = 0;
+  ctx.value_to_return = FALSE;
+  gum_module_snapshot_enumerate_modules (first, module_found_cb, &ctx);
+  g_assert_cmpuint (ctx.number_of_calls, ==, 1);
+
+  expected = gum_module_find_export_by_name (SYSTEM_MODULE_NAME,
+      SYSTEM_MODULE_EXPORT);
+  g_assert (expected != 0);
+  g_assert_cmphex (gum_module_snapshot_find_export_by_name (first,
+      SYSTEM_MODULE_NAME, SYSTEM_MODULE_EXPORT), ==, expected);
+  g_assert_cmphex (gum_module_snapshot_find_export_by_name (second,
+      SYSTEM_MODULE_NAME, SYSTEM_MODULE_EXPORT), ==, expected);
+  g_assert_cmphex (gum_module_snapshot_lookup_export (SYSTEM_MODULE_NAME,
+      SYSTEM_MODULE_EXPORT), ==, expected);
+  g_assert_cmphex (gum_module_snapshot_find_export_by_name (first,
+      GUM_TESTS_MODULE_NAME, "nope"), ==, 0);
+
+  gum_module_snapshot_unref (second);
+  gum_module_snapshot_unref (first);
+}
+
 PROCESS_TESTCASE (module_export_matches_system_lookup)
 {
 #ifndef G_OS_WIN32
@@ -779,6 +1016,27 @@ thread_found_cb (const GumThreadDetails * details,
   return ctx->value_to_return;
 }
 
+static gboolean
+thread_collect_cb (const GumThreadDetails * details,
+                   gpointer user_data)
+{
+  GArray * thread_ids = user_data;
+
+  g_array_append_val (thread_ids, details->id);
+
+  return TRUE;
+}
+
+static void
+thread_modify_cb (GumThreadId thread_id,
+                  GumCpuContext * cpu_context,
+                  gpointer user_data)
+{
+  guint * number_of_calls = user_data;
+
+  (*number_of_calls)++;
+}
+
 static gboolean
 thread_check_cb (const GumThreadDetails * details,
                  gpointer user_data)
@@ -896,7 +1154,7 @@ store_first_range (const GumRangeDetails * details,
   return FALSE;
 }
 
-#if defined (G_OS_WIN32) || defined (HAVE_DARWIN)
+#if defined (G_OS_WIN32) || defined (HAVE_DARWIN) || defined (HAVE_GLIBC)
 
 static gboolean
 malloc_range_found_cb (const GumMallocRangeDetails * details,
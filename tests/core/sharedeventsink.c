@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "testutil.h"
+
+#include <string.h>
+#ifdef HAVE_LINUX
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+
+#define SHAREDEVENTSINK_TESTCASE(NAME) \
+    void test_shared_event_sink_ ## NAME (void)
+#define SHAREDEVENTSINK_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/SharedEventSink", test_shared_event_sink, NAME)
+
+TEST_LIST_BEGIN (sharedeventsink)
+  SHAREDEVENTSINK_TESTENTRY (events_should_reach_reader)
+  SHAREDEVENTSINK_TESTENTRY (full_ring_should_drop_events)
+#ifdef HAVE_LINUX
+  SHAREDEVENTSINK_TESTENTRY (ring_should_be_visible_through_path)
+#endif
+TEST_LIST_END ()
+
+static void push_exec_event (GumSharedEventSink * sink, gsize location);
+
+SHAREDEVENTSINK_TESTCASE (events_should_reach_reader)
+{
+  GumSharedEventSink * sink;
+  GumEventRing * ring;
+  GumEvent events[4];
+  guint i;
+
+  sink = gum_shared_event_sink_new (GUM_EXEC, 8, NULL);
+  g_assert (sink != NULL);
+  g_assert_cmpuint (gum_event_sink_query_mask (GUM_EVENT_SINK (sink)), ==,
+      GUM_EXEC);
+  g_assert (gum_shared_event_sink_get_path (sink) != NULL);
+
+  ring = gum_shared_event_sink_get_ring (sink);
+  g_assert_cmpuint (ring->magic, ==, GUM_EVENT_RING_MAGIC);
+  g_assert_cmpuint (ring->record_size, ==, sizeof (GumEvent));
+  g_assert_cmpuint (ring->capacity, ==, 8);
+
+  for (i = 0; i != 12; i++)
+  {
+    push_exec_event (sink, 0x1000 + i);
+
+    g_assert_cmpuint (gum_event_ring_drain (ring, events, 4), ==, 1);
+    GUM_ASSERT_CMPADDR (events[0].exec.location, ==,
+        GSIZE_TO_POINTER (0x1000 + i));
+  }
+  g_assert_cmpuint (gum_event_ring_drain (ring, events, 4), ==, 0);
+
+  g_object_unref (sink);
+}
+
+SHAREDEVENTSINK_TESTCASE (full_ring_should_drop_events)
+{
+  GumSharedEventSink * sink;
+  GumEventRing * ring;
+  GumEvent events[8];
+  guint i;
+
+  sink = gum_shared_event_sink_new (GUM_EXEC, 5, NULL);
+  g_assert (sink != NULL);
+  ring = gum_shared_event_sink_get_ring (sink);
+  g_assert_cmpuint (ring->capacity, ==, 8);
+
+  for (i = 0; i != 10; i++)
+    push_exec_event (sink, 0x2000 + i);
+  g_assert_cmpuint (ring->dropped_count, ==, 2);
+
+  g_assert_cmpuint (gum_event_ring_drain (ring, events, 8), ==, 8);
+  GUM_ASSERT_CMPADDR (events[0].exec.location, ==, GSIZE_TO_POINTER (0x2000));
+  GUM_ASSERT_CMPADDR (events[7].exec.location, ==, GSIZE_TO_POINTER (0x2007));
+
+  g_object_unref (sink);
+}
+
+#ifdef HAVE_LINUX
+
+SHAREDEVENTSINK_TESTCASE (ring_should_be_visible_through_path)
+{
+  GumSharedEventSink * sink;
+  gsize size;
+  gint fd;
+  GumEventRing * ring;
+  GumEvent ev;
+
+  sink = gum_shared_event_sink_new (GUM_EXEC, 16, NULL);
+  g_assert (sink != NULL);
+  size = gum_shared_event_sink_get_size (sink);
+
+  fd = open (gum_shared_event_sink_get_path (sink), O_RDWR | O_CLOEXEC);
+  g_assert_cmpint (fd, !=, -1);
+  ring = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  g_assert (ring != MAP_FAILED);
+  close (fd);
+
+  g_assert (ring != gum_shared_event_sink_get_ring (sink));
+
+  push_exec_event (sink, 0x3000);
+  g_assert_cmpuint (gum_event_ring_drain (ring, &ev, 1), ==, 1);
+  GUM_ASSERT_CMPADDR (ev.exec.location, ==, GSIZE_TO_POINTER (0x3000));
+  g_assert_cmpuint (gum_shared_event_sink_get_ring (sink)->tail, ==, 1);
+
+  munmap (ring, size);
+  g_object_unref (sink);
+}
+
+#endif
+
+static void
+push_exec_event (GumSharedEventSink * sink,
+                 gsize location)
+{
+  GumEvent ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.type = GUM_EXEC;
+  ev.exec.location = GSIZE_TO_POINTER (location);
+
+  gum_event_sink_process (GUM_EVENT_SINK (sink), &ev);
+}
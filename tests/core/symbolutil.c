@@ -14,6 +14,7 @@
 
 TEST_LIST_BEGIN (symbolutil)
   SYMUTIL_TESTENTRY (symbol_details_from_address)
+  SYMUTIL_TESTENTRY (symbol_details_from_addresses)
   SYMUTIL_TESTENTRY (symbol_name_from_address)
   SYMUTIL_TESTENTRY (find_external_public_function)
   SYMUTIL_TESTENTRY (find_local_static_function)
@@ -39,6 +40,33 @@ SYMUTIL_TESTCASE (symbol_details_from_address)
 #endif
 }
 
+SYMUTIL_TESTCASE (symbol_details_from_addresses)
+{
+  const gpointer addresses[] = {
+    gum_dummy_function_0,
+    gum_dummy_function_1,
+    gum_dummy_function_0
+  };
+  GumDebugSymbolDetails details[G_N_ELEMENTS (addresses)];
+  gboolean resolved[G_N_ELEMENTS (addresses)];
+  guint i;
+
+  g_assert_cmpuint (gum_symbol_details_from_addresses (addresses,
+      G_N_ELEMENTS (addresses), details, resolved), ==,
+      G_N_ELEMENTS (addresses));
+
+  for (i = 0; i != G_N_ELEMENTS (addresses); i++)
+  {
+    g_assert (resolved[i]);
+    g_assert_cmphex (GPOINTER_TO_SIZE (details[i].address), ==,
+        GPOINTER_TO_SIZE (addresses[i]));
+  }
+
+  g_assert_cmpstr (details[0].symbol_name, ==, "gum_dummy_function_0");
+  g_assert_cmpstr (details[1].symbol_name, ==, "gum_dummy_function_1");
+  g_assert_cmpstr (details[2].symbol_name, ==, "gum_dummy_function_0");
+}
+
 SYMUTIL_TESTCASE (symbol_name_from_address)
 {
   gchar * symbol_name;
@@ -15,16 +15,32 @@
 # include <pthread.h>
 #endif
 
+#if defined (HAVE_STATIC_TLS) && defined (HAVE_LINUX) && \
+    !defined (HAVE_ANDROID) && (defined (HAVE_I386) || defined (HAVE_ARM64))
+/* Keys are backed by static TLS slots rather than pthread keys. */
+# define GUM_TLS_KEYS_ARE_SYSTEM_KEYS 0
+#else
+# define GUM_TLS_KEYS_ARE_SYSTEM_KEYS 1
+#endif
+
 #define TLS_TESTCASE(NAME) \
     void test_tls_ ## NAME (void)
 #define TLS_TESTENTRY(NAME) \
     TEST_ENTRY_SIMPLE ("Core/Tls", test_tls, NAME)
 
 TEST_LIST_BEGIN (tls)
+#if GUM_TLS_KEYS_ARE_SYSTEM_KEYS
   TLS_TESTENTRY (get_should_work_like_the_system_implementation)
   TLS_TESTENTRY (set_should_work_like_the_system_implementation)
+#endif
+  TLS_TESTENTRY (values_should_be_per_thread)
+  TLS_TESTENTRY (value_should_not_outlive_its_key)
 TEST_LIST_END ()
 
+static gpointer swap_value_on_other_thread (gpointer data);
+
+#if GUM_TLS_KEYS_ARE_SYSTEM_KEYS
+
 TLS_TESTCASE (get_should_work_like_the_system_implementation)
 {
   GumTlsKey key;
@@ -58,3 +74,54 @@ TLS_TESTCASE (set_should_work_like_the_system_implementation)
 
   gum_tls_key_free (key);
 }
+
+#endif
+
+TLS_TESTCASE (values_should_be_per_thread)
+{
+  GumTlsKey key;
+  GThread * thread;
+  gpointer other_value;
+
+  key = gum_tls_key_new ();
+
+  gum_tls_key_set_value (key, GSIZE_TO_POINTER (0x11223344));
+
+  thread = g_thread_new ("tls-test-other", swap_value_on_other_thread,
+      &key);
+  other_value = g_thread_join (thread);
+
+  g_assert (other_value == NULL);
+  g_assert_cmphex (GPOINTER_TO_SIZE (gum_tls_key_get_value (key)),
+      ==, 0x11223344);
+
+  gum_tls_key_free (key);
+}
+
+TLS_TESTCASE (value_should_not_outlive_its_key)
+{
+  guint i;
+
+  /* Enough to go through any static slots more than once. */
+  for (i = 0; i != 64; i++)
+  {
+    GumTlsKey key;
+
+    key = gum_tls_key_new ();
+    g_assert (gum_tls_key_get_value (key) == NULL);
+    gum_tls_key_set_value (key, GSIZE_TO_POINTER (0x11223344));
+    gum_tls_key_free (key);
+  }
+}
+
+static gpointer
+swap_value_on_other_thread (gpointer data)
+{
+  GumTlsKey key = *((GumTlsKey *) data);
+  gpointer previous_value;
+
+  previous_value = gum_tls_key_get_value (key);
+  gum_tls_key_set_value (key, GSIZE_TO_POINTER (0x55667788));
+
+  return previous_value;
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumwatchpointmonitor.h"
+
+#include "testutil.h"
+
+#define WATCHPOINT_TESTCASE(NAME) \
+    void test_watchpoint_monitor_ ## NAME (void)
+#define WATCHPOINT_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Core/WatchpointMonitor", test_watchpoint_monitor, NAME)
+
+typedef struct _TestWatchpointContext TestWatchpointContext;
+
+struct _TestWatchpointContext
+{
+  volatile guint number_of_notifies;
+  GumWatchpointDetails last_details;
+};
+
+static void watchpoint_notify_cb (GumWatchpointMonitor * monitor,
+    const GumWatchpointDetails * details, gpointer user_data);
+
+TEST_LIST_BEGIN (watchpointmonitor)
+  WATCHPOINT_TESTENTRY (write_should_be_reported)
+  WATCHPOINT_TESTENTRY (unset_should_stop_reporting)
+TEST_LIST_END ()
+
+static volatile gsize watched_value = 0;
+
+WATCHPOINT_TESTCASE (write_should_be_reported)
+{
+  TestWatchpointContext ctx = { 0, };
+  GumWatchpointMonitor * monitor;
+  GumThreadId thread_id;
+  gsize val;
+
+  monitor = gum_watchpoint_monitor_new (watchpoint_notify_cb, &ctx, NULL);
+
+  g_assert (gum_watchpoint_monitor_set (monitor, 2,
+      GUM_ADDRESS (&watched_value), sizeof (watched_value), GUM_WATCH_WRITE,
+      NULL));
+  thread_id = gum_process_get_current_thread_id ();
+  g_assert (gum_watchpoint_monitor_apply (monitor, &thread_id, 1, NULL));
+
+  val = watched_value;
+  g_assert_cmpuint (ctx.number_of_notifies, ==, 0);
+
+  watched_value = val + 1;
+  g_assert_cmpuint (ctx.number_of_notifies, ==, 1);
+  g_assert_cmpuint (ctx.last_details.watchpoint_id, ==, 2);
+  g_assert_cmpuint (ctx.last_details.thread_id, ==, thread_id);
+  g_assert (ctx.last_details.address == &watched_value);
+
+  g_object_unref (monitor);
+
+  watched_value = val + 2;
+  g_assert_cmpuint (ctx.number_of_notifies, ==, 1);
+}
+
+WATCHPOINT_TESTCASE (unset_should_stop_reporting)
+{
+  TestWatchpointContext ctx = { 0, };
+  GumWatchpointMonitor * monitor;
+  GumThreadId thread_id;
+
+  monitor = gum_watchpoint_monitor_new (watchpoint_notify_cb, &ctx, NULL);
+
+  g_assert (gum_watchpoint_monitor_set (monitor, 0,
+      GUM_ADDRESS (&watched_value), sizeof (watched_value), GUM_WATCH_WRITE,
+      NULL));
+  thread_id = gum_process_get_current_thread_id ();
+  g_assert (gum_watchpoint_monitor_apply (monitor, &thread_id, 1, NULL));
+
+  gum_watchpoint_monitor_unset (monitor, 0);
+  g_assert (gum_watchpoint_monitor_apply (monitor, &thread_id, 1, NULL));
+
+  watched_value++;
+  g_assert_cmpuint (ctx.number_of_notifies, ==, 0);
+
+  g_object_unref (monitor);
+}
+
+static void
+watchpoint_notify_cb (GumWatchpointMonitor * monitor,
+                      const GumWatchpointDetails * details,
+                      gpointer user_data)
+{
+  TestWatchpointContext * ctx = user_data;
+
+  ctx->number_of_notifies++;
+  ctx->last_details = *details;
+}
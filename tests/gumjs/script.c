@@ -12,6 +12,8 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (array_buffer_can_be_created)
   SCRIPT_TESTENTRY (message_can_be_sent)
   SCRIPT_TESTENTRY (message_can_be_sent_with_data)
+  SCRIPT_TESTENTRY (message_can_be_sent_with_transferred_data)
+  SCRIPT_TESTENTRY (messages_sent_in_a_burst_should_be_batched)
   SCRIPT_TESTENTRY (message_can_be_received)
   SCRIPT_TESTENTRY (message_can_be_received_with_data)
   SCRIPT_TESTENTRY (recv_may_specify_desired_message_type)
@@ -24,6 +26,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (thread_can_be_forced_to_sleep)
   SCRIPT_TESTENTRY (timeout_can_be_scheduled)
   SCRIPT_TESTENTRY (timeout_can_be_cancelled)
+  SCRIPT_TESTENTRY (timeouts_fire_in_order_and_can_cancel_each_other)
   SCRIPT_TESTENTRY (interval_can_be_scheduled)
   SCRIPT_TESTENTRY (interval_can_be_cancelled)
   SCRIPT_TESTENTRY (callback_can_be_scheduled)
@@ -32,6 +35,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (callback_can_be_scheduled_on_next_tick)
   SCRIPT_TESTENTRY (timer_cancellation_apis_should_be_forgiving)
   SCRIPT_TESTENTRY (argument_can_be_read)
+  SCRIPT_TESTENTRY (argument_can_be_read_repeatedly)
   SCRIPT_TESTENTRY (argument_can_be_replaced)
   SCRIPT_TESTENTRY (return_value_can_be_read)
   SCRIPT_TESTENTRY (return_value_can_be_replaced)
@@ -52,6 +56,9 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (listener_can_be_detached)
   SCRIPT_TESTENTRY (listener_can_be_detached_by_destruction_mid_call)
   SCRIPT_TESTENTRY (all_listeners_can_be_detached)
+  SCRIPT_TESTENTRY (native_listener_can_be_attached)
+  SCRIPT_TESTENTRY (deferred_listener_should_receive_recorded_calls)
+  SCRIPT_TESTENTRY (captured_calls_can_be_drained)
   SCRIPT_TESTENTRY (function_can_be_replaced)
   SCRIPT_TESTENTRY (function_can_be_replaced_and_called_immediately)
   SCRIPT_TESTENTRY (function_can_be_reverted)
@@ -64,8 +71,10 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (pointer_can_be_read)
   SCRIPT_TESTENTRY (pointer_can_be_written)
   SCRIPT_TESTENTRY (memory_can_be_allocated)
+  SCRIPT_TESTENTRY (memory_can_be_allocated_in_arena)
   SCRIPT_TESTENTRY (memory_can_be_copied)
   SCRIPT_TESTENTRY (memory_can_be_duped)
+  SCRIPT_TESTENTRY (memory_can_be_viewed)
   SCRIPT_TESTENTRY (memory_can_be_protected)
   SCRIPT_TESTENTRY (code_can_be_patched)
   SCRIPT_TESTENTRY (s8_can_be_read)
@@ -119,8 +128,11 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (invalid_read_write_execute_results_in_exception)
   SCRIPT_TESTENTRY (memory_can_be_scanned)
   SCRIPT_TESTENTRY (memory_can_be_scanned_synchronously)
+  SCRIPT_TESTENTRY (memory_can_be_scanned_for_multiple_patterns)
   SCRIPT_TESTENTRY (memory_scan_should_be_interruptible)
   SCRIPT_TESTENTRY (memory_scan_handles_unreadable_memory)
+  SCRIPT_TESTENTRY (memory_can_be_scanned_incrementally)
+  SCRIPT_TESTENTRY (memory_scan_iterator_can_be_cancelled)
 #ifdef G_OS_WIN32
   SCRIPT_TESTENTRY (memory_access_can_be_monitored)
 #endif
@@ -139,6 +151,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (process_threads_can_be_enumerated_synchronously)
   SCRIPT_TESTENTRY (process_modules_can_be_enumerated)
   SCRIPT_TESTENTRY (process_modules_can_be_enumerated_synchronously)
+  SCRIPT_TESTENTRY (process_modules_are_enumerated_off_the_js_thread)
   SCRIPT_TESTENTRY (process_module_can_be_looked_up_from_address)
   SCRIPT_TESTENTRY (process_module_can_be_looked_up_from_name)
   SCRIPT_TESTENTRY (process_ranges_can_be_enumerated)
@@ -156,6 +169,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (module_exports_can_be_enumerated)
   SCRIPT_TESTENTRY (module_exports_can_be_enumerated_synchronously)
   SCRIPT_TESTENTRY (module_exports_enumeration_performance)
+  SCRIPT_TESTENTRY (module_exports_can_be_enumerated_as_table)
   SCRIPT_TESTENTRY (module_symbols_can_be_enumerated)
   SCRIPT_TESTENTRY (module_symbols_can_be_enumerated_synchronously)
   SCRIPT_TESTENTRY (module_ranges_can_be_enumerated)
@@ -174,9 +188,12 @@ TEST_LIST_BEGIN (script)
 #ifdef G_OS_UNIX
   SCRIPT_TESTENTRY (unix_fd_can_be_read_from)
   SCRIPT_TESTENTRY (unix_fd_can_be_written_to)
+  SCRIPT_TESTENTRY (unix_fd_can_be_written_to_in_batches)
 #endif
   SCRIPT_TESTENTRY (basic_hexdump_functionality_is_available)
   SCRIPT_TESTENTRY (hexdump_supports_native_pointer_conforming_object)
+  SCRIPT_TESTENTRY (hexdump_supports_offset_and_ansi)
+  SCRIPT_TESTENTRY (hexdump_of_inaccessible_memory_throws)
   SCRIPT_TESTENTRY (native_pointer_provides_is_null)
   SCRIPT_TESTENTRY (native_pointer_provides_arithmetic_operations)
   SCRIPT_TESTENTRY (native_pointer_to_match_pattern)
@@ -184,6 +201,7 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (uint64_provides_arithmetic_operations)
   SCRIPT_TESTENTRY (int64_provides_arithmetic_operations)
   SCRIPT_TESTENTRY (native_function_can_be_invoked)
+  SCRIPT_TESTENTRY (native_function_should_extend_narrow_arguments)
   SCRIPT_TESTENTRY (native_function_can_be_intercepted_when_thread_is_ignored)
   SCRIPT_TESTENTRY (native_function_should_implement_call_and_apply)
   SCRIPT_TESTENTRY (system_function_can_be_invoked)
@@ -195,26 +213,39 @@ TEST_LIST_BEGIN (script)
   SCRIPT_TESTENTRY (native_callback_is_a_native_pointer)
   SCRIPT_TESTENTRY (native_callback_memory_should_be_eagerly_reclaimed)
   SCRIPT_TESTENTRY (address_can_be_resolved_to_symbol)
+  SCRIPT_TESTENTRY (addresses_can_be_resolved_to_symbols)
   SCRIPT_TESTENTRY (name_can_be_resolved_to_symbol)
   SCRIPT_TESTENTRY (function_can_be_found_by_name)
   SCRIPT_TESTENTRY (functions_can_be_found_by_name)
   SCRIPT_TESTENTRY (functions_can_be_found_by_matching)
   SCRIPT_TESTENTRY (instruction_can_be_parsed)
+  SCRIPT_TESTENTRY (instruction_range_can_be_parsed)
   SCRIPT_TESTENTRY (instruction_can_be_generated)
+  SCRIPT_TESTENTRY (instructions_can_be_generated_in_bulk)
   SCRIPT_TESTENTRY (instruction_can_be_relocated)
   SCRIPT_TESTENTRY (file_can_be_written_to)
   SCRIPT_TESTENTRY (inline_sqlite_database_can_be_queried)
+  SCRIPT_TESTENTRY (inline_sqlite_database_supports_batches)
+  SCRIPT_TESTENTRY (inline_sqlite_database_can_spill_to_disk)
   SCRIPT_TESTENTRY (external_sqlite_database_can_be_queried)
   SCRIPT_TESTENTRY (external_sqlite_database_can_be_opened_with_flags)
 #if defined (HAVE_I386) || defined (HAVE_ARM64)
   SCRIPT_TESTENTRY (execution_can_be_traced)
   SCRIPT_TESTENTRY (execution_can_be_traced_with_custom_transformer)
+  SCRIPT_TESTENTRY (execution_can_be_traced_with_batched_transformer)
+  SCRIPT_TESTENTRY (execution_tracing_reports_dropped_events)
+  SCRIPT_TESTENTRY (call_summary_can_be_packed)
+  SCRIPT_TESTENTRY (events_can_be_compressed)
+  SCRIPT_TESTENTRY (events_can_be_parsed_as_a_stream)
   SCRIPT_TESTENTRY (call_can_be_probed)
 #endif
   SCRIPT_TESTENTRY (stalker_events_can_be_parsed)
   SCRIPT_TESTENTRY (script_can_be_compiled_to_bytecode)
   SCRIPT_TESTENTRY (script_can_be_reloaded)
   SCRIPT_TESTENTRY (script_memory_usage)
+  SCRIPT_TESTENTRY (script_statistics_can_be_queried)
+  SCRIPT_TESTENTRY (script_can_be_profiled)
+  SCRIPT_TESTENTRY (scripts_can_be_spread_across_js_threads)
   SCRIPT_TESTENTRY (source_maps_should_be_supported_for_our_runtime)
   SCRIPT_TESTENTRY (source_maps_should_be_supported_for_user_scripts)
   SCRIPT_TESTENTRY (types_handle_invalid_construction)
@@ -248,6 +279,8 @@ static guint64 gum_square (guint64 value);
 static gint gum_sum (gint count, ...);
 static gint gum_add_pointers_and_float_fixed (gpointer a, gpointer b, float c);
 static gint gum_add_pointers_and_float_variadic (gpointer a, gpointer b, ...);
+static gint64 gum_sum_narrow_arguments (gint8 a, guint8 b, gint16 c, guint16 d,
+    gint32 e, guint32 f);
 
 #ifndef HAVE_ANDROID
 static gboolean on_incoming_connection (GSocketService * service,
@@ -266,11 +299,16 @@ static void measure_target_function_int_overhead (void);
 
 static void on_script_message (GumScript * script, const gchar * message,
     GBytes * data, gpointer user_data);
+static void on_script_message_batch (GumScript * script,
+    const GumScriptMessage * messages, guint n_messages, gpointer user_data);
 static void on_incoming_debug_message (GumInspectorServer * server,
     const gchar * message, gpointer user_data);
 static void on_outgoing_debug_message (const gchar * message,
     gpointer user_data);
 
+static void on_native_enter (GumInvocationContext * ic);
+static void on_native_leave (GumInvocationContext * ic);
+
 static int target_function_int (int arg);
 static const guint8 * target_function_base_plus_offset (const guint8 * base,
     int offset);
@@ -573,6 +611,47 @@ SCRIPT_TESTCASE (instruction_can_be_parsed)
 #endif
 }
 
+SCRIPT_TESTCASE (instruction_range_can_be_parsed)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var first = Instruction.parse(" GUM_PTR_CONST ");"
+      "var range = Instruction.parseRange(first.address, 3);"
+      "send(range.length);"
+      "send(range[0].toString() === first.toString());"
+      "send(range[1].address.equals(range[0].next));"
+      "send(range[2].address.equals(range[1].next));"
+      "send(range[1].operands === range[1].operands);",
+      target_function_int);
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_NO_MESSAGES ();
+
+#if defined (HAVE_I386)
+  COMPILE_AND_LOAD_SCRIPT (
+      "var code = Memory.alloc(Process.pageSize);"
+
+      "var cw = new X86Writer(code);"
+      "cw.putNop();"
+      "cw.putBreakpoint();"
+      "cw.flush();"
+      "send(Instruction.parse(code).mnemonic);"
+
+      "cw.reset(code);"
+      "cw.putBreakpoint();"
+      "cw.flush();"
+      "send(Instruction.parse(code).mnemonic);"
+
+      "send(Instruction.parseRange(code, 10).length);");
+  EXPECT_SEND_MESSAGE_WITH ("\"nop\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"int3\"");
+  EXPECT_SEND_MESSAGE_WITH ("10");
+  EXPECT_NO_MESSAGES ();
+#endif
+}
+
 SCRIPT_TESTCASE (instruction_can_be_generated)
 {
 #if defined (HAVE_I386)
@@ -621,6 +700,37 @@ SCRIPT_TESTCASE (instruction_can_be_generated)
 #endif
 }
 
+SCRIPT_TESTCASE (instructions_can_be_generated_in_bulk)
+{
+#if defined (HAVE_I386)
+  COMPILE_AND_LOAD_SCRIPT (
+      "var page = Memory.alloc(Process.pageSize);"
+
+      "Memory.patchCode(page, 64, function (code) {"
+        "var cw = new X86Writer(code, { pc: page });"
+        "cw.putOps(["
+          "['putMovRegU32', 'eax', 42],"
+          "['putJmpShortLabel', 'badger'],"
+          "['putMovRegU32', 'eax', 43],"
+          "['putLabel', 'badger'],"
+          "['putRet']"
+        "]);"
+        "cw.flush();"
+      "});"
+
+      "var f = new NativeFunction(page, 'int', []);"
+      "send(f());");
+  EXPECT_SEND_MESSAGE_WITH ("42");
+  EXPECT_NO_MESSAGES ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var code = Memory.alloc(16);"
+      "var cw = new X86Writer(code);"
+      "cw.putOps([['putNop'], ['putMovRegU32', 'rax', 42]]);");
+  EXPECT_ERROR_MESSAGE_WITH (ANY_LINE_NUMBER, "Error: invalid argument");
+#endif
+}
+
 SCRIPT_TESTCASE (instruction_can_be_relocated)
 {
 #if defined (HAVE_I386)
@@ -709,6 +819,29 @@ SCRIPT_TESTCASE (address_can_be_resolved_to_symbol)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (addresses_can_be_resolved_to_symbols)
+{
+#ifdef HAVE_ANDROID
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+#endif
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var syms = DebugSymbol.fromAddresses([" GUM_PTR_CONST ", "
+          GUM_PTR_CONST "]);"
+      "send(syms.length);"
+      "send(syms[0].name);"
+      "send(syms[1].name);",
+      target_function_int, target_function_int);
+  EXPECT_SEND_MESSAGE_WITH ("2");
+  EXPECT_SEND_MESSAGE_WITH ("\"target_function_int\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"target_function_int\"");
+  EXPECT_NO_MESSAGES ();
+}
+
 SCRIPT_TESTCASE (name_can_be_resolved_to_symbol)
 {
   gchar * expected;
@@ -846,6 +979,17 @@ SCRIPT_TESTCASE (native_function_can_be_invoked)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (native_function_should_extend_narrow_arguments)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var sum = new NativeFunction(" GUM_PTR_CONST ", 'int64', "
+          "['int8', 'uint8', 'int16', 'uint16', 'int32', 'uint32']);"
+      "send(sum(-1, 255, -2, 65535, -3, 4294967295).toString());",
+      gum_sum_narrow_arguments);
+  EXPECT_SEND_MESSAGE_WITH ("\"4295033079\"");
+  EXPECT_NO_MESSAGES ();
+}
+
 SCRIPT_TESTCASE (native_function_can_be_intercepted_when_thread_is_ignored)
 {
   GumInterceptor * interceptor;
@@ -1321,6 +1465,43 @@ SCRIPT_TESTCASE (unix_fd_can_be_written_to)
   signal (SIGPIPE, original_sigpipe_handler);
 }
 
+SCRIPT_TESTCASE (unix_fd_can_be_written_to_in_batches)
+{
+  gint fds[2];
+  guint8 buffer[8];
+
+  g_assert_cmpint (socketpair (AF_UNIX, SOCK_STREAM, 0, fds), ==, 0);
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var stream = new UnixOutputStream(%d, { autoClose: false });"
+      "var region = Memory.alloc(2);"
+      "Memory.writeByteArray(region, [0xba, 0xbe]);"
+      "stream.cork();"
+      "stream.writeAll([0x13, 0x37]).then(function (size) { send(size); });"
+      "stream.writeMemoryRegion(region, 2)"
+      ".then(function (size) { send(size); });"
+      "stream.writev([[0xca, 0xfe], [region, 1]])"
+      ".then(function (size) { send(size); });"
+      "stream.uncork().then(function (size) { send(size); });",
+      fds[0]);
+  EXPECT_SEND_MESSAGE_WITH ("2");
+  EXPECT_SEND_MESSAGE_WITH ("2");
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_SEND_MESSAGE_WITH ("7");
+  EXPECT_NO_MESSAGES ();
+  g_assert_cmpint (read (fds[1], buffer, sizeof (buffer)), ==, 7);
+  g_assert_cmphex (buffer[0], ==, 0x13);
+  g_assert_cmphex (buffer[1], ==, 0x37);
+  g_assert_cmphex (buffer[2], ==, 0xba);
+  g_assert_cmphex (buffer[3], ==, 0xbe);
+  g_assert_cmphex (buffer[4], ==, 0xca);
+  g_assert_cmphex (buffer[5], ==, 0xfe);
+  g_assert_cmphex (buffer[6], ==, 0xba);
+
+  close (fds[1]);
+  close (fds[0]);
+}
+
 #endif
 
 SCRIPT_TESTCASE (basic_hexdump_functionality_is_available)
@@ -1350,6 +1531,34 @@ SCRIPT_TESTCASE (hexdump_supports_native_pointer_conforming_object)
           "Hello hex world!\"");
 }
 
+SCRIPT_TESTCASE (hexdump_supports_offset_and_ansi)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var str = Memory.allocUtf8String(\"Hello hex world!\");"
+      "send(hexdump(str, { offset: 12, length: 14, header: false }));"
+      "send(hexdump(str, { length: 2, header: false, ansi: true }));");
+  EXPECT_SEND_MESSAGE_WITH ("\""
+      "0000000c  72 6c                                            rl\"");
+  EXPECT_SEND_MESSAGE_WITH ("\""
+      "\\u001b[0;32m00000000\\u001b[0m  "
+      "\\u001b[0;33m48\\u001b[0m \\u001b[0;33m65\\u001b[0m"
+      "                                            "
+      "\\u001b[0;33mH\\u001b[0m\\u001b[0;33me\\u001b[0m\"");
+}
+
+SCRIPT_TESTCASE (hexdump_of_inaccessible_memory_throws)
+{
+  if (RUNNING_ON_VALGRIND)
+  {
+    g_print ("<skipping, not compatible with Valgrind> ");
+    return;
+  }
+
+  COMPILE_AND_LOAD_SCRIPT ("hexdump(ptr(\"0x1\"), { length: 16 });");
+  EXPECT_ERROR_MESSAGE_WITH (ANY_LINE_NUMBER,
+      "Error: access violation accessing 0x1");
+}
+
 SCRIPT_TESTCASE (native_pointer_provides_is_null)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -1546,6 +1755,17 @@ gum_sum (gint count,
   return total;
 }
 
+static gint64
+gum_sum_narrow_arguments (gint8 a,
+                          guint8 b,
+                          gint16 c,
+                          guint16 d,
+                          gint32 e,
+                          guint32 f)
+{
+  return (gint64) a + b + c + d + e + f;
+}
+
 static gint
 gum_add_pointers_and_float_fixed (gpointer a,
                                   gpointer b,
@@ -1589,6 +1809,49 @@ SCRIPT_TESTCASE (file_can_be_written_to)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (inline_sqlite_database_supports_batches)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var db = SqliteDatabase.openInline(new ArrayBuffer(0));\n"
+      "db.exec('PRAGMA journal_mode=WAL');\n"
+      "db.exec('CREATE TABLE events (id INTEGER, name TEXT, score REAL)');\n"
+
+      "var s = db.prepare('INSERT INTO events VALUES (?, ?, ?)');\n"
+      "send(s.runMany([[1, 'a', 0.5], [2, 'b', null], [3, 'c', 2]]));\n"
+
+      "s = db.prepare('SELECT id, name, score FROM events ORDER BY id');\n"
+      "send(s.stepMany(2));\n"
+      "send(s.stepMany(2));\n"
+
+      "var copy = SqliteDatabase.openInline(db.dump('binary'));\n"
+      "send(copy.prepare('SELECT COUNT(*) FROM events').step());\n");
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_SEND_MESSAGE_WITH ("[[1,\"a\",0.5],[2,\"b\",null]]");
+  EXPECT_SEND_MESSAGE_WITH ("[[3,\"c\",2]]");
+  EXPECT_SEND_MESSAGE_WITH ("[3]");
+  EXPECT_NO_MESSAGES ();
+}
+
+SCRIPT_TESTCASE (inline_sqlite_database_can_spill_to_disk)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var db = SqliteDatabase.openInline(new ArrayBuffer(0), "
+          "{ memoryLimit: 65536 });\n"
+      "db.exec('CREATE TABLE blobs (id INTEGER, data BLOB)');\n"
+      "var s = db.prepare('INSERT INTO blobs VALUES (?, randomblob(?))');\n"
+      "s.runMany([[1, 100000], [2, 200000], [3, 300000]]);\n"
+
+      "s = db.prepare('SELECT SUM(LENGTH(data)) FROM blobs');\n"
+      "send(s.step());\n"
+
+      "var copy = SqliteDatabase.openInline(db.dump('binary'));\n"
+      "send(copy.prepare('SELECT id FROM blobs WHERE data = "
+          "(SELECT data FROM blobs WHERE id = 2)').step());\n");
+  EXPECT_SEND_MESSAGE_WITH ("[600000]");
+  EXPECT_SEND_MESSAGE_WITH ("[2]");
+  EXPECT_NO_MESSAGES ();
+}
+
 SCRIPT_TESTCASE (inline_sqlite_database_can_be_queried)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -2251,6 +2514,178 @@ SCRIPT_TESTCASE (execution_can_be_traced_with_custom_transformer)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (execution_can_be_traced_with_batched_transformer)
+{
+  GumThreadId test_thread_id;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+    "var instructionsSeen = 0;"
+    "var calloutsFired = 0;"
+    "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+    "  transformBlock: function (instructions) {"
+    "    instructionsSeen += instructions.length / 3;"
+    "    return {"
+    "      callouts: [[0, onBlockEntry]]"
+    "    };"
+    "  }"
+    "});"
+    "function onBlockEntry (context) {"
+    "  calloutsFired++;"
+    "}"
+    "recv('stop', function (message) {"
+    "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+    "  send([instructionsSeen > 0, calloutsFired > 0]);"
+    "});", test_thread_id, test_thread_id);
+  g_usleep (1);
+  EXPECT_NO_MESSAGES ();
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[true,true]");
+  EXPECT_NO_MESSAGES ();
+}
+
+SCRIPT_TESTCASE (execution_tracing_reports_dropped_events)
+{
+  GumThreadId test_thread_id;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+    "Stalker.queueCapacity = 2;"
+    "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+    "  events: {"
+    "    exec: true"
+    "  },"
+    "  onReceive: function (events, dropped) {"
+    "    send([events.byteLength > 0, dropped > 0]);"
+    "  }"
+    "});"
+    "Stalker.queueCapacity = 16384;"
+    "recv('stop', function (message) {"
+    "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+    "});", test_thread_id, test_thread_id);
+  g_usleep (1);
+  EXPECT_NO_MESSAGES ();
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[true,true]");
+}
+
+SCRIPT_TESTCASE (call_summary_can_be_packed)
+{
+  GumThreadId test_thread_id;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+    "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+    "  events: {"
+    "    call: true"
+    "  },"
+    "  callSummaryFormat: 'packed',"
+    "  onCallSummary: function (summary) {"
+    "    send([summary instanceof Float64Array, summary.length > 0,"
+    "        summary.length %% 2, summary[1] > 0]);"
+    "  }"
+    "});"
+    "recv('stop', function (message) {"
+    "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+    "});", test_thread_id, test_thread_id);
+  g_usleep (1);
+  EXPECT_NO_MESSAGES ();
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[true,true,0,true]");
+}
+
+SCRIPT_TESTCASE (events_can_be_compressed)
+{
+  GumThreadId test_thread_id;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+    "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+    "  events: {"
+    "    exec: true"
+    "  },"
+    "  compression: 'deflate',"
+    "  onReceive: function (events) {"
+    "    send([events instanceof ArrayBuffer, events.byteLength > 0]);"
+    "  }"
+    "});"
+    "recv('stop', function (message) {"
+    "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+    "});", test_thread_id, test_thread_id);
+  g_usleep (1);
+  EXPECT_NO_MESSAGES ();
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[true,true]");
+}
+
+SCRIPT_TESTCASE (events_can_be_parsed_as_a_stream)
+{
+  GumThreadId test_thread_id;
+
+  if (!g_test_slow ())
+  {
+    g_print ("<skipping, run in slow mode> ");
+    return;
+  }
+
+  test_thread_id = gum_process_get_current_thread_id ();
+
+  COMPILE_AND_LOAD_SCRIPT (
+    "Stalker.follow(%" G_GSIZE_FORMAT ", {"
+    "  events: {"
+    "    exec: true"
+    "  },"
+    "  onReceive: function (events) {"
+    "    var count = 0;"
+    "    var allNumeric = true;"
+    "    Stalker.parse(events, {"
+    "      numeric: true,"
+    "      onEvent: function (type, location) {"
+    "        count++;"
+    "        allNumeric = allNumeric && type === 4 &&"
+    "            typeof location === 'number';"
+    "      }"
+    "    });"
+    "    send([count === Stalker.parse(events).length, allNumeric]);"
+    "  }"
+    "});"
+    "recv('stop', function (message) {"
+    "  Stalker.unfollow(%" G_GSIZE_FORMAT ");"
+    "});", test_thread_id, test_thread_id);
+  g_usleep (1);
+  EXPECT_NO_MESSAGES ();
+  POST_MESSAGE ("{\"type\":\"stop\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[true,true]");
+}
+
 SCRIPT_TESTCASE (call_can_be_probed)
 {
   GumThreadId test_thread_id;
@@ -2483,6 +2918,23 @@ SCRIPT_TESTCASE (process_modules_can_be_enumerated)
   EXPECT_SEND_MESSAGE_WITH ("\"onComplete\"");
 }
 
+SCRIPT_TESTCASE (process_modules_are_enumerated_off_the_js_thread)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var count = 0;"
+      "Process.enumerateModules({"
+        "onMatch: function (module) {"
+        "  count++;"
+        "},"
+        "onComplete: function () {"
+        "  send(count === Process.enumerateModulesSync().length);"
+        "}"
+      "});"
+      "send('scheduled');");
+  EXPECT_SEND_MESSAGE_WITH ("\"scheduled\"");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 SCRIPT_TESTCASE (process_modules_can_be_enumerated_synchronously)
 {
   COMPILE_AND_LOAD_SCRIPT ("send(Process.enumerateModulesSync().length > 1);");
@@ -2559,7 +3011,15 @@ SCRIPT_TESTCASE (process_module_can_be_looked_up_from_address)
       "  map.getPath(ptr(1));"
       "} catch (e) {"
       "  send(e.message);"
-      "}");
+      "}"
+
+      "var addresses = Memory.alloc(2 * Process.pointerSize);"
+      "Memory.writePointer(addresses, someModule.base.add(1));"
+      "Memory.writePointer(addresses.add(Process.pointerSize), ptr(1));"
+      "var locations = new Int32Array(map.annotate("
+      "    Memory.readByteArray(addresses, 2 * Process.pointerSize)));"
+      "send(map.values()[locations[0]].name === someModule.name);"
+      "send([locations[1], locations[2], locations[3]]);");
 
   EXPECT_SEND_MESSAGE_WITH ("true");
   EXPECT_SEND_MESSAGE_WITH ("false");
@@ -2581,6 +3041,9 @@ SCRIPT_TESTCASE (process_module_can_be_looked_up_from_address)
   EXPECT_SEND_MESSAGE_WITH ("true");
   EXPECT_SEND_MESSAGE_WITH ("\"unable to find module containing 0x1\"");
 
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("[1,-1,0]");
+
   EXPECT_NO_MESSAGES ();
 
 #ifdef HAVE_DARWIN
@@ -2785,9 +3248,9 @@ SCRIPT_TESTCASE (module_exports_enumeration_performance)
         "onMatch: function (exp) {"
         "},"
         "onComplete: function () {"
+        "  send((new Date()).getTime() - start.getTime());"
         "}"
-      "});"
-      "send((new Date()).getTime() - start.getTime());",
+      "});",
       SYSTEM_MODULE_NAME);
   item = test_script_fixture_pop_message (fixture);
   sscanf (item->message, "{\"type\":\"send\",\"payload\":%d}", &duration);
@@ -2795,6 +3258,26 @@ SCRIPT_TESTCASE (module_exports_enumeration_performance)
   test_script_message_item_free (item);
 }
 
+SCRIPT_TESTCASE (module_exports_can_be_enumerated_as_table)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var exports = Module.enumerateExportsSync(\"%s\");"
+      "var table = Module.enumerateExportsTable(\"%s\");"
+      "send(table.length === exports.length);"
+      "var i = table.length - 1;"
+      "var exp = table.get(i);"
+      "send(exp.type === exports[i].type);"
+      "send(exp.name === exports[i].name);"
+      "send(exp.address.equals(exports[i].address));"
+      "send(table.get(table.length) === undefined);",
+      SYSTEM_MODULE_NAME, SYSTEM_MODULE_NAME);
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 SCRIPT_TESTCASE (module_symbols_can_be_enumerated)
 {
 #if defined (HAVE_DARWIN) || defined (HAVE_LINUX)
@@ -2974,12 +3457,15 @@ SCRIPT_TESTCASE (rpc_can_be_performed)
       "rpc.exports.badger = function () {"
           "var buf = Memory.allocUtf8String(\"Yo\");"
           "return Memory.readByteArray(buf, 2);"
+      "};"
+      "rpc.exports.measure = function (a, data) {"
+          "return a + data.byteLength;"
       "};");
   EXPECT_NO_MESSAGES ();
 
   POST_MESSAGE ("[\"frida:rpc\",1,\"list\"]");
   EXPECT_SEND_MESSAGE_WITH ("[\"frida:rpc\",1,\"ok\","
-      "[\"foo\",\"bar\",\"badger\"]]");
+      "[\"foo\",\"bar\",\"badger\",\"measure\"]]");
 
   POST_MESSAGE ("[\"frida:rpc\",2,\"call\",\"foo\",[1,2]]");
   EXPECT_SEND_MESSAGE_WITH ("[\"frida:rpc\",2,\"ok\",3]");
@@ -3000,6 +3486,31 @@ SCRIPT_TESTCASE (rpc_can_be_performed)
   POST_MESSAGE ("[\"frida:rpc\",7,\"call\",\"badger\",[]]");
   EXPECT_SEND_MESSAGE_WITH_PAYLOAD_AND_DATA ("[\"frida:rpc\",7,\"ok\",{}]",
       "59 6f");
+
+  gum_script_post (fixture->script,
+      "[\"frida:rpc\",8,\"call\",\"measure\",[10]]",
+      g_bytes_new_static ("abc", 3));
+  EXPECT_SEND_MESSAGE_WITH ("[\"frida:rpc\",8,\"ok\",13]");
+
+  POST_MESSAGE ("[\"frida:rpc\",9,\"call-batch\",[]]");
+  EXPECT_SEND_MESSAGE_WITH ("[\"frida:rpc\",9,\"ok\",[]]");
+
+  gum_script_post (fixture->script,
+      "[\"frida:rpc\",10,\"call-batch\",["
+          "[\"foo\",[1,2]],"
+          "[\"bar\",[3,4]],"
+          "[\"measure\",[1],1,2],"
+          "[\"baz\",[]],"
+          "[\"badger\",[]]"
+      "]]",
+      g_bytes_new_static ("abc", 3));
+  EXPECT_SEND_MESSAGE_WITH_PAYLOAD_AND_DATA ("[\"frida:rpc\",10,\"ok\",["
+      "[\"ok\",3],"
+      "[\"ok\",7],"
+      "[\"ok\",3],"
+      "[\"error\",\"unable to find method 'baz'\"],"
+      "[\"ok\",null,0,2]"
+      "]]", "59 6f");
 }
 
 SCRIPT_TESTCASE (message_can_be_sent)
@@ -3014,6 +3525,29 @@ SCRIPT_TESTCASE (message_can_be_sent_with_data)
   EXPECT_SEND_MESSAGE_WITH_PAYLOAD_AND_DATA ("1234", "13 37");
 }
 
+SCRIPT_TESTCASE (message_can_be_sent_with_transferred_data)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "const buf = new Uint8Array([0x13, 0x37]).buffer;"
+      "send(buf.byteLength, buf, { transfer: true });"
+      "send(buf.byteLength);");
+  EXPECT_SEND_MESSAGE_WITH_PAYLOAD_AND_DATA ("2", "13 37");
+  if (GUM_DUK_IS_SCRIPT_BACKEND (fixture->backend))
+    EXPECT_SEND_MESSAGE_WITH ("2");
+  else
+    EXPECT_SEND_MESSAGE_WITH ("0");
+}
+
+SCRIPT_TESTCASE (messages_sent_in_a_burst_should_be_batched)
+{
+  COMPILE_AND_LOAD_SCRIPT ("send(1); send(2, [0x13, 0x37]); send(3);");
+  gum_script_set_message_batch_handler (fixture->script,
+      on_script_message_batch, fixture, NULL);
+  EXPECT_SEND_MESSAGE_WITH ("1");
+  EXPECT_SEND_MESSAGE_WITH_PAYLOAD_AND_DATA ("2", "13 37");
+  EXPECT_SEND_MESSAGE_WITH ("3");
+}
+
 SCRIPT_TESTCASE (message_can_be_received)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -3265,6 +3799,39 @@ SCRIPT_TESTCASE (timeout_can_be_cancelled)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (timeouts_fire_in_order_and_can_cancel_each_other)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var fired = [];"
+      "var victim;"
+      "for (var i = 0; i !== 1000; i++) {"
+      "  (function (delay) {"
+      "    setTimeout(function () {"
+      "      fired.push(delay);"
+      "      if (delay === 300)"
+      "        clearTimeout(victim);"
+      "    }, delay);"
+      "  })(1000 - i);"
+      "}"
+      "setTimeout(function () {"
+      "  fired.push(300);"
+      "}, 300);"
+      "victim = setTimeout(function () {"
+      "  send('victim fired');"
+      "}, 300);"
+      "setTimeout(function () {"
+      "  var sorted = fired.every(function (delay, i) {"
+      "    return i === 0 || delay >= fired[i - 1];"
+      "  });"
+      "  send([fired.length, sorted]);"
+      "}, 1100);");
+  EXPECT_NO_MESSAGES ();
+
+  g_usleep (1250000);
+  EXPECT_SEND_MESSAGE_WITH ("[1001,true]");
+  EXPECT_NO_MESSAGES ();
+}
+
 SCRIPT_TESTCASE (interval_can_be_scheduled)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -3370,6 +3937,33 @@ SCRIPT_TESTCASE (argument_can_be_read)
   EXPECT_SEND_MESSAGE_WITH ("-42");
 }
 
+SCRIPT_TESTCASE (argument_can_be_read_repeatedly)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var previous = null;"
+      "Interceptor.attach(" GUM_PTR_CONST ", {"
+      "  onEnter: function (args) {"
+      "    var arg = args[0];"
+      "    send([arg.toInt32(), args[0].toInt32(), arg === previous]);"
+      "    previous = arg;"
+      "  }"
+      "});", target_function_int);
+
+  EXPECT_NO_MESSAGES ();
+
+  target_function_int (42);
+  EXPECT_SEND_MESSAGE_WITH ("[42,42,false]");
+
+  target_function_int (42);
+  if (GUM_DUK_IS_SCRIPT_BACKEND (fixture->backend))
+    EXPECT_SEND_MESSAGE_WITH ("[42,42,false]");
+  else
+    EXPECT_SEND_MESSAGE_WITH ("[42,42,true]");
+
+  target_function_int (7);
+  EXPECT_SEND_MESSAGE_WITH ("[7,7,false]");
+}
+
 SCRIPT_TESTCASE (argument_can_be_replaced)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -3873,6 +4467,91 @@ SCRIPT_TESTCASE (all_listeners_can_be_detached)
   EXPECT_NO_MESSAGES ();
 }
 
+SCRIPT_TESTCASE (native_listener_can_be_attached)
+{
+  gint count = 0;
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var listener = Interceptor.attach(" GUM_PTR_CONST ", {"
+      "  onEnter: " GUM_PTR_CONST ","
+      "  onLeave: " GUM_PTR_CONST
+      "}, " GUM_PTR_CONST ");"
+      "recv('detach', function () {"
+      "  listener.detach();"
+      "  send('detached');"
+      "});",
+      target_function_int, on_native_enter, on_native_leave, &count);
+  EXPECT_NO_MESSAGES ();
+
+  target_function_int (42);
+  g_assert_cmpint (count, ==, 1 + 10);
+  target_function_int (42);
+  g_assert_cmpint (count, ==, 2 + 20);
+
+  POST_MESSAGE ("{\"type\":\"detach\"}");
+  EXPECT_SEND_MESSAGE_WITH ("\"detached\"");
+  target_function_int (42);
+  g_assert_cmpint (count, ==, 2 + 20);
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "Interceptor.attach(" GUM_PTR_CONST ", " GUM_PTR_CONST ", "
+          GUM_PTR_CONST ");",
+      target_function_int, on_native_enter, &count);
+  count = 0;
+  target_function_int (42);
+  g_assert_cmpint (count, ==, 1);
+}
+
+SCRIPT_TESTCASE (deferred_listener_should_receive_recorded_calls)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "var pending = [];"
+      "var listener = Interceptor.attachDeferred(" GUM_PTR_CONST ","
+      "    function (calls) {"
+      "  calls.forEach(function (call) {"
+      "    pending.push([call.args[0].toInt32(), call.retval.toInt32(),"
+      "        call.depth, typeof call.duration]);"
+      "  });"
+      "  if (pending.length === 2) {"
+      "    listener.detach();"
+      "    send(pending);"
+      "  }"
+      "}, { args: 1 });",
+      target_function_int);
+  EXPECT_NO_MESSAGES ();
+
+  target_function_int (7);
+  target_function_int (8);
+  EXPECT_SEND_MESSAGE_WITH ("[[7,315,0,\"number\"],[8,360,0,\"number\"]]");
+
+  target_function_int (9);
+  EXPECT_NO_MESSAGES ();
+}
+
+SCRIPT_TESTCASE (captured_calls_can_be_drained)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "Interceptor.drainCaptures();"
+      "Interceptor.capture(" GUM_PTR_CONST ", { args: 1, retval: true });"
+      "recv('drain', function () {"
+      "  Interceptor.detachCapture(" GUM_PTR_CONST ");"
+      "  send(Interceptor.drainCaptures().map(function (call) {"
+      "    return [call.args[0].toInt32(), call.retval.toInt32(),"
+      "        typeof call.timestamp];"
+      "  }));"
+      "});",
+      target_function_int, target_function_int);
+  EXPECT_NO_MESSAGES ();
+
+  target_function_int (7);
+  target_function_int (8);
+  POST_MESSAGE ("{\"type\":\"drain\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[[7,315,\"number\"],[8,360,\"number\"]]");
+
+  target_function_int (9);
+  EXPECT_NO_MESSAGES ();
+}
+
 SCRIPT_TESTCASE (function_can_be_replaced)
 {
   COMPILE_AND_LOAD_SCRIPT (
@@ -4136,6 +4815,24 @@ SCRIPT_TESTCASE (memory_can_be_scanned_synchronously)
   EXPECT_SEND_MESSAGE_WITH ("\"done\"");
 }
 
+SCRIPT_TESTCASE (memory_can_be_scanned_for_multiple_patterns)
+{
+  guint8 haystack[] = { 0x01, 0x02, 0x13, 0x37, 0x03, 0x12, 0x44, 0x56 };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "Memory.scanSync(" GUM_PTR_CONST ", 8, ['13 37', '12 ?? 56'])"
+      ".forEach(function (match) {"
+      "  send('match offset=' + match.address.sub(" GUM_PTR_CONST
+           ").toInt32() + ' size=' + match.size +"
+      "      ' pattern=' + match.pattern);"
+      "});"
+      "send('done');",
+      haystack, haystack);
+  EXPECT_SEND_MESSAGE_WITH ("\"match offset=2 size=2 pattern=0\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"match offset=5 size=3 pattern=1\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"done\"");
+}
+
 SCRIPT_TESTCASE (memory_scan_should_be_interruptible)
 {
   guint8 haystack[] = { 0x01, 0x02, 0x13, 0x37, 0x03, 0x13, 0x37 };
@@ -4186,6 +4883,57 @@ SCRIPT_TESTCASE (memory_scan_handles_unreadable_memory)
   EXPECT_SEND_MESSAGE_WITH ("\"access violation accessing 0x530\"");
 }
 
+SCRIPT_TESTCASE (memory_can_be_scanned_incrementally)
+{
+  guint8 haystack[] = { 0x13, 0x37, 0x02, 0x13, 0x37, 0x03, 0x13, 0x37 };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var base = " GUM_PTR_CONST ";"
+      "var it = Memory.scanIterator(base, 8, '13 37', { chunkSize: 2 });"
+      "function offsets(matches) {"
+      "  return matches.map(function (m) {"
+      "    return m.address.sub(base).toInt32();"
+      "  }).join(',');"
+      "}"
+      "it.readChunk()"
+      ".then(function (matches) {"
+      "  send(offsets(matches));"
+      "  return it.readChunk();"
+      "})"
+      ".then(function (matches) {"
+      "  send(offsets(matches));"
+      "  return it.next();"
+      "})"
+      ".then(function (result) {"
+      "  send(result.done);"
+      "});", haystack);
+  EXPECT_SEND_MESSAGE_WITH ("\"0,3\"");
+  EXPECT_SEND_MESSAGE_WITH ("\"6\"");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
+SCRIPT_TESTCASE (memory_scan_iterator_can_be_cancelled)
+{
+  guint8 haystack[] = { 0x13, 0x37, 0x02, 0x13, 0x37, 0x03, 0x13, 0x37 };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var base = " GUM_PTR_CONST ";"
+      "var it = Memory.scanIterator(base, 8, '13 37', { chunkSize: 1 });"
+      "it.next()"
+      ".then(function (result) {"
+      "  send(result.value.address.sub(base).toInt32());"
+      "  return it.return();"
+      "})"
+      ".then(function () {"
+      "  return it.next();"
+      "})"
+      ".then(function (result) {"
+      "  send(result.done);"
+      "});", haystack);
+  EXPECT_SEND_MESSAGE_WITH ("0");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+}
+
 #ifdef G_OS_WIN32
 
 SCRIPT_TESTCASE (memory_access_can_be_monitored)
@@ -4283,6 +5031,40 @@ SCRIPT_TESTCASE (memory_can_be_allocated)
   EXPECT_SEND_MESSAGE_WITH_PAYLOAD_AND_DATA("\"p\"", "00 00 00 00 00");
 }
 
+SCRIPT_TESTCASE (memory_can_be_allocated_in_arena)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "send(Memory.arena(function () {"
+      "  var a = Memory.alloc(8);"
+      "  var b = Memory.alloc(8);"
+      "  Memory.writeU32(a, 1337);"
+      "  return [Memory.readU32(a), Memory.readU32(b), a.equals(b)];"
+      "}));");
+  EXPECT_SEND_MESSAGE_WITH ("[1337,0,false]");
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var first = Memory.arena(function () {"
+      "  return Memory.alloc(8);"
+      "});"
+      "var second = Memory.arena(function () {"
+      "  return Memory.alloc(8);"
+      "});"
+      "send(first.equals(second));");
+  EXPECT_SEND_MESSAGE_WITH ("true");
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "try {"
+      "  Memory.arena(function () {"
+      "    throw new Error('oops');"
+      "  });"
+      "} catch (e) {"
+      "  send(e.message);"
+      "}"
+      "send(Memory.arena(function () { return 42; }));");
+  EXPECT_SEND_MESSAGE_WITH ("\"oops\"");
+  EXPECT_SEND_MESSAGE_WITH ("42");
+}
+
 SCRIPT_TESTCASE (memory_can_be_copied)
 {
   const gchar * from = "Hei";
@@ -4316,6 +5098,26 @@ SCRIPT_TESTCASE (memory_can_be_copied)
 #endif
 }
 
+SCRIPT_TESTCASE (memory_can_be_viewed)
+{
+  guint32 values[3] = { 1, 2, 3 };
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "var view = new Uint32Array(Memory.view(" GUM_PTR_CONST ", 12));"
+      "send(view.length);"
+      "send(view[0] + view[1] + view[2]);"
+      "view[1] = 1337;",
+      values);
+  EXPECT_SEND_MESSAGE_WITH ("3");
+  EXPECT_SEND_MESSAGE_WITH ("6");
+  g_assert_cmpuint (values[0], ==, 1);
+  g_assert_cmpuint (values[1], ==, 1337);
+  g_assert_cmpuint (values[2], ==, 3);
+
+  COMPILE_AND_LOAD_SCRIPT ("Memory.view(ptr(\"1337\"), 4);");
+  EXPECT_ERROR_MESSAGE_WITH (1, "Error: access violation accessing 0x539");
+}
+
 SCRIPT_TESTCASE (memory_can_be_duped)
 {
   guint8 buf[3] = { 0x13, 0x37, 0x42 };
@@ -5024,68 +5826,45 @@ SCRIPT_TESTCASE (script_can_be_compiled_to_bytecode)
   GError * error;
   GBytes * code;
   GumScript * script;
+  TestScriptMessageItem * item;
 
   error = NULL;
   code = gum_script_backend_compile_sync (fixture->backend, "testcase",
       "send(1337);\noops;", NULL, &error);
-  if (GUM_DUK_IS_SCRIPT_BACKEND (fixture->backend))
-  {
-    g_assert (code != NULL);
-    g_assert (error == NULL);
-
-    g_assert (gum_script_backend_compile_sync (fixture->backend, "failcase1",
-        "'", NULL, NULL) == NULL);
-
-    g_assert (gum_script_backend_compile_sync (fixture->backend, "failcase2",
-        "'", NULL, &error) == NULL);
-    g_assert (error != NULL);
-    g_assert (g_str_has_prefix (error->message,
-        "Script(line 1): SyntaxError: "));
-    g_clear_error (&error);
-  }
-  else
-  {
-    g_assert (code == NULL);
-    g_assert (error != NULL);
-    g_assert_cmpstr (error->message, ==, "not yet supported by the V8 runtime");
-    g_clear_error (&error);
+  g_assert (code != NULL);
+  g_assert (error == NULL);
 
-    code = g_bytes_new (NULL, 0);
-  }
+  g_assert (gum_script_backend_compile_sync (fixture->backend, "failcase1",
+      "'", NULL, NULL) == NULL);
+
+  g_assert (gum_script_backend_compile_sync (fixture->backend, "failcase2",
+      "'", NULL, &error) == NULL);
+  g_assert (error != NULL);
+  g_assert (g_str_has_prefix (error->message,
+      "Script(line 1): SyntaxError: "));
+  g_clear_error (&error);
 
   script = gum_script_backend_create_from_bytes_sync (fixture->backend, code,
       NULL, &error);
-  if (GUM_DUK_IS_SCRIPT_BACKEND (fixture->backend))
-  {
-    TestScriptMessageItem * item;
+  g_assert (script != NULL);
+  g_assert (error == NULL);
 
-    g_assert (script != NULL);
-    g_assert (error == NULL);
+  gum_script_set_message_handler (script, test_script_fixture_store_message,
+      fixture, NULL);
 
-    gum_script_set_message_handler (script, test_script_fixture_store_message,
-        fixture, NULL);
-
-    gum_script_load_sync (script, NULL);
+  gum_script_load_sync (script, NULL);
 
-    EXPECT_SEND_MESSAGE_WITH ("1337");
+  EXPECT_SEND_MESSAGE_WITH ("1337");
 
-    item = test_script_fixture_pop_message (fixture);
-    g_assert (strstr (item->message, "ReferenceError") != NULL);
-    g_assert (strstr (item->message, "agent.js") == NULL);
-    g_assert (strstr (item->message, "testcase.js") != NULL);
-    test_script_message_item_free (item);
+  item = test_script_fixture_pop_message (fixture);
+  g_assert (strstr (item->message, "ReferenceError") != NULL);
+  g_assert (strstr (item->message, "agent.js") == NULL);
+  g_assert (strstr (item->message, "testcase.js") != NULL);
+  test_script_message_item_free (item);
 
-    EXPECT_NO_MESSAGES ();
+  EXPECT_NO_MESSAGES ();
 
-    g_object_unref (script);
-  }
-  else
-  {
-    g_assert (script == NULL);
-    g_assert (error != NULL);
-    g_assert_cmpstr (error->message, ==, "not yet supported by the V8 runtime");
-    g_clear_error (&error);
-  }
+  g_object_unref (script);
 
   g_bytes_unref (code);
 }
@@ -5105,6 +5884,109 @@ SCRIPT_TESTCASE (script_can_be_reloaded)
   EXPECT_SEND_MESSAGE_WITH ("\"undefined\"");
 }
 
+static void
+record_js_thread (GThread ** thread)
+{
+  g_usleep (G_USEC_PER_SEC / 100);
+
+  g_atomic_pointer_set (thread, g_thread_self ());
+}
+
+SCRIPT_TESTCASE (scripts_can_be_spread_across_js_threads)
+{
+  GumScriptScheduler * scheduler, * first, * second, * third;
+  GThread * root_thread = NULL;
+  GThread * lane_thread = NULL;
+
+  scheduler = gum_script_scheduler_new ();
+  gum_script_scheduler_set_js_thread_count (scheduler, 2);
+  gum_script_scheduler_start (scheduler);
+
+  first = gum_script_scheduler_acquire_js_lane (scheduler, 0);
+  second = gum_script_scheduler_acquire_js_lane (scheduler, 1);
+  third = gum_script_scheduler_acquire_js_lane (scheduler, 3);
+  g_assert (first == scheduler);
+  g_assert (second != scheduler);
+  g_assert (third == second);
+
+  gum_script_scheduler_push_job_on_js_thread (first, G_PRIORITY_DEFAULT,
+      (GumScriptJobFunc) record_js_thread, &root_thread, NULL);
+  gum_script_scheduler_push_job_on_js_thread (second, G_PRIORITY_DEFAULT,
+      (GumScriptJobFunc) record_js_thread, &lane_thread, NULL);
+  while (g_atomic_pointer_get (&root_thread) == NULL ||
+      g_atomic_pointer_get (&lane_thread) == NULL)
+    g_usleep (G_USEC_PER_SEC / 100);
+  g_assert (root_thread != lane_thread);
+
+  g_assert_cmpuint (gum_script_scheduler_get_js_busy_time (second), >=,
+      G_USEC_PER_SEC / 100);
+
+  g_object_unref (third);
+  g_object_unref (second);
+  g_object_unref (first);
+  g_object_unref (scheduler);
+}
+
+SCRIPT_TESTCASE (script_statistics_can_be_queried)
+{
+  COMPILE_AND_LOAD_SCRIPT (
+      "Interceptor.attach(" GUM_PTR_CONST ", {"
+      "  onEnter: function (args) {},"
+      "  onLeave: function (retval) {}"
+      "});"
+      "var cb = new NativeCallback(function (a) { return a * 2; },"
+      "    'int', ['int']);"
+      "var f = new NativeFunction(cb, 'int', ['int']);"
+      "f(1);"
+      "f(2);"
+      "setInterval(function () {}, 60000);"
+      "recv('query', function () {"
+      "  var s = Script.getStatistics();"
+      "  var l = s.listeners[0];"
+      "  var n = s.nativeCallbacks[0];"
+      "  var t = s.timers[0];"
+      "  send([s.listeners.length, l.calls.toNumber(),"
+      "      l.maxTime.compare(l.totalTime) <= 0]);"
+      "  send([s.nativeCallbacks.length, n.address.equals(cb),"
+      "      n.calls.toNumber()]);"
+      "  send([s.timers.length, t.calls.toNumber()]);"
+      "});",
+      target_function_int);
+  EXPECT_NO_MESSAGES ();
+
+  target_function_int (7);
+  POST_MESSAGE ("{\"type\":\"query\"}");
+  EXPECT_SEND_MESSAGE_WITH ("[1,2,true]");
+  EXPECT_SEND_MESSAGE_WITH ("[1,true,2]");
+  EXPECT_SEND_MESSAGE_WITH ("[1,0]");
+  EXPECT_NO_MESSAGES ();
+}
+
+SCRIPT_TESTCASE (script_can_be_profiled)
+{
+  if (GUM_DUK_IS_SCRIPT_BACKEND (fixture->backend))
+  {
+    COMPILE_AND_LOAD_SCRIPT ("Script.startProfiling();");
+    EXPECT_ERROR_MESSAGE_WITH (ANY_LINE_NUMBER,
+        "Error: CPU profiling is only supported by the V8 runtime");
+    return;
+  }
+
+  COMPILE_AND_LOAD_SCRIPT (
+      "Script.startProfiling();"
+      "var x = 0;"
+      "for (var i = 0; i !== 100000; i++)"
+      "  x += i;"
+      "var p = JSON.parse(Script.stopProfiling());"
+      "send([p.nodes[0].callFrame.functionName,"
+      "    p.samples.length === p.timeDeltas.length,"
+      "    p.endTime >= p.startTime]);");
+  EXPECT_SEND_MESSAGE_WITH ("[\"(root)\",true,true]");
+
+  COMPILE_AND_LOAD_SCRIPT ("Script.stopProfiling();");
+  EXPECT_ERROR_MESSAGE_WITH (ANY_LINE_NUMBER, "Error: not profiling");
+}
+
 SCRIPT_TESTCASE (script_memory_usage)
 {
   GumScript * script;
@@ -5529,6 +6411,23 @@ on_script_message (GumScript * script,
   g_print ("Message from %s: %s\n", sender, message);
 }
 
+static void
+on_script_message_batch (GumScript * script,
+                         const GumScriptMessage * messages,
+                         guint n_messages,
+                         gpointer user_data)
+{
+  guint i;
+
+  g_assert_cmpuint (n_messages, ==, 3);
+
+  for (i = 0; i != n_messages; i++)
+  {
+    test_script_fixture_store_message (script, messages[i].message,
+        messages[i].data, user_data);
+  }
+}
+
 static void
 on_incoming_debug_message (GumInspectorServer * server,
                            const gchar * message,
@@ -5548,7 +6447,23 @@ on_outgoing_debug_message (const gchar * message,
   gum_inspector_server_post_message (server, message);
 }
 
-GUM_NOINLINE static int
+GUM_NOINLINE static void
+on_native_enter (GumInvocationContext * ic)
+{
+  gint * count = GUM_LINCTX_GET_FUNC_DATA (ic, gint *);
+
+  (*count)++;
+}
+
+static void
+on_native_leave (GumInvocationContext * ic)
+{
+  gint * count = GUM_LINCTX_GET_FUNC_DATA (ic, gint *);
+
+  *count += 10;
+}
+
+static int
 target_function_int (int arg)
 {
   int result = 0;
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "boundlistener.hpp"
+
+#include "testutil.h"
+
+G_BEGIN_DECLS
+
+#define GUMPP_TESTCASE(NAME) \
+  void test_gumpp_bound_listener_ ## NAME (void)
+#define GUMPP_TESTENTRY(NAME) \
+  TEST_ENTRY_SIMPLE ("Gum++/BoundListener", test_gumpp_bound_listener, NAME)
+
+TEST_LIST_BEGIN (gumpp_bound_listener)
+  GUMPP_TESTENTRY (enter_and_leave_are_invoked)
+  GUMPP_TESTENTRY (enter_only_leaves_leave_slot_empty)
+TEST_LIST_END ()
+
+gint gumpp_bound_target_function (GString * str, gint value);
+
+class BoundTestListener
+{
+public:
+  void on_enter (Gum::Invocation & invocation)
+  {
+    GString * str = invocation.get_nth_argument<GString *> (0);
+    g_string_append_printf (str, ">%d", invocation.get_nth_argument<gint> (1));
+
+    g_assert (invocation.get_listener_function_data<GString> () == str);
+  }
+
+  void on_leave (Gum::Invocation & invocation)
+  {
+    GString * str = invocation.get_listener_function_data<GString> ();
+    g_string_append_printf (str, "<%d", invocation.get_return_value<gint> ());
+  }
+};
+
+class BoundEnterOnlyListener
+{
+public:
+  BoundEnterOnlyListener () : calls (0) {}
+
+  void on_enter (Gum::Invocation & invocation)
+  {
+    calls++;
+  }
+
+  guint calls;
+};
+
+GUMPP_TESTCASE (enter_and_leave_are_invoked)
+{
+  Gum::RefPtr<Gum::Interceptor> interceptor (Gum::Interceptor_obtain ());
+  BoundTestListener target;
+  Gum::RefPtr<Gum::BoundListener<BoundTestListener> > listener (
+      Gum::BoundListener<BoundTestListener>::create (&target));
+
+  GString * output = g_string_new ("");
+  g_assert (Gum::attach_listener (interceptor.operator-> (),
+      reinterpret_cast<void *> (gumpp_bound_target_function),
+      listener.operator-> (), output));
+
+  gumpp_bound_target_function (output, 41);
+  g_assert_cmpstr (output->str, ==, ">41|<42");
+
+  Gum::detach_listener (interceptor.operator-> (), listener.operator-> ());
+
+  g_string_truncate (output, 0);
+  gumpp_bound_target_function (output, 41);
+  g_assert_cmpstr (output->str, ==, "|");
+
+  g_string_free (output, TRUE);
+}
+
+GUMPP_TESTCASE (enter_only_leaves_leave_slot_empty)
+{
+  Gum::RefPtr<Gum::Interceptor> interceptor (Gum::Interceptor_obtain ());
+  BoundEnterOnlyListener target;
+  Gum::RefPtr<Gum::BoundListener<BoundEnterOnlyListener> > listener (
+      Gum::BoundListener<BoundEnterOnlyListener>::create (&target));
+
+  GumInvocationListenerInterface * iface = GUM_INVOCATION_LISTENER_GET_IFACE (
+      listener->get_listener ());
+  g_assert (iface->on_enter != NULL);
+  g_assert (iface->on_leave == NULL);
+
+  GString * output = g_string_new ("");
+  Gum::attach_listener (interceptor.operator-> (),
+      reinterpret_cast<void *> (gumpp_bound_target_function),
+      listener.operator-> ());
+  gumpp_bound_target_function (output, 1);
+  gumpp_bound_target_function (output, 2);
+  g_assert_cmpuint (target.calls, ==, 2);
+  Gum::detach_listener (interceptor.operator-> (), listener.operator-> ());
+
+  g_string_free (output, TRUE);
+}
+
+gint GUM_NOINLINE
+gumpp_bound_target_function (GString * str,
+                             gint value)
+{
+  g_string_append_c (str, '|');
+
+  return value + 1;
+}
+
+G_END_DECLS
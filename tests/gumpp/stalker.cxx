@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "eventsink.hpp"
+
+#include "testutil.h"
+
+#include <vector>
+
+G_BEGIN_DECLS
+
+#define GUMPP_TESTCASE(NAME) \
+  void test_gumpp_stalker_ ## NAME (void)
+#define GUMPP_TESTENTRY(NAME) \
+  TEST_ENTRY_SIMPLE ("Gum++/Stalker", test_gumpp_stalker, NAME)
+
+TEST_LIST_BEGIN (gumpp_stalker)
+  GUMPP_TESTENTRY (events_are_delivered_in_batches)
+TEST_LIST_END ()
+
+gint gumpp_stalker_target_function (gint value);
+
+class BatchCollector
+{
+public:
+  BatchCollector () : num_events (0), num_calls (0) {}
+
+  void on_events (Gum::EventBuffer && events)
+  {
+    for (const GumEvent & ev : events.span ())
+    {
+      if (ev.type == GUM_CALL)
+        num_calls++;
+    }
+    num_events += events.size ();
+
+    if (kept.empty ())
+      kept.push_back (std::move (events));
+  }
+
+  size_t num_events;
+  size_t num_calls;
+  std::vector<Gum::EventBuffer> kept;
+};
+
+GUMPP_TESTCASE (events_are_delivered_in_batches)
+{
+  if (!gum_stalker_is_supported ())
+  {
+    g_print ("<skipping, no stalker support> ");
+    return;
+  }
+
+  Gum::RefPtr<Gum::Stalker> stalker (Gum::Stalker_new ());
+  BatchCollector collector;
+  Gum::RefPtr<Gum::BoundEventSink<BatchCollector> > sink (
+      Gum::BoundEventSink<BatchCollector>::create (&collector,
+          static_cast<GumEventType> (GUM_CALL | GUM_RET), 16));
+
+  gint result = 0;
+  Gum::follow_me (stalker.operator-> (), sink.operator-> ());
+  for (gint i = 0; i != 100; i++)
+    result += gumpp_stalker_target_function (i);
+  stalker->unfollow_me ();
+  g_assert_cmpint (result, !=, 0);
+
+  while (stalker->garbage_collect ())
+    g_usleep (10000);
+
+  g_assert_cmpuint (collector.num_calls, >=, 100);
+  g_assert_cmpuint (collector.kept.size (), ==, 1);
+  g_assert_cmpuint (collector.kept[0].size (), ==, 16);
+}
+
+gint GUM_NOINLINE
+gumpp_stalker_target_function (gint value)
+{
+  return (value * 31) + 7;
+}
+
+G_END_DECLS
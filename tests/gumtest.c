@@ -173,6 +173,11 @@ main (gint argc, gchar * argv[])
   TEST_RUN_LIST (testutil);
   TEST_RUN_LIST (tls);
   TEST_RUN_LIST (cloak);
+  TEST_RUN_LIST (exceptor);
+  TEST_RUN_LIST (log);
+  TEST_RUN_LIST (eventcodec);
+  TEST_RUN_LIST (metalmap);
+  TEST_RUN_LIST (sharedeventsink);
   TEST_RUN_LIST (memory);
   TEST_RUN_LIST (process);
 #if !defined (HAVE_QNX) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
@@ -202,12 +207,17 @@ main (gint argc, gchar * argv[])
 #endif
 #ifdef HAVE_ARM64
   TEST_RUN_LIST (interceptor_arm64);
+#endif
+  TEST_RUN_LIST (importhooker);
+#ifndef G_OS_WIN32
+  TEST_RUN_LIST (fork);
 #endif
 #ifdef HAVE_DARWIN
   TEST_RUN_LIST (exceptor_darwin);
 #endif
-#if defined (HAVE_I386) && defined (G_OS_WIN32)
+#if defined (HAVE_I386) && (defined (G_OS_WIN32) || defined (HAVE_LINUX))
   TEST_RUN_LIST (memoryaccessmonitor);
+  TEST_RUN_LIST (watchpointmonitor);
 #endif
 
   if (gum_stalker_is_supported ())
@@ -262,6 +272,7 @@ main (gint argc, gchar * argv[])
 #if !defined (HAVE_IOS) && !(defined (HAVE_ANDROID) && defined (HAVE_ARM64))
   TEST_RUN_LIST (sampler);
 #endif
+  TEST_RUN_LIST (sampling_profiler);
 #ifdef G_OS_WIN32
   TEST_RUN_LIST (profiler);
 #endif
@@ -304,6 +315,8 @@ main (gint argc, gchar * argv[])
 #if defined (HAVE_GUMPP) && defined (G_OS_WIN32)
   /* Gum++ */
   TEST_RUN_LIST (gumpp_backtracer);
+  TEST_RUN_LIST (gumpp_bound_listener);
+  TEST_RUN_LIST (gumpp_stalker);
 #endif
 
 #ifdef _MSC_VER
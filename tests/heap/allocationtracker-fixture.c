@@ -56,5 +56,9 @@ static const GumReturnAddress dummy_return_addresses_b[] =
   GUINT_TO_POINTER (0x4321),
 };
 
+static void append_to_string (gconstpointer data, gsize size,
+    gpointer user_data);
+static void discard_output (gconstpointer data, gsize size,
+    gpointer user_data);
 static gboolean filter_cb (GumAllocationTracker * tracker, gpointer address,
     guint size, gpointer user_data);
@@ -16,8 +16,10 @@ TEST_LIST_BEGIN (allocation_tracker)
   ALLOCTRACKER_TESTENTRY (block_list_sizes)
   ALLOCTRACKER_TESTENTRY (block_list_backtraces)
   ALLOCTRACKER_TESTENTRY (block_groups)
+  ALLOCTRACKER_TESTENTRY (site_profile_deltas)
 
   ALLOCTRACKER_TESTENTRY (filter_function)
+  ALLOCTRACKER_TESTENTRY (sampling_should_estimate_totals)
 
   ALLOCTRACKER_TESTENTRY (realloc_new_block)
   ALLOCTRACKER_TESTENTRY (realloc_unknown_block)
@@ -286,6 +288,70 @@ ALLOCTRACKER_TESTCASE (block_groups)
   gum_allocation_group_list_free (groups);
 }
 
+ALLOCTRACKER_TESTCASE (site_profile_deltas)
+{
+  GumBacktracer * backtracer;
+  GumAllocationTracker * t;
+  GString * output;
+
+  backtracer = gum_fake_backtracer_new (dummy_return_addresses_a,
+      G_N_ELEMENTS (dummy_return_addresses_a));
+  t = gum_allocation_tracker_new_with_backtracer (backtracer);
+
+  gum_allocation_tracker_begin (t);
+
+  gum_allocation_tracker_on_malloc (t, DUMMY_BLOCK_A, 42);
+  gum_allocation_tracker_on_malloc (t, DUMMY_BLOCK_B, 10);
+
+  GUM_FAKE_BACKTRACER (backtracer)->ret_addrs = dummy_return_addresses_b;
+  GUM_FAKE_BACKTRACER (backtracer)->num_ret_addrs =
+      G_N_ELEMENTS (dummy_return_addresses_b);
+
+  gum_allocation_tracker_on_malloc (t, DUMMY_BLOCK_C, 8);
+
+  output = g_string_new (NULL);
+  g_assert_cmpuint (gum_allocation_tracker_emit_site_profile (t, TRUE,
+      append_to_string, output), ==, 2);
+  g_assert_cmpuint (output->len, >, 0);
+  g_assert_cmphex ((guint8) output->str[0], ==, 0x0a);
+  g_string_free (output, TRUE);
+
+  gum_allocation_tracker_on_free (t, DUMMY_BLOCK_C);
+
+  g_assert_cmpuint (gum_allocation_tracker_emit_site_profile (t, TRUE,
+      discard_output, NULL), ==, 2);
+  g_assert_cmpuint (gum_allocation_tracker_emit_site_profile (t, TRUE,
+      discard_output, NULL), ==, 1);
+  g_assert_cmpuint (gum_allocation_tracker_emit_site_profile (t, FALSE,
+      discard_output, NULL), ==, 1);
+
+  gum_allocation_tracker_on_free (t, DUMMY_BLOCK_A);
+  gum_allocation_tracker_on_free (t, DUMMY_BLOCK_B);
+
+  g_assert_cmpuint (gum_allocation_tracker_emit_site_profile (t, TRUE,
+      discard_output, NULL), ==, 1);
+  g_assert_cmpuint (gum_allocation_tracker_emit_site_profile (t, TRUE,
+      discard_output, NULL), ==, 0);
+
+  g_object_unref (t);
+  g_object_unref (backtracer);
+}
+
+static void
+append_to_string (gconstpointer data,
+                  gsize size,
+                  gpointer user_data)
+{
+  g_string_append_len ((GString *) user_data, data, size);
+}
+
+static void
+discard_output (gconstpointer data,
+                gsize size,
+                gpointer user_data)
+{
+}
+
 ALLOCTRACKER_TESTCASE (filter_function)
 {
   GumBacktracer * backtracer;
@@ -329,6 +395,45 @@ filter_cb (GumAllocationTracker * tracker,
   return (size == 1337);
 }
 
+ALLOCTRACKER_TESTCASE (sampling_should_estimate_totals)
+{
+  GumAllocationTracker * t = fixture->tracker;
+  const guint n = 10000;
+  guint i, count;
+  GList * blocks, * groups;
+
+  gum_allocation_tracker_set_sample_interval (t, 4096);
+  gum_allocation_tracker_begin (t);
+
+  for (i = 0; i != n; i++)
+  {
+    gum_allocation_tracker_on_malloc (t, GUINT_TO_POINTER (0x1000 + i * 64),
+        64);
+  }
+
+  count = gum_allocation_tracker_peek_block_count (t);
+  g_assert_cmpuint (count, >, n / 2);
+  g_assert_cmpuint (count, <, n * 2);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), ==,
+      count * 64);
+
+  blocks = gum_allocation_tracker_peek_block_list (t);
+  g_assert_cmpuint (g_list_length (blocks), <, n / 10);
+  gum_allocation_block_list_free (blocks);
+
+  groups = gum_allocation_tracker_peek_block_groups (t);
+  g_assert_cmpuint (g_list_length (groups), ==, 1);
+  g_assert_cmpuint (((GumAllocationGroup *) groups->data)->alive_now, ==,
+      count);
+  gum_allocation_group_list_free (groups);
+
+  for (i = 0; i != n; i++)
+    gum_allocation_tracker_on_free (t, GUINT_TO_POINTER (0x1000 + i * 64));
+
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_count (t), ==, 0);
+  g_assert_cmpuint (gum_allocation_tracker_peek_block_total_size (t), ==, 0);
+}
+
 ALLOCTRACKER_TESTCASE (realloc_new_block)
 {
   GumAllocationTracker * t = fixture->tracker;
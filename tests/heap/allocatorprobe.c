@@ -16,9 +16,13 @@ TEST_LIST_BEGIN (allocator_probe)
   ALLOCPROBE_TESTENTRY (nonstandard_ignored)
 #endif
   ALLOCPROBE_TESTENTRY (full_cycle)
+  ALLOCPROBE_TESTENTRY (nested_apis_counted_once)
   ALLOCPROBE_TESTENTRY (gtype_interop)
 TEST_LIST_END ()
 
+static gpointer test_mallocx (gsize size, gint flags);
+static void test_sdallocx (gpointer address, gsize size, gint flags);
+
 ALLOCPROBE_TESTCASE (basics)
 {
   guint malloc_count, realloc_count, free_count;
@@ -153,6 +157,56 @@ ALLOCPROBE_TESTCASE (full_cycle)
   g_object_unref (t);
 }
 
+ALLOCPROBE_TESTCASE (nested_apis_counted_once)
+{
+  guint malloc_count, realloc_count, free_count;
+  GumHeapApi api;
+  GumHeapApiList * apis;
+  gpointer (* volatile do_mallocx) (gsize size, gint flags) = test_mallocx;
+  void (* volatile do_sdallocx) (gpointer address, gsize size, gint flags) =
+      test_sdallocx;
+  gpointer a;
+
+  api = *gum_heap_api_list_get_nth (test_util_heap_apis (), 0);
+  api.mallocx = test_mallocx;
+  api.sdallocx = test_sdallocx;
+
+  apis = gum_heap_api_list_new ();
+  gum_heap_api_list_add (apis, &api);
+  gum_heap_api_list_add (apis, &api);
+
+  g_object_set (fixture->ap, "enable-counters", TRUE, NULL);
+  gum_allocator_probe_attach_to_apis (fixture->ap, apis);
+
+  a = do_mallocx (42, 0);
+  READ_PROBE_COUNTERS ();
+  g_assert_cmpuint (malloc_count, ==, 1);
+  g_assert_cmpuint (free_count, ==, 0);
+
+  do_sdallocx (a, 42, 0);
+  READ_PROBE_COUNTERS ();
+  g_assert_cmpuint (malloc_count, ==, 1);
+  g_assert_cmpuint (free_count, ==, 1);
+
+  DETACH_PROBE ();
+  gum_heap_api_list_free (apis);
+}
+
+GUM_NOINLINE static gpointer
+test_mallocx (gsize size,
+              gint flags)
+{
+  return malloc (size);
+}
+
+GUM_NOINLINE static void
+test_sdallocx (gpointer address,
+               gsize size,
+               gint flags)
+{
+  free (address);
+}
+
 /*
  * Turns out that doing any GType lookups from within the context where
  * malloc() or similar is being called can be dangerous, as the caller
@@ -17,6 +17,7 @@ TEST_LIST_BEGIN (boundschecker)
   BOUNDSCHECKER_TESTENTRY (protected_after_free)
   BOUNDSCHECKER_TESTENTRY (calloc_initializes_to_zero)
   BOUNDSCHECKER_TESTENTRY (custom_front_alignment)
+  BOUNDSCHECKER_TESTENTRY (sampling_guards_some_allocations)
 #ifndef HAVE_QNX
   BOUNDSCHECKER_TESTENTRY (output_report_on_access_beyond_end)
   BOUNDSCHECKER_TESTENTRY (output_report_on_access_after_free)
@@ -228,3 +229,27 @@ BOUNDSCHECKER_TESTCASE (custom_front_alignment)
 
   g_assert (exception_on_read && exception_on_write);
 }
+
+BOUNDSCHECKER_TESTCASE (sampling_guards_some_allocations)
+{
+  guint8 * blocks[64];
+  guint n_guarded, i;
+
+  g_object_set (fixture->checker, "sample-rate", 4, NULL);
+
+  ATTACH_CHECKER ();
+  for (i = 0; i != G_N_ELEMENTS (blocks); i++)
+    blocks[i] = (guint8 *) malloc (16);
+  n_guarded = 0;
+  for (i = 0; i != G_N_ELEMENTS (blocks); i++)
+  {
+    if (!gum_memory_is_readable (GUM_ADDRESS (blocks[i] + 16), 1))
+      n_guarded++;
+  }
+  for (i = 0; i != G_N_ELEMENTS (blocks); i++)
+    free (blocks[i]);
+  DETACH_CHECKER ();
+
+  g_assert_cmpuint (n_guarded, >=, G_N_ELEMENTS (blocks) / 8);
+  g_assert_cmpuint (n_guarded, <, G_N_ELEMENTS (blocks));
+}
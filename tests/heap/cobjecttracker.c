@@ -12,6 +12,7 @@ TEST_LIST_BEGIN (cobjecttracker)
   COBJTRACKER_TESTENTRY (total_count_increase)
   COBJTRACKER_TESTENTRY (total_count_decrease)
   COBJTRACKER_TESTENTRY (object_list)
+  COBJTRACKER_TESTENTRY (object_list_between_snapshots)
 TEST_LIST_END ()
 
 COBJTRACKER_TESTCASE (total_count_increase)
@@ -111,4 +112,31 @@ COBJTRACKER_TESTCASE (object_list)
   gum_cobject_list_free (cobjects);
 }
 
+COBJTRACKER_TESTCASE (object_list_between_snapshots)
+{
+  GumCObjectTracker * t = fixture->tracker;
+  guint first, second;
+  GList * cobjects;
+  GumCObject * cobject;
+
+  fixture->ht1 = g_hash_table_new (NULL, NULL);
+  first = gum_cobject_tracker_take_snapshot (t);
+
+  fixture->ht2 = g_hash_table_new (NULL, NULL);
+  fixture->mo = my_object_new ();
+  second = gum_cobject_tracker_take_snapshot (t);
+
+  g_hash_table_unref (fixture->ht2); fixture->ht2 = NULL;
+
+  cobjects = gum_cobject_tracker_peek_object_list_between (t, first, second);
+  g_assert_cmpint (g_list_length (cobjects), ==, 1);
+  cobject = cobjects->data;
+  g_assert (cobject->address == fixture->mo);
+  g_assert_cmpstr (cobject->type_name, ==, "MyObject");
+  g_assert_cmpuint (cobject->return_addresses.len, ==, 0);
+  gum_cobject_list_free (cobjects);
+
+  g_assert_cmpuint (gum_cobject_tracker_peek_total_count (t, NULL), ==, 2);
+}
+
 #endif /* G_OS_WIN32 */
@@ -17,6 +17,7 @@ TEST_LIST_BEGIN (instancetracker)
   INSTRACKER_TESTENTRY (ignore_other_trackers)
   INSTRACKER_TESTENTRY (peek_instances)
   INSTRACKER_TESTENTRY (walk_instances)
+  INSTRACKER_TESTENTRY (walk_instances_between_snapshots)
   INSTRACKER_TESTENTRY (avoid_heap)
 TEST_LIST_END ()
 
@@ -219,6 +220,41 @@ INSTRACKER_TESTCASE (walk_instances)
   g_list_free (ctx.expected_instances);
 }
 
+INSTRACKER_TESTCASE (walk_instances_between_snapshots)
+{
+  GumInstanceTracker * t = fixture->tracker;
+  WalkInstancesContext ctx;
+  MyPony * pony1, * pony2, * pony3;
+  guint first, second;
+
+  ctx.call_count = 0;
+  ctx.expected_instances = NULL;
+
+  pony1 = g_object_new (MY_TYPE_PONY, NULL);
+  first = gum_instance_tracker_take_snapshot (t);
+
+  pony2 = g_object_new (MY_TYPE_PONY, NULL);
+  ctx.expected_instances = g_list_prepend (ctx.expected_instances, pony2);
+  pony3 = g_object_new (MY_TYPE_PONY, NULL);
+  ctx.expected_instances = g_list_prepend (ctx.expected_instances, pony3);
+  second = gum_instance_tracker_take_snapshot (t);
+
+  g_object_unref (pony2);
+  ctx.expected_instances = g_list_remove (ctx.expected_instances, pony2);
+  g_object_unref (pony1);
+  pony1 = g_object_new (MY_TYPE_PONY, NULL);
+
+  g_test_message ("Only pony3 was created between the snapshots and survived");
+  gum_instance_tracker_walk_instances_between (t, first, second,
+      walk_instance, &ctx);
+  g_assert_cmpuint (ctx.call_count, ==, 1);
+
+  g_object_unref (pony1);
+  g_object_unref (pony3);
+
+  g_list_free (ctx.expected_instances);
+}
+
 INSTRACKER_TESTCASE (avoid_heap)
 {
   GumInstanceTracker * t = fixture->tracker;
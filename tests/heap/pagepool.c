@@ -15,6 +15,7 @@ TEST_LIST_BEGIN (pagepool)
   PAGEPOOL_TESTENTRY (query_block_details)
   PAGEPOOL_TESTENTRY (peek_used)
   PAGEPOOL_TESTENTRY (alloc_and_fill_full_cycle)
+  PAGEPOOL_TESTENTRY (grow_up_to_max_size)
 TEST_LIST_END ()
 
 PAGEPOOL_TESTCASE (alloc_sizes)
@@ -214,3 +215,35 @@ PAGEPOOL_TESTCASE (alloc_and_fill_full_cycle)
 
   memset (p, 0, buffer_size);
 }
+
+PAGEPOOL_TESTCASE (grow_up_to_max_size)
+{
+  GumPagePool * pool;
+  GumBlockDetails details;
+  gpointer p1, p2, p3;
+
+  SETUP_POOL (&pool, GUM_PROTECT_MODE_ABOVE, 2);
+  g_object_set (pool, "max-size", 4, NULL);
+
+  p1 = gum_page_pool_try_alloc (pool, 1);
+  g_assert (p1 != NULL);
+  g_assert_cmpuint (gum_page_pool_peek_available (pool), ==, 0);
+
+  p2 = gum_page_pool_try_alloc (pool, 1);
+  g_assert (p2 != NULL);
+  g_assert_cmpuint (gum_page_pool_peek_used (pool), ==, 4);
+  g_assert (gum_memory_is_readable (GUM_ADDRESS (p2), 16));
+  g_assert (!gum_memory_is_readable (GUM_ADDRESS (p2) + 16, 1));
+
+  p3 = gum_page_pool_try_alloc (pool, 1);
+  g_assert (p3 == NULL);
+
+  g_assert (gum_page_pool_query_block_details (pool, p2, &details));
+  g_assert_cmphex (GPOINTER_TO_SIZE (details.address),
+      ==, GPOINTER_TO_SIZE (p2));
+  g_assert (details.allocated);
+
+  g_assert (gum_page_pool_try_free (pool, p2));
+  g_assert (gum_page_pool_try_free (pool, p1));
+  g_assert_cmpuint (gum_page_pool_peek_used (pool), ==, 0);
+}
@@ -16,6 +16,7 @@ TEST_LIST_BEGIN (sanitychecker)
   SANITYCHECKER_TESTENTRY (array_access_out_of_bounds_causes_exception)
   SANITYCHECKER_TESTENTRY (multiple_checks_at_once_should_not_collide)
   SANITYCHECKER_TESTENTRY (checker_itself_does_not_leak)
+  SANITYCHECKER_TESTENTRY (step_check_while_running)
 TEST_LIST_END ()
 
 SANITYCHECKER_TESTCASE (no_leaks)
@@ -129,4 +130,39 @@ SANITYCHECKER_TESTCASE (checker_itself_does_not_leak)
   gum_sanity_checker_destroy (checker);
 }
 
+SANITYCHECKER_TESTCASE (step_check_while_running)
+{
+  GumSanityChecker * checker = fixture->checker;
+  GumSanityCheckStatus status;
+  gpointer block;
+  guint steps;
+
+  gum_sanity_checker_begin (checker, GUM_CHECK_BLOCK_LEAKS);
+
+  block = malloc (5);
+
+  steps = 0;
+  do
+  {
+    status = gum_sanity_checker_check_step (checker, 1);
+    steps++;
+  }
+  while (status == GUM_SANITY_CHECK_IN_PROGRESS);
+  g_assert_cmpint (status, ==, GUM_SANITY_CHECK_FAILED);
+  g_assert_cmpuint (steps, >, 1);
+  g_assert (g_str_has_prefix (fixture->output->str,
+      "Block leaks detected:\n"));
+
+  free (block);
+  g_string_truncate (fixture->output, 0);
+
+  do
+    status = gum_sanity_checker_check_step (checker, 1);
+  while (status == GUM_SANITY_CHECK_IN_PROGRESS);
+  g_assert_cmpint (status, ==, GUM_SANITY_CHECK_PASSED);
+  g_assert_cmpuint (fixture->output->len, ==, 0);
+
+  g_assert (gum_sanity_checker_end (checker));
+}
+
 #endif /* G_OS_WIN32 */
@@ -189,6 +189,28 @@ assert_same_xml (TestProfileReportFixture * fixture,
   g_free (generated_xml);
 }
 
+static void
+append_output (gconstpointer data,
+               gsize size,
+               gpointer user_data)
+{
+  GString * output = user_data;
+
+  g_string_append_len (output, data, size);
+}
+
+static GString *
+export_profile (TestProfileReportFixture * fixture,
+                GumProfileFormat format)
+{
+  GString * output;
+
+  output = g_string_new ("");
+  gum_profiler_export (fixture->profiler, format, append_output, output);
+
+  return output;
+}
+
 /*
  * Guinea pig functions:
  */
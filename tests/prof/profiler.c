@@ -17,6 +17,7 @@ TEST_LIST_BEGIN (profiler)
 
   PROFILER_TESTENTRY (flat_function)
   PROFILER_TESTENTRY (two_calls)
+  PROFILER_TESTENTRY (many_threads)
   PROFILER_TESTENTRY (profile_matching_functions)
   PROFILER_TESTENTRY (recursion)
   PROFILER_TESTENTRY (deep_recursion)
@@ -34,6 +35,9 @@ TEST_LIST_BEGIN (profiler)
   PROFILEREPORT_TESTENTRY (xml_multiple_threads)
   PROFILEREPORT_TESTENTRY (xml_worst_case_info)
   PROFILEREPORT_TESTENTRY (xml_thread_ordering)
+  PROFILEREPORT_TESTENTRY (collapsed_stacks)
+  PROFILEREPORT_TESTENTRY (collapsed_stacks_multiple_threads)
+  PROFILEREPORT_TESTENTRY (pprof)
 TEST_LIST_END ()
 
 #ifdef HAVE_I386
@@ -99,6 +103,28 @@ PROFILER_TESTCASE (two_calls)
       &sleepy_function), ==, 2 * 1000);
 }
 
+PROFILER_TESTCASE (many_threads)
+{
+  GumProfiler * prof = fixture->profiler;
+  const guint n = 64;
+  guint i;
+
+  gum_profiler_instrument_function (prof, &sleepy_function, fixture->sampler);
+
+  for (i = 0; i != n; i++)
+  {
+    g_thread_join (g_thread_new ("profiler-test-many-threads",
+        (GThreadFunc) sleepy_function, fixture->fake_sampler));
+  }
+
+  g_assert_cmpuint (gum_profiler_get_total_duration_of (prof, 0,
+      &sleepy_function), ==, 1000);
+  g_assert_cmpuint (gum_profiler_get_total_duration_of (prof, n - 1,
+      &sleepy_function), ==, 1000);
+  g_assert_cmpuint (gum_profiler_get_total_duration_of (prof, n,
+      &sleepy_function), ==, 0);
+}
+
 PROFILEREPORT_TESTCASE (bottleneck)
 {
   instrument_example_functions (fixture);
@@ -287,6 +313,58 @@ PROFILEREPORT_TESTCASE (xml_thread_ordering)
       "</ProfileReport>");
 }
 
+PROFILEREPORT_TESTCASE (collapsed_stacks)
+{
+  GString * output;
+
+  instrument_example_functions (fixture);
+
+  example_a (fixture->fake_sampler);
+
+  output = export_profile (fixture, GUM_PROFILE_FORMAT_COLLAPSED_STACKS);
+  g_assert_cmpstr (output->str, ==,
+      "example_a 5\n"
+      "example_a;example_c 4\n");
+  g_string_free (output, TRUE);
+}
+
+PROFILEREPORT_TESTCASE (collapsed_stacks_multiple_threads)
+{
+  GString * output;
+
+  instrument_example_functions (fixture);
+
+  example_a (fixture->fake_sampler);
+  g_thread_join (g_thread_new ("profiler-test-multiple-threads",
+      (GThreadFunc) example_d, fixture->fake_sampler));
+  g_thread_join (g_thread_new ("profiler-test-multiple-threads",
+      (GThreadFunc) example_a, fixture->fake_sampler));
+
+  output = export_profile (fixture, GUM_PROFILE_FORMAT_COLLAPSED_STACKS);
+  g_assert_cmpstr (output->str, ==,
+      "example_a 10\n"
+      "example_a;example_c 8\n"
+      "example_d 7\n"
+      "example_d;example_c 4\n");
+  g_string_free (output, TRUE);
+}
+
+PROFILEREPORT_TESTCASE (pprof)
+{
+  GString * output;
+
+  instrument_example_functions (fixture);
+
+  example_a (fixture->fake_sampler);
+
+  output = export_profile (fixture, GUM_PROFILE_FORMAT_PPROF);
+  g_assert_cmpuint (output->len, >, 11);
+  g_assert_cmphex ((guint8) output->str[0], ==, 0x0a);
+  g_assert_cmpint (memcmp (output->str + output->len - 11,
+      "\x32\x09" "example_c", 11), ==, 0);
+  g_string_free (output, TRUE);
+}
+
 PROFILER_TESTCASE (profile_matching_functions)
 {
   gum_profiler_instrument_functions_matching (fixture->profiler, "simple_*",
@@ -12,7 +12,10 @@ TEST_LIST_BEGIN (sampler)
   SAMPLER_TESTENTRY (busy_cycle)
   SAMPLER_TESTENTRY (malloc_count)
   SAMPLER_TESTENTRY (multiple_call_counters)
+  SAMPLER_TESTENTRY (call_counter_with_nested_calls)
   SAMPLER_TESTENTRY (wallclock)
+  SAMPLER_TESTENTRY (timestamp)
+  SAMPLER_TESTENTRY (perf_event_instructions)
 TEST_LIST_END ()
 
 static void spin_for_one_tenth_second (void);
@@ -131,6 +134,22 @@ SAMPLER_TESTCASE (multiple_call_counters)
   g_object_unref (sampler1);
 }
 
+SAMPLER_TESTCASE (call_counter_with_nested_calls)
+{
+  GumCallCountSampler * sampler;
+
+  sampler = g_object_new (GUM_TYPE_CALL_COUNT_SAMPLER, NULL);
+  fixture->sampler = GUM_SAMPLER (sampler);
+  gum_call_count_sampler_set_count_nested_calls (sampler, TRUE);
+  gum_call_count_sampler_add_function (sampler, nop_function_a);
+
+  nop_function_a ();
+  nop_function_a ();
+
+  g_assert_cmpint (gum_sampler_sample (fixture->sampler), ==, 2);
+  g_assert_cmpint (gum_call_count_sampler_peek_total_count (sampler), ==, 2);
+}
+
 SAMPLER_TESTCASE (wallclock)
 {
   GumSample sample_a, sample_b;
@@ -144,6 +163,46 @@ SAMPLER_TESTCASE (wallclock)
   g_assert_cmpuint (sample_b, >, sample_a);
 }
 
+SAMPLER_TESTCASE (timestamp)
+{
+  GumSample sample_a, sample_b;
+
+  fixture->sampler = gum_timestamp_sampler_new ();
+
+  sample_a = gum_sampler_sample (fixture->sampler);
+  g_usleep (G_USEC_PER_SEC / 30);
+  sample_b = gum_sampler_sample (fixture->sampler);
+
+  g_assert_cmpuint (sample_b - sample_a, >=, 20 * G_TIME_SPAN_MILLISECOND *
+      1000);
+}
+
+SAMPLER_TESTCASE (perf_event_instructions)
+{
+  GumSample spin_start, spin_diff;
+  GumSample sleep_start, sleep_diff;
+
+  fixture->sampler = gum_perf_event_sampler_new (GUM_PERF_EVENT_INSTRUCTIONS);
+
+  if (gum_perf_event_sampler_is_available (
+      GUM_PERF_EVENT_SAMPLER (fixture->sampler)))
+  {
+    spin_start = gum_sampler_sample (fixture->sampler);
+    spin_for_one_tenth_second ();
+    spin_diff = gum_sampler_sample (fixture->sampler) - spin_start;
+
+    sleep_start = gum_sampler_sample (fixture->sampler);
+    g_usleep (G_USEC_PER_SEC / 10);
+    sleep_diff = gum_sampler_sample (fixture->sampler) - sleep_start;
+
+    g_assert_cmpuint (spin_diff, >, sleep_diff);
+  }
+  else
+  {
+    g_test_message ("skipping test because perf events are unavailable");
+  }
+}
+
 static void
 spin_for_one_tenth_second (void)
 {
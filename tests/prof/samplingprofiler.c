@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2018 Ole André Vadla Ravnås <oleavr@nowsecure.com>
+ *
+ * Licence: wxWindows Library Licence, Version 3.1
+ */
+
+#include "gumsamplingprofiler.h"
+
+#include "testutil.h"
+
+#define SAMPLINGPROFILER_TESTCASE(NAME) \
+    void test_sampling_profiler_ ## NAME (void)
+#define SAMPLINGPROFILER_TESTENTRY(NAME) \
+    TEST_ENTRY_SIMPLE ("Prof/SamplingProfiler", test_sampling_profiler, NAME)
+
+TEST_LIST_BEGIN (sampling_profiler)
+  SAMPLINGPROFILER_TESTENTRY (busy_thread_should_be_sampled)
+TEST_LIST_END ()
+
+static gboolean count_hot_function (const GumHotFunctionDetails * details,
+    gpointer user_data);
+static void GUM_NOINLINE spin_for_one_fifth_second (void);
+
+SAMPLINGPROFILER_TESTCASE (busy_thread_should_be_sampled)
+{
+  GumSamplingProfiler * profiler;
+  guint n = 0;
+
+  profiler = gum_sampling_profiler_new ();
+  gum_sampling_profiler_set_interval (profiler, 1000);
+
+  gum_sampling_profiler_start (profiler);
+  spin_for_one_fifth_second ();
+  gum_sampling_profiler_stop (profiler);
+
+  g_assert_cmpuint (gum_sampling_profiler_get_total_samples (profiler), >, 0);
+
+  gum_sampling_profiler_enumerate_hot_functions (profiler, count_hot_function,
+      &n);
+  g_assert_cmpuint (n, >, 0);
+
+  g_object_unref (profiler);
+}
+
+static gboolean
+count_hot_function (const GumHotFunctionDetails * details,
+                    gpointer user_data)
+{
+  guint * n = user_data;
+
+  g_assert (details->name != NULL);
+  g_assert_cmpuint (details->total_samples, >=, details->self_samples);
+
+  (*n)++;
+
+  return TRUE;
+}
+
+static void GUM_NOINLINE
+spin_for_one_fifth_second (void)
+{
+  GTimer * timer;
+  guint i;
+  volatile guint b = 0;
+
+  timer = g_timer_new ();
+
+  do
+  {
+    for (i = 0; i != 1000000; i++)
+      b += i * i;
+  }
+  while (g_timer_elapsed (timer, NULL) < 0.2);
+
+  g_timer_destroy (timer);
+}